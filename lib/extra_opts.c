@@ -24,6 +24,7 @@
 #include "utils_base.h"
 #include "parse_ini.h"
 #include "extra_opts.h"
+#include "utils_output.h"
 
 /* FIXME: copied from utils.h; we should move a bunch of libs! */
 int
@@ -46,7 +47,7 @@ char **np_extra_opts(int *argc, char **argv, const char *plugin_name){
 
 	if(*argc<2) {
 		/* No arguments provided */
-		return argv;
+		return np_output_opts(argc, argv);
 	}
 
 	for(i=1; i<*argc; i++){
@@ -108,7 +109,7 @@ char **np_extra_opts(int *argc, char **argv, const char *plugin_name){
 
 	if(ea_num==*argc && extra_args==NULL){
 		/* No extra-opts */
-		return argv;
+		return np_output_opts(argc, argv);
 	}
 
 	/* done processing arguments. now create a new argv array... */
@@ -131,6 +132,7 @@ char **np_extra_opts(int *argc, char **argv, const char *plugin_name){
 	/* and terminate. */
 	argv_new[argc_new]=NULL;
 
-	return argv_new;
+	/* and --output-format, wherever it came from */
+	return np_output_opts(argc, argv_new);
 }
 
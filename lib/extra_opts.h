@@ -14,6 +14,8 @@
  * always removed from **argv. The original pointers from **argv are kept in
  * the new array to preserve ability to overwrite arguments in processlist.
  *
+ * --output-format is then taken out of it as np_output_opts() does.
+ *
  * The new array can be easily freed as long as a pointer to the original one
  * is kept. See my_free() in lib/tests/test_opts1.c for an example.
  */
@@ -30,6 +30,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
 
 /* np_ini_info contains the result of parsing a "locator" in the format
  * [stanza_name][@config_filename] (check_foo@/etc/foo.ini, for example)
@@ -66,13 +70,56 @@ static char *default_ini_path_names[] = {
 	NULL
 };
 
-/* eat all characters from a FILE pointer until n is encountered */
-#define GOBBLE_TO(f, c, n) do { (c)=fgetc((f)); } while((c)!=EOF && (c)!=(n))
+/* The section index: a compiled map of section name to the offsets of its
+ * bodies, cached per INI file under the state directory so that
+ * --extra-opts does not parse a large file from the top on every start.
+ * It is keyed on the device and inode of the INI file and is stale as soon
+ * as its size, mtime or ctime change, in which case it is rebuilt and
+ * renamed into place. Files the index cannot describe exactly (anything
+ * the parser below would reject) are simply not indexed. */
+#define NP_INI_INDEX_MAGIC "NPINIIX1"
+#define NP_INI_INDEX_DIR "extra-opts"
+
+typedef struct {
+	char magic[8];
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime;
+	int64_t ctime;
+	uint32_t buckets;
+	uint32_t entries;
+	uint32_t strings;
+	uint32_t pad;
+} np_ini_index_header;
+
+typedef struct {
+	uint32_t hash;
+	uint32_t next;		/* next entry in the bucket + 1, 0 ends it */
+	uint32_t name;		/* offset into the string table */
+	uint32_t name_len;
+	uint64_t offset;	/* start of the section body in the INI file */
+} np_ini_index_entry;
+
+/* the INI file in memory, from a mapping where possible */
+typedef struct {
+	const char *data;
+	size_t len;
+	void *map;
+	size_t map_len;
+	char *buf;
+} np_ini_text;
 
 /* internal function that returns the constructed defaults options */
 static int read_defaults(FILE *f, const char *stanza, np_arg_list **opts);
+/* internal functions that use the section index, if there is one */
+static int read_defaults_indexed(FILE *f, const struct stat *st, const char *stanza, np_arg_list **opts);
+/* internal functions that hold the file in memory and parse it there */
+static void ini_text_load(FILE *f, np_ini_text *t);
+static void ini_text_free(np_ini_text *t);
+static int parse_defaults(const char *p, const char *end, const char *stanza, np_arg_list **opts);
 /* internal function that converts a single line into options format */
-static int add_option(FILE *f, np_arg_list **optlst);
+static const char *add_option(const char *p, const char *end, np_arg_list ***tail);
 /* internal functions to find default file */
 static char* default_file(void);
 static char* default_file_in_path(void);
@@ -104,8 +151,7 @@ static void parse_locator(const char *locator, const char *def_stanza, np_ini_in
 	/* if there is no @file part */
 	if(stanza_len==locator_len){
 		dflt=default_file();
-		if (dflt)
-			i->file=strdup(dflt);
+		i->file=dflt ? strdup(dflt) : NULL;
 	} else {
 		i->file=strdup(&(locator[stanza_len+1]));
 	}
@@ -119,8 +165,9 @@ np_arg_list* np_get_defaults(const char *locator, const char *default_section){
 	FILE *inifile=NULL;
 	np_arg_list *defaults=NULL;
 	np_ini_info i;
-	struct stat fstat;
+	struct stat ini_stat;
 	bool is_suid_set = np_suid();
+	int status;
 
 	if (is_suid_set && idpriv_temp_drop() == -1) 
 		die(STATE_UNKNOWN, "%s %s\n", _("Can't drop user permissions."), strerror(errno));
@@ -132,10 +179,10 @@ np_arg_list* np_get_defaults(const char *locator, const char *default_section){
 			inifile = stdin;
 		} else {
 			/* We must be able to stat() the thing. */
-			if (lstat(i.file, &fstat) != 0)
+			if (lstat(i.file, &ini_stat) != 0)
 				die(STATE_UNKNOWN, "%s %s\n", _("Can't read config file."), strerror(errno));
 			/* The requested file must be a regular file. */
-			if (!S_ISREG(fstat.st_mode))
+			if (!S_ISREG(ini_stat.st_mode))
 				die(STATE_UNKNOWN, "%s\n", _("Can't read config file. Requested path is not a regular file."));
 			/* We must be able to read the requested file. */
 			if (access(i.file, R_OK|F_OK) != 0)
@@ -149,7 +196,12 @@ np_arg_list* np_get_defaults(const char *locator, const char *default_section){
 		if (inifile == NULL)
 			die(STATE_UNKNOWN, "%s %s\n", _("Can't read config file:"), strerror(errno));
 		/* inifile points to an open FILE our ruid/rgid can access, parse its contents. */
-		if (read_defaults(inifile, i.stanza, &defaults) == FALSE)
+		status = -1;
+		if (inifile != stdin && !is_suid_set && fstat(fileno(inifile), &ini_stat) == 0)
+			status = read_defaults_indexed(inifile, &ini_stat, i.stanza, &defaults);
+		if (status == -1)
+			status = read_defaults(inifile, i.stanza, &defaults);
+		if (status == FALSE)
 			die(STATE_UNKNOWN,"%s%s%s%s'\n", _("Invalid section '"), i.stanza, _("' in config file '"), i.file);
 		if (inifile != stdin) fclose(inifile);
 	}
@@ -176,41 +228,107 @@ np_arg_list* np_get_defaults(const char *locator, const char *default_section){
  * format string vulnerabilities, etc)
  */
 static int read_defaults(FILE *f, const char *stanza, np_arg_list **opts){
-	int c, status=FALSE;
-	size_t i, stanza_len;
-	enum { NOSTANZA, WRONGSTANZA, RIGHTSTANZA } stanzastate=NOSTANZA;
+	np_ini_text t;
+	int status;
+
+	ini_text_load(f, &t);
+	status=parse_defaults(t.data, t.data+t.len, stanza, opts);
+	ini_text_free(&t);
+	return status;
+}
+
+/* Map the file, or read it in large blocks where it cannot be mapped
+ * (stdin, a pipe), so that it is parsed by scanning memory rather than a
+ * character at a time through stdio. */
+static void ini_text_load(FILE *f, np_ini_text *t){
+	struct stat st;
+	size_t sz=0, n;
+
+	memset(t, 0, sizeof(*t));
+	t->data="";
+#ifdef HAVE_SYS_MMAN_H
+	if(fstat(fileno(f), &st)==0 && S_ISREG(st.st_mode) && st.st_size>0 &&
+	   (off_t)(size_t)st.st_size==st.st_size){
+		t->map=mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+		if(t->map!=MAP_FAILED){
+			t->map_len=(size_t)st.st_size;
+			t->data=t->map;
+			t->len=t->map_len;
+			return;
+		}
+		t->map=NULL;
+	}
+#endif
+	for(;;){
+		if(t->len==sz){
+			sz=sz ? sz<<1 : 65536;
+			if((t->buf=realloc(t->buf, sz))==NULL)
+				die(STATE_UNKNOWN, "%s\n", _("malloc() failed!"));
+		}
+		if((n=fread(t->buf+t->len, 1, sz-t->len, f))==0)
+			break;
+		t->len+=n;
+	}
+	if(ferror(f))
+		die(STATE_UNKNOWN, "%s %s\n", _("Can't read config file."), strerror(errno));
+	if(t->buf)
+		t->data=t->buf;
+}
+
+static void ini_text_free(np_ini_text *t){
+#ifdef HAVE_SYS_MMAN_H
+	if(t->map) munmap(t->map, t->map_len);
+#endif
+	free(t->buf);
+}
+
+/* where the next line starts */
+static const char *ini_next_line(const char *p, const char *end){
+	const char *nl=memchr(p, '\n', (size_t)(end-p));
+
+	return nl ? nl+1 : end;
+}
+
+/* Our little stanza-parsing state machine, over the text from p to end.
+ * With a NULL stanza, p is the start of a section body, as the index
+ * knows it, which is read up to the next section header. */
+static int parse_defaults(const char *p, const char *end, const char *stanza, np_arg_list **opts){
+	np_arg_list **tail=opts;
+	size_t stanza_len=stanza ? strlen(stanza) : 0;
+	int status=FALSE;
+	enum { NOSTANZA, WRONGSTANZA, RIGHTSTANZA } stanzastate=stanza ? NOSTANZA : RIGHTSTANZA;
 
-	stanza_len=strlen(stanza);
+	while(*tail) tail=&(*tail)->next;
 
-	/* our little stanza-parsing state machine.  */
-	while((c=fgetc(f))!=EOF){
+	while(p<end){
 		/* gobble up leading whitespace */
-		if(isspace(c)) continue;
-		switch(c){
+		if(isspace((unsigned char)*p)){
+			p++;
+			continue;
+		}
+		switch(*p){
 			/* globble up comment lines */
 			case ';':
 			case '#':
-				GOBBLE_TO(f, c, '\n');
+				p=ini_next_line(p, end);
 				break;
 			/* start of a stanza.  check to see if it matches */
 			case '[':
+				if(stanza==NULL)
+					return status;
 				stanzastate=WRONGSTANZA;
-				for(i=0; i<stanza_len; i++){
-					c=fgetc(f);
-					/* Strip leading whitespace */
-					if(i==0) for(; isspace(c); c=fgetc(f));
-					/* nope, read to the end of the line */
-					if(c!=stanza[i]) {
-						GOBBLE_TO(f, c, '\n');
-						break;
-					}
+				/* Strip leading whitespace */
+				for(p++; p<end && isspace((unsigned char)*p); p++);
+				/* nope, read to the end of the line */
+				if((size_t)(end-p)<stanza_len || memcmp(p, stanza, stanza_len)){
+					p=ini_next_line(p, end);
+					break;
 				}
 				/* if it matched up to here and the next char is ']'... */
-				if(i==stanza_len){
-					c=fgetc(f);
-					/* Strip trailing whitespace */
-					for(; isspace(c); c=fgetc(f));
-					if(c==']') stanzastate=RIGHTSTANZA;
+				for(p+=stanza_len; p<end && isspace((unsigned char)*p); p++);
+				if(p<end && *p==']'){
+					stanzastate=RIGHTSTANZA;
+					p++;
 				}
 				break;
 			/* otherwise, we're in the body of a stanza or a parse error */
@@ -223,14 +341,11 @@ static int read_defaults(FILE *f, const char *stanza, np_arg_list **opts){
 						die(STATE_UNKNOWN, "%s\n", _("Config file error"));
 					/* we're in a stanza, but for a different plugin */
 					case WRONGSTANZA:
-						GOBBLE_TO(f, c, '\n');
+						p=ini_next_line(p, end);
 						break;
 					/* okay, this is where we start taking the config */
 					case RIGHTSTANZA:
-						ungetc(c, f);
-						if(add_option(f, opts)){
-							die(STATE_UNKNOWN, "%s\n", _("Config file error"));
-						}
+						p=add_option(p, end, &tail);
 						status=TRUE;
 						break;
 				}
@@ -240,59 +355,276 @@ static int read_defaults(FILE *f, const char *stanza, np_arg_list **opts){
 	return status;
 }
 
+static uint32_t ini_hash(const char *name, size_t len){
+	uint32_t h=2166136261U;
+
+	while(len--) h=(h^(unsigned char)*name++)*16777619U;
+	return h;
+}
+
+static int ini_index_current(const np_ini_index_header *h, const struct stat *st){
+	return !memcmp(h->magic, NP_INI_INDEX_MAGIC, sizeof(h->magic)) &&
+		h->dev==(uint64_t)st->st_dev && h->ino==(uint64_t)st->st_ino &&
+		h->size==(uint64_t)st->st_size && h->mtime==(int64_t)st->st_mtime &&
+		h->ctime==(int64_t)st->st_ctime;
+}
+
+/* Scan the whole file once and lay the index out in memory exactly as it
+ * is stored. Returns NULL if the file holds anything read_defaults()
+ * would treat differently from a plain list of [name] and option lines. */
+static char *ini_index_build(FILE *f, const struct stat *st, size_t *len){
+	np_ini_index_header *h;
+	np_ini_index_entry *ent=NULL;
+	uint32_t *buckets;
+	char *line=NULL, *p, *end, *strings=NULL, *index;
+	size_t line_sz=0, nent=0, ent_sz=0, str_len=0, str_sz=0, i, off;
+	ssize_t n;
+	uint32_t nbuckets;
+	int in_section=FALSE, ok=TRUE;
+
+	rewind(f);
+	while(ok && (n=getline(&line, &line_sz, f))>=0){
+		end=line+n;
+		for(p=line; p<end && isspace((unsigned char)*p); p++);
+		if(p==end || *p==';' || *p=='#') continue;
+		if(*p!='['){
+			/* an option before the first section is a config error */
+			ok=in_section;
+			continue;
+		}
+		/* a header has its ']' on the same line and nothing but a
+		 * comment after it */
+		for(p++; p<end && isspace((unsigned char)*p); p++);
+		if((end=memchr(p, ']', (size_t)(line+n-p)))==NULL || end==p){
+			ok=FALSE;
+			break;
+		}
+		for(off=1; end+off<line+n && isspace((unsigned char)end[off]); off++);
+		if(end+off<line+n && end[off]!=';' && end[off]!='#'){
+			ok=FALSE;
+			break;
+		}
+		while(end>p && isspace((unsigned char)end[-1])) end--;
+
+		if(nent==ent_sz){
+			ent_sz=ent_sz ? ent_sz<<1 : 64;
+			if((ent=realloc(ent, ent_sz*sizeof(*ent)))==NULL)
+				die(STATE_UNKNOWN, "%s\n", _("malloc() failed!"));
+		}
+		if(str_len+(size_t)(end-p)+1>str_sz){
+			while(str_len+(size_t)(end-p)+1>str_sz) str_sz=str_sz ? str_sz<<1 : 1024;
+			if((strings=realloc(strings, str_sz))==NULL)
+				die(STATE_UNKNOWN, "%s\n", _("malloc() failed!"));
+		}
+		ent[nent].hash=ini_hash(p, (size_t)(end-p));
+		ent[nent].name=(uint32_t)str_len;
+		ent[nent].name_len=(uint32_t)(end-p);
+		ent[nent].offset=(uint64_t)ftello(f);
+		memcpy(strings+str_len, p, (size_t)(end-p));
+		str_len+=(size_t)(end-p);
+		strings[str_len++]='\0';
+		nent++;
+		in_section=TRUE;
+	}
+	free(line);
+	if(!ok || ferror(f) || nent>=UINT32_MAX/2){
+		free(ent);
+		free(strings);
+		return NULL;
+	}
+
+	for(nbuckets=16; nbuckets<nent*2; nbuckets<<=1);
+	*len=sizeof(*h)+nbuckets*sizeof(uint32_t)+nent*sizeof(*ent)+str_len;
+	if((index=calloc(1, *len))==NULL)
+		die(STATE_UNKNOWN, "%s\n", _("malloc() failed!"));
+
+	h=(np_ini_index_header *)index;
+	memcpy(h->magic, NP_INI_INDEX_MAGIC, sizeof(h->magic));
+	h->dev=(uint64_t)st->st_dev;
+	h->ino=(uint64_t)st->st_ino;
+	h->size=(uint64_t)st->st_size;
+	h->mtime=(int64_t)st->st_mtime;
+	h->ctime=(int64_t)st->st_ctime;
+	h->buckets=nbuckets;
+	h->entries=(uint32_t)nent;
+	h->strings=(uint32_t)str_len;
+
+	/* chains are built back to front so that a section defined twice is
+	 * read in file order */
+	buckets=(uint32_t *)(index+sizeof(*h));
+	for(i=nent; i-->0;){
+		ent[i].next=buckets[ent[i].hash&(nbuckets-1)];
+		buckets[ent[i].hash&(nbuckets-1)]=(uint32_t)i+1;
+	}
+	memcpy(buckets+nbuckets, ent, nent*sizeof(*ent));
+	if(str_len) memcpy((char *)(buckets+nbuckets)+nent*sizeof(*ent), strings, str_len);
+
+	free(ent);
+	free(strings);
+	return index;
+}
+
+/* write the index next to the others, replacing any stale one atomically */
+static void ini_index_save(const char *path, const char *index, size_t len){
+	char *tmp;
+	int fd;
+
+	if(asprintf(&tmp, "%s.XXXXXX", path)<0)
+		return;
+	if((fd=mkstemp(tmp))<0){
+		free(tmp);
+		return;
+	}
+	if(write(fd, index, len)!=(ssize_t)len || close(fd)!=0 || rename(tmp, path)!=0)
+		unlink(tmp);
+	free(tmp);
+}
+
+static char *ini_index_path(const struct stat *st){
+	char *prefix, *dir, *path;
+
+	if((prefix=_np_state_calculate_location_prefix())==NULL)
+		return NULL;
+	/* only the last two levels are created; no state directory, no cache */
+	if(asprintf(&dir, "%s/%lu", prefix, (unsigned long)geteuid())<0)
+		return NULL;
+	if(access(prefix, W_OK)!=0 || (access(dir, F_OK) && mkdir(dir, S_IRWXU))){
+		free(dir);
+		return NULL;
+	}
+	if(asprintf(&path, "%s/%s", dir, NP_INI_INDEX_DIR)<0){
+		free(dir);
+		return NULL;
+	}
+	if(access(path, F_OK) && mkdir(path, S_IRWXU)){
+		free(path);
+		free(dir);
+		return NULL;
+	}
+	free(path);
+	if(asprintf(&path, "%s/%s/%llx-%llx", dir, NP_INI_INDEX_DIR,
+	            (unsigned long long)st->st_dev, (unsigned long long)st->st_ino)<0)
+		path=NULL;
+	free(dir);
+	return path;
+}
+
+/* Returns -1 if there is no usable index, in which case the caller parses
+ * the whole file, and otherwise what read_defaults() would return. */
+static int read_defaults_indexed(FILE *f, const struct stat *st, const char *stanza, np_arg_list **opts){
+	const np_ini_index_header *h;
+	const np_ini_index_entry *ent;
+	const uint32_t *buckets;
+	const char *strings;
+	char *path, *built=NULL;
+	void *map=NULL;
+	size_t len=0, stanza_len=strlen(stanza);
+	uint32_t hash, e;
+	struct stat ist;
+	np_ini_text t;
+	int fd, status=FALSE, loaded=FALSE;
+
+	/* names are stored trimmed; leave the odd cases to the parser */
+	if(stanza_len==0 || strchr(stanza, ']') || isspace((unsigned char)stanza[stanza_len-1]))
+		return -1;
+	if((path=ini_index_path(st))==NULL)
+		return -1;
+
+#ifdef HAVE_SYS_MMAN_H
+	if((fd=open(path, O_RDONLY))>=0){
+		if(fstat(fd, &ist)==0 && (size_t)ist.st_size>=sizeof(*h)){
+			len=(size_t)ist.st_size;
+			map=mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+			if(map==MAP_FAILED) map=NULL;
+		}
+		close(fd);
+	}
+#endif
+	h=map;
+	if(h && (!ini_index_current(h, st) ||
+	         len!=sizeof(*h)+h->buckets*sizeof(uint32_t)+h->entries*sizeof(*ent)+h->strings)){
+#ifdef HAVE_SYS_MMAN_H
+		munmap(map, len);
+#endif
+		map=NULL;
+		h=NULL;
+	}
+	if(!h){
+		if((built=ini_index_build(f, st, &len))==NULL){
+			free(path);
+			return -1;
+		}
+		ini_index_save(path, built, len);
+		h=(np_ini_index_header *)built;
+	}
+	free(path);
+
+	buckets=(const uint32_t *)(h+1);
+	ent=(const np_ini_index_entry *)(buckets+h->buckets);
+	strings=(const char *)(ent+h->entries);
+	hash=ini_hash(stanza, stanza_len);
+	for(e=buckets[hash&(h->buckets-1)]; e && e<=h->entries; e=ent[e-1].next){
+		if(ent[e-1].hash!=hash || ent[e-1].name_len!=stanza_len ||
+		   ent[e-1].name+stanza_len>h->strings ||
+		   memcmp(strings+ent[e-1].name, stanza, stanza_len))
+			continue;
+		if(!loaded){
+			ini_text_load(f, &t);
+			loaded=TRUE;
+		}
+		if(ent[e-1].offset<=t.len &&
+		   parse_defaults(t.data+ent[e-1].offset, t.data+t.len, NULL, opts))
+			status=TRUE;
+	}
+	if(loaded)
+		ini_text_free(&t);
+
+#ifdef HAVE_SYS_MMAN_H
+	if(map) munmap(map, len);
+#endif
+	free(built);
+	return status;
+}
+
 /*
  * read one line of input in the format
  * 	^option[[:space:]]*(=[[:space:]]*value)?
  * and creates it as a cmdline argument
  * 	--option[=value]
- * appending it to the linked list optbuf.
+ * appending it to the linked list at *tail. The line is not copied, the
+ * argument is allocated once at its size. Returns where the next line
+ * starts.
  */
-static int add_option(FILE *f, np_arg_list **optlst){
-	np_arg_list *opttmp=*optlst, *optnew;
-	char *linebuf=NULL, *lineend=NULL, *optptr=NULL, *optend=NULL;
-	char *eqptr=NULL, *valptr=NULL, *valend=NULL;
-	short done_reading=0, equals=0, value=0;
-	size_t cfg_len=0, read_sz=8, linebuf_sz=0, read_pos=0;
-	size_t opt_len=0, val_len=0;
-
-	/* read one line from the file */
-	while(!done_reading){
-		/* grow if necessary */
-		if(linebuf==NULL || read_pos+read_sz >= linebuf_sz){
-			linebuf_sz=(linebuf_sz>0)?linebuf_sz<<1:read_sz;
-			linebuf=realloc(linebuf, linebuf_sz);
-			if(linebuf==NULL) die(STATE_UNKNOWN, "%s\n", _("malloc() failed!"));
-		}
-		if(fgets(&linebuf[read_pos], (int)read_sz, f)==NULL) done_reading=1;
-		else {
-			read_pos=strlen(linebuf);
-			if(linebuf[read_pos-1]=='\n') {
-				linebuf[--read_pos]='\0';
-				done_reading=1;
-			}
-		}
-	}
-	lineend=&linebuf[read_pos];
-	/* all that to read one line.  isn't C fun? :) now comes the parsing :/ */
+static const char *add_option(const char *p, const char *end, np_arg_list ***tail){
+	np_arg_list *optnew;
+	const char *lineend, *next, *optptr, *optend=NULL;
+	const char *eqptr, *valptr, *valend;
+	short value=0;
+	size_t cfg_len=0, opt_len=0, val_len=0, pos=0;
+
+	/* the line, without its newline */
+	if((lineend=memchr(p, '\n', (size_t)(end-p)))==NULL)
+		next=lineend=end;
+	else
+		next=lineend+1;
 
 	/* skip leading whitespace */
-	for(optptr=linebuf; optptr<lineend && isspace(*optptr); optptr++);
+	for(optptr=p; optptr<lineend && isspace((unsigned char)*optptr); optptr++);
 	/* continue to '=' or EOL, watching for spaces that might precede it */
 	for(eqptr=optptr; eqptr<lineend && *eqptr!='='; eqptr++){
-		if(isspace(*eqptr) && optend==NULL) optend=eqptr;
+		if(isspace((unsigned char)*eqptr) && optend==NULL) optend=eqptr;
 		else optend=NULL;
 	}
 	if(optend==NULL) optend=eqptr;
 	--optend;
 	/* ^[[:space:]]*=foo is a syntax error */
 	if(optptr==eqptr) die(STATE_UNKNOWN, "%s\n", _("Config file error"));
+	/* A line with no equal sign isn't valid */
+	if(eqptr==lineend) die(STATE_UNKNOWN, "%s\n", _("Config file error"));
 	/* continue from '=' to start of value or EOL */
-	for(valptr=eqptr+1; valptr<lineend && isspace(*valptr); valptr++);
-	/* continue to the end of value */
-	for(valend=valptr; valend<lineend; valend++);
-	--valend;
+	for(valptr=eqptr+1; valptr<lineend && isspace((unsigned char)*valptr); valptr++);
 	/* Finally trim off trailing spaces */
-	for(; isspace(*valend); valend--);
+	for(valend=lineend-1; valend>valptr && isspace((unsigned char)*valend); valend--);
 	/* calculate the length of "--foo" */
 	opt_len=(size_t)(1+optend-optptr);
 	/* 1-character params needs only one dash */
@@ -302,53 +634,42 @@ static int add_option(FILE *f, np_arg_list **optlst){
 		cfg_len=2+(opt_len);
 	/* if valptr<lineend then we have to also allocate space for "=bar" */
 	if(valptr<lineend) {
-		equals=value=1;
+		value=1;
 		val_len=(size_t)(1+valend-valptr);
 		cfg_len+=1+val_len;
 	}
-	/* if valptr==valend then we have "=" but no "bar" */
-	else if(valptr==lineend) {
-		equals=1;
+	/* if valptr==lineend then we have "=" but no "bar" */
+	else {
 		cfg_len+=1;
 	}
-	/* A line with no equal sign isn't valid */
-	if(equals==0) die(STATE_UNKNOWN, "%s\n", _("Config file error"));
 
 	/* okay, now we have all the info we need, so we create a new np_arg_list
-	 * element and set the argument...
+	 * element and set the argument; callers free the two apart...
 	 */
 	optnew=malloc(sizeof(np_arg_list));
+	if(optnew==NULL || (optnew->arg=malloc(cfg_len+1))==NULL)
+		die(STATE_UNKNOWN, "%s\n", _("malloc() failed!"));
 	optnew->next=NULL;
 
-	read_pos=0;
-	optnew->arg=malloc(cfg_len+1);
 	/* 1-character params needs only one dash */
 	if(opt_len==1) {
-		strncpy(&optnew->arg[read_pos], "-", 1);
-		read_pos+=1;
+		optnew->arg[pos++]='-';
 	} else {
-		strncpy(&optnew->arg[read_pos], "--", 2);
-		read_pos+=2;
+		memcpy(&optnew->arg[pos], "--", 2);
+		pos+=2;
 	}
-	strncpy(&optnew->arg[read_pos], optptr, opt_len); read_pos+=opt_len;
+	memcpy(&optnew->arg[pos], optptr, opt_len); pos+=opt_len;
 	if(value) {
-		optnew->arg[read_pos++]='=';
-		strncpy(&optnew->arg[read_pos], valptr, val_len); read_pos+=val_len;
+		optnew->arg[pos++]='=';
+		memcpy(&optnew->arg[pos], valptr, val_len); pos+=val_len;
 	}
-	optnew->arg[read_pos]='\0';
+	optnew->arg[pos]='\0';
 
 	/* ...and put that to the end of the list */
-	if(*optlst==NULL) {
-		*optlst=optnew;
-	}	else {
-		while(opttmp->next!=NULL) {
-			opttmp=opttmp->next;
-		}
-		opttmp->next = optnew;
-	}
+	**tail=optnew;
+	*tail=&optnew->next;
 
-	free(linebuf);
-	return 0;
+	return next;
 }
 
 static char *default_file_in_path(void){
@@ -0,0 +1,286 @@
+/*****************************************************************************
+*
+* Scaling benchmark for the check_disk library code
+*
+* Synthetic mount tables of 100 to 20000 entries, in the style of a
+* container host (data volumes with nested bind mounts, kubelet tmpfs
+* volumes, overlay roots), are written as mountinfo files and run through
+* what check_disk does with them: np_read_mountinfo with and without a -p
+* filter, np_set_best_match for 100 paths, 50 -r expressions and the
+* threshold checks of every mount. Each benchmark is one tap test with the
+* time and the number of allocations per call, and a line
+* "name<TAB>calls<TAB>ns_per_call<TAB>allocations_per_call" in the file
+* named by BENCH_OUTPUT (default bench_disk.out).
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_disk.h"
+#include <time.h>
+
+#include "tap.h"
+
+/* seconds each benchmark runs for, at the least */
+#define NP_BENCH_MIN_TIME 0.5
+
+#define BENCH_PATHS 100
+#define BENCH_REGEX 50
+
+typedef void (*bench_fn) (void);
+
+static const int sizes[] = { 100, 1000, 5000, 20000 };
+
+static FILE *results;
+static unsigned long allocations;
+
+static char mountinfo[] = "/tmp/bench_disk.XXXXXX";
+static struct mount_entry *mounts;
+static struct parameter_list *paths;
+static struct parameter_list *one_path;
+static struct np_mount_regex regex[BENCH_REGEX];
+static thresholds *free_thresholds;
+static thresholds *used_thresholds;
+static volatile int checked;
+
+#ifdef __GLIBC__
+/* count what the code under test allocates; glibc lets us wrap these */
+extern void *__libc_malloc (size_t);
+extern void *__libc_calloc (size_t, size_t);
+extern void *__libc_realloc (void *, size_t);
+
+void *
+malloc (size_t size)
+{
+	allocations++;
+	return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n, size_t size)
+{
+	allocations++;
+	return __libc_calloc (n, size);
+}
+
+void *
+realloc (void *p, size_t size)
+{
+	if (p == NULL)
+		allocations++;
+	return __libc_realloc (p, size);
+}
+#endif
+
+static double
+bench_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* run fn in growing batches until it has taken long enough, then report */
+static void
+bench (const char *name, int size, bench_fn fn)
+{
+	unsigned long calls = 0, batch = 1, i, start_allocations = allocations;
+	double start, elapsed, allocs;
+
+	start = bench_now ();
+	do {
+		for (i = 0; i < batch; i++)
+			fn ();
+		calls += batch;
+		batch <<= 1;
+		elapsed = bench_now () - start;
+	} while (elapsed < NP_BENCH_MIN_TIME);
+	allocs = (double) (allocations - start_allocations) / calls;
+
+	ok (calls > 0, "%s_%d: %lu calls, %.0f ns/call, %.1f allocations/call",
+	    name, size, calls, elapsed * 1e9 / calls, allocs);
+	if (results)
+		fprintf (results, "%s_%d\t%lu\t%.0f\t%.1f\n", name, size, calls, elapsed * 1e9 / calls, allocs);
+}
+
+
+static void
+free_mounts (struct mount_entry *list)
+{
+	struct mount_entry *next;
+
+	for (; list; list = next) {
+		next = list->me_next;
+		free_mount_entry (list);
+	}
+}
+
+/* the mounts np_set_best_match() may pick for one_path, as check_disk keeps for -p */
+static int
+path_filter (const char *devname, const char *mountdir, const char *type,
+             int dummy, int remote, void *data)
+{
+	size_t len = strlen (mountdir);
+
+	return len == 1 || strncmp (mountdir, one_path->name, len) == 0 || strcmp (devname, one_path->name) == 0;
+}
+
+static void
+bench_read_mountinfo (void)
+{
+	struct mount_entry *list;
+
+	np_read_mountinfo (mountinfo, NULL, NULL, &list);
+	free_mounts (list);
+}
+
+static void
+bench_read_mountinfo_filtered (void)
+{
+	struct mount_entry *list;
+
+	np_read_mountinfo (mountinfo, path_filter, NULL, &list);
+	free_mounts (list);
+}
+
+static void
+bench_set_best_match (void)
+{
+	struct parameter_list *p;
+
+	for (p = paths; p; p = p->name_next)
+		p->best_match = NULL;
+	np_set_best_match (paths, mounts, FALSE);
+}
+
+static void
+bench_match_mount_regex (void)
+{
+	struct mount_entry *me;
+	int i;
+
+	for (i = 0; i < BENCH_REGEX; i++)
+		for (me = mounts; me; me = me->me_next)
+			np_match_mount_regex (&regex[i], me);
+}
+
+/* what main() asks of each mount with -w/-c in percent and units */
+static void
+bench_thresholds (void)
+{
+	struct mount_entry *me;
+	double pct = 0;
+	int result = STATE_OK;
+
+	for (me = mounts; me; me = me->me_next) {
+		pct = pct >= 100 ? 0 : pct + 0.7;
+		result |= get_status (100 - pct, free_thresholds);
+		result |= get_status (pct * 1024, used_thresholds);
+		result |= get_status (100 - pct / 2, free_thresholds);
+	}
+	checked += result;
+}
+
+
+/* a container host: data volumes with bind mounts below them, pod tmpfs
+ * volumes and overlay roots */
+static void
+setup_mounts (int size)
+{
+	FILE *fp;
+	char *str;
+	int i;
+
+	if ((fp = fopen (mountinfo, "w")) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot create file:"), strerror (errno));
+	fprintf (fp, "22 1 8:1 / / rw,relatime shared:1 - ext4 /dev/sda1 rw\n");
+	for (i = 1; i < size; i++) {
+		switch (i % 4) {
+		case 0:
+			fprintf (fp, "%d 22 253:%d / /srv/vol%05d rw,relatime shared:%d - xfs /dev/mapper/vg-lv%05d rw\n",
+			         22 + i, i, i, i, i);
+			break;
+		case 1:
+			fprintf (fp, "%d %d 253:%d /data /srv/vol%05d/bind rw,relatime shared:%d - xfs /dev/mapper/vg-lv%05d rw\n",
+			         22 + i, 21 + i, i - 1, i - 1, i - 1, i - 1);
+			break;
+		case 2:
+			fprintf (fp, "%d 22 0:%d / /var/lib/kubelet/pods/%08x-4a1e/volumes/kubernetes.io\\040secret/token rw - tmpfs tmpfs rw,size=4096k\n",
+			         22 + i, 100 + i, i);
+			break;
+		default:
+			fprintf (fp, "%d 22 0:%d / /var/lib/docker/overlay2/%08x/merged rw - overlay overlay rw,lowerdir=/l/%08x\n",
+			         22 + i, 100 + i, i, i);
+			break;
+		}
+	}
+	fclose (fp);
+
+	free_mounts (mounts);
+	np_read_mountinfo (mountinfo, NULL, NULL, &mounts);
+
+	for (paths = NULL, i = 4; i < size; i += size / BENCH_PATHS < 4 ? 4 : size / BENCH_PATHS / 4 * 4) {
+		asprintf (&str, "/srv/vol%05d/bind/archive", i);
+		np_add_parameter (&paths, str);
+	}
+	one_path = paths;
+}
+
+
+int
+main (int argc, char **argv)
+{
+	const char *name = getenv ("BENCH_OUTPUT");
+	char *str;
+	size_t i;
+	int fd;
+
+	plan_tests (5 * sizeof (sizes) / sizeof (*sizes));
+
+	if ((results = fopen (name ? name : "bench_disk.out", "w")) == NULL)
+		diag ("Cannot write results: %s", strerror (errno));
+	if ((fd = mkstemp (mountinfo)) < 0)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot create file:"), strerror (errno));
+	close (fd);
+
+	/* -r style expressions as a generated config would have them */
+	for (i = 0; i < BENCH_REGEX; i++) {
+		if (i % 2)
+			asprintf (&str, "^/srv/vol%03lu[0-9]{2}/(bind|snap)$", (unsigned long) i);
+		else
+			asprintf (&str, "/var/lib/kubelet/pods/0000%02lx", (unsigned long) i);
+		np_compile_mount_regex (&regex[i], str, REG_NOSUB | REG_EXTENDED);
+	}
+	set_thresholds (&free_thresholds, "10:", "5:");
+	set_thresholds (&used_thresholds, "~:90000", "~:95000");
+
+	for (i = 0; i < sizeof (sizes) / sizeof (*sizes); i++) {
+		setup_mounts (sizes[i]);
+		bench ("np_read_mountinfo", sizes[i], bench_read_mountinfo);
+		bench ("np_read_mountinfo_one_path", sizes[i], bench_read_mountinfo_filtered);
+		bench ("np_set_best_match", sizes[i], bench_set_best_match);
+		bench ("np_match_mount_regex_50", sizes[i], bench_match_mount_regex);
+		bench ("get_status_thresholds", sizes[i], bench_thresholds);
+	}
+
+	unlink (mountinfo);
+	if (results)
+		fclose (results);
+	return exit_status ();
+}
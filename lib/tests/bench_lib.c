@@ -0,0 +1,358 @@
+/*****************************************************************************
+*
+* Micro-benchmarks for the hot paths in lib/
+*
+* Each benchmark runs one function over a realistic input until it has
+* taken at least NP_BENCH_MIN_TIME, and is reported as one tap test with
+* the time per call. The same figures are written, one benchmark per line
+* as "name<TAB>calls<TAB>ns_per_call", to the file named by BENCH_OUTPUT
+* (default bench.out) so that runs on different commits can be compared.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_disk.h"
+#include "utils_tcp.h"
+#include "utils_cmd.h"
+#include "utils_regex.h"
+#ifdef NP_EXTRA_OPTS
+#include "parse_ini.h"
+#endif
+#include <time.h>
+
+#include "tap.h"
+
+/* seconds each benchmark runs for, at the least */
+#define NP_BENCH_MIN_TIME 0.5
+
+#define BENCH_MOUNTS 10000
+#define BENCH_PATHS 100
+#define BENCH_PS_LINES 5000
+#define BENCH_INI_SECTIONS 2000
+#define BENCH_EXPECT 1000
+#define BENCH_REGEX 50
+#define BENCH_BODY (1024 * 1024)
+
+typedef void (*bench_fn) (void);
+
+static FILE *results;
+
+static char *ranges[] = { "10", "10:", "~:10", "@10:20", "-1.5:3e4", "@~:0.001", "1e3:1e6" };
+static struct mount_entry *mounts;
+static struct parameter_list *paths;
+static struct np_mount_regex regex[BENCH_REGEX];
+static char *expect[BENCH_EXPECT];
+static char *expect_status;
+static np_regex_t body_regex;
+static char *body;
+static char ps_file[] = "/tmp/bench_ps.XXXXXX";
+static char *ps_command;
+#ifdef NP_EXTRA_OPTS
+static char ini_file[] = "/tmp/bench_ini.XXXXXX";
+static char *ini_locator;
+#endif
+
+static double
+bench_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* run fn in growing batches until it has taken long enough, then report */
+static void
+bench (const char *name, bench_fn fn)
+{
+	unsigned long calls = 0, batch = 1, i;
+	double start, elapsed;
+
+	start = bench_now ();
+	do {
+		for (i = 0; i < batch; i++)
+			fn ();
+		calls += batch;
+		batch <<= 1;
+		elapsed = bench_now () - start;
+	} while (elapsed < NP_BENCH_MIN_TIME);
+
+	ok (calls > 0, "%s: %lu calls, %.0f ns/call", name, calls, elapsed * 1e9 / calls);
+	if (results)
+		fprintf (results, "%s\t%lu\t%.0f\n", name, calls, elapsed * 1e9 / calls);
+}
+
+
+static void
+bench_parse_range_string (void)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof (ranges) / sizeof (*ranges); i++)
+		free (parse_range_string (ranges[i]));
+}
+
+static void
+bench_get_status_compiled (void)
+{
+	static compiled_thresholds *ct = NULL;
+	static double values[1000];
+	static int states[1000];
+	thresholds *t = NULL;
+	size_t i;
+
+	if (ct == NULL) {
+		set_thresholds (&t, "@10:20", "~:50");
+		ct = compile_thresholds (t);
+		for (i = 0; i < 1000; i++)
+			values[i] = (double) i / 10;
+	}
+	get_status_many (values, 1000, ct, states);
+}
+
+static void
+bench_expect_match_all (void)
+{
+	np_expect_match (expect_status, expect, BENCH_EXPECT, NP_MATCH_ALL);
+}
+
+static void
+bench_expect_match_last (void)
+{
+	/* only the last expect string is in the reply */
+	np_expect_match (expect[BENCH_EXPECT - 1], expect, BENCH_EXPECT, 0);
+}
+
+static void
+bench_set_best_match (void)
+{
+	struct parameter_list *p;
+
+	for (p = paths; p; p = p->name_next)
+		p->best_match = NULL;
+	np_set_best_match (paths, mounts, FALSE);
+}
+
+static void
+bench_regex_match_mount_entry (void)
+{
+	struct mount_entry *me;
+	int i;
+
+	for (i = 0; i < BENCH_REGEX; i++)
+		for (me = mounts; me; me = me->me_next)
+			np_regex_match_mount_entry (me, &regex[i].re);
+}
+
+static void
+bench_match_mount_regex (void)
+{
+	struct mount_entry *me;
+	int i;
+
+	for (i = 0; i < BENCH_REGEX; i++)
+		for (me = mounts; me; me = me->me_next)
+			np_match_mount_regex (&regex[i], me);
+}
+
+static void
+bench_regexec_body (void)
+{
+	/* check_http -r, the match at the end of the page */
+	np_regexec (&body_regex, body, 0, NULL, 0);
+}
+
+static void
+bench_cmd_run (void)
+{
+	output out, err;
+
+	cmd_run (ps_command, &out, &err, 0);
+	free (out.line);
+	free (out.buf);
+	free (err.line);
+	free (err.buf);
+}
+
+#ifdef NP_EXTRA_OPTS
+static void
+bench_get_defaults (void)
+{
+	np_arg_list *list, *next;
+
+	for (list = np_get_defaults (ini_locator, "check_bench"); list; list = next) {
+		next = list->next;
+		free (list->arg);
+		free (list);
+	}
+}
+#endif
+
+
+static void
+setup_mounts (void)
+{
+	struct mount_entry *me, **mtail = &mounts;
+	char *str;
+	int i;
+
+	/* the root file system plus BENCH_MOUNTS - 1 data volumes */
+	for (i = 0; i < BENCH_MOUNTS; i++) {
+		if ((me = calloc (1, sizeof (*me))) == NULL)
+			die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+		asprintf (&me->me_devname, "/dev/mapper/vg%02d-lv%04d", i % 64, i);
+		if (i == 0)
+			me->me_mountdir = strdup ("/");
+		else
+			asprintf (&me->me_mountdir, "/srv/vol%02d/data%04d", i % 64, i);
+		me->me_type = strdup ("ext4");
+		*mtail = me;
+		mtail = &me->me_next;
+	}
+	*mtail = NULL;
+
+	for (i = 1; i < BENCH_MOUNTS; i += BENCH_MOUNTS / BENCH_PATHS) {
+		asprintf (&str, "/srv/vol%02d/data%04d/spool", i % 64, i);
+		np_add_parameter (&paths, str);
+	}
+
+	/* -r style expressions as a generated config would have them */
+	for (i = 0; i < BENCH_REGEX; i++) {
+		asprintf (&str, "^/srv/vol%02d/(archive|backup)[0-9]*$", i);
+		if (i % 2)
+			asprintf (&str, "/snapshots/vol%02d-[a-z]+", i);
+		np_compile_mount_regex (&regex[i], str, REG_NOSUB | REG_EXTENDED);
+	}
+}
+
+static void
+setup_expect (void)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < BENCH_EXPECT; i++) {
+		asprintf (&expect[i], "X-Backend-%04d: healthy", i);
+		len += strlen (expect[i]) + 2;
+	}
+	if ((expect_status = malloc (len + 1)) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	expect_status[0] = '\0';
+	for (i = 0, len = 0; i < BENCH_EXPECT; i++)
+		len += sprintf (expect_status + len, "%s\r\n", expect[i]);
+}
+
+static void
+setup_body (void)
+{
+	size_t len = 0;
+
+	if ((body = malloc (BENCH_BODY + 100)) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	while (len < BENCH_BODY)
+		len += sprintf (body + len, "<tr><td>backend%06zu</td><td class=\"ok\">healthy</td></tr>\n", len);
+	sprintf (body + len, "<p>Status: OK, 4096 backends</p>\n");
+	np_regcomp (&body_regex, "Status: (OK|DEGRADED), [0-9]+ backends", REG_NOSUB | REG_EXTENDED | REG_NEWLINE);
+}
+
+static void
+setup_ps (void)
+{
+	FILE *fp;
+	int fd, i;
+
+	if ((fd = mkstemp (ps_file)) < 0 || (fp = fdopen (fd, "w")) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot create file:"), strerror (errno));
+	fprintf (fp, "S   UID   PID  PPID    VSZ   RSS %%CPU COMMAND COMMAND\n");
+	for (i = 0; i < BENCH_PS_LINES; i++)
+		fprintf (fp, "S  %4d %5d %5d %6d %5d  %3.1f httpd /usr/sbin/httpd -DFOREGROUND -k start\n",
+		         48 + i % 3, 1000 + i, 1 + i / 50, 250000 + i, 9000 + i % 700, (i % 97) / 10.0);
+	fclose (fp);
+	asprintf (&ps_command, "/bin/cat %s", ps_file);
+}
+
+#ifdef NP_EXTRA_OPTS
+static void
+setup_ini (void)
+{
+	FILE *fp;
+	int fd, i;
+
+	if ((fd = mkstemp (ini_file)) < 0 || (fp = fdopen (fd, "w")) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot create file:"), strerror (errno));
+	fprintf (fp, "# generated by bench_lib\n");
+	for (i = 0; i < BENCH_INI_SECTIONS; i++)
+		fprintf (fp, "\n[check_host%04d]\nhostname=host%04d.example.com\nwarning=10:20\ncritical=5:30\n; comment\ntimeout=15\n",
+		         i, i);
+	fprintf (fp, "\n[check_bench]\nhostname=bench.example.com\nport=443\n");
+	fclose (fp);
+	asprintf (&ini_locator, "check_bench@%s", ini_file);
+}
+#endif
+
+
+int
+main (int argc, char **argv)
+{
+	const char *name = getenv ("BENCH_OUTPUT");
+
+	/* no state directory, so no section index, for the first INI run */
+	setenv ("NAGIOS_PLUGIN_STATE_DIRECTORY", "var/nonexistent", 1);
+
+#ifdef NP_EXTRA_OPTS
+	plan_tests (12);
+#else
+	plan_tests (10);
+#endif
+
+	if ((results = fopen (name ? name : "bench.out", "w")) == NULL)
+		diag ("Cannot write results: %s", strerror (errno));
+
+	setup_mounts ();
+	setup_expect ();
+	setup_body ();
+	setup_ps ();
+	cmd_init ();
+
+	bench ("parse_range_string", bench_parse_range_string);
+	bench ("get_status_many_1000", bench_get_status_compiled);
+	bench ("np_expect_match_all_1000", bench_expect_match_all);
+	bench ("np_expect_match_any_1000", bench_expect_match_last);
+	bench ("np_set_best_match_10000", bench_set_best_match);
+	ok (paths->best_match && !strcmp (paths->best_match->me_mountdir, "/srv/vol01/data0001"),
+	    "np_set_best_match found the right mount");
+	bench ("np_regex_match_mount_entry_50x10000", bench_regex_match_mount_entry);
+	bench ("np_match_mount_regex_50x10000", bench_match_mount_regex);
+	diag ("regular expressions with %s", np_regex_engine (&body_regex));
+	bench ("np_regexec_body_1M", bench_regexec_body);
+	bench ("cmd_run_ps_5000", bench_cmd_run);
+
+#ifdef NP_EXTRA_OPTS
+	setup_ini ();
+	bench ("np_get_defaults_2000", bench_get_defaults);
+	setenv ("NAGIOS_PLUGIN_STATE_DIRECTORY", "var", 1);
+	bench ("np_get_defaults_2000_indexed", bench_get_defaults);
+	unlink (ini_file);
+#endif
+
+	unlink (ps_file);
+	if (results)
+		fclose (results);
+	return exit_status ();
+}
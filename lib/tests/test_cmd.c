@@ -20,6 +20,12 @@
 #include "utils_cmd.h"
 #include "utils_base.h"
 #include "tap.h"
+#include <sys/wait.h>
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+
+extern char **environ;
 
 #define COMMAND_LINE 1024
 #define UNSET 65530
@@ -39,6 +45,38 @@ get_command (char *const *line)
 	return cmd;
 }
 
+/* counts what cmd_run_filter() hands it */
+struct filter_seen {
+	size_t bytes, calls, eof;
+};
+
+static void
+count_output (const char *buf, size_t len, void *data)
+{
+	struct filter_seen *seen = data;
+
+	seen->bytes += len;
+	if (len)
+		seen->calls++;
+	else
+		seen->eof++;
+}
+
+/* whether exits can be polled for, as cmd_fetch_children() does */
+static int
+have_pidfd (void)
+{
+#ifdef SYS_pidfd_open
+	int fd = (int) syscall (SYS_pidfd_open, getpid (), 0);
+
+	if (fd >= 0) {
+		close (fd);
+		return 1;
+	}
+#endif
+	return 0;
+}
+
 int
 main (int argc, char **argv)
 {
@@ -49,7 +87,7 @@ main (int argc, char **argv)
 	int c;
 	int result = UNSET;
 
-	plan_tests(51);
+	plan_tests(76);
 
 	diag ("Running plain echo command, set one");
 
@@ -229,5 +267,144 @@ main (int argc, char **argv)
 	ok (result == 3, "Get return code 3 = UNKNOWN when command does not exist");
 
 
+	diag ("Output buffering and line splitting");
+
+	/* large enough to grow the output buffer several times */
+	memset (&chld_out, 0, sizeof (output));
+	memset (&chld_err, 0, sizeof (output));
+	command_line[0] = strdup ("/bin/sh");
+	command_line[1] = strdup ("-c");
+	command_line[2] = strdup ("i=0; while [ $i -lt 5000 ]; do echo line$i; i=$((i+1)); done");
+	command_line[3] = NULL;
+	result = cmd_run_array (command_line, &chld_out, &chld_err, 0);
+	ok (chld_out.lines == 5000, "Large output is split into 5000 lines");
+	ok (strcmp (chld_out.line[0], "line0") == 0 &&
+	    strcmp (chld_out.line[4999], "line4999") == 0,
+	    "...with the first and last lines intact");
+	ok (chld_out.lens[4999] == 8, "...and the right line length");
+
+	memset (&chld_out, 0, sizeof (output));
+	command_line[2] = strdup ("printf 'a\\n\\nbc'");
+	result = cmd_run_array (command_line, &chld_out, NULL, CMD_NO_ARRAYS);
+	ok (chld_out.lines == 5 && chld_out.line == NULL,
+	    "CMD_NO_ARRAYS returns the buffer length and no line index");
+	ok (chld_out.buf[chld_out.buflen] == '\0', "...with a terminated buffer");
+	ok (cmd_split_lines (&chld_out, 0) == 3, "Lines can be split later on");
+	ok (chld_out.lens[1] == 0 && strcmp (chld_out.line[2], "bc") == 0,
+	    "...keeping empty lines and an unterminated last line");
+
+	memset (&chld_out, 0, sizeof (output));
+	command_line[2] = strdup ("echo one; echo two");
+	result = cmd_run_array (command_line, &chld_out, NULL, CMD_NO_ASSOC);
+	ok (chld_out.lines == 2, "CMD_NO_ASSOC splits lines");
+	ok (strcmp (chld_out.line[1], "two") == 0, "...into a separate copy");
+	ok (strcmp (chld_out.buf, "one\ntwo\n") == 0, "...leaving buf unbroken");
+
+
+	diag ("Draining stdout and stderr together");
+
+	/* more stderr than a pipe holds, before anything goes to stdout */
+	command_line[2] = strdup ("i=0; while [ $i -lt 20000 ]; do echo err$i >&2; i=$((i+1)); done; echo out");
+	result = cmd_run_array (command_line, &chld_out, &chld_err, 0);
+	ok (chld_err.lines == 20000 && strcmp (chld_err.line[19999], "err19999") == 0,
+	    "A child filling its stderr pipe does not stall");
+	ok (chld_out.lines == 1 && result == 0, "...and its stdout and status are kept");
+
+	cmd_set_timeout (1);
+	command_line[2] = strdup ("echo started; sleep 10");
+	result = cmd_run_array (command_line, &chld_out, &chld_err, 0);
+	ok (result == -1 && errno == ETIMEDOUT, "cmd_set_timeout() stops a hung command");
+	ok (chld_out.lines == 1 && strcmp (chld_out.line[0], "started") == 0,
+	    "...keeping the output it produced so far");
+	cmd_set_timeout (0);
+
+	{
+		char *const first[] = { "/bin/sh", "-c", "echo first", NULL };
+		char *const second[] = { "/bin/sh", "-c", "echo second >&2; echo second", NULL };
+		int p1[2], e1[2], p2[2], e2[2];
+		output out1, out2, err2;
+		cmd_child kids[2];
+
+		memset (kids, 0, sizeof (kids));
+		pipe (p1); pipe (e1); pipe (p2); pipe (e2);
+		cmd_spawn (first, environ, p1, e1);
+		cmd_spawn (second, environ, p2, e2);
+		close (p1[1]); close (e1[1]); close (p2[1]); close (e2[1]);
+		kids[0].out_fd = p1[0]; kids[0].err_fd = e1[0];
+		kids[0].out = &out1; kids[0].err = NULL;
+		kids[1].out_fd = p2[0]; kids[1].err_fd = e2[0];
+		kids[1].out = &out2; kids[1].err = &err2;
+		result = cmd_fetch_children (kids, 2, 0, 5);
+		ok (result == 0 && strcmp (out1.line[0], "first") == 0 &&
+		    strcmp (out2.line[0], "second") == 0,
+		    "cmd_fetch_children() drains several children");
+		ok (err2.lines == 1 && strcmp (err2.line[0], "second") == 0, "...including their stderr");
+		while (wait (NULL) > 0);
+	}
+
+	{
+		char *const hung[] = { "/bin/sh", "-c", "echo hung; exec sleep 10", NULL };
+		char *const quick[] = { "/bin/sh", "-c", "echo quick; exit 2", NULL };
+		char *const forked[] = { "/bin/sh", "-c", "echo forked; sleep 10 & exit 1", NULL };
+		int p[3][2], e[3][2];
+		output outs[3];
+		cmd_child kids[3];
+		time_t start;
+		int i;
+
+		memset (kids, 0, sizeof (kids));
+		for (i = 0; i < 3; i++) {
+			pipe (p[i]);
+			pipe (e[i]);
+		}
+		kids[0].pid = cmd_spawn (hung, environ, p[0], e[0]);
+		kids[0].timeout = 1;
+		kids[1].pid = cmd_spawn (quick, environ, p[1], e[1]);
+		kids[2].pid = cmd_spawn (forked, environ, p[2], e[2]);
+		for (i = 0; i < 3; i++) {
+			close (p[i][1]);
+			close (e[i][1]);
+			kids[i].out_fd = p[i][0];
+			kids[i].err_fd = e[i][0];
+			kids[i].out = &outs[i];
+		}
+		start = time (NULL);
+		result = cmd_fetch_children (kids, 3, 0, 5);
+		ok (result == -1 && errno == ETIMEDOUT && kids[0].timed_out && !kids[1].timed_out,
+		    "A child given with its pid has a deadline of its own");
+		ok (WIFSIGNALED (kids[0].status) && strcmp (outs[0].line[0], "hung") == 0,
+		    "...is killed at it, keeping its output");
+		ok (WIFEXITED (kids[1].status) && WEXITSTATUS (kids[1].status) == 2,
+		    "...and is reaped with its exit status");
+		ok (WIFEXITED (kids[2].status) && strcmp (outs[2].line[0], "forked") == 0,
+		    "A child whose grandchild holds its stdout is reaped");
+		skip_start (!have_pidfd (), 1, "no pidfd_open");
+		ok (time (NULL) - start < 4, "...as it exits, not at the timeout");
+		skip_end;
+		for (i = 0; i < 3; i++) {
+			close (p[i][0]);
+			close (e[i][0]);
+		}
+	}
+
+
+	diag ("Filtering output as it is read");
+
+	{
+		char *const big[] = { "/bin/sh", "-c",
+			"i=0; while [ $i -lt 5000 ]; do echo line$i; i=$((i+1)); done; echo oops >&2; exit 2", NULL };
+		char **split;
+		struct filter_seen seen = { 0, 0, 0 };
+
+		result = cmd_run_filter (big, count_output, &seen, &chld_err);
+		ok (result == 2 && seen.bytes == 43890, "cmd_run_filter() passes on all of stdout");
+		ok (seen.calls > 1 && seen.eof == 1, "...a block at a time, then EOF once");
+		ok (chld_err.lines == 1 && strcmp (chld_err.line[0], "oops") == 0, "...and keeps stderr");
+
+		split = cmd_argv ("/bin/echo 'two words' three");
+		ok (split && strcmp (split[1], "two words") == 0 && strcmp (split[2], "three") == 0
+		    && split[3] == NULL, "cmd_argv() splits a command line as cmd_run() does");
+	}
+
 	return exit_status ();
 }
@@ -19,11 +19,18 @@
 #include "common.h"
 #include "utils_disk.h"
 #include "tap.h"
-#include "regex.h"
+#include "utils_regex.h"
+#include <sys/stat.h>
+#include <fcntl.h>
 
 void np_test_mount_entry_regex (struct mount_entry *dummy_mount_list,
 	       			char *regstr, int cflags, int expect,
 			       	char *desc);
+void np_test_mountinfo (void);
+void np_test_best_match_index (void);
+void np_test_regex_literal (void);
+void np_test_disk_trend (void);
+void np_test_du (void);
 
 
 int
@@ -42,7 +49,7 @@ main (int argc, char **argv)
 	int cflags = REG_NOSUB | REG_EXTENDED;
 	int found = 0, count = 0;
 
-	plan_tests(33);
+	plan_tests(75);
 
 	ok( np_find_name(exclude_filesystem, "/var/log") == FALSE, "/var/log not in list");
 	np_add_name(&exclude_filesystem, "/var/log");
@@ -58,6 +65,27 @@ main (int argc, char **argv)
 
 	ok( np_find_name(exclude_filesystem, "iso9660") == FALSE, "Make sure no clashing in variables");
 
+	/* enough names for the set to grow a few times over */
+	for (count = 0; count < 1000; count++) {
+		char name[32];
+		snprintf (name, sizeof (name), "/mnt/%d", count);
+		np_add_name(&dummy_mountlist, strdup (name));
+	}
+	for (found = 0, count = 0; count < 1000; count++) {
+		char name[32];
+		snprintf (name, sizeof (name), "/mnt/%d", count);
+		found += np_find_name(dummy_mountlist, name);
+	}
+	ok( found == 1000, "All of 1000 names are found" );
+	ok( np_find_name(dummy_mountlist, "/mnt/1000") == FALSE && np_find_name(dummy_mountlist, "/mnt") == FALSE,
+	    "and those not added are not" );
+	np_add_name(&dummy_mountlist, "/mnt/7");
+	ok( np_seen_name(dummy_mountlist, "/mnt/7") == TRUE, "A name added again is still seen" );
+	for (count = 0, temp_name = dummy_mountlist; temp_name; temp_name = temp_name->next)
+		count++;
+	ok( count == 1001, "and the list still has every entry" );
+	found = count = 0;
+
 	/*
 	for (temp_name = exclude_filesystem; temp_name; temp_name = temp_name->next) {
 		printf("Name: %s\n", temp_name->name);
@@ -198,6 +226,11 @@ main (int argc, char **argv)
 	ok(found == 0, "last (/home) element successfully deleted");
 	ok(count == 2, "two elements remaining");
 
+	np_test_mountinfo();
+	np_test_best_match_index();
+	np_test_regex_literal();
+	np_test_disk_trend();
+	np_test_du();
 
 	return exit_status();
 }
@@ -207,9 +240,9 @@ void
 np_test_mount_entry_regex (struct mount_entry *dummy_mount_list, char *regstr, int cflags, int expect, char *desc)
 {	
 	int matches = 0;
-	regex_t re;
+	np_regex_t re;
 	struct mount_entry *me;
-	if (regcomp(&re,regstr, cflags) == 0) {
+	if (np_regcomp(&re,regstr, cflags) == 0) {
 		for (me = dummy_mount_list; me; me= me->me_next) {
 			if(np_regex_match_mount_entry(me,&re))
 				matches++;
@@ -222,3 +255,211 @@ np_test_mount_entry_regex (struct mount_entry *dummy_mount_list, char *regstr, i
 		ok ( false, "regex '%s' not compilable", regstr);
 }
 
+
+static int
+no_tmpfs (const char *devname, const char *mountdir, const char *type, int dummy, int remote, void *data)
+{
+	(*(int *) data)++;
+	return strcmp(type, "tmpfs") != 0;
+}
+
+void
+np_test_mountinfo (void)
+{
+	char file[] = "/tmp/test_disk.XXXXXX";
+	struct mount_entry *list, *me;
+	int fd, seen = 0, count = 0;
+	const char *mountinfo =
+		"22 1 8:1 / / rw,relatime shared:1 - ext4 /dev/sda1 rw\n"
+		"23 22 0:21 / /run rw,nosuid shared:5 master:1 - tmpfs tmpfs rw,mode=755\n"
+		"24 22 0:22 / /mnt/my\\040disk rw - nfs srv:/export rw\n"
+		"25 22 0:23 / /proc rw - proc proc rw\n"
+		"garbage\n"
+		"26 22 8:2 / /home rw - xfs /dev/sda2 rw";
+
+	fd = mkstemp(file);
+	write(fd, mountinfo, strlen(mountinfo));
+	close(fd);
+
+	ok(np_read_mountinfo(file, no_tmpfs, &seen, &list) == TRUE, "mountinfo file read");
+	ok(seen == 5, "filter called for each well-formed line");
+	for (me = list; me; me = me->me_next)
+		count++;
+	ok(count == 4, "tmpfs entry left out by the filter");
+	ok(list && !strcmp(list->me_devname, "/dev/sda1") && !strcmp(list->me_type, "ext4") &&
+	   !list->me_dummy && !list->me_remote, "source and type found after the optional fields");
+	me = list ? list->me_next : NULL;
+	ok(me && !strcmp(me->me_mountdir, "/mnt/my disk") && me->me_remote, "escaped blank decoded, nfs is remote");
+	me = me ? me->me_next : NULL;
+	ok(me && !strcmp(me->me_type, "proc") && me->me_dummy, "proc is a dummy file system");
+	me = me ? me->me_next : NULL;
+	ok(me && !strcmp(me->me_mountdir, "/home") && me->me_next == NULL, "last line without newline kept");
+
+	unlink(file);
+	ok(np_read_mountinfo(file, NULL, NULL, &list) == FALSE && list == NULL, "missing file reported");
+}
+
+static struct mount_entry *
+test_mount (struct mount_entry ***mtail, const char *devname, const char *mountdir)
+{
+	struct mount_entry *me = calloc(1, sizeof *me);
+
+	me->me_devname = strdup(devname);
+	me->me_mountdir = strdup(mountdir);
+	**mtail = me;
+	*mtail = &me->me_next;
+	return me;
+}
+
+static struct mount_entry *
+test_best_match (struct mount_entry *list, const char *name, int exact)
+{
+	struct parameter_list *paths = NULL;
+
+	np_add_parameter(&paths, name);
+	np_set_best_match(paths, list, exact);
+	return paths->best_match;
+}
+
+void
+np_test_best_match_index (void)
+{
+	struct mount_entry *list = NULL, **mtail = &list;
+	struct mount_entry *root, *srv, *srv2, *data, *dev;
+
+	root = test_mount(&mtail, "/dev/sda1", "/");
+	srv = test_mount(&mtail, "/dev/sdb1", "/srv");
+	data = test_mount(&mtail, "/dev/sdc1", "/srv/data");
+	srv2 = test_mount(&mtail, "/dev/sdd1", "/srv");
+	dev = test_mount(&mtail, "/srv/data/x", "/mnt/x");
+
+	ok(test_best_match(list, "/srv/data/file", FALSE) == data, "longest mount directory wins");
+	ok(test_best_match(list, "/srv/other", FALSE) == srv2, "the later of two equal mounts wins");
+	ok(test_best_match(list, "/srvdata", FALSE) == srv2, "mount directories match as plain string prefixes");
+	ok(test_best_match(list, "/srv/data/x", FALSE) == dev, "device name checked before directories");
+	ok(test_best_match(list, "/srv/data/file", TRUE) == NULL && test_best_match(list, "/srv", TRUE) == srv2,
+	   "exact match needs the whole directory");
+	ok(test_best_match(list, "/tmp", FALSE) == root, "root file system is the fallback");
+}
+
+static int
+test_literal (const char *pattern, int cflags, const char *expect)
+{
+	char *literal = np_regex_literal(pattern, cflags);
+	int ret = expect ? literal && !strcmp(literal, expect) : literal == NULL;
+
+	free(literal);
+	return ret;
+}
+
+void
+np_test_regex_literal (void)
+{
+	int cflags = REG_NOSUB | REG_EXTENDED;
+	struct np_mount_regex mr;
+	struct mount_entry me;
+
+	ok(test_literal("^/srv/vol07/(archive|backup)[0-9]*$", cflags, "/srv/vol07/"), "literal before a group");
+	ok(test_literal("/var/lib/dock?er", cflags, "/var/lib/doc"), "optional character left out");
+	ok(test_literal("ab+c", cflags, "ab"), "a repeated character ends the run");
+	ok(test_literal("data\\.img", cflags, "data.img"), "escaped dot is literal");
+	ok(test_literal("/home|/var", cflags, NULL), "no literal for a top level alternation");
+	ok(test_literal("[/]mnt[0-9]{2}x", cflags, "mnt"), "brackets and intervals end the run");
+	ok(test_literal("/data", REG_NOSUB, NULL), "basic expressions are not looked at");
+
+	me.me_devname = "/dev/mapper/VG0-backup";
+	me.me_mountdir = "/srv/Backup";
+	ok(np_compile_mount_regex(&mr, "backup$", cflags) == 0 && np_match_mount_regex(&mr, &me),
+	   "literal found in the device name");
+	np_free_mount_regex(&mr);
+	ok(np_compile_mount_regex(&mr, "^/srv/b", cflags | REG_ICASE) == 0 && np_match_mount_regex(&mr, &me),
+	   "literal compared without case for -R");
+	np_free_mount_regex(&mr);
+	ok(np_compile_mount_regex(&mr, "/srv/archive", cflags) == 0 && !np_match_mount_regex(&mr, &me),
+	   "missing literal rejects the mount");
+	np_free_mount_regex(&mr);
+	ok(np_compile_mount_regex(&mr, "(", cflags) != 0, "compile error reported");
+}
+
+void
+np_test_disk_trend (void)
+{
+	char file[] = "/tmp/test_trend.XXXXXX";
+	np_disk_trend *trend;
+	double rate = -1;
+	struct stat st;
+
+	close(mkstemp(file));
+	unlink(file);
+
+	trend = np_disk_trend_open(file);
+	ok(np_disk_trend_update(trend, "/var", 1000, 100, 3600, &rate) == FALSE, "no estimate from the first sample");
+	ok(np_disk_trend_update(trend, "/var", 1100, 300, 3600, &rate) == TRUE && rate == 2, "growth from the second sample");
+	np_disk_trend_update(trend, "/home", 1100, 50, 3600, &rate);
+	ok(np_disk_trend_save(trend, 1100) == TRUE && stat(file, &st) == 0 && st.st_size == 16 + 2 * 40,
+	   "one fixed size record per file system saved");
+	np_disk_trend_close(trend);
+
+	trend = np_disk_trend_open(file);
+	ok(np_disk_trend_update(trend, "/var", 4700, 300, 3600, &rate) == TRUE && rate == 1,
+	   "an hour without growth halves the estimate with a one hour window");
+	ok(np_disk_trend_update(trend, "/home", 4700 + NP_DISK_TREND_EXPIRE, 50, 3600, &rate) == TRUE && rate == 0,
+	   "second sample of a file system read back");
+	ok(np_disk_trend_save(trend, 5000 + NP_DISK_TREND_EXPIRE) == TRUE && stat(file, &st) == 0 && st.st_size == 16 + 40,
+	   "records not updated for a long time dropped");
+	np_disk_trend_close(trend);
+	unlink(file);
+}
+
+
+void
+np_test_du (void)
+{
+	char dir[] = "/tmp/test_du.XXXXXX";
+	char path[256], file[sizeof (dir) + 16];
+	np_du_cache *cache;
+	np_du_usage usage, again;
+	int fd, i;
+
+	mkdtemp(dir);
+	for (i = 0; i < 20; i++) {
+		snprintf(path, sizeof (path), "%s/%d", dir, i);
+		mkdir(path, 0700);
+		snprintf(path, sizeof (path), "%s/%d/%d", dir, i, i);
+		mkdir(path, 0700);
+		snprintf(path, sizeof (path), "%s/%d/%d/file", dir, i, i);
+		if ((fd = open(path, O_WRONLY | O_CREAT, 0600)) >= 0) {
+			write(fd, path, strlen (path));
+			close(fd);
+		}
+	}
+	snprintf(file, sizeof (file), "%s/cache", dir);
+
+	ok(np_du_walk(dir, 3, NULL, 1000, &usage) == 0 && usage.dirs == 41 && usage.dirs_read == 41 &&
+	   usage.files == 20 && usage.errors == 0, "every directory and file of a tree counted by 3 workers");
+	ok(usage.bytes > 0, "with the blocks they use");
+
+	cache = np_du_cache_open(file, 3600);
+	np_du_walk(dir, 3, cache, 1000, &again);
+	ok(again.bytes == usage.bytes && again.dirs_read == 41, "the same from an empty cache");
+	ok(np_du_cache_save(cache) == TRUE, "which is saved");
+	np_du_cache_close(cache);
+
+	snprintf(path, sizeof (path), "%s/7/7/new", dir);
+	close(open(path, O_WRONLY | O_CREAT, 0600));
+	cache = np_du_cache_open(file, 3600);
+	ok(np_du_walk(dir, 2, cache, 2000, &again) == 0 && again.dirs == 41 && again.dirs_read == 2 &&
+	   again.files == 22, "only the directories whose mtime changed are read again");
+	np_du_cache_close(cache);
+
+	cache = np_du_cache_open(file, 3600);
+	np_du_walk(dir, 2, cache, 5000, &again);
+	ok(again.dirs_read == 41, "and all of them once the cache is older than its max age");
+	np_du_cache_close(cache);
+
+	snprintf(path, sizeof (path), "%s/none", dir);
+	ok(np_du_walk(path, 2, NULL, 1000, &usage) < 0 && errno == ENOENT, "a tree that is not there");
+
+	snprintf(path, sizeof (path), "rm -rf %s", dir);
+	system(path);
+}
@@ -0,0 +1,331 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_dns.h"
+#include "tap.h"
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+/* "www.example.com" A with RD set and id 0x1234, as dig +noedns sends it */
+static const unsigned char a_query[] = {
+	0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x03, 'w', 'w', 'w', 0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x03, 'c',
+	'o', 'm', 0x00, 0x00, 0x01, 0x00, 0x01
+};
+
+/* its answer: a CNAME, the A record of the alias and a TXT record, with
+ * names compressed, and an OPT record */
+static const unsigned char a_response[] = {
+	0x12, 0x34, 0x85, 0x80, 0x00, 0x01, 0x00, 0x03, 0x00, 0x00, 0x00, 0x01,
+	0x03, 'w', 'w', 'w', 0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x03, 'c',
+	'o', 'm', 0x00, 0x00, 0x01, 0x00, 0x01,
+	0xc0, 0x0c, 0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x06,
+	0x03, 'w', 'e', 'b', 0xc0, 0x10,
+	0xc0, 0x2d, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x04,
+	0xc0, 0x00, 0x02, 0x01,
+	0xc0, 0x0c, 0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x10,
+	0x0b, 'v', '=', 's', 'p', 'f', '1', ' ', '-', 'a', 'l', 'l',
+	0x03, 'a', '"', 'b',
+	0x00, 0x00, 0x29, 0x04, 0xd0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+/* a name that points at itself */
+static const unsigned char loop_response[] = {
+	0x00, 0x01, 0x81, 0x80, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01
+};
+
+/* a record of the name in the answer section of buf, its data uncompressed */
+static size_t
+add_record (unsigned char *buf, size_t len, int type, const unsigned char *rdata, size_t rdlength)
+{
+	unsigned char *p = buf + len;
+
+	/* the name of the question */
+	*p++ = 0xc0;
+	*p++ = 0x0c;
+	*p++ = type >> 8;
+	*p++ = type & 0xff;
+	*p++ = 0;
+	*p++ = NP_DNS_CLASS_IN;
+	memset (p, 0, 4);
+	p[3] = 60;
+	p += 4;
+	*p++ = rdlength >> 8;
+	*p++ = rdlength & 0xff;
+	memcpy (p, rdata, rdlength);
+	buf[7]++;
+	return len + 12 + rdlength;
+}
+
+/* A child answering the first query on the UDP port with a response of
+ * the wrong id and then a truncated one, and the query again on a TCP
+ * socket of the same port with an A record. The port is returned. */
+static int
+truncating_server (pid_t *pid)
+{
+	unsigned char buf[512], head[2];
+	static const unsigned char addr[] = { 192, 0, 2, 7 };
+	struct sockaddr_in sin, from;
+	socklen_t len = sizeof (sin);
+	int sd, ld, cd, n;
+
+	sd = socket (AF_INET, SOCK_DGRAM, 0);
+	ld = socket (AF_INET, SOCK_STREAM, 0);
+	memset (&sin, 0, sizeof (sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	bind (sd, (struct sockaddr *) &sin, sizeof (sin));
+	getsockname (sd, (struct sockaddr *) &sin, &len);
+	if (bind (ld, (struct sockaddr *) &sin, sizeof (sin)) < 0 || listen (ld, 1) < 0)
+		return -1;
+	if ((*pid = fork ()) == 0) {
+		len = sizeof (from);
+		if ((n = recvfrom (sd, buf, sizeof (buf), 0, (struct sockaddr *) &from, &len)) < 12)
+			_exit (1);
+		buf[2] |= 0x80;
+		buf[0] ^= 0xff;
+		sendto (sd, buf, n, 0, (struct sockaddr *) &from, len);
+		buf[0] ^= 0xff;
+		buf[2] |= 0x02;
+		sendto (sd, buf, n, 0, (struct sockaddr *) &from, len);
+		if ((cd = accept (ld, NULL, NULL)) < 0 || recv (cd, head, 2, MSG_WAITALL) != 2 ||
+		    (n = recv (cd, buf, (head[0] << 8) | head[1], MSG_WAITALL)) < 12)
+			_exit (1);
+		buf[2] |= 0x80;
+		n = add_record (buf, n, NP_DNS_A, addr, 4);
+		head[0] = n >> 8;
+		head[1] = n & 0xff;
+		send (cd, head, 2, 0);
+		send (cd, buf, n, 0);
+		close (cd);
+		_exit (0);
+	}
+	close (sd);
+	close (ld);
+	return ntohs (sin.sin_port);
+}
+
+/* A child answering the first two queries in the reverse order, with
+ * an A record of 192.0.2.N for the Nth, after an answer to the first
+ * question with the id of the second. The port is returned. */
+static int
+reordering_server (pid_t *pid)
+{
+	unsigned char buf[2][512], decoy[512];
+	static const unsigned char decoy_addr[] = { 192, 0, 2, 99 };
+	unsigned char addr[4] = { 192, 0, 2, 0 };
+	struct sockaddr_in sin, from;
+	socklen_t len = sizeof (sin);
+	int sd, n[2], i;
+
+	sd = socket (AF_INET, SOCK_DGRAM, 0);
+	memset (&sin, 0, sizeof (sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	bind (sd, (struct sockaddr *) &sin, sizeof (sin));
+	getsockname (sd, (struct sockaddr *) &sin, &len);
+	if ((*pid = fork ()) == 0) {
+		for (i = 0; i < 2; i++) {
+			len = sizeof (from);
+			if ((n[i] = recvfrom (sd, buf[i], sizeof (buf[i]), 0, (struct sockaddr *) &from, &len)) < 23)
+				_exit (1);
+			/* answered without the OPT record */
+			buf[i][2] |= 0x80;
+			buf[i][11] = 0;
+			n[i] -= 11;
+		}
+		memcpy (decoy, buf[0], n[0]);
+		memcpy (decoy, buf[1], 2);
+		sendto (sd, decoy, add_record (decoy, n[0], NP_DNS_A, decoy_addr, 4), 0, (struct sockaddr *) &from, len);
+		for (i = 1; i >= 0; i--) {
+			addr[3] = i + 1;
+			sendto (sd, buf[i], add_record (buf[i], n[i], NP_DNS_A, addr, 4), 0, (struct sockaddr *) &from, len);
+		}
+		_exit (0);
+	}
+	close (sd);
+	return ntohs (sin.sin_port);
+}
+
+int
+main (int argc, char **argv)
+{
+	unsigned char buf[NP_DNS_MAX_MESSAGE];
+	char str[NP_DNS_MAX_NAME];
+	char resolv_conf[] = "/tmp/test_dns.XXXXXX";
+	np_dns_message m;
+	struct sockaddr_in sin;
+	FILE *fp;
+	size_t len;
+	socklen_t addrlen;
+	pid_t pid;
+	int port, sd, status;
+	np_dns_target targets[3];
+	char port_str[8];
+
+	static const unsigned char mx[] = { 0, 10, 4, 'm', 'a', 'i', 'l', 0 };
+	static const unsigned char srv[] = { 0, 1, 0, 5, 0x13, 0xc4, 3, 's', 'i', 'p', 0 };
+	static const unsigned char soa[] = {
+		2, 'n', 's', 0, 4, 'h', 'o', 's', 't', 0,
+		0x78, 0x4b, 0x2b, 0x11, 0, 0, 0x1c, 0x20, 0, 0, 0x0e, 0x10,
+		0, 0x12, 0x75, 0, 0, 0, 0x0e, 0x10
+	};
+	static const unsigned char aaaa[] = {
+		0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1
+	};
+	static const unsigned char unknown[] = { 0xde, 0xad };
+	static const unsigned char bad_a[] = { 1, 2, 3 };
+
+	plan_tests (45);
+
+	ok (np_dns_type ("aaaa") == NP_DNS_AAAA && np_dns_type ("MX") == NP_DNS_MX,
+	    "record types are known by name");
+	ok (np_dns_type ("TYPE65") == 65, "the generic form of a type is understood");
+	ok (np_dns_type ("FOO") == -1 && np_dns_type ("TYPE65536") == -1, "unknown types are rejected");
+	ok (!strcmp (np_dns_type_name (NP_DNS_SRV, str, sizeof (str)), "SRV") &&
+	    !strcmp (np_dns_type_name (65, str, sizeof (str)), "TYPE65"), "types are named");
+	ok (np_dns_class ("ch") == NP_DNS_CLASS_CH && np_dns_class ("CLASS254") == 254 &&
+	    np_dns_class ("XX") == -1, "classes are known by name");
+	ok (!strcmp (np_dns_class_name (NP_DNS_CLASS_IN, str, sizeof (str)), "IN") &&
+	    !strcmp (np_dns_class_name (254, str, sizeof (str)), "CLASS254"), "classes are named");
+	ok (!strcmp (np_dns_rcode_name (NP_DNS_NXDOMAIN), "NXDOMAIN"), "response codes are named");
+
+	ok (np_dns_encode_query (0x1234, "www.example.com", NP_DNS_A, NP_DNS_CLASS_IN, NP_DNS_RD,
+	                         0, buf, sizeof (buf)) == sizeof (a_query) &&
+	    !memcmp (buf, a_query, sizeof (a_query)), "a query encodes the way dig sends it");
+	ok (np_dns_encode_query (0x1234, "www.example.com.", NP_DNS_A, NP_DNS_CLASS_IN, NP_DNS_RD,
+	                         0, buf, sizeof (buf)) == sizeof (a_query) &&
+	    !memcmp (buf, a_query, sizeof (a_query)), "a final dot makes no difference");
+	ok (np_dns_encode_query (1, "example.com", NP_DNS_A, NP_DNS_CLASS_IN, 0, NP_DNS_EDNS_SIZE,
+	                         buf, sizeof (buf)) == 40 && buf[11] == 1 && buf[31] == 0x29 &&
+	    buf[32] == 0x04 && buf[33] == 0xd0, "EDNS(0) adds an OPT record of the payload size");
+	ok (np_dns_encode_query (1, "a..b", NP_DNS_A, NP_DNS_CLASS_IN, 0, 0, buf, sizeof (buf)) == -1,
+	    "an empty label is rejected");
+	ok (np_dns_encode_query (1, "0123456789012345678901234567890123456789012345678901234567890123.com",
+	                         NP_DNS_A, NP_DNS_CLASS_IN, 0, 0, buf, sizeof (buf)) == -1,
+	    "a label of 64 octets is rejected");
+	ok (np_dns_encode_query (1, "a\\.b", NP_DNS_A, NP_DNS_CLASS_IN, 0, 0, buf, sizeof (buf)) == 21 &&
+	    buf[12] == 3 && buf[14] == '.', "an escaped dot stays in its label");
+	ok (np_dns_encode_query (1, "www.example.com", NP_DNS_A, NP_DNS_CLASS_IN, 0, 0, buf, 20) == -1,
+	    "encoding into a short buffer fails");
+
+	ok (np_dns_same_name ("www.Example.COM.", "www.example.com") &&
+	    !np_dns_same_name ("www.example.com", "ww.example.com"), "names match but for case and a final dot");
+
+	ok (np_dns_decode (a_response, sizeof (a_response), &m), "decode a response");
+	ok (m.id == 0x1234 && (m.flags & NP_DNS_QR) && (m.flags & NP_DNS_AA) &&
+	    m.rcode == NP_DNS_NOERROR && m.edns, "the header decodes");
+	ok (!strcmp (m.qname, "www.example.com.") && m.qtype == NP_DNS_A && m.qclass == NP_DNS_CLASS_IN,
+	    "the question decodes");
+	ok (m.count == 3 && m.counts[NP_DNS_ANSWER] == 3 && m.counts[NP_DNS_ADDITIONAL] == 0,
+	    "the OPT record is not counted as a record");
+	ok (m.rr[0].type == NP_DNS_CNAME && !strcmp (m.rr[0].data, "web.example.com.") && m.rr[0].ttl == 3600,
+	    "a compressed CNAME decodes");
+	ok (m.rr[1].type == NP_DNS_A && !strcmp (m.rr[1].name, "web.example.com.") &&
+	    !strcmp (m.rr[1].data, "192.0.2.1"), "a name pointing into data decodes");
+	ok (m.rr[2].type == NP_DNS_TXT && !strcmp (m.rr[2].data, "\"v=spf1 -all\" \"a\\\"b\""),
+	    "TXT strings are quoted and escaped");
+	np_dns_message_free (&m);
+
+	ok (!np_dns_decode (a_response, sizeof (a_response) - 12, &m), "a cut off response is rejected");
+	ok (!np_dns_decode (loop_response, sizeof (loop_response), &m), "a name pointing at itself is rejected");
+
+	memcpy (buf, a_query, sizeof (a_query));
+	buf[2] |= 0x80;
+	len = add_record (buf, sizeof (a_query), NP_DNS_MX, mx, sizeof (mx));
+	len = add_record (buf, len, NP_DNS_SRV, srv, sizeof (srv));
+	len = add_record (buf, len, NP_DNS_SOA, soa, sizeof (soa));
+	len = add_record (buf, len, NP_DNS_AAAA, aaaa, sizeof (aaaa));
+	len = add_record (buf, len, 65, unknown, sizeof (unknown));
+	ok (np_dns_decode (buf, len, &m) && m.count == 5, "decode a response with more types");
+	ok (!strcmp (m.rr[0].data, "10 mail."), "an MX record decodes");
+	ok (!strcmp (m.rr[1].data, "1 5 5060 sip."), "an SRV record decodes");
+	ok (!strcmp (m.rr[2].data, "ns. host. 2018192145 7200 3600 1209600 3600"), "an SOA record decodes");
+	ok (!strcmp (m.rr[3].data, "2001:db8::1"), "an AAAA record decodes");
+	ok (!strcmp (m.rr[4].data, "\\# 2 DEAD"), "an unknown record decodes as in RFC 3597");
+	np_dns_message_free (&m);
+	len = add_record (buf, len, NP_DNS_A, bad_a, sizeof (bad_a));
+	ok (!np_dns_decode (buf, len, &m), "an A record of 3 octets is rejected");
+
+	ok (!strcmp (np_dns_reverse_name ("192.0.2.1", str, sizeof (str)), "1.2.0.192.in-addr.arpa"),
+	    "the reverse name of an IPv4 address");
+	ok (!strcmp (np_dns_reverse_name ("2001:db8::1", str, sizeof (str)),
+	             "1.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.8.b.d.0.1.0.0.2.ip6.arpa"),
+	    "the reverse name of an IPv6 address");
+	ok (np_dns_reverse_name ("www.example.com", str, sizeof (str)) == NULL, "a name has no reverse name");
+
+	fp = fdopen (mkstemp (resolv_conf), "w");
+	fputs ("# generated\nsearch example.com\n  nameserver\t192.0.2.53 # first\nnameserver 192.0.2.54\n", fp);
+	fclose (fp);
+	ok (!strcmp (np_dns_default_server (resolv_conf, str, sizeof (str)), "192.0.2.53"),
+	    "the first nameserver of resolv.conf is the default");
+	unlink (resolv_conf);
+	ok (!strcmp (np_dns_default_server (resolv_conf, str, sizeof (str)), "127.0.0.1"),
+	    "the local host is the default without resolv.conf");
+
+	memset (&sin, 0, sizeof (sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	port = truncating_server (&pid);
+	sin.sin_port = htons (port);
+	ok (port > 0 && np_dns_query ((struct sockaddr *) &sin, sizeof (sin), a_query, sizeof (a_query),
+	                              &m, 0, 2000, 0) == NP_DNS_OK, "a truncated response is asked for over TCP");
+	ok (m.tcp && m.count == 1 && !strcmp (m.rr[0].data, "192.0.2.7"), "the response over TCP decodes");
+	np_dns_message_free (&m);
+	ok (waitpid (pid, &status, 0) == pid && WIFEXITED (status) && WEXITSTATUS (status) == 0,
+	    "the server saw a query over UDP and one over TCP");
+
+	/* a socket that never answers */
+	sd = socket (AF_INET, SOCK_DGRAM, 0);
+	sin.sin_port = 0;
+	bind (sd, (struct sockaddr *) &sin, sizeof (sin));
+	addrlen = sizeof (sin);
+	getsockname (sd, (struct sockaddr *) &sin, &addrlen);
+	ok (np_dns_query ((struct sockaddr *) &sin, sizeof (sin), a_query, sizeof (a_query),
+	                  &m, 0, 100, 1) == NP_DNS_TIMEOUT, "a server that does not answer times out");
+	ok (recv (sd, buf, sizeof (buf), MSG_DONTWAIT) == sizeof (a_query) &&
+	    recv (sd, buf, sizeof (buf), MSG_DONTWAIT) == sizeof (a_query), "the query was sent again once");
+	close (sd);
+
+	/* a closed port, which the kernel answers with a port unreachable */
+	ok (np_dns_query ((struct sockaddr *) &sin, sizeof (sin), a_query, sizeof (a_query),
+	                  &m, 0, 1000, 0) == NP_DNS_ERROR && errno == ECONNREFUSED,
+	    "a refused query is an error");
+
+	memset (targets, 0, sizeof (targets));
+	targets[0].server = targets[1].server = targets[2].server = "127.0.0.1";
+	targets[0].name = "a.test";
+	targets[1].name = "b.test.";
+	targets[2].name = "c.test";
+	targets[0].type = targets[1].type = targets[2].type = NP_DNS_A;
+	snprintf (port_str, sizeof (port_str), "%d", reordering_server (&pid));
+	ok (np_dns_query_targets (targets, 3, port_str, 0, 2, 300, 0), "query several names at once");
+	ok (targets[0].status == NP_DNS_OK && targets[0].response.count == 1 &&
+	    !strcmp (targets[0].response.rr[0].data, "192.0.2.1") &&
+	    targets[1].status == NP_DNS_OK && targets[1].response.count == 1 &&
+	    !strcmp (targets[1].response.rr[0].data, "192.0.2.2"),
+	    "answers in another order find their queries, and the wrong question is dropped");
+	ok (targets[2].status == NP_DNS_TIMEOUT, "the unanswered query times out");
+	np_dns_targets_free (targets, 3);
+	waitpid (pid, &status, 0);
+
+	return exit_status ();
+}
@@ -53,8 +53,9 @@ int
 main (int argc, char **argv)
 {
 	char *optstr=NULL;
+	FILE *fp;
 
-	plan_tests(12);
+	plan_tests(20);
 
 	optstr=list2str(np_get_defaults("section@./config-tiny.ini", "check_disk"));
 	ok( !strcmp(optstr, "--one=two --Foo=Bar --this=Your Mother! --blank"), "config-tiny.ini's section as expected");
@@ -104,6 +105,55 @@ main (int argc, char **argv)
 	ok( !strcmp(optstr, "--escape --send=Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda --expect=Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda --jail"), "Long options");
 	my_free(optstr);
 
+	/* the same lookups through the section index */
+	setenv("NAGIOS_PLUGIN_STATE_DIRECTORY", "var", 1);
+
+	optstr=list2str(np_get_defaults("section_twice@./plugin.ini", "check_disk"));
+	ok( !strcmp(optstr, "--foo=bar --bar=foo"), "section_twice while building the index");
+	my_free(optstr);
+
+	optstr=list2str(np_get_defaults("section_twice@./plugin.ini", "check_disk"));
+	ok( !strcmp(optstr, "--foo=bar --bar=foo"), "section_twice from the index");
+	my_free(optstr);
+
+	optstr=list2str(np_get_defaults("check space_and_flags@./plugin.ini", "check_disk"));
+	ok( !strcmp(optstr, "--foo=bar -a -b --bar"), "space in stanza from the index");
+	my_free(optstr);
+
+	optstr=list2str(np_get_defaults("section3@./config-tiny.ini", "check_disk"));
+	ok( !strcmp(optstr, "--this=that"), "whitespace after section name from the index");
+	my_free(optstr);
+
+	fp=fopen("var/index-test.ini", "w");
+	fputs("[one]\nfoo=bar\n[two]\nbar=foo\n", fp);
+	fclose(fp);
+	optstr=list2str(np_get_defaults("two@var/index-test.ini", "check_disk"));
+	my_free(optstr);
+	fp=fopen("var/index-test.ini", "w");
+	fputs("[two]\nbaz=qux\n[one]\nfoo=bar\n; longer than before\n", fp);
+	fclose(fp);
+	optstr=list2str(np_get_defaults("two@var/index-test.ini", "check_disk"));
+	ok( !strcmp(optstr, "--baz=qux"), "stale index is rebuilt");
+	my_free(optstr);
+
+	optstr=list2str(np_get_defaults("one@var/index-test.ini", "check_disk"));
+	ok( !strcmp(optstr, "--foo=bar"), "rebuilt index used for another section");
+	my_free(optstr);
+	unlink("var/index-test.ini");
+
+	/* the last line need not end, and a header may have its options after it */
+	unsetenv("NAGIOS_PLUGIN_STATE_DIRECTORY");
+	fp=fopen("var/noeol-test.ini", "w");
+	fputs("[one] foo=bar\n[two]\n  baz = qux  ", fp);
+	fclose(fp);
+	optstr=list2str(np_get_defaults("two@var/noeol-test.ini", "check_disk"));
+	ok( !strcmp(optstr, "--baz=qux"), "last line without a newline");
+	my_free(optstr);
+	optstr=list2str(np_get_defaults("one@var/noeol-test.ini", "check_disk"));
+	ok( !strcmp(optstr, "--foo=bar"), "option on the line of its header");
+	my_free(optstr);
+	unlink("var/noeol-test.ini");
+
 	return exit_status();
 }
 
@@ -0,0 +1,96 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_output.h"
+#include "tap.h"
+
+static int
+json_is (const char *text, int code, const char *expected, const char *name)
+{
+	char *json = np_output_json ("check_test", code, text, strlen (text));
+	int result = strcmp (json, expected) == 0;
+
+	ok (result, "%s", name);
+	if (!result)
+		diag ("got %s", json);
+	free (json);
+	return result;
+}
+
+int
+main (int argc, char **argv)
+{
+	char *args[] = { "check_test", "-H", "host", "--output-format=text", "-w",
+	                 "--output-format", "text", "1", NULL };
+	int count = 8;
+
+	plan_tests (9);
+
+	json_is ("TCP OK - 0.001 second response time|time=0.001000s;;10.000000;0.000000;10.000000\n",
+	         STATE_OK,
+	         "{\"plugin\":\"check_test\",\"status\":\"OK\",\"code\":0,"
+	         "\"message\":\"TCP OK - 0.001 second response time\",\"long_output\":\"\","
+	         "\"perfdata\":[{\"label\":\"time\",\"value\":0.001,\"uom\":\"s\",\"warn\":null,"
+	         "\"crit\":\"10.000000\",\"min\":0,\"max\":10}]}\n",
+	         "A message and one metric");
+
+	json_is ("DISK WARNING - free space: / 10 MB | '/ with ''quotes'''=10MB;@5:20;~:2;; x=U\n",
+	         STATE_WARNING,
+	         "{\"plugin\":\"check_test\",\"status\":\"WARNING\",\"code\":1,"
+	         "\"message\":\"DISK WARNING - free space: / 10 MB \",\"long_output\":\"\","
+	         "\"perfdata\":[{\"label\":\"/ with 'quotes'\",\"value\":10,\"uom\":\"MB\","
+	         "\"warn\":\"@5:20\",\"crit\":\"~:2\",\"min\":null,\"max\":null},"
+	         "{\"label\":\"x\",\"value\":null,\"uom\":\"\",\"warn\":null,\"crit\":null,"
+	         "\"min\":null,\"max\":null}]}\n",
+	         "Quoted labels, ranges and U");
+
+	json_is ("CRITICAL: \"down\"\tnow\nline two\nline three|a=1 b=2c\nc=-1.5e3;1;2;3;4;5\n",
+	         STATE_CRITICAL,
+	         "{\"plugin\":\"check_test\",\"status\":\"CRITICAL\",\"code\":2,"
+	         "\"message\":\"CRITICAL: \\\"down\\\"\\tnow\",\"long_output\":\"line two\\nline three\","
+	         "\"perfdata\":[{\"label\":\"a\",\"value\":1,\"uom\":\"\",\"warn\":null,\"crit\":null,"
+	         "\"min\":null,\"max\":null},{\"label\":\"b\",\"value\":2,\"uom\":\"c\",\"warn\":null,"
+	         "\"crit\":null,\"min\":null,\"max\":null},{\"label\":\"c\",\"value\":-1500,\"uom\":\"\","
+	         "\"warn\":\"1\",\"crit\":\"2\",\"min\":3,\"max\":4}]}\n",
+	         "Long output, escapes and perfdata after it");
+
+	json_is ("", 7,
+	         "{\"plugin\":\"check_test\",\"status\":\"UNKNOWN\",\"code\":7,\"message\":\"\","
+	         "\"long_output\":\"\",\"perfdata\":[]}\n",
+	         "No output and a code past UNKNOWN");
+
+	json_is ("OK | broken stuff=", STATE_OK,
+	         "{\"plugin\":\"check_test\",\"status\":\"OK\",\"code\":0,\"message\":\"OK \","
+	         "\"long_output\":\"\",\"perfdata\":[]}\n",
+	         "Perfdata that is not ends the metrics");
+
+	json_is ("OK\001\n", STATE_OK,
+	         "{\"plugin\":\"check_test\",\"status\":\"OK\",\"code\":0,\"message\":\"OK\\u0001\","
+	         "\"long_output\":\"\",\"perfdata\":[]}\n",
+	         "Control characters are escaped");
+
+	np_output_opts (&count, args);
+	ok (count == 5 && strcmp (args[3], "-w") == 0 && strcmp (args[4], "1") == 0 && args[5] == NULL,
+	    "np_output_opts() takes --output-format out of argv, in both forms");
+	ok (np_output_format == NP_OUTPUT_TEXT, "...and text is the default format");
+	ok (np_set_output_format ("xml", "check_test") == ERROR, "Unknown formats are refused");
+
+	return exit_status ();
+}
@@ -0,0 +1,182 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_passive.h"
+#include "tap.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+static char dir[] = "/tmp/test_passive.XXXXXX";
+
+/* all there is to read on fd, up to size - 1 bytes */
+static size_t
+read_all (int fd, char *buf, size_t size)
+{
+	size_t len = 0;
+	ssize_t n;
+
+	while (len < size - 1 && (n = read (fd, buf + len, size - 1 - len)) > 0)
+		len += n;
+	buf[len] = '\0';
+	return len;
+}
+
+static int
+count_of (const char *s, const char *what)
+{
+	int n = 0;
+
+	while ((s = strstr (s, what)) != NULL) {
+		n++;
+		s += strlen (what);
+	}
+	return n;
+}
+
+int
+main (int argc, char **argv)
+{
+	np_passive p;
+	np_strbuf b;
+	struct sockaddr_un su;
+	struct dirent *de;
+	DIR *d;
+	static char buf[1 << 18], name[64];
+	char path[256], *expected, *big;
+	size_t len;
+	int fd, sd, i, files = 0, oks = 0;
+
+	plan_tests (16);
+
+	if (mkdtemp (dir) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot create directory:"), strerror (errno));
+
+	np_passive_init (&p);
+	np_passive_service (&p, 1080933700, "flint", "c1", 0, "up 2 days");
+	np_passive_host (&p, 1080933701, "flint", 1, "first\nsecond\r\n");
+	np_strbuf_init (&b, NULL);
+	np_passive_lines (&p, &b);
+	ok (!strcmp (np_strbuf_string (&b),
+	             "[1080933700] PROCESS_SERVICE_CHECK_RESULT;flint;c1;0;up 2 days\n"
+	             "[1080933701] PROCESS_HOST_CHECK_RESULT;flint;1;first\\nsecond\\n\n"),
+	    "command file lines, newlines in the output as \\n");
+	np_passive_truncate (&p, 1);
+	ok (p.count == 1, "results dropped again");
+	np_passive_free (&p);
+
+	/* many results to a FIFO: chunks of whole lines of at most PIPE_BUF */
+	np_passive_init (&p);
+	for (i = 0; i < 300; i++) {
+		snprintf (name, sizeof (name), "service%d", i);
+		np_passive_service (&p, 1080933700, "host.example.com", name, i % 4, "OK - the output of a check that has some length to it");
+	}
+	np_strbuf_init (&b, NULL);
+	np_passive_lines (&p, &b);
+	expected = strdup (np_strbuf_string (&b));
+	snprintf (path, sizeof (path), "%s/nagios.cmd", dir);
+	mkfifo (path, 0600);
+	fd = open (path, O_RDWR | O_NONBLOCK);
+	ok (np_passive_write (&p, fd) == OK, "written to a FIFO");
+	len = read_all (fd, buf, sizeof (buf));
+	ok (len == strlen (expected) && !strcmp (buf, expected), "all of it, in order");
+	ok (p.writes > 1 && p.writes <= len / (PIPE_BUF - 100) + 1, "in %lu writes of up to PIPE_BUF", p.writes);
+
+	/* a line longer than PIPE_BUF goes alone */
+	big = malloc (PIPE_BUF * 2);
+	memset (big, 'x', PIPE_BUF * 2 - 1);
+	big[PIPE_BUF * 2 - 1] = '\0';
+	np_passive_truncate (&p, 1);
+	np_passive_service (&p, 1080933700, "h", "big", 0, big);
+	np_passive_service (&p, 1080933700, "h", "small", 0, "OK");
+	ok (np_passive_write (&p, fd) == OK && p.writes == 3, "a long line in a write of its own");
+	len = read_all (fd, buf, sizeof (buf));
+	ok (len > PIPE_BUF * 2 && count_of (buf, "PROCESS_SERVICE_CHECK_RESULT") == 3, "and the lines around it");
+	close (fd);
+
+	/* to a plain file, in one write */
+	snprintf (path, sizeof (path), "%s/results", dir);
+	ok (np_passive_send (&p, path) == OK && p.writes == 1, "to a file in one write");
+	fd = open (path, O_RDONLY);
+	len = read_all (fd, buf, sizeof (buf));
+	close (fd);
+	ok (count_of (buf, "PROCESS_SERVICE_CHECK_RESULT") == 3, "with every result");
+
+	/* a checkresult spool file, with its .ok */
+	np_passive_truncate (&p, 2);
+	np_passive_host (&p, 1080933702, "h", 2, "DOWN");
+	snprintf (path, sizeof (path), "%s%s", NP_PASSIVE_SPOOL, dir);
+	ok (np_passive_send (&p, path) == OK, "spool file written");
+	d = opendir (dir);
+	while ((de = readdir (d)) != NULL) {
+		if (de->d_name[0] != 'c')
+			continue;
+		if (strstr (de->d_name, ".ok"))
+			oks++;
+		else {
+			files++;
+			snprintf (path, sizeof (path), "%s/%s", dir, de->d_name);
+			fd = open (path, O_RDONLY);
+			len = read_all (fd, buf, sizeof (buf));
+			close (fd);
+		}
+	}
+	closedir (d);
+	ok (files == 1 && oks == 1, "one file, ready to be read");
+	ok (!strncmp (buf, "### Active Check Result File ###\nfile_time=", 43) &&
+	    count_of (buf, "### Nagios Service Check Result ###\nhost_name=") == 2 &&
+	    strstr (buf, "### Nagios Host Check Result ###\nhost_name=h\ncheck_type=1\n") != NULL,
+	    "with a record for each result");
+	ok (strstr (buf, "return_code=2\noutput=DOWN\n\n") != NULL &&
+	    strstr (buf, "start_time=1080933700.0\n") != NULL, "and their codes and times");
+
+	/* livestatus over a unix socket */
+	snprintf (path, sizeof (path), "%s/live", dir);
+	memset (&su, 0, sizeof (su));
+	su.sun_family = AF_UNIX;
+	strcpy (su.sun_path, path);
+	sd = socket (AF_UNIX, SOCK_STREAM, 0);
+	bind (sd, (struct sockaddr *) &su, sizeof (su));
+	listen (sd, 1);
+	snprintf (path, sizeof (path), "%s%s/live", NP_PASSIVE_LIVESTATUS, dir);
+	np_passive_truncate (&p, 1);
+	np_passive_service (&p, 1080933700, "h", "small", 0, "OK");
+	ok (np_passive_send (&p, path) == OK, "sent to livestatus");
+	fd = accept (sd, NULL, NULL);
+	len = read_all (fd, buf, sizeof (buf));
+	close (fd);
+	close (sd);
+	ok (!strcmp (buf, "COMMAND [1080933700] PROCESS_SERVICE_CHECK_RESULT;host.example.com;service0;0;"
+	             "OK - the output of a check that has some length to it\n\n"
+	             "COMMAND [1080933700] PROCESS_SERVICE_CHECK_RESULT;h;small;0;OK\n\n"),
+	    "as COMMAND requests on one connection");
+	snprintf (path, sizeof (path), "%s%s/nonexistent", NP_PASSIVE_LIVESTATUS, dir);
+	ok (np_passive_send (&p, path) == ERROR, "no livestatus to send to");
+	np_passive_free (&p);
+	free (big);
+	free (expected);
+
+	snprintf (path, sizeof (path), "rm -rf %s", dir);
+	i = system (path);
+	return exit_status ();
+}
@@ -0,0 +1,339 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_proc.h"
+#include "tap.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+
+static char root[] = "/tmp/test_proc.XXXXXX";
+
+static void
+write_file (const char *name, const char *content)
+{
+	char path[256];
+	FILE *fp;
+
+	snprintf (path, sizeof (path), "%s/%s", root, name);
+	if ((fp = fopen (path, "w")) == NULL)
+		die (STATE_UNKNOWN, "%s %s: %s\n", _("Cannot create file:"), path, strerror (errno));
+	fputs (content, fp);
+	fclose (fp);
+}
+
+static void
+write_data (const char *name, const char *content, size_t len)
+{
+	char path[256];
+	FILE *fp;
+
+	snprintf (path, sizeof (path), "%s/%s", root, name);
+	if ((fp = fopen (path, "w")) == NULL)
+		die (STATE_UNKNOWN, "%s %s: %s\n", _("Cannot create file:"), path, strerror (errno));
+	fwrite (content, 1, len, fp);
+	fclose (fp);
+}
+
+static void
+make_dir (const char *name)
+{
+	char path[256];
+
+	snprintf (path, sizeof (path), "%s/%s", root, name);
+	mkdir (path, 0700);
+}
+
+int
+main (int argc, char **argv)
+{
+	double load[3], uptime;
+	np_proc_meminfo mi;
+	np_proc_swap swaps[4];
+	np_proc_pressure psi;
+	np_proc_stat st;
+	np_proc_vmstat vm;
+	np_proc_scan scan;
+	np_proc_entry pe;
+	np_proc_cpu cpu;
+	np_proc_snapshot snap;
+	np_proc_snapshot_header header;
+	np_proc_table table;
+	np_proc_table_entry *te;
+	char path[256];
+	int n, fd;
+
+	plan_tests (74);
+
+	if (mkdtemp (root) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot create directory:"), strerror (errno));
+	np_proc_set_root (root);
+
+	ok (np_proc_loadavg (load) == FALSE, "no loadavg file");
+	write_file ("loadavg", "0.52 1.07 2.50 3/812 43211\n");
+	ok (np_proc_loadavg (load) == TRUE, "loadavg read");
+	ok (load[0] == 0.52 && load[1] == 1.07 && load[2] == 2.50, "loadavg values");
+
+	write_file ("uptime", "5234.17 20536.42\n");
+	ok (np_proc_uptime (&uptime) == TRUE && uptime == 5234.17, "uptime read");
+
+	write_file ("meminfo",
+	            "MemTotal:       16303532 kB\n"
+	            "MemFree:         1074424 kB\n"
+	            "MemAvailable:    9353280 kB\n"
+	            "Buffers:          540072 kB\n"
+	            "Cached:          7611312 kB\n"
+	            "SwapCached:         4864 kB\n"
+	            "Active:          8332360 kB\n"
+	            "SwapTotal:       2097148 kB\n"
+	            "SwapFree:        1572860 kB\n"
+	            "Dirty:               264 kB\n");
+	ok (np_proc_meminfo_read (&mi) == TRUE, "meminfo read");
+	ok (mi.mem_total == 16303532 && mi.mem_free == 1074424 && mi.mem_available == 9353280, "memory");
+	ok (mi.buffers == 540072 && mi.cached == 7611312 && mi.swap_cached == 4864, "caches");
+	ok (mi.swap_total == 2097148 && mi.swap_free == 1572860, "swap totals");
+	write_file ("meminfo", "Active:          8332360 kB\n");
+	ok (np_proc_meminfo_read (&mi) == FALSE, "meminfo without MemTotal");
+
+	write_file ("swaps", "Filename\t\t\t\tType\t\tSize\t\tUsed\t\tPriority\n");
+	ok (np_proc_swaps (swaps, 4) == 0, "no swap areas");
+	write_file ("swaps",
+	            "Filename\t\t\t\tType\t\tSize\t\tUsed\t\tPriority\n"
+	            "/dev/dm-1                               partition\t1048572\t\t524288\t\t-2\n"
+	            "/swap\\040file                           file\t\t1048576\t\t0\t\t-3\n");
+	n = np_proc_swaps (swaps, 4);
+	ok (n == 2, "two swap areas");
+	ok (!strcmp (swaps[0].name, "/dev/dm-1") && !strcmp (swaps[0].type, "partition"), "first area");
+	ok (swaps[0].size == 1048572 && swaps[0].used == 524288 && swaps[0].priority == -2, "first sizes");
+	ok (!strcmp (swaps[1].name, "/swap\\040file") && swaps[1].size == 1048576 && swaps[1].used == 0, "second area");
+	ok (np_proc_swaps (swaps, 1) == 1, "up to max areas");
+
+	make_dir ("pressure");
+	ok (np_proc_pressure_read ("memory", &psi) == FALSE, "no pressure file");
+	write_file ("pressure/memory",
+	            "some avg10=1.53 avg60=0.87 avg300=0.22 total=5123456\n"
+	            "full avg10=0.40 avg60=0.11 avg300=0.02 total=1234567\n");
+	ok (np_proc_pressure_read ("memory", &psi) == TRUE, "memory pressure read");
+	ok (psi.some_avg10 == 1.53 && psi.some_avg60 == 0.87 && psi.some_avg300 == 0.22 && psi.some_total == 5123456, "some");
+	ok (psi.has_full && psi.full_avg10 == 0.40 && psi.full_total == 1234567, "full");
+	write_file ("pressure/cpu", "some avg10=0.00 avg60=0.01 avg300=0.00 total=98765\n");
+	ok (np_proc_pressure_read ("cpu", &psi) == TRUE && !psi.has_full && psi.some_total == 98765, "cpu pressure without full");
+
+	write_file ("stat",
+	            "cpu  10132153 290696 3084719 46828483 16683 0 25195 0 0 0\n"
+	            "cpu0 1393280 32966 572056 13343292 6130 0 17875 0 0 0\n"
+	            "cpu1 1335003 35549 468951 13380063 4205 0 3280 0 0 0\n"
+	            "intr 114930548 113199788 3 0 5 263 0 4 [2] 1 1 0 0\n"
+	            "ctxt 1990473\n"
+	            "btime 1062191376\n"
+	            "processes 2915\n"
+	            "procs_running 1\n"
+	            "procs_blocked 2\n");
+	ok (np_proc_stat_read (&st) == TRUE, "stat read");
+	ok (st.cpu[NP_PROC_CPU_USER] == 10132153 && st.cpu[NP_PROC_CPU_IDLE] == 46828483 && st.cpu[NP_PROC_CPU_SOFTIRQ] == 25195, "cpu ticks");
+	ok (st.cpus == 2, "cpu count");
+	ok (st.ctxt == 1990473 && st.btime == 1062191376 && st.processes == 2915, "counters");
+	ok (st.procs_running == 1 && st.procs_blocked == 2, "running and blocked");
+
+	ok (np_proc_vmstat_read (&vm) == FALSE, "no vmstat file");
+	write_file ("vmstat",
+	            "nr_free_pages 262490\n"
+	            "pswpin 81234\n"
+	            "pswpout 150023\n"
+	            "pgmajfault 40417\n");
+	ok (np_proc_vmstat_read (&vm) == TRUE, "vmstat read");
+	ok (vm.pswpin == 81234 && vm.pswpout == 150023 && vm.pgmajfault == 40417, "swap counters");
+
+	/* a process table of a shell and a kernel thread */
+	make_dir ("1234");
+	write_file ("1234/stat", "1234 (my (odd) sh) S 1 1234 1234 34816 1300 4194304 1443 0 0 0 "
+	            "150 50 0 0 20 0 1 0 500000 12922880 800 18446744073709551615\n");
+	write_file ("1234/status", "Name:\tsh\nUid:\t1000\t1001\t1001\t1001\nVmLck:\t       0 kB\nVmRSS:\t    3300 kB\n");
+	write_data ("1234/cmdline", "/bin/sh\0-c\0echo\nhi\0", 19);
+	write_file ("1234/cgroup", "0::/user.slice/session-1.scope\n");
+	make_dir ("2");
+	write_file ("2/stat", "2 (kthreadd) S 0 0 0 0 -1 2129984 0 0 0 0 0 0 0 0 20 0 1 0 2 0 0 18446744073709551615\n");
+	write_file ("2/cmdline", "");
+	write_file ("2/cgroup", "0::/\n");
+	make_dir ("self");
+
+	ok (np_proc_scan_open (&scan) == TRUE, "scan opened");
+	ok (scan.uptime == 5234 && scan.uptime_ms == 5234170, "scan uptime");
+	for (n = 0; np_proc_scan_next (&scan, &pe) && pe.pid != 1234; n++)
+		;
+	ok (pe.pid == 1234 && pe.ppid == 1, "shell found");
+	ok (!strcmp (pe.prog, "my (odd) sh"), "comm with parentheses");
+	ok (pe.start == 500000 && pe.ticks == 200, "start and ticks");
+	ok (pe.vsz == 12620 && !strcmp (pe.stat, "S"), "vsz and state");
+	ok (np_proc_scan_status (&scan, &pe) == TRUE, "status read");
+	ok (pe.uid == 1001 && pe.rss == 3300 && !strcmp (pe.stat, "Ss"), "uid, rss and flags");
+	ok (np_proc_scan_args (&scan, &pe) == TRUE && !strcmp (pe.args, "/bin/sh -c echo hi"), "args");
+	np_proc_scan_cgroup (&scan, &pe);
+	ok (!strcmp (pe.cgroup, "0::/user.slice/session-1.scope"), "cgroup");
+	np_proc_scan_close (&scan);
+
+	ok (np_proc_scan_open (&scan) == TRUE, "scan opened again");
+	while (np_proc_scan_next (&scan, &pe) && pe.pid != 2)
+		;
+	ok (pe.pid == 2 && np_proc_scan_args (&scan, &pe) == TRUE && !strcmp (pe.args, "[kthreadd]"), "kernel thread args");
+	np_proc_scan_cgroup (&scan, &pe);
+	ok (!strcmp (pe.cgroup, "-"), "root cgroup left out");
+	np_proc_scan_close (&scan);
+
+	ok (np_proc_scan_open (&scan) == TRUE && np_proc_scan_pid (&scan, 1234, &pe) == TRUE
+	    && pe.pid == 1234 && pe.ticks == 200, "one process by its pid");
+	ok (np_proc_scan_args (&scan, &pe) == TRUE && !strcmp (pe.args, "/bin/sh -c echo hi"), "...and its args");
+	ok (np_proc_scan_pid (&scan, 4321, &pe) == FALSE, "no process of another pid");
+	np_proc_scan_close (&scan);
+
+	/* CPU over an interval: 200 ticks at the first scan, 300 at the next
+	 * one, 10 s later */
+	memset (&cpu, 0, sizeof (cpu));
+	ok (np_proc_scan_open (&scan) == TRUE, "first sample");
+	np_proc_cpu_begin (&cpu, &scan);
+	while (np_proc_scan_next (&scan, &pe))
+		np_proc_cpu_update (&cpu, &pe);
+	np_proc_scan_close (&scan);
+	ok (cpu.count == 1, "only the process that used CPU time kept");
+	np_proc_cpu_next (&cpu);
+
+	write_file ("uptime", "5244.17 20536.42\n");
+	write_file ("1234/stat", "1234 (my (odd) sh) S 1 1234 1234 34816 1300 4194304 1443 0 0 0 "
+	            "230 70 0 0 20 0 1 0 500000 12922880 800 18446744073709551615\n");
+	ok (np_proc_scan_open (&scan) == TRUE, "second sample");
+	np_proc_cpu_begin (&cpu, &scan);
+	while (np_proc_scan_next (&scan, &pe) && pe.pid != 1234)
+		;
+	ok (pe.pcpu > 1.1 && pe.pcpu < 1.3, "lifetime %%CPU before the update: %.1f", pe.pcpu);
+	np_proc_cpu_update (&cpu, &pe);
+	ok (pe.pcpu > 9.9 && pe.pcpu < 10.1, "%%CPU over the interval: %.1f", pe.pcpu);
+	np_proc_scan_close (&scan);
+
+	/* and through a state file */
+	snprintf (path, sizeof (path), "%s/cpu.state", root);
+	ok (np_proc_cpu_save (&cpu, path) == TRUE, "state saved");
+	np_proc_cpu_free (&cpu);
+	np_proc_cpu_load (&cpu, path);
+	ok (cpu.have_old && cpu.last.count == 1 && cpu.last.uptime_ms == 5244170, "state loaded");
+	ok (cpu.old[0].pid == 1234 && cpu.old[0].start == 500000 && cpu.old[0].ticks == 300, "state record");
+	np_proc_cpu_free (&cpu);
+	snprintf (path, sizeof (path), "%s/nonexistent.state", root);
+	np_proc_cpu_load (&cpu, path);
+	ok (cpu.have_old == FALSE, "no state file");
+	np_proc_cpu_free (&cpu);
+
+	/* a snapshot of all of it, taken by the first to want one */
+	write_file ("meminfo", "MemTotal:       16303532 kB\nMemFree:         1074424 kB\nSwapTotal:       2097148 kB\nSwapFree:        1572860 kB\n");
+	write_file ("2/status", "Name:\tkthreadd\nUid:\t0\t0\t0\t0\n");
+	snprintf (path, sizeof (path), "%s/snapshot", root);
+	ok (np_proc_snapshot_open (&snap, path, 60) == TRUE && snap.age == 0, "snapshot taken");
+	ok ((snap.header->have & (NP_PROC_SNAPSHOT_LOADAVG | NP_PROC_SNAPSHOT_MEMINFO | NP_PROC_SNAPSHOT_PROCS)) ==
+	    (NP_PROC_SNAPSHOT_LOADAVG | NP_PROC_SNAPSHOT_MEMINFO | NP_PROC_SNAPSHOT_PROCS) &&
+	    snap.header->load[1] == 1.07 && snap.header->meminfo.swap_free == 1572860, "with the load and memory");
+	while (np_proc_snapshot_next (&snap, &pe) && pe.pid != 1234)
+		;
+	ok (pe.pid == 1234 && pe.ppid == 1 && pe.uid == 1001 && pe.rss == 3300 && !strcmp (pe.stat, "Ss") &&
+	    !strcmp (pe.prog, "my (odd) sh"), "a process with its status");
+	ok (!strcmp (pe.args, "/bin/sh -c echo hi") && !strcmp (pe.cgroup, "0::/user.slice/session-1.scope"), "its args and cgroup");
+	for (snap.next = 0, n = 0; np_proc_snapshot_next (&snap, &pe); n++)
+		;
+	ok (n == 2, "and the rest of the table");
+	np_proc_snapshot_close (&snap);
+
+	write_file ("loadavg", "9.00 9.00 9.00 3/812 43211\n");
+	ok (np_proc_snapshot_open (&snap, path, 60) == TRUE && snap.header->load[1] == 1.07, "a fresh snapshot is shared");
+	np_proc_snapshot_close (&snap);
+
+	/* as if taken two minutes ago */
+	fd = open (path, O_RDWR);
+	n = pread (fd, &header, sizeof (header), 0);
+	header.time -= 120;
+	n = pwrite (fd, &header, sizeof (header), 0);
+	close (fd);
+	ok (np_proc_snapshot_open (&snap, path, 60) == TRUE && snap.header->load[1] == 9.00, "an old one is taken again");
+	np_proc_snapshot_close (&snap);
+
+	truncate (path, sizeof (header) + 10);
+	write_file ("loadavg", "3.00 3.00 3.00 3/812 43211\n");
+	ok (np_proc_snapshot_open (&snap, path, 60) == TRUE && snap.header->load[1] == 3.00, "and so is one cut short");
+	np_proc_snapshot_close (&snap);
+
+	/* the table of a resident worker, told of the changes as the proc
+	 * connector would */
+	np_proc_table_init (&table);
+	table.listening = TRUE;
+	ok (np_proc_table_update (&table) == TRUE && table.rescanned && table.count == 2 && table.reads == 2,
+	    "table scanned whole at first");
+	ok (np_proc_table_update (&table) == TRUE && !table.rescanned && table.reads == 0,
+	    "and nothing read with nothing changed");
+	make_dir ("77");
+	write_file ("77/stat", "77 (sh) S 1234 77 77 0 -1 4194304 0 0 0 0 1 1 0 0 20 0 1 0 510000 4096000 100 18446744073709551615\n");
+	write_file ("77/status", "Name:\tsh\nUid:\t1001\t1001\t1001\t1001\n");
+	write_data ("77/cmdline", "sh\0", 3);
+	write_file ("77/cgroup", "0::/\n");
+	make_dir ("78");
+	write_file ("78/stat", "78 (sleep) S 77 77 77 0 -1 4194304 0 0 0 0 0 0 0 0 20 0 1 0 510100 4096000 100 18446744073709551615\n");
+	write_file ("78/status", "Name:\tsleep\nUid:\t1001\t1001\t1001\t1001\n");
+	write_data ("78/cmdline", "sleep\0" "60\0", 9);
+	write_file ("78/cgroup", "0::/\n");
+	np_proc_table_touch (&table, 77);
+	np_proc_table_touch (&table, 78);
+	np_proc_table_touch (&table, 77);
+	ok (np_proc_table_update (&table) == TRUE && !table.rescanned && table.count == 4 && table.reads == 2,
+	    "the processes forked read, once each");
+	for (te = table.entries; te < table.entries + table.count && te->pe.pid != 78; te++)
+		;
+	ok (te->pe.ppid == 77 && !strcmp (te->pe.args, "sleep 60") && te->pe.uid == 1001, "with their args and owner");
+	write_data ("77/cmdline", "/bin/true\0", 10);
+	np_proc_table_touch (&table, 77);
+	ok (np_proc_table_update (&table) == TRUE && table.reads == 1, "an exec read again");
+	for (te = table.entries; te < table.entries + table.count && te->pe.pid != 77; te++)
+		;
+	ok (!strcmp (te->pe.args, "/bin/true"), "with its new args");
+
+	/* 77 exits, and 78 is inherited by init */
+	snprintf (path, sizeof (path), "rm -rf %s/77", root);
+	system (path);
+	write_file ("78/stat", "78 (sleep) S 1 77 77 0 -1 4194304 0 0 0 0 0 0 0 0 20 0 1 0 510100 4096000 100 18446744073709551615\n");
+	np_proc_table_touch (&table, 77);
+	ok (np_proc_table_update (&table) == TRUE && table.count == 3 && table.reads == 2, "an exit read, and its children");
+	for (te = table.entries; te < table.entries + table.count && te->pe.pid != 78; te++)
+		;
+	ok (te->pe.pid == 78 && te->pe.ppid == 1, "which have another parent");
+
+	/* what changes without an event */
+	write_file ("78/stat", "78 (sleep) R 1 77 77 0 -1 4194304 0 0 0 0 0 0 0 0 20 0 1 0 510100 8192000 100 18446744073709551615\n");
+	ok (np_proc_table_live (&table, te) == TRUE && te->pe.vsz == 8000 && te->pe.stat[0] == 'R', "live fields read again");
+	write_file ("78/stat", "78 (sleep) S 1 77 77 0 -1 4194304 0 0 0 0 0 0 0 0 20 0 1 0 520000 4096000 100 18446744073709551615\n");
+	ok (np_proc_table_live (&table, te) == FALSE && table.nchanged == 1, "a pid taken by another process is not");
+	np_proc_table_done (&table);
+
+	table.scanned -= NP_PROC_TABLE_RESYNC;
+	ok (np_proc_table_update (&table) == TRUE && table.rescanned && table.count == 3, "scanned whole again in time");
+	table.listening = FALSE;
+	ok (np_proc_table_update (&table) == TRUE && table.rescanned, "and at each update while not told of changes");
+	np_proc_table_free (&table);
+
+	np_proc_set_root ("/nonexistent");
+	ok (np_proc_scan_open (&scan) == FALSE, "no process table");
+
+	snprintf (path, sizeof (path), "rm -rf %s", root);
+	system (path);
+	return exit_status ();
+}
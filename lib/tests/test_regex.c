@@ -0,0 +1,110 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_regex.h"
+#include <locale.h>
+#include "tap.h"
+
+/* whether pattern matches string, the same with either engine */
+static void
+match_is (const char *pattern, int cflags, const char *string, int expect)
+{
+	np_regex_t re;
+	int err = np_regcomp (&re, pattern, cflags);
+
+	if (err != 0) {
+		ok (FALSE, "'%s' does not compile", pattern);
+		return;
+	}
+	ok ((np_regexec (&re, string, 0, NULL, 0) == 0) == expect,
+	    "'%s' %s with %s", pattern, expect ? "matches" : "does not match", np_regex_engine (&re));
+	np_regfree (&re);
+}
+
+int
+main (int argc, char **argv)
+{
+	int ere = REG_EXTENDED | REG_NOSUB;
+	np_regex_t re;
+	regmatch_t pmatch[4];
+	char errbuf[256];
+	int err;
+
+	plan_tests (30);
+
+	match_is ("a.c", ere, "xabcx", TRUE);
+	match_is ("a.c", ere, "ac", FALSE);
+	match_is ("HeLLo", ere | REG_ICASE, "well, hello world", TRUE);
+	match_is ("HeLLo", ere, "well, hello world", FALSE);
+	match_is ("[[:digit:]]+ms", ere, "took 15ms", TRUE);
+	match_is ("^/srv/vol[0-9]+/(archive|backup)[0-9]*$", ere, "/srv/vol07/backup12", TRUE);
+	match_is ("^/srv/vol[0-9]+/(archive|backup)[0-9]*$", ere, "/srv/vol07/backup12/x", FALSE);
+
+	/* lines, as check_http and check_snmp have them */
+	match_is ("^second$", ere | REG_NEWLINE, "first\nsecond\nthird", TRUE);
+	match_is ("^second$", ere, "first\nsecond\nthird", FALSE);
+	match_is ("first.second", ere, "first\nsecond", TRUE);
+	match_is ("first.second", ere | REG_NEWLINE, "first\nsecond", FALSE);
+	match_is ("end$", ere, "the end\n", FALSE);
+	match_is ("end$", ere | REG_NEWLINE, "the end\n", TRUE);
+
+	/* left to regcomp(): a basic expression, GNU word boundaries */
+	match_is ("a\\{2\\}b", REG_NOSUB, "xaab", TRUE);
+	match_is ("a\\{2\\}b", REG_NOSUB, "xab", FALSE);
+	match_is ("\\<cat\\>", ere, "a cat sat", TRUE);
+	match_is ("\\<cat\\>", ere, "concatenate", FALSE);
+
+	err = np_regcomp (&re, "\\<cat\\>", ere);
+	ok (err == 0 && strcmp (np_regex_engine (&re), "posix") == 0, "word boundaries are regexec's");
+	np_regfree (&re);
+	err = np_regcomp (&re, "cat", ere);
+#ifdef HAVE_PCRE2
+	ok (err == 0 && strncmp (np_regex_engine (&re), "pcre2", 5) == 0, "extended expressions are PCRE2's");
+#else
+	ok (err == 0 && strcmp (np_regex_engine (&re), "posix") == 0, "without PCRE2, everything is regexec's");
+#endif
+	np_regfree (&re);
+
+	err = np_regcomp (&re, "([a-z]+)=([0-9]+)(x)?", REG_EXTENDED);
+	ok (err == 0 && np_regexec (&re, "  key=42;", 4, pmatch, 0) == 0, "Match with subexpressions");
+	ok (pmatch[0].rm_so == 2 && pmatch[0].rm_eo == 8, "the whole match");
+	ok (pmatch[1].rm_so == 2 && pmatch[1].rm_eo == 5, "the first group");
+	ok (pmatch[2].rm_so == 6 && pmatch[2].rm_eo == 8, "the second group");
+	ok (pmatch[3].rm_so == -1 && pmatch[3].rm_eo == -1, "a group that did not take part");
+	np_regfree (&re);
+
+	err = np_regcomp (&re, "^abc", ere);
+	ok (np_regexec (&re, "abc", 0, NULL, REG_NOTBOL) == REG_NOMATCH, "REG_NOTBOL");
+	ok (np_regexec (&re, "abcd", 0, NULL, 0) == 0, "and without");
+	np_regfree (&re);
+
+	err = np_regcomp (&re, "a(b", ere);
+	ok (err != 0, "An expression that does not compile");
+	ok (np_regerror (err, &re, errbuf, sizeof (errbuf)) > 1 && *errbuf, "is explained: %s", errbuf);
+
+	/* characters, not bytes, in a UTF-8 locale */
+	if (setlocale (LC_CTYPE, "C.UTF-8") || setlocale (LC_CTYPE, "en_US.UTF-8")) {
+		match_is ("^.$", ere, "\xc3\xa9", TRUE);
+		match_is ("^..$", ere, "\xc3\xa9", FALSE);
+	} else {
+		skip (2, "No UTF-8 locale");
+	}
+
+	return exit_status ();
+}
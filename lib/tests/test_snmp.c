@@ -0,0 +1,339 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_snmp.h"
+#include "tap.h"
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+/* the sysUpTime.0 GET from "snmpget -v2c -c public host 1.3.6.1.2.1.1.3.0",
+ * with request id 0x1234 */
+static const unsigned char get_request[] = {
+	0x30, 0x27, 0x02, 0x01, 0x01, 0x04, 0x06, 'p', 'u', 'b', 'l', 'i', 'c',
+	0xa0, 0x1a, 0x02, 0x02, 0x12, 0x34, 0x02, 0x01, 0x00, 0x02, 0x01, 0x00,
+	0x30, 0x0e, 0x30, 0x0c, 0x06, 0x08, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x01,
+	0x03, 0x00, 0x05, 0x00
+};
+
+/* A child that answers count requests on a UDP socket of 127.0.0.1
+ * with the request itself as the response; the port is returned. */
+static int
+echo_agent (int count, pid_t *pid)
+{
+	unsigned char buf[NP_SNMP_MAX_MESSAGE];
+	struct sockaddr_in sin, from;
+	socklen_t len = sizeof (sin);
+	np_snmp_pdu pdu;
+	int sd, n;
+
+	sd = socket (AF_INET, SOCK_DGRAM, 0);
+	memset (&sin, 0, sizeof (sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	bind (sd, (struct sockaddr *) &sin, sizeof (sin));
+	getsockname (sd, (struct sockaddr *) &sin, &len);
+	if ((*pid = fork ()) == 0) {
+		while (count-- > 0) {
+			len = sizeof (from);
+			if ((n = recvfrom (sd, buf, sizeof (buf), 0, (struct sockaddr *) &from, &len)) < 0 ||
+			    !np_snmp_decode (buf, n, &pdu))
+				_exit (1);
+			pdu.type = NP_SNMP_RESPONSE;
+			n = np_snmp_encode (&pdu, buf, sizeof (buf));
+			sendto (sd, buf, n, 0, (struct sockaddr *) &from, len);
+		}
+		_exit (0);
+	}
+	close (sd);
+	return ntohs (sin.sin_port);
+}
+
+static char *
+format (int type, int64_t integer, uint64_t counter, const char *data, size_t length)
+{
+	static char *str = NULL;
+	np_snmp_varbind vb;
+
+	memset (&vb, 0, sizeof (vb));
+	vb.type = type;
+	vb.integer = integer;
+	vb.counter = counter;
+	vb.data = (const unsigned char *) data;
+	vb.length = length;
+	free (str);
+	return str = np_snmp_format_value (&vb);
+}
+
+int
+main (int argc, char **argv)
+{
+	unsigned char buf[NP_SNMP_MAX_MESSAGE];
+	char str[NP_SNMP_MAX_OID * 11];
+	np_snmp_pdu pdu, decoded;
+	np_snmp_varbind *vb;
+	np_snmp_oid oid, oid2;
+	np_snmp_mib_cache *cache;
+	np_snmp_mib_entry entry;
+	char cache_file[] = "/tmp/test_snmp.XXXXXX";
+	int len;
+
+	unsigned char key[NP_SNMP_MAX_KEY];
+	size_t key_len;
+
+	np_snmp_rate *rate;
+	struct stat st;
+	ino_t inode;
+	time_t when;
+	uint64_t counter;
+	double value;
+
+	np_snmp_response_cache *responses, *other;
+
+	np_snmp_target targets[3];
+	char agent_port[8];
+	pid_t pid;
+
+	plan_tests (71);
+
+	ok (np_snmp_parse_oid ("1.3.6.1.2.1.1.3.0", &oid) && oid.len == 9 && oid.id[8] == 0,
+	    "parse a numeric OID");
+	ok (np_snmp_parse_oid (".1.3.6.1.2.1.1.3.0", &oid2) && np_snmp_oid_compare (&oid, &oid2) == 0,
+	    "parse a numeric OID with a leading dot");
+	ok (np_snmp_parse_oid ("iso.3.6.1.2.1.1.3.0", &oid2) && np_snmp_oid_compare (&oid, &oid2) == 0,
+	    "parse an OID starting with iso");
+	ok (np_snmp_parse_oid ("1.3.6.1.4.1.4294967295", &oid2) && oid2.id[6] == 4294967295U,
+	    "parse the largest sub-identifier");
+	ok (!np_snmp_parse_oid ("1.3.6.1.4.1.4294967296", &oid2), "reject a sub-identifier that is too large");
+	ok (!np_snmp_parse_oid ("sysUpTime.0", &oid2), "reject a MIB name");
+	ok (!np_snmp_parse_oid ("1.3.6.", &oid2), "reject a trailing dot");
+	ok (!np_snmp_parse_oid ("1..3", &oid2), "reject an empty sub-identifier");
+	ok (!np_snmp_parse_oid ("1", &oid2), "reject a single sub-identifier");
+	ok (!np_snmp_parse_oid ("3.1", &oid2), "reject a first sub-identifier above 2");
+
+	ok (!strcmp (np_snmp_oid_string (&oid, TRUE, str, sizeof (str)), "iso.3.6.1.2.1.1.3.0"),
+	    "format an OID as iso");
+	ok (!strcmp (np_snmp_oid_string (&oid, FALSE, str, sizeof (str)), "1.3.6.1.2.1.1.3.0"),
+	    "format an OID numerically");
+	np_snmp_parse_oid ("1.3.6.1.2.1.1.3", &oid2);
+	ok (np_snmp_oid_compare (&oid2, &oid) < 0, "a prefix sorts first");
+	np_snmp_parse_oid ("1.3.6.1.2.1.1.10", &oid2);
+	ok (np_snmp_oid_compare (&oid2, &oid) > 0, "sub-identifiers compare as numbers");
+	np_snmp_parse_oid ("1.3.6.1.2.1.1", &oid2);
+	ok (np_snmp_oid_in_subtree (&oid, &oid2), "an OID is in the subtree above it");
+	ok (!np_snmp_oid_in_subtree (&oid2, &oid2), "an OID is not in its own subtree");
+	np_snmp_parse_oid ("1.3.6.1.2.1.10", &oid2);
+	ok (!np_snmp_oid_in_subtree (&oid, &oid2), "an OID is not in a sibling subtree");
+
+	np_snmp_pdu_init (&pdu, NP_SNMP_VERSION_2C, "public", NP_SNMP_GET);
+	pdu.request_id = 0x1234;
+	np_snmp_pdu_add (&pdu, &oid);
+	len = np_snmp_encode (&pdu, buf, sizeof (buf));
+	ok (len == sizeof (get_request) && !memcmp (buf, get_request, len),
+	    "a GET encodes the way net-snmp sends it");
+	ok (np_snmp_encode (&pdu, buf, 20) == -1, "encoding into a short buffer fails");
+
+	ok (np_snmp_decode (get_request, sizeof (get_request), &decoded), "decode a GET");
+	ok (decoded.version == NP_SNMP_VERSION_2C && decoded.type == NP_SNMP_GET &&
+	    decoded.request_id == 0x1234 && decoded.community_len == 6 &&
+	    !memcmp (decoded.community, "public", 6), "the GET header decodes");
+	ok (decoded.count == 1 && np_snmp_oid_compare (&decoded.varbinds[0].oid, &oid) == 0 &&
+	    decoded.varbinds[0].type == NP_SNMP_NULL, "the GET varbind decodes");
+	np_snmp_pdu_free (&decoded);
+	np_snmp_pdu_free (&pdu);
+
+	/* a response with one of everything */
+	np_snmp_pdu_init (&pdu, NP_SNMP_VERSION_2C, "public", NP_SNMP_RESPONSE);
+	pdu.request_id = -5;
+	vb = np_snmp_pdu_add (&pdu, &oid);
+	vb->type = NP_SNMP_INTEGER;
+	vb->integer = -129;
+	vb = np_snmp_pdu_add (&pdu, &oid);
+	vb->type = NP_SNMP_COUNTER64;
+	vb->counter = 18446744073709551615ULL;
+	vb = np_snmp_pdu_add (&pdu, &oid);
+	vb->type = NP_SNMP_OCTET_STRING;
+	vb->data = (const unsigned char *) "eth0";
+	vb->length = 4;
+	vb = np_snmp_pdu_add (&pdu, &oid);
+	vb->type = NP_SNMP_OBJECT_ID;
+	np_snmp_parse_oid ("1.3.6.1.4.1.8072.3.2.10", &vb->value_oid);
+	vb = np_snmp_pdu_add (&pdu, &oid);
+	vb->type = NP_SNMP_END_OF_MIB_VIEW;
+	len = np_snmp_encode (&pdu, buf, sizeof (buf));
+	ok (len > 0 && np_snmp_decode (buf, len, &decoded), "a response round trips");
+	ok (decoded.request_id == -5 && decoded.count == 5, "the response header round trips");
+	ok (decoded.varbinds[0].type == NP_SNMP_INTEGER && decoded.varbinds[0].integer == -129,
+	    "a negative INTEGER round trips");
+	ok (decoded.varbinds[1].type == NP_SNMP_COUNTER64 &&
+	    decoded.varbinds[1].counter == 18446744073709551615ULL, "the largest Counter64 round trips");
+	ok (decoded.varbinds[2].length == 4 && !memcmp (decoded.varbinds[2].data, "eth0", 4),
+	    "an OCTET STRING round trips");
+	ok (np_snmp_oid_compare (&decoded.varbinds[3].value_oid, &pdu.varbinds[3].value_oid) == 0,
+	    "an OBJECT IDENTIFIER round trips");
+	ok (decoded.varbinds[4].type == NP_SNMP_END_OF_MIB_VIEW, "endOfMibView round trips");
+	ok (!np_snmp_decode (buf, len - 1, &decoded), "a truncated message does not decode");
+	buf[1] = 0x84;
+	ok (!np_snmp_decode (buf, len, &decoded), "a bad length does not decode");
+	np_snmp_pdu_free (&pdu);
+
+	ok (!strcmp (format (NP_SNMP_INTEGER, -3, 0, NULL, 0), "INTEGER: -3"), "format an INTEGER");
+	ok (!strcmp (format (NP_SNMP_COUNTER32, 0, 4294967295U, NULL, 0), "Counter32: 4294967295"),
+	    "format a Counter32");
+	ok (!strcmp (format (NP_SNMP_GAUGE32, 0, 1000, NULL, 0), "Gauge32: 1000"), "format a Gauge32");
+	ok (!strcmp (format (NP_SNMP_COUNTER64, 0, 12345678901ULL, NULL, 0), "Counter64: 12345678901"),
+	    "format a Counter64");
+	ok (!strcmp (format (NP_SNMP_TIMETICKS, 0, 12345, NULL, 0), "Timeticks: (12345) 0:02:03.45"),
+	    "format Timeticks under a day");
+	ok (!strcmp (format (NP_SNMP_TIMETICKS, 0, 8640000, NULL, 0), "Timeticks: (8640000) 1 day, 0:00:00.00"),
+	    "format Timeticks of one day");
+	ok (!strcmp (format (NP_SNMP_TIMETICKS, 0, 26790000, NULL, 0), "Timeticks: (26790000) 3 days, 2:25:00.00"),
+	    "format Timeticks of days");
+	ok (!strcmp (format (NP_SNMP_OCTET_STRING, 0, 0, "a \"b\"\\", 6), "STRING: \"a \\\"b\\\"\\\\\""),
+	    "format a STRING with quotes");
+	ok (!strcmp (format (NP_SNMP_OCTET_STRING, 0, 0, "\0\x1f\xff", 3), "Hex-STRING: 00 1F FF "),
+	    "format a binary STRING as hex");
+	ok (!strcmp (format (NP_SNMP_IPADDRESS, 0, 0, "\x0a\x00\x00\xfe", 4), "IpAddress: 10.0.0.254"),
+	    "format an IpAddress");
+	ok (!strcmp (format (NP_SNMP_NO_SUCH_OBJECT, 0, 0, NULL, 0), "No Such Object available on this agent at this OID"),
+	    "format noSuchObject");
+	ok (!strcmp (np_snmp_error_string (2), "(noSuchName) There is no such variable name in this MIB."),
+	    "the error string for noSuchName");
+
+	/* the localized keys of RFC 3414 A.3 */
+	ok (np_snmp_localize_key ("MD5", "maplesyrup", (const unsigned char *) "\0\0\0\0\0\0\0\0\0\0\0\2", 12,
+	                          key, &key_len) && key_len == 16 &&
+	    !memcmp (key, "\x52\x6f\x5e\xed\x9f\xcc\xe2\x6f\x89\x64\xc2\x93\x07\x87\xd8\x2b", 16),
+	    "localize an MD5 key");
+	ok (np_snmp_localize_key ("sha", "maplesyrup", (const unsigned char *) "\0\0\0\0\0\0\0\0\0\0\0\2", 12,
+	                          key, &key_len) && key_len == 20 &&
+	    !memcmp (key, "\x66\x95\xfe\xbc\x92\x88\xe3\x62\x82\x23\x5f\xc7\x15\x1f\x12\x84\x97\xb3\x8f\x3f", 20),
+	    "localize a SHA key");
+	ok (!np_snmp_localize_key ("RIPEMD", "maplesyrup", (const unsigned char *) "", 0, key, &key_len),
+	    "an unknown protocol has no key");
+
+	/* the MIB cache */
+	if ((len = mkstemp (cache_file)) >= 0)
+		close (len);
+	cache = np_snmp_mib_cache_open (cache_file, 1);
+	ok (!np_snmp_mib_cache_lookup (cache, "IF-MIB::ifInOctets.1", &entry), "an empty cache has nothing");
+	np_snmp_mib_cache_add (cache, "IF-MIB::ifInOctets.1", "1.3.6.1.2.1.2.2.1.10.1", "IF-MIB::ifInOctets.1", "Counter32");
+	np_snmp_mib_cache_add (cache, "sysUpTime.0", "1.3.6.1.2.1.1.3.0", "DISMAN-EVENT-MIB::sysUpTimeInstance", "TimeTicks");
+	ok (np_snmp_mib_cache_lookup (cache, "sysUpTime.0", &entry) && !strcmp (entry.oid, "1.3.6.1.2.1.1.3.0"),
+	    "an added name is found before it is saved");
+	ok (np_snmp_mib_cache_save (cache), "save the cache");
+	np_snmp_mib_cache_close (cache);
+
+	cache = np_snmp_mib_cache_open (cache_file, 1);
+	ok (np_snmp_mib_cache_lookup (cache, "IF-MIB::ifInOctets.1", &entry) &&
+	    !strcmp (entry.oid, "1.3.6.1.2.1.2.2.1.10.1") && !strcmp (entry.type, "Counter32"),
+	    "a saved name is found again");
+	ok (np_snmp_mib_cache_lookup (cache, "sysUpTime.0", &entry) &&
+	    !strcmp (entry.label, "DISMAN-EVENT-MIB::sysUpTimeInstance"), "the label is kept");
+	ok (!np_snmp_mib_cache_lookup (cache, "sysName.0", &entry), "an unknown name is not found");
+	np_snmp_mib_cache_add (cache, "sysName.0", "1.3.6.1.2.1.1.5.0", NULL, NULL);
+	np_snmp_mib_cache_save (cache);
+	np_snmp_mib_cache_close (cache);
+
+	cache = np_snmp_mib_cache_open (cache_file, 1);
+	ok (np_snmp_mib_cache_lookup (cache, "sysName.0", &entry) && !strcmp (entry.label, "sysName.0") &&
+	    np_snmp_mib_cache_lookup (cache, "IF-MIB::ifInOctets.1", &entry), "saving again keeps the old names");
+	np_snmp_mib_cache_close (cache);
+
+	cache = np_snmp_mib_cache_open (cache_file, 2);
+	ok (!np_snmp_mib_cache_lookup (cache, "sysName.0", &entry), "a cache for other MIBs is ignored");
+	np_snmp_mib_cache_close (cache);
+	unlink (cache_file);
+
+	/* rates */
+	ok (np_snmp_counter_delta (4294967000U, 704, 32) == 1000, "a Counter32 that wrapped");
+	ok (np_snmp_counter_delta (18446744073709551000ULL, 384, 64) == 1000, "a Counter64 that wrapped");
+	ok (np_snmp_counter_delta (1000, 3000, 32) == 2000, "a counter that did not wrap");
+	rate = np_snmp_rate_open (cache_file);
+	ok (!np_snmp_rate_get (rate, "ifInOctets.1", &when, &counter, &value), "no rate state yet");
+	ok (!np_snmp_rate_restarted (rate, 1000, 5000), "no restart without an earlier uptime");
+	np_snmp_rate_set (rate, "ifInOctets.1", 1000, 4000000000U, 4e9);
+	np_snmp_rate_set (rate, "ifInOctets.2", 1000, 7, 7);
+	ok (np_snmp_rate_save (rate), "save the rate state");
+	np_snmp_rate_close (rate);
+	stat (cache_file, &st);
+	inode = st.st_ino;
+
+	rate = np_snmp_rate_open (cache_file);
+	ok (np_snmp_rate_get (rate, "ifInOctets.1", &when, &counter, &value) && when == 1000 &&
+	    counter == 4000000000U && value == 4e9, "the value of the last run");
+	ok (np_snmp_rate_restarted (rate, 1060, 100), "sysUpTime going back is a restart");
+	np_snmp_rate_set (rate, "ifInOctets.2", 1060, 8, 8);
+	np_snmp_rate_save (rate);
+	np_snmp_rate_close (rate);
+	stat (cache_file, &st);
+	ok (st.st_ino == inode, "the same OIDs are written in place");
+
+	rate = np_snmp_rate_open (cache_file);
+	ok (np_snmp_rate_get (rate, "ifInOctets.2", &when, &counter, &value) && when == 1060 && counter == 8 &&
+	    !np_snmp_rate_restarted (rate, 1120, 6100), "the update in place is read back");
+	np_snmp_rate_close (rate);
+	unlink (cache_file);
+
+	/* the response cache, saved by two checks at once */
+	responses = np_snmp_response_cache_open (cache_file, 1000, 30);
+	ok (np_snmp_response_cache_get (responses, "GET 1.3.6.1.2.1.1.3.0") == NULL, "no cached response yet");
+	np_snmp_response_cache_put (responses, "GET 1.3.6.1.2.1.1.3.0", "iso.3.6.1.2.1.1.3.0 = Timeticks: (5) 0:00:00.05");
+	other = np_snmp_response_cache_open (cache_file, 1010, 30);
+	np_snmp_response_cache_put (other, "GET 1.3.6.1.2.1.1.5.0", "iso.3.6.1.2.1.1.5.0 = STRING: \"x\"");
+	np_snmp_response_cache_save (responses);
+	np_snmp_response_cache_save (other);
+	np_snmp_response_cache_close (responses);
+	np_snmp_response_cache_close (other);
+	responses = np_snmp_response_cache_open (cache_file, 1020, 30);
+	ok (np_snmp_response_cache_get (responses, "GET 1.3.6.1.2.1.1.3.0") &&
+	    !strcmp (np_snmp_response_cache_get (responses, "GET 1.3.6.1.2.1.1.3.0"),
+	             "iso.3.6.1.2.1.1.3.0 = Timeticks: (5) 0:00:00.05"), "a fresh cached response");
+	ok (np_snmp_response_cache_get (responses, "GET 1.3.6.1.2.1.1.5.0") != NULL,
+	    "the responses of two checks saved at the same time are both kept");
+	np_snmp_response_cache_close (responses);
+	responses = np_snmp_response_cache_open (cache_file, 1035, 30);
+	ok (np_snmp_response_cache_get (responses, "GET 1.3.6.1.2.1.1.3.0") == NULL &&
+	    np_snmp_response_cache_get (responses, "GET 1.3.6.1.2.1.1.5.0") != NULL,
+	    "a cached response older than the TTL is gone");
+	np_snmp_response_cache_close (responses);
+	unlink (cache_file);
+
+	/* the agent answers once, so with one target at a time the second
+	 * one to the same port times out */
+	snprintf (agent_port, sizeof (agent_port), "%d", echo_agent (1, &pid));
+	memset (targets, 0, sizeof (targets));
+	targets[0].host = "127.0.0.1";
+	targets[1].host = "127.0.0.1";
+	targets[2].host = "no.such.host.invalid";
+	np_snmp_pdu_init (&pdu, NP_SNMP_VERSION_2C, "public", NP_SNMP_GET);
+	np_snmp_parse_oid ("1.3.6.1.2.1.1.3.0", &oid);
+	np_snmp_pdu_add (&pdu, &oid);
+	np_snmp_query_targets (targets, 3, agent_port, AF_UNSPEC, &pdu, 1, 200, 0);
+	waitpid (pid, NULL, 0);
+	ok (targets[0].status == NP_SNMP_OK && targets[0].response.request_id == pdu.request_id &&
+	    targets[0].response.count == 1, "a target that answers");
+	ok (targets[1].status == NP_SNMP_TIMEOUT, "a target that does not");
+	ok (targets[2].status == NP_SNMP_ERROR && targets[2].error != NULL, "a target that is not there");
+	np_snmp_targets_free (targets, 3);
+	np_snmp_pdu_free (&pdu);
+
+	return exit_status ();
+}
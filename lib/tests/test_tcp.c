@@ -25,8 +25,10 @@ main(void)
 {
 	char **server_expect;
 	int server_expect_count = 3;
+	char *overlap[] = { "he", "she", "his", "hers", "" };
+	np_expect *e;
 
-	plan_tests(9);
+	plan_tests(21);
 
 	server_expect = malloc(sizeof(char*) * server_expect_count);
 
@@ -52,7 +54,31 @@ main(void)
 	   "Test not matching all strings");
 	ok(np_expect_match("XX XX", server_expect, server_expect_count, NP_MATCH_ALL) == NP_MATCH_RETRY,
 	   "Test not matching any string (testing all)");
-	 
+
+	ok(np_expect_match("ushers", overlap, 4, NP_MATCH_ALL) == NP_MATCH_RETRY,
+	   "Overlapping strings found through the fail links, one missing");
+	ok(np_expect_match("ushers his", overlap, 4, NP_MATCH_ALL) == NP_MATCH_SUCCESS,
+	   "Overlapping strings all found");
+	ok(np_expect_match("", overlap, 5, 0) == NP_MATCH_SUCCESS,
+	   "An empty string is found in no data");
+
+	e = np_expect_new(server_expect, server_expect_count, NP_MATCH_ALL);
+	ok(np_expect_feed(e, "XX A", 4) == NP_MATCH_RETRY, "Fed: nothing found yet");
+	ok(np_expect_feed(e, "A b", 3) == NP_MATCH_RETRY, "Fed: a string split between two feeds");
+	ok(np_expect_matched(e, 0) && !np_expect_matched(e, 1), "Fed: only the first string found");
+	ok(np_expect_feed(e, "b C", 3) == NP_MATCH_RETRY && np_expect_matched(e, 1), "Fed: second string found");
+	ok(np_expect_feed(e, "C", 1) == NP_MATCH_SUCCESS, "Fed: all strings found");
+	np_expect_free(e);
+
+	e = np_expect_new(server_expect, 1, 0);
+	ok(np_expect_feed(e, "xxAAyy", 6) == NP_MATCH_SUCCESS, "Fed: one string found");
+	ok(np_expect_consumed(e) == 4, "Fed: the data after the match is left");
+	np_expect_free(e);
+
+	e = np_expect_new(server_expect, server_expect_count, NP_MATCH_EXACT);
+	ok(np_expect_feed(e, "b", 1) == NP_MATCH_RETRY, "Fed exact: the start of a string");
+	ok(np_expect_feed(e, "x", 1) == NP_MATCH_FAILURE, "Fed exact: off every string");
+	np_expect_free(e);
 
 	return exit_status();
 }
@@ -18,12 +18,14 @@
 
 #include "common.h"
 #include "utils_base.h"
+#include "utils_state.h"
 
 #include "tap.h"
 
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "utils_base.c"
 
@@ -36,11 +38,22 @@ main (int argc, char **argv)
 	thresholds *thresholds = NULL;
 	int	i, rc;
 	char	*temp_string;
+	np_histogram *hist;
+	np_rtt rtt;
+	np_rate rate;
+	np_arena arena = { NULL };
+	np_strbuf sb;
+	char	*sb_data;
+	sigjmp_buf exit_point;
 	state_key *temp_state_key = NULL;
 	state_data *temp_state_data;
 	time_t	current_time;
+	char	*cached;
+	size_t	cached_len;
+	int	lock;
+	pid_t	pid;
 
-	plan_tests(185);
+	plan_tests(238);
 
 	ok( this_nagios_plugin==NULL, "nagios_plugin not initialised");
 
@@ -199,6 +212,48 @@ main (int argc, char **argv)
 	ok( get_status(19, thresholds) == STATE_WARNING, "19 - warning");
 	ok( get_status(21, thresholds) == STATE_CRITICAL, "21 - critical");
 
+	{
+		char *ranges[] = { "10", "5:", "~:4", "@2:8", "~:", "@~:", "-3:3", "@-3:" };
+		double values[] = { -HUGE_VAL, -4, -3, 0, 2, 4.5, 5, 8, 10, 10.5, HUGE_VAL, NAN };
+		int states[sizeof(values) / sizeof(values[0])];
+		size_t nvalues = sizeof(values) / sizeof(values[0]);
+		compiled_thresholds *ct;
+		int w, c, mismatches = 0, worst, expected_worst;
+		size_t i;
+
+		for (w = 0; w < 8; w++) {
+			for (c = 0; c < 8; c++) {
+				_set_thresholds(&thresholds, ranges[w], ranges[c]);
+				ct = compile_thresholds(thresholds);
+				worst = get_status_many(values, nvalues, ct, states);
+				expected_worst = STATE_OK;
+				for (i = 0; i < nvalues; i++) {
+					if (get_status(values[i], thresholds) != get_status_compiled(values[i], ct) ||
+					    states[i] != get_status(values[i], thresholds))
+						mismatches++;
+					if (get_status(values[i], thresholds) > expected_worst)
+						expected_worst = get_status(values[i], thresholds);
+				}
+				if (worst != expected_worst)
+					mismatches++;
+				free(ct);
+			}
+		}
+		ok( mismatches == 0, "Compiled thresholds agree with get_status()");
+
+		_set_thresholds(&thresholds, "10", "20");
+		ct = compile_thresholds(thresholds);
+		ok( get_status_many(values + 3, 1, ct, NULL) == STATE_OK, "get_status_many() works without states");
+		free(ct);
+
+		_set_thresholds(&thresholds, NULL, "@-3:3");
+		ct = compile_thresholds(thresholds);
+		ok( get_status_many(values, 5, ct, states) == STATE_CRITICAL, "Worst state returned");
+		ok( states[0] == STATE_OK && states[1] == STATE_OK && states[2] == STATE_CRITICAL &&
+		    states[4] == STATE_CRITICAL, "Per item states set");
+		free(ct);
+	}
+
 	char *test;
 	test = np_escaped_string("bob\\n");
 	ok( strcmp(test, "bob\n") == 0, "bob\\n ok");
@@ -445,6 +500,60 @@ main (int argc, char **argv)
 	/* Check time is set to current_time */
 	ok(system("cmp var/generated var/statefile > /dev/null")!=0, "Generated file should be different this time");
 	ok(this_nagios_plugin->state->state_data->time-current_time<=1, "Has time generated from current time");
+
+	setenv("NAGIOS_PLUGIN_STATE_STORE", "var/state.store", 1);
+	unlink("var/state.store");
+	unlink("var/store_only");
+	temp_state_key->_filename="var/store_only";
+	np_state_write_string(1234567890, "Kept in the store");
+	ok(access("var/store_only", F_OK) != 0, "No state file written when the store is used");
+	temp_state_data = np_state_read();
+	ok(temp_state_data && temp_state_data->time==1234567890 &&
+	   !strcmp((char *)temp_state_data->data, "Kept in the store"), "State read back from the store");
+
+	temp_state_key->data_version=53;
+	temp_state_data = np_state_read();
+	ok( temp_state_data==NULL, "Other data version gives NULL from the store" );
+	temp_state_key->data_version=54;
+
+	free(temp_state_key->name);
+	temp_state_key->name=strdup("not_in_store");
+	temp_state_key->_filename="var/statefile";
+	temp_state_data = np_state_read();
+	ok(temp_state_data && !strcmp((char *)temp_state_data->data, "String to read"),
+	   "Keys missing from the store fall back to the state file");
+
+	np_state_store_close();
+	unsetenv("NAGIOS_PLUGIN_STATE_STORE");
+	unlink("var/state.store");
+	ok(!np_state_store_enabled(), "Store not used once unset");
+
+	unlink("var/result");
+	ok(np_cache_write("var/result", 1234567890, STATE_WARNING, "\nWARNING - x|a=1\nmore\n", 22), "Result written to the cache");
+	rc = -1;
+	cached = NULL;
+	ok(np_cache_read("var/result", 1234567899, 10, &rc, &cached, &cached_len) && rc == STATE_WARNING &&
+	   cached_len == 22 && !memcmp(cached, "\nWARNING - x|a=1\nmore\n", 23), "Fresh result read back whole");
+	free(cached);
+	ok(!np_cache_read("var/result", 1234567900, 10, &rc, &cached, &cached_len), "Result as old as the ttl is not used");
+	ok(!np_cache_read("var/result", 1234567889, 10, &rc, &cached, &cached_len), "Result from the future is not used");
+	ok(!np_cache_read("var/nonexistent", 1234567890, 10, &rc, &cached, &cached_len), "No cached result without a file");
+
+	unlink("var/result.lock");
+	lock = np_cache_lock("var/result.lock");
+	ok(lock >= 0, "Cache lock taken");
+	if ((pid = fork()) == 0) {
+		struct flock other;
+		memset(&other, 0, sizeof(other));
+		other.l_type = F_WRLCK;
+		other.l_whence = SEEK_SET;
+		_exit(fcntl(open("var/result.lock", O_RDWR), F_SETLK, &other) < 0 ? 0 : 1);
+	}
+	waitpid(pid, &rc, 0);
+	close(lock);
+	unlink("var/result.lock");
+	unlink("var/result");
+	ok(WIFEXITED(rc) && WEXITSTATUS(rc) == 0, "and held against another process");
 	
 
 	/* Don't know how to automatically test this. Need to be able to redefine die and catch the error */
@@ -458,6 +567,19 @@ main (int argc, char **argv)
 
 	ok(this_nagios_plugin==NULL, "Free'd this_nagios_plugin" );
 
+	np_init( "check_one", argc, argv );
+	np_init( "check_two", 0, NULL );
+	ok( !strcmp(this_nagios_plugin->plugin_name, "check_two"), "np_init can be called again for another plugin" );
+	ok( this_nagios_plugin->argc==0, "Argc replaced on re-init" );
+
+	if (sigsetjmp(exit_point, 1) == 0) {
+		np_set_resident(&exit_point);
+		die(STATE_WARNING, "%s", "");
+	}
+	np_set_resident(NULL);
+	ok( np_resident_result()==STATE_WARNING, "die() returns to the exit point in resident mode" );
+	ok( this_nagios_plugin==NULL, "die() still cleans up in resident mode" );
+
 	ok(np_suid() == FALSE, "Tests aren't suid" );
 
 	/* base states with random case */
@@ -505,6 +627,104 @@ main (int argc, char **argv)
 	ok(ERROR==translate_state("10"), "Translate state string: bad numeric string 3");
 	ok(ERROR==translate_state(""), "Translate state string: empty string");
 
+	hist = malloc(sizeof(np_histogram));
+	np_histogram_init(hist);
+	ok(np_histogram_percentile(hist, 50) == 0, "Histogram without samples");
+	/* 1 to 1000 milliseconds */
+	for (i = 1000; i >= 1; i--)
+		np_histogram_add(hist, i / 1000.0);
+	ok(hist->count == 1000, "Histogram counts every sample");
+	ok(np_histogram_percentile(hist, 0) == 0.001, "Histogram 0th percentile is the minimum");
+	ok(np_histogram_percentile(hist, 100) == 1.0, "Histogram 100th percentile is the maximum");
+	temp = np_histogram_percentile(hist, 50);
+	ok(temp >= 0.5 - 0.005 && temp <= 0.5 + 0.005, "Histogram median within a percent");
+	temp = np_histogram_percentile(hist, 95);
+	ok(temp >= 0.95 - 0.0095 && temp <= 0.95 + 0.0095, "Histogram 95th percentile within a percent");
+	temp = np_histogram_percentile(hist, 99.9);
+	ok(temp >= 0.999 - 0.00999 && temp <= 0.999 + 0.00999, "Histogram 99.9th percentile within a percent");
+	np_histogram_init(hist);
+	np_histogram_add(hist, 0.000042);
+	np_histogram_add(hist, 0.000043);
+	ok(np_histogram_percentile(hist, 50) == 0.000042, "Histogram exact to the microsecond at first");
+	np_histogram_add(hist, 1.0e9);
+	ok(np_histogram_percentile(hist, 90) == 1.0e9, "Histogram top rank is the exact maximum, past the last bucket");
+	free(hist);
+
+	memset(&rtt, 0, sizeof(rtt));
+	ok(np_rtt_timeout(&rtt, 10000) == 0, "RTT: no timeout without samples");
+	np_rtt_add(&rtt, 100);
+	ok(rtt.srtt == 100 && rtt.rttvar == 50, "RTT: the first sample is the estimate, with half of it as variance");
+	ok(np_rtt_timeout(&rtt, 10000) == 300, "RTT: timeout is SRTT plus four times RTTVAR");
+	np_rtt_add(&rtt, 300);
+	ok(rtt.srtt == 125 && rtt.rttvar == 87.5, "RTT: later samples are smoothed as RFC 6298");
+	ok(np_rtt_timeout(&rtt, 400) == 400, "RTT: timeout capped");
+	memset(&rtt, 0, sizeof(rtt));
+	for (i = 0; i < 20; i++)
+		np_rtt_add(&rtt, 1.5);
+	ok(np_rtt_timeout(&rtt, 10000) == NP_RTT_MIN, "RTT: timeout never below NP_RTT_MIN");
+
+	np_rate_init(&rate, 0, 0);
+	for (i = 0; i < 1000 && np_rate_take(&rate, 0); i++)
+		;
+	ok(i == 1000, "Rate: no limit without a rate");
+	np_rate_init(&rate, 4, 2);
+	ok(np_rate_take(&rate, 0) && np_rate_take(&rate, 0) && !np_rate_take(&rate, 0), "Rate: a burst at once, then it has to wait");
+	ok(np_rate_delay(&rate, 0.125) == 0.125, "Rate: the wait is until the next token");
+	ok(np_rate_take(&rate, 0.25) && !np_rate_take(&rate, 0.25), "Rate: one token each 1/rate seconds");
+	ok(np_rate_take(&rate, 10) && np_rate_take(&rate, 10) && !np_rate_take(&rate, 10), "Rate: no more than the burst saved up");
+	np_rate_held(&rate, TRUE, 10);
+	np_rate_held(&rate, TRUE, 10.25);
+	np_rate_held(&rate, FALSE, 10.5);
+	np_rate_held(&rate, FALSE, 11);
+	ok(rate.throttled == 0.5, "Rate: the time held back is counted once");
+
+	np_strbuf_init(&sb, &arena);
+	ok(!strcmp(np_strbuf_string(&sb), ""), "Strbuf: empty until appended to");
+	for (i = 0; i < 1000; i++)
+		np_strbuf_appendf(&sb, "%d,", i);
+	ok(sb.len == strlen(sb.data) && !strncmp(sb.data, "0,1,2,", 6) && !strcmp(sb.data + sb.len - 4, "999,"),
+	   "Strbuf: appended in order");
+	np_arena_free(&arena);
+	ok(arena.chunks == NULL, "Arena: freed at once");
+
+	np_strbuf_init(&sb, &arena);
+	np_strbuf_append(&sb, state_path, 0);
+	np_strbuf_appendf(&sb, "%100s", "a");
+	sb_data = sb.data;
+	np_strbuf_appendf(&sb, "%100s", "b");
+	ok(sb.data == sb_data && sb.len == 200, "Strbuf: grows in place while last in the arena");
+	np_arena_strdup(&arena, "in the way");
+	np_strbuf_appendf(&sb, "%300s", "c");
+	ok(sb.data != sb_data && sb.len == 500 && sb.data[99] == 'a' && sb.data[199] == 'b' && sb.data[499] == 'c',
+	   "Strbuf: moves with what it had once something follows it");
+	np_strbuf_reserve(&sb, 100000);
+	ok(sb.size > 100500 && !strcmp(sb.data + 499, "c"), "Strbuf: reserved beyond a chunk");
+	np_arena_free(&arena);
+
+	np_strbuf_init(&sb, NULL);
+	np_strbuf_puts(&sb, "kept until np_cleanup");
+	np_cleanup();
+	ok(np_plugin_arena()->chunks == NULL, "Arena: the plugin arena is freed by np_cleanup");
+
+#if ENABLE_NLS
+	unsetenv("LC_ALL");
+	unsetenv("LC_MESSAGES");
+	unsetenv("LANG");
+	ok(np_locale_wanted() == FALSE, "No locale without LC_ALL, LC_MESSAGES or LANG");
+	setenv("LANG", "de_DE.UTF-8", 1);
+	ok(np_locale_wanted() == TRUE, "Locale from LANG");
+	setenv("LC_ALL", "C", 1);
+	ok(np_locale_wanted() == FALSE, "LC_ALL=C comes before LANG");
+	setenv("LC_ALL", "", 1);
+	setenv("LC_MESSAGES", "POSIX", 1);
+	ok(np_locale_wanted() == FALSE, "An empty LC_ALL is skipped for LC_MESSAGES");
+	unsetenv("LC_MESSAGES");
+	setenv("LANG", "C.UTF-8", 1);
+	ok(np_locale_wanted() == FALSE, "C.UTF-8 has no messages to translate");
+#else
+	skip(5, "Built without NLS");
+#endif
+
 	return exit_status();
 }
 
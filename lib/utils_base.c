@@ -27,6 +27,7 @@
 #include "common.h"
 #include <stdarg.h>
 #include "utils_base.h"
+#include "utils_state.h"
 #include <ctype.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -37,9 +38,81 @@
 
 nagios_plugin *this_nagios_plugin=NULL;
 
+/* Set while a resident worker runs a check; die() and np_exit() jump back
+ * here instead of terminating the process */
+static sigjmp_buf *np_exit_point = NULL;
+static int np_exit_result = STATE_UNKNOWN;
+static np_arena plugin_arena;	/* see np_plugin_arena() */
+
 int _np_state_read_file(FILE *);
 
+#if ENABLE_NLS
+/* TRUE if the environment asks for messages in a locale other than C */
+static int
+np_locale_wanted (void)
+{
+	const char *names[] = { "LC_ALL", "LC_MESSAGES", "LANG" };
+	const char *value = NULL;
+	size_t i;
+
+	for (i = 0; i < sizeof (names) / sizeof (names[0]) && (value == NULL || *value == '\0'); i++)
+		value = getenv (names[i]);
+	if (value == NULL || *value == '\0')
+		return FALSE;
+	return strcmp (value, "C") && strcmp (value, "POSIX") && strncmp (value, "C.", 2);
+}
+
+/* Binds the message catalog the first time it is needed, and not at all
+ * when the environment has no locale for it: a plugin prints a line or
+ * two, and in the C locale they are the strings as they are. Only
+ * LC_CTYPE and LC_MESSAGES come from the environment; numbers are read
+ * and printed the C way, as thresholds and perfdata want. */
+static int
+np_locale_init (void)
+{
+	static int translate = -1;
+
+	if (translate < 0) {
+		translate = np_locale_wanted ();
+		if (translate) {
+			setlocale (LC_CTYPE, "");
+			setlocale (LC_MESSAGES, "");
+			bindtextdomain (PACKAGE, LOCALEDIR);
+		}
+	}
+	return translate;
+}
+#endif /* ENABLE_NLS */
+
+char *
+np_gettext (const char *msgid)
+{
+#if ENABLE_NLS
+	if (np_locale_init ())
+		return dgettext (PACKAGE, msgid);
+#endif
+	return (char *) msgid;
+}
+
+char *
+np_ngettext (const char *msgid1, const char *msgid2, unsigned long n)
+{
+#if ENABLE_NLS
+	if (np_locale_init ())
+		return dngettext (PACKAGE, msgid1, msgid2, n);
+#endif
+	return (char *) (n == 1 ? msgid1 : msgid2);
+}
+
+/*
+ * May be called more than once per process. A second call for a different
+ * plugin (or a new check run in resident mode) drops any state left over
+ * from the previous one.
+ */
 void np_init( char *plugin_name, int argc, char **argv ) {
+	if (this_nagios_plugin && strcmp(this_nagios_plugin->plugin_name, plugin_name))
+		np_cleanup();
+
 	if (!this_nagios_plugin) {
 		this_nagios_plugin = calloc(1, sizeof(nagios_plugin));
 		if (!this_nagios_plugin) {
@@ -48,9 +121,9 @@ void np_init( char *plugin_name, int argc, char **argv ) {
 		this_nagios_plugin->plugin_name = strdup(plugin_name);
 		if (!this_nagios_plugin->plugin_name)
 			die(STATE_UNKNOWN, "%s %s\n", _("Cannot execute strdup:"), strerror(errno));
-		this_nagios_plugin->argc = argc;
-		this_nagios_plugin->argv = argv;
 	}
+	this_nagios_plugin->argc = argc;
+	this_nagios_plugin->argv = argv;
 }
 
 void np_set_args( int argc, char **argv ) {
@@ -63,6 +136,7 @@ void np_set_args( int argc, char **argv ) {
 
 
 void np_cleanup() {
+	np_arena_free(&plugin_arena);
 	if (this_nagios_plugin) {
 		if(this_nagios_plugin->state) {
 			if(this_nagios_plugin->state->state_data) { 
@@ -93,9 +167,47 @@ die (int result, const char *fmt, ...)
 	if(this_nagios_plugin) {
 		np_cleanup();
 	}
+	np_exit (result);
+}
+
+/*
+ * Terminate the check with the given return code. Outside of resident
+ * mode this is exit(); inside, control returns to the worker loop which
+ * picks the code up with np_resident_result(). Safe to call from the
+ * timeout signal handlers as the jump point is set up with sigsetjmp().
+ */
+void
+np_exit (int result)
+{
+	if (np_exit_point) {
+		np_exit_result = result;
+		fflush (stdout);
+		siglongjmp (*np_exit_point, 1);
+	}
 	exit (result);
 }
 
+void
+np_set_resident (sigjmp_buf *exit_point)
+{
+	/* keep the last result readable after the exit point is cleared */
+	if (exit_point)
+		np_exit_result = STATE_UNKNOWN;
+	np_exit_point = exit_point;
+}
+
+int
+np_resident_active (void)
+{
+	return np_exit_point != NULL;
+}
+
+int
+np_resident_result (void)
+{
+	return np_exit_result;
+}
+
 void set_range_start (range *this, double value) {
 	this->start = value;
 	this->start_infinity = FALSE;
@@ -278,6 +390,387 @@ get_status(double value, thresholds *my_thresholds)
 	return STATE_OK;
 }
 
+static void
+_compile_range(compiled_range *dst, const range *src)
+{
+	dst->set = (src != NULL);
+	if (!src) {
+		dst->low = dst->high = 0;
+		dst->any = FALSE;
+		dst->alert_on = OUTSIDE;
+		return;
+	}
+	dst->low = src->start_infinity ? -HUGE_VAL : src->start;
+	dst->high = src->end_infinity ? HUGE_VAL : src->end;
+	dst->any = src->start_infinity && src->end_infinity;
+	dst->alert_on = src->alert_on;
+}
+
+/* Build the flat form of my_thresholds for get_status_compiled() and
+ * get_status_many(). It does not refer back to my_thresholds. */
+compiled_thresholds *
+compile_thresholds(const thresholds *my_thresholds)
+{
+	compiled_thresholds *ct;
+
+	if (!(ct = calloc(1, sizeof(compiled_thresholds))))
+		die(STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror(errno));
+
+	_compile_range(&ct->warning, my_thresholds ? my_thresholds->warning : NULL);
+	_compile_range(&ct->critical, my_thresholds ? my_thresholds->critical : NULL);
+	return ct;
+}
+
+/* Same answer as check_range(), NaN included */
+static inline int
+_check_compiled_range(double value, const compiled_range *r)
+{
+	int within = r->any | ((r->low <= value) & (value <= r->high));
+
+	return r->set & (within ^ (r->alert_on == OUTSIDE));
+}
+
+int
+get_status_compiled(double value, const compiled_thresholds *ct)
+{
+	if (_check_compiled_range(value, &ct->critical))
+		return STATE_CRITICAL;
+	if (_check_compiled_range(value, &ct->warning))
+		return STATE_WARNING;
+	return STATE_OK;
+}
+
+int
+get_status_many(const double *values, size_t count, const compiled_thresholds *ct, int *states)
+{
+	int worst = STATE_OK, state;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		/* critical wins over warning: 2 * crit, else 1 * warn */
+		state = _check_compiled_range(values[i], &ct->critical) << 1;
+		state |= _check_compiled_range(values[i], &ct->warning) & !state;
+		if (states)
+			states[i] = state;
+		if (state > worst)
+			worst = state;
+	}
+	return worst;
+}
+
+/* the microsecond buckets: one each below 2 * NP_HISTOGRAM_SUB, then
+ * NP_HISTOGRAM_SUB for each power of two, b << shift up to
+ * (b + 1) << shift */
+#define HISTOGRAM_MAX_USEC ((1ULL << (NP_HISTOGRAM_BUCKETS / NP_HISTOGRAM_SUB + 5)) - 1)
+
+static size_t
+_histogram_bucket(unsigned long long usec)
+{
+	int shift = 0;
+
+	if (usec > HISTOGRAM_MAX_USEC)
+		usec = HISTOGRAM_MAX_USEC;
+	while ((usec >> shift) >= 2 * NP_HISTOGRAM_SUB)
+		shift++;
+	return shift * NP_HISTOGRAM_SUB + (usec >> shift);
+}
+
+void
+np_histogram_init(np_histogram *h)
+{
+	memset(h, 0, sizeof(np_histogram));
+}
+
+void
+np_histogram_add(np_histogram *h, double seconds)
+{
+	if (seconds < 0)
+		seconds = 0;
+	if (h->count == 0 || seconds < h->min)
+		h->min = seconds;
+	if (h->count == 0 || seconds > h->max)
+		h->max = seconds;
+	h->count++;
+	h->sum += seconds;
+	h->buckets[_histogram_bucket((unsigned long long)(seconds * 1.0e6 + 0.5))]++;
+}
+
+double
+np_histogram_percentile(const np_histogram *h, double percent)
+{
+	unsigned long rank, seen = 0;
+	double value, width;
+	size_t i;
+	int shift;
+
+	if (h->count == 0)
+		return 0;
+	if (percent <= 0)
+		return h->min;
+	if (percent >= 100)
+		return h->max;
+	/* the sample of rank ceil(count * percent / 100), from 1 */
+	value = h->count * percent / 100;
+	rank = (unsigned long)value;
+	if (rank < value || rank == 0)
+		rank++;
+	if (rank >= h->count)
+		return h->max;
+	for (i = 0; i < NP_HISTOGRAM_BUCKETS; i++)
+		if ((seen += h->buckets[i]) >= rank)
+			break;
+	/* the middle of the bucket, as close as it gets to any sample in it */
+	shift = i < 2 * NP_HISTOGRAM_SUB ? 0 : (int)(i / NP_HISTOGRAM_SUB) - 1;
+	width = (double)(1ULL << shift);
+	value = ((double)(i - shift * NP_HISTOGRAM_SUB) * width + (width - 1) / 2) / 1.0e6;
+	if (value < h->min)
+		return h->min;
+	if (value > h->max)
+		return h->max;
+	return value;
+}
+
+void
+np_rtt_add(np_rtt *r, double ms)
+{
+	if (ms < 0)
+		ms = 0;
+	if (r->samples++ == 0) {
+		r->srtt = ms;
+		r->rttvar = ms / 2;
+		return;
+	}
+	/* RTTVAR first, from the SRTT before this sample */
+	r->rttvar = 0.75 * r->rttvar + 0.25 * (r->srtt > ms ? r->srtt - ms : ms - r->srtt);
+	r->srtt = 0.875 * r->srtt + 0.125 * ms;
+}
+
+int
+np_rtt_timeout(const np_rtt *r, int max_ms)
+{
+	double rto;
+	int ms;
+
+	if (r->samples == 0)
+		return 0;
+	rto = r->srtt + 4 * r->rttvar;
+	if (rto < NP_RTT_MIN)
+		rto = NP_RTT_MIN;
+	if (max_ms > 0 && rto > max_ms)
+		rto = max_ms;
+	/* rounded up, never early */
+	ms = (int)rto;
+	return ms < rto ? ms + 1 : ms;
+}
+
+void
+np_rate_init(np_rate *r, double rate, double burst)
+{
+	memset(r, 0, sizeof(*r));
+	r->rate = rate > 0 ? rate : 0;
+	r->burst = burst < 1 ? 1 : burst;
+	r->tokens = r->burst;
+	r->held_since = -1;
+}
+
+double
+np_rate_delay(np_rate *r, double now)
+{
+	if (r->rate == 0)
+		return 0;
+	if (now > r->last) {
+		r->tokens += (now - r->last) * r->rate;
+		if (r->tokens > r->burst)
+			r->tokens = r->burst;
+		r->last = now;
+	}
+	return r->tokens >= 1 ? 0 : (1 - r->tokens) / r->rate;
+}
+
+int
+np_rate_take(np_rate *r, double now)
+{
+	if (np_rate_delay(r, now) > 0)
+		return FALSE;
+	if (r->rate)
+		r->tokens -= 1;
+	return TRUE;
+}
+
+void
+np_rate_held(np_rate *r, int held, double now)
+{
+	if (held && r->held_since < 0) {
+		r->held_since = now;
+	} else if (!held && r->held_since >= 0) {
+		r->throttled += now - r->held_since;
+		r->held_since = -1;
+	}
+}
+
+/* the chunks of an arena, each with its memory right after it */
+typedef struct np_arena_chunk_struct {
+	struct np_arena_chunk_struct *next;
+	size_t size;
+	size_t used;
+	size_t last;		/* where the last allocation in it starts */
+} np_arena_chunk;
+
+#define NP_ARENA_CHUNK 8192
+#define NP_ARENA_ALIGN 16
+#define NP_ARENA_ROUND(n) (((n) + NP_ARENA_ALIGN - 1) & ~(size_t)(NP_ARENA_ALIGN - 1))
+#define NP_ARENA_DATA(c) ((char *)(c) + NP_ARENA_ROUND(sizeof(np_arena_chunk)))
+
+/* for --profile, over all arenas */
+static size_t arena_allocations, arena_bytes;
+
+void *
+np_arena_alloc(np_arena *a, size_t len)
+{
+	np_arena_chunk *c = a->chunks;
+	size_t start, size;
+
+	start = c ? NP_ARENA_ROUND(c->used) : 0;
+	if (c == NULL || start + len > c->size || start + len < start) {
+		size = len > NP_ARENA_CHUNK / 2 ? len : NP_ARENA_CHUNK;
+		if (size + NP_ARENA_ROUND(sizeof(np_arena_chunk)) < size ||
+		    (c = malloc(NP_ARENA_ROUND(sizeof(np_arena_chunk)) + size)) == NULL)
+			die(STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror(errno));
+		c->size = size;
+		c->used = 0;
+		arena_bytes += NP_ARENA_ROUND(sizeof(np_arena_chunk)) + size;
+		/* a chunk of its own for something large keeps the one being
+		 * filled in front */
+		if (a->chunks && size > NP_ARENA_CHUNK) {
+			c->next = a->chunks->next;
+			a->chunks->next = c;
+		} else {
+			c->next = a->chunks;
+			a->chunks = c;
+		}
+		start = 0;
+	}
+	c->last = start;
+	c->used = start + len;
+	arena_allocations++;
+	return NP_ARENA_DATA(c) + start;
+}
+
+void
+np_arena_stats(size_t *allocations, size_t *bytes)
+{
+	*allocations = arena_allocations;
+	*bytes = arena_bytes;
+}
+
+char *
+np_arena_strdup(np_arena *a, const char *str)
+{
+	size_t len = strlen(str) + 1;
+
+	return memcpy(np_arena_alloc(a, len), str, len);
+}
+
+void
+np_arena_free(np_arena *a)
+{
+	np_arena_chunk *c, *next;
+
+	for (c = a->chunks; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	a->chunks = NULL;
+}
+
+np_arena *
+np_plugin_arena(void)
+{
+	return &plugin_arena;
+}
+
+void
+np_strbuf_init(np_strbuf *sb, np_arena *a)
+{
+	sb->arena = a ? a : &plugin_arena;
+	sb->data = NULL;
+	sb->len = 0;
+	sb->size = 0;
+}
+
+void
+np_strbuf_reserve(np_strbuf *sb, size_t len)
+{
+	np_arena_chunk *c;
+	char *data;
+	size_t size;
+
+	if (sb->len + len < sb->size)
+		return;
+	for (c = sb->arena->chunks; c; c = c->next)
+		if (sb->data == NP_ARENA_DATA(c) + c->last)
+			break;
+	size = sb->size ? sb->size * 2 : 64;
+	while (size <= sb->len + len)
+		size *= 2;
+	/* still the last thing in its chunk: take what follows it */
+	if (c && c->used == c->last + sb->size && c->last + sb->len + len < c->size) {
+		if (c->last + size > c->size)
+			size = c->size - c->last;
+		c->used = c->last + size;
+		sb->size = size;
+		return;
+	}
+	data = np_arena_alloc(sb->arena, size);
+	if (sb->len)
+		memcpy(data, sb->data, sb->len);
+	data[sb->len] = '\0';
+	sb->data = data;
+	sb->size = size;
+}
+
+void
+np_strbuf_append(np_strbuf *sb, const char *str, size_t len)
+{
+	np_strbuf_reserve(sb, len);
+	memcpy(sb->data + sb->len, str, len);
+	sb->len += len;
+	sb->data[sb->len] = '\0';
+}
+
+void
+np_strbuf_puts(np_strbuf *sb, const char *str)
+{
+	np_strbuf_append(sb, str, strlen(str));
+}
+
+void
+np_strbuf_appendf(np_strbuf *sb, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	np_strbuf_reserve(sb, 0);
+	va_start(ap, fmt);
+	n = vsnprintf(sb->data + sb->len, sb->size - sb->len, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		die(STATE_UNKNOWN, "%s\n", _("Cannot format output"));
+	if ((size_t)n >= sb->size - sb->len) {
+		np_strbuf_reserve(sb, (size_t)n);
+		va_start(ap, fmt);
+		vsnprintf(sb->data + sb->len, sb->size - sb->len, fmt, ap);
+		va_end(ap);
+	}
+	sb->len += (size_t)n;
+}
+
+const char *
+np_strbuf_string(const np_strbuf *sb)
+{
+	return sb->data ? sb->data : "";
+}
+
 char *np_escaped_string (const char *string) {
 	char *data;
 	int i, j=0;
@@ -508,6 +1001,24 @@ void np_enable_state(char *keyname, int expected_data_version) {
  * If numerically lower, then return as no previous state. die with UNKNOWN
  * if exceptional error.
  */
+static state_data *_np_state_store_read() {
+	state_key *key = this_nagios_plugin->state;
+	state_data *this_state_data;
+	time_t data_time;
+	char *data;
+
+	if(!np_state_store_read(key->plugin_name, key->name, key->data_version, &data_time, &data))
+		return NULL;
+
+	this_state_data = (state_data *) calloc(1, sizeof(state_data));
+	if(!this_state_data)
+		die(STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror(errno));
+	this_state_data->time = data_time;
+	this_state_data->data = data;
+	key->state_data = this_state_data;
+	return this_state_data;
+}
+
 state_data *np_state_read() {
 	state_data *this_state_data=NULL;
 	FILE *statefile;
@@ -516,6 +1027,10 @@ state_data *np_state_read() {
 	if(!this_nagios_plugin)
 		die(STATE_UNKNOWN, "%s\n", _("This requires np_init to be called"));
 
+	/* Keys not in the store yet may still have a state file */
+	if(np_state_store_enabled() && (this_state_data = _np_state_store_read()))
+		return this_state_data;
+
 	/* Open file. If this fails, no previous state found */
 	statefile = fopen( this_nagios_plugin->state->_filename, "r" );
 	if(statefile) {
@@ -539,7 +1054,142 @@ state_data *np_state_read() {
 	return this_nagios_plugin->state->state_data;
 }
 
-/* 
+/*
+ * Create the directories above path. Returns NULL, or the one that could
+ * not be created.
+ */
+static char *_np_state_create_directories(const char *path) {
+	char *directories, *p;
+
+	directories = strdup(path);
+	if(!directories)
+		die(STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror(errno));
+
+	for(p=directories+1; *p; p++) {
+		if(*p=='/') {
+			*p='\0';
+			if(access(directories,F_OK) && mkdir(directories, S_IRWXU))
+				return directories;
+			*p='/';
+		}
+	}
+	np_free(directories);
+	return NULL;
+}
+
+/*
+ * For state a plugin keeps in a format of its own: the state file of the
+ * key with the suffix added, its directories created. Returns NULL if
+ * they cannot be. The state store is not used for these.
+ */
+char *np_state_path(const char *suffix) {
+	char *path=NULL, *failed;
+
+	if(!this_nagios_plugin || !this_nagios_plugin->state)
+		die(STATE_UNKNOWN, "%s\n", _("This requires np_enable_state to be called"));
+	if(asprintf(&path, "%s%s", this_nagios_plugin->state->_filename, suffix) < 0)
+		die(STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror(errno));
+	if(access(path, F_OK) && (failed = _np_state_create_directories(path))) {
+		np_free(failed);
+		np_free(path);
+		return NULL;
+	}
+	return path;
+}
+
+/*
+ * Read a result cache file. Returns TRUE and fills in the exit status and
+ * a malloc'd, nul terminated copy of the output if the file holds a whole
+ * result written less than ttl seconds before now. Anything else - no
+ * file, an older format, a result from the future, a short read - is
+ * as if there was no result.
+ */
+int np_cache_read(const char *path, time_t now, unsigned int ttl, int *result, char **output, size_t *length) {
+	FILE *fp;
+	unsigned long data_time, data_length;
+	int version, status, rc=FALSE;
+	char *data;
+
+	if(!(fp = fopen(path, "r")))
+		return FALSE;
+	/* the output follows the newline after the length, whatever it starts with */
+	if(fscanf(fp, "# NP result cache\n%d\n%lu\n%d\n%lu", &version, &data_time, &status, &data_length) == 4 &&
+	   fgetc(fp) == '\n' && version == NP_CACHE_FORMAT_VERSION && (time_t)data_time <= now &&
+	   now - (time_t)data_time < (time_t)ttl && data_length < (1UL << 30) &&
+	   (data = malloc(data_length + 1)) != NULL) {
+		if(fread(data, 1, data_length, fp) == data_length) {
+			data[data_length] = '\0';
+			*result = status;
+			*output = data;
+			*length = data_length;
+			rc = TRUE;
+		} else {
+			free(data);
+		}
+	}
+	fclose(fp);
+	return rc;
+}
+
+/*
+ * Store a result for np_cache_read(), written to a temporary file and
+ * renamed over path so that readers see the old result or the new one,
+ * never half of one. Returns FALSE if it could not be written.
+ */
+int np_cache_write(const char *path, time_t data_time, int result, const char *output, size_t length) {
+	char *temp_file=NULL;
+	FILE *fp;
+	int fd;
+
+	if(asprintf(&temp_file, "%s.XXXXXX", path) < 0)
+		return FALSE;
+	if((fd = mkstemp(temp_file)) < 0) {
+		np_free(temp_file);
+		return FALSE;
+	}
+	fchmod(fd, S_IRUSR | S_IWUSR);
+	if(!(fp = fdopen(fd, "w"))) {
+		close(fd);
+		unlink(temp_file);
+		np_free(temp_file);
+		return FALSE;
+	}
+	fprintf(fp, "# NP result cache\n%d\n%lu\n%d\n%lu\n", NP_CACHE_FORMAT_VERSION,
+	        (unsigned long)data_time, result, (unsigned long)length);
+	fwrite(output, 1, length, fp);
+	if(fclose(fp) != 0 || rename(temp_file, path) != 0) {
+		unlink(temp_file);
+		np_free(temp_file);
+		return FALSE;
+	}
+	np_free(temp_file);
+	return TRUE;
+}
+
+/*
+ * Wait for the lock on path, created if needed, so that of the runs
+ * sharing it only one at a time gets past. Returns the descriptor that
+ * holds the lock, closing it releases it, or -1 if it cannot be had.
+ */
+int np_cache_lock(const char *path) {
+	struct flock lock;
+	int fd;
+
+	if((fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) < 0)
+		return -1;
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	while(fcntl(fd, F_SETLKW, &lock) < 0) {
+		if(errno != EINTR) {
+			close(fd);
+			return -1;
+		}
+	}
+	return fd;
+}
+
+/*
  * Read the state file
  */
 int _np_state_read_file(FILE *f) {
@@ -607,7 +1257,8 @@ int _np_state_read_file(FILE *f) {
 }
 
 /*
- * If time=NULL, use current time. Create state file, with state format 
+ * If time=NULL, use current time. Stored in the shared state store when
+ * NAGIOS_PLUGIN_STATE_STORE is set, otherwise create state file, with state format 
  * version, default text. Writes version, time, and data. Avoid locking 
  * problems - use mv to write and then swap. Possible loss of state data if 
  * two things writing to same key at same time. 
@@ -619,34 +1270,22 @@ void np_state_write_string(time_t data_time, char *data_string) {
 	int fd=0, result=0;
 	time_t current_time;
 	char *directories=NULL;
-	char *p=NULL;
 
 	if(!data_time)
 		time(&current_time);
 	else
 		current_time=data_time;
+
+	/* Falls through to the state file if the store is full or unset */
+	if(np_state_store_enabled() &&
+	   np_state_store_write(this_nagios_plugin->state->plugin_name, this_nagios_plugin->state->name,
+	                        this_nagios_plugin->state->data_version, current_time, data_string))
+		return;
 	
 	/* If file doesn't currently exist, create directories */
-	if(access(this_nagios_plugin->state->_filename,F_OK)) {
-		result = asprintf(&directories, "%s", this_nagios_plugin->state->_filename);
-		if (result < 0)
-			die(STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror(errno));
-		if(!directories)
-			die(STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror(errno));
-
-		for(p=directories+1; *p; p++) {
-			if(*p=='/') {
-				*p='\0';
-				if(access(directories,F_OK) && mkdir(directories, S_IRWXU)) {
-					/* Can't free this! Otherwise error message is wrong! */
-					/* np_free(directories); */ 
-					die(STATE_UNKNOWN, "%s %s\n", _("Cannot create directory:"), directories);
-				}
-				*p='/';
-			}
-		}
-		np_free(directories);
-	}
+	if(access(this_nagios_plugin->state->_filename,F_OK) &&
+	   (directories = _np_state_create_directories(this_nagios_plugin->state->_filename)))
+		die(STATE_UNKNOWN, "%s %s\n", _("Cannot create directory:"), directories);
 
 	result = asprintf(&temp_file,"%s.XXXXXX",this_nagios_plugin->state->_filename);
 	if (result < 0)
@@ -3,6 +3,7 @@
 /* Header file for nagios plugins utils_base.c */
 
 #include "sha1.h"
+#include <setjmp.h>
 
 /* This file holds header information for thresholds - use this in preference to 
    individual plugin logic */
@@ -32,6 +33,22 @@ typedef struct thresholds_struct {
 	char    *critical_string;
 	} thresholds;
 
+/* A range flattened for evaluation: infinite ends become -/+HUGE_VAL, so
+ * checking a value is two compares and no branching on the kind of range */
+typedef struct compiled_range_struct {
+	double	low;
+	double	high;
+	int	set;			/* FALSE if this level has no range */
+	int	any;			/* both ends are infinite */
+	int	alert_on;		/* OUTSIDE or INSIDE */
+	} compiled_range;
+
+/* Immutable once built, so one can be shared by any number of items */
+typedef struct compiled_thresholds_struct {
+	compiled_range	warning;
+	compiled_range	critical;
+	} compiled_thresholds;
+
 #define NP_STATE_FORMAT_VERSION 1
 
 typedef struct state_data_struct {
@@ -63,12 +80,115 @@ void print_thresholds(const char *, thresholds *);
 int check_range(double, range *);
 int get_status(double, thresholds *);
 
+compiled_thresholds *compile_thresholds(const thresholds *);
+int get_status_compiled(double, const compiled_thresholds *);
+/* states[i] gets the state of values[i] (states may be NULL); returns the worst */
+int get_status_many(const double *, size_t, const compiled_thresholds *, int *);
+
+/* Durations counted in fixed buckets instead of kept, for percentiles of
+ * any number of samples in constant memory: to the microsecond below 128
+ * microseconds, then within 1% up to about 100 days (longer ones count as
+ * that). The minimum and maximum are exact. */
+#define NP_HISTOGRAM_SUB 64
+#define NP_HISTOGRAM_BUCKETS (NP_HISTOGRAM_SUB * 38)
+typedef struct np_histogram_struct {
+	unsigned long count;
+	double min;
+	double max;
+	double sum;
+	unsigned long buckets[NP_HISTOGRAM_BUCKETS];
+} np_histogram;
+
+void np_histogram_init(np_histogram *);
+/* one sample, in seconds */
+void np_histogram_add(np_histogram *, double);
+/* the duration percent of the samples take at most; 0 without samples */
+double np_histogram_percentile(const np_histogram *, double);
+
+/* A latency estimate the way TCP keeps one for its retransmission timer
+ * (RFC 6298): smoothed round-trip time and its mean deviation, in
+ * milliseconds. Small enough to be kept per target between runs. */
+#define NP_RTT_MIN 200		/* milliseconds, as the Linux TCP_RTO_MIN */
+typedef struct np_rtt_struct {
+	double srtt;
+	double rttvar;
+	unsigned long samples;
+} np_rtt;
+
+void np_rtt_add(np_rtt *, double);
+/* how long to wait for an answer before trying again, at least NP_RTT_MIN
+ * and at most max_ms; 0 without samples */
+int np_rtt_timeout(const np_rtt *, int);
+
+/* A token bucket that spreads what a run sends to at most rate a second,
+ * with burst of it at once, instead of dropping it; times in seconds. The
+ * time anything was held back by it or the caller's own limits is kept in
+ * throttled, for perfdata. */
+typedef struct np_rate_struct {
+	double rate;		/* 0 for no limit */
+	double burst;
+	double tokens;
+	double last;		/* when the tokens were counted */
+	double held_since;	/* or -1 while nothing waits */
+	double throttled;
+} np_rate;
+
+void np_rate_init(np_rate *, double, double);
+/* how long until np_rate_take() would succeed, 0 if now */
+double np_rate_delay(np_rate *, double);
+/* TRUE with a token taken, FALSE if it has to wait */
+int np_rate_take(np_rate *, double);
+/* whether something waits for the limits now, counted in throttled */
+void np_rate_held(np_rate *, int, double);
+
+/* An arena: memory handed out from chunks of it and given back all at
+ * once by np_arena_free(). np_plugin_arena() lasts as long as the plugin
+ * run and is freed by np_cleanup(). */
+typedef struct np_arena_struct {
+	struct np_arena_chunk_struct *chunks;
+} np_arena;
+
+void *np_arena_alloc(np_arena *, size_t);
+char *np_arena_strdup(np_arena *, const char *);
+void np_arena_free(np_arena *);
+np_arena *np_plugin_arena(void);
+/* the allocations made in arenas so far, and the bytes of their chunks */
+void np_arena_stats(size_t *, size_t *);
+
+/* A string built by appending to it, in an arena (NULL for the plugin
+ * arena): it grows in place while it is the last thing allocated there,
+ * and at least doubles otherwise, so building output of many items takes
+ * time and memory linear in its length. */
+typedef struct np_strbuf_struct {
+	np_arena *arena;
+	char *data;
+	size_t len;
+	size_t size;
+} np_strbuf;
+
+void np_strbuf_init(np_strbuf *, np_arena *);
+/* room for len more bytes and the '\0' */
+void np_strbuf_reserve(np_strbuf *, size_t);
+void np_strbuf_append(np_strbuf *, const char *, size_t);
+void np_strbuf_puts(np_strbuf *, const char *);
+void np_strbuf_appendf(np_strbuf *, const char *, ...) __attribute__((format(printf, 2, 3)));
+/* "" until something is appended */
+const char *np_strbuf_string(const np_strbuf *);
+
 /* All possible characters in a threshold range */
 #define NP_THRESHOLDS_CHARS "-0123456789.:@~"
 
 char *np_escaped_string (const char *);
 
 void die (int, const char *, ...) __attribute__((noreturn,format(printf, 2, 3)));
+void np_exit (int) __attribute__((noreturn));
+
+/* Resident mode: while an exit point is set, die() and np_exit() longjmp
+ * to it instead of terminating the process. Pass NULL to clear it. */
+void np_set_resident (sigjmp_buf *);
+int np_resident_result (void);
+/* TRUE while a check runs in resident mode */
+int np_resident_active (void);
 
 /* Return codes for _set_thresholds */
 #define NP_RANGE_UNPARSEABLE 1
@@ -87,6 +207,9 @@ int np_warn_if_not_root(void);
  */
 int translate_state (char *);
 
+/* the directory state files live under, see np_enable_state() */
+char *_np_state_calculate_location_prefix(void);
+
 /*
  * Extract the value from key/value pairs, or return NULL. The value returned
  * can be free()ed.
@@ -105,6 +228,14 @@ char *np_extract_value(const char*, const char*, char);
 void np_enable_state(char *, int);
 state_data *np_state_read();
 void np_state_write_string(time_t, char *);
+char *np_state_path(const char *);
+
+/* Whole results of a plugin - its exit status and output - kept for a
+ * while in a file of their own, see cache_result */
+#define NP_CACHE_FORMAT_VERSION 1
+int np_cache_read(const char *, time_t, unsigned int, int *, char **, size_t *);
+int np_cache_write(const char *, time_t, int, const char *, size_t);
+int np_cache_lock(const char *);
 
 void np_init(char *, int argc, char **argv);
 void np_set_args(int argc, char **argv);
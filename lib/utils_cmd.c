@@ -43,11 +43,19 @@
 #include "utils_cmd.h"
 #include "utils_base.h"
 #include <fcntl.h>
+#include <sys/resource.h>
+#ifdef HAVE_POLL
+# include <poll.h>
+#endif
 
 #ifdef HAVE_SYS_WAIT_H
 # include <sys/wait.h>
 #endif
 
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+
 /* used in _cmd_open to pass the environment to commands */
 extern char **environ;
 
@@ -75,12 +83,18 @@ extern char **environ;
  * occur in any number of threads simultaneously. */
 static pid_t *_cmd_pids = NULL;
 
+/* see cmd_set_timeout() */
+static unsigned int cmd_timeout = 0;
+
+int (*cmd_run_inprocess) (char *const *, output *, output *) = NULL;
+
 /* Try sysconf(_SC_OPEN_MAX) first, as it can be higher than OPEN_MAX.
  * If that fails and the macro isn't defined, we fall back to an educated
  * guess. There's no guarantee that our guess is adequate and the program
  * will die with SIGSEGV if it isn't and the upper boundary is breached. */
 #define DEFAULT_MAXFD  256   /* fallback value if no max open files value is set */
 #define MAXFD_LIMIT   8192   /* upper limit of open files */
+#define CMD_OUTPUT_CHUNK 4096 /* initial output buffer and minimum read size */
 #ifdef _SC_OPEN_MAX
 static long maxfd = 0;
 #elif defined(OPEN_MAX)
@@ -94,9 +108,6 @@ static long maxfd = 0;
 static int _cmd_open (char *const *, int *, int *)
 	__attribute__ ((__nonnull__ (1, 2, 3)));
 
-static int _cmd_fetch_output (int, output *, int)
-	__attribute__ ((__nonnull__ (2)));
-
 static int _cmd_close (int);
 
 /* prototype imported from utils.h */
@@ -131,16 +142,76 @@ cmd_init (void)
 }
 
 
-/* Start running a command, array style */
-static int
-_cmd_open (char *const *argv, int *pfd, int *pfderr)
+/* Start argv[0] with its stdout and stderr on the write ends of pfd and
+ * pfderr. Every other descriptor above stderr is closed in the child, with
+ * closefrom() or close_range() where the system has them, so nothing leaks
+ * into the command and the cost does not grow with RLIMIT_NOFILE.
+ *
+ * vfork() is used where it works, so a large parent is not copied just to
+ * be replaced by execve(). The child only makes system calls on data
+ * prepared here before the fork, which is what vfork() requires. */
+pid_t
+cmd_spawn (char *const *argv, char *const *envp, int *pfd, int *pfderr)
 {
 	pid_t pid;
+#ifndef HAVE_CLOSEFROM
+	long fd, open_max;
+#endif
 #ifdef RLIMIT_CORE
 	struct rlimit limit;
+
+	/* the program we execve shouldn't leave core files */
+	getrlimit (RLIMIT_CORE, &limit);
+	limit.rlim_cur = 0;
+#endif
+#ifndef HAVE_CLOSEFROM
+	if ((open_max = sysconf (_SC_OPEN_MAX)) < 0 || open_max > MAXFD_LIMIT)
+		open_max = MAXFD_LIMIT;
 #endif
 
-	int flags, i = 0;
+#ifdef HAVE_WORKING_VFORK
+	pid = vfork ();
+#else
+	pid = fork ();
+#endif
+	if (pid != 0)
+		return pid;
+
+	/* child runs execve() and _exit. */
+#ifdef RLIMIT_CORE
+	setrlimit (RLIMIT_CORE, &limit);
+#endif
+	if (pfd[0] != STDOUT_FILENO && pfd[0] != STDERR_FILENO)
+		close (pfd[0]);
+	if (pfderr[0] != STDOUT_FILENO && pfderr[0] != STDERR_FILENO)
+		close (pfderr[0]);
+	if (pfd[1] != STDOUT_FILENO)
+		dup2 (pfd[1], STDOUT_FILENO);
+	if (pfderr[1] != STDERR_FILENO)
+		dup2 (pfderr[1], STDERR_FILENO);
+
+#ifdef HAVE_CLOSEFROM
+	closefrom (STDERR_FILENO + 1);
+#else
+# ifdef HAVE_CLOSE_RANGE
+	/* old kernels return ENOSYS */
+	if (close_range (STDERR_FILENO + 1, ~0U, 0) < 0)
+# endif
+		for (fd = STDERR_FILENO + 1; fd < open_max; fd++)
+			close (fd);
+#endif
+
+	execve (argv[0], argv, envp);
+	_exit (STATE_UNKNOWN);
+}
+
+
+/* Start running a command, array style */
+static int
+_cmd_open (char *const *argv, int *pfd, int *pfderr)
+{
+	pid_t pid;
+	int flags;
 
 	/* if no command was passed, return with no error */
 	if (argv == NULL)
@@ -151,39 +222,10 @@ _cmd_open (char *const *argv, int *pfd, int *pfderr)
 
 	setenv("LC_ALL", "C", 1);
 
-	if (pipe (pfd) < 0 || pipe (pfderr) < 0 || (pid = fork ()) < 0)
+	if (pipe (pfd) < 0 || pipe (pfderr) < 0 ||
+	    (pid = cmd_spawn (argv, environ, pfd, pfderr)) < 0)
 		return -1;									/* errno set by the failing function */
 
-	/* child runs exceve() and _exit. */
-	if (pid == 0) {
-#ifdef 	RLIMIT_CORE
-		/* the program we execve shouldn't leave core files */
-		getrlimit (RLIMIT_CORE, &limit);
-		limit.rlim_cur = 0;
-		setrlimit (RLIMIT_CORE, &limit);
-#endif
-		close (pfd[0]);
-		if (pfd[1] != STDOUT_FILENO) {
-			dup2 (pfd[1], STDOUT_FILENO);
-			close (pfd[1]);
-		}
-		close (pfderr[0]);
-		if (pfderr[1] != STDERR_FILENO) {
-			dup2 (pfderr[1], STDERR_FILENO);
-			close (pfderr[1]);
-		}
-
-		/* close all descriptors in _cmd_pids[]
-		 * This is executed in a separate address space (pure child),
-		 * so we don't have to worry about async safety */
-		for (i = 0; i < maxfd; i++)
-			if (_cmd_pids[i] > 0)
-				close (i);
-
-		execve (argv[0], argv, environ);
-		_exit (STATE_UNKNOWN);
-	}
-
 	/* parent picks up execution here */
 	/* close childs descriptors in our address space */
 	close (pfd[1]);
@@ -224,79 +266,395 @@ _cmd_close (int fd)
 }
 
 
+/* Make room for another read into op->buf, keeping space for the NUL.
+ * The buffer grows geometrically, so capturing N bytes costs O(N) copying
+ * in total rather than one realloc+memcpy per read. */
 static int
-_cmd_fetch_output (int fd, output * op, int flags)
+_cmd_reserve (output * op, size_t * size)
 {
-	size_t len = 0, i = 0, lineno = 0;
-	size_t rsf = 6, ary_size = 0;	/* rsf = right shift factor, dec'ed uncond once */
-	char *buf = NULL;
-	int ret;
-	char tmpbuf[4096];
+	char *tmp;
+
+	if (op->buf == NULL) {
+		*size = CMD_OUTPUT_CHUNK;
+		op->buflen = 0;
+		return (op->buf = malloc (*size)) == NULL ? -1 : 0;
+	}
+	if (*size - op->buflen < CMD_OUTPUT_CHUNK / 4 + 1) {
+		if ((tmp = realloc (op->buf, *size << 1)) == NULL)
+			return -1;
+		op->buf = tmp;
+		*size <<= 1;
+	}
+	return 0;
+}
+
+
+/* Read everything from fd into op->buf, which is always NUL terminated. */
+static int
+_cmd_read_all (int fd, output * op)
+{
+	size_t size = 0;
+	ssize_t ret;
 
 	op->buf = NULL;
 	op->buflen = 0;
-	while ((ret = read (fd, tmpbuf, sizeof (tmpbuf))) > 0) {
-		len = (size_t) ret;
-		op->buf = realloc (op->buf, op->buflen + len + 1);
-		memcpy (op->buf + op->buflen, tmpbuf, len);
-		op->buflen += len;
-		i++;
+	while (1) {
+		if (_cmd_reserve (op, &size) < 0)
+			return -1;
+		ret = read (fd, op->buf + op->buflen, size - op->buflen - 1);
+		if (ret <= 0)
+			break;
+		op->buflen += (size_t) ret;
 	}
+	op->buf[op->buflen] = '\0';
 
 	if (ret < 0 && (errno != EAGAIN && errno != EWOULDBLOCK)) {
-		printf ("read() returned %d: %s\n", ret, strerror (errno));
-		return ret;
+		printf ("read() returned %d: %s\n", (int) ret, strerror (errno));
+		return (int) ret;
 	}
 
-	/* some plugins may want to keep output unbroken, and some commands
-	 * will yield no output, so return here for those */
-	if (flags & CMD_NO_ARRAYS || !op->buf || !op->buflen)
-		return op->buflen;
+	return 0;
+}
+
+
+/* Build the line index of op. Lines are found with memchr() and the arrays
+ * are sized up front, so each byte is looked at once. */
+size_t
+cmd_split_lines (output * op, int flags)
+{
+	size_t i = 0, lineno = 0, count = 0;
+	char *buf, *nl;
+
+	op->line = NULL;
+	op->lens = NULL;
+	if (!op->buf || !op->buflen)
+		return 0;
 
 	/* and some may want both */
 	if (flags & CMD_NO_ASSOC) {
-		buf = malloc (op->buflen);
-		memcpy (buf, op->buf, op->buflen);
+		if ((buf = malloc (op->buflen + 1)) == NULL)
+			return 0;
+		memcpy (buf, op->buf, op->buflen + 1);
 	}
 	else
 		buf = op->buf;
 
-	op->line = NULL;
-	op->lens = NULL;
-	i = 0;
-	while (i < op->buflen) {
-		/* make sure we have enough memory */
-		if (lineno >= ary_size) {
-			/* ary_size must never be zero */
-			do {
-				ary_size = op->buflen >> --rsf;
-			} while (!ary_size);
-
-			op->line = realloc (op->line, ary_size * sizeof (char *));
-			op->lens = realloc (op->lens, ary_size * sizeof (size_t));
-		}
+	for (nl = buf; (nl = memchr (nl, '\n', op->buflen - (nl - buf))) != NULL; nl++)
+		count++;
+	if (buf[op->buflen - 1] != '\n')
+		count++;
+
+	op->line = malloc (count * sizeof (char *));
+	op->lens = malloc (count * sizeof (size_t));
+	if (!op->line || !op->lens)
+		die (STATE_UNKNOWN, _("Could not allocate memory for command output\n"));
 
+	while (i < op->buflen) {
 		/* set the pointer to the string */
 		op->line[lineno] = &buf[i];
 
 		/* hop to next newline or end of buffer */
-		while (buf[i] != '\n' && i < op->buflen)
-			i++;
+		nl = memchr (&buf[i], '\n', op->buflen - i);
+		i = nl ? (size_t) (nl - buf) : op->buflen;
 		buf[i] = '\0';
 
-		/* calculate the string length using pointer difference */
-		op->lens[lineno] = (size_t) & buf[i] - (size_t) op->line[lineno];
+		op->lens[lineno] = (size_t) (&buf[i] - op->line[lineno]);
 
 		lineno++;
 		i++;
 	}
 
+	op->lines = lineno;
 	return lineno;
 }
 
 
+/* some plugins may want to keep output unbroken, and some commands
+ * will yield no output, so return here for those */
+static size_t
+_cmd_index_output (output * op, int flags)
+{
+	if (flags & CMD_NO_ARRAYS || !op->buflen)
+		return op->buflen;
+
+	return cmd_split_lines (op, flags);
+}
+
+
 int
-cmd_run (const char *cmdstring, output * out, output * err, int flags)
+cmd_fetch_output (int fd, output * op, int flags)
+{
+	int ret;
+
+	if ((ret = _cmd_read_all (fd, op)) < 0)
+		return ret;
+
+	return _cmd_index_output (op, flags);
+}
+
+
+#ifdef HAVE_POLL
+static void
+_cmd_now (struct timeval *now)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	now->tv_sec = ts.tv_sec;
+	now->tv_usec = ts.tv_nsec / 1000;
+#else
+	gettimeofday (now, NULL);
+#endif
+}
+
+
+/* milliseconds left until deadline, or -1 if there is none */
+static int
+_cmd_time_left (const struct timeval *deadline)
+{
+	struct timeval now;
+	long ms;
+
+	if (deadline->tv_sec == 0)
+		return -1;
+
+	_cmd_now (&now);
+	ms = (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_usec - now.tv_usec) / 1000;
+	return ms < 0 ? 0 : (int) ms;
+}
+
+
+/* Read once from a non-blocking pipe. Returns 1 if data was read, -1 if
+ * none was available and 0 at EOF or on errors. */
+static int
+_cmd_drain_one (int fd, output * op, size_t * size)
+{
+	char discard[CMD_OUTPUT_CHUNK];
+	ssize_t ret;
+
+	if (op && _cmd_reserve (op, size) < 0)
+		return 0;
+	if (op)
+		ret = read (fd, op->buf + op->buflen, *size - op->buflen - 1);
+	else
+		ret = read (fd, discard, sizeof (discard));
+
+	if (ret > 0) {
+		if (op)
+			op->buflen += (size_t) ret;
+		return 1;
+	}
+	if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return -1;
+	if (ret < 0)
+		printf ("read() returned %d: %s\n", (int) ret, strerror (errno));
+	return 0;
+}
+#endif /* HAVE_POLL */
+
+
+/* A descriptor that polls readable once pid has exited, so that the exit
+ * is seen with the pipes rather than by SIGCHLD; -1 where the system has
+ * none (other than Linux 5.3 and later) */
+static int
+_cmd_pidfd (pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return (int) syscall (SYS_pidfd_open, pid, 0);
+#else
+	(void) pid;
+	return -1;
+#endif
+}
+
+
+/* Reap a child given with its pid, killed first if it is past its
+ * deadline; its wait status goes to child->status */
+static void
+_cmd_reap (cmd_child * child, int kill_it)
+{
+	if (kill_it)
+		child->timed_out = 1;
+	if (child->pid <= 0)
+		return;
+	if (kill_it)
+		kill (child->pid, SIGKILL);
+	while (waitpid (child->pid, &child->status, 0) < 0)
+		if (errno != EINTR) {
+			child->status = -1;
+			break;
+		}
+}
+
+
+#ifdef HAVE_POLL
+/* Child i is done: take what is left in its pipes without waiting for
+ * more, and reap it. pfds holds three descriptors per child, stdout,
+ * stderr and its pidfd. */
+static void
+_cmd_finish (struct pollfd *pfds, size_t *sizes, cmd_child * child, int i, int kill_it)
+{
+	struct pollfd *p = &pfds[3 * i];
+
+	if (p[0].fd >= 0)
+		while (_cmd_drain_one (p[0].fd, child->out, &sizes[2 * i]) > 0);
+	if (p[1].fd >= 0)
+		while (_cmd_drain_one (p[1].fd, child->err, &sizes[2 * i + 1]) > 0);
+	if (p[2].fd >= 0)
+		close (p[2].fd);
+	p[0].fd = p[1].fd = p[2].fd = -1;
+	_cmd_reap (child, kill_it);
+}
+#endif /* HAVE_POLL */
+
+
+/* Drain the stdout and stderr pipes of n children at once, so that none
+ * of them stalls on a full pipe while another one is being read.
+ *
+ * A child is finished once its stdout reaches EOF. Whatever it has left in
+ * its stderr pipe is collected then, but stderr is not waited on, since a
+ * backgrounded grandchild may keep it open indefinitely. Missing outputs
+ * are read and thrown away.
+ *
+ * A child given with its pid has a deadline of its own, its timeout or
+ * this one if that is sooner, and is killed when it passes it; on Linux
+ * its pidfd is polled with its pipes, so that it is also finished when it
+ * exits while a grandchild holds its stdout. It is reaped either way, with
+ * its wait status in status. Every other child has this timeout.
+ *
+ * Returns 0, or -1 with errno set to ETIMEDOUT when a child timed out;
+ * the line arrays are then still built from what was read. */
+int
+cmd_fetch_children (cmd_child * children, int n, int flags, unsigned int timeout)
+{
+	int i, ret = 0, timed_out = 0;
+#ifdef HAVE_POLL
+	struct pollfd *pfds;
+	struct timeval *deadlines;
+	unsigned int seconds;
+	cmd_child *child;
+	size_t *sizes;
+	int left, wait, active = 0;
+
+	pfds = calloc ((size_t) n * 3, sizeof (struct pollfd));
+	sizes = calloc ((size_t) n * 2, sizeof (size_t));
+	deadlines = calloc ((size_t) n, sizeof (struct timeval));
+	if (pfds == NULL || sizes == NULL || deadlines == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory for command output\n"));
+#endif
+
+	for (i = 0; i < n; i++) {
+		if (children[i].out)
+			memset (children[i].out, 0, sizeof (output));
+		if (children[i].err)
+			memset (children[i].err, 0, sizeof (output));
+		children[i].status = 0;
+		children[i].timed_out = 0;
+	}
+
+#ifdef HAVE_POLL
+	for (i = 0; i < n; i++) {
+		child = &children[i];
+		pfds[3 * i].fd = child->out_fd;
+		pfds[3 * i + 1].fd = child->err_fd;
+		pfds[3 * i + 2].fd = child->pid > 0 && child->out_fd >= 0 ? _cmd_pidfd (child->pid) : -1;
+		pfds[3 * i].events = pfds[3 * i + 1].events = pfds[3 * i + 2].events = POLLIN;
+		if (child->out_fd >= 0)
+			active++;
+
+		seconds = child->pid > 0 && child->timeout && (!timeout || child->timeout < timeout)
+			? child->timeout : timeout;
+		if (seconds) {
+			_cmd_now (&deadlines[i]);
+			deadlines[i].tv_sec += seconds;
+		}
+	}
+	for (i = 0; i < n * 3; i++)
+		if (pfds[i].fd >= 0 && i % 3 != 2)
+			fcntl (pfds[i].fd, F_SETFL, fcntl (pfds[i].fd, F_GETFL, 0) | O_NONBLOCK);
+
+	while (active > 0) {
+		/* the children past their deadline are done, the soonest of the
+		 * others is as long as poll waits */
+		wait = -1;
+		for (i = 0; i < n; i++) {
+			if (pfds[3 * i].fd < 0)
+				continue;
+			if ((left = _cmd_time_left (&deadlines[i])) == 0) {
+				_cmd_finish (pfds, sizes, &children[i], i, 1);
+				timed_out = 1;
+				active--;
+			} else if (left > 0 && (wait < 0 || left < wait))
+				wait = left;
+		}
+		if (active == 0)
+			break;
+
+		if (poll (pfds, (nfds_t) n * 3, wait) < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -1;
+			break;
+		}
+
+		for (i = 0; i < n * 3; i++) {
+			if (pfds[i].fd < 0 || !pfds[i].revents)
+				continue;
+			child = &children[i / 3];
+			if (i % 3 != 2
+			    && _cmd_drain_one (pfds[i].fd, (i % 3) ? child->err : child->out, &sizes[i / 3 * 2 + i % 3]))
+				continue;
+			if (i % 3 == 1) {
+				pfds[i].fd = -1;
+				continue;
+			}
+			/* stdout is done or the child has exited: take what is left
+			 * and move on */
+			if (i % 3 == 0)
+				pfds[i].fd = -1;
+			_cmd_finish (pfds, sizes, child, i / 3, 0);
+			active--;
+		}
+	}
+
+	/* children not done when poll failed are not left running */
+	for (i = 0; i < n; i++)
+		if (pfds[3 * i].fd >= 0)
+			_cmd_finish (pfds, sizes, &children[i], i, 1);
+
+	free (pfds);
+	free (sizes);
+	free (deadlines);
+#else
+	for (i = 0; i < n; i++) {
+		if (children[i].out && _cmd_read_all (children[i].out_fd, children[i].out) < 0)
+			ret = -1;
+		if (children[i].err && _cmd_read_all (children[i].err_fd, children[i].err) < 0)
+			ret = -1;
+		_cmd_reap (&children[i], 0);
+	}
+#endif /* HAVE_POLL */
+
+	for (i = 0; i < n * 2; i++) {
+		output *op = (i & 1) ? children[i >> 1].err : children[i >> 1].out;
+		if (op == NULL || op->buf == NULL)
+			continue;
+		op->buf[op->buflen] = '\0';
+		op->lines = _cmd_index_output (op, flags);
+	}
+
+	if (timed_out) {
+		ret = -1;
+		errno = ETIMEDOUT;
+	}
+	return ret;
+}
+
+
+/* Split a command line into arguments, as cmd_run() does */
+char **
+cmd_argv (const char *cmdstring)
 {
 	int i = 0, argc;
 	size_t cmdlen;
@@ -305,28 +663,22 @@ cmd_run (const char *cmdstring, output * out, output * err, int flags)
 	char *str = NULL;
 
 	if (cmdstring == NULL)
-		return -1;
-
-	/* initialize the structs */
-	if (out)
-		memset (out, 0, sizeof (output));
-	if (err)
-		memset (err, 0, sizeof (output));
+		return NULL;
 
 	/* make copy of command string so strtok() doesn't silently modify it */
 	/* (the calling program may want to access it later) */
 	cmdlen = strlen (cmdstring);
 	if ((cmd = malloc (cmdlen + 1)) == NULL)
-		return -1;
+		return NULL;
 	memcpy (cmd, cmdstring, cmdlen);
 	cmd[cmdlen] = '\0';
 
 	/* This is not a shell, so we don't handle "???" */
-	if (strstr (cmdstring, "\"")) return -1;
+	if (strstr (cmdstring, "\"")) return NULL;
 
 	/* allow single quotes, but only if non-whitesapce doesn't occur on both sides */
 	if (strstr (cmdstring, " ' ") || strstr (cmdstring, "'''"))
-		return -1;
+		return NULL;
 
 	/* each arg must be whitespace-separated, so args can be a maximum
 	 * of (len / 2) + 1. We add 1 extra to the mix for NULL termination */
@@ -335,7 +687,7 @@ cmd_run (const char *cmdstring, output * out, output * err, int flags)
 
 	if (argv == NULL) {
 		printf ("%s\n", _("Could not malloc argv array in popen()"));
-		return -1;
+		return NULL;
 	}
 
 	/* get command arguments (stupidly, but fairly quickly) */
@@ -346,7 +698,7 @@ cmd_run (const char *cmdstring, output * out, output * err, int flags)
 		if (strstr (str, "'") == str) {	/* handle SIMPLE quoted strings */
 			str++;
 			if (!strstr (str, "'"))
-				return -1;							/* balanced? */
+				return NULL;							/* balanced? */
 			cmd = 1 + strstr (str, "'");
 			str[strcspn (str, "'")] = 0;
 		}
@@ -366,13 +718,32 @@ cmd_run (const char *cmdstring, output * out, output * err, int flags)
 		argv[i++] = str;
 	}
 
+	return argv;
+}
+
+
+int
+cmd_run (const char *cmdstring, output * out, output * err, int flags)
+{
+	char **argv;
+
+	/* initialize the structs */
+	if (out)
+		memset (out, 0, sizeof (output));
+	if (err)
+		memset (err, 0, sizeof (output));
+
+	if ((argv = cmd_argv (cmdstring)) == NULL)
+		return -1;
+
 	return cmd_run_array (argv, out, err, flags);
 }
 
 int
 cmd_run_array (char *const *argv, output * out, output * err, int flags)
 {
-	int fd, pfd_out[2], pfd_err[2];
+	int fd, pfd_out[2], pfd_err[2], timed_out;
+	cmd_child child;
 
 	/* initialize the structs */
 	if (out)
@@ -383,14 +754,112 @@ cmd_run_array (char *const *argv, output * out, output * err, int flags)
 	if ((fd = _cmd_open (argv, pfd_out, pfd_err)) == -1)
 		die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), argv[0]);
 
-	if (out)
-		out->lines = _cmd_fetch_output (pfd_out[0], out, flags);
+	child.out_fd = pfd_out[0];
+	child.err_fd = pfd_err[0];
+	child.out = out;
+	child.err = err;
+	child.pid = _cmd_pids[fd];
+	child.timeout = 0;
+	timed_out = cmd_fetch_children (&child, 1, flags, cmd_timeout) < 0 && errno == ETIMEDOUT;
+	/* reaped there */
+	_cmd_pids[fd] = 0;
+	close (pfd_out[0]);
+	close (pfd_err[0]);
+	if (timed_out) {
+		errno = ETIMEDOUT;
+		return -1;
+	}
+
+	return (WIFEXITED (child.status)) ? WEXITSTATUS (child.status) : -1;
+}
+
+
+/* Run argv with its stdout handed to filter a block at a time as it is
+ * read, and once more with len 0 at EOF, so that output of any size goes
+ * through without being held; stderr is collected into err as by
+ * cmd_run_array(), and the same timeout applies */
+int
+cmd_run_filter (char *const *argv, cmd_filter filter, void *data, output * err)
+{
+	int fd, pfd_out[2], pfd_err[2];
+	char buf[CMD_OUTPUT_CHUNK];
+	ssize_t len;
+	size_t err_size = 0;
+#ifdef HAVE_POLL
+	struct pollfd pfds[2];
+	struct timeval deadline = { 0, 0 };
+	int wait;
+#endif
+
 	if (err)
-		err->lines = _cmd_fetch_output (pfd_err[0], err, flags);
+		memset (err, 0, sizeof (output));
+
+	if ((fd = _cmd_open (argv, pfd_out, pfd_err)) == -1)
+		die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), argv[0]);
+
+#ifdef HAVE_POLL
+	fcntl (fd, F_SETFL, fcntl (fd, F_GETFL, 0) | O_NONBLOCK);
+	pfds[0].fd = fd;
+	pfds[1].fd = pfd_err[0];
+	pfds[0].events = pfds[1].events = POLLIN;
+	if (cmd_timeout) {
+		_cmd_now (&deadline);
+		deadline.tv_sec += cmd_timeout;
+	}
+
+	while (pfds[0].fd >= 0) {
+		if ((wait = _cmd_time_left (&deadline)) == 0) {
+			kill (_cmd_pids[fd], SIGKILL);
+			close (pfd_err[0]);
+			_cmd_close (fd);
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		if (poll (pfds, 2, wait) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (pfds[1].fd >= 0 && pfds[1].revents
+		    && _cmd_drain_one (pfds[1].fd, err, &err_size) == 0)
+			pfds[1].fd = -1;
+		if (!pfds[0].revents)
+			continue;
+		if ((len = read (fd, buf, sizeof (buf))) > 0)
+			filter (buf, (size_t) len, data);
+		else if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			pfds[0].fd = -1;
+	}
+	/* as cmd_fetch_children(), stderr is not waited on past stdout's EOF */
+	if (pfds[1].fd >= 0)
+		while (_cmd_drain_one (pfds[1].fd, err, &err_size) > 0);
+#else
+	while ((len = read (fd, buf, sizeof (buf))) > 0)
+		filter (buf, (size_t) len, data);
+	if (err)
+		_cmd_read_all (pfd_err[0], err);
+#endif /* HAVE_POLL */
+	filter (buf, 0, data);
+	close (pfd_err[0]);
+
+	if (err && err->buf) {
+		err->buf[err->buflen] = '\0';
+		err->lines = _cmd_index_output (err, 0);
+	}
 
 	return _cmd_close (fd);
 }
 
+
+/* Give commands started by cmd_run() and cmd_run_array() this many seconds
+ * to finish, measured on a monotonic clock. 0, the default, waits forever
+ * and leaves timeouts to the plugin's alarm() */
+void
+cmd_set_timeout (unsigned int seconds)
+{
+	cmd_timeout = seconds;
+}
+
 int
 cmd_file_read ( char *filename, output *out, int flags)
 {
@@ -403,7 +872,7 @@ cmd_file_read ( char *filename, output *out, int flags)
 	}
 
 	if(out)
-		out->lines = _cmd_fetch_output (fd, out, flags);
+		out->lines = cmd_fetch_output (fd, out, flags);
 	
 	if (close(fd) == -1)
 		die( STATE_UNKNOWN, _("Error closing %s: %s"), filename, strerror(errno) );
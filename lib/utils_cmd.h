@@ -19,11 +19,59 @@ struct output
 
 typedef struct output output;
 
+/* the read ends of one running child's pipes, see cmd_fetch_children() */
+struct cmd_child
+{
+	int out_fd;    /* stdout, must be open */
+	int err_fd;    /* stderr, or -1 */
+	output *out;   /* NULL to throw stdout away */
+	output *err;   /* NULL to throw stderr away */
+	pid_t pid;     /* or 0; with it, the child is killed at its own
+	                * deadline and reaped */
+	unsigned int timeout; /* seconds of that deadline, 0 for the call's */
+	int status;    /* set: its wait status, once reaped */
+	int timed_out; /* set: it was past its deadline */
+};
+
+typedef struct cmd_child cmd_child;
+
+/* see cmd_run_filter() */
+typedef void (*cmd_filter) (const char *, size_t, void *);
+
 /** prototypes **/
 int cmd_run (const char *, output *, output *, int);
 int cmd_run_array (char *const *, output *, output *, int);
+/* run a command with its stdout passed through filter as it comes */
+int cmd_run_filter (char *const *, cmd_filter, void *, output *)
+	__attribute__ ((__nonnull__ (1, 2)));
+/* split a command line into arguments as cmd_run() does; NULL if it
+ * cannot be run that way */
+char **cmd_argv (const char *);
 int cmd_file_read (char *, output *, int);
 
+/* start argv with stdout/stderr on the write ends of the two pipes */
+pid_t cmd_spawn (char *const *, char *const *, int *, int *)
+	__attribute__ ((__nonnull__ (1, 3, 4)));
+/* read all of fd into an output struct, honouring the CMD_* flags below */
+int cmd_fetch_output (int, output *, int)
+	__attribute__ ((__nonnull__ (2)));
+/* drain the pipes of several children at once, with a timeout in seconds,
+ * and reap those given with their pid */
+int cmd_fetch_children (cmd_child *, int, int, unsigned int)
+	__attribute__ ((__nonnull__ (1)));
+/* build the line arrays later for output fetched with CMD_NO_ARRAYS */
+size_t cmd_split_lines (output *, int);
+
+/* Set by the multi-call binary, for wrappers such as negate: runs argv
+ * within this process if it names one of the binary's own plugins, with
+ * stdout and stderr into out and err as cmd_run_array() would put them,
+ * and returns its exit status; returns -1 without running anything if
+ * argv is some other command */
+extern int (*cmd_run_inprocess) (char *const *, output *, output *);
+
+/* timeout in seconds for cmd_run() and cmd_run_array(), 0 for none */
+void cmd_set_timeout (unsigned int);
+
 /* only multi-threaded plugins need to bother with this */
 void cmd_init (void);
 #define CMD_INIT cmd_init()
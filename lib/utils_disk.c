@@ -28,16 +28,12 @@
 
 #include "common.h"
 #include "utils_disk.h"
-
-void
-np_add_name (struct name_list **list, const char *name)
-{
-  struct name_list *new_entry;
-  new_entry = (struct name_list *) malloc (sizeof *new_entry);
-  new_entry->name = (char *) name;
-  new_entry->next = *list;
-  *list = new_entry;
-}
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <poll.h>
 
 /* Initialises a new parameter at the end of list */
 struct parameter_list *
@@ -115,44 +111,225 @@ np_find_parameter(struct parameter_list *list, const char *name)
   return NULL;
 }
 
+/*
+ * Index of the mount table by mount directory and by device name, so that
+ * each desired path costs a few hash lookups instead of a pass over every
+ * mount. Like the list scan it replaces, a later entry wins over an earlier
+ * one with the same key.
+ */
+struct mount_slot
+{
+  unsigned int hash;
+  size_t len;
+  const char *key;
+  struct mount_entry *me;
+};
+
+struct mount_index
+{
+  struct mount_slot *slots;
+  size_t mask;
+};
+
+#define MOUNT_HASH_INIT 2166136261u
+#define MOUNT_HASH_STEP(h, c) (((h) ^ (unsigned char) (c)) * 16777619u)
+
+static unsigned int
+mount_hash (const char *s, size_t len)
+{
+  unsigned int h = MOUNT_HASH_INIT;
+
+  while (len--)
+    h = MOUNT_HASH_STEP (h, *s++);
+  return h;
+}
+
+/*
+ * The names of a name_list, in an open addressing set that every entry of
+ * the list points to, so that a lookup does not walk the list. An entry
+ * added to a list is in the set of the entries before it too: a list is
+ * only ever used through its latest head.
+ */
+struct name_set
+{
+  const char **names;
+  unsigned int *hashes;
+  size_t mask;
+  size_t count;
+};
+
+static size_t
+name_set_slot (const struct name_set *set, unsigned int hash, const char *name)
+{
+  size_t i;
+
+  for (i = hash & set->mask; set->names[i]; i = (i + 1) & set->mask)
+    if (set->hashes[i] == hash && strcmp (set->names[i], name) == 0)
+      break;
+  return i;
+}
+
+static void
+name_set_grow (struct name_set *set, size_t size)
+{
+  const char **names = set->names;
+  unsigned int *hashes = set->hashes;
+  size_t i, j, old_size = set->names ? set->mask + 1 : 0;
+
+  set->names = calloc (size, sizeof (*set->names));
+  set->hashes = calloc (size, sizeof (*set->hashes));
+  if (set->names == NULL || set->hashes == NULL)
+    die (STATE_UNKNOWN, _("Could not allocate memory for the name list\n"));
+  set->mask = size - 1;
+  for (i = 0; i < old_size; i++) {
+    if (names[i] == NULL)
+      continue;
+    for (j = hashes[i] & set->mask; set->names[j]; j = (j + 1) & set->mask)
+      ;
+    set->names[j] = names[i];
+    set->hashes[j] = hashes[i];
+  }
+  free (names);
+  free (hashes);
+}
+
+static void
+name_set_add (struct name_set *set, const char *name)
+{
+  unsigned int hash = mount_hash (name, strlen (name));
+  size_t i;
+
+  if ((set->count + 1) * 2 > set->mask + 1)
+    name_set_grow (set, (set->mask + 1) * 2);
+  i = name_set_slot (set, hash, name);
+  if (set->names[i])
+    return;
+  set->names[i] = name;
+  set->hashes[i] = hash;
+  set->count++;
+}
+
+static int
+name_set_has (const struct name_set *set, const char *name)
+{
+  return set->names[name_set_slot (set, mount_hash (name, strlen (name)), name)] != NULL;
+}
+
+void
+np_add_name (struct name_list **list, const char *name)
+{
+  struct name_list *new_entry;
+  new_entry = (struct name_list *) malloc (sizeof *new_entry);
+  if (new_entry == NULL)
+    die (STATE_UNKNOWN, _("Could not allocate memory for the name list\n"));
+  new_entry->name = (char *) name;
+  new_entry->next = *list;
+  new_entry->set = *list ? (*list)->set : NULL;
+  if (new_entry->set == NULL) {
+    if ((new_entry->set = calloc (1, sizeof (struct name_set))) == NULL)
+      die (STATE_UNKNOWN, _("Could not allocate memory for the name list\n"));
+    name_set_grow (new_entry->set, 16);
+  }
+  name_set_add (new_entry->set, name);
+  *list = new_entry;
+}
+
+static struct mount_slot *
+mount_slot (struct mount_index *index, unsigned int hash, const char *key, size_t len)
+{
+  size_t i;
+
+  for (i = hash & index->mask; index->slots[i].key; i = (i + 1) & index->mask)
+    if (index->slots[i].hash == hash && index->slots[i].len == len &&
+        memcmp (index->slots[i].key, key, len) == 0)
+      break;
+  return &index->slots[i];
+}
+
+static void
+mount_index_put (struct mount_index *index, const char *key, struct mount_entry *me)
+{
+  size_t len = strlen (key);
+  unsigned int hash = mount_hash (key, len);
+  struct mount_slot *slot = mount_slot (index, hash, key, len);
+
+  slot->hash = hash;
+  slot->len = len;
+  slot->key = key;
+  slot->me = me;
+}
+
+static struct mount_entry *
+mount_index_get (struct mount_index *index, unsigned int hash, const char *key, size_t len)
+{
+  return mount_slot (index, hash, key, len)->me;
+}
+
 void
 np_set_best_match(struct parameter_list *desired, struct mount_entry *mount_list, int exact)
 {
   struct parameter_list *d;
+  struct mount_index dirs, devs;
+  struct mount_entry *me;
+  /* the scan took any one character directory (and an empty one) as a prefix */
+  struct mount_entry *short_dir[2] = { NULL, NULL };
+  size_t count = 0, size = 2;
+
+  for (d = desired; d && d->best_match; d = d->name_next)
+    ;
+  if (d == NULL)
+    return;
+
+  for (me = mount_list; me; me = me->me_next)
+    count++;
+  while (size < count * 2)
+    size *= 2;
+  dirs.slots = calloc (size, sizeof (struct mount_slot));
+  devs.slots = calloc (size, sizeof (struct mount_slot));
+  if (dirs.slots == NULL || devs.slots == NULL)
+    die (STATE_UNKNOWN, _("Could not allocate memory for the mount list\n"));
+  dirs.mask = devs.mask = size - 1;
+
+  for (me = mount_list; me; me = me->me_next) {
+    size_t len = strlen (me->me_mountdir);
+
+    mount_index_put (&devs, me->me_devname, me);
+    mount_index_put (&dirs, me->me_mountdir, me);
+    if (len < 2)
+      short_dir[len] = me;
+  }
+
   for (d = desired; d; d= d->name_next) {
     if (! d->best_match) {
-      struct mount_entry *me;
       size_t name_len = strlen(d->name);
-      size_t best_match_len = 0;
-      struct mount_entry *best_match = NULL;
+      struct mount_entry *best_match;
 
       /* set best match if path name exactly matches a mounted device name */
-      for (me = mount_list; me; me = me->me_next) {
-        if (strcmp(me->me_devname, d->name)==0)
-          best_match = me;
-      }
+      best_match = mount_index_get (&devs, mount_hash (d->name, name_len), d->name, name_len);
 
       /* set best match by directory name if no match was found by devname */
-      if (! best_match) {
-        for (me = mount_list; me; me = me->me_next) {
-          size_t len = strlen (me->me_mountdir);
-          if ((exact == FALSE && (best_match_len <= len && len <= name_len &&
-             (len == 1 || strncmp (me->me_mountdir, d->name, len) == 0)))
-             || (exact == TRUE && strcmp(me->me_mountdir, d->name)==0))
-          {
+      if (! best_match && exact == TRUE) {
+        best_match = mount_index_get (&dirs, mount_hash (d->name, name_len), d->name, name_len);
+      } else if (! best_match) {
+        /* the longest mount directory that is a prefix of the path */
+        unsigned int hash = MOUNT_HASH_INIT;
+        size_t len;
+
+        for (len = 1; len <= name_len; len++) {
+          hash = MOUNT_HASH_STEP (hash, d->name[len - 1]);
+          if (len >= 2 && (me = mount_index_get (&dirs, hash, d->name, len)))
             best_match = me;
-            best_match_len = len;
-          }
         }
+        if (! best_match)
+          best_match = name_len >= 1 && short_dir[1] ? short_dir[1] : short_dir[0];
       }
 
-      if (best_match) {
-        d->best_match = best_match;
-      } else {
-        d->best_match = NULL;	/* Not sure why this is needed as it should be null on initialisation */
-      }
+      d->best_match = best_match;
     }
   }
+
+  free (dirs.slots);
+  free (devs.slots);
 }
 
 /* Returns TRUE if name is in list */
@@ -164,6 +341,8 @@ np_find_name (struct name_list *list, const char *name)
   if (list == NULL || name == NULL) {
     return FALSE;
   }
+  if (list->set)
+    return name_set_has (list->set, name);
   for (n = list; n; n = n->next) {
     if (!strcmp(name, n->name)) {
       return TRUE;
@@ -176,6 +355,8 @@ int
 np_seen_name(struct name_list *list, const char *name)
 {
   const struct name_list *s;
+  if (list && list->set)
+    return name_set_has (list->set, name);
   for (s = list; s; s=s->next) {
     if (!strcmp(s->name, name)) {
       return TRUE;
@@ -185,13 +366,1070 @@ np_seen_name(struct name_list *list, const char *name)
 }
 
 int
-np_regex_match_mount_entry (struct mount_entry* me, regex_t* re)
+np_regex_match_mount_entry (struct mount_entry* me, np_regex_t* re)
 {
-  if (regexec(re, me->me_devname, (size_t) 0, NULL, 0) == 0 ||
-      regexec(re, me->me_mountdir, (size_t) 0, NULL, 0) == 0 ) {
+  if (np_regexec(re, me->me_devname, (size_t) 0, NULL, 0) == 0 ||
+      np_regexec(re, me->me_mountdir, (size_t) 0, NULL, 0) == 0 ) {
     return TRUE;
   } else {
     return FALSE;
   }
 }
 
+
+/*
+ * The longest run of plain characters that any match of an extended regular
+ * expression must contain, or NULL when there is none worth looking for.
+ * Only the top level is looked at: a pattern with an alternation has no
+ * such run, and groups and bracket expressions just end the current one.
+ */
+char *
+np_regex_literal (const char *pattern, int cflags)
+{
+  size_t plen = strlen (pattern), run = 0, best = 0, best_at = 0, at = 0, i;
+  char *out, *literal;
+  int depth = 0, in_bracket = 0;
+
+  if (!(cflags & REG_EXTENDED))
+    return NULL;
+  /* a top level | means no single run is required */
+  for (i = 0; i < plen; i++) {
+    if (pattern[i] == '\\' && pattern[i + 1])
+      i++;
+    else if (in_bracket) {
+      if (pattern[i] == ']')
+        in_bracket = 0;
+    } else if (pattern[i] == '[') {
+      in_bracket = 1;
+      if (pattern[i + 1] == '^')
+        i++;
+      if (pattern[i + 1] == ']')
+        i++;
+    } else if (pattern[i] == '(')
+      depth++;
+    else if (pattern[i] == ')')
+      depth--;
+    else if (pattern[i] == '|' && depth == 0)
+      return NULL;
+  }
+
+  out = malloc (plen + 1);
+  if (out == NULL)
+    return NULL;
+
+#define END_RUN() do { if (run > best) { best = run; best_at = at - run; } run = 0; } while (0)
+  for (i = 0; i < plen; i++) {
+    char c = pattern[i];
+
+    if (c == '*' || c == '?' || c == '{') {
+      /* the character before may not be there at all */
+      if (run > 0) {
+        run--;
+        at--;
+      }
+      END_RUN ();
+      if (c == '{')
+        while (i < plen && pattern[i] != '}')
+          i++;
+    } else if (c == '+') {
+      /* at least one, but the next one need not follow it */
+      END_RUN ();
+    } else if (c == '\\' && pattern[i + 1] && !isalnum ((unsigned char) pattern[i + 1])) {
+      out[at++] = pattern[++i];
+      run++;
+    } else if (c == '\\' || c == '.' || c == '^' || c == '$') {
+      if (c == '\\' && pattern[i + 1])
+        i++;
+      END_RUN ();
+    } else if (c == '[') {
+      END_RUN ();
+      i++;
+      if (pattern[i] == '^')
+        i++;
+      if (pattern[i] == ']')
+        i++;
+      while (i < plen && pattern[i] != ']')
+        i++;
+      /* a bracket is one atom, a following quantifier is harmless */
+    } else if (c == '(') {
+      END_RUN ();
+      for (depth = 1, i++; i < plen && depth; i++) {
+        if (pattern[i] == '\\' && pattern[i + 1])
+          i++;
+        else if (pattern[i] == '(')
+          depth++;
+        else if (pattern[i] == ')')
+          depth--;
+      }
+      i--;
+    } else if ((unsigned char) c >= 0x80 && (cflags & REG_ICASE)) {
+      /* leave case folding of multibyte text to np_regexec */
+      END_RUN ();
+    } else {
+      out[at++] = c;
+      run++;
+    }
+  }
+  END_RUN ();
+#undef END_RUN
+
+  if (best == 0) {
+    free (out);
+    return NULL;
+  }
+  literal = malloc (best + 1);
+  if (literal) {
+    memcpy (literal, out + best_at, best);
+    literal[best] = '\0';
+  }
+  free (out);
+  return literal;
+}
+
+/* Returns regcomp()'s error code, so that np_regerror() can explain it */
+int
+np_compile_mount_regex (struct np_mount_regex *mr, const char *pattern, int cflags)
+{
+  int err = np_regcomp (&mr->re, pattern, cflags);
+
+  if (err != 0)
+    return err;
+  mr->literal = np_regex_literal (pattern, cflags);
+  mr->icase = (cflags & REG_ICASE) != 0;
+  return 0;
+}
+
+static int
+np_contains (const char *s, const char *literal, int icase)
+{
+  size_t len;
+
+  if (!icase)
+    return strstr (s, literal) != NULL;
+  for (len = strlen (literal); *s; s++)
+    if (strncasecmp (s, literal, len) == 0)
+      return TRUE;
+  return FALSE;
+}
+
+/* np_regex_match_mount_entry(), skipping np_regexec when the literal is not there */
+int
+np_match_mount_regex (struct np_mount_regex *mr, struct mount_entry *me)
+{
+  if (mr->literal &&
+      !np_contains (me->me_devname, mr->literal, mr->icase) &&
+      !np_contains (me->me_mountdir, mr->literal, mr->icase))
+    return FALSE;
+  return np_regex_match_mount_entry (me, &mr->re);
+}
+
+void
+np_free_mount_regex (struct np_mount_regex *mr)
+{
+  np_regfree (&mr->re);
+  free (mr->literal);
+  mr->literal = NULL;
+}
+
+/* Same classification as gnulib's ME_DUMMY and ME_REMOTE for mountinfo */
+static int
+np_mount_dummy (const char *type)
+{
+  static const char *dummy_types[] = {
+    "autofs", "proc", "subfs", "debugfs", "devpts", "fusectl", "mqueue",
+    "rpc_pipefs", "sysfs", "devfs", "kernfs", "ignore", "none", NULL
+  };
+  int i;
+
+  for (i = 0; dummy_types[i]; i++)
+    if (!strcmp (type, dummy_types[i]))
+      return TRUE;
+  return FALSE;
+}
+
+static int
+np_mount_remote (const char *devname, const char *type)
+{
+  return strchr (devname, ':') != NULL ||
+         (devname[0] == '/' && devname[1] == '/' &&
+          (!strcmp (type, "smbfs") || !strcmp (type, "cifs")));
+}
+
+/* Decodes the \ooo escapes the kernel uses for blanks, in place */
+static char *
+np_mount_unescape (char *s)
+{
+  char *r, *w;
+
+  for (r = w = s; *r; r++, w++) {
+    if (r[0] == '\\' && r[1] >= '0' && r[1] <= '3' &&
+        r[2] >= '0' && r[2] <= '7' && r[3] >= '0' && r[3] <= '7') {
+      *w = (char) ((r[1] - '0') << 6 | (r[2] - '0') << 3 | (r[3] - '0'));
+      r += 3;
+    } else
+      *w = *r;
+  }
+  *w = '\0';
+  return s;
+}
+
+/*
+ * Reads a /proc/self/mountinfo style file in one go and builds a mount list
+ * of the entries the filter keeps. Nothing is copied for the others, which
+ * is most of them on hosts with thousands of container mounts. Returns FALSE
+ * with errno set if the file could not be read.
+ */
+int
+np_read_mountinfo (const char *file, np_mount_filter filter, void *data, struct mount_entry **list)
+{
+  struct mount_entry *me, **mtail = list;
+  size_t size = 65536, len = 0;
+  char *buf, *line, *next;
+  ssize_t n;
+  int fd;
+
+  *list = NULL;
+  if ((fd = open (file, O_RDONLY)) < 0)
+    return FALSE;
+  if ((buf = malloc (size)) == NULL) {
+    close (fd);
+    return FALSE;
+  }
+  /* proc files have no size, so read until EOF */
+  while ((n = read (fd, buf + len, size - len - 1)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      n = errno;
+      free (buf);
+      close (fd);
+      errno = n;
+      return FALSE;
+    }
+    len += n;
+    if (len + 1 == size) {
+      char *bigger = realloc (buf, size * 2);
+      if (bigger == NULL) {
+        free (buf);
+        close (fd);
+        errno = ENOMEM;
+        return FALSE;
+      }
+      buf = bigger;
+      size *= 2;
+    }
+  }
+  close (fd);
+  buf[len] = '\0';
+
+  for (line = buf; line && *line; line = next) {
+    /* id parent major:minor root mountpoint options [optional...] - type source superoptions */
+    char *field[6], *devname, *mountdir, *type, *p;
+    int nfields = 0, dummy, remote;
+
+    if ((next = strchr (line, '\n')) != NULL)
+      *next++ = '\0';
+
+    for (p = line; nfields < 6 && (field[nfields] = strsep (&p, " ")) != NULL; nfields++)
+      ;
+    if (nfields < 6 || p == NULL)
+      continue;
+    /* skip the optional fields up to the separator */
+    while ((type = strsep (&p, " ")) != NULL && strcmp (type, "-"))
+      ;
+    if (type == NULL || (type = strsep (&p, " ")) == NULL ||
+        (devname = strsep (&p, " ")) == NULL)
+      continue;
+
+    mountdir = np_mount_unescape (field[4]);
+    type = np_mount_unescape (type);
+    devname = np_mount_unescape (devname);
+    dummy = np_mount_dummy (type);
+    remote = np_mount_remote (devname, type);
+    if (filter && !filter (devname, mountdir, type, dummy, remote, data))
+      continue;
+
+    me = malloc (sizeof *me);
+    if (me == NULL || (me->me_devname = strdup (devname)) == NULL ||
+        (me->me_mountdir = strdup (mountdir)) == NULL ||
+        (me->me_type = strdup (type)) == NULL)
+      die (STATE_UNKNOWN, _("Could not allocate memory for the mount list\n"));
+    me->me_type_malloced = 1;
+    /* no one here uses the device number */
+    me->me_dev = (dev_t) -1;
+    me->me_dummy = dummy;
+    me->me_remote = remote;
+    *mtail = me;
+    mtail = &me->me_next;
+  }
+  *mtail = NULL;
+  free (buf);
+  return TRUE;
+}
+
+/* Trend state: a header and one record per file system, sorted by hash.
+ * When no file system is new or dropped the records are written back over
+ * the old ones. */
+#define NP_DISK_TREND_MAGIC "NPTREND1"
+
+struct np_disk_trend_header
+{
+  char magic[8];
+  uint32_t count;
+  uint32_t pad;
+};
+
+struct np_disk_trend_record
+{
+  uint64_t hash;
+  int64_t time;             /* of the last sample */
+  double used;
+  double rate;              /* smoothed growth per second */
+  uint32_t samples;
+  uint32_t pad;
+};
+
+struct np_disk_trend
+{
+  char *path;
+  struct np_disk_trend_record *records;
+  size_t loaded;            /* sorted, as read; the new ones follow */
+  size_t count;
+  size_t size;
+  int changed;
+};
+
+static uint64_t
+trend_hash (const char *name)
+{
+  uint64_t h = 14695981039346656037ULL;
+
+  while (*name)
+    h = (h ^ (unsigned char) *name++) * 1099511628211ULL;
+  return h;
+}
+
+np_disk_trend *
+np_disk_trend_open (const char *path)
+{
+  struct np_disk_trend_header h;
+  np_disk_trend *trend;
+  struct stat st;
+  size_t i, len;
+  int fd;
+
+  if ((trend = calloc (1, sizeof (*trend))) == NULL || (trend->path = strdup (path)) == NULL)
+    die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+  if ((fd = open (path, O_RDONLY)) < 0)
+    return trend;
+  if (fstat (fd, &st) == 0 && read (fd, &h, sizeof (h)) == sizeof (h) &&
+      !memcmp (h.magic, NP_DISK_TREND_MAGIC, sizeof (h.magic)) &&
+      (size_t) st.st_size == sizeof (h) + h.count * sizeof (*trend->records)) {
+    trend->size = h.count;
+    len = h.count * sizeof (*trend->records);
+    if ((trend->records = malloc (len + 1)) == NULL)
+      die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+    if (read (fd, trend->records, len) == (ssize_t) len)
+      trend->loaded = trend->count = h.count;
+    /* they have to be in order for the search */
+    for (i = 1; i < trend->count; i++)
+      if (trend->records[i - 1].hash >= trend->records[i].hash)
+        trend->loaded = trend->count = 0;
+  }
+  close (fd);
+  return trend;
+}
+
+static struct np_disk_trend_record *
+trend_find (np_disk_trend *trend, uint64_t hash)
+{
+  size_t lo = 0, hi = trend->loaded, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (trend->records[mid].hash == hash)
+      return &trend->records[mid];
+    if (trend->records[mid].hash < hash)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  /* added this run */
+  for (mid = trend->loaded; mid < trend->count; mid++)
+    if (trend->records[mid].hash == hash)
+      return &trend->records[mid];
+  return NULL;
+}
+
+int
+np_disk_trend_update (np_disk_trend *trend, const char *name, time_t now, double used, double window, double *rate)
+{
+  struct np_disk_trend_record *r;
+  uint64_t hash = trend_hash (name);
+  double elapsed, growth;
+
+  if ((r = trend_find (trend, hash)) == NULL) {
+    if (trend->count == trend->size) {
+      trend->size = trend->size ? trend->size * 2 : 16;
+      if ((trend->records = realloc (trend->records, trend->size * sizeof (*trend->records))) == NULL)
+        die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+    }
+    r = &trend->records[trend->count++];
+    memset (r, 0, sizeof (*r));
+    r->hash = hash;
+  }
+
+  elapsed = (double) (now - (time_t) r->time);
+  if (r->samples > 0 && elapsed <= 0) {
+    /* two runs within a second: nothing to learn */
+    *rate = r->rate;
+    return r->samples > 1;
+  }
+  if (r->samples > 0) {
+    growth = (used - r->used) / elapsed;
+    /* weigh the new growth by how much of the window it covers, so that
+     * the average does not depend on how often the check runs */
+    if (r->samples == 1)
+      r->rate = growth;
+    else
+      r->rate += elapsed / (window + elapsed) * (growth - r->rate);
+  }
+  if (r->samples < 2)
+    r->samples++;
+  r->time = (int64_t) now;
+  r->used = used;
+  trend->changed = TRUE;
+  *rate = r->rate;
+  return r->samples > 1;
+}
+
+static int
+trend_compare (const void *a, const void *b)
+{
+  const struct np_disk_trend_record *x = a, *y = b;
+
+  return x->hash < y->hash ? -1 : x->hash > y->hash;
+}
+
+int
+np_disk_trend_save (np_disk_trend *trend, time_t now)
+{
+  struct np_disk_trend_header h;
+  size_t i, kept, len;
+  char *tmp;
+  int fd, ok = FALSE;
+
+  if (!trend->changed)
+    return TRUE;
+  for (i = kept = 0; i < trend->count; i++)
+    if (trend->records[i].time > (int64_t) now - NP_DISK_TREND_EXPIRE)
+      trend->records[kept++] = trend->records[i];
+  memset (&h, 0, sizeof (h));
+  memcpy (h.magic, NP_DISK_TREND_MAGIC, sizeof (h.magic));
+  h.count = (uint32_t) kept;
+  len = kept * sizeof (*trend->records);
+
+  /* the same file systems as last time: over the old records */
+  if (kept == trend->count && trend->count == trend->loaded &&
+      (fd = open (trend->path, O_WRONLY)) >= 0) {
+    ok = pwrite (fd, trend->records, len, sizeof (h)) == (ssize_t) len;
+    ok = close (fd) == 0 && ok;
+    if (ok)
+      return TRUE;
+  }
+
+  qsort (trend->records, kept, sizeof (*trend->records), trend_compare);
+  if (asprintf (&tmp, "%s.XXXXXX", trend->path) < 0)
+    return FALSE;
+  if ((fd = mkstemp (tmp)) >= 0) {
+    ok = write (fd, &h, sizeof (h)) == sizeof (h) &&
+         write (fd, trend->records, len) == (ssize_t) len &&
+         fchmod (fd, S_IRUSR | S_IWUSR | S_IRGRP) == 0;
+    ok = close (fd) == 0 && ok;
+    ok = ok && rename (tmp, trend->path) == 0;
+    if (!ok)
+      unlink (tmp);
+  }
+  free (tmp);
+  return ok;
+}
+
+void
+np_disk_trend_close (np_disk_trend *trend)
+{
+  if (trend == NULL)
+    return;
+  free (trend->records);
+  free (trend->path);
+  free (trend);
+}
+
+
+/*
+ * check_disk --du. The parent keeps the queue of directories and hands
+ * them to the workers, a few at a time each so that none waits on the
+ * parent; a worker reads one and answers with the blocks and number of
+ * the entries in it and the names of its subdirectories, which go on the
+ * queue. Given the mtime the cache has for the directory, a worker that
+ * finds it unchanged answers just that, and the subdirectories are those
+ * the cache has under it.
+ */
+#define NP_DU_CACHE_MAGIC "np_du 1\n"
+#define NP_DU_WINDOW 8              /* requests in flight to each worker */
+#define NP_DU_MAX_PATH 4000         /* so that they always fit in the pipe */
+#define NP_DU_NONE ((size_t) -1)
+
+struct du_record
+{
+  char *path;
+  int64_t mtime_sec;
+  long mtime_nsec;
+  uintmax_t bytes;              /* of the directory and the entries in it */
+  uintmax_t files;
+  int64_t read;                 /* when the entries were read */
+  size_t child;                 /* as loaded: the first subdirectory, */
+  size_t sibling;               /* and the next one of the same parent */
+  int seen;                     /* walked this run */
+};
+
+struct np_du_cache
+{
+  char *path;
+  time_t max_age;
+  struct du_record *records;
+  size_t count;
+  size_t size;
+  size_t loaded;
+  size_t *index;                /* record numbers by path, NP_DU_NONE if empty */
+  size_t mask;
+};
+
+static size_t
+du_slot (const np_du_cache *cache, const char *path)
+{
+  size_t i, len = strlen (path);
+
+  for (i = mount_hash (path, len) & cache->mask; cache->index[i] != NP_DU_NONE; i = (i + 1) & cache->mask)
+    if (strcmp (cache->records[cache->index[i]].path, path) == 0)
+      break;
+  return i;
+}
+
+static void
+du_index_grow (np_du_cache *cache, size_t size)
+{
+  size_t i;
+
+  free (cache->index);
+  if ((cache->index = malloc (size * sizeof (*cache->index))) == NULL)
+    die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+  for (i = 0; i < size; i++)
+    cache->index[i] = NP_DU_NONE;
+  cache->mask = size - 1;
+  for (i = 0; i < cache->count; i++)
+    cache->index[du_slot (cache, cache->records[i].path)] = i;
+}
+
+static struct du_record *
+du_find (np_du_cache *cache, const char *path)
+{
+  size_t k;
+
+  if (cache == NULL || cache->index == NULL)
+    return NULL;
+  k = cache->index[du_slot (cache, path)];
+  return k == NP_DU_NONE ? NULL : &cache->records[k];
+}
+
+/* the record of path, a new one if there is none */
+static struct du_record *
+du_record (np_du_cache *cache, const char *path)
+{
+  struct du_record *r;
+
+  if ((r = du_find (cache, path)) != NULL)
+    return r;
+  if (cache->count == cache->size) {
+    cache->size = cache->size ? cache->size * 2 : 64;
+    if ((cache->records = realloc (cache->records, cache->size * sizeof (*r))) == NULL)
+      die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+  }
+  r = &cache->records[cache->count++];
+  memset (r, 0, sizeof (*r));
+  if ((r->path = strdup (path)) == NULL)
+    die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+  r->child = r->sibling = NP_DU_NONE;
+  if (cache->index == NULL || cache->count * 2 > cache->mask + 1)
+    du_index_grow (cache, cache->index ? (cache->mask + 1) * 2 : 128);
+  else
+    cache->index[du_slot (cache, path)] = cache->count - 1;
+  return r;
+}
+
+np_du_cache *
+np_du_cache_open (const char *path, time_t max_age)
+{
+  np_du_cache *cache;
+  struct du_record *r, *parent;
+  long long mtime_sec, read_time;
+  uintmax_t bytes, files;
+  long mtime_nsec;
+  char *line = NULL, *p, *slash;
+  size_t len = 0, i;
+  FILE *fp;
+
+  if ((cache = calloc (1, sizeof (*cache))) == NULL || (cache->path = strdup (path)) == NULL)
+    die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+  cache->max_age = max_age;
+  if ((fp = fopen (path, "r")) == NULL)
+    return cache;
+  if (getline (&line, &len, fp) < 0 || strcmp (line, NP_DU_CACHE_MAGIC) != 0) {
+    fclose (fp);
+    free (line);
+    return cache;
+  }
+  while (getline (&line, &len, fp) > 0) {
+    if ((p = strchr (line, '\t')) == NULL ||
+        sscanf (line, "%lld %ld %ju %ju %lld", &mtime_sec, &mtime_nsec, &bytes, &files, &read_time) != 5)
+      continue;
+    p[strcspn (p, "\n")] = '\0';
+    r = du_record (cache, p + 1);
+    r->mtime_sec = mtime_sec;
+    r->mtime_nsec = mtime_nsec;
+    r->bytes = bytes;
+    r->files = files;
+    r->read = read_time;
+  }
+  fclose (fp);
+  free (line);
+
+  /* each directory in the list of its parent */
+  cache->loaded = cache->count;
+  for (i = 0; i < cache->loaded; i++) {
+    r = &cache->records[i];
+    if ((slash = strrchr (r->path, '/')) == NULL || slash == r->path)
+      continue;
+    *slash = '\0';
+    parent = du_find (cache, r->path);
+    *slash = '/';
+    if (parent != NULL && parent != r) {
+      r->sibling = parent->child;
+      parent->child = i;
+    }
+  }
+  return cache;
+}
+
+int
+np_du_cache_save (np_du_cache *cache)
+{
+  struct du_record *r;
+  size_t i;
+  char *tmp;
+  FILE *fp;
+  int fd, ok = FALSE;
+
+  if (asprintf (&tmp, "%s.XXXXXX", cache->path) < 0)
+    return FALSE;
+  if ((fd = mkstemp (tmp)) >= 0 && (fp = fdopen (fd, "w")) != NULL) {
+    ok = fputs (NP_DU_CACHE_MAGIC, fp) >= 0;
+    for (i = 0; ok && i < cache->count; i++) {
+      r = &cache->records[i];
+      if (r->seen)
+        ok = fprintf (fp, "%lld %ld %ju %ju %lld\t%s\n", (long long) r->mtime_sec, r->mtime_nsec,
+                      r->bytes, r->files, (long long) r->read, r->path) > 0;
+    }
+    ok = fchmod (fd, S_IRUSR | S_IWUSR | S_IRGRP) == 0 && ok;
+    ok = fclose (fp) == 0 && ok;
+    ok = ok && rename (tmp, cache->path) == 0;
+    if (!ok)
+      unlink (tmp);
+  } else if (fd >= 0) {
+    close (fd);
+    unlink (tmp);
+  }
+  free (tmp);
+  return ok;
+}
+
+void
+np_du_cache_close (np_du_cache *cache)
+{
+  size_t i;
+
+  if (cache == NULL)
+    return;
+  for (i = 0; i < cache->count; i++)
+    free (cache->records[i].path);
+  free (cache->records);
+  free (cache->index);
+  free (cache->path);
+  free (cache);
+}
+
+struct du_request
+{
+  size_t job;
+  int64_t mtime_sec;            /* as cached, -1 for none */
+  long mtime_nsec;
+  size_t len;                   /* of the path that follows */
+};
+
+#define DU_READ 0
+#define DU_UNCHANGED 1
+#define DU_OTHER_FS 2
+
+struct du_reply
+{
+  size_t job;
+  int status;                   /* DU_*, or an errno negated */
+  int64_t mtime_sec;
+  long mtime_nsec;
+  uintmax_t bytes;
+  uintmax_t files;
+  size_t names_len;             /* of the subdirectory names that follow, each ended by a NUL */
+};
+
+static int
+du_read_full (int fd, void *buf, size_t len)
+{
+  char *p = buf;
+  ssize_t n;
+
+  while (len) {
+    if ((n = read (fd, p, len)) < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return FALSE;
+    p += n;
+    len -= n;
+  }
+  return TRUE;
+}
+
+static int
+du_write_full (int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+  ssize_t n;
+
+  while (len) {
+    if ((n = write (fd, p, len)) < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return FALSE;
+    p += n;
+    len -= n;
+  }
+  return TRUE;
+}
+
+static void
+du_worker (int request, int result, dev_t dev)
+{
+  struct du_request q;
+  struct du_reply r;
+  struct dirent *de;
+  struct stat st;
+  char path[NP_DU_MAX_PATH + 1];
+  char *names = NULL;
+  size_t names_size = 0, len;
+  DIR *dir;
+  int fd, is_dir;
+
+  while (du_read_full (request, &q, sizeof (q)) && q.len <= NP_DU_MAX_PATH &&
+         du_read_full (request, path, q.len)) {
+    path[q.len] = '\0';
+    memset (&r, 0, sizeof (r));
+    r.job = q.job;
+    if ((fd = open (path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW)) < 0 || fstat (fd, &st) < 0) {
+      r.status = -errno;
+    } else if (st.st_dev != dev) {
+      r.status = DU_OTHER_FS;
+    } else {
+      r.mtime_sec = st.st_mtim.tv_sec;
+      r.mtime_nsec = st.st_mtim.tv_nsec;
+      r.bytes = (uintmax_t) st.st_blocks * 512;
+      if (q.mtime_sec == r.mtime_sec && q.mtime_nsec == r.mtime_nsec) {
+        r.status = DU_UNCHANGED;
+      } else if ((dir = fdopendir (fd)) == NULL) {
+        r.status = -errno;
+      } else {
+        r.status = DU_READ;
+        while ((de = readdir (dir)) != NULL) {
+          if (de->d_name[0] == '.' && (de->d_name[1] == '\0' || (de->d_name[1] == '.' && de->d_name[2] == '\0')))
+            continue;
+#ifdef DT_DIR
+          is_dir = de->d_type == DT_DIR;
+          if (de->d_type == DT_UNKNOWN || !is_dir) {
+#endif
+            if (fstatat (dirfd (dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+              continue;
+            is_dir = S_ISDIR (st.st_mode);
+            if (!is_dir) {
+              r.bytes += (uintmax_t) st.st_blocks * 512;
+              r.files++;
+            }
+#ifdef DT_DIR
+          }
+#endif
+          if (!is_dir)
+            continue;
+          len = strlen (de->d_name) + 1;
+          if (r.names_len + len > names_size) {
+            names_size = (r.names_len + len) * 2;
+            if ((names = realloc (names, names_size)) == NULL)
+              _exit (1);
+          }
+          memcpy (names + r.names_len, de->d_name, len);
+          r.names_len += len;
+        }
+        closedir (dir);
+        fd = -1;
+      }
+    }
+    if (fd >= 0)
+      close (fd);
+    if (!du_write_full (result, &r, sizeof (r)) || !du_write_full (result, names, r.names_len))
+      break;
+  }
+  _exit (0);
+}
+
+struct du_worker_slot
+{
+  pid_t pid;
+  int request;
+  int result;
+  int inflight;
+};
+
+struct du_job
+{
+  char *path;
+  size_t cached;                /* the record fresh enough to be trusted, or NP_DU_NONE */
+};
+
+struct du_walk
+{
+  np_du_cache *cache;
+  time_t now;
+  np_du_usage *usage;
+  struct du_job *jobs;
+  size_t count;
+  size_t size;
+};
+
+static void
+du_push (struct du_walk *w, char *path)
+{
+  struct du_record *r;
+
+  if (w->count == w->size) {
+    w->size = w->size ? w->size * 2 : 256;
+    if ((w->jobs = realloc (w->jobs, w->size * sizeof (*w->jobs))) == NULL)
+      die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+  }
+  /* records are moved as more are added: by number */
+  r = du_find (w->cache, path);
+  w->jobs[w->count].path = path;
+  w->jobs[w->count++].cached = r && (size_t) (r - w->cache->records) < w->cache->loaded &&
+                               r->read + w->cache->max_age >= (int64_t) w->now ?
+                               (size_t) (r - w->cache->records) : NP_DU_NONE;
+}
+
+static char *
+du_join (const char *dir, const char *name)
+{
+  char *path;
+
+  if (asprintf (&path, "%s%s%s", dir, dir[strlen (dir) - 1] == '/' ? "" : "/", name) < 0)
+    die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+  return path;
+}
+
+/* what a worker found in a directory */
+static void
+du_answer (struct du_walk *w, const struct du_reply *r, char *names)
+{
+  struct du_job *job = &w->jobs[r->job];   /* until a du_push() moves them */
+  struct du_record *rec;
+  size_t k, off;
+
+  if (r->status < 0) {
+    w->usage->errors++;
+    return;
+  }
+  if (r->status == DU_OTHER_FS)
+    return;
+  w->usage->dirs++;
+  if (r->status == DU_UNCHANGED && job->cached != NP_DU_NONE) {
+    rec = &w->cache->records[job->cached];
+    rec->seen = TRUE;
+    w->usage->bytes += rec->bytes;
+    w->usage->files += rec->files;
+    for (k = rec->child; k != NP_DU_NONE; k = w->cache->records[k].sibling)
+      du_push (w, du_join (w->jobs[r->job].path, strrchr (w->cache->records[k].path, '/') + 1));
+    return;
+  }
+  w->usage->dirs_read++;
+  w->usage->bytes += r->bytes;
+  w->usage->files += r->files;
+  if (w->cache && !strchr (job->path, '\n')) {
+    rec = du_record (w->cache, job->path);
+    rec->mtime_sec = r->mtime_sec;
+    rec->mtime_nsec = r->mtime_nsec;
+    rec->bytes = r->bytes;
+    rec->files = r->files;
+    rec->read = w->now;
+    rec->seen = TRUE;
+  }
+  for (off = 0; off < r->names_len; off += strlen (names + off) + 1)
+    du_push (w, du_join (w->jobs[r->job].path, names + off));
+}
+
+static int
+du_worker_start (struct du_worker_slot *pool, int count, struct du_worker_slot *slot, dev_t dev)
+{
+  int request[2], result[2], i;
+
+  if (pipe (request) < 0)
+    return FALSE;
+  if (pipe (result) < 0) {
+    close (request[0]);
+    close (request[1]);
+    return FALSE;
+  }
+  if ((slot->pid = fork ()) < 0) {
+    close (request[0]);
+    close (request[1]);
+    close (result[0]);
+    close (result[1]);
+    return FALSE;
+  }
+  if (slot->pid == 0) {
+    for (i = 0; i < count; i++) {
+      if (&pool[i] != slot && pool[i].pid > 0) {
+        close (pool[i].request);
+        close (pool[i].result);
+      }
+    }
+    close (request[1]);
+    close (result[0]);
+    du_worker (request[0], result[1], dev);
+  }
+  close (request[0]);
+  close (result[1]);
+  slot->request = request[1];
+  slot->result = result[0];
+  slot->inflight = 0;
+  return TRUE;
+}
+
+int
+np_du_walk (const char *root, int workers, np_du_cache *cache, time_t now, np_du_usage *usage)
+{
+  struct du_worker_slot *pool;
+  struct du_walk w;
+  struct du_request q;
+  struct du_reply r;
+  struct pollfd *pfd;
+  struct stat st;
+  char *names = NULL;
+  size_t next = 0, names_size = 0, done = 0, i;
+  int k, inflight;
+
+  memset (usage, 0, sizeof (*usage));
+  if (stat (root, &st) < 0)
+    return -1;
+  if (!S_ISDIR (st.st_mode)) {
+    errno = ENOTDIR;
+    return -1;
+  }
+  if (workers < 1)
+    workers = 1;
+
+  memset (&w, 0, sizeof (w));
+  w.cache = cache;
+  w.now = now;
+  w.usage = usage;
+  du_push (&w, strdup (root));
+
+  pool = calloc (workers, sizeof (*pool));
+  pfd = calloc (workers, sizeof (*pfd));
+  if (pool == NULL || pfd == NULL || w.jobs[0].path == NULL)
+    die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+  for (k = 0; k < workers; k++)
+    if (!du_worker_start (pool, workers, &pool[k], st.st_dev))
+      die (STATE_UNKNOWN, _("Cannot start a worker: %s\n"), strerror (errno));
+
+  while (done < w.count) {
+    /* the next directories to the workers with the fewest in flight */
+    for (inflight = 1; inflight <= NP_DU_WINDOW && next < w.count; inflight++) {
+      for (k = 0; k < workers && next < w.count; k++) {
+        if (pool[k].inflight >= inflight)
+          continue;
+        if (strlen (w.jobs[next].path) > NP_DU_MAX_PATH) {
+          usage->errors++;
+          next++;
+          done++;
+          continue;
+        }
+        q.job = next;
+        q.mtime_sec = q.mtime_nsec = -1;
+        if (w.jobs[next].cached != NP_DU_NONE) {
+          q.mtime_sec = cache->records[w.jobs[next].cached].mtime_sec;
+          q.mtime_nsec = cache->records[w.jobs[next].cached].mtime_nsec;
+        }
+        q.len = strlen (w.jobs[next].path);
+        if (!du_write_full (pool[k].request, &q, sizeof (q)) ||
+            !du_write_full (pool[k].request, w.jobs[next].path, q.len))
+          die (STATE_UNKNOWN, _("A worker exited: %s\n"), strerror (errno));
+        pool[k].inflight++;
+        next++;
+      }
+    }
+    if (done == w.count)
+      break;
+
+    for (k = 0; k < workers; k++) {
+      pfd[k].fd = pool[k].inflight ? pool[k].result : -1;
+      pfd[k].events = POLLIN;
+      pfd[k].revents = 0;
+    }
+    if (poll (pfd, workers, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      die (STATE_UNKNOWN, _("poll() failed: %s\n"), strerror (errno));
+    }
+    for (k = 0; k < workers; k++) {
+      if (!pfd[k].revents)
+        continue;
+      if (!du_read_full (pool[k].result, &r, sizeof (r)) || r.job >= w.count)
+        die (STATE_UNKNOWN, "%s\n", _("A worker exited"));
+      if (r.names_len + 1 > names_size) {
+        names_size = r.names_len + 1;
+        if ((names = realloc (names, names_size)) == NULL)
+          die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+      }
+      if (!du_read_full (pool[k].result, names, r.names_len))
+        die (STATE_UNKNOWN, "%s\n", _("A worker exited"));
+      du_answer (&w, &r, names);
+      pool[k].inflight--;
+      done++;
+    }
+  }
+
+  for (k = 0; k < workers; k++) {
+    close (pool[k].request);
+    close (pool[k].result);
+    waitpid (pool[k].pid, NULL, 0);
+  }
+  for (i = 0; i < w.count; i++)
+    free (w.jobs[i].path);
+  free (w.jobs);
+  free (names);
+  free (pool);
+  free (pfd);
+  return 0;
+}
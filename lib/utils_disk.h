@@ -2,12 +2,17 @@
 
 #include "mountlist.h"
 #include "utils_base.h"
-#include "regex.h"
+#include "utils_regex.h"
+
+/* The entries of a list share one hash set of its names, which
+ * np_find_name() and np_seen_name() look them up in */
+struct name_set;
 
 struct name_list
 {
   char *name;
   struct name_list *next;
+  struct name_set *set;
 };
 
 struct parameter_list
@@ -39,4 +44,63 @@ struct parameter_list *np_del_parameter(struct parameter_list *item, struct para
   
 int search_parameter_list (struct parameter_list *list, const char *name);
 void np_set_best_match(struct parameter_list *desired, struct mount_entry *mount_list, int exact);
-int np_regex_match_mount_entry (struct mount_entry* me, regex_t* re);
+int np_regex_match_mount_entry (struct mount_entry* me, np_regex_t* re);
+
+/* An expression for -r/-i along with a literal that every match contains */
+struct np_mount_regex
+{
+  np_regex_t re;
+  char *literal;
+  int icase;
+};
+
+char *np_regex_literal (const char *pattern, int cflags);
+int np_compile_mount_regex (struct np_mount_regex *mr, const char *pattern, int cflags);
+int np_match_mount_regex (struct np_mount_regex *mr, struct mount_entry *me);
+void np_free_mount_regex (struct np_mount_regex *mr);
+
+/* Growth of each file system between runs, for check_disk --forecast-*:
+ * one fixed size record per mount, sorted by a hash of its name. */
+typedef struct np_disk_trend np_disk_trend;
+
+#define NP_DISK_TREND_EXPIRE (30 * 86400)	/* records not updated for this long are dropped */
+
+np_disk_trend *np_disk_trend_open (const char *path);
+/* Adds a sample of the space used; returns FALSE while there is no estimate
+ * yet, else TRUE with the growth per second, smoothed over window seconds */
+int np_disk_trend_update (np_disk_trend *, const char *name, time_t now, double used, double window, double *rate);
+/* returns FALSE if the file could not be written */
+int np_disk_trend_save (np_disk_trend *, time_t now);
+void np_disk_trend_close (np_disk_trend *);
+
+/* Space used by a directory tree on one file system, as du -sx counts it,
+ * for check_disk --du. The directories are read by a pool of worker
+ * processes, and the totals of each one can be kept in a cache file: a
+ * directory whose mtime is the one in the cache is not read again, only
+ * looked at to find the subdirectories it had. */
+typedef struct np_du_cache np_du_cache;
+
+typedef struct np_du_usage {
+  uintmax_t bytes;          /* the blocks of every entry, in bytes */
+  uintmax_t files;          /* entries that are not directories */
+  uintmax_t dirs;
+  uintmax_t dirs_read;      /* of those, the ones not taken from the cache */
+  uintmax_t errors;         /* directories that could not be read */
+} np_du_usage;
+
+/* The cache in path, with the totals of a directory trusted for max_age
+ * seconds after it was last read; a file that is missing or not one is an
+ * empty cache */
+np_du_cache *np_du_cache_open (const char *path, time_t max_age);
+/* the usage of root with workers processes; -1 with errno if root itself
+ * cannot be read, else 0. cache may be NULL. */
+int np_du_walk (const char *root, int workers, np_du_cache *cache, time_t now, np_du_usage *usage);
+/* keeps the directories walked since the cache was opened; FALSE if the
+ * file could not be written */
+int np_du_cache_save (np_du_cache *);
+void np_du_cache_close (np_du_cache *);
+
+/* Returns TRUE to keep a mount entry read by np_read_mountinfo */
+typedef int (*np_mount_filter) (const char *devname, const char *mountdir, const char *type,
+                                int dummy, int remote, void *data);
+int np_read_mountinfo (const char *file, np_mount_filter filter, void *data, struct mount_entry **list);
@@ -0,0 +1,1050 @@
+/*****************************************************************************
+*
+* utils_dns.c
+*
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+*
+* Minimal DNS engine for check_dns
+*
+* Responses are decoded in place with bounds checks on every field, and
+* compressed names are followed no further than a message could need.
+* The data of each record is kept in the text form dig prints, which is
+* what the plugins compare and report anyway.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_dns.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#define MAX_POINTERS 128             /* more than a name of 127 labels needs */
+
+static const struct {
+	const char *name;
+	int type;
+} types[] = {
+	{"A", NP_DNS_A}, {"NS", NP_DNS_NS}, {"CNAME", NP_DNS_CNAME},
+	{"SOA", NP_DNS_SOA}, {"WKS", NP_DNS_WKS}, {"PTR", NP_DNS_PTR},
+	{"HINFO", NP_DNS_HINFO}, {"MX", NP_DNS_MX}, {"TXT", NP_DNS_TXT},
+	{"AAAA", NP_DNS_AAAA}, {"SRV", NP_DNS_SRV}, {"DNAME", NP_DNS_DNAME},
+	{"OPT", NP_DNS_OPT}, {"CAA", NP_DNS_CAA}, {"ANY", NP_DNS_ANY}
+};
+
+int
+np_dns_type (const char *name)
+{
+	size_t i;
+	char *end;
+	long n;
+
+	for (i = 0; i < sizeof (types) / sizeof (*types); i++)
+		if (!strcasecmp (name, types[i].name))
+			return types[i].type;
+	/* the generic form of RFC 3597 */
+	if (strncasecmp (name, "TYPE", 4) || !isdigit ((unsigned char) name[4]))
+		return -1;
+	n = strtol (name + 4, &end, 10);
+	if (*end || n > 65535)
+		return -1;
+	return (int) n;
+}
+
+const char *
+np_dns_type_name (int type, char *buf, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof (types) / sizeof (*types); i++)
+		if (types[i].type == type)
+			return types[i].name;
+	snprintf (buf, size, "TYPE%d", type);
+	return buf;
+}
+
+int
+np_dns_class (const char *name)
+{
+	char *end;
+	long n;
+
+	if (!strcasecmp (name, "IN"))
+		return NP_DNS_CLASS_IN;
+	if (!strcasecmp (name, "CH"))
+		return NP_DNS_CLASS_CH;
+	if (!strcasecmp (name, "HS"))
+		return NP_DNS_CLASS_HS;
+	if (strncasecmp (name, "CLASS", 5) || !isdigit ((unsigned char) name[5]))
+		return -1;
+	n = strtol (name + 5, &end, 10);
+	if (*end || n > 65535)
+		return -1;
+	return (int) n;
+}
+
+const char *
+np_dns_class_name (int class, char *buf, size_t size)
+{
+	if (class == NP_DNS_CLASS_IN)
+		return "IN";
+	if (class == NP_DNS_CLASS_CH)
+		return "CH";
+	if (class == NP_DNS_CLASS_HS)
+		return "HS";
+	snprintf (buf, size, "CLASS%d", class);
+	return buf;
+}
+
+const char *
+np_dns_rcode_name (int rcode)
+{
+	static const char *names[] = {
+		"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED",
+		"YXDOMAIN", "YXRRSET", "NXRRSET", "NOTAUTH", "NOTZONE"
+	};
+
+	if (rcode == 16)
+		return "BADVERS";
+	if (rcode < 0 || (size_t) rcode >= sizeof (names) / sizeof (*names))
+		return "RESERVED";
+	return names[rcode];
+}
+
+
+/* Text that grows as it is written; s is NULL once memory ran out. */
+struct text {
+	char *s;
+	size_t len;
+	size_t size;
+};
+
+static void
+text_put (struct text *t, const char *s, size_t len)
+{
+	char *p;
+
+	if (t->s == NULL)
+		return;
+	if (t->len + len >= t->size) {
+		t->size = (t->len + len) * 2 + 64;
+		if ((p = realloc (t->s, t->size)) == NULL) {
+			free (t->s);
+			t->s = NULL;
+			return;
+		}
+		t->s = p;
+	}
+	memcpy (t->s + t->len, s, len);
+	t->len += len;
+	t->s[t->len] = '\0';
+}
+
+static void
+text_printf (struct text *t, const char *fmt, ...)
+{
+	char buf[64];
+	va_list ap;
+	int n;
+
+	va_start (ap, fmt);
+	n = vsnprintf (buf, sizeof (buf), fmt, ap);
+	va_end (ap);
+	if (n > 0)
+		text_put (t, buf, (size_t) n < sizeof (buf) ? (size_t) n : sizeof (buf) - 1);
+}
+
+/* an octet of a name, or of a quoted string, escaped as dig does */
+static void
+text_octet (struct text *t, unsigned char c, int quoted)
+{
+	char buf[5];
+
+	if (quoted && c == ' ') {
+		text_put (t, " ", 1);
+		return;
+	}
+	if (c < 0x21 || c > 0x7e) {
+		snprintf (buf, sizeof (buf), "\\%03u", c);
+		text_put (t, buf, 4);
+		return;
+	}
+	if (strchr (quoted ? "\"\\" : ".\\\"();@$", c)) {
+		buf[0] = '\\';
+		buf[1] = c;
+		text_put (t, buf, 2);
+		return;
+	}
+	buf[0] = c;
+	text_put (t, buf, 1);
+}
+
+
+/* The name at *pos into out with its final dot, and *pos past it (not
+ * past what a pointer points to). */
+static int
+read_name (const unsigned char *msg, size_t len, size_t *pos, char *out, size_t size)
+{
+	struct text t;
+	size_t p = *pos;
+	int jumped = FALSE, pointers = 0, octets = 0;
+	unsigned int c, i;
+
+	t.s = malloc (t.size = 64);
+	t.len = 0;
+	if (t.s)
+		t.s[0] = '\0';
+	while (p < len && t.s) {
+		c = msg[p];
+		if ((c & 0xc0) == 0xc0) {
+			if (p + 1 >= len || ++pointers > MAX_POINTERS)
+				break;
+			if (!jumped)
+				*pos = p + 2;
+			jumped = TRUE;
+			p = ((c & 0x3f) << 8) | msg[p + 1];
+			continue;
+		}
+		/* the extended label types never took off */
+		if (c & 0xc0)
+			break;
+		if (c == 0) {
+			if (!jumped)
+				*pos = p + 1;
+			if (t.len == 0)
+				text_put (&t, ".", 1);
+			if (t.s == NULL || t.len >= size)
+				break;
+			strcpy (out, t.s);
+			free (t.s);
+			return TRUE;
+		}
+		if (p + 1 + c > len || (octets += c + 1) > 255)
+			break;
+		for (i = 0; i < c; i++)
+			text_octet (&t, msg[p + 1 + i], FALSE);
+		text_put (&t, ".", 1);
+		p += c + 1;
+	}
+	free (t.s);
+	return FALSE;
+}
+
+/* the name in wire form at buf + *pos; FALSE if it is not a valid name */
+static int
+write_name (const char *name, unsigned char *buf, size_t size, size_t *pos)
+{
+	size_t p = *pos, label = p, total = 1;
+	unsigned int c;
+
+	if (!strcmp (name, "."))
+		name++;
+	if (p + 1 > size)
+		return FALSE;
+	while (*name) {
+		/* the length goes in front once the label is done */
+		label = p++;
+		c = 0;
+		while (*name && *name != '.') {
+			c = (unsigned char) *name++;
+			if (c == '\\' && *name) {
+				if (isdigit ((unsigned char) name[0]) && isdigit ((unsigned char) name[1]) &&
+				    isdigit ((unsigned char) name[2])) {
+					c = (name[0] - '0') * 100 + (name[1] - '0') * 10 + (name[2] - '0');
+					name += 3;
+					if (c > 255)
+						return FALSE;
+				}
+				else
+					c = (unsigned char) *name++;
+			}
+			if (p >= size || p - label > 63)
+				return FALSE;
+			buf[p++] = (unsigned char) c;
+		}
+		if (p - label == 1 || p - label > 64)
+			return FALSE;
+		buf[label] = (unsigned char) (p - label - 1);
+		total += p - label;
+		if (*name == '.')
+			name++;
+	}
+	if (total > 255 || p >= size)
+		return FALSE;
+	buf[p++] = 0;
+	*pos = p;
+	return TRUE;
+}
+
+static void
+put16 (unsigned char *p, unsigned int v)
+{
+	p[0] = (v >> 8) & 0xff;
+	p[1] = v & 0xff;
+}
+
+static unsigned int
+get16 (const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static uint32_t
+get32 (const unsigned char *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+int
+np_dns_encode_query (uint16_t id, const char *name, int type, int class, int flags,
+                     int edns_size, unsigned char *buf, size_t size)
+{
+	size_t pos = 12;
+
+	if (size < 12)
+		return -1;
+	put16 (buf, id);
+	put16 (buf + 2, flags & ~NP_DNS_QR);
+	put16 (buf + 4, 1);
+	put16 (buf + 6, 0);
+	put16 (buf + 8, 0);
+	put16 (buf + 10, edns_size ? 1 : 0);
+	if (!write_name (name, buf, size, &pos) || pos + 4 > size)
+		return -1;
+	put16 (buf + pos, type);
+	put16 (buf + pos + 2, class);
+	pos += 4;
+	if (edns_size) {
+		/* root, OPT, the payload size, no extended flags, no options */
+		if (pos + 11 > size)
+			return -1;
+		buf[pos] = 0;
+		put16 (buf + pos + 1, NP_DNS_OPT);
+		put16 (buf + pos + 3, edns_size);
+		memset (buf + pos + 5, 0, 6);
+		pos += 11;
+	}
+	return (int) pos;
+}
+
+
+/* the character-strings of TXT, HINFO and the like, each one quoted */
+static int
+format_strings (struct text *t, const unsigned char *p, size_t len)
+{
+	size_t i, n;
+
+	while (len > 0) {
+		n = p[0];
+		if (n + 1 > len)
+			return FALSE;
+		if (t->len)
+			text_put (t, " ", 1);
+		text_put (t, "\"", 1);
+		for (i = 1; i <= n; i++)
+			text_octet (t, p[i], TRUE);
+		text_put (t, "\"", 1);
+		p += n + 1;
+		len -= n + 1;
+	}
+	return TRUE;
+}
+
+/* the presentation form of the data of the record, or NULL if the data
+ * does not make sense for its type */
+static char *
+format_rdata (const unsigned char *msg, size_t len, const np_dns_rr *rr)
+{
+	char name[NP_DNS_MAX_NAME], name2[NP_DNS_MAX_NAME];
+	char addr[INET6_ADDRSTRLEN];
+	const unsigned char *p = msg + rr->rdoffset;
+	size_t end = rr->rdoffset + rr->rdlength, pos = rr->rdoffset, i;
+	struct text t;
+	int ok = FALSE;
+
+	t.s = malloc (t.size = 64);
+	t.len = 0;
+	if (t.s == NULL)
+		return NULL;
+	t.s[0] = '\0';
+
+	switch (rr->type) {
+	case NP_DNS_A:
+		if ((ok = rr->rdlength == 4 && inet_ntop (AF_INET, p, addr, sizeof (addr))))
+			text_put (&t, addr, strlen (addr));
+		break;
+	case NP_DNS_AAAA:
+		if ((ok = rr->rdlength == 16 && inet_ntop (AF_INET6, p, addr, sizeof (addr))))
+			text_put (&t, addr, strlen (addr));
+		break;
+	case NP_DNS_NS:
+	case NP_DNS_CNAME:
+	case NP_DNS_PTR:
+	case NP_DNS_DNAME:
+		if ((ok = read_name (msg, len, &pos, name, sizeof (name)) && pos == end))
+			text_put (&t, name, strlen (name));
+		break;
+	case NP_DNS_MX:
+		pos += 2;
+		if ((ok = rr->rdlength > 2 && read_name (msg, len, &pos, name, sizeof (name)) && pos == end)) {
+			text_printf (&t, "%u ", get16 (p));
+			text_put (&t, name, strlen (name));
+		}
+		break;
+	case NP_DNS_SRV:
+		pos += 6;
+		if ((ok = rr->rdlength > 6 && read_name (msg, len, &pos, name, sizeof (name)) && pos == end)) {
+			text_printf (&t, "%u %u %u ", get16 (p), get16 (p + 2), get16 (p + 4));
+			text_put (&t, name, strlen (name));
+		}
+		break;
+	case NP_DNS_SOA:
+		if (read_name (msg, len, &pos, name, sizeof (name)) &&
+		    read_name (msg, len, &pos, name2, sizeof (name2)) && pos + 20 == end) {
+			p = msg + pos;
+			text_put (&t, name, strlen (name));
+			text_put (&t, " ", 1);
+			text_put (&t, name2, strlen (name2));
+			text_printf (&t, " %lu %lu %lu %lu %lu", (unsigned long) get32 (p),
+			             (unsigned long) get32 (p + 4), (unsigned long) get32 (p + 8),
+			             (unsigned long) get32 (p + 12), (unsigned long) get32 (p + 16));
+			ok = TRUE;
+		}
+		break;
+	case NP_DNS_TXT:
+	case NP_DNS_HINFO:
+		ok = rr->rdlength > 0 && format_strings (&t, p, rr->rdlength);
+		break;
+	case NP_DNS_CAA:
+		if (rr->rdlength >= 2 && (size_t) p[1] + 2 <= rr->rdlength) {
+			text_printf (&t, "%u ", p[0]);
+			for (i = 0; i < p[1]; i++)
+				text_octet (&t, p[2 + i], TRUE);
+			text_put (&t, " \"", 2);
+			for (i = 2 + p[1]; i < rr->rdlength; i++)
+				text_octet (&t, p[i], TRUE);
+			text_put (&t, "\"", 1);
+			ok = TRUE;
+		}
+		break;
+	default:
+		/* RFC 3597 */
+		text_printf (&t, "\\# %lu", (unsigned long) rr->rdlength);
+		if (rr->rdlength)
+			text_put (&t, " ", 1);
+		for (i = 0; i < rr->rdlength; i++)
+			text_printf (&t, "%02X", p[i]);
+		ok = TRUE;
+	}
+	if (!ok || t.s == NULL) {
+		free (t.s);
+		return NULL;
+	}
+	return t.s;
+}
+
+void
+np_dns_message_free (np_dns_message *m)
+{
+	size_t i;
+
+	for (i = 0; i < m->count; i++)
+		free (m->rr[i].data);
+	free (m->rr);
+	free (m->packet);
+	m->rr = NULL;
+	m->packet = NULL;
+	m->count = 0;
+}
+
+int
+np_dns_decode (const unsigned char *msg, size_t len, np_dns_message *m)
+{
+	size_t pos = 12, qdcount, total, i, opt;
+	np_dns_rr *rr;
+	int section;
+
+	memset (m, 0, sizeof (*m));
+	if (len < 12 || len > NP_DNS_MAX_MESSAGE)
+		return FALSE;
+	m->id = get16 (msg);
+	m->flags = get16 (msg + 2);
+	m->rcode = m->flags & 0xf;
+	qdcount = get16 (msg + 4);
+	m->counts[NP_DNS_ANSWER] = get16 (msg + 6);
+	m->counts[NP_DNS_AUTHORITY] = get16 (msg + 8);
+	m->counts[NP_DNS_ADDITIONAL] = get16 (msg + 10);
+	total = m->counts[0] + m->counts[1] + m->counts[2];
+	/* every record takes 11 octets at least */
+	if (qdcount > 1 || total * 11 > len)
+		return FALSE;
+	if (qdcount) {
+		if (!read_name (msg, len, &pos, m->qname, sizeof (m->qname)) || pos + 4 > len)
+			return FALSE;
+		m->qtype = get16 (msg + pos);
+		m->qclass = get16 (msg + pos + 2);
+		pos += 4;
+	}
+	if (total && (m->rr = calloc (total, sizeof (*m->rr))) == NULL)
+		return FALSE;
+
+	for (section = NP_DNS_ANSWER; section <= NP_DNS_ADDITIONAL; section++) {
+		for (i = m->counts[section], opt = 0; i > 0; i--) {
+			rr = &m->rr[m->count];
+			if (!read_name (msg, len, &pos, rr->name, sizeof (rr->name)) || pos + 10 > len)
+				goto fail;
+			rr->section = section;
+			rr->type = get16 (msg + pos);
+			rr->class = get16 (msg + pos + 2);
+			rr->ttl = get32 (msg + pos + 4);
+			rr->rdlength = get16 (msg + pos + 8);
+			rr->rdoffset = pos + 10;
+			pos = rr->rdoffset + rr->rdlength;
+			if (pos > len)
+				goto fail;
+			if (rr->type == NP_DNS_OPT) {
+				/* not a record, the EDNS(0) part of the header */
+				m->edns = TRUE;
+				m->rcode |= (rr->ttl >> 24) << 4;
+				opt++;
+				continue;
+			}
+			if ((rr->data = format_rdata (msg, len, rr)) == NULL)
+				goto fail;
+			m->count++;
+		}
+		m->counts[section] -= opt;
+	}
+	if ((m->packet = malloc (len)) == NULL)
+		goto fail;
+	memcpy (m->packet, msg, len);
+	m->length = len;
+	return TRUE;
+
+fail:
+	np_dns_message_free (m);
+	return FALSE;
+}
+
+
+char *
+np_dns_reverse_name (const char *address, char *buf, size_t size)
+{
+	static const char hex[] = "0123456789abcdef";
+	unsigned char a[16];
+	struct text t;
+	int i;
+
+	t.s = malloc (t.size = 80);
+	t.len = 0;
+	if (t.s == NULL)
+		return NULL;
+	t.s[0] = '\0';
+	if (inet_pton (AF_INET, address, a) == 1) {
+		for (i = 3; i >= 0; i--)
+			text_printf (&t, "%u.", a[i]);
+		text_put (&t, "in-addr.arpa", 12);
+	}
+	else if (inet_pton (AF_INET6, address, a) == 1) {
+		for (i = 15; i >= 0; i--)
+			text_printf (&t, "%c.%c.", hex[a[i] & 0xf], hex[a[i] >> 4]);
+		text_put (&t, "ip6.arpa", 8);
+	}
+	else {
+		free (t.s);
+		return NULL;
+	}
+	if (t.s == NULL || t.len >= size) {
+		free (t.s);
+		return NULL;
+	}
+	strcpy (buf, t.s);
+	free (t.s);
+	return buf;
+}
+
+char *
+np_dns_default_server (const char *file, char *buf, size_t size)
+{
+	char line[1024], *p, *end;
+	FILE *fp;
+
+	snprintf (buf, size, "%s", "127.0.0.1");
+	if ((fp = fopen (file ? file : "/etc/resolv.conf", "r")) == NULL)
+		return buf;
+	while (fgets (line, sizeof (line), fp)) {
+		for (p = line; isspace ((unsigned char) *p); p++)
+			;
+		if (strncmp (p, "nameserver", 10) || !isspace ((unsigned char) p[10]))
+			continue;
+		for (p += 10; isspace ((unsigned char) *p); p++)
+			;
+		for (end = p; *end && !isspace ((unsigned char) *end) && *end != ';' && *end != '#'; end++)
+			;
+		if (end == p)
+			continue;
+		*end = '\0';
+		snprintf (buf, size, "%s", p);
+		break;
+	}
+	fclose (fp);
+	return buf;
+}
+
+
+static int64_t
+now_us (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t
+now_ms (void)
+{
+	return now_us () / 1000;
+}
+
+/* TRUE if the message is the response to the query */
+static int
+response_match (const unsigned char *in, size_t len, const np_dns_message *q, np_dns_message *resp)
+{
+	if (len < 12 || get16 (in) != q->id || !(in[2] & 0x80) || !np_dns_decode (in, len, resp))
+		return FALSE;
+	/* a FORMERR may come without the question */
+	if (resp->qname[0] == '\0' && resp->rcode != NP_DNS_NOERROR)
+		return TRUE;
+	if (!strcasecmp (resp->qname, q->qname) && resp->qtype == q->qtype && resp->qclass == q->qclass)
+		return TRUE;
+	np_dns_message_free (resp);
+	return FALSE;
+}
+
+/* all of buf written to or read from the stream socket before the deadline */
+static int
+stream_io (int sd, unsigned char *buf, size_t len, int out, int64_t deadline)
+{
+	struct pollfd pfd;
+	ssize_t n;
+	int wait;
+
+	while (len > 0) {
+		n = out ? send (sd, buf, len, 0) : recv (sd, buf, len, 0);
+		if (n > 0) {
+			buf += n;
+			len -= n;
+			continue;
+		}
+		if (n == 0) {
+			errno = ECONNRESET;
+			return NP_DNS_ERROR;
+		}
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINPROGRESS)
+			return NP_DNS_ERROR;
+		if ((wait = (int) (deadline - now_ms ())) <= 0)
+			return NP_DNS_TIMEOUT;
+		pfd.fd = sd;
+		pfd.events = out ? POLLOUT : POLLIN;
+		if (poll (&pfd, 1, wait) < 0 && errno != EINTR)
+			return NP_DNS_ERROR;
+	}
+	return NP_DNS_OK;
+}
+
+static int
+query_tcp (const struct sockaddr *addr, socklen_t addrlen, const unsigned char *query, size_t len,
+           const np_dns_message *q, np_dns_message *resp, int timeout_ms)
+{
+	static unsigned char in[NP_DNS_MAX_MESSAGE];
+	unsigned char head[2];
+	int64_t deadline = now_ms () + timeout_ms;
+	struct pollfd pfd;
+	socklen_t errlen = sizeof (int);
+	int sd, err = 0, wait, result;
+
+	if ((sd = socket (addr->sa_family, SOCK_STREAM, 0)) < 0)
+		return NP_DNS_ERROR;
+	fcntl (sd, F_SETFL, fcntl (sd, F_GETFL) | O_NONBLOCK);
+	if (connect (sd, addr, addrlen) < 0) {
+		if (errno != EINPROGRESS) {
+			result = NP_DNS_ERROR;
+			goto done;
+		}
+		do {
+			if ((wait = (int) (deadline - now_ms ())) <= 0) {
+				result = NP_DNS_TIMEOUT;
+				goto done;
+			}
+			pfd.fd = sd;
+			pfd.events = POLLOUT;
+		} while (poll (&pfd, 1, wait) <= 0);
+		if (getsockopt (sd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err) {
+			if (err)
+				errno = err;
+			result = NP_DNS_ERROR;
+			goto done;
+		}
+	}
+
+	/* RFC 1035 4.2.2, each message after its length */
+	put16 (head, len);
+	if ((result = stream_io (sd, head, 2, TRUE, deadline)) != NP_DNS_OK ||
+	    (result = stream_io (sd, (unsigned char *) query, len, TRUE, deadline)) != NP_DNS_OK)
+		goto done;
+	for (;;) {
+		if ((result = stream_io (sd, head, 2, FALSE, deadline)) != NP_DNS_OK ||
+		    (result = stream_io (sd, in, get16 (head), FALSE, deadline)) != NP_DNS_OK)
+			goto done;
+		if (response_match (in, get16 (head), q, resp)) {
+			resp->tcp = TRUE;
+			break;
+		}
+	}
+
+done:
+	err = errno;
+	close (sd);
+	errno = err;
+	return result;
+}
+
+int
+np_dns_query (const struct sockaddr *addr, socklen_t addrlen, const unsigned char *query,
+              size_t len, np_dns_message *resp, int options, int timeout_ms, int retries)
+{
+	static unsigned char in[NP_DNS_MAX_MESSAGE];
+	np_dns_message q;
+	struct pollfd pfd;
+	int64_t deadline;
+	int sd, n, try, result = NP_DNS_TIMEOUT, err;
+
+	if (!np_dns_decode (query, len, &q)) {
+		errno = EINVAL;
+		return NP_DNS_ERROR;
+	}
+	if (options & NP_DNS_USE_TCP) {
+		result = query_tcp (addr, addrlen, query, len, &q, resp, timeout_ms);
+		np_dns_message_free (&q);
+		return result;
+	}
+
+	/* connected, so that only the server's datagrams and its ICMP errors
+	 * come back to us */
+	if ((sd = socket (addr->sa_family, SOCK_DGRAM, 0)) < 0 || connect (sd, addr, addrlen) < 0) {
+		err = errno;
+		if (sd >= 0)
+			close (sd);
+		np_dns_message_free (&q);
+		errno = err;
+		return NP_DNS_ERROR;
+	}
+	for (try = 0; try <= retries && result == NP_DNS_TIMEOUT; try++) {
+		if (send (sd, query, len, 0) < 0) {
+			result = NP_DNS_ERROR;
+			break;
+		}
+		deadline = now_ms () + timeout_ms;
+		while ((n = (int) (deadline - now_ms ())) > 0) {
+			pfd.fd = sd;
+			pfd.events = POLLIN;
+			if ((n = poll (&pfd, 1, n)) < 0 && errno != EINTR) {
+				result = NP_DNS_ERROR;
+				break;
+			}
+			if (n <= 0)
+				continue;
+			if ((n = recv (sd, in, sizeof (in), 0)) < 0) {
+				if (errno == EINTR)
+					continue;
+				result = NP_DNS_ERROR;
+				break;
+			}
+			/* anything else that turns up is not for us */
+			if (response_match (in, n, &q, resp)) {
+				result = NP_DNS_OK;
+				break;
+			}
+		}
+	}
+	err = errno;
+	close (sd);
+	errno = err;
+
+	if (result == NP_DNS_OK && (resp->flags & NP_DNS_TC)) {
+		np_dns_message_free (resp);
+		result = query_tcp (addr, addrlen, query, len, &q, resp, timeout_ms);
+	}
+	np_dns_message_free (&q);
+	return result;
+}
+
+
+/* All queries from one socket per address family. Each query in flight
+ * holds its own id; ids are handed out in turn, skipping those still in
+ * use, so that a late answer to a finished query finds nobody to take
+ * it. A query is resent with the same id each timeout until the retries
+ * are used up. */
+static void
+target_fail (np_dns_target *t, int status, int error)
+{
+	t->status = status;
+	t->error = error;
+	t->done = TRUE;
+}
+
+static int
+target_encode (np_dns_target *t, int options, unsigned char *out, size_t size)
+{
+	int len;
+
+	if ((len = np_dns_encode_query (t->id, t->name, t->type, NP_DNS_CLASS_IN, NP_DNS_RD,
+	                                (options & NP_DNS_NO_EDNS) ? 0 : NP_DNS_EDNS_SIZE, out, size)) < 0)
+		target_fail (t, NP_DNS_ERROR, EINVAL);
+	return len;
+}
+
+static void
+target_send (np_dns_target *t, const unsigned char *out, int len, int timeout_ms)
+{
+	int64_t now = now_us ();
+
+	if (sendto (t->sd, out, len, 0, (struct sockaddr *) &t->addr, t->addrlen) < 0) {
+		target_fail (t, NP_DNS_ERROR, errno);
+		return;
+	}
+	if (t->tries++ == 0)
+		t->sent = now;
+	t->deadline = now / 1000 + timeout_ms;
+}
+
+static int
+same_address (const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+	if (a->ss_family != b->ss_family)
+		return FALSE;
+	if (a->ss_family == AF_INET)
+		return ((struct sockaddr_in *) a)->sin_port == ((struct sockaddr_in *) b)->sin_port &&
+			!memcmp (&((struct sockaddr_in *) a)->sin_addr, &((struct sockaddr_in *) b)->sin_addr,
+			         sizeof (struct in_addr));
+	if (a->ss_family == AF_INET6)
+		return ((struct sockaddr_in6 *) a)->sin6_port == ((struct sockaddr_in6 *) b)->sin6_port &&
+			!memcmp (&((struct sockaddr_in6 *) a)->sin6_addr, &((struct sockaddr_in6 *) b)->sin6_addr,
+			         sizeof (struct in6_addr));
+	return FALSE;
+}
+
+int
+np_dns_same_name (const char *a, const char *b)
+{
+	size_t la = strlen (a), lb = strlen (b);
+
+	if (la > 1 && a[la - 1] == '.')
+		la--;
+	if (lb > 1 && b[lb - 1] == '.')
+		lb--;
+	return la == lb && !strncasecmp (a, b, la);
+}
+
+int
+np_dns_query_targets (np_dns_target *targets, size_t count, const char *port, int options,
+                      size_t concurrency, int timeout_ms, int retries)
+{
+	static unsigned char out[NP_DNS_MAX_MESSAGE], in[NP_DNS_MAX_MESSAGE];
+	np_dns_target **active, **by_id, *t;
+	np_dns_message resp;
+	struct addrinfo hints, *res;
+	struct sockaddr_storage from;
+	socklen_t fromlen;
+	struct pollfd pfd[2];
+	int64_t now, wait;
+	size_t i, j, nactive = 0, next = 0;
+	int sd[2] = { -1, -1 };
+	unsigned int id = (unsigned int) (getpid () ^ now_ms ()) & 0xffff;
+	int k, n, len;
+	ssize_t got;
+
+	if (concurrency == 0)
+		return FALSE;
+	/* there are only so many ids */
+	if (concurrency > 4096)
+		concurrency = 4096;
+	if ((active = calloc (concurrency, sizeof (*active))) == NULL)
+		return FALSE;
+	if ((by_id = calloc (65536, sizeof (*by_id))) == NULL) {
+		free (active);
+		return FALSE;
+	}
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = (options & NP_DNS_INET4) ? AF_INET : (options & NP_DNS_INET6) ? AF_INET6 : AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	for (i = 0; i < count; i++) {
+		t = &targets[i];
+		memset (&t->response, 0, sizeof (t->response));
+		t->status = NP_DNS_TIMEOUT;
+		t->error = 0;
+		t->time = 0;
+		t->tries = 0;
+		t->done = FALSE;
+		t->sd = -1;
+		/* the same server is usually asked many times */
+		if (i > 0 && !strcmp (t->server, targets[i - 1].server) && targets[i - 1].addrlen) {
+			memcpy (&t->addr, &targets[i - 1].addr, targets[i - 1].addrlen);
+			t->addrlen = targets[i - 1].addrlen;
+		}
+		else if ((n = getaddrinfo (t->server, port, &hints, &res)) != 0) {
+			t->addrlen = 0;
+			target_fail (t, NP_DNS_ERROR, n == EAI_SYSTEM ? errno : EHOSTUNREACH);
+			continue;
+		}
+		else {
+			memcpy (&t->addr, res->ai_addr, res->ai_addrlen);
+			t->addrlen = res->ai_addrlen;
+			freeaddrinfo (res);
+		}
+		k = t->addr.ss_family == AF_INET6;
+		if (sd[k] < 0 && ((sd[k] = socket (t->addr.ss_family, SOCK_DGRAM, 0)) < 0 ||
+		                  fcntl (sd[k], F_SETFL, O_NONBLOCK) < 0)) {
+			target_fail (t, NP_DNS_ERROR, errno);
+			if (sd[k] >= 0)
+				close (sd[k]);
+			sd[k] = -1;
+			continue;
+		}
+		t->sd = sd[k];
+	}
+
+	while (next < count || nactive) {
+		for (; nactive < concurrency && next < count; next++) {
+			t = &targets[next];
+			if (t->done)
+				continue;
+			while (by_id[id])
+				id = (id + 1) & 0xffff;
+			t->id = id;
+			id = (id + 1) & 0xffff;
+			if ((len = target_encode (t, options, out, sizeof (out))) < 0)
+				continue;
+			target_send (t, out, len, timeout_ms);
+			if (t->done)
+				continue;
+			by_id[t->id] = t;
+			active[nactive++] = t;
+		}
+
+		/* resend to the overdue, or give up on them */
+		now = now_ms ();
+		for (i = 0; i < nactive; i++) {
+			t = active[i];
+			if (t->done || t->deadline > now)
+				continue;
+			if (t->tries > retries) {
+				t->done = TRUE;
+				continue;
+			}
+			if ((len = target_encode (t, options, out, sizeof (out))) >= 0)
+				target_send (t, out, len, timeout_ms);
+		}
+		wait = -1;
+		for (i = j = 0; i < nactive; i++) {
+			if (active[i]->done) {
+				by_id[active[i]->id] = NULL;
+				continue;
+			}
+			active[j++] = active[i];
+			if (wait < 0 || active[i]->deadline - now < wait)
+				wait = active[i]->deadline - now;
+		}
+		if ((nactive = j) == 0)
+			continue;
+
+		for (n = 0, k = 0; k < 2; k++) {
+			if (sd[k] >= 0) {
+				pfd[n].fd = sd[k];
+				pfd[n++].events = POLLIN;
+			}
+		}
+		if (poll (pfd, n, wait < 0 ? 0 : (int) wait) < 0 && errno != EINTR)
+			break;
+
+		for (k = 0; k < n; k++) {
+			if (!(pfd[k].revents & POLLIN))
+				continue;
+			fromlen = sizeof (from);
+			while ((got = recvfrom (pfd[k].fd, in, sizeof (in), 0, (struct sockaddr *) &from, &fromlen)) >= 0) {
+				fromlen = sizeof (from);
+				/* late answers to a retry, and anyone else's, are dropped */
+				if (got < 12 || !(in[2] & 0x80) || (t = by_id[get16 (in)]) == NULL || t->done ||
+				    !same_address (&from, &t->addr) || !np_dns_decode (in, got, &resp))
+					continue;
+				if ((resp.qname[0] || resp.rcode == NP_DNS_NOERROR) &&
+				    (!np_dns_same_name (resp.qname, t->name) || resp.qtype != t->type)) {
+					np_dns_message_free (&resp);
+					continue;
+				}
+				t->response = resp;
+				t->status = NP_DNS_OK;
+				t->time = (double) (now_us () - t->sent) / 1e6;
+				t->done = TRUE;
+			}
+		}
+	}
+	for (k = 0; k < 2; k++) {
+		if (sd[k] >= 0)
+			close (sd[k]);
+	}
+	free (by_id);
+	free (active);
+
+	for (i = 0; i < count; i++) {
+		t = &targets[i];
+		if (t->status != NP_DNS_OK || !(t->response.flags & NP_DNS_TC))
+			continue;
+		np_dns_message_free (&t->response);
+		if ((len = target_encode (t, options, out, sizeof (out))) < 0)
+			continue;
+		np_dns_decode (out, len, &resp);
+		t->status = query_tcp ((struct sockaddr *) &t->addr, t->addrlen, out, len, &resp, &t->response,
+		                       timeout_ms);
+		t->error = t->status == NP_DNS_ERROR ? errno : 0;
+		t->time = (double) (now_us () - t->sent) / 1e6;
+		np_dns_message_free (&resp);
+	}
+	return TRUE;
+}
+
+void
+np_dns_targets_free (np_dns_target *targets, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (targets[i].status == NP_DNS_OK)
+			np_dns_message_free (&targets[i].response);
+		targets[i].status = NP_DNS_TIMEOUT;
+	}
+}
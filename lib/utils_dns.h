@@ -0,0 +1,166 @@
+#ifndef NAGIOS_UTILS_DNS_H_INCLUDED
+#define NAGIOS_UTILS_DNS_H_INCLUDED
+/* Header file for nagios plugins utils_dns.c */
+
+/* A minimal DNS engine: encoding of queries, decoding of responses with
+ * every resource record of the answer, authority and additional sections,
+ * and a query/response exchange over UDP that goes on over TCP when the
+ * response is truncated. Enough for check_dns to ask a server itself
+ * instead of running nslookup. Nothing is cached and nothing is followed;
+ * the answer is what the server sent. */
+
+#define NP_DNS_MAX_MESSAGE 65535     /* the largest message over TCP */
+#define NP_DNS_MAX_NAME 1025         /* a name in text form, every octet escaped */
+#define NP_DNS_EDNS_SIZE 1232        /* the UDP payload we offer with EDNS(0) */
+#define NP_DNS_PORT 53
+
+/* record types */
+#define NP_DNS_A 1
+#define NP_DNS_NS 2
+#define NP_DNS_CNAME 5
+#define NP_DNS_SOA 6
+#define NP_DNS_WKS 11
+#define NP_DNS_PTR 12
+#define NP_DNS_HINFO 13
+#define NP_DNS_MX 15
+#define NP_DNS_TXT 16
+#define NP_DNS_AAAA 28
+#define NP_DNS_SRV 33
+#define NP_DNS_DNAME 39
+#define NP_DNS_OPT 41
+#define NP_DNS_CAA 257
+#define NP_DNS_ANY 255
+
+#define NP_DNS_CLASS_IN 1
+#define NP_DNS_CLASS_CH 3
+#define NP_DNS_CLASS_HS 4
+
+/* header flags */
+#define NP_DNS_QR 0x8000
+#define NP_DNS_AA 0x0400
+#define NP_DNS_TC 0x0200
+#define NP_DNS_RD 0x0100
+#define NP_DNS_RA 0x0080
+#define NP_DNS_AD 0x0020
+#define NP_DNS_CD 0x0010
+
+/* response codes */
+#define NP_DNS_NOERROR 0
+#define NP_DNS_FORMERR 1
+#define NP_DNS_SERVFAIL 2
+#define NP_DNS_NXDOMAIN 3
+#define NP_DNS_NOTIMP 4
+#define NP_DNS_REFUSED 5
+
+/* sections of a response */
+#define NP_DNS_ANSWER 0
+#define NP_DNS_AUTHORITY 1
+#define NP_DNS_ADDITIONAL 2
+
+/* np_dns_query() results */
+#define NP_DNS_OK 0
+#define NP_DNS_TIMEOUT 1
+#define NP_DNS_ERROR 2
+
+/* np_dns_query() options */
+#define NP_DNS_USE_TCP 0x1           /* not UDP first */
+#define NP_DNS_NO_EDNS 0x2           /* a query without an OPT record */
+#define NP_DNS_INET4 0x4             /* np_dns_query_targets() servers by IPv4 only */
+#define NP_DNS_INET6 0x8             /* or by IPv6 only */
+
+typedef struct np_dns_rr {
+	char name[NP_DNS_MAX_NAME];
+	int section;
+	int type;
+	int class;
+	uint32_t ttl;
+	size_t rdoffset;          /* of the data in the message */
+	size_t rdlength;
+	char *data;               /* the data as dig prints it, malloc'd */
+} np_dns_rr;
+
+typedef struct np_dns_message {
+	uint16_t id;
+	uint16_t flags;
+	int rcode;                /* with the extended bits of an OPT record */
+	char qname[NP_DNS_MAX_NAME];
+	int qtype;
+	int qclass;
+	np_dns_rr *rr;            /* the records of all sections, in order */
+	size_t count;
+	size_t counts[3];         /* of each section */
+	int edns;                 /* TRUE if the response had an OPT record */
+	unsigned char *packet;    /* a copy of the message */
+	size_t length;
+	int tcp;                  /* TRUE if it came over TCP */
+} np_dns_message;
+
+/* "AAAA" to NP_DNS_AAAA and back; "TYPE65" for the others, -1 for
+ * what is neither */
+int np_dns_type (const char *);
+const char *np_dns_type_name (int, char *, size_t);
+/* the same for classes: "CH", "CLASS254" */
+int np_dns_class (const char *);
+const char *np_dns_class_name (int, char *, size_t);
+/* "NXDOMAIN" */
+const char *np_dns_rcode_name (int);
+
+/* The query for the name, with flags such as NP_DNS_RD and an OPT record
+ * offering edns_size octets unless that is 0. Returns the length of the
+ * message, or -1 if the name is not valid or it does not fit. */
+int np_dns_encode_query (uint16_t, const char *, int, int, int, int, unsigned char *, size_t);
+/* returns FALSE for anything that is not a well formed message */
+int np_dns_decode (const unsigned char *, size_t, np_dns_message *);
+void np_dns_message_free (np_dns_message *);
+
+/* TRUE if the names are the same but for case and a final dot, as the
+ * question of a response is matched against the name asked for */
+int np_dns_same_name (const char *, const char *);
+
+/* "4.3.2.1.in-addr.arpa" or the ip6.arpa name for an address, NULL if it
+ * is not one */
+char *np_dns_reverse_name (const char *, char *, size_t);
+/* the first nameserver of the resolv.conf file, or that of the resolver
+ * (the local host) if it names none; NULL reads /etc/resolv.conf */
+char *np_dns_default_server (const char *, char *, size_t);
+
+/* Send the query to the server and wait up to timeout_ms for the response
+ * with its id and question, resending it retries times over UDP. A
+ * truncated response is asked for again over TCP. errno tells what the
+ * NP_DNS_ERROR was. */
+int np_dns_query (const struct sockaddr *, socklen_t, const unsigned char *, size_t,
+                  np_dns_message *, int, int, int);
+
+/* one query of np_dns_query_targets() */
+typedef struct np_dns_target {
+	const char *server;
+	const char *name;
+	int type;
+	int status;               /* NP_DNS_OK, NP_DNS_TIMEOUT or NP_DNS_ERROR */
+	int error;                /* the errno of the NP_DNS_ERROR */
+	double time;              /* seconds from the first try to the response */
+	np_dns_message response;  /* if NP_DNS_OK */
+	/* for np_dns_query_targets() */
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int sd;
+	int tries;
+	int64_t sent;             /* microseconds */
+	int64_t deadline;
+	uint16_t id;
+	int done;
+} np_dns_target;
+
+/* Send every query and wait for the responses, from one socket per
+ * address family and at most concurrency at a time, each with its own
+ * timeout_ms and retries; options as for np_dns_query(), and
+ * NP_DNS_INET4 or NP_DNS_INET6 for the family of the servers. Queries in
+ * flight have distinct ids, and a response is only taken from the server
+ * it was sent to and for its question. Truncated responses are asked for
+ * again over TCP, one after the other, once the rest are done. FALSE if
+ * memory ran out. */
+int np_dns_query_targets (np_dns_target *, size_t, const char *, int, size_t, int, int);
+/* the responses of np_dns_query_targets() */
+void np_dns_targets_free (np_dns_target *, size_t);
+
+#endif /* NAGIOS_UTILS_DNS_H_INCLUDED */
@@ -0,0 +1,413 @@
+/*****************************************************************************
+*
+* utils_output.c
+*
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+*
+* Output formats of the plugins other than plain text
+*
+* The plugins print their result as they always have. In JSON mode that
+* text goes to a temporary file instead of stdout, and is turned into one
+* JSON object when the plugin exits, which where the C library has
+* on_exit() is seen with the exit code from within the same process.
+* Elsewhere the plugin runs on in a child and its parent waits for it.
+* The split into message, long output and perfdata is the one Nagios
+* makes of the text, so the two formats always say the same.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_output.h"
+#include "utils_profile.h"
+#include <ctype.h>
+#include <sys/wait.h>
+
+int np_output_format = NP_OUTPUT_TEXT;
+
+/* a growing buffer for the JSON text */
+typedef struct json_buffer {
+	char *buf;
+	size_t len;
+	size_t size;
+} json_buffer;
+
+static const char *states[] = { "OK", "WARNING", "CRITICAL", "UNKNOWN", "DEPENDENT" };
+
+/* what the JSON mode keeps until the plugin exits */
+static char *output_plugin = NULL;
+static FILE *output_capture = NULL;
+static int output_stdout = -1;
+
+static void json_append (json_buffer *, const char *, size_t);
+static void json_string (json_buffer *, const char *, size_t);
+static void json_number (json_buffer *, const char *, size_t);
+static void json_perfdata (json_buffer *, const char *, const char *, int *);
+static char *read_all (int, size_t *);
+
+
+char **
+np_output_opts (int *argc, char **argv)
+{
+	const char *format = NULL;
+	int i, j, n;
+
+	for (i = 1; i < *argc; i++) {
+		if (strncmp (argv[i], "--output-format=", 16) == 0) {
+			format = argv[i] + 16;
+			n = 1;
+		} else if (strcmp (argv[i], "--output-format") == 0 && i + 1 < *argc) {
+			format = argv[i + 1];
+			n = 2;
+		} else
+			continue;
+
+		for (j = i; j + n <= *argc; j++)
+			argv[j] = argv[j + n];
+		*argc -= n;
+		i--;
+	}
+
+	if (format && np_set_output_format (format, argv[0]) == ERROR)
+		die (STATE_UNKNOWN, _("Output format must be text or json, not %s\n"), format);
+
+	return np_profile_opts (argc, argv);
+}
+
+
+#ifdef HAVE_ON_EXIT
+/* the JSON for what the plugin printed, from on_exit() */
+static void
+output_exit (int status, void *unused)
+{
+	char *text, *json;
+	size_t len, done;
+	ssize_t ret;
+
+	(void) unused;
+	fflush (stdout);
+	text = read_all (fileno (output_capture), &len);
+	json = np_output_json (output_plugin, status & 0xff, text, len);
+	for (done = 0, len = strlen (json); done < len; done += (size_t) ret)
+		if ((ret = write (output_stdout, json + done, len - done)) <= 0)
+			break;
+	free (text);
+	free (json);
+}
+#endif
+
+
+int
+np_set_output_format (const char *format, const char *plugin)
+{
+	const char *name;
+
+	if (strcmp (format, "text") == 0)
+		return OK;
+	if (strcmp (format, "json") != 0)
+		return ERROR;
+	if (np_output_format == NP_OUTPUT_JSON)
+		return OK;
+	/* the worker loop holds the output already, and turns it into JSON
+	 * once the check is done */
+	if (np_resident_active ()) {
+		np_output_format = NP_OUTPUT_JSON;
+		return OK;
+	}
+
+	name = plugin ? strrchr (plugin, '/') : NULL;
+	output_plugin = strdup (name ? name + 1 : plugin ? plugin : "");
+	fflush (stdout);
+
+#ifdef HAVE_ON_EXIT
+	if ((output_capture = tmpfile ()) == NULL || (output_stdout = dup (STDOUT_FILENO)) < 0)
+		die (STATE_UNKNOWN, _("Cannot hold the output for JSON: %s\n"), strerror (errno));
+	dup2 (fileno (output_capture), STDOUT_FILENO);
+	on_exit (output_exit, NULL);
+#else
+	{
+		int pfd[2], status;
+		pid_t pid;
+		char *text, *json;
+		size_t len;
+
+		if (pipe (pfd) < 0 || (pid = fork ()) < 0)
+			die (STATE_UNKNOWN, _("Cannot hold the output for JSON: %s\n"), strerror (errno));
+		if (pid == 0) {
+			/* the plugin goes on here */
+			dup2 (pfd[1], STDOUT_FILENO);
+			close (pfd[0]);
+			close (pfd[1]);
+			np_output_format = NP_OUTPUT_JSON;
+			return OK;
+		}
+		close (pfd[1]);
+		text = read_all (pfd[0], &len);
+		while (waitpid (pid, &status, 0) < 0 && errno == EINTR)
+			;
+		status = WIFEXITED (status) ? WEXITSTATUS (status) : STATE_UNKNOWN;
+		json = np_output_json (output_plugin, status, text, len);
+		fputs (json, stdout);
+		exit (status);
+	}
+#endif
+
+	np_output_format = NP_OUTPUT_JSON;
+	return OK;
+}
+
+
+char *
+np_output_json (const char *plugin, int code, const char *text, size_t len)
+{
+	json_buffer j = { NULL, 0, 0 };
+	const char *end = text + len, *nl, *bar, *perf = NULL, *long_start, *long_end;
+	const char *message_end;
+	char number[32];
+	int first = TRUE;
+
+	if (text == NULL)
+		text = end = "";
+
+	/* the first line: the message, then its perfdata after a | */
+	nl = memchr (text, '\n', (size_t) (end - text));
+	message_end = nl ? nl : end;
+	if ((bar = memchr (text, '|', (size_t) (message_end - text))) != NULL)
+		perf = bar + 1;
+
+	/* the long output, up to a | after which the rest is perfdata */
+	long_start = long_end = nl ? nl + 1 : end;
+	if (nl) {
+		const char *long_bar = memchr (long_start, '|', (size_t) (end - long_start));
+		long_end = long_bar ? long_bar : end;
+		while (long_end > long_start && long_end[-1] == '\n')
+			long_end--;
+	}
+
+	json_append (&j, "{\"plugin\":", 10);
+	json_string (&j, plugin ? plugin : "", strlen (plugin ? plugin : ""));
+	json_append (&j, ",\"status\":", 10);
+	json_string (&j, code >= 0 && code <= 4 ? states[code] : states[STATE_UNKNOWN],
+	             strlen (code >= 0 && code <= 4 ? states[code] : states[STATE_UNKNOWN]));
+	snprintf (number, sizeof (number), ",\"code\":%d", code);
+	json_append (&j, number, strlen (number));
+	json_append (&j, ",\"message\":", 11);
+	json_string (&j, text, (size_t) ((bar ? bar : message_end) - text));
+	json_append (&j, ",\"long_output\":", 15);
+	json_string (&j, long_start, (size_t) (long_end - long_start));
+	json_append (&j, ",\"perfdata\":[", 13);
+	if (perf)
+		json_perfdata (&j, perf, message_end, &first);
+	if (long_end < end && *long_end == '|')
+		json_perfdata (&j, long_end + 1, end, &first);
+	json_append (&j, "]}\n", 3);
+
+	return j.buf;
+}
+
+
+/* The metrics in [p, end), as Nagios reads them:
+ * 'label'=value[uom];[warn];[crit];[min];[max], separated by whitespace,
+ * with '' for a quote within a quoted label. Anything else ends them. */
+static void
+json_perfdata (json_buffer *j, const char *p, const char *end, int *first)
+{
+	char label[MAX_INPUT_BUFFER];
+	const char *field, *num_end;
+	size_t label_len;
+	int n;
+
+	while (p < end) {
+		while (p < end && isspace ((unsigned char) *p))
+			p++;
+		if (p >= end)
+			return;
+
+		label_len = 0;
+		if (*p == '\'') {
+			for (p++; p < end; p++) {
+				if (*p == '\'') {
+					if (p + 1 < end && p[1] == '\'')
+						p++;
+					else
+						break;
+				}
+				if (label_len < sizeof (label))
+					label[label_len++] = *p;
+			}
+			if (p >= end || p + 1 >= end || p[1] != '=')
+				return;
+			p += 2;
+		} else {
+			for (; p < end && *p != '=' && !isspace ((unsigned char) *p); p++)
+				if (label_len < sizeof (label))
+					label[label_len++] = *p;
+			if (p >= end || *p != '=' || label_len == 0)
+				return;
+			p++;
+		}
+
+		json_append (j, *first ? "{\"label\":" : ",{\"label\":", *first ? 9 : 10);
+		*first = FALSE;
+		json_string (j, label, label_len);
+
+		/* value and unit, then the four fields after it */
+		for (n = 0; n < 5; n++) {
+			for (field = p; p < end && *p != ';' && !isspace ((unsigned char) *p); p++)
+				;
+			switch (n) {
+			case 0:
+				/* U for a value that could not be had */
+				if (p - field == 1 && *field == 'U') {
+					json_append (j, ",\"value\":null,\"uom\":\"\"", 22);
+					break;
+				}
+				for (num_end = field; num_end < p && strchr ("+-0123456789.eE", *num_end); num_end++)
+					;
+				/* 1e is one and the letter of a unit, not a number */
+				while (num_end > field && (num_end[-1] == 'e' || num_end[-1] == 'E'))
+					num_end--;
+				json_append (j, ",\"value\":", 9);
+				json_number (j, field, (size_t) (num_end - field));
+				json_append (j, ",\"uom\":", 7);
+				json_string (j, num_end, (size_t) (p - num_end));
+				break;
+			case 1:
+			case 2:
+				json_append (j, n == 1 ? ",\"warn\":" : ",\"crit\":", 8);
+				if (p > field)
+					json_string (j, field, (size_t) (p - field));
+				else
+					json_append (j, "null", 4);
+				break;
+			default:
+				json_append (j, n == 3 ? ",\"min\":" : ",\"max\":", 7);
+				json_number (j, field, (size_t) (p - field));
+			}
+			/* fields left out are empty */
+			if (p < end && *p == ';' && n < 4)
+				p++;
+		}
+		/* more fields than Nagios knows of are skipped */
+		while (p < end && !isspace ((unsigned char) *p))
+			p++;
+		json_append (j, "}", 1);
+	}
+}
+
+
+static void
+json_append (json_buffer *j, const char *s, size_t len)
+{
+	char *tmp;
+
+	if (j->len + len + 1 > j->size) {
+		size_t size = j->size ? j->size : 256;
+		while (j->len + len + 1 > size)
+			size <<= 1;
+		if ((tmp = realloc (j->buf, size)) == NULL)
+			die (STATE_UNKNOWN, _("Could not allocate memory for the output\n"));
+		j->buf = tmp;
+		j->size = size;
+	}
+	memcpy (j->buf + j->len, s, len);
+	j->len += len;
+	j->buf[j->len] = '\0';
+}
+
+
+/* s as a JSON string: quotes, backslashes and control characters escaped,
+ * everything else, UTF-8 included, as it is */
+static void
+json_string (json_buffer *j, const char *s, size_t len)
+{
+	const char *end = s + len, *run;
+	char esc[8];
+
+	json_append (j, "\"", 1);
+	while (s < end) {
+		for (run = s; s < end && (unsigned char) *s >= 0x20 && *s != '"' && *s != '\\'; s++)
+			;
+		json_append (j, run, (size_t) (s - run));
+		if (s >= end)
+			break;
+		switch (*s) {
+		case '"': json_append (j, "\\\"", 2); break;
+		case '\\': json_append (j, "\\\\", 2); break;
+		case '\n': json_append (j, "\\n", 2); break;
+		case '\r': json_append (j, "\\r", 2); break;
+		case '\t': json_append (j, "\\t", 2); break;
+		default:
+			snprintf (esc, sizeof (esc), "\\u%04x", (unsigned char) *s);
+			json_append (j, esc, 6);
+		}
+		s++;
+	}
+	json_append (j, "\"", 1);
+}
+
+
+/* the number in s as JSON, null unless all of s is one */
+static void
+json_number (json_buffer *j, const char *s, size_t len)
+{
+	char buf[64], *end;
+	double value;
+
+	if (len == 0 || len >= sizeof (buf)) {
+		json_append (j, "null", 4);
+		return;
+	}
+	memcpy (buf, s, len);
+	buf[len] = '\0';
+	value = strtod (buf, &end);
+	if (*end != '\0' || end == buf || value != value || value - value != 0) {
+		json_append (j, "null", 4);
+		return;
+	}
+	snprintf (buf, sizeof (buf), "%.15g", value);
+	json_append (j, buf, strlen (buf));
+}
+
+
+/* all there is to read from fd, nul-terminated */
+static char *
+read_all (int fd, size_t *len)
+{
+	size_t size = 4096;
+	char *buf = malloc (size), *tmp;
+	ssize_t ret;
+
+	*len = 0;
+	if (buf == NULL)
+		return NULL;
+	lseek (fd, 0, SEEK_SET);
+	while ((ret = read (fd, buf + *len, size - *len - 1)) > 0 || (ret < 0 && errno == EINTR)) {
+		if (ret < 0)
+			continue;
+		*len += (size_t) ret;
+		if (size - *len < 1024) {
+			if ((tmp = realloc (buf, size <<= 1)) == NULL)
+				break;
+			buf = tmp;
+		}
+	}
+	buf[*len] = '\0';
+	return buf;
+}
@@ -0,0 +1,36 @@
+#ifndef NAGIOS_UTILS_OUTPUT_H_INCLUDED
+#define NAGIOS_UTILS_OUTPUT_H_INCLUDED
+/* Header file for nagios plugins utils_output.c */
+
+/* The output formats of --output-format. In json, what the plugin prints
+ * is held back and, when it exits, written out as one JSON object with
+ * the exit code and its state, the message, the long output and each
+ * perfdata metric with its label, value, unit, thresholds and bounds as
+ * fields of their own:
+ *
+ * {"plugin":"check_tcp","status":"OK","code":0,"message":"TCP OK - ...",
+ *  "long_output":"","perfdata":[{"label":"time","value":0.001,"uom":"s",
+ *  "warn":null,"crit":"10.000000","min":0,"max":10}]}
+ *
+ * Values and bounds are numbers, or null where they are missing or "U";
+ * thresholds stay strings, as ranges such as "@10:20" are. */
+#define NP_OUTPUT_TEXT 0
+#define NP_OUTPUT_JSON 1
+
+extern int np_output_format;
+
+/* Take --output-format=FORMAT (or --output-format FORMAT) out of argv and
+ * switch to that format, then --profile as np_profile_opts() does;
+ * np_extra_opts() does this for the plugins. Returns argv, having died
+ * on formats it does not know. */
+char **np_output_opts (int *argc, char **argv);
+
+/* Switch the rest of the run to the output format given by name, for the
+ * plugin of that name. Returns OK or, for unknown formats, ERROR. */
+int np_set_output_format (const char *format, const char *plugin);
+
+/* The JSON object for len bytes of a plugin's text output and its exit
+ * code, as above; to be freed by the caller */
+char *np_output_json (const char *plugin, int code, const char *text, size_t len);
+
+#endif /* NAGIOS_UTILS_OUTPUT_H_INCLUDED */
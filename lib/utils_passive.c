@@ -0,0 +1,348 @@
+/*****************************************************************************
+*
+* utils_passive.c
+*
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+*
+* Passive check results for the Nagios command file, a checkresult spool
+* directory or livestatus
+*
+* A batch is formatted once, for the destination, and written with as
+* few calls as that allows; to a FIFO those are cut at line boundaries so
+* that no write is longer than PIPE_BUF and none is interleaved with the
+* writes of other processes.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_passive.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+void
+np_passive_init (np_passive *p)
+{
+	memset (p, 0, sizeof (*p));
+}
+
+static void
+passive_add (np_passive *p, time_t t, const char *host, const char *service, int state,
+             const char *output)
+{
+	np_passive_result *r;
+
+	if (p->count == p->size) {
+		p->size = p->size ? p->size * 2 : 64;
+		if ((p->results = realloc (p->results, p->size * sizeof (*p->results))) == NULL)
+			die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	}
+	r = &p->results[p->count++];
+	r->time = t;
+	r->host = np_arena_strdup (&p->arena, host);
+	r->service = service ? np_arena_strdup (&p->arena, service) : NULL;
+	r->state = state;
+	r->output = np_arena_strdup (&p->arena, output ? output : "");
+}
+
+void
+np_passive_service (np_passive *p, time_t t, const char *host, const char *service, int state,
+                    const char *output)
+{
+	passive_add (p, t, host, service, state, output);
+}
+
+void
+np_passive_host (np_passive *p, time_t t, const char *host, int state, const char *output)
+{
+	passive_add (p, t, host, NULL, state, output);
+}
+
+void
+np_passive_truncate (np_passive *p, size_t count)
+{
+	if (count < p->count)
+		p->count = count;
+}
+
+/* the output on one line, its newlines as \n */
+static void
+passive_output (np_strbuf *b, const char *s)
+{
+	size_t n;
+
+	while (*s) {
+		n = strcspn (s, "\r\n");
+		np_strbuf_append (b, s, n);
+		s += n;
+		if (*s == '\n')
+			np_strbuf_append (b, "\\n", 2);
+		if (*s)
+			s++;
+	}
+}
+
+void
+np_passive_lines (const np_passive *p, np_strbuf *b)
+{
+	const np_passive_result *r;
+
+	for (r = p->results; r < p->results + p->count; r++) {
+		if (r->service)
+			np_strbuf_appendf (b, "[%lu] PROCESS_SERVICE_CHECK_RESULT;%s;%s;%d;",
+			                   (unsigned long) r->time, r->host, r->service, r->state);
+		else
+			np_strbuf_appendf (b, "[%lu] PROCESS_HOST_CHECK_RESULT;%s;%d;",
+			                   (unsigned long) r->time, r->host, r->state);
+		passive_output (b, r->output);
+		np_strbuf_append (b, "\n", 1);
+	}
+}
+
+/* the batch as a checkresult file, each result ended by an empty line */
+static void
+passive_spool_file (const np_passive *p, np_strbuf *b)
+{
+	const np_passive_result *r;
+
+	np_strbuf_appendf (b, "### Active Check Result File ###\nfile_time=%lu\n\n",
+	                   (unsigned long) time (NULL));
+	for (r = p->results; r < p->results + p->count; r++) {
+		if (r->service)
+			np_strbuf_appendf (b, "### Nagios Service Check Result ###\nhost_name=%s\nservice_description=%s\n",
+			                   r->host, r->service);
+		else
+			np_strbuf_appendf (b, "### Nagios Host Check Result ###\nhost_name=%s\n", r->host);
+		np_strbuf_appendf (b, "check_type=1\ncheck_options=0\nscheduled_check=0\nreschedule_check=0\n"
+		                   "latency=0.0\nstart_time=%lu.0\nfinish_time=%lu.0\nearly_timeout=0\n"
+		                   "exited_ok=1\nreturn_code=%d\noutput=",
+		                   (unsigned long) r->time, (unsigned long) r->time, r->state);
+		passive_output (b, r->output);
+		np_strbuf_append (b, "\n\n", 2);
+	}
+}
+
+static int
+passive_write_all (np_passive *p, int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		p->writes++;
+		if ((ret = write (fd, buf, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return ERROR;
+		}
+		buf += ret;
+		len -= (size_t) ret;
+	}
+	return OK;
+}
+
+/* len bytes of lines to fd in writes of whole lines of at most max bytes;
+ * a line longer than that has a write of its own */
+static int
+passive_write_lines (np_passive *p, int fd, const char *data, size_t len, size_t max)
+{
+	const char *s, *end, *next, *nl, *stop = data + len;
+
+	for (s = data; s < stop; s = end) {
+		for (end = s; end < stop; end = next) {
+			nl = memchr (end, '\n', stop - end);
+			next = nl ? nl + 1 : stop;
+			if (end != s && (size_t) (next - s) > max)
+				break;
+		}
+		if (passive_write_all (p, fd, s, end - s) == ERROR)
+			return ERROR;
+	}
+	return OK;
+}
+
+int
+np_passive_write (np_passive *p, int fd)
+{
+	np_arena arena = { NULL };
+	np_strbuf b;
+	struct stat st;
+	int ret;
+
+	p->writes = 0;
+	np_strbuf_init (&b, &arena);
+	np_passive_lines (p, &b);
+	ret = passive_write_lines (p, fd, np_strbuf_string (&b), b.len,
+	                           fstat (fd, &st) == 0 && S_ISFIFO (st.st_mode) ? PIPE_BUF : b.len);
+	np_arena_free (&arena);
+	return ret;
+}
+
+/* a checkresult file in dir, read by Nagios once its .ok file is there */
+static int
+passive_spool (np_passive *p, const char *dir)
+{
+	np_arena arena = { NULL };
+	np_strbuf b;
+	char *path, *ok_path;
+	int fd, ret = ERROR, saved;
+
+	if (asprintf (&path, "%s/cXXXXXX", dir) < 0)
+		return ERROR;
+	if ((fd = mkstemp (path)) < 0) {
+		free (path);
+		return ERROR;
+	}
+	np_strbuf_init (&b, &arena);
+	passive_spool_file (p, &b);
+	if (passive_write_all (p, fd, np_strbuf_string (&b), b.len) == OK && close (fd) == 0) {
+		fd = -1;
+		if (asprintf (&ok_path, "%s.ok", path) >= 0) {
+			p->writes++;
+			if ((fd = open (ok_path, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR)) >= 0 && close (fd) == 0)
+				ret = OK;
+			fd = -1;
+			free (ok_path);
+		}
+	}
+	saved = errno;
+	if (fd >= 0)
+		close (fd);
+	if (ret == ERROR)
+		unlink (path);
+	free (path);
+	np_arena_free (&arena);
+	errno = saved;
+	return ret;
+}
+
+/* a connection to livestatus at a unix socket path or HOST:PORT */
+static int
+passive_livestatus_connect (const char *addr)
+{
+	struct sockaddr_un su;
+	struct addrinfo hints, *res, *ai;
+	char *host, *port;
+	int sd = -1, err;
+
+	if (strchr (addr, '/') || (port = strrchr (addr, ':')) == NULL) {
+		if (strlen (addr) >= sizeof (su.sun_path)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		memset (&su, 0, sizeof (su));
+		su.sun_family = AF_UNIX;
+		strcpy (su.sun_path, addr);
+		if ((sd = socket (AF_UNIX, SOCK_STREAM, 0)) >= 0 && connect (sd, (struct sockaddr *) &su, sizeof (su)) < 0) {
+			err = errno;
+			close (sd);
+			errno = err;
+			sd = -1;
+		}
+		return sd;
+	}
+
+	if ((host = strdup (addr)) == NULL)
+		return -1;
+	host[port - addr] = '\0';
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if ((err = getaddrinfo (host, port + 1, &hints, &res)) != 0) {
+		free (host);
+		errno = err == EAI_SYSTEM ? errno : EHOSTUNREACH;
+		return -1;
+	}
+	for (ai = res; ai && sd < 0; ai = ai->ai_next) {
+		if ((sd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+			continue;
+		if (connect (sd, ai->ai_addr, ai->ai_addrlen) < 0) {
+			err = errno;
+			close (sd);
+			errno = err;
+			sd = -1;
+		}
+	}
+	freeaddrinfo (res);
+	free (host);
+	return sd;
+}
+
+/* a COMMAND request for each result on one connection; livestatus keeps
+ * a connection open after a command, and an empty line ends each */
+static int
+passive_livestatus (np_passive *p, const char *addr)
+{
+	np_arena arena = { NULL };
+	np_strbuf lines, b;
+	const char *s, *nl;
+	int sd, ret, saved;
+
+	if ((sd = passive_livestatus_connect (addr)) < 0)
+		return ERROR;
+	np_strbuf_init (&lines, &arena);
+	np_strbuf_init (&b, &arena);
+	np_passive_lines (p, &lines);
+	np_strbuf_reserve (&b, lines.len + p->count * 10);
+	for (s = np_strbuf_string (&lines); *s; s = nl + 1) {
+		nl = strchr (s, '\n');
+		np_strbuf_append (&b, "COMMAND ", 8);
+		np_strbuf_append (&b, s, nl - s);
+		np_strbuf_append (&b, "\n\n", 2);
+	}
+	ret = passive_write_all (p, sd, np_strbuf_string (&b), b.len);
+	saved = errno;
+	close (sd);
+	np_arena_free (&arena);
+	errno = saved;
+	return ret;
+}
+
+int
+np_passive_send (np_passive *p, const char *destination)
+{
+	size_t spool = strlen (NP_PASSIVE_SPOOL), live = strlen (NP_PASSIVE_LIVESTATUS);
+	int fd, ret, saved;
+
+	p->writes = 0;
+	if (!strncmp (destination, NP_PASSIVE_SPOOL, spool))
+		return p->count ? passive_spool (p, destination + spool) : OK;
+	if (!strncmp (destination, NP_PASSIVE_LIVESTATUS, live))
+		return p->count ? passive_livestatus (p, destination + live) : OK;
+
+	if ((fd = open (destination, O_WRONLY | O_APPEND | O_CREAT, 0666)) < 0)
+		return ERROR;
+	ret = np_passive_write (p, fd);
+	saved = errno;
+	if (close (fd) < 0 && ret == OK)
+		return ERROR;
+	errno = saved;
+	return ret;
+}
+
+void
+np_passive_free (np_passive *p)
+{
+	np_arena_free (&p->arena);
+	free (p->results);
+	np_passive_init (p);
+}
@@ -0,0 +1,60 @@
+#ifndef NAGIOS_UTILS_PASSIVE_H_INCLUDED
+#define NAGIOS_UTILS_PASSIVE_H_INCLUDED
+/* Header file for nagios plugins utils_passive.c */
+
+/* Passive check results, gathered into one batch and delivered to Nagios
+ * in as few writes as the destination allows, so that the results of
+ * thousands of targets take a few system calls rather than one each:
+ *
+ *  FILE             the external command file, usually a FIFO. A write of
+ *                   at most PIPE_BUF bytes to a FIFO is never interleaved
+ *                   with those of others, so the batch goes in chunks of
+ *                   whole lines up to that size; to a plain file, in one.
+ *  spool:DIR        a checkresult file in DIR, the check_result_path of
+ *                   nagios.cfg, with every result; it is written whole
+ *                   before the .ok file that lets Nagios read it is made.
+ *  livestatus:PATH  COMMAND requests over the unix socket of livestatus,
+ *  livestatus:HOST:PORT  or its TCP port, on one connection.
+ *
+ * Newlines in the output are sent as the two characters \n, which Nagios
+ * takes as the start of the long output. */
+
+#define NP_PASSIVE_SPOOL "spool:"
+#define NP_PASSIVE_LIVESTATUS "livestatus:"
+
+typedef struct np_passive_result {
+	time_t time;
+	const char *host;
+	const char *service; /* NULL for a host result */
+	int state;
+	const char *output;
+} np_passive_result;
+
+typedef struct np_passive {
+	np_arena arena; /* the strings of the results */
+	np_passive_result *results;
+	size_t count;
+	size_t size;
+	unsigned long writes; /* made by the last np_passive_send() */
+} np_passive;
+
+void np_passive_init (np_passive *);
+void np_passive_service (np_passive *, time_t, const char *host, const char *service,
+                         int state, const char *output);
+void np_passive_host (np_passive *, time_t, const char *host, int state, const char *output);
+/* the results after the first count dropped again */
+void np_passive_truncate (np_passive *, size_t count);
+
+/* The batch as command file lines, "[TIME] PROCESS_SERVICE_CHECK_RESULT;...",
+ * in b */
+void np_passive_lines (const np_passive *, np_strbuf *b);
+
+/* All of the batch to the destination, as above; OK, or ERROR with errno
+ * set. The results are kept, to be sent elsewhere or freed. */
+int np_passive_send (np_passive *, const char *destination);
+/* to the command file open on fd, in chunks of whole lines of at most
+ * PIPE_BUF bytes if it is a FIFO */
+int np_passive_write (np_passive *, int fd);
+void np_passive_free (np_passive *);
+
+#endif /* NAGIOS_UTILS_PASSIVE_H_INCLUDED */
@@ -0,0 +1,1266 @@
+/*****************************************************************************
+*
+* Library for the /proc files of Linux
+*
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+*
+* Description:
+*
+* This file contains the readers of /proc for check_load, check_swap,
+* check_uptime and check_procs, and the snapshot of them they may share.
+* These are tested by libtap
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_proc.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+#if HAVE_UTMPX_H
+# include <utmpx.h>
+#endif
+#ifdef HAVE_LINUX_CN_PROC_H
+# include <sys/socket.h>
+# include <linux/netlink.h>
+# include <linux/connector.h>
+# include <linux/cn_proc.h>
+#endif
+
+static const char *proc_root = "/proc";
+static char proc_buf[NP_PROC_BUFSIZE];
+
+void
+np_proc_set_root (const char *root)
+{
+	proc_root = root;
+}
+
+/* root/name into proc_buf with one pread, returning the length or -1 */
+static ssize_t
+proc_file (const char *name)
+{
+	char path[256];
+	ssize_t n;
+	int fd;
+
+	snprintf (path, sizeof (path), "%s/%s", proc_root, name);
+	if ((fd = open (path, O_RDONLY)) < 0)
+		return -1;
+	do
+		n = pread (fd, proc_buf, sizeof (proc_buf) - 1, 0);
+	while (n < 0 && errno == EINTR);
+	close (fd);
+	if (n < 0)
+		return -1;
+	proc_buf[n] = '\0';
+	return n;
+}
+
+/* the line after the one at line, or NULL at the end */
+static char *
+next_line (char *line)
+{
+	return (line = strchr (line, '\n')) ? line + 1 : NULL;
+}
+
+int
+np_proc_loadavg (double load[3])
+{
+	return proc_file ("loadavg") > 0 &&
+	       sscanf (proc_buf, "%lf %lf %lf", &load[0], &load[1], &load[2]) == 3;
+}
+
+int
+np_proc_uptime (double *uptime)
+{
+	return proc_file ("uptime") > 0 && sscanf (proc_buf, "%lf", uptime) == 1;
+}
+
+int
+np_proc_meminfo_read (np_proc_meminfo *mi)
+{
+	static const struct {
+		const char *key;
+		size_t offset;
+	} keys[] = {
+		{ "MemTotal:", offsetof (np_proc_meminfo, mem_total) },
+		{ "MemFree:", offsetof (np_proc_meminfo, mem_free) },
+		{ "MemAvailable:", offsetof (np_proc_meminfo, mem_available) },
+		{ "Buffers:", offsetof (np_proc_meminfo, buffers) },
+		{ "Cached:", offsetof (np_proc_meminfo, cached) },
+		{ "SwapCached:", offsetof (np_proc_meminfo, swap_cached) },
+		{ "SwapTotal:", offsetof (np_proc_meminfo, swap_total) },
+		{ "SwapFree:", offsetof (np_proc_meminfo, swap_free) },
+	};
+	char *line;
+	size_t i, found = 0;
+
+	memset (mi, 0, sizeof (*mi));
+	if (proc_file ("meminfo") <= 0)
+		return FALSE;
+	for (line = proc_buf; line && found < sizeof (keys) / sizeof (*keys); line = next_line (line))
+		for (i = 0; i < sizeof (keys) / sizeof (*keys); i++)
+			if (!strncmp (line, keys[i].key, strlen (keys[i].key))) {
+				*(unsigned long long *) ((char *) mi + keys[i].offset) =
+					strtoull (line + strlen (keys[i].key), NULL, 10);
+				found++;
+				break;
+			}
+	return mi->mem_total > 0;
+}
+
+int
+np_proc_swaps (np_proc_swap *swaps, int max)
+{
+	char *line;
+	int n = 0;
+
+	if (proc_file ("swaps") < 0)
+		return -1;
+	/* Filename Type Size Used Priority */
+	for (line = next_line (proc_buf); line && *line && n < max; line = next_line (line))
+		if (sscanf (line, "%255s %15s %llu %llu %d", swaps[n].name, swaps[n].type,
+		            &swaps[n].size, &swaps[n].used, &swaps[n].priority) == 5)
+			n++;
+	return n;
+}
+
+static int
+pressure_line (const char *line, const char *kind, double *avg10, double *avg60, double *avg300, unsigned long long *total)
+{
+	size_t len = strlen (kind);
+
+	return !strncmp (line, kind, len) && line[len] == ' ' &&
+	       sscanf (line + len, " avg10=%lf avg60=%lf avg300=%lf total=%llu", avg10, avg60, avg300, total) == 4;
+}
+
+int
+np_proc_pressure_read (const char *resource, np_proc_pressure *p)
+{
+	char name[64];
+	char *line;
+
+	memset (p, 0, sizeof (*p));
+	snprintf (name, sizeof (name), "pressure/%s", resource);
+	if (proc_file (name) <= 0 ||
+	    !pressure_line (proc_buf, "some", &p->some_avg10, &p->some_avg60, &p->some_avg300, &p->some_total))
+		return FALSE;
+	if ((line = next_line (proc_buf)) != NULL)
+		p->has_full = pressure_line (line, "full", &p->full_avg10, &p->full_avg60, &p->full_avg300, &p->full_total);
+	return TRUE;
+}
+
+int
+np_proc_stat_read (np_proc_stat *st)
+{
+	char *line;
+
+	memset (st, 0, sizeof (*st));
+	if (proc_file ("stat") <= 0 ||
+	    sscanf (proc_buf, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+	            &st->cpu[0], &st->cpu[1], &st->cpu[2], &st->cpu[3],
+	            &st->cpu[4], &st->cpu[5], &st->cpu[6], &st->cpu[7]) < 4)
+		return FALSE;
+	for (line = next_line (proc_buf); line && *line; line = next_line (line)) {
+		if (!strncmp (line, "cpu", 3) && isdigit ((unsigned char) line[3]))
+			st->cpus++;
+		else if (!strncmp (line, "ctxt ", 5))
+			st->ctxt = strtoull (line + 5, NULL, 10);
+		else if (!strncmp (line, "btime ", 6))
+			st->btime = strtol (line + 6, NULL, 10);
+		else if (!strncmp (line, "processes ", 10))
+			st->processes = strtoull (line + 10, NULL, 10);
+		else if (!strncmp (line, "procs_running ", 14))
+			st->procs_running = atoi (line + 14);
+		else if (!strncmp (line, "procs_blocked ", 14))
+			st->procs_blocked = atoi (line + 14);
+	}
+	return TRUE;
+}
+
+
+int
+np_proc_vmstat_read (np_proc_vmstat *vm)
+{
+	char *line;
+	int seen = 0;
+
+	memset (vm, 0, sizeof (*vm));
+	if (proc_file ("vmstat") <= 0)
+		return FALSE;
+	for (line = proc_buf; line && *line; line = next_line (line)) {
+		if (!strncmp (line, "pswpin ", 7)) {
+			vm->pswpin = strtoull (line + 7, NULL, 10);
+			seen++;
+		}
+		else if (!strncmp (line, "pswpout ", 8)) {
+			vm->pswpout = strtoull (line + 8, NULL, 10);
+			seen++;
+		}
+		else if (!strncmp (line, "pgmajfault ", 11))
+			vm->pgmajfault = strtoull (line + 11, NULL, 10);
+	}
+	return seen == 2;
+}
+
+/* read all of <pid>/name into scan->buf, returning the length or -1 */
+static ssize_t
+proc_read (np_proc_scan *scan, const char *pid, const char *name)
+{
+	char path[64];
+	ssize_t len = 0, n;
+	int fd;
+
+	snprintf (path, sizeof (path), "%s/%s", pid, name);
+	if ((fd = openat (scan->fd, path, O_RDONLY)) < 0)
+		return -1;
+	for (;;) {
+		if (len + 1 >= (ssize_t) scan->size) {
+			scan->size *= 2;
+			if ((scan->buf = realloc (scan->buf, scan->size)) == NULL)
+				die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+		}
+		n = pread (fd, scan->buf + len, scan->size - len - 1, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	close (fd);
+	if (n < 0)
+		return -1;
+	scan->buf[len] = '\0';
+	return len;
+}
+
+int
+np_proc_scan_open (np_proc_scan *scan)
+{
+	double uptime;
+
+	memset (scan, 0, sizeof (*scan));
+	if ((scan->dir = opendir (proc_root)) == NULL)
+		return FALSE;
+	scan->fd = dirfd (scan->dir);
+	scan->hz = sysconf (_SC_CLK_TCK);
+	scan->pagesize = sysconf (_SC_PAGESIZE);
+	scan->ascii = MB_CUR_MAX == 1;
+	scan->size = scan->args_size = MAX_INPUT_BUFFER;
+	scan->buf = malloc (scan->size);
+	scan->args = malloc (scan->args_size);
+	if (scan->buf == NULL || scan->args == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	if (!np_proc_uptime (&uptime)) {
+		closedir (scan->dir);
+		return FALSE;
+	}
+	scan->uptime = (unsigned long long) uptime;
+	scan->uptime_ms = (unsigned long long) (uptime * 1000);
+	return TRUE;
+}
+
+/* the next process from its stat file, or FALSE at the end of the table;
+ * the rest is read by np_proc_scan_status(), _args() and _cgroup() only for
+ * the processes the filters on these fields still have to look at */
+/* the process of the pid directory from its stat file, or FALSE if it
+ * is gone */
+static int
+proc_stat_entry (np_proc_scan *scan, const char *pid, np_proc_entry *pe)
+{
+	unsigned long utime, stime, vsize, seconds;
+	unsigned long long start;
+	long rss;
+	char *comm, *end;
+	size_t n;
+
+	/* pid (comm) state ppid pgrp session tty tpgid flags minflt cminflt
+	 * majflt cmajflt utime stime cutime cstime priority nice threads
+	 * itrealvalue starttime vsize rss ... */
+	if (proc_read (scan, pid, "stat") < 0 ||
+	    (comm = strchr (scan->buf, '(')) == NULL || (end = strrchr (comm, ')')) == NULL)
+		return FALSE;
+	if (sscanf (end + 1, " %c %d %d %d %*d %d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %ld %ld %*d %llu %lu %ld",
+	            &scan->state, &pe->ppid, &scan->pgrp, &scan->session, &scan->tpgid, &utime, &stime,
+	            &scan->nice, &scan->threads, &start, &vsize, &rss) != 12)
+		return FALSE;
+	snprintf (scan->pid, sizeof (scan->pid), "%s", pid);
+	pe->pid = atoi (scan->buf);
+	/* ps shows the first TASK_COMM_LEN - 1 characters */
+	*end = '\0';
+	snprintf (scan->comm, sizeof (scan->comm), "%s", comm + 1);
+	n = strlen (scan->comm);
+	if (n >= sizeof (pe->prog))
+		n = sizeof (pe->prog) - 1;
+	memcpy (pe->prog, scan->comm, n);
+	pe->prog[n] = '\0';
+
+	pe->start = start;
+	pe->ticks = utime + stime;
+
+	/* the seconds since start and %CPU as procps works them out */
+	start /= scan->hz;
+	seconds = scan->uptime > start ? scan->uptime - start : 0;
+	pe->seconds = seconds;
+	pe->pcpu = seconds ? ((utime + stime) * 1000ULL / scan->hz / seconds) / 10.0 : 0;
+	pe->vsz = vsize / 1024;
+	pe->rss = rss * (scan->pagesize / 1024);
+	pe->uid = 0;
+	pe->stat[0] = scan->state;
+	pe->stat[1] = '\0';
+	pe->args = "";
+	pe->cgroup = "-";
+	return TRUE;
+}
+
+int
+np_proc_scan_next (np_proc_scan *scan, np_proc_entry *pe)
+{
+	struct dirent *de;
+
+	while ((de = readdir (scan->dir)) != NULL) {
+		if (!isdigit ((unsigned char) de->d_name[0]))
+			continue;
+		if (proc_stat_entry (scan, de->d_name, pe))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+int
+np_proc_scan_pid (np_proc_scan *scan, pid_t pid, np_proc_entry *pe)
+{
+	char name[16];
+
+	snprintf (name, sizeof (name), "%ld", (long) pid);
+	return pid > 0 && proc_stat_entry (scan, name, pe);
+}
+
+/* the effective uid, the resident size as procps shows it and the flags
+ * of ps's STAT column, or FALSE if the process is gone */
+int
+np_proc_scan_status (np_proc_scan *scan, np_proc_entry *pe)
+{
+	char *line;
+	int locked = 0;
+	size_t n = 1;
+
+	if (proc_read (scan, scan->pid, "status") < 0)
+		return FALSE;
+	for (line = scan->buf; line; line = (line = strchr (line, '\n')) ? line + 1 : NULL) {
+		if (!strncmp (line, "Uid:", 4))
+			sscanf (line + 4, "%*d %d", &pe->uid);
+		else if (!strncmp (line, "VmLck:", 6))
+			locked = strtol (line + 6, NULL, 10) > 0;
+		else if (!strncmp (line, "VmRSS:", 6))
+			pe->rss = strtol (line + 6, NULL, 10);
+	}
+
+	if (scan->nice < 0)
+		pe->stat[n++] = '<';
+	if (scan->nice > 0)
+		pe->stat[n++] = 'N';
+	if (locked)
+		pe->stat[n++] = 'L';
+	if (scan->session == pe->pid)
+		pe->stat[n++] = 's';
+	if (scan->threads > 1)
+		pe->stat[n++] = 'l';
+	if (scan->pgrp == scan->tpgid)
+		pe->stat[n++] = '+';
+	pe->stat[n] = '\0';
+	return TRUE;
+}
+
+/* the arguments with control characters as spaces, and other bytes ps
+ * would not print in this locale as ?, or [comm]; FALSE if it is gone */
+int
+np_proc_scan_args (np_proc_scan *scan, np_proc_entry *pe)
+{
+	ssize_t len, i;
+
+	if ((len = proc_read (scan, scan->pid, "cmdline")) < 0)
+		return FALSE;
+	while (len > 0 && scan->buf[len - 1] == '\0')
+		len--;
+	if ((size_t) len + sizeof (scan->comm) + 12 > scan->args_size) {
+		scan->args_size = len + sizeof (scan->comm) + 12;
+		if ((scan->args = realloc (scan->args, scan->args_size)) == NULL)
+			die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	}
+	if (len == 0)
+		snprintf (scan->args, scan->args_size, scan->state == 'Z' ? "[%s] <defunct>" : "[%s]", scan->comm);
+	else {
+		for (i = 0; i < len; i++)
+			scan->args[i] = (unsigned char) scan->buf[i] < ' ' || scan->buf[i] == 0x7f ? ' ' :
+			                (unsigned char) scan->buf[i] > 0x7f && scan->ascii ? '?' : scan->buf[i];
+		scan->args[len] = '\0';
+	}
+	pe->args = scan->args;
+	return TRUE;
+}
+
+/* ps's CGROUP column, which leaves out the root cgroup, or is - */
+void
+np_proc_scan_cgroup (np_proc_scan *scan, np_proc_entry *pe)
+{
+	char *line, *end;
+	size_t n = 0;
+
+	pe->cgroup = scan->cgroup;
+	strcpy (scan->cgroup, "-");
+	if (proc_read (scan, scan->pid, "cgroup") <= 0)
+		return;
+	for (line = strtok (scan->buf, "\n"); line; line = strtok (NULL, "\n")) {
+		if ((end = strrchr (line, ':')) == NULL || !strcmp (end, ":/"))
+			continue;
+		n += snprintf (scan->cgroup + n, sizeof (scan->cgroup) - n, "%s%s", n ? "," : "", line);
+		if (n >= sizeof (scan->cgroup))
+			break;
+	}
+}
+
+void
+np_proc_scan_close (np_proc_scan *scan)
+{
+	closedir (scan->dir);
+	free (scan->buf);
+	free (scan->args);
+}
+
+/* The CPU time the processes had used at one scan, to take a rate over
+ * the interval up to the next one rather than the average over their
+ * lifetime that ps shows. Only processes that have used any are kept,
+ * sorted by pid, so one missing from a complete sample had used none;
+ * this keeps the records to a few per host for kernel threads and idle
+ * daemons, and a reused pid is told by its start time */
+static int
+proc_cpu_compare (const void *a, const void *b)
+{
+	const np_proc_cpu_record *x = a, *y = b;
+
+	return x->pid < y->pid ? -1 : x->pid > y->pid;
+}
+
+/* the sample of the last run from path, if there is a usable one */
+void
+np_proc_cpu_load (np_proc_cpu *cpu, const char *path)
+{
+	struct stat st;
+	size_t len;
+	FILE *fp;
+
+	memset (cpu, 0, sizeof (*cpu));
+	if ((fp = fopen (path, "r")) == NULL)
+		return;
+	if (fstat (fileno (fp), &st) == 0 && fread (&cpu->last, sizeof (cpu->last), 1, fp) == 1 &&
+	    !memcmp (cpu->last.magic, NP_PROC_CPU_MAGIC, sizeof (cpu->last.magic)) &&
+	    (size_t) st.st_size == sizeof (cpu->last) + cpu->last.count * sizeof (*cpu->old)) {
+		len = cpu->last.count;
+		if ((cpu->old = malloc (len * sizeof (*cpu->old) + 1)) == NULL)
+			die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+		cpu->have_old = fread (cpu->old, sizeof (*cpu->old), len, fp) == len;
+	}
+	fclose (fp);
+}
+
+/* the start of a scan: whether what was loaded can be compared with it */
+void
+np_proc_cpu_begin (np_proc_cpu *cpu, np_proc_scan *scan)
+{
+	np_proc_stat st;
+
+	memset (&cpu->now, 0, sizeof (cpu->now));
+	memcpy (cpu->now.magic, NP_PROC_CPU_MAGIC, sizeof (cpu->now.magic));
+	cpu->now.hz = scan->hz;
+	cpu->now.uptime_ms = scan->uptime_ms;
+	cpu->now.boot = np_proc_stat_read (&st) && st.btime ? (int64_t) st.btime : (int64_t) time (NULL) - (int64_t) scan->uptime;
+	cpu->count = 0;
+	cpu->sorted = TRUE;
+
+	/* a sample from before the last boot, or one taken in the same
+	 * millisecond, has nothing to compare */
+	if (cpu->have_old && (cpu->last.hz != cpu->now.hz || cpu->last.uptime_ms >= cpu->now.uptime_ms ||
+	    cpu->last.boot - cpu->now.boot > 2 || cpu->now.boot - cpu->last.boot > 2))
+		cpu->have_old = FALSE;
+}
+
+/* record the process' CPU time and, if there was a sample before, set its
+ * %CPU to that since then */
+void
+np_proc_cpu_update (np_proc_cpu *cpu, np_proc_entry *pe)
+{
+	np_proc_cpu_record key, *r;
+	unsigned long long start_ms, interval;
+	uint32_t delta;
+
+	if (pe->ticks > 0) {
+		if (cpu->count == cpu->size) {
+			cpu->size = cpu->size ? cpu->size * 2 : 1024;
+			if ((cpu->records = realloc (cpu->records, cpu->size * sizeof (*cpu->records))) == NULL)
+				die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+		}
+		r = &cpu->records[cpu->count++];
+		r->pid = pe->pid;
+		r->start = (uint32_t) pe->start;
+		r->ticks = (uint32_t) pe->ticks;
+		if (cpu->count > 1 && r[-1].pid >= r->pid)
+			cpu->sorted = FALSE;
+	}
+	if (!cpu->have_old)
+		return;
+
+	start_ms = pe->start * 1000 / cpu->now.hz;
+	if (start_ms >= cpu->last.uptime_ms) {
+		/* started since */
+		interval = cpu->now.uptime_ms > start_ms ? cpu->now.uptime_ms - start_ms : 0;
+		delta = (uint32_t) pe->ticks;
+	} else {
+		interval = cpu->now.uptime_ms - cpu->last.uptime_ms;
+		key.pid = pe->pid;
+		r = bsearch (&key, cpu->old, cpu->last.count, sizeof (*cpu->old), proc_cpu_compare);
+		delta = (uint32_t) pe->ticks - (r && r->start == (uint32_t) pe->start ? r->ticks : 0);
+	}
+	pe->pcpu = interval ? (delta * 1000000ULL / cpu->now.hz / interval) / 10.0 : 0;
+}
+
+/* this scan's sample as the one to compare the next with, in this run */
+void
+np_proc_cpu_next (np_proc_cpu *cpu)
+{
+	if (!cpu->sorted)
+		qsort (cpu->records, cpu->count, sizeof (*cpu->records), proc_cpu_compare);
+	free (cpu->old);
+	cpu->old = cpu->records;
+	cpu->last = cpu->now;
+	cpu->last.count = cpu->count;
+	cpu->have_old = TRUE;
+	cpu->records = NULL;
+	cpu->count = cpu->size = 0;
+}
+
+/* this scan's sample for the next run */
+int
+np_proc_cpu_save (np_proc_cpu *cpu, const char *path)
+{
+	char *tmp;
+	int fd, ok = FALSE;
+	size_t len;
+
+	np_proc_cpu_next (cpu);
+	len = cpu->last.count * sizeof (*cpu->old);
+	if (asprintf (&tmp, "%s.XXXXXX", path) < 0)
+		return FALSE;
+	if ((fd = mkstemp (tmp)) >= 0) {
+		ok = write (fd, &cpu->last, sizeof (cpu->last)) == sizeof (cpu->last) &&
+		     write (fd, cpu->old, len) == (ssize_t) len &&
+		     fchmod (fd, S_IRUSR | S_IWUSR | S_IRGRP) == 0;
+		ok = close (fd) == 0 && ok;
+		ok = ok && rename (tmp, path) == 0;
+		if (!ok)
+			unlink (tmp);
+	}
+	free (tmp);
+	return ok;
+}
+
+void
+np_proc_cpu_free (np_proc_cpu *cpu)
+{
+	free (cpu->old);
+	free (cpu->records);
+	memset (cpu, 0, sizeof (*cpu));
+}
+
+/* The snapshot: its header, a record for each process and then their
+ * arguments and cgroups, each string nul terminated */
+struct proc_snapshot_build {
+	np_proc_snapshot_header header;
+	np_proc_snapshot_record *records;
+	size_t size;
+	char *text;
+	size_t text_size;
+};
+
+static uint32_t
+proc_snapshot_string (struct proc_snapshot_build *b, const char *s)
+{
+	size_t len = strlen (s) + 1;
+	uint32_t offset = b->header.text;
+
+	while (b->header.text + len > b->text_size) {
+		b->text_size = b->text_size ? b->text_size * 2 : 65536;
+		if ((b->text = realloc (b->text, b->text_size)) == NULL)
+			die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	}
+	memcpy (b->text + offset, s, len);
+	b->header.text += len;
+	return offset;
+}
+
+/* the users logged in as check_users counts them, or -1 */
+static int
+proc_snapshot_users (void)
+{
+#if HAVE_UTMPX_H
+	struct utmpx *ut;
+	int users = 0;
+
+	setutxent ();
+	while ((ut = getutxent ()) != NULL)
+		if (ut->ut_type == USER_PROCESS)
+			users++;
+	endutxent ();
+	return users;
+#else
+	return -1;
+#endif
+}
+
+/* Take a snapshot now and store it at path. The process taking it and its
+ * parent (the shell or daemon that runs it) are left out: by the time the
+ * others read it, they are gone. */
+static int
+proc_snapshot_take (const char *path)
+{
+	struct proc_snapshot_build b;
+	np_proc_snapshot_record *r;
+	np_proc_scan scan;
+	np_proc_entry pe;
+	pid_t self = getpid (), parent = getppid ();
+	char *tmp;
+	int fd, ok = FALSE;
+	size_t len;
+
+	memset (&b, 0, sizeof (b));
+	memcpy (b.header.magic, NP_PROC_SNAPSHOT_MAGIC, sizeof (b.header.magic));
+	b.header.time = (int64_t) time (NULL);
+	if (np_proc_loadavg (b.header.load))
+		b.header.have |= NP_PROC_SNAPSHOT_LOADAVG;
+	if (np_proc_meminfo_read (&b.header.meminfo))
+		b.header.have |= NP_PROC_SNAPSHOT_MEMINFO;
+	if ((b.header.users = proc_snapshot_users ()) >= 0)
+		b.header.have |= NP_PROC_SNAPSHOT_USERS;
+
+	if (np_proc_scan_open (&scan)) {
+		while (np_proc_scan_next (&scan, &pe)) {
+			if (pe.pid == self || pe.pid == parent ||
+			    !np_proc_scan_status (&scan, &pe) || !np_proc_scan_args (&scan, &pe))
+				continue;
+			np_proc_scan_cgroup (&scan, &pe);
+			if (b.header.procs == b.size) {
+				b.size = b.size ? b.size * 2 : 1024;
+				if ((b.records = realloc (b.records, b.size * sizeof (*b.records))) == NULL)
+					die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+			}
+			r = &b.records[b.header.procs++];
+			memset (r, 0, sizeof (*r));
+			r->uid = pe.uid;
+			r->pid = pe.pid;
+			r->ppid = pe.ppid;
+			r->vsz = pe.vsz;
+			r->rss = pe.rss;
+			r->seconds = pe.seconds;
+			r->pcpu = pe.pcpu;
+			memcpy (r->stat, pe.stat, sizeof (r->stat) - 1);
+			memcpy (r->prog, pe.prog, sizeof (r->prog) - 1);
+			r->args = proc_snapshot_string (&b, pe.args);
+			r->cgroup = proc_snapshot_string (&b, pe.cgroup);
+		}
+		np_proc_scan_close (&scan);
+		b.header.have |= NP_PROC_SNAPSHOT_PROCS;
+	}
+
+	len = b.header.procs * sizeof (*b.records);
+	if (asprintf (&tmp, "%s.XXXXXX", path) >= 0) {
+		if ((fd = mkstemp (tmp)) >= 0) {
+			ok = write (fd, &b.header, sizeof (b.header)) == sizeof (b.header) &&
+			     write (fd, b.records, len) == (ssize_t) len &&
+			     write (fd, b.text, b.header.text) == (ssize_t) b.header.text &&
+			     fchmod (fd, S_IRUSR | S_IWUSR) == 0;
+			ok = close (fd) == 0 && ok;
+			ok = ok && rename (tmp, path) == 0;
+			if (!ok)
+				unlink (tmp);
+		}
+		free (tmp);
+	}
+	free (b.records);
+	free (b.text);
+	return ok;
+}
+
+/* map the snapshot at path if it is a whole one, at most max_age old */
+static int
+proc_snapshot_map (np_proc_snapshot *snap, const char *path, unsigned int max_age)
+{
+#ifdef HAVE_SYS_MMAN_H
+	const np_proc_snapshot_header *h;
+	struct stat st;
+	time_t now = time (NULL);
+	void *map;
+	int fd;
+
+	if ((fd = open (path, O_RDONLY)) < 0)
+		return FALSE;
+	if (fstat (fd, &st) < 0 || (size_t) st.st_size < sizeof (*h) ||
+	    (map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close (fd);
+		return FALSE;
+	}
+	close (fd);
+	h = map;
+	if (memcmp (h->magic, NP_PROC_SNAPSHOT_MAGIC, sizeof (h->magic)) ||
+	    h->time > (int64_t) now || (int64_t) now - h->time > (int64_t) max_age ||
+	    (size_t) st.st_size != sizeof (*h) + (size_t) h->procs * sizeof (np_proc_snapshot_record) + h->text ||
+	    (h->text && ((const char *) map)[st.st_size - 1] != '\0')) {
+		munmap (map, st.st_size);
+		return FALSE;
+	}
+	snap->map = map;
+	snap->size = st.st_size;
+	snap->header = h;
+	snap->records = (const np_proc_snapshot_record *) (h + 1);
+	snap->text = (const char *) (snap->records + h->procs);
+	snap->next = 0;
+	snap->age = (long) (now - h->time);
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+char *
+np_proc_snapshot_path (void)
+{
+	char *dir, *path;
+
+	if (asprintf (&dir, "%s/%lu", _np_state_calculate_location_prefix (), (unsigned long) geteuid ()) < 0)
+		return NULL;
+	/* the directory of the state files, if no plugin has made it yet */
+	if (access (dir, F_OK))
+		mkdir (dir, S_IRWXU);
+	if (asprintf (&path, "%s/snapshot", dir) < 0)
+		path = NULL;
+	free (dir);
+	return path;
+}
+
+int
+np_proc_snapshot_open (np_proc_snapshot *snap, const char *path, unsigned int max_age)
+{
+	char *lock_path, *default_path = NULL;
+	int lock = -1, ok;
+
+	memset (snap, 0, sizeof (*snap));
+	if (path == NULL && (path = default_path = np_proc_snapshot_path ()) == NULL)
+		return FALSE;
+	if (proc_snapshot_map (snap, path, max_age)) {
+		free (default_path);
+		return TRUE;
+	}
+
+	/* whoever holds the lock is taking one */
+	if (asprintf (&lock_path, "%s.lock", path) >= 0) {
+		lock = np_cache_lock (lock_path);
+		free (lock_path);
+	}
+	ok = proc_snapshot_map (snap, path, max_age) ||
+	     (proc_snapshot_take (path) && proc_snapshot_map (snap, path, max_age));
+	if (lock >= 0)
+		close (lock);
+	free (default_path);
+	return ok;
+}
+
+int
+np_proc_snapshot_next (np_proc_snapshot *snap, np_proc_entry *pe)
+{
+	const np_proc_snapshot_record *r;
+
+	if (snap->header == NULL || snap->next >= snap->header->procs)
+		return FALSE;
+	r = &snap->records[snap->next++];
+	memset (pe, 0, sizeof (*pe));
+	pe->uid = r->uid;
+	pe->pid = r->pid;
+	pe->ppid = r->ppid;
+	pe->vsz = r->vsz;
+	pe->rss = r->rss;
+	pe->pcpu = r->pcpu;
+	pe->seconds = r->seconds + snap->age;
+	memcpy (pe->stat, r->stat, sizeof (pe->stat) - 1);
+	memcpy (pe->prog, r->prog, sizeof (pe->prog) - 1);
+	pe->args = (char *) (r->args < snap->header->text ? snap->text + r->args : "");
+	pe->cgroup = (char *) (r->cgroup < snap->header->text ? snap->text + r->cgroup : "-");
+	return TRUE;
+}
+
+void
+np_proc_snapshot_close (np_proc_snapshot *snap)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (snap->map)
+		munmap (snap->map, snap->size);
+#endif
+	memset (snap, 0, sizeof (*snap));
+}
+
+/* The process table of a resident worker. The entries are in the order
+ * /proc lists them, those started since at the end, and found by pid
+ * through an open addressing index; a deleted slot stays taken (as
+ * UINT32_MAX) until the index is built again */
+#define PROC_TABLE_DELETED UINT32_MAX
+
+void
+np_proc_table_init (np_proc_table *t)
+{
+	memset (t, 0, sizeof (*t));
+	t->fd = -1;
+}
+
+static size_t
+proc_table_slot (const np_proc_table *t, pid_t pid)
+{
+	return ((uint32_t) pid * 2654435761U) & (t->index_size - 1);
+}
+
+static np_proc_table_entry *
+proc_table_find (const np_proc_table *t, pid_t pid)
+{
+	size_t i;
+	uint32_t e;
+
+	if (t->index_size == 0)
+		return NULL;
+	for (i = proc_table_slot (t, pid); (e = t->index[i]) != 0; i = (i + 1) & (t->index_size - 1))
+		if (e != PROC_TABLE_DELETED && t->entries[e - 1].pe.pid == pid)
+			return &t->entries[e - 1];
+	return NULL;
+}
+
+static void
+proc_table_index_put (np_proc_table *t, size_t n)
+{
+	size_t i;
+
+	for (i = proc_table_slot (t, t->entries[n].pe.pid); t->index[i] != 0; i = (i + 1) & (t->index_size - 1))
+		;
+	t->index[i] = n + 1;
+	t->index_used++;
+}
+
+/* the index built again, at most half full once there is room for one
+ * more entry */
+static void
+proc_table_index_build (np_proc_table *t)
+{
+	size_t n;
+
+	while (t->index_size < (t->count + 1) * 2 + 16)
+		t->index_size = t->index_size ? t->index_size * 2 : 1024;
+	free (t->index);
+	if ((t->index = calloc (t->index_size, sizeof (*t->index))) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	t->index_used = 0;
+	for (n = 0; n < t->count; n++)
+		proc_table_index_put (t, n);
+}
+
+/* the slot of the index that points at entry n */
+static uint32_t *
+proc_table_index_of (np_proc_table *t, size_t n)
+{
+	size_t i;
+
+	for (i = proc_table_slot (t, t->entries[n].pe.pid); t->index[i] != n + 1; i = (i + 1) & (t->index_size - 1))
+		;
+	return &t->index[i];
+}
+
+static char *
+proc_table_strdup (const char *s)
+{
+	char *copy;
+
+	if ((copy = strdup (s)) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	return copy;
+}
+
+/* pe, just read, in place of what the table had for its pid */
+static void
+proc_table_store (np_proc_table *t, const np_proc_entry *pe)
+{
+	np_proc_table_entry *te;
+
+	if ((te = proc_table_find (t, pe->pid)) != NULL) {
+		free (te->pe.args);
+		free (te->pe.cgroup);
+	} else {
+		if (t->count == t->size) {
+			t->size = t->size ? t->size * 2 : 1024;
+			if ((t->entries = realloc (t->entries, t->size * sizeof (*t->entries))) == NULL)
+				die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+		}
+		te = &t->entries[t->count++];
+		te->pe.pid = pe->pid;
+		if ((t->index_used + 1) * 2 > t->index_size)
+			proc_table_index_build (t);
+		else
+			proc_table_index_put (t, t->count - 1);
+	}
+	te->pe = *pe;
+	te->pe.args = proc_table_strdup (pe->args);
+	te->pe.cgroup = proc_table_strdup (pe->cgroup);
+}
+
+/* the entry dropped, the last one moved into its place */
+static void
+proc_table_remove (np_proc_table *t, np_proc_table_entry *te)
+{
+	size_t n = te - t->entries, last = t->count - 1;
+
+	free (te->pe.args);
+	free (te->pe.cgroup);
+	*proc_table_index_of (t, n) = PROC_TABLE_DELETED;
+	if (n != last) {
+		*proc_table_index_of (t, last) = n + 1;
+		*te = t->entries[last];
+	}
+	t->count--;
+}
+
+/* all of the process of pid, as a scan with every field would read it;
+ * FALSE if it is gone */
+static int
+proc_table_read (np_proc_table *t, pid_t pid, np_proc_entry *pe)
+{
+	t->reads++;
+	if (!np_proc_scan_pid (&t->scan, pid, pe) || !np_proc_scan_status (&t->scan, pe) ||
+	    !np_proc_scan_args (&t->scan, pe))
+		return FALSE;
+	np_proc_scan_cgroup (&t->scan, pe);
+	return TRUE;
+}
+
+static void
+proc_table_clear (np_proc_table *t)
+{
+	size_t n;
+
+	for (n = 0; n < t->count; n++) {
+		free (t->entries[n].pe.args);
+		free (t->entries[n].pe.cgroup);
+	}
+	t->count = 0;
+	t->nchanged = 0;
+	if (t->index)
+		memset (t->index, 0, t->index_size * sizeof (*t->index));
+	t->index_used = 0;
+}
+
+/* all of /proc again */
+static void
+proc_table_rescan (np_proc_table *t, time_t now)
+{
+	np_proc_entry pe;
+
+	proc_table_clear (t);
+	while (np_proc_scan_next (&t->scan, &pe)) {
+		t->reads++;
+		if (np_proc_scan_status (&t->scan, &pe) && np_proc_scan_args (&t->scan, &pe)) {
+			np_proc_scan_cgroup (&t->scan, &pe);
+			proc_table_store (t, &pe);
+		}
+	}
+	t->scanned = now;
+	t->lost = FALSE;
+}
+
+static int
+proc_table_pid_compare (const void *a, const void *b)
+{
+	pid_t x = *(const pid_t *) a, y = *(const pid_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* the processes of the changed pids read again, each once. Those found
+ * gone are added to gone, if it is not NULL, to look for their children:
+ * a process that is reparented is not told of */
+static void
+proc_table_apply (np_proc_table *t, pid_t **gone, size_t *ngone)
+{
+	np_proc_table_entry *te;
+	np_proc_entry pe;
+	size_t i, n = t->nchanged;
+
+	qsort (t->changed, n, sizeof (*t->changed), proc_table_pid_compare);
+	t->nchanged = 0;
+	for (i = 0; i < n; i++) {
+		if (i && t->changed[i] == t->changed[i - 1])
+			continue;
+		if (proc_table_read (t, t->changed[i], &pe))
+			proc_table_store (t, &pe);
+		else if ((te = proc_table_find (t, t->changed[i])) != NULL) {
+			proc_table_remove (t, te);
+			if (gone) {
+				if ((*gone = realloc (*gone, (*ngone + 1) * sizeof (**gone))) == NULL)
+					die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+				(*gone)[(*ngone)++] = t->changed[i];
+			}
+		}
+	}
+}
+
+/* the processes events named read again, with the zombies, whose reaping
+ * no event tells of, and the children of those that are gone */
+static void
+proc_table_refresh (np_proc_table *t)
+{
+	pid_t *gone = NULL;
+	size_t ngone = 0, n;
+
+	for (n = 0; n < t->count; n++)
+		if (t->entries[n].pe.stat[0] == 'Z')
+			np_proc_table_touch (t, t->entries[n].pe.pid);
+	proc_table_apply (t, &gone, &ngone);
+	if (ngone == 0)
+		return;
+	qsort (gone, ngone, sizeof (*gone), proc_table_pid_compare);
+	for (n = 0; n < t->count; n++)
+		if (bsearch (&t->entries[n].pe.ppid, gone, ngone, sizeof (*gone), proc_table_pid_compare))
+			np_proc_table_touch (t, t->entries[n].pe.pid);
+	proc_table_apply (t, NULL, NULL);
+	free (gone);
+}
+
+void
+np_proc_table_touch (np_proc_table *t, pid_t pid)
+{
+	if (t->nchanged == t->changed_size) {
+		t->changed_size = t->changed_size ? t->changed_size * 2 : 256;
+		if ((t->changed = realloc (t->changed, t->changed_size * sizeof (*t->changed))) == NULL)
+			die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	}
+	t->changed[t->nchanged++] = pid;
+}
+
+#ifdef HAVE_LINUX_CN_PROC_H
+int
+np_proc_table_listen (np_proc_table *t)
+{
+	struct sockaddr_nl sa;
+	struct nlmsghdr *nl;
+	struct cn_msg *cn;
+	enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+	char buf[NLMSG_SPACE (sizeof (struct cn_msg) + sizeof (op))] __attribute__ ((aligned (NLMSG_ALIGNTO)));
+	int size = 4 * 1024 * 1024;
+
+	if (t->fd >= 0)
+		return TRUE;
+	if ((t->fd = socket (PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR)) < 0)
+		return FALSE;
+	memset (&sa, 0, sizeof (sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = CN_IDX_PROC;
+	memset (buf, 0, sizeof (buf));
+	nl = (struct nlmsghdr *) buf;
+	nl->nlmsg_len = NLMSG_LENGTH (sizeof (struct cn_msg) + sizeof (op));
+	nl->nlmsg_type = NLMSG_DONE;
+	cn = NLMSG_DATA (nl);
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len = sizeof (op);
+	memcpy (cn->data, &op, sizeof (op));
+	if (bind (t->fd, (struct sockaddr *) &sa, sizeof (sa)) < 0 ||
+	    send (t->fd, buf, nl->nlmsg_len, 0) != (ssize_t) nl->nlmsg_len) {
+		close (t->fd);
+		t->fd = -1;
+		return FALSE;
+	}
+	/* room for the events of a busy host between two checks */
+	if (setsockopt (t->fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof (size)) < 0)
+		setsockopt (t->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+	t->listening = TRUE;
+	t->lost = TRUE;
+	return TRUE;
+}
+
+/* the pids of the events queued on the connector, or lost set if some
+ * did not fit */
+static void
+proc_table_drain (np_proc_table *t)
+{
+	char buf[16384] __attribute__ ((aligned (NLMSG_ALIGNTO)));
+	struct nlmsghdr *nl;
+	struct cn_msg *cn;
+	struct proc_event *ev;
+	ssize_t n;
+	int len;
+	pid_t pid;
+
+	if (t->fd < 0)
+		return;
+	for (;;) {
+		if ((n = recv (t->fd, buf, sizeof (buf), 0)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				t->lost = TRUE;
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				/* no more events: a scan at each update */
+				close (t->fd);
+				t->fd = -1;
+				t->listening = FALSE;
+			}
+			return;
+		}
+		len = (int) n;
+		for (nl = (struct nlmsghdr *) buf; NLMSG_OK (nl, len); nl = NLMSG_NEXT (nl, len)) {
+			if (nl->nlmsg_type == NLMSG_ERROR || nl->nlmsg_type == NLMSG_OVERRUN) {
+				t->lost = TRUE;
+				continue;
+			}
+			cn = NLMSG_DATA (nl);
+			if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC)
+				continue;
+			ev = (struct proc_event *) cn->data;
+			/* the events of threads other than the first are left out */
+			switch (ev->what) {
+			case PROC_EVENT_FORK:
+				if (ev->event_data.fork.child_pid != ev->event_data.fork.child_tgid)
+					continue;
+				pid = ev->event_data.fork.child_tgid;
+				break;
+			case PROC_EVENT_EXEC:
+				pid = ev->event_data.exec.process_tgid;
+				break;
+			case PROC_EVENT_UID:
+			case PROC_EVENT_GID:
+				pid = ev->event_data.id.process_tgid;
+				break;
+			case PROC_EVENT_SID:
+				pid = ev->event_data.sid.process_tgid;
+				break;
+			case PROC_EVENT_COMM:
+				pid = ev->event_data.comm.process_tgid;
+				break;
+			case PROC_EVENT_EXIT:
+				if (ev->event_data.exit.process_pid != ev->event_data.exit.process_tgid)
+					continue;
+				pid = ev->event_data.exit.process_tgid;
+				break;
+			default:
+				continue;
+			}
+			np_proc_table_touch (t, pid);
+		}
+	}
+}
+#else
+int
+np_proc_table_listen (np_proc_table *t)
+{
+	return FALSE;
+}
+
+static void
+proc_table_drain (np_proc_table *t)
+{
+}
+#endif
+
+int
+np_proc_table_update (np_proc_table *t)
+{
+	time_t now = time (NULL);
+	size_t n;
+	unsigned long long start;
+
+	np_proc_table_done (t);
+	if (!(t->scanning = np_proc_scan_open (&t->scan)))
+		return FALSE;
+	t->reads = 0;
+	proc_table_drain (t);
+	t->rescanned = !t->listening || t->lost || t->scanned == 0 ||
+	               now < t->scanned || now - t->scanned >= NP_PROC_TABLE_RESYNC;
+	if (t->rescanned) {
+		proc_table_rescan (t, now);
+		return TRUE;
+	}
+	proc_table_refresh (t);
+
+	/* how long those not read again have been running, as of now */
+	for (n = 0; n < t->count; n++) {
+		start = t->entries[n].pe.start / t->scan.hz;
+		t->entries[n].pe.seconds = t->scan.uptime > start ? t->scan.uptime - start : 0;
+	}
+	return TRUE;
+}
+
+int
+np_proc_table_live (np_proc_table *t, np_proc_table_entry *te)
+{
+	np_proc_entry pe;
+
+	t->reads++;
+	if (!t->scanning || !np_proc_scan_pid (&t->scan, te->pe.pid, &pe) || pe.start != te->pe.start ||
+	    !np_proc_scan_status (&t->scan, &pe)) {
+		np_proc_table_touch (t, te->pe.pid);
+		return FALSE;
+	}
+	te->pe.uid = pe.uid;
+	te->pe.vsz = pe.vsz;
+	te->pe.rss = pe.rss;
+	te->pe.pcpu = pe.pcpu;
+	te->pe.seconds = pe.seconds;
+	te->pe.ticks = pe.ticks;
+	memcpy (te->pe.stat, pe.stat, sizeof (te->pe.stat));
+	return TRUE;
+}
+
+void
+np_proc_table_done (np_proc_table *t)
+{
+	if (t->scanning)
+		np_proc_scan_close (&t->scan);
+	t->scanning = FALSE;
+}
+
+void
+np_proc_table_free (np_proc_table *t)
+{
+	proc_table_clear (t);
+	np_proc_table_done (t);
+	if (t->fd >= 0)
+		close (t->fd);
+	free (t->entries);
+	free (t->index);
+	free (t->changed);
+	np_proc_table_init (t);
+}
@@ -0,0 +1,314 @@
+#ifndef NAGIOS_UTILS_PROC_H_INCLUDED
+#define NAGIOS_UTILS_PROC_H_INCLUDED
+/* Header file for nagios plugins utils_proc.c */
+
+/* Readers for the Linux /proc files the plugins look at, so that they do
+ * not have to run uptime, ps or swapinfo for what the kernel has there.
+ * Each system file is read with one pread() into a buffer of the
+ * library's and parsed where it is, so the readers allocate nothing.
+ * They return FALSE where the file cannot be read or parsed, e.g. on
+ * other systems, for the plugin to fall back on what it did before.
+ *
+ * The process table is read one pid directory at a time by np_proc_scan,
+ * and np_proc_cpu keeps CPU times from one scan to the next, in memory or
+ * in a state file, to give the %CPU over that interval. */
+
+#include <dirent.h>
+
+/* the largest system file read; /proc/stat on a host with many CPUs and
+ * interrupts can have more, the lines past it are not seen */
+#define NP_PROC_BUFSIZE 65536
+
+#define NP_PROC_MAX_SWAPS 32
+
+/* where the files are read from, /proc unless a test gives another */
+void np_proc_set_root (const char *root);
+
+int np_proc_loadavg (double load[3]);
+int np_proc_uptime (double *uptime);
+
+/* in kB, 0 for the fields the kernel does not have */
+typedef struct np_proc_meminfo {
+	unsigned long long mem_total;
+	unsigned long long mem_free;
+	unsigned long long mem_available;
+	unsigned long long buffers;
+	unsigned long long cached;
+	unsigned long long swap_cached;
+	unsigned long long swap_total;
+	unsigned long long swap_free;
+} np_proc_meminfo;
+
+int np_proc_meminfo_read (np_proc_meminfo *);
+
+/* A swap area of /proc/swaps, sizes in kB */
+typedef struct np_proc_swap {
+	char name[256];
+	char type[16];
+	unsigned long long size;
+	unsigned long long used;
+	int priority;
+} np_proc_swap;
+
+/* Up to max swap areas into swaps; their number, or -1 */
+int np_proc_swaps (np_proc_swap *swaps, int max);
+
+/* /proc/pressure/<resource>: the share of time some (or all, for full)
+ * tasks were stalled, over 10, 60 and 300 seconds, and the total in us */
+typedef struct np_proc_pressure {
+	double some_avg10, some_avg60, some_avg300;
+	unsigned long long some_total;
+	int has_full; /* the cpu resource has no full line before Linux 5.13 */
+	double full_avg10, full_avg60, full_avg300;
+	unsigned long long full_total;
+} np_proc_pressure;
+
+int np_proc_pressure_read (const char *resource, np_proc_pressure *);
+
+/* The ticks of the cpu line of /proc/stat, and the counters after it */
+#define NP_PROC_CPU_USER 0
+#define NP_PROC_CPU_NICE 1
+#define NP_PROC_CPU_SYSTEM 2
+#define NP_PROC_CPU_IDLE 3
+#define NP_PROC_CPU_IOWAIT 4
+#define NP_PROC_CPU_IRQ 5
+#define NP_PROC_CPU_SOFTIRQ 6
+#define NP_PROC_CPU_STEAL 7
+#define NP_PROC_CPU_STATES 8
+
+typedef struct np_proc_stat {
+	unsigned long long cpu[NP_PROC_CPU_STATES];
+	int cpus; /* the cpuN lines */
+	unsigned long long ctxt;
+	unsigned long long processes; /* forks since boot */
+	long btime;
+	int procs_running;
+	int procs_blocked;
+} np_proc_stat;
+
+int np_proc_stat_read (np_proc_stat *);
+
+/* Counters of /proc/vmstat since boot: pages swapped in and out, and
+ * major page faults */
+typedef struct np_proc_vmstat {
+	unsigned long long pswpin;
+	unsigned long long pswpout;
+	unsigned long long pgmajfault;
+} np_proc_vmstat;
+
+/* FALSE without the swap counters */
+int np_proc_vmstat_read (np_proc_vmstat *);
+
+/* A process as ps would show it in check_procs' PS_COMMAND columns */
+typedef struct np_proc_entry {
+	int uid;
+	pid_t pid;
+	pid_t ppid;
+	int vsz;
+	int rss;
+	float pcpu;
+	int seconds;
+	unsigned long long start; /* in ticks since boot */
+	unsigned long long ticks; /* utime + stime */
+	char stat[8];
+	char prog[16];
+	char *args;
+	char *cgroup;
+} np_proc_entry;
+
+/* Reads the process table, one pid directory at a time, into buffers
+ * that are kept from one process to the next */
+typedef struct np_proc_scan {
+	DIR *dir;
+	int fd;
+	long hz;
+	long pagesize;
+	unsigned long long uptime;
+	unsigned long long uptime_ms;
+	int ascii;
+	char *buf;
+	size_t size;
+	char *args;
+	size_t args_size;
+	/* the current process, from its stat file */
+	char pid[16];
+	char comm[64];
+	char state;
+	int pgrp, session, tpgid;
+	long nice, threads;
+	char cgroup[257];
+} np_proc_scan;
+
+int np_proc_scan_open (np_proc_scan *);
+/* The next process from its stat file, or FALSE at the end of the table;
+ * the rest is read by np_proc_scan_status(), _args() and _cgroup() only
+ * for the processes that still need it */
+int np_proc_scan_next (np_proc_scan *, np_proc_entry *);
+/* the one process of pid as np_proc_scan_next() reads it, without going
+ * through the table; FALSE if there is none */
+int np_proc_scan_pid (np_proc_scan *, pid_t, np_proc_entry *);
+/* the effective uid, the resident size as procps shows it and the flags
+ * of ps's STAT column, or FALSE if the process is gone */
+int np_proc_scan_status (np_proc_scan *, np_proc_entry *);
+/* the arguments as ps shows them, or FALSE if the process is gone */
+int np_proc_scan_args (np_proc_scan *, np_proc_entry *);
+/* ps's CGROUP column, which leaves out the root cgroup, or - */
+void np_proc_scan_cgroup (np_proc_scan *, np_proc_entry *);
+void np_proc_scan_close (np_proc_scan *);
+
+/* The CPU time the processes had used at one scan, to take a rate over
+ * the interval up to the next one rather than the average over their
+ * lifetime that ps shows */
+#define NP_PROC_CPU_MAGIC "NPCPU\0\0\1"
+
+typedef struct np_proc_cpu_header {
+	char magic[8];
+	uint32_t count;
+	uint32_t hz;
+	uint64_t uptime_ms;
+	int64_t boot;
+} np_proc_cpu_header;
+
+typedef struct np_proc_cpu_record {
+	uint32_t pid;
+	uint32_t start; /* low bits of the start time in ticks */
+	uint32_t ticks; /* utime + stime, modulo 2^32 */
+} np_proc_cpu_record;
+
+typedef struct np_proc_cpu {
+	np_proc_cpu_header last; /* of the sample before */
+	np_proc_cpu_record *old;
+	int have_old;
+	np_proc_cpu_header now;
+	np_proc_cpu_record *records; /* of this scan */
+	size_t count;
+	size_t size;
+	int sorted;
+} np_proc_cpu;
+
+/* the sample of an earlier run from path, if there is a usable one */
+void np_proc_cpu_load (np_proc_cpu *, const char *path);
+/* the start of a scan, after np_proc_scan_open() */
+void np_proc_cpu_begin (np_proc_cpu *, np_proc_scan *);
+/* records the process' CPU time and, if there was a sample before, sets
+ * its %CPU to that since then */
+void np_proc_cpu_update (np_proc_cpu *, np_proc_entry *);
+/* this scan's sample as the one to compare the next with, in this run */
+void np_proc_cpu_next (np_proc_cpu *);
+/* this scan's sample for the next run; FALSE if it cannot be written */
+int np_proc_cpu_save (np_proc_cpu *, const char *path);
+void np_proc_cpu_free (np_proc_cpu *);
+
+/* A snapshot of what the local checks of a host read - the load average,
+ * /proc/meminfo, the users logged in and the process table - taken by the
+ * first of them to run and shared by the others while it is fresh, so
+ * that they scan the system once between them rather than once each. It
+ * is one file under the state directory, written whole to a temporary
+ * file and renamed over the last one, and mapped read-only by readers. */
+#define NP_PROC_SNAPSHOT_MAGIC "NPSNAP\0\1"
+
+/* the parts a snapshot has */
+#define NP_PROC_SNAPSHOT_LOADAVG 0x01
+#define NP_PROC_SNAPSHOT_MEMINFO 0x02
+#define NP_PROC_SNAPSHOT_USERS 0x04
+#define NP_PROC_SNAPSHOT_PROCS 0x08
+
+typedef struct np_proc_snapshot_header {
+	char magic[8];
+	int64_t time;
+	uint32_t have;
+	int32_t users;
+	double load[3];
+	np_proc_meminfo meminfo;
+	uint32_t procs;
+	uint32_t text; /* bytes of the strings after the records */
+} np_proc_snapshot_header;
+
+/* a process with all of np_proc_entry that check_procs looks at */
+typedef struct np_proc_snapshot_record {
+	int32_t uid;
+	int32_t pid;
+	int32_t ppid;
+	int32_t vsz;
+	int32_t rss;
+	int32_t seconds;
+	float pcpu;
+	char stat[8];
+	char prog[16];
+	uint32_t args;   /* offsets into the strings */
+	uint32_t cgroup;
+} np_proc_snapshot_record;
+
+typedef struct np_proc_snapshot {
+	void *map;
+	size_t size;
+	const np_proc_snapshot_header *header;
+	const np_proc_snapshot_record *records;
+	const char *text;
+	uint32_t next;
+	long age; /* seconds since it was taken */
+} np_proc_snapshot;
+
+/* the snapshot file of this user under the state directory */
+char *np_proc_snapshot_path (void);
+/* The snapshot at path (NULL for np_proc_snapshot_path()) if it is at most
+ * max_age seconds old, or else one taken now and stored there; of the runs
+ * that find none, one takes it and the others wait for it. FALSE if there
+ * is none to be had. */
+int np_proc_snapshot_open (np_proc_snapshot *, const char *path, unsigned int max_age);
+/* the next process of the snapshot, with the seconds it has been running
+ * brought up to now, or FALSE at the end of the table */
+int np_proc_snapshot_next (np_proc_snapshot *, np_proc_entry *);
+void np_proc_snapshot_close (np_proc_snapshot *);
+
+/* The process table kept from one check of a resident worker to the next.
+ * After one scan of /proc the Linux proc connector, a netlink socket that
+ * needs CAP_NET_ADMIN, tells of each fork, exec, exit and change of ids,
+ * and only the processes it names are read again, so an update costs what
+ * changed rather than what runs. What needs no event to change - the
+ * state, sizes and CPU time - np_proc_table_live() reads again for the
+ * processes a check looks at. The whole table is scanned again every
+ * NP_PROC_TABLE_RESYNC seconds, when events were lost, and at every
+ * update while nothing tells of the changes. */
+#define NP_PROC_TABLE_RESYNC 300
+
+typedef struct np_proc_table_entry {
+	np_proc_entry pe; /* its args and cgroup are the table's */
+} np_proc_table_entry;
+
+typedef struct np_proc_table {
+	np_proc_scan scan; /* open from an update to np_proc_table_done() */
+	int scanning;
+	np_proc_table_entry *entries;
+	size_t count;
+	size_t size;
+	uint32_t *index; /* pid -> entry + 1 by linear probing */
+	size_t index_size;
+	size_t index_used; /* slots taken, by deleted ones too */
+	pid_t *changed; /* to read again at the next update */
+	size_t nchanged;
+	size_t changed_size;
+	int fd; /* the proc connector, -1 without */
+	int listening; /* whether the changes are told, by the connector or np_proc_table_touch() */
+	int lost; /* events were lost since the last scan */
+	time_t scanned; /* when the table was last scanned whole */
+	int rescanned; /* whether the last update did */
+	unsigned long reads; /* processes read by the check, since the update */
+} np_proc_table;
+
+void np_proc_table_init (np_proc_table *);
+/* subscribe to the proc connector; FALSE where it cannot be had */
+int np_proc_table_listen (np_proc_table *);
+/* read what changed since the last update, or all of /proc; FALSE if it
+ * cannot be read */
+int np_proc_table_update (np_proc_table *);
+/* a process to read again at the next update, as an event would have it */
+void np_proc_table_touch (np_proc_table *, pid_t);
+/* the state, sizes, CPU time and owner of the process as of now; FALSE,
+ * to be read again at the next update, if it is gone */
+int np_proc_table_live (np_proc_table *, np_proc_table_entry *);
+/* the check is done with the table until the next update */
+void np_proc_table_done (np_proc_table *);
+void np_proc_table_free (np_proc_table *);
+
+#endif /* NAGIOS_UTILS_PROC_H_INCLUDED */
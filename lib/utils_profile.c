@@ -0,0 +1,176 @@
+/*****************************************************************************
+*
+* utils_profile.c
+*
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+*
+* Where a plugin run spends its time and memory, for --profile
+*
+* Phases are marked in the plugins; each takes getrusage() and the wall
+* clock where it starts and adds the difference to it where the next one
+* starts, so that with no --profile a mark costs one test of a variable.
+* The report goes to stderr at exit, never into what Nagios reads.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_profile.h"
+#include <sys/time.h>
+#include <sys/resource.h>
+#ifdef HAVE_MALLINFO2
+# include <malloc.h>
+#endif
+
+#define NP_PROFILE_PHASES 32
+
+int np_profile_enabled = 0;
+
+/* what a phase has taken, in microseconds but for the counts */
+typedef struct profile_phase {
+	const char *name;
+	unsigned int runs;
+	double wall;
+	double user;
+	double sys;
+	long nvcsw;
+	long nivcsw;
+	long inblock;
+	long oublock;
+} profile_phase;
+
+static const char *profile_plugin = NULL;
+static profile_phase phases[NP_PROFILE_PHASES];
+static int nphases = 0;
+static profile_phase *current = NULL;
+static struct timeval start_wall, phase_wall;
+static struct rusage phase_usage;
+
+static double
+usec (const struct timeval *tv)
+{
+	return tv->tv_sec * 1e6 + tv->tv_usec;
+}
+
+/* what the running phase took since it started */
+static void
+phase_end (void)
+{
+	struct timeval now;
+	struct rusage ru;
+
+	gettimeofday (&now, NULL);
+	getrusage (RUSAGE_SELF, &ru);
+	if (current) {
+		current->wall += usec (&now) - usec (&phase_wall);
+		current->user += usec (&ru.ru_utime) - usec (&phase_usage.ru_utime);
+		current->sys += usec (&ru.ru_stime) - usec (&phase_usage.ru_stime);
+		current->nvcsw += ru.ru_nvcsw - phase_usage.ru_nvcsw;
+		current->nivcsw += ru.ru_nivcsw - phase_usage.ru_nivcsw;
+		current->inblock += ru.ru_inblock - phase_usage.ru_inblock;
+		current->oublock += ru.ru_oublock - phase_usage.ru_oublock;
+	}
+	phase_wall = now;
+	phase_usage = ru;
+}
+
+void
+np_profile_mark (const char *name)
+{
+	int i;
+
+	phase_end ();
+	for (i = 0; i < nphases; i++)
+		if (strcmp (phases[i].name, name) == 0)
+			break;
+	if (i == nphases) {
+		/* past so many, the rest is the last one's */
+		if (nphases == NP_PROFILE_PHASES) {
+			current = &phases[nphases - 1];
+			return;
+		}
+		phases[nphases++].name = name;
+	}
+	current = &phases[i];
+	current->runs++;
+}
+
+void
+np_profile_report (FILE *f)
+{
+	struct timeval now;
+	struct rusage ru;
+	size_t allocations, bytes;
+	profile_phase *p;
+
+	phase_end ();
+	current = NULL;
+	gettimeofday (&now, NULL);
+	getrusage (RUSAGE_SELF, &ru);
+	np_arena_stats (&allocations, &bytes);
+
+	fprintf (f, "profile %s: wall %.3fs user %.3fs sys %.3fs maxrss %ldkB\n",
+	         profile_plugin, (usec (&now) - usec (&start_wall)) / 1e6,
+	         usec (&ru.ru_utime) / 1e6, usec (&ru.ru_stime) / 1e6, ru.ru_maxrss);
+	fprintf (f, "profile %s: arena %lu allocations %lu bytes", profile_plugin,
+	         (unsigned long) allocations, (unsigned long) bytes);
+#ifdef HAVE_MALLINFO2
+	fprintf (f, ", heap %lu bytes in use", (unsigned long) mallinfo2 ().uordblks);
+#endif
+	fputc ('\n', f);
+
+	for (p = phases; p < phases + nphases; p++)
+		fprintf (f, "profile %s: phase %s %ux wall %.3fs user %.3fs sys %.3fs csw %ld/%ld io %ld/%ld%s\n",
+		         profile_plugin, p->name, p->runs, p->wall / 1e6, p->user / 1e6, p->sys / 1e6,
+		         p->nvcsw, p->nivcsw, p->inblock, p->oublock,
+		         (p->sys > p->user && p->sys >= 1000) ? " syscall-heavy" : "");
+}
+
+static void
+profile_exit (void)
+{
+	fflush (stdout);
+	np_profile_report (stderr);
+}
+
+char **
+np_profile_opts (int *argc, char **argv)
+{
+	char *base;
+	int i, j;
+
+	for (i = 1; i < *argc; i++) {
+		if (strcmp (argv[i], "--profile") != 0)
+			continue;
+		for (j = i; j < *argc; j++)
+			argv[j] = argv[j + 1];
+		(*argc)--;
+		i--;
+		if (np_profile_enabled)
+			continue;
+
+		base = strrchr (argv[0], '/');
+		profile_plugin = base ? base + 1 : argv[0];
+		np_profile_enabled = 1;
+		gettimeofday (&start_wall, NULL);
+		atexit (profile_exit);
+		np_profile_mark ("startup");
+	}
+	return argv;
+}
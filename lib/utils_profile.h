@@ -0,0 +1,31 @@
+#ifndef NAGIOS_UTILS_PROFILE_H_INCLUDED
+#define NAGIOS_UTILS_PROFILE_H_INCLUDED
+/* Header file for nagios plugins utils_profile.c */
+
+/* --profile: where a run spends its time and memory, written to stderr
+ * when the plugin exits, so that what Nagios reads is the same:
+ *
+ *   profile check_http: wall 0.105s user 0.004s sys 0.012s maxrss 5120kB
+ *   profile check_http: arena 12 allocations 16448 bytes, heap 123456 bytes in use
+ *   profile check_http: phase connect 1x wall 0.100s user 0.000s sys 0.001s csw 2/0 io 0/0
+ *
+ * A phase runs from its np_profile_phase() to the next one; phases of the
+ * same name add up. csw are the voluntary and involuntary context
+ * switches, io the blocks read and written; a phase with more system than
+ * user time is marked syscall-heavy. Without --profile a phase is a test
+ * of np_profile_enabled and nothing more. */
+extern int np_profile_enabled;
+
+/* Take --profile out of argv and start profiling the run of argv[0];
+ * np_output_opts() does this for the plugins */
+char **np_profile_opts (int *argc, char **argv);
+
+/* end the phase that runs, if any, and start the one named so; name
+ * is kept (a string literal) */
+#define np_profile_phase(name) do { if (np_profile_enabled) np_profile_mark (name); } while (0)
+void np_profile_mark (const char *name);
+
+/* the report above, so far */
+void np_profile_report (FILE *);
+
+#endif /* NAGIOS_UTILS_PROFILE_H_INCLUDED */
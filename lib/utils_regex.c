@@ -0,0 +1,218 @@
+/*****************************************************************************
+*
+* Library for regular expressions
+*
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+*
+* Description:
+*
+* This file contains np_regcomp() and np_regexec(), which match with the
+* PCRE2 JIT when it is there and with the POSIX functions otherwise.
+* These are tested by libtap
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_regex.h"
+
+#ifdef HAVE_PCRE2
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+#ifdef HAVE_LANGINFO_CODESET
+# include <langinfo.h>
+#endif
+
+/* The JIT's default stack of 32K runs out backtracking over a large body */
+#define NP_JIT_STACK_MIN (32 * 1024)
+#define NP_JIT_STACK_MAX (1024 * 1024)
+
+static pcre2_match_context *np_match_context;
+
+/*
+ * GNU extensions PCRE2 would take for something else: \< \> \` \' are
+ * plain characters to it.  Everything else of an extended expression
+ * means the same to both, as far as a plugin's -r goes.
+ */
+static int
+np_pcre2_compatible (const char *pattern)
+{
+	const char *p;
+
+	for (p = pattern; *p; p++) {
+		if (*p != '\\')
+			continue;
+		if (p[1] == '<' || p[1] == '>' || p[1] == '`' || p[1] == '\'')
+			return FALSE;
+		if (p[1])
+			p++;
+	}
+	return TRUE;
+}
+
+/* The options for PCRE2 to match like regexec() would, or FALSE if it cannot */
+static int
+np_pcre2_options (int cflags, uint32_t *options)
+{
+	*options = 0;
+	if (!(cflags & REG_EXTENDED))
+		return FALSE;
+	if (MB_CUR_MAX > 1) {
+#if defined(PCRE2_MATCH_INVALID_UTF) && defined(HAVE_LANGINFO_CODESET)
+		/* text that is not UTF-8 just does not match, as with regexec */
+		if (strcmp (nl_langinfo (CODESET), "UTF-8") != 0)
+			return FALSE;
+		*options |= PCRE2_UTF | PCRE2_UCP | PCRE2_MATCH_INVALID_UTF;
+#else
+		return FALSE;
+#endif
+	}
+	if (cflags & REG_ICASE)
+		*options |= PCRE2_CASELESS;
+	if (cflags & REG_NEWLINE)
+		*options |= PCRE2_MULTILINE;
+	else
+		*options |= PCRE2_DOTALL | PCRE2_DOLLAR_ENDONLY;
+	return TRUE;
+}
+
+static int
+np_pcre2_compile (np_regex_t *preg, const char *pattern)
+{
+	pcre2_code *code;
+	pcre2_jit_stack *stack;
+	uint32_t options;
+	PCRE2_SIZE offset;
+	int err;
+
+	if (!np_pcre2_options (preg->cflags, &options) || !np_pcre2_compatible (pattern))
+		return FALSE;
+	code = pcre2_compile ((PCRE2_SPTR) pattern, PCRE2_ZERO_TERMINATED, options, &err, &offset, NULL);
+	if (code == NULL)
+		return FALSE;
+	preg->match_data = pcre2_match_data_create_from_pattern (code, NULL);
+	if (preg->match_data == NULL) {
+		pcre2_code_free (code);
+		return FALSE;
+	}
+	preg->code = code;
+	preg->jit = pcre2_jit_compile (code, PCRE2_JIT_COMPLETE) == 0;
+
+	if (preg->jit && np_match_context == NULL) {
+		np_match_context = pcre2_match_context_create (NULL);
+		stack = pcre2_jit_stack_create (NP_JIT_STACK_MIN, NP_JIT_STACK_MAX, NULL);
+		if (np_match_context && stack)
+			pcre2_jit_stack_assign (np_match_context, NULL, stack);
+	}
+	return TRUE;
+}
+
+static int
+np_pcre2_exec (const np_regex_t *preg, const char *string, size_t nmatch,
+               regmatch_t pmatch[], int eflags)
+{
+	pcre2_match_data *md = preg->match_data;
+	PCRE2_SIZE *ovector;
+	uint32_t options = 0;
+	size_t i;
+	int rc;
+
+	if (eflags & REG_NOTBOL)
+		options |= PCRE2_NOTBOL;
+	if (eflags & REG_NOTEOL)
+		options |= PCRE2_NOTEOL;
+
+	if (preg->jit)
+		rc = pcre2_jit_match (preg->code, (PCRE2_SPTR) string, strlen (string), 0, options, md, np_match_context);
+	else
+		rc = pcre2_match (preg->code, (PCRE2_SPTR) string, strlen (string), 0, options, md, np_match_context);
+	if (rc == PCRE2_ERROR_NOMATCH)
+		return REG_NOMATCH;
+	if (rc < 0)
+		return REG_ESPACE;	/* a match or stack limit */
+
+	if (preg->cflags & REG_NOSUB)
+		return 0;
+	ovector = pcre2_get_ovector_pointer (md);
+	for (i = 0; i < nmatch; i++) {
+		if (i < (size_t) rc && ovector[2 * i] != PCRE2_UNSET) {
+			pmatch[i].rm_so = ovector[2 * i];
+			pmatch[i].rm_eo = ovector[2 * i + 1];
+		} else {
+			pmatch[i].rm_so = -1;
+			pmatch[i].rm_eo = -1;
+		}
+	}
+	return 0;
+}
+#endif /* HAVE_PCRE2 */
+
+int
+np_regcomp (np_regex_t *preg, const char *pattern, int cflags)
+{
+	preg->code = NULL;
+	preg->match_data = NULL;
+	preg->jit = FALSE;
+	preg->cflags = cflags;
+#ifdef HAVE_PCRE2
+	if (np_pcre2_compile (preg, pattern))
+		return 0;
+#endif
+	return regcomp (&preg->re, pattern, cflags);
+}
+
+int
+np_regexec (const np_regex_t *preg, const char *string, size_t nmatch,
+            regmatch_t pmatch[], int eflags)
+{
+#ifdef HAVE_PCRE2
+	if (preg->code)
+		return np_pcre2_exec (preg, string, nmatch, pmatch, eflags);
+#endif
+	return regexec (&preg->re, string, nmatch, pmatch, eflags);
+}
+
+size_t
+np_regerror (int errcode, const np_regex_t *preg, char *errbuf, size_t errbuf_size)
+{
+	/* the PCRE2 errors are given regexec()'s codes */
+	return regerror (errcode, &preg->re, errbuf, errbuf_size);
+}
+
+void
+np_regfree (np_regex_t *preg)
+{
+#ifdef HAVE_PCRE2
+	if (preg->code) {
+		pcre2_match_data_free (preg->match_data);
+		pcre2_code_free (preg->code);
+		preg->code = NULL;
+		preg->match_data = NULL;
+		return;
+	}
+#endif
+	regfree (&preg->re);
+}
+
+const char *
+np_regex_engine (const np_regex_t *preg)
+{
+	if (preg->code == NULL)
+		return "posix";
+	return preg->jit ? "pcre2-jit" : "pcre2";
+}
@@ -0,0 +1,35 @@
+/* Header file for utils_regex */
+
+#ifndef _UTILS_REGEX_
+#define _UTILS_REGEX_
+
+#include "regex.h"
+
+/*
+ * Regular expressions as regcomp()/regexec() take them, matched with the
+ * PCRE2 JIT when nagios-plugins was built with libpcre2-8 and with the
+ * POSIX functions otherwise.  A pattern PCRE2 does not take, or a basic
+ * (not REG_EXTENDED) one, is left to regcomp() too, so that whatever
+ * worked before still does.  The return values and error codes are
+ * regcomp()'s and regexec()'s: 0, REG_NOMATCH or REG_E*.
+ */
+typedef struct np_regex_t
+{
+	regex_t re;        /* when PCRE2 is not used */
+	void *code;        /* pcre2_code, NULL when it is not used */
+	void *match_data;  /* pcre2_match_data */
+	int jit;           /* code was compiled by the JIT */
+	int cflags;
+} np_regex_t;
+
+int np_regcomp (np_regex_t *preg, const char *pattern, int cflags);
+int np_regexec (const np_regex_t *preg, const char *string, size_t nmatch,
+                regmatch_t pmatch[], int eflags);
+size_t np_regerror (int errcode, const np_regex_t *preg, char *errbuf,
+                    size_t errbuf_size);
+void np_regfree (np_regex_t *preg);
+
+/* "pcre2-jit", "pcre2" or "posix": what np_regexec() uses for preg */
+const char *np_regex_engine (const np_regex_t *preg);
+
+#endif /* _UTILS_REGEX_ */
@@ -0,0 +1,1776 @@
+/*****************************************************************************
+*
+* utils_snmp.c
+*
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+*
+* Minimal SNMP engine for check_snmp
+*
+* Messages are encoded back to front, so that every length is known by
+* the time its header is written, and decoded in place with bounds
+* checks on every element. Decoded strings point into a copy of the
+* message kept with the PDU.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_snmp.h"
+#include "sha1.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+#ifdef USE_OPENSSL
+# include <openssl/evp.h>
+#endif
+
+#define BER_SEQUENCE 0x30
+
+/* under the state directory, for what is kept between runs */
+#define NP_SNMP_STATE_DIR "snmp"
+
+/* writes go in front of what was written before */
+struct ber_out {
+	unsigned char *buf;
+	size_t pos;
+	int full;
+};
+
+struct ber_in {
+	const unsigned char *p;
+	const unsigned char *end;
+};
+
+static void
+put_byte (struct ber_out *out, unsigned char c)
+{
+	if (out->pos == 0) {
+		out->full = 1;
+		return;
+	}
+	out->buf[--out->pos] = c;
+}
+
+static void
+put_bytes (struct ber_out *out, const unsigned char *data, size_t len)
+{
+	if (out->pos < len) {
+		out->full = 1;
+		return;
+	}
+	out->pos -= len;
+	memcpy (out->buf + out->pos, data, len);
+}
+
+/* the header of an element whose content ends at end */
+static void
+put_header (struct ber_out *out, int tag, size_t end)
+{
+	size_t len = out->full ? 0 : end - out->pos;
+	int n = 0;
+
+	if (len < 0x80) {
+		put_byte (out, len);
+	} else {
+		for (; len; len >>= 8, n++)
+			put_byte (out, len & 0xff);
+		put_byte (out, 0x80 | n);
+	}
+	put_byte (out, tag);
+}
+
+static void
+put_integer (struct ber_out *out, int tag, int64_t value)
+{
+	size_t end = out->pos;
+	unsigned char c;
+
+	do {
+		c = value & 0xff;
+		put_byte (out, c);
+		value >>= 8;
+	} while (!((value == 0 && !(c & 0x80)) || (value == -1 && (c & 0x80))));
+	put_header (out, tag, end);
+}
+
+static void
+put_unsigned (struct ber_out *out, int tag, uint64_t value)
+{
+	size_t end = out->pos;
+	unsigned char c;
+
+	do {
+		c = value & 0xff;
+		put_byte (out, c);
+		value >>= 8;
+	} while (value);
+	if (c & 0x80)
+		put_byte (out, 0);
+	put_header (out, tag, end);
+}
+
+static void
+put_subid (struct ber_out *out, uint32_t value)
+{
+	put_byte (out, value & 0x7f);
+	for (value >>= 7; value; value >>= 7)
+		put_byte (out, 0x80 | (value & 0x7f));
+}
+
+static void
+put_oid (struct ber_out *out, const np_snmp_oid *oid)
+{
+	size_t end = out->pos;
+	unsigned int i;
+
+	for (i = oid->len; i > 2; i--)
+		put_subid (out, oid->id[i - 1]);
+	put_subid (out, oid->len >= 2 ? oid->id[0] * 40 + oid->id[1] :
+	           oid->len ? oid->id[0] * 40 : 0);
+	put_header (out, NP_SNMP_OBJECT_ID, end);
+}
+
+static void
+put_value (struct ber_out *out, const np_snmp_varbind *vb)
+{
+	size_t end = out->pos;
+
+	switch (vb->type) {
+	case NP_SNMP_INTEGER:
+		put_integer (out, vb->type, vb->integer);
+		break;
+	case NP_SNMP_OCTET_STRING:
+	case NP_SNMP_IPADDRESS:
+	case NP_SNMP_OPAQUE:
+		put_bytes (out, vb->data, vb->length);
+		put_header (out, vb->type, end);
+		break;
+	case NP_SNMP_OBJECT_ID:
+		put_oid (out, &vb->value_oid);
+		break;
+	case NP_SNMP_COUNTER32:
+	case NP_SNMP_GAUGE32:
+	case NP_SNMP_TIMETICKS:
+	case NP_SNMP_COUNTER64:
+		put_unsigned (out, vb->type, vb->counter);
+		break;
+	default:
+		/* NULL and the v2 exceptions have no content */
+		put_header (out, vb->type, end);
+		break;
+	}
+}
+
+int
+np_snmp_encode (const np_snmp_pdu *pdu, unsigned char *buf, size_t size)
+{
+	struct ber_out out;
+	size_t end, vb_end, i;
+
+	out.buf = buf;
+	out.pos = end = size;
+	out.full = 0;
+
+	for (i = pdu->count; i > 0; i--) {
+		vb_end = out.pos;
+		put_value (&out, &pdu->varbinds[i - 1]);
+		put_oid (&out, &pdu->varbinds[i - 1].oid);
+		put_header (&out, BER_SEQUENCE, vb_end);
+	}
+	put_header (&out, BER_SEQUENCE, end);
+	put_integer (&out, NP_SNMP_INTEGER, pdu->error_index);
+	put_integer (&out, NP_SNMP_INTEGER, pdu->error_status);
+	put_integer (&out, NP_SNMP_INTEGER, pdu->request_id);
+	put_header (&out, pdu->type, end);
+	vb_end = out.pos;
+	put_bytes (&out, pdu->community, pdu->community_len);
+	put_header (&out, NP_SNMP_OCTET_STRING, vb_end);
+	put_integer (&out, NP_SNMP_INTEGER, pdu->version);
+	put_header (&out, BER_SEQUENCE, end);
+
+	if (out.full || size - out.pos > INT_MAX)
+		return -1;
+	memmove (buf, buf + out.pos, size - out.pos);
+	return (int) (size - out.pos);
+}
+
+
+static int
+get_header (struct ber_in *in, int *tag, struct ber_in *content)
+{
+	size_t len, n;
+
+	if (in->end - in->p < 2)
+		return FALSE;
+	*tag = *in->p++;
+	len = *in->p++;
+	if (len & 0x80) {
+		n = len & 0x7f;
+		if (n == 0 || n > 4 || (size_t) (in->end - in->p) < n)
+			return FALSE;
+		for (len = 0; n; n--)
+			len = len << 8 | *in->p++;
+	}
+	if (len > (size_t) (in->end - in->p))
+		return FALSE;
+	content->p = in->p;
+	content->end = in->p + len;
+	in->p += len;
+	return TRUE;
+}
+
+static int
+get_element (struct ber_in *in, int tag, struct ber_in *content)
+{
+	int found;
+
+	return get_header (in, &found, content) && found == tag;
+}
+
+static int
+get_signed (const struct ber_in *content, int64_t *value)
+{
+	const unsigned char *p = content->p;
+	size_t len = content->end - p;
+
+	if (len < 1 || len > 8)
+		return FALSE;
+	*value = (signed char) *p++;
+	while (p < content->end)
+		*value = (int64_t) ((uint64_t) *value << 8 | *p++);
+	return TRUE;
+}
+
+static int
+get_integer (struct ber_in *in, int64_t *value)
+{
+	struct ber_in content;
+
+	return get_element (in, NP_SNMP_INTEGER, &content) && get_signed (&content, value);
+}
+
+static int
+get_unsigned (const struct ber_in *content, uint64_t *value)
+{
+	const unsigned char *p = content->p;
+	size_t len = content->end - p;
+
+	if (len < 1 || len > 9 || (len == 9 && *p))
+		return FALSE;
+	for (*value = 0; p < content->end; p++)
+		*value = *value << 8 | *p;
+	return TRUE;
+}
+
+static int
+get_oid (const struct ber_in *content, np_snmp_oid *oid)
+{
+	const unsigned char *p = content->p;
+	uint32_t value;
+
+	oid->len = 0;
+	if (p == content->end)
+		return FALSE;
+	while (p < content->end) {
+		for (value = 0; ; p++) {
+			if (p == content->end || value > 0x1ffffff)
+				return FALSE;
+			value = value << 7 | (*p & 0x7f);
+			if (!(*p & 0x80))
+				break;
+		}
+		p++;
+		if (oid->len == 0) {
+			oid->id[0] = value < 40 ? 0 : value < 80 ? 1 : 2;
+			oid->id[1] = value - oid->id[0] * 40;
+			oid->len = 2;
+		} else if (oid->len == NP_SNMP_MAX_OID) {
+			return FALSE;
+		} else {
+			oid->id[oid->len++] = value;
+		}
+	}
+	return TRUE;
+}
+
+static int
+get_varbind (struct ber_in *in, np_snmp_varbind *vb)
+{
+	struct ber_in seq, content;
+
+	if (!get_element (in, BER_SEQUENCE, &seq) ||
+	    !get_element (&seq, NP_SNMP_OBJECT_ID, &content) ||
+	    !get_oid (&content, &vb->oid) ||
+	    !get_header (&seq, &vb->type, &content))
+		return FALSE;
+
+	switch (vb->type) {
+	case NP_SNMP_INTEGER:
+		return get_signed (&content, &vb->integer);
+	case NP_SNMP_OCTET_STRING:
+	case NP_SNMP_IPADDRESS:
+	case NP_SNMP_OPAQUE:
+		vb->data = content.p;
+		vb->length = content.end - content.p;
+		return TRUE;
+	case NP_SNMP_OBJECT_ID:
+		return get_oid (&content, &vb->value_oid);
+	case NP_SNMP_COUNTER32:
+	case NP_SNMP_GAUGE32:
+	case NP_SNMP_TIMETICKS:
+	case NP_SNMP_COUNTER64:
+		return get_unsigned (&content, &vb->counter);
+	case NP_SNMP_NULL:
+	case NP_SNMP_NO_SUCH_OBJECT:
+	case NP_SNMP_NO_SUCH_INSTANCE:
+	case NP_SNMP_END_OF_MIB_VIEW:
+		return content.p == content.end;
+	}
+	/* some type from the future, keep it as opaque data */
+	vb->data = content.p;
+	vb->length = content.end - content.p;
+	return TRUE;
+}
+
+int
+np_snmp_decode (const unsigned char *buf, size_t len, np_snmp_pdu *pdu)
+{
+	struct ber_in in, msg, content, list;
+	np_snmp_varbind *vb;
+	int64_t value;
+
+	memset (pdu, 0, sizeof (*pdu));
+	if ((pdu->packet = malloc (len ? len : 1)) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	memcpy (pdu->packet, buf, len);
+	in.p = pdu->packet;
+	in.end = pdu->packet + len;
+
+	if (!get_element (&in, BER_SEQUENCE, &msg) || !get_integer (&msg, &value))
+		goto invalid;
+	pdu->version = (int) value;
+	if (!get_element (&msg, NP_SNMP_OCTET_STRING, &content))
+		goto invalid;
+	pdu->community = content.p;
+	pdu->community_len = content.end - content.p;
+
+	if (!get_header (&msg, &pdu->type, &content) || (pdu->type & 0xe0) != 0xa0 ||
+	    !get_integer (&content, &value))
+		goto invalid;
+	pdu->request_id = (int32_t) value;
+	if (!get_integer (&content, &value))
+		goto invalid;
+	pdu->error_status = (int) value;
+	if (!get_integer (&content, &value))
+		goto invalid;
+	pdu->error_index = (int) value;
+
+	if (!get_element (&content, BER_SEQUENCE, &list))
+		goto invalid;
+	while (list.p < list.end) {
+		vb = np_snmp_pdu_add (pdu, NULL);
+		if (!get_varbind (&list, vb))
+			goto invalid;
+	}
+	return TRUE;
+
+invalid:
+	np_snmp_pdu_free (pdu);
+	return FALSE;
+}
+
+
+void
+np_snmp_pdu_init (np_snmp_pdu *pdu, int version, const char *community, int type)
+{
+	static int seeded = 0;
+
+	if (!seeded) {
+		srandom ((unsigned int) time (NULL) ^ ((unsigned int) getpid () << 16));
+		seeded = 1;
+	}
+	memset (pdu, 0, sizeof (*pdu));
+	pdu->version = version;
+	pdu->community = (const unsigned char *) community;
+	pdu->community_len = community ? strlen (community) : 0;
+	pdu->type = type;
+	pdu->request_id = random () & 0x7fffffff;
+}
+
+np_snmp_varbind *
+np_snmp_pdu_add (np_snmp_pdu *pdu, const np_snmp_oid *oid)
+{
+	np_snmp_varbind *vb;
+
+	if (pdu->count == pdu->size) {
+		pdu->size = pdu->size ? pdu->size * 2 : 8;
+		pdu->varbinds = realloc (pdu->varbinds, pdu->size * sizeof (*pdu->varbinds));
+		if (pdu->varbinds == NULL)
+			die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	}
+	vb = &pdu->varbinds[pdu->count++];
+	memset (vb, 0, sizeof (*vb));
+	if (oid)
+		vb->oid = *oid;
+	vb->type = NP_SNMP_NULL;
+	return vb;
+}
+
+void
+np_snmp_pdu_free (np_snmp_pdu *pdu)
+{
+	free (pdu->varbinds);
+	free (pdu->packet);
+	pdu->varbinds = NULL;
+	pdu->packet = NULL;
+	pdu->count = pdu->size = 0;
+}
+
+
+int
+np_snmp_parse_oid (const char *str, np_snmp_oid *oid)
+{
+	unsigned long value;
+	char *end;
+
+	oid->len = 0;
+	if (!strncmp (str, "iso", 3) && (str[3] == '.' || str[3] == '\0')) {
+		oid->id[oid->len++] = 1;
+		str += 3;
+	} else if (*str == '.') {
+		str++;
+	} else if (*str == '\0') {
+		return FALSE;
+	}
+
+	while (*str) {
+		if (oid->len) {
+			if (*str++ != '.')
+				return FALSE;
+		}
+		if (!isdigit ((unsigned char) *str) || oid->len == NP_SNMP_MAX_OID)
+			return FALSE;
+		errno = 0;
+		value = strtoul (str, &end, 10);
+		if (errno || value > 0xffffffffUL)
+			return FALSE;
+		oid->id[oid->len++] = (uint32_t) value;
+		str = end;
+	}
+	/* the first two go in one sub-identifier */
+	return oid->len >= 2 && oid->id[0] <= 2 && (oid->id[0] == 2 || oid->id[1] < 40);
+}
+
+char *
+np_snmp_oid_string (const np_snmp_oid *oid, int iso, char *buf, size_t size)
+{
+	static const char *roots[] = { "ccitt", "iso", "joint-iso-ccitt" };
+	size_t pos = 0;
+	unsigned int i;
+	int n;
+
+	buf[0] = '\0';
+	for (i = 0; i < oid->len && pos < size; i++) {
+		if (i == 0 && iso && oid->id[0] <= 2)
+			n = snprintf (buf, size, "%s", roots[oid->id[0]]);
+		else
+			n = snprintf (buf + pos, size - pos, i ? ".%lu" : "%lu", (unsigned long) oid->id[i]);
+		if (n < 0)
+			break;
+		pos += n;
+	}
+	return buf;
+}
+
+int
+np_snmp_oid_compare (const np_snmp_oid *a, const np_snmp_oid *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < a->len && i < b->len; i++) {
+		if (a->id[i] != b->id[i])
+			return a->id[i] < b->id[i] ? -1 : 1;
+	}
+	return a->len == b->len ? 0 : a->len < b->len ? -1 : 1;
+}
+
+int
+np_snmp_oid_in_subtree (const np_snmp_oid *oid, const np_snmp_oid *root)
+{
+	return oid->len > root->len &&
+	       !memcmp (oid->id, root->id, root->len * sizeof (*root->id));
+}
+
+
+/* STRING: "..." if it prints, with quotes and backslashes escaped, or
+ * Hex-STRING: with the bytes in hex */
+static char *
+format_string (const char *type, const unsigned char *data, size_t len, int hex)
+{
+	char *str, *p;
+	size_t i;
+
+	for (i = 0; !hex && i < len; i++) {
+		if (!isprint (data[i]) && !isspace (data[i]))
+			hex = 1;
+	}
+	if (hex)
+		type = "Hex-STRING";
+
+	if ((str = malloc (strlen (type) + 5 + len * 3)) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	p = str + sprintf (str, "%s: ", type);
+	if (hex) {
+		for (i = 0; i < len; i++)
+			p += sprintf (p, "%02X ", data[i]);
+	} else {
+		*p++ = '"';
+		for (i = 0; i < len; i++) {
+			if (data[i] == '"' || data[i] == '\\')
+				*p++ = '\\';
+			*p++ = data[i];
+		}
+		*p++ = '"';
+	}
+	*p = '\0';
+	return str;
+}
+
+char *
+np_snmp_format_value (const np_snmp_varbind *vb)
+{
+	char oid[NP_SNMP_MAX_OID * 11 + 16];
+	unsigned long ticks, secs, days;
+	char *str = NULL;
+	int n = 0;
+
+	switch (vb->type) {
+	case NP_SNMP_INTEGER:
+		n = asprintf (&str, "INTEGER: %lld", (long long) vb->integer);
+		break;
+	case NP_SNMP_OCTET_STRING:
+		return format_string ("STRING", vb->data, vb->length, 0);
+	case NP_SNMP_OPAQUE:
+		return format_string ("Opaque", vb->data, vb->length, 1);
+	case NP_SNMP_NULL:
+		n = asprintf (&str, "NULL");
+		break;
+	case NP_SNMP_OBJECT_ID:
+		n = asprintf (&str, "OID: %s", np_snmp_oid_string (&vb->value_oid, TRUE, oid, sizeof (oid)));
+		break;
+	case NP_SNMP_IPADDRESS:
+		if (vb->length != 4)
+			return format_string ("IpAddress", vb->data, vb->length, 1);
+		n = asprintf (&str, "IpAddress: %u.%u.%u.%u", vb->data[0], vb->data[1], vb->data[2], vb->data[3]);
+		break;
+	case NP_SNMP_COUNTER32:
+		n = asprintf (&str, "Counter32: %lu", (unsigned long) vb->counter);
+		break;
+	case NP_SNMP_GAUGE32:
+		n = asprintf (&str, "Gauge32: %lu", (unsigned long) vb->counter);
+		break;
+	case NP_SNMP_TIMETICKS:
+		ticks = (unsigned long) vb->counter;
+		secs = ticks / 100;
+		days = secs / 86400;
+		if (days)
+			n = asprintf (&str, "Timeticks: (%lu) %lu %s, %lu:%02lu:%02lu.%02lu", ticks,
+			              days, days == 1 ? "day" : "days",
+			              (secs / 3600) % 24, (secs / 60) % 60, secs % 60, ticks % 100);
+		else
+			n = asprintf (&str, "Timeticks: (%lu) %lu:%02lu:%02lu.%02lu", ticks,
+			              (secs / 3600) % 24, (secs / 60) % 60, secs % 60, ticks % 100);
+		break;
+	case NP_SNMP_COUNTER64:
+		n = asprintf (&str, "Counter64: %llu", (unsigned long long) vb->counter);
+		break;
+	case NP_SNMP_NO_SUCH_OBJECT:
+		n = asprintf (&str, "No Such Object available on this agent at this OID");
+		break;
+	case NP_SNMP_NO_SUCH_INSTANCE:
+		n = asprintf (&str, "No Such Instance currently exists at this OID");
+		break;
+	case NP_SNMP_END_OF_MIB_VIEW:
+		n = asprintf (&str, "No more variables left in this MIB View (It is past the end of the MIB tree)");
+		break;
+	default:
+		return format_string ("Opaque", vb->data, vb->length, 1);
+	}
+	if (n < 0)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	return str;
+}
+
+const char *
+np_snmp_error_string (int status)
+{
+	static const char *errors[] = {
+		"(noError) No Error",
+		"(tooBig) Response message would have been too large.",
+		"(noSuchName) There is no such variable name in this MIB.",
+		"(badValue) The value given has the wrong type or length.",
+		"(readOnly) The two parties used do not have access to use the specified SNMP PDU.",
+		"(genError) A general failure occured",
+		"noAccess",
+		"wrongType (The set datatype does not match the data type the agent expects)",
+		"wrongLength (The set value has an illegal length from what the agent expects)",
+		"wrongEncoding",
+		"wrongValue (The set value is illegal or unsupported in some way)",
+		"noCreation (That table does not support row creation or that object can not ever be created)",
+		"inconsistentValue (The set value is illegal or unsupported in some way)",
+		"resourceUnavailable (This is likely a out-of-memory failure within the agent)",
+		"commitFailed",
+		"undoFailed",
+		"authorizationError (access denied to that object)",
+		"notWritable (That object does not support modification)",
+		"inconsistentName (That object can not currently be created)",
+	};
+
+	if (status < 0 || (size_t) status >= sizeof (errors) / sizeof (*errors))
+		return "Unknown Error";
+	return errors[status];
+}
+
+
+static int64_t
+now_ms (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Send the message and wait for one that match() accepts, resending it
+ * retries times. The accepted message is left in in. */
+static int
+transact (int sd, const unsigned char *out, int len, unsigned char *in,
+          int (*match) (const unsigned char *, int, void *), void *arg, int timeout_ms, int retries)
+{
+	struct pollfd pfd;
+	int64_t deadline;
+	int n, try;
+
+	for (try = 0; try <= retries; try++) {
+		if (send (sd, out, len, 0) < 0)
+			return NP_SNMP_ERROR;
+		deadline = now_ms () + timeout_ms;
+		while ((n = (int) (deadline - now_ms ())) > 0) {
+			pfd.fd = sd;
+			pfd.events = POLLIN;
+			if ((n = poll (&pfd, 1, n)) < 0 && errno != EINTR)
+				return NP_SNMP_ERROR;
+			if (n <= 0)
+				continue;
+			if ((n = recv (sd, in, NP_SNMP_MAX_MESSAGE, 0)) < 0) {
+				if (errno == EINTR)
+					continue;
+				return NP_SNMP_ERROR;
+			}
+			/* anything else that turns up is not for us */
+			if (match (in, n, arg))
+				return NP_SNMP_OK;
+		}
+	}
+	return NP_SNMP_TIMEOUT;
+}
+
+struct query_match {
+	const np_snmp_pdu *req;
+	np_snmp_pdu *resp;
+};
+
+static int
+query_match (const unsigned char *in, int len, void *arg)
+{
+	struct query_match *m = arg;
+
+	if (!np_snmp_decode (in, len, m->resp))
+		return FALSE;
+	if (m->resp->type == NP_SNMP_RESPONSE && m->resp->request_id == m->req->request_id)
+		return TRUE;
+	np_snmp_pdu_free (m->resp);
+	return FALSE;
+}
+
+int
+np_snmp_query (int sd, const np_snmp_pdu *req, np_snmp_pdu *resp, int timeout_ms, int retries)
+{
+	static unsigned char out[NP_SNMP_MAX_MESSAGE], in[NP_SNMP_MAX_MESSAGE];
+	struct query_match m;
+	int len;
+
+	if ((len = np_snmp_encode (req, out, sizeof (out))) < 0) {
+		errno = EMSGSIZE;
+		return NP_SNMP_ERROR;
+	}
+	m.req = req;
+	m.resp = resp;
+	return transact (sd, out, len, in, query_match, &m, timeout_ms, retries);
+}
+
+
+/* All targets from one socket per address family. Request ids run up
+ * from the id of the request, one per target, so that a response finds
+ * its target without a search; the request is resent with the same id
+ * each timeout until the retries are used up. */
+static void
+target_fail (np_snmp_target *t, int status, const char *error)
+{
+	t->status = status;
+	t->error = error ? strdup (error) : NULL;
+	t->done = TRUE;
+}
+
+static void
+target_send (np_snmp_target *t, const unsigned char *out, int len, int timeout_ms)
+{
+	if (sendto (t->sd, out, len, 0, (struct sockaddr *) &t->addr, t->addrlen) < 0) {
+		target_fail (t, NP_SNMP_ERROR, strerror (errno));
+		return;
+	}
+	t->tries++;
+	t->deadline = now_ms () + timeout_ms;
+}
+
+int
+np_snmp_query_targets (np_snmp_target *targets, size_t count, const char *port, int family,
+                       const np_snmp_pdu *request, size_t concurrency, int timeout_ms, int retries)
+{
+	static unsigned char out[NP_SNMP_MAX_MESSAGE], in[NP_SNMP_MAX_MESSAGE];
+	np_snmp_target **active;
+	np_snmp_pdu req, resp;
+	struct addrinfo hints, *res;
+	struct pollfd pfd[2];
+	int64_t now, wait;
+	size_t i, j, nactive = 0, next = 0;
+	int sd[2] = { -1, -1 };
+	int k, n, len;
+	ssize_t got;
+
+	if (concurrency == 0 || (active = calloc (concurrency, sizeof (*active))) == NULL)
+		return FALSE;
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = family;
+	hints.ai_socktype = SOCK_DGRAM;
+	for (i = 0; i < count; i++) {
+		targets[i].status = NP_SNMP_TIMEOUT;
+		targets[i].error = NULL;
+		targets[i].tries = 0;
+		targets[i].done = FALSE;
+		targets[i].sd = -1;
+		if ((n = getaddrinfo (targets[i].host, port, &hints, &res)) != 0) {
+			target_fail (&targets[i], NP_SNMP_ERROR, gai_strerror (n));
+			continue;
+		}
+		memcpy (&targets[i].addr, res->ai_addr, res->ai_addrlen);
+		targets[i].addrlen = res->ai_addrlen;
+		freeaddrinfo (res);
+		k = targets[i].addr.ss_family == AF_INET6;
+		if (sd[k] < 0 && ((sd[k] = socket (targets[i].addr.ss_family, SOCK_DGRAM, 0)) < 0 ||
+		                  fcntl (sd[k], F_SETFL, O_NONBLOCK) < 0)) {
+			target_fail (&targets[i], NP_SNMP_ERROR, strerror (errno));
+			if (sd[k] >= 0)
+				close (sd[k]);
+			sd[k] = -1;
+			continue;
+		}
+		targets[i].sd = sd[k];
+	}
+
+	req = *request;
+	while (next < count || nactive) {
+		for (; nactive < concurrency && next < count; next++) {
+			if (targets[next].done)
+				continue;
+			req.request_id = (request->request_id + (int32_t) next) & 0x7fffffff;
+			if ((len = np_snmp_encode (&req, out, sizeof (out))) < 0) {
+				target_fail (&targets[next], NP_SNMP_ERROR, strerror (EMSGSIZE));
+				continue;
+			}
+			target_send (&targets[next], out, len, timeout_ms);
+			if (!targets[next].done)
+				active[nactive++] = &targets[next];
+		}
+
+		/* resend to the overdue, or give up on them */
+		now = now_ms ();
+		for (i = 0; i < nactive; i++) {
+			if (active[i]->done || active[i]->deadline > now)
+				continue;
+			if (active[i]->tries > retries) {
+				active[i]->done = TRUE;
+				continue;
+			}
+			req.request_id = (request->request_id + (int32_t) (active[i] - targets)) & 0x7fffffff;
+			if ((len = np_snmp_encode (&req, out, sizeof (out))) >= 0)
+				target_send (active[i], out, len, timeout_ms);
+		}
+		wait = -1;
+		for (i = j = 0; i < nactive; i++) {
+			if (active[i]->done)
+				continue;
+			active[j++] = active[i];
+			if (wait < 0 || active[i]->deadline - now < wait)
+				wait = active[i]->deadline - now;
+		}
+		if ((nactive = j) == 0)
+			continue;
+
+		for (n = 0, k = 0; k < 2; k++) {
+			if (sd[k] >= 0) {
+				pfd[n].fd = sd[k];
+				pfd[n++].events = POLLIN;
+			}
+		}
+		if (poll (pfd, n, wait < 0 ? 0 : (int) wait) < 0 && errno != EINTR)
+			break;
+
+		for (k = 0; k < n; k++) {
+			if (!(pfd[k].revents & POLLIN))
+				continue;
+			while ((got = recv (pfd[k].fd, in, sizeof (in), 0)) >= 0) {
+				if (!np_snmp_decode (in, got, &resp))
+					continue;
+				/* late answers to a retry, and anyone else's, are dropped */
+				i = (uint32_t) (resp.request_id - request->request_id) & 0x7fffffff;
+				if (resp.type == NP_SNMP_RESPONSE && i < next && targets[i].tries && !targets[i].done) {
+					targets[i].response = resp;
+					targets[i].status = NP_SNMP_OK;
+					targets[i].done = TRUE;
+				} else {
+					np_snmp_pdu_free (&resp);
+				}
+			}
+		}
+	}
+	for (k = 0; k < 2; k++) {
+		if (sd[k] >= 0)
+			close (sd[k]);
+	}
+	free (active);
+	return TRUE;
+}
+
+void
+np_snmp_targets_free (np_snmp_target *targets, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (targets[i].status == NP_SNMP_OK)
+			np_snmp_pdu_free (&targets[i].response);
+		free ((char *) targets[i].error);
+		targets[i].error = NULL;
+		targets[i].status = NP_SNMP_TIMEOUT;
+	}
+}
+
+/* SNMPv3 engine discovery (RFC 3414 4.): an unauthenticated, reportable
+ * request with an empty engine ID, which the agent answers with a Report
+ * carrying its engine ID, boots and time in the USM security parameters */
+#define SNMP_USM 3
+#define SNMP_FLAG_REPORTABLE 0x04
+
+struct discover_match {
+	int32_t msg_id;
+	np_snmp_engine *engine;
+};
+
+static int
+discover_match (const unsigned char *buf, int len, void *arg)
+{
+	struct discover_match *m = arg;
+	struct ber_in in, msg, header, params, usm, content;
+	int64_t version, msg_id, boots, time;
+
+	in.p = buf;
+	in.end = buf + len;
+	if (!get_element (&in, BER_SEQUENCE, &msg) || !get_integer (&msg, &version) || version != 3 ||
+	    !get_element (&msg, BER_SEQUENCE, &header) || !get_integer (&header, &msg_id) ||
+	    msg_id != m->msg_id || !get_element (&msg, NP_SNMP_OCTET_STRING, &params) ||
+	    !get_element (&params, BER_SEQUENCE, &usm) ||
+	    !get_element (&usm, NP_SNMP_OCTET_STRING, &content) ||
+	    !get_integer (&usm, &boots) || !get_integer (&usm, &time))
+		return FALSE;
+	if (content.p == content.end || content.end - content.p > NP_SNMP_MAX_ENGINE_ID ||
+	    boots < 0 || boots > INT32_MAX || time < 0 || time > INT32_MAX)
+		return FALSE;
+	m->engine->id_len = content.end - content.p;
+	memcpy (m->engine->id, content.p, m->engine->id_len);
+	m->engine->boots = (long) boots;
+	m->engine->time = (long) time;
+	return TRUE;
+}
+
+int
+np_snmp_discover_engine (int sd, np_snmp_engine *engine, int timeout_ms, int retries)
+{
+	static unsigned char out[512], in[NP_SNMP_MAX_MESSAGE];
+	struct discover_match m;
+	struct ber_out ber;
+	size_t end, inner;
+	unsigned char flags = SNMP_FLAG_REPORTABLE;
+	np_snmp_pdu pdu;
+
+	/* for the request ids */
+	np_snmp_pdu_init (&pdu, NP_SNMP_VERSION_2C, "", NP_SNMP_GET);
+	m.msg_id = pdu.request_id;
+	m.engine = engine;
+
+	ber.buf = out;
+	ber.pos = end = sizeof (out);
+	ber.full = 0;
+	/* the scoped PDU, a GET without varbinds */
+	put_header (&ber, BER_SEQUENCE, end);
+	put_integer (&ber, NP_SNMP_INTEGER, 0);
+	put_integer (&ber, NP_SNMP_INTEGER, 0);
+	put_integer (&ber, NP_SNMP_INTEGER, (pdu.request_id + 1) & 0x7fffffff);
+	put_header (&ber, NP_SNMP_GET, end);
+	put_header (&ber, NP_SNMP_OCTET_STRING, ber.pos);
+	put_header (&ber, NP_SNMP_OCTET_STRING, ber.pos);
+	put_header (&ber, BER_SEQUENCE, end);
+	/* empty USM parameters */
+	inner = ber.pos;
+	put_header (&ber, NP_SNMP_OCTET_STRING, ber.pos);
+	put_header (&ber, NP_SNMP_OCTET_STRING, ber.pos);
+	put_header (&ber, NP_SNMP_OCTET_STRING, ber.pos);
+	put_integer (&ber, NP_SNMP_INTEGER, 0);
+	put_integer (&ber, NP_SNMP_INTEGER, 0);
+	put_header (&ber, NP_SNMP_OCTET_STRING, ber.pos);
+	put_header (&ber, BER_SEQUENCE, inner);
+	put_header (&ber, NP_SNMP_OCTET_STRING, inner);
+	/* the global header */
+	inner = ber.pos;
+	put_integer (&ber, NP_SNMP_INTEGER, SNMP_USM);
+	put_bytes (&ber, &flags, 1);
+	put_header (&ber, NP_SNMP_OCTET_STRING, ber.pos + 1);
+	put_integer (&ber, NP_SNMP_INTEGER, NP_SNMP_MAX_MESSAGE);
+	put_integer (&ber, NP_SNMP_INTEGER, m.msg_id);
+	put_header (&ber, BER_SEQUENCE, inner);
+	put_integer (&ber, NP_SNMP_INTEGER, 3);
+	put_header (&ber, BER_SEQUENCE, end);
+
+	return transact (sd, out + ber.pos, (int) (end - ber.pos), in, discover_match, &m, timeout_ms, retries);
+}
+
+
+/* the digests -a names and their length */
+static const struct {
+	const char *name;
+	const char *digest;
+	size_t len;
+} snmp_auth_protocols[] = {
+	{ "MD5", "MD5", 16 },
+	{ "SHA", "SHA1", 20 },
+	{ "SHA-224", "SHA224", 28 },
+	{ "SHA-256", "SHA256", 32 },
+	{ "SHA-384", "SHA384", 48 },
+	{ "SHA-512", "SHA512", 64 },
+};
+
+/* RFC 3414 A.2, hashing a megabyte of the password over and over */
+#define SNMP_KEY_EXPANSION 1048576
+
+int
+np_snmp_localize_key (const char *protocol, const char *password, const unsigned char *engine_id,
+                      size_t engine_id_len, unsigned char *key, size_t *key_len)
+{
+	unsigned char block[64];
+	size_t i, pos, plen = strlen (password);
+
+	for (i = 0; i < sizeof (snmp_auth_protocols) / sizeof (*snmp_auth_protocols); i++)
+		if (!strcasecmp (protocol, snmp_auth_protocols[i].name))
+			break;
+	if (i == sizeof (snmp_auth_protocols) / sizeof (*snmp_auth_protocols) || plen == 0)
+		return FALSE;
+	*key_len = snmp_auth_protocols[i].len;
+
+#ifdef USE_OPENSSL
+	{
+		const EVP_MD *md = EVP_get_digestbyname (snmp_auth_protocols[i].digest);
+		EVP_MD_CTX *ctx;
+		unsigned int len;
+		size_t n;
+
+		if (md == NULL || (ctx = EVP_MD_CTX_new ()) == NULL)
+			return FALSE;
+		EVP_DigestInit_ex (ctx, md, NULL);
+		for (n = 0, pos = 0; n < SNMP_KEY_EXPANSION; n += sizeof (block)) {
+			for (i = 0; i < sizeof (block); i++, pos++)
+				block[i] = password[pos % plen];
+			EVP_DigestUpdate (ctx, block, sizeof (block));
+		}
+		EVP_DigestFinal_ex (ctx, key, &len);
+		EVP_DigestInit_ex (ctx, md, NULL);
+		EVP_DigestUpdate (ctx, key, len);
+		EVP_DigestUpdate (ctx, engine_id, engine_id_len);
+		EVP_DigestUpdate (ctx, key, len);
+		EVP_DigestFinal_ex (ctx, key, &len);
+		EVP_MD_CTX_free (ctx);
+		return TRUE;
+	}
+#else
+	{
+		struct sha1_ctx ctx;
+		size_t n;
+
+		if (*key_len != SHA1_DIGEST_SIZE)
+			return FALSE;
+		sha1_init_ctx (&ctx);
+		for (n = 0, pos = 0; n < SNMP_KEY_EXPANSION; n += sizeof (block)) {
+			for (i = 0; i < sizeof (block); i++, pos++)
+				block[i] = password[pos % plen];
+			sha1_process_block (block, sizeof (block), &ctx);
+		}
+		sha1_finish_ctx (&ctx, key);
+		sha1_init_ctx (&ctx);
+		sha1_process_bytes (key, SHA1_DIGEST_SIZE, &ctx);
+		sha1_process_bytes (engine_id, engine_id_len, &ctx);
+		sha1_process_bytes (key, SHA1_DIGEST_SIZE, &ctx);
+		sha1_finish_ctx (&ctx, key);
+		return TRUE;
+	}
+#endif
+}
+
+
+/* The MIB cache: MIB names mapped to what snmptranslate made of them,
+ * laid out as a hash table in one file like the extra-opts section index
+ * so that a lookup is a mmap() and a few compares. The file carries the
+ * key of the MIBs it was built from and is ignored once that changes. */
+#define NP_SNMP_MIB_CACHE_MAGIC "NPMIBCH1"
+
+typedef struct {
+	char magic[8];
+	uint64_t key;
+	uint32_t buckets;
+	uint32_t entries;
+	uint32_t strings;
+	uint32_t pad;
+} np_snmp_mib_cache_header;
+
+typedef struct {
+	uint32_t hash;
+	uint32_t next;            /* next entry in the bucket + 1, 0 ends it */
+	uint32_t name;            /* offsets into the string table */
+	uint32_t oid;
+	uint32_t label;
+	uint32_t type;
+} np_snmp_mib_cache_entry;
+
+struct np_snmp_mib_cache {
+	char *path;
+	uint64_t key;
+	void *map;
+	size_t map_len;
+	const np_snmp_mib_cache_header *h;
+	/* entries looked up since, written out by np_snmp_mib_cache_save() */
+	char **added;             /* name, oid, label, type for each */
+	size_t nadded;
+};
+
+static uint32_t
+mib_hash (const char *str)
+{
+	uint32_t h = 2166136261U;
+
+	for (; *str; str++)
+		h = (h ^ (unsigned char) *str) * 16777619U;
+	return h;
+}
+
+static uint64_t
+mib_hash64 (uint64_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--)
+		h = (h ^ *p++) * 1099511628211ULL;
+	return h;
+}
+
+uint64_t
+np_snmp_mib_cache_key (const char *mibdirs, const char *mibs)
+{
+	uint64_t key = 14695981039346656037ULL, files = 0, h;
+	struct dirent *de;
+	struct stat st;
+	char *dirs, *dir, *path;
+	DIR *d;
+	int64_t t;
+
+	key = mib_hash64 (key, mibdirs, strlen (mibdirs) + 1);
+	key = mib_hash64 (key, mibs, strlen (mibs) + 1);
+	dirs = strdup (mibdirs);
+	for (dir = strtok (dirs, ":"); dir; dir = strtok (NULL, ":")) {
+		if ((d = opendir (dir)) == NULL)
+			continue;
+		/* in whatever order readdir() gives them */
+		while ((de = readdir (d)) != NULL) {
+			if (de->d_name[0] == '.' || asprintf (&path, "%s/%s", dir, de->d_name) < 0)
+				continue;
+			if (stat (path, &st) == 0) {
+				h = mib_hash64 (14695981039346656037ULL, path, strlen (path));
+				t = (int64_t) st.st_mtime;
+				h = mib_hash64 (h, &t, sizeof (t));
+				t = (int64_t) st.st_size;
+				h = mib_hash64 (h, &t, sizeof (t));
+				files += h;
+			}
+			free (path);
+		}
+		closedir (d);
+	}
+	free (dirs);
+	return mib_hash64 (key, &files, sizeof (files));
+}
+
+char *
+np_snmp_state_path (const char *name)
+{
+	char *prefix, *dir, *path;
+
+	if ((prefix = _np_state_calculate_location_prefix ()) == NULL)
+		return NULL;
+	/* only the last two levels are created; no state directory, no cache */
+	if (asprintf (&dir, "%s/%lu", prefix, (unsigned long) geteuid ()) < 0)
+		return NULL;
+	if (access (prefix, W_OK) != 0 || (access (dir, F_OK) && mkdir (dir, S_IRWXU))) {
+		free (dir);
+		return NULL;
+	}
+	if (asprintf (&path, "%s/%s", dir, NP_SNMP_STATE_DIR) < 0)
+		path = NULL;
+	free (dir);
+	if (path && access (path, F_OK) && mkdir (path, S_IRWXU)) {
+		free (path);
+		return NULL;
+	}
+	if (path) {
+		dir = path;
+		if (asprintf (&path, "%s/%s", dir, name) < 0)
+			path = NULL;
+		free (dir);
+	}
+	return path;
+}
+
+np_snmp_mib_cache *
+np_snmp_mib_cache_open (const char *path, uint64_t key)
+{
+	np_snmp_mib_cache *cache;
+	const np_snmp_mib_cache_header *h;
+	struct stat st;
+	int fd;
+
+	if ((cache = calloc (1, sizeof (*cache))) == NULL || (cache->path = strdup (path)) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	cache->key = key;
+
+#ifdef HAVE_SYS_MMAN_H
+	if ((fd = open (path, O_RDONLY)) >= 0) {
+		if (fstat (fd, &st) == 0 && (size_t) st.st_size >= sizeof (*h)) {
+			cache->map_len = (size_t) st.st_size;
+			cache->map = mmap (NULL, cache->map_len, PROT_READ, MAP_SHARED, fd, 0);
+			if (cache->map == MAP_FAILED)
+				cache->map = NULL;
+		}
+		close (fd);
+	}
+	h = cache->map;
+	if (h && (memcmp (h->magic, NP_SNMP_MIB_CACHE_MAGIC, sizeof (h->magic)) || h->key != key ||
+	          h->buckets == 0 || (h->buckets & (h->buckets - 1)) ||
+	          cache->map_len != sizeof (*h) + h->buckets * sizeof (uint32_t) +
+	                            h->entries * sizeof (np_snmp_mib_cache_entry) + h->strings)) {
+		munmap (cache->map, cache->map_len);
+		cache->map = NULL;
+		h = NULL;
+	}
+	cache->h = h;
+#endif
+	return cache;
+}
+
+/* a string of the table, or NULL if the offset is out of it */
+static const char *
+mib_string (const np_snmp_mib_cache_header *h, uint32_t off)
+{
+	const char *strings = (const char *) h + h->buckets * sizeof (uint32_t) + sizeof (*h) +
+	                      h->entries * sizeof (np_snmp_mib_cache_entry);
+
+	if (off >= h->strings || !memchr (strings + off, '\0', h->strings - off))
+		return NULL;
+	return strings + off;
+}
+
+int
+np_snmp_mib_cache_lookup (np_snmp_mib_cache *cache, const char *name, np_snmp_mib_entry *entry)
+{
+	const np_snmp_mib_cache_header *h = cache->h;
+	const np_snmp_mib_cache_entry *ent;
+	const uint32_t *buckets;
+	const char *str;
+	uint32_t hash = mib_hash (name), e;
+	size_t i;
+
+	for (i = 0; i < cache->nadded; i++) {
+		if (!strcmp (cache->added[i * 4], name)) {
+			entry->oid = cache->added[i * 4 + 1];
+			entry->label = cache->added[i * 4 + 2];
+			entry->type = cache->added[i * 4 + 3];
+			return TRUE;
+		}
+	}
+	if (h == NULL)
+		return FALSE;
+
+	buckets = (const uint32_t *) (h + 1);
+	ent = (const np_snmp_mib_cache_entry *) (buckets + h->buckets);
+	for (e = buckets[hash & (h->buckets - 1)]; e && e <= h->entries; e = ent[e - 1].next) {
+		if (ent[e - 1].hash != hash || (str = mib_string (h, ent[e - 1].name)) == NULL || strcmp (str, name))
+			continue;
+		entry->oid = mib_string (h, ent[e - 1].oid);
+		entry->label = mib_string (h, ent[e - 1].label);
+		entry->type = mib_string (h, ent[e - 1].type);
+		return entry->oid && entry->label && entry->type;
+	}
+	return FALSE;
+}
+
+void
+np_snmp_mib_cache_add (np_snmp_mib_cache *cache, const char *name, const char *oid,
+                       const char *label, const char *type)
+{
+	char **added;
+
+	if ((added = realloc (cache->added, (cache->nadded + 1) * 4 * sizeof (*added))) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	cache->added = added;
+	added += cache->nadded++ * 4;
+	added[0] = strdup (name);
+	added[1] = strdup (oid);
+	added[2] = strdup (label ? label : name);
+	added[3] = strdup (type ? type : "");
+}
+
+/* the strings of entry i, old ones first, then the added ones */
+static void
+mib_entry_strings (const np_snmp_mib_cache *cache, size_t i, const char **str)
+{
+	const np_snmp_mib_cache_header *h = cache->h;
+	const np_snmp_mib_cache_entry *ent;
+	size_t old = h ? h->entries : 0;
+
+	if (i < old) {
+		ent = (const np_snmp_mib_cache_entry *) ((const uint32_t *) (h + 1) + h->buckets) + i;
+		str[0] = mib_string (h, ent->name);
+		str[1] = mib_string (h, ent->oid);
+		str[2] = mib_string (h, ent->label);
+		str[3] = mib_string (h, ent->type);
+	} else {
+		memcpy (str, cache->added + (i - old) * 4, 4 * sizeof (*str));
+	}
+}
+
+int
+np_snmp_mib_cache_save (np_snmp_mib_cache *cache)
+{
+	np_snmp_mib_cache_header *h;
+	np_snmp_mib_cache_entry *ent;
+	uint32_t *buckets, nbuckets;
+	const char *str[4];
+	char *file, *strings, *tmp;
+	size_t nent, len, str_len = 0, i, k;
+	int fd, ok;
+
+	if (cache->nadded == 0)
+		return TRUE;
+	nent = (cache->h ? cache->h->entries : 0) + cache->nadded;
+	for (i = 0; i < nent; i++) {
+		mib_entry_strings (cache, i, str);
+		for (k = 0; k < 4; k++)
+			str_len += str[k] ? strlen (str[k]) + 1 : 1;
+	}
+	if (str_len >= UINT32_MAX || nent >= UINT32_MAX / 2)
+		return FALSE;
+
+	for (nbuckets = 16; nbuckets < nent * 2; nbuckets <<= 1);
+	len = sizeof (*h) + nbuckets * sizeof (uint32_t) + nent * sizeof (*ent) + str_len;
+	if ((file = calloc (1, len)) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	h = (np_snmp_mib_cache_header *) file;
+	memcpy (h->magic, NP_SNMP_MIB_CACHE_MAGIC, sizeof (h->magic));
+	h->key = cache->key;
+	h->buckets = nbuckets;
+	h->entries = (uint32_t) nent;
+	h->strings = (uint32_t) str_len;
+	buckets = (uint32_t *) (h + 1);
+	ent = (np_snmp_mib_cache_entry *) (buckets + nbuckets);
+	strings = (char *) (ent + nent);
+
+	for (str_len = 0, i = 0; i < nent; i++) {
+		mib_entry_strings (cache, i, str);
+		for (k = 0; k < 4; k++) {
+			(&ent[i].name)[k] = (uint32_t) str_len;
+			if (str[k])
+				strcpy (strings + str_len, str[k]);
+			str_len += str[k] ? strlen (str[k]) + 1 : 1;
+		}
+		ent[i].hash = mib_hash (str[0] ? str[0] : "");
+		ent[i].next = buckets[ent[i].hash & (nbuckets - 1)];
+		buckets[ent[i].hash & (nbuckets - 1)] = (uint32_t) i + 1;
+	}
+
+	/* replace the old one atomically */
+	ok = asprintf (&tmp, "%s.XXXXXX", cache->path) >= 0;
+	if (ok && (fd = mkstemp (tmp)) >= 0) {
+		if (write (fd, file, len) != (ssize_t) len || close (fd) != 0 || rename (tmp, cache->path) != 0) {
+			unlink (tmp);
+			ok = FALSE;
+		}
+	} else {
+		ok = FALSE;
+	}
+	if (tmp)
+		free (tmp);
+	free (file);
+	return ok;
+}
+
+void
+np_snmp_mib_cache_close (np_snmp_mib_cache *cache)
+{
+	size_t i;
+
+#ifdef HAVE_SYS_MMAN_H
+	if (cache->map)
+		munmap (cache->map, cache->map_len);
+#endif
+	for (i = 0; i < cache->nadded * 4; i++)
+		free (cache->added[i]);
+	free (cache->added);
+	free (cache->path);
+	free (cache);
+}
+
+
+/* Rate state: the last value of each OID as a fixed size record, sorted
+ * by a hash of the OID, after a header with the last sysUpTime. When no
+ * OID is new the records are written back over the old ones. */
+#define NP_SNMP_RATE_MAGIC "NPRATES1"
+
+struct np_snmp_rate_header {
+	char magic[8];
+	uint32_t count;
+	uint32_t pad;
+	int64_t uptime_time;      /* when the agent said uptime, or 0 */
+	uint64_t uptime;          /* sysUpTime.0 in ticks */
+};
+
+struct np_snmp_rate_record {
+	uint64_t hash;
+	int64_t time;
+	uint64_t counter;
+	double value;
+};
+
+struct np_snmp_rate {
+	char *path;
+	struct np_snmp_rate_header h;
+	struct np_snmp_rate_record *records;
+	size_t count;             /* as read, then the new ones after them */
+	size_t size;
+	int changed;
+};
+
+static uint64_t
+rate_hash (const char *oid)
+{
+	return mib_hash64 (14695981039346656037ULL, oid, strlen (oid));
+}
+
+np_snmp_rate *
+np_snmp_rate_open (const char *path)
+{
+	np_snmp_rate *rate;
+	struct stat st;
+	size_t i;
+	int fd;
+
+	if ((rate = calloc (1, sizeof (*rate))) == NULL || (rate->path = strdup (path)) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	if ((fd = open (path, O_RDONLY)) < 0)
+		return rate;
+	if (fstat (fd, &st) == 0 && read (fd, &rate->h, sizeof (rate->h)) == sizeof (rate->h) &&
+	    !memcmp (rate->h.magic, NP_SNMP_RATE_MAGIC, sizeof (rate->h.magic)) &&
+	    (size_t) st.st_size == sizeof (rate->h) + rate->h.count * sizeof (*rate->records)) {
+		rate->size = rate->count = rate->h.count;
+		if ((rate->records = malloc (rate->size * sizeof (*rate->records) + 1)) == NULL)
+			die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+		if (read (fd, rate->records, rate->count * sizeof (*rate->records)) !=
+		    (ssize_t) (rate->count * sizeof (*rate->records)))
+			rate->count = 0;
+		/* they have to be in order for the search */
+		for (i = 1; i < rate->count; i++)
+			if (rate->records[i - 1].hash >= rate->records[i].hash)
+				rate->count = 0;
+	}
+	if (rate->count == 0)
+		memset (&rate->h, 0, sizeof (rate->h));
+	rate->h.count = (uint32_t) rate->count;
+	close (fd);
+	return rate;
+}
+
+static struct np_snmp_rate_record *
+rate_find (np_snmp_rate *rate, uint64_t hash)
+{
+	size_t lo = 0, hi = rate->h.count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (rate->records[mid].hash == hash)
+			return &rate->records[mid];
+		if (rate->records[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	/* added this run */
+	for (mid = rate->h.count; mid < rate->count; mid++)
+		if (rate->records[mid].hash == hash)
+			return &rate->records[mid];
+	return NULL;
+}
+
+int
+np_snmp_rate_get (np_snmp_rate *rate, const char *oid, time_t *time, uint64_t *counter, double *value)
+{
+	struct np_snmp_rate_record *r;
+
+	if ((r = rate_find (rate, rate_hash (oid))) == NULL || r->time == 0)
+		return FALSE;
+	*time = (time_t) r->time;
+	*counter = r->counter;
+	*value = r->value;
+	return TRUE;
+}
+
+void
+np_snmp_rate_set (np_snmp_rate *rate, const char *oid, time_t time, uint64_t counter, double value)
+{
+	struct np_snmp_rate_record *r;
+	uint64_t hash = rate_hash (oid);
+
+	if ((r = rate_find (rate, hash)) == NULL) {
+		if (rate->count == rate->size) {
+			rate->size = rate->size ? rate->size * 2 : 16;
+			if ((rate->records = realloc (rate->records, rate->size * sizeof (*rate->records))) == NULL)
+				die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+		}
+		r = &rate->records[rate->count++];
+		r->hash = hash;
+	}
+	r->time = (int64_t) time;
+	r->counter = counter;
+	r->value = value;
+	rate->changed = TRUE;
+}
+
+int
+np_snmp_rate_restarted (np_snmp_rate *rate, time_t now, uint64_t uptime)
+{
+	uint64_t expected;
+	int restarted = FALSE;
+
+	if (rate->h.uptime_time && now >= rate->h.uptime_time) {
+		/* sysUpTime is a TimeTicks and wraps after 497 days */
+		expected = rate->h.uptime + (uint64_t) (now - rate->h.uptime_time) * 100;
+		restarted = uptime < rate->h.uptime && expected < 4294967296ULL;
+	}
+	rate->h.uptime_time = (int64_t) now;
+	rate->h.uptime = uptime;
+	rate->changed = TRUE;
+	return restarted;
+}
+
+double
+np_snmp_counter_delta (uint64_t old, uint64_t new, int bits)
+{
+	uint64_t delta = new - old;
+
+	if (bits < 64)
+		delta &= ((uint64_t) 1 << bits) - 1;
+	return (double) delta;
+}
+
+static int
+rate_compare (const void *a, const void *b)
+{
+	const struct np_snmp_rate_record *x = a, *y = b;
+
+	return x->hash < y->hash ? -1 : x->hash > y->hash;
+}
+
+int
+np_snmp_rate_save (np_snmp_rate *rate)
+{
+	struct np_snmp_rate_header h;
+	size_t len;
+	char *tmp;
+	int fd, ok = FALSE;
+
+	if (!rate->changed)
+		return TRUE;
+	len = rate->count * sizeof (*rate->records);
+	h = rate->h;
+	memcpy (h.magic, NP_SNMP_RATE_MAGIC, sizeof (h.magic));
+
+	/* the same OIDs as last time: over the old records */
+	if (rate->count == rate->h.count && (fd = open (rate->path, O_WRONLY)) >= 0) {
+		ok = pwrite (fd, &h, sizeof (h), 0) == sizeof (h) &&
+		     pwrite (fd, rate->records, len, sizeof (rate->h)) == (ssize_t) len;
+		ok = close (fd) == 0 && ok;
+		if (ok)
+			return TRUE;
+	}
+
+	qsort (rate->records, rate->count, sizeof (*rate->records), rate_compare);
+	h.count = rate->h.count = (uint32_t) rate->count;
+	if (asprintf (&tmp, "%s.XXXXXX", rate->path) < 0)
+		return FALSE;
+	if ((fd = mkstemp (tmp)) >= 0) {
+		/* like the state files */
+		fchmod (fd, S_IRUSR | S_IWUSR | S_IRGRP);
+		ok = write (fd, &h, sizeof (h)) == sizeof (h) &&
+		     write (fd, rate->records, len) == (ssize_t) len;
+		ok = close (fd) == 0 && ok && rename (tmp, rate->path) == 0;
+		if (!ok)
+			unlink (tmp);
+	}
+	free (tmp);
+	return ok;
+}
+
+void
+np_snmp_rate_close (np_snmp_rate *rate)
+{
+	free (rate->records);
+	free (rate->path);
+	free (rate);
+}
+
+
+/* The response cache: a header and then, for each OID, when its value
+ * was received, the lengths of the OID and of its line and the two
+ * texts. Every check that saves reads the file again first, so that
+ * checks running at the same time keep each other's values. */
+#define NP_SNMP_RESPONSE_MAGIC "NPRESP01"
+#define NP_SNMP_RESPONSE_MAX_TEXT 65536
+
+struct np_snmp_response_record {
+	int64_t time;
+	uint32_t oid_len;
+	uint32_t line_len;
+};
+
+struct np_snmp_response_entry {
+	time_t time;
+	char *oid;
+	char *line;
+};
+
+struct np_snmp_response_cache {
+	char *path;
+	time_t now;
+	int ttl;
+	struct np_snmp_response_entry *entries;
+	size_t count;
+	size_t size;
+	int changed;
+};
+
+static struct np_snmp_response_entry *
+response_find (np_snmp_response_cache *cache, const char *oid)
+{
+	size_t i;
+
+	for (i = 0; i < cache->count; i++)
+		if (!strcmp (cache->entries[i].oid, oid))
+			return &cache->entries[i];
+	return NULL;
+}
+
+static void
+response_add (np_snmp_response_cache *cache, time_t when, char *oid, char *line)
+{
+	if (cache->count == cache->size) {
+		cache->size = cache->size ? cache->size * 2 : 16;
+		if ((cache->entries = realloc (cache->entries, cache->size * sizeof (*cache->entries))) == NULL)
+			die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	}
+	cache->entries[cache->count].time = when;
+	cache->entries[cache->count].oid = oid;
+	cache->entries[cache->count].line = line;
+	cache->count++;
+}
+
+/* the fresh values of the file the cache does not have yet */
+static void
+response_load (np_snmp_response_cache *cache)
+{
+	struct np_snmp_response_record r;
+	char magic[sizeof (NP_SNMP_RESPONSE_MAGIC) - 1];
+	char *oid, *line;
+	FILE *fp;
+
+	if ((fp = fopen (cache->path, "r")) == NULL)
+		return;
+	if (fread (magic, sizeof (magic), 1, fp) != 1 || memcmp (magic, NP_SNMP_RESPONSE_MAGIC, sizeof (magic))) {
+		fclose (fp);
+		return;
+	}
+	while (fread (&r, sizeof (r), 1, fp) == 1) {
+		if (r.oid_len > NP_SNMP_RESPONSE_MAX_TEXT || r.line_len > NP_SNMP_RESPONSE_MAX_TEXT)
+			break;
+		if ((oid = malloc (r.oid_len + 1)) == NULL || (line = malloc (r.line_len + 1)) == NULL)
+			die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+		if ((r.oid_len && fread (oid, r.oid_len, 1, fp) != 1) ||
+		    (r.line_len && fread (line, r.line_len, 1, fp) != 1)) {
+			free (oid);
+			free (line);
+			break;
+		}
+		oid[r.oid_len] = line[r.line_len] = '\0';
+		/* a value from the future is a clock that went back */
+		if (r.time > cache->now || cache->now - r.time >= cache->ttl || response_find (cache, oid)) {
+			free (oid);
+			free (line);
+			continue;
+		}
+		response_add (cache, (time_t) r.time, oid, line);
+	}
+	fclose (fp);
+}
+
+np_snmp_response_cache *
+np_snmp_response_cache_open (const char *path, time_t now, int ttl)
+{
+	np_snmp_response_cache *cache;
+
+	if ((cache = calloc (1, sizeof (*cache))) == NULL || (cache->path = strdup (path)) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	cache->now = now;
+	cache->ttl = ttl;
+	response_load (cache);
+	return cache;
+}
+
+const char *
+np_snmp_response_cache_get (np_snmp_response_cache *cache, const char *oid)
+{
+	struct np_snmp_response_entry *e = response_find (cache, oid);
+
+	return e ? e->line : NULL;
+}
+
+void
+np_snmp_response_cache_put (np_snmp_response_cache *cache, const char *oid, const char *line)
+{
+	struct np_snmp_response_entry *e = response_find (cache, oid);
+	char *copy, *key = NULL;
+
+	if ((copy = strdup (line)) == NULL || (!e && (key = strdup (oid)) == NULL))
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	if (e) {
+		free (e->line);
+		e->line = copy;
+		e->time = cache->now;
+	} else {
+		response_add (cache, cache->now, key, copy);
+	}
+	cache->changed = TRUE;
+}
+
+int
+np_snmp_response_cache_save (np_snmp_response_cache *cache)
+{
+	struct np_snmp_response_record r;
+	struct np_snmp_response_entry *e;
+	char *tmp;
+	size_t i;
+	int fd, ok = FALSE;
+	FILE *fp;
+
+	if (!cache->changed)
+		return TRUE;
+	response_load (cache);
+	if (asprintf (&tmp, "%s.XXXXXX", cache->path) < 0)
+		return FALSE;
+	if ((fd = mkstemp (tmp)) >= 0) {
+		/* like the state files */
+		fchmod (fd, S_IRUSR | S_IWUSR | S_IRGRP);
+		if ((fp = fdopen (fd, "w")) == NULL) {
+			close (fd);
+		} else {
+			ok = fwrite (NP_SNMP_RESPONSE_MAGIC, sizeof (NP_SNMP_RESPONSE_MAGIC) - 1, 1, fp) == 1;
+			for (i = 0; ok && i < cache->count; i++) {
+				e = &cache->entries[i];
+				r.time = (int64_t) e->time;
+				r.oid_len = (uint32_t) strlen (e->oid);
+				r.line_len = (uint32_t) strlen (e->line);
+				if (r.oid_len > NP_SNMP_RESPONSE_MAX_TEXT || r.line_len > NP_SNMP_RESPONSE_MAX_TEXT)
+					continue;
+				ok = fwrite (&r, sizeof (r), 1, fp) == 1 &&
+				     fwrite (e->oid, 1, r.oid_len, fp) == r.oid_len &&
+				     fwrite (e->line, 1, r.line_len, fp) == r.line_len;
+			}
+			ok = fclose (fp) == 0 && ok && rename (tmp, cache->path) == 0;
+		}
+		if (!ok)
+			unlink (tmp);
+	}
+	free (tmp);
+	if (ok)
+		cache->changed = FALSE;
+	return ok;
+}
+
+void
+np_snmp_response_cache_close (np_snmp_response_cache *cache)
+{
+	size_t i;
+
+	for (i = 0; i < cache->count; i++) {
+		free (cache->entries[i].oid);
+		free (cache->entries[i].line);
+	}
+	free (cache->entries);
+	free (cache->path);
+	free (cache);
+}
@@ -0,0 +1,201 @@
+#ifndef NAGIOS_UTILS_SNMP_H_INCLUDED
+#define NAGIOS_UTILS_SNMP_H_INCLUDED
+/* Header file for nagios plugins utils_snmp.c */
+
+/* A minimal SNMP engine: BER encoding and decoding of v1 and v2c
+ * messages, and a request/response exchange over a connected UDP
+ * socket. Enough for check_snmp to send GET/GETNEXT/GETBULK PDUs itself
+ * instead of running snmpget. There is no MIB support; OIDs are
+ * numeric. */
+
+#define NP_SNMP_MAX_OID 128          /* sub-identifiers, as in RFC 2578 */
+#define NP_SNMP_MAX_MESSAGE 65507    /* the largest UDP payload */
+
+/* message versions */
+#define NP_SNMP_VERSION_1 0
+#define NP_SNMP_VERSION_2C 1
+
+/* PDU types */
+#define NP_SNMP_GET 0xa0
+#define NP_SNMP_GETNEXT 0xa1
+#define NP_SNMP_RESPONSE 0xa2
+#define NP_SNMP_SET 0xa3
+#define NP_SNMP_GETBULK 0xa5
+
+/* value types */
+#define NP_SNMP_INTEGER 0x02
+#define NP_SNMP_OCTET_STRING 0x04
+#define NP_SNMP_NULL 0x05
+#define NP_SNMP_OBJECT_ID 0x06
+#define NP_SNMP_IPADDRESS 0x40
+#define NP_SNMP_COUNTER32 0x41
+#define NP_SNMP_GAUGE32 0x42
+#define NP_SNMP_TIMETICKS 0x43
+#define NP_SNMP_OPAQUE 0x44
+#define NP_SNMP_COUNTER64 0x46
+#define NP_SNMP_NO_SUCH_OBJECT 0x80
+#define NP_SNMP_NO_SUCH_INSTANCE 0x81
+#define NP_SNMP_END_OF_MIB_VIEW 0x82
+
+/* np_snmp_query() results */
+#define NP_SNMP_OK 0
+#define NP_SNMP_TIMEOUT 1
+#define NP_SNMP_ERROR 2
+
+typedef struct np_snmp_oid {
+	unsigned int len;
+	uint32_t id[NP_SNMP_MAX_OID];
+} np_snmp_oid;
+
+typedef struct np_snmp_varbind {
+	np_snmp_oid oid;
+	int type;
+	int64_t integer;          /* INTEGER */
+	uint64_t counter;         /* Counter32/64, Gauge32, TimeTicks */
+	np_snmp_oid value_oid;    /* OBJECT IDENTIFIER */
+	const unsigned char *data; /* OCTET STRING, IpAddress, Opaque */
+	size_t length;
+} np_snmp_varbind;
+
+typedef struct np_snmp_pdu {
+	int version;
+	const unsigned char *community;
+	size_t community_len;
+	int type;
+	int32_t request_id;
+	int error_status;         /* non-repeaters for GETBULK */
+	int error_index;          /* max-repetitions for GETBULK */
+	np_snmp_varbind *varbinds;
+	size_t count;
+	size_t size;
+	unsigned char *packet;    /* a decoded message, data points into it */
+} np_snmp_pdu;
+
+/* an empty PDU with a fresh request id; the community is not copied */
+void np_snmp_pdu_init (np_snmp_pdu *, int, const char *, int);
+/* append a varbind for the OID, NULL valued */
+np_snmp_varbind *np_snmp_pdu_add (np_snmp_pdu *, const np_snmp_oid *);
+void np_snmp_pdu_free (np_snmp_pdu *);
+
+/* returns the length of the message, or -1 if it does not fit */
+int np_snmp_encode (const np_snmp_pdu *, unsigned char *, size_t);
+/* returns FALSE for anything that is not a well formed message */
+int np_snmp_decode (const unsigned char *, size_t, np_snmp_pdu *);
+
+/* "1.3.6.1.2.1.1.3.0", optionally with a leading "." or "iso" */
+int np_snmp_parse_oid (const char *, np_snmp_oid *);
+/* the numeric form, as "iso.3.6..." if iso is TRUE (like snmpget -m '') */
+char *np_snmp_oid_string (const np_snmp_oid *, int, char *, size_t);
+int np_snmp_oid_compare (const np_snmp_oid *, const np_snmp_oid *);
+/* TRUE if the first OID is below the second one (not equal to it) */
+int np_snmp_oid_in_subtree (const np_snmp_oid *, const np_snmp_oid *);
+
+/* a malloc'd "TYPE: value" text of the value, the way snmpget prints it */
+char *np_snmp_format_value (const np_snmp_varbind *);
+/* the net-snmp text for an error-status */
+const char *np_snmp_error_string (int);
+
+/* Send the request on a connected UDP socket and wait up to timeout_ms
+ * for the response with its request id, resending retries times. */
+int np_snmp_query (int, const np_snmp_pdu *, np_snmp_pdu *, int, int);
+
+/* one agent of np_snmp_query_targets() */
+typedef struct np_snmp_target {
+	const char *host;
+	int status;               /* NP_SNMP_OK, NP_SNMP_TIMEOUT or NP_SNMP_ERROR */
+	const char *error;        /* what the NP_SNMP_ERROR was */
+	np_snmp_pdu response;     /* if NP_SNMP_OK */
+	/* for np_snmp_query_targets() */
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int sd;
+	int tries;
+	int64_t deadline;
+	int done;
+} np_snmp_target;
+
+/* Send the request to every target and wait for their responses, at most
+ * concurrency at a time, each with its own timeout_ms and retries. The
+ * targets get count request ids from that of the request on. FALSE if
+ * memory ran out. */
+int np_snmp_query_targets (np_snmp_target *, size_t, const char *, int, const np_snmp_pdu *,
+                           size_t, int, int);
+/* the responses and errors of np_snmp_query_targets() */
+void np_snmp_targets_free (np_snmp_target *, size_t);
+
+/* SNMPv3 is left to snmpget; this is just enough to save it the work
+ * of finding the engine of an agent and localizing keys every time */
+#define NP_SNMP_MAX_ENGINE_ID 32     /* octets, RFC 3411 */
+#define NP_SNMP_MAX_KEY 64           /* a SHA-512 localized key */
+
+typedef struct np_snmp_engine {
+	unsigned char id[NP_SNMP_MAX_ENGINE_ID];
+	size_t id_len;
+	long boots;
+	long time;
+} np_snmp_engine;
+
+/* engine discovery on a connected UDP socket, like np_snmp_query() */
+int np_snmp_discover_engine (int, np_snmp_engine *, int, int);
+/* the key for a password and engine, for an -a protocol of snmpget
+ * (MD5, SHA, SHA-224 ...); FALSE if the protocol is not known */
+int np_snmp_localize_key (const char *, const char *, const unsigned char *, size_t,
+                          unsigned char *, size_t *);
+
+/* A persistent cache of MIB name translations, so that a name is only
+ * looked up in the MIBs (by snmptranslate) the first time it is used.
+ * The key covers the MIB files themselves; see np_snmp_mib_cache_key(). */
+typedef struct np_snmp_mib_cache np_snmp_mib_cache;
+
+typedef struct np_snmp_mib_entry {
+	const char *oid;          /* numeric, "1.3.6.1.2.1.2.2.1.10.1" */
+	const char *label;        /* as snmpget prints it, "IF-MIB::ifInOctets.1" */
+	const char *type;         /* the SYNTAX, "Counter32", or "" */
+} np_snmp_mib_entry;
+
+/* from the directories (colon separated) and names of the MIBs loaded */
+uint64_t np_snmp_mib_cache_key (const char *, const char *);
+/* a file of that name in the SNMP state directory, or NULL if there is
+ * no state directory */
+char *np_snmp_state_path (const char *);
+/* never fails; a missing or stale file is an empty cache */
+np_snmp_mib_cache *np_snmp_mib_cache_open (const char *, uint64_t);
+/* the strings stay valid until the cache is closed */
+int np_snmp_mib_cache_lookup (np_snmp_mib_cache *, const char *, np_snmp_mib_entry *);
+void np_snmp_mib_cache_add (np_snmp_mib_cache *, const char *, const char *, const char *, const char *);
+/* write the file again if anything was added */
+int np_snmp_mib_cache_save (np_snmp_mib_cache *);
+void np_snmp_mib_cache_close (np_snmp_mib_cache *);
+
+/* The values of the last run, for rates: one binary record per OID,
+ * found by a hash of the OID text, plus the sysUpTime of the agent. */
+typedef struct np_snmp_rate np_snmp_rate;
+
+/* never fails; a missing or damaged file has no records */
+np_snmp_rate *np_snmp_rate_open (const char *);
+/* FALSE if the OID has no value yet */
+int np_snmp_rate_get (np_snmp_rate *, const char *, time_t *, uint64_t *, double *);
+void np_snmp_rate_set (np_snmp_rate *, const char *, time_t, uint64_t, double);
+/* record the sysUpTime of now; TRUE if it went back, the agent restarted */
+int np_snmp_rate_restarted (np_snmp_rate *, time_t, uint64_t);
+/* the increase of a Counter32 (32) or Counter64 (64), across a wrap */
+double np_snmp_counter_delta (uint64_t, uint64_t, int);
+/* in place if no OID was added, else the file is written again */
+int np_snmp_rate_save (np_snmp_rate *);
+void np_snmp_rate_close (np_snmp_rate *);
+
+/* Responses of an agent kept for a few seconds, for other checks of the
+ * same agent: the line check_snmp made of each OID's value, by OID. */
+typedef struct np_snmp_response_cache np_snmp_response_cache;
+
+/* never fails; only values received less than ttl seconds before now
+ * are read from the file */
+np_snmp_response_cache *np_snmp_response_cache_open (const char *, time_t, int);
+/* NULL if the OID has no fresh value */
+const char *np_snmp_response_cache_get (np_snmp_response_cache *, const char *);
+void np_snmp_response_cache_put (np_snmp_response_cache *, const char *, const char *);
+/* merged with what other checks saved in the meantime */
+int np_snmp_response_cache_save (np_snmp_response_cache *);
+void np_snmp_response_cache_close (np_snmp_response_cache *);
+
+#endif /* NAGIOS_UTILS_SNMP_H_INCLUDED */
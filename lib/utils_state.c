@@ -0,0 +1,311 @@
+/*****************************************************************************
+*
+* utils_state.c
+*
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+*
+* Memory mapped state store for the np_state_* routines
+*
+* The store is a fixed size, open addressing hash table in one file that
+* every plugin maps shared. Slots are keyed by the SHA1 of the plugin name
+* and the state key name. Each slot carries a sequence counter used as a
+* seqlock: writers make it odd while they update the slot, readers retry
+* if it was odd or changed while they copied the slot out. There is no
+* global lock, only cross-process atomics on the slot being touched.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_state.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+/* how often to retry a slot held by another writer before taking it over
+ * (the other writer died half way) or by a reader before giving up */
+#define NP_STATE_STORE_SPINS 10000
+
+struct np_store_header {
+	char	magic[8];
+	uint32_t	slots;
+	uint32_t	slot_size;
+	char	pad[48];
+};
+
+struct np_store_slot {
+	uint32_t	seq;		/* odd while a writer is updating the slot */
+	uint32_t	used;
+	unsigned char	key[20];
+	int32_t	data_version;
+	int64_t	time;
+	uint32_t	length;
+	char	data[NP_STATE_STORE_DATA];
+};
+
+static struct np_store_header *store = NULL;
+static struct np_store_slot *store_slots = NULL;
+static size_t store_size = 0;
+static char *store_path = NULL;
+
+static const char *
+_np_state_store_location (void)
+{
+	const char *path;
+
+	/* same rule as NAGIOS_PLUGIN_STATE_DIRECTORY */
+	if (np_suid ())
+		return NULL;
+	path = getenv ("NAGIOS_PLUGIN_STATE_STORE");
+	return (path && path[0] != '\0') ? path : NULL;
+}
+
+void
+np_state_store_close (void)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (store)
+		munmap (store, store_size);
+#endif
+	store = NULL;
+	store_slots = NULL;
+	store_size = 0;
+	free (store_path);
+	store_path = NULL;
+}
+
+/* map the store, creating it if needed; FALSE if it cannot be used */
+static int
+_np_state_store_map (const char *path)
+{
+#ifdef HAVE_SYS_MMAN_H
+	struct np_store_header header;
+	struct flock lock;
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd;
+
+	if ((fd = open (path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) < 0)
+		return FALSE;
+
+	/* only creation is locked, the table itself is not */
+	memset (&lock, 0, sizeof (lock));
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	while (fcntl (fd, F_SETLKW, &lock) < 0 && errno == EINTR);
+
+	if (fstat (fd, &st) == 0 && st.st_size == 0) {
+		memset (&header, 0, sizeof (header));
+		memcpy (header.magic, NP_STATE_STORE_MAGIC, sizeof (header.magic));
+		header.slots = NP_STATE_STORE_SLOTS;
+		header.slot_size = sizeof (struct np_store_slot);
+		size = sizeof (header) + (size_t) header.slots * header.slot_size;
+		if (ftruncate (fd, (off_t) size) < 0 ||
+		    pwrite (fd, &header, sizeof (header), 0) != sizeof (header))
+			ftruncate (fd, 0);
+	}
+
+	lock.l_type = F_UNLCK;
+	fcntl (fd, F_SETLK, &lock);
+
+	if (pread (fd, &header, sizeof (header), 0) != sizeof (header) ||
+	    memcmp (header.magic, NP_STATE_STORE_MAGIC, sizeof (header.magic)) ||
+	    header.slot_size != sizeof (struct np_store_slot) ||
+	    header.slots == 0 || (header.slots & (header.slots - 1)) ||
+	    fstat (fd, &st) < 0) {
+		close (fd);
+		return FALSE;
+	}
+	size = sizeof (header) + (size_t) header.slots * header.slot_size;
+	if ((size_t) st.st_size < size) {
+		close (fd);
+		return FALSE;
+	}
+
+	map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED)
+		return FALSE;
+
+	store = map;
+	store_slots = (struct np_store_slot *) ((char *) map + sizeof (header));
+	store_size = size;
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+int
+np_state_store_enabled (void)
+{
+	const char *path = _np_state_store_location ();
+
+	if (path == NULL)
+		return FALSE;
+	/* a resident worker keeps the mapping between checks */
+	if (store && store_path && !strcmp (store_path, path))
+		return TRUE;
+
+	np_state_store_close ();
+	if (!_np_state_store_map (path))
+		return FALSE;
+	if ((store_path = strdup (path)) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot execute strdup:"), strerror (errno));
+	return TRUE;
+}
+
+static void
+_np_state_store_key (const char *plugin_name, const char *name, unsigned char *key)
+{
+	struct sha1_ctx ctx;
+
+	sha1_init_ctx (&ctx);
+	sha1_process_bytes (plugin_name, strlen (plugin_name) + 1, &ctx);
+	sha1_process_bytes (name, strlen (name), &ctx);
+	sha1_finish_ctx (&ctx, key);
+}
+
+static uint32_t
+_np_state_store_hash (const unsigned char *key)
+{
+	return ((uint32_t) key[0] << 24 | (uint32_t) key[1] << 16 |
+	        (uint32_t) key[2] << 8 | (uint32_t) key[3]) & (store->slots - 1);
+}
+
+static int
+_np_state_slot_lock (struct np_store_slot *slot)
+{
+	uint32_t seq = 0, last = 0;
+	int spins;
+
+	for (spins = 0; spins < NP_STATE_STORE_SPINS; spins++) {
+		seq = *(volatile uint32_t *) &slot->seq;
+		if (!(seq & 1) && __sync_bool_compare_and_swap (&slot->seq, seq, seq + 1))
+			return TRUE;
+		if (seq != last)
+			spins = 0;
+		last = seq;
+	}
+	/* the writer stopped half way; keep the counter odd and carry on */
+	return (seq & 1) && __sync_bool_compare_and_swap (&slot->seq, seq, seq + 2);
+}
+
+static void
+_np_state_slot_unlock (struct np_store_slot *slot)
+{
+	__sync_fetch_and_add (&slot->seq, 1);
+}
+
+int
+np_state_store_read (const char *plugin_name, const char *name, int data_version,
+                     time_t *data_time, char **data)
+{
+	struct np_store_slot copy;
+	struct np_store_slot *slot;
+	unsigned char key[20];
+	uint32_t h, seq;
+	int probe, spins;
+
+	if (!store)
+		return FALSE;
+
+	_np_state_store_key (plugin_name, name, key);
+	h = _np_state_store_hash (key);
+	for (probe = 0; probe < NP_STATE_STORE_PROBES; probe++) {
+		slot = &store_slots[(h + probe) & (store->slots - 1)];
+
+		for (spins = 0; spins < NP_STATE_STORE_SPINS; spins++) {
+			seq = *(volatile uint32_t *) &slot->seq;
+			if (seq & 1)
+				continue;
+			__sync_synchronize ();
+			memcpy (&copy, slot, sizeof (copy));
+			__sync_synchronize ();
+			if (*(volatile uint32_t *) &slot->seq == seq)
+				break;
+		}
+		if (spins == NP_STATE_STORE_SPINS)
+			return FALSE;
+
+		/* keys are never removed, so an empty slot ends the chain */
+		if (!copy.used)
+			return FALSE;
+		if (memcmp (copy.key, key, sizeof (key)))
+			continue;
+
+		if (copy.data_version != data_version || copy.length >= NP_STATE_STORE_DATA ||
+		    copy.time > (int64_t) time (NULL))
+			return FALSE;
+		copy.data[copy.length] = '\0';
+		if ((*data = strdup (copy.data)) == NULL)
+			die (STATE_UNKNOWN, "%s %s\n", _("Cannot execute strdup:"), strerror (errno));
+		*data_time = (time_t) copy.time;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+int
+np_state_store_write (const char *plugin_name, const char *name, int data_version,
+                      time_t data_time, const char *data)
+{
+	struct np_store_slot *slot;
+	unsigned char key[20];
+	size_t len = strlen (data);
+	uint32_t h;
+	int probe;
+
+	if (!store || len >= NP_STATE_STORE_DATA)
+		return FALSE;
+
+	_np_state_store_key (plugin_name, name, key);
+	h = _np_state_store_hash (key);
+	for (probe = 0; probe < NP_STATE_STORE_PROBES; probe++) {
+		slot = &store_slots[(h + probe) & (store->slots - 1)];
+
+		/* cheap unlocked look first, checked again under the lock */
+		if (slot->used && memcmp (slot->key, key, sizeof (key)))
+			continue;
+		if (!_np_state_slot_lock (slot))
+			return FALSE;
+		if (slot->used && memcmp (slot->key, key, sizeof (key))) {
+			/* another key claimed the slot meanwhile */
+			_np_state_slot_unlock (slot);
+			continue;
+		}
+
+		__sync_synchronize ();
+		memcpy (slot->key, key, sizeof (key));
+		slot->data_version = data_version;
+		slot->time = (int64_t) data_time;
+		slot->length = (uint32_t) len;
+		memcpy (slot->data, data, len + 1);
+		slot->used = 1;
+		__sync_synchronize ();
+		_np_state_slot_unlock (slot);
+		return TRUE;
+	}
+
+	return FALSE;
+}
@@ -0,0 +1,29 @@
+#ifndef NAGIOS_UTILS_STATE_H_INCLUDED
+#define NAGIOS_UTILS_STATE_H_INCLUDED
+/* Header file for nagios plugins utils_state.c */
+
+/* Memory mapped state store, an optional backend for np_state_read() and
+ * np_state_write_string(). Instead of one file per key, all keys live in
+ * one shared hash table, so storing state does not create and rename a
+ * file per check run.
+ *
+ * Enabled by pointing NAGIOS_PLUGIN_STATE_STORE at the store file (never
+ * for setuid plugins). It is created on first use. When it is unset,
+ * unusable or full, the state file backend is used as before. */
+
+#define NP_STATE_STORE_MAGIC "NPSTORE1"
+#define NP_STATE_STORE_SLOTS 65536	/* must be a power of 2 */
+#define NP_STATE_STORE_PROBES 64	/* linear probes before giving up */
+#define NP_STATE_STORE_DATA 1024	/* same limit as the state files */
+
+/* returns TRUE if the store is configured and mapped */
+int np_state_store_enabled(void);
+/* Returns TRUE and fills in time and a malloc'd copy of the data if the key
+ * holds data of the given version. */
+int np_state_store_read(const char *, const char *, int, time_t *, char **);
+/* returns FALSE if the data could not be stored (too long, table full) */
+int np_state_store_write(const char *, const char *, int, time_t, const char *);
+/* unmaps the store; the next call maps it again */
+void np_state_store_close(void);
+
+#endif /* NAGIOS_UTILS_STATE_H_INCLUDED */
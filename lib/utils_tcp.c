@@ -27,6 +27,7 @@
 *****************************************************************************/
 
 #include "common.h"
+#include "utils_base.h"
 #include "utils_tcp.h"
 
 #define VERBOSE(message)                        \
@@ -35,41 +36,218 @@
 			puts(message);          \
 	} while (0)
 
+/* A trie node; the children of a node are a list of siblings */
+struct np_expect_node {
+	int child;
+	int sibling;
+	int fail;        /* longest proper suffix that is also in the trie */
+	int output;      /* nearest node down the fail links that ends a string */
+	int first;       /* first string ending here, -1 if none */
+	unsigned char c;
+};
+
+struct np_expect {
+	struct np_expect_node *nodes;
+	int node_count;
+	int *next;       /* next string ending at the same node */
+	char *matched;
+	int count;
+	int match_count;
+	int flags;
+	int state;
+	int alive;       /* exact mode: still on a path from the root */
+	size_t consumed; /* of the data last fed */
+};
+
+static int
+np_expect_child(const np_expect *e, int node, unsigned char c)
+{
+	int i;
+
+	for (i = e->nodes[node].child; i >= 0; i = e->nodes[i].sibling)
+		if (e->nodes[i].c == c)
+			return i;
+	return -1;
+}
+
+np_expect *
+np_expect_new(char **server_expect, int expect_count, int flags)
+{
+	np_expect *e;
+	const unsigned char *p;
+	int i, node, child, size, *queue, head = 0, tail = 0;
+
+	if ((e = calloc(1, sizeof(*e))) == NULL)
+		die(STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror(errno));
+	e->count = expect_count;
+	e->flags = flags;
+	e->alive = 1;
+
+	/* at most one node for each byte of the strings, and the root */
+	size = 1;
+	for (i = 0; i < expect_count; i++)
+		size += strlen(server_expect[i]);
+	e->nodes = malloc(size * sizeof(*e->nodes));
+	e->next = malloc((expect_count + 1) * sizeof(int));
+	e->matched = calloc(expect_count + 1, 1);
+	queue = malloc(size * sizeof(int));
+	if (e->nodes == NULL || e->next == NULL || e->matched == NULL || queue == NULL)
+		die(STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror(errno));
+
+	e->nodes[0].child = e->nodes[0].sibling = -1;
+	e->nodes[0].fail = e->nodes[0].output = 0;
+	e->nodes[0].first = -1;
+	e->node_count = 1;
+
+	for (i = 0; i < expect_count; i++) {
+		node = 0;
+		for (p = (const unsigned char *)server_expect[i]; *p; p++) {
+			if ((child = np_expect_child(e, node, *p)) < 0) {
+				child = e->node_count++;
+				e->nodes[child].c = *p;
+				e->nodes[child].child = -1;
+				e->nodes[child].first = -1;
+				e->nodes[child].sibling = e->nodes[node].child;
+				e->nodes[node].child = child;
+			}
+			node = child;
+		}
+		e->next[i] = e->nodes[node].first;
+		e->nodes[node].first = i;
+	}
+
+	/* an empty string is found before any data */
+	for (i = e->nodes[0].first; i >= 0; i = e->next[i]) {
+		e->matched[i] = 1;
+		e->match_count++;
+	}
+
+	/* fail and output links, breadth first so each node's fail is done
+	 * before its children need it */
+	for (child = e->nodes[0].child; child >= 0; child = e->nodes[child].sibling) {
+		e->nodes[child].fail = 0;
+		e->nodes[child].output = 0;
+		queue[tail++] = child;
+	}
+	while (head < tail) {
+		node = queue[head++];
+		for (child = e->nodes[node].child; child >= 0; child = e->nodes[child].sibling) {
+			int f = e->nodes[node].fail, to;
+
+			while ((to = np_expect_child(e, f, e->nodes[child].c)) < 0 && f)
+				f = e->nodes[f].fail;
+			f = to >= 0 ? to : 0;
+			e->nodes[child].fail = f;
+			e->nodes[child].output = e->nodes[f].first >= 0 ? f : e->nodes[f].output;
+			queue[tail++] = child;
+		}
+	}
+	free(queue);
+
+	return e;
+}
+
+static void
+np_expect_mark(np_expect *e, int node)
+{
+	int i;
+
+	for (i = e->nodes[node].first; i >= 0; i = e->next[i])
+		if (!e->matched[i]) {
+			e->matched[i] = 1;
+			e->match_count++;
+		}
+}
+
+static int
+np_expect_done(const np_expect *e)
+{
+	return (e->flags & NP_MATCH_ALL) ? e->match_count == e->count : e->match_count >= 1;
+}
+
+enum np_match_result
+np_expect_feed(np_expect *e, const char *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data, *end = p + len;
+	int node, to;
+
+	/* verbose callers are told about every string, so do not stop early */
+	for (; p < end && (!np_expect_done(e) || (e->flags & NP_MATCH_VERBOSE)); p++) {
+		if (e->flags & NP_MATCH_EXACT) {
+			/* anchored: only the path from the root can match */
+			if (!e->alive)
+				break;
+			if ((to = np_expect_child(e, e->state, *p)) < 0) {
+				e->alive = 0;
+				break;
+			}
+			e->state = to;
+			np_expect_mark(e, to);
+			continue;
+		}
+
+		node = e->state;
+		while ((to = np_expect_child(e, node, *p)) < 0 && node)
+			node = e->nodes[node].fail;
+		e->state = node = to >= 0 ? to : 0;
+		for (; node; node = e->nodes[node].output)
+			np_expect_mark(e, node);
+	}
+	e->consumed = (size_t)(p - (const unsigned char *)data);
+
+	if (np_expect_done(e))
+		return NP_MATCH_SUCCESS;
+	/* exact: a string the data so far is the start of may still come */
+	if (!(e->flags & NP_MATCH_EXACT) || (e->alive && e->nodes[e->state].child >= 0))
+		return NP_MATCH_RETRY;
+	return NP_MATCH_FAILURE;
+}
+
+int
+np_expect_matched(const np_expect *e, int i)
+{
+	return e->matched[i];
+}
+
+size_t
+np_expect_consumed(const np_expect *e)
+{
+	return e->consumed;
+}
+
+void
+np_expect_free(np_expect *e)
+{
+	if (e == NULL)
+		return;
+	free(e->nodes);
+	free(e->next);
+	free(e->matched);
+	free(e);
+}
+
 enum np_match_result
 np_expect_match(char *status, char **server_expect, int expect_count, int flags)
 {
-	int i, match = 0, partial = 0;
+	np_expect *e = np_expect_new(server_expect, expect_count, flags);
+	enum np_match_result result = np_expect_feed(e, status, strlen(status));
+	int i;
 
-	for (i = 0; i < expect_count; i++) {
-		if (flags & NP_MATCH_VERBOSE)
+	if (flags & NP_MATCH_VERBOSE)
+		for (i = 0; i < expect_count; i++) {
 			printf("looking for [%s] %s [%s]\n", server_expect[i],
 			    (flags & NP_MATCH_EXACT) ?
 			    "in beginning of" : "anywhere in",
 			    status);
-
-		if (flags & NP_MATCH_EXACT) {
-			if (strncmp(status, server_expect[i], strlen(server_expect[i])) == 0) {
+			if (e->matched[i])
 				VERBOSE("found it");
-				match++;
-				continue;
-			} else if (strncmp(status, server_expect[i], strlen(status)) == 0) {
+			else if ((flags & NP_MATCH_EXACT) &&
+			    strncmp(status, server_expect[i], strlen(status)) == 0)
 				VERBOSE("found a substring");
-				partial++;
-				continue;
-			}
-		} else if (strstr(status, server_expect[i]) != NULL) {
-				VERBOSE("found it");
-				match++;
-				continue;
+			else
+				VERBOSE("couldn't find it");
 		}
-		VERBOSE("couldn't find it");
-	}
 
-	if ((flags & NP_MATCH_ALL && match == expect_count) ||
-	    (!(flags & NP_MATCH_ALL) && match >= 1))
-		return NP_MATCH_SUCCESS;
-	else if (partial > 0 || !(flags & NP_MATCH_EXACT))
-		return NP_MATCH_RETRY;
-	else
-		return NP_MATCH_FAILURE;
+	np_expect_free(e);
+	return result;
 }
@@ -20,3 +20,24 @@ enum np_match_result np_expect_match(char *status,
                                      char **server_expect,
                                      int server_expect_count,
                                      int flags);
+
+/*
+ * An Aho-Corasick automaton of the expect strings, built once and fed the
+ * response as it arrives; each byte is looked at once, whatever the
+ * number of expect strings.  np_expect_feed() returns what
+ * np_expect_match() would return for all the data fed so far.
+ */
+typedef struct np_expect np_expect;
+
+np_expect *np_expect_new(char **server_expect, int server_expect_count,
+                         int flags);
+enum np_match_result np_expect_feed(np_expect *expect, const char *data,
+                                    size_t len);
+int np_expect_matched(const np_expect *expect, int i);
+/*
+ * The bytes of the last np_expect_feed() that were looked at.  Once all is
+ * found (without NP_MATCH_VERBOSE) the rest of that data came after the
+ * match, for whatever is expected next.
+ */
+size_t np_expect_consumed(const np_expect *expect);
+void np_expect_free(np_expect *expect);
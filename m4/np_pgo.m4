@@ -0,0 +1,25 @@
+# np_pgo.m4
+dnl Copyright (C) 2014 Nagios Plugins Team
+dnl This file is free software; the Nagios Plugin Team
+dnl gives unlimited permission to copy and/or distribute it,
+dnl with or without modifications, as long as this notice is preserved.
+
+dnl Test whether the compiler takes a flag, for --enable-pgo
+dnl np_pgo_flag(VARIABLE, FLAG, [ACTION-IF-TAKEN], [ACTION-IF-NOT])
+dnl Appends FLAG to VARIABLE if a program can be compiled and linked with
+dnl it, CFLAGS being left as it was.
+
+AC_DEFUN([np_pgo_flag],
+[
+  AC_MSG_CHECKING([whether $CC accepts $2])
+  _np_pgo_cflags="$CFLAGS"
+  CFLAGS="$CFLAGS $2"
+  AC_LINK_IFELSE([AC_LANG_PROGRAM([], [])],
+    [AC_MSG_RESULT(yes)
+     CFLAGS="$_np_pgo_cflags"
+     $1="$$1 $2"
+     $3],
+    [AC_MSG_RESULT(no)
+     CFLAGS="$_np_pgo_cflags"
+     $4])
+])
@@ -65,6 +65,9 @@ const char *email = "devel@nagios-plugins.org";
 
 #include <features.h>
 #include <linux/if_ether.h>
+#if HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif
 
 #elif defined(__bsd__)
 
@@ -158,6 +161,19 @@ typedef struct dhcp_offer_struct {
   struct dhcp_offer_struct *next;
 } dhcp_offer;
 
+/* one of the -i interfaces, and what came in on it */
+typedef struct dhcp_interface_struct {
+  char name[IFNAMSIZ];
+  int sock;
+  unsigned char hardware_address[MAX_DHCP_CHADDR_LENGTH];
+  struct in_addr my_ip;
+  u_int32_t xid;
+  dhcp_offer *offer_list;
+  int responses;       /* seen on the wire */
+  int valid_responses; /* DHCPOFFERs for this machine */
+  int done;            /* TRUE once offers_complete() */
+} dhcp_interface;
+
 typedef struct requested_server_struct {
   struct in_addr server_address;
   int answered;
@@ -203,6 +219,8 @@ unsigned char client_hardware_address[MAX_DHCP_CHADDR_LENGTH] = "";
 unsigned char *user_specified_mac = NULL;
 
 char network_interface_name[IFNAMSIZ] = "eth0";
+dhcp_interface *interfaces = NULL; /* if -i was given more than once */
+int num_interfaces = 0;
 
 u_int32_t packet_xid = 0;
 
@@ -211,6 +229,7 @@ u_int32_t dhcp_renewal_time = 0;
 u_int32_t dhcp_rebinding_time = 0;
 
 int dhcpoffer_timeout = 2;
+int expected_offers = 0; /* stop listening once this many have come */
 
 dhcp_offer *dhcp_offer_list = NULL;
 requested_server *requested_server_list = NULL;
@@ -225,6 +244,27 @@ int received_requested_address = FALSE;
 int verbose = 0;
 struct in_addr requested_address;
 
+/* --load: a burst of DHCPDISCOVERs, each from a MAC address and with an
+ * xid of its own, sent at --rate a second */
+#define MAX_LOAD_DISCOVERS 65535 /* the low 16 bits of the xid */
+int load_discovers = 0;
+double load_rate = 50;
+double loss_warn = 5, loss_crit = 20;        /* percent without an offer */
+double latency_warn = -1, latency_crit = -1; /* ms, of the 95th percentile */
+
+/* a DHCPDISCOVER of the burst, in usecs of the monotonic clock */
+typedef struct load_request {
+  int64_t sent;
+  int64_t offered; /* of the first offer, 0 until one came */
+} load_request;
+
+/* an offer made to the burst, to release again */
+typedef struct load_offer {
+  int index;
+  struct in_addr address;
+  struct in_addr server;
+} load_offer;
+
 int process_arguments(int, char **);
 int validate_arguments(void);
 void print_usage(void);
@@ -236,10 +276,22 @@ void print_hardware_address(const unsigned char *);
 int get_hardware_address(int, char *);
 int get_ip_address(int, char *);
 
+u_int32_t random_xid(void);
+void build_dhcp_discover(dhcp_packet *, u_int32_t, const unsigned char *);
+void dhcp_server_address(struct sockaddr_in *);
 int send_dhcp_discover(int);
 int get_dhcp_offer(int);
-
-int get_results(void);
+int read_dhcp_offer(int, int64_t);
+int offers_complete(void);
+void attach_dhcp_filter(int, u_int32_t, u_int32_t);
+int get_dhcp_option(const dhcp_packet *, unsigned, void *, unsigned);
+int check_load(int);
+
+int get_results(char **);
+int check_interfaces(void);
+int add_interface(const char *);
+void use_interface(dhcp_interface *);
+void save_interface(dhcp_interface *);
 
 int add_dhcp_offer(struct in_addr, dhcp_packet *);
 int free_dhcp_offer_list(void);
@@ -248,15 +300,12 @@ int free_requested_server_list(void);
 int create_dhcp_socket(void);
 int close_dhcp_socket(int);
 int send_dhcp_packet(void *, int, int, struct sockaddr_in *);
-int receive_dhcp_packet(void *, int, int, int, struct sockaddr_in *);
+int receive_dhcp_packet(void *, int, int, int64_t, struct sockaddr_in *);
 
 int main(int argc, char **argv) {
   int dhcp_socket;
   int result = STATE_UNKNOWN;
-
-  setlocale(LC_ALL, "");
-  bindtextdomain(PACKAGE, LOCALEDIR);
-  textdomain(PACKAGE);
+  char *output;
 
   /* Set default address_family to AF_INET (IPv4) */
   /* It will be changed to AF_INET6 later if required */
@@ -272,6 +321,20 @@ int main(int argc, char **argv) {
   /* this plugin almost certainly needs root permissions. */
   np_warn_if_not_root();
 
+  if (load_discovers > 0) {
+    dhcp_socket = create_dhcp_socket();
+    if (unicast) {
+      get_ip_address(dhcp_socket, network_interface_name);
+    }
+    result = check_load(dhcp_socket);
+    close_dhcp_socket(dhcp_socket);
+    return result;
+  }
+
+  if (num_interfaces > 1) {
+    return check_interfaces();
+  }
+
   /* create socket for DHCP communications */
   dhcp_socket = create_dhcp_socket();
 
@@ -296,7 +359,8 @@ int main(int argc, char **argv) {
   close_dhcp_socket(dhcp_socket);
 
   /* determine state/plugin output to return */
-  result = get_results();
+  result = get_results(&output);
+  printf("%s: %s\n", state_text(result), output);
 
   /* free allocated memory */
   free_dhcp_offer_list();
@@ -455,97 +519,110 @@ int get_ip_address(int sock, char *interface_name) {
 }
 
 /* sends a DHCPDISCOVER broadcast message in an attempt to find DHCP servers */
-int send_dhcp_discover(int sock) {
-  dhcp_packet discover_packet;
-  struct sockaddr_in sockaddr_broadcast;
+/*
+ * transaction ID is supposed to be random.
+ * This allows for proper randomness if the system supports it, and fallback
+ * to srand & random if not.
+ */
+u_int32_t random_xid(void) {
+  u_int32_t xid = 0;
+  int randfd = open("/dev/urandom", O_RDONLY);
+  if (randfd > 2 && read(randfd, (char *)&xid, sizeof(uint32_t)) >= 0) {
+    /* no-op as we have successfully filled xid */
+  } else {
+    /* fallback bad rand */
+    srand(time(NULL));
+    xid = random();
+  }
+  if (randfd > 2) {
+    close(randfd);
+  }
+  return xid;
+}
+
+/* a DHCPDISCOVER with this xid from the hardware address chaddr */
+void build_dhcp_discover(dhcp_packet *discover_packet, u_int32_t xid,
+                         const unsigned char *chaddr) {
   unsigned short opts;
 
   /* clear the packet data structure */
-  bzero(&discover_packet, sizeof(discover_packet));
+  bzero(discover_packet, sizeof(*discover_packet));
 
   /* boot request flag (backward compatible with BOOTP servers) */
-  discover_packet.op = BOOTREQUEST;
+  discover_packet->op = BOOTREQUEST;
 
   /* hardware address type */
-  discover_packet.htype = ETHERNET_HARDWARE_ADDRESS;
+  discover_packet->htype = ETHERNET_HARDWARE_ADDRESS;
 
   /* length of our hardware address */
-  discover_packet.hlen = ETHERNET_HARDWARE_ADDRESS_LENGTH;
-
-  /*
-   * transaction ID is supposed to be random.
-   * This allows for proper randomness if the system supports it, and fallback
-   * to srand & random if not.
-   */
-  int randfd = open("/dev/urandom", O_RDONLY);
-  if (randfd > 2 && read(randfd, (char *)&packet_xid, sizeof(uint32_t)) >= 0) {
-    /* no-op as we have successfully filled packet_xid */
-  } else {
-    /* fallback bad rand */
-    srand(time(NULL));
-    packet_xid = random();
-  }
-  if (randfd > 2) {
-    close(randfd);
-  }
-  discover_packet.xid = htonl(packet_xid);
+  discover_packet->hlen = ETHERNET_HARDWARE_ADDRESS_LENGTH;
 
-  /* WHAT THE HECK IS UP WITH THIS?!?  IF I DON'T MAKE THIS CALL, ONLY ONE
-   * SERVER RESPONSE IS PROCESSED!!!! */
-  /* downright bizzarre... */
-  ntohl(discover_packet.xid);
+  discover_packet->xid = htonl(xid);
 
-  /*discover_packet.secs=htons(65535);*/
-  discover_packet.secs = 0xFF;
+  /*discover_packet->secs=htons(65535);*/
+  discover_packet->secs = 0xFF;
 
   /*
    * server needs to know if it should broadcast or unicast its response:
    * 0x8000L == 32768 == 1 << 15 == broadcast, 0 == unicast
    */
-  discover_packet.flags = unicast ? 0 : htons(DHCP_BROADCAST_FLAG);
+  discover_packet->flags = unicast ? 0 : htons(DHCP_BROADCAST_FLAG);
 
   /* our hardware address */
-  memcpy(discover_packet.chaddr, client_hardware_address,
-         ETHERNET_HARDWARE_ADDRESS_LENGTH);
+  memcpy(discover_packet->chaddr, chaddr, ETHERNET_HARDWARE_ADDRESS_LENGTH);
 
   /* first four bytes of options field is magic cookie (as per RFC 2132) */
-  discover_packet.options[0] = '\x63';
-  discover_packet.options[1] = '\x82';
-  discover_packet.options[2] = '\x53';
-  discover_packet.options[3] = '\x63';
+  discover_packet->options[0] = '\x63';
+  discover_packet->options[1] = '\x82';
+  discover_packet->options[2] = '\x53';
+  discover_packet->options[3] = '\x63';
 
   opts = 4;
   /* DHCP message type is embedded in options field */
-  discover_packet.options[opts++] =
+  discover_packet->options[opts++] =
       DHCP_OPTION_MESSAGE_TYPE; /* DHCP message type option identifier */
-  discover_packet.options[opts++] =
+  discover_packet->options[opts++] =
       '\x01'; /* DHCP message option length in bytes */
-  discover_packet.options[opts++] = DHCPDISCOVER;
+  discover_packet->options[opts++] = DHCPDISCOVER;
 
   /* the IP address we're requesting */
   if (request_specific_address == TRUE) {
-    discover_packet.options[opts++] = DHCP_OPTION_REQUESTED_ADDRESS;
-    discover_packet.options[opts++] = '\x04';
-    memcpy(&discover_packet.options[opts], &requested_address,
+    discover_packet->options[opts++] = DHCP_OPTION_REQUESTED_ADDRESS;
+    discover_packet->options[opts++] = '\x04';
+    memcpy(&discover_packet->options[opts], &requested_address,
            sizeof(requested_address));
     opts += sizeof(requested_address);
   }
-  discover_packet.options[opts++] = (char) DHCP_OPTION_END;
+  discover_packet->options[opts++] = (char) DHCP_OPTION_END;
 
   /* unicast fields */
   if (unicast) {
-    discover_packet.giaddr.s_addr = my_ip.s_addr;
+    discover_packet->giaddr.s_addr = my_ip.s_addr;
   }
 
   /* see RFC 1542, 4.1.1 */
-  discover_packet.hops = unicast ? 1 : 0;
+  discover_packet->hops = unicast ? 1 : 0;
+}
 
-  /* send the DHCPDISCOVER packet to broadcast address */
-  sockaddr_broadcast.sin_family = address_family;
-  sockaddr_broadcast.sin_port = htons(DHCP_SERVER_PORT);
-  sockaddr_broadcast.sin_addr.s_addr =
+/* where a DHCPDISCOVER goes: the broadcast address, or the -s server */
+void dhcp_server_address(struct sockaddr_in *sockaddr_broadcast) {
+  sockaddr_broadcast->sin_family = address_family;
+  sockaddr_broadcast->sin_port = htons(DHCP_SERVER_PORT);
+  sockaddr_broadcast->sin_addr.s_addr =
       unicast ? dhcp_ip.s_addr : INADDR_BROADCAST;
-  bzero(&sockaddr_broadcast.sin_zero, sizeof(sockaddr_broadcast.sin_zero));
+  bzero(&sockaddr_broadcast->sin_zero, sizeof(sockaddr_broadcast->sin_zero));
+}
+
+int send_dhcp_discover(int sock) {
+  dhcp_packet discover_packet;
+  struct sockaddr_in sockaddr_broadcast;
+
+  packet_xid = random_xid();
+  build_dhcp_discover(&discover_packet, packet_xid, client_hardware_address);
+  attach_dhcp_filter(sock, packet_xid, 0xFFFFFFFF);
+
+  /* send the DHCPDISCOVER packet to broadcast address */
+  dhcp_server_address(&sockaddr_broadcast);
 
   if (verbose) {
     printf(_("DHCPDISCOVER to %s port %d\n"),
@@ -572,115 +649,130 @@ int send_dhcp_discover(int sock) {
 
 /* waits for a DHCPOFFER message from one or more DHCP servers */
 int get_dhcp_offer(int sock) {
-  dhcp_packet offer_packet;
-  struct sockaddr_in source;
-  struct sockaddr_in via;
-  int result = OK;
+  int result;
   int responses = 0;
-  int x;
-  time_t start_time;
-  time_t current_time;
+  int64_t deadline;
 
-  time(&start_time);
+  deadline = np_net_deadline(dhcpoffer_timeout * 1000);
 
-  /* receive as many responses as we can */
-  for (responses = 0, valid_responses = 0;;) {
-    time(&current_time);
-    if ((current_time - start_time) >= dhcpoffer_timeout) {
-      break;
+  /* receive as many responses as we can, or as we expect */
+  for (valid_responses = 0; np_net_time_left(deadline) > 0;) {
+    result = read_dhcp_offer(sock, deadline);
+    if (result == ERROR) {
+      continue;
     }
+    responses++;
 
-    if (verbose) {
-      printf("\n\n");
+    if (result == TRUE && offers_complete()) {
+      if (verbose) {
+        printf(_("All expected DHCPOFFERs received\n"));
+      }
+      break;
     }
+  }
 
-    bzero(&source, sizeof(source));
-    bzero(&via, sizeof(via));
-    bzero(&offer_packet, sizeof(offer_packet));
+  if (verbose) {
+    printf(_("Total responses seen on the wire: %d\n"), responses);
+    printf(_("Valid responses for this machine: %d\n"), valid_responses);
+  }
 
-    result = receive_dhcp_packet(&offer_packet, sizeof(offer_packet), sock,
-                                 dhcpoffer_timeout, &source);
+  return OK;
+}
 
-    if (result != OK) {
-      if (verbose) {
-        printf(_("Result=ERROR\n"));
-      }
-      continue;
-    } else {
-      if (verbose) {
-        printf(_("Result=OK\n"));
-      }
-      responses++;
-    }
+/* Receives one packet, by the deadline, and adds it to the offers if it is
+ * a DHCPOFFER for our DHCPDISCOVER. Returns TRUE if it was, FALSE if it was
+ * not and ERROR if none came. */
+int read_dhcp_offer(int sock, int64_t deadline) {
+  dhcp_packet offer_packet;
+  struct sockaddr_in source;
+  struct sockaddr_in via;
+  int result = OK;
+  int x;
 
-    /* The "source" is either a server or a relay. */
-    /* Save a copy of "source" into "via" even if it's via itself */
-    memcpy(&via, &source, sizeof(source));
+  if (verbose) {
+    printf("\n\n");
+  }
 
-    if (verbose) {
-      printf(_("DHCPOFFER from IP address %s"), inet_ntoa(source.sin_addr));
-      printf(_(" via %s\n"), inet_ntoa(via.sin_addr));
-      printf("DHCPOFFER XID: %u (0x%X)\n", ntohl(offer_packet.xid),
-             ntohl(offer_packet.xid));
-    }
+  bzero(&source, sizeof(source));
+  bzero(&via, sizeof(via));
+  bzero(&offer_packet, sizeof(offer_packet));
 
-    /* check packet xid to see if its the same as the one we used in the
-     * discover packet */
-    if (ntohl(offer_packet.xid) != packet_xid) {
-      if (verbose) {
-        printf(_("DHCPOFFER XID (%u) did not match DHCPDISCOVER XID (%u) - "
-                 "ignoring packet\n"),
-               ntohl(offer_packet.xid), packet_xid);
-      }
-      continue;
-    }
+  result = receive_dhcp_packet(&offer_packet, sizeof(offer_packet), sock,
+                               deadline, &source);
 
-    /* check hardware address */
-    result = OK;
+  if (result != OK) {
     if (verbose) {
-      printf("DHCPOFFER chaddr: ");
+      printf(_("Result=ERROR\n"));
     }
+    return ERROR;
+  } else {
+    if (verbose) {
+      printf(_("Result=OK\n"));
+    }
+  }
 
-    for (x = 0; x < ETHERNET_HARDWARE_ADDRESS_LENGTH; x++) {
-      if (verbose) {
-        printf("%02X", (unsigned char)offer_packet.chaddr[x]);
-      }
+  /* The "source" is either a server or a relay. */
+  /* Save a copy of "source" into "via" even if it's via itself */
+  memcpy(&via, &source, sizeof(source));
 
-      if (offer_packet.chaddr[x] != client_hardware_address[x]) {
-        result = ERROR;
-      }
-    }
+  if (verbose) {
+    printf(_("DHCPOFFER from IP address %s"), inet_ntoa(source.sin_addr));
+    printf(_(" via %s\n"), inet_ntoa(via.sin_addr));
+    printf("DHCPOFFER XID: %u (0x%X)\n", ntohl(offer_packet.xid),
+           ntohl(offer_packet.xid));
+  }
 
+  /* check packet xid to see if its the same as the one we used in the
+   * discover packet */
+  if (ntohl(offer_packet.xid) != packet_xid) {
     if (verbose) {
-      printf("\n");
+      printf(_("DHCPOFFER XID (%u) did not match DHCPDISCOVER XID (%u) - "
+               "ignoring packet\n"),
+             ntohl(offer_packet.xid), packet_xid);
     }
+    return FALSE;
+  }
 
-    if (result == ERROR) {
-      if (verbose) {
-        printf(_("DHCPOFFER hardware address did not match our own - ignoring "
-                 "packet\n"));
-      }
-      continue;
-    }
+  /* check hardware address */
+  result = OK;
+  if (verbose) {
+    printf("DHCPOFFER chaddr: ");
+  }
 
+  for (x = 0; x < ETHERNET_HARDWARE_ADDRESS_LENGTH; x++) {
     if (verbose) {
-      printf("DHCPOFFER ciaddr: %s\n", inet_ntoa(offer_packet.ciaddr));
-      printf("DHCPOFFER yiaddr: %s\n", inet_ntoa(offer_packet.yiaddr));
-      printf("DHCPOFFER siaddr: %s\n", inet_ntoa(offer_packet.siaddr));
-      printf("DHCPOFFER giaddr: %s\n", inet_ntoa(offer_packet.giaddr));
+      printf("%02X", (unsigned char)offer_packet.chaddr[x]);
     }
 
-    add_dhcp_offer(source.sin_addr, &offer_packet);
+    if (offer_packet.chaddr[x] != client_hardware_address[x]) {
+      result = ERROR;
+    }
+  }
 
-    valid_responses++;
+  if (verbose) {
+    printf("\n");
+  }
+
+  if (result == ERROR) {
+    if (verbose) {
+      printf(_("DHCPOFFER hardware address did not match our own - ignoring "
+               "packet\n"));
+    }
+    return FALSE;
   }
 
   if (verbose) {
-    printf(_("Total responses seen on the wire: %d\n"), responses);
-    printf(_("Valid responses for this machine: %d\n"), valid_responses);
+    printf("DHCPOFFER ciaddr: %s\n", inet_ntoa(offer_packet.ciaddr));
+    printf("DHCPOFFER yiaddr: %s\n", inet_ntoa(offer_packet.yiaddr));
+    printf("DHCPOFFER siaddr: %s\n", inet_ntoa(offer_packet.siaddr));
+    printf("DHCPOFFER giaddr: %s\n", inet_ntoa(offer_packet.giaddr));
   }
 
-  return OK;
+  add_dhcp_offer(source.sin_addr, &offer_packet);
+
+  valid_responses++;
+
+  return TRUE;
 }
 
 /* sends a DHCP packet */
@@ -700,28 +792,98 @@ int send_dhcp_packet(void *buffer, int buffer_size, int sock,
   return OK;
 }
 
-/* receives a DHCP packet */
-int receive_dhcp_packet(void *buffer, int buffer_size, int sock, int timeout,
-                        struct sockaddr_in *address) {
-  struct timeval tv;
-  fd_set readfds;
-  fd_set oobfds;
+/* TRUE once the offers received meet everything asked for: one from each
+ * requested server, the requested address and the number of offers. With
+ * none of these there is no telling, and we listen until the timeout. */
+int offers_complete(void) {
+  requested_server *temp_server;
+  dhcp_offer *temp_offer;
+  int found;
+
+  if (requested_servers == 0 && request_specific_address == FALSE &&
+      expected_offers == 0) {
+    return FALSE;
+  }
+  if (valid_responses < expected_offers) {
+    return FALSE;
+  }
+
+  for (temp_server = requested_server_list; temp_server != NULL;
+       temp_server = temp_server->next) {
+    found = FALSE;
+    for (temp_offer = dhcp_offer_list; temp_offer != NULL && !found;
+         temp_offer = temp_offer->next) {
+      found = !memcmp(&temp_offer->server_address, &temp_server->server_address,
+                      sizeof(temp_server->server_address));
+    }
+    if (!found) {
+      return FALSE;
+    }
+  }
+
+  if (request_specific_address == TRUE) {
+    found = FALSE;
+    for (temp_offer = dhcp_offer_list; temp_offer != NULL && !found;
+         temp_offer = temp_offer->next) {
+      found = !memcmp(&requested_address, &temp_offer->offered_address,
+                      sizeof(requested_address));
+    }
+    if (!found) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/* Have the kernel drop what is not a reply to our DHCPDISCOVER: on a busy
+ * segment every client's traffic reaches the socket. Keeps BOOTREPLY
+ * messages with our xid, or those of --load, which share the bits of mask;
+ * get_dhcp_offer() still checks them as before, and sorts everything out
+ * itself where there is no socket filter. */
+void attach_dhcp_filter(int sock, u_int32_t xid, u_int32_t mask) {
+#if defined(SO_ATTACH_FILTER) && HAVE_LINUX_FILTER_H
+  /* the filter sees the udp header before the message */
+  struct sock_filter code[] = {
+      BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 8),  /* op */
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, BOOTREPLY, 0, 4),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 12), /* xid */
+      BPF_STMT(BPF_ALU | BPF_AND | BPF_K, mask),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, xid & mask, 0, 1),
+      BPF_STMT(BPF_RET | BPF_K, 0xffff),
+      BPF_STMT(BPF_RET | BPF_K, 0),
+  };
+  struct sock_fprog prog;
+
+  prog.len = sizeof(code) / sizeof(*code);
+  prog.filter = code;
+  if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog))) {
+    if (verbose) {
+      printf(_("No socket filter: %s\n"), strerror(errno));
+    }
+  } else if (verbose) {
+    printf(_("Socket filter for XID %u attached\n"), xid);
+  }
+#else
+  (void)sock;
+  (void)xid;
+  (void)mask;
+#endif
+}
+
+/* receives a DHCP packet, waiting for one until the deadline */
+int receive_dhcp_packet(void *buffer, int buffer_size, int sock,
+                        int64_t deadline, struct sockaddr_in *address) {
   int recv_result;
   socklen_t address_size;
   struct sockaddr_in source_address;
   int nfound;
 
-  /* wait for data to arrive (up time timeout) */
-  tv.tv_sec = timeout;
-  tv.tv_usec = 0;
-  FD_ZERO(&readfds);
-  FD_ZERO(&oobfds);
-  FD_SET(sock, &readfds);
-  FD_SET(sock, &oobfds);
-  nfound = select(sock + 1, &readfds, NULL, &oobfds, &tv);
+  /* wait for data to arrive (up to the deadline) */
+  nfound = np_net_wait(sock, POLLIN, deadline);
 
   /* make sure some data has arrived */
-  if (!FD_ISSET(sock, &readfds)) {
+  if (nfound != 1) {
     if (verbose) {
       printf(_("No (more) data received (nfound: %d)\n"), nfound);
     }
@@ -1012,8 +1174,401 @@ int free_requested_server_list(void) {
   return OK;
 }
 
+
+/* adds an interface to listen on to the list */
+int add_interface(const char *name) {
+  dhcp_interface *new_interfaces;
+
+  new_interfaces = (dhcp_interface *)realloc(
+      interfaces, sizeof(dhcp_interface) * (num_interfaces + 1));
+  if (new_interfaces == NULL) {
+    return ERROR;
+  }
+  interfaces = new_interfaces;
+  bzero(&interfaces[num_interfaces], sizeof(dhcp_interface));
+  strncpy(interfaces[num_interfaces].name, name, IFNAMSIZ - 1);
+  interfaces[num_interfaces].sock = -1;
+  num_interfaces++;
+
+  return OK;
+}
+
+/* the functions above keep what they know of the interface in use in
+ * globals; these switch them to another one and back */
+void use_interface(dhcp_interface *iface) {
+  strncpy(network_interface_name, iface->name, IFNAMSIZ);
+  memcpy(client_hardware_address, iface->hardware_address,
+         sizeof(client_hardware_address));
+  my_ip = iface->my_ip;
+  packet_xid = iface->xid;
+  dhcp_offer_list = iface->offer_list;
+  valid_responses = iface->valid_responses;
+}
+
+void save_interface(dhcp_interface *iface) {
+  memcpy(iface->hardware_address, client_hardware_address,
+         sizeof(iface->hardware_address));
+  iface->my_ip = my_ip;
+  iface->xid = packet_xid;
+  iface->offer_list = dhcp_offer_list;
+  iface->valid_responses = valid_responses;
+}
+
+/* Probes every -i interface at once: a socket bound to each, all the
+ * DHCPDISCOVERs sent before listening, and the offers read as they come
+ * in on any of them until each interface has what it expects or the
+ * timeout passes. Prints a line for each after the summary. */
+int check_interfaces(void) {
+  struct pollfd *ufds;
+  dhcp_interface *iface;
+  int64_t deadline;
+  int i, pending, nready, state;
+  int result = STATE_OK, count_ok = 0;
+  char *output, *name, *problems = NULL, *lines = strdup("");
+
+  ufds = (struct pollfd *)calloc(num_interfaces, sizeof(struct pollfd));
+  if (ufds == NULL) {
+    die(STATE_UNKNOWN, _("Could not allocate memory for %d interfaces\n"),
+        num_interfaces);
+  }
+
+  for (i = 0; i < num_interfaces; i++) {
+    iface = &interfaces[i];
+    use_interface(iface);
+    iface->sock = create_dhcp_socket();
+    if (user_specified_mac != NULL) {
+      memcpy(client_hardware_address, user_specified_mac, 6);
+    } else {
+      get_hardware_address(iface->sock, iface->name);
+    }
+    if (unicast) {
+      get_ip_address(iface->sock, iface->name);
+    }
+    send_dhcp_discover(iface->sock);
+    save_interface(iface);
+    ufds[i].fd = iface->sock;
+    ufds[i].events = POLLIN;
+  }
+
+  deadline = np_net_deadline(dhcpoffer_timeout * 1000);
+  for (pending = num_interfaces; pending > 0 && np_net_time_left(deadline) > 0;) {
+    nready = poll(ufds, num_interfaces, np_net_time_left(deadline));
+    if (nready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      die(STATE_UNKNOWN, _("Error polling the DHCP sockets: %s\n"),
+          strerror(errno));
+    }
+    for (i = 0; nready > 0 && i < num_interfaces; i++) {
+      if (!(ufds[i].revents & POLLIN)) {
+        continue;
+      }
+      iface = &interfaces[i];
+      use_interface(iface);
+      state = read_dhcp_offer(iface->sock, deadline);
+      if (state != ERROR) {
+        iface->responses++;
+      }
+      if (state == TRUE && offers_complete()) {
+        if (verbose) {
+          printf(_("All expected DHCPOFFERs received on %s\n"), iface->name);
+        }
+        iface->done = TRUE;
+        /* poll() leaves it alone from now on */
+        ufds[i].fd = -1;
+        pending--;
+      }
+      save_interface(iface);
+    }
+  }
+
+  for (i = 0; i < num_interfaces; i++) {
+    iface = &interfaces[i];
+    close_dhcp_socket(iface->sock);
+    use_interface(iface);
+    if (verbose) {
+      printf(_("%s: %d responses seen on the wire, %d valid\n"), iface->name,
+             iface->responses, iface->valid_responses);
+    }
+    state = get_results(&output);
+    result = max_state(result, state);
+    /* "No response from:" goes on the same line */
+    for (name = output; (name = strchr(name, '\n')) != NULL;) {
+      *name = ' ';
+    }
+    if (state == STATE_OK) {
+      count_ok++;
+    } else {
+      xasprintf(&problems, "%s%s%s: %s", problems ? problems : "",
+                problems ? "; " : "", iface->name, output);
+    }
+    xasprintf(&lines, "%s[%s] %s: %s\n", lines, state_text(state), iface->name,
+              output);
+    free_dhcp_offer_list();
+    iface->offer_list = NULL;
+  }
+
+  printf("%s: %d of %d %s%s%s\n%s", state_text(result), count_ok,
+         num_interfaces, _("interfaces OK"), problems ? " - " : "",
+         problems ? problems : "", lines);
+
+  free(ufds);
+  free(interfaces);
+  free_requested_server_list();
+
+  return result;
+}
+
+/* the option of this type in the packet, up to size bytes of it into out;
+ * FALSE if it has none */
+int get_dhcp_option(const dhcp_packet *packet, unsigned type, void *out,
+                    unsigned size) {
+  unsigned x = 4, option_type, option_length;
+
+  while (x < MAX_DHCP_OPTIONS_LENGTH - 1) {
+    option_type = (unsigned char)packet->options[x++];
+    if (option_type == DHCP_OPTION_END) {
+      break;
+    }
+    /* "pad" option, see RFC 2132 (3.1) */
+    if (option_type == 0) {
+      continue;
+    }
+    option_length = (unsigned char)packet->options[x++];
+    if (x + option_length > MAX_DHCP_OPTIONS_LENGTH) {
+      break;
+    }
+    if (option_type == type) {
+      memcpy(out, &packet->options[x],
+             option_length < size ? option_length : size);
+      return TRUE;
+    }
+    x += option_length;
+  }
+  return FALSE;
+}
+
+static int64_t load_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* the made up hardware address of DHCPDISCOVER i of the burst: locally
+ * administered, with bits of the burst's xid and i in it */
+static void load_chaddr(unsigned char *chaddr, u_int32_t base, int i) {
+  chaddr[0] = 0x02;
+  chaddr[1] = (base >> 24) & 0xFF;
+  chaddr[2] = (base >> 16) & 0xFF;
+  chaddr[3] = 0;
+  chaddr[4] = (i >> 8) & 0xFF;
+  chaddr[5] = i & 0xFF;
+}
+
+/* gives the address of an offer back, so that the burst leaves no leases
+ * behind; a DHCPDECLINE would have the server take it out of the pool */
+static void load_release(int sock, u_int32_t base, const load_offer *offer) {
+  dhcp_packet packet;
+  struct sockaddr_in server;
+  unsigned short opts = 4;
+
+  bzero(&packet, sizeof(packet));
+  packet.op = BOOTREQUEST;
+  packet.htype = ETHERNET_HARDWARE_ADDRESS;
+  packet.hlen = ETHERNET_HARDWARE_ADDRESS_LENGTH;
+  packet.xid = htonl(base | offer->index);
+  packet.ciaddr = offer->address;
+  load_chaddr(packet.chaddr, base, offer->index);
+  memcpy(packet.options, "\x63\x82\x53\x63", 4);
+  packet.options[opts++] = DHCP_OPTION_MESSAGE_TYPE;
+  packet.options[opts++] = '\x01';
+  packet.options[opts++] = DHCPRELEASE;
+  packet.options[opts++] = DHCP_OPTION_SERVER_IDENTIFIER;
+  packet.options[opts++] = '\x04';
+  memcpy(&packet.options[opts], &offer->server, sizeof(offer->server));
+  opts += sizeof(offer->server);
+  packet.options[opts++] = (char) DHCP_OPTION_END;
+
+  bzero(&server, sizeof(server));
+  server.sin_family = AF_INET;
+  server.sin_port = htons(DHCP_SERVER_PORT);
+  server.sin_addr = offer->server;
+  if (verbose) {
+    printf(_("DHCPRELEASE of %s"), inet_ntoa(offer->address));
+    printf(_(" to %s\n"), inet_ntoa(offer->server));
+  }
+  send_dhcp_packet(&packet, sizeof(packet), sock, &server);
+}
+
+static int compare_latency(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* the latency at percentile pct of the n sorted ones, in ms */
+static double load_percentile(const int64_t *latency, int n, int pct) {
+  int rank = (n * pct + 99) / 100;
+
+  return latency[rank > 0 ? rank - 1 : 0] / 1000.0;
+}
+
+/* Sends the burst of DHCPDISCOVERs on schedule while reading the offers in
+ * the same loop, matched to them by xid, until every one has one or the
+ * timeout has passed since the last was sent. The addresses offered are
+ * released at the end. */
+int check_load(int sock) {
+  load_request *requests;
+  load_offer *offers = NULL, *offer;
+  dhcp_packet packet;
+  struct sockaddr_in server, source;
+  unsigned char chaddr[MAX_DHCP_CHADDR_LENGTH] = "";
+  unsigned char type;
+  struct in_addr server_id;
+  u_int32_t base, xid;
+  int64_t start, now, interval, until, end = 0, *latency;
+  int i, index, ms, sent = 0, answered = 0, num_offers = 0, offers_size = 0;
+  int result = STATE_OK, latency_state = STATE_OK;
+  double loss, p50 = 0, p95 = 0, p99 = 0, max = 0;
+  np_perfdata perf;
+
+  requests = calloc(load_discovers, sizeof(*requests));
+  latency = calloc(load_discovers, sizeof(*latency));
+  if (requests == NULL || latency == NULL) {
+    die(STATE_UNKNOWN, _("Could not allocate memory for %d DHCPDISCOVERs\n"),
+        load_discovers);
+  }
+
+  /* the xids of the burst differ in their low 16 bits */
+  base = random_xid() & 0xFFFF0000;
+  attach_dhcp_filter(sock, base, 0xFFFF0000);
+  dhcp_server_address(&server);
+  interval = (int64_t)(1000000 / load_rate);
+
+  start = load_now();
+  for (;;) {
+    now = load_now();
+    if (sent < load_discovers && now >= start + sent * interval) {
+      load_chaddr(chaddr, base, sent);
+      build_dhcp_discover(&packet, base | sent, chaddr);
+      requests[sent].sent = now;
+      send_dhcp_packet(&packet, sizeof(packet), sock, &server);
+      if (++sent == load_discovers) {
+        end = now + (int64_t)dhcpoffer_timeout * 1000000;
+      }
+      continue;
+    }
+    if (sent == load_discovers && (answered == load_discovers || now >= end)) {
+      break;
+    }
+
+    until = sent < load_discovers ? start + sent * interval : end;
+    ms = (int)((until - now + 999) / 1000);
+    if (receive_dhcp_packet(&packet, sizeof(packet), sock,
+                            np_net_deadline(ms > 0 ? ms : 1), &source) != OK) {
+      continue;
+    }
+    now = load_now();
+    xid = ntohl(packet.xid);
+    index = xid & 0xFFFF;
+    if (packet.op != BOOTREPLY || (xid & 0xFFFF0000) != base || index >= sent) {
+      continue;
+    }
+    load_chaddr(chaddr, base, index);
+    if (memcmp(packet.chaddr, chaddr, ETHERNET_HARDWARE_ADDRESS_LENGTH) ||
+        !get_dhcp_option(&packet, DHCP_OPTION_MESSAGE_TYPE, &type, 1) ||
+        type != DHCPOFFER) {
+      continue;
+    }
+    if (!get_dhcp_option(&packet, DHCP_OPTION_SERVER_IDENTIFIER, &server_id,
+                         sizeof(server_id))) {
+      server_id = source.sin_addr;
+    }
+
+    if (num_offers == offers_size) {
+      offers_size = offers_size ? offers_size * 2 : 64;
+      if ((offers = realloc(offers, offers_size * sizeof(*offers))) == NULL) {
+        die(STATE_UNKNOWN, _("Could not allocate memory for the DHCPOFFERs\n"));
+      }
+    }
+    offer = &offers[num_offers++];
+    offer->index = index;
+    offer->address = packet.yiaddr;
+    offer->server = server_id;
+
+    /* the latency is that of the first offer, from whichever server */
+    if (requests[index].offered == 0) {
+      requests[index].offered = now;
+      latency[answered++] = now - requests[index].sent;
+    }
+  }
+
+  for (i = 0; i < num_offers; i++) {
+    load_release(sock, base, &offers[i]);
+  }
+
+  loss = (load_discovers - answered) * 100.0 / load_discovers;
+  if (answered > 0) {
+    qsort(latency, answered, sizeof(*latency), compare_latency);
+    p50 = load_percentile(latency, answered, 50);
+    p95 = load_percentile(latency, answered, 95);
+    p99 = load_percentile(latency, answered, 99);
+    max = latency[answered - 1] / 1000.0;
+  }
+
+  if (answered == 0 || loss > loss_crit) {
+    result = STATE_CRITICAL;
+  } else if (loss > loss_warn) {
+    result = STATE_WARNING;
+  }
+  if (latency_crit >= 0 && p95 > latency_crit) {
+    latency_state = STATE_CRITICAL;
+  } else if (latency_warn >= 0 && p95 > latency_warn) {
+    latency_state = STATE_WARNING;
+  }
+  if (answered > 0) {
+    result = max_state(result, latency_state);
+  }
+
+  np_perfdata_init(&perf);
+  np_perfdata_addf(&perf, "sent", sent, "", FALSE, 0, FALSE, 0, TRUE, 0, FALSE,
+                   0);
+  np_perfdata_addf(&perf, "offered", answered, "", FALSE, 0, FALSE, 0, TRUE, 0,
+                   TRUE, load_discovers);
+  np_perfdata_addf(&perf, "loss", loss, "%", TRUE, loss_warn, TRUE, loss_crit,
+                   TRUE, 0, TRUE, 100);
+  if (answered > 0) {
+    np_perfdata_addf(&perf, "latency_p50", p50, "ms", FALSE, 0, FALSE, 0, TRUE,
+                     0, FALSE, 0);
+    np_perfdata_addf(&perf, "latency_p95", p95, "ms", latency_warn >= 0,
+                     latency_warn, latency_crit >= 0, latency_crit, TRUE, 0,
+                     FALSE, 0);
+    np_perfdata_addf(&perf, "latency_p99", p99, "ms", FALSE, 0, FALSE, 0, TRUE,
+                     0, FALSE, 0);
+    np_perfdata_addf(&perf, "latency_max", max, "ms", FALSE, 0, FALSE, 0, TRUE,
+                     0, FALSE, 0);
+    printf(_("%s: %d of %d DHCPDISCOVERs at %g/s offered, %.1f%% lost, offer "
+             "latency p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms, %d "
+             "offers released|%s\n"),
+           state_text(result), answered, load_discovers, load_rate, loss, p50,
+           p95, p99, max, num_offers, np_perfdata_string(&perf));
+  } else {
+    printf(_("%s: No DHCPOFFERs were received for %d DHCPDISCOVERs at %g/s|%s\n"),
+           state_text(result), load_discovers, load_rate,
+           np_perfdata_string(&perf));
+  }
+  np_perfdata_free(&perf);
+
+  free(requests);
+  free(latency);
+  free(offers);
+  return result;
+}
+
 /* gets state and plugin output to return */
-int get_results(void) {
+int get_results(char **output) {
   dhcp_offer *temp_offer;
   requested_server *temp_server;
   int result;
@@ -1025,6 +1580,10 @@ int get_results(void) {
   /* checks responses from requested servers */
   requested_responses = 0;
   if (requested_servers > 0) {
+    for (temp_server = requested_server_list; temp_server != NULL;
+         temp_server = temp_server->next) {
+      temp_server->answered = FALSE;
+    }
     for (temp_server = requested_server_list; temp_server != NULL;
          temp_server = temp_server->next) {
       for (temp_offer = dhcp_offer_list; temp_offer != NULL;
@@ -1099,27 +1658,17 @@ int get_results(void) {
     result = STATE_WARNING;
   }
 
-  if (result == 0) {
-    printf("OK: ");
-  } else if (result == 1) {
-    printf("WARNING: ");
-  } else if (result == 2) {
-    printf("CRITICAL: ");
-  } else if (result == 3) {
-    printf("UNKNOWN: ");
-  }
-
   /* we didn't receive any DHCPOFFERs */
   if (dhcp_offer_list == NULL) {
-    printf(_("No DHCPOFFERs were received.\n"));
+    xasprintf(output, _("No DHCPOFFERs were received."));
     return result;
   }
 
-  printf(_("Received %d DHCPOFFER(s)"), valid_responses);
+  xasprintf(output, _("Received %d DHCPOFFER(s)"), valid_responses);
 
   if (requested_servers > 0) {
-    printf(
-        _(", %s%d of %d requested servers responded"),
+    xasprintf(
+        output, _("%s, %s%d of %d requested servers responded"), *output,
         ((requested_responses < requested_servers) && requested_responses > 0)
             ? "only "
             : "",
@@ -1127,22 +1676,20 @@ int get_results(void) {
   }
 
   if (request_specific_address == TRUE) {
-    printf(_(", requested address (%s) was %soffered"),
-           inet_ntoa(requested_address),
-           (received_requested_address == TRUE) ? "" : _("not "));
+    xasprintf(output, _("%s, requested address (%s) was %soffered"), *output,
+              inet_ntoa(requested_address),
+              (received_requested_address == TRUE) ? "" : _("not "));
   }
 
-  printf(_(", max lease time = "));
   if (max_lease_time == DHCP_INFINITE_TIME) {
-    printf(_("Infinity"));
+    xasprintf(output, _("%s, max lease time = Infinity."), *output);
   } else {
-    printf("%lu sec", (unsigned long)max_lease_time);
+    xasprintf(output, _("%s, max lease time = %lu sec."), *output,
+              (unsigned long)max_lease_time);
   }
 
-  printf(".\n");
-
   if (requested_servers > 0 && requested_servers != requested_responses) {
-    printf("No response from:%s\n", responses_none);
+    xasprintf(output, "%s\nNo response from:%s", *output, responses_none);
   }
 
   return result;
@@ -1152,6 +1699,15 @@ int get_results(void) {
 int process_arguments(int argc, char **argv) {
   int c = 0;
   int option_index = 0;
+  char *name, *next;
+  double warn, crit;
+
+  enum {
+    LOAD_OPTION = CHAR_MAX + 1,
+    RATE_OPTION,
+    LOSS_OPTION,
+    LATENCY_OPTION
+  };
 
   static struct option long_options[] = {
       {"serverip", required_argument, 0, 's'},
@@ -1160,6 +1716,11 @@ int process_arguments(int argc, char **argv) {
       {"interface", required_argument, 0, 'i'},
       {"mac", required_argument, 0, 'm'},
       {"unicast", no_argument, 0, 'u'},
+      {"offers", required_argument, 0, 'n'},
+      {"load", required_argument, 0, LOAD_OPTION},
+      {"rate", required_argument, 0, RATE_OPTION},
+      {"loss", required_argument, 0, LOSS_OPTION},
+      {"latency", required_argument, 0, LATENCY_OPTION},
       {"verbose", no_argument, 0, 'v'},
       {"version", no_argument, 0, 'V'},
       {"help", no_argument, 0, 'h'},
@@ -1170,7 +1731,7 @@ int process_arguments(int argc, char **argv) {
   }
 
   while (1) {
-    c = getopt_long(argc, argv, "+hVvt:s:r:t:i:m:u", long_options,
+    c = getopt_long(argc, argv, "+hVvt:s:r:t:i:m:un:", long_options,
                     &option_index);
 
     if (c == -1 || c == EOF || c == 1) {
@@ -1222,16 +1783,65 @@ int process_arguments(int argc, char **argv) {
       }
       break;
 
-    case 'i': /* interface name */
-      strncpy(network_interface_name, optarg,
-              sizeof(network_interface_name) - 1);
-      network_interface_name[sizeof(network_interface_name) - 1] = '\x0';
+    case 'i': /* interface name, or several */
+      for (name = strtok(optarg, ","); name != NULL;
+           name = strtok(NULL, ",")) {
+        if (add_interface(name) != OK) {
+          die(STATE_UNKNOWN, _("Could not allocate memory for interface %s\n"),
+              name);
+        }
+      }
+      if (num_interfaces > 0) {
+        strncpy(network_interface_name, interfaces[0].name,
+                sizeof(network_interface_name) - 1);
+        network_interface_name[sizeof(network_interface_name) - 1] = '\x0';
+      }
       break;
 
     case 'u': /* unicast testing */
       unicast = 1;
       break;
 
+    case 'n': /* number of offers to wait for */
+      if (!is_intpos(optarg)) {
+        usage2(_("Number of offers must be a positive integer"), optarg);
+      }
+      expected_offers = atoi(optarg);
+      break;
+
+    case LOAD_OPTION:
+      if (!is_intpos(optarg) || atoi(optarg) > MAX_LOAD_DISCOVERS) {
+        usage2(_("The number of DHCPDISCOVERs must be between 1 and 65535"),
+               optarg);
+      }
+      load_discovers = atoi(optarg);
+      break;
+
+    case RATE_OPTION:
+      if (!is_positive(optarg) || strtod(optarg, NULL) > 1000000) {
+        usage2(_("The rate must be a positive number of DHCPDISCOVERs a second"),
+               optarg);
+      }
+      load_rate = strtod(optarg, NULL);
+      break;
+
+    case LOSS_OPTION:
+    case LATENCY_OPTION:
+      warn = strtod(optarg, &next);
+      if (next == optarg || warn < 0 || *next != ',' ||
+          !is_nonnegative(next + 1)) {
+        usage2(_("Thresholds must be given as WARN,CRIT"), optarg);
+      }
+      crit = strtod(next + 1, NULL);
+      if (c == LOSS_OPTION) {
+        loss_warn = warn;
+        loss_crit = crit;
+      } else {
+        latency_warn = warn;
+        latency_crit = crit;
+      }
+      break;
+
     case 'V': /* version */
       print_revision(progname, NP_VERSION);
       exit(STATE_OK);
@@ -1256,7 +1866,17 @@ int process_arguments(int argc, char **argv) {
   return validate_arguments();
 }
 
-int validate_arguments(void) { return OK; }
+int validate_arguments(void) {
+  if (load_discovers > 0) {
+    if (num_interfaces > 1) {
+      usage4(_("--load takes a single interface"));
+    }
+    if (user_specified_mac != NULL || request_specific_address == TRUE) {
+      usage4(_("--load makes up the MAC address of each DHCPDISCOVER and cannot be combined with -m or -r"));
+    }
+  }
+  return OK;
+}
 
 #if defined(__sun__) || defined(__solaris__) || defined(__hpux__)
 /* get a message from a stream; return type of message */
@@ -1459,12 +2079,31 @@ void print_help(void) {
          _("IP address that should be offered by at least one DHCP server"));
   printf(" %s\n", "-t, --timeout=INTEGER");
   printf("    %s\n", _("Seconds to wait for DHCPOFFER before timeout occurs"));
+  printf(" %s\n", "-n, --offers=INTEGER");
+  printf("    %s\n", _("Number of DHCPOFFERs to wait for. Listening ends before the"));
+  printf("    %s\n", _("timeout once these have come, every -s server has answered"));
+  printf("    %s\n", _("and the -r address was offered, as far as each is given"));
   printf(" %s\n", "-i, --interface=STRING");
-  printf("    %s\n", _("Interface to to use for listening (i.e. eth0)"));
+  printf("    %s\n", _("Interface to to use for listening (i.e. eth0). May be repeated or"));
+  printf("    %s\n", _("a comma separated list: all are probed at once, each on its own"));
+  printf("    %s\n", _("socket, with a line for each after the summary. -s, -r and -n"));
+  printf("    %s\n", _("then apply to each interface"));
   printf(" %s\n", "-m, --mac=STRING");
   printf("    %s\n", _("MAC address to use in the DHCP request"));
   printf(" %s\n", "-u, --unicast");
   printf("    %s\n", _("Unicast testing: mimic a DHCP relay, requires -s"));
+  printf(" %s\n", "--load=INTEGER");
+  printf("    %s\n", _("Send this many DHCPDISCOVERs, each from a made up MAC address, and"));
+  printf("    %s\n", _("report the share that got no offer and the percentiles of the time"));
+  printf("    %s\n", _("to the first offer; every address offered is released afterwards"));
+  printf(" %s\n", "--rate=NUMBER");
+  printf("    %s\n", _("DHCPDISCOVERs a second with --load (default: 50)"));
+  printf(" %s\n", "--loss=WARN,CRIT");
+  printf("    %s\n", _("Percent of them without an offer for a warning or critical state"));
+  printf("    %s\n", _("(default: 5,20)"));
+  printf(" %s\n", "--latency=WARN,CRIT");
+  printf("    %s\n", _("Milliseconds to the first offer, at the 95th percentile, for a"));
+  printf("    %s\n", _("warning or critical state"));
   printf(UT_SUPPORT);
   return;
 }
@@ -1473,6 +2112,8 @@ void print_usage(void) {
   printf("%s\n", _("Usage:"));
   printf(" %s [-v] [-u] [-s serverip] [-r requestedip] [-t timeout]\n",
          progname);
-  printf("                  [-i interface] [-m mac]\n");
+  printf("                  [-i interface[,interface...]] [-m mac] [-n offers]\n");
+  printf("                  [--load discovers [--rate per_second] [--loss warn,crit]\n");
+  printf("                  [--latency warn,crit]]\n");
   return;
 }
@@ -51,11 +51,21 @@ const char *email = "devel@nagios-plugins.org";
 /* nagios plugins basic includes */
 #include "common.h"
 #include "netutils.h"
+#include "icmputils.h"
 #include "utils.h"
 
 #if HAVE_SYS_SOCKIO_H
 #include <sys/sockio.h>
 #endif
+#if HAVE_LINUX_NET_TSTAMP_H
+#include <linux/net_tstamp.h>
+#endif
+#if HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
 #include <arpa/inet.h>
 #include <ctype.h>
 #include <errno.h>
@@ -92,32 +102,22 @@ const char *email = "devel@nagios-plugins.org";
 #define SOL_IP 0
 #endif
 
-/* we bundle these in one #ifndef, since they're all from BSD */
-/* Put individual #ifndef's around those that bother you */
-#ifndef ICMP_UNREACH_NET_UNKNOWN
-#define ICMP_UNREACH_NET_UNKNOWN 6
-#define ICMP_UNREACH_HOST_UNKNOWN 7
-#define ICMP_UNREACH_ISOLATED 8
-#define ICMP_UNREACH_NET_PROHIB 9
-#define ICMP_UNREACH_HOST_PROHIB 10
-#define ICMP_UNREACH_TOSNET 11
-#define ICMP_UNREACH_TOSHOST 12
-#endif
-/* tru64 has the ones above, but not these */
-#ifndef ICMP_UNREACH_FILTER_PROHIB
-#define ICMP_UNREACH_FILTER_PROHIB 13
-#define ICMP_UNREACH_HOST_PRECEDENCE 14
-#define ICMP_UNREACH_PRECEDENCE_CUTOFF 15
-#endif
-
 #ifndef DBL_MAX
 #define DBL_MAX 9.9999999999e999
 #endif
 
 typedef unsigned short range_t; /* type for get_range() -- unimplemented */
 
+/* Rtts are counted in a log-linear histogram: exact below HIST_SUB usecs,
+ * then HIST_SUB buckets per power of two (each at most 1/HIST_SUB wide)
+ * up to some 268 seconds, so percentiles cost constant memory per host
+ * whatever the number of packets. */
+#define HIST_SUB 8
+#define HIST_BUCKETS (HIST_SUB * 26)
+
 typedef struct rta_host {
-  unsigned short id;                  /* id in **table, and icmp pkts */
+  unsigned int id;                    /* next icmp seq, before truncation */
+  unsigned int index;                 /* position in **table */
   char *name;                         /* arg used for adding this host */
   char *msg;                          /* icmp error message, if any */
   struct sockaddr_storage saddr_in;   /* the address of this host */
@@ -139,11 +139,17 @@ typedef struct rta_host {
   int mos_status;
   double score; /* score */
   int score_status;
+  double pct; /* rtt at the percentile of percentile_mode, in usecs */
+  int pct_status;
+  unsigned short hist[HIST_BUCKETS]; /* rtt histogram, see HIST_SUB */
   u_int last_tdiff;
   u_int last_icmp_seq; /* Last ICMP_SEQ to check out of order pkts */
   unsigned char pl;    /* measured packet loss */
   int pl_status;
   struct rta_host *next; /* linked list */
+  struct rta_host *hash_next; /* same bucket in host_hash */
+  int64_t next_send; /* when the next packet is due, monotonic usecs */
+  int sched_pos;     /* position in the send schedule, -1 if not in it */
   int order_status;
 } rta_host;
 
@@ -156,14 +162,23 @@ typedef struct threshold {
   double jitter;    /* jitter time average, microseconds */
   double mos;       /* MOS */
   double score;     /* Score */
+  unsigned int pct; /* rtt at the percentile, microseconds, 0 if unset */
 } threshold;
 
 /* the data structure */
 typedef struct icmp_ping_data {
-  struct timeval stime; /* timestamp (saved in protocol struct as well) */
+  int64_t stime; /* wall clock send time in nsecs, as kernel timestamps are */
+  int64_t smono; /* monotonic send time in nsecs */
   unsigned short ping_id;
 } icmp_ping_data;
 
+/* when a reply arrived */
+typedef struct rx_time {
+  int64_t hw;   /* hardware timestamp in wall clock nsecs, 0 if none */
+  int64_t sw;   /* kernel timestamp in wall clock nsecs, 0 if none */
+  int64_t mono; /* monotonic nsecs when it was read */
+} rx_time;
+
 typedef union ip_hdr {
   struct ip ip;
   struct ip6_hdr ip6;
@@ -207,6 +222,16 @@ typedef union icmp_packet {
 #define MAX_PING_DATA (MAX_IP_PKT_SIZE - IP_HDR_SIZE - ICMP_MINLEN)
 #define DEFAULT_PING_DATA_SIZE (MIN_PING_DATA_SIZE + 44)
 
+#define ICMP_BATCH 64        /* packets per sendmmsg() and recvmmsg() */
+#define FAMILY_V4 1          /* address families, as bits */
+#define FAMILY_V6 2
+#define FAMILY_BIT(f) ((f) == AF_INET6 ? FAMILY_V6 : FAMILY_V4)
+#define RESOLVE_THREADS 16   /* names looked up at the same time */
+#define MAX_RANGE_BITS 16    /* largest address range, /16 or /112 */
+#define RECV_BUF_SIZE 4096   /* room for one received packet */
+#define MAX_SHARDS 64        /* processes -j can split the targets between */
+#define SHARD_TOTALS 0xffffffffu /* index of the last record of a shard */
+
 /* various target states */
 #define TSTATE_INACTIVE 0x01 /* don't ping this host anymore */
 #define TSTATE_WAITING 0x02  /* unanswered packets on the wire */
@@ -218,21 +243,49 @@ void print_help(void);
 void print_usage(void);
 static u_int get_timevar(const char *);
 static u_int get_timevaldiff(struct timeval *, struct timeval *);
+static int64_t clock_ns(int);
+static u_int reply_rtt(const icmp_ping_data *, const rx_time *);
 static in_addr_t get_ip_address(const char *);
-static int wait_for_reply(int, u_int);
-static int recvfrom_wto(int, void *, unsigned int, struct sockaddr *, u_int *,
-                        struct timeval *);
-static int send_icmp_ping(int, struct rta_host *);
+static int wait_for_reply(u_int);
+static int recvfrom_wto(void *, unsigned int, struct sockaddr *, u_int *,
+                        rx_time *);
+static int send_icmp_ping(struct rta_host *);
+static void flush_icmp_pings(void);
+#ifdef HAVE_RECVMMSG
+static int recv_ring_take(void *, unsigned int, struct sockaddr *,
+                          rx_time *);
+#endif
 static int get_threshold(char *str, threshold *th);
+static int get_percentile(const char *, threshold *);
+static unsigned int hist_bucket(u_int);
+static double hist_percentile(const struct rta_host *, double);
 static int get_threshold2(char *str, threshold *, threshold *, int type);
 static void run_checks(void);
 static void set_source_ip(char *);
-static int add_target(char *);
+static void attach_filter(int, int);
+static void setup_icmp_socket(int, int);
+static void add_target(char *, int);
+static void read_targets(const char *);
+static void load_targets(void);
 static int add_target_ip(char *, struct sockaddr_storage *);
 static int handle_random_icmp(unsigned char *, struct sockaddr_storage *);
-static unsigned short icmp_checksum(unsigned short *, int);
+static void hash_host(struct rta_host *);
+static struct rta_host *find_host(const struct sockaddr_storage *);
+static unsigned int host_bucket(const struct sockaddr_storage *);
+static void sched_push(struct rta_host *);
+static struct rta_host *sched_pop(void);
+static void sched_remove(struct rta_host *);
+static int sched_reply(struct rta_host *, int64_t);
+static int evaluate_host(struct rta_host *, int *);
+static void print_host(const struct rta_host *, int *);
+static void host_done(struct rta_host *);
+static struct rta_host *reply_host(const struct sockaddr_storage *,
+                                   unsigned short);
 static void finish(int);
 static void crash(const char *, ...);
+static void run_shards(void);
+static void shard_send(const struct rta_host *);
+static void shard_finish(void);
 
 /* external */
 extern int optind, opterr, optopt;
@@ -241,17 +294,89 @@ extern char **environ;
 
 /* global variables */
 static struct rta_host **table, *cursor, *list;
+/* hosts by address, so that replies and duplicates are found in O(1) */
+static struct rta_host **host_hash;
+static unsigned int host_hash_size;
 static threshold crit = {80, 500000}, warn = {40, 200000};
 static int mode, protocols, sockets, debug = 0, timeout = 10;
 static unsigned short icmp_data_size = DEFAULT_PING_DATA_SIZE;
 static unsigned short icmp_pkt_size = DEFAULT_PING_DATA_SIZE + ICMP_MINLEN;
 
+/* queued echo requests, see send_icmp_ping() */
+static unsigned char *send_bufs;
+static struct rta_host *send_queue[ICMP_BATCH];
+static unsigned int send_queued;
+
+#ifdef HAVE_RECVMMSG
+/* packets read by the last recvmmsg(), see recvfrom_wto() */
+static unsigned char *recv_bufs;
+static struct mmsghdr recv_msgs[ICMP_BATCH];
+static struct iovec recv_iov[ICMP_BATCH];
+static struct sockaddr_storage recv_addr[ICMP_BATCH];
+static char recv_control[ICMP_BATCH]
+                        [CMSG_SPACE(3 * sizeof(struct timespec)) + 64];
+static int64_t recv_mono;
+static unsigned int recv_count, recv_next;
+#endif
+
 static unsigned int icmp_sent = 0, icmp_recv = 0, icmp_lost = 0;
 #define icmp_pkts_en_route (icmp_sent - (icmp_recv + icmp_lost))
-static unsigned short targets_down = 0, targets = 0, packets = 0;
+static unsigned int targets_down = 0, targets = 0;
+static unsigned short packets = 0;
 #define targets_alive (targets - targets_down)
 static unsigned int retry_interval, pkt_interval, target_interval;
-static int icmp_sock, tcp_sock, udp_sock, status = STATE_OK;
+/* per-host results written as hosts are decided, see host_done() */
+#define STREAM_NONE 0
+#define STREAM_JSON 1
+#define STREAM_PASSIVE 2
+static int stream_mode = STREAM_NONE;
+static unsigned int streamed[STATE_UNKNOWN];
+
+/* Targets as given, with -H, -f or as arguments. They are added by
+ * load_targets() once all options are known, which looks the names up
+ * in parallel. */
+typedef struct target_spec {
+  char *arg;
+  int from_file;         /* a name that fails is skipped rather than fatal */
+  int lookup;            /* a name rather than an address or range */
+  int done;              /* the lookup has finished */
+  int error;             /* of getaddrinfo() */
+  struct addrinfo *res;
+} target_spec;
+static target_spec *specs;
+static unsigned int specs_len, specs_size;
+
+/* hosts with packets left to send, a min-heap on next_send */
+static struct rta_host **sched;
+static unsigned int sched_len;
+static int icmp_sock = -1, icmp6_sock = -1, tcp_sock, udp_sock,
+           status = STATE_OK;
+/* With -j the targets are split between as many processes, each with
+ * raw sockets of its own opened here and its pid as the ICMP id of its
+ * packets and socket filter, and each sending at its share of the rate
+ * of -I. They write their hosts to the parent over a pipe, which gives
+ * the output as if it had checked them itself. */
+static unsigned int shards = 1;
+static unsigned int shard;          /* of this process */
+static int shard_fd = -1;           /* in a shard, the pipe to the parent */
+static int shard_sock[MAX_SHARDS][2]; /* the ICMPv4 and ICMPv6 sockets */
+static pid_t shard_pid[MAX_SHARDS];
+static int64_t shard_delay;         /* of its first packet, in usecs */
+
+/* a host of a shard, and at the end its counters */
+typedef struct shard_record {
+  uint32_t index; /* in the parent's table, or SHARD_TOTALS */
+  union {
+    struct rta_host host;
+    struct {
+      unsigned int down, sent, recv, lost;
+    } totals;
+  } u;
+} shard_record;
+
+static int ip_families;  /* the families given with -4 and -6 */
+static int run_families; /* the families of the targets */
+static int send_family;  /* of the queued echo requests */
 static pid_t pid;
 static struct timezone tz;
 static struct timeval prog_start;
@@ -268,6 +393,8 @@ int jitter_mode = 0;
 int score_mode = 0;
 int mos_mode = 0;
 int order_mode = 0;
+int percentile_mode = 0;
+double percentile = 0; /* of the rtts, set by -w/-c pN=... */
 
 /* code start */
 static void crash(const char *fmt, ...) {
@@ -288,136 +415,18 @@ static void crash(const char *fmt, ...) {
   exit(3);
 }
 
-static const char *get_icmp_error_msg(unsigned char icmp_type,
-                                      unsigned char icmp_code) {
-  const char *msg = "unreachable";
-
-  if (debug > 1) {
-    printf("get_icmp_error_msg(%u, %u)\n", icmp_type, icmp_code);
-  }
-  switch (icmp_type) {
-  case ICMP_UNREACH:
-    switch (icmp_code) {
-    case ICMP_UNREACH_NET:
-      msg = "Net unreachable";
-      break;
-
-    case ICMP_UNREACH_HOST:
-      msg = "Host unreachable";
-      break;
-
-    case ICMP_UNREACH_PROTOCOL:
-      msg = "Protocol unreachable (firewall?)";
-      break;
-
-    case ICMP_UNREACH_PORT:
-      msg = "Port unreachable (firewall?)";
-      break;
-
-    case ICMP_UNREACH_NEEDFRAG:
-      msg = "Fragmentation needed";
-      break;
-
-    case ICMP_UNREACH_SRCFAIL:
-      msg = "Source route failed";
-      break;
-
-    case ICMP_UNREACH_ISOLATED:
-      msg = "Source host isolated";
-      break;
-
-    case ICMP_UNREACH_NET_UNKNOWN:
-      msg = "Unknown network";
-      break;
-
-    case ICMP_UNREACH_HOST_UNKNOWN:
-      msg = "Unknown host";
-      break;
-
-    case ICMP_UNREACH_NET_PROHIB:
-      msg = "Network denied (firewall?)";
-      break;
-
-    case ICMP_UNREACH_HOST_PROHIB:
-      msg = "Host denied (firewall?)";
-      break;
-
-    case ICMP_UNREACH_TOSNET:
-      msg = "Bad TOS for network (firewall?)";
-      break;
-
-    case ICMP_UNREACH_TOSHOST:
-      msg = "Bad TOS for host (firewall?)";
-      break;
-
-    case ICMP_UNREACH_FILTER_PROHIB:
-      msg = "Prohibited by filter (firewall)";
-      break;
-
-    case ICMP_UNREACH_HOST_PRECEDENCE:
-      msg = "Host precedence violation";
-      break;
-
-    case ICMP_UNREACH_PRECEDENCE_CUTOFF:
-      msg = "Precedence cutoff";
-      break;
-
-    default:
-      msg = "Invalid code";
-      break;
-    }
-    break;
-
-  case ICMP_TIMXCEED:
-    /* really 'out of reach', or non-existant host behind a router serving */
-    /* two different subnets */
-    switch (icmp_code) {
-    case ICMP_TIMXCEED_INTRANS:
-      msg = "Time to live exceeded in transit";
-      break;
-
-    case ICMP_TIMXCEED_REASS:
-      msg = "Fragment reassembly time exceeded";
-      break;
-
-    default:
-      msg = "Invalid code";
-      break;
-    }
-    break;
-
-  case ICMP_SOURCEQUENCH:
-    msg = "Transmitting too fast";
-    break;
-
-  case ICMP_REDIRECT:
-    msg = "Redirect (change route)";
-    break;
-
-  case ICMP_PARAMPROB:
-    msg = "Bad IP header (required option absent)";
-    break;
-
-  /* the following aren't error messages, so ignore */
-  case ICMP_TSTAMP:
-  case ICMP_TSTAMPREPLY:
-  case ICMP_IREQ:
-  case ICMP_IREQREPLY:
-  case ICMP_MASKREQ:
-  case ICMP_MASKREPLY:
-  default:
-    msg = "";
-    break;
-  }
-
-  return msg;
-}
-
 static int handle_random_icmp(unsigned char *packet,
                               struct sockaddr_storage *addr) {
   struct icmp p, sent_icmp;
+  struct ip sent_ip;
+  struct sockaddr_in sent_to;
   struct rta_host *host = NULL;
 
+  /* only ICMPv4 errors are looked into */
+  if (addr->ss_family != AF_INET) {
+    return 0;
+  }
+
   memcpy(&p, packet, sizeof(p));
   if (p.icmp_type == ICMP_ECHO && ntohs(p.icmp_id) == pid) {
     /* echo request from us to us (pinging localhost) */
@@ -444,10 +453,17 @@ static int handle_random_icmp(unsigned char *packet,
   }
 
   /* might be for us. At least it holds the original package (according
-   * to RFC 792). If it isn't, just ignore it */
-  memcpy(&sent_icmp, packet + 28, sizeof(sent_icmp));
+   * to RFC 792), whose destination tells which host it was sent to. If
+   * it isn't, just ignore it */
+  memcpy(&sent_ip, packet + ICMP_MINLEN, sizeof(sent_ip));
+  memcpy(&sent_icmp, packet + ICMP_MINLEN + (sent_ip.ip_hl << 2),
+         sizeof(sent_icmp));
+  memset(&sent_to, 0, sizeof(sent_to));
+  sent_to.sin_family = AF_INET;
+  sent_to.sin_addr = sent_ip.ip_dst;
   if (sent_icmp.icmp_type != ICMP_ECHO || ntohs(sent_icmp.icmp_id) != pid ||
-      ntohs(sent_icmp.icmp_seq) >= targets * packets) {
+      !(host = reply_host((struct sockaddr_storage *)&sent_to,
+                          ntohs(sent_icmp.icmp_seq)))) {
     if (debug) {
       printf("Packet is no response to a packet we sent\n");
     }
@@ -455,18 +471,18 @@ static int handle_random_icmp(unsigned char *packet,
   }
 
   /* it is indeed a response for us */
-  host = table[ntohs(sent_icmp.icmp_seq) / packets];
   if (debug) {
-    char address[address_length(address_family)];
-    parse_address_string(address_family, addr, address, sizeof(address));
+    char address[address_length(addr->ss_family)];
+    parse_address_string(addr->ss_family, addr, address, sizeof(address));
     printf("Received \"%s\" from %s for ICMP ECHO sent to %s.\n",
-           get_icmp_error_msg(p.icmp_type, p.icmp_code), address, host->name);
+           np_icmp_error_text(p.icmp_type, p.icmp_code), address, host->name);
   }
 
   icmp_lost++;
   host->icmp_lost++;
   /* don't spend time on lost hosts any more */
   if (host->flags & FLAG_LOST_CAUSE) {
+    host_done(host);
     return 0;
   }
 
@@ -483,6 +499,7 @@ static int handle_random_icmp(unsigned char *packet,
   host->icmp_code = p.icmp_code;
   host->error_addr = *addr;
 
+  host_done(host);
   return 0;
 }
 
@@ -491,19 +508,13 @@ int main(int argc, char **argv) {
   char *ptr;
   char *bind_address = NULL;
   long int arg;
-  int icmp_sockerrno, udp_sockerrno, tcp_sockerrno;
+  int icmp_sockerrno, icmp6_sockerrno, udp_sockerrno, tcp_sockerrno;
+  int hops;
   int result;
   struct rta_host *host;
 #ifdef HAVE_SIGACTION
   struct sigaction sig_action;
 #endif
-#ifdef SO_TIMESTAMP
-  int on = 1;
-#endif
-
-  setlocale(LC_ALL, "");
-  bindtextdomain(PACKAGE, LOCALEDIR);
-  textdomain(PACKAGE);
 
   /* print a helpful error message if geteuid != 0 */
   np_warn_if_not_root();
@@ -512,13 +523,10 @@ int main(int argc, char **argv) {
   /* It will be changed to AF_INET6 later if required */
   address_family = AF_INET;
 
-  /* Set default ip_protocol to IPPROTO_ICMP (IPv4) */
-  /* It will be changed to IPPROTO_ICMPV6 later if required */
-  int ip_protocol = IPPROTO_ICMP;
-
   /* we only need to be setsuid when we get the sockets, so do
    * that before pointer magic (esp. on network data) */
-  icmp_sockerrno = udp_sockerrno = tcp_sockerrno = sockets = 0;
+  icmp_sockerrno = icmp6_sockerrno = udp_sockerrno = tcp_sockerrno = sockets =
+      0;
 
   /* get calling name the old-fashioned way for portability instead
    * of relying on the glibc-ism __progname */
@@ -571,7 +579,7 @@ int main(int argc, char **argv) {
   /* parse the arguments */
   for (i = 1; i < argc; i++) {
     while ((arg = getopt(argc, argv,
-                         "vhVw:c:n:p:t:H:s:i:b:I:l:m:P:R:J:S:M:O:64")) != EOF) {
+                         "vhVw:c:n:p:t:H:f:s:i:b:I:j:l:m:o:P:R:J:S:M:O:64")) != EOF) {
       long size;
       switch (arg) {
       case 'v':
@@ -599,12 +607,23 @@ int main(int argc, char **argv) {
         target_interval = get_timevar(optarg);
         break;
 
+      case 'j':
+        shards = strtoul(optarg, NULL, 0);
+        if (shards < 1 || shards > MAX_SHARDS) {
+          usage_va("The number of shards must be between 1 and %d", MAX_SHARDS);
+        }
+        break;
+
       case 'w':
-        get_threshold(optarg, &warn);
+        if (!get_percentile(optarg, &warn)) {
+          get_threshold(optarg, &warn);
+        }
         break;
 
       case 'c':
-        get_threshold(optarg, &crit);
+        if (!get_percentile(optarg, &crit)) {
+          get_threshold(optarg, &crit);
+        }
         break;
 
       case 'n':
@@ -620,21 +639,23 @@ int main(int argc, char **argv) {
         break;
 
       case '4':
-        address_family = AF_INET;
-        ip_protocol = IPPROTO_ICMP;
+        ip_families |= FAMILY_V4;
         break;
 
       case '6':
 #ifdef USE_IPV6
-        address_family = AF_INET6;
-        ip_protocol = IPPROTO_ICMPV6;
+        ip_families |= FAMILY_V6;
 #else
         usage(_("IPv6 support not available\n"));
 #endif
         break;
 
       case 'H':
-        add_target(optarg);
+        add_target(optarg, FALSE);
+        break;
+
+      case 'f':
+        read_targets(optarg);
         break;
 
       case 'l':
@@ -702,14 +723,67 @@ int main(int argc, char **argv) {
         /* out of order mode */
         order_mode = 1;
         break;
+
+      case 'o':
+        if (!strcmp(optarg, "json")) {
+          stream_mode = STREAM_JSON;
+        } else if (!strcmp(optarg, "passive")) {
+          stream_mode = STREAM_PASSIVE;
+        } else {
+          usage_va("Unknown output format: %s (json or passive)", optarg);
+        }
+        break;
       }
     }
   }
 
-  if ((icmp_sock = socket(address_family, SOCK_RAW, ip_protocol)) != -1) {
-    sockets |= HAVE_ICMP;
-  } else {
-    icmp_sockerrno = errno;
+  /* if no new mode selected, use old schema */
+  if (!rta_mode && !pl_mode && !jitter_mode && !score_mode && !mos_mode &&
+      !order_mode && !percentile_mode) {
+    rta_mode = 1;
+    pl_mode = 1;
+  }
+
+  /* Addresses can be of either family, names are looked up as IPv4
+   * unless -6 is given. With both -4 and -6 names are looked up as
+   * either. Either one alone limits the targets to that family. */
+  if (ip_families == (FAMILY_V4 | FAMILY_V6)) {
+    address_family = AF_UNSPEC;
+  } else if (ip_families == FAMILY_V6) {
+    address_family = AF_INET6;
+  }
+  if (!ip_families) {
+#ifdef USE_IPV6
+    ip_families = FAMILY_V4 | FAMILY_V6;
+#else
+    ip_families = FAMILY_V4;
+#endif
+  }
+
+  if (ip_families & FAMILY_V4) {
+    if ((icmp_sock = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) != -1) {
+      sockets |= HAVE_ICMP;
+    } else {
+      icmp_sockerrno = errno;
+    }
+  }
+  if (ip_families & FAMILY_V6) {
+    if ((icmp6_sock = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6)) != -1) {
+      sockets |= HAVE_ICMP;
+    } else {
+      icmp6_sockerrno = errno;
+    }
+  }
+  /* the sockets of the other shards, while we can open them */
+  shard_sock[0][0] = icmp_sock;
+  shard_sock[0][1] = icmp6_sock;
+  for (i = 1; i < (int)shards; i++) {
+    shard_sock[i][0] = icmp_sock == -1 ? -1 : socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+    shard_sock[i][1] = icmp6_sock == -1 ? -1 : socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6);
+    if ((icmp_sock != -1 && shard_sock[i][0] == -1) ||
+        (icmp6_sock != -1 && shard_sock[i][1] == -1)) {
+      crash("Failed to obtain the ICMP sockets of shard %d", i);
+    }
   }
 
   if (bind_address != NULL) {
@@ -719,14 +793,6 @@ int main(int argc, char **argv) {
   /* now drop privileges (no effect if not setsuid or geteuid() == 0) */
   setuid(getuid());
 
-#ifdef SO_TIMESTAMP
-  if (setsockopt(icmp_sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on))) {
-    if (debug) {
-      printf("Warning: no SO_TIMESTAMP support\n");
-    }
-  }
-#endif /* SO_TIMESTAMP */
-
   /* POSIXLY_CORRECT might break things, so unset it (the portable way) */
   environ = NULL;
 
@@ -734,6 +800,14 @@ int main(int argc, char **argv) {
   /* Some systems have 32-bit pid_t so mask off only 16 bits */
   pid = getpid() & 0xffff;
   /* printf("pid = %u\n", pid); */
+  for (i = 0; i < (int)shards; i++) {
+    if (shard_sock[i][0] != -1) {
+      setup_icmp_socket(shard_sock[i][0], AF_INET);
+    }
+    if (shard_sock[i][1] != -1) {
+      setup_icmp_socket(shard_sock[i][1], AF_INET6);
+    }
+  }
 
   /* Parse extra opts if any */
   argv = np_extra_opts(&argc, argv, progname);
@@ -754,21 +828,27 @@ int main(int argc, char **argv) {
 
   argv = &argv[optind];
   while (*argv) {
-    add_target(*argv);
+    add_target(*argv, FALSE);
     argv++;
   }
+  load_targets();
   if (!targets) {
     errno = 0;
     crash("No hosts to check");
     exit(3);
   }
 
+  if ((run_families & FAMILY_V4) && icmp_sock == -1) {
+    errno = icmp_sockerrno;
+    crash("Failed to obtain ICMP socket");
+    return -1;
+  }
+  if ((run_families & FAMILY_V6) && icmp6_sock == -1) {
+    errno = icmp6_sockerrno;
+    crash("Failed to obtain ICMPv6 socket");
+    return -1;
+  }
   if (!sockets) {
-    if (icmp_sock == -1) {
-      errno = icmp_sockerrno;
-      crash("Failed to obtain ICMP socket");
-      return -1;
-    }
     /* if(udp_sock == -1) { */
     /* 	errno = icmp_sockerrno; */
     /* 	crash("Failed to obtain UDP socket"); */
@@ -784,7 +864,7 @@ int main(int argc, char **argv) {
     ttl = 64;
   }
 
-  if (icmp_sock) {
+  if (icmp_sock != -1) {
     result = setsockopt(icmp_sock, SOL_IP, IP_TTL, &ttl, sizeof(ttl));
     if (debug) {
       if (result == -1) {
@@ -794,6 +874,28 @@ int main(int argc, char **argv) {
       }
     }
   }
+  if (icmp6_sock != -1) {
+    hops = ttl;
+    result = setsockopt(icmp6_sock, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &hops,
+                        sizeof(hops));
+    if (debug) {
+      if (result == -1) {
+        printf("setsockopt failed\n");
+      } else {
+        printf("hop limit set to %u\n", ttl);
+      }
+    }
+  }
+  for (i = 1; i < (int)shards; i++) {
+    hops = ttl;
+    if (shard_sock[i][0] != -1) {
+      setsockopt(shard_sock[i][0], SOL_IP, IP_TTL, &ttl, sizeof(ttl));
+    }
+    if (shard_sock[i][1] != -1) {
+      setsockopt(shard_sock[i][1], IPPROTO_IPV6, IPV6_UNICAST_HOPS, &hops,
+                 sizeof(hops));
+    }
+  }
 
   /* Users should be able to give whatever thresholds they want */
   /* (nothing will break if they do), but some plugin maintainer */
@@ -884,16 +986,28 @@ int main(int argc, char **argv) {
   host = list;
 
   table = (struct rta_host **)malloc(sizeof(struct rta_host **) * targets);
+  if (!table) {
+    crash("main(): failed to malloc %lu bytes for the host table",
+          (unsigned long)(sizeof(struct rta_host **) * targets));
+  }
 
   i = 0;
   while (host) {
+    host->index = i;
     host->id = i * packets;
     table[i] = host;
     host = host->next;
     i++;
   }
 
-  run_checks();
+  if (shards > targets) {
+    shards = targets;
+  }
+  if (shards > 1) {
+    run_shards();
+  } else {
+    run_checks();
+  }
 
   errno = 0;
   finish(0);
@@ -901,31 +1015,70 @@ int main(int argc, char **argv) {
   return (0); 
 }
 
+/* Packets go out on a schedule: the first one to each target
+ * target_interval after the one to the target before it, the next ones
+ * to a target pkt_interval apart. Both are maximums, so a target's next
+ * packet is due as soon as it has answered the last one. Replies are
+ * reaped while waiting for the next packet to be due. */
 static void run_checks() {
-  u_int i, t, result;
+  struct rta_host *host;
+  struct timeval tv;
+  int64_t start, now;
+  u_int i, result;
   u_int final_wait, time_passed;
 
-  /* this loop might actually violate the pkt_interval or target_interval
-   * settings, but only if there aren't any packets on the wire which
-   * indicates that the target can handle an increased packet rate */
-  for (i = 0; i < packets; i++) {
-    for (t = 0; t < targets; t++) {
-      /* don't send useless packets */
-      if (!targets_alive) {
-        finish(0);
+  if (!(sched = malloc(sizeof(*sched) * targets))) {
+    crash("run_checks(): failed to malloc %lu bytes for the schedule",
+          (unsigned long)(sizeof(*sched) * targets));
+  }
+
+  start = clock_ns(CLOCK_MONOTONIC) / 1000 + shard_delay;
+  for (i = 0; i < targets; i++) {
+    table[i]->next_send = start + (int64_t)i * target_interval;
+    sched_push(table[i]);
+  }
+
+  while (sched_len) {
+    /* don't send useless packets */
+    if (!targets_alive) {
+      finish(0);
+    }
+    host = sched[0];
+    if (host->flags & FLAG_LOST_CAUSE) {
+      if (debug) {
+        printf("%s is a lost cause. not sending any more\n", host->name);
       }
-      if (table[t]->flags & FLAG_LOST_CAUSE) {
-        if (debug) {
-          printf("%s is a lost cause. not sending any more\n", table[t]->name);
-        }
-        continue;
+      sched_pop();
+      continue;
+    }
+
+    now = clock_ns(CLOCK_MONOTONIC) / 1000;
+    if (host->next_send > now) {
+      flush_icmp_pings();
+      if (icmp_pkts_en_route) {
+        result = wait_for_reply((u_int)(host->next_send - now));
+      } else {
+        /* nothing to listen for until then */
+        tv.tv_sec = (host->next_send - now) / 1000000;
+        tv.tv_usec = (host->next_send - now) % 1000000;
+        select(0, NULL, NULL, NULL, &tv);
       }
-      /* we're still in the game, so send next packet */
-      (void)send_icmp_ping(icmp_sock, table[t]);
-      result = wait_for_reply(icmp_sock, target_interval);
+      continue;
+    }
+
+    /* we're still in the game, so send next packet */
+    sched_pop();
+    (void)send_icmp_ping(host);
+    if (host->id - host->index * packets < packets) {
+      /* keep to the cadence, unless we fell behind it */
+      host->next_send += pkt_interval;
+      if (host->next_send < now) {
+        host->next_send = now;
+      }
+      sched_push(host);
     }
-    result = wait_for_reply(icmp_sock, pkt_interval * targets);
   }
+  flush_icmp_pings();
 
   if (icmp_pkts_en_route && targets_alive) {
     time_passed = get_timevaldiff(NULL, NULL);
@@ -948,8 +1101,79 @@ static void run_checks() {
       printf("Waiting for %u micro-seconds (%0.3f msecs)\n", final_wait,
              (float)final_wait / 1000);
     }
-    result = wait_for_reply(icmp_sock, final_wait);
+    result = wait_for_reply(final_wait);
+  }
+}
+
+static void sched_swap(unsigned int a, unsigned int b) {
+  struct rta_host *host = sched[a];
+
+  sched[a] = sched[b];
+  sched[b] = host;
+  sched[a]->sched_pos = a;
+  sched[b]->sched_pos = b;
+}
+
+static void sched_up(unsigned int pos) {
+  while (pos && sched[pos]->next_send < sched[(pos - 1) / 2]->next_send) {
+    sched_swap(pos, (pos - 1) / 2);
+    pos = (pos - 1) / 2;
+  }
+}
+
+static void sched_push(struct rta_host *host) {
+  host->sched_pos = sched_len;
+  sched[sched_len++] = host;
+  sched_up(host->sched_pos);
+}
+
+static void sched_down(unsigned int pos) {
+  unsigned int child;
+
+  while ((child = 2 * pos + 1) < sched_len) {
+    if (child + 1 < sched_len &&
+        sched[child + 1]->next_send < sched[child]->next_send) {
+      child++;
+    }
+    if (sched[pos]->next_send <= sched[child]->next_send) {
+      break;
+    }
+    sched_swap(pos, child);
+    pos = child;
+  }
+}
+
+static void sched_remove(struct rta_host *host) {
+  unsigned int pos = host->sched_pos;
+
+  host->sched_pos = -1;
+  if (pos != --sched_len) {
+    sched[pos] = sched[sched_len];
+    sched[pos]->sched_pos = pos;
+    sched_up(pos);
+    sched_down(sched[pos]->sched_pos);
+  }
+}
+
+/* take the host that is due first off the schedule */
+static struct rta_host *sched_pop(void) {
+  struct rta_host *host = sched[0];
+
+  sched_remove(host);
+  return host;
+}
+
+/* A reply from host came in at now, so its next packet is due. Returns
+ * TRUE if that packet is waiting to be sent. */
+static int sched_reply(struct rta_host *host, int64_t now) {
+  if (host->sched_pos < 0) {
+    return FALSE;
+  }
+  if (host->next_send > now) {
+    host->next_send = now;
+    sched_up(host->sched_pos);
   }
+  return TRUE;
 }
 
 /* Response Structure: */
@@ -960,29 +1184,31 @@ static void run_checks() {
 /*	Both: */
 /*		icmp header                : 28 bytes */
 /*		icmp echo reply            : the rest */
-static int wait_for_reply(int sock, u_int t) {
+static int wait_for_reply(u_int t) {
   int n, hlen;
-  static unsigned char buf[4096];
+  static unsigned char buf[RECV_BUF_SIZE];
+  static icmp_packet packet;
   struct sockaddr_storage resp_addr;
   union ip_hdr *ip;
-  union icmp_packet packet;
   struct rta_host *host;
   struct icmp_ping_data data;
-  struct timeval wait_start, now;
+  struct timeval wait_start;
+  rx_time now;
   u_int tdiff, i, per_pkt_wait;
   double jitter_tmp;
 
-  if (!(packet.buf = malloc(icmp_pkt_size))) {
-    crash("send_icmp_ping(): failed to malloc %d bytes for send buffer",
+  if (!packet.buf && !(packet.buf = malloc(icmp_pkt_size))) {
+    crash("wait_for_reply(): failed to malloc %d bytes for receive buffer",
           icmp_pkt_size);
     return -1; /* might be reached if we're in debug mode */
   }
 
-  memset(packet.buf, 0, icmp_pkt_size);
-
   /* if we can't listen or don't have anything to listen to, just return */
-  if (!t || !icmp_pkts_en_route) {
-    free(packet.buf);
+  if (!t) {
+    return 0;
+  }
+  flush_icmp_pings();
+  if (!icmp_pkts_en_route) {
     return 0;
   }
 
@@ -1001,8 +1227,7 @@ static int wait_for_reply(int sock, u_int t) {
     }
 
     /* reap responses until we hit a timeout */
-    n = recvfrom_wto(sock, buf, sizeof(buf), (struct sockaddr *)&resp_addr, &t,
-                     &now);
+    n = recvfrom_wto(buf, sizeof(buf), (struct sockaddr *)&resp_addr, &t, &now);
     if (!n) {
       if (debug > 1) {
         printf("recvfrom_wto() timed out during a %u usecs wait\n",
@@ -1018,28 +1243,29 @@ static int wait_for_reply(int sock, u_int t) {
       return n;
     }
 
+    memset(packet.buf, 0, icmp_pkt_size);
     ip = (union ip_hdr *)buf;
     if (debug > 1) {
-      char address[address_length(address_family)];
-      parse_address_string(address_family, &resp_addr, address,
+      char address[address_length(resp_addr.ss_family)];
+      parse_address_string(resp_addr.ss_family, &resp_addr, address,
                            sizeof(address));
-      if (address_family == AF_INET) {
+      if (resp_addr.ss_family == AF_INET) {
         printf("received %u bytes from %s\n", ntohs(ip->ip.ip_len), address);
-      } else if (address_family == AF_INET6) {
+      } else if (resp_addr.ss_family == AF_INET6) {
         printf("received %u bytes from %s\n", ntohs(ip->ip6.ip6_plen), address);
       }
     }
 
     /* IPv6 doesn't have a header length, it's a payload length */
-    if (address_family == AF_INET) {
+    if (resp_addr.ss_family == AF_INET) {
       hlen = ip->ip.ip_hl << 2;
-    } else if (address_family == AF_INET6) {
+    } else if (resp_addr.ss_family == AF_INET6) {
       hlen = 0;
     }
 
     if (n < (hlen + ICMP_MINLEN)) {
-      char address[address_length(address_family)];
-      parse_address_string(address_family, &resp_addr, address,
+      char address[address_length(resp_addr.ss_family)];
+      parse_address_string(resp_addr.ss_family, &resp_addr, address,
                            sizeof(address));
       crash("received packet too short for ICMP (%d bytes, expected %d) from "
             "%s\n",
@@ -1047,15 +1273,18 @@ static int wait_for_reply(int sock, u_int t) {
     }
 
     /* check the response */
-    memcpy(packet.buf, buf + hlen, icmp_pkt_size);
-    if ((address_family == AF_INET &&
+    memcpy(packet.buf, buf + hlen,
+           (unsigned int)(n - hlen) < icmp_pkt_size ? (unsigned int)(n - hlen)
+                                                    : icmp_pkt_size);
+    host = NULL;
+    if ((resp_addr.ss_family == AF_INET &&
          (ntohs(packet.icp->icmp_id) != pid ||
           packet.icp->icmp_type != ICMP_ECHOREPLY ||
-          ntohs(packet.icp->icmp_seq) >= targets * packets)) ||
-        (address_family == AF_INET6 &&
+          !(host = reply_host(&resp_addr, ntohs(packet.icp->icmp_seq))))) ||
+        (resp_addr.ss_family == AF_INET6 &&
          (ntohs(packet.icp6->icmp6_id) != pid ||
           packet.icp6->icmp6_type != ICMP6_ECHO_REPLY ||
-          ntohs(packet.icp6->icmp6_seq) >= targets * packets))) {
+          !(host = reply_host(&resp_addr, ntohs(packet.icp6->icmp6_seq)))))) {
       if (debug > 2) {
         printf("not a proper ICMP_ECHOREPLY\n");
       }
@@ -1064,25 +1293,23 @@ static int wait_for_reply(int sock, u_int t) {
     }
 
     /* this is indeed a valid response */
-    if (address_family == AF_INET) {
+    if (resp_addr.ss_family == AF_INET) {
       memcpy(&data, packet.icp->icmp_data, sizeof(data));
       if (debug > 2) {
         printf("ICMP echo-reply of len %lu, id %u, seq %u, cksum 0x%X\n",
                (unsigned long)sizeof(data), ntohs(packet.icp->icmp_id),
                ntohs(packet.icp->icmp_seq), packet.icp->icmp_cksum);
       }
-      host = table[ntohs(packet.icp->icmp_seq) / packets];
-    } else if (address_family == AF_INET6) {
+    } else if (resp_addr.ss_family == AF_INET6) {
       memcpy(&data, &packet.icp6->icmp6_dataun.icmp6_un_data8[4], sizeof(data));
       if (debug > 2) {
         printf("ICMP echo-reply of len %lu, id %u, seq %u, cksum 0x%X\n",
                (unsigned long)sizeof(data), ntohs(packet.icp6->icmp6_id),
                ntohs(packet.icp6->icmp6_seq), packet.icp6->icmp6_cksum);
       }
-      host = table[ntohs(packet.icp6->icmp6_seq) / packets];
     }
 
-    tdiff = get_timevaldiff(&data.stime, &now);
+    tdiff = reply_rtt(&data, &now);
 
     if (host->last_tdiff > 0) {
       /* Calculate jitter */
@@ -1122,10 +1349,13 @@ static int wait_for_reply(int sock, u_int t) {
     if (tdiff < (int)host->rtmin) {
       host->rtmin = tdiff;
     }
+    if (host->hist[hist_bucket(tdiff)] < USHRT_MAX) {
+      host->hist[hist_bucket(tdiff)]++;
+    }
 
     if (debug) {
-      char address[address_length(address_family)];
-      parse_address_string(address_family, &resp_addr, address,
+      char address[address_length(resp_addr.ss_family)];
+      parse_address_string(resp_addr.ss_family, &resp_addr, address,
                            sizeof(address));
       printf("%0.3f ms rtt from %s, outgoing ttl: %u, incoming ttl: %u, max: "
              "%0.3f, min: %0.3f\n",
@@ -1142,160 +1372,327 @@ static int wait_for_reply(int sock, u_int t) {
              (float)crit.rta / 1000);
       exit(STATE_OK);
     }
+
+    /* go and send it */
+    if (sched_reply(host, now.mono / 1000)) {
+      return 0;
+    }
+    host_done(host);
   }
   return 0;
 }
 
 /* the ping functions */
-static int send_icmp_ping(int sock, struct rta_host *host) {
-  long int len;
-  struct icmp_ping_data data;
-  struct msghdr hdr;
-  struct iovec iov;
-  struct timeval tv;
-  void *buf = NULL;
 
-  if (sock == -1) {
+/* Echo requests are built by send_icmp_ping() into send_bufs and go out
+ * together, with one sendmmsg() where there is one, when the queue is
+ * full or before waiting for replies. They are timestamped as they are
+ * flushed, so queueing does not add to the measured rtt. */
+static int send_icmp_ping(struct rta_host *host) {
+  int family = host->saddr_in.ss_family;
+  unsigned char *buf;
+
+  if ((family == AF_INET6 ? icmp6_sock : icmp_sock) == -1) {
     errno = 0;
     crash("Attempt to send on bogus socket");
     return -1;
   }
 
-  if (!buf) {
-    if (!(buf = malloc(icmp_pkt_size))) {
+  if (!send_bufs) {
+    if (!(send_bufs = malloc((size_t)icmp_pkt_size * ICMP_BATCH))) {
       crash("send_icmp_ping(): failed to malloc %d bytes for send buffer",
-            icmp_pkt_size);
+            icmp_pkt_size * ICMP_BATCH);
       return -1; /* might be reached if we're in debug mode */
     }
   }
-
-  memset(buf, 0, icmp_pkt_size);
-
-  if ((gettimeofday(&tv, &tz)) == -1) {
-    free(buf);
-    return -1;
+  /* a batch goes out on one socket */
+  if (send_queued == ICMP_BATCH || (send_queued && send_family != family)) {
+    flush_icmp_pings();
   }
+  send_family = family;
 
-  data.ping_id = 10; /* host->icmp.icmp_sent; */
-
-  memcpy(&data.stime, &tv, sizeof(tv));
+  buf = send_bufs + (size_t)send_queued * icmp_pkt_size;
+  memset(buf, 0, icmp_pkt_size);
 
-  if (address_family == AF_INET) {
+  if (family == AF_INET) {
     struct icmp *icp = (struct icmp *)buf;
-    memcpy(&icp->icmp_data, &data, sizeof(data));
     icp->icmp_type = ICMP_ECHO;
     icp->icmp_code = 0;
-    icp->icmp_cksum = 0;
     icp->icmp_id = htons(pid);
-    icp->icmp_seq = htons(host->id++);
-    icp->icmp_cksum = icmp_checksum((unsigned short *)buf, icmp_pkt_size);
-    if (debug > 2) {
-      printf("Sending ICMPv4 echo-request of len %lu, id %u, seq %u, cksum "
-             "0x%X to host %s\n",
-             (unsigned long)sizeof(data), ntohs(icp->icmp_id),
-             ntohs(icp->icmp_seq), icp->icmp_cksum, host->name);
-    }
-  } else if (address_family == AF_INET6) {
+    icp->icmp_seq = htons(host->id++ & 0xffff);
+  } else if (family == AF_INET6) {
     struct icmp6_hdr *icp6 = (struct icmp6_hdr *)buf;
-    memcpy(&icp6->icmp6_dataun.icmp6_un_data8[4], &data, sizeof(data));
     icp6->icmp6_type = ICMP6_ECHO_REQUEST;
     icp6->icmp6_code = 0;
-    icp6->icmp6_cksum = 0;
     icp6->icmp6_id = htons(pid);
-    icp6->icmp6_seq = htons(host->id++);
-    /* checksum is calculated automatically */
-    if (debug > 2) {
-      printf("Sending ICMPv6 echo-request of len %lu, id %u, seq %u, cksum "
-             "0x%X to host %s\n",
-             (unsigned long)sizeof(data), ntohs(icp6->icmp6_id),
-             ntohs(icp6->icmp6_seq), icp6->icmp6_cksum, host->name);
-    }
+    icp6->icmp6_seq = htons(host->id++ & 0xffff);
   }
 
-  memset(&iov, 0, sizeof(iov));
-  iov.iov_base = buf;
-  iov.iov_len = icmp_pkt_size;
-  memset(&hdr, 0, sizeof(hdr));
-  hdr.msg_name = (struct sockaddr *)&host->saddr_in;
-  hdr.msg_namelen = sizeof(struct sockaddr_storage);
-  hdr.msg_iov = &iov;
-  hdr.msg_iovlen = 1;
-
-  errno = 0;
-
-/* MSG_CONFIRM is a linux thing and only available on linux kernels >= 2.3.15,
- * see send(2) */
-#ifdef MSG_CONFIRM
-  len = sendmsg(sock, &hdr, MSG_CONFIRM);
-#else
-  len = sendmsg(sock, &hdr, 0);
-#endif
+  send_queue[send_queued++] = host;
+  return 0;
+}
 
-  free(buf);
+/* account for the queued packet i, which was sent if len is its size */
+static void icmp_ping_sent(unsigned int i, long int len) {
+  struct rta_host *host = send_queue[i];
 
   if (len < 0 || (unsigned int)len != icmp_pkt_size) {
     if (debug) {
-      char address[address_length(address_family)];
-      parse_address_string(address_family,
-                           (struct sockaddr_storage *)&host->saddr_in, address,
+      char address[address_length(host->saddr_in.ss_family)];
+      parse_address_string(host->saddr_in.ss_family, &host->saddr_in, address,
                            sizeof(address));
       printf("Failed to send ping to %s = %s\n", address, strerror(errno));
     }
     errno = 0;
-    return -1;
+    return;
   }
 
   icmp_sent++;
   host->icmp_sent++;
-
-  return 0;
 }
 
-static int recvfrom_wto(int sock, void *buf, unsigned int len,
-                        struct sockaddr *saddr, u_int *timo,
-                        struct timeval *tv) {
-  u_int slen;
-  int n, ret;
-  struct timeval to, then, now;
-  fd_set rd, wr;
-  char ans_data[4096];
+/* send the queued echo requests */
+static void flush_icmp_pings(void) {
+  int sock = send_family == AF_INET6 ? icmp6_sock : icmp_sock;
+  struct icmp_ping_data data;
+  unsigned char *buf;
+  unsigned int i;
+#ifdef HAVE_SENDMMSG
+  struct mmsghdr msgs[ICMP_BATCH];
+  struct iovec iov[ICMP_BATCH];
+  unsigned int done;
+  int n;
+#else
   struct msghdr hdr;
   struct iovec iov;
-#ifdef SO_TIMESTAMP
-  struct cmsghdr *chdr;
+  long int len;
 #endif
+  int flags = 0;
 
-  if (!*timo) {
-    if (debug)
-      printf("*timo is not\n");
-    return 0;
+  if (!send_queued) {
+    return;
   }
 
-  to.tv_sec = *timo / 1000000;
-  to.tv_usec = (*timo - (to.tv_sec * 1000000));
+/* MSG_CONFIRM is a linux thing and only available on linux kernels >= 2.3.15,
+ * see send(2) */
+#ifdef MSG_CONFIRM
+  flags = MSG_CONFIRM;
+#endif
 
-  FD_ZERO(&rd);
-  FD_ZERO(&wr);
-  FD_SET(sock, &rd);
-  errno = 0;
-  gettimeofday(&then, &tz);
-  n = select(sock + 1, &rd, &wr, NULL, &to);
-  if (n < 0) {
-    crash("select() in recvfrom_wto");
-  }
-  gettimeofday(&now, &tz);
-  *timo = get_timevaldiff(&then, &now);
+  data.stime = clock_ns(CLOCK_REALTIME);
+  data.smono = clock_ns(CLOCK_MONOTONIC);
+  data.ping_id = 10; /* host->icmp.icmp_sent; */
 
-  if (!n) {
-    /* timeout */
-    return 0;
+  for (i = 0; i < send_queued; i++) {
+    buf = send_bufs + (size_t)i * icmp_pkt_size;
+    if (send_family == AF_INET) {
+      struct icmp *icp = (struct icmp *)buf;
+      memcpy(&icp->icmp_data, &data, sizeof(data));
+      icp->icmp_cksum = 0;
+      icp->icmp_cksum = np_icmp_checksum(buf, icmp_pkt_size);
+      if (debug > 2) {
+        printf("Sending ICMPv4 echo-request of len %lu, id %u, seq %u, cksum "
+               "0x%X to host %s\n",
+               (unsigned long)sizeof(data), ntohs(icp->icmp_id),
+               ntohs(icp->icmp_seq), icp->icmp_cksum, send_queue[i]->name);
+      }
+    } else if (send_family == AF_INET6) {
+      struct icmp6_hdr *icp6 = (struct icmp6_hdr *)buf;
+      memcpy(&icp6->icmp6_dataun.icmp6_un_data8[4], &data, sizeof(data));
+      /* checksum is calculated automatically */
+      if (debug > 2) {
+        printf("Sending ICMPv6 echo-request of len %lu, id %u, seq %u, cksum "
+               "0x%X to host %s\n",
+               (unsigned long)sizeof(data), ntohs(icp6->icmp6_id),
+               ntohs(icp6->icmp6_seq), icp6->icmp6_cksum, send_queue[i]->name);
+      }
+    }
   }
 
-  slen = sizeof(struct sockaddr_storage);
-
-  memset(&iov, 0, sizeof(iov));
-  iov.iov_base = buf;
-  iov.iov_len = len;
+#ifdef HAVE_SENDMMSG
+  memset(msgs, 0, sizeof(msgs[0]) * send_queued);
+  for (i = 0; i < send_queued; i++) {
+    iov[i].iov_base = send_bufs + (size_t)i * icmp_pkt_size;
+    iov[i].iov_len = icmp_pkt_size;
+    msgs[i].msg_hdr.msg_name = (struct sockaddr *)&send_queue[i]->saddr_in;
+    msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  for (done = 0; done < send_queued;) {
+    errno = 0;
+    n = sendmmsg(sock, msgs + done, send_queued - done, flags);
+    if (n <= 0) {
+      /* the first one failed; count it and go on with the rest */
+      icmp_ping_sent(done++, -1);
+      continue;
+    }
+    for (i = 0; i < (unsigned int)n; i++, done++) {
+      icmp_ping_sent(done, msgs[done].msg_len);
+    }
+  }
+#else
+  for (i = 0; i < send_queued; i++) {
+    memset(&iov, 0, sizeof(iov));
+    iov.iov_base = send_bufs + (size_t)i * icmp_pkt_size;
+    iov.iov_len = icmp_pkt_size;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_name = (struct sockaddr *)&send_queue[i]->saddr_in;
+    hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    errno = 0;
+    len = sendmsg(sock, &hdr, flags);
+    icmp_ping_sent(i, len);
+  }
+#endif
+
+  send_queued = 0;
+}
+
+/* the timestamps the kernel put on a received packet, if it did */
+static void recv_timestamp(struct msghdr *hdr, rx_time *rx) {
+#ifdef HAVE_MSGHDR_MSG_CONTROL
+  struct cmsghdr *chdr;
+  struct timespec ts[3];
+  struct timeval tv;
+
+  for (chdr = CMSG_FIRSTHDR(hdr); chdr; chdr = CMSG_NXTHDR(hdr, chdr)) {
+    if (chdr->cmsg_level != SOL_SOCKET) {
+      continue;
+    }
+#ifdef SCM_TIMESTAMPING
+    /* software, (deprecated) transformed hardware, raw hardware */
+    if (chdr->cmsg_type == SCM_TIMESTAMPING &&
+        chdr->cmsg_len >= CMSG_LEN(sizeof(ts))) {
+      memcpy(ts, CMSG_DATA(chdr), sizeof(ts));
+      rx->sw = (int64_t)ts[0].tv_sec * 1000000000 + ts[0].tv_nsec;
+      rx->hw = (int64_t)ts[2].tv_sec * 1000000000 + ts[2].tv_nsec;
+    }
+#endif
+#ifdef SCM_TIMESTAMPNS
+    if (chdr->cmsg_type == SCM_TIMESTAMPNS &&
+        chdr->cmsg_len >= CMSG_LEN(sizeof(ts[0]))) {
+      memcpy(ts, CMSG_DATA(chdr), sizeof(ts[0]));
+      rx->sw = (int64_t)ts[0].tv_sec * 1000000000 + ts[0].tv_nsec;
+    }
+#endif
+#ifdef SO_TIMESTAMP
+    if (chdr->cmsg_type == SO_TIMESTAMP &&
+        chdr->cmsg_len >= CMSG_LEN(sizeof(tv))) {
+      memcpy(&tv, CMSG_DATA(chdr), sizeof(tv));
+      rx->sw = (int64_t)tv.tv_sec * 1000000000 + (int64_t)tv.tv_usec * 1000;
+    }
+#endif
+  }
+#endif /* HAVE_MSGHDR_MSG_CONTROL */
+}
+
+/* Receive one packet, waiting at most *timo usecs for it. Where there
+ * is recvmmsg(), everything that is waiting is read into the ring at
+ * once and handed out from there on the following calls. */
+static int recvfrom_wto(void *buf, unsigned int len, struct sockaddr *saddr,
+                        u_int *timo, rx_time *rx) {
+  static int turn;
+  int sock;
+  u_int slen;
+  int n, ret;
+  struct timeval to, then, now;
+  fd_set rd, wr;
+#ifdef HAVE_RECVMMSG
+  unsigned int i;
+#else
+  char ans_data[4096];
+  struct msghdr hdr;
+  struct iovec iov;
+#endif
+
+#ifdef HAVE_RECVMMSG
+  if (recv_next < recv_count) {
+    *timo = 0;
+    return recv_ring_take(buf, len, saddr, rx);
+  }
+#endif
+
+  if (!*timo) {
+    if (debug)
+      printf("*timo is not\n");
+    return 0;
+  }
+
+  to.tv_sec = *timo / 1000000;
+  to.tv_usec = (*timo - (to.tv_sec * 1000000));
+
+  FD_ZERO(&rd);
+  FD_ZERO(&wr);
+  if (icmp_sock != -1) {
+    FD_SET(icmp_sock, &rd);
+  }
+  if (icmp6_sock != -1) {
+    FD_SET(icmp6_sock, &rd);
+  }
+  errno = 0;
+  gettimeofday(&then, &tz);
+  n = select((icmp_sock > icmp6_sock ? icmp_sock : icmp6_sock) + 1, &rd, &wr,
+             NULL, &to);
+  if (n < 0) {
+    crash("select() in recvfrom_wto");
+  }
+  gettimeofday(&now, &tz);
+  *timo = get_timevaldiff(&then, &now);
+
+  if (!n) {
+    /* timeout */
+    return 0;
+  }
+
+  /* take turns if both sockets have something */
+  if (icmp6_sock == -1 || !FD_ISSET(icmp6_sock, &rd)) {
+    sock = icmp_sock;
+  } else if (icmp_sock == -1 || !FD_ISSET(icmp_sock, &rd)) {
+    sock = icmp6_sock;
+  } else {
+    sock = (turn = !turn) ? icmp6_sock : icmp_sock;
+  }
+
+  slen = sizeof(struct sockaddr_storage);
+
+#ifdef HAVE_RECVMMSG
+  if (!recv_bufs) {
+    if (!(recv_bufs = malloc((size_t)RECV_BUF_SIZE * ICMP_BATCH))) {
+      crash("recvfrom_wto(): failed to malloc %d bytes for receive buffers",
+            RECV_BUF_SIZE * ICMP_BATCH);
+    }
+  }
+  memset(recv_msgs, 0, sizeof(recv_msgs));
+  for (i = 0; i < ICMP_BATCH; i++) {
+    recv_iov[i].iov_base = recv_bufs + (size_t)i * RECV_BUF_SIZE;
+    recv_iov[i].iov_len = RECV_BUF_SIZE;
+    recv_msgs[i].msg_hdr.msg_name = &recv_addr[i];
+    recv_msgs[i].msg_hdr.msg_namelen = slen;
+    recv_msgs[i].msg_hdr.msg_iov = &recv_iov[i];
+    recv_msgs[i].msg_hdr.msg_iovlen = 1;
+#ifdef HAVE_MSGHDR_MSG_CONTROL
+    recv_msgs[i].msg_hdr.msg_control = recv_control[i];
+    recv_msgs[i].msg_hdr.msg_controllen = sizeof(recv_control[i]);
+#endif
+  }
+
+  ret = recvmmsg(sock, recv_msgs, ICMP_BATCH, MSG_DONTWAIT, NULL);
+  if (ret <= 0) {
+    /* nothing after all is no error; anything else is */
+    return (ret < 0 && errno == EAGAIN) ? 0 : ret;
+  }
+  recv_mono = clock_ns(CLOCK_MONOTONIC);
+  recv_count = ret;
+  recv_next = 0;
+  return recv_ring_take(buf, len, saddr, rx);
+#else
+  memset(&iov, 0, sizeof(iov));
+  iov.iov_base = buf;
+  iov.iov_len = len;
 
   memset(&hdr, 0, sizeof(hdr));
   hdr.msg_name = saddr;
@@ -1308,42 +1705,475 @@ static int recvfrom_wto(int sock, void *buf, unsigned int len,
 #endif
 
   ret = recvmsg(sock, &hdr, 0);
-#ifdef SO_TIMESTAMP
-  for (chdr = CMSG_FIRSTHDR(&hdr); chdr; chdr = CMSG_NXTHDR(&hdr, chdr)) {
-    if (chdr->cmsg_level == SOL_SOCKET && chdr->cmsg_type == SO_TIMESTAMP &&
-        chdr->cmsg_len >= CMSG_LEN(sizeof(struct timeval))) {
-      memcpy(tv, CMSG_DATA(chdr), sizeof(*tv));
+  memset(rx, 0, sizeof(*rx));
+  rx->mono = clock_ns(CLOCK_MONOTONIC);
+  recv_timestamp(&hdr, rx);
+  return (ret);
+#endif
+}
+
+#ifdef HAVE_RECVMMSG
+/* hand out the next packet in the receive ring */
+static int recv_ring_take(void *buf, unsigned int len, struct sockaddr *saddr,
+                          rx_time *rx) {
+  struct mmsghdr *msg = &recv_msgs[recv_next];
+  unsigned int n = msg->msg_len < len ? msg->msg_len : len;
+
+  memcpy(buf, recv_iov[recv_next].iov_base, n);
+  memcpy(saddr, &recv_addr[recv_next], sizeof(recv_addr[recv_next]));
+  memset(rx, 0, sizeof(*rx));
+  rx->mono = recv_mono;
+  recv_timestamp(&msg->msg_hdr, rx);
+  recv_next++;
+  return n;
+}
+#endif
+
+static void perf_printf(np_perfdata *perf, const char *fmt, ...) {
+  char buf[MAX_INPUT_BUFFER];
+  va_list ap;
+  int len;
+
+  va_start(ap, fmt);
+  len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len > 0) {
+    np_perfdata_append(perf, buf,
+                       (size_t)len < sizeof(buf) ? (size_t)len : sizeof(buf) - 1);
+  }
+}
+
+static void add_host_perfdata(np_perfdata *perf, const struct rta_host *host,
+                              const char *name) {
+  if (rta_mode) {
+    perf_printf(perf, "%srta=%0.3fms;%0.3f;%0.3f;0; ", name,
+                (float)host->rta / 1000, (float)warn.rta / 1000,
+                (float)crit.rta / 1000);
+  }
+  if (pl_mode) {
+    perf_printf(perf, "%spl=%u%%;%u;%u;0;100 ", name, host->pl, warn.pl,
+                crit.pl);
+  }
+  if (rta_mode) {
+    perf_printf(perf, "%srtmax=%0.3fms;;;; %srtmin=%0.3fms;;;; ", name,
+                (float)host->rtmax / 1000, name, (float)host->rtmin / 1000);
+  }
+  if (jitter_mode) {
+    perf_printf(perf,
+                "%sjitter_avg=%0.3fms;%0.3f;%0.3f;0; %sjitter_max=%0.3fms;;;; "
+                "%sjitter_min=%0.3fms;;;; ",
+                name, (float)host->jitter, (float)warn.jitter,
+                (float)crit.jitter, name, (float)host->jitter_max / 1000, name,
+                (float)host->jitter_min / 1000);
+  }
+  if (mos_mode) {
+    perf_printf(perf, "%smos=%0.1f;%0.1f;%0.1f;0;5 ", name, (float)host->mos,
+                (float)warn.mos, (float)crit.mos);
+  }
+  if (score_mode) {
+    perf_printf(perf, "%sscore=%u;%u;%u;0;100 ", name, (int)host->score,
+                (int)warn.score, (int)crit.score);
+  }
+  if (percentile_mode) {
+    char w[32] = "", c[32] = "";
+
+    if (warn.pct) {
+      snprintf(w, sizeof(w), "%0.3f", (float)warn.pct / 1000);
+    }
+    if (crit.pct) {
+      snprintf(c, sizeof(c), "%0.3f", (float)crit.pct / 1000);
+    }
+    perf_printf(perf, "%sp%g=%0.3fms;%s;%s;0; ", name, percentile,
+                host->pct / 1000, w, c);
+  }
+}
+
+/* Work out the values of a host from its counters, which can be done
+ * once only, and return its state. status is raised to the worst state
+ * seen, where a warning no longer counts once it is critical. */
+static int evaluate_host(struct rta_host *host, int *status) {
+  int this_status = STATE_OK;
+  unsigned char pl;
+  double rta;
+  double R;
+
+  if (!host->icmp_recv) {
+    /* rta 0 is ofcourse not entirely correct, but will still show up
+     * conspicuosly as missing entries in perfparse and cacti */
+    pl = 100;
+    rta = 0;
+    host->rtmin = 0;
+    host->jitter_min = 0;
+    *status = STATE_CRITICAL;
+    /* up the down counter if not already counted */
+    if (!(host->flags & FLAG_LOST_CAUSE) && targets_alive) {
+      targets_down++;
+    }
+  } else {
+    pl = ((host->icmp_sent - host->icmp_recv) * 100) / host->icmp_sent;
+    rta = (double)host->time_waited / host->icmp_recv;
+  }
+  if (host->icmp_recv > 1) {
+    host->jitter = (host->jitter / (host->icmp_recv - 1) / 1000);
+    host->EffectiveLatency = (rta / 1000) + host->jitter * 2 + 10;
+    if (host->EffectiveLatency < 160) {
+      R = 93.2 - (host->EffectiveLatency / 40);
+    } else {
+      R = 93.2 - ((host->EffectiveLatency - 120) / 10);
+    }
+    R = R - (pl * 2.5);
+    if (R < 0) {
+      R = 0;
+    }
+    host->score = R;
+    host->mos = 1 + ((0.035) * R) + ((.000007) * R * (R - 60) * (100 - R));
+  } else {
+    host->jitter = 0;
+    host->jitter_min = 0;
+    host->jitter_max = 0;
+    host->mos = 0;
+  }
+  host->pl = pl;
+  host->rta = rta;
+
+  /* Check which mode is on and do the warn / Crit stuff */
+  if (rta_mode) {
+    if (rta >= crit.rta) {
+      this_status = STATE_CRITICAL;
+      *status = STATE_CRITICAL;
+      host->rta_status = STATE_CRITICAL;
+    } else if (*status != STATE_CRITICAL && (rta >= warn.rta)) {
+      this_status = (this_status <= STATE_WARNING ? STATE_WARNING : this_status);
+      *status = STATE_WARNING;
+      host->rta_status = STATE_WARNING;
+    }
+  }
+  if (pl_mode) {
+    if (pl >= crit.pl) {
+      this_status = STATE_CRITICAL;
+      *status = STATE_CRITICAL;
+      host->pl_status = STATE_CRITICAL;
+    } else if (*status != STATE_CRITICAL && (pl >= warn.pl)) {
+      this_status = (this_status <= STATE_WARNING ? STATE_WARNING : this_status);
+      *status = STATE_WARNING;
+      host->pl_status = STATE_WARNING;
+    }
+  }
+  if (jitter_mode) {
+    if (host->jitter >= crit.jitter) {
+      this_status = STATE_CRITICAL;
+      *status = STATE_CRITICAL;
+      host->jitter_status = STATE_CRITICAL;
+    } else if (*status != STATE_CRITICAL && (host->jitter >= warn.jitter)) {
+      this_status = (this_status <= STATE_WARNING ? STATE_WARNING : this_status);
+      *status = STATE_WARNING;
+      host->jitter_status = STATE_WARNING;
+    }
+  }
+  if (mos_mode) {
+    if (host->mos <= crit.mos) {
+      this_status = STATE_CRITICAL;
+      *status = STATE_CRITICAL;
+      host->mos_status = STATE_CRITICAL;
+    } else if (*status != STATE_CRITICAL && (host->mos <= warn.mos)) {
+      this_status = (this_status <= STATE_WARNING ? STATE_WARNING : this_status);
+      *status = STATE_WARNING;
+      host->mos_status = STATE_WARNING;
+    }
+  }
+  if (score_mode) {
+    if (host->score <= crit.score) {
+      this_status = STATE_CRITICAL;
+      *status = STATE_CRITICAL;
+      host->score_status = STATE_CRITICAL;
+    } else if (*status != STATE_CRITICAL && (host->score <= warn.score)) {
+      this_status = (this_status <= STATE_WARNING ? STATE_WARNING : this_status);
+      *status = STATE_WARNING;
+      host->score_status = STATE_WARNING;
+    }
+  }
+  if (percentile_mode) {
+    host->pct = hist_percentile(host, percentile);
+    if (crit.pct && host->pct >= crit.pct) {
+      this_status = STATE_CRITICAL;
+      *status = STATE_CRITICAL;
+      host->pct_status = STATE_CRITICAL;
+    } else if (*status != STATE_CRITICAL && warn.pct && host->pct >= warn.pct) {
+      this_status = (this_status <= STATE_WARNING ? STATE_WARNING : this_status);
+      *status = STATE_WARNING;
+      host->pct_status = STATE_WARNING;
+    }
+  }
+
+  return this_status;
+}
+
+/* which family a host was checked over, if the run has both */
+static const char *family_tag(const struct rta_host *host) {
+  if (run_families != (FAMILY_V4 | FAMILY_V6)) {
+    return "";
+  }
+  return host->saddr_in.ss_family == AF_INET6 ? " (IPv6)" : " (IPv4)";
+}
+
+/* the text output for one host, given the state of the whole */
+static void print_host(const struct rta_host *host, int *status) {
+  if (!host->icmp_recv) {
+    *status = STATE_CRITICAL;
+    if (host->flags & FLAG_LOST_CAUSE) {
+      char address[address_length(host->error_addr.ss_family)];
+      parse_address_string(host->error_addr.ss_family,
+                           (struct sockaddr_storage *)&host->error_addr,
+                           address, sizeof(address));
+      printf("%s%s: %s @ %s. rta nan, lost %d%%", host->name, family_tag(host),
+             np_icmp_error_text(host->icmp_type, host->icmp_code), address,
+             100);
+    } else {
+      /* not marked as lost cause, so we have no flags for it */
+      printf("%s%s: rta nan, lost 100%%", host->name, family_tag(host));
+    }
+    return;
+  }
+
+  printf("%s%s", host->name, family_tag(host));
+  /* rta text output */
+  if (rta_mode) {
+    if (*status == STATE_OK) {
+      printf(" rta %0.3fms", host->rta / 1000);
+    } else if (*status == STATE_WARNING && host->rta_status == *status) {
+      printf(" rta %0.3fms >= %0.3fms", (float)host->rta / 1000,
+             (float)warn.rta / 1000);
+    } else if (*status == STATE_CRITICAL && host->rta_status == *status) {
+      printf(" rta %0.3fms >= %0.3fms", (float)host->rta / 1000,
+             (float)crit.rta / 1000);
+    }
+  }
+  /* pl text output */
+  if (pl_mode) {
+    if (*status == STATE_OK) {
+      printf(" lost %u%%", host->pl);
+    } else if (*status == STATE_WARNING && host->pl_status == *status) {
+      printf(" lost %u%% >= %u%%", host->pl, warn.pl);
+    } else if (*status == STATE_CRITICAL && host->pl_status == *status) {
+      printf(" lost %u%% >= %u%%", host->pl, crit.pl);
+    }
+  }
+  /* jitter text output */
+  if (jitter_mode) {
+    if (*status == STATE_OK) {
+      printf(" jitter %0.3fms", (float)host->jitter);
+    } else if (*status == STATE_WARNING && host->jitter_status == *status) {
+      printf(" jitter %0.3fms >= %0.3fms", (float)host->jitter, warn.jitter);
+    } else if (*status == STATE_CRITICAL && host->jitter_status == *status) {
+      printf(" jitter %0.3fms >= %0.3fms", (float)host->jitter, crit.jitter);
+    }
+  }
+  /* mos text output */
+  if (mos_mode) {
+    if (*status == STATE_OK) {
+      printf(" MOS %0.1f", (float)host->mos);
+    } else if (*status == STATE_WARNING && host->mos_status == *status) {
+      printf(" MOS %0.1f <= %0.1f", (float)host->mos, (float)warn.mos);
+    } else if (*status == STATE_CRITICAL && host->mos_status == *status) {
+      printf(" MOS %0.1f <= %0.1f", (float)host->mos, (float)crit.mos);
+    }
+  }
+  /* score text output */
+  if (score_mode) {
+    if (*status == STATE_OK) {
+      printf(" Score %u", (int)host->score);
+    } else if (*status == STATE_WARNING && host->score_status == *status) {
+      printf(" Score %u <= %u", (int)host->score, (int)warn.score);
+    } else if (*status == STATE_CRITICAL && host->score_status == *status) {
+      printf(" Score %u <= %u", (int)host->score, (int)crit.score);
+    }
+  }
+  /* percentile text output */
+  if (percentile_mode) {
+    if (*status == STATE_OK) {
+      printf(" p%g %0.3fms", percentile, host->pct / 1000);
+    } else if (*status == STATE_WARNING && host->pct_status == *status) {
+      printf(" p%g %0.3fms >= %0.3fms", percentile, host->pct / 1000,
+             (float)warn.pct / 1000);
+    } else if (*status == STATE_CRITICAL && host->pct_status == *status) {
+      printf(" p%g %0.3fms >= %0.3fms", percentile, host->pct / 1000,
+             (float)crit.pct / 1000);
+    }
+  }
+  /* order statis text output */
+  if (order_mode) {
+    if (*status == STATE_OK) {
+      printf(" Packets in order");
+    } else if (*status == STATE_CRITICAL && host->order_status == *status) {
+      printf(" Packets out of order");
+    }
+  }
+}
+
+static void json_string(const char *str) {
+  putchar('"');
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\') {
+      printf("\\%c", *str);
+    } else if ((unsigned char)*str < 0x20) {
+      printf("\\u%04x", (unsigned char)*str);
+    } else {
+      putchar(*str);
+    }
+  }
+  putchar('"');
+}
+
+/* write the result of one host on a line of its own */
+static void stream_host(struct rta_host *host) {
+  const char *status_string[] = {"OK", "WARNING", "CRITICAL", "UNKNOWN"};
+  char address[address_length(host->saddr_in.ss_family)];
+  int host_status = STATE_OK;
+  np_perfdata perf;
+
+  evaluate_host(host, &host_status);
+  streamed[host_status]++;
+  parse_address_string(host->saddr_in.ss_family, &host->saddr_in, address,
+                       sizeof(address));
+
+  if (stream_mode == STREAM_JSON) {
+    printf("{\"host\":");
+    json_string(host->name);
+    printf(",\"address\":\"%s\",\"family\":\"%s\",\"state\":\"%s\","
+           "\"sent\":%u,\"received\":%u,\"pl\":%u",
+           address, host->saddr_in.ss_family == AF_INET6 ? "ipv6" : "ipv4",
+           status_string[host_status], host->icmp_sent,
+           host->icmp_recv, host->pl);
+    if (host->icmp_recv) {
+      printf(",\"rta\":%0.3f,\"rtmin\":%0.3f,\"rtmax\":%0.3f,"
+             "\"jitter\":%0.3f,\"mos\":%0.1f,\"score\":%u",
+             host->rta / 1000, host->rtmin / 1000, host->rtmax / 1000,
+             host->jitter, host->mos, (int)host->score);
+      if (percentile_mode) {
+        printf(",\"p%g\":%0.3f", percentile, host->pct / 1000);
+      }
+    }
+    if (host->flags & FLAG_LOST_CAUSE) {
+      printf(",\"error\":");
+      json_string(np_icmp_error_text(host->icmp_type, host->icmp_code));
+    }
+    printf("}\n");
+  } else {
+    /* a host result as an external command, UP unless it is critical */
+    np_perfdata_init(&perf);
+    add_host_perfdata(&perf, host, "");
+    printf("[%lu] PROCESS_HOST_CHECK_RESULT;%s;%d;%s - ",
+           (unsigned long)time(NULL), host->name,
+           host_status == STATE_CRITICAL ? 1 : 0, status_string[host_status]);
+    print_host(host, &host_status);
+    printf("|%s\n", np_perfdata_string(&perf));
+  }
+  fflush(stdout);
+}
+
+/* unhook a host that has been written and free it */
+static void release_host(struct rta_host *host) {
+  struct rta_host **h;
+
+  for (h = &host_hash[host_bucket(&host->saddr_in)]; *h; h = &(*h)->hash_next) {
+    if (*h == host) {
+      *h = host->hash_next;
       break;
     }
   }
-#endif /* SO_TIMESTAMP */
+  if (host->sched_pos >= 0) {
+    sched_remove(host);
+  }
+  table[host->index] = NULL;
+  free(host->name);
+  free(host);
+}
+
+/* When streaming, write out a host as soon as it is decided, that is when
+ * no packet to it is on the way and none is left to send. */
+static void host_done(struct rta_host *host) {
+  if (stream_mode == STREAM_NONE ||
+      host->icmp_recv + host->icmp_lost < host->icmp_sent ||
+      (host->sched_pos >= 0 && !(host->flags & FLAG_LOST_CAUSE))) {
+    return;
+  }
+  if (shard_fd >= 0) {
+    shard_send(host);
+  } else {
+    stream_host(host);
+  }
+  release_host(host);
+}
+
+/* the hosts not decided yet, and the totals */
+static void finish_stream(void) {
+  const char *status_string[] = {"OK", "WARNING", "CRITICAL", "UNKNOWN"};
+  u_int i, total;
 
-  if (!chdr) {
-    gettimeofday(tv, &tz);
+  for (i = 0; table && i < targets; i++) {
+    if (table[i]) {
+      stream_host(table[i]);
+    }
   }
-  return (ret);
+
+  if (streamed[STATE_CRITICAL] || !targets_alive) {
+    status = STATE_CRITICAL;
+  } else if (streamed[STATE_WARNING]) {
+    status = STATE_WARNING;
+  } else {
+    status = STATE_OK;
+  }
+  if (min_hosts_alive > -1) {
+    if (streamed[STATE_OK] >= (u_int)min_hosts_alive) {
+      status = STATE_OK;
+    } else if (streamed[STATE_OK] + streamed[STATE_WARNING] >=
+               (u_int)min_hosts_alive) {
+      status = STATE_WARNING;
+    }
+  }
+
+  total = streamed[STATE_OK] + streamed[STATE_WARNING] +
+          streamed[STATE_CRITICAL];
+  printf("%s - %u hosts: %u ok, %u warning, %u critical|"
+         "hosts_ok=%u;;;0;%u hosts_warning=%u;;;0;%u "
+         "hosts_critical=%u;;;0;%u\n",
+         status_string[status], total, streamed[STATE_OK],
+         streamed[STATE_WARNING], streamed[STATE_CRITICAL], streamed[STATE_OK],
+         total, streamed[STATE_WARNING], total, streamed[STATE_CRITICAL],
+         total);
+  exit(status);
 }
 
 static void finish(int sig) {
-  u_int i = 0;
-  unsigned char pl;
-  double rta;
+  u_int i = 0, s;
   struct rta_host *host;
   const char *status_string[] = {"OK", "WARNING", "CRITICAL", "UNKNOWN",
                                  "DEPENDENT"};
   int hosts_ok = 0;
   int hosts_warn = 0;
   int this_status;
-  double R;
+  np_perfdata perf;
 
   alarm(0);
   if (debug > 1) {
     printf("finish(%d) called\n", sig);
   }
+  if (shard_fd >= 0) {
+    shard_finish();
+  }
+  /* the shards still running have nobody to tell */
+  for (s = 0; s < shards; s++) {
+    if (shard_pid[s] > 0) {
+      kill(shard_pid[s], SIGKILL);
+    }
+  }
 
   if (icmp_sock != -1) {
     close(icmp_sock);
   }
+  if (icmp6_sock != -1) {
+    close(icmp6_sock);
+  }
   if (udp_sock != -1) {
     close(udp_sock);
   }
@@ -1357,112 +2187,18 @@ static void finish(int sig) {
     printf("targets: %u  targets_alive: %u\n", targets, targets_alive);
   }
 
-  /* iterate thrice to calculate values, give output, and print perfparse */
+  if (stream_mode != STREAM_NONE) {
+    finish_stream();
+  }
+
+  /* calculate the values and collect the perfdata in one pass over the
+   * hosts, then give the output in a second one, once the overall state
+   * is known */
+  np_perfdata_init(&perf);
   status = STATE_OK;
   host = list;
   while (host) {
-    this_status = STATE_OK;
-    if (!host->icmp_recv) {
-      /* rta 0 is ofcourse not entirely correct, but will still show up
-       * conspicuosly as missing entries in perfparse and cacti */
-      pl = 100;
-      rta = 0;
-      status = STATE_CRITICAL;
-      /* up the down counter if not already counted */
-      if (!(host->flags & FLAG_LOST_CAUSE) && targets_alive) {
-        targets_down++;
-      }
-    } else {
-      pl = ((host->icmp_sent - host->icmp_recv) * 100) / host->icmp_sent;
-      rta = (double)host->time_waited / host->icmp_recv;
-    }
-    if (host->icmp_recv > 1) {
-      host->jitter = (host->jitter / (host->icmp_recv - 1) / 1000);
-      host->EffectiveLatency = (rta / 1000) + host->jitter * 2 + 10;
-      if (host->EffectiveLatency < 160) {
-        R = 93.2 - (host->EffectiveLatency / 40);
-      } else {
-        R = 93.2 - ((host->EffectiveLatency - 120) / 10);
-      }
-      R = R - (pl * 2.5);
-      if (R < 0) {
-        R = 0;
-      }
-      host->score = R;
-      host->mos = 1 + ((0.035) * R) + ((.000007) * R * (R - 60) * (100 - R));
-    } else {
-      host->jitter = 0;
-      host->jitter_min = 0;
-      host->jitter_max = 0;
-      host->mos = 0;
-    }
-    host->pl = pl;
-    host->rta = rta;
-
-    /* if no new mode selected, use old schema */
-    if (!rta_mode && !pl_mode && !jitter_mode && !score_mode && !mos_mode &&
-        !order_mode) {
-      rta_mode = 1;
-      pl_mode = 1;
-    }
-
-    /* Check which mode is on and do the warn / Crit stuff */
-    if (rta_mode) {
-      if (rta >= crit.rta) {
-        this_status = STATE_CRITICAL;
-        status = STATE_CRITICAL;
-        host->rta_status = STATE_CRITICAL;
-      } else if (status != STATE_CRITICAL && (rta >= warn.rta)) {
-        this_status = (this_status <= STATE_WARNING ? STATE_WARNING : this_status);
-        status = STATE_WARNING;
-        host->rta_status = STATE_WARNING;
-      }
-    }
-    if (pl_mode) {
-      if (pl >= crit.pl) {
-        this_status = STATE_CRITICAL;
-        status = STATE_CRITICAL;
-        host->pl_status = STATE_CRITICAL;
-      } else if (status != STATE_CRITICAL && (pl >= warn.pl)) {
-        this_status = (this_status <= STATE_WARNING ? STATE_WARNING : this_status);
-        status = STATE_WARNING;
-        host->pl_status = STATE_WARNING;
-      }
-    }
-    if (jitter_mode) {
-      if (host->jitter >= crit.jitter) {
-        this_status = STATE_CRITICAL;
-        status = STATE_CRITICAL;
-        host->jitter_status = STATE_CRITICAL;
-      } else if (status != STATE_CRITICAL && (host->jitter >= warn.jitter)) {
-        this_status = (this_status <= STATE_WARNING ? STATE_WARNING : this_status);
-        status = STATE_WARNING;
-        host->jitter_status = STATE_WARNING;
-      }
-    }
-    if (mos_mode) {
-      if (host->mos <= crit.mos) {
-        this_status = STATE_CRITICAL;
-        status = STATE_CRITICAL;
-        host->mos_status = STATE_CRITICAL;
-      } else if (status != STATE_CRITICAL && (host->mos <= warn.mos)) {
-        this_status = (this_status <= STATE_WARNING ? STATE_WARNING : this_status);
-        status = STATE_WARNING;
-        host->mos_status = STATE_WARNING;
-      }
-    }
-    if (score_mode) {
-      if (host->score <= crit.score) {
-        this_status = STATE_CRITICAL;
-        status = STATE_CRITICAL;
-        host->score_status = STATE_CRITICAL;
-      } else if (status != STATE_CRITICAL && (host->score <= warn.score)) {
-        this_status = (this_status <= STATE_WARNING ? STATE_WARNING : this_status);
-        status = STATE_WARNING;
-        host->score_status = STATE_WARNING;
-      }
-    }
-
+    this_status = evaluate_host(host, &status);
     if (this_status == STATE_WARNING) {
       hosts_warn++;
     }
@@ -1470,6 +2206,7 @@ static void finish(int sig) {
       hosts_ok++;
     }
 
+    add_host_perfdata(&perf, host, (targets > 1) ? host->name : "");
     host = host->next;
   }
 
@@ -1500,131 +2237,16 @@ static void finish(int sig) {
       }
     }
     i++;
-    if (!host->icmp_recv) {
-      status = STATE_CRITICAL;
-      host->rtmin = 0;
-      host->jitter_min = 0;
-      if (host->flags & FLAG_LOST_CAUSE) {
-        char address[address_length(address_family)];
-        parse_address_string(address_family, &host->error_addr, address,
-                             sizeof(address));
-        printf("%s: %s @ %s. rta nan, lost %d%%", host->name,
-               get_icmp_error_msg(host->icmp_type, host->icmp_code), address,
-               100);
-      } else {
-        /* not marked as lost cause, so we have no flags for it */
-        printf("%s: rta nan, lost 100%%", host->name);
-      }
-    } else {
-      /* !icmp_recv */
-      printf("%s", host->name);
-      /* rta text output */
-      if (rta_mode) {
-        if (status == STATE_OK) {
-          printf(" rta %0.3fms", host->rta / 1000);
-        } else if (status == STATE_WARNING && host->rta_status == status) {
-          printf(" rta %0.3fms >= %0.3fms", (float)host->rta / 1000,
-                 (float)warn.rta / 1000);
-        } else if (status == STATE_CRITICAL && host->rta_status == status) {
-          printf(" rta %0.3fms >= %0.3fms", (float)host->rta / 1000,
-                 (float)crit.rta / 1000);
-        }
-      }
-      /* pl text output */
-      if (pl_mode) {
-        if (status == STATE_OK) {
-          printf(" lost %u%%", host->pl);
-        } else if (status == STATE_WARNING && host->pl_status == status) {
-          printf(" lost %u%% >= %u%%", host->pl, warn.pl);
-        } else if (status == STATE_CRITICAL && host->pl_status == status) {
-          printf(" lost %u%% >= %u%%", host->pl, crit.pl);
-        }
-      }
-      /* jitter text output */
-      if (jitter_mode) {
-        if (status == STATE_OK) {
-          printf(" jitter %0.3fms", (float)host->jitter);
-        } else if (status == STATE_WARNING && host->jitter_status == status) {
-          printf(" jitter %0.3fms >= %0.3fms", (float)host->jitter, warn.jitter);
-        } else if (status == STATE_CRITICAL && host->jitter_status == status) {
-          printf(" jitter %0.3fms >= %0.3fms", (float)host->jitter, crit.jitter);
-        }
-      }
-      /* mos text output */
-      if (mos_mode) {
-        if (status == STATE_OK) {
-          printf(" MOS %0.1f", (float)host->mos);
-        } else if (status == STATE_WARNING && host->mos_status == status) {
-          printf(" MOS %0.1f <= %0.1f", (float)host->mos, (float)warn.mos);
-        } else if (status == STATE_CRITICAL && host->mos_status == status) {
-          printf(" MOS %0.1f <= %0.1f", (float)host->mos, (float)crit.mos);
-        }
-      }
-      /* score text output */
-      if (score_mode) {
-        if (status == STATE_OK) {
-          printf(" Score %u", (int)host->score);
-        } else if (status == STATE_WARNING && host->score_status == status) {
-          printf(" Score %u <= %u", (int)host->score, (int)warn.score);
-        } else if (status == STATE_CRITICAL && host->score_status == status) {
-          printf(" Score %u <= %u", (int)host->score, (int)crit.score);
-        }
-      }
-      /* order statis text output */
-      if (order_mode) {
-        if (status == STATE_OK) {
-          printf(" Packets in order");
-        } else if (status == STATE_CRITICAL && host->order_status == status) {
-          printf(" Packets out of order");
-        }
-      }
-    }
+    print_host(host, &status);
     host = host->next;
   }
 
-  /* iterate once more for pretty perfparse output */
+  /* perfdata was collected along with the values */
   if (!(!rta_mode && !pl_mode && !jitter_mode && !score_mode && !mos_mode &&
-        order_mode)) {
+        !percentile_mode && order_mode)) {
     printf("|");
   }
-  i = 0;
-  host = list;
-  while (host) {
-    if (debug) {
-      puts("");
-    }
-    if (rta_mode) {
-      printf("%srta=%0.3fms;%0.3f;%0.3f;0; ",
-             (targets > 1) ? host->name : "", (float)host->rta / 1000,
-             (float)warn.rta / 1000, (float)crit.rta / 1000);
-    }
-    if (pl_mode) {
-      printf("%spl=%u%%;%u;%u;0;100 ", (targets > 1) ? host->name : "",
-             host->pl, warn.pl, crit.pl);
-    }
-    if (rta_mode) {
-      printf("%srtmax=%0.3fms;;;; %srtmin=%0.3fms;;;; ",
-             (targets > 1) ? host->name : "", (float)host->rtmax / 1000,
-             (targets > 1) ? host->name : "", (float)host->rtmin / 1000);
-    }
-    if (jitter_mode) {
-      printf("%sjitter_avg=%0.3fms;%0.3f;%0.3f;0; %sjitter_max=%0.3fms;;;; "
-             "%sjitter_min=%0.3fms;;;; ",
-             (targets > 1) ? host->name : "", (float)host->jitter,
-             (float)warn.jitter, (float)crit.jitter,
-             (targets > 1) ? host->name : "", (float)host->jitter_max / 1000,
-             (targets > 1) ? host->name : "", (float)host->jitter_min / 1000);
-    }
-    if (mos_mode) {
-      printf("%smos=%0.1f;%0.1f;%0.1f;0;5 ", (targets > 1) ? host->name : "",
-             (float)host->mos, (float)warn.mos, (float)crit.mos);
-    }
-    if (score_mode) {
-      printf("%sscore=%u;%u;%u;0;100 ", (targets > 1) ? host->name : "",
-             (int)host->score, (int)warn.score, (int)crit.score);
-    }
-    host = host->next;
-  }
+  fputs(np_perfdata_string(&perf), stdout);
 
   if (min_hosts_alive > -1) {
     if (hosts_ok >= min_hosts_alive) {
@@ -1645,6 +2267,247 @@ static void finish(int sig) {
   exit(status);
 }
 
+/* a record to the parent, in one write where it fits in PIPE_BUF */
+static void shard_write(const shard_record *rec) {
+  const char *p = (const char *)rec;
+  size_t left = sizeof(*rec);
+  ssize_t n;
+
+  while (left) {
+    if ((n = write(shard_fd, p, left)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      _exit(STATE_UNKNOWN);
+    }
+    p += n;
+    left -= n;
+  }
+}
+
+static void shard_send(const struct rta_host *host) {
+  shard_record rec;
+
+  memset(&rec, 0, sizeof(rec));
+  rec.index = host->index * shards + shard;
+  rec.u.host = *host;
+  shard_write(&rec);
+}
+
+/* the hosts not sent yet, and the counters, for the parent's finish() */
+static void shard_finish(void) {
+  shard_record rec;
+  u_int i;
+
+  for (i = 0; i < targets; i++) {
+    if (table[i]) {
+      shard_send(table[i]);
+    }
+  }
+  memset(&rec, 0, sizeof(rec));
+  rec.index = SHARD_TOTALS;
+  rec.u.totals.down = targets_down;
+  rec.u.totals.sent = icmp_sent;
+  rec.u.totals.recv = icmp_recv;
+  rec.u.totals.lost = icmp_lost;
+  shard_write(&rec);
+  close(shard_fd);
+  _exit(STATE_OK);
+}
+
+/* Shard s checks every shards'th target from the s'th on, with its own
+ * sockets and ICMP id. Its first packet goes when it would have without
+ * shards, and the shards take turns at the target interval after that. */
+static void shard_child(unsigned int s, int fd) {
+  struct rta_host *host, **tail;
+  struct itimerval expiry;
+  u_int i, k, all = targets;
+
+  shard = s;
+  shard_fd = fd;
+  for (i = 0; i < shards; i++) {
+    if (i == s) {
+      continue;
+    }
+    if (shard_sock[i][0] != -1) {
+      close(shard_sock[i][0]);
+    }
+    if (shard_sock[i][1] != -1) {
+      close(shard_sock[i][1]);
+    }
+  }
+  icmp_sock = shard_sock[s][0];
+  icmp6_sock = shard_sock[s][1];
+  memset(shard_pid, 0, sizeof(shard_pid));
+
+  pid = getpid() & 0xffff;
+  if (icmp_sock != -1) {
+    attach_filter(icmp_sock, AF_INET);
+  }
+  if (icmp6_sock != -1) {
+    attach_filter(icmp6_sock, AF_INET6);
+  }
+
+  list = NULL;
+  tail = &list;
+  for (i = s, k = 0; i < all; i += shards, k++) {
+    host = table[i];
+    host->index = k;
+    host->id = k * packets;
+    table[k] = host;
+    *tail = host;
+    tail = &host->next;
+  }
+  *tail = NULL;
+  targets = k;
+
+  free(host_hash);
+  for (host_hash_size = 64; host_hash_size < targets; host_hash_size *= 2) {
+  }
+  if (!(host_hash = calloc(host_hash_size, sizeof(*host_hash)))) {
+    crash("shard_child(): failed to malloc %lu bytes for the host index",
+          (unsigned long)(host_hash_size * sizeof(*host_hash)));
+  }
+  for (host = list; host; host = host->next) {
+    k = host_bucket(&host->saddr_in);
+    host->hash_next = host_hash[k];
+    host_hash[k] = host;
+  }
+
+  shard_delay = (int64_t)s * target_interval;
+  target_interval *= shards;
+  max_completion_time =
+      ((targets * packets * pkt_interval) + (targets * target_interval)) +
+      shard_delay + (targets * packets * crit.rta) + crit.rta;
+
+  /* done a little before the parent, to have the hosts there in time */
+  memset(&expiry, 0, sizeof(expiry));
+  expiry.it_value.tv_sec = timeout > 1 ? timeout - 1 : 0;
+  expiry.it_value.tv_usec = timeout > 1 ? 900000 : 800000;
+  setitimer(ITIMER_REAL, &expiry, NULL);
+
+  if (debug) {
+    printf("shard %u: %u targets, ICMP id %u\n", s, targets, pid);
+  }
+  run_checks();
+  errno = 0;
+  finish(0);
+}
+
+/* a host from a shard in place of the one it was forked with */
+static void shard_merge(const shard_record *rec) {
+  struct rta_host *host, *next, *hash_next;
+  char *name;
+  u_int index;
+
+  if (rec->index == SHARD_TOTALS) {
+    targets_down += rec->u.totals.down;
+    icmp_sent += rec->u.totals.sent;
+    icmp_recv += rec->u.totals.recv;
+    icmp_lost += rec->u.totals.lost;
+    return;
+  }
+  if (rec->index >= targets || !(host = table[rec->index])) {
+    return;
+  }
+  name = host->name;
+  next = host->next;
+  hash_next = host->hash_next;
+  index = host->index;
+  *host = rec->u.host;
+  host->name = name;
+  host->next = next;
+  host->hash_next = hash_next;
+  host->index = index;
+  host->msg = NULL;
+  host->sched_pos = -1;
+  if (stream_mode != STREAM_NONE) {
+    stream_host(host);
+    release_host(host);
+  }
+}
+
+/* fork the shards and take in the hosts they write until all are done */
+static void run_shards(void) {
+  static shard_record recs[MAX_SHARDS];
+  int fds[2], pipes[MAX_SHARDS], maxfd = -1, running = 0;
+  size_t got[MAX_SHARDS];
+  fd_set rd;
+  ssize_t n;
+  u_int s, k;
+
+  fflush(stdout);
+  for (s = 0; s < shards; s++) {
+    if (pipe(fds) == -1) {
+      crash("run_shards(): pipe() failed");
+    }
+    if ((shard_pid[s] = fork()) == -1) {
+      crash("run_shards(): fork() failed");
+    }
+    if (shard_pid[s] == 0) {
+      close(fds[0]);
+      for (k = 0; k < s; k++) {
+        close(pipes[k]);
+      }
+      shard_child(s, fds[1]);
+    }
+    close(fds[1]);
+    pipes[s] = fds[0];
+    got[s] = 0;
+    if (fds[0] > maxfd) {
+      maxfd = fds[0];
+    }
+    running++;
+  }
+  for (s = 0; s < shards; s++) {
+    if (shard_sock[s][0] != -1) {
+      close(shard_sock[s][0]);
+    }
+    if (shard_sock[s][1] != -1) {
+      close(shard_sock[s][1]);
+    }
+  }
+  icmp_sock = icmp6_sock = -1;
+
+  while (running) {
+    FD_ZERO(&rd);
+    for (s = 0; s < shards; s++) {
+      if (pipes[s] != -1) {
+        FD_SET(pipes[s], &rd);
+      }
+    }
+    if (select(maxfd + 1, &rd, NULL, NULL, NULL) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      crash("run_shards(): select() failed");
+    }
+    for (s = 0; s < shards; s++) {
+      if (pipes[s] == -1 || !FD_ISSET(pipes[s], &rd)) {
+        continue;
+      }
+      n = read(pipes[s], (char *)&recs[s] + got[s], sizeof(recs[s]) - got[s]);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        if (debug && n < 0) {
+          printf("shard %u: %s\n", s, strerror(errno));
+        }
+        close(pipes[s]);
+        pipes[s] = -1;
+        running--;
+        continue;
+      }
+      got[s] += n;
+      if (got[s] == sizeof(recs[s])) {
+        shard_merge(&recs[s]);
+        got[s] = 0;
+      }
+    }
+  }
+}
+
 static u_int get_timevaldiff(struct timeval *early, struct timeval *later) {
   u_int ret;
   struct timeval now;
@@ -1668,47 +2531,178 @@ static u_int get_timevaldiff(struct timeval *early, struct timeval *later) {
   return ret;
 }
 
+/* nanoseconds on clock, which falls back to the wall clock */
+static int64_t clock_ns(int clock) {
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+
+  if (!clock_gettime(clock, &ts)) {
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+#endif
+  {
+    struct timeval tv;
+
+    gettimeofday(&tv, &tz);
+    return (int64_t)tv.tv_sec * 1000000000 + (int64_t)tv.tv_usec * 1000;
+  }
+}
+
+/* The rtt of a reply in usecs. Kernel timestamps are on the wall clock,
+ * so one is only taken if it lies between sending and reading the reply
+ * on the monotonic clock; otherwise (the wall clock was stepped, or a
+ * hardware clock is not synced to it) the monotonic time is used. */
+static u_int reply_rtt(const icmp_ping_data *data, const rx_time *rx) {
+  int64_t bound = rx->mono - data->smono, rtt;
+
+  if (bound < 0) {
+    return 0;
+  }
+  if (rx->hw && (rtt = rx->hw - data->stime) >= 0 && rtt <= bound) {
+    /* hardware */
+  } else if (rx->sw && (rtt = rx->sw - data->stime) >= 0 && rtt <= bound) {
+    /* kernel */
+  } else {
+    rtt = bound;
+  }
+  return (u_int)((rtt + 500) / 1000);
+}
+
+/* the address bytes of addr, which are what host_hash is keyed on */
+static const unsigned char *host_key(const struct sockaddr_storage *addr,
+                                     size_t *len) {
+  if (addr->ss_family == AF_INET6) {
+    *len = sizeof(struct in6_addr);
+    return (const unsigned char *)&((const struct sockaddr_in6 *)addr)
+        ->sin6_addr;
+  }
+  *len = sizeof(struct in_addr);
+  return (const unsigned char *)&((const struct sockaddr_in *)addr)->sin_addr;
+}
+
+static unsigned int host_bucket(const struct sockaddr_storage *addr) {
+  const unsigned char *key;
+  unsigned int h = 2166136261u; /* FNV-1a */
+  size_t len, i;
+
+  key = host_key(addr, &len);
+  for (i = 0; i < len; i++) {
+    h = (h ^ key[i]) * 16777619u;
+  }
+  return h & (host_hash_size - 1);
+}
+
+static struct rta_host *find_host(const struct sockaddr_storage *addr) {
+  const unsigned char *key, *host_addr;
+  struct rta_host *host;
+  size_t len, host_len;
+
+  if (!host_hash_size) {
+    return NULL;
+  }
+  key = host_key(addr, &len);
+  for (host = host_hash[host_bucket(addr)]; host; host = host->hash_next) {
+    host_addr = host_key(&host->saddr_in, &host_len);
+    if (host->saddr_in.ss_family == addr->ss_family && host_len == len &&
+        !memcmp(host_addr, key, len)) {
+      return host;
+    }
+  }
+  return NULL;
+}
+
+/* add host to host_hash, doubling it whenever it gets as many hosts as
+ * it has buckets */
+static void hash_host(struct rta_host *host) {
+  struct rta_host *h;
+  unsigned int b;
+
+  if (targets > host_hash_size) {
+    free(host_hash);
+    host_hash_size = host_hash_size ? host_hash_size * 2 : 64;
+    host_hash = calloc(host_hash_size, sizeof(*host_hash));
+    if (!host_hash) {
+      crash("hash_host(): failed to malloc %lu bytes for the host index",
+            (unsigned long)(host_hash_size * sizeof(*host_hash)));
+    }
+    for (h = list; h; h = h->next) {
+      b = host_bucket(&h->saddr_in);
+      h->hash_next = host_hash[b];
+      host_hash[b] = h;
+    }
+    return;
+  }
+  b = host_bucket(&host->saddr_in);
+  host->hash_next = host_hash[b];
+  host_hash[b] = host;
+}
+
+/* The host an echo reply (or an error about an echo request) with this
+ * icmp seq belongs to, NULL if it is no answer to a packet we sent. The
+ * address finds the host and the seq has to be one sent to it. */
+static struct rta_host *reply_host(const struct sockaddr_storage *addr,
+                                   unsigned short seq) {
+  struct rta_host *host = find_host(addr);
+  unsigned int first;
+
+  /* an answer from another address can only be placed by its seq, and
+   * only as long as the seqs of all packets fit in 16 bits */
+  if (!host) {
+    if ((unsigned long)targets * packets > 0x10000 ||
+        seq >= targets * packets) {
+      return NULL;
+    }
+    if (!(host = table[seq / packets])) {
+      return NULL;
+    }
+  }
+  first = host->index * packets;
+  if ((unsigned short)(seq - first) >= host->id - first) {
+    return NULL;
+  }
+  return host;
+}
+
 static int add_target_ip(char *arg, struct sockaddr_storage *in) {
   struct rta_host *host;
   struct sockaddr_in *sin, *host_sin;
   struct sockaddr_in6 *sin6, *host_sin6;
+  struct sockaddr_storage key;
 
-  if (address_family == AF_INET) {
+  if (in->ss_family == AF_INET) {
     sin = (struct sockaddr_in *)in;
   } else {
     sin6 = (struct sockaddr_in6 *)in;
   }
 
   /* disregard some addresses */
-  if (((address_family == AF_INET && (sin->sin_addr.s_addr == INADDR_NONE ||
+  if (((in->ss_family == AF_INET && (sin->sin_addr.s_addr == INADDR_NONE ||
                                       sin->sin_addr.s_addr == INADDR_ANY))) ||
-      (address_family == AF_INET6 &&
+      (in->ss_family == AF_INET6 &&
        sin6->sin6_addr.s6_addr == in6addr_any.s6_addr)) {
     return -1;
   }
 
   /* no point in adding two identical IP's, so don't. ;) */
-  host = list;
-  while (host) {
-    host_sin = (struct sockaddr_in *)&host->saddr_in;
-    host_sin6 = (struct sockaddr_in6 *)&host->saddr_in;
-    if ((address_family == AF_INET &&
-         host_sin->sin_addr.s_addr == sin->sin_addr.s_addr) ||
-        (address_family == AF_INET6 &&
-         host_sin6->sin6_addr.s6_addr == sin6->sin6_addr.s6_addr)) {
-      if (debug) {
-        printf("Identical IP already exists. Not adding %s\n", arg);
-      }
-      return -1;
+  memset(&key, 0, sizeof(key));
+  key.ss_family = in->ss_family;
+  if (in->ss_family == AF_INET) {
+    ((struct sockaddr_in *)&key)->sin_addr = sin->sin_addr;
+  } else {
+    ((struct sockaddr_in6 *)&key)->sin6_addr = sin6->sin6_addr;
+  }
+  if (find_host(&key)) {
+    if (debug) {
+      printf("Identical IP already exists. Not adding %s\n", arg);
     }
-    host = host->next;
+    return -1;
   }
 
   /* add the fresh ip */
   host = (struct rta_host *)malloc(sizeof(struct rta_host));
   if (!host) {
-    char address[address_length(address_family)];
-    parse_address_string(address_family, (struct sockaddr_storage *)&in,
+    char address[address_length(in->ss_family)];
+    parse_address_string(in->ss_family, in,
                          address, sizeof(address));
     crash("add_target_ip(%s, %s): malloc(%d) failed", arg, address,
           sizeof(struct rta_host));
@@ -1720,11 +2714,11 @@ static int add_target_ip(char *arg, struct sockaddr_storage *in) {
   host->name = strdup(arg);
 
   /* fill out the sockaddr_storage struct */
-  if (address_family == AF_INET) {
+  if (in->ss_family == AF_INET) {
     host_sin = (struct sockaddr_in *)&host->saddr_in;
     host_sin->sin_family = AF_INET;
     host_sin->sin_addr.s_addr = sin->sin_addr.s_addr;
-  } else if (address_family == AF_INET6) {
+  } else if (in->ss_family == AF_INET6) {
     host_sin6 = (struct sockaddr_in6 *)&host->saddr_in;
     host_sin6->sin6_family = AF_INET6;
     memcpy(host_sin6->sin6_addr.s6_addr, sin6->sin6_addr.s6_addr,
@@ -1754,78 +2748,431 @@ static int add_target_ip(char *arg, struct sockaddr_storage *in) {
 
   cursor = host;
   targets++;
+  run_families |= FAMILY_BIT(in->ss_family);
+  hash_host(host);
 
   return 0;
 }
 
 /* wrapper for add_target_ip */
-static int add_target(char *arg) {
-  int error, result;
-  struct sockaddr_storage ip;
-  struct addrinfo hints, *res, *p;
-  struct sockaddr_in *sin;
-  struct sockaddr_in6 *sin6;
+static void add_target(char *arg, int from_file) {
+  target_spec *spec;
+  struct in6_addr addr;
+
+  if (specs_len == specs_size) {
+    specs_size = specs_size ? specs_size * 2 : 64;
+    if (!(specs = realloc(specs, specs_size * sizeof(*specs)))) {
+      crash("add_target(): failed to malloc %lu bytes for the targets",
+            (unsigned long)(specs_size * sizeof(*specs)));
+    }
+  }
+  spec = &specs[specs_len++];
+  memset(spec, 0, sizeof(*spec));
+  if (!(spec->arg = strdup(arg))) {
+    crash("add_target(): failed to copy %s", arg);
+  }
+  spec->from_file = from_file;
+  /* the family may still change, so a literal of either is no name */
+  spec->lookup = !strchr(arg, '/') && inet_pton(AF_INET, arg, &addr) != 1 &&
+                 inet_pton(AF_INET6, arg, &addr) != 1;
+}
 
-  switch (address_family) {
-  case AF_INET:
-    sin = (struct sockaddr_in *)&ip;
-    result = inet_pton(address_family, arg, &sin->sin_addr);
-    break;
+/* targets from a file, or stdin for -, separated by white space; # starts
+ * a comment */
+static void read_targets(const char *file) {
+  char line[MAX_INPUT_BUFFER], *p, *end;
+  FILE *fp;
 
-  case AF_INET6:
-    sin6 = (struct sockaddr_in6 *)&ip;
-    result = inet_pton(address_family, arg, &sin6->sin6_addr);
-    break;
+  if (!strcmp(file, "-")) {
+    fp = stdin;
+  } else if (!(fp = fopen(file, "r"))) {
+    crash("Cannot open %s", file);
+  }
 
-  default:
-    crash("Address family not supported");
+  while (fgets(line, sizeof(line), fp)) {
+    if ((p = strchr(line, '#'))) {
+      *p = '\0';
+    }
+    for (p = line; *(p += strspn(p, " \t\r\n"));) {
+      end = p + strcspn(p, " \t\r\n");
+      if (*end) {
+        *end++ = '\0';
+      }
+      add_target(p, TRUE);
+      p = end;
+    }
   }
 
-  /* don't resolve if we don't have to */
-  if (result == 1) {
-    /* don't add all ip's if we were given a specific one */
-    return add_target_ip(arg, &ip);
-  } else {
+  if (fp != stdin) {
+    fclose(fp);
+  }
+}
+
+static void resolve_target(target_spec *spec) {
+  struct addrinfo hints;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = address_family == AF_INET
+                       ? PF_INET
+                       : address_family == AF_INET6 ? PF_INET6 : PF_UNSPEC;
+  hints.ai_socktype = SOCK_RAW;
+  spec->error = getaddrinfo(spec->arg, NULL, &hints, &spec->res);
+}
+
+#ifdef HAVE_LIBPTHREAD
+static pthread_mutex_t resolve_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resolve_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int resolve_next, resolve_left;
+static int resolve_abandoned;
+
+static void *resolve_worker(void *arg) {
+  target_spec *spec, copy;
+  unsigned int i;
+
+  (void)arg;
+  pthread_mutex_lock(&resolve_lock);
+  while (!resolve_abandoned && resolve_next < specs_len) {
+    if (!specs[i = resolve_next++].lookup) {
+      continue;
+    }
+    spec = &specs[i];
+    copy = *spec;
+    pthread_mutex_unlock(&resolve_lock);
+    resolve_target(&copy);
+    pthread_mutex_lock(&resolve_lock);
+    /* too late, the targets have been added without this one */
+    if (resolve_abandoned) {
+      if (!copy.error) {
+        freeaddrinfo(copy.res);
+      }
+      break;
+    }
+    spec->error = copy.error;
+    spec->res = copy.res;
+    spec->done = 1;
+    if (!--resolve_left) {
+      pthread_cond_signal(&resolve_cond);
+    }
+  }
+  pthread_mutex_unlock(&resolve_lock);
+  return NULL;
+}
+#endif
+
+/* Look up the names among the targets, RESOLVE_THREADS at a time, until
+ * all are done or the deadline (on the wall clock) has passed. */
+static void resolve_targets(const struct timespec *deadline) {
+  unsigned int i, names = 0;
+#ifdef HAVE_LIBPTHREAD
+  pthread_t thread;
+  pthread_attr_t attr;
+  sigset_t all, old;
+  int started = 0;
+#endif
+
+  for (i = 0; i < specs_len; i++) {
+    names += specs[i].lookup;
+  }
+  if (!names) {
+    return;
+  }
+
+#ifdef HAVE_LIBPTHREAD
+  if (names > 1) {
+    resolve_left = names;
+    /* signals are for the main thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (i = 0; i < RESOLVE_THREADS && i < names; i++) {
+      started += !pthread_create(&thread, &attr, resolve_worker, NULL);
+    }
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (started) {
+      pthread_mutex_lock(&resolve_lock);
+      while (resolve_left &&
+             pthread_cond_timedwait(&resolve_cond, &resolve_lock, deadline) !=
+                 ETIMEDOUT)
+        ;
+      /* whatever is still being looked up is given up on */
+      resolve_abandoned = 1;
+      pthread_mutex_unlock(&resolve_lock);
+      return;
+    }
+  }
+#endif
+
+  (void)deadline;
+  for (i = 0; i < specs_len; i++) {
+    if (specs[i].lookup) {
+      resolve_target(&specs[i]);
+      specs[i].done = 1;
+    }
+  }
+}
+
+/* every address of a range, but the network and broadcast ones of IPv4 */
+static void add_target_range(char *arg) {
+  char text[INET6_ADDRSTRLEN], *slash = strchr(arg, '/');
+  struct sockaddr_storage ip;
+  struct sockaddr_in *sin = (struct sockaddr_in *)&ip;
+  struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ip;
+  unsigned int bits, prefix, n, count, first, last;
+  uint32_t base;
+  char *end;
+  int family;
+
+  *slash = '\0';
+  family = strchr(arg, ':') ? AF_INET6 : AF_INET;
+  bits = family == AF_INET ? 32 : 128;
+  prefix = strtoul(slash + 1, &end, 10);
+  memset(&ip, 0, sizeof(ip));
+  ip.ss_family = family;
+  if (*end || end == slash + 1 || prefix > bits ||
+      !(ip_families & FAMILY_BIT(family)) ||
+      inet_pton(family, arg,
+                family == AF_INET ? (void *)&sin->sin_addr
+                                          : (void *)&sin6->sin6_addr) != 1) {
     errno = 0;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = address_family == AF_INET ? PF_INET : PF_INET6;
-    hints.ai_socktype = SOCK_RAW;
-    if ((error = getaddrinfo(arg, NULL, &hints, &res)) != 0) {
-      errno = 0;
-      crash("Failed to resolve %s: %s", arg, gai_strerror(error));
-      return -1;
+    crash("Invalid address range %s/%s", arg, slash + 1);
+  }
+  if (bits - prefix > MAX_RANGE_BITS) {
+    errno = 0;
+    crash("Address range %s/%u is too large (at most /%u)", arg, prefix,
+          bits - MAX_RANGE_BITS);
+  }
+
+  count = 1u << (bits - prefix);
+  first = 0;
+  last = count - 1;
+  if (family == AF_INET && count > 2) {
+    first++;
+    last--;
+  }
+
+  if (family == AF_INET) {
+    base = ntohl(sin->sin_addr.s_addr) & ~(count - 1);
+  } else {
+    /* the range is within the last MAX_RANGE_BITS bits */
+    base = (sin6->sin6_addr.s6_addr[14] << 8 | sin6->sin6_addr.s6_addr[15]) &
+           ~(count - 1);
+  }
+  for (n = first; n <= last; n++) {
+    if (family == AF_INET) {
+      sin->sin_addr.s_addr = htonl(base + n);
+      inet_ntop(AF_INET, &sin->sin_addr, text, sizeof(text));
+    } else {
+      sin6->sin6_addr.s6_addr[14] = ((base + n) >> 8) & 0xff;
+      sin6->sin6_addr.s6_addr[15] = (base + n) & 0xff;
+      inet_ntop(AF_INET6, &sin6->sin6_addr, text, sizeof(text));
     }
+    add_target_ip(text, &ip);
   }
+}
 
-  /* possibly add all the IP's as targets */
-  for (p = res; p != NULL; p = p->ai_next) {
-    memcpy(&ip, p->ai_addr, p->ai_addrlen);
-    add_target_ip(arg, &ip);
+/* add the targets given, in the order they were given */
+static void load_targets(void) {
+  struct sockaddr_storage ip;
+  struct sockaddr_in *sin = (struct sockaddr_in *)&ip;
+  struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ip;
+  struct addrinfo *p;
+  struct timespec deadline;
+  target_spec *spec;
+  int64_t start, spent;
+  unsigned int i;
+
+  /* the lookups get the time the check has, less a second for the pings */
+  start = clock_ns(CLOCK_MONOTONIC);
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout > 1 ? timeout - 1 : 1;
+  resolve_targets(&deadline);
+  spent = (clock_ns(CLOCK_MONOTONIC) - start) / 1000000;
+  if (spent > 999) {
+    if (debug) {
+      printf("Looking up targets took %ld ms\n", (long)spent);
+    }
+    timeout -= (spent + 999) / 1000;
+    if (timeout < 1) {
+      timeout = 1;
+    }
+  }
 
-    /* this is silly, but it works */
-    if (mode == MODE_HOSTCHECK || mode == MODE_ALL) {
-      if (debug > 2) {
-        printf("mode: %d\n", mode);
-      }
+  for (i = 0; i < specs_len; i++) {
+    spec = &specs[i];
+    if (strchr(spec->arg, '/')) {
+      add_target_range(spec->arg);
       continue;
     }
-    break;
+
+    if (!spec->lookup) {
+      memset(&ip, 0, sizeof(ip));
+      ip.ss_family = strchr(spec->arg, ':') ? AF_INET6 : AF_INET;
+      if ((ip_families & FAMILY_BIT(ip.ss_family)) &&
+          inet_pton(ip.ss_family, spec->arg,
+                    ip.ss_family == AF_INET ? (void *)&sin->sin_addr
+                                            : (void *)&sin6->sin6_addr) == 1) {
+        /* don't add all ip's if we were given a specific one */
+        add_target_ip(spec->arg, &ip);
+        continue;
+      }
+      /* an address of a family not used, which the lookup will refuse */
+      resolve_target(spec);
+      spec->done = 1;
+    }
+
+    if (!spec->done || spec->error) {
+      if (spec->from_file) {
+        if (debug) {
+          printf("Failed to resolve %s: %s, skipped\n", spec->arg,
+                 spec->done ? gai_strerror(spec->error) : "timed out");
+        }
+        continue;
+      }
+      errno = 0;
+      crash("Failed to resolve %s: %s", spec->arg,
+            spec->done ? gai_strerror(spec->error) : "timed out");
+    }
+
+    /* possibly add all the IP's as targets */
+    for (p = spec->res; p != NULL; p = p->ai_next) {
+      memcpy(&ip, p->ai_addr, p->ai_addrlen);
+      add_target_ip(spec->arg, &ip);
+
+      /* this is silly, but it works */
+      if (mode == MODE_HOSTCHECK || mode == MODE_ALL) {
+        if (debug > 2) {
+          printf("mode: %d\n", mode);
+        }
+        continue;
+      }
+      break;
+    }
+    freeaddrinfo(spec->res);
   }
-  freeaddrinfo(res);
+}
 
-  return 0;
+/* Have the kernel drop what is not for us: every raw ICMP socket sees every
+ * ICMP packet on the host, including the replies of all other check_icmp
+ * instances. Keeps echo replies with our id, and for IPv4 the errors that
+ * handle_random_icmp() looks at, if they quote an echo request with our id.
+ * Without the filter wait_for_reply() sorts them out as before. */
+static void attach_filter(int sock, int family) {
+#if defined(SO_ATTACH_FILTER) && HAVE_LINUX_FILTER_H
+  struct sock_filter ip4[] = {
+      BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),         /* x = ip header */
+      BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),          /* a = icmp type */
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, 0, 2),
+      BPF_STMT(BPF_LD | BPF_H | BPF_IND, 4),          /* a = icmp id */
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, pid, 13, 14),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_UNREACH, 3, 0),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_SOURCEQUENCH, 2, 0),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_TIMXCEED, 1, 0),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_PARAMPROB, 0, 10),
+      BPF_STMT(BPF_LD | BPF_B | BPF_IND, ICMP_MINLEN), /* quoted ip header */
+      BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xf),
+      BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 2),
+      BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+      BPF_STMT(BPF_MISC | BPF_TAX, 0),                /* x = quoted icmp */
+      BPF_STMT(BPF_LD | BPF_B | BPF_IND, ICMP_MINLEN),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHO, 0, 3),
+      BPF_STMT(BPF_LD | BPF_H | BPF_IND, ICMP_MINLEN + 4),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, pid, 0, 1),
+      BPF_STMT(BPF_RET | BPF_K, 0xffff),
+      BPF_STMT(BPF_RET | BPF_K, 0),
+  };
+  /* raw ICMPv6 sockets get no ip header */
+  struct sock_filter ip6[] = {
+      BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP6_ECHO_REPLY, 0, 3),
+      BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 4),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, pid, 0, 1),
+      BPF_STMT(BPF_RET | BPF_K, 0xffff),
+      BPF_STMT(BPF_RET | BPF_K, 0),
+  };
+  struct sock_fprog prog;
+
+  if (family == AF_INET) {
+    prog.len = sizeof(ip4) / sizeof(*ip4);
+    prog.filter = ip4;
+  } else {
+    prog.len = sizeof(ip6) / sizeof(*ip6);
+    prog.filter = ip6;
+  }
+  if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog))) {
+    if (debug) {
+      printf("Warning: no socket filter: %s\n", strerror(errno));
+    }
+  } else if (debug) {
+    printf("Socket filter for ICMP id %u attached\n", pid);
+  }
+#else
+  (void)sock;
+  (void)family;
+#endif
+}
+
+/* receive timestamps and the filter, once the socket is no longer needed
+ * to be opened as root */
+static void setup_icmp_socket(int sock, int family) {
+#if defined(SO_TIMESTAMPNS) || defined(SO_TIMESTAMP)
+  int on = 1;
+#endif
+#if defined(SO_TIMESTAMPING) && HAVE_LINUX_NET_TSTAMP_H
+  int timestamps;
+#endif
+  const char *timestamping = NULL;
+
+  /* Have the kernel stamp replies as they arrive, so that time spent
+   * waiting for us to read them is not part of the rtt. Hardware stamps
+   * also need the interface set up for them (SIOCSHWTSTAMP). */
+#if defined(SO_TIMESTAMPING) && HAVE_LINUX_NET_TSTAMP_H
+  timestamps = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+               SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+  if (!setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &timestamps,
+                  sizeof(timestamps))) {
+    timestamping = "SO_TIMESTAMPING";
+  }
+#endif
+#ifdef SO_TIMESTAMPNS
+  if (!timestamping &&
+      !setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on))) {
+    timestamping = "SO_TIMESTAMPNS";
+  }
+#endif
+#ifdef SO_TIMESTAMP
+  if (!timestamping &&
+      !setsockopt(sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on))) {
+    timestamping = "SO_TIMESTAMP";
+  }
+#endif
+  if (debug) {
+    if (timestamping) {
+      printf("Receive timestamps from %s\n", timestamping);
+    } else {
+      printf("Warning: no kernel receive timestamps\n");
+    }
+  }
+
+  attach_filter(sock, family);
 }
 
 static void set_source_ip(char *arg) {
   struct sockaddr_in src;
+  unsigned int i;
 
   memset(&src, 0, sizeof(src));
-  src.sin_family = address_family;
+  src.sin_family = AF_INET;
   if ((src.sin_addr.s_addr = inet_addr(arg)) == INADDR_NONE) {
     src.sin_addr.s_addr = get_ip_address(arg);
   }
-  if (bind(icmp_sock, (struct sockaddr *)&src, sizeof(src)) == -1) {
-    crash("Cannot bind to IP address %s", arg);
+  for (i = 0; i < shards; i++) {
+    if (shard_sock[i][0] != -1 &&
+        bind(shard_sock[i][0], (struct sockaddr *)&src, sizeof(src)) == -1) {
+      crash("Cannot bind to IP address %s", arg);
+    }
   }
 }
 
@@ -1956,6 +3303,79 @@ static int get_threshold(char *str, threshold *th) {
   return 0;
 }
 
+/* A percentile threshold, pN=TIME, for the rtt at the Nth percentile.
+ * Returns 0 if str is none. Warning and critical share the percentile. */
+static int get_percentile(const char *str, threshold *th) {
+  double p;
+  char *end;
+
+  if (str[0] != 'p' || !isdigit((int)str[1])) {
+    return 0;
+  }
+  p = strtod(str + 1, &end);
+  if (*end != '=' || p <= 0 || p > 100) {
+    usage_va("Percentile must be between 0 and 100, as in p95=50ms: %s", str);
+  }
+  if (percentile && p != percentile) {
+    usage_va("Warning and critical must be for the same percentile: %s", str);
+  }
+  if (!(th->pct = get_timevar(end + 1))) {
+    usage_va("Invalid percentile threshold: %s", str);
+  }
+  percentile = p;
+  percentile_mode = 1;
+  return 1;
+}
+
+/* the histogram bucket of an rtt in usecs */
+static unsigned int hist_bucket(u_int v) {
+  unsigned int e = 0, b;
+
+  if (v < HIST_SUB) {
+    return v;
+  }
+  while ((v >> e) >= 2 * HIST_SUB) {
+    e++;
+  }
+  b = (e + 1) * HIST_SUB + (v >> e) - HIST_SUB;
+  return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+/* The rtt at percentile p of the replies from host: the top of the
+ * bucket it falls in, within the rtts that were seen. */
+static double hist_percentile(const struct rta_host *host, double p) {
+  unsigned int rank, seen = 0, b, e;
+  double top;
+
+  if (!host->icmp_recv) {
+    return 0;
+  }
+  /* rounded up, which makes it at least 1 */
+  rank = (unsigned int)(p / 100 * host->icmp_recv);
+  if (rank < p / 100 * host->icmp_recv) {
+    rank++;
+  }
+  for (b = 0; b < HIST_BUCKETS - 1; b++) {
+    if ((seen += host->hist[b]) >= rank) {
+      break;
+    }
+  }
+
+  if (b < HIST_SUB) {
+    top = b;
+  } else {
+    e = b / HIST_SUB - 1;
+    top = ((double)(HIST_SUB + b % HIST_SUB + 1) * (1u << e)) - 1;
+  }
+  if (top > host->rtmax) {
+    top = host->rtmax;
+  }
+  if (top < host->rtmin) {
+    top = host->rtmin;
+  }
+  return top;
+}
+
 /* not too good at checking errors, but it'll do (main() should barfe on -1) */
 static int get_threshold2(char *str, threshold *warn, threshold *crit,
                           int type) {
@@ -2001,27 +3421,6 @@ static int get_threshold2(char *str, threshold *warn, threshold *crit,
   return 0;
 }
 
-unsigned short icmp_checksum(unsigned short *p, int n) {
-  unsigned short cksum;
-  long sum = 0;
-
-  while (n > 2) {
-    sum += *p++;
-    n -= sizeof(unsigned short);
-  }
-
-  /* mop up the occasional odd byte */
-  if (n == 1) {
-    sum += (unsigned char)*p;
-  }
-
-  sum = (sum >> 16) + (sum & 0xffff); /* add hi 16 to low 16 */
-  sum += (sum >> 16);                 /* add carry */
-  cksum = ~sum;                       /* ones-complement, trunc to 16 bits */
-
-  return cksum;
-}
-
 void print_help(void) {
   print_revision(progname, NP_VERSION);
   printf(COPYRIGHT, copyright, email);
@@ -2036,6 +3435,8 @@ void print_help(void) {
   printf(" %s\n", "-c");
   printf("    %s", _("critical threshold (currently "));
   printf("%0.3fms,%u%%)\n", (float)crit.rta / 1000, crit.pl);
+  printf("    %s\n", _("-w and -c also take pN=TIME, a threshold on the Nth percentile of"));
+  printf("    %s\n", _("the rtt, ex. -w p95=50ms -c p95=100ms"));
   printf(" %s\n", "-R");
   printf("    %s\n", _("RTA, round trip average,  mode  warning,critical, ex. "
                        "100ms,200ms unit in ms"));
@@ -2053,12 +3454,19 @@ void print_help(void) {
          _("score  mode, max value 100  warning,critical, ex. 80,70 "));
   printf(" %s\n", "-O");
   printf("    %s\n", _("detect out of order ICMP packts "));
+  printf(" %s\n", "-o json|passive");
+  printf("    %s\n", _("write a line per host as soon as its result is known, as JSON or as"));
+  printf("    %s\n", _("a passive host check result, followed by a summary line"));
   printf(" %s\n", "-4");
   printf("    %s\n", _("target address(es) are IPv4 and packets are ICMPv4"));
   printf(" %s\n", "-6");
   printf("    %s\n", _("target address(es) are IPv6 and packets are ICMPv6"));
+  printf("    %s\n", _("Without either, addresses of both families can be mixed and names"));
+  printf("    %s\n", _("are looked up as IPv4. With both, names are looked up as either."));
   printf(" %s\n", "-H");
-  printf("    %s\n", _("specify a target"));
+  printf("    %s\n", _("specify a target, a host, an address or a range of them, ex. 10.1.0.0/22"));
+  printf(" %s\n", "-f");
+  printf("    %s\n", _("read targets from a file, or stdin for -; names that do not resolve are skipped"));
   printf(" %s\n", "-s");
   printf("    %s\n", _("specify a source IP address or device name"));
   printf(" %s\n", "-n");
@@ -2073,6 +3481,9 @@ void print_help(void) {
   printf(" %s\n", "-I");
   printf("    %s", _("max target interval (currently "));
   printf("%0.3fms)\n", (float)target_interval / 1000);
+  printf(" %s\n", "-j");
+  printf("    %s\n", _("split the targets between this many processes, each with its own sockets"));
+  printf("    %s %d)\n", _("and ICMP id, sharing the rate of -I (currently 1, at most"), MAX_SHARDS);
   printf(" %s\n", "-m");
   printf("    %s", _("number of alive hosts required for success"));
   printf("\n");
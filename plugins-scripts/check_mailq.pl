@@ -29,7 +29,7 @@ use POSIX;
 use strict;
 use Getopt::Long;
 use vars qw($opt_V $opt_h $opt_v $verbose $PROGNAME $opt_w $opt_c $opt_t $opt_s $opt_d
-					$opt_M $mailq $status $state $msg $msg_q $msg_p $opt_W $opt_C $mailq $mailq_args
+					$opt_n $opt_S $opt_M $mailq $status $state $msg $msg_q $msg_p $opt_W $opt_C $mailq $mailq_args
 					@lines %srcdomains %dstdomains);
 use FindBin;
 use lib "$FindBin::Bin";
@@ -41,6 +41,9 @@ my ($sudo);
 sub print_help ();
 sub print_usage ();
 sub process_arguments ();
+sub count_spool ($$);
+sub postfix_domains ($);
+sub exim_domains ($);
 
 $ENV{'PATH'}='@TRUSTED_PATH@';
 $ENV{'BASH_ENV'}=''; 
@@ -85,7 +88,69 @@ alarm($opt_t);
 
 # switch based on MTA
 
-if ($mailq eq "sendmail") {
+if ($opt_n) {
+
+	# Count the queue files themselves: one directory read per entry, and
+	# no message is opened unless domain thresholds are asked for.
+	my (@dirs, $dir);
+	if ($mailq eq "postfix") {
+		$opt_S = '/var/spool/postfix' unless defined $opt_S;
+		@dirs = map { "$opt_S/$_" } qw(maildrop incoming active deferred hold);
+	} else {
+		$opt_S = (-d '/var/spool/exim4' ? '/var/spool/exim4' : '/var/spool/exim') unless defined $opt_S;
+		@dirs = ("$opt_S/input");
+	}
+	foreach $dir (@dirs) {
+		# postfix creates the queues it needs; a missing one is empty
+		next if ($mailq eq "postfix" && ! -e $dir);
+		my $count = count_spool($dir, $mailq eq "exim" ? '-H$' : '');
+		unless (defined $count) {
+			print "ERROR: could not read $dir: $!\n";
+			exit $ERRORS{'UNKNOWN'};
+		}
+		print "$dir = $count\n" if $verbose;
+		$msg_q += $count;
+	}
+
+	alarm(0);
+
+	if ($msg_q == 0) {
+		$msg = "OK: $mailq mailq is empty";
+		$state = $ERRORS{'OK'};
+	} elsif ($msg_q < $opt_w) {
+		$msg = "OK: $mailq mailq ($msg_q) is below threshold ($opt_w/$opt_c)";
+		$state = $ERRORS{'OK'};
+	} elsif ($msg_q < $opt_c) {
+		$msg = "WARNING: $mailq mailq is $msg_q (threshold w = $opt_w)";
+		$state = $ERRORS{'WARNING'};
+	} else {
+		$msg = "CRITICAL: $mailq mailq is $msg_q (threshold c = $opt_c)";
+		$state = $ERRORS{'CRITICAL'};
+	}
+
+	# check for domain specific queue lengths if requested
+	if (defined $opt_W && $msg_q > 0) {
+		my %domains = $mailq eq "postfix" ? postfix_domains($opt_S) : exim_domains($opt_S);
+		my ($maxkey) = sort { $domains{$b} <=> $domains{$a} } keys %domains;
+		if (defined $maxkey) {
+			my $count = $domains{$maxkey};
+			print "dst max is $maxkey with $count messages\n" if $verbose;
+			if ($count >= $opt_C) {
+				$msg = ($state == $ERRORS{'OK'} ? "CRITICAL: " : $msg . " -and- ")
+				       . "$count messages in queue TO $maxkey (threshold C = $opt_C)";
+				$state = $ERRORS{'CRITICAL'};
+			} elsif ($count >= $opt_W) {
+				$msg = ($state == $ERRORS{'OK'} ? "WARNING: " : $msg . " -and- ")
+				       . "$count messages in queue TO $maxkey (threshold W = $opt_W)";
+				$state = $ERRORS{'WARNING'} if $state == $ERRORS{'OK'};
+			} else {
+				$msg .= " $count msgs. TO $maxkey is below threshold ($opt_W/$opt_C)";
+			}
+		}
+	}
+
+} # end of native count
+elsif ($mailq eq "sendmail") {
 
 	## open mailq 
 	if ( defined $utils::PATH_TO_MAILQ && -x $utils::PATH_TO_MAILQ ) {
@@ -645,6 +710,89 @@ exit $state;
 #####################################
 #### subs
 
+# The number of entries in a queue directory and in its one character
+# hash subdirectories, counting only the names matching $pattern.
+sub count_spool ($$) {
+	my ($top, $pattern) = @_;
+	my @todo = ($top);
+	my $count = 0;
+	while (defined (my $dir = shift @todo)) {
+		opendir(my $dh, $dir) or return undef;
+		while (defined (my $entry = readdir $dh)) {
+			next if $entry eq '.' || $entry eq '..';
+			if (length $entry == 1 && -d "$dir/$entry") {
+				push @todo, "$dir/$entry";
+			} elsif ($entry =~ /$pattern/) {
+				$count++;
+			}
+		}
+		closedir $dh;
+	}
+	return $count;
+}
+
+# The files of a queue directory and of its hash subdirectories.
+sub spool_files ($$) {
+	my ($top, $pattern) = @_;
+	my @todo = ($top);
+	my @files;
+	while (defined (my $dir = shift @todo)) {
+		opendir(my $dh, $dir) or next;
+		foreach my $entry (readdir $dh) {
+			next if $entry eq '.' || $entry eq '..';
+			if (length $entry == 1 && -d "$dir/$entry") {
+				push @todo, "$dir/$entry";
+			} elsif ($entry =~ /$pattern/) {
+				push @files, "$dir/$entry";
+			}
+		}
+		closedir $dh;
+	}
+	return @files;
+}
+
+# Deferred messages for each recipient domain, from postfix's defer logs;
+# a message counts once for each domain.
+sub postfix_domains ($) {
+	my ($spool) = @_;
+	my %domains;
+	foreach my $file (spool_files("$spool/defer", '')) {
+		open(my $fh, '<', $file) or next;
+		my %seen;
+		while (<$fh>) {
+			$seen{lc $1} = 1 if /^recipient=.*\@([^\s>]+)/;
+		}
+		close $fh;
+		$domains{$_}++ foreach keys %seen;
+	}
+	return %domains;
+}
+
+# Queued messages for each recipient domain, from the recipient list of
+# each exim header file; a message counts once for each domain.
+sub exim_domains ($) {
+	my ($spool) = @_;
+	my %domains;
+	foreach my $file (spool_files("$spool/input", '-H$')) {
+		open(my $fh, '<', $file) or next;
+		my (%seen, $left);
+		# id, owner, sender and time, then "-" options, the tree of the
+		# addresses already delivered, and the count of recipients
+		<$fh> for 1..4;
+		while (<$fh>) {
+			next if /^-/ || /^(XX|[NY][NY] )/;
+			$left = $1 if /^(\d+)$/;
+			last;
+		}
+		while (defined $left && $left-- > 0 && defined ($_ = <$fh>)) {
+			$seen{lc $1} = 1 if /\@([^\s>]+)/;
+		}
+		close $fh;
+		$domains{$_}++ foreach keys %seen;
+	}
+	return %domains;
+}
+
 
 sub process_arguments(){
 	GetOptions
@@ -656,7 +804,11 @@ sub process_arguments(){
 		 "c=i" => \$opt_c, "critical=i" => \$opt_c,	  # critical if above this number
 		 "t=i" => \$opt_t, "timeout=i"  => \$opt_t,
 		 "s"   => \$opt_s, "sudo"       => \$opt_s,
-		 "d:s" => \$opt_d, "configdir:s" => \$opt_d
+		 "d:s" => \$opt_d, "configdir:s" => \$opt_d,
+		 "W=i" => \$opt_W, "domain-warning=i" => \$opt_W, # warning if above this number for a domain
+		 "C=i" => \$opt_C, "domain-critical=i" => \$opt_C, # critical if above this number for a domain
+		 "n"   => \$opt_n, "native"     => \$opt_n,   # count the spool instead of running mailq
+		 "S=s" => \$opt_S, "spooldir=s" => \$opt_S
 		 );
 
 	if ($opt_V) {
@@ -687,7 +839,7 @@ sub process_arguments(){
 		exit $ERRORS{'UNKNOWN'};
 	}
 
-	if (defined $opt_W && ! defined !$opt_C) {
+	if (defined $opt_W && ! defined $opt_C) {
 		print "Need -C if using -W\n";
 		exit $ERRORS{'UNKNOWN'};
 	}elsif(defined $opt_W && defined $opt_C) {
@@ -736,12 +888,17 @@ sub process_arguments(){
 			$mailq = 'sendmail';
 		}
 	}
+
+	if ($opt_n && $mailq ne 'postfix' && $mailq ne 'exim') {
+		print "-n: only postfix and exim queues can be counted natively\n";
+		exit $ERRORS{'UNKNOWN'};
+	}
 		
 	return $ERRORS{'OK'};
 }
 
 sub print_usage () {
-	print "Usage: $PROGNAME -w <warn> -c <crit> [-W <warn>] [-C <crit>] [-M <MTA>] [-t <timeout>] [-s] [-d <CONFIGDIR>] [-v]\n";
+	print "Usage: $PROGNAME -w <warn> -c <crit> [-W <warn>] [-C <crit>] [-M <MTA>] [-t <timeout>] [-s] [-d <CONFIGDIR>] [-n [-S <SPOOLDIR>]] [-v]\n";
 }
 
 sub print_help () {
@@ -754,10 +911,12 @@ sub print_help () {
 	print "   Feedback/patches to support non-sendmail mailqueue welcome\n\n";
 	print "-w (--warning)   = Min. number of messages in queue to generate warning\n";
 	print "-c (--critical)  = Min. number of messages in queue to generate critical alert ( w < c )\n";
-	print "-W (--Warning)   = Min. number of messages for same domain in queue to generate warning\n";
-	print "-C (--Critical)  = Min. number of messages for same domain in queue to generate critical alert ( W < C )\n";
+	print "-W (--domain-warning) = Min. number of messages for same domain in queue to generate warning\n";
+	print "-C (--domain-critical) = Min. number of messages for same domain in queue to generate critical alert ( W < C )\n";
 	print "-t (--timeout)   = Plugin timeout in seconds (default = $utils::TIMEOUT)\n";
 	print "-M (--mailserver) = [ sendmail | qmail | postfix | exim | nullmailer | opensmtpd ] (default = autodetect)\n";
+	print "-n (--native)    = Count the queue files instead of running mailq (postfix, exim)\n";
+	print "-S (--spooldir)  = Spool of -n (default = /var/spool/postfix, /var/spool/exim4 or /var/spool/exim)\n";
 	print "-h (--help)\n";
 	print "-V (--version)\n";
 	print "-v (--verbose)   = debugging output\n";
@@ -765,6 +924,8 @@ sub print_help () {
 	print "Note: -w and -c are required arguments.  -W and -C are optional.\n";
 	print " -W and -C are applied to domains listed on the queues - both FROM and TO. (sendmail)\n";
 	print " -W and -C are applied message not yet preproccessed. (qmail)\n";
+	print " -W and -C are applied to the recipient domains of deferred messages (postfix -n)\n";
+	print " and of queued messages (exim -n); only then are any messages read.\n";
 	print " This plugin tries to autodetect which mailserver you are running,\n";
 	print " you can override the autodetection with -M.\n";
 	print " This plugin uses the system mailq command (sendmail) or qmail-stat (qmail)\n";
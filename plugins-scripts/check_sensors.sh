@@ -19,6 +19,7 @@ print_help() {
 	print_usage
 	echo ""
 	echo "This plugin checks hardware status using the lm_sensors package."
+	echo "On Linux, check_hwmon checks the same sensors without it."
 	echo ""
 	support
 	exit "$STATE_OK"
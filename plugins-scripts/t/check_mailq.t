@@ -0,0 +1,61 @@
+#! /usr/bin/perl -w -I ..
+#
+# check_mailq tests of the native queue count
+#
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use File::Temp qw(tempdir);
+
+plan tests => 12;
+
+my $res;
+my $spool = tempdir( CLEANUP => 1 );
+
+sub put {
+	my ($file, @lines) = @_;
+	open(F, ">", "$spool/$file") or die "Cannot write $spool/$file: $!";
+	print F @lines;
+	close F;
+}
+
+mkdir "$spool/$_" foreach qw(active deferred deferred/A deferred/B defer defer/A input input/x);
+
+$res = NPTest->testCmd( "./check_mailq -M postfix -n -S $spool -w 2 -c 4" );
+is( $res->return_code, 0, "Empty postfix queue" );
+is( $res->output, "OK: postfix mailq is empty|unsent=0;2;4;0", "Output correct" );
+
+put( "active/4F2A11C0B", "" );
+put( "deferred/A/A1B2C3D4E", "" );
+put( "deferred/B/B1B2C3D4E", "" );
+put( "defer/A/A1B2C3D4E", "recipient=one\@example.com\n", "reason=timeout\n", "recipient=two\@example.com\n" );
+put( "defer/A/B1B2C3D4E", "recipient=three\@Example.com\n" );
+$res = NPTest->testCmd( "./check_mailq -M postfix -n -S $spool -w 2 -c 4" );
+is( $res->return_code, 1, "Hashed queue directories counted" );
+is( $res->output, "WARNING: postfix mailq is 3 (threshold w = 2)|unsent=3;2;4;0", "Output correct" );
+
+$res = NPTest->testCmd( "./check_mailq -M postfix -n -S $spool -w 5 -c 10 -W 2 -C 3" );
+is( $res->return_code, 1, "Domain counted once for each message" );
+is( $res->output, "WARNING: 2 messages in queue TO example.com (threshold W = 2)|unsent=3;5;10;0", "Output correct" );
+
+$res = NPTest->testCmd( "./check_mailq -M postfix -n -S $spool/none -w 2 -c 4" );
+is( $res->return_code, 0, "Queues not created yet are empty" );
+
+put( "input/1aB2cD-0000ab-Xy-H", "1aB2cD-0000ab-Xy-H\n", "exim 101 101\n", "<a\@example.org>\n", "1500000000 0\n",
+     "-local\n", "XX\n", "2\n", "x\@example.net\n", "y\@example.org\n", "\n" );
+put( "input/1aB2cD-0000ab-Xy-D", "" );
+put( "input/x/1aB2cE-0000ab-Xy-H", "1aB2cE-0000ab-Xy-H\n", "exim 101 101\n", "<>\n", "1500000000 0\n",
+     "NN x\@example.com\n", "1\n", "z\@example.net\n", "\n" );
+put( "input/x/1aB2cE-0000ab-Xy-D", "" );
+$res = NPTest->testCmd( "./check_mailq -M exim -n -S $spool -w 3 -c 4" );
+is( $res->return_code, 0, "Only exim header files counted" );
+is( $res->output, "OK: exim mailq (2) is below threshold (3/4)|unsent=2;3;4;0", "Output correct" );
+
+$res = NPTest->testCmd( "./check_mailq -M exim -n -S $spool -w 3 -c 4 -W 1 -C 2" );
+is( $res->return_code, 2, "Exim recipient domains" );
+is( $res->output, "CRITICAL: 2 messages in queue TO example.net (threshold C = 2)|unsent=2;3;4;0", "Output correct" );
+
+$res = NPTest->testCmd( "./check_mailq -M qmail -n -w 2 -c 4" );
+is( $res->return_code, 3, "Native count only for postfix and exim" );
@@ -0,0 +1,278 @@
+/*****************************************************************************
+*
+* Nagios cache_result plugin
+*
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+*
+* Description:
+*
+* This file contains the cache_result plugin
+*
+* Runs a plugin at most once per --cache-ttl for the same command line:
+* while a result of it is fresh, its output and exit status are given
+* again instead. Identical runs that start together wait for the one
+* that runs the plugin and give its result.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+const char *progname = "cache_result";
+const char *copyright = "2014";
+const char *email = "devel@nagios-plugins.org";
+
+#define DEFAULT_TIMEOUT 11
+
+#include "common.h"
+#include "utils.h"
+#include "utils_cmd.h"
+
+static char **process_arguments (int, char **);
+static char **normalize_command (char **, int *);
+static void replay (int, char *, size_t) __attribute__((noreturn));
+void validate_arguments (char **);
+void print_help (void);
+void print_usage (void);
+
+unsigned int cache_ttl = 0;
+
+int
+main (int argc, char **argv)
+{
+	char **command_line, **key_argv;
+	char *result_path, *lock_path, *stored, *p;
+	output chld_out, chld_err;
+	size_t length;
+	int key_argc, result, lock, i;
+
+	timeout_interval = DEFAULT_TIMEOUT;
+
+	command_line = process_arguments (argc, argv);
+
+	/* Nothing to cache: be the plugin rather than wait on it */
+	if (cache_ttl == 0 && command_line[1] != NULL)
+		execv (command_line[0], command_line);
+
+	if (signal (SIGALRM, timeout_alarm_handler) == SIG_ERR)
+		die (STATE_UNKNOWN, _("Cannot catch SIGALRM"));
+	(void) alarm ((unsigned) timeout_interval);
+
+	/* the state key of the command line is the name of the result */
+	key_argv = normalize_command (command_line, &key_argc);
+	np_init ((char *) progname, key_argc, key_argv);
+	np_enable_state (NULL, NP_CACHE_FORMAT_VERSION);
+	result_path = np_state_path (".result");
+	lock_path = np_state_path (".lock");
+
+	lock = -1;
+	if (cache_ttl && result_path && lock_path) {
+		if (np_cache_read (result_path, time (NULL), cache_ttl, &result, &stored, &length))
+			replay (result, stored, length);
+		/* the run that holds the lock may store what this one wants */
+		lock = np_cache_lock (lock_path);
+		if (lock >= 0 && np_cache_read (result_path, time (NULL), cache_ttl, &result, &stored, &length))
+			replay (result, stored, length);
+	}
+
+	if (command_line[1] == NULL) {
+		result = cmd_run (command_line[0], &chld_out, &chld_err, 0);
+	} else if (cmd_run_inprocess == NULL
+	           || (result = cmd_run_inprocess (command_line, &chld_out, &chld_err)) < 0) {
+		result = cmd_run_array (command_line, &chld_out, &chld_err, 0);
+	}
+	if (result < 0)
+		die (STATE_UNKNOWN, _("Could not run %s\n"), command_line[0]);
+
+	/* the lines again as the plugin printed them */
+	p = stored = malloc (chld_out.buflen + 2);
+	if (stored == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (i = 0; i < chld_out.lines; i++) {
+		memcpy (p, chld_out.line[i], chld_out.lens[i]);
+		p += chld_out.lens[i];
+		*p++ = '\n';
+	}
+	length = p - stored;
+
+	/* errors are the plugin's to show, not to be kept */
+	for (i = 0; i < chld_err.lines; i++)
+		fprintf (stderr, "%s\n", chld_err.line[i]);
+
+	if (lock >= 0) {
+		np_cache_write (result_path, time (NULL), result, stored, length);
+		close (lock);
+	}
+	replay (result, stored, length);
+}
+
+
+static void
+replay (int result, char *stored, size_t length)
+{
+	fwrite (stored, 1, length, stdout);
+	exit (result);
+}
+
+
+/*
+ * The command line as the key of its result: the plugin by its real path,
+ * so that ./check_x and /usr/local/nagios/libexec/check_x share one, and a
+ * quoted command line split the way it is run. Each argument is prefixed
+ * with its length: the state key runs them together, and "ab c" is not
+ * "a bc".
+ */
+static char **
+normalize_command (char **command_line, int *argc)
+{
+	char **args = command_line, **key;
+	char *path;
+	int i, n;
+
+	if (command_line[1] == NULL) {
+		args = cmd_argv (command_line[0]);
+		if (args == NULL)
+			args = command_line;
+	}
+	for (n = 0; args[n]; n++)
+		;
+	key = malloc ((n + 1) * sizeof (char *));
+	if (key == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (i = 0; i < n; i++) {
+		path = (i == 0) ? realpath (args[0], NULL) : NULL;
+		xasprintf (&key[i], "%lu:%s", (unsigned long) strlen (path ? path : args[i]), path ? path : args[i]);
+		free (path);
+	}
+	key[n] = NULL;
+	*argc = n;
+	return key;
+}
+
+
+/* process command-line arguments */
+static char **
+process_arguments (int argc, char **argv)
+{
+	int c;
+
+	int option = 0;
+	static struct option longopts[] = {
+		{"help", no_argument, 0, 'h'},
+		{"version", no_argument, 0, 'V'},
+		{"timeout", required_argument, 0, 't'},
+		{"timeout-result", required_argument, 0, 'T'},
+		{"cache-ttl", required_argument, 0, 'C'},
+		{0, 0, 0, 0}
+	};
+
+	while (1) {
+		c = getopt_long (argc, argv, "+hVt:T:C:", longopts, &option);
+
+		if (c == -1 || c == EOF)
+			break;
+
+		switch (c) {
+		case '?':     /* help */
+			usage5 ();
+			break;
+		case 'h':     /* help */
+			print_help ();
+			exit (EXIT_SUCCESS);
+			break;
+		case 'V':     /* version */
+			print_revision (progname, NP_VERSION);
+			exit (EXIT_SUCCESS);
+		case 't':     /* timeout period */
+			timeout_interval = parse_timeout_string (optarg);
+			break;
+		case 'T':     /* Result to return on timeouts */
+			if ((timeout_state = translate_state(optarg)) == ERROR)
+				usage4 (_("Timeout result must be a valid state name (OK, WARNING, CRITICAL, UNKNOWN) or integer (0-3)."));
+			break;
+		case 'C':     /* how long a result is given again */
+			if (!is_integer (optarg) || atoi (optarg) < 0)
+				usage4 (_("Cache TTL must be a number of seconds"));
+			cache_ttl = atoi (optarg);
+			break;
+		}
+	}
+
+	validate_arguments (&argv[optind]);
+
+	return &argv[optind];
+}
+
+
+void
+validate_arguments (char **command_line)
+{
+	if (command_line[0] == NULL)
+		usage4 (_("Could not parse arguments"));
+
+	if (strncmp(command_line[0],"/",1) != 0 && strncmp(command_line[0],"./",2) != 0)
+		usage4 (_("Require path to command"));
+}
+
+
+void
+print_help (void)
+{
+	print_revision (progname, NP_VERSION);
+
+	printf (COPYRIGHT, copyright, email);
+
+	printf ("%s\n", _("Runs a plugin at most once in a while for the same command line, and gives"));
+	printf ("%s\n", _("its output and status again until then."));
+
+	printf ("\n\n");
+
+	print_usage ();
+
+	printf (UT_HELP_VRSN);
+
+	printf (UT_PLUG_TIMEOUT, timeout_interval);
+	printf ("    %s\n", _("Keep timeout longer than the plugin timeout to retain its status."));
+	printf ("    %s\n", _("Waiting for an identical run to finish counts towards it."));
+	printf (" -T, --timeout-result=STATUS\n");
+	printf ("    %s\n", _("Custom result on timeouts, as a state name or integer (0-3)"));
+	printf (" -C, --cache-ttl=SECONDS\n");
+	printf ("    %s\n", _("Give the result of the same command line again for so long after it was"));
+	printf ("    %s\n", _("run (default: 0, always run the plugin)"));
+
+	printf ("\n");
+	printf ("%s\n", _("Examples:"));
+	printf (" %s\n", "cache_result -C 30 /usr/local/nagios/libexec/check_http -H www.example.org");
+	printf ("    %s\n", _("Services with this same check share one run of check_http every 30 seconds"));
+	printf ("\n");
+	printf ("%s\n", _("Notes:"));
+	printf (" %s\n", _("The full path of the plugin must be provided."));
+	printf (" %s\n", _("Results are kept under the state directory (see NAGIOS_PLUGIN_STATE_DIRECTORY),"));
+	printf (" %s\n", _("keyed by the command line; runs of it that start while it runs wait for it"));
+	printf (" %s\n", _("and give its result instead of running it again. The environment is not"));
+	printf (" %s\n", _("part of the key. Standard error is passed through but not kept."));
+
+	printf (UT_SUPPORT);
+}
+
+
+
+void
+print_usage (void)
+{
+	printf ("%s\n", _("Usage:"));
+	printf ("%s [-t timeout] [-T STATE] -C seconds <definition of wrapped plugin>\n", progname);
+}
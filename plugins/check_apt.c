@@ -36,13 +36,17 @@ const char *email = "devel@nagios-plugins.org";
 #include "common.h"
 #include "runcmd.h"
 #include "utils.h"
-#include "regex.h"
+#include "utils_regex.h"
+#include "sha1.h"
+#include <sys/stat.h>
 
 /* some constants */
 typedef enum { UPGRADE, DIST_UPGRADE, NO_UPGRADE } upgrade_type;
 
 /* Character for hidden input file option (for testing). */
 #define INPUT_FILE_OPT CHAR_MAX+1
+#define CACHE_OPT CHAR_MAX+2
+#define REFRESH_OPT CHAR_MAX+3
 /* the default opts can be overridden via the cmdline */
 #define UPGRADE_DEFAULT_OPTS "-o 'Debug::NoLocking=true' -s -qq"
 #define UPDATE_DEFAULT_OPTS "-q"
@@ -55,6 +59,13 @@ typedef enum { UPGRADE, DIST_UPGRADE, NO_UPGRADE } upgrade_type;
 #define PKGINST_PREFIX "Inst "
 /* the RE that catches security updates */
 #define SECURITY_RE "^[^\\(]*\\(.* (Debian-Security:|Ubuntu:[^/]*/[^-]*-security)"
+/* one of which the origin of a line SECURITY_RE matches has in it */
+#define SECURITY_ORIGIN_DEBIAN " Debian-Security:"
+#define SECURITY_ORIGIN_UBUNTU "-security"
+/* what the result of an upgrade simulation depends on: the installed
+ * packages and the lists of available ones */
+#define DPKG_STATUS "/var/lib/dpkg/status"
+#define APT_LISTS "/var/lib/apt/lists"
 
 /* some standard functions */
 int process_arguments(int, char **);
@@ -69,6 +80,13 @@ int run_update(void);
 int run_upgrade(int *pkgcount, int *secpkgcount);
 /* add another clause to a regexp */
 char* add_to_regexp(char *expr, const char *next);
+/* whether an Inst line is for a critical update */
+int is_critical(const char *line, np_regex_t *sreg);
+/* the package state a cached result is good for, NULL if unknown */
+char* package_state(void);
+/* the counts cached for the options and the package state, if any */
+int cache_read(const char *pstate, int *pkgcount, int *secpkgcount);
+void cache_write(const char *pstate, int pkgcount, int secpkgcount);
 
 /* configuration variables */
 static int verbose = 0;      /* -v */
@@ -83,6 +101,8 @@ static char *do_critical = NULL;  /* regexp specifying critical packages */
 static char *input_filename = NULL; /* input filename for testing */
 /* number of packages available for upgrade to return WARNING status */
 static int packages_warning = 1;
+static int use_cache = 0;      /* --cache */
+static int refresh_cache = 0;  /* --refresh */
 
 /* other global variables */
 static int stderr_warning = 0;   /* if a cmd issued output on stderr */
@@ -90,6 +110,9 @@ static int exec_warning = 0;     /* if a cmd exited non-zero */
 
 int main (int argc, char **argv) {
 	int result=STATE_UNKNOWN, packages_available=0, sec_count=0;
+	char *pstate=NULL;
+
+	np_init ((char *) progname, argc, argv);
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts(&argc, argv, progname);
@@ -108,8 +131,19 @@ int main (int argc, char **argv) {
 	/* if they want to run apt-get update first... */
 	if(do_update) result = run_update();
 
-	/* apt-get upgrade */
-	result = max_state(result, run_upgrade(&packages_available, &sec_count));
+	/* apt-get upgrade, unless it already ran for the same packages */
+	if (use_cache && upgrade != NO_UPGRADE)
+		pstate = package_state();
+	if (pstate && !refresh_cache && cache_read(pstate, &packages_available, &sec_count)) {
+		if (verbose)
+			printf(_("Using the result cached for this package state\n"));
+		result = max_state(result, STATE_OK);
+	} else {
+		result = max_state(result, run_upgrade(&packages_available, &sec_count));
+		/* only a clean run is kept, so problems are not hidden */
+		if (pstate && !stderr_warning && !exec_warning)
+			cache_write(pstate, packages_available, sec_count);
+	}
 
 	if(sec_count > 0){
 		result = max_state(result, STATE_CRITICAL);
@@ -154,6 +188,8 @@ int process_arguments (int argc, char **argv) {
 		{"only-critical", no_argument, 0, 'o'},
 		{"input-file", required_argument, 0, INPUT_FILE_OPT},
 		{"packages-warning", required_argument, 0, 'w'},
+		{"cache", no_argument, 0, CACHE_OPT},
+		{"refresh", no_argument, 0, REFRESH_OPT},
 		{0, 0, 0, 0}
 	};
 
@@ -217,6 +253,13 @@ int process_arguments (int argc, char **argv) {
 		case 'w':
 			packages_warning = atoi(optarg);
 			break;
+		case CACHE_OPT:
+			use_cache=1;
+			break;
+		case REFRESH_OPT:
+			use_cache=1;
+			refresh_cache=1;
+			break;
 		default:
 			/* print short usage statement if args not parsable */
 			usage5();
@@ -231,36 +274,33 @@ int process_arguments (int argc, char **argv) {
 int run_upgrade(int *pkgcount, int *secpkgcount){
 	int i=0, result=STATE_UNKNOWN, regres=0, pc=0, spc=0;
 	struct output chld_out, chld_err;
-	regex_t ireg, ereg, sreg;
+	np_regex_t ireg, ereg, sreg;
 	char *cmdline=NULL, rerrbuf[64];
 
-	/* initialize ereg as it is possible it is printed while uninitialized */
-	memset(&ereg, '\0', sizeof(ereg.buffer));
-
 	if(upgrade==NO_UPGRADE) return STATE_OK;
 
 	/* compile the regexps */
 	if (do_include != NULL) {
-		regres=regcomp(&ireg, do_include, REG_EXTENDED);
+		regres=np_regcomp(&ireg, do_include, REG_EXTENDED|REG_NOSUB);
 		if (regres!=0) {
-			regerror(regres, &ireg, rerrbuf, 64);
+			np_regerror(regres, &ireg, rerrbuf, 64);
 			die(STATE_UNKNOWN, _("%s: Error compiling regexp: %s"), progname, rerrbuf);
 		}
 	}
    
 	if(do_exclude!=NULL){
-		regres=regcomp(&ereg, do_exclude, REG_EXTENDED);
+		regres=np_regcomp(&ereg, do_exclude, REG_EXTENDED|REG_NOSUB);
 		if(regres!=0) {
-			regerror(regres, &ereg, rerrbuf, 64);
+			np_regerror(regres, &ereg, rerrbuf, 64);
 			die(STATE_UNKNOWN, _("%s: Error compiling regexp: %s"),
 			    progname, rerrbuf);
 		}
 	}
    
 	const char *crit_ptr = (do_critical != NULL) ? do_critical : SECURITY_RE;
-	regres=regcomp(&sreg, crit_ptr, REG_EXTENDED);
+	regres=np_regcomp(&sreg, crit_ptr, REG_EXTENDED|REG_NOSUB);
 	if(regres!=0) {
-		regerror(regres, &ereg, rerrbuf, 64);
+		np_regerror(regres, &sreg, rerrbuf, 64);
 		die(STATE_UNKNOWN, _("%s: Error compiling regexp: %s"),
 		    progname, rerrbuf);
 	}
@@ -299,13 +339,13 @@ int run_upgrade(int *pkgcount, int *secpkgcount){
 		}
 		/* if it is a package we care about */
 		if (strncmp(PKGINST_PREFIX, chld_out.line[i], strlen(PKGINST_PREFIX)) == 0 &&
-		    (do_include == NULL || regexec(&ireg, chld_out.line[i], 0, NULL, 0) == 0)) {
+		    (do_include == NULL || np_regexec(&ireg, chld_out.line[i], 0, NULL, 0) == 0)) {
 			/* if we're not excluding, or it's not in the
 			 * list of stuff to exclude */
 			if(do_exclude==NULL ||
-			   regexec(&ereg, chld_out.line[i], 0, NULL, 0)!=0){
+			   np_regexec(&ereg, chld_out.line[i], 0, NULL, 0)!=0){
 				pc++;
-				if(regexec(&sreg, chld_out.line[i], 0, NULL, 0)==0){
+				if(is_critical(chld_out.line[i], &sreg)){
 					spc++;
 					if(verbose) printf("*");
 				}
@@ -328,9 +368,9 @@ int run_upgrade(int *pkgcount, int *secpkgcount){
 			}
 		}
 	}
-	if (do_include != NULL) regfree(&ireg);
-	regfree(&sreg);
-	if(do_exclude!=NULL) regfree(&ereg);
+	if (do_include != NULL) np_regfree(&ireg);
+	np_regfree(&sreg);
+	if(do_exclude!=NULL) np_regfree(&ereg);
 	free(cmdline);
 	return result;
 }
@@ -374,6 +414,22 @@ int run_update(void){
 	return result;
 }
 
+/* With the default SECURITY_RE only the lines whose origin (what follows
+ * the first '(') names a security archive can match, and those are few,
+ * so the others are told apart without running the regexp */
+int is_critical(const char *line, np_regex_t *sreg){
+	const char *origin;
+
+	if (do_critical == NULL) {
+		if ((origin = strchr(line, '(')) == NULL)
+			return FALSE;
+		if (strstr(origin, SECURITY_ORIGIN_DEBIAN) == NULL &&
+		    strstr(origin, SECURITY_ORIGIN_UBUNTU) == NULL)
+			return FALSE;
+	}
+	return np_regexec(sreg, line, 0, NULL, 0) == 0;
+}
+
 char* add_to_regexp(char *expr, const char *next){
 	char *re=NULL;
 
@@ -392,6 +448,75 @@ char* add_to_regexp(char *expr, const char *next){
 	return re;
 }
 
+/* The dpkg status file (which dpkg replaces on every change) and the
+ * directory of the package lists (which apt-get update renames new lists
+ * into), or with --input-file that file, as "mtime inode size" of each */
+char* package_state(void){
+	struct stat st, lists;
+	char *pstate=NULL;
+
+	if (input_filename != NULL) {
+		if (stat(input_filename, &st) != 0)
+			return NULL;
+		memset(&lists, 0, sizeof(lists));
+	} else if (stat(DPKG_STATUS, &st) != 0 || stat(APT_LISTS, &lists) != 0)
+		return NULL;
+
+	xasprintf(&pstate, "%lu %lu %lu %lu %lu %lu",
+	          (unsigned long)st.st_mtime, (unsigned long)st.st_ino, (unsigned long)st.st_size,
+	          (unsigned long)lists.st_mtime, (unsigned long)lists.st_ino, (unsigned long)lists.st_size);
+	return pstate;
+}
+
+/* The cache is keyed on what decides which packages are counted, so the
+ * thresholds may differ between checks sharing it */
+static void cache_enable(void){
+	struct sha1_ctx ctx;
+	unsigned char key[20];
+	char keyname[41];
+	const char *parts[6];
+	int i;
+
+	parts[0] = (upgrade==DIST_UPGRADE) ? "dist-upgrade" : "upgrade";
+	parts[1] = upgrade_opts ? upgrade_opts : "";
+	parts[2] = do_include ? do_include : "";
+	parts[3] = do_exclude ? do_exclude : "";
+	parts[4] = do_critical ? do_critical : "";
+	parts[5] = input_filename ? input_filename : "";
+	sha1_init_ctx(&ctx);
+	for (i = 0; i < 6; i++)
+		sha1_process_bytes(parts[i], strlen(parts[i]) + 1, &ctx);
+	sha1_finish_ctx(&ctx, key);
+	for (i = 0; i < 20; i++)
+		sprintf(&keyname[2 * i], "%02x", key[i]);
+
+	np_enable_state(keyname, 1);
+}
+
+int cache_read(const char *pstate, int *pkgcount, int *secpkgcount){
+	state_data *data;
+	char *counts;
+	size_t len = strlen(pstate);
+
+	cache_enable();
+	if ((data = np_state_read()) == NULL || data->data == NULL)
+		return FALSE;
+	counts = (char *)data->data;
+	if (strncmp(counts, pstate, len) != 0 || counts[len] != ' ' ||
+	    sscanf(counts + len, "%d %d", pkgcount, secpkgcount) != 2)
+		return FALSE;
+	return TRUE;
+}
+
+void cache_write(const char *pstate, int pkgcount, int secpkgcount){
+	char *counts=NULL;
+
+	cache_enable();
+	xasprintf(&counts, "%s %d %d", pstate, pkgcount, secpkgcount);
+	np_state_write_string(0, counts);
+	free(counts);
+}
+
 char* construct_cmdline(upgrade_type u, const char *opts){
 	int len=0;
 	const char *opts_ptr=NULL, *aptcmd=NULL;
@@ -479,6 +604,15 @@ print_help (void)
   printf ("    %s\n", _("Only warn about upgrades matching the critical list.  The total number"));
   printf ("    %s\n", _("of upgrades will be printed, but any non-critical upgrades will not cause"));
   printf ("    %s\n\n", _("the plugin to return WARNING status."));
+  printf (" %s\n", "--cache");
+  printf ("    %s\n", _("Keep the counts in the state directory and use them again as long as"));
+  printf ("    ");
+  printf (_("neither %s nor %s change, instead of"), DPKG_STATUS, APT_LISTS);
+  printf ("\n");
+  printf ("    %s\n", _("running the upgrade simulation again."));
+  printf (" %s\n", "--refresh");
+  printf ("    %s\n", _("Run the simulation even if the counts are cached, and cache them anew"));
+  printf ("    %s\n", _("(implies --cache)."));
   printf (" %s\n", "-w, --packages-warning=INTEGER");
   printf ("    %s\n", _("Minumum number of packages available for upgrade to return WARNING status."));
   printf ("    %s\n\n", _("Default is 1 package."));
@@ -500,4 +634,5 @@ print_usage(void)
 {
   printf ("%s\n", _("Usage:"));
   printf ("%s [[-d|-u|-U]opts] [-n] [-t timeout] [-w packages-warning]\n", progname);
+  printf ("       [--cache] [--refresh]\n");
 }
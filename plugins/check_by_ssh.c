@@ -34,14 +34,49 @@ const char *email = "devel@nagios-plugins.org";
 #include "utils.h"
 #include "netutils.h"
 #include "utils_cmd.h"
+#include "utils_passive.h"
+#include "sha1.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_WAIT_H
+# include <sys/wait.h>
+#endif
 
 #ifndef NP_MAXARGS
 #define NP_MAXARGS 1024
 #endif
 
+/* used in fan_out to pass the environment to ssh */
+extern char **environ;
+
+/* how long an idle master connection stays, in seconds */
+#define DEFAULT_CONTROL_PERSIST 300
+/* hosts checked at a time with several -H */
+#define DEFAULT_CONCURRENCY 16
+
+/* one -H, with the -n that follows it (or, for the first, that comes
+ * before it) */
+typedef struct ssh_host {
+	char *name;
+	char *shortname;
+	char *control_socket;
+	char **argv;
+	pid_t pid;
+	int timed_out;
+	output out;
+	output err;
+} ssh_host;
+
 int process_arguments (int, char **);
 int validate_arguments (void);
 void comm_append (const char *);
+char *control_path (void);
+void control_expire (const char *, const char *);
+void add_host (char *);
+int fan_out (int);
+int open_output (void);
+int passive_results (output *, const char *, time_t, np_passive *);
+int write_results (int, np_passive *);
 void print_help (void);
 void print_usage (void);
 
@@ -58,26 +93,25 @@ char *host_shortname = NULL;
 char **service;
 int passive = FALSE;
 int verbose = FALSE;
+int control_master = FALSE;
+int control_persist = DEFAULT_CONTROL_PERSIST;
+int control_max_age = 0;
+int concurrency = DEFAULT_CONCURRENCY;
+ssh_host *hosts = NULL;
+int host_count = 0;
 
 int
 main (int argc, char **argv)
 {
 
-	char *status_text;
-	int cresult;
+	np_passive results;
 	int result = STATE_UNKNOWN;
-	int i;
-	time_t local_time;
-	FILE *fp = NULL;
+	int i, fd = -1;
 	output chld_out, chld_err;
 
 	remotecmd = "";
 	comm_append(SSH_COMMAND);
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
 
@@ -85,12 +119,28 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage_va(_("Could not parse arguments"));
 
+	/* process output: a command file is opened before the commands run,
+	 * a spool directory or livestatus only written to once they are done */
+	if (passive && strncmp (outputfile, NP_PASSIVE_SPOOL, strlen (NP_PASSIVE_SPOOL)) &&
+	    strncmp (outputfile, NP_PASSIVE_LIVESTATUS, strlen (NP_PASSIVE_LIVESTATUS)) &&
+	    (fd = open_output ()) < 0) {
+		printf (_("SSH WARNING: could not open %s\n"), outputfile);
+		exit (STATE_UNKNOWN);
+	}
+
+	/* each round of hosts has the timeout to itself */
+	if (host_count > 1)
+		return fan_out (fd);
+
 	/* Set signal handling and alarm timeout */
 	if (signal (SIGALRM, timeout_alarm_handler) == SIG_ERR) {
 		usage_va(_("Cannot catch SIGALRM"));
 	}
 	alarm (timeout_interval);
 
+	if (hosts[0].control_socket && control_max_age > 0)
+		control_expire (hosts[0].control_socket, hosts[0].name);
+
 	/* run the command */
 	if (verbose) {
 		printf ("Command: %s\n", commargv[0]);
@@ -129,40 +179,186 @@ main (int argc, char **argv)
 	 * Passive mode
 	 */
 
-	/* process output */
-	if (!(fp = fopen (outputfile, "a"))) {
-		printf (_("SSH WARNING: could not open %s\n"), outputfile);
+	np_passive_init (&results);
+	if (passive_results (&chld_out, host_shortname, time (NULL), &results) < 0)
+		die (STATE_UNKNOWN, _("%s: Error parsing output\n"), progname);
+	if (write_results (fd, &results) == ERROR) {
+		printf (_("SSH WARNING: could not write to %s\n"), outputfile);
 		exit (STATE_UNKNOWN);
 	}
 
-	local_time = time (NULL);
-	commands = 0;
-	for(i = skip_stdout; i < chld_out.lines; i++) {
-		status_text = chld_out.line[i++];
-		if (i == chld_out.lines || strstr (chld_out.line[i], "STATUS CODE: ") == NULL)
-			die (STATE_UNKNOWN, _("%s: Error parsing output\n"), progname);
+	/* Multiple commands and passive checking should always return OK */
+	return result;
+}
 
-		if (service[commands] && status_text
-			&& sscanf (chld_out.line[i], "STATUS CODE: %d", &cresult) == 1)
-		{
-			fprintf (fp, "[%d] PROCESS_SERVICE_CHECK_RESULT;%s;%s;%d;%s\n",
-			         (int) local_time, host_shortname, service[commands++],
-			         cresult, status_text);
+
+
+/* Run the commands on every host, concurrency of them at a time, and
+ * write the results of all hosts to the command file at the end, in as
+ * few writes as it takes. The output of a round is drained by one poll
+ * loop, and what is still running once the timeout is over is killed
+ * with the rest of it. */
+int
+fan_out (int fd)
+{
+	cmd_child *children;
+	ssh_host *h;
+	char **messages, *problems = NULL;
+	np_passive results;
+	int *states;
+	int pfd[2], pfderr[2];
+	int i, j, round, count_ok = 0, skip, written;
+	int result = STATE_OK;
+
+	children = calloc (concurrency, sizeof (cmd_child));
+	states = calloc (host_count, sizeof (int));
+	messages = calloc (host_count, sizeof (char *));
+	if (children == NULL || states == NULL || messages == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+
+	setenv ("LC_ALL", "C", 1);
+	np_passive_init (&results);
+	for (i = 0; i < host_count; i += round) {
+		round = host_count - i < concurrency ? host_count - i : concurrency;
+
+		for (j = 0; j < round; j++) {
+			h = &hosts[i + j];
+			if (h->control_socket && control_max_age > 0)
+				control_expire (h->control_socket, h->name);
+			if (verbose)
+				printf ("Host %s: %s ... %s\n", h->name, h->argv[0], remotecmd);
+			if (pipe (pfd) < 0 || pipe (pfderr) < 0 ||
+			    (h->pid = cmd_spawn (h->argv, environ, pfd, pfderr)) < 0)
+				die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), h->argv[0]);
+			close (pfd[1]);
+			close (pfderr[1]);
+			children[j].out_fd = pfd[0];
+			children[j].err_fd = pfderr[0];
+			children[j].out = &h->out;
+			children[j].err = &h->err;
+			children[j].pid = h->pid;
+		}
+
+		/* what is still running at the timeout is killed and reaped there */
+		cmd_fetch_children (children, round, 0, timeout_interval);
+		for (j = 0; j < round; j++) {
+			h = &hosts[i + j];
+			close (children[j].out_fd);
+			close (children[j].err_fd);
+			h->timed_out = children[j].timed_out;
+		}
+
+		for (j = 0; j < round; j++) {
+			h = &hosts[i + j];
+			skip = skip_stderr == -1 ? (int) h->err.lines : skip_stderr;
+			states[i + j] = STATE_UNKNOWN;
+			if (h->timed_out)
+				xasprintf (&messages[i + j], _("Timed out after %d seconds"), timeout_interval);
+			else if ((int) h->err.lines > skip)
+				xasprintf (&messages[i + j], _("Remote command execution failed: %s"),
+				           h->err.line[skip]);
+			else if ((written = passive_results (&h->out, h->shortname, time (NULL), &results)) < 0)
+				messages[i + j] = strdup (_("Error parsing output"));
+			else {
+				states[i + j] = STATE_OK;
+				xasprintf (&messages[i + j], _("%d results"), written);
+			}
+			free (h->out.buf);
+			free (h->out.line);
+			free (h->out.lens);
+			free (h->err.buf);
+			free (h->err.line);
+			free (h->err.lens);
 		}
 	}
-	
-	/* Multiple commands and passive checking should always return OK */
+
+	if (results.count && write_results (fd, &results) == ERROR)
+		for (i = 0; i < host_count; i++)
+			if (states[i] == STATE_OK) {
+				states[i] = STATE_UNKNOWN;
+				xasprintf (&messages[i], _("Could not write to %s"), outputfile);
+			}
+	np_passive_free (&results);
+
+	for (i = 0; i < host_count; i++) {
+		result = max_state_alt (result, states[i]);
+		if (states[i] == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           hosts[i].name, messages[i]);
+	}
+
+	printf ("SSH %s: %d of %d %s%s%s\n", state_text (result), count_ok, host_count,
+	        _("hosts OK"), problems ? " - " : "", problems ? problems : "");
+	for (i = 0; i < host_count; i++)
+		printf ("[%s] %s: %s\n", state_text (states[i]), hosts[i].name, messages[i]);
 	return result;
 }
 
+
+
+/* the command file, opened for appending */
+int
+open_output (void)
+{
+	return open (outputfile, O_WRONLY | O_APPEND | O_CREAT, 0666);
+}
+
+/* The service results of what the commands printed, each line followed
+ * by the STATUS CODE line of its exit status, after the lines skipped,
+ * added to results. Returns how many there are, or -1 (and none added)
+ * if the output is not made of such pairs. */
+int
+passive_results (output *out, const char *shortname, time_t local_time, np_passive *results)
+{
+	char *status_text;
+	int cresult, count = 0;
+	size_t i, skip, before = results->count;
+
+	skip = skip_stdout == -1 ? out->lines : (size_t) skip_stdout;
+	for(i = skip; i < out->lines; i++) {
+		status_text = out->line[i++];
+		if (i == out->lines || strstr (out->line[i], "STATUS CODE: ") == NULL) {
+			np_passive_truncate (results, before);
+			return -1;
+		}
+
+		if ((unsigned int) count < services && service[count] && status_text
+			&& sscanf (out->line[i], "STATUS CODE: %d", &cresult) == 1)
+		{
+			np_passive_service (results, local_time, shortname, service[count++],
+			                    cresult, status_text);
+		}
+	}
+	return count;
+}
+
+/* the results to the command file open on fd, in writes that the pipe
+ * keeps apart from those of others, or else to the spool directory or
+ * livestatus of -O */
+int
+write_results (int fd, np_passive *results)
+{
+	if (fd >= 0)
+		return np_passive_write (results, fd);
+	return np_passive_send (results, outputfile);
+}
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
 {
-	int c;
+	int c, i, common;
 	char *p1, *p2;
 
 	int option = 0;
+	enum {
+		CONTROL_MASTER = CHAR_MAX + 1,
+		CONTROL_PERSIST,
+		CONTROL_MAX_AGE,
+		CONCURRENCY
+	};
 	static struct option longopts[] = {
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
@@ -189,6 +385,10 @@ process_arguments (int argc, char **argv)
 		{"ssh-option", required_argument, 0, 'o'},
 		{"quiet", no_argument, 0, 'q'},
 		{"configfile", optional_argument, 0, 'F'},
+		{"control-master", no_argument, 0, CONTROL_MASTER},
+		{"control-persist", required_argument, 0, CONTROL_PERSIST},
+		{"control-max-age", required_argument, 0, CONTROL_MAX_AGE},
+		{"concurrency", required_argument, 0, CONCURRENCY},
 		{0, 0, 0, 0}
 	};
 
@@ -222,6 +422,7 @@ process_arguments (int argc, char **argv)
 		case 'H':									/* host */
 			host_or_die(optarg);
 			hostname = optarg;
+			add_host (optarg);
 			break;
 		case 'p': /* port number */
 			if (!is_integer (optarg))
@@ -246,6 +447,8 @@ process_arguments (int argc, char **argv)
 			break;
 		case 'n':									/* short name of host in nagios configuration */
 			host_shortname = optarg;
+			if (host_count > 0)
+				hosts[host_count - 1].shortname = optarg;
 			break;
 
 		case 'u':
@@ -309,6 +512,26 @@ process_arguments (int argc, char **argv)
 			comm_append("-F");
 			comm_append(optarg);
 			break;
+		case CONTROL_MASTER:
+			control_master = TRUE;
+			break;
+		case CONTROL_PERSIST:
+			if (!is_intpos (optarg))
+				usage_va(_("control-persist argument must be a positive integer"));
+			control_persist = atoi (optarg);
+			control_master = TRUE;
+			break;
+		case CONTROL_MAX_AGE:
+			if (!is_intnonneg (optarg))
+				usage_va(_("control-max-age argument must be a non-negative integer"));
+			control_max_age = atoi (optarg);
+			control_master = TRUE;
+			break;
+		case CONCURRENCY:
+			if (!is_intpos (optarg))
+				usage_va(_("concurrency argument must be a positive integer"));
+			concurrency = atoi (optarg);
+			break;
 		default:									/* help */
 			usage5();
 		}
@@ -321,6 +544,7 @@ process_arguments (int argc, char **argv)
 		}
 		host_or_die(argv[c]);
 		hostname = argv[c++];
+		add_host (hostname);
 	}
 
 	if (strlen(remotecmd) == 0) {
@@ -337,8 +561,42 @@ process_arguments (int argc, char **argv)
 	if (remotecmd == NULL || strlen (remotecmd) <= 1)
 		usage_va(_("No remotecmd"));
 
-	comm_append(hostname);
-	comm_append(remotecmd);
+	/* the -n before the first -H is for that one, the others default to
+	 * their names */
+	if (hosts[0].shortname == NULL)
+		hosts[0].shortname = host_shortname;
+	for (i = host_count > 1 ? 0 : 1; i < host_count; i++)
+		if (hosts[i].shortname == NULL)
+			hosts[i].shortname = hosts[i].name;
+
+	/* the options so far are the same for all hosts, each of which gets
+	 * its own copy of the command line with the rest */
+	common = commargc;
+	for (i = 0; i < host_count; i++) {
+		hostname = hosts[i].name;
+		commargc = common;
+
+		/* share one authenticated connection to the host between runs:
+		 * the first one becomes the master, which stays in the background
+		 * for control_persist seconds after the last session on it */
+		if (control_master && (hosts[i].control_socket = control_path ()) != NULL) {
+			comm_append("-o");
+			comm_append("ControlMaster=auto");
+			xasprintf (&p1, "ControlPath=%s", hosts[i].control_socket);
+			comm_append("-o");
+			comm_append(p1);
+			xasprintf (&p1, "ControlPersist=%d", control_persist);
+			comm_append("-o");
+			comm_append(p1);
+		}
+
+		comm_append(hostname);
+		comm_append(remotecmd);
+
+		if ((hosts[i].argv = malloc ((commargc + 1) * sizeof (char *))) == NULL)
+			die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+		memcpy (hosts[i].argv, commargv, (commargc + 1) * sizeof (char *));
+	}
 
 	return validate_arguments ();
 }
@@ -359,6 +617,89 @@ comm_append (const char *str)
 
 }
 
+/* The control socket for the host with the ssh options given so far,
+ * named after them in the state directory. NULL when that name would be
+ * too long for a socket, with ssh's own suffix for the one it binds
+ * first. */
+char *
+control_path (void)
+{
+	struct sha1_ctx ctx;
+	unsigned char key[20];
+	char *path, *p;
+	int i;
+
+	sha1_init_ctx (&ctx);
+	for (i = 0; i < commargc; i++)
+		sha1_process_bytes (commargv[i], strlen (commargv[i]) + 1, &ctx);
+	sha1_process_bytes (hostname, strlen (hostname) + 1, &ctx);
+	sha1_finish_ctx (&ctx, key);
+
+	xasprintf (&path, "%s/%lu/ssh_control/", _np_state_calculate_location_prefix (),
+	           (unsigned long) geteuid ());
+	for (i = 0; i < 10; i++)
+		xasprintf (&path, "%s%02x", path, key[i]);
+
+#ifdef HAVE_SYS_UN_H
+	if (strlen (path) + sizeof (".XXXXXXXXXXXXXXXX") > UNIX_PATH_MAX) {
+#else
+	if (TRUE) {
+#endif
+		if (verbose)
+			printf (_("Not sharing connections, control socket name too long: %s\n"), path);
+		return NULL;
+	}
+
+	/* the state directory may not exist yet; what is in it gives access
+	 * to the host, so it is for us alone */
+	for (p = strchr (path + 1, '/'); p; p = strchr (p + 1, '/')) {
+		*p = '\0';
+		if (access (path, F_OK))
+			mkdir (path, S_IRWXU);
+		*p = '/';
+	}
+	return path;
+}
+
+/* Stop the master behind the socket once it is control_max_age seconds
+ * old, so the next run authenticates again */
+void
+control_expire (const char *path, const char *host)
+{
+	struct stat st;
+	output chld_out, chld_err;
+	char *argv[7], *option;
+
+	if (lstat (path, &st) || time (NULL) - st.st_mtime < control_max_age)
+		return;
+
+	if (verbose)
+		printf (_("Control socket %s is %lu seconds old, stopping its master\n"),
+		        path, (unsigned long) (time (NULL) - st.st_mtime));
+	xasprintf (&option, "ControlPath=%s", path);
+	argv[0] = SSH_COMMAND;
+	argv[1] = "-o";
+	argv[2] = option;
+	argv[3] = "-O";
+	argv[4] = "exit";
+	argv[5] = (char *) host;
+	argv[6] = NULL;
+	cmd_run_array (argv, &chld_out, &chld_err, 0);
+	/* a master that is gone leaves its socket behind */
+	unlink (path);
+	free (option);
+}
+
+void
+add_host (char *name)
+{
+	hosts = realloc (hosts, (host_count + 1) * sizeof (ssh_host));
+	if (hosts == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	memset (&hosts[host_count], 0, sizeof (ssh_host));
+	hosts[host_count++].name = name;
+}
+
 int
 validate_arguments (void)
 {
@@ -368,7 +709,10 @@ validate_arguments (void)
 	if (passive && commands != services)
 		die (STATE_UNKNOWN, _("%s: In passive mode, you must provide a service name for each command.\n"), progname);
 
-	if (passive && host_shortname == NULL)
+	if (host_count > 1 && !passive)
+		die (STATE_UNKNOWN, _("%s: Several hosts need passive mode (-O).\n"), progname);
+
+	if (passive && host_shortname == NULL && host_count == 1)
 		die (STATE_UNKNOWN, _("%s: In passive mode, you must provide the host short name from the nagios configs.\n"), progname);
 
 	return OK;
@@ -414,7 +758,9 @@ print_help (void)
   printf (" %s\n","-i, --identity=KEYFILE");
   printf ("    %s\n", _("identity of an authorized key [optional]"));
   printf (" %s\n","-O, --output=FILE");
-  printf ("    %s\n", _("external command file for nagios [optional]"));
+  printf ("    %s\n", _("external command file for nagios [optional]; spool:DIR writes one"));
+  printf ("    %s\n", _("checkresult file to the check_result_path DIR instead, and"));
+  printf ("    %s\n", _("livestatus:SOCKET (or livestatus:HOST:PORT) sends the results as commands"));
   printf (" %s\n","-s, --services=LIST");
   printf ("    %s\n", _("list of nagios service names, separated by ':' [optional]"));
   printf (" %s\n","-n, --name=NAME");
@@ -425,6 +771,17 @@ print_help (void)
   printf ("    %s\n", _("Tell ssh to use this configfile [optional]"));
   printf (" %s\n","-q, --quiet");
   printf ("    %s\n", _("Tell ssh to suppress warning and diagnostic messages [optional]"));
+  printf (" %s\n","--concurrency=INTEGER");
+  printf ("    %s %d)\n", _("Hosts to run the commands on at a time with several -H (default:"), DEFAULT_CONCURRENCY);
+  printf (" %s\n","--control-master");
+  printf ("    %s\n", _("Share one authenticated connection to the host between checks, through a"));
+  printf ("    %s\n", _("control socket in the state directory [optional]"));
+  printf (" %s\n","--control-persist=SECONDS");
+  printf ("    %s\n", _("Keep a shared connection that long after the last check on it"));
+  printf ("    %s %d)\n", _("(implies --control-master, default:"), DEFAULT_CONTROL_PERSIST);
+  printf (" %s\n","--control-max-age=SECONDS");
+  printf ("    %s\n", _("Stop a shared connection that has been up that long, so that the next"));
+  printf ("    %s\n", _("check makes a new one (implies --control-master, default: never)"));
 	printf (UT_WARN_CRIT);
 	printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 	printf (UT_VERBOSE);
@@ -439,6 +796,9 @@ print_help (void)
   printf("\n");
   printf (" %s\n", _("To use passive mode, provide multiple '-C' options, and provide"));
   printf (" %s\n", _("all of -O, -s, and -n options (servicelist order must match '-C'options)"));
+  printf (" %s\n", _("In passive mode, -H may be repeated to run the commands on several hosts"));
+  printf (" %s\n", _("at once. Each -H takes the -n that follows it, and defaults to its own"));
+  printf (" %s\n", _("name. The results of each host are written with one write."));
   printf ("\n");
   printf ("%s\n", _("Examples:"));
   printf (" %s\n", "$ check_by_ssh -H localhost -n lh -s c1:c2:c3 -C uptime -C uptime -C uptime -O /tmp/foo");
@@ -459,6 +819,8 @@ print_usage (void)
 	printf (" %s -H <host> -C <command> [-fqv] [-1|-2] [-4|-6]\n"
 	        "       [-S [lines]] [-E [lines]] [-t timeout] [-i identity]\n"
 	        "       [-l user] [-n name] [-s servicelist] [-O outputfile]\n"
-	        "       [-p port] [-o ssh-option] [-F configfile]\n",
+	        "       [-p port] [-o ssh-option] [-F configfile]\n"
+	        "       [--control-master] [--control-persist=seconds]\n"
+	        "       [--control-max-age=seconds]\n",
 	        progname);
 }
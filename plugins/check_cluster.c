@@ -29,12 +29,17 @@ const char *email = "devel@nagios-plugins.org";
 #include "common.h"
 #include "utils.h"
 #include "utils_base.h"
+#include "netutils.h"	/* for UNIX_PATH_MAX */
 
 #define CHECK_SERVICES	1
 #define CHECK_HOSTS	2
 
 void print_help (void);
 void print_usage (void);
+void count_state (int);
+void read_status_file (void);
+void read_members (void);
+void read_livestatus (void);
 
 int total_services_ok=0;
 int total_services_warning=0;
@@ -53,6 +58,17 @@ int check_type=CHECK_SERVICES;
 char *data_vals=NULL;
 char *label=NULL;
 
+/* instead of -d, the states of the members of a group (or of all hosts
+ * or services) from Nagios itself */
+char *status_file=NULL;
+char *object_cache=NULL;
+char *livestatus=NULL;
+char *group=NULL;
+
+/* the hosts, or "host;service" for services, of the group, sorted */
+char **members=NULL;
+size_t member_count=0;
+
 int verbose=0;
 
 int process_arguments(int,char **);
@@ -65,10 +81,6 @@ int main(int argc, char **argv){
 	int return_code=STATE_OK;
 	thresholds *thresholds = NULL;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	/* Parse extra opts if any */
 	argv=np_extra_opts(&argc, argv, progname);
 
@@ -81,44 +93,22 @@ int main(int argc, char **argv){
 		print_thresholds("check_cluster", thresholds);
 
 	/* check the data values */
-	for(ptr=strtok(data_vals,",");ptr!=NULL;ptr=strtok(NULL,",")){
-
-		data_val=atoi(ptr);
-
-		if(check_type==CHECK_SERVICES){
-			switch(data_val){
-			case 0:
-				total_services_ok++;
-				break;
-			case 1:
-				total_services_warning++;
-				break;
-			case 2:
-				total_services_critical++;
-				break;
-			case 3:
-				total_services_unknown++;
-				break;
-			default:
-				break;
-		        }
-	        }
-		else{
-			switch(data_val){
-			case 0:
-				total_hosts_up++;
-				break;
-			case 1:
-				total_hosts_down++;
-				break;
-			case 2:
-				total_hosts_unreachable++;
-				break;
-			default:
-				break;
-		        }
-	        }
-        }
+	if(data_vals!=NULL){
+		for(ptr=strtok(data_vals,",");ptr!=NULL;ptr=strtok(NULL,",")){
+			data_val=atoi(ptr);
+			count_state(data_val);
+		}
+	}
+	else{
+		/* a socket or a file that does not answer should not hang us */
+		signal(SIGALRM, timeout_alarm_handler);
+		alarm(timeout_interval);
+		if(livestatus!=NULL)
+			read_livestatus();
+		else
+			read_status_file();
+		alarm(0);
+	}
 
 
 	/* return the status of the cluster */
@@ -141,11 +131,280 @@ int main(int argc, char **argv){
 
 
 
+void count_state(int data_val){
+
+	if(check_type==CHECK_SERVICES){
+		switch(data_val){
+		case 0:
+			total_services_ok++;
+			break;
+		case 1:
+			total_services_warning++;
+			break;
+		case 2:
+			total_services_critical++;
+			break;
+		case 3:
+			total_services_unknown++;
+			break;
+		default:
+			break;
+		}
+	}
+	else{
+		switch(data_val){
+		case 0:
+			total_hosts_up++;
+			break;
+		case 1:
+			total_hosts_down++;
+			break;
+		case 2:
+			total_hosts_unreachable++;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+
+
+/* reads a line into buf, throwing away what does not fit (the plugin
+ * output of long status entries); FALSE at the end of the file */
+static int read_line(FILE *fp, char *buf, size_t size){
+	size_t len;
+	int c;
+
+	if(fgets(buf, size, fp)==NULL)
+		return FALSE;
+	len=strlen(buf);
+	if(len>0 && buf[len-1]=='\n')
+		buf[--len]='\0';
+	else
+		while((c=getc(fp))!=EOF && c!='\n');
+	return TRUE;
+}
+
+static int compare_names(const void *a, const void *b){
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int is_member(const char *name){
+	if(group==NULL)
+		return TRUE;
+	return bsearch(&name, members, member_count, sizeof(char *), compare_names)!=NULL;
+}
+
+/* The members list of the host or service group in the object cache:
+ * "host1,host2" or "host1,service1,host2,service2" */
+void read_members(void){
+	char line[MAX_INPUT_BUFFER], *key, *value, *list=NULL, *p, *next;
+	const char *block=(check_type==CHECK_HOSTS)?"define hostgroup {":"define servicegroup {";
+	const char *name_key=(check_type==CHECK_HOSTS)?"hostgroup_name":"servicegroup_name";
+	int in_block=FALSE, found=FALSE;
+	FILE *fp;
+
+	if((fp=fopen(object_cache, "r"))==NULL)
+		die(STATE_UNKNOWN, _("CLUSTER UNKNOWN: Cannot open %s: %s\n"), object_cache, strerror(errno));
+
+	while(!found && read_line(fp, line, sizeof(line))){
+		if(!in_block){
+			in_block=!strcmp(line, block);
+			continue;
+		}
+		key=line+strspn(line, " \t");
+		if(!strcmp(key, "}")){
+			in_block=FALSE;
+			free(list);
+			list=NULL;
+			continue;
+		}
+		value=key+strcspn(key, " \t");
+		if(*value!='\0')
+			*value++='\0';
+		value+=strspn(value, " \t");
+		if(!strcmp(key, name_key) && !strcmp(value, group))
+			found=TRUE;
+		else if(!strcmp(key, "members"))
+			list=strdup(value);
+	}
+	/* the members may come after the name */
+	while(found && list==NULL && read_line(fp, line, sizeof(line))){
+		key=line+strspn(line, " \t");
+		if(!strcmp(key, "}"))
+			break;
+		if(!strncmp(key, "members", 7) && strchr(" \t", key[7]))
+			list=strdup(key+7+strspn(key+7, " \t"));
+	}
+	fclose(fp);
+
+	if(!found)
+		die(STATE_UNKNOWN, _("CLUSTER UNKNOWN: No group %s in %s\n"), group, object_cache);
+	if(list==NULL)
+		return;
+
+	for(p=list;p!=NULL;p=next){
+		if((next=strchr(p, ','))!=NULL)
+			*next++='\0';
+		/* "host,service" pairs become "host;service" */
+		if(check_type==CHECK_SERVICES && next!=NULL){
+			p[strlen(p)]=';';
+			if((next=strchr(next, ','))!=NULL)
+				*next++='\0';
+		}
+		members=realloc(members, (member_count+1)*sizeof(char *));
+		if(members==NULL)
+			die(STATE_UNKNOWN, _("Could not allocate memory\n"));
+		members[member_count++]=p;
+	}
+	qsort(members, member_count, sizeof(char *), compare_names);
+	if(verbose)
+		printf(_("%lu members in group %s\n"), (unsigned long)member_count, group);
+}
+
+/* One pass over status.dat, counting the current state of each host or
+ * service entry of the group as it goes by */
+void read_status_file(void){
+	char line[MAX_INPUT_BUFFER], *value, *p;
+	char host[MAX_INPUT_BUFFER], service[MAX_INPUT_BUFFER], *name=NULL;
+	const char *block=(check_type==CHECK_HOSTS)?"hoststatus {":"servicestatus {";
+	int in_block=FALSE, state=-1;
+	FILE *fp;
+
+	if(group!=NULL){
+		if(object_cache==NULL){
+			object_cache=strdup(status_file);
+			if((p=strrchr(object_cache, '/'))!=NULL)
+				p[1]='\0';
+			else
+				object_cache[0]='\0';
+			xasprintf(&object_cache, "%sobjects.cache", object_cache);
+		}
+		read_members();
+	}
+
+	if((fp=fopen(status_file, "r"))==NULL)
+		die(STATE_UNKNOWN, _("CLUSTER UNKNOWN: Cannot open %s: %s\n"), status_file, strerror(errno));
+
+	while(read_line(fp, line, sizeof(line))){
+		if(!in_block){
+			if(!strcmp(line, block)){
+				in_block=TRUE;
+				host[0]=service[0]='\0';
+				state=-1;
+			}
+			continue;
+		}
+		p=line+strspn(line, " \t");
+		if(!strcmp(p, "}")){
+			in_block=FALSE;
+			if(check_type==CHECK_HOSTS)
+				name=host;
+			else
+				xasprintf(&name, "%s;%s", host, service);
+			if(state>=0 && is_member(name))
+				count_state(state);
+			if(check_type==CHECK_SERVICES)
+				free(name);
+			continue;
+		}
+		if((value=strchr(p, '='))==NULL)
+			continue;
+		*value++='\0';
+		if(!strcmp(p, "host_name"))
+			snprintf(host, sizeof(host), "%s", value);
+		else if(!strcmp(p, "service_description"))
+			snprintf(service, sizeof(service), "%s", value);
+		else if(!strcmp(p, "current_state"))
+			state=atoi(value);
+	}
+	fclose(fp);
+}
+
+/* Ask livestatus for the counts of each state, which it works out
+ * itself */
+void read_livestatus(void){
+#ifdef HAVE_SYS_UN_H
+	struct sockaddr_un su;
+	char *query=NULL, reply[MAX_INPUT_BUFFER], *body;
+	size_t len=0, sent=0;
+	ssize_t n;
+	int sd, status, counts[4]={0, 0, 0, 0};
+
+	if(group!=NULL && strpbrk(group, "\r\n"))
+		die(STATE_UNKNOWN, _("CLUSTER UNKNOWN: Invalid group name\n"));
+	xasprintf(&query, "GET %s\n", (check_type==CHECK_HOSTS)?"hosts":"services");
+	if(group!=NULL)
+		xasprintf(&query, "%sFilter: groups >= %s\n", query, group);
+	xasprintf(&query, "%sStats: state = 0\nStats: state = 1\nStats: state = 2\n%s"
+	          "ResponseHeader: fixed16\n\n", query,
+	          (check_type==CHECK_HOSTS)?"":"Stats: state = 3\n");
+	if(verbose)
+		printf("%s", query);
+
+	if(strlen(livestatus)>=UNIX_PATH_MAX)
+		die(STATE_UNKNOWN, _("Supplied path too long unix domain socket"));
+	memset(&su, 0, sizeof(su));
+	su.sun_family=AF_UNIX;
+	strncpy(su.sun_path, livestatus, UNIX_PATH_MAX);
+	if((sd=socket(PF_UNIX, SOCK_STREAM, 0))<0 || connect(sd, (struct sockaddr *)&su, sizeof(su))<0)
+		die(STATE_UNKNOWN, _("CLUSTER UNKNOWN: Cannot connect to %s: %s\n"), livestatus, strerror(errno));
+
+	while(sent<strlen(query)){
+		if((n=write(sd, query+sent, strlen(query)-sent))<0)
+			die(STATE_UNKNOWN, _("CLUSTER UNKNOWN: Cannot send to %s: %s\n"), livestatus, strerror(errno));
+		sent+=n;
+	}
+	shutdown(sd, SHUT_WR);
+	while(len<sizeof(reply)-1 && (n=read(sd, reply+len, sizeof(reply)-1-len))>0)
+		len+=n;
+	reply[len]='\0';
+	close(sd);
+
+	/* "200          8\n" and the counts, "12;0;1;0" */
+	if(len<16 || sscanf(reply, "%d", &status)!=1)
+		die(STATE_UNKNOWN, _("CLUSTER UNKNOWN: Invalid reply from %s\n"), livestatus);
+	body=reply+16;
+	strip(body);
+	if(status!=200)
+		die(STATE_UNKNOWN, _("CLUSTER UNKNOWN: Livestatus error %d: %s\n"), status, body);
+	if(verbose)
+		printf("%s\n", body);
+	if(sscanf(body, "%d;%d;%d;%d", &counts[0], &counts[1], &counts[2], &counts[3])<3)
+		die(STATE_UNKNOWN, _("CLUSTER UNKNOWN: Invalid reply from %s\n"), livestatus);
+
+	if(check_type==CHECK_SERVICES){
+		total_services_ok=counts[0];
+		total_services_warning=counts[1];
+		total_services_critical=counts[2];
+		total_services_unknown=counts[3];
+	}
+	else{
+		total_hosts_up=counts[0];
+		total_hosts_down=counts[1];
+		total_hosts_unreachable=counts[2];
+	}
+#else
+	die(STATE_UNKNOWN, "%s\n", _("Unix sockets are not supported on this system"));
+#endif
+}
+
+
+
 int process_arguments(int argc, char **argv){
 	int c;
 	int option=0;
+	enum {
+		OBJECT_CACHE = CHAR_MAX + 1
+	};
 	static struct option longopts[]={
 		{"data",     required_argument,0,'d'},
+		{"status-file", required_argument,0,'f'},
+		{"object-cache", required_argument,0,OBJECT_CACHE},
+		{"livestatus", required_argument,0,'L'},
+		{"group",    required_argument,0,'g'},
+		{"timeout",  required_argument,0,'t'},
 		{"warning",  required_argument,0,'w'},
 		{"critical", required_argument,0,'c'},
 		{"label",    required_argument,0,'l'},
@@ -163,7 +422,7 @@ int process_arguments(int argc, char **argv){
 
 	while(1){
 
-		c=getopt_long(argc,argv,"hHsvVw:c:d:l:",longopts,&option);
+		c=getopt_long(argc,argv,"hHsvVw:c:d:l:f:L:g:t:",longopts,&option);
 
 		if(c==-1 || c==EOF || c==1)
 			break;
@@ -190,6 +449,26 @@ int process_arguments(int argc, char **argv){
 			data_vals=(char *)strdup(optarg);
 			break;
 
+		case 'f': /* status.dat */
+			status_file=optarg;
+			break;
+
+		case OBJECT_CACHE: /* objects.cache, for the groups */
+			object_cache=optarg;
+			break;
+
+		case 'L': /* livestatus socket */
+			livestatus=optarg;
+			break;
+
+		case 'g': /* host or service group */
+			group=optarg;
+			break;
+
+		case 't': /* timeout */
+			timeout_interval=parse_timeout_string(optarg);
+			break;
+
 		case 'l': /* text label */
 			label=(char *)strdup(optarg);
 			break;
@@ -214,7 +493,7 @@ int process_arguments(int argc, char **argv){
 	        }
 	}
 
-	if(data_vals==NULL)
+	if((data_vals!=NULL)+(status_file!=NULL)+(livestatus!=NULL)!=1)
 		return ERROR;
 
 	return OK;
@@ -250,6 +529,17 @@ print_help(void)
 	printf (" %s\n", "-d, --data=LIST");
 	printf ("    %s\n", _("The status codes of the hosts or services in the cluster, separated by"));
 	printf ("    %s\n", _("commas"));
+	printf (" %s\n", "-f, --status-file=FILE");
+	printf ("    %s\n", _("Count the current states in the status.dat file of Nagios instead"));
+	printf (" %s\n", "--object-cache=FILE");
+	printf ("    %s\n", _("The objects.cache file with the groups for -g and -f (default: the one"));
+	printf ("    %s\n", _("in the directory of the status file)"));
+	printf (" %s\n", "-L, --livestatus=SOCKET");
+	printf ("    %s\n", _("Ask the livestatus socket for the counts of each state instead"));
+	printf (" %s\n", "-g, --group=NAME");
+	printf ("    %s\n", _("With -f or -L, only the members of this host group (with -h) or"));
+	printf ("    %s\n", _("service group (with -s); all hosts or services otherwise"));
+	printf (UT_PLUG_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
 	printf(UT_VERBOSE);
 
@@ -272,7 +562,8 @@ print_usage(void)
 {
 
 	printf("%s\n", _("Usage:"));
-	printf(" %s (-s | -h) -d val1[,val2,...,valn] [-l label]\n", progname);
+	printf(" %s (-s | -h) (-d val1[,val2,...,valn] | -f status.dat | -L socket)\n", progname);
+	printf("[-g group] [--object-cache=file] [-t timeout] [-l label]\n");
 	printf("[-w threshold] [-c threshold] [-v] [--help]\n");
 
 }
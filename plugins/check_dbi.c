@@ -37,6 +37,7 @@ const char *email = "devel@nagios-plugins.org";
 #include "utils.h"
 #include "netutils.h"
 #include "regex.h"
+#include "resident.h"
 
 /* required for NAN */
 #ifndef _ISOC99_SOURCE
@@ -65,27 +66,47 @@ typedef struct {
 	char *value;
 } driver_option_t;
 
-char *host = NULL;
-int verbose = 0;
+/* defaults are set in reset_state() so resident mode can restore them */
+char *host;
+int verbose;
 
-char *warning_range = NULL;
-char *critical_range = NULL;
-thresholds *dbi_thresholds = NULL;
+char *warning_range;
+char *critical_range;
+thresholds *dbi_thresholds;
 
-char *expect = NULL;
+char *expect;
 
 regex_t expect_re;
-char *expect_re_str = NULL;
-int expect_re_cflags = 0;
+char *expect_re_str;
+int expect_re_cflags;
 
-np_dbi_metric_t metric = METRIC_QUERY_RESULT;
-np_dbi_type_t type = TYPE_NUMERIC;
+np_dbi_metric_t metric;
+np_dbi_type_t type;
 
-char *np_dbi_driver = NULL;
-driver_option_t *np_dbi_options = NULL;
-int np_dbi_options_num = 0;
-char *np_dbi_database = NULL;
-char *np_dbi_query = NULL;
+char *np_dbi_driver;
+driver_option_t *np_dbi_options;
+int np_dbi_options_num;
+char *np_dbi_database;
+char *np_dbi_query;
+
+/* one -q, with the -n, -m, -w and -c that follow it */
+typedef struct {
+	char *name;
+	char *sql;
+	int metric;               /* np_dbi_metric_t, -1 for that of the check */
+	char *warning;
+	char *critical;
+	thresholds *thresholds;
+	int state;
+	double value;
+	double time;              /* < 0 if the query failed */
+	char *msg;
+} named_query_t;
+
+named_query_t *queries;
+int query_count;
+/* the errors of the query being run, with several -q */
+char *query_errors;
 
 int process_arguments (int, char **);
 int validate_arguments (void);
@@ -95,12 +116,72 @@ void print_help (void);
 double timediff (struct timeval, struct timeval);
 
 void np_dbi_print_error (dbi_conn, char *, ...);
+void np_dbi_query_error (dbi_conn, int, char *, ...);
+
+int do_query (dbi_conn, const char *, np_dbi_metric_t, const char **, double *, double *);
+int check_queries (dbi_conn, double, unsigned int, int);
+dbi_conn connect_db (dbi_driver);
+char *pool_key (void);
+static void close_connection (dbi_conn);
+
+static int run_check (int, char **);
+static void reset_state (void);
+
+/* connections kept between the checks of a resident worker; without an
+ * alive() as dbi_conn_ping() lets some drivers reconnect in place, which
+ * would lose the database selected with -D */
+static int
+pool_fd (void *conn)
+{
+	return dbi_conn_get_socket (conn);
+}
 
-int do_query (dbi_conn, const char **, double *, double *);
+static void
+pool_close (void *conn)
+{
+	dbi_conn_close (conn);
+}
+
+static const np_pool_ops pool_ops = { pool_fd, NULL, pool_close };
 
 int
 main (int argc, char **argv)
 {
+	if (np_resident_requested (argc, argv))
+		return np_resident_main (argc, argv, run_check, reset_state);
+
+	reset_state ();
+	return run_check (argc, argv);
+}
+
+static void
+reset_state (void)
+{
+	host = NULL;
+	verbose = 0;
+	warning_range = NULL;
+	critical_range = NULL;
+	dbi_thresholds = NULL;
+	expect = NULL;
+	expect_re_str = NULL;
+	expect_re_cflags = 0;
+	metric = METRIC_QUERY_RESULT;
+	type = TYPE_NUMERIC;
+	np_dbi_driver = NULL;
+	np_dbi_options = NULL;
+	np_dbi_options_num = 0;
+	np_dbi_database = NULL;
+	np_dbi_query = NULL;
+	queries = NULL;
+	query_count = 0;
+	query_errors = NULL;
+}
+
+static int
+run_check (int argc, char **argv)
+{
+	/* once per process, a resident worker's connections depend on it */
+	static int initialized = FALSE;
 	int status = STATE_UNKNOWN;
 
 	dbi_driver driver;
@@ -115,11 +196,8 @@ main (int argc, char **argv)
 	const char *query_val_str = NULL;
 	double query_val = 0.0;
 
-	int i;
-
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	char *key;
+	int reused = FALSE;
 
 	/* Parse extra opts if any */
 	argv = np_extra_opts (&argc, argv, progname);
@@ -136,9 +214,12 @@ main (int argc, char **argv)
 	if (verbose > 2)
 		printf ("Initializing DBI\n");
 
-	if (dbi_initialize (NULL) < 0) {
-		printf ("UNKNOWN - failed to initialize DBI; possibly you don't have any drivers installed.\n");
-		return STATE_UNKNOWN;
+	if (! initialized) {
+		if (dbi_initialize (NULL) < 0) {
+			printf ("UNKNOWN - failed to initialize DBI; possibly you don't have any drivers installed.\n");
+			return STATE_UNKNOWN;
+		}
+		initialized = TRUE;
 	}
 
 	if (verbose)
@@ -156,64 +237,17 @@ main (int argc, char **argv)
 		return STATE_UNKNOWN;
 	}
 
-	/* make a connection to the database */
+	/* make a connection to the database, unless a resident worker kept
+	 * one from an earlier check */
+	key = pool_key ();
 	gettimeofday (&start_timeval, NULL);
-
-	conn = dbi_conn_open (driver);
-	if (! conn) {
-		printf ("UNKNOWN - failed top open connection object.\n");
-		dbi_conn_close (conn);
-		return STATE_UNKNOWN;
+	if ((conn = np_pool_get (key, &pool_ops)) != NULL) {
+		reused = TRUE;
+		if (verbose)
+			printf ("Reusing the connection of an earlier check\n");
 	}
-
-	for (i = 0; i < np_dbi_options_num; ++i) {
-		const char *opt;
-
-		if (verbose > 1)
-			printf ("Setting DBI driver option '%s' to '%s'\n",
-					np_dbi_options[i].key, np_dbi_options[i].value);
-
-		if (! dbi_conn_set_option (conn, np_dbi_options[i].key, np_dbi_options[i].value))
-			continue;
-		/* else: status != 0 */
-
-		np_dbi_print_error (conn, "UNKNOWN - failed to set option '%s' to '%s'",
-				np_dbi_options[i].key, np_dbi_options[i].value);
-		printf ("Known driver options:\n");
-
-		for (opt = dbi_conn_get_option_list (conn, NULL); opt;
-				opt = dbi_conn_get_option_list (conn, opt)) {
-			printf (" - %s\n", opt);
-		}
-		dbi_conn_close (conn);
+	else if ((conn = connect_db (driver)) == NULL)
 		return STATE_UNKNOWN;
-	}
-
-	if (host) {
-		if (verbose > 1)
-			printf ("Setting DBI driver option 'host' to '%s'\n", host);
-		dbi_conn_set_option (conn, "host", host);
-	}
-
-	if (verbose) {
-		const char *dbname, *host;
-
-		dbname = dbi_conn_get_option (conn, "dbname");
-		host = dbi_conn_get_option (conn, "host");
-
-		if (! dbname)
-			dbname = "<unspecified>";
-		if (! host)
-			host = "<unspecified>";
-
-		printf ("Connecting to database '%s' at host '%s'\n",
-				dbname, host);
-	}
-
-	if (dbi_conn_connect (conn) < 0) {
-		np_dbi_print_error (conn, "UNKNOWN - failed to connect to database");
-		return STATE_UNKNOWN;
-	}
 
 	gettimeofday (&end_timeval, NULL);
 	conn_time = timediff (start_timeval, end_timeval);
@@ -231,8 +265,8 @@ main (int argc, char **argv)
 	if (metric == METRIC_CONN_TIME)
 		status = get_status (conn_time, dbi_thresholds);
 
-	/* select a database */
-	if (np_dbi_database) {
+	/* select a database, which a kept connection has already done */
+	if (np_dbi_database && ! reused) {
 		if (verbose > 1)
 			printf ("Selecting database '%s'\n", np_dbi_database);
 
@@ -242,10 +276,17 @@ main (int argc, char **argv)
 			return STATE_UNKNOWN;
 		}
 	}
+	if (! reused)
+		np_pool_add (key, conn, &pool_ops);
+
+	if (query_count > 1)
+		return check_queries (conn, conn_time, server_version,
+				((metric == METRIC_CONN_TIME) || (metric == METRIC_SERVER_VERSION))
+					? status : STATE_OK);
 
 	if (np_dbi_query) {
 		/* execute query */
-		status = do_query (conn, &query_val_str, &query_val, &query_time);
+		status = do_query (conn, np_dbi_query, metric, &query_val_str, &query_val, &query_time);
 		if (status != STATE_OK)
 			/* do_query prints an error message in this case */
 			return status;
@@ -280,9 +321,7 @@ main (int argc, char **argv)
 			status = get_status (query_time, dbi_thresholds);
 	}
 
-	if (verbose)
-		printf("Closing connection\n");
-	dbi_conn_close (conn);
+	close_connection (conn);
 
 	/* In case of METRIC_QUERY_RESULT, isnan(query_val) indicates an error
 	 * which should have been reported and handled (abort) before
@@ -348,12 +387,13 @@ process_arguments (int argc, char **argv)
 		{"driver", required_argument, 0, 'd'},
 		{"option", required_argument, 0, 'o'},
 		{"query", required_argument, 0, 'q'},
+		{"query-name", required_argument, 0, 'n'},
 		{"database", required_argument, 0, 'D'},
 		{0, 0, 0, 0}
 	};
 
 	while (1) {
-		c = getopt_long (argc, argv, "Vvht:c:w:e:r:R:m:H:d:o:q:D:",
+		c = getopt_long (argc, argv, "Vvht:c:w:e:r:R:m:H:d:o:q:n:D:",
 				longopts, &option);
 
 		if (c == EOF)
@@ -364,17 +404,25 @@ process_arguments (int argc, char **argv)
 			usage5 ();
 		case 'h':     /* help */
 			print_help ();
-			exit (STATE_OK);
+			np_exit (STATE_OK);
 		case 'V':     /* version */
 			print_revision (progname, NP_VERSION);
-			exit (STATE_OK);
+			np_exit (STATE_OK);
 
+		/* before the first -q these apply to every query, after it to the
+		 * last one */
 		case 'c':     /* critical range */
-			critical_range = optarg;
+			if (query_count > 0)
+				queries[query_count - 1].critical = optarg;
+			else
+				critical_range = optarg;
 			type = TYPE_NUMERIC;
 			break;
 		case 'w':     /* warning range */
-			warning_range = optarg;
+			if (query_count > 0)
+				queries[query_count - 1].warning = optarg;
+			else
+				warning_range = optarg;
 			type = TYPE_NUMERIC;
 			break;
 		case 'e':
@@ -404,17 +452,26 @@ process_arguments (int argc, char **argv)
 			}
 
 		case 'm':
-			if (! strcasecmp (optarg, "CONN_TIME"))
-				metric = METRIC_CONN_TIME;
-			else if (! strcasecmp (optarg, "SERVER_VERSION"))
-				metric = METRIC_SERVER_VERSION;
-			else if (! strcasecmp (optarg, "QUERY_RESULT"))
-				metric = METRIC_QUERY_RESULT;
-			else if (! strcasecmp (optarg, "QUERY_TIME"))
-				metric = METRIC_QUERY_TIME;
-			else
-				usage2 (_("Invalid metric"), optarg);
-			break;
+			{
+				np_dbi_metric_t m;
+
+				if (! strcasecmp (optarg, "CONN_TIME"))
+					m = METRIC_CONN_TIME;
+				else if (! strcasecmp (optarg, "SERVER_VERSION"))
+					m = METRIC_SERVER_VERSION;
+				else if (! strcasecmp (optarg, "QUERY_RESULT"))
+					m = METRIC_QUERY_RESULT;
+				else if (! strcasecmp (optarg, "QUERY_TIME"))
+					m = METRIC_QUERY_TIME;
+				else
+					usage2 (_("Invalid metric"), optarg);
+
+				if (query_count > 0)
+					queries[query_count - 1].metric = m;
+				else
+					metric = m;
+				break;
+			}
 		case 't':     /* timeout */
 			timeout_interval = parse_timeout_string(optarg);
 			break;
@@ -451,7 +508,7 @@ process_arguments (int argc, char **argv)
 						(np_dbi_options_num + 1) * sizeof (*new));
 				if (! new) {
 					printf ("UNKNOWN - failed to reallocate memory\n");
-					exit (STATE_UNKNOWN);
+					np_exit (STATE_UNKNOWN);
 				}
 
 				np_dbi_options = new;
@@ -464,6 +521,21 @@ process_arguments (int argc, char **argv)
 			break;
 		case 'q':
 			np_dbi_query = optarg;
+			queries = realloc (queries, (query_count + 1) * sizeof (*queries));
+			if (! queries) {
+				printf ("UNKNOWN - failed to reallocate memory\n");
+				np_exit (STATE_UNKNOWN);
+			}
+			memset (&queries[query_count], 0, sizeof (*queries));
+			queries[query_count].sql = optarg;
+			queries[query_count].metric = -1;
+			xasprintf (&queries[query_count].name, "query%d", query_count + 1);
+			++query_count;
+			break;
+		case 'n':
+			if (query_count == 0)
+				usage2 (_("A query name must follow its query"), optarg);
+			queries[query_count - 1].name = optarg;
 			break;
 		case 'D':
 			np_dbi_database = optarg;
@@ -471,6 +543,28 @@ process_arguments (int argc, char **argv)
 		}
 	}
 
+	/* a single -q is the check's own, whatever follows it */
+	if (query_count == 1) {
+		if (queries[0].metric >= 0)
+			metric = queries[0].metric;
+		if (queries[0].warning)
+			warning_range = queries[0].warning;
+		if (queries[0].critical)
+			critical_range = queries[0].critical;
+	}
+	for (c = 0; c < query_count; ++c) {
+		named_query_t *q = queries + c;
+		int inherit = (metric == METRIC_QUERY_RESULT) || (metric == METRIC_QUERY_TIME);
+
+		if (q->metric < 0)
+			q->metric = inherit ? metric : METRIC_QUERY_RESULT;
+		if (inherit && ! q->warning)
+			q->warning = warning_range;
+		if (inherit && ! q->critical)
+			q->critical = critical_range;
+		set_thresholds (&q->thresholds, q->warning, q->critical);
+	}
+
 	set_thresholds (&dbi_thresholds, warning_range, critical_range);
 
 	return validate_arguments ();
@@ -504,6 +598,18 @@ validate_arguments ()
 	if (expect_re_str && (metric != METRIC_QUERY_RESULT))
 		usage ("Options -r/-R require metric QUERY_RESULT");
 
+	if ((query_count > 1) && (expect || expect_re_str))
+		usage ("Options -e/-r/-R take a single query");
+
+	if (query_count > 1) {
+		int i;
+
+		for (i = 0; i < query_count; ++i)
+			if ((queries[i].metric != METRIC_QUERY_RESULT)
+					&& (queries[i].metric != METRIC_QUERY_TIME))
+				usage ("The metric of a query must be QUERY_RESULT or QUERY_TIME");
+	}
+
 	return OK;
 }
 
@@ -535,7 +641,9 @@ print_help (void)
 	printf (" %s\n", "-o, --option=STRING");
 	printf ("    %s\n", _("DBI driver options"));
 	printf (" %s\n", "-q, --query=STRING");
-	printf ("    %s\n", _("query to execute"));
+	printf ("    %s\n", _("query to execute; may be given more than once, see below"));
+	printf (" %s\n", "-n, --query-name=STRING");
+	printf ("    %s\n", _("name of the -q before it in the output (default: query1, query2, ...)"));
 	printf ("\n");
 
 	printf (UT_WARN_CRIT_RANGE);
@@ -574,6 +682,12 @@ print_help (void)
 	printf (" %s\n", _("driver. See its documentation at http://libdbi-drivers.sourceforge.net/"));
 	printf (" %s\n\n", _("for details."));
 
+	printf (" %s\n", _("Several -q are all run over the one connection. The -m, -w and -c after a"));
+	printf (" %s\n", _("-q (QUERY_RESULT or QUERY_TIME) apply to it alone, those before the first"));
+	printf (" %s\n", _("-q to every query, or to the connection for CONN_TIME and SERVER_VERSION."));
+	printf (" %s\n", _("A summary is printed with a line for each query after it. -e, -r and -R"));
+	printf (" %s\n\n", _("take a single query."));
+
 	printf (" %s\n", _("Examples:"));
 	printf ("  check_dbi -d pgsql -o username=postgres -m QUERY_RESULT \\\n");
 	printf ("    -q 'SELECT COUNT(*) FROM pg_stat_activity' -w 5 -c 10\n");
@@ -607,31 +721,31 @@ void
 print_usage (void)
 {
 	printf ("%s\n", _("Usage:"));
-	printf ("%s -d <DBI driver> [-o <DBI driver option> [...]] [-q <query>]\n", progname);
+	printf ("%s -d <DBI driver> [-o <DBI driver option> [...]] [-q <query> [-n <name>]]\n", progname);
 	printf (" [-H <host>] [-c <critical range>] [-w <warning range>] [-m <metric>]\n");
 	printf (" [-e <string>] [-r|-R <regex>]\n");
 }
 
 #define CHECK_IGNORE_ERROR(s) \
 	do { \
-		if (metric != METRIC_QUERY_RESULT) \
+		if (query_metric != METRIC_QUERY_RESULT) \
 			return (s); \
 	} while (0)
 
 const char *
-get_field_str (dbi_conn conn, dbi_result res, unsigned short field_type)
+get_field_str (dbi_conn conn, dbi_result res, unsigned short field_type, np_dbi_metric_t query_metric)
 {
 	const char *str;
 
 	if (field_type != DBI_TYPE_STRING) {
-		printf ("CRITICAL - result value is not a string\n");
+		np_dbi_query_error (NULL, STATE_CRITICAL, "result value is not a string");
 		return NULL;
 	}
 
 	str = dbi_result_get_string_idx (res, 1);
 	if ((! str) || (strcmp (str, "ERROR") == 0)) {
 		CHECK_IGNORE_ERROR (NULL);
-		np_dbi_print_error (conn, "CRITICAL - failed to fetch string value");
+		np_dbi_query_error (conn, STATE_CRITICAL, "failed to fetch string value");
 		return NULL;
 	}
 
@@ -641,7 +755,7 @@ get_field_str (dbi_conn conn, dbi_result res, unsigned short field_type)
 }
 
 double
-get_field (dbi_conn conn, dbi_result res, unsigned short *field_type)
+get_field (dbi_conn conn, dbi_result res, unsigned short *field_type, np_dbi_metric_t query_metric)
 {
 	double val = NAN;
 
@@ -655,7 +769,7 @@ get_field (dbi_conn conn, dbi_result res, unsigned short *field_type)
 		const char *val_str;
 		char *endptr = NULL;
 
-		val_str = get_field_str (conn, res, *field_type);
+		val_str = get_field_str (conn, res, *field_type, query_metric);
 		if (! val_str) {
 			CHECK_IGNORE_ERROR (NAN);
 			*field_type = DBI_TYPE_ERROR;
@@ -665,7 +779,7 @@ get_field (dbi_conn conn, dbi_result res, unsigned short *field_type)
 		val = strtod (val_str, &endptr);
 		if (endptr == val_str) {
 			CHECK_IGNORE_ERROR (NAN);
-			printf ("CRITICAL - result value is not a numeric: %s\n", val_str);
+			np_dbi_query_error (NULL, STATE_CRITICAL, "result value is not a numeric: %s", val_str);
 			*field_type = DBI_TYPE_ERROR;
 			return NAN;
 		}
@@ -676,7 +790,7 @@ get_field (dbi_conn conn, dbi_result res, unsigned short *field_type)
 	}
 	else {
 		CHECK_IGNORE_ERROR (NAN);
-		printf ("CRITICAL - cannot parse value of type %s (%i)\n",
+		np_dbi_query_error (NULL, STATE_CRITICAL, "cannot parse value of type %s (%i)",
 				(*field_type == DBI_TYPE_BINARY)
 					? "BINARY"
 					: (*field_type == DBI_TYPE_DATETIME)
@@ -690,38 +804,39 @@ get_field (dbi_conn conn, dbi_result res, unsigned short *field_type)
 }
 
 double
-get_query_result (dbi_conn conn, dbi_result res, const char **res_val_str, double *res_val)
+get_query_result (dbi_conn conn, dbi_result res, np_dbi_metric_t query_metric,
+		const char **res_val_str, double *res_val)
 {
 	unsigned short field_type;
 	double val = NAN;
 
 	if (dbi_result_get_numrows (res) == DBI_ROW_ERROR) {
 		CHECK_IGNORE_ERROR (STATE_OK);
-		np_dbi_print_error (conn, "CRITICAL - failed to fetch rows");
+		np_dbi_query_error (conn, STATE_CRITICAL, "failed to fetch rows");
 		return STATE_CRITICAL;
 	}
 
 	if (dbi_result_get_numrows (res) < 1) {
 		CHECK_IGNORE_ERROR (STATE_OK);
-		printf ("WARNING - no rows returned\n");
+		np_dbi_query_error (NULL, STATE_WARNING, "no rows returned");
 		return STATE_WARNING;
 	}
 
 	if (dbi_result_get_numfields (res) == DBI_FIELD_ERROR) {
 		CHECK_IGNORE_ERROR (STATE_OK);
-		np_dbi_print_error (conn, "CRITICAL - failed to fetch fields");
+		np_dbi_query_error (conn, STATE_CRITICAL, "failed to fetch fields");
 		return STATE_CRITICAL;
 	}
 
 	if (dbi_result_get_numfields (res) < 1) {
 		CHECK_IGNORE_ERROR (STATE_OK);
-		printf ("WARNING - no fields returned\n");
+		np_dbi_query_error (NULL, STATE_WARNING, "no fields returned");
 		return STATE_WARNING;
 	}
 
 	if (dbi_result_first_row (res) != 1) {
 		CHECK_IGNORE_ERROR (STATE_OK);
-		np_dbi_print_error (conn, "CRITICAL - failed to fetch first row");
+		np_dbi_query_error (conn, STATE_CRITICAL, "failed to fetch first row");
 		return STATE_CRITICAL;
 	}
 
@@ -729,16 +844,16 @@ get_query_result (dbi_conn conn, dbi_result res, const char **res_val_str, doubl
 	if (field_type != DBI_TYPE_ERROR) {
 		if (type == TYPE_STRING)
 			/* the value will be freed in dbi_result_free */
-			*res_val_str = strdup (get_field_str (conn, res, field_type));
+			*res_val_str = strdup (get_field_str (conn, res, field_type, query_metric));
 		else
-			val = get_field (conn, res, &field_type);
+			val = get_field (conn, res, &field_type, query_metric);
 	}
 
 	*res_val = val;
 
 	if (field_type == DBI_TYPE_ERROR) {
 		CHECK_IGNORE_ERROR (STATE_OK);
-		np_dbi_print_error (conn, "CRITICAL - failed to fetch data");
+		np_dbi_query_error (conn, STATE_CRITICAL, "failed to fetch data");
 		return STATE_CRITICAL;
 	}
 
@@ -749,27 +864,28 @@ get_query_result (dbi_conn conn, dbi_result res, const char **res_val_str, doubl
 #undef CHECK_IGNORE_ERROR
 
 int
-do_query (dbi_conn conn, const char **res_val_str, double *res_val, double *res_time)
+do_query (dbi_conn conn, const char *query, np_dbi_metric_t query_metric,
+		const char **res_val_str, double *res_val, double *res_time)
 {
 	dbi_result res;
 
 	struct timeval timeval_start, timeval_end;
 	int status = STATE_OK;
 
-	assert (np_dbi_query);
+	assert (query);
 
 	if (verbose)
-		printf ("Executing query '%s'\n", np_dbi_query);
+		printf ("Executing query '%s'\n", query);
 
 	gettimeofday (&timeval_start, NULL);
 
-	res = dbi_conn_query (conn, np_dbi_query);
+	res = dbi_conn_query (conn, query);
 	if (! res) {
-		np_dbi_print_error (conn, "CRITICAL - failed to execute query '%s'", np_dbi_query);
+		np_dbi_query_error (conn, STATE_CRITICAL, "failed to execute query '%s'", query);
 		return STATE_CRITICAL;
 	}
 
-	status = get_query_result (conn, res, res_val_str, res_val);
+	status = get_query_result (conn, res, query_metric, res_val_str, res_val);
 
 	gettimeofday (&timeval_end, NULL);
 	*res_time = timediff (timeval_start, timeval_end);
@@ -780,6 +896,102 @@ do_query (dbi_conn conn, const char **res_val_str, double *res_val, double *res_
 	return status;
 }
 
+/* a new connection with the driver options, NULL once the error is
+ * printed */
+dbi_conn
+connect_db (dbi_driver driver)
+{
+	dbi_conn conn;
+	int i;
+
+	conn = dbi_conn_open (driver);
+	if (! conn) {
+		printf ("UNKNOWN - failed top open connection object.\n");
+		dbi_conn_close (conn);
+		return NULL;
+	}
+
+	for (i = 0; i < np_dbi_options_num; ++i) {
+		const char *opt;
+
+		if (verbose > 1)
+			printf ("Setting DBI driver option '%s' to '%s'\n",
+					np_dbi_options[i].key, np_dbi_options[i].value);
+
+		if (! dbi_conn_set_option (conn, np_dbi_options[i].key, np_dbi_options[i].value))
+			continue;
+		/* else: status != 0 */
+
+		np_dbi_print_error (conn, "UNKNOWN - failed to set option '%s' to '%s'",
+				np_dbi_options[i].key, np_dbi_options[i].value);
+		printf ("Known driver options:\n");
+
+		for (opt = dbi_conn_get_option_list (conn, NULL); opt;
+				opt = dbi_conn_get_option_list (conn, opt)) {
+			printf (" - %s\n", opt);
+		}
+		dbi_conn_close (conn);
+		return NULL;
+	}
+
+	if (host) {
+		if (verbose > 1)
+			printf ("Setting DBI driver option 'host' to '%s'\n", host);
+		dbi_conn_set_option (conn, "host", host);
+	}
+
+	if (verbose) {
+		const char *dbname, *host;
+
+		dbname = dbi_conn_get_option (conn, "dbname");
+		host = dbi_conn_get_option (conn, "host");
+
+		if (! dbname)
+			dbname = "<unspecified>";
+		if (! host)
+			host = "<unspecified>";
+
+		printf ("Connecting to database '%s' at host '%s'\n",
+				dbname, host);
+	}
+
+	if (dbi_conn_connect (conn) < 0) {
+		np_dbi_print_error (conn, "UNKNOWN - failed to connect to database");
+		return NULL;
+	}
+
+	return conn;
+}
+
+/* done with the connection; closed unless the pool keeps it */
+static void
+close_connection (dbi_conn conn)
+{
+	if (np_pool_release (conn)) {
+		if (verbose)
+			printf ("Keeping connection for the next check\n");
+	}
+	else {
+		if (verbose)
+			printf ("Closing connection\n");
+		dbi_conn_close (conn);
+	}
+}
+
+/* what selects and authenticates a connection */
+char *
+pool_key (void)
+{
+	char *key;
+	int i;
+
+	xasprintf (&key, "%s:%s:%s", np_dbi_driver, host ? host : "",
+			np_dbi_database ? np_dbi_database : "");
+	for (i = 0; i < np_dbi_options_num; ++i)
+		xasprintf (&key, "%s:%s=%s", key, np_dbi_options[i].key, np_dbi_options[i].value);
+	return key;
+}
+
 double
 timediff (struct timeval start, struct timeval end)
 {
@@ -809,3 +1021,95 @@ np_dbi_print_error (dbi_conn conn, char *fmt, ...)
 	va_end (ap);
 }
 
+
+/* errors of a query: printed as "STATE - message" with a single -q, kept
+ * for its line with several */
+void
+np_dbi_query_error (dbi_conn conn, int state, char *fmt, ...)
+{
+	const char *errmsg = NULL;
+	char *msg;
+	va_list ap;
+
+	va_start (ap, fmt);
+	if (vasprintf (&msg, fmt, ap) < 0)
+		die (STATE_UNKNOWN, "UNKNOWN - failed to allocate memory\n");
+	va_end (ap);
+
+	if (conn) {
+		dbi_conn_error (conn, &errmsg);
+		xasprintf (&msg, "%s: %s", msg, errmsg);
+	}
+
+	if (query_count > 1)
+		xasprintf (&query_errors, "%s%s%s", query_errors ? query_errors : "",
+				query_errors ? "; " : "", msg);
+	else
+		printf ("%s - %s\n", state_text (state), msg);
+	free (msg);
+}
+
+/* Runs every -q over the connection, checks each against its own metric
+ * and thresholds, and prints a summary and a line for each. status is
+ * that of the connection. */
+int
+check_queries (dbi_conn conn, double conn_time, unsigned int server_version, int status)
+{
+	char *problems = NULL;
+	int i, count_ok = 0;
+
+	for (i = 0; i < query_count; ++i) {
+		named_query_t *q = queries + i;
+		const char *val_str = NULL;
+
+		query_errors = NULL;
+		q->value = NAN;
+		q->time = -1.0;
+		q->state = do_query (conn, q->sql, q->metric, &val_str, &q->value, &q->time);
+		if (q->state == STATE_OK)
+			q->state = get_status ((q->metric == METRIC_QUERY_TIME) ? q->time : q->value,
+					q->thresholds);
+
+		if (query_errors)
+			q->msg = query_errors;
+		else if (isnan (q->value))
+			xasprintf (&q->msg, "'%s' query execution time: %fs", q->sql, q->time);
+		else
+			xasprintf (&q->msg, "'%s' returned %f in %fs", q->sql, q->value, q->time);
+
+		status = max_state (status, q->state);
+		if (q->state == STATE_OK)
+			++count_ok;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "",
+					problems ? "; " : "", q->name, q->msg);
+	}
+
+	close_connection (conn);
+
+	printf ("%s - connection time: %fs, %d of %d queries OK%s%s", state_text (status),
+			conn_time, count_ok, query_count, problems ? " - " : "", problems ? problems : "");
+	printf (" | conntime=%fs;%s;%s;0; server_version=%u;%s;%s;0;", conn_time,
+			((metric == METRIC_CONN_TIME) && warning_range) ? warning_range : "",
+			((metric == METRIC_CONN_TIME) && critical_range) ? critical_range : "",
+			server_version,
+			((metric == METRIC_SERVER_VERSION) && warning_range) ? warning_range : "",
+			((metric == METRIC_SERVER_VERSION) && critical_range) ? critical_range : "");
+	for (i = 0; i < query_count; ++i) {
+		named_query_t *q = queries + i;
+
+		if (! isnan (q->value))
+			printf (" %s=%f;%s;%s;;", q->name, q->value,
+					((q->metric == METRIC_QUERY_RESULT) && q->warning) ? q->warning : "",
+					((q->metric == METRIC_QUERY_RESULT) && q->critical) ? q->critical : "");
+		if (q->time >= 0)
+			printf (" %s_time=%fs;%s;%s;0;", q->name, q->time,
+					((q->metric == METRIC_QUERY_TIME) && q->warning) ? q->warning : "",
+					((q->metric == METRIC_QUERY_TIME) && q->critical) ? q->critical : "");
+	}
+	printf ("\n");
+
+	for (i = 0; i < query_count; ++i)
+		printf ("[%s] %s: %s\n", state_text (queries[i].state), queries[i].name, queries[i].msg);
+	return status;
+}
@@ -40,9 +40,16 @@ const char *email = "devel@nagios-plugins.org";
 #include "netutils.h"
 #include "utils.h"
 #include "runcmd.h"
+#include "utils_dns.h"
 
 int process_arguments (int, char **);
 int validate_arguments (void);
+int check_servers (void);
+static const char *parse_dig_args (void);
+static int lookup_native (char **);
+#ifdef PATH_TO_DIG
+static int lookup_dig (char **);
+#endif
 void print_help (void);
 void print_usage (void);
 
@@ -54,6 +61,8 @@ char *query_address = NULL;
 char *record_type = "A";
 char *expected_address = NULL;
 char *dns_server = NULL;
+char **servers = NULL;
+size_t server_count = 0;
 char *dig_args = "";
 char *query_transport = "";
 int verbose = FALSE;
@@ -62,23 +71,21 @@ int number_tries = DEFAULT_TRIES;
 double warning_interval = UNDEFINED;
 double critical_interval = UNDEFINED;
 struct timeval tv;
+int use_dig = FALSE;
+/* the query as the dig arguments make it */
+int query_class = NP_DNS_CLASS_IN;
+int query_flags = NP_DNS_RD;
+int query_options = 0;
+int edns_size = NP_DNS_EDNS_SIZE;
+int try_timeout = 0;
 
 int
 main (int argc, char **argv)
 {
-  char *command_line;
-  output chld_out, chld_err;
   char *msg = NULL;
-  size_t i;
-  char *t;
   long microsec;
   double elapsed_time;
   int result = STATE_UNKNOWN;
-  int timeout_interval_dig;
-
-  setlocale (LC_ALL, "");
-  bindtextdomain (PACKAGE, LOCALEDIR);
-  textdomain (PACKAGE);
 
   /* Set signal handling and alarm */
   if (signal (SIGALRM, runcmd_timeout_alarm_handler) == SIG_ERR)
@@ -90,18 +97,16 @@ main (int argc, char **argv)
   if (process_arguments (argc, argv) == ERROR)
     usage_va(_("Could not parse arguments"));
 
-  /* dig applies the timeout to each try, so we need to work around this */
-  timeout_interval_dig = ceil((double) timeout_interval / (double) number_tries);
-
-  /* get the command to run */
-  xasprintf (&command_line, "%s %s %s -p %d @%s %s %s +tries=%d +time=%d",
-  	PATH_TO_DIG, dig_args, query_transport, server_port, dns_server, query_address, record_type, number_tries, timeout_interval_dig);
+  /* several servers are asked at once and their answers compared */
+  if (server_count > 1) {
+    alarm (timeout_interval);
+    return check_servers ();
+  }
 
   alarm (timeout_interval);
   gettimeofday (&tv, NULL);
 
   if (verbose) {
-    printf ("%s\n", command_line);
     if(expected_address != NULL) {
       printf (_("Looking for: '%s'\n"), expected_address);
     } else {
@@ -109,10 +114,62 @@ main (int argc, char **argv)
     }
   }
 
+#ifdef PATH_TO_DIG
+  if (use_dig)
+    result = lookup_dig (&msg);
+  else
+#endif
+    result = lookup_native (&msg);
+
+  microsec = deltime (tv);
+  elapsed_time = (double)microsec / 1.0e6;
+
+  if (critical_interval > UNDEFINED && elapsed_time > critical_interval)
+    result = STATE_CRITICAL;
+
+  else if (warning_interval > UNDEFINED && elapsed_time > warning_interval)
+    result = STATE_WARNING;
+
+  printf ("DNS %s - %.3f seconds response time (%s)|%s\n",
+          state_text (result), elapsed_time,
+          msg ? msg : _("Probably a non-existent host/domain"),
+          fperfdata("time", elapsed_time, "s",
+                    (warning_interval>UNDEFINED?TRUE:FALSE),
+                    warning_interval,
+                    (critical_interval>UNDEFINED?TRUE:FALSE),
+            critical_interval,
+            TRUE, 0, FALSE, 0));
+  return result;
+}
+
+
+
+#ifdef PATH_TO_DIG
+/* the answer as dig prints it */
+static int
+lookup_dig (char **msg)
+{
+  char *command_line;
+  output chld_out, chld_err;
+  size_t i;
+  char *t;
+  int result = STATE_UNKNOWN;
+  int timeout_interval_dig;
+
+  /* dig applies the timeout to each try, so we need to work around this */
+  timeout_interval_dig = ceil((double) timeout_interval / (double) number_tries);
+
+  /* get the command to run */
+  xasprintf (&command_line, "%s %s %s -p %d @%s %s %s +tries=%d +time=%d",
+  	PATH_TO_DIG, dig_args, query_transport, server_port, dns_server, query_address, record_type, number_tries, timeout_interval_dig);
+
+  if (verbose)
+    printf ("%s\n", command_line);
+
   /* run the command */
   if(np_runcmd(command_line, &chld_out, &chld_err, 0) != 0) {
     result = STATE_WARNING;
-    msg = (char *)_("dig returned an error status");
+    *msg = (char *)_("dig returned an error status");
   }
 
   for(i = 0; i < chld_out.lines; i++) {
@@ -126,18 +183,18 @@ main (int argc, char **argv)
           printf ("%s\n", chld_out.line[i]);
 
         if (strcasestr (chld_out.line[i], (expected_address == NULL ? query_address : expected_address)) != NULL) {
-          msg = chld_out.line[i];
+          *msg = chld_out.line[i];
           result = STATE_OK;
 
           /* Translate output TAB -> SPACE */
-          t = msg;
+          t = *msg;
           while ((t = strchr(t, '\t')) != NULL) *t = ' ';
           break;
         }
       }
 
       if (result == STATE_UNKNOWN) {
-        msg = (char *)_("Server not found in ANSWER SECTION");
+        *msg = (char *)_("Server not found in ANSWER SECTION");
         result = STATE_WARNING;
       }
 
@@ -147,40 +204,385 @@ main (int argc, char **argv)
   }
 
   if (result == STATE_UNKNOWN) {
-    msg = (char *)_("No ANSWER SECTION found");
+    *msg = (char *)_("No ANSWER SECTION found");
     result = STATE_CRITICAL;
   }
 
   /* If we get anything on STDERR, at least set warning */
   if(chld_err.buflen > 0) {
     result = max_state(result, STATE_WARNING);
-    if(!msg) for(i = 0; i < chld_err.lines; i++) {
-      msg = strchr(chld_err.line[0], ':');
-      if(msg) {
-        msg++;
+    if(!*msg) for(i = 0; i < chld_err.lines; i++) {
+      *msg = strchr(chld_err.line[0], ':');
+      if(*msg) {
+        (*msg)++;
         break;
       }
     }
   }
 
-  microsec = deltime (tv);
-  elapsed_time = (double)microsec / 1.0e6;
+  return result;
+}
+#endif
 
-  if (critical_interval > UNDEFINED && elapsed_time > critical_interval)
-    result = STATE_CRITICAL;
 
-  else if (warning_interval > UNDEFINED && elapsed_time > warning_interval)
+
+static int
+compare_data (const void *a, const void *b)
+{
+  return strcmp (*(char * const *) a, *(char * const *) b);
+}
+
+/* the answers of one server, sorted so that servers that agree match */
+static char *
+answer_set (np_dns_message *resp, int type)
+{
+  char **data, *set = NULL;
+  size_t i, n = 0;
+
+  if ((data = calloc (resp->count + 1, sizeof (*data))) == NULL)
+    die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+  for (i = 0; i < resp->count; i++) {
+    if (resp->rr[i].section == NP_DNS_ANSWER &&
+        (type == NP_DNS_ANY || resp->rr[i].type == type))
+      data[n++] = resp->rr[i].data;
+  }
+  qsort (data, n, sizeof (*data), compare_data);
+  for (i = 0; i < n; i++)
+    xasprintf (&set, "%s%s%s", set ? set : "", set ? "," : "", data[i]);
+  free (data);
+  return set;
+}
+
+/* the answer line as dig prints it for the record that matches */
+static char *
+answer_match (np_dns_message *resp, const char *expected)
+{
+  char type_buf[16], class_buf[16], *line;
+  size_t i;
+
+  for (i = 0; i < resp->count; i++) {
+    if (resp->rr[i].section != NP_DNS_ANSWER)
+      continue;
+    xasprintf (&line, "%s %u %s %s %s", resp->rr[i].name, resp->rr[i].ttl,
+               np_dns_class_name (resp->rr[i].class, class_buf, sizeof (class_buf)),
+               np_dns_type_name (resp->rr[i].type, type_buf, sizeof (type_buf)), resp->rr[i].data);
+    if (strcasestr (line, expected) != NULL)
+      return line;
+    free (line);
+  }
+  return NULL;
+}
+
+/* the serial of the zone's SOA, in the answer or with a negative answer
+ * in the authority section */
+static int
+soa_serial (np_dns_message *resp, unsigned long *serial)
+{
+  size_t i;
+
+  for (i = 0; i < resp->count; i++) {
+    if (resp->rr[i].type == NP_DNS_SOA && resp->rr[i].section != NP_DNS_ADDITIONAL &&
+        sscanf (resp->rr[i].data, "%*s %*s %lu", serial) == 1)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* The dig arguments that say how to ask, into the query; the first one
+ * that asks for something else is returned, for dig to be run instead */
+static const char *
+parse_dig_args (void)
+{
+  static const char *ignored[] = { "cmd", "comments", "question", "stats", "search", "cl", "ttlid", NULL };
+  char *args, *arg, *opt;
+  int no, i, n;
+
+  if ((args = strdup (dig_args)) == NULL)
+    die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+  for (arg = strtok (args, " \t"); arg != NULL; arg = strtok (NULL, " \t")) {
+    if (!strcmp (arg, "-4") || !strcmp (arg, "-6")) {
+      query_transport = !strcmp (arg, "-4") ? "-4" : "-6";
+      continue;
+    }
+    if (!strcmp (arg, "-c")) {
+      if ((opt = strtok (NULL, " \t")) == NULL || (query_class = np_dns_class (opt)) < 0)
+        return opt ? opt : arg;
+      continue;
+    }
+    if ((n = np_dns_class (arg)) >= 0) {
+      query_class = n;
+      continue;
+    }
+    if (arg[0] != '+')
+      return arg;
+    opt = arg + 1;
+    if ((no = !strncmp (opt, "no", 2)))
+      opt += 2;
+    if (!strcmp (opt, "tcp") || !strcmp (opt, "vc"))
+      query_options = no ? query_options & ~NP_DNS_USE_TCP : query_options | NP_DNS_USE_TCP;
+    else if (!strcmp (opt, "rec") || !strcmp (opt, "recurse"))
+      query_flags = no ? query_flags & ~NP_DNS_RD : query_flags | NP_DNS_RD;
+    else if (!strcmp (opt, "cd") || !strcmp (opt, "cdflag"))
+      query_flags = no ? query_flags & ~NP_DNS_CD : query_flags | NP_DNS_CD;
+    else if (!strcmp (opt, "ad") || !strcmp (opt, "adflag"))
+      query_flags = no ? query_flags & ~NP_DNS_AD : query_flags | NP_DNS_AD;
+    else if (!strcmp (opt, "aa") || !strcmp (opt, "aaflag") || !strcmp (opt, "aaonly"))
+      query_flags = no ? query_flags & ~NP_DNS_AA : query_flags | NP_DNS_AA;
+    else if (!strcmp (opt, "edns") || !strcmp (opt, "edns=0"))
+      edns_size = no ? 0 : NP_DNS_EDNS_SIZE;
+    else if (!no && sscanf (opt, "bufsize=%d", &n) == 1 && n >= 0 && n <= 65535)
+      edns_size = n;
+    else if (!no && sscanf (opt, "time=%d", &n) == 1 && n > 0)
+      try_timeout = n;
+    else if (!no && sscanf (opt, "tries=%d", &n) == 1 && n >= 0)
+      number_tries = n;
+    else if (!no && sscanf (opt, "retry=%d", &n) == 1 && n >= 0)
+      number_tries = n + 1;
+    else {
+      for (i = 0; ignored[i] != NULL && strcmp (opt, ignored[i]); i++)
+        ;
+      if (ignored[i] == NULL)
+        return arg;
+    }
+  }
+  return NULL;
+}
+
+/* Ask the server itself, and put the answer in the words dig would use */
+static int
+lookup_native (char **msg)
+{
+  static unsigned char query[NP_DNS_MAX_MESSAGE];
+  np_dns_message resp;
+  struct addrinfo hints, *res;
+  char port[8], type_buf[16], class_buf[16];
+  size_t i, answers = 0;
+  int type = np_dns_type (record_type), len, status, tries, timeout_ms;
+  int result = STATE_OK;
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = !strcmp (query_transport, "-4") ? AF_INET : !strcmp (query_transport, "-6") ? AF_INET6 : AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  snprintf (port, sizeof (port), "%d", server_port);
+  if (getaddrinfo (dns_server, port, &hints, &res) != 0) {
+    xasprintf (msg, _("couldn't get address for '%s': not found"), dns_server);
+    return STATE_WARNING;
+  }
+
+  if ((len = np_dns_encode_query ((uint16_t) (getpid () ^ tv.tv_usec), query_address, type, query_class,
+                                  query_flags, edns_size, query, sizeof (query))) < 0)
+    die (STATE_UNKNOWN, _("Invalid query name - %s\n"), query_address);
+  /* the timeout is shared out between the tries, leaving time to report */
+  tries = number_tries > 0 ? number_tries : 1;
+  timeout_ms = try_timeout ? try_timeout * 1000 : (timeout_interval * 1000 - 250) / tries;
+  if (timeout_ms < 100)
+    timeout_ms = 100;
+  if (verbose)
+    printf (_("Asking %s port %d for '%s' %s %s over %s, %d tries of %d ms\n"), dns_server, server_port,
+            query_address, np_dns_type_name (type, type_buf, sizeof (type_buf)),
+            np_dns_class_name (query_class, class_buf, sizeof (class_buf)),
+            (query_options & NP_DNS_USE_TCP) ? "TCP" : "UDP", tries, timeout_ms);
+
+  status = np_dns_query (res->ai_addr, res->ai_addrlen, query, len, &resp, query_options, timeout_ms, tries - 1);
+  freeaddrinfo (res);
+  if (status == NP_DNS_TIMEOUT) {
+    *msg = (char *)_("connection timed out; no servers could be reached");
+    return STATE_WARNING;
+  }
+  if (status == NP_DNS_ERROR) {
+    xasprintf (msg, "%s", strerror (errno));
+    return STATE_WARNING;
+  }
+
+  for (i = 0; i < resp.count; i++) {
+    if (resp.rr[i].section != NP_DNS_ANSWER)
+      continue;
+    if (verbose && answers == 0)
+      printf (";; ANSWER SECTION:\n");
+    if (verbose)
+      printf ("%s %u %s %s %s\n", resp.rr[i].name, resp.rr[i].ttl,
+              np_dns_class_name (resp.rr[i].class, class_buf, sizeof (class_buf)),
+              np_dns_type_name (resp.rr[i].type, type_buf, sizeof (type_buf)), resp.rr[i].data);
+    answers++;
+  }
+  if (answers == 0) {
+    *msg = (char *)_("No ANSWER SECTION found");
+    result = STATE_CRITICAL;
+  }
+  else if ((*msg = answer_match (&resp, expected_address == NULL ? query_address : expected_address)) == NULL) {
+    *msg = (char *)_("Server not found in ANSWER SECTION");
     result = STATE_WARNING;
+  }
+  np_dns_message_free (&resp);
+  return result;
+}
 
-  printf ("DNS %s - %.3f seconds response time (%s)|%s\n",
-          state_text (result), elapsed_time,
-          msg ? msg : _("Probably a non-existent host/domain"),
-          fperfdata("time", elapsed_time, "s",
-                    (warning_interval>UNDEFINED?TRUE:FALSE),
-                    warning_interval,
-                    (critical_interval>UNDEFINED?TRUE:FALSE),
-            critical_interval,
-            TRUE, 0, FALSE, 0));
+struct server_result {
+  int state;
+  char *msg;
+  char *answers;
+  int has_serial;
+  unsigned long serial;
+  double time;
+};
+
+/* Ask every server the same question, and for the SOA of the name, all
+ * at once; they should give the same answers and the same serial */
+int
+check_servers (void)
+{
+  np_dns_target *targets;
+  struct server_result *r;
+  char port[8], *line, *problems = NULL, *perf = NULL, *lines = NULL;
+  const char *reference = NULL;
+  unsigned long newest = 0;
+  int has_serial = FALSE;
+  size_t i, j, k, ok = 0, fastest = 0, slowest = 0, best = 0, agree;
+  size_t per_server;
+  int type, result = STATE_OK, options = 0, timeout_ms;
+
+  if ((type = np_dns_type (record_type)) < 0)
+    usage_va (_("Invalid record type - %s"), record_type);
+  per_server = type == NP_DNS_SOA ? 1 : 2;
+  targets = calloc (server_count * per_server, sizeof (*targets));
+  r = calloc (server_count, sizeof (*r));
+  if (targets == NULL || r == NULL)
+    die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+  for (i = 0; i < server_count * per_server; i++) {
+    targets[i].server = servers[i / per_server];
+    targets[i].name = query_address;
+    targets[i].type = i % per_server ? NP_DNS_SOA : type;
+  }
+  if (!strcmp (query_transport, "-4"))
+    options |= NP_DNS_INET4;
+  else if (!strcmp (query_transport, "-6"))
+    options |= NP_DNS_INET6;
+  snprintf (port, sizeof (port), "%d", server_port);
+  /* as dig does, the timeout is shared out between the tries */
+  timeout_ms = (timeout_interval * 1000 - 500) / (number_tries > 0 ? number_tries : 1);
+  if (timeout_ms < 100)
+    timeout_ms = 100;
+  if (verbose)
+    printf (_("Asking %lu servers for '%s' %s\n"), (unsigned long) server_count, query_address, record_type);
+  if (!np_dns_query_targets (targets, server_count * per_server, port, options, server_count * per_server,
+                             timeout_ms, number_tries > 0 ? number_tries - 1 : 0))
+    die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+  alarm (0);
+
+  for (i = 0; i < server_count; i++) {
+    for (k = 0; k < per_server; k++) {
+      np_dns_target *t = &targets[i * per_server + k];
+
+      if (t->status == NP_DNS_TIMEOUT)
+        xasprintf (&r[i].msg, _("timed out"));
+      else if (t->status == NP_DNS_ERROR)
+        xasprintf (&r[i].msg, "%s", strerror (t->error));
+      else if (t->response.rcode != NP_DNS_NOERROR && (k == 0 || t->response.rcode != NP_DNS_NXDOMAIN))
+        xasprintf (&r[i].msg, "%s", np_dns_rcode_name (t->response.rcode));
+      else
+        continue;
+      r[i].state = STATE_CRITICAL;
+      break;
+    }
+    r[i].time = targets[i * per_server].time;
+    if (r[i].state != STATE_OK)
+      continue;
+    if (verbose) {
+      for (j = 0; j < targets[i * per_server].response.count; j++)
+        printf ("%s: %s\n", servers[i], targets[i * per_server].response.rr[j].data);
+    }
+    r[i].answers = answer_set (&targets[i * per_server].response, type);
+    r[i].has_serial = soa_serial (&targets[(i + 1) * per_server - 1].response, &r[i].serial);
+    if (r[i].answers == NULL) {
+      r[i].state = STATE_CRITICAL;
+      xasprintf (&r[i].msg, _("No ANSWER SECTION found"));
+      continue;
+    }
+    line = answer_match (&targets[i * per_server].response,
+                         expected_address == NULL ? query_address : expected_address);
+    if (line == NULL) {
+      r[i].state = STATE_WARNING;
+      xasprintf (&r[i].msg, _("Server not found in ANSWER SECTION"));
+    }
+    else
+      r[i].msg = line;
+    if (r[i].has_serial && (!has_serial || r[i].serial > newest))
+      newest = r[i].serial;
+    has_serial |= r[i].has_serial;
+  }
+
+  /* what most of the servers say is taken for the answer */
+  for (i = 0; i < server_count; i++) {
+    if (r[i].answers == NULL)
+      continue;
+    for (agree = 0, j = 0; j < server_count; j++)
+      agree += r[j].answers != NULL && !strcmp (r[i].answers, r[j].answers);
+    if (agree > best) {
+      best = agree;
+      reference = r[i].answers;
+    }
+  }
+
+  for (i = 0; i < server_count; i++) {
+    if (r[i].answers != NULL && strcmp (r[i].answers, reference)) {
+      r[i].state = STATE_CRITICAL;
+      xasprintf (&r[i].msg, _("answer differs: %s"), r[i].answers);
+    }
+    else if (r[i].answers != NULL && !r[i].has_serial && has_serial) {
+      r[i].state = max_state (r[i].state, STATE_WARNING);
+      xasprintf (&r[i].msg, _("no SOA serial, %s"), r[i].msg);
+    }
+    else if (r[i].answers != NULL && r[i].has_serial && r[i].serial != newest) {
+      r[i].state = max_state (r[i].state, STATE_WARNING);
+      xasprintf (&r[i].msg, _("serial %lu behind %lu"), r[i].serial, newest);
+    }
+    if (r[i].state != STATE_CRITICAL) {
+      if (critical_interval > UNDEFINED && r[i].time > critical_interval)
+        r[i].state = STATE_CRITICAL;
+      else if (warning_interval > UNDEFINED && r[i].time > warning_interval)
+        r[i].state = max_state (r[i].state, STATE_WARNING);
+    }
+    result = max_state (result, r[i].state);
+
+    if (r[i].answers != NULL) {
+      if (r[i].time < r[fastest].time || r[fastest].answers == NULL)
+        fastest = i;
+      if (r[i].time > r[slowest].time || r[slowest].answers == NULL)
+        slowest = i;
+    }
+    if (r[i].state == STATE_OK)
+      ok++;
+    else
+      xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+                 servers[i], r[i].msg);
+    if (r[i].has_serial)
+      xasprintf (&lines, _("%s\n[%s] %s: %s (serial %lu, %.3f seconds response time)"), lines ? lines : "",
+                 state_text (r[i].state), servers[i], r[i].msg, r[i].serial, r[i].time);
+    else
+      xasprintf (&lines, "%s\n[%s] %s: %s", lines ? lines : "", state_text (r[i].state),
+                 servers[i], r[i].msg);
+    if (r[i].answers == NULL)
+      continue;
+    xasprintf (&line, "time@%s", servers[i]);
+    xasprintf (&perf, "%s%s%s", perf ? perf : "", perf ? " " : "",
+               fperfdata (line, r[i].time, "s",
+                          (warning_interval>UNDEFINED?TRUE:FALSE), warning_interval,
+                          (critical_interval>UNDEFINED?TRUE:FALSE), critical_interval,
+                          TRUE, 0, FALSE, 0));
+    free (line);
+  }
+
+  printf ("DNS %s - %lu of %lu servers consistent%s%s", state_text (result), (unsigned long) ok,
+          (unsigned long) server_count, problems ? " - " : "", problems ? problems : "");
+  if (reference != NULL && has_serial)
+    printf (_(" (serial %lu, fastest %s %.3fs, slowest %s %.3fs)"), newest,
+            servers[fastest], r[fastest].time, servers[slowest], r[slowest].time);
+  else if (reference != NULL)
+    printf (_(" (fastest %s %.3fs, slowest %s %.3fs)"),
+            servers[fastest], r[fastest].time, servers[slowest], r[slowest].time);
+  printf ("|%s%s\n", perf ? perf : "", lines ? lines : "");
+
+  np_dns_targets_free (targets, server_count * per_server);
   return result;
 }
 
@@ -191,8 +593,12 @@ int
 process_arguments (int argc, char **argv)
 {
   int c;
+  char *t;
 
   int option = 0;
+  enum {
+    USE_DIG_OPTION = CHAR_MAX + 1
+  };
   static struct option longopts[] = {
     {"hostname", required_argument, 0, 'H'},
     {"query_address", required_argument, 0, 'l'},
@@ -209,6 +615,7 @@ process_arguments (int argc, char **argv)
     {"port", required_argument, 0, 'p'},
     {"use-ipv4", no_argument, 0, '4'},
     {"use-ipv6", no_argument, 0, '6'},
+    {"use-dig", no_argument, 0, USE_DIG_OPTION},
     {0, 0, 0, 0}
   };
 
@@ -229,8 +636,14 @@ process_arguments (int argc, char **argv)
       print_revision (progname, NP_VERSION);
       exit (STATE_OK);
     case 'H':                 /* hostname */
-      host_or_die(optarg);
-      dns_server = optarg;
+      for (t = strtok (optarg, ","); t != NULL; t = strtok (NULL, ",")) {
+        host_or_die(t);
+        servers = realloc (servers, (server_count + 1) * sizeof (*servers));
+        if (servers == NULL)
+          die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+        servers[server_count++] = t;
+      }
+      dns_server = servers[0];
       break;
     case 'p':                 /* server port */
       if (is_intpos (optarg)) {
@@ -288,6 +701,12 @@ process_arguments (int argc, char **argv)
     case '6':
       query_transport = "-6";
       break;
+    case USE_DIG_OPTION:
+#ifndef PATH_TO_DIG
+      die (STATE_UNKNOWN, "%s\n", _("dig is not installed, so --use-dig cannot be used"));
+#endif
+      use_dig = TRUE;
+      break;
     default:                  /* usage5 */
       usage5();
     }
@@ -315,10 +734,19 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments (void)
 {
-  if (query_address != NULL)
-    return OK;
-  else
+  const char *arg;
+
+  if (query_address == NULL)
     return ERROR;
+  /* what the query engine cannot ask is left to dig */
+  if (!use_dig && ((arg = parse_dig_args ()) != NULL || np_dns_type (record_type) < 0)) {
+#ifdef PATH_TO_DIG
+    use_dig = TRUE;
+#else
+    usage_va (_("%s needs dig, which is not installed"), arg ? arg : record_type);
+#endif
+  }
+  return OK;
 }
 
 
@@ -335,7 +763,9 @@ print_help (void)
   printf ("Copyright (c) 2000 Karl DeBisschop <kdebisschop@users.sourceforge.net>\n");
   printf (COPYRIGHT, copyright, email);
 
-  printf (_("This plugin test the DNS service on the specified host using dig"));
+  printf (_("This plugin test the DNS service on the specified host the way dig does, by"));
+  printf ("\n");
+  printf (_("asking it itself, or with dig for what only dig can ask"));
 
   printf ("\n\n");
 
@@ -346,11 +776,15 @@ print_help (void)
   printf (UT_EXTRA_OPTS);
 
   printf (UT_HOST_PORT, 'p', myport);
+  printf ("    %s\n",_("With more than one host (-H repeated, or a comma separated list) every server"));
+  printf ("    %s\n",_("is asked at once, without dig, for the record and for the SOA of the name."));
+  printf ("    %s\n",_("A server whose answers differ from the others' is critical, one whose serial"));
+  printf ("    %s\n",_("is behind the newest is a warning. The fastest and slowest are reported."));
 
   printf (" %s\n","-4, --use-ipv4");
-  printf ("    %s\n",_("Force dig to only use IPv4 query transport"));
+  printf ("    %s\n",_("Force IPv4 query transport"));
   printf (" %s\n","-6, --use-ipv6");
-  printf ("    %s\n",_("Force dig to only use IPv6 query transport"));
+  printf ("    %s\n",_("Force IPv6 query transport"));
   printf (" %s\n","-l, --query_address=STRING");
   printf ("    %s\n",_("Machine name to lookup"));
   printf (" %s\n","-T, --record_type=STRING");
@@ -359,7 +793,11 @@ print_help (void)
   printf ("    %s\n",_("An address expected to be in the answer section. If not set, uses whatever"));
   printf ("    %s\n",_("was in -l"));
   printf (" %s\n","-A, --dig-arguments=STRING");
-  printf ("    %s\n",_("Pass STRING as argument(s) to dig"));
+  printf ("    %s\n",_("Ask as dig would with STRING as argument(s): +[no]tcp, +[no]vc, +[no]rec,"));
+  printf ("    %s\n",_("+[no]cd, +[no]ad, +[no]aa, +[no]edns, +bufsize=N, +time=N, +tries=N, +retry=N,"));
+  printf ("    %s\n",_("-4, -6 and a class (-c CH) are understood; anything else has dig run"));
+  printf (" %s\n","--use-dig");
+  printf ("    %s\n",_("Run dig to make the query"));
   printf (" %s\n","-r, --retries=INTEGER");
   printf ("    %s\n",_("Number of retries passed to dig, timeout is divided by this value (Default: 3)"));
   printf (UT_WARN_CRIT);
@@ -370,6 +808,8 @@ print_help (void)
   printf ("%s\n", _("Examples:"));
   printf (" %s\n", "check_dig -H DNSSERVER -l www.example.com -A \"+tcp\"");
   printf (" %s\n", "This will send a tcp query to DNSSERVER for www.example.com");
+  printf (" %s\n", "check_dig -H ns1.example.com,ns2.example.com -l example.com -T SOA");
+  printf (" %s\n", "This will check that both servers have the same version of example.com");
 
   printf (UT_SUPPORT);
 }
@@ -380,7 +820,7 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-  printf ("%s -l <query_address> [-H <host>] [-p <server port>]\n", progname);
+  printf ("%s -l <query_address> [-H <host>[,<host>...]] [-p <server port>]\n", progname);
   printf (" [-T <query type>] [-w <warning interval>] [-c <critical interval>]\n");
   printf (" [-t <timeout>] [-r <retries>] [-a <expected answer address>] [-v]\n");
 }
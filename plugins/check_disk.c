@@ -52,6 +52,10 @@ const char *email = "devel@nagios-plugins.org";
 #endif
 #include "regex.h"
 #include <human.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 #ifdef __CYGWIN__
 # include <windows.h>
@@ -116,6 +120,10 @@ static struct parameter_list *path_select_list = NULL;
 /* Linked list of mounted filesystems. */
 static struct mount_entry *mount_list;
 
+/* How much of the mount table read_mount_list() keeps */
+enum { MOUNTS_NONE, MOUNTS_PATHS, MOUNTS_CHECKED, MOUNTS_ALL };
+static int mount_list_kind = MOUNTS_NONE;
+
 static const char *always_exclude[] = { "iso9600", "fuse.gvfsd-fuse", NULL };
 
 #define MAX_HUMAN_COL_WIDTH 255
@@ -177,9 +185,17 @@ int validate_arguments (uintmax_t, uintmax_t, double, double, double, double, ch
 void print_help (void);
 void print_usage (void);
 double calculate_percent(uintmax_t, uintmax_t);
-void stat_path (struct parameter_list *p);
-void get_stats (struct parameter_list *p, struct fs_usage *fsp);
+int stat_path (struct parameter_list *p);
+int get_stats (struct parameter_list *p, struct fs_usage *fsp);
 void get_path_stats (struct parameter_list *p, struct fs_usage *fsp);
+static int path_wanted (struct parameter_list *p);
+static void probe_paths (void);
+static int probe_fs_usage (struct parameter_list *p, struct fs_usage *fsp);
+static void timed_out_path (np_strbuf *output, int *result, struct parameter_list *p);
+static struct mount_entry *read_mount_list (int kind);
+static int fake_fs (const char *type);
+static double forecast_hours (struct parameter_list *p);
+static int check_du (void);
 
 double w_dfp = -1.0;
 double c_dfp = -1.0;
@@ -213,55 +229,118 @@ struct name_list *seen = NULL;
 int human_output = 0;
 int inode_perfdata_enabled = 0;
 
+/* The stat() and statvfs() of every file system are made by a pool of
+ * worker processes before anything is checked, so that a mount that
+ * hangs costs one worker and --mount-timeout seconds instead of the
+ * whole check. A worker that misses the deadline is killed and
+ * replaced, and its file system is reported with the -t state. */
+#define DEFAULT_WORKERS 8
+#define DEFAULT_MOUNT_TIMEOUT 5
+int workers = DEFAULT_WORKERS;
+int mount_timeout = DEFAULT_MOUNT_TIMEOUT;
+
+/* Network file systems get a stat() under --stale-timeout first. One that
+ * does not answer is reported as stale and left out of the statvfs() pass,
+ * so a wedged server does not hold workers for --mount-timeout each. */
+#define DEFAULT_STALE_TIMEOUT 1
+int stale_timeout = DEFAULT_STALE_TIMEOUT;
+
+/* what path_wanted() says is to be done with a path */
+#define PROBE_SKIP 0
+#define PROBE_STAT 1   /* only stat(), for -L */
+#define PROBE_FULL 2
+
+struct disk_probe {
+  struct parameter_list *path;
+  int kind;
+  int timed_out;
+  int stale;                    /* timed out in the network file system pass */
+  int done;
+  int stat_errno;
+  struct fs_usage fsu;
+};
+static struct disk_probe *probes = NULL;
+static size_t num_probes = 0;
+
+/* --forecast-warning/--forecast-critical: the growth of each file system is
+ * kept in the plugin's state as a moving average over --forecast-window
+ * hours, updated each run, and the hours left until it is full at that
+ * pace are checked against the thresholds. */
+#define DEFAULT_FORECAST_WINDOW 24
+char *forecast_warning = NULL;
+char *forecast_critical = NULL;
+double forecast_window = DEFAULT_FORECAST_WINDOW;
+thresholds *forecast_thresholds = NULL;
+np_disk_trend *trend = NULL;
+
+/* --du: the space used by directory trees rather than file systems, read
+ * by --workers processes. With --du-cache the totals of each directory
+ * are kept in the state directory, and one whose mtime has not changed
+ * is not read again for up to that many seconds. */
+char **du_paths = NULL;
+int du_count = 0;
+char *du_warning = NULL;
+char *du_critical = NULL;
+int du_cache = 0;
+
 int
 main (int argc, char **argv)
 {
   int result = STATE_UNKNOWN;
   int disk_result = STATE_UNKNOWN;
-  char *output = NULL;
+  int timeout_result = STATE_OK;
+  np_strbuf output;
   char *details;
-  char *perf;
+  np_perfdata perf;
   char *preamble;
   char *flag_header = NULL;
   char *label_name;
   char *inode_label_name, *raw_used_inodes_name, *raw_free_inodes_name;
+  char *forecast_label_name;
   int print_inode_perfdata_warning, print_inode_perfdata_critical;
   double inode_space_pct;
   double warning_high_tide;
   double critical_high_tide;
   int temp_result;
   int temp_result2;
+  double hours_to_full = -1;
+  char *trend_file;
 
   struct mount_entry *me;
-  struct mount_entry *last_me;
+  struct mount_entry *last_me = NULL;
+  struct mount_entry *next_me;
   struct fs_usage fsp, tmpfsp;
   struct parameter_list *temp_list, *path;
 
   human_disk_entry_t* human_disk_entries = NULL;
   unsigned num_human_disk_entries = 0;
 
-#ifdef __CYGWIN__
-  char mountdir[32];
-#endif
+  int want;
 
   preamble = strdup (" - free space:");
-  output = strdup ("");
+  np_strbuf_init (&output, NULL);
   details = strdup ("");
-  perf = strdup ("");
+  np_perfdata_init (&perf);
   stat_buf = malloc(sizeof *stat_buf);
 
-  setlocale (LC_ALL, "");
-  bindtextdomain (PACKAGE, LOCALEDIR);
-  textdomain (PACKAGE);
-
-  mount_list = read_file_system_list (0);
+  np_init ((char *) progname, argc, argv);
 
   /* Parse extra opts if any */
   argv = np_extra_opts (&argc, argv, progname);
 
+  np_set_args (argc, argv);
+
   if (process_arguments (argc, argv) == ERROR)
     usage4 (_("Could not parse arguments"));
 
+  if (forecast_thresholds) {
+    np_enable_state (NULL, 1);
+    if ((trend_file = np_state_path (".trends")) == NULL)
+      die (STATE_UNKNOWN, "%s\n", _("Cannot create the state directory"));
+    trend = np_disk_trend_open (trend_file);
+    free (trend_file);
+  }
+
   verbose_machine_output = (verbose >= 3 && !human_output);
 
   /* Set signal handling and alarm timeout */
@@ -270,25 +349,28 @@ main (int argc, char **argv)
   }
   (void) alarm ((unsigned) timeout_interval);
 
+  if (du_count)
+    return check_du ();
+
   /* If a list of paths has not been selected, find entire
      mount list and create list of paths
    */
+  np_profile_phase ("mounts");
   if (path_selected == FALSE) {
-    for (me = mount_list; me; me = me->me_next) {
+    if (mount_list_kind != MOUNTS_ALL)
+      mount_list = read_mount_list (MOUNTS_CHECKED);
+    for (me = mount_list; me; me = next_me) {
+      next_me = me->me_next;
 
       if (strcmp(me->me_type, "autofs") == 0 && show_local_fs) {
         if (last_me == NULL)
-          mount_list = me;
+          mount_list = me->me_next;
         else
           last_me->me_next = me->me_next;
         free_mount_entry (me);
         continue;
       }
-      if (skip_fake_fs &&
-          (strcmp(me->me_type, "sysfs") == 0 || strcmp(me->me_type, "proc") == 0
-        || strcmp(me->me_type, "debugfs") == 0 || strcmp(me->me_type, "tracefs") == 0
-        || strcmp(me->me_type, "fusectl") == 0 || strcmp(me->me_type, "fuse.gvfsd-fuse") == 0
-        || strcmp(me->me_type, "cgroup") == 0 || strstr(me->me_type, "tmpfs") != NULL))
+      if (skip_fake_fs && fake_fs(me->me_type))
       {
         if (last_me == NULL)
           mount_list = me->me_next;
@@ -321,6 +403,10 @@ main (int argc, char **argv)
     temp_list = temp_list->name_next;
   }
 
+  np_profile_phase ("statfs");
+  probe_paths ();
+  np_profile_phase ("thresholds");
+
   /* Initialize the header lengths to be the header text, so each column is at minimum as wide as its header */
   if (human_output) {
       int i;
@@ -346,9 +432,6 @@ main (int argc, char **argv)
 #ifdef __CYGWIN__
     if (strncmp(path->name, "/cygdrive/", 10) != 0 || strlen(path->name) > 11)
 	    continue;
-    snprintf(mountdir, sizeof(mountdir), "%s:\\", me->me_mountdir + 10);
-    if (GetDriveType(mountdir) != DRIVE_FIXED)
-	    me->me_remote = 1;
 #endif
     /* Filters */
 
@@ -358,34 +441,22 @@ main (int argc, char **argv)
     } 
     np_add_name(&seen, me->me_mountdir);
 
-    if (path->group == NULL) {
-      /* Skip remote filesystems if we're not interested in them */
-      if (me->me_remote && show_local_fs) {
-        if (stat_remote_fs)
-          stat_path(path);
-        continue;
-      /* Skip pseudo fs's if we haven't asked for all fs's */
-      } else if (me->me_dummy && !show_all_fs) {
-        continue;
-      /* Skip excluded fstypes */
-      } else if (fs_exclude_list && np_find_name (fs_exclude_list, me->me_type)) {
-        continue;
-      /* Skip excluded fs's */
-      } else if (dp_exclude_list &&
-               (np_find_name (dp_exclude_list, me->me_devname) ||
-                np_find_name (dp_exclude_list, me->me_mountdir))) {
-        continue;
-      /* Skip not included fstypes */
-      } else if (fs_include_list && !np_find_name (fs_include_list, me->me_type)) {
-        continue;
-      }
+    if ((want = path_wanted(path)) != PROBE_FULL) {
+      if (want == PROBE_STAT && !stat_path(path))
+        timed_out_path(&output, &timeout_result, path);
+      continue;
     }
 
-    stat_path(path);
-    get_fs_usage (me->me_mountdir, me->me_devname, &fsp);
+    if (!stat_path(path) || !probe_fs_usage(path, &fsp)) {
+      timed_out_path(&output, &timeout_result, path);
+      continue;
+    }
 
     if (fsp.fsu_blocks && strcmp ("none", me->me_mountdir)) {
-      get_stats (path, &fsp);
+      if (!get_stats (path, &fsp)) {
+        timed_out_path(&output, &timeout_result, path);
+        continue;
+      }
 
       if (verbose_machine_output) {
         printf ("For %s, used_pct=%g free_pct=%g used_units=%g free_units=%g total_units=%g used_inodes_pct=%g free_inodes_pct=%g fsp.fsu_blocksize=%llu mult=%llu\n",
@@ -443,6 +514,12 @@ main (int argc, char **argv)
       }
       disk_result = max_state(disk_result, temp_result);
 
+      if (trend && (hours_to_full = forecast_hours(path)) >= 0) {
+        temp_result = get_status(hours_to_full, forecast_thresholds);
+        if (verbose_machine_output) printf("Hours_to_full=%g result=%d\n", hours_to_full, temp_result);
+        disk_result = max_state(disk_result, temp_result);
+      }
+
       result = max_state(result, disk_result);
 
       /* What a mess of units. The output shows free space, the perf data shows used space. Yikes!
@@ -502,13 +579,12 @@ main (int argc, char **argv)
       } else {
           label_name = (!strcmp(me->me_mountdir, "none") || display_mntp) ? me->me_devname : me->me_mountdir;
           /* Nb: *_high_tide are unset when == ULONG_MAX */
-          xasprintf (&perf, "%s %s", perf,
-                     perfdata (label_name,
-                               path->dused_units, units,
-                               (warning_high_tide != ULONG_MAX ? TRUE : FALSE), warning_high_tide,
-                               (critical_high_tide != ULONG_MAX ? TRUE : FALSE), critical_high_tide,
-                               TRUE, 0,
-                               TRUE, path->dtotal_units));
+          np_perfdata_add (&perf, label_name,
+                           path->dused_units, units,
+                           (warning_high_tide != ULONG_MAX ? TRUE : FALSE), warning_high_tide,
+                           (critical_high_tide != ULONG_MAX ? TRUE : FALSE), critical_high_tide,
+                           TRUE, 0,
+                           TRUE, path->dtotal_units);
 
           if (inode_perfdata_enabled) {
 
@@ -526,23 +602,31 @@ main (int argc, char **argv)
               print_inode_perfdata_critical = TRUE;
             }
 
-            xasprintf (&perf, "%s %s", perf,
-                       perfdata (inode_label_name,
-                                  path->dused_inodes_percent, "%",
-                                  print_inode_perfdata_warning, (print_inode_perfdata_warning ? path->freeinodes_percent->warning->end : 0),
-                                  print_inode_perfdata_critical, (print_inode_perfdata_critical ? path->freeinodes_percent->critical->end : 0),
-                                  TRUE, 0,
-                                  TRUE, 100));
+            np_perfdata_add (&perf, inode_label_name,
+                             path->dused_inodes_percent, "%",
+                             print_inode_perfdata_warning, (print_inode_perfdata_warning ? path->freeinodes_percent->warning->end : 0),
+                             print_inode_perfdata_critical, (print_inode_perfdata_critical ? path->freeinodes_percent->critical->end : 0),
+                             TRUE, 0,
+                             TRUE, 100);
 
             raw_used_inodes_name = calloc(strlen(label_name) + 1 + 11, 1);
             raw_used_inodes_name = strcat(raw_used_inodes_name, label_name);
             raw_used_inodes_name = strcat(raw_used_inodes_name, "_inode_used");
-            xasprintf(&perf, "%s %s", perf, perfdata(raw_used_inodes_name, path->inodes_total - path->inodes_free, "", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, path->inodes_total));
+            np_perfdata_add (&perf, raw_used_inodes_name, path->inodes_total - path->inodes_free, "", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, path->inodes_total);
 
             raw_free_inodes_name = calloc(strlen(label_name) + 1 + 11, 1);
             raw_free_inodes_name = strcat(raw_free_inodes_name, label_name);
             raw_free_inodes_name = strcat(raw_free_inodes_name, "_inode_free");
-            xasprintf(&perf, "%s %s", perf, perfdata(raw_free_inodes_name, path->inodes_free, "", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, path->inodes_total));
+            np_perfdata_add (&perf, raw_free_inodes_name, path->inodes_free, "", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, path->inodes_total);
+          }
+
+          if (hours_to_full >= 0) {
+            xasprintf(&forecast_label_name, "%s_hours_to_full", label_name);
+            np_perfdata_addf (&perf, forecast_label_name, hours_to_full, "h",
+                              forecast_thresholds->warning != NULL, forecast_thresholds->warning ? forecast_thresholds->warning->start : 0,
+                              forecast_thresholds->critical != NULL, forecast_thresholds->critical ? forecast_thresholds->critical->start : 0,
+                              TRUE, 0, FALSE, 0);
+            free(forecast_label_name);
           }
 
       }
@@ -557,24 +641,25 @@ main (int argc, char **argv)
           else {
               xasprintf(&flag_header, "");
           }
-          xasprintf (&output, "%s %s %.0f %s (%.2f%%",
-                     output,
+          np_strbuf_appendf (&output, " %s %.0f %s (%.2f%%",
                      (!strcmp(me->me_mountdir, "none") || display_mntp) ? me->me_devname : me->me_mountdir,
                      (double)path->dfree_units,
                      units,
                      path->dfree_pct);
+          if (hours_to_full >= 0)
+            np_strbuf_appendf (&output, " full_in=%.1fh", hours_to_full);
           /* Whether or not to put all disks on new line */
           if (newlines) {
               if (path->dused_inodes_percent < 0) {
-                  xasprintf(&output, "%s inode=-)%s;\n", output, (disk_result ? "]" : ""));
+                  np_strbuf_appendf (&output, " inode=-)%s;\n", (disk_result ? "]" : ""));
               } else {
-                  xasprintf(&output, "%s inode=%.0f%%)%s;\n", output, path->dfree_inodes_percent, ((disk_result && verbose) ? "]" : ""));
+                  np_strbuf_appendf (&output, " inode=%.0f%%)%s;\n", path->dfree_inodes_percent, ((disk_result && verbose) ? "]" : ""));
               }
           } else {
               if (path->dused_inodes_percent < 0) {
-                  xasprintf(&output, "%s inode=-)%s;", output, (disk_result ? "]" : ""));
+                  np_strbuf_appendf (&output, " inode=-)%s;", (disk_result ? "]" : ""));
               } else {
-                  xasprintf(&output, "%s inode=%.0f%%)%s;", output, path->dfree_inodes_percent, ((disk_result && verbose) ? "]" : ""));
+                  np_strbuf_appendf (&output, " inode=%.0f%%)%s;", path->dfree_inodes_percent, ((disk_result && verbose) ? "]" : ""));
               }
           }
 
@@ -594,16 +679,27 @@ main (int argc, char **argv)
 
   }
 
+    if (trend) {
+      np_disk_trend_save (trend, time (NULL));
+      np_disk_trend_close (trend);
+    }
+
+    /* kept apart so that a -t UNKNOWN is not outranked by the OK mounts */
+    if (timeout_result != STATE_OK)
+      result = max_state_alt (result, timeout_result);
+
     if (human_output) {
         print_human_disk_entries(&human_disk_entries[0], num_human_disk_entries);
     } else {
         if (verbose >= 2)
-            xasprintf (&output, "%s%s", output, details);
+            np_strbuf_puts (&output, details);
 
         if (newlines) {
-            printf ("DISK %s%s\n%s|%s\n", state_text (result), (erronly && result==STATE_OK) ? "" : preamble, output, perf);
+            printf ("DISK %s%s\n%s|%s%s\n", state_text (result), (erronly && result==STATE_OK) ? "" : preamble, np_strbuf_string (&output),
+                    perf.len ? " " : "", np_perfdata_string (&perf));
         } else {
-            printf ("DISK %s%s%s|%s\n", state_text (result), (erronly && result==STATE_OK) ? "" : preamble, output, perf);
+            printf ("DISK %s%s%s|%s%s\n", state_text (result), (erronly && result==STATE_OK) ? "" : preamble, np_strbuf_string (&output),
+                    perf.len ? " " : "", np_perfdata_string (&perf));
         }
 
     }
@@ -646,7 +742,7 @@ process_arguments (int argc, char **argv)
   struct parameter_list *temp_path_select_list = NULL;
   struct mount_entry *me, *temp_me;
   int result = OK;
-  regex_t re;
+  struct np_mount_regex re;
   int cflags = REG_NOSUB | REG_EXTENDED;
   int default_cflags = cflags;
   char errbuf[MAX_INPUT_BUFFER];
@@ -656,6 +752,16 @@ process_arguments (int argc, char **argv)
     SKIP_FAKE_FS = CHAR_MAX + 1,
     INODE_PERFDATA_ENABLED,
     COMBINED_THRESHOLDS,
+    WORKERS,
+    MOUNT_TIMEOUT,
+    STALE_TIMEOUT,
+    FORECAST_WARNING,
+    FORECAST_CRITICAL,
+    FORECAST_WINDOW,
+    DU,
+    DU_WARNING,
+    DU_CRITICAL,
+    DU_CACHE,
   };
 
   int option = 0;
@@ -690,6 +796,16 @@ process_arguments (int argc, char **argv)
     {"local", no_argument, 0, 'l'},
     {"skip-fake-fs", no_argument, 0, SKIP_FAKE_FS},
     {"inode-perfdata", no_argument, 0, INODE_PERFDATA_ENABLED},
+    {"workers", required_argument, 0, WORKERS},
+    {"mount-timeout", required_argument, 0, MOUNT_TIMEOUT},
+    {"stale-timeout", required_argument, 0, STALE_TIMEOUT},
+    {"forecast-warning", required_argument, 0, FORECAST_WARNING},
+    {"forecast-critical", required_argument, 0, FORECAST_CRITICAL},
+    {"forecast-window", required_argument, 0, FORECAST_WINDOW},
+    {"du", required_argument, 0, DU},
+    {"du-warning", required_argument, 0, DU_WARNING},
+    {"du-critical", required_argument, 0, DU_CRITICAL},
+    {"du-cache", required_argument, 0, DU_CACHE},
     {"stat-remote-fs", no_argument, 0, 'L'},
     {"mountpoint", no_argument, 0, 'M'},
     {"errors-only", no_argument, 0, 'e'},
@@ -845,6 +961,53 @@ process_arguments (int argc, char **argv)
     case INODE_PERFDATA_ENABLED:
       inode_perfdata_enabled = 1;
       break;
+    case WORKERS:
+      if (!is_intpos (optarg))
+        usage2 (_("Workers must be a positive integer"), optarg);
+      workers = atoi (optarg);
+      break;
+    case MOUNT_TIMEOUT:
+      if (!is_intpos (optarg))
+        usage2 (_("Mount timeout must be a positive integer"), optarg);
+      mount_timeout = atoi (optarg);
+      break;
+    case STALE_TIMEOUT:
+      if (!is_intnonneg (optarg))
+        usage2 (_("Stale timeout must be a non-negative integer"), optarg);
+      stale_timeout = atoi (optarg);
+      break;
+    case FORECAST_WARNING:
+    case FORECAST_CRITICAL:
+      if (!is_positive (optarg))
+        usage2 (_("Forecast thresholds must be a positive number of hours"), optarg);
+      /* alert when fewer hours than that are left */
+      if (c == FORECAST_WARNING)
+        xasprintf (&forecast_warning, "%s:", optarg);
+      else
+        xasprintf (&forecast_critical, "%s:", optarg);
+      set_thresholds (&forecast_thresholds, forecast_warning, forecast_critical);
+      break;
+    case FORECAST_WINDOW:
+      if (!is_positive (optarg))
+        usage2 (_("Forecast window must be a positive number of hours"), optarg);
+      forecast_window = strtod (optarg, NULL);
+      break;
+    case DU:
+      if ((du_paths = realloc (du_paths, (du_count + 1) * sizeof (char *))) == NULL)
+        die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+      du_paths[du_count++] = optarg;
+      break;
+    case DU_WARNING:
+      du_warning = optarg;
+      break;
+    case DU_CRITICAL:
+      du_critical = optarg;
+      break;
+    case DU_CACHE:
+      if (!is_intnonneg (optarg))
+        usage2 (_("Cache time must be a number of seconds"), optarg);
+      du_cache = atoi (optarg);
+      break;
     case 'p':                 /* select path */
       if (! (warn_freespace_units || crit_freespace_units || warn_freespace_percent ||
              crit_freespace_percent || warn_usedspace_units || crit_usedspace_units ||
@@ -865,7 +1028,7 @@ process_arguments (int argc, char **argv)
       /* NB: We can't free the old mount_list "just like that": both list pointers and struct
        * pointers are copied around. One of the reason it wasn't done yet is that other parts
        * of check_disk need the same kind of cleanup so it'd better be done as a whole */
-      mount_list = read_file_system_list (0);
+      mount_list = read_mount_list (MOUNTS_PATHS);
       np_set_best_match(se, mount_list, exact_match);
 
       path_selected = TRUE;
@@ -910,9 +1073,9 @@ process_arguments (int argc, char **argv)
     case 'i':
       if (!path_selected)
         die (STATE_UNKNOWN, "DISK %s: %s\n", _("UNKNOWN"), _("Paths need to be selected before using -i/-I. Use -A to select all paths explicitly"));
-      err = regcomp(&re, optarg, cflags);
+      err = np_compile_mount_regex(&re, optarg, cflags);
       if (err != 0) {
-        regerror (err, &re, errbuf, MAX_INPUT_BUFFER);
+        np_regerror (err, &re.re, errbuf, MAX_INPUT_BUFFER);
         die (STATE_UNKNOWN, "DISK %s: %s - %s\n",_("UNKNOWN"), _("Could not compile regular expression"), errbuf);
       }
 
@@ -921,7 +1084,7 @@ process_arguments (int argc, char **argv)
       previous = NULL;
       while (temp_list) {
         if (temp_list->best_match) {
-          if (np_regex_match_mount_entry(temp_list->best_match, &re)) {
+          if (np_match_mount_regex(&re, temp_list->best_match)) {
 
               if (verbose >= 3)
                 printf("ignoring %s matching regex\n", temp_list->name);
@@ -940,7 +1103,7 @@ process_arguments (int argc, char **argv)
         }
       }
 
-
+      np_free_mount_regex(&re);
       cflags = default_cflags;
       break;
 
@@ -956,14 +1119,16 @@ process_arguments (int argc, char **argv)
         die (STATE_UNKNOWN, "DISK %s: %s", _("UNKNOWN"), _("Must set a threshold value before using -r/-R\n"));
       }
 
-      err = regcomp(&re, optarg, cflags);
+      err = np_compile_mount_regex(&re, optarg, cflags);
       if (err != 0) {
-        regerror (err, &re, errbuf, MAX_INPUT_BUFFER);
+        np_regerror (err, &re.re, errbuf, MAX_INPUT_BUFFER);
         die (STATE_UNKNOWN, "DISK %s: %s - %s\n",_("UNKNOWN"), _("Could not compile regular expression"), errbuf);
       }
 
+      if (mount_list_kind != MOUNTS_ALL)
+        mount_list = read_mount_list (MOUNTS_ALL);
       for (me = mount_list; me; me = me->me_next) {
-        if (np_regex_match_mount_entry(me, &re)) {
+        if (np_match_mount_regex(&re, me)) {
           fnd = TRUE;
           if (verbose >= 3)
             printf("%s %s matching expression %s\n", me->me_devname, me->me_mountdir, optarg);
@@ -981,6 +1146,7 @@ process_arguments (int argc, char **argv)
         die (STATE_UNKNOWN, "DISK %s: %s - %s\n",_("UNKNOWN"),
             _("Regular expression did not match any path or disk"), optarg);
 
+      np_free_mount_regex(&re);
       fnd = FALSE;
       path_selected = TRUE;
       np_set_best_match(path_select_list, mount_list, exact_match);
@@ -994,6 +1160,8 @@ process_arguments (int argc, char **argv)
        /* add all mount entries to path_select list if no partitions have been explicitly defined using -p */
        if (path_selected == FALSE) {
          struct parameter_list *path;
+         if (mount_list_kind != MOUNTS_ALL)
+           mount_list = read_mount_list (MOUNTS_ALL);
          for (me = mount_list; me; me = me->me_next) {
            if (! (path = np_find_parameter(path_select_list, me->me_mountdir)))
              path = np_add_parameter(&path_select_list, me->me_mountdir);
@@ -1200,6 +1368,34 @@ print_help (void)
   printf (" %s\n", "-i, --ignore-ereg-path=PATH, --ignore-ereg-partition=PARTITION");
   printf ("    %s\n", _("Regular expression to ignore selected path or partition (may be repeated)"));
   printf (UT_PLUG_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+  printf (" %s\n", "--mount-timeout=INTEGER");
+  printf ("    %s (%s %d)\n", _("Seconds a file system has to answer stat() and statvfs(), else it is"),
+          _("default:"), DEFAULT_MOUNT_TIMEOUT);
+  printf ("    %s\n", _("reported as timed out with the state of -t and the others are still checked"));
+  printf (" %s\n", "--stale-timeout=INTEGER");
+  printf ("    %s (%s %d)\n", _("Seconds a network file system (NFS, CIFS, FUSE) has to answer a stat() before"),
+          _("default:"), DEFAULT_STALE_TIMEOUT);
+  printf ("    %s\n", _("the other checks, else it is reported as stale with the state of -t. 0 skips this"));
+  printf (" %s\n", "--workers=INTEGER");
+  printf ("    %s (%s %d)\n", _("Number of file systems asked at the same time"), _("default:"),
+          DEFAULT_WORKERS);
+  printf (" %s\n", "--forecast-warning=HOURS, --forecast-critical=HOURS");
+  printf ("    %s\n", _("Exit with WARNING or CRITICAL status if a file system will be full in less than"));
+  printf ("    %s\n", _("HOURS at the pace it grew at recently. The growth is kept in the state directory"));
+  printf ("    %s\n", _("between runs, so there is no forecast on the first two runs"));
+  printf (" %s\n", "--forecast-window=HOURS");
+  printf ("    %s (%s %d)\n", _("Hours the growth is averaged over, older runs weigh less and less"),
+          _("default:"), DEFAULT_FORECAST_WINDOW);
+  printf (" %s\n", "--du=PATH");
+  printf ("    %s\n", _("Check the space used by the directory tree at PATH, as du -sx counts it, instead"));
+  printf ("    %s\n", _("of file systems (may be repeated). The directories are read by --workers processes"));
+  printf (" %s\n", "--du-warning=RANGE, --du-critical=RANGE");
+  printf ("    %s\n", _("Exit with WARNING or CRITICAL status if the space used by a --du tree, in --units,"));
+  printf ("    %s\n", _("is outside RANGE"));
+  printf (" %s\n", "--du-cache=SECONDS");
+  printf ("    %s\n", _("Keep the totals of each directory in the state directory, and do not read one"));
+  printf ("    %s\n", _("again while its mtime is the same, for up to SECONDS after it was read. Files that"));
+  printf ("    %s\n", _("grow in place are counted at their new size when their directory is read again"));
   printf (" %s\n", "-u, --units=STRING");
   printf ("    %s\n", _("Choose bytes, kB, MB, GB, TB, KiB, MiB, GiB, TiB (default: MiB)"));
   printf ("    %s\n", _("Note: kB/MB/GB/TB are still calculated as their respective binary"));
@@ -1234,25 +1430,499 @@ print_usage (void)
   printf (" %s -w limit -c limit [-W limit] [-K limit] {-p path | -x device}\n", progname);
   printf ("[-C] [-E] [-e] [-f] [-g group ] [-H] [-k] [-l] [-M] [-m] [-R path ] [-r path ]\n");
   printf ("[-t timeout] [-u unit] [-v] [-X type] [-N type] [-n] [--combined-thresholds ]\n");
+  printf ("[--mount-timeout=seconds] [--stale-timeout=seconds] [--workers=N]\n");
+  printf ("[--forecast-warning=hours] [--forecast-critical=hours] [--forecast-window=hours]\n");
+  printf (" %s --du=path [--du=path...] [--du-warning=range] [--du-critical=range]\n", progname);
+  printf ("[--du-cache=seconds] [--workers=N] [-u unit] [-t timeout]\n");
 }
 
-void
+/* --du: a line of output for all the trees, with their perfdata */
+static int
+check_du (void)
+{
+  np_du_cache *cache = NULL;
+  np_du_usage usage;
+  np_perfdata perf;
+  np_strbuf output;
+  thresholds *du_thresholds = NULL;
+  char *cache_file, *label;
+  double used;
+  int i, state, result = STATE_OK;
+
+  set_thresholds (&du_thresholds, du_warning, du_critical);
+  if (du_cache) {
+    if (!forecast_thresholds)
+      np_enable_state (NULL, 1);
+    if ((cache_file = np_state_path (".du")) == NULL)
+      die (STATE_UNKNOWN, "%s\n", _("Cannot create the state directory"));
+    cache = np_du_cache_open (cache_file, du_cache);
+    free (cache_file);
+  }
+
+  np_strbuf_init (&output, NULL);
+  np_perfdata_init (&perf);
+  for (i = 0; i < du_count; i++) {
+    np_profile_phase ("du");
+    if (np_du_walk (du_paths[i], workers, cache, time (NULL), &usage) < 0) {
+      result = max_state_alt (result, STATE_UNKNOWN);
+      np_strbuf_appendf (&output, " %s %s;%s", du_paths[i], strerror (errno), newlines ? "\n" : "");
+      continue;
+    }
+    used = (double) usage.bytes / mult;
+    state = get_status (used, du_thresholds);
+    /* a tree that could not all be read is not its usage */
+    if (usage.errors)
+      state = max_state_alt (state, STATE_UNKNOWN);
+    result = max_state_alt (result, state);
+    if (verbose >= 3)
+      printf ("%s: %ju directories, %ju of them read, %ju files, %ju bytes, %ju errors\n", du_paths[i],
+              usage.dirs, usage.dirs_read, usage.files, usage.bytes, usage.errors);
+    if (!erronly || state != STATE_OK) {
+      np_strbuf_appendf (&output, " %s %.0f %s (%ju files", du_paths[i], used, units, usage.files);
+      if (usage.errors)
+        np_strbuf_appendf (&output, _(", %ju unreadable directories"), usage.errors);
+      np_strbuf_appendf (&output, ");%s", newlines ? "\n" : "");
+    }
+    np_perfdata_adds (&perf, du_paths[i], used, units, du_warning, du_critical, TRUE, 0, FALSE, 0);
+    xasprintf (&label, "%s_files", du_paths[i]);
+    np_perfdata_add (&perf, label, (long) usage.files, "", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+    free (label);
+  }
+  if (cache) {
+    np_du_cache_save (cache);
+    np_du_cache_close (cache);
+  }
+
+  printf ("DISK %s - used space:%s%s|%s\n", state_text (result), newlines ? "\n" : "",
+          np_strbuf_string (&output), np_perfdata_string (&perf));
+  return result;
+}
+
+/* what is done with a path, by the filters; the same for probe_paths()
+ * and main() */
+static int
+path_wanted (struct parameter_list *p)
+{
+  struct mount_entry *me = p->best_match;
+#ifdef __CYGWIN__
+  char mountdir[32];
+
+  if (strncmp(p->name, "/cygdrive/", 10) != 0 || strlen(p->name) > 11)
+    return PROBE_SKIP;
+  snprintf(mountdir, sizeof(mountdir), "%s:\\", me->me_mountdir + 10);
+  if (GetDriveType(mountdir) != DRIVE_FIXED)
+    me->me_remote = 1;
+#endif
+
+  if (p->group != NULL)
+    return PROBE_FULL;
+  /* Skip remote filesystems if we're not interested in them */
+  if (me->me_remote && show_local_fs)
+    return stat_remote_fs ? PROBE_STAT : PROBE_SKIP;
+  /* Skip pseudo fs's if we haven't asked for all fs's */
+  if (me->me_dummy && !show_all_fs)
+    return PROBE_SKIP;
+  /* Skip excluded fstypes */
+  if (fs_exclude_list && np_find_name (fs_exclude_list, me->me_type))
+    return PROBE_SKIP;
+  /* Skip excluded fs's */
+  if (dp_exclude_list &&
+      (np_find_name (dp_exclude_list, me->me_devname) ||
+       np_find_name (dp_exclude_list, me->me_mountdir)))
+    return PROBE_SKIP;
+  /* Skip not included fstypes */
+  if (fs_include_list && !np_find_name (fs_include_list, me->me_type))
+    return PROBE_SKIP;
+  return PROBE_FULL;
+}
+
+/* The hours until p is full at its average growth, or -1 before there is
+ * an estimate and while it is not growing */
+static double
+forecast_hours (struct parameter_list *p)
+{
+  double rate;
+
+  if (!np_disk_trend_update (trend, p->best_match->me_mountdir, time (NULL), (double) p->dused_units,
+                             forecast_window * 3600, &rate) || rate <= 0)
+    return -1;
+  return (double) p->dfree_units / rate / 3600;
+}
+
+/* The "fake" file systems --skip-fake-fs leaves out */
+static int
+fake_fs (const char *type)
+{
+  return strcmp(type, "sysfs") == 0 || strcmp(type, "proc") == 0
+      || strcmp(type, "debugfs") == 0 || strcmp(type, "tracefs") == 0
+      || strcmp(type, "fusectl") == 0 || strcmp(type, "fuse.gvfsd-fuse") == 0
+      || strcmp(type, "cgroup") == 0 || strstr(type, "tmpfs") != NULL;
+}
+
+/*
+ * np_read_mountinfo() filter. For -p only the mounts np_set_best_match() may
+ * pick for one of the selected paths are kept, and when every mount is
+ * checked the ones main() and path_wanted() would skip are dropped up front.
+ */
+static int
+mount_wanted (const char *devname, const char *mountdir, const char *type,
+              int dummy, int remote, void *data)
+{
+  struct parameter_list *p;
+  size_t len;
+
+  if (*(int *) data == MOUNTS_PATHS) {
+    len = strlen (mountdir);
+    for (p = path_select_list; p; p = p->name_next)
+      if (len == 1 || strncmp (mountdir, p->name, len) == 0 || strcmp (devname, p->name) == 0)
+        return TRUE;
+    return FALSE;
+  }
+
+  if (show_local_fs && strcmp (type, "autofs") == 0)
+    return FALSE;
+  if (skip_fake_fs && fake_fs (type))
+    return FALSE;
+  /* group members are checked whatever their type */
+  if (group != NULL)
+    return TRUE;
+  if (remote && show_local_fs && !stat_remote_fs)
+    return FALSE;
+  if (dummy && !show_all_fs)
+    return FALSE;
+  if (np_find_name (fs_exclude_list, type))
+    return FALSE;
+  if (np_find_name (dp_exclude_list, devname) || np_find_name (dp_exclude_list, mountdir))
+    return FALSE;
+  if (fs_include_list && !np_find_name (fs_include_list, type))
+    return FALSE;
+  return TRUE;
+}
+
+/* The mount table, parsed straight from /proc/self/mountinfo on Linux */
+static struct mount_entry *
+read_mount_list (int kind)
+{
+#ifdef __linux__
+  struct mount_entry *list;
+
+  if (np_read_mountinfo ("/proc/self/mountinfo", kind == MOUNTS_ALL ? NULL : mount_wanted, &kind, &list)) {
+    mount_list_kind = kind;
+    return list;
+  }
+#endif
+  mount_list_kind = MOUNTS_ALL;
+  return read_file_system_list (0);
+}
+
+/* The paths come up in the order they were probed, mostly */
+static struct disk_probe *
+probe_find (struct parameter_list *p)
+{
+  static size_t cursor = 0;
+  size_t i;
+
+  for (i = 0; i < num_probes; i++, cursor++) {
+    if (cursor >= num_probes)
+      cursor = 0;
+    if (probes[cursor].path == p)
+      return probes[cursor].done ? &probes[cursor] : NULL;
+  }
+  return NULL;
+}
+
+struct disk_worker {
+  pid_t pid;
+  int request;                  /* the probe index goes down this */
+  int result;                   /* and a struct probe_result comes back */
+  int busy;
+  size_t job;
+  struct timeval deadline;
+};
+
+struct probe_request {
+  size_t job;
+  int stat_only;
+};
+
+struct probe_result {
+  size_t job;
+  int stat_errno;
+  struct fs_usage fsu;
+};
+
+static void
+probe_worker (int request, int result)
+{
+  struct probe_request q;
+  struct probe_result r;
+  struct disk_probe *probe;
+  int fd;
+
+  /* nothing of ours stays open for a worker that hangs on */
+  if ((fd = open ("/dev/null", O_RDWR)) >= 0) {
+    dup2 (fd, STDIN_FILENO);
+    dup2 (fd, STDOUT_FILENO);
+    dup2 (fd, STDERR_FILENO);
+    if (fd > STDERR_FILENO)
+      close (fd);
+  }
+  while (read (request, &q, sizeof (q)) == sizeof (q) && q.job < num_probes) {
+    probe = &probes[r.job = q.job];
+    memset (&r.fsu, 0, sizeof (r.fsu));
+    r.stat_errno = stat (probe->path->name, &stat_buf[0]) ? errno : 0;
+    if (r.stat_errno == 0 && probe->kind == PROBE_FULL && !q.stat_only)
+      get_fs_usage (probe->path->best_match->me_mountdir, probe->path->best_match->me_devname, &r.fsu);
+    if (write (result, &r, sizeof (r)) != sizeof (r))
+      break;
+  }
+  _exit (0);
+}
+
+static int
+probe_worker_start (struct disk_worker *pool, int count, struct disk_worker *w)
+{
+  int request[2], result[2], i;
+
+  w->busy = FALSE;
+  if (pipe (request) < 0)
+    return FALSE;
+  if (pipe (result) < 0) {
+    close (request[0]);
+    close (request[1]);
+    return FALSE;
+  }
+  if ((w->pid = fork ()) < 0) {
+    close (request[0]);
+    close (request[1]);
+    close (result[0]);
+    close (result[1]);
+    return FALSE;
+  }
+  if (w->pid == 0) {
+    /* or the other workers would never see the end of their requests */
+    for (i = 0; i < count; i++) {
+      if (&pool[i] != w && pool[i].pid > 0) {
+        close (pool[i].request);
+        close (pool[i].result);
+      }
+    }
+    close (request[1]);
+    close (result[0]);
+    probe_worker (request[0], result[1]);
+  }
+  close (request[0]);
+  close (result[1]);
+  w->request = request[1];
+  w->result = result[0];
+  return TRUE;
+}
+
+static void
+probe_worker_stop (struct disk_worker *w, int sig)
+{
+  close (w->request);
+  close (w->result);
+  if (sig)
+    kill (w->pid, sig);
+  waitpid (w->pid, NULL, sig ? WNOHANG : 0);
+  w->pid = 0;
+  w->busy = FALSE;
+}
+
+/* Hands the jobs to the workers, each with timeout seconds to answer */
+static void
+probe_run (struct disk_worker *pool, int count, const size_t *jobs, size_t njobs,
+           int timeout, int stat_only)
+{
+  struct pollfd *pfd;
+  struct probe_request q;
+  struct probe_result r;
+  struct timeval now;
+  size_t next = 0, done = 0;
+  long ms;
+  int k, wait;
+
+  if ((pfd = calloc (count, sizeof (*pfd))) == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  if (verbose >= 3)
+    printf ("Probing %lu paths with %d workers, %d seconds each%s\n", (unsigned long) njobs, count, timeout,
+            stat_only ? ", stat() only" : "");
+
+  while (done < njobs) {
+    gettimeofday (&now, NULL);
+    for (wait = -1, k = 0; k < count; k++) {
+      if (pool[k].pid == 0 && next < njobs && !probe_worker_start (pool, count, &pool[k]))
+        die (STATE_UNKNOWN, _("Cannot start a worker: %s\n"), strerror (errno));
+      if (pool[k].pid && !pool[k].busy && next < njobs) {
+        q.job = pool[k].job = jobs[next++];
+        q.stat_only = stat_only;
+        pool[k].busy = TRUE;
+        pool[k].deadline = now;
+        pool[k].deadline.tv_sec += timeout;
+        if (write (pool[k].request, &q, sizeof (q)) != sizeof (q))
+          pool[k].deadline = now;     /* the worker is gone, which is the same as too slow */
+      }
+      if (pool[k].busy) {
+        ms = (pool[k].deadline.tv_sec - now.tv_sec) * 1000L + (pool[k].deadline.tv_usec - now.tv_usec) / 1000;
+        if (ms < 0)
+          ms = 0;
+        if (wait < 0 || ms < wait)
+          wait = (int) ms;
+      }
+      pfd[k].fd = pool[k].busy ? pool[k].result : -1;
+      pfd[k].events = POLLIN;
+      pfd[k].revents = 0;
+    }
+
+    if (poll (pfd, count, wait) < 0 && errno != EINTR)
+      die (STATE_UNKNOWN, _("poll() failed: %s\n"), strerror (errno));
+
+    gettimeofday (&now, NULL);
+    for (k = 0; k < count; k++) {
+      if (!pool[k].busy)
+        continue;
+      if (pfd[k].revents & POLLIN && read (pool[k].result, &r, sizeof (r)) == sizeof (r) && r.job == pool[k].job) {
+        probes[r.job].stat_errno = r.stat_errno;
+        probes[r.job].fsu = r.fsu;
+        probes[r.job].done = TRUE;
+        pool[k].busy = FALSE;
+        done++;
+      } else if (pfd[k].revents & (POLLIN | POLLHUP | POLLERR) ||
+                 now.tv_sec > pool[k].deadline.tv_sec ||
+                 (now.tv_sec == pool[k].deadline.tv_sec && now.tv_usec >= pool[k].deadline.tv_usec)) {
+        if (verbose >= 3)
+          printf ("%s %s\n", probes[pool[k].job].path->name, stat_only ? "is stale" : "timed out");
+        probes[pool[k].job].timed_out = TRUE;
+        probes[pool[k].job].stale = stat_only;
+        probes[pool[k].job].done = TRUE;
+        done++;
+        probe_worker_stop (&pool[k], SIGKILL);
+      }
+    }
+  }
+  free (pfd);
+}
+
+/* what the stale pass looks at */
+static int
+network_fs (const struct mount_entry *me)
+{
+  return me->me_remote || strncmp (me->me_type, "nfs", 3) == 0 || strcmp (me->me_type, "cifs") == 0 ||
+         strncmp (me->me_type, "smb", 3) == 0 || strncmp (me->me_type, "fuse", 4) == 0;
+}
+
+/* stat() and get_fs_usage() of every path main() is going to look at */
+static void
+probe_paths (void)
+{
+  struct parameter_list *p;
+  struct disk_worker *pool;
+  size_t *jobs, njobs, i;
+  int count, k;
+
+  for (p = path_select_list; p; p = p->name_next)
+    if (p->best_match)
+      num_probes++;
+  if (num_probes == 0)
+    return;
+  if ((probes = calloc (num_probes, sizeof (*probes))) == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  for (num_probes = 0, p = path_select_list; p; p = p->name_next) {
+    if (p->best_match && (probes[num_probes].kind = path_wanted (p)) != PROBE_SKIP)
+      probes[num_probes++].path = p;
+  }
+
+  count = (size_t) workers < num_probes ? workers : (int) num_probes;
+  pool = calloc (count, sizeof (*pool));
+  jobs = calloc (num_probes + 1, sizeof (*jobs));
+  if (pool == NULL || jobs == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+  if (stale_timeout) {
+    for (i = njobs = 0; i < num_probes; i++)
+      if (network_fs (probes[i].path->best_match))
+        jobs[njobs++] = i;
+    if (njobs)
+      probe_run (pool, count, jobs, njobs, stale_timeout, TRUE);
+  }
+  for (i = njobs = 0; i < num_probes; i++) {
+    if (!probes[i].stale) {
+      probes[i].done = FALSE;
+      jobs[njobs++] = i;
+    }
+  }
+  probe_run (pool, count, jobs, njobs, mount_timeout, FALSE);
+
+  for (k = 0; k < count; k++)
+    if (pool[k].pid)
+      probe_worker_stop (&pool[k], 0);
+  free (pool);
+  free (jobs);
+}
+
+/* Stat entry to check that dir exists and is accessible; FALSE if it
+ * did not answer in time */
+int
 stat_path (struct parameter_list *p)
 {
-  /* Stat entry to check that dir exists and is accessible */
+  struct disk_probe *probe = probe_find (p);
+  int err;
+
   if (verbose >= 3)
     printf("calling stat on %s\n", p->name);
-  if (stat (p->name, &stat_buf[0])) {
+  if (probe && probe->timed_out)
+    return FALSE;
+  err = probe ? probe->stat_errno : stat (p->name, &stat_buf[0]) ? errno : 0;
+  if (err) {
     if (verbose >= 3)
       printf("stat failed on %s\n", p->name);
     if (!human_output)
         printf("DISK %s - ", _("CRITICAL"));
-    die (STATE_CRITICAL, _("%s %s: %s\n"), p->name, _("is not accessible"), strerror(errno));
+    die (STATE_CRITICAL, _("%s %s: %s\n"), p->name, _("is not accessible"), strerror(err));
   }
+  return TRUE;
 }
 
+/* get_fs_usage() of the mount of a path, from the probe if it has one */
+static int
+probe_fs_usage (struct parameter_list *p, struct fs_usage *fsp)
+{
+  struct disk_probe *probe = probe_find (p);
 
-void
+  if (probe == NULL || probe->kind != PROBE_FULL) {
+    get_fs_usage (p->best_match->me_mountdir, p->best_match->me_devname, fsp);
+    return TRUE;
+  }
+  *fsp = probe->fsu;
+  return !probe->timed_out;
+}
+
+/* a path that missed --stale-timeout or --mount-timeout, counted with the
+ * -t state */
+static void
+timed_out_path (np_strbuf *output, int *result, struct parameter_list *p)
+{
+  const char *name = p->group ? p->group :
+                     display_mntp || !strcmp (p->best_match->me_mountdir, "none") ?
+                     p->best_match->me_devname : p->best_match->me_mountdir;
+  static struct name_list *reported = NULL;
+
+  struct disk_probe *probe = probe_find (p);
+
+  /* every member of a group ends up here */
+  if (np_seen_name (reported, name))
+    return;
+  np_add_name (&reported, name);
+  *result = max_state_alt (*result, timeout_state);
+  if (!human_output)
+    np_strbuf_appendf (output, " %s %s;%s", name, probe && probe->stale ? _("is stale") : _("timed out"),
+               newlines ? "\n" : "");
+}
+
+
+/* FALSE if a file system of the group did not answer in time */
+int
 get_stats (struct parameter_list *p, struct fs_usage *fsp) {
   struct parameter_list *p_list;
   struct fs_usage tmpfsp;
@@ -1268,8 +1938,8 @@ get_stats (struct parameter_list *p, struct fs_usage *fsp) {
         continue;
 #endif
       if (p_list->group && ! (strcmp(p_list->group, p->group))) {
-        stat_path(p_list);
-        get_fs_usage (p_list->best_match->me_mountdir, p_list->best_match->me_devname, &tmpfsp);
+        if (!stat_path(p_list) || !probe_fs_usage(p_list, &tmpfsp))
+          return FALSE;
         get_path_stats(p_list, &tmpfsp); 
         if (verbose >= 3)
           printf("Group %s: adding %llu blocks sized %llu, (%s) used_units=%g free_units=%g total_units=%g fsu_blocksize=%llu mult=%llu\n",
@@ -1305,7 +1975,7 @@ get_stats (struct parameter_list *p, struct fs_usage *fsp) {
   p->dfree_pct = 100 - p->dused_pct;
   p->dused_inodes_percent = calculate_percent(p->inodes_total - p->inodes_free, p->inodes_total);
   p->dfree_inodes_percent = 100 - p->dused_inodes_percent;
-  
+  return TRUE;
 }
 
 void
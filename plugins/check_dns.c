@@ -34,8 +34,8 @@
       } \
       temp_buffer = rindex (chld_out.line[i], comp_str); \
       addresses[n_addresses++] = check_new_address(temp_buffer); \
-      memset(query_found, '\0', sizeof(query_found)); \
-      strncpy(query_found, querytype, sizeof(query_found)); 
+      memset(query_found, '\0', query_size); \
+      strncpy(query_found, querytype, query_size); 
 
 const char *progname = "check_dns";
 const char *copyright = "2000-2018";
@@ -46,7 +46,21 @@ const char *email = "devel@nagios-plugins.org";
 #include "utils_base.h"
 #include "netutils.h"
 #include "runcmd.h"
-
+#include "resident.h"
+#include "utils_dns.h"
+#include <netinet/tcp.h>
+#ifdef HAVE_NGHTTP2
+#include <nghttp2/nghttp2.h>
+#endif
+
+static int run_check (int, char **);
+static void reset_state (void);
+static int lookup_native (char ***, int *, char *, size_t, int *, char **);
+static int check_dns_batch (void);
+static int query_targets (np_dns_target *, size_t, int, int);
+#ifdef NSLOOKUP_COMMAND
+static int lookup_nslookup (char ***, int *, char *, size_t, int *, char **);
+#endif
 int process_arguments (int, char **);
 int validate_arguments (void);
 int error_scan (char *);
@@ -56,19 +70,40 @@ void print_usage (void);
 /* Allow up to 4096 input length, this is helpful
    when the TXT records returned have multiple 255 legth values returned */
 #define ADDRESS_LENGTH 4096
-char query_address[ADDRESS_LENGTH] = "";
-char dns_server[ADDRESS_LENGTH] = "";
-char tmp_dns_server[ADDRESS_LENGTH] = "";
-char ptr_server[ADDRESS_LENGTH] = "";
-char query_type[16] = "";
-int query_set = FALSE;
-int verbose = FALSE;
-char **expected_address = NULL;
-int expected_address_cnt = 0;
-
-int expect_authority = FALSE;
-int accept_cname = FALSE;
-thresholds *time_thresholds = NULL;
+/* queries in flight at once in batch mode */
+#define DEFAULT_CONCURRENCY 256
+/* how the queries go to the server */
+#define TRANSPORT_UDP 0           /* UDP, then TCP for truncated answers */
+#define TRANSPORT_TLS 1           /* DNS over TLS, --tls */
+#define TRANSPORT_HTTPS 2         /* DNS over HTTPS, --https */
+#define DOT_PORT 853
+#define DOH_PORT 443
+#define DEFAULT_DOH_PATH "/dns-query"
+/* defaults are set in reset_state() */
+char query_address[ADDRESS_LENGTH];
+char dns_server[ADDRESS_LENGTH];
+char tmp_dns_server[ADDRESS_LENGTH];
+char ptr_server[ADDRESS_LENGTH];
+char query_type[16];
+int query_set;
+int verbose;
+char **expected_address;
+int expected_address_cnt;
+
+int expect_authority;
+int accept_cname;
+int trace_timing;
+int use_nslookup;
+int server_port;
+int port_set;
+int transport;
+char *doh_path;
+/* every -s, for batch mode */
+char **servers;
+int server_count;
+char *records_file;
+int concurrency;
+thresholds *time_thresholds;
 
 
 static int
@@ -81,6 +116,7 @@ qstrcmp(const void *p1, const void *p2)
 }
 
 
+#ifdef NSLOOKUP_COMMAND
 char *
 check_new_address(char *temp_buffer)
 {
@@ -97,33 +133,88 @@ check_new_address(char *temp_buffer)
 
     return temp_buffer;
 }
+#endif
+
+
+/* the addresses sorted and joined with commas, as -a compares them */
+static char *
+join_addresses (char **addresses, int n_addresses)
+{
+    int i,slen;
+    char *adrp, *address;
+    qsort(addresses, n_addresses, sizeof(*addresses), qstrcmp);
+    for(i=0, slen=1; i < n_addresses; i++) {
+        slen += strlen(addresses[i])+1;
+    }
+
+    adrp = address = malloc(slen);
+    for(i=0; i < n_addresses; i++) {
+        if (i) *adrp++ = ',';
+        strcpy(adrp, addresses[i]);
+        adrp += strlen(addresses[i]);
+    }
+    *adrp = 0;
+    return address;
+}
 
 
 int
 main (int argc, char **argv)
 {
-    char *command_line = NULL;
-    char input_buffer[MAX_INPUT_BUFFER];
+    if (np_resident_requested (argc, argv))
+        return np_resident_main (argc, argv, run_check, reset_state);
+
+    reset_state ();
+    return run_check (argc, argv);
+}
+
+
+static void
+reset_state (void)
+{
+    query_address[0] = '\0';
+    dns_server[0] = '\0';
+    tmp_dns_server[0] = '\0';
+    ptr_server[0] = '\0';
+    query_type[0] = '\0';
+    query_set = FALSE;
+    verbose = FALSE;
+    expected_address = NULL;
+    expected_address_cnt = 0;
+    expect_authority = FALSE;
+    accept_cname = FALSE;
+    trace_timing = FALSE;
+    use_nslookup = FALSE;
+    server_port = NP_DNS_PORT;
+    port_set = FALSE;
+    transport = TRANSPORT_UDP;
+    doh_path = DEFAULT_DOH_PATH;
+    servers = NULL;
+    server_count = 0;
+    records_file = NULL;
+    concurrency = DEFAULT_CONCURRENCY;
+    time_thresholds = NULL;
+    np_net_reset ();
+}
+
+
+static int
+run_check (int argc, char **argv)
+{
     char *address = NULL; /* comma separated str with addrs/ptrs (sorted) */
     char **addresses = NULL;
     int n_addresses = 0;
     char *msg = NULL;
     char query_found[24] = "";
-    int query_size = 24;
     char *temp_buffer = NULL;
     int non_authoritative = FALSE;
     int result = STATE_UNKNOWN;
     double elapsed_time;
+    np_perfdata perf;
     long microsec;
     struct timeval tv;
-    int parse_address = FALSE; /* This flag scans for Address: but only after Name: */
-    output chld_out, chld_err;
     size_t i;
 
-    setlocale (LC_ALL, "");
-    bindtextdomain (PACKAGE, LOCALEDIR);
-    textdomain (PACKAGE);
-
     /* Set signal handling and alarm */
     if (signal (SIGALRM, runcmd_timeout_alarm_handler) == SIG_ERR) {
         usage_va(_("Cannot catch SIGALRM"));
@@ -136,18 +227,348 @@ main (int argc, char **argv)
         usage_va(_("Could not parse arguments"));
     }
 
-    /* get the command to run */
-    xasprintf (&command_line, "%s %s %s %s", NSLOOKUP_COMMAND, query_type, query_address, dns_server);
+    if (records_file || server_count > 1) {
+        return check_dns_batch ();
+    }
 
     alarm (timeout_interval);
     gettimeofday (&tv, NULL);
 
+#ifdef NSLOOKUP_COMMAND
+    if (use_nslookup) {
+        result = lookup_nslookup (&addresses, &n_addresses, query_found, sizeof (query_found), &non_authoritative, &msg);
+    }
+    else
+#endif
+    result = lookup_native (&addresses, &n_addresses, query_found, sizeof (query_found), &non_authoritative, &msg);
+
+    if (addresses) {
+        address = join_addresses (addresses, n_addresses);
+    }
+
+    /* compare to expected address */
+    if (result == STATE_OK && expected_address_cnt > 0) {
+        result = STATE_CRITICAL;
+        temp_buffer = "";
+        for (i=0; i<expected_address_cnt; i++) {
+            /* check if we get a match and prepare an error string */
+            if (strcasecmp(address, expected_address[i]) == 0) result = STATE_OK;
+            xasprintf(&temp_buffer, "%s%s; ", temp_buffer, expected_address[i]);
+        }
+        if (result == STATE_CRITICAL) {
+            /* Strip off last semicolon... */
+            temp_buffer[strlen(temp_buffer)-2] = '\0';
+            xasprintf(&msg, "%s%s%s%s%s", _("expected '"), temp_buffer, _("' but got '"), address, "'");
+        }
+    }
+
+    /* check if authoritative */
+    if (result == STATE_OK && expect_authority && non_authoritative) {
+        result = STATE_CRITICAL;
+
+        if (strncmp(dns_server, "", 1)) {
+            xasprintf(&msg, "%s %s %s %s", _("server"), dns_server, _("is not authoritative for"), query_address);
+        }
+        else {
+            xasprintf(&msg, "%s %s", _("there is no authoritative server for"), query_address);
+        }
+    }
+
+    /* compare query type to query found, if query type is ANY we can skip as any record is accepted*/
+    if (result == STATE_OK && strncmp(query_type, "", 1) && (strncmp(query_type, "-querytype=ANY", 15) != 0)) {
+        if (strncmp(query_type, query_found, 16) != 0) {
+          if (verbose) {
+              printf( "%s %s %s %s %s\n", _("Failed query for"), query_type, _("only found"), query_found, _(", or nothing"));
+          }
+          result = STATE_CRITICAL;
+          xasprintf(&msg, "%s %s %s %s", _("query type of"), query_type, _("was not found for"), query_address);
+        }
+    }
+
+    microsec = deltime (tv);
+    elapsed_time = (double)microsec / 1.0e6;
+
+    if (result == STATE_OK) {
+        result = get_status(elapsed_time, time_thresholds);
+        if (result == STATE_OK) {
+            printf ("%s %s: ", _("DNS"), _("OK"));
+        }
+        else if (result == STATE_WARNING) {
+            printf ("%s %s: ", _("DNS"), _("WARNING"));
+        }
+        else if (result == STATE_CRITICAL) {
+            printf ("%s %s: ", _("DNS"), _("CRITICAL"));
+        }
+        printf (ngettext("%.3f second response time", "%.3f seconds response time", elapsed_time), elapsed_time);
+        printf (". %s %s %s", query_address, _("returns"), address);
+        np_perfdata_init (&perf);
+        np_perfdata_addf (&perf, "time", elapsed_time, "s",
+                time_thresholds->warning != NULL,
+                time_thresholds->warning != NULL ? time_thresholds->warning->end : 0,
+                time_thresholds->critical != NULL,
+                time_thresholds->critical != NULL ? time_thresholds->critical->end : 0,
+                TRUE, 0, FALSE, 0);
+        if (trace_timing) {
+            np_timer_phase_perfdata (&perf, 0);
+            np_timer_phase_report (stderr);
+        }
+        printf ("|%s\n", np_perfdata_string (&perf));
+        np_perfdata_free (&perf);
+    }
+    else if (result == STATE_WARNING) {
+        printf ("%s %s\n", _("DNS WARNING -"), !strcmp (msg, "") ? _("Probably a non-existent host/domain") : msg);
+    }
+    else if (result == STATE_CRITICAL) {
+        printf ("%s %s\n", _("DNS CRITICAL -"), !strcmp (msg, "") ? _("Probably a non-existent host/domain") : msg);
+    }
+    else {
+        printf ("%s %s\n", _("DNS UNKNOWN -"), !strcmp (msg, "") ? _("Probably a non-existent host/domain") : msg);
+    }
+
+    return result;
+}
+
+
+/* what is wrong with an answer of that response code, or NULL */
+static char *
+rcode_problem (int rcode, const char *name, const char *server, int *state)
+{
+    char *msg = NULL;
+
+    *state = STATE_CRITICAL;
+    switch (rcode) {
+    case NP_DNS_NOERROR:
+        return NULL;
+    case NP_DNS_NXDOMAIN:
+        xasprintf (&msg, "%s %s %s", _("Domain"), name, _("was not found by the server"));
+        break;
+    case NP_DNS_REFUSED:
+        xasprintf (&msg, "%s %s", _("Query was refused by DNS server at"), server);
+        break;
+    case NP_DNS_SERVFAIL:
+        xasprintf (&msg, "%s %s", _("DNS failure for"), server);
+        break;
+    case NP_DNS_FORMERR:
+        *state = STATE_WARNING;
+        xasprintf (&msg, "%s %s %s", _("DNS WARNING -"), server, _("could not understand the query"));
+        break;
+    default:
+        xasprintf (&msg, "%s %s %s %s", _("DNS"), server, _("answered"), np_dns_rcode_name (rcode));
+    }
+    return msg;
+}
+
+/* The records of the answer that a query of the type asks for, put the
+ * way nslookup prints them, as far as the -a comparison goes, so that the
+ * expected addresses of existing checks still match. Returns their
+ * number; the type last found goes in query_found. */
+static int
+answer_records (const np_dns_message *resp, int type, char ***addresses_found, char *query_found, size_t query_size)
+{
+    char type_buf[16];
+    char **addresses = NULL;
+    int n_addresses = 0;
+    char *temp_buffer;
+    const np_dns_rr *rr;
+    size_t i;
+
+    for (i = 0; i < resp->count; i++) {
+        rr = &resp->rr[i];
+        if (verbose) {
+            printf ("%s\t%lu\t%s\t%s\n", rr->name, (unsigned long) rr->ttl,
+                    np_dns_type_name (rr->type, type_buf, sizeof (type_buf)), rr->data);
+        }
+        if (rr->section != NP_DNS_ANSWER || rr->class != NP_DNS_CLASS_IN ||
+            (rr->type != type && type != NP_DNS_ANY) || (rr->type == NP_DNS_CNAME && !accept_cname)) {
+            continue;
+        }
+        if (verbose) {
+            printf ("Found %s record\n", np_dns_type_name (rr->type, type_buf, sizeof (type_buf)));
+        }
+
+        addresses = realloc (addresses, sizeof (*addresses) * (n_addresses + 1));
+        /* nslookup gives the target of SRV records and the primary
+         * server of SOA records, without its dot */
+        if (rr->type == NP_DNS_SRV && (temp_buffer = strrchr (rr->data, ' '))) {
+            addresses[n_addresses] = strdup (temp_buffer + 1);
+        }
+        else if (rr->type == NP_DNS_SOA) {
+            addresses[n_addresses] = strndup (rr->data, strcspn (rr->data, " "));
+            if (strlen (addresses[n_addresses]) > 1) {
+                addresses[n_addresses][strlen (addresses[n_addresses]) - 1] = '\0';
+            }
+        }
+        else {
+            addresses[n_addresses] = strdup (rr->data);
+        }
+        n_addresses++;
+        if (query_found) {
+            snprintf (query_found, query_size, "-querytype=%s", np_dns_type_name (rr->type, type_buf, sizeof (type_buf)));
+        }
+    }
+    *addresses_found = addresses;
+    return n_addresses;
+}
+
+
+/* Ask the server ourselves. */
+static int
+lookup_native (char ***addresses_found, int *n_found, char *query_found, size_t query_size,
+               int *authority_missing, char **message)
+{
+    unsigned char query[NP_DNS_MAX_MESSAGE];
+    char name[NP_DNS_MAX_NAME], port_str[8], type_buf[16];
+    const char *server, *type_name;
+    char **addresses = NULL;
+    int n_addresses = 0;
+    char *temp_buffer;
+    struct addrinfo hints, *res;
+    np_dns_message resp;
+    np_dns_target target;
+    struct timeval now;
+    int type, len, ret, wait_ms, edns = NP_DNS_EDNS_SIZE;
+
+    type_name = query_type + strlen ("-querytype=");
+    if ((type = np_dns_type (type_name)) < 0) {
+        die (STATE_UNKNOWN, "%s %s\n", _("Unknown query type"), type_name);
+    }
+
+    /* with no -s, where nslookup would have gone first */
+    if (strlen (dns_server) > 0) {
+        server = dns_server;
+    }
+    else {
+        server = np_dns_default_server (NULL, tmp_dns_server, sizeof (tmp_dns_server));
+    }
+
+    /* like nslookup, look addresses up by their reverse name; a name
+     * longer than any DNS name is not cut down to another one */
+    if (np_dns_reverse_name (query_address, name, sizeof (name)) == NULL) {
+        len = strlen (query_address);
+        if (len >= (int) sizeof (name)) {
+            die (STATE_UNKNOWN, "%s %s\n", _("Name too long for a DNS query:"), query_address);
+        }
+        memcpy (name, query_address, len + 1);
+    }
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    snprintf (port_str, sizeof (port_str), "%d", server_port);
+    np_timer_phase_begin (NP_PHASE_DNS);
+    if (np_net_getaddrinfo (server, port_str, &hints, &res) != 0) {
+        die (STATE_CRITICAL, "%s %s %s\n", _("Connection to DNS"), server, _("was refused"));
+    }
+
+    /* two tries over UDP, leaving a third of the time for TCP */
+    wait_ms = max ((int) timeout_interval * 1000 / 3, 100);
+    gettimeofday (&now, NULL);
+    do {
+        len = np_dns_encode_query ((uint16_t) (getpid () ^ now.tv_usec), name, type, NP_DNS_CLASS_IN,
+                                   NP_DNS_RD, edns, query, sizeof (query));
+        if (len < 0) {
+            die (STATE_UNKNOWN, "%s %s\n", _("Cannot make a query for"), query_address);
+        }
+        if (verbose) {
+            printf ("%s %s %s %s:%d%s\n", _("Querying"), name, np_dns_type_name (type, type_buf, sizeof (type_buf)),
+                    server, server_port, edns ? " (EDNS)" : "");
+        }
+        if (transport != TRANSPORT_UDP) {
+            memset (&target, 0, sizeof (target));
+            target.server = server;
+            target.name = name;
+            target.type = type;
+            query_targets (&target, 1, edns ? 0 : NP_DNS_NO_EDNS, (int) timeout_interval * 1000);
+            ret = target.status;
+            errno = target.error;
+            resp = target.response;
+        }
+        else {
+            ret = np_dns_query (res->ai_addr, res->ai_addrlen, query, len, &resp, 0, wait_ms, 1);
+        }
+        /* servers from before EDNS(0) may not take the OPT record */
+        if (ret == NP_DNS_OK && resp.rcode == NP_DNS_FORMERR && edns && !resp.edns) {
+            np_dns_message_free (&resp);
+            edns = 0;
+            continue;
+        }
+        break;
+    } while (TRUE);
+    np_timer_phase_end (NP_PHASE_DNS);
+
+    if (ret == NP_DNS_TIMEOUT) {
+        die (STATE_CRITICAL, "%s %s %s\n", _("Connection to DNS"), server, _("timed out"));
+    }
+    else if (ret != NP_DNS_OK && errno == ECONNREFUSED) {
+        die (STATE_CRITICAL, "%s %s %s\n", _("Connection to DNS"), server, _("was refused"));
+    }
+    else if (ret != NP_DNS_OK && errno == ENETUNREACH) {
+        die (STATE_CRITICAL, "%s\n", _("Network is unreachable"));
+    }
+    else if (ret != NP_DNS_OK) {
+        die (STATE_CRITICAL, "%s %s: %s\n", _("No response from DNS"), server, strerror (errno));
+    }
+
+    if (verbose) {
+        printf ("%s %s, %s%s%s, %lu %s\n", _("Response"), np_dns_rcode_name (resp.rcode),
+                (resp.flags & NP_DNS_AA) ? "aa " : "", (resp.flags & NP_DNS_RA) ? "ra " : "",
+                transport == TRANSPORT_TLS ? "tls" : transport == TRANSPORT_HTTPS ? "https" : resp.tcp ? "tcp" : "udp",
+                (unsigned long) resp.counts[NP_DNS_ANSWER], _("answers"));
+    }
+
+    if ((temp_buffer = rcode_problem (resp.rcode, query_address, server, &ret)) != NULL) {
+        die (ret, "%s\n", temp_buffer);
+    }
+
+    n_addresses = answer_records (&resp, type, &addresses, query_found, query_size);
+    if (n_addresses == 0) {
+        die (STATE_CRITICAL, "%s %s %s\n", _("DNS"), server, _("has no records"));
+    }
+
+    *addresses_found = addresses;
+    *n_found = n_addresses;
+    *authority_missing = !(resp.flags & NP_DNS_AA);
+    *message = strdup ("");
+    np_dns_message_free (&resp);
+    return STATE_OK;
+}
+
+#ifdef NSLOOKUP_COMMAND
+/* Run nslookup and pick the records out of what it prints. */
+static int
+lookup_nslookup (char ***addresses_found, int *n_found, char *query_found, size_t query_size,
+                 int *authority_missing, char **message)
+{
+    char *command_line = NULL;
+    char **addresses = NULL;
+    int n_addresses = 0;
+    char *msg = NULL;
+    char *temp_buffer = NULL;
+    char port_option[32] = "";
+    int non_authoritative = FALSE;
+    int result = STATE_UNKNOWN;
+    int parse_address = FALSE; /* This flag scans for Address: but only after Name: */
+    output chld_out, chld_err;
+    size_t i;
+    int ret;
+
+    if (server_port != NP_DNS_PORT) {
+        snprintf (port_option, sizeof (port_option), "-port=%d ", server_port);
+    }
+
+    /* get the command to run */
+    xasprintf (&command_line, "%s %s%s %s %s", NSLOOKUP_COMMAND, port_option, query_type, query_address, dns_server);
+
     if (verbose) {
         printf ("%s\n", command_line);
     }
 
     /* run the command */
-    if((np_runcmd(command_line, &chld_out, &chld_err, 0)) != 0) {
+    np_timer_phase_begin (NP_PHASE_DNS);
+    ret = np_runcmd(command_line, &chld_out, &chld_err, 0);
+    np_timer_phase_end (NP_PHASE_DNS);
+    if (ret != 0) {
         msg = strdup(_("nslookup returned an error status"));
         result = STATE_WARNING;
     }
@@ -222,8 +643,8 @@ main (int argc, char **argv)
             temp_buffer = index(chld_out.line[i], '"');
             --temp_buffer;
             addresses[n_addresses++] = check_new_address(temp_buffer);
-            memset(query_found, '\0', sizeof(query_found));
-            strncpy(query_found, "-querytype=TXT", sizeof(query_found)); 
+            memset(query_found, '\0', query_size);
+            strncpy(query_found, "-querytype=TXT", query_size); 
         }
 
         /* only matching for origin records, if requested other fields could be included at a later date */
@@ -235,7 +656,7 @@ main (int argc, char **argv)
             }
             temp_buffer = index (chld_out.line[i], '=');
             addresses[n_addresses++] = check_new_address(temp_buffer);
-            strncpy(query_found, "-querytype=CNAME", sizeof(query_found));
+            strncpy(query_found, "-querytype=CNAME", query_size);
         }
         /* does not need strncmp as we want A at all times unless another record match */
         else if (parse_address == TRUE && (strstr (chld_out.line[i], "Address:") || strstr (chld_out.line[i], "Addresses:"))) {
@@ -249,13 +670,13 @@ main (int argc, char **argv)
                 if (verbose) {
                     printf("Found AAAA record\n");
                 }
-                strncpy(query_found, "-querytype=AAAA", sizeof(query_found));
+                strncpy(query_found, "-querytype=AAAA", query_size);
             }
             else {
                 if (verbose) {
                     printf("Found A record\n");
                 }
-                strncpy(query_found, "-querytype=A", sizeof(query_found));
+                strncpy(query_found, "-querytype=A", query_size);
             }
         }
         /* must be after other records with "name" as an identifier, as ptr does not spefify */
@@ -309,117 +730,804 @@ main (int argc, char **argv)
         }
     }
 
-    if (addresses) {
-        int i,slen;
-        char *adrp;
-        qsort(addresses, n_addresses, sizeof(*addresses), qstrcmp);
-        for(i=0, slen=1; i < n_addresses; i++) {
-            slen += strlen(addresses[i])+1;
-        }
+    if (addresses == NULL) {
+        die (STATE_CRITICAL, "%s%s%s\n", _("DNS CRITICAL - '"), NSLOOKUP_COMMAND, _("' msg parsing exited with no address"));
+    }
+
+    *addresses_found = addresses;
+    *n_found = n_addresses;
+    *authority_missing = non_authoritative;
+    *message = msg;
+    return result;
+}
+#endif
+
+
+/*
+ * --tls and --https: the queries to a server go over one TLS connection
+ * to it, made by sslutils so that the handshake resumes the session of an
+ * earlier run from its cache, and is made once for all of them. Over TLS
+ * (RFC 7858) they are pipelined, each after its length as over TCP, and
+ * the answers are taken in any order by id; over HTTPS (RFC 8484) each is
+ * a POST on a stream of one HTTP/2 connection. At most --concurrency are
+ * in flight at a time. The servers are asked one after the other, each
+ * within the timeout.
+ */
+
+#ifdef HAVE_SSL
+struct dns_stream {
+    np_dns_target *targets;   /* those of one server */
+    size_t count;
+    size_t sent;              /* the first sent targets have been asked */
+    size_t done;
+    int options;
+    size_t concurrency;
+    int64_t deadline;         /* in milliseconds */
+    int sd;
+};
+
+static int64_t
+stream_now_us (void)
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
 
-        adrp = address = malloc(slen);
-        for(i=0; i < n_addresses; i++) {
-            if (i) *adrp++ = ',';
-            strcpy(adrp, addresses[i]);
-            adrp += strlen(addresses[i]);
+static void
+stream_finish (struct dns_stream *st, np_dns_target *t, int status, int error)
+{
+    if (t->done) {
+        return;
+    }
+    t->status = status;
+    t->error = error;
+    t->time = (double) (stream_now_us () - t->sent) / 1e6;
+    t->done = TRUE;
+    st->done++;
+}
+
+/* every query not answered yet, after a failed read or write */
+static void
+stream_fail (struct dns_stream *st, int error)
+{
+    size_t i;
+    int status = (error == EAGAIN || error == EWOULDBLOCK || error == ETIMEDOUT) ? NP_DNS_TIMEOUT : NP_DNS_ERROR;
+
+    for (i = 0; i < st->count; i++) {
+        stream_finish (st, &st->targets[i], status, status == NP_DNS_TIMEOUT ? 0 : error);
+    }
+}
+
+/* the reads and writes of the socket to give up at the deadline; FALSE,
+ * with errno ETIMEDOUT, once it has passed */
+static int
+stream_deadline (struct dns_stream *st)
+{
+    struct timeval tv;
+    int64_t left = st->deadline - stream_now_us () / 1000;
+
+    if (left <= 0) {
+        errno = ETIMEDOUT;
+        return FALSE;
+    }
+    tv.tv_sec = left / 1000;
+    tv.tv_usec = (left % 1000) * 1000;
+    return setsockopt (st->sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv)) == 0 &&
+        setsockopt (st->sd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv)) == 0;
+}
+
+/* the answer, if it is one to the query */
+static void
+stream_answer (struct dns_stream *st, np_dns_target *t, const unsigned char *msg, size_t len)
+{
+    np_dns_message resp;
+
+    if (t == NULL || t->done || !np_dns_decode (msg, len, &resp)) {
+        return;
+    }
+    /* a FORMERR may come without the question */
+    if ((resp.qname[0] || resp.rcode == NP_DNS_NOERROR) &&
+        (!np_dns_same_name (resp.qname, t->name) || resp.qtype != t->type)) {
+        np_dns_message_free (&resp);
+        return;
+    }
+    resp.tcp = TRUE;
+    t->response = resp;
+    stream_finish (st, t, NP_DNS_OK, 0);
+}
+
+static int
+stream_encode (struct dns_stream *st, np_dns_target *t, unsigned char *out, size_t size)
+{
+    int len;
+
+    if ((len = np_dns_encode_query (t->id, t->name, t->type, NP_DNS_CLASS_IN, NP_DNS_RD,
+                                    (st->options & NP_DNS_NO_EDNS) ? 0 : NP_DNS_EDNS_SIZE, out, size)) < 0) {
+        stream_finish (st, t, NP_DNS_ERROR, EINVAL);
+    }
+    return len;
+}
+
+/* a TCP connection to the server and the handshake over it */
+static int
+stream_connect (struct dns_stream *st, const char *server)
+{
+    struct addrinfo hints, *res, *ai;
+    char port_str[8];
+    int n, err = EHOSTUNREACH, flag = 1;
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    snprintf (port_str, sizeof (port_str), "%d", server_port);
+    if ((n = np_net_getaddrinfo (server, port_str, &hints, &res)) != 0) {
+        stream_fail (st, n == EAI_SYSTEM ? errno : EHOSTUNREACH);
+        return FALSE;
+    }
+    st->sd = -1;
+    for (ai = res; ai && st->sd < 0; ai = ai->ai_next) {
+        if ((st->sd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) {
+            err = errno;
+            continue;
         }
-        *adrp = 0;
-      }
+        if (!stream_deadline (st) || connect (st->sd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            /* a connect that runs into SO_SNDTIMEO gives up with EINPROGRESS */
+            err = errno == EINPROGRESS ? ETIMEDOUT : errno;
+            close (st->sd);
+            st->sd = -1;
+        }
+    }
+    if (st->sd < 0) {
+        stream_fail (st, err);
+        return FALSE;
+    }
+    /* the queries after the first are not to wait for its ack */
+    setsockopt (st->sd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof (flag));
+
+    np_net_ssl_quiet (TRUE);
+    np_net_ssl_session_cache (server, server_port, FALSE);
+    np_net_ssl_alpn (transport == TRANSPORT_HTTPS ? "h2" : NULL);
+    errno = 0;
+    if (np_net_ssl_init_with_hostname (st->sd, (char *) server) != OK) {
+        err = (errno == EAGAIN || errno == EWOULDBLOCK) ? ETIMEDOUT : EPROTO;
+    }
+    else if (transport == TRANSPORT_HTTPS &&
+             (np_net_ssl_alpn_selected () == NULL || strcmp (np_net_ssl_alpn_selected (), "h2"))) {
+        err = EPROTONOSUPPORT;
+    }
     else {
-        die (STATE_CRITICAL, "%s%s%s\n", _("DNS CRITICAL - '"), NSLOOKUP_COMMAND, _("' msg parsing exited with no address"));
+        err = 0;
     }
+    np_net_ssl_quiet (FALSE);
+    if (verbose) {
+        printf ("%s %s:%d: %s%s\n", transport == TRANSPORT_HTTPS ? "HTTPS" : "TLS", server, server_port,
+                err ? strerror (err) : np_net_ssl_session_reused () ? _("session resumed") : _("new session"),
+                err == EPROTONOSUPPORT ? _(" (no HTTP/2)") : "");
+    }
+    if (err) {
+        np_net_ssl_cleanup ();
+        close (st->sd);
+        stream_fail (st, err);
+        return FALSE;
+    }
+    return TRUE;
+}
 
-    /* compare to expected address */
-    if (result == STATE_OK && expected_address_cnt > 0) {
-        result = STATE_CRITICAL;
-        temp_buffer = "";
-        for (i=0; i<expected_address_cnt; i++) {
-            /* check if we get a match and prepare an error string */
-            if (strcasecmp(address, expected_address[i]) == 0) result = STATE_OK;
-            xasprintf(&temp_buffer, "%s%s; ", temp_buffer, expected_address[i]);
+static void
+stream_close (struct dns_stream *st)
+{
+    np_net_ssl_cleanup ();
+    np_net_ssl_session_cache (NULL, 0, FALSE);
+    np_net_ssl_alpn (NULL);
+    close (st->sd);
+}
+
+/* DNS over TLS: the queries that fit the window in one write, then the
+ * answers of one read, until all are answered */
+static void
+dot_query (struct dns_stream *st)
+{
+    static unsigned char out[NP_DNS_MAX_MESSAGE], in[2 * (NP_DNS_MAX_MESSAGE + 2)];
+    np_dns_target **by_id, *t;
+    unsigned int id = (unsigned int) (getpid () ^ stream_now_us ()) & 0xffff;
+    size_t len, have = 0, used;
+    int n;
+
+    if ((by_id = calloc (65536, sizeof (*by_id))) == NULL) {
+        stream_fail (st, errno);
+        return;
+    }
+    while (st->done < st->count) {
+        for (len = 0; st->sent < st->count && st->sent - st->done < st->concurrency &&
+                 sizeof (out) - len >= NP_DNS_MAX_NAME + 32; st->sent++) {
+            t = &st->targets[st->sent];
+            while (by_id[id]) {
+                id = (id + 1) & 0xffff;
+            }
+            t->id = id;
+            id = (id + 1) & 0xffff;
+            if ((n = stream_encode (st, t, out + len + 2, sizeof (out) - len - 2)) < 0) {
+                continue;
+            }
+            /* RFC 1035 4.2.2, the length first */
+            out[len] = n >> 8;
+            out[len + 1] = n & 0xff;
+            len += n + 2;
+            t->sent = stream_now_us ();
+            by_id[t->id] = t;
         }
-        if (result == STATE_CRITICAL) {
-            /* Strip off last semicolon... */
-            temp_buffer[strlen(temp_buffer)-2] = '\0';
-            xasprintf(&msg, "%s%s%s%s%s", _("expected '"), temp_buffer, _("' but got '"), address, "'");
+        if (len > 0 && (!stream_deadline (st) || np_net_ssl_write (out, len) <= 0)) {
+            stream_fail (st, errno ? errno : ECONNRESET);
+            break;
+        }
+        if (st->done == st->count) {
+            break;
+        }
+
+        errno = 0;
+        if (!stream_deadline (st) || (n = np_net_ssl_read (in + have, sizeof (in) - have)) <= 0) {
+            stream_fail (st, errno ? errno : ECONNRESET);
+            break;
+        }
+        for (have += n, used = 0; have - used >= 2; used += 2 + len) {
+            len = (in[used] << 8) | in[used + 1];
+            if (have - used < 2 + len) {
+                break;
+            }
+            if ((t = by_id[(in[used + 2] << 8) | in[used + 3]]) != NULL && len >= 12) {
+                stream_answer (st, t, in + used + 2, len);
+                if (t->done) {
+                    by_id[t->id] = NULL;
+                }
+            }
         }
+        memmove (in, in + used, have - used);
+        have -= used;
     }
+    free (by_id);
+}
 
-    /* check if authoritative */
-    if (result == STATE_OK && expect_authority && non_authoritative) {
-        result = STATE_CRITICAL;
+#ifdef HAVE_NGHTTP2
+/* a query of DNS over HTTPS, on its stream */
+struct doh_query {
+    struct dns_stream *st;
+    np_dns_target *t;
+    unsigned char query[NP_DNS_MAX_NAME + 32];
+    size_t len;
+    size_t posted;
+    int status;               /* of the response */
+    unsigned char *body;
+    size_t body_len;
+};
+
+static ssize_t
+doh_read_post (nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length,
+               uint32_t *data_flags, nghttp2_data_source *source, void *user_data)
+{
+    struct doh_query *q = source->ptr;
 
-        if (strncmp(dns_server, "", 1)) {
-            xasprintf(&msg, "%s %s %s %s", _("server"), dns_server, _("is not authoritative for"), query_address);
+    if (length > q->len - q->posted) {
+        length = q->len - q->posted;
+    }
+    memcpy (buf, q->query + q->posted, length);
+    if ((q->posted += length) == q->len) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    }
+    return length;
+}
+
+static int
+doh_on_header (nghttp2_session *session, const nghttp2_frame *frame, const uint8_t *name, size_t namelen,
+               const uint8_t *value, size_t valuelen, uint8_t flags, void *user_data)
+{
+    struct doh_query *q = nghttp2_session_get_stream_user_data (session, frame->hd.stream_id);
+
+    if (q && frame->hd.type == NGHTTP2_HEADERS && namelen == 7 && !memcmp (name, ":status", 7)) {
+        q->status = atoi ((const char *) value);
+    }
+    return 0;
+}
+
+static int
+doh_on_data_chunk (nghttp2_session *session, uint8_t flags, int32_t stream_id, const uint8_t *data,
+                   size_t len, void *user_data)
+{
+    struct doh_query *q = nghttp2_session_get_stream_user_data (session, stream_id);
+    unsigned char *body;
+
+    if (q == NULL) {
+        return 0;
+    }
+    /* more than a DNS message can be is not one */
+    if (q->body_len + len > NP_DNS_MAX_MESSAGE || (body = realloc (q->body, q->body_len + len)) == NULL) {
+        nghttp2_submit_rst_stream (session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CANCEL);
+        return 0;
+    }
+    memcpy (body + q->body_len, data, len);
+    q->body = body;
+    q->body_len += len;
+    return 0;
+}
+
+static int
+doh_on_stream_close (nghttp2_session *session, int32_t stream_id, uint32_t error_code, void *user_data)
+{
+    struct doh_query *q = nghttp2_session_get_stream_user_data (session, stream_id);
+
+    if (q == NULL) {
+        return 0;
+    }
+    if (q->status == 200 && error_code == NGHTTP2_NO_ERROR) {
+        stream_answer (q->st, q->t, q->body, q->body_len);
+    }
+    else if (verbose) {
+        printf ("%s %s: HTTP %d, %s\n", _("No answer for"), q->t->name, q->status,
+                nghttp2_http2_strerror (error_code));
+    }
+    stream_finish (q->st, q->t, NP_DNS_ERROR, EPROTO);
+    free (q->body);
+    q->body = NULL;
+    return 0;
+}
+
+static int32_t
+doh_submit (nghttp2_session *session, struct doh_query *q)
+{
+    nghttp2_data_provider post = { { 0 }, doh_read_post };
+    char authority[ADDRESS_LENGTH + 8], length[16];
+    nghttp2_nv nva[7];
+    const char *names[] = { ":method", ":scheme", ":authority", ":path", "content-type", "accept", "content-length" };
+    const char *values[7];
+    size_t i;
+
+    if (server_port == DOH_PORT) {
+        snprintf (authority, sizeof (authority), "%s", q->t->server);
+    }
+    else {
+        snprintf (authority, sizeof (authority), strchr (q->t->server, ':') ? "[%s]:%d" : "%s:%d",
+                  q->t->server, server_port);
+    }
+    snprintf (length, sizeof (length), "%lu", (unsigned long) q->len);
+    values[0] = "POST";
+    values[1] = "https";
+    values[2] = authority;
+    values[3] = doh_path;
+    values[4] = values[5] = "application/dns-message";
+    values[6] = length;
+    for (i = 0; i < 7; i++) {
+        nva[i].name = (uint8_t *) names[i];
+        nva[i].namelen = strlen (names[i]);
+        nva[i].value = (uint8_t *) values[i];
+        nva[i].valuelen = strlen (values[i]);
+        nva[i].flags = NGHTTP2_NV_FLAG_NONE;
+    }
+    post.source.ptr = q;
+    return nghttp2_submit_request (session, NULL, nva, 7, &post, q);
+}
+
+/* write out what nghttp2 has queued, in one go */
+static int
+doh_flush (struct dns_stream *st, nghttp2_session *session)
+{
+    static unsigned char out[NP_DNS_MAX_MESSAGE];
+    const uint8_t *data;
+    ssize_t n;
+    size_t len = 0;
+
+    while ((n = nghttp2_session_mem_send (session, &data)) > 0) {
+        if (len + n > sizeof (out) && len > 0) {
+            if (!stream_deadline (st) || np_net_ssl_write (out, len) <= 0) {
+                return FALSE;
+            }
+            len = 0;
         }
-        else {
-            xasprintf(&msg, "%s %s", _("there is no authoritative server for"), query_address);
+        if ((size_t) n > sizeof (out)) {
+            if (!stream_deadline (st) || np_net_ssl_write (data, n) <= 0) {
+                return FALSE;
+            }
+            continue;
         }
+        memcpy (out + len, data, n);
+        len += n;
     }
+    if (n < 0) {
+        errno = EPROTO;
+        return FALSE;
+    }
+    return len == 0 || (stream_deadline (st) && np_net_ssl_write (out, len) > 0);
+}
 
-    /* compare query type to query found, if query type is ANY we can skip as any record is accepted*/
-    if (result == STATE_OK && strncmp(query_type, "", 1) && (strncmp(query_type, "-querytype=ANY", 15) != 0)) {
-        if (strncmp(query_type, query_found, 16) != 0) {
-          if (verbose) {
-              printf( "%s %s %s %s %s\n", _("Failed query for"), query_type, _("only found"), query_found, _(", or nothing"));
-          }
-          result = STATE_CRITICAL;
-          xasprintf(&msg, "%s %s %s %s", _("query type of"), query_type, _("was not found for"), query_address);
+/* DNS over HTTPS: a stream for each query, with the ids left 0 as RFC
+ * 8484 asks since the stream tells which answer is whose */
+static void
+doh_query (struct dns_stream *st)
+{
+    static unsigned char in[NP_DNS_MAX_MESSAGE];
+    nghttp2_settings_entry settings[] = {
+        { NGHTTP2_SETTINGS_ENABLE_PUSH, 0 },
+        { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, 1 << 20 }
+    };
+    nghttp2_session_callbacks *callbacks;
+    nghttp2_session *session;
+    struct doh_query *queries, *q;
+    int32_t id;
+    int n;
+
+    queries = calloc (st->count, sizeof (*queries));
+    if (queries == NULL || nghttp2_session_callbacks_new (&callbacks) != 0) {
+        die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+    }
+    nghttp2_session_callbacks_set_on_header_callback (callbacks, doh_on_header);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback (callbacks, doh_on_data_chunk);
+    nghttp2_session_callbacks_set_on_stream_close_callback (callbacks, doh_on_stream_close);
+    if (nghttp2_session_client_new (&session, callbacks, st) != 0) {
+        die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+    }
+    nghttp2_session_callbacks_del (callbacks);
+    nghttp2_submit_settings (session, NGHTTP2_FLAG_NONE, settings, sizeof (settings) / sizeof (*settings));
+
+    while (st->done < st->count) {
+        /* nghttp2 holds back streams over the server's limit itself */
+        for (; st->sent < st->count && st->sent - st->done < st->concurrency; st->sent++) {
+            q = &queries[st->sent];
+            q->st = st;
+            q->t = &st->targets[st->sent];
+            q->t->id = 0;
+            if ((n = stream_encode (st, q->t, q->query, sizeof (q->query))) < 0) {
+                continue;
+            }
+            q->len = n;
+            q->t->sent = stream_now_us ();
+            if ((id = doh_submit (session, q)) < 0) {
+                stream_finish (st, q->t, NP_DNS_ERROR, EPROTO);
+            }
+        }
+        if (!doh_flush (st, session)) {
+            stream_fail (st, errno ? errno : ECONNRESET);
+            break;
+        }
+        if (st->done == st->count) {
+            break;
+        }
+        errno = 0;
+        if (!stream_deadline (st) || (n = np_net_ssl_read (in, sizeof (in))) <= 0) {
+            stream_fail (st, errno ? errno : ECONNRESET);
+            break;
+        }
+        if (nghttp2_session_mem_recv (session, in, n) < 0) {
+            stream_fail (st, EPROTO);
+            break;
         }
     }
+    nghttp2_session_terminate_session (session, NGHTTP2_NO_ERROR);
+    doh_flush (st, session);
+    nghttp2_session_del (session);
+    for (q = queries; q < queries + st->count; q++) {
+        free (q->body);
+    }
+    free (queries);
+}
+#endif /* HAVE_NGHTTP2 */
 
-    microsec = deltime (tv);
-    elapsed_time = (double)microsec / 1.0e6;
+/* the targets server by server, as they come, each over its connection */
+static void
+dns_query_stream (np_dns_target *targets, size_t count, int options, size_t concurrency, int timeout_ms)
+{
+    struct dns_stream st;
+    size_t first, i;
+
+    signal (SIGPIPE, SIG_IGN);
+    for (i = 0; i < count; i++) {
+        memset (&targets[i].response, 0, sizeof (targets[i].response));
+        targets[i].status = NP_DNS_TIMEOUT;
+        targets[i].error = 0;
+        targets[i].time = 0;
+        targets[i].sent = stream_now_us ();
+        targets[i].done = FALSE;
+    }
+    for (first = 0; first < count; first = i) {
+        for (i = first + 1; i < count && !strcmp (targets[i].server, targets[first].server); i++)
+            ;
+        memset (&st, 0, sizeof (st));
+        st.targets = targets + first;
+        st.count = i - first;
+        st.options = options;
+        st.concurrency = concurrency;
+        st.deadline = stream_now_us () / 1000 + timeout_ms;
+        if (!stream_connect (&st, targets[first].server)) {
+            continue;
+        }
+#ifdef HAVE_NGHTTP2
+        if (transport == TRANSPORT_HTTPS) {
+            doh_query (&st);
+        }
+        else
+#endif
+        dot_query (&st);
+        stream_close (&st);
+    }
+}
+#endif /* HAVE_SSL */
 
-    if (result == STATE_OK) {
-        result = get_status(elapsed_time, time_thresholds);
-        if (result == STATE_OK) {
-            printf ("%s %s: ", _("DNS"), _("OK"));
+/* the queries of batch mode over the transport of the command line */
+static int
+query_targets (np_dns_target *targets, size_t count, int options, int timeout_ms)
+{
+    char port_str[8];
+
+#ifdef HAVE_SSL
+    if (transport != TRANSPORT_UDP) {
+        dns_query_stream (targets, count, options, concurrency, timeout_ms);
+        return TRUE;
+    }
+#endif
+    snprintf (port_str, sizeof (port_str), "%d", server_port);
+    return np_dns_query_targets (targets, count, port_str, options, concurrency, timeout_ms, 1);
+}
+
+
+/*
+ * Batch mode: the records of --records (and -H) asked of every -s server
+ * at once by np_dns_query_targets(), at most --concurrency queries in
+ * flight. Each answer is judged on its own, with the -A, -n and -w/-c
+ * options of the command line and the expected answer of its record.
+ */
+
+struct dns_record {
+    char *name;
+    char *query;              /* the name asked for, reversed for an address */
+    int type;
+    char **expected;
+    int expected_count;
+};
+
+struct dns_result {
+    int state;
+    char *msg;
+};
+
+static void
+add_record (struct dns_record **records, int *count, const char *name, const char *type_name,
+            char **expected, int expected_count, const char *where)
+{
+    char reverse_name[NP_DNS_MAX_NAME];
+    struct dns_record *r;
+
+    *records = realloc (*records, sizeof (**records) * (*count + 1));
+    if (*records == NULL) {
+        die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+    }
+    r = &(*records)[(*count)++];
+    r->name = strdup (name);
+    if (np_dns_reverse_name (name, reverse_name, sizeof (reverse_name))) {
+        r->query = strdup (reverse_name);
+    }
+    else {
+        r->query = r->name;
+    }
+    if (type_name == NULL) {
+        r->type = r->query == r->name ? NP_DNS_A : NP_DNS_PTR;
+    }
+    else if ((r->type = np_dns_type (type_name)) < 0) {
+        die (STATE_UNKNOWN, "%s%s %s\n", where, _("Unknown query type"), type_name);
+    }
+    r->expected = expected;
+    r->expected_count = expected_count;
+}
+
+/* "name [type [expected]]" lines, with # comments; - reads stdin. The
+ * expected answer is the rest of the line, compared as -a is. */
+static void
+read_records (const char *file, struct dns_record **records, int *count)
+{
+    char line[ADDRESS_LENGTH], where[ADDRESS_LENGTH + 32];
+    char *p, *name, *type, **expected;
+    FILE *fp;
+    int lineno = 0;
+
+    if (!strcmp (file, "-")) {
+        fp = stdin;
+    }
+    else if ((fp = fopen (file, "r")) == NULL) {
+        die (STATE_UNKNOWN, "%s %s: %s\n", _("Cannot read"), file, strerror (errno));
+    }
+    while (fgets (line, sizeof (line), fp)) {
+        lineno++;
+        if ((p = strchr (line, '#'))) {
+            *p = '\0';
         }
-        else if (result == STATE_WARNING) {
-            printf ("%s %s: ", _("DNS"), _("WARNING"));
+        if ((name = strtok (line, " \t\r\n")) == NULL) {
+            continue;
         }
-        else if (result == STATE_CRITICAL) {
-            printf ("%s %s: ", _("DNS"), _("CRITICAL"));
+        type = strtok (NULL, " \t\r\n");
+        expected = NULL;
+        if ((p = strtok (NULL, "\r\n"))) {
+            for (; *p == ' ' || *p == '\t'; p++)
+                ;
+            strip (p);
+            if (*p) {
+                expected = malloc (sizeof (*expected));
+                expected[0] = strdup (p);
+            }
         }
-        printf (ngettext("%.3f second response time", "%.3f seconds response time", elapsed_time), elapsed_time);
-        printf (". %s %s %s", query_address, _("returns"), address);
-        if ((time_thresholds->warning != NULL) && (time_thresholds->critical != NULL)) {
-            printf ("|%s\n", fperfdata ("time", elapsed_time, "s",
-                    TRUE, time_thresholds->warning->end,
-                    TRUE, time_thresholds->critical->end,
-                    TRUE, 0, FALSE, 0));
-        }
-        else if ((time_thresholds->warning == NULL) && (time_thresholds->critical != NULL)) {
-            printf ("|%s\n", fperfdata ("time", elapsed_time, "s",
-                    FALSE, 0,
-                    TRUE, time_thresholds->critical->end,
-                    TRUE, 0, FALSE, 0));
-        }
-        else if ((time_thresholds->warning != NULL) && (time_thresholds->critical == NULL)) {
-            printf ("|%s\n", fperfdata ("time", elapsed_time, "s",
-                    TRUE, time_thresholds->warning->end,
-                    FALSE, 0,
-                    TRUE, 0, FALSE, 0));
+        if (type) {
+            strntoupper (type, strlen (type));
         }
-        else {
-          printf ("|%s\n", fperfdata ("time", elapsed_time, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+        snprintf (where, sizeof (where), "%s:%d: ", file, lineno);
+        add_record (records, count, name, type, expected, expected ? 1 : 0, where);
+    }
+    if (fp != stdin) {
+        fclose (fp);
+    }
+}
+
+static void
+dns_result_set (struct dns_result *res, int state, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start (ap, fmt);
+    if (vasprintf (&res->msg, fmt, ap) < 0) {
+        die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+    }
+    va_end (ap);
+    res->state = state;
+}
+
+/* the tests run_check() makes of a single answer */
+static void
+dns_target_evaluate (const struct dns_record *r, const np_dns_target *t, struct dns_result *res)
+{
+    char **addresses = NULL;
+    char *address, *problem, *expected = NULL;
+    int n_addresses, state, i;
+
+    if (t->status == NP_DNS_TIMEOUT) {
+        dns_result_set (res, STATE_CRITICAL, "%s", _("timed out"));
+        return;
+    }
+    if (t->status != NP_DNS_OK) {
+        dns_result_set (res, STATE_CRITICAL, "%s", strerror (t->error));
+        return;
+    }
+    if ((problem = rcode_problem (t->response.rcode, r->name, t->server, &state)) != NULL) {
+        res->state = state;
+        res->msg = problem;
+        return;
+    }
+    if ((n_addresses = answer_records (&t->response, r->type, &addresses, NULL, 0)) == 0) {
+        dns_result_set (res, STATE_CRITICAL, "%s (%.3fs)", _("has no records"), t->time);
+        return;
+    }
+    address = join_addresses (addresses, n_addresses);
+    for (i = 0; i < n_addresses; i++) {
+        free (addresses[i]);
+    }
+    free (addresses);
+
+    state = r->expected_count ? STATE_CRITICAL : STATE_OK;
+    for (i = 0; i < r->expected_count; i++) {
+        if (strcasecmp (address, r->expected[i]) == 0) {
+            state = STATE_OK;
         }
+        xasprintf (&expected, "%s%s%s", expected ? expected : "", expected ? "; " : "", r->expected[i]);
     }
-    else if (result == STATE_WARNING) {
-        printf ("%s %s\n", _("DNS WARNING -"), !strcmp (msg, "") ? _("Probably a non-existent host/domain") : msg);
+    if (state != STATE_OK) {
+        dns_result_set (res, state, "%s%s%s%s%s", _("expected '"), expected, _("' but got '"), address, "'");
     }
-    else if (result == STATE_CRITICAL) {
-        printf ("%s %s\n", _("DNS CRITICAL -"), !strcmp (msg, "") ? _("Probably a non-existent host/domain") : msg);
+    else if (expect_authority && !(t->response.flags & NP_DNS_AA)) {
+        dns_result_set (res, STATE_CRITICAL, "%s (%s)", _("is not authoritative"), address);
     }
     else {
-        printf ("%s %s\n", _("DNS UNKNOWN -"), !strcmp (msg, "") ? _("Probably a non-existent host/domain") : msg);
+        dns_result_set (res, get_status (t->time, time_thresholds), "%s %s (%.3fs)", _("returns"), address, t->time);
+    }
+    free (expected);
+    free (address);
+}
+
+static int
+check_dns_batch (void)
+{
+    struct dns_record *records = NULL;
+    struct dns_result *results;
+    np_dns_target *targets, *t;
+    np_perfdata perf;
+    char type_buf[16], label[ADDRESS_LENGTH + 64];
+    const char *type_name;
+    char *problems = NULL;
+    int record_count = 0, count, count_ok = 0, result = STATE_OK;
+    int i, j, k;
+
+    if (use_nslookup) {
+        usage4 (_("--records and more than one -s cannot be used with --use-nslookup"));
+    }
+    if (records_file) {
+        read_records (records_file, &records, &record_count);
+    }
+    if (query_address[0]) {
+        add_record (&records, &record_count, query_address, query_type + strlen ("-querytype="),
+                    expected_address, expected_address_cnt, "");
+    }
+    if (record_count == 0) {
+        die (STATE_UNKNOWN, "%s\n", _("No records to look up"));
+    }
+    if (server_count == 0) {
+        servers = malloc (sizeof (*servers));
+        servers[server_count++] = strdup (np_dns_default_server (NULL, tmp_dns_server, sizeof (tmp_dns_server)));
+    }
+
+    count = record_count * server_count;
+    targets = calloc (count, sizeof (*targets));
+    results = calloc (count, sizeof (*results));
+    if (targets == NULL || results == NULL) {
+        die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+    }
+    /* server by server, so that each is looked up once */
+    for (k = j = 0; j < server_count; j++) {
+        for (i = 0; i < record_count; i++, k++) {
+            targets[k].server = servers[j];
+            targets[k].name = records[i].query;
+            targets[k].type = records[i].type;
+        }
+    }
+
+    /* -t bounds each query here, two tries of half of it, or the
+     * connection to each server with --tls and --https */
+    alarm (0);
+    if (verbose) {
+        printf ("%d %s %d %s, %d %s\n", record_count, _("records of"), server_count, _("servers"),
+                concurrency, _("queries at a time"));
+    }
+    np_timer_phase_begin (NP_PHASE_DNS);
+    if (!query_targets (targets, count, 0, transport == TRANSPORT_UDP ?
+                        max ((int) timeout_interval * 1000 / 2, 100) : (int) timeout_interval * 1000)) {
+        die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+    }
+    np_timer_phase_end (NP_PHASE_DNS);
+
+    np_perfdata_init (&perf);
+    for (k = 0; k < count; k++) {
+        t = &targets[k];
+        dns_target_evaluate (&records[k % record_count], t, &results[k]);
+        result = max_state_alt (results[k].state, result);
+        type_name = np_dns_type_name (t->type, type_buf, sizeof (type_buf));
+        if (results[k].state == STATE_OK) {
+            count_ok++;
+        }
+        else {
+            xasprintf (&problems, "%s%s%s %s @%s: %s", problems ? problems : "", problems ? "; " : "",
+                       records[k % record_count].name, type_name, t->server, results[k].msg);
+        }
+        if (t->status != NP_DNS_OK) {
+            continue;
+        }
+        snprintf (label, sizeof (label), "%s:%s@%s", records[k % record_count].name, type_name, t->server);
+        np_perfdata_addf (&perf, label, t->time, "s",
+                time_thresholds->warning != NULL,
+                time_thresholds->warning != NULL ? time_thresholds->warning->end : 0,
+                time_thresholds->critical != NULL,
+                time_thresholds->critical != NULL ? time_thresholds->critical->end : 0,
+                TRUE, 0, FALSE, 0);
+    }
+    if (trace_timing) {
+        np_timer_phase_perfdata (&perf, 0);
+        np_timer_phase_report (stderr);
     }
 
+    printf ("%s %s: %d of %d %s%s%s|%s\n", _("DNS"), state_text (result), count_ok, count, _("records OK"),
+            problems ? " - " : "", problems ? problems : "", np_perfdata_string (&perf));
+    for (k = 0; k < count; k++) {
+        printf ("[%s] %s %s @%s: %s\n", state_text (results[k].state), records[k % record_count].name,
+                np_dns_type_name (targets[k].type, type_buf, sizeof (type_buf)), targets[k].server, results[k].msg);
+    }
+    np_perfdata_free (&perf);
+    np_dns_targets_free (targets, count);
     return result;
 }
 
-
 int
 error_scan (char *input_buffer)
 {
@@ -492,6 +1600,15 @@ process_arguments (int argc, char **argv)
     char *warning = NULL;
     char *critical = NULL;
 
+    enum {
+        TRACE_TIMING_OPTION = CHAR_MAX + 1,
+        USE_NSLOOKUP_OPTION,
+        RECORDS_OPTION,
+        CONCURRENCY_OPTION,
+        TLS_OPTION,
+        HTTPS_OPTION
+    };
+
     int opt_index = 0;
     static struct option long_opts[] = {
         {"help", no_argument, 0, 'h'},
@@ -500,6 +1617,7 @@ process_arguments (int argc, char **argv)
         {"timeout", required_argument, 0, 't'},
         {"hostname", required_argument, 0, 'H'},
         {"server", required_argument, 0, 's'},
+        {"port", required_argument, 0, 'p'},
         {"reverse-server", required_argument, 0, 'r'},
         {"querytype", required_argument, 0, 'q'},
         {"expected-address", required_argument, 0, 'a'},
@@ -507,6 +1625,12 @@ process_arguments (int argc, char **argv)
         {"accept-cname", no_argument, 0, 'n'},
         {"warning", required_argument, 0, 'w'},
         {"critical", required_argument, 0, 'c'},
+        {"trace-timing", no_argument, 0, TRACE_TIMING_OPTION},
+        {"use-nslookup", no_argument, 0, USE_NSLOOKUP_OPTION},
+        {"records", required_argument, 0, RECORDS_OPTION},
+        {"concurrency", required_argument, 0, CONCURRENCY_OPTION},
+        {"tls", no_argument, 0, TLS_OPTION},
+        {"https", optional_argument, 0, HTTPS_OPTION},
         {0, 0, 0, 0}
     };
 
@@ -521,7 +1645,7 @@ process_arguments (int argc, char **argv)
     }
 
     while (1) {
-        c = getopt_long (argc, argv, "hVvAnt:H:s:r:a:q:w:c:", long_opts, &opt_index);
+        c = getopt_long (argc, argv, "hVvAnt:H:s:p:r:a:q:w:c:", long_opts, &opt_index);
 
         if (c == -1 || c == EOF) {
             break;
@@ -531,11 +1655,11 @@ process_arguments (int argc, char **argv)
         /* help */
         case 'h':
             print_help ();
-            exit (STATE_OK);
+            np_exit (STATE_OK);
        /* version */
         case 'V':
             print_revision (progname, NP_VERSION);
-            exit (STATE_OK);
+            np_exit (STATE_OK);
         /* verbose */
         case 'v':
             verbose = TRUE;
@@ -560,6 +1684,16 @@ process_arguments (int argc, char **argv)
                 die (STATE_UNKNOWN, "%s\n", _("Input buffer overflow"));
             }
             strcpy (dns_server, optarg);
+            servers = realloc (servers, sizeof (*servers) * (server_count + 1));
+            servers[server_count++] = strdup (optarg);
+            break;
+        /* port of the server */
+        case 'p':
+            if (!is_intpos (optarg) || atoi (optarg) > 65535) {
+                usage4 (_("Port must be a positive integer"));
+            }
+            server_port = atoi (optarg);
+            port_set = TRUE;
             break;
         /* reverse server name */
         case 'r':
@@ -596,6 +1730,42 @@ process_arguments (int argc, char **argv)
         case 'n':
             accept_cname = TRUE;
             break;
+        case TRACE_TIMING_OPTION:
+            trace_timing = TRUE;
+            break;
+        case USE_NSLOOKUP_OPTION:
+#ifndef NSLOOKUP_COMMAND
+            die (STATE_UNKNOWN, "%s\n", _("nslookup is not installed, so --use-nslookup cannot be used"));
+#endif
+            use_nslookup = TRUE;
+            break;
+        case RECORDS_OPTION:
+            records_file = optarg;
+            break;
+        case CONCURRENCY_OPTION:
+            if (!is_intpos (optarg)) {
+                usage4 (_("Concurrency must be a positive integer"));
+            }
+            concurrency = atoi (optarg);
+            break;
+        case TLS_OPTION:
+#ifndef HAVE_SSL
+            usage4 (_("Invalid option - SSL is not available"));
+#endif
+            transport = TRANSPORT_TLS;
+            break;
+        case HTTPS_OPTION:
+#ifndef HAVE_NGHTTP2
+            usage4 (_("HTTP/2 support was not compiled in"));
+#endif
+            transport = TRANSPORT_HTTPS;
+            if (optarg) {
+                if (*optarg != '/') {
+                    usage2 (_("The path of --https must start with a /"), optarg);
+                }
+                doh_path = optarg;
+            }
+            break;
         /* expect authority */
         case 'A':
             expect_authority = TRUE;
@@ -621,19 +1791,30 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments ()
 {
-    if (query_address[0] == 0) {
+    if (query_address[0] == 0 && records_file == NULL) {
         return ERROR;
     }
 
+    if (transport != TRANSPORT_UDP) {
+        if (use_nslookup) {
+            usage4 (_("--tls and --https cannot be used with --use-nslookup"));
+        }
+        if (!port_set) {
+            server_port = transport == TRANSPORT_TLS ? DOT_PORT : DOH_PORT;
+        }
+    }
+
     /* Bind 9.11.x onwards performs a query for both A and AAAA records */
     /* The previous default behavior of nslookup was just A records. */
     /* To ensure that exisitng users of this plugin do not get incorrect results */
     /* set the querytype to A if it has not already been specified. */
     /* If an end user wants both A and AAAA then they need to use ANY. */
+    /* An address is looked up by its reverse name, for its PTR records. */
     if (strcmp(query_type, "") == 0) {
+        char reverse_name[NP_DNS_MAX_NAME];
         /*query_type = "-querytype=A";*/
         strcpy(query_type, "-querytype=");
-        strcat(query_type, "A");
+        strcat(query_type, np_dns_reverse_name(query_address, reverse_name, sizeof(reverse_name)) ? "PTR" : "A");
         query_set = TRUE;
     }
 
@@ -649,9 +1830,9 @@ print_help (void)
     printf ("%s\n", "Copyright (c) 1999 Ethan Galstad <nagios@nagios.org>");
     printf (COPYRIGHT, copyright, email);
 
-    printf ("%s\n", _("This plugin uses the nslookup program to obtain the IP address for the given host/domain query."));
+    printf ("%s\n", _("This plugin asks a DNS server for the IP address (or other records) of the given host/domain query."));
     printf ("%s\n", _("An optional DNS server to use may be specified."));
-    printf ("%s\n", _("If no DNS server is specified, the default server(s) specified in /etc/resolv.conf will be used."));
+    printf ("%s\n", _("If no DNS server is specified, the first server specified in /etc/resolv.conf will be used."));
 
     printf ("\n\n");
 
@@ -664,9 +1845,11 @@ print_help (void)
     printf ("    %s\n", _("The name or address you want to query"));
     printf ("%s\n", " -s, --server=HOST");
     printf ("    %s\n", _("Optional DNS server you want to use for the lookup"));
+    printf ("%s\n", " -p, --port=INTEGER");
+    printf ("    %s (%s %d)\n", _("Port of the DNS server"), _("default:"), NP_DNS_PORT);
     printf ("%s\n", " -q, --querytype=TYPE");
     printf ("    %s\n", _("Optional DNS record query type where TYPE =(A, AAAA, SRV, TXT, MX, ANY)"));
-    printf ("    %s\n", _("The default query type is 'A' (IPv4 host entry)"));
+    printf ("    %s\n", _("The default query type is 'A' (IPv4 host entry), or 'PTR' for an address"));
     printf ("    %s\n", _("BIND 9.11.x onwards supports both 'A' and 'AAAA', if you want both use 'ANY'"));
     printf ("%s\n", " -a, --expected-address=IP-ADDRESS|HOST");
     printf ("    %s\n", _("Optional IP-ADDRESS you expect the DNS server to return. HOST must end with"));
@@ -686,6 +1869,34 @@ print_help (void)
 
     printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
+    printf (UT_TRACE_TIMING);
+
+    printf ("%s\n", " --use-nslookup");
+    printf ("    %s\n", _("Run nslookup and read what it prints instead of asking the server directly"));
+    printf ("    %s\n", _("over UDP (and TCP for truncated answers)"));
+    printf ("%s\n", " --records=FILE");
+    printf ("    %s\n", _("Look up the records of the file (- for stdin) as well as -H, one per line as"));
+    printf ("    %s\n", _("\"name [type [expected]]\" where expected is compared as -a is. Each record is"));
+    printf ("    %s\n", _("asked of every server given with -s (which can be repeated for this) at the"));
+    printf ("    %s\n", _("same time, and each answer is judged and reported on its own. -t is the time"));
+    printf ("    %s\n", _("for each query here. More than one -s does this for -H alone"));
+    printf ("%s\n", " --concurrency=INTEGER");
+    printf ("    %s (%s %d)\n", _("Queries in flight at once with --records"), _("default:"), DEFAULT_CONCURRENCY);
+#ifdef HAVE_SSL
+    printf ("%s\n", " --tls");
+    printf ("    %s (%s %d)\n", _("Ask over DNS over TLS, RFC 7858"), _("default port:"), DOT_PORT);
+#endif
+#ifdef HAVE_NGHTTP2
+    printf ("%s\n", " --https[=PATH]");
+    printf ("    %s (%s %s, %s %d)\n", _("Ask over DNS over HTTPS, RFC 8484, with HTTP/2"), _("default:"),
+            DEFAULT_DOH_PATH, _("port"), DOH_PORT);
+#endif
+#ifdef HAVE_SSL
+    printf ("    %s\n", _("All queries to a server share one connection, pipelined over TLS and as"));
+    printf ("    %s\n", _("concurrent streams over HTTPS, and its TLS session is kept in the state"));
+    printf ("    %s\n", _("directory to be resumed by the next run. -t is then the time for each server"));
+#endif
+
     printf (UT_SUPPORT);
 }
 
@@ -694,5 +1905,6 @@ void
 print_usage (void)
 {
     printf ("%s\n", _("Usage:"));
-    printf ("%s %s\n", progname, "-H host [-s server] [-q type ] [-a expected-address] [-A] [-n] [-t timeout] [-w warn] [-c crit]");
+    printf ("%s %s\n", progname, "-H host [-s server] [-p port] [-q type ] [-a expected-address] [-A] [-n] [-t timeout] [-w warn] [-c crit] [--trace-timing] [--use-nslookup] [--tls | --https[=PATH]]");
+    printf ("%s %s\n", progname, "[-H host] --records=FILE [-s server ...] [-p port] [-A] [-n] [-t timeout] [-w warn] [-c crit] [--concurrency=N] [--tls | --https[=PATH]]");
 }
@@ -44,9 +44,7 @@ main (int argc, char **argv)
 {
   int result = STATE_UNKNOWN;
 
-  setlocale (LC_ALL, "");
-  bindtextdomain (PACKAGE, LOCALEDIR);
-  textdomain (PACKAGE);
+  argv = np_output_opts (&argc, argv);
 
   if (argc < 2)
     usage4 (_("Could not parse arguments"));
@@ -110,6 +108,8 @@ print_help (void)
   print_usage ();
 
   printf (UT_HELP_VRSN);
+  printf (" --output-format=FORMAT\n");
+  printf ("    %s\n", _("text (the default), or json"));
 
   printf (UT_SUPPORT);
 }
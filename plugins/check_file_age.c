@@ -0,0 +1,327 @@
+/*****************************************************************************
+*
+* Nagios check_file_age plugin
+*
+* License: GPL
+* Copyright (c) 2003 Steven Grimm <koreth-nagios@midwinter.com>
+* Copyright (c) 2003-2014 Nagios Plugins Development Team
+*
+* Description:
+*
+* This file contains the check_file_age plugin
+*
+* Checks the size and modification time of files to make sure they are
+* not empty and that they are sufficiently recent. Any number of files or
+* glob patterns are checked in one run; the files of a directory are
+* stat'ed relative to one descriptor of it.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+const char *progname = "check_file_age";
+const char *copyright = "2003-2014";
+const char *email = "devel@nagios-plugins.org";
+
+#include "common.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/stat.h>
+
+int process_arguments (int, char **);
+void print_help (void);
+void print_usage (void);
+int file_stat (int dirfd, const char *name, time_t *mtime, off_t *size);
+
+char **patterns = NULL;
+size_t npatterns = 0;
+double warning_age = 240;
+double critical_age = 600;
+double warning_size = 0;
+double critical_size = 0;
+int ignore_missing = FALSE;
+int verbose = 0;
+
+int
+main (int argc, char **argv)
+{
+	int result = STATE_OK, state, counter = 0, dirfd = -1, flags;
+	glob_t files;
+	char *path, *dir, *base, *lastdir = NULL, *label, *p;
+	char *output, *perf;
+	time_t now, mtime;
+	off_t size;
+	long age;
+	size_t i;
+
+	/* Parse extra opts if any */
+	argv=np_extra_opts (&argc, argv, progname);
+
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	/* a pattern that matches nothing stays as it is, to be reported missing */
+	memset (&files, 0, sizeof (files));
+	for (i = 0; i < npatterns; i++) {
+		flags = GLOB_NOCHECK | (i ? GLOB_APPEND : 0);
+		if (glob (patterns[i], flags, NULL, &files) == GLOB_NOSPACE)
+			die (STATE_UNKNOWN, "FILE_AGE UNKNOWN: %s\n", _("Cannot allocate memory"));
+	}
+
+	output = strdup ("");
+	perf = strdup ("");
+	time (&now);
+	for (i = 0; i < files.gl_pathc; i++) {
+		path = files.gl_pathv[i];
+
+		/* one descriptor for each run of files of the same directory */
+		dir = strdup (path);
+		if ((p = strrchr (dir, '/')) != NULL) {
+			p[p == dir] = '\0';
+			base = path + (p - dir) + 1;
+		} else {
+			strcpy (dir, ".");
+			base = path;
+		}
+		if (lastdir == NULL || strcmp (dir, lastdir)) {
+			if (dirfd >= 0)
+				close (dirfd);
+			dirfd = open (dir, O_RDONLY);
+			free (lastdir);
+			lastdir = dir;
+		}
+		else
+			free (dir);
+
+		if (*output)
+			xasprintf (&output, "%s\n", output);
+
+		if (dirfd < 0 || file_stat (dirfd, base, &mtime, &size) != 0) {
+			if (ignore_missing) {
+				xasprintf (&output, _("%sFILE_AGE OK: %s doesn't exist, but ignore-missing was set"), output, path);
+				state = STATE_OK;
+			} else {
+				xasprintf (&output, _("%sFILE_AGE CRITICAL: File not found - %s"), output, path);
+				state = STATE_CRITICAL;
+			}
+		} else {
+			age = (long) (now - mtime);
+			if (files.gl_pathc == 1)
+				xasprintf (&perf, "age=%lds;%.0f;%.0f size=%lldB;%.0f;%.0f;0", age,
+				           warning_age, critical_age, (long long) size, warning_size, critical_size);
+			else {
+				/* the file's name, safe as a label */
+				label = strdup (strrchr (path, '/') ? strrchr (path, '/') + 1 : path);
+				for (p = label; *p; p++)
+					if (*p == '=' || *p == '\'' || *p == '"' || *p == ' ')
+						*p = '_';
+				xasprintf (&perf, "%s%s%s_age=%lds;%.0f;%.0f %s_size=%lldB;%.0f;%.0f;0", perf, *perf ? " " : "",
+				           label, age, warning_age, critical_age, label, (long long) size, warning_size, critical_size);
+				free (label);
+			}
+
+			if ((critical_age && age > critical_age) || (critical_size && size < critical_size))
+				state = STATE_CRITICAL;
+			else if ((warning_age && age > warning_age) || (warning_size && size < warning_size))
+				state = STATE_WARNING;
+			else
+				state = STATE_OK;
+			xasprintf (&output, _("%sFILE_AGE %s: %s is %ld seconds old and %lld bytes"), output,
+			           state_text (state), path, age, (long long) size);
+		}
+
+		/* the files at the worst state are counted; there is no UNKNOWN here */
+		if (counter == 0 || state > result) {
+			counter = 1;
+			result = state;
+		} else if (state == result)
+			counter++;
+	}
+	if (dirfd >= 0)
+		close (dirfd);
+
+	if (files.gl_pathc == 1)
+		printf ("%s | %s\n", output, perf);
+	else
+		printf (_("%s: %d files are %s\n%s | %s\n"), state_text (result), counter, state_text (result), output, perf);
+	globfree (&files);
+	return result;
+}
+
+
+
+/* the modification time and size of name in dirfd, following links; only
+ * these two are asked for where there is statx() */
+int
+file_stat (int dirfd, const char *name, time_t *mtime, off_t *size)
+{
+	struct stat st;
+#ifdef STATX_MTIME
+	struct statx stx;
+
+	if (statx (dirfd, name, 0, STATX_MTIME | STATX_SIZE, &stx) == 0) {
+		*mtime = stx.stx_mtime.tv_sec;
+		*size = stx.stx_size;
+		return 0;
+	}
+	if (errno != ENOSYS)
+		return -1;
+#endif
+	if (fstatat (dirfd, name, &st, 0) != 0)
+		return -1;
+	*mtime = st.st_mtime;
+	*size = st.st_size;
+	return 0;
+}
+
+
+
+/* process command-line arguments */
+int
+process_arguments (int argc, char **argv)
+{
+	int c;
+
+	int option = 0;
+	static struct option longopts[] = {
+		{"file", required_argument, 0, 'f'},
+		{"warning-age", required_argument, 0, 'w'},
+		{"critical-age", required_argument, 0, 'c'},
+		{"warning-size", required_argument, 0, 'W'},
+		{"critical-size", required_argument, 0, 'C'},
+		{"ignore-missing", no_argument, 0, 'i'},
+		{"version", no_argument, 0, 'V'},
+		{"help", no_argument, 0, 'h'},
+		{"verbose", no_argument, 0, 'v'},
+		{0, 0, 0, 0}
+	};
+
+	while (1) {
+		c = getopt_long (argc, argv, "hVvif:w:c:W:C:", longopts, &option);
+
+		if (c == -1 || c == EOF)
+			break;
+
+		switch (c) {
+		case 'h':									/* help */
+			print_help ();
+			exit (STATE_OK);
+		case 'V':									/* version */
+			print_revision (progname, NP_VERSION);
+			exit (STATE_OK);
+		case 'f':									/* file or pattern */
+			patterns = realloc (patterns, (npatterns + 1) * sizeof (char *));
+			patterns[npatterns++] = optarg;
+			break;
+		case 'w':
+			if (!is_numeric (optarg))
+				usage2 (_("Warning age must be a number of seconds"), optarg);
+			warning_age = strtod (optarg, NULL);
+			break;
+		case 'c':
+			if (!is_numeric (optarg))
+				usage2 (_("Critical age must be a number of seconds"), optarg);
+			critical_age = strtod (optarg, NULL);
+			break;
+		case 'W':
+			if (!is_numeric (optarg))
+				usage2 (_("Warning size must be a number of bytes"), optarg);
+			warning_size = strtod (optarg, NULL);
+			break;
+		case 'C':
+			if (!is_numeric (optarg))
+				usage2 (_("Critical size must be a number of bytes"), optarg);
+			critical_size = strtod (optarg, NULL);
+			break;
+		case 'i':
+			ignore_missing = TRUE;
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			usage5 ();
+		}
+	}
+
+	/* and the files after the options */
+	for (c = optind; c < argc; c++) {
+		patterns = realloc (patterns, (npatterns + 1) * sizeof (char *));
+		patterns[npatterns++] = argv[c];
+	}
+
+	if (npatterns == 0)
+		die (STATE_UNKNOWN, "FILE_AGE UNKNOWN: %s\n", _("No file specified"));
+
+	return OK;
+}
+
+
+
+void
+print_help (void)
+{
+	print_revision (progname, NP_VERSION);
+
+	printf ("Copyright (c) 2003 Steven Grimm\n");
+	printf (_(COPYRIGHT), copyright, email);
+
+	printf ("%s\n", _("This plugin checks that files are recent enough and not too small."));
+
+	printf ("\n\n");
+
+	print_usage ();
+
+	printf (UT_HELP_VRSN);
+	printf (UT_EXTRA_OPTS);
+
+	printf (" %s\n", "-f, --file=FILE");
+	printf ("    %s\n", _("The file or glob pattern to check; may be given more than once, and files"));
+	printf ("    %s\n", _("may also follow the options"));
+	printf (" %s\n", "-w, --warning-age=SECONDS");
+	printf ("    %s\n", _("Files must be no more than this many seconds old (default: 240)"));
+	printf (" %s\n", "-c, --critical-age=SECONDS");
+	printf ("    %s\n", _("Files must be no more than this many seconds old (default: 600)"));
+	printf (" %s\n", "-W, --warning-size=BYTES");
+	printf ("    %s\n", _("Files must be at least this many bytes long (default: 0)"));
+	printf (" %s\n", "-C, --critical-size=BYTES");
+	printf ("    %s\n", _("Files must be at least this many bytes long (default: 0)"));
+	printf (" %s\n", "-i, --ignore-missing");
+	printf ("    %s\n", _("Return OK if a file does not exist"));
+	printf (UT_VERBOSE);
+
+	printf ("\n");
+	printf ("%s\n", _("Notes:"));
+	printf (" %s\n", _("The thresholds apply to each file, and the result is the worst of their"));
+	printf (" %s\n", _("states. With more than one file, a summary line counts the files at that"));
+	printf (" %s\n", _("state and the perfdata labels start with each file's name."));
+
+	printf ("\n");
+	printf ("%s\n", _("Examples:"));
+	printf (" %s\n", "check_file_age -w 3600 -c 7200 -f '/var/spool/export/*.csv' -f /var/run/app.stamp");
+
+	printf (UT_SUPPORT);
+}
+
+
+
+void
+print_usage (void)
+{
+	printf ("%s\n", _("Usage:"));
+	printf ("%s [-w <secs>] [-c <secs>] [-W <size>] [-C <size>] [-i] -f <file> [-f <file>...]\n", progname);
+}
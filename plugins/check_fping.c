@@ -36,6 +36,7 @@ const char *email = "devel@nagios-plugins.org";
 #include "common.h"
 #include "popen.h"
 #include "netutils.h"
+#include "icmputils.h"
 #include "utils.h"
 
 enum {
@@ -45,13 +46,19 @@ enum {
   RTA = 1
 };
 
+int fping_native (void);
+int fping_command (void);
+int host_state (const np_icmp_host *, const char *, char **, char **);
 int textscan (char *buf);
 int process_arguments (int, char **);
 int get_threshold (char *arg, char *rv[2]);
+void add_hosts (const char *, int);
 void print_help (void);
 void print_usage (void);
 
 char *server_name = NULL;
+char **server_names = NULL;
+int server_count = 0;
 char *sourceip = NULL;
 char *sourceif = NULL;
 int packet_size = PACKET_SIZE;
@@ -70,6 +77,180 @@ int wrta_p = FALSE;
 
 int
 main (int argc, char **argv)
+{
+  int status;
+
+  /* Parse extra opts if any */
+  argv=np_extra_opts (&argc, argv, progname);
+
+  if (process_arguments (argc, argv) == ERROR)
+    usage4 (_("Could not parse arguments"));
+
+  if ((status = fping_native ()) >= 0)
+    return status;
+  if (server_count > 1)
+    die (STATE_UNKNOWN, _("FPING UNKNOWN - No ICMP socket to ping more than one host with: %s\n"),
+         strerror (errno));
+  return fping_command ();
+}
+
+
+
+/* Pings the hosts with the packets sent and read here, all at once.
+ * Returns -1 if there is no ICMP socket to do that with, for fping to
+ * do it instead. */
+int
+fping_native (void)
+{
+  np_icmp_host *hosts, source;
+  np_icmp_options opts;
+  np_rate rate;
+  char **msg, **perf, *problems = NULL, *all_perf = NULL, *throttled = NULL;
+  int *state, *resolved, result = STATE_OK, count = 0, count_ok = 0, i;
+
+  hosts = calloc (server_count, sizeof (*hosts));
+  state = calloc (server_count, sizeof (*state));
+  resolved = calloc (server_count, sizeof (*resolved));
+  msg = calloc (server_count, sizeof (*msg));
+  perf = calloc (server_count, sizeof (*perf));
+  if (hosts == NULL || state == NULL || resolved == NULL || msg == NULL || perf == NULL)
+    die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+
+  /* the hosts that are found are pinged, in a list of their own */
+  for (i = 0; i < server_count; i++) {
+    if (np_icmp_resolve (&hosts[count], server_names[i], address_family) == 0) {
+      resolved[i] = TRUE;
+      count++;
+    } else if (server_count == 1) {
+      die (STATE_CRITICAL, _("FPING UNKNOWN - %s not found\n"), server_name);
+    }
+  }
+
+  memset (&opts, 0, sizeof (opts));
+  opts.packets = packet_count;
+  opts.size = packet_size;
+  /* fping's default period; an answer may take that long, up to 2s */
+  opts.interval = packet_interval ? packet_interval : 1000;
+  opts.wait = target_timeout ? target_timeout : opts.interval < 2000 ? opts.interval : 2000;
+  opts.interface = sourceif;
+  opts.verbose = verbose;
+  if (np_net_max_rate) {
+    np_rate_init (&rate, np_net_max_rate, 1);
+    opts.rate = &rate;
+  }
+  if (sourceip) {
+    if (np_icmp_resolve (&source, sourceip, address_family) != 0)
+      die (STATE_UNKNOWN, _("FPING UNKNOWN - %s parameter error\n"), "host");
+    opts.source = &source.addr;
+  }
+
+  switch (np_icmp_ping (hosts, count, &opts)) {
+  case NP_ICMP_NO_SOCKET:
+    if (verbose)
+      printf (_("No ICMP socket (%s), running fping\n"), strerror (errno));
+    return -1;
+  case NP_ICMP_BAD_SOURCE:
+    die (STATE_UNKNOWN, _("FPING UNKNOWN - %s parameter error\n"), "host");
+  }
+
+  if (np_net_max_rate)
+    xasprintf (&throttled, "%s", fperfdata ("throttled", rate.throttled, "s",
+                                            FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+
+  if (server_count == 1) {
+    state[0] = host_state (&hosts[0], "", &msg[0], &perf[0]);
+    if (throttled)
+      xasprintf (&perf[0], "%s%s%s", perf[0] ? perf[0] : "", perf[0] ? " " : "", throttled);
+    die (state[0], "FPING %s - %s%s%s\n", state_text (state[0]), msg[0], perf[0] ? "|" : "",
+         perf[0] ? perf[0] : "");
+  }
+
+  for (i = count = 0; i < server_count; i++) {
+    if (resolved[i]) {
+      state[i] = host_state (&hosts[count++], "_", &msg[i], &perf[i]);
+    } else {
+      state[i] = STATE_CRITICAL;
+      xasprintf (&msg[i], _("%s not found"), server_names[i]);
+    }
+    result = max_state (result, state[i]);
+    if (state[i] == STATE_OK)
+      count_ok++;
+    else
+      xasprintf (&problems, "%s%s%s", problems ? problems : "", problems ? "; " : "", msg[i]);
+    if (perf[i])
+      xasprintf (&all_perf, "%s%s%s", all_perf ? all_perf : "", all_perf ? " " : "", perf[i]);
+  }
+
+  if (throttled)
+    xasprintf (&all_perf, "%s%s%s", all_perf ? all_perf : "", all_perf ? " " : "", throttled);
+  printf ("FPING %s: %d of %d hosts OK%s%s|%s\n", state_text (result), count_ok, server_count,
+          problems ? " - " : "", problems ? problems : "", all_perf ? all_perf : "");
+  for (i = 0; i < server_count; i++)
+    printf ("[%s] %s\n", state_text (state[i]), msg[i]);
+  return result;
+}
+
+
+
+/* The state of a host from its results, the way it was read from the
+ * summary fping prints; the perfdata labels are prefixed with its name
+ * and separator, unless separator is empty. */
+int
+host_state (const np_icmp_host *host, const char *separator, char **msg, char **perf)
+{
+  char *loss_label, *rta_label;
+  double loss, rta;
+  int status;
+
+  *msg = *perf = NULL;
+  if (*separator) {
+    xasprintf (&loss_label, "%s%sloss", host->name, separator);
+    xasprintf (&rta_label, "%s%srta", host->name, separator);
+  } else {
+    loss_label = "loss";
+    rta_label = "rta";
+  }
+
+  if (host->error != NP_ICMP_OK) {
+    xasprintf (msg, _("%s is unreachable"), *separator ? host->name : "host");
+    return STATE_CRITICAL;
+  }
+  if (host->sent == 0) {
+    xasprintf (msg, _("%s is down"), host->name);
+    return STATE_CRITICAL;
+  }
+
+  /* fping counts in whole percents */
+  loss = (host->sent - host->received) * 100 / host->sent;
+  if (host->received == 0) {
+    xasprintf (msg, _("%s (loss=%.0f%% )"), host->name, loss);
+    xasprintf (perf, "%s", perfdata (loss_label, (long int)loss, "%", wpl_p, wpl, cpl_p, cpl, TRUE, 0, TRUE, 100));
+    return STATE_CRITICAL;
+  }
+
+  rta = host->rtt_sum / host->received;
+  if (cpl_p == TRUE && loss > cpl)
+    status = STATE_CRITICAL;
+  else if (crta_p == TRUE  && rta > crta)
+    status = STATE_CRITICAL;
+  else if (wpl_p == TRUE && loss > wpl)
+    status = STATE_WARNING;
+  else if (wrta_p == TRUE && rta > wrta)
+    status = STATE_WARNING;
+  else
+    status = STATE_OK;
+  xasprintf (msg, _("%s (loss=%.0f%%, rta=%f ms)"), host->name, loss, rta);
+  xasprintf (perf, "%s %s",
+             perfdata (loss_label, (long int)loss, "%", wpl_p, wpl, cpl_p, cpl, TRUE, 0, TRUE, 100),
+             fperfdata (rta_label, rta/1.0e3, "s", wrta_p, wrta/1.0e3, crta_p, crta/1.0e3, TRUE, 0, FALSE, 0));
+  return status;
+}
+
+
+
+/* Pings the host with the fping command configure found */
+int
+fping_command (void)
 {
 /* normally should be  int result = STATE_UNKNOWN; */
 
@@ -77,58 +258,70 @@ main (int argc, char **argv)
   int result = 0;
   char *fping_prog = NULL;
   char *server = NULL;
-  char *command_line = NULL;
   char *input_buffer = NULL;
-  char *option_string = "";
+  char *argv[16];
+  char timeout_arg[16], interval_arg[16], size_arg[16], count_arg[16];
+  int argc = 0, i;
   input_buffer = malloc (MAX_INPUT_BUFFER);
 
-  setlocale (LC_ALL, "");
-  bindtextdomain (PACKAGE, LOCALEDIR);
-  textdomain (PACKAGE);
-
-  /* Parse extra opts if any */
-  argv=np_extra_opts (&argc, argv, progname);
-
-  if (process_arguments (argc, argv) == ERROR)
-    usage4 (_("Could not parse arguments"));
-
   server = strscpy (server, server_name);
 
-  /* compose the command */
-  if (target_timeout)
-    xasprintf(&option_string, "%s-t %d ", option_string, target_timeout);
-  if (packet_interval)
-    xasprintf(&option_string, "%s-p %d ", option_string, packet_interval);
-  if (sourceip)
-    xasprintf(&option_string, "%s-S %s ", option_string, sourceip);
-  if (sourceif)
-    xasprintf(&option_string, "%s-I %s ", option_string, sourceif);
-
-#ifdef PATH_TO_FPING6
+#ifndef PATH_TO_FPING
+  die (STATE_UNKNOWN, _("FPING UNKNOWN - No ICMP socket, and no fping command to run\n"));
+#elif defined PATH_TO_FPING6
   if (address_family != AF_INET && is_inet6_addr(server))
-    fping_prog = strdup(PATH_TO_FPING6);
+    fping_prog = PATH_TO_FPING6;
   else
-    fping_prog = strdup(PATH_TO_FPING);
+    fping_prog = PATH_TO_FPING;
 #else
-  fping_prog = strdup(PATH_TO_FPING);
+  fping_prog = PATH_TO_FPING;
 #endif
 
-  xasprintf (&command_line, "%s %s-b %d -c %d %s", fping_prog,
-            option_string, packet_size, packet_count, server);
-
-  if (verbose)
-    printf ("%s\n", command_line);
+  /* compose the command, one argument each so that none is split again */
+  argv[argc++] = fping_prog;
+  if (target_timeout) {
+    snprintf (timeout_arg, sizeof (timeout_arg), "%d", target_timeout);
+    argv[argc++] = "-t";
+    argv[argc++] = timeout_arg;
+  }
+  if (packet_interval) {
+    snprintf (interval_arg, sizeof (interval_arg), "%d", packet_interval);
+    argv[argc++] = "-p";
+    argv[argc++] = interval_arg;
+  }
+  if (sourceip) {
+    argv[argc++] = "-S";
+    argv[argc++] = sourceip;
+  }
+  if (sourceif) {
+    argv[argc++] = "-I";
+    argv[argc++] = sourceif;
+  }
+  snprintf (size_arg, sizeof (size_arg), "%d", packet_size);
+  snprintf (count_arg, sizeof (count_arg), "%d", packet_count);
+  argv[argc++] = "-b";
+  argv[argc++] = size_arg;
+  argv[argc++] = "-c";
+  argv[argc++] = count_arg;
+  argv[argc++] = server;
+  argv[argc] = NULL;
+
+  if (verbose) {
+    for (i = 0; i < argc; i++)
+      printf ("%s%s", i ? " " : "", argv[i]);
+    printf ("\n");
+  }
 
   /* run the command */
-  child_process = spopen (command_line);
+  child_process = spopenv (argv);
   if (child_process == NULL) {
-    printf (_("Could not open pipe: %s\n"), command_line);
+    printf (_("Could not open pipe: %s\n"), fping_prog);
     return STATE_UNKNOWN;
   }
 
   child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
   if (child_stderr == NULL) {
-    printf (_("Could not open stderr for %s\n"), command_line);
+    printf (_("Could not open stderr for %s\n"), fping_prog);
   }
 
   while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_process)) {
@@ -272,6 +465,9 @@ process_arguments (int argc, char **argv)
   char *rv[2];
 
   int option = 0;
+  enum {
+    MAX_RATE_OPTION = CHAR_MAX + 1
+  };
   static struct option longopts[] = {
     {"hostname", required_argument, 0, 'H'},
     {"sourceip", required_argument, 0, 'S'},
@@ -287,6 +483,7 @@ process_arguments (int argc, char **argv)
     {"help", no_argument, 0, 'h'},
     {"use-ipv4", no_argument, 0, '4'},
     {"use-ipv6", no_argument, 0, '6'},
+    {"max-rate", required_argument, 0, MAX_RATE_OPTION},
     {0, 0, 0, 0}
   };
 
@@ -297,7 +494,7 @@ process_arguments (int argc, char **argv)
     return ERROR;
 
   if (!is_option (argv[1])) {
-    server_name = argv[1];
+    add_hosts (argv[1], FALSE);
     argv[1] = argv[0];
     argv = &argv[1];
     argc--;
@@ -322,10 +519,7 @@ process_arguments (int argc, char **argv)
       verbose = TRUE;
       break;
     case 'H':                 /* hostname */
-      if (is_host (optarg) == FALSE) {
-        usage2 (_("Invalid hostname/address"), optarg);
-      }
-      server_name = strscpy (server_name, optarg);
+      add_hosts (optarg, TRUE);
       break;
     case 'S':                 /* sourceip */
       if (is_host (optarg) == FALSE) {
@@ -335,6 +529,7 @@ process_arguments (int argc, char **argv)
       break;
     case 'I':                 /* sourceip */
       sourceif = strscpy (sourceif, optarg);
+      break;
     case '4':                 /* IPv4 only */
       address_family = AF_INET;
       break;
@@ -395,6 +590,11 @@ process_arguments (int argc, char **argv)
       else
         usage (_("Interval must be a positive integer"));
       break;
+    case MAX_RATE_OPTION:
+      if (!is_positive (optarg))
+        usage2 (_("Rate must be a positive number"), optarg);
+      np_net_max_rate = strtod (optarg, NULL);
+      break;
     }
   }
 
@@ -405,6 +605,31 @@ process_arguments (int argc, char **argv)
 }
 
 
+/* adds the hosts of a comma separated list, checked to be valid names if
+ * check is set; the first is server_name */
+void
+add_hosts (const char *list, int check)
+{
+  char *copy, *host, *next;
+
+  copy = strdup (list);
+  for (host = copy; host; host = next) {
+    if ((next = strchr (host, ',')) != NULL)
+      *next++ = '\0';
+    if (*host == '\0')
+      continue;
+    if (check && is_host (host) == FALSE)
+      usage2 (_("Invalid hostname/address"), host);
+    server_names = realloc (server_names, (server_count + 1) * sizeof (char *));
+    if (server_names == NULL)
+      die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+    server_names[server_count++] = host;
+  }
+  if (server_count && server_name == NULL)
+    server_name = server_names[0];
+}
+
+
 int
 get_threshold (char *arg, char *rv[2])
 {
@@ -455,9 +680,11 @@ print_help (void)
   printf ("Copyright (c) 1999 Didi Rieder <adrieder@sbox.tu-graz.ac.at>\n");
   printf (COPYRIGHT, copyright, email);
 
-  printf ("%s\n", _("This plugin will use the fping command to ping the specified host for a fast check"));
+  printf ("%s\n", _("This plugin will ping the specified hosts, all at once, for a fast check"));
 
-  printf ("%s\n", _("Note that it is necessary to set the suid flag on fping."));
+  printf ("%s\n", _("It sends the packets itself where it may open an ICMP socket: as root, or where"));
+  printf ("%s\n", _("the kernel allows it (net.ipv4.ping_group_range on Linux). Otherwise a single"));
+  printf ("%s\n", _("host is pinged with the fping command, on which the suid flag must be set."));
 
   printf ("\n\n");
 
@@ -470,6 +697,7 @@ print_help (void)
 
   printf (" %s\n", "-H, --hostname=HOST");
   printf ("    %s\n", _("name or IP Address of host to ping (IP Address bypasses name lookup, reducing system load)"));
+  printf ("    %s\n", _("Repeat it or give a comma separated list to ping several hosts at once"));
   printf (" %s\n", "-w, --warning=THRESHOLD");
   printf ("    %s\n", _("warning threshold pair"));
   printf (" %s\n", "-c, --critical=THRESHOLD");
@@ -479,18 +707,20 @@ print_help (void)
   printf (" %s\n", "-n, --number=INTEGER");
   printf ("    %s (default: %d)\n", _("number of ICMP packets to send"),PACKET_COUNT);
   printf (" %s\n", "-T, --target-timeout=INTEGER");
-  printf ("    %s (default: fping's default for -t)\n", _("Target timeout (ms)"));
+  printf ("    %s (default: %s)\n", _("Target timeout (ms)"), _("the interval, up to 2000"));
   printf (" %s\n", "-i, --interval=INTEGER");
-  printf ("    %s (default: fping's default for -p)\n", _("Interval (ms) between sending packets"));
+  printf ("    %s (default: 1000)\n", _("Interval (ms) between sending packets to a host"));
   printf (" %s\n", "-S, --sourceip=HOST");
   printf ("    %s\n", _("name or IP Address of sourceip"));
   printf (" %s\n", "-I, --sourceif=IF");
   printf ("    %s\n", _("source interface name"));
+  printf (UT_MAX_RATE, _("packets"));
   printf (UT_VERBOSE);
   printf ("\n");
   printf (" %s\n", _("THRESHOLD is <rta>,<pl>%% where <rta> is the round trip average travel time (ms)"));
   printf (" %s\n", _("which triggers a WARNING or CRITICAL state, and <pl> is the percentage of"));
-  printf (" %s\n", _("packet loss to trigger an alarm state."));
+  printf (" %s\n", _("packet loss to trigger an alarm state. With several hosts, each host is held"));
+  printf (" %s\n", _("to them, and the worst state of any is returned."));
 
   printf ("\n");
   printf (" %s\n", _("IPv4 is used by default. Specify -6 to use IPv6."));
@@ -503,5 +733,7 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-  printf (" %s <host_address> -w limit -c limit [-b size] [-n number] [-T number] [-i number]\n", progname);
+  printf (" %s <host_address>[,<host_address>...] -w limit -c limit [-b size] [-n number]\n", progname);
+  printf (" [-T number] [-i number] [-H host_address] [-S source] [-I interface]\n");
+  printf (" [--max-rate rate]\n");
 }
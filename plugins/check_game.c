@@ -11,6 +11,10 @@
 * 
 * This plugin tests game server connections with the specified host.
 * using the qstat program
+*
+* With --servers, all the servers given are queried by one run of qstat,
+* which gives a line for each of them, and each is held to the player and
+* ping thresholds.
 * 
 * 
 * This program is free software: you can redistribute it and/or modify
@@ -39,6 +43,9 @@ const char *email = "devel@nagios-plugins.org";
 
 int process_arguments (int, char **);
 int validate_arguments (void);
+static int split_reply (char *, char **);
+static int server_state (char **, int, const char *, char **, np_perfdata *);
+static int check_servers (void);
 void print_help (void);
 void print_usage (void);
 
@@ -61,19 +68,26 @@ int qstat_game_field = -1;
 int qstat_map_field = -1;
 int qstat_ping_field = -1;
 
+/* --servers */
+char **servers = NULL;
+int server_count = 0;
+
+char *players_warning = NULL;
+char *players_critical = NULL;
+char *ping_warning = NULL;
+char *ping_critical = NULL;
+thresholds *players_thlds = NULL;
+thresholds *ping_thlds = NULL;
+
 
 int
 main (int argc, char **argv)
 {
-  char *command_line;
+  char *command_line, *msg;
   int result = STATE_UNKNOWN;
-  char *p, *ret[QSTAT_MAX_RETURN_ARGS];
-  size_t i = 0;
+  char *ret[QSTAT_MAX_RETURN_ARGS];
   output chld_out;
-
-  setlocale (LC_ALL, "");
-  bindtextdomain (PACKAGE, LOCALEDIR);
-  textdomain (PACKAGE);
+  np_perfdata perf;
 
   /* Parse extra opts if any */
   argv=np_extra_opts (&argc, argv, progname);
@@ -81,7 +95,11 @@ main (int argc, char **argv)
   if (process_arguments (argc, argv) == ERROR)
     usage_va(_("Could not parse arguments"));
 
-  result = STATE_OK;
+  set_thresholds (&players_thlds, players_warning, players_critical);
+  set_thresholds (&ping_thlds, ping_warning, ping_critical);
+
+  if (server_count)
+    return check_servers ();
 
   /* create the command line to execute */
   xasprintf (&command_line, "%s -raw %s -%s %s",
@@ -107,13 +125,34 @@ main (int argc, char **argv)
      In the end, I figured I'd simply let an error occur & then trap it
    */
 
+  if (chld_out.lines == 0)
+    die (STATE_UNKNOWN, _("No output from %s\n"), PATH_TO_QSTAT);
+
   if (!strncmp (chld_out.line[0], "unknown option", 14)) {
     printf (_("CRITICAL - Host type parameter incorrect!\n"));
     result = STATE_CRITICAL;
     return result;
   }
 
-  p = (char *) strtok (chld_out.line[0], QSTAT_DATA_DELIMITER);
+  np_perfdata_init (&perf);
+  result = server_state (ret, split_reply (chld_out.line[0], ret), "", &msg, &perf);
+  if (perf.len == 0)
+    printf ("%s - %s\n", state_text (result), msg);
+  else
+    printf ("%s: %s|%s\n", result == STATE_OK ? "OK" : state_text (result), msg, np_perfdata_string (&perf));
+
+  return result;
+}
+
+
+/* the fields of a line of qstat -raw output in ret, and how many there are */
+static int
+split_reply (char *line, char **ret)
+{
+  char *p;
+  int i = 0;
+
+  p = (char *) strtok (line, QSTAT_DATA_DELIMITER);
   while (p != NULL) {
     ret[i] = p;
     p = (char *) strtok (NULL, QSTAT_DATA_DELIMITER);
@@ -121,34 +160,129 @@ main (int argc, char **argv)
     if (i >= QSTAT_MAX_RETURN_ARGS)
       break;
   }
+  return i;
+}
 
-  if (strstr (ret[2], QSTAT_HOST_ERROR)) {
-    printf (_("CRITICAL - Host not found\n"));
-    result = STATE_CRITICAL;
+
+/*
+ * The state of a server by the fields of its line, held to the thresholds,
+ * with what it says in *msg and its perfdata labelled with prefix added to
+ * perf. Only a server that answered has perfdata.
+ */
+static int
+server_state (char **ret, int fields, const char *prefix, char **msg, np_perfdata *perf)
+{
+  char label[MAX_INPUT_BUFFER];
+  long players, players_max;
+  double ping;
+  int result;
+
+  if (fields <= 2 || strstr (ret[2], QSTAT_HOST_ERROR)) {
+    *msg = _("Host not found");
+    return STATE_CRITICAL;
   }
-  else if (strstr (ret[2], QSTAT_HOST_DOWN)) {
-    printf (_("CRITICAL - Game server down or unavailable\n"));
-    result = STATE_CRITICAL;
+  if (strstr (ret[2], QSTAT_HOST_DOWN)) {
+    *msg = _("Game server down or unavailable");
+    return STATE_CRITICAL;
   }
-  else if (strstr (ret[2], QSTAT_HOST_TIMEOUT)) {
-    printf (_("CRITICAL - Game server timeout\n"));
-    result = STATE_CRITICAL;
+  if (strstr (ret[2], QSTAT_HOST_TIMEOUT)) {
+    *msg = _("Game server timeout");
+    return STATE_CRITICAL;
   }
-  else {
-    printf ("OK: %s/%s %s (%s), Ping: %s ms|%s %s\n",
-            ret[qstat_game_players],
-            ret[qstat_game_players_max],
-            ret[qstat_game_field],
-            ret[qstat_map_field],
-            ret[qstat_ping_field],
-            perfdata ("players", atol(ret[qstat_game_players]), "",
-                      FALSE, 0, FALSE, 0,
-                      TRUE, 0, TRUE, atol(ret[qstat_game_players_max])),
-            fperfdata ("ping", strtod(ret[qstat_ping_field], NULL), "",
-                      FALSE, 0, FALSE, 0,
-                      TRUE, 0, FALSE, 0));
+  if (fields <= qstat_game_players || fields <= qstat_game_players_max
+      || fields <= qstat_game_field || fields <= qstat_map_field
+      || fields <= qstat_ping_field) {
+    *msg = _("Too few fields in the qstat output");
+    return STATE_UNKNOWN;
   }
 
+  players = atol (ret[qstat_game_players]);
+  players_max = atol (ret[qstat_game_players_max]);
+  ping = strtod (ret[qstat_ping_field], NULL);
+  result = max_state (get_status (players, players_thlds), get_status (ping, ping_thlds));
+
+  xasprintf (msg, "%s/%s %s (%s), Ping: %s ms",
+             ret[qstat_game_players], ret[qstat_game_players_max],
+             ret[qstat_game_field], ret[qstat_map_field], ret[qstat_ping_field]);
+
+  snprintf (label, sizeof (label), "%splayers", prefix);
+  np_perfdata_adds_int (perf, label, (int) players, "", players_warning, players_critical,
+                        TRUE, 0, TRUE, (int) players_max);
+  snprintf (label, sizeof (label), "%sping", prefix);
+  np_perfdata_adds (perf, label, ping, "", ping_warning, ping_critical,
+                    TRUE, 0, FALSE, 0);
+  return result;
+}
+
+
+/*
+ * --servers: one run of qstat for all of them. It answers with a line for
+ * each, in no given order, that starts with the server as it was given.
+ */
+static int
+check_servers (void)
+{
+  char *command_line, *ret[QSTAT_MAX_RETURN_ARGS], *problems = NULL, *prefix;
+  char **msgs;
+  int *states, *answered;
+  int i, j, fields, count_ok = 0, result = STATE_OK;
+  output chld_out;
+  np_perfdata perf;
+
+  xasprintf (&command_line, "%s -raw %s", PATH_TO_QSTAT, QSTAT_DATA_DELIMITER);
+  for (i = 0; i < server_count; i++)
+    xasprintf (&command_line, "%s -%s %s", command_line, game_type, servers[i]);
+
+  if (verbose > 0)
+    printf ("%s\n", command_line);
+
+  (void)np_runcmd(command_line, &chld_out, NULL, 0);
+
+  if (chld_out.lines && !strncmp (chld_out.line[0], "unknown option", 14)) {
+    printf (_("CRITICAL - Host type parameter incorrect!\n"));
+    return STATE_CRITICAL;
+  }
+
+  msgs = calloc (server_count, sizeof (char *));
+  states = calloc (server_count, sizeof (int));
+  answered = calloc (server_count, sizeof (int));
+  if (msgs == NULL || states == NULL || answered == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+  np_perfdata_init (&perf);
+  for (i = 0; i < chld_out.lines; i++) {
+    fields = split_reply (chld_out.line[i], ret);
+    if (fields < 2)
+      continue;
+    for (j = 0; j < server_count; j++)
+      if (!answered[j] && !strcmp (ret[1], servers[j]))
+        break;
+    if (j == server_count)
+      continue;
+    answered[j] = TRUE;
+    xasprintf (&prefix, "%s_", servers[j]);
+    states[j] = server_state (ret, fields, prefix, &msgs[j], &perf);
+    free (prefix);
+  }
+
+  for (j = 0; j < server_count; j++) {
+    if (!answered[j]) {
+      states[j] = STATE_UNKNOWN;
+      msgs[j] = _("No answer in the qstat output");
+    }
+    result = max_state_alt (result, states[j]);
+    if (states[j] == STATE_OK)
+      count_ok++;
+    else
+      xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+                 servers[j], msgs[j]);
+  }
+
+  printf ("GAME %s: %d of %d servers OK%s%s|%s\n", state_text (result), count_ok, server_count,
+          problems ? " - " : "", problems ? problems : "", np_perfdata_string (&perf));
+  for (j = 0; j < server_count; j++)
+    printf ("[%s] %s: %s\n", state_text (states[j]), servers[j], msgs[j]);
+
   return result;
 }
 
@@ -157,6 +291,15 @@ int
 process_arguments (int argc, char **argv)
 {
   int c;
+  char *p;
+
+  enum {
+    SERVERS_OPTION = 131,
+    PLAYERS_WARNING_OPTION,
+    PLAYERS_CRITICAL_OPTION,
+    PING_WARNING_OPTION,
+    PING_CRITICAL_OPTION
+  };
 
   int opt_index = 0;
   static struct option long_opts[] = {
@@ -172,6 +315,11 @@ process_arguments (int argc, char **argv)
     {"game-field", required_argument, 0, 'g'},
     {"players-field", required_argument, 0, 129},
     {"max-players-field", required_argument, 0, 130},
+    {"servers", required_argument, 0, SERVERS_OPTION},
+    {"players-warning", required_argument, 0, PLAYERS_WARNING_OPTION},
+    {"players-critical", required_argument, 0, PLAYERS_CRITICAL_OPTION},
+    {"ping-warning", required_argument, 0, PING_WARNING_OPTION},
+    {"ping-critical", required_argument, 0, PING_CRITICAL_OPTION},
     {0, 0, 0, 0}
   };
 
@@ -246,6 +394,28 @@ process_arguments (int argc, char **argv)
       if (qstat_game_players_max < 0 || qstat_game_players_max > QSTAT_MAX_RETURN_ARGS)
         return ERROR;
       break;
+    case SERVERS_OPTION: /* HOST[:PORT],... to query at once */
+      for (p = strtok (optarg, ","); p != NULL; p = strtok (NULL, ",")) {
+        if (strlen (p) >= MAX_HOST_ADDRESS_LENGTH)
+          die (STATE_UNKNOWN, _("Input buffer overflow\n"));
+        servers = realloc (servers, (server_count + 1) * sizeof (char *));
+        if (servers == NULL)
+          die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+        servers[server_count++] = p;
+      }
+      break;
+    case PLAYERS_WARNING_OPTION:
+      players_warning = optarg;
+      break;
+    case PLAYERS_CRITICAL_OPTION:
+      players_critical = optarg;
+      break;
+    case PING_WARNING_OPTION:
+      ping_warning = optarg;
+      break;
+    case PING_CRITICAL_OPTION:
+      ping_critical = optarg;
+      break;
     default: /* args not parsable */
       usage5();
     }
@@ -257,7 +427,7 @@ process_arguments (int argc, char **argv)
     game_type = strdup (argv[c++]);
 
   /* Second option is the server name */
-  if (!server_ip && c<argc)
+  if (!server_ip && !server_count && c<argc)
     server_ip = strdup (argv[c++]);
 
   return validate_arguments ();
@@ -267,6 +437,9 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments (void)
 {
+  if (game_type == NULL || (server_ip == NULL && server_count == 0))
+    return ERROR;
+
   if (qstat_game_players_max < 0)
     qstat_game_players_max = 4;
 
@@ -311,6 +484,14 @@ print_help (void)
   printf ("    %s\n", _("Field number in raw qstat output that contains map name"));
   printf (" %s\n", "-pf");
   printf ("    %s\n", _("Field number in raw qstat output that contains ping time"));
+  printf (" %s\n", "--servers=HOST[:PORT][,HOST[:PORT]...]");
+  printf ("    %s\n", _("Query all these servers with one run of qstat instead of one -H (may be"));
+  printf ("    %s\n", _("repeated); each is held to the thresholds, and one with no line in the"));
+  printf ("    %s\n", _("qstat output is UNKNOWN"));
+  printf (" %s\n", "--players-warning=RANGE, --players-critical=RANGE");
+  printf ("    %s\n", _("Number of players on a server to result in warning or critical status"));
+  printf (" %s\n", "--ping-warning=RANGE, --ping-critical=RANGE");
+  printf ("    %s\n", _("Ping time of a server in ms to result in warning or critical status"));
 
   printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
@@ -330,6 +511,8 @@ print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
   printf (" %s [-hvV] [-P port] [-t timeout] [-g game_field] [-m map_field] [-p ping_field] [-G game-time] [-H hostname] <game> <ip_address>\n", progname);
+  printf (" %s [-v] [-t timeout] -G game-type --servers=host[:port],... [--players-warning=range]\n", progname);
+  printf ("  [--players-critical=range] [--ping-warning=range] [--ping-critical=range]\n");
 }
 
 /******************************************************************************
@@ -341,6 +524,10 @@ print_usage (void)
  * qstat -raw , -qs 67.20.190.61
  *  ==> QS,67.20.190.61,Nightmare.fintek.ca,67.20.190.61:26000,3,e2m1,6,0,83,0
  *
+ * qstat -raw , -qs 67.20.190.61 -qs 10.0.0.1:26000
+ *  ==> QS,67.20.190.61,Nightmare.fintek.ca,67.20.190.61:26000,3,e2m1,6,0,83,0
+ *  ==> QS,10.0.0.1:26000,DOWN
+ *
  * qstat -qs 67.20.190.61
  *  ==> ADDRESS           PLAYERS      MAP   RESPONSE TIME    NAME
  *  ==> 67.20.190.61            0/ 6     e2m1     79 / 0   Nightmare.fintek.ca
@@ -10,7 +10,6 @@
 * This file contains the check_hpjd plugin
 * 
 * This plugin tests the STATUS of an HP printer with a JetDirect card.
-* Net-SNMP must be installed on the computer running the plugin.
 * 
 * 
 * This program is free software: you can redistribute it and/or modify
@@ -34,27 +33,46 @@ const char *copyright = "2000-2014";
 const char *email = "devel@nagios-plugins.org";
 
 #include "common.h"
-#include "popen.h"
 #include "utils.h"
+#include "utils_snmp.h"
 #include "netutils.h"
 
 #define DEFAULT_COMMUNITY "public"
 #define DEFAULT_PORT "161"
+#define DEFAULT_RETRIES 5
+#define DEFAULT_CONCURRENCY 64
 
 const char *option_summary = "-H host [-C community]\n";
 
-#define HPJD_LINE_STATUS           ".1.3.6.1.4.1.11.2.3.9.1.1.2.1"
-#define HPJD_PAPER_STATUS          ".1.3.6.1.4.1.11.2.3.9.1.1.2.2"
-#define HPJD_INTERVENTION_REQUIRED ".1.3.6.1.4.1.11.2.3.9.1.1.2.3"
-#define HPJD_GD_PERIPHERAL_ERROR   ".1.3.6.1.4.1.11.2.3.9.1.1.2.6"
-#define HPJD_GD_PAPER_OUT          ".1.3.6.1.4.1.11.2.3.9.1.1.2.8"
-#define HPJD_GD_PAPER_JAM          ".1.3.6.1.4.1.11.2.3.9.1.1.2.9"
-#define HPJD_GD_TONER_LOW          ".1.3.6.1.4.1.11.2.3.9.1.1.2.10"
-#define HPJD_GD_PAGE_PUNT          ".1.3.6.1.4.1.11.2.3.9.1.1.2.11"
-#define HPJD_GD_MEMORY_OUT         ".1.3.6.1.4.1.11.2.3.9.1.1.2.12"
-#define HPJD_GD_DOOR_OPEN          ".1.3.6.1.4.1.11.2.3.9.1.1.2.17"
-#define HPJD_GD_PAPER_OUTPUT       ".1.3.6.1.4.1.11.2.3.9.1.1.2.19"
-#define HPJD_GD_STATUS_DISPLAY     ".1.3.6.1.4.1.11.2.3.9.1.1.3"
+/* the status objects, in the order of one GET */
+static const char *hpjd_oids[] = {
+	"1.3.6.1.4.1.11.2.3.9.1.1.2.1.0",      /* line status */
+	"1.3.6.1.4.1.11.2.3.9.1.1.2.2.0",      /* paper status */
+	"1.3.6.1.4.1.11.2.3.9.1.1.2.3.0",      /* intervention required */
+	"1.3.6.1.4.1.11.2.3.9.1.1.2.6.0",      /* peripheral error */
+	"1.3.6.1.4.1.11.2.3.9.1.1.2.9.0",      /* paper jam */
+	"1.3.6.1.4.1.11.2.3.9.1.1.2.8.0",      /* paper out */
+	"1.3.6.1.4.1.11.2.3.9.1.1.2.10.0",     /* toner low */
+	"1.3.6.1.4.1.11.2.3.9.1.1.2.11.0",     /* page punt, data too slow for the engine */
+	"1.3.6.1.4.1.11.2.3.9.1.1.2.12.0",     /* memory out */
+	"1.3.6.1.4.1.11.2.3.9.1.1.2.17.0",     /* door open */
+	"1.3.6.1.4.1.11.2.3.9.1.1.2.19.0",     /* output tray full */
+	"1.3.6.1.4.1.11.2.3.9.1.1.3.0"         /* display panel message */
+};
+
+#define HPJD_LINE_STATUS           0
+#define HPJD_PAPER_STATUS          1
+#define HPJD_INTERVENTION_REQUIRED 2
+#define HPJD_GD_PERIPHERAL_ERROR   3
+#define HPJD_GD_PAPER_JAM          4
+#define HPJD_GD_PAPER_OUT          5
+#define HPJD_GD_TONER_LOW          6
+#define HPJD_GD_PAGE_PUNT          7
+#define HPJD_GD_MEMORY_OUT         8
+#define HPJD_GD_DOOR_OPEN          9
+#define HPJD_GD_PAPER_OUTPUT       10
+#define HPJD_GD_STATUS_DISPLAY     11
+#define HPJD_OIDS                  12
 
 #define ONLINE		0
 #define OFFLINE		1
@@ -65,258 +83,173 @@ void print_help (void);
 void print_usage (void);
 
 char *community = NULL;
-char *address = NULL;
-int port = 0;
+char **addresses = NULL;
+int num_addresses = 0;
+char *port = NULL;
+int retries = DEFAULT_RETRIES;
+int concurrency = DEFAULT_CONCURRENCY;
 char flawcorrection =0; // There are devices which report offline when that is not the case. Correct that.
 
-int
-main (int argc, char **argv)
+/* the state of one printer from its response, and the text for it */
+static int
+hpjd_status (const np_snmp_pdu *resp, char **msg)
 {
-	char command_line[1024];
-	int result = STATE_UNKNOWN;
-	int line;
-	char input_buffer[MAX_INPUT_BUFFER];
-	char query_string[512];
-	char *errmsg;
-	char *temp_buffer;
-	int line_status = ONLINE;
-	int paper_status = 0;
-	int intervention_required = 0;
-	int peripheral_error = 0;
-	int paper_jam = 0;
-	int paper_out = 0;
-	int toner_low = 0;
-	int page_punt = 0;
-	int memory_out = 0;
-	int door_open = 0;
-	int paper_output = 0;
-	char display_message[MAX_INPUT_BUFFER];
-
-	errmsg = malloc(MAX_INPUT_BUFFER);
-
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
-	/* Parse extra opts if any */
-	argv=np_extra_opts (&argc, argv, progname);
-
-	if (process_arguments (argc, argv) == ERROR)
-		usage4 (_("Could not parse arguments"));
-
-	/* removed ' 2>1' at end of command 10/27/1999 - EG */
-	/* create the query string */
-	sprintf
-		(query_string,
-		 "%s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0",
-		 HPJD_LINE_STATUS,
-		 HPJD_PAPER_STATUS,
-		 HPJD_INTERVENTION_REQUIRED,
-		 HPJD_GD_PERIPHERAL_ERROR,
-		 HPJD_GD_PAPER_JAM,
-		 HPJD_GD_PAPER_OUT,
-		 HPJD_GD_TONER_LOW,
-		 HPJD_GD_PAGE_PUNT,
-		 HPJD_GD_MEMORY_OUT,
-		 HPJD_GD_DOOR_OPEN, HPJD_GD_PAPER_OUTPUT, HPJD_GD_STATUS_DISPLAY);
-
-	/* get the command to run */
-	sprintf (command_line, "%s -OQa -m : -v 1 -c %s %s:%hd %s",
-			PATH_TO_SNMPGET, community, address, (short)port, query_string);
-
-	/* run the command */
-	child_process = spopen (command_line);
-	if (child_process == NULL) {
-		printf (_("Could not open pipe: %s\n"), command_line);
+	long status[HPJD_OIDS];
+	char display_message[MAX_INPUT_BUFFER] = "";
+	const np_snmp_varbind *vb;
+	const char *problem = NULL;
+	size_t i, len;
+
+	if (resp->error_status) {
+		xasprintf (msg, "%s%s%s", np_snmp_error_string (resp->error_status),
+		           resp->error_index > 0 && resp->error_index <= HPJD_OIDS ? " " : "",
+		           resp->error_index > 0 && resp->error_index <= HPJD_OIDS ? hpjd_oids[resp->error_index - 1] : "");
 		return STATE_UNKNOWN;
 	}
-
-	child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
-	if (child_stderr == NULL) {
-		printf (_("Could not open stderr for %s\n"), command_line);
+	if (resp->count < HPJD_OIDS) {
+		xasprintf (msg, _("Only %lu of %d values returned"), (unsigned long) resp->count, HPJD_OIDS);
+		return STATE_UNKNOWN;
 	}
 
-	result = STATE_OK;
-
-	line = 0;
-	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_process)) {
-
-		/* strip the newline character from the end of the input */
-		if (input_buffer[strlen (input_buffer) - 1] == '\n')
-			input_buffer[strlen (input_buffer) - 1] = 0;
-
-		line++;
-
-		/* We want the string after the "=" */
-		(void)strtok (input_buffer, "=");
-		temp_buffer = strtok (NULL, "=");
-
-		if (temp_buffer == NULL && line < 13) {
-
-				result = STATE_UNKNOWN;
-				strcpy (errmsg, input_buffer);
-
-		} else {
-			switch (line) {
-
-			case 1:										/* 1st line should contain the line status */
-				line_status = atoi (temp_buffer);
-				break;
-			case 2:										/* 2nd line should contain the paper status */
-				paper_status = atoi (temp_buffer);
-				break;
-			case 3:										/* 3rd line should be intervention required */
-				intervention_required = atoi (temp_buffer);
-				break;
-			case 4:										/* 4th line should be peripheral error */
-				peripheral_error = atoi (temp_buffer);
-				break;
-			case 5:										/* 5th line should contain the paper jam status */
-				paper_jam = atoi (temp_buffer);
-				break;
-			case 6:										/* 6th line should contain the paper out status */
-				paper_out = atoi (temp_buffer);
-				break;
-			case 7:										/* 7th line should contain the toner low status */
-				toner_low = atoi (temp_buffer);
-				break;
-			case 8:										/* did data come too slow for engine */
-				page_punt = atoi (temp_buffer);
-				break;
-			case 9:										/* did we run out of memory */
-				memory_out = atoi (temp_buffer);
-				break;
-			case 10:										/* is there a door open */
-				door_open = atoi (temp_buffer);
-				break;
-			case 11:										/* is output tray full */
-				paper_output = atoi (temp_buffer);
-				break;
-			case 12:										/* display panel message */
-				strcpy (display_message, temp_buffer + 1);
-				if (
-                                    (flawcorrection)                   &&
-                                    (!strcmp(display_message,"READY")) &&
-                                    (!paper_status)                    &&
-                                    (!intervention_required)           &&
-                                    (!peripheral_error)                &&
-                                    (!paper_jam)                       &&
-                                    (!paper_out)
-                                   ) 
-                                   line_status = 0;    
-				break;
-			default:										/* fold multiline message */
-				strncat (display_message, input_buffer,
-						sizeof (display_message) - strlen (display_message) - 1);
-			}
-
+	for (i = 0; i < HPJD_GD_STATUS_DISPLAY; i++) {
+		vb = &resp->varbinds[i];
+		if (vb->type != NP_SNMP_INTEGER) {
+			xasprintf (msg, _("No valid data returned for %s"), hpjd_oids[i]);
+			return STATE_UNKNOWN;
 		}
-
-		/* break out of the read loop if we encounter an error */
-		if (result != STATE_OK)
-			break;
+		status[i] = (long) vb->integer;
 	}
-
-	/* WARNING if output found on stderr */
-	if (fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_stderr)) {
-		result = max_state (result, STATE_WARNING);
-		/* remove CRLF */
-		if (input_buffer[strlen (input_buffer) - 1] == '\n')
-			input_buffer[strlen (input_buffer) - 1] = 0;
-		sprintf (errmsg, "%s", input_buffer );
-
+	vb = &resp->varbinds[HPJD_GD_STATUS_DISPLAY];
+	if (vb->type == NP_SNMP_OCTET_STRING) {
+		len = vb->length < sizeof (display_message) ? vb->length : sizeof (display_message) - 1;
+		memcpy (display_message, vb->data, len);
+		display_message[len] = '\0';
 	}
 
-	/* close stderr */
-	(void) fclose (child_stderr);
+	if (flawcorrection && !strcmp (display_message, "READY") &&
+	    !status[HPJD_PAPER_STATUS] && !status[HPJD_INTERVENTION_REQUIRED] &&
+	    !status[HPJD_GD_PERIPHERAL_ERROR] && !status[HPJD_GD_PAPER_JAM] && !status[HPJD_GD_PAPER_OUT])
+		status[HPJD_LINE_STATUS] = ONLINE;
+
+	if (status[HPJD_GD_PAPER_JAM])
+		problem = _("Paper Jam");
+	else if (status[HPJD_GD_PAPER_OUT])
+		problem = _("Out of Paper");
+	else if (status[HPJD_LINE_STATUS] == OFFLINE) {
+		if (strcmp (display_message, "POWERSAVE ON") != 0)
+			problem = _("Printer Offline");
+	}
+	else if (status[HPJD_GD_PERIPHERAL_ERROR])
+		problem = _("Peripheral Error");
+	else if (status[HPJD_INTERVENTION_REQUIRED])
+		problem = _("Intervention Required");
+	else if (status[HPJD_GD_TONER_LOW])
+		problem = _("Toner Low");
+	else if (status[HPJD_GD_MEMORY_OUT])
+		problem = _("Insufficient Memory");
+	else if (status[HPJD_GD_DOOR_OPEN])
+		problem = _("A Door is Open");
+	else if (status[HPJD_GD_PAPER_OUTPUT])
+		problem = _("Output Tray is Full");
+	else if (status[HPJD_GD_PAGE_PUNT])
+		problem = _("Data too Slow for Engine");
+	else if (status[HPJD_PAPER_STATUS])
+		problem = _("Unknown Paper Error");
+
+	/* quoted, as snmpget -OQ printed it */
+	if (problem == NULL) {
+		xasprintf (msg, _("Printer ok - (\"%s\")"), display_message);
+		return STATE_OK;
+	}
+	xasprintf (msg, "%s (\"%s\")", problem, display_message);
+	return STATE_WARNING;
+}
 
-	/* close the pipe */
-	if (spclose (child_process))
-		result = max_state (result, STATE_WARNING);
+int
+main (int argc, char **argv)
+{
+	np_snmp_target *targets;
+	np_snmp_pdu req;
+	np_snmp_oid oid;
+	char **msgs, *problems = NULL;
+	int *states;
+	int i, count_ok = 0, result = STATE_OK, command_interval;
 
-	/* if there wasn't any output, display an error */
-	if (line == 0) {
+	/* Parse extra opts if any */
+	argv=np_extra_opts (&argc, argv, progname);
 
-		/* might not be the problem, but most likely is. */
-		result = STATE_UNKNOWN ;
-		xasprintf (&errmsg, "%s : Timeout from host %s\n", errmsg, address );
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
 
+	/* every status object in one GET, as SNMPv1 like snmpget -v 1 */
+	np_snmp_pdu_init (&req, NP_SNMP_VERSION_1, community, NP_SNMP_GET);
+	for (i = 0; i < HPJD_OIDS; i++) {
+		np_snmp_parse_oid (hpjd_oids[i], &oid);
+		np_snmp_pdu_add (&req, &oid);
 	}
 
-	/* if we had no read errors, check the printer status results... */
-	if (result == STATE_OK) {
-
-		if (paper_jam) {
-			result = STATE_WARNING;
-			strcpy (errmsg, _("Paper Jam"));
-		}
-		else if (paper_out) {
-			result = STATE_WARNING;
-			strcpy (errmsg, _("Out of Paper"));
-		}
-		else if (line_status == OFFLINE) {
-			if (strcmp (errmsg, "POWERSAVE ON") != 0) {
-				result = STATE_WARNING;
-				strcpy (errmsg, _("Printer Offline"));
-			}
-		}
-		else if (peripheral_error) {
-			result = STATE_WARNING;
-			strcpy (errmsg, _("Peripheral Error"));
-		}
-		else if (intervention_required) {
-			result = STATE_WARNING;
-			strcpy (errmsg, _("Intervention Required"));
-		}
-		else if (toner_low) {
-			result = STATE_WARNING;
-			strcpy (errmsg, _("Toner Low"));
-		}
-		else if (memory_out) {
-			result = STATE_WARNING;
-			strcpy (errmsg, _("Insufficient Memory"));
-		}
-		else if (door_open) {
-			result = STATE_WARNING;
-			strcpy (errmsg, _("A Door is Open"));
-		}
-		else if (paper_output) {
-			result = STATE_WARNING;
-			strcpy (errmsg, _("Output Tray is Full"));
-		}
-		else if (page_punt) {
-			result = STATE_WARNING;
-			strcpy (errmsg, _("Data too Slow for Engine"));
-		}
-		else if (paper_status) {
-			result = STATE_WARNING;
-			strcpy (errmsg, _("Unknown Paper Error"));
+	targets = calloc (num_addresses, sizeof (*targets));
+	msgs = calloc (num_addresses, sizeof (*msgs));
+	states = calloc (num_addresses, sizeof (*states));
+	if (targets == NULL || msgs == NULL || states == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	for (i = 0; i < num_addresses; i++)
+		targets[i].host = addresses[i];
+
+	/* -t is per printer, the tries share it */
+	command_interval = timeout_interval * 1000 / (retries + 1);
+	if (!np_snmp_query_targets (targets, num_addresses, port, address_family, &req, concurrency,
+	                            command_interval > 0 ? command_interval : 1, retries))
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	np_snmp_pdu_free (&req);
+
+	for (i = 0; i < num_addresses; i++) {
+		if (targets[i].status == NP_SNMP_OK) {
+			states[i] = hpjd_status (&targets[i].response, &msgs[i]);
+		} else if (targets[i].status == NP_SNMP_TIMEOUT) {
+			/* the printer could not be reached */
+			states[i] = STATE_CRITICAL;
+			xasprintf (&msgs[i], _("Timeout: No Response from %s:%s"), addresses[i], port);
+		} else {
+			states[i] = STATE_UNKNOWN;
+			xasprintf (&msgs[i], "%s", targets[i].error);
 		}
+		result = max_state_alt (states[i], result);
+		if (states[i] == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           addresses[i], msgs[i]);
 	}
+	np_snmp_targets_free (targets, num_addresses);
 
-	if (result == STATE_OK)
-		printf (_("Printer ok - (%s)\n"), display_message);
-
-	else if (result == STATE_UNKNOWN) {
-
-		printf ("%s\n", errmsg);
-
-		/* if printer could not be reached, escalate to critical */
-		if (strstr (errmsg, "Timeout"))
-			result = STATE_CRITICAL;
+	if (num_addresses == 1) {
+		printf ("%s\n", msgs[0]);
+		return result;
 	}
-
-	else if (result == STATE_WARNING)
-		printf ("%s (%s)\n", errmsg, display_message);
-
+	printf (_("HPJD %s: %d of %d printers OK%s%s\n"), state_text (result), count_ok, num_addresses,
+	        problems ? " - " : "", problems ? problems : "");
+	for (i = 0; i < num_addresses; i++)
+		printf ("[%s] %s: %s\n", state_text (states[i]), addresses[i], msgs[i]);
 	return result;
 }
 
 
+static void
+add_address (char *host)
+{
+	if (!is_host (host))
+		usage2 (_("Invalid hostname/address"), host);
+	if ((addresses = realloc (addresses, (num_addresses + 1) * sizeof (*addresses))) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	addresses[num_addresses++] = host;
+}
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
 {
+	char *ptr;
 	int c;
 
 	int option = 0;
@@ -327,6 +260,11 @@ process_arguments (int argc, char **argv)
 /*  		{"warning",        required_argument,0,'w'}, */
   		{"port", required_argument,0,'p'}, 
 		{"flawcorrection", no_argument, 0, 'N'},
+		{"timeout", required_argument, 0, 't'},
+		{"retries", required_argument, 0, 'e'},
+		{"concurrency", required_argument, 0, 'n'},
+		{"ipv4", no_argument, 0, '4'},
+		{"ipv6", no_argument, 0, '6'},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
 		{0, 0, 0, 0}
@@ -337,19 +275,15 @@ process_arguments (int argc, char **argv)
 
 
 	while (1) {
-		c = getopt_long (argc, argv, "+hVNH:C:p:", longopts, &option);
+		c = getopt_long (argc, argv, "+hVNH:C:p:t:e:n:46", longopts, &option);
 
 		if (c == -1 || c == EOF || c == 1)
 			break;
 
 		switch (c) {
-		case 'H':									/* hostname */
-			if (is_host (optarg)) {
-				address = strscpy(address, optarg) ;
-			}
-			else {
-				usage2 (_("Invalid hostname/address"), optarg);
-			}
+		case 'H':									/* hostnames, comma separated, may be repeated */
+			for (ptr = strtok (strdup (optarg), ","); ptr != NULL; ptr = strtok (NULL, ","))
+				add_address (ptr);
 			break;
 		case 'C':									/* community */
 			community = strscpy (community, optarg);
@@ -358,7 +292,32 @@ process_arguments (int argc, char **argv)
 			if (!is_intpos(optarg))
 				usage2 (_("Port must be a positive short integer"), optarg);
 			else
-				port = atoi(optarg);
+				port = optarg;
+			break;
+		case 't':									/* timeout */
+			if (!is_intnonneg (optarg) || atoi (optarg) < 1)
+				usage2 (_("Timeout interval must be a positive integer"), optarg);
+			timeout_interval = atoi (optarg);
+			break;
+		case 'e':									/* retries */
+			if (!is_intnonneg (optarg))
+				usage2 (_("Retries interval must be a positive integer"), optarg);
+			retries = atoi (optarg);
+			break;
+		case 'n':									/* printers waited for at a time */
+			if (!is_intpos (optarg))
+				usage2 (_("Concurrency must be a positive integer"), optarg);
+			concurrency = atoi (optarg);
+			break;
+		case '4':
+			address_family = AF_INET;
+			break;
+		case '6':
+#ifdef USE_IPV6
+			address_family = AF_INET6;
+#else
+			usage4 (_("IPv6 support not available"));
+#endif
 			break;
                 case 'N':                                                                       /* flaw correction */
                         flawcorrection=1;
@@ -375,13 +334,10 @@ process_arguments (int argc, char **argv)
 	}
 
 	c = optind;
-	if (address == NULL) {
-		if (is_host (argv[c])) {
-			address = argv[c++];
-		}
-		else {
-			usage2 (_("Invalid hostname/address"), argv[c]);
-		}
+	if (num_addresses == 0) {
+		if (argv[c] == NULL)
+			usage2 (_("Invalid hostname/address"), "");
+		add_address (argv[c++]);
 	}
 
 	if (community == NULL) {
@@ -391,11 +347,11 @@ process_arguments (int argc, char **argv)
 			community = strdup (DEFAULT_COMMUNITY);
 	}
 
-	if (port == 0) {
+	if (port == NULL) {
 		if (argv[c] != NULL )
-			port = atoi (argv[c++]);
+			port = argv[c++];
 		else
-			port = atoi (DEFAULT_PORT);
+			port = DEFAULT_PORT;
 	}
 
 	return validate_arguments ();
@@ -418,7 +374,8 @@ print_help (void)
 	printf (COPYRIGHT, copyright, email);
 
 	printf ("%s\n", _("This plugin tests the STATUS of an HP printer with a JetDirect card."));
-	printf ("%s\n", _("Net-snmp must be installed on the computer running the plugin."));
+	printf ("%s\n", _("It asks for all of the status in one SNMPv1 GET, and can check many printers"));
+	printf ("%s\n", _("at the same time."));
 
 	printf ("\n\n");
 
@@ -426,6 +383,10 @@ print_help (void)
 
 	printf (UT_HELP_VRSN);
 	printf (UT_EXTRA_OPTS);
+	printf (UT_IPv46);
+
+	printf (" %s\n", "-H, --hostname=ADDRESS[,ADDRESS...]");
+	printf ("    %s\n", _("The printer, or printers to check at the same time. May be repeated"));
 
 	printf (" %s\n", "-C, --community=STRING");
 	printf ("    %s", _("The SNMP community name "));
@@ -439,6 +400,19 @@ print_help (void)
 	printf ("    %s", _("Correct false offline status reports "));
 	printf (_("(default=%s)"), "false");
 	printf ("\n");
+	printf (" %s\n", "-e, --retries=INTEGER");
+	printf ("    %s", _("Number of times to resend the request "));
+	printf (_("(default=%d)"), DEFAULT_RETRIES);
+	printf ("\n");
+	printf (" %s\n", "-n, --concurrency=INTEGER");
+	printf ("    %s", _("Number of printers waited for at the same time "));
+	printf (_("(default=%d)"), DEFAULT_CONCURRENCY);
+	printf ("\n");
+	printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+	printf ("    %s\n", _("This is per printer, for the request and its retries"));
+	printf ("\n");
+	printf ("%s\n", _("With more than one printer, the state is the worst of them and each one"));
+	printf ("%s\n", _("follows on a line of its own."));
 
 	printf (UT_SUPPORT);
 }
@@ -449,5 +423,6 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-	printf ("%s -H host [-C community] [-p port][-N]\n", progname);
+	printf ("%s -H host[,host...] [-C community] [-p port] [-N] [-t timeout] [-e retries]\n", progname);
+	printf ("[-n concurrency] [-4|-6]\n");
 }
@@ -41,13 +41,32 @@ const char *email = "devel@nagios-plugins.org";
 #include "netutils.h"
 #include "utils.h"
 #include "base64.h"
+#include "resident.h"
 #include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef HAVE_NGHTTP2
+#include <nghttp2/nghttp2.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BROTLI
+#include <brotli/decode.h>
+#endif
 
 #define STICKY_NONE 0
 #define STICKY_HOST 1
 #define STICKY_PORT 2
 
 #define HTTP_EXPECT "HTTP/1."
+#define HTTP2_EXPECT "HTTP/2"
+
+#define HTTP2_NONE 0
+#define HTTP2_ALPN 1                /* --http2 */
+#define HTTP2_PRIOR_KNOWLEDGE 2     /* --http2-prior-knowledge */
 enum {
     MAX_IPV4_HOSTLENGTH = 255,
     HTTP_PORT = 80,
@@ -55,10 +74,16 @@ enum {
     MAX_PORT = 65535
 };
 
+/* defaults for the options below are set in reset_state() so that
+ * resident mode can put them back between checks */
 #ifdef HAVE_SSL
-int check_cert = FALSE;
-int continue_after_check_cert = FALSE;
-int ssl_version = 0;
+int check_cert;
+int continue_after_check_cert;
+int check_ocsp;
+int ocsp_fetch;
+int ocsp_warn_hours;
+int ocsp_crit_hours;
+int ssl_version;
 int days_till_exp_warn, days_till_exp_crit;
 char *randbuff;
 X509 *server_cert;
@@ -68,21 +93,21 @@ X509 *server_cert;
 #  define my_recv(buf, len) read(sd, buf, len)
 #  define my_send(buf, len) send(sd, buf, len, 0)
 #endif /* HAVE_SSL */
-int no_body = FALSE;
-int maximum_age = -1;
+int no_body;
+int maximum_age;
 
 enum {
     REGS = 2,
     MAX_RE_SIZE = 2048
 };
-#include "regex.h"
-regex_t preg;
+#include "utils_regex.h"
+np_regex_t preg;
 regmatch_t pmatch[REGS];
 char regexp[MAX_RE_SIZE];
 char errbuf[MAX_INPUT_BUFFER];
-int cflags = REG_NOSUB | REG_EXTENDED | REG_NEWLINE;
+int cflags;
 int errcode;
-int invert_regex = 0;
+int invert_regex;
 
 struct timeval tv;
 struct timeval tv_temp;
@@ -90,52 +115,135 @@ struct timeval tv_temp;
 #define HTTP_URL "/"
 #define CRLF "\r\n"
 
-int specify_port = FALSE;
-int server_port = HTTP_PORT;
-char server_port_text[6] = "";
-char server_type[6] = "http";
+int specify_port;
+int server_port;
+char server_port_text[6];
+char server_type[6];
 char *server_address;
 char *host_name;
 char *server_url;
 char *user_agent;
 int server_url_length;
-int server_expect_yn = 0;
-char server_expect[MAX_INPUT_BUFFER] = HTTP_EXPECT;
-char header_expect[MAX_INPUT_BUFFER] = "";
-char string_expect[MAX_INPUT_BUFFER] = "";
-char output_header_search[30] = "";
-char output_string_search[30] = "";
-char *warning_thresholds = NULL;
-char *critical_thresholds = NULL;
+int server_expect_yn;
+char server_expect[MAX_INPUT_BUFFER];
+char header_expect[MAX_INPUT_BUFFER];
+char string_expect[MAX_INPUT_BUFFER];
+char output_header_search[30];
+char output_string_search[30];
+char *warning_thresholds;
+char *critical_thresholds;
 thresholds *thlds;
-char user_auth[MAX_INPUT_BUFFER] = "";
-char proxy_auth[MAX_INPUT_BUFFER] = "";
-int display_html = FALSE;
-char **http_opt_headers = NULL;
-int http_opt_headers_count = 0;
-int have_accept = FALSE;
-int onredirect = STATE_OK;
-int followsticky = STICKY_NONE;
-int use_ssl = FALSE;
-int use_sni = FALSE;
-int verbose = FALSE;
-int show_extended_perfdata = FALSE;
-int show_url = FALSE;
+char user_auth[MAX_INPUT_BUFFER];
+char proxy_auth[MAX_INPUT_BUFFER];
+int display_html;
+char **http_opt_headers;
+int http_opt_headers_count;
+int have_accept;
+int have_accept_encoding;
+int onredirect;
+int followsticky;
+int use_ssl;
+int use_sni;
+int tls_session_cache;
+int tls_full_handshake;
+int tls_early_data;
+int http2;
+int verbose;
+int show_extended_perfdata;
+int show_url;
 int sd;
-int min_page_len = 0;
-int max_page_len = 0;
-int redir_depth = 0;
-int max_depth = 15;
+int min_page_len;
+int max_page_len;
+int redir_depth;
+int max_depth;
+/* -f follow: sd is still open from the previous hop, to conn_address */
+int reuse_connection;
+int conn_ssl;
+int conn_port;
+char *conn_address;
+char *conn_host;
+double *redirect_time;
+int redirect_count;
 char *http_method;
 char *http_post_data;
+size_t http_post_len;
+int http_post_mapped;   /* http_post_data is --post-file's mapping */
 char *http_content_type;
 char buffer[MAX_INPUT_BUFFER];
-char *client_cert = NULL;
-char *client_privkey = NULL;
+char *client_cert;
+char *client_privkey;
+
+/* a string being built up, see http_buf_append() */
+struct http_buf {
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+/* the fields of a header block, see http_headers_parse() */
+struct http_field {
+    int name, name_len;         /* offsets into the block */
+    int value, value_len;
+};
+struct http_headers {
+    const char *base;
+    struct http_field *field;
+    int count;
+    int size;
+};
 
+/* --multi-url: each URL with its own checks, all on one connection */
+struct http_url_check {
+    char *url;
+    char *expect;       /* overrides -e */
+    char *string;       /* overrides -s */
+    np_regex_t preg;    /* overrides -r, if have_regex */
+    int have_regex;
+    char *warning;      /* override -w and -c */
+    char *critical;
+    thresholds *thlds;
+};
+struct http_url_check *url_checks;
+int url_check_count;
+int pipeline;
+int max_body_len;
+int stop_on_match;
+/* --compressed: ask for a compressed body; --decoded-size: -m checks it decoded */
+int compressed;
+int decoded_size;
+/* --conditional: revalidate with the validators of the last reply */
+int conditional;
+static char *conditional_headers;   /* If-None-Match etc. for this request */
+#define HTTP_STATE_VERSION 1
+/* --hosts: the same check against each of these, in parallel */
+char **target_hosts;
+int *target_ports;     /* 0 for -p */
+int target_count;
+int concurrency;
+/* --connect-to: the backends that HOST:PORT of the check stands for */
+char **connect_to;
+int connect_to_count;
+/* --cluster-warning/--cluster-critical: the backends down to care about */
+char *cluster_warning;
+char *cluster_critical;
+thresholds *cluster_thlds;
+
+static int run_check (int, char **);
+static void reset_state (void);
 int process_arguments (int, char **);
 int check_http (void);
-void redir (char *pos, char *status_line);
+int check_http_multi (void);
+int check_http2 (void);
+static int http_send_all (const char *, size_t);
+static const char *http_accept_encoding (void);
+static int http_send_request (const char *, size_t);
+static int http_tunnel (void);
+static int http_proxy_connect (char **);
+#ifdef HAVE_SSL
+static int http_check_certificate (void);
+#endif
+int check_http_parallel (void);
+void redir (const struct http_headers *headers, char *status_line);
 int server_type_check(const char *type);
 int server_port_check(int ssl_flag);
 char *perfd_time (double microsec);
@@ -154,11 +262,121 @@ extern int check_hostname;
 int
 main (int argc, char **argv)
 {
-    int result = STATE_UNKNOWN;
+    if (np_resident_requested (argc, argv))
+        return np_resident_main (argc, argv, run_check, reset_state);
+
+    reset_state ();
+    return run_check (argc, argv);
+}
+
+static void
+reset_state (void)
+{
+#ifdef HAVE_SSL
+    check_cert = FALSE;
+    continue_after_check_cert = FALSE;
+    check_ocsp = FALSE;
+    ocsp_fetch = FALSE;
+    ocsp_warn_hours = 24;
+    ocsp_crit_hours = 4;
+    ssl_version = 0;
+    days_till_exp_warn = days_till_exp_crit = 0;
+    server_cert = NULL;
+#endif
+    check_hostname = 0;
+    no_body = FALSE;
+    maximum_age = -1;
+    cflags = REG_NOSUB | REG_EXTENDED | REG_NEWLINE;
+    invert_regex = 0;
+    regexp[0] = '\0';
+
+    specify_port = FALSE;
+    server_port = HTTP_PORT;
+    server_port_text[0] = '\0';
+    strcpy (server_type, "http");
+    server_address = NULL;
+    host_name = NULL;
+    server_url = NULL;
+    user_agent = NULL;
+    server_url_length = 0;
+    server_expect_yn = 0;
+    strcpy (server_expect, HTTP_EXPECT);
+    header_expect[0] = '\0';
+    string_expect[0] = '\0';
+    output_header_search[0] = '\0';
+    output_string_search[0] = '\0';
+    warning_thresholds = NULL;
+    critical_thresholds = NULL;
+    thlds = NULL;
+    user_auth[0] = '\0';
+    proxy_auth[0] = '\0';
+    display_html = FALSE;
+    http_opt_headers = NULL;
+    http_opt_headers_count = 0;
+    have_accept = FALSE;
+    have_accept_encoding = FALSE;
+    onredirect = STATE_OK;
+    followsticky = STICKY_NONE;
+    use_ssl = FALSE;
+    use_sni = FALSE;
+    tls_session_cache = FALSE;
+    tls_full_handshake = FALSE;
+    tls_early_data = FALSE;
+    http2 = HTTP2_NONE;
+#ifdef HAVE_SSL
+    np_net_ssl_session_cache (NULL, 0, FALSE);
+    np_net_ssl_alpn (NULL);
+    np_net_ssl_ocsp (FALSE, FALSE);
+#endif
+    verbose = FALSE;
+    show_extended_perfdata = FALSE;
+    show_url = FALSE;
+    sd = 0;
+    min_page_len = 0;
+    max_page_len = 0;
+    redir_depth = 0;
+    max_depth = 15;
+    http_method = NULL;
+    if (http_post_mapped)
+        munmap (http_post_data, http_post_len);
+    http_post_data = NULL;
+    http_post_len = 0;
+    http_post_mapped = FALSE;
+    http_content_type = NULL;
+    client_cert = NULL;
+    client_privkey = NULL;
+    url_checks = NULL;
+    url_check_count = 0;
+    pipeline = FALSE;
+    max_body_len = 0;
+    stop_on_match = FALSE;
+    compressed = FALSE;
+    decoded_size = FALSE;
+    conditional = FALSE;
+    free (conditional_headers);
+    conditional_headers = NULL;
+    target_hosts = NULL;
+    target_ports = NULL;
+    target_count = 0;
+    connect_to = NULL;
+    connect_to_count = 0;
+    cluster_warning = cluster_critical = NULL;
+    cluster_thlds = NULL;
+    concurrency = 64;
+    reuse_connection = FALSE;
+    free (conn_address);
+    free (conn_host);
+    conn_address = conn_host = NULL;
+    free (redirect_time);
+    redirect_time = NULL;
+    redirect_count = 0;
+    np_net_reset ();
+}
 
-    setlocale (LC_ALL, "");
-    bindtextdomain (PACKAGE, LOCALEDIR);
-    textdomain (PACKAGE);
+static int
+run_check (int argc, char **argv)
+{
+    int result = STATE_UNKNOWN;
 
     /* Set default URL. Must be malloced for subsequent realloc if --onredirect=follow */
     server_url = strdup(HTTP_URL);
@@ -172,6 +390,12 @@ main (int argc, char **argv)
     if (process_arguments (argc, argv) == ERROR)
         usage4 (_("Could not parse arguments"));
 
+    /* the validators are kept under the key of the command line */
+    if (conditional) {
+        np_init ((char *) progname, argc, argv);
+        np_enable_state (NULL, HTTP_STATE_VERSION);
+    }
+
     if (display_html == TRUE)
         printf ("<A HREF=\"%s://%s:%d%s\" target=\"_blank\">",
                 use_ssl ? "https" : "http", host_name ? host_name : server_address,
@@ -182,7 +406,20 @@ main (int argc, char **argv)
     (void) alarm (timeout_interval);
     gettimeofday (&tv, NULL);
 
-    result = check_http ();
+#ifdef HAVE_POLL
+    if (target_count > 0)
+        result = check_http_parallel ();
+    else
+#endif
+#ifdef HAVE_NGHTTP2
+    if (http2 != HTTP2_NONE)
+        result = check_http2 ();
+    else
+#endif
+    if (url_check_count > 0)
+        result = check_http_multi ();
+    else
+        result = check_http ();
     return result;
 }
 
@@ -213,7 +450,107 @@ test_file (char *path)
     usage2 (_("file does not exist or is not readable"), path);
 }
 
+/* the URL that a --url-* option applies to */
+static struct http_url_check *
+last_url_check (const char *option)
+{
+    if (url_check_count == 0)
+        usage2 (_("Option must follow --multi-url"), option);
+    return &url_checks[url_check_count - 1];
+}
+
+/* --post-file: the body is not read, but mapped and sent from there */
+static void
+http_map_post_file (const char *path)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    if ((fd = open (path, O_RDONLY)) < 0 || fstat (fd, &st) < 0)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Cannot read %s: %s\n"), path, strerror (errno));
+    if (!S_ISREG (st.st_mode))
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - %s is not a file\n"), path);
+    if (st.st_size == 0) {
+        http_post_data = strdup ("");
+    } else {
+        if ((map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+            die (STATE_UNKNOWN, _("HTTP UNKNOWN - Cannot map %s: %s\n"), path, strerror (errno));
+#ifdef MADV_SEQUENTIAL
+        madvise (map, st.st_size, MADV_SEQUENTIAL);
+#endif
+        http_post_data = map;
+        http_post_mapped = TRUE;
+    }
+    http_post_len = st.st_size;
+    close (fd);
+}
+
 /* process command-line arguments */
+static void
+http_add_target (char *address, int port)
+{
+    target_hosts = realloc (target_hosts, sizeof (char *) * (target_count + 1));
+    target_ports = realloc (target_ports, sizeof (int) * (target_count + 1));
+    if (target_hosts == NULL || target_ports == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+    target_hosts[target_count] = address;
+    target_ports[target_count++] = port;
+}
+
+/* where a host, [IPv6] or not, ends in a HOST:PORT list */
+static char *
+http_host_end (char *p)
+{
+    char *end;
+
+    if (*p == '[' && (end = strchr (p, ']')) != NULL)
+        return end + 1;
+    return p + strcspn (p, ":");
+}
+
+/*
+ * --connect-to=HOST:PORT:ADDRESS[,ADDRESS...], as curl's but to several
+ * addresses: a check of HOST:PORT (either may be left empty for any) is
+ * made against each ADDRESS, each of which may have a :PORT of its own,
+ * with the Host header and SNI of HOST. FALSE if this one does not match.
+ */
+static int
+http_connect_to (const char *mapping)
+{
+    char *spec = strdup (mapping), *host, *port, *address, *end;
+    int n, matched;
+
+    if (spec == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+    end = http_host_end (host = spec);
+    if (*end != ':' || (end = strchr (port = end + 1, ':')) == NULL)
+        usage2 (_("--connect-to must be HOST:PORT:ADDRESS[,ADDRESS...]"), mapping);
+    port[-1] = *end = '\0';
+    if (*port && !is_intpos (port))
+        usage2 (_("Invalid port in --connect-to"), mapping);
+    matched = (!*host || !strcasecmp (host, host_name ? host_name : server_address))
+              && (!*port || atoi (port) == server_port);
+    if (!matched) {
+        free (spec);
+        return FALSE;
+    }
+    for (address = strtok (end + 1, ","); address != NULL; address = strtok (NULL, ",")) {
+        n = 0;
+        end = http_host_end (address);
+        /* a bare IPv6 address has colons of its own */
+        if (*end == ':' && (*address == '[' || strchr (end + 1, ':') == NULL)) {
+            if (!is_intpos (end + 1))
+                usage2 (_("Invalid port in --connect-to"), mapping);
+            n = atoi (end + 1);
+        }
+        http_add_target (address, n);
+    }
+    if (target_count == 0)
+        usage2 (_("--connect-to must be HOST:PORT:ADDRESS[,ADDRESS...]"), mapping);
+    return TRUE;
+}
+
 int
 process_arguments (int argc, char **argv)
 {
@@ -225,7 +562,36 @@ process_arguments (int argc, char **argv)
         INVERT_REGEX = CHAR_MAX + 1,
         SNI_OPTION,
         VERIFY_HOST,
-        CONTINUE_AFTER_CHECK_CERT
+        CONTINUE_AFTER_CHECK_CERT,
+        MULTI_URL,
+        URL_EXPECT,
+        URL_STRING,
+        URL_REGEX,
+        URL_WARNING,
+        URL_CRITICAL,
+        PIPELINE,
+        HOSTS,
+        CONNECT_TO,
+        CLUSTER_WARNING,
+        CLUSTER_CRITICAL,
+        CONCURRENCY,
+        MAX_BODY,
+        STOP_ON_MATCH,
+        TLS_SESSION_CACHE,
+        TLS_FULL_HANDSHAKE,
+        TLS_EARLY_DATA,
+        OCSP,
+        OCSP_FETCH,
+        HTTP2,
+        HTTP2_PRIOR,
+        TCP_FASTOPEN,
+        ADAPTIVE_TIMEOUT,
+        MAX_RATE,
+        MAX_INFLIGHT,
+        COMPRESSED,
+        DECODED_SIZE,
+        CONDITIONAL,
+        POST_FILE
     };
 
     int option = 0;
@@ -237,6 +603,7 @@ process_arguments (int argc, char **argv)
         {"sni", no_argument, 0, SNI_OPTION},
         {"verify-host", no_argument, 0, VERIFY_HOST},
         {"post", required_argument, 0, 'P'},
+        {"post-file", required_argument, 0, POST_FILE},
         {"method", required_argument, 0, 'j'},
         {"IP-address", required_argument, 0, 'I'},
         {"url", required_argument, 0, 'u'},
@@ -267,6 +634,34 @@ process_arguments (int argc, char **argv)
         {"use-ipv6", no_argument, 0, '6'},
         {"extended-perfdata", no_argument, 0, 'E'},
         {"show-url", no_argument, 0, 'U'},
+        {"multi-url", required_argument, 0, MULTI_URL},
+        {"url-expect", required_argument, 0, URL_EXPECT},
+        {"url-string", required_argument, 0, URL_STRING},
+        {"url-regex", required_argument, 0, URL_REGEX},
+        {"url-warning", required_argument, 0, URL_WARNING},
+        {"url-critical", required_argument, 0, URL_CRITICAL},
+        {"pipeline", no_argument, 0, PIPELINE},
+        {"hosts", required_argument, 0, HOSTS},
+        {"connect-to", required_argument, 0, CONNECT_TO},
+        {"cluster-warning", required_argument, 0, CLUSTER_WARNING},
+        {"cluster-critical", required_argument, 0, CLUSTER_CRITICAL},
+        {"concurrency", required_argument, 0, CONCURRENCY},
+        {"max-body", required_argument, 0, MAX_BODY},
+        {"stop-on-match", no_argument, 0, STOP_ON_MATCH},
+        {"tls-session-cache", no_argument, 0, TLS_SESSION_CACHE},
+        {"tls-full-handshake", no_argument, 0, TLS_FULL_HANDSHAKE},
+        {"tls-early-data", no_argument, 0, TLS_EARLY_DATA},
+        {"ocsp", optional_argument, 0, OCSP},
+        {"ocsp-fetch", no_argument, 0, OCSP_FETCH},
+        {"http2", no_argument, 0, HTTP2},
+        {"http2-prior-knowledge", no_argument, 0, HTTP2_PRIOR},
+        {"tcp-fastopen", no_argument, 0, TCP_FASTOPEN},
+        {"adaptive-timeout", no_argument, 0, ADAPTIVE_TIMEOUT},
+        {"max-rate", required_argument, 0, MAX_RATE},
+        {"max-inflight", required_argument, 0, MAX_INFLIGHT},
+        {"compressed", no_argument, 0, COMPRESSED},
+        {"decoded-size", no_argument, 0, DECODED_SIZE},
+        {"conditional", no_argument, 0, CONDITIONAL},
         {0, 0, 0, 0}
     };
 
@@ -297,11 +692,11 @@ process_arguments (int argc, char **argv)
             break;
         case 'h': /* help */
             print_help ();
-            exit (STATE_OK);
+            np_exit (STATE_OK);
             break;
         case 'V': /* version */
             print_revision (progname, NP_VERSION);
-            exit (STATE_OK);
+            np_exit (STATE_OK);
             break;
         case 't': /* timeout period */
             timeout_interval = parse_timeout_string(optarg);
@@ -323,6 +718,8 @@ process_arguments (int argc, char **argv)
             http_opt_headers[http_opt_headers_count - 1] = optarg;
             if (!strncmp(optarg, "Accept:", 7))
                 have_accept = TRUE;
+            if (!strncasecmp (optarg, "Accept-Encoding:", 16))
+                have_accept_encoding = TRUE;
             break;
         case 'L': /* show html link */
             display_html = TRUE;
@@ -350,6 +747,25 @@ process_arguments (int argc, char **argv)
             }
             check_cert = TRUE;
             goto enable_ssl;
+#endif
+        case OCSP: /* check the OCSP status of the certificate */
+#ifdef HAVE_SSL
+            if (optarg) {
+                if ((temp = strchr (optarg, ',')) != NULL)
+                    *temp++ = '\0';
+                if (!is_intnonneg (optarg) || (temp && !is_intnonneg (temp)))
+                    usage2 (_("Invalid OCSP next update period"), optarg);
+                ocsp_warn_hours = atoi (optarg);
+                ocsp_crit_hours = temp ? atoi (temp) : 0;
+            }
+            check_ocsp = TRUE;
+            goto enable_ssl;
+#endif
+        case OCSP_FETCH: /* ask the responder when nothing is stapled */
+#ifdef HAVE_SSL
+            ocsp_fetch = TRUE;
+            check_ocsp = TRUE;
+            goto enable_ssl;
 #endif
         case CONTINUE_AFTER_CHECK_CERT: /* don't stop after the certificate is checked */
 #ifdef HAVE_SSL
@@ -464,8 +880,16 @@ enable_ssl:
             proxy_auth[MAX_INPUT_BUFFER - 1] = 0;
             break;
         case 'P': /* HTTP POST data in URL encoded format; ignored if settings already */
-            if (! http_post_data)
+            if (! http_post_data) {
                 http_post_data = strdup (optarg);
+                http_post_len = strlen (http_post_data);
+            }
+            if (! http_method)
+                http_method = strdup("POST");
+            break;
+        case POST_FILE: /* the same, from a file */
+            if (! http_post_data)
+                http_map_post_file (optarg);
             if (! http_method)
                 http_method = strdup("POST");
             break;
@@ -498,9 +922,9 @@ enable_ssl:
         case 'r': /* regex */
             strncpy (regexp, optarg, MAX_RE_SIZE - 1);
             regexp[MAX_RE_SIZE - 1] = 0;
-            errcode = regcomp (&preg, regexp, cflags);
+            errcode = np_regcomp (&preg, regexp, cflags);
             if (errcode != 0) {
-                (void) regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
+                (void) np_regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
                 printf (_("Could Not Compile Regular Expression: %s"), errbuf);
                 return ERROR;
             }
@@ -522,6 +946,7 @@ enable_ssl:
             break;
         case 'v': /* verbose */
             verbose = TRUE;
+            np_net_verbose = TRUE;
             break;
         case 'm': { /* min_page_length */
             char *tmp;
@@ -530,14 +955,14 @@ enable_ssl:
                 tmp = strtok(optarg, ":");
                 if (tmp == NULL) {
                     printf("Bad format: try \"-m min:max\"\n");
-                    exit (STATE_WARNING);
+                    np_exit (STATE_WARNING);
                 } else
                     min_page_len = atoi(tmp);
 
                 tmp = strtok(NULL, ":");
                 if (tmp == NULL) {
                     printf("Bad format: try \"-m min:max\"\n");
-                    exit (STATE_WARNING);
+                    np_exit (STATE_WARNING);
                 } else
                     max_page_len = atoi(tmp);
             } else
@@ -560,7 +985,7 @@ enable_ssl:
                 maximum_age = atoi (optarg);
             else {
                 fprintf (stderr, "unparsable max-age: %s\n", optarg);
-                exit (STATE_WARNING);
+                np_exit (STATE_WARNING);
             }
         }
         break;
@@ -570,6 +995,115 @@ enable_ssl:
         case 'U': /* show checked url in output msg */
           show_url = TRUE;
           break;
+        case MULTI_URL: /* one more URL for the shared connection */
+            url_checks = realloc (url_checks, sizeof (*url_checks) * (url_check_count + 1));
+            if (url_checks == NULL)
+                die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+            memset (&url_checks[url_check_count], 0, sizeof (*url_checks));
+            url_checks[url_check_count++].url = optarg;
+            break;
+        case URL_EXPECT: /* the --url-* options apply to the last --multi-url */
+            last_url_check (longopts[option].name)->expect = optarg;
+            break;
+        case URL_STRING:
+            last_url_check (longopts[option].name)->string = optarg;
+            break;
+        case URL_REGEX: {
+            struct http_url_check *u = last_url_check (longopts[option].name);
+            if (u->have_regex)
+                np_regfree (&u->preg);
+            errcode = np_regcomp (&u->preg, optarg, cflags);
+            if (errcode != 0) {
+                (void) np_regerror (errcode, &u->preg, errbuf, MAX_INPUT_BUFFER);
+                printf (_("Could Not Compile Regular Expression: %s"), errbuf);
+                return ERROR;
+            }
+            u->have_regex = TRUE;
+            break;
+        }
+        case URL_WARNING:
+            last_url_check (longopts[option].name)->warning = optarg;
+            break;
+        case URL_CRITICAL:
+            last_url_check (longopts[option].name)->critical = optarg;
+            break;
+        case PIPELINE:
+            pipeline = TRUE;
+            break;
+        case HOSTS: /* comma separated, may be repeated */
+            for (p = strtok (strdup (optarg), ","); p != NULL; p = strtok (NULL, ","))
+                http_add_target (p, 0);
+            break;
+        case CONNECT_TO: /* may be repeated, the first one that matches is used */
+            if ((connect_to = realloc (connect_to, sizeof (char *) * (connect_to_count + 1))) == NULL)
+                die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+            connect_to[connect_to_count++] = optarg;
+            break;
+        case CLUSTER_WARNING:
+            cluster_warning = optarg;
+            break;
+        case CLUSTER_CRITICAL:
+            cluster_critical = optarg;
+            break;
+        case CONCURRENCY:
+            if (!is_intpos (optarg))
+                usage2 (_("Concurrency must be a positive integer"), optarg);
+            concurrency = atoi (optarg);
+            break;
+        case MAX_BODY:
+            if (!is_intpos (optarg))
+                usage2 (_("Invalid body size"), optarg);
+            max_body_len = atoi (optarg);
+            break;
+        case STOP_ON_MATCH:
+            stop_on_match = TRUE;
+            break;
+        case TLS_SESSION_CACHE:
+            tls_session_cache = TRUE;
+            break;
+        case TLS_FULL_HANDSHAKE:
+            tls_full_handshake = TRUE;
+            break;
+        case TLS_EARLY_DATA:
+            /* there is nothing to send it with but a resumed session */
+            tls_early_data = TRUE;
+            tls_session_cache = TRUE;
+            break;
+        case HTTP2:
+        case HTTP2_PRIOR:
+#ifdef HAVE_NGHTTP2
+            http2 = c == HTTP2 ? HTTP2_ALPN : HTTP2_PRIOR_KNOWLEDGE;
+#else
+            usage4 (_("HTTP/2 support was not compiled in"));
+#endif
+            break;
+        case TCP_FASTOPEN:
+            np_net_fastopen = TRUE;
+            break;
+        case ADAPTIVE_TIMEOUT:
+            np_net_adaptive = TRUE;
+            break;
+        case MAX_RATE:
+            if (!is_positive (optarg))
+                usage2 (_("Rate must be a positive number"), optarg);
+            np_net_max_rate = strtod (optarg, NULL);
+            break;
+        case MAX_INFLIGHT:
+            if (!is_intpos (optarg))
+                usage2 (_("Inflight limit must be a positive integer"), optarg);
+            np_net_max_inflight = atoi (optarg);
+            break;
+        case COMPRESSED:
+            if (http_accept_encoding () == NULL)
+                usage4 (_("Decoding compressed bodies was not compiled in"));
+            compressed = TRUE;
+            break;
+        case DECODED_SIZE:
+            decoded_size = TRUE;
+            break;
+        case CONDITIONAL:
+            conditional = TRUE;
+            break;
         }
     }
 
@@ -585,6 +1119,9 @@ enable_ssl:
         usage4(_("Server name indication requires that a host name is defined with -H"));
     }
 
+    if (server_address == NULL && target_count > 0)
+        server_address = strdup (target_hosts[0]);
+
     if (server_address == NULL) {
         if (host_name == NULL)
             usage4 (_("You must specify a server address or host name"));
@@ -594,6 +1131,18 @@ enable_ssl:
 
     set_thresholds(&thlds, warning_thresholds, critical_thresholds);
 
+    if (connect_to_count > 0) {
+        if (target_count > 0)
+            usage4 (_("--hosts and --connect-to cannot be combined"));
+        for (c = 0; c < connect_to_count && !http_connect_to (connect_to[c]); c++)
+            ;
+    }
+    if (cluster_warning || cluster_critical) {
+        if (target_count == 0)
+            usage4 (_("--cluster-warning and --cluster-critical require --hosts or --connect-to"));
+        set_thresholds (&cluster_thlds, cluster_warning, cluster_critical);
+    }
+
     if (critical_thresholds && thlds->critical->end>(double)timeout_interval)
         timeout_interval = (int)thlds->critical->end + 1;
 
@@ -602,6 +1151,56 @@ enable_ssl:
 
     if (client_cert && !client_privkey)
         usage4 (_("If you use a client certificate you must also specify a private key file"));
+#ifdef HAVE_SSL
+    np_net_ssl_ocsp (check_ocsp, ocsp_fetch);
+#endif
+
+    if (url_check_count > 0) {
+        if (onredirect == STATE_DEPENDENT)
+            usage4 (_("Redirects cannot be followed with --multi-url"));
+        if (strcmp (http_method, "CONNECT") == 0 && (use_ssl != TRUE || host_name == NULL))
+            usage4 (_("The CONNECT method needs -S and -H with --multi-url"));
+        for (c = 0; c < url_check_count; c++)
+            set_thresholds (&url_checks[c].thlds,
+                            url_checks[c].warning ? url_checks[c].warning : warning_thresholds,
+                            url_checks[c].critical ? url_checks[c].critical : critical_thresholds);
+    }
+    else if (pipeline)
+        usage4 (_("--pipeline requires --multi-url"));
+
+    if (target_count > 0) {
+#ifndef HAVE_POLL
+        usage4 (_("--hosts is not supported on this system"));
+#endif
+        if (url_check_count > 0)
+            usage4 (_("--hosts and --multi-url cannot be combined"));
+        if (onredirect == STATE_DEPENDENT)
+            usage4 (_("Redirects cannot be followed with --hosts"));
+#ifdef HAVE_SSL
+        if (check_cert == TRUE || check_ocsp == TRUE)
+            usage4 (_("Certificates cannot be checked with --hosts"));
+#endif
+        if (strcmp (http_method, "CONNECT") == 0)
+            usage4 (_("The CONNECT method cannot be used with --hosts"));
+    }
+
+    if (conditional) {
+        if (url_check_count > 0 || target_count > 0 || http2 != HTTP2_NONE)
+            usage4 (_("--conditional cannot be combined with --multi-url, --hosts or HTTP/2"));
+        if (maximum_age >= 0)
+            usage4 (_("--conditional cannot be combined with -M"));
+    }
+
+    if (http2 != HTTP2_NONE) {
+        if (http2 == HTTP2_ALPN && use_ssl == FALSE)
+            usage4 (_("--http2 is negotiated during the TLS handshake, use --http2-prior-knowledge without -S"));
+        if (target_count > 0)
+            usage4 (_("--hosts does not support HTTP/2"));
+        if (onredirect == STATE_DEPENDENT)
+            usage4 (_("Redirects cannot be followed with HTTP/2"));
+        if (strcmp (http_method, "CONNECT") == 0)
+            usage4 (_("The CONNECT method cannot be used with HTTP/2"));
+    }
 
     return TRUE;
 }
@@ -610,13 +1209,14 @@ enable_ssl:
 
 /* Returns 0 if we're still retrieving the headers.
  * Otherwise, returns the length of the header (not including the final newlines)
+ * Scanning starts at from, where the last call left off.
  */
 static int
-document_headers_done (const char *full_page)
+document_headers_done (const char *full_page, size_t from)
 {
     const char *body;
 
-    for (body = full_page; *body; body++) {
+    for (body = full_page + from; *body; body++) {
         if (!strncmp (body, "\n\n", 2) || !strncmp (body, "\n\r\n", 3))
             break;
     }
@@ -757,7 +1357,8 @@ int chunk_header(char **buf)
     return lth;
 }
 
-char *
+/* the chunks of raw one after the other at dst; returns their length */
+size_t
 decode_chunked_page (const char *raw, char *dst)
 {
     int  chunksize;
@@ -779,125 +1380,303 @@ decode_chunked_page (const char *raw, char *dst)
             raw_pos++;
     }
 
-    return dst;
+    return dst_pos - dst;
 }
 
-static char *
-header_value (const char *headers, const char *header)
+/* Split the header block into fields once. Fields are kept as offsets
+ * into the block, so the index stays valid when the block moves. */
+static void
+http_headers_parse (struct http_headers *h, const char *block, size_t len)
 {
-    char *s;
-    char *value;
-    const char *value_end;
-    int value_size;
+    const char *end = block + len, *line, *eol, *colon, *v;
+    struct http_field *f;
+
+    h->base = block;
+    h->count = 0;
+
+    for (line = block; line < end; line = eol + 1) {
+        if ((eol = memchr (line, '\n', end - line)) == NULL)
+            eol = end;
+        if (line == eol || (*line == '\r' && line + 1 == eol))
+            break;  /* the empty line ends the headers */
+
+        /* RFC 2616 (4.2): a line starting with SP or HT continues the field */
+        if ((*line == ' ' || *line == '\t') && h->count > 0) {
+            f = &h->field[h->count - 1];
+            for (v = eol; v > line && isspace (v[-1]); v--);
+            f->value_len = (v - block) - f->value;
+            continue;
+        }
 
-    if (!(s = strcasestr(headers, header))) {
-        return NULL;
+        /* the status line, or anything else without a field name */
+        for (colon = line; colon < eol && *colon != ':' && !isspace (*colon); colon++);
+        if (colon == line || colon == eol || *colon != ':')
+            continue;
+
+        if (h->count == h->size) {
+            h->size = h->size ? h->size * 2 : 16;
+            if ((h->field = realloc (h->field, h->size * sizeof (*h->field))) == NULL)
+                die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+        }
+        f = &h->field[h->count++];
+        f->name = line - block;
+        f->name_len = colon - line;
+        for (v = colon + 1; v < eol && (*v == ' ' || *v == '\t'); v++);
+        f->value = v - block;
+        for (v = eol; v > block + f->value && isspace (v[-1]); v--);
+        f->value_len = (v - block) - f->value;
     }
+}
+
+static void
+http_headers_free (struct http_headers *h)
+{
+    free (h->field);
+    memset (h, 0, sizeof (*h));
+}
 
-    s += strlen(header);
+/* the first field called name, NULL if there is none */
+static const struct http_field *
+http_header_find (const struct http_headers *h, const char *name)
+{
+    size_t len = strlen (name);
+    int i;
 
-    while (*s && (isspace(*s) || *s == ':')) s++;
-    while (*s && isspace(*s)) s++;
+    for (i = 0; i < h->count; i++)
+        if (h->field[i].name_len == len && !strncasecmp (h->base + h->field[i].name, name, len))
+            return &h->field[i];
+    return NULL;
+}
 
-    value_end = strchr(s, '\r');
-    if (!value_end)
-        value_end = strchr(s, '\n');
-    if (!value_end) {
-        // Turns out there's no newline after the header... So it's at the end!
-        value_end = s + strlen(s);
-    }
+static char *
+header_value (const struct http_headers *h, const char *header)
+{
+    const struct http_field *f = http_header_find (h, header);
+    char *value;
 
-    value_size = value_end - s;
+    if (f == NULL)
+        return NULL;
 
-    value = malloc(value_size + 1);
+    value = malloc(f->value_len + 1);
     if (!value) {
         die (STATE_UNKNOWN, _("HTTP_UNKNOWN - Memory allocation error\n"));
     }
-
-    if (!strncpy(value, s, value_size)) {
-        die(STATE_UNKNOWN, _("HTTP_UNKNOWN - Memory copy failure\n"));
-    }
-    value[value_size] = '\0';
+    memcpy (value, h->base + f->value, f->value_len);
+    value[f->value_len] = '\0';
 
     return value;
 }
 
 static int
-chunked_transfer_encoding (const char *headers)
+chunked_transfer_encoding (const struct http_headers *h)
 {
-    int result;
-    char *encoding = header_value(headers, "Transfer-Encoding");
-    if (!encoding) {
-        return 0;
-    }
+    const struct http_field *f = http_header_find (h, "Transfer-Encoding");
 
-    if (! strncmp(encoding, "chunked", sizeof("chunked"))) {
-        result = 1;
-    } else {
-        result = 0;
-    }
+    return f && f->value_len == strlen ("chunked") &&
+        !strncasecmp (h->base + f->value, "chunked", f->value_len);
+}
 
-    free(encoding);
-    return result;
+/*
+ * A body in a Content-Encoding this build decodes is decoded as it comes
+ * in, and the matchers see it decoded; any other is passed on as it is.
+ * --compressed asks for one with Accept-Encoding.
+ */
+enum {
+    HTTP_CODING_IDENTITY,
+    HTTP_CODING_DEFLATE,    /* gzip or deflate: zlib tells them apart */
+    HTTP_CODING_BR
+};
+
+struct http_decoder {
+    int coding;
+    int done;
+    int raw;                /* deflate without its zlib header */
+    size_t fed;
+#ifdef HAVE_ZLIB
+    z_stream z;
+#endif
+#ifdef HAVE_BROTLI
+    BrotliDecoderState *br;
+#endif
+};
+
+typedef void (*http_decoded_fn) (void *, const char *, size_t);
+
+/* the codings to ask for, NULL if none can be decoded */
+static const char *
+http_accept_encoding (void)
+{
+#if defined(HAVE_ZLIB) && defined(HAVE_BROTLI)
+    return "br, gzip, deflate";
+#elif defined(HAVE_ZLIB)
+    return "gzip, deflate";
+#elif defined(HAVE_BROTLI)
+    return "br";
+#else
+    return NULL;
+#endif
 }
 
 static int
-check_document_dates (const char *headers, char **msg)
+http_token_is (const char *value, size_t len, const char *token)
 {
-    const char *s;
-    char *server_date = 0;
-    char *document_date = 0;
-    int date_result = STATE_OK;
+    return len == strlen (token) && !strncasecmp (value, token, len);
+}
 
-    s = headers;
-    while (*s) {
-        const char *field = s;
-        const char *value = 0;
-
-        /* Find the end of the header field */
-        while (*s && !isspace(*s) && *s != ':')
-            s++;
-
-        /* Remember the header value, if any. */
-        if (*s == ':')
-            value = ++s;
-
-        /* Skip to the end of the header, including continuation lines. */
-        while (*s && !(*s == '\n' && (s[1] != ' ' && s[1] != '\t')))
-            s++;
-
-        /* Avoid stepping over end-of-string marker */
-        if (*s)
-            s++;
-
-        /* Process this header. */
-        if (value && value > field+2) {
-            char *ff = (char *) malloc (value-field);
-            char *ss = ff;
-            while (field < value-1)
-                *ss++ = tolower(*field++);
-            *ss++ = 0;
-
-            if (!strcmp (ff, "date") || !strcmp (ff, "last-modified")) {
-                const char *e;
-                while (*value && isspace (*value))
-                    value++;
-                for (e = value; *e && *e != '\r' && *e != '\n'; e++)
-                    ;
-                ss = (char *) malloc (e - value + 1);
-                strncpy (ss, value, e - value);
-                ss[e - value] = 0;
-                if (!strcmp (ff, "date")) {
-                    if (server_date) free (server_date);
-                    server_date = ss;
-                } else {
-                    if (document_date) free (document_date);
-                    document_date = ss;
-                }
+static int
+http_content_coding (const struct http_headers *h)
+{
+    const struct http_field *f = http_header_find (h, "Content-Encoding");
+    const char *value;
+
+    if (f == NULL)
+        return HTTP_CODING_IDENTITY;
+    value = h->base + f->value;
+#ifdef HAVE_ZLIB
+    if (http_token_is (value, f->value_len, "gzip") || http_token_is (value, f->value_len, "x-gzip") ||
+            http_token_is (value, f->value_len, "deflate"))
+        return HTTP_CODING_DEFLATE;
+#endif
+#ifdef HAVE_BROTLI
+    if (http_token_is (value, f->value_len, "br"))
+        return HTTP_CODING_BR;
+#endif
+    return HTTP_CODING_IDENTITY;
+}
+
+static void
+http_decoder_init (struct http_decoder *d, int coding)
+{
+    memset (d, 0, sizeof (*d));
+    d->coding = coding;
+#ifdef HAVE_ZLIB
+    /* 15 + 32: a gzip or a zlib header, whichever it has */
+    if (coding == HTTP_CODING_DEFLATE && inflateInit2 (&d->z, 15 + 32) != Z_OK)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+#endif
+#ifdef HAVE_BROTLI
+    if (coding == HTTP_CODING_BR && (d->br = BrotliDecoderCreateInstance (NULL, NULL, NULL)) == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+#endif
+}
+
+static void
+http_decoder_free (struct http_decoder *d)
+{
+#ifdef HAVE_ZLIB
+    if (d->coding == HTTP_CODING_DEFLATE)
+        inflateEnd (&d->z);
+#endif
+#ifdef HAVE_BROTLI
+    if (d->br)
+        BrotliDecoderDestroyInstance (d->br);
+#endif
+    d->coding = HTTP_CODING_IDENTITY;
+}
+
+/* the body as sent, whatever it decodes to goes to out; FALSE if it
+ * cannot be decoded. What follows the end of the encoded data is dropped. */
+static int
+http_decoder_feed (struct http_decoder *d, const char *data, size_t len, http_decoded_fn out, void *arg)
+{
+    char buf[MAX_INPUT_BUFFER];
+    int ret;
+
+    if (d->coding == HTTP_CODING_IDENTITY) {
+        out (arg, data, len);
+        return TRUE;
+    }
+    if (d->done || len == 0)
+        return TRUE;
+    d->fed += len;
+#ifdef HAVE_ZLIB
+    if (d->coding == HTTP_CODING_DEFLATE) {
+        d->z.next_in = (Bytef *) data;
+        d->z.avail_in = len;
+        do {
+            d->z.next_out = (Bytef *) buf;
+            d->z.avail_out = sizeof (buf);
+            ret = inflate (&d->z, Z_NO_FLUSH);
+            /* some servers send deflate as the bare stream */
+            if (ret == Z_DATA_ERROR && !d->raw && d->fed == len && d->z.total_out == 0) {
+                d->raw = TRUE;
+                if (inflateReset2 (&d->z, -15) != Z_OK)
+                    return FALSE;
+                d->z.next_in = (Bytef *) data;
+                d->z.avail_in = len;
+                continue;
             }
-            free (ff);
-        }
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+                return FALSE;
+            out (arg, buf, sizeof (buf) - d->z.avail_out);
+            if (ret == Z_STREAM_END) {
+                d->done = TRUE;
+                break;
+            }
+        } while (d->z.avail_in > 0 || d->z.avail_out == 0);
+    }
+#endif
+#ifdef HAVE_BROTLI
+    if (d->coding == HTTP_CODING_BR) {
+        const uint8_t *next_in = (const uint8_t *) data;
+        size_t avail_in = len, avail_out;
+        uint8_t *next_out;
+
+        do {
+            next_out = (uint8_t *) buf;
+            avail_out = sizeof (buf);
+            ret = BrotliDecoderDecompressStream (d->br, &avail_in, &next_in, &avail_out, &next_out, NULL);
+            if (ret == BROTLI_DECODER_RESULT_ERROR)
+                return FALSE;
+            out (arg, buf, sizeof (buf) - avail_out);
+            if (ret == BROTLI_DECODER_RESULT_SUCCESS) {
+                d->done = TRUE;
+                break;
+            }
+        } while (avail_in > 0 || ret == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+    }
+#endif
+    return TRUE;
+}
+
+static void http_buf_append (struct http_buf *, const char *, size_t);
+
+static void
+http_buf_append_fn (void *b, const char *data, size_t len)
+{
+    http_buf_append (b, data, len);
+}
+
+/* a whole body decoded, for the --multi-url and --hosts replies: the
+ * body, or a new one if it was encoded, NULL if it cannot be decoded */
+static char *
+http_decode_body (const struct http_headers *h, char *body, size_t len, size_t *decoded_len)
+{
+    struct http_decoder d;
+    struct http_buf out = { NULL, 0, 0 };
+    int ok;
+
+    *decoded_len = len;
+    if ((d.coding = http_content_coding (h)) == HTTP_CODING_IDENTITY)
+        return body;
+    http_decoder_init (&d, d.coding);
+    ok = http_decoder_feed (&d, body, len, http_buf_append_fn, &out) && d.done;
+    http_decoder_free (&d);
+    if (!ok) {
+        free (out.data);
+        return NULL;
     }
+    http_buf_append_fn (&out, "", 0);
+    *decoded_len = out.len;
+    return out.data;
+}
+
+static int
+check_document_dates (const struct http_headers *h, char **msg)
+{
+    char *server_date = header_value (h, "Date");
+    char *document_date = header_value (h, "Last-Modified");
+    int date_result = STATE_OK;
 
     /* Done parsing the body.  Now check the dates we (hopefully) parsed.  */
     if (!server_date || !*server_date) {
@@ -935,57 +1714,64 @@ check_document_dates (const char *headers, char **msg)
     return date_result;
 }
 
+/* HTTP/1.1 connections persist unless either side says otherwise */
+static int
+http_keep_alive (const struct http_headers *h, const char *status_line)
+{
+    char *connection = header_value (h, "Connection");
+    int keep_alive;
+
+    if (connection != NULL)
+        keep_alive = strcasecmp (connection, "close") != 0 &&
+            (strncmp (status_line, "HTTP/1.0", 8) != 0 || strcasecmp (connection, "keep-alive") == 0);
+    else
+        keep_alive = strncmp (status_line, "HTTP/1.0", 8) != 0;
+    free (connection);
+    return keep_alive;
+}
+
+/* the status code of a reply starting at status_line, 0 if there is none */
+static int
+http_status_code (const char *status_line)
+{
+    const char *code = status_line + strcspn (status_line, " \r\n");
+
+    code += strspn (code, " ");
+    return strspn (code, "1234567890") == 3 ? atoi (code) : 0;
+}
+
+/* -j CONNECT with -S and -H: the requests go to host_name through a
+ * tunnel opened by the proxy at server_address */
+static int
+http_tunnel (void)
+{
+    return server_address != NULL && strcmp (http_method, "CONNECT") == 0
+           && host_name != NULL && use_ssl == TRUE;
+}
+
+/* TRUE if the connection still open from the last redirect goes where
+ * the next request has to */
+static int
+http_same_origin (void)
+{
+    if (conn_ssl != use_ssl || conn_port != server_port || strcmp (conn_address, server_address))
+        return FALSE;
+    /* the TLS session was set up for conn_host (SNI, certificate) */
+    if (!use_ssl)
+        return TRUE;
+    if (conn_host == NULL || host_name == NULL)
+        return conn_host == host_name;
+    return !strcmp (conn_host, host_name);
+}
+
 int
-get_content_length (const char *headers)
-{
-    const char *s;
-    int content_length = -1;
-
-    s = headers;
-    while (*s) {
-        const char *field = s;
-        const char *value = 0;
-
-        /* Find the end of the header field */
-        while (*s && !isspace(*s) && *s != ':')
-            s++;
-
-        /* Remember the header value, if any. */
-        if (*s == ':')
-            value = ++s;
-
-        /* Skip to the end of the header, including continuation lines. */
-        while (*s && !(*s == '\n' && (s[1] != ' ' && s[1] != '\t')))
-            s++;
-
-        /* Avoid stepping over end-of-string marker */
-        if (*s)
-            s++;
-
-        /* Process this header. */
-        if (value && value > field+2) {
-            char *ff = (char *) malloc (value-field);
-            char *ss = ff;
-            while (field < value-1)
-                *ss++ = tolower(*field++);
-            *ss++ = 0;
-
-            if (!strcmp (ff, "content-length")) {
-                const char *e;
-                while (*value && isspace (*value))
-                    value++;
-                for (e = value; *e && *e != '\r' && *e != '\n'; e++)
-                    ;
-                ss = (char *) malloc (e - value + 1);
-                strncpy (ss, value, e - value);
-                ss[e - value] = 0;
-                content_length = atoi(ss);
-                free (ss);
-            }
-            free (ff);
-        }
-    }
-    return (content_length);
+get_content_length (const struct http_headers *h)
+{
+    const struct http_field *f = http_header_find (h, "Content-Length");
+
+    if (f == NULL || f->value_len == 0 || !isdigit (h->base[f->value]))
+        return -1;
+    return atoi (h->base + f->value);
 }
 
 char *
@@ -1004,104 +1790,291 @@ prepend_slash (char *path)
     return newpath;
 }
 
-int
-check_http (void)
+/*
+ * The body of a single URL check is not collected in memory. It is
+ * decoded as it arrives and fed to the -s and -r matchers, which keep only
+ * what a match could still span: the last strlen(string) - 1 bytes, or the
+ * unfinished line (a -l regex sees the whole body). --max-body and
+ * --stop-on-match end the transfer early.
+ */
+
+enum {
+    HTTP_CHUNK_SIZE,
+    HTTP_CHUNK_DATA,
+    HTTP_CHUNK_DATA_END,
+    HTTP_CHUNK_TRAILER,
+    HTTP_CHUNK_DONE
+};
+
+struct http_window {
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+struct http_body {
+    int chunked;
+    int chunk_state;
+    unsigned long chunk_left;
+    char chunk_line[32];
+    size_t chunk_line_len;
+    struct http_decoder decoder;
+    size_t wire_length;         /* as sent, without the chunking */
+    size_t length;              /* decoded so far */
+    int full;                   /* --max-body reached */
+    struct http_window string;  /* -s window */
+    int string_found;
+    struct http_window regex;   /* -r window */
+    int regex_result;           /* np_regexec(), once decided */
+    int regex_done;
+    int keep_all;               /* regex over the whole body, or -v */
+};
+
+static void
+http_window_append (struct http_window *w, const char *data, size_t len)
 {
-    char *msg;
-    char *status_line;
-    char *status_code;
-    char *header;
-    char *page;
-    char *auth;
-    int http_status;
-    int header_end;
-    int content_length;
-    int content_start;
-    int seen_length;
-    int i = 0;
-    size_t pagesize = 0;
-    char *full_page;
-    char *full_page_new;
-    char *buf;
-    char *pos;
-    long microsec = 0L;
-    double elapsed_time = 0.0;
-    long microsec_connect = 0L;
-    double elapsed_time_connect = 0.0;
-    long microsec_ssl = 0L;
-    double elapsed_time_ssl = 0.0;
-    long microsec_firstbyte = 0L;
-    double elapsed_time_firstbyte = 0.0;
-    long microsec_headers = 0L;
-    double elapsed_time_headers = 0.0;
-    long microsec_transfer = 0L;
-    double elapsed_time_transfer = 0.0;
-    int page_len = 0;
-    int result = STATE_OK;
-    char *force_host_header = NULL;
-    int bad_response = FALSE;
-    char save_char;
+    if (w->len + len + 1 > w->size) {
+        w->size = max (w->size * 2, w->len + len + 1);
+        if ((w->data = realloc (w->data, w->size)) == NULL)
+            die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for full_page\n"));
+    }
+    memcpy (w->data + w->len, data, len);
+    w->len += len;
+    w->data[w->len] = '\0';
+}
 
-    /* try to connect to the host at the given port number */
-    gettimeofday (&tv_temp, NULL);
-    if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
-        die (STATE_CRITICAL, _("HTTP CRITICAL - Unable to open TCP socket\n"));
-    microsec_connect = deltime (tv_temp);
+/* keep only the last len bytes of the window */
+static void
+http_window_keep (struct http_window *w, size_t len)
+{
+    if (len >= w->len)
+        return;
+    memmove (w->data, w->data + w->len - len, len);
+    w->len = len;
+    w->data[len] = '\0';
+}
 
-    /* if we are called with the -I option, the -j method is CONNECT and */
-    /* we received -S for SSL, then we tunnel the request through a proxy*/
-    /* @20100414, public[at]frank4dd.com, http://www.frank4dd.com/howto  */
+static int
+http_contains (const char *data, size_t len, const char *needle, size_t needle_len)
+{
+    const char *p = data, *end = data + len;
+
+    if (needle_len == 0)
+        return TRUE;
+    while (end - p >= (long) needle_len && (p = memchr (p, needle[0], end - p - needle_len + 1)) != NULL) {
+        if (!memcmp (p, needle, needle_len))
+            return TRUE;
+        p++;
+    }
+    return FALSE;
+}
 
-    if ( server_address != NULL && strcmp(http_method, "CONNECT") == 0
-            && host_name != NULL && use_ssl == TRUE) {
+static void
+http_body_init (struct http_body *b, const struct http_headers *h)
+{
+    memset (b, 0, sizeof (*b));
+    b->chunked = chunked_transfer_encoding (h);
+    b->chunk_state = HTTP_CHUNK_SIZE;
+    b->keep_all = verbose || (strlen (regexp) && !(cflags & REG_NEWLINE));
+    http_decoder_init (&b->decoder, http_content_coding (h));
+}
 
-        if (verbose) printf ("Entering CONNECT tunnel mode with proxy %s:%d to dst %s:%d\n", server_address, server_port, host_name, HTTPS_PORT);
-        asprintf (&buf, "%s %s:%d HTTP/1.1\r\n%s\r\n", http_method, host_name, HTTPS_PORT, user_agent);
-        asprintf (&buf, "%sProxy-Connection: keep-alive\r\n", buf);
-        asprintf (&buf, "%sHost: %s\r\n", buf, host_name);
-        /* we finished our request, send empty line with CRLF */
-        asprintf (&buf, "%s%s", buf, CRLF);
-        if (verbose) printf ("%s\n", buf);
-        send(sd, buf, strlen (buf), 0);
-        buf[0]='\0';
-
-        if (verbose) printf ("Receive response from proxy\n");
-        read (sd, buffer, MAX_INPUT_BUFFER-1);
-        if (verbose) printf ("%s", buffer);
-        /* Here we should check if we got HTTP/1.1 200 Connection established */
+static void
+http_body_free (struct http_body *b)
+{
+    free (b->string.data);
+    free (b->regex.data);
+    http_decoder_free (&b->decoder);
+}
+
+/* TRUE once every matcher has an answer that more data will not change */
+static int
+http_body_matched (struct http_body *b)
+{
+    return (!strlen (string_expect) || b->string_found) &&
+        (!strlen (regexp) || b->regex_done);
+}
+
+/* decoded body data, for the matchers */
+static void
+http_body_plain (void *arg, const char *data, size_t len)
+{
+    struct http_body *b = arg;
+    size_t slen = strlen (string_expect);
+    char *nl, save;
+
+    if (b->full)
+        return;
+    if (max_body_len > 0 && b->length + len >= (size_t) max_body_len) {
+        len = max_body_len - b->length;
+        b->full = TRUE;
     }
-#ifdef HAVE_SSL
-    elapsed_time_connect = (double)microsec_connect / 1.0e6;
-    if (use_ssl == TRUE) {
-        gettimeofday (&tv_temp, NULL);
-        result = np_net_ssl_init_with_hostname_version_and_cert(sd, (use_sni ? host_name : NULL), ssl_version, client_cert, client_privkey);
-        if (verbose) printf ("SSL initialized\n");
-        if (result != STATE_OK)
-            die (STATE_CRITICAL, NULL);
-        microsec_ssl = deltime (tv_temp);
-        elapsed_time_ssl = (double)microsec_ssl / 1.0e6;
-        if (check_cert == TRUE) {
-            result = np_net_ssl_check_cert(days_till_exp_warn, days_till_exp_crit);
-            if (continue_after_check_cert == FALSE) {
+    b->length += len;
 
-                if (sd) {
-                    close(sd);
-                }
-                np_net_ssl_cleanup();
-                return result;
+    if (slen && !b->string_found) {
+        http_window_append (&b->string, data, len);
+        b->string_found = http_contains (b->string.data, b->string.len, string_expect, slen);
+        http_window_keep (&b->string, slen - 1);
+    }
+
+    if (strlen (regexp) && (!b->regex_done || b->keep_all)) {
+        http_window_append (&b->regex, data, len);
+        /* without -l no match spans a newline, so complete lines are done */
+        for (nl = b->regex.data + b->regex.len; nl > b->regex.data && nl[-1] != '\n'; nl--);
+        if (!b->keep_all && nl-- > b->regex.data) {
+            save = nl[1];
+            nl[1] = '\0';
+            b->regex_result = np_regexec (&preg, b->regex.data, REGS, pmatch, 0);
+            nl[1] = save;
+            if (b->regex_result != REG_NOMATCH)
+                b->regex_done = TRUE;
+            http_window_keep (&b->regex, b->regex.data + b->regex.len - nl - 1);
+        }
+    }
+
+    if (verbose && !strlen (regexp))
+        http_window_append (&b->regex, data, len);
+}
+
+/* the body without its chunking, still encoded */
+static void
+http_body_data (struct http_body *b, const char *data, size_t len)
+{
+    b->wire_length += len;
+    if (!http_decoder_feed (&b->decoder, data, len, http_body_plain, b))
+        die (STATE_CRITICAL, _("HTTP CRITICAL - Invalid Content-Encoding of the body\n"));
+}
+
+/* the body as it came off the wire */
+static void
+http_body_feed (struct http_body *b, const char *data, size_t len)
+{
+    const char *end = data + len;
+    char *hex_end;
+    size_t n;
+
+    if (!b->chunked) {
+        if (!b->full)
+            http_body_data (b, data, len);
+        return;
+    }
+
+    while (data < end && b->chunk_state != HTTP_CHUNK_DONE) {
+        switch (b->chunk_state) {
+        case HTTP_CHUNK_SIZE:
+        case HTTP_CHUNK_TRAILER:
+            if (*data != '\n') {
+                if (b->chunk_line_len < sizeof (b->chunk_line) - 1)
+                    b->chunk_line[b->chunk_line_len++] = *data;
+                data++;
+                break;
             }
+            data++;
+            b->chunk_line[b->chunk_line_len] = '\0';
+            if (b->chunk_state == HTTP_CHUNK_TRAILER) {
+                /* trailers end with an empty line */
+                if (b->chunk_line_len == 0 || !strcmp (b->chunk_line, "\r"))
+                    b->chunk_state = HTTP_CHUNK_DONE;
+            } else {
+                b->chunk_left = strtoul (b->chunk_line, &hex_end, 16);
+                if (hex_end == b->chunk_line)
+                    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Failed to parse chunked body, invalid chunk size\n"));
+                b->chunk_state = b->chunk_left ? HTTP_CHUNK_DATA : HTTP_CHUNK_TRAILER;
+            }
+            b->chunk_line_len = 0;
+            break;
+        case HTTP_CHUNK_DATA:
+            n = min ((size_t) (end - data), b->chunk_left);
+            if (!b->full)
+                http_body_data (b, data, n);
+            data += n;
+            if ((b->chunk_left -= n) == 0)
+                b->chunk_state = HTTP_CHUNK_DATA_END;
+            break;
+        case HTTP_CHUNK_DATA_END:
+            if (*data == '\n')
+                b->chunk_state = HTTP_CHUNK_SIZE;
+            else if (*data != '\r')
+                die (STATE_UNKNOWN, _("HTTP UNKNOWN - Failed to parse chunked body, invalid format\n"));
+            data++;
+            break;
         }
     }
-#endif /* HAVE_SSL */
+}
 
-    if ( server_address != NULL && strcmp(http_method, "CONNECT") == 0
-            && host_name != NULL && use_ssl == TRUE)
-        asprintf (&buf, "%s %s %s\r\n%s\r\n", "GET", server_url, host_name ? "HTTP/1.1" : "HTTP/1.0", user_agent);
-    else
-        asprintf (&buf, "%s %s %s\r\n%s\r\n", http_method, server_url, host_name ? "HTTP/1.1" : "HTTP/1.0", user_agent);
+/* no more body will come; settle the regex */
+static void
+http_body_end (struct http_body *b)
+{
+    if (strlen (regexp) && !b->regex_done) {
+        b->regex_result = np_regexec (&preg, b->regex.data ? b->regex.data : "", REGS, pmatch, 0);
+        b->regex_done = TRUE;
+    }
+}
+
+/* TRUE when reading can stop before the server is done sending */
+static int
+http_body_complete (struct http_body *b)
+{
+    if (b->chunked && b->chunk_state == HTTP_CHUNK_DONE)
+        return TRUE;
+    if (b->full)
+        return TRUE;
+    return stop_on_match && (strlen (string_expect) || strlen (regexp)) && http_body_matched (b);
+}
+
+/* append len bytes to b, keeping it NUL terminated */
+static void
+http_buf_append (struct http_buf *b, const char *data, size_t len)
+{
+    if (b->len + len + 1 > b->size) {
+        b->size = b->len + len + 1 > 2 * b->size ? b->len + len + 1 : 2 * b->size;
+        if ((b->data = realloc (b->data, b->size)) == NULL)
+            die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+    }
+    memcpy (b->data + b->len, data, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+}
+
+static void
+http_buf_puts (struct http_buf *b, const char *str)
+{
+    http_buf_append (b, str, strlen (str));
+}
 
-    /* tell HTTP/1.1 servers not to keep the connection alive */
-    xasprintf (&buf, "%sConnection: close\r\n", buf);
+/* Build the request for url. Unless keep_alive is set, HTTP/1.1 servers
+ * are told to close the connection after their reply. The request is
+ * written into one buffer, sized up front, so that it goes out in a
+ * single write and a -P body is copied only once; a --post-file body is
+ * left out, for http_send_request() to send from its mapping. */
+static char *
+http_build_request (const char *method, const char *url, int keep_alive)
+{
+    struct http_buf req = { NULL, 0, 0 };
+    char *auth;
+    char number[32];
+    char *force_host_header = NULL;
+    size_t post_len = http_post_mapped ? 0 : http_post_len;
+    int i;
+
+    req.size = strlen (method) + strlen (url) + strlen (user_agent) + post_len + 256 +
+               2 * (strlen (user_auth) + strlen (proxy_auth)) +
+               (http_content_type ? strlen (http_content_type) : 0) +
+               (host_name ? strlen (host_name) : 0);
+    for (i = 0; i < http_opt_headers_count; i++)
+        req.size += strlen (http_opt_headers[i]) + 2;
+    if ((req.data = malloc (req.size)) == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+
+    http_buf_puts (&req, method);
+    http_buf_puts (&req, " ");
+    http_buf_puts (&req, url);
+    http_buf_puts (&req, host_name ? " HTTP/1.1\r\n" : " HTTP/1.0\r\n");
+    http_buf_puts (&req, user_agent);
+    http_buf_puts (&req, CRLF);
+
+    http_buf_puts (&req, keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
 
     /* check if Host header is explicitly set in options */
     if (http_opt_headers_count) {
@@ -1115,18 +2088,25 @@ check_http (void)
     /* optionally send the host header info */
     if (host_name) {
         if (force_host_header) {
-            xasprintf (&buf, "%s%s\r\n", buf, force_host_header);
+            http_buf_puts (&req, force_host_header);
+            http_buf_puts (&req, CRLF);
         } else {
             /*
              * Specify the port only if we're using a non-default port (see RFC 2616,
              * 14.23).  Some server applications/configurations cause trouble if the
              * (default) port is explicitly specified in the "Host:" header line.
+             * Through a tunnel the port is that of the proxy, and the server
+             * is on the default one.
              */
+            http_buf_puts (&req, "Host: ");
+            http_buf_puts (&req, host_name);
             if ((use_ssl == FALSE && server_port == HTTP_PORT) ||
-                    (use_ssl == TRUE && server_port == HTTPS_PORT))
-                xasprintf (&buf, "%sHost: %s\r\n", buf, host_name);
-            else
-                xasprintf (&buf, "%sHost: %s:%d\r\n", buf, host_name, server_port);
+                    (use_ssl == TRUE && (server_port == HTTPS_PORT || http_tunnel ())))
+                http_buf_puts (&req, CRLF);
+            else {
+                snprintf (number, sizeof (number), ":%d\r\n", server_port);
+                http_buf_puts (&req, number);
+            }
         }
     }
 
@@ -1135,13 +2115,21 @@ check_http (void)
      * so that we can alert if a response is of an invalid type.
     */
     if (!have_accept)
-        xasprintf(&buf, "%sAccept: */*\r\n", buf);
+        http_buf_puts (&req, "Accept: */*\r\n");
+    if (compressed && !have_accept_encoding && http_accept_encoding ()) {
+        http_buf_puts (&req, "Accept-Encoding: ");
+        http_buf_puts (&req, http_accept_encoding ());
+        http_buf_puts (&req, CRLF);
+    }
+    if (conditional_headers)
+        http_buf_puts (&req, conditional_headers);
 
     /* optionally send any other header tag */
     if (http_opt_headers_count) {
         for (i = 0; i < http_opt_headers_count ; i++) {
             if (force_host_header != http_opt_headers[i]) {
-                xasprintf (&buf, "%s%s\r\n", buf, http_opt_headers[i]);
+                http_buf_puts (&req, http_opt_headers[i]);
+                http_buf_puts (&req, CRLF);
             }
         }
         /* This cannot be free'd here because a redirection will then try to access this and segfault */
@@ -1152,37 +2140,275 @@ check_http (void)
     /* optionally send the authentication info */
     if (strlen(user_auth)) {
         base64_encode_alloc (user_auth, strlen (user_auth), &auth);
-        xasprintf (&buf, "%sAuthorization: Basic %s\r\n", buf, auth);
+        http_buf_puts (&req, "Authorization: Basic ");
+        http_buf_puts (&req, auth);
+        http_buf_puts (&req, CRLF);
+        free (auth);
     }
 
-    /* optionally send the proxy authentication info */
-    if (strlen(proxy_auth)) {
+    /* optionally send the proxy authentication info; through a tunnel it
+     * goes with the CONNECT instead */
+    if (strlen(proxy_auth) && !http_tunnel ()) {
         base64_encode_alloc (proxy_auth, strlen (proxy_auth), &auth);
-        xasprintf (&buf, "%sProxy-Authorization: Basic %s\r\n", buf, auth);
+        http_buf_puts (&req, "Proxy-Authorization: Basic ");
+        http_buf_puts (&req, auth);
+        http_buf_puts (&req, CRLF);
+        free (auth);
     }
 
     /* either send http POST data (any data, not only POST)*/
     if (http_post_data) {
-        if (http_content_type) {
-            xasprintf (&buf, "%sContent-Type: %s\r\n", buf, http_content_type);
-        } else {
-            xasprintf (&buf, "%sContent-Type: application/x-www-form-urlencoded\r\n", buf);
-        }
+        http_buf_puts (&req, "Content-Type: ");
+        http_buf_puts (&req, http_content_type ? http_content_type : "application/x-www-form-urlencoded");
+        snprintf (number, sizeof (number), "\r\nContent-Length: %lu\r\n\r\n", (unsigned long) http_post_len);
+        http_buf_puts (&req, number);
+        if (http_post_mapped)
+            return req.data;
+        http_buf_append (&req, http_post_data, post_len);
+    }
+    /* and a newline so the server knows we're done with the request */
+    http_buf_puts (&req, CRLF);
 
-        xasprintf (&buf, "%sContent-Length: %i\r\n\r\n", buf, (int)strlen (http_post_data));
-        xasprintf (&buf, "%s%s%s", buf, http_post_data, CRLF);
-    } else {
-        /* or just a newline so the server knows we're done with the request */
-        xasprintf (&buf, "%s%s", buf, CRLF);
+    return req.data;
+}
+
+/* What --conditional keeps of the last reply to a GET: its validators,
+ * and the verdicts on its body that a 304 Not Modified stands for. One
+ * record per command line, for the URL that the check ended on, in the
+ * state file line (tab-separated, the URL last). */
+struct http_validators {
+    char *etag;
+    char *last_modified;
+    int string_found;
+    int regex_result;
+    int page_len;
+    int decoded_len;
+};
+
+static char *
+http_state_url (void)
+{
+    char *url;
+
+    xasprintf (&url, "%s://%s:%d%s", use_ssl ? "https" : "http",
+               host_name ? host_name : server_address, server_port, server_url);
+    return url;
+}
+
+/* the validators kept for this URL; FALSE if there are none */
+static int
+http_state_get (struct http_validators *v)
+{
+    state_data *data = np_state_read ();
+    char *field[7], *p, *url;
+    int n, found;
+
+    if (data == NULL || data->data == NULL || (p = strdup (data->data)) == NULL)
+        return FALSE;
+    for (n = 0; n < 7 && p; n++) {
+        field[n] = p;
+        if ((p = strchr (p, '\t')) != NULL)
+            *p++ = '\0';
+    }
+    url = http_state_url ();
+    found = n == 7 && !strcmp (field[6], url) && (*field[0] || *field[1]);
+    free (url);
+    if (!found) {
+        free (field[0]);
+        return FALSE;
+    }
+    v->etag = field[0];
+    v->last_modified = field[1];
+    v->string_found = atoi (field[2]);
+    v->regex_result = atoi (field[3]);
+    v->page_len = atoi (field[4]);
+    v->decoded_len = atoi (field[5]);
+    return TRUE;
+}
+
+/* keep the validators of a reply with the verdicts on its body */
+static void
+http_state_put (const struct http_headers *h, const struct http_body *b,
+                int page_len, int decoded_len)
+{
+    char *etag = header_value (h, "ETag");
+    char *modified = header_value (h, "Last-Modified");
+    char *url = http_state_url ();
+    char *line = NULL;
+
+    /* state lines are read back up to 1024 bytes, tabs separate fields */
+    if ((etag || modified)
+            && !strchr (etag ? etag : "", '\t') && !strchr (modified ? modified : "", '\t')) {
+        xasprintf (&line, "%s\t%s\t%d\t%d\t%d\t%d\t%s", etag ? etag : "",
+                   modified ? modified : "", b->string_found, b->regex_result,
+                   page_len, decoded_len, url);
+        if (strlen (line) < 1000 && !strchr (line, '\n'))
+            np_state_write_string (0, line);
+        else if (verbose)
+            printf (_("Validators too long to keep\n"));
+    }
+    free (line);
+    free (url);
+    free (etag);
+    free (modified);
+}
+
+int
+check_http (void)
+{
+    char *msg;
+    char *status_line;
+    char *status_code;
+    char *header;
+    char *page;
+    int http_status;
+    int header_end = 0;
+    int content_length;
+    int content_start;
+    int seen_length = 0;
+    int reply_status;
+    int keep_alive;
+    int empty_body;
+    int have_validators = FALSE;
+    int unchanged;
+    struct http_validators validators;
+    int i = 0;
+    size_t pagesize = 0;
+    char *full_page;
+    char *full_page_new;
+    char *buf;
+    char *pos;
+    long microsec = 0L;
+    double elapsed_time = 0.0;
+    long microsec_connect = 0L;
+    double elapsed_time_connect = 0.0;
+    long microsec_ssl = 0L;
+    double elapsed_time_ssl = 0.0;
+    long microsec_proxy = 0L;
+    long microsec_firstbyte = 0L;
+    double elapsed_time_firstbyte = 0.0;
+    long microsec_headers = 0L;
+    double elapsed_time_headers = 0.0;
+    long microsec_transfer = 0L;
+    double elapsed_time_transfer = 0.0;
+    int page_len = 0;
+    int decoded_len, checked_len;
+    int result = STATE_OK;
+    int bad_response = FALSE;
+    char save_char;
+#ifdef HAVE_SSL
+    int early_data = NP_SSL_EARLY_DATA_NONE;
+#endif
+    struct http_headers headers = { NULL, NULL, 0, 0 };
+    struct http_body body;
+    struct timeval tv_hop;
+
+    gettimeofday (&tv_hop, NULL);
+    if (reuse_connection && !http_same_origin ()) {
+        close (sd);
+#ifdef HAVE_SSL
+        np_net_ssl_cleanup ();
+#endif
+        reuse_connection = FALSE;
+    }
+
+    if (reuse_connection) {
+        if (verbose)
+            printf (_("Reusing connection to %s:%d\n"), server_address, server_port);
     }
+    /* try to connect to the host at the given port number */
+    else {
+        np_profile_phase ("connect");
+        gettimeofday (&tv_temp, NULL);
+        if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
+            die (STATE_CRITICAL, _("HTTP CRITICAL - Unable to open TCP socket\n"));
+        microsec_connect = deltime (tv_temp);
+    }
+
+    /* if we are called with the -I option, the -j method is CONNECT and */
+    /* we received -S for SSL, then we tunnel the request through a proxy*/
+    /* @20100414, public[at]frank4dd.com, http://www.frank4dd.com/howto  */
+
+    if (http_tunnel ()) {
+        if (verbose) printf ("Entering CONNECT tunnel mode with proxy %s:%d to dst %s:%d\n", server_address, server_port, host_name, HTTPS_PORT);
+        np_profile_phase ("proxy");
+        gettimeofday (&tv_temp, NULL);
+        if (http_proxy_connect (&msg) != STATE_OK)
+            die (STATE_CRITICAL, "HTTP CRITICAL - %s\n", msg);
+        microsec_proxy = deltime (tv_temp);
+    }
+
+    /* the request is ready before the handshake, which may carry it as
+     * early data; a redirect to the same origin goes over the same
+     * connection */
+    keep_alive = onredirect == STATE_DEPENDENT && strcmp (http_method, "CONNECT") != 0;
+
+    /* revalidate what the last run got from this URL */
+    free (conditional_headers);
+    conditional_headers = NULL;
+    memset (&validators, 0, sizeof (validators));
+    if (conditional && !strcmp (http_method, "GET") && (have_validators = http_state_get (&validators))) {
+        xasprintf (&conditional_headers, "%s%s%s%s%s%s",
+                   *validators.etag ? "If-None-Match: " : "", validators.etag, *validators.etag ? CRLF : "",
+                   *validators.last_modified ? "If-Modified-Since: " : "", validators.last_modified,
+                   *validators.last_modified ? CRLF : "");
+    }
+
+    if (http_tunnel ())
+        buf = http_build_request ("GET", server_url, FALSE);
+    else
+        buf = http_build_request (http_method, server_url, keep_alive);
+
+#ifdef HAVE_SSL
+    elapsed_time_connect = (double)microsec_connect / 1.0e6;
+    if (use_ssl == TRUE && !reuse_connection) {
+        np_profile_phase ("tls");
+        gettimeofday (&tv_temp, NULL);
+        np_net_ssl_session_cache (tls_session_cache ? server_address : NULL, server_port, tls_full_handshake);
+        /* a replay of these changes nothing */
+        if (tls_early_data && !http_post_mapped && (!strcmp (http_method, "GET") || !strcmp (http_method, "HEAD")
+                || !strcmp (http_method, "CONNECT")))
+            np_net_ssl_early_data (buf, strlen (buf));
+        result = np_net_ssl_init_with_hostname_version_and_cert(sd, (use_sni ? host_name : NULL), ssl_version, client_cert, client_privkey);
+        early_data = np_net_ssl_early_data_status ();
+        if (verbose) printf ("SSL initialized%s%s\n", np_net_ssl_session_reused () ? _(", session resumed") : "",
+                             early_data == NP_SSL_EARLY_DATA_ACCEPTED ? _(", early data accepted")
+                             : early_data == NP_SSL_EARLY_DATA_REJECTED ? _(", early data rejected") : "");
+        if (result != STATE_OK)
+            die (STATE_CRITICAL, NULL);
+        microsec_ssl = deltime (tv_temp);
+        elapsed_time_ssl = (double)microsec_ssl / 1.0e6;
+        if (check_cert == TRUE || check_ocsp == TRUE) {
+            result = http_check_certificate ();
+            if (continue_after_check_cert == FALSE) {
+
+                if (sd) {
+                    close(sd);
+                }
+                np_net_ssl_cleanup();
+                free (buf);
+                return result;
+            }
+        }
+    }
+#endif /* HAVE_SSL */
+
+    reuse_connection = FALSE;
 
     if (verbose) printf ("%s\n", buf);
+    np_profile_phase ("request");
     gettimeofday (&tv_temp, NULL);
-    my_send (buf, strlen (buf));
+    /* taken as early data, it is not to be sent again */
+#ifdef HAVE_SSL
+    if (early_data != NP_SSL_EARLY_DATA_ACCEPTED)
+#endif
+        http_send_request (buf, strlen (buf));
+    free (buf);
     microsec_headers = deltime (tv_temp);
     elapsed_time_headers = (double)microsec_headers / 1.0e6;
 
     /* fetch the page */
+    np_profile_phase ("reply");
     full_page = strdup("");
     gettimeofday (&tv_temp, NULL);
     while ((i = my_recv (buffer, MAX_INPUT_BUFFER-1)) > 0) {
@@ -1198,41 +2424,49 @@ check_http (void)
         memmove(&full_page_new[pagesize], buffer, i + 1);
         /*free (full_page);*/
         full_page = full_page_new;
+        /* the end of the headers may straddle two reads */
+        header_end = document_headers_done(full_page, pagesize > 2 ? pagesize - 2 : 0);
         pagesize += i;
-
-        header_end = document_headers_done(full_page);
         if (header_end) {
             i = 0;
             break;
         }
     }
 
-    if (no_body) {
-        full_page[header_end] = '\0';
-    }
-    else {
-        content_length = get_content_length(full_page);
-
-        content_start = header_end + 1;
-        while (full_page[content_start] == '\n' || full_page[content_start] == '\r') {
-            content_start += 1;
-        }
+    /* only the headers stay in full_page, the body is streamed */
+    content_start = header_end + (full_page[header_end] && full_page[header_end + 1] == '\r' ? 3 : 2);
+    if (header_end == 0 || (size_t) content_start > pagesize)
+        content_start = pagesize;
+    http_headers_parse (&headers, full_page, content_start);
+    http_body_init (&body, &headers);
+    content_length = get_content_length (&headers);
+    reply_status = http_status_code (full_page);
+    /* these never have a body, which matters once the server keeps the
+     * connection open instead of closing it after the headers */
+    empty_body = !strcmp (http_method, "HEAD") || reply_status == 204 || reply_status == 304;
+
+    if (!no_body && !(keep_alive && empty_body)) {
         seen_length = pagesize - content_start;
+        http_body_feed (&body, full_page + content_start, seen_length);
         /* Continue receiving the body until content-length is met */
-        while ((content_length < 0 || seen_length < content_length)
+        while (!http_body_complete (&body)
+            && (content_length < 0 || seen_length < content_length)
             && ((i = my_recv(buffer, MAX_INPUT_BUFFER-1)) > 0)) {
 
-            buffer[i] = '\0';
-
-            if ((full_page_new = realloc(full_page, pagesize + i + 1)) == NULL)
-                die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for full_page\n"));
-            memmove(&full_page_new[pagesize], buffer, i + 1);
-            full_page = full_page_new;
-
             pagesize += i;
-            seen_length = pagesize - content_start;
+            seen_length += i;
+            http_body_feed (&body, buffer, i);
         }
     }
+    full_page[content_start] = '\0';
+    http_body_end (&body);
+
+    /* a body not sent again is the one the kept verdicts are on */
+    unchanged = have_validators && reply_status == 304;
+    if (unchanged) {
+        body.string_found = validators.string_found;
+        body.regex_result = validators.regex_result;
+    }
 
     microsec_transfer = deltime (tv_temp);
     elapsed_time_transfer = (double)microsec_transfer / 1.0e6;
@@ -1263,11 +2497,32 @@ check_http (void)
     if (pagesize == (size_t) 0)
         die (STATE_CRITICAL, _("HTTP CRITICAL - No data received from host\n"));
 
+    np_profile_phase ("checks");
+
+    /* keep the connection for the next hop if this reply ended exactly
+     * where the bytes read so far do */
+    if (keep_alive && !no_body && !server_expect_yn && reply_status >= 300 && reply_status < 400
+            && http_keep_alive (&headers, full_page)
+            && (empty_body ? seen_length == 0
+                : body.chunked ? body.chunk_state == HTTP_CHUNK_DONE
+                : content_length >= 0 && seen_length == content_length)) {
+        reuse_connection = TRUE;
+        conn_ssl = use_ssl;
+        conn_port = server_port;
+        free (conn_address);
+        free (conn_host);
+        conn_address = strdup (server_address);
+        conn_host = host_name ? strdup (host_name) : NULL;
+        if (conn_address == NULL || (host_name && conn_host == NULL))
+            die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+    }
     /* close the connection */
-    if (sd) close(sd);
+    else {
+        if (sd) close(sd);
 #ifdef HAVE_SSL
-    np_net_ssl_cleanup();
+        np_net_ssl_cleanup();
 #endif
+    }
 
     /* Save check time */
     microsec = deltime (tv);
@@ -1319,17 +2574,14 @@ check_http (void)
         ++header;
     }
 
-    if (chunked_transfer_encoding(header) && *page)
-        page = decode_chunked_page(page, page);
-
     if (verbose)
         printf ("**** HEADER ****\n%s\n**** CONTENT ****\n%s\n", header,
-                (no_body ? "  [[ skipped ]]" : page));
+                (no_body ? "  [[ skipped ]]" : body.regex.data ? body.regex.data : ""));
 
     xasprintf(&msg, "");
 
     /* make sure the status line matches the response we are looking for */
-    if (!expected_statuscode (status_line, server_expect)) {
+    if (!unchanged && !expected_statuscode (status_line, server_expect)) {
 
         if (server_port == HTTP_PORT)
             xasprintf (&msg,
@@ -1394,11 +2646,20 @@ check_http (void)
                 result = max_state_alt(STATE_WARNING, result);
         }
 
+        /* the page is as the last run found it */
+        else if (unchanged) {
+            xasprintf (&msg, _("%s%s, unchanged - "), msg, status_line);
+        }
+
         /* check redirected page if specified */
         else if (http_status >= 300) {
 
-            if (onredirect == STATE_DEPENDENT)
-                redir (header, status_line);
+            if (onredirect == STATE_DEPENDENT) {
+                if ((redirect_time = realloc (redirect_time, (redirect_count + 1) * sizeof (double))) == NULL)
+                    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+                redirect_time[redirect_count++] = (double)deltime (tv_hop) / 1.0e6;
+                redir (&headers, status_line);
+            }
             else
                 result = max_state_alt(onredirect, result);
             xasprintf (&msg, _("%s%s - "), msg, status_line);
@@ -1422,7 +2683,7 @@ check_http (void)
     alarm (0);
 
     if (maximum_age >= 0) {
-        result = max_state_alt(check_document_dates(header, &msg), result);
+        result = max_state_alt(check_document_dates(&headers, &msg), result);
     }
 
 
@@ -1439,7 +2700,7 @@ check_http (void)
     }
 
     if (strlen (string_expect)) {
-        if (!strstr (page, string_expect)) {
+        if (!body.string_found) {
             strncpy(&output_string_search[0],string_expect,sizeof(output_string_search));
             if(output_string_search[sizeof(output_string_search)-1]!='\0') {
                 bcopy("...",&output_string_search[sizeof(output_string_search)-4],4);
@@ -1450,7 +2711,7 @@ check_http (void)
     }
 
     if (strlen (regexp)) {
-        errcode = regexec (&preg, page, REGS, pmatch, 0);
+        errcode = body.regex_result;
         if ((errcode == 0 && invert_regex == 0) || (errcode == REG_NOMATCH && invert_regex == 1)) {
             /* OK - No-op to avoid changing the logic around it */
             result = max_state_alt(STATE_OK, result);
@@ -1462,7 +2723,7 @@ check_http (void)
             result = STATE_CRITICAL;
         } else {
             /* FIXME: Shouldn't that be UNKNOWN? */
-            regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
+            np_regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
             xasprintf (&msg, _("%sExecute Error: %s, "), msg, errbuf);
             result = STATE_CRITICAL;
         }
@@ -1478,11 +2739,18 @@ check_http (void)
      * it == get_content_length(header) ??
      */
     page_len = pagesize;
-    if ((max_page_len > 0) && (page_len > max_page_len)) {
-        xasprintf (&msg, _("%spage size %d too large, "), msg, page_len);
+    /* the headers and the body as it decodes, for --decoded-size */
+    decoded_len = content_start + body.length;
+    checked_len = decoded_size ? decoded_len : page_len;
+    if (unchanged)
+        checked_len = decoded_size ? validators.decoded_len : validators.page_len;
+    else if (conditional && reply_status >= 200 && reply_status < 300 && !strcmp (http_method, "GET"))
+        http_state_put (&headers, &body, page_len, decoded_len);
+    if ((max_page_len > 0) && (checked_len > max_page_len)) {
+        xasprintf (&msg, _("%spage size %d too large, "), msg, checked_len);
         result = max_state_alt(STATE_WARNING, result);
-    } else if ((min_page_len > 0) && (page_len < min_page_len)) {
-        xasprintf (&msg, _("%spage size %d too small, "), msg, page_len);
+    } else if ((min_page_len > 0) && (checked_len < min_page_len)) {
+        xasprintf (&msg, _("%spage size %d too small, "), msg, checked_len);
         result = max_state_alt(STATE_WARNING, result);
     }
 
@@ -1522,8 +2790,32 @@ check_http (void)
                    perfd_time (elapsed_time),
                    perfd_size (page_len));
     }
+    if (show_extended_perfdata && http_tunnel ())
+        xasprintf (&msg, "%s %s", msg, fperfdata ("time_proxy", (double) microsec_proxy / 1.0e6, "s",
+                                                  FALSE, 0, FALSE, 0, FALSE, 0, FALSE, 0));
+    if (compressed || decoded_size)
+        xasprintf (&msg, "%s %s", msg, perfdata ("size_decoded", decoded_len, "B",
+                                                 decoded_size && min_page_len > 0, min_page_len,
+                                                 FALSE, 0, TRUE, 0, FALSE, 0));
+#ifdef HAVE_SSL
+    if (use_ssl == TRUE && tls_session_cache)
+        xasprintf (&msg, "%s %s", msg, perfdata ("tls_resumed", np_net_ssl_session_reused (), "",
+                                                 FALSE, 0, FALSE, 0, TRUE, 0, TRUE, 1));
+    if (use_ssl == TRUE && tls_early_data)
+        xasprintf (&msg, "%s %s", msg, perfdata ("tls_early_data", early_data == NP_SSL_EARLY_DATA_ACCEPTED, "",
+                                                 FALSE, 0, FALSE, 0, TRUE, 0, TRUE, 1));
+#endif
+    for (i = 0; i < redirect_count; i++) {
+        char name[32];
+
+        snprintf (name, sizeof (name), "redirect%d_time", i + 1);
+        xasprintf (&msg, "%s %s", msg, fperfdata (name, redirect_time[i], "s",
+                                                  FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+    }
 
     result = max_state_alt(get_status(elapsed_time, thlds), result);
+    http_body_free (&body);
+    http_headers_free (&headers);
 
     die (result, "HTTP %s: %s\n", state_text(result), msg);
 
@@ -1533,11 +2825,1636 @@ check_http (void)
 
 
 
-/* per RFC 2396 */
-#define URI_HTTP "%5[HTPShtps]"
-#define URI_HOST "%255[-.abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789]"
-#define URI_PORT "%6d" /* MAX_PORT's width is 5 chars, 6 to detect overflow */
-#define URI_PATH "%[-_.!~*'();/?:@&=+$,%#abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789]"
+/*
+ * --multi-url: the URLs are requested one after the other over a single
+ * keep-alive connection (all at once with --pipeline), instead of one
+ * connection, and one plugin run, per URL. Replies are framed by their
+ * Content-Length or chunked encoding so that bytes already read for the
+ * next reply stay in the connection buffer. If the server closes the
+ * connection anyway, the check reconnects and resends what is missing.
+ */
+
+/* bytes read from the connection but not yet consumed */
+struct http_conn_buf {
+    char *data;
+    size_t len;
+    size_t size;
+    size_t scanned;             /* searched for the end of the headers */
+    size_t header_len;          /* of the reply at the front, once known */
+    struct http_headers headers;
+};
+
+struct http_reply {
+    char *status_line;
+    char *header;
+    struct http_headers headers;
+    char *body;
+    size_t body_len;    /* without the chunking */
+    size_t size;        /* on the wire, headers included */
+    int keep_alive;
+};
+
+enum {
+    HTTP_READ_OK,
+    HTTP_READ_MORE,
+    HTTP_READ_CLOSED,   /* closed before the reply started */
+    HTTP_READ_ERROR
+};
+
+/* the tunnels opened through the proxy, which are reused like any other
+ * connection, and the time they took */
+static int multi_tunnels;
+static double multi_time_proxy;
+
+static int
+http_multi_connect (char **msg)
+{
+    struct timeval tv;
+
+    *msg = _("Unable to open TCP socket");
+    if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK) {
+        sd = 0;
+        return STATE_CRITICAL;
+    }
+    if (http_tunnel ()) {
+        gettimeofday (&tv, NULL);
+        if (http_proxy_connect (msg) != STATE_OK) {
+            close (sd);
+            sd = 0;
+            return STATE_CRITICAL;
+        }
+        multi_time_proxy += (double) deltime (tv) / 1.0e6;
+        multi_tunnels++;
+    }
+#ifdef HAVE_SSL
+    if (use_ssl == TRUE) {
+        np_net_ssl_session_cache (tls_session_cache ? server_address : NULL, server_port, tls_full_handshake);
+        if (np_net_ssl_init_with_hostname_version_and_cert(sd, (use_sni ? host_name : NULL), ssl_version, client_cert, client_privkey) != STATE_OK) {
+            close (sd);
+            sd = 0;
+            *msg = _("Unable to open TCP socket");
+            return STATE_CRITICAL;
+        }
+        if (verbose && np_net_ssl_session_reused ())
+            printf ("%s\n", _("TLS session resumed"));
+    }
+#endif
+    return STATE_OK;
+}
+
+static void
+http_multi_disconnect (struct http_conn_buf *cb)
+{
+#ifdef HAVE_SSL
+    if (use_ssl == TRUE)
+        np_net_ssl_cleanup();
+#endif
+    if (sd) close(sd);
+    sd = 0;
+    cb->len = 0;
+    cb->header_len = cb->scanned = 0;
+    http_headers_free (&cb->headers);
+}
+
+#ifdef HAVE_SSL
+/* -C and --ocsp on the handshake just done, each with a line of its own */
+static int
+http_check_certificate (void)
+{
+    int result = STATE_OK;
+
+    if (check_cert == TRUE)
+        result = np_net_ssl_check_cert (days_till_exp_warn, days_till_exp_crit);
+    if (check_ocsp == TRUE)
+        result = max_state_alt (result, np_net_ssl_check_ocsp (ocsp_warn_hours, ocsp_crit_hours));
+    return result;
+}
+#endif
+
+static int
+http_send_all (const char *buf, size_t len)
+{
+    int n;
+
+    while (len > 0) {
+        if ((n = my_send (buf, len > INT_MAX ? INT_MAX : len)) <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* What of a request is left from sent on, a piece at a time: the request
+ * from http_build_request(), then a --post-file body and its CRLF */
+static size_t
+http_request_piece (const char *request, size_t request_len, size_t sent, const char **piece)
+{
+    if (sent < request_len) {
+        *piece = request + sent;
+        return request_len - sent;
+    }
+    sent -= request_len;
+    if (!http_post_mapped)
+        return 0;
+    if (sent < http_post_len) {
+        *piece = http_post_data + sent;
+        return http_post_len - sent;
+    }
+    sent -= http_post_len;
+    *piece = CRLF + sent;
+    return sent < 2 ? 2 - sent : 0;
+}
+
+/* The request and a --post-file body: in one writev() from the mapping in
+ * the clear, SSL_write()s of the mapping itself with TLS */
+static int
+http_send_request (const char *request, size_t len)
+{
+    struct iovec iov[3];
+    size_t sent = 0, total = len, at, left, i;
+    const char *piece;
+    ssize_t n;
+
+    if (!http_post_mapped)
+        return http_send_all (request, len);
+#ifdef HAVE_SSL
+    if (use_ssl) {
+        while ((left = http_request_piece (request, len, sent, &piece)) > 0) {
+            if (http_send_all (piece, left) < 0)
+                return -1;
+            sent += left;
+        }
+        return 0;
+    }
+#endif
+    total += http_post_len + 2;
+    while (sent < total) {
+        at = sent;
+        for (i = 0; i < 3 && (left = http_request_piece (request, len, at, &piece)) > 0; i++) {
+            iov[i].iov_base = (char *) piece;
+            iov[i].iov_len = left;
+            at += left;
+        }
+        if ((n = writev (sd, iov, i)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        sent += n;
+    }
+    return 0;
+}
+
+/* make room for another read of up to MAX_INPUT_BUFFER bytes */
+static void
+http_conn_reserve (struct http_conn_buf *cb)
+{
+    if (cb->size - cb->len <= MAX_INPUT_BUFFER) {
+        cb->size = cb->size ? cb->size * 2 : 4 * MAX_INPUT_BUFFER;
+        if ((cb->data = realloc (cb->data, cb->size)) == NULL)
+            die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for full_page\n"));
+    }
+}
+
+/* read more of the connection into cb; returns what my_recv() did */
+static int
+http_conn_fill (struct http_conn_buf *cb)
+{
+    int n;
+
+    http_conn_reserve (cb);
+    n = my_recv (cb->data + cb->len, MAX_INPUT_BUFFER);
+    if (n > 0) {
+        cb->len += n;
+        cb->data[cb->len] = '\0';
+    }
+    return n;
+}
+
+/* length of the header block including the empty line, 0 if incomplete;
+ * the first from bytes were searched before */
+static size_t
+http_header_length (const char *buf, size_t len, size_t from)
+{
+    size_t i;
+
+    for (i = from > 2 ? from - 2 : 0; i < len; i++) {
+        if (buf[i] != '\n')
+            continue;
+        if (i + 1 < len && buf[i + 1] == '\n')
+            return i + 2;
+        if (i + 2 < len && buf[i + 1] == '\r' && buf[i + 2] == '\n')
+            return i + 3;
+    }
+    return 0;
+}
+
+/* length of a complete chunked body at buf, 0 if incomplete, -1 if invalid */
+static long
+http_chunked_length (const char *buf, size_t len)
+{
+    size_t pos = 0, eol;
+    unsigned long chunk;
+    char *end;
+
+    for (;;) {
+        for (eol = pos; eol < len && buf[eol] != '\n'; eol++);
+        if (eol >= len)
+            return 0;
+        chunk = strtoul (buf + pos, &end, 16);
+        if (end == buf + pos)
+            return -1;
+        pos = eol + 1;
+
+        if (chunk == 0) {
+            /* skip any trailers up to the empty line */
+            for (;;) {
+                for (eol = pos; eol < len && buf[eol] != '\n'; eol++);
+                if (eol >= len)
+                    return 0;
+                if (eol == pos || (eol == pos + 1 && buf[pos] == '\r'))
+                    return eol + 1;
+                pos = eol + 1;
+            }
+        }
+
+        if (len - pos < chunk)
+            return 0;
+        pos += chunk;
+        if (pos < len && buf[pos] == '\r')
+            pos++;
+        if (pos >= len)
+            return 0;
+        if (buf[pos] != '\n')
+            return -1;
+        pos++;
+    }
+}
+
+/* Take a complete reply off the front of cb. Returns HTTP_READ_MORE if
+ * more of it has to be read first; eof says that nothing more will come.
+ * The headers are searched for and indexed once, not on every call. */
+static int
+http_take_reply (struct http_conn_buf *cb, int head_only, int eof, struct http_reply *reply)
+{
+    size_t header_len, body_len;
+    long chunked_len;
+    int content_length, chunked, http_status, n;
+
+    memset (reply, 0, sizeof (*reply));
+
+    while (cb->header_len == 0) {
+        if ((cb->header_len = http_header_length (cb->data, cb->len, cb->scanned)) == 0) {
+            cb->scanned = cb->len;
+            return eof ? (cb->len ? HTTP_READ_ERROR : HTTP_READ_CLOSED) : HTTP_READ_MORE;
+        }
+
+        /* drop interim replies such as 100 Continue */
+        n = strcspn (cb->data, " \r\n");
+        http_status = cb->data[n] == ' ' ? atoi (cb->data + n) : 0;
+        if (http_status >= 100 && http_status < 200) {
+            memmove (cb->data, cb->data + cb->header_len, cb->len - cb->header_len);
+            cb->len -= cb->header_len;
+            cb->data[cb->len] = '\0';
+            cb->header_len = cb->scanned = 0;
+            continue;
+        }
+        http_headers_parse (&cb->headers, cb->data, cb->header_len);
+    }
+
+    header_len = cb->header_len;
+    cb->headers.base = cb->data;    /* the buffer may have moved */
+    n = strcspn (cb->data, " \r\n");
+    http_status = cb->data[n] == ' ' ? atoi (cb->data + n) : 0;
+    chunked = chunked_transfer_encoding (&cb->headers);
+    content_length = get_content_length (&cb->headers);
+
+    if (head_only || http_status == 204 || http_status == 304) {
+        body_len = 0;
+    } else if (chunked) {
+        chunked_len = http_chunked_length (cb->data + header_len, cb->len - header_len);
+        if (chunked_len == 0 && !eof)
+            return HTTP_READ_MORE;
+        if (chunked_len <= 0)
+            return HTTP_READ_ERROR;
+        body_len = chunked_len;
+    } else if (content_length >= 0) {
+        if (cb->len - header_len < (size_t) content_length)
+            return eof ? HTTP_READ_ERROR : HTTP_READ_MORE;
+        body_len = content_length;
+    } else if (!eof) {
+        /* the body runs to the end of the connection */
+        return HTTP_READ_MORE;
+    } else {
+        body_len = cb->len - header_len;
+    }
+
+    if ((reply->header = malloc (header_len + 1)) == NULL ||
+            (reply->body = malloc (body_len + 1)) == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+    memcpy (reply->header, cb->data, header_len);
+    reply->header[header_len] = '\0';
+    memcpy (reply->body, cb->data + header_len, body_len);
+    reply->body[body_len] = '\0';
+    reply->body_len = body_len;
+    if (chunked && body_len)
+        reply->body_len = decode_chunked_page (reply->body, reply->body);
+    if (no_body)
+        reply->body[reply->body_len = 0] = '\0';
+
+    /* the index moves over to the copy of the headers */
+    reply->headers = cb->headers;
+    reply->headers.base = reply->header;
+    memset (&cb->headers, 0, sizeof (cb->headers));
+
+    n = strcspn (reply->header, "\r\n");
+    if ((reply->status_line = malloc (n + 1)) == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+    memcpy (reply->status_line, reply->header, n);
+    reply->status_line[n] = '\0';
+    strip (reply->status_line);
+
+    reply->keep_alive = !eof && http_keep_alive (&reply->headers, reply->status_line);
+
+    reply->size = header_len + body_len;
+    memmove (cb->data, cb->data + reply->size, cb->len - reply->size);
+    cb->len -= reply->size;
+    cb->data[cb->len] = '\0';
+    cb->header_len = cb->scanned = 0;
+    return HTTP_READ_OK;
+}
+
+/* read the next reply off the shared connection */
+static int
+http_read_reply (struct http_conn_buf *cb, int head_only, struct http_reply *reply)
+{
+    int eof = FALSE, ret, n;
+
+    while ((ret = http_take_reply (cb, head_only, eof, reply)) == HTTP_READ_MORE) {
+        if ((n = http_conn_fill (cb)) < 0 && errno != ECONNRESET)
+            return cb->len ? HTTP_READ_ERROR : HTTP_READ_CLOSED;
+        eof = n <= 0;
+    }
+    return ret;
+}
+
+static void
+http_reply_free (struct http_reply *reply)
+{
+    free (reply->status_line);
+    free (reply->header);
+    http_headers_free (&reply->headers);
+    free (reply->body);
+    memset (reply, 0, sizeof (*reply));
+}
+
+/* Ask the proxy on sd, in the clear, for the tunnel to host_name and take
+ * its reply off a buffer of our own: STATE_OK once it answers 2xx with
+ * nothing after the empty line, since the TLS handshake that follows is
+ * ours to start. Anything else is critical, *msg says why. */
+static int
+http_proxy_connect (char **msg)
+{
+    np_arena arena = { NULL };
+    struct http_conn_buf cb = { NULL, 0, 0 };
+    struct http_reply reply;
+    np_strbuf req;
+    const char *p;
+    char *auth;
+    size_t left;
+    ssize_t n = 0;
+    int eof = FALSE, ret, status;
+
+    np_strbuf_init (&req, &arena);
+    np_strbuf_appendf (&req, "CONNECT %s:%d HTTP/1.1\r\n%s\r\nHost: %s:%d\r\n",
+                       host_name, HTTPS_PORT, user_agent, host_name, HTTPS_PORT);
+    np_strbuf_puts (&req, "Proxy-Connection: keep-alive\r\n");
+    /* the credentials are for the proxy, not for the server behind it */
+    if (strlen (proxy_auth)) {
+        base64_encode_alloc (proxy_auth, strlen (proxy_auth), &auth);
+        np_strbuf_appendf (&req, "Proxy-Authorization: Basic %s\r\n", auth);
+        free (auth);
+    }
+    np_strbuf_puts (&req, CRLF);
+    if (verbose) printf ("%s\n", np_strbuf_string (&req));
+
+    for (p = req.data, left = req.len; left > 0; p += n, left -= n)
+        if ((n = send (sd, p, left, 0)) <= 0)
+            break;
+    np_arena_free (&arena);
+    if (left > 0) {
+        xasprintf (msg, _("Error sending CONNECT to proxy: %s"), strerror (errno));
+        return STATE_CRITICAL;
+    }
+
+    /* a 2xx reply to CONNECT has no body, whatever its headers say */
+    while ((ret = http_take_reply (&cb, TRUE, eof, &reply)) == HTTP_READ_MORE) {
+        http_conn_reserve (&cb);
+        if ((n = read (sd, cb.data + cb.len, MAX_INPUT_BUFFER)) > 0) {
+            cb.len += n;
+            cb.data[cb.len] = '\0';
+        }
+        eof = n <= 0;
+    }
+    left = cb.len;
+    free (cb.data);
+    http_headers_free (&cb.headers);
+    if (ret != HTTP_READ_OK) {
+        xasprintf (msg, ret == HTTP_READ_CLOSED ? _("No reply from proxy to CONNECT")
+                   : _("Invalid reply from proxy to CONNECT"));
+        return STATE_CRITICAL;
+    }
+
+    if (verbose) printf ("%s", reply.header);
+    p = strchr (reply.status_line, ' ');
+    status = p ? atoi (p) : 0;
+    if (status < 200 || status > 299)
+        xasprintf (msg, _("Proxy CONNECT to %s:%d failed - %s"), host_name, HTTPS_PORT, reply.status_line);
+    else if (left > 0)
+        xasprintf (msg, _("Proxy sent data after its reply to CONNECT"));
+    http_reply_free (&reply);
+    return status < 200 || status > 299 || left > 0 ? STATE_CRITICAL : STATE_OK;
+}
+
+/* the checks check_http() makes, for one URL and its reply; name starts
+ * the message */
+static int
+http_check_reply (struct http_url_check *u, const char *name, struct http_reply *reply,
+                  double elapsed_time, char **msg)
+{
+    const char *expect = u->expect ? u->expect : (server_expect_yn ? server_expect : NULL);
+    const char *string = u->string ? u->string : (strlen (string_expect) ? string_expect : NULL);
+    np_regex_t *re = u->have_regex ? &u->preg : (strlen (regexp) ? &preg : NULL);
+    const char *protocol = strncmp (reply->status_line, HTTP2_EXPECT, strlen (HTTP2_EXPECT))
+                           ? HTTP_EXPECT : HTTP2_EXPECT;
+    char *status_code, *date_msg, *body;
+    size_t body_len, checked_len;
+    int http_status, result = STATE_OK;
+
+    /* a single URL is reported without its name */
+    if (name)
+        xasprintf (msg, "%s: %s", name, reply->status_line);
+    else
+        *msg = strdup (reply->status_line);
+
+    if (expect) {
+        if (!expected_statuscode (reply->status_line, expect)) {
+            xasprintf (msg, _("%s, status line did not match \"%s\""), *msg, expect);
+            result = STATE_CRITICAL;
+        }
+    } else if (!expected_statuscode (reply->status_line, protocol)) {
+        xasprintf (msg, _("%s, invalid HTTP response"), *msg);
+        result = STATE_CRITICAL;
+    } else {
+        status_code = strchr (reply->status_line, ' ');
+        if (status_code != NULL)
+            while (*status_code == ' ') status_code++;
+
+        if (status_code == NULL || strspn (status_code, "1234567890") != 3 ||
+                (http_status = atoi (status_code)) >= 600) {
+            xasprintf (msg, _("%s, invalid status line"), *msg);
+            result = STATE_CRITICAL;
+        }
+        else if (http_status >= 500)
+            result = STATE_CRITICAL;
+        else if (http_status >= 400)
+            result = STATE_WARNING;
+        else if (http_status >= 300)
+            result = onredirect;
+    }
+
+    if (maximum_age >= 0) {
+        date_msg = strdup ("");
+        result = max_state_alt (check_document_dates (&reply->headers, &date_msg), result);
+        if (strlen (date_msg) > 2) {
+            date_msg[strlen (date_msg) - 2] = '\0';
+            xasprintf (msg, "%s, %s", *msg, date_msg);
+        }
+        free (date_msg);
+    }
+
+    if (strlen (header_expect) && !strstr (reply->header, header_expect)) {
+        xasprintf (msg, _("%s, header '%.30s' not found"), *msg, header_expect);
+        result = STATE_CRITICAL;
+    }
+
+    if ((body = http_decode_body (&reply->headers, reply->body, reply->body_len, &body_len)) == NULL) {
+        xasprintf (msg, _("%s, invalid Content-Encoding of the body"), *msg);
+        result = STATE_CRITICAL;
+        body = reply->body;
+    }
+
+    if (string && !strstr (body, string)) {
+        xasprintf (msg, _("%s, string '%.30s' not found"), *msg, string);
+        result = STATE_CRITICAL;
+    }
+
+    if (re) {
+        errcode = np_regexec (re, body, REGS, pmatch, 0);
+        if (errcode != 0 && errcode != REG_NOMATCH) {
+            np_regerror (errcode, re, errbuf, MAX_INPUT_BUFFER);
+            xasprintf (msg, _("%s, Execute Error: %s"), *msg, errbuf);
+            result = STATE_CRITICAL;
+        } else if ((errcode == REG_NOMATCH) != (invert_regex == 1)) {
+            xasprintf (msg, invert_regex ? _("%s, pattern found") : _("%s, pattern not found"), *msg);
+            result = STATE_CRITICAL;
+        }
+    }
+
+    if (body != reply->body)
+        free (body);
+
+    checked_len = decoded_size ? strlen (reply->header) + body_len : reply->size;
+    if ((max_page_len > 0) && ((int) checked_len > max_page_len)) {
+        xasprintf (msg, _("%s, page size %d too large"), *msg, (int) checked_len);
+        result = max_state_alt (STATE_WARNING, result);
+    } else if ((min_page_len > 0) && ((int) checked_len < min_page_len)) {
+        xasprintf (msg, _("%s, page size %d too small"), *msg, (int) checked_len);
+        result = max_state_alt (STATE_WARNING, result);
+    }
+
+    xasprintf (msg, _("%s - %d bytes in %.3f second response time"),
+               *msg, (int) reply->size, elapsed_time);
+
+    return max_state_alt (get_status (elapsed_time, u->thlds), result);
+}
+
+/* print the --multi-url summary, extra perfdata after the per-URL
+ * figures, then one line per URL, and exit */
+static void
+http_multi_report (const int *url_state, char **url_msg, const double *url_time,
+                   const size_t *url_size, np_perfdata *extra)
+{
+    np_perfdata perf;
+    char *problems = NULL;
+    char label[32];
+    int result = STATE_OK, count_ok = 0;
+    int i;
+
+    np_perfdata_init (&perf);
+    for (i = 0; i < url_check_count; i++) {
+        result = max_state_alt (url_state[i], result);
+        if (url_state[i] == STATE_OK)
+            count_ok++;
+        else
+            xasprintf (&problems, "%s%s%s", problems ? problems : "", problems ? "; " : "", url_msg[i]);
+
+        if (url_size[i] == 0)
+            continue;   /* no reply */
+        snprintf (label, sizeof (label), "url%d_time", i + 1);
+        np_perfdata_addf (&perf, label, url_time[i], "s",
+                          url_checks[i].thlds->warning ? TRUE : FALSE,
+                          url_checks[i].thlds->warning ? url_checks[i].thlds->warning->end : 0,
+                          url_checks[i].thlds->critical ? TRUE : FALSE,
+                          url_checks[i].thlds->critical ? url_checks[i].thlds->critical->end : 0,
+                          TRUE, 0, FALSE, 0);
+        snprintf (label, sizeof (label), "url%d_size", i + 1);
+        np_perfdata_add (&perf, label, (long) url_size[i], "B",
+                         FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+    }
+
+    printf ("HTTP %s: %d of %d URLs OK%s%s|%s%s%s\n", state_text (result), count_ok, url_check_count,
+            problems ? " - " : "", problems ? problems : "", np_perfdata_string (&perf),
+            extra ? " " : "", extra ? np_perfdata_string (extra) : "");
+    for (i = 0; i < url_check_count; i++)
+        printf ("[%s] %s\n", state_text (url_state[i]), url_msg[i]);
+
+    np_exit (result);
+}
+
+int
+check_http_multi (void)
+{
+    struct http_conn_buf cb = { NULL, 0, 0 };
+    struct http_reply reply;
+    struct timeval *sent;
+    struct timeval last_reply;
+    char **request, **url_msg;
+    int *url_state;
+    double *url_time;
+    size_t *url_size;
+    int head_only = strcmp (http_method, "HEAD") == 0;
+    int next_send = 0, next_reply = 0, reused = FALSE, retried = FALSE;
+    int result = STATE_OK;
+    double elapsed_time;
+    np_perfdata perf;
+    char *msg;
+    int i, ret;
+
+    /* writing to a connection the server closed must not kill us */
+    signal (SIGPIPE, SIG_IGN);
+    gettimeofday (&last_reply, NULL);
+
+    request = calloc (url_check_count, sizeof (*request));
+    url_msg = calloc (url_check_count, sizeof (*url_msg));
+    url_state = calloc (url_check_count, sizeof (*url_state));
+    url_time = calloc (url_check_count, sizeof (*url_time));
+    url_size = calloc (url_check_count, sizeof (*url_size));
+    sent = calloc (url_check_count, sizeof (*sent));
+    if (!request || !url_msg || !url_state || !url_time || !url_size || !sent)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+
+    /* only the last request lets the server close the connection */
+    for (i = 0; i < url_check_count; i++)
+        request[i] = http_build_request (http_tunnel () ? "GET" : http_method, url_checks[i].url,
+                                         i < url_check_count - 1);
+
+    if (http_multi_connect (&msg) != STATE_OK)
+        die (STATE_CRITICAL, "HTTP CRITICAL - %s\n", msg);
+#ifdef HAVE_SSL
+    if (use_ssl == TRUE && (check_cert == TRUE || check_ocsp == TRUE)) {
+        result = http_check_certificate ();
+        if (continue_after_check_cert == FALSE) {
+            http_multi_disconnect (&cb);
+            return result;
+        }
+    }
+#endif
+
+    while (next_reply < url_check_count) {
+        if (sd == 0) {
+            next_send = next_reply;
+            reused = FALSE;
+            if (http_multi_connect (&msg) != STATE_OK) {
+                xasprintf (&url_msg[next_reply], "%s: %s", url_checks[next_reply].url, msg);
+                url_state[next_reply++] = STATE_CRITICAL;
+                continue;
+            }
+        }
+
+        /* without --pipeline a request waits for the reply before it */
+        while (next_send < url_check_count && (pipeline || next_send == next_reply)) {
+            if (verbose) printf ("%s\n", request[next_send]);
+            gettimeofday (&sent[next_send], NULL);
+            if (http_send_request (request[next_send], strlen (request[next_send])) < 0)
+                break;
+            next_send++;
+        }
+
+        ret = next_send > next_reply ? http_read_reply (&cb, head_only, &reply) : HTTP_READ_CLOSED;
+        if (ret == HTTP_READ_CLOSED && reused && !retried) {
+            /* the server dropped an idle connection, try once more */
+            http_multi_disconnect (&cb);
+            retried = TRUE;
+            continue;
+        }
+        retried = FALSE;
+
+        if (ret != HTTP_READ_OK) {
+            xasprintf (&url_msg[next_reply], ret == HTTP_READ_CLOSED
+                       ? _("%s: No data received from host") : _("%s: Error on receive"),
+                       url_checks[next_reply].url);
+            url_state[next_reply++] = STATE_CRITICAL;
+            http_multi_disconnect (&cb);
+            continue;
+        }
+
+        /* a pipelined reply is timed from the end of the one before it */
+        if (timercmp (&sent[next_reply], &last_reply, <))
+            sent[next_reply] = last_reply;
+        elapsed_time = (double) deltime (sent[next_reply]) / 1.0e6;
+        gettimeofday (&last_reply, NULL);
+
+        if (verbose)
+            printf ("**** HEADER ****\n%s\n**** CONTENT ****\n%s\n", reply.header,
+                    (no_body ? "  [[ skipped ]]" : reply.body));
+
+        url_state[next_reply] = http_check_reply (&url_checks[next_reply], url_checks[next_reply].url,
+                                                  &reply, elapsed_time, &url_msg[next_reply]);
+        url_time[next_reply] = elapsed_time;
+        url_size[next_reply] = reply.size;
+        next_reply++;
+        reused = TRUE;
+
+        if (!reply.keep_alive)
+            http_multi_disconnect (&cb);
+        http_reply_free (&reply);
+    }
+    http_multi_disconnect (&cb);
+    free (cb.data);
+
+    /* reset the alarm */
+    alarm (0);
+
+    /* with -E, how often the tunnel had to be opened and what it cost */
+    np_perfdata_init (&perf);
+    if (show_extended_perfdata && http_tunnel ()) {
+        np_perfdata_addf (&perf, "time_proxy", multi_time_proxy, "s",
+                          FALSE, 0, FALSE, 0, FALSE, 0, FALSE, 0);
+        np_perfdata_add (&perf, "tunnels", multi_tunnels, "",
+                         FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+    }
+    http_multi_report (url_state, url_msg, url_time, url_size, perf.len ? &perf : NULL);
+    return STATE_UNKNOWN;
+}
+
+
+#ifdef HAVE_NGHTTP2
+/*
+ * --http2, --http2-prior-knowledge: the request, or every --multi-url
+ * URL, goes out as a stream on one HTTP/2 connection; nghttp2 does the
+ * framing and flow control. The replies are turned back into an
+ * HTTP/1-style header block so that http_check_reply() judges them
+ * exactly as it does for HTTP/1.1.
+ */
+struct http2_stream {
+    struct http_url_check *u;
+    int32_t id;
+    struct http_buf header;         /* "HTTP/2 <status>" and the fields */
+    struct http_buf body;
+    size_t post_sent;
+    int interim;                    /* in a 1xx header block */
+    int done;
+    uint32_t error;
+    struct timeval sent, first, headers, closed;
+};
+
+static int
+http2_on_begin_frame (nghttp2_session *session, const nghttp2_frame_hd *hd, void *user_data)
+{
+    struct http2_stream *st = nghttp2_session_get_stream_user_data (session, hd->stream_id);
+
+    if (st && !timerisset (&st->first))
+        gettimeofday (&st->first, NULL);
+    return 0;
+}
+
+static int
+http2_on_header (nghttp2_session *session, const nghttp2_frame *frame,
+                 const uint8_t *name, size_t namelen, const uint8_t *value, size_t valuelen,
+                 uint8_t flags, void *user_data)
+{
+    struct http2_stream *st = nghttp2_session_get_stream_user_data (session, frame->hd.stream_id);
+
+    if (st == NULL || frame->hd.type != NGHTTP2_HEADERS)
+        return 0;
+
+    if (namelen == 7 && memcmp (name, ":status", 7) == 0) {
+        st->interim = valuelen == 3 && value[0] == '1';
+        if (!st->interim) {
+            st->header.len = 0;
+            http_buf_append (&st->header, "HTTP/2 ", 7);
+            http_buf_append (&st->header, (const char *) value, valuelen);
+            http_buf_append (&st->header, "\r\n", 2);
+        }
+    } else if (!st->interim && name[0] != ':') {
+        http_buf_append (&st->header, (const char *) name, namelen);
+        http_buf_append (&st->header, ": ", 2);
+        http_buf_append (&st->header, (const char *) value, valuelen);
+        http_buf_append (&st->header, "\r\n", 2);
+    }
+    return 0;
+}
+
+static int
+http2_on_frame_recv (nghttp2_session *session, const nghttp2_frame *frame, void *user_data)
+{
+    struct http2_stream *st = nghttp2_session_get_stream_user_data (session, frame->hd.stream_id);
+
+    if (st && frame->hd.type == NGHTTP2_HEADERS && (frame->hd.flags & NGHTTP2_FLAG_END_HEADERS)) {
+        if (st->interim)
+            st->interim = FALSE;
+        else if (!timerisset (&st->headers))
+            gettimeofday (&st->headers, NULL);
+    }
+    return 0;
+}
+
+static int
+http2_on_data_chunk (nghttp2_session *session, uint8_t flags, int32_t stream_id,
+                     const uint8_t *data, size_t len, void *user_data)
+{
+    struct http2_stream *st = nghttp2_session_get_stream_user_data (session, stream_id);
+
+    if (st == NULL || no_body || st->done)
+        return 0;
+    if (max_body_len > 0 && st->body.len + len >= (size_t) max_body_len) {
+        /* as much as --max-body allows, then the stream is cancelled */
+        http_buf_append (&st->body, (const char *) data, max_body_len - st->body.len);
+        nghttp2_submit_rst_stream (session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CANCEL);
+        st->done = TRUE;
+        return 0;
+    }
+    http_buf_append (&st->body, (const char *) data, len);
+    return 0;
+}
+
+static int
+http2_on_stream_close (nghttp2_session *session, int32_t stream_id, uint32_t error_code, void *user_data)
+{
+    struct http2_stream *st = nghttp2_session_get_stream_user_data (session, stream_id);
+    int *open = user_data;
+
+    if (st == NULL)
+        return 0;
+    gettimeofday (&st->closed, NULL);
+    /* our own cancel after --max-body is not an error */
+    if (!st->done)
+        st->error = error_code;
+    st->done = TRUE;
+    (*open)--;
+    return 0;
+}
+
+static ssize_t
+http2_read_post (nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length,
+                 uint32_t *data_flags, nghttp2_data_source *source, void *user_data)
+{
+    struct http2_stream *st = source->ptr;
+    size_t left = http_post_len - st->post_sent;
+
+    if (length > left)
+        length = left;
+    memcpy (buf, http_post_data + st->post_sent, length);
+    st->post_sent += length;
+    if (st->post_sent == http_post_len)
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    return length;
+}
+
+static void
+http2_add_header (nghttp2_nv **nva, size_t *count, const char *name, size_t namelen,
+                  const char *value)
+{
+    nghttp2_nv *nv;
+    size_t i;
+
+    if ((*nva = realloc (*nva, (*count + 1) * sizeof (**nva))) == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+    nv = &(*nva)[(*count)++];
+    /* HTTP/2 field names are lower case */
+    if ((nv->name = malloc (namelen + 1)) == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+    for (i = 0; i < namelen; i++)
+        nv->name[i] = tolower ((unsigned char) name[i]);
+    nv->name[namelen] = '\0';
+    nv->namelen = namelen;
+    nv->value = (uint8_t *) strdup (value);
+    nv->valuelen = strlen (value);
+    nv->flags = NGHTTP2_NV_FLAG_NONE;
+    if (nv->value == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+}
+
+/* the same request http_build_request() makes, as HTTP/2 fields */
+static int32_t
+http2_submit (nghttp2_session *session, struct http2_stream *st)
+{
+    nghttp2_data_provider post = { { 0 }, http2_read_post };
+    nghttp2_nv *nva = NULL;
+    size_t count = 0, i;
+    const char *authority = NULL, *colon;
+    char *value, *auth;
+    int32_t id;
+
+    for (i = 0; i < (size_t) http_opt_headers_count; i++)
+        if (strncmp (http_opt_headers[i], "Host:", 5) == 0)
+            authority = http_opt_headers[i] + 5 + strspn (http_opt_headers[i] + 5, " \t");
+    if (authority)
+        value = strdup (authority);
+    else if (host_name && ((use_ssl == FALSE && server_port == HTTP_PORT) ||
+                           (use_ssl == TRUE && server_port == HTTPS_PORT)))
+        value = strdup (host_name);
+    else
+        xasprintf (&value, "%s:%d", host_name ? host_name : server_address, server_port);
+
+    http2_add_header (&nva, &count, ":method", 7, http_method);
+    http2_add_header (&nva, &count, ":scheme", 7, use_ssl ? "https" : "http");
+    http2_add_header (&nva, &count, ":authority", 10, value);
+    http2_add_header (&nva, &count, ":path", 5, st->u->url);
+    free (value);
+    /* user_agent is the whole header line */
+    http2_add_header (&nva, &count, "user-agent", 10, user_agent + strlen ("User-Agent: "));
+    if (!have_accept)
+        http2_add_header (&nva, &count, "accept", 6, "*/*");
+    if (compressed && !have_accept_encoding && http_accept_encoding ())
+        http2_add_header (&nva, &count, "accept-encoding", 15, http_accept_encoding ());
+
+    for (i = 0; i < (size_t) http_opt_headers_count; i++) {
+        if ((colon = strchr (http_opt_headers[i], ':')) == NULL)
+            continue;
+        /* Host became :authority, and connection-specific fields are
+         * not allowed in HTTP/2 (RFC 7540, 8.1.2.2) */
+        if ((colon - http_opt_headers[i] == 4 && !strncasecmp (http_opt_headers[i], "Host", 4)) ||
+                (colon - http_opt_headers[i] == 10 && !strncasecmp (http_opt_headers[i], "Connection", 10)) ||
+                (colon - http_opt_headers[i] == 10 && !strncasecmp (http_opt_headers[i], "Keep-Alive", 10)) ||
+                (colon - http_opt_headers[i] == 17 && !strncasecmp (http_opt_headers[i], "Transfer-Encoding", 17)) ||
+                (colon - http_opt_headers[i] == 7 && !strncasecmp (http_opt_headers[i], "Upgrade", 7)))
+            continue;
+        http2_add_header (&nva, &count, http_opt_headers[i], colon - http_opt_headers[i],
+                          colon + 1 + strspn (colon + 1, " \t"));
+    }
+
+    if (strlen (user_auth)) {
+        base64_encode_alloc (user_auth, strlen (user_auth), &auth);
+        xasprintf (&value, "Basic %s", auth);
+        http2_add_header (&nva, &count, "authorization", 13, value);
+        free (value);
+        free (auth);
+    }
+    if (strlen (proxy_auth)) {
+        base64_encode_alloc (proxy_auth, strlen (proxy_auth), &auth);
+        xasprintf (&value, "Basic %s", auth);
+        http2_add_header (&nva, &count, "proxy-authorization", 19, value);
+        free (value);
+        free (auth);
+    }
+    if (http_post_data) {
+        http2_add_header (&nva, &count, "content-type", 12,
+                          http_content_type ? http_content_type : "application/x-www-form-urlencoded");
+        xasprintf (&value, "%lu", (unsigned long) http_post_len);
+        http2_add_header (&nva, &count, "content-length", 14, value);
+        free (value);
+        post.source.ptr = st;
+    }
+
+    if (verbose) {
+        for (i = 0; i < count; i++)
+            printf ("%s: %s\n", nva[i].name, nva[i].value);
+        printf ("\n");
+    }
+
+    /* nghttp2 keeps its own copy of the fields */
+    id = nghttp2_submit_request (session, NULL, nva, count, http_post_data ? &post : NULL, st);
+    for (i = 0; i < count; i++) {
+        free (nva[i].name);
+        free (nva[i].value);
+    }
+    free (nva);
+    return id;
+}
+
+/* write out whatever nghttp2 has queued, in one go so that Nagle does
+ * not hold back the frames behind the first */
+static int
+http2_flush (nghttp2_session *session)
+{
+    struct http_buf out = { NULL, 0, 0 };
+    const uint8_t *data;
+    ssize_t n;
+    int ret = 0;
+
+    while ((n = nghttp2_session_mem_send (session, &data)) > 0)
+        http_buf_append (&out, (const char *) data, n);
+    if (n < 0 || (out.len && http_send_all (out.data, out.len) < 0))
+        ret = -1;
+    free (out.data);
+    return ret;
+}
+
+static double
+http2_delta (const struct timeval *from, const struct timeval *to)
+{
+    if (!timerisset (from) || !timerisset (to))
+        return 0;
+    return (to->tv_sec - from->tv_sec) + (to->tv_usec - from->tv_usec) / 1.0e6;
+}
+
+int
+check_http2 (void)
+{
+    nghttp2_settings_entry settings[] = {
+        { NGHTTP2_SETTINGS_ENABLE_PUSH, 0 },
+        { NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 100 },
+        { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, 1 << 20 }
+    };
+    nghttp2_session_callbacks *callbacks;
+    nghttp2_session *session;
+    struct http_url_check single;
+    struct http_url_check *checks = url_checks;
+    struct http2_stream *streams;
+    struct http_reply reply;
+    struct timeval tv_connect;
+    struct timeval tv_ssl;
+    np_perfdata perf;
+    const char *alpn = NULL;
+    char **url_msg;
+    char label[48];
+    int *url_state;
+    double *url_time;
+    size_t *url_size;
+    int count = url_check_count, open = 0, result = STATE_OK;
+    double elapsed_time_connect, elapsed_time_ssl = 0;
+    int i, n;
+
+    /* a single URL is just the one stream */
+    if (count == 0) {
+        memset (&single, 0, sizeof (single));
+        single.url = server_url;
+        single.thlds = thlds;
+        checks = &single;
+        count = 1;
+    }
+
+    signal (SIGPIPE, SIG_IGN);
+    streams = calloc (count, sizeof (*streams));
+    url_msg = calloc (count, sizeof (*url_msg));
+    url_state = calloc (count, sizeof (*url_state));
+    url_time = calloc (count, sizeof (*url_time));
+    url_size = calloc (count, sizeof (*url_size));
+    if (!streams || !url_msg || !url_state || !url_time || !url_size)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+
+    if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
+        die (STATE_CRITICAL, _("HTTP CRITICAL - Unable to open TCP socket\n"));
+    gettimeofday (&tv_connect, NULL);
+    elapsed_time_connect = http2_delta (&tv, &tv_connect);
+#ifdef HAVE_SSL
+    if (use_ssl == TRUE) {
+        np_net_ssl_alpn (http2 == HTTP2_ALPN ? "h2,http/1.1" : "h2");
+        np_net_ssl_session_cache (tls_session_cache ? server_address : NULL, server_port, tls_full_handshake);
+        if (np_net_ssl_init_with_hostname_version_and_cert (sd, (use_sni ? host_name : NULL), ssl_version,
+                client_cert, client_privkey) != STATE_OK)
+            die (STATE_CRITICAL, NULL);
+        gettimeofday (&tv_ssl, NULL);
+        elapsed_time_ssl = http2_delta (&tv_connect, &tv_ssl);
+        alpn = np_net_ssl_alpn_selected ();
+        if (verbose)
+            printf ("SSL initialized, ALPN %s\n", alpn ? alpn : _("not negotiated"));
+        if (check_cert == TRUE || check_ocsp == TRUE) {
+            result = http_check_certificate ();
+            if (continue_after_check_cert == FALSE) {
+                np_net_ssl_cleanup ();
+                close (sd);
+                return result;
+            }
+        }
+        if (http2 == HTTP2_ALPN && (alpn == NULL || strcmp (alpn, "h2") != 0))
+            die (STATE_CRITICAL, _("HTTP CRITICAL - Server did not negotiate HTTP/2 (ALPN: %s)\n"),
+                 alpn ? alpn : _("none"));
+    }
+#endif
+
+    if (nghttp2_session_callbacks_new (&callbacks) != 0)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+    nghttp2_session_callbacks_set_on_begin_frame_callback (callbacks, http2_on_begin_frame);
+    nghttp2_session_callbacks_set_on_header_callback (callbacks, http2_on_header);
+    nghttp2_session_callbacks_set_on_frame_recv_callback (callbacks, http2_on_frame_recv);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback (callbacks, http2_on_data_chunk);
+    nghttp2_session_callbacks_set_on_stream_close_callback (callbacks, http2_on_stream_close);
+    if (nghttp2_session_client_new (&session, callbacks, &open) != 0)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+    nghttp2_session_callbacks_del (callbacks);
+
+    nghttp2_submit_settings (session, NGHTTP2_FLAG_NONE, settings, sizeof (settings) / sizeof (*settings));
+    nghttp2_session_set_local_window_size (session, NGHTTP2_FLAG_NONE, 0, 1 << 24);
+    for (i = 0; i < count; i++) {
+        streams[i].u = &checks[i];
+        if ((streams[i].id = http2_submit (session, &streams[i])) < 0) {
+            xasprintf (&url_msg[i], _("%s: Cannot submit request: %s"), checks[i].url,
+                       nghttp2_strerror (streams[i].id));
+            url_state[i] = STATE_UNKNOWN;
+            streams[i].done = TRUE;
+            continue;
+        }
+        open++;
+    }
+
+    /* all streams go out together and are answered in any order */
+    for (i = 0; i < count; i++)
+        gettimeofday (&streams[i].sent, NULL);
+    while (open > 0 && (nghttp2_session_want_read (session) || nghttp2_session_want_write (session))) {
+        if (http2_flush (session) < 0)
+            break;
+        if ((n = my_recv (buffer, sizeof (buffer))) <= 0)
+            break;
+        if ((n = nghttp2_session_mem_recv (session, (const uint8_t *) buffer, n)) < 0) {
+            if (verbose)
+                printf ("%s\n", nghttp2_strerror (n));
+            break;
+        }
+    }
+    nghttp2_session_terminate_session (session, NGHTTP2_NO_ERROR);
+    http2_flush (session);
+
+    for (i = 0; i < count; i++) {
+        const char *name = url_check_count ? checks[i].url : NULL;
+
+        if (url_msg[i])
+            continue;
+        if (!streams[i].done || streams[i].error || streams[i].header.len == 0) {
+            if (!streams[i].done)
+                xasprintf (&url_msg[i], _("%s%sNo data received from host"), name ? name : "", name ? ": " : "");
+            else if (streams[i].error)
+                xasprintf (&url_msg[i], _("%s%sStream reset: %s"), name ? name : "", name ? ": " : "",
+                           nghttp2_http2_strerror (streams[i].error));
+            else
+                xasprintf (&url_msg[i], _("%s%sNo response headers received"), name ? name : "", name ? ": " : "");
+            url_state[i] = STATE_CRITICAL;
+            free (streams[i].header.data);
+            free (streams[i].body.data);
+            continue;
+        }
+
+        http_buf_append (&streams[i].header, "\r\n", 2);
+        if (streams[i].body.data == NULL)
+            http_buf_append (&streams[i].body, "", 0);
+        memset (&reply, 0, sizeof (reply));
+        reply.header = streams[i].header.data;
+        reply.body = streams[i].body.data;
+        reply.body_len = streams[i].body.len;
+        reply.size = streams[i].header.len + streams[i].body.len;
+        n = strcspn (reply.header, "\r\n");
+        if ((reply.status_line = strndup (reply.header, n)) == NULL)
+            die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+        http_headers_parse (&reply.headers, reply.header, streams[i].header.len);
+
+        if (verbose)
+            printf ("**** HEADER ****\n%s\n**** CONTENT ****\n%s\n", reply.header,
+                    (no_body ? "  [[ skipped ]]" : reply.body));
+
+        /* a single URL is timed like check_http(), from the start */
+        url_time[i] = name ? http2_delta (&streams[i].sent, &streams[i].closed) : (double) deltime (tv) / 1.0e6;
+        url_size[i] = reply.size;
+        url_state[i] = http_check_reply (&checks[i], name, &reply, url_time[i], &url_msg[i]);
+        http_reply_free (&reply);
+    }
+    nghttp2_session_del (session);
+#ifdef HAVE_SSL
+    if (use_ssl == TRUE)
+        np_net_ssl_cleanup ();
+#endif
+    close (sd);
+    sd = 0;
+
+    /* reset the alarm */
+    alarm (0);
+
+    if (url_check_count == 0) {
+        if (show_url)
+            xasprintf (&url_msg[0], _("%s - %s://%s:%d%s"), url_msg[0], use_ssl ? "https" : "http",
+                       host_name ? host_name : server_address, server_port, server_url);
+        if (url_size[0] == 0)
+            die (url_state[0], "HTTP %s - %s\n", state_text (url_state[0]), url_msg[0]);
+        if (show_extended_perfdata)
+            die (url_state[0], "HTTP %s: %s %s|%s %s %s %s %s %s %s\n", state_text (url_state[0]), url_msg[0],
+                 (display_html ? "</A>" : ""), perfd_time (url_time[0]), perfd_size (url_size[0]),
+                 perfd_time_connect (elapsed_time_connect),
+                 use_ssl == TRUE ? perfd_time_ssl (elapsed_time_ssl) : "",
+                 perfd_time_headers (http2_delta (&streams[0].sent, &streams[0].headers)),
+                 perfd_time_firstbyte (http2_delta (&streams[0].sent, &streams[0].first)),
+                 perfd_time_transfer (http2_delta (&streams[0].headers, &streams[0].closed)));
+        die (url_state[0], "HTTP %s: %s %s|%s %s\n", state_text (url_state[0]), url_msg[0],
+             (display_html ? "</A>" : ""), perfd_time (url_time[0]), perfd_size (url_size[0]));
+    }
+
+    /* with -E each stream's phases are shown too */
+    np_perfdata_init (&perf);
+    if (show_extended_perfdata) {
+        np_perfdata_addf (&perf, "time_connect", elapsed_time_connect, "s",
+                          FALSE, 0, FALSE, 0, FALSE, 0, FALSE, 0);
+        if (use_ssl == TRUE)
+            np_perfdata_addf (&perf, "time_ssl", elapsed_time_ssl, "s",
+                              FALSE, 0, FALSE, 0, FALSE, 0, FALSE, 0);
+        for (i = 0; i < count; i++) {
+            if (url_size[i] == 0)
+                continue;
+            snprintf (label, sizeof (label), "url%d_time_headers", i + 1);
+            np_perfdata_addf (&perf, label, http2_delta (&streams[i].sent, &streams[i].headers), "s",
+                              FALSE, 0, FALSE, 0, FALSE, 0, FALSE, 0);
+            snprintf (label, sizeof (label), "url%d_time_firstbyte", i + 1);
+            np_perfdata_addf (&perf, label, http2_delta (&streams[i].sent, &streams[i].first), "s",
+                              FALSE, 0, FALSE, 0, FALSE, 0, FALSE, 0);
+            snprintf (label, sizeof (label), "url%d_time_transfer", i + 1);
+            np_perfdata_addf (&perf, label, http2_delta (&streams[i].headers, &streams[i].closed), "s",
+                              FALSE, 0, FALSE, 0, FALSE, 0, FALSE, 0);
+        }
+    }
+    http_multi_report (url_state, url_msg, url_time, url_size, show_extended_perfdata ? &perf : NULL);
+    return STATE_UNKNOWN;
+}
+#endif /* HAVE_NGHTTP2 */
+
+
+#ifdef HAVE_POLL
+/*
+ * --hosts: the same check against many servers from one process. Each
+ * target is a non-blocking socket that steps through connect, TLS
+ * handshake, request and reply as poll() reports it ready; at most
+ * --concurrency targets are in flight at a time. Replies are judged by
+ * http_check_reply(), like --multi-url, and -t applies to each target.
+ */
+
+enum {
+    HTTP_STEP_CONNECT,
+    HTTP_STEP_TLS,
+    HTTP_STEP_SEND,
+    HTTP_STEP_RECV,
+    HTTP_STEP_DONE
+};
+
+#ifdef HAVE_SSL
+static SSL_CTX *target_ssl_ctx;
+#endif
+
+struct http_target {
+    char *address;      /* as given, which names it in the output */
+    char *host;         /* and where it connects to */
+    int port;
+    int fd;
+    int step;
+    short events;       /* what the current step waits for */
+#ifdef HAVE_SSL
+    SSL *ssl;
+#endif
+    struct timeval start;
+    size_t sent;
+    struct http_conn_buf cb;
+    int state;
+    char *msg;
+    double time;
+    size_t size;
+    int started;
+};
+
+static void
+http_target_done (struct http_target *t, int state, const char *msg)
+{
+#ifdef HAVE_SSL
+    if (t->ssl) {
+        SSL_free (t->ssl);
+        t->ssl = NULL;
+    }
+#endif
+    if (t->fd >= 0)
+        close (t->fd);
+    t->fd = -1;
+    free (t->cb.data);
+    t->cb.data = NULL;
+    http_headers_free (&t->cb.headers);
+    t->step = HTTP_STEP_DONE;
+    if (msg) {
+        t->state = state;
+        xasprintf (&t->msg, "%s: %s", t->address, msg);
+    }
+}
+
+static void
+http_target_connect (struct http_target *t)
+{
+    struct addrinfo hints, *res;
+    char port_str[6];
+    int ret;
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = address_family;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf (port_str, sizeof (port_str), "%d", t->port);
+
+    gettimeofday (&t->start, NULL);
+    if ((ret = np_net_getaddrinfo (t->host, port_str, &hints, &res)) != 0) {
+        http_target_done (t, STATE_CRITICAL, gai_strerror (ret));
+        return;
+    }
+    t->fd = socket (res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (t->fd < 0 || fcntl (t->fd, F_SETFL, O_NONBLOCK) < 0 ||
+            (connect (t->fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS)) {
+        http_target_done (t, STATE_CRITICAL, strerror (errno));
+        return;
+    }
+    t->step = HTTP_STEP_CONNECT;
+    t->events = POLLOUT;
+}
+
+#ifdef HAVE_SSL
+/* what a non-blocking SSL call that did not finish is waiting for;
+ * 0 if it failed */
+static short
+http_ssl_wants (SSL *ssl, int ret)
+{
+    switch (SSL_get_error (ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+        return POLLIN;
+    case SSL_ERROR_WANT_WRITE:
+        return POLLOUT;
+    default:
+        return 0;
+    }
+}
+#endif
+
+/* move a target on as far as it goes without blocking */
+static void
+http_target_step (struct http_target *t, const char *request, size_t request_len,
+                  int head_only, struct http_url_check *u)
+{
+    struct http_reply reply;
+    const char *piece;
+    socklen_t len;
+    size_t left;
+    int err, n, ret;
+
+    switch (t->step) {
+    case HTTP_STEP_CONNECT:
+        len = sizeof (err);
+        if (getsockopt (t->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+            err = errno;
+        if (err) {
+            http_target_done (t, STATE_CRITICAL, strerror (err));
+            return;
+        }
+#ifdef HAVE_SSL
+        if (use_ssl == TRUE) {
+            if ((t->ssl = SSL_new (target_ssl_ctx)) == NULL) {
+                http_target_done (t, STATE_CRITICAL, _("Cannot initiate SSL handshake"));
+                return;
+            }
+#ifdef SSL_set_tlsext_host_name
+            if (use_sni && host_name != NULL)
+                SSL_set_tlsext_host_name (t->ssl, host_name);
+#endif
+            SSL_set_fd (t->ssl, t->fd);
+            t->step = HTTP_STEP_TLS;
+        }
+        else
+#endif
+            t->step = HTTP_STEP_SEND;
+        t->events = POLLOUT;
+        /* FALLTHROUGH */
+
+    case HTTP_STEP_TLS:
+#ifdef HAVE_SSL
+        if (t->step == HTTP_STEP_TLS) {
+            if ((ret = SSL_connect (t->ssl)) != 1) {
+                if ((t->events = http_ssl_wants (t->ssl, ret)) == 0)
+                    http_target_done (t, STATE_CRITICAL, _("Cannot make SSL connection"));
+                return;
+            }
+            if (!np_net_ssl_hostname_ok (t->ssl, host_name)) {
+                http_target_done (t, STATE_CRITICAL, _("Hostname mismatch"));
+                return;
+            }
+            t->step = HTTP_STEP_SEND;
+        }
+#endif
+        /* FALLTHROUGH */
+
+    case HTTP_STEP_SEND:
+        while ((left = http_request_piece (request, request_len, t->sent, &piece)) > 0) {
+            if (left > INT_MAX)
+                left = INT_MAX;
+#ifdef HAVE_SSL
+            if (t->ssl) {
+                if ((n = SSL_write (t->ssl, piece, left)) <= 0) {
+                    if ((t->events = http_ssl_wants (t->ssl, n)) == 0)
+                        http_target_done (t, STATE_CRITICAL, _("Error on send"));
+                    return;
+                }
+            }
+            else
+#endif
+            if ((n = send (t->fd, piece, left, 0)) < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    t->events = POLLOUT;
+                else
+                    http_target_done (t, STATE_CRITICAL, strerror (errno));
+                return;
+            }
+            t->sent += n;
+        }
+        t->step = HTTP_STEP_RECV;
+        t->events = POLLIN;
+        /* FALLTHROUGH */
+
+    case HTTP_STEP_RECV:
+        for (;;) {
+            http_conn_reserve (&t->cb);
+#ifdef HAVE_SSL
+            if (t->ssl) {
+                if ((n = SSL_read (t->ssl, t->cb.data + t->cb.len, MAX_INPUT_BUFFER)) < 0) {
+                    if ((t->events = http_ssl_wants (t->ssl, n)) != 0)
+                        return;
+                    n = 0;  /* a reset counts as the end of the reply */
+                }
+            }
+            else
+#endif
+            if ((n = read (t->fd, t->cb.data + t->cb.len, MAX_INPUT_BUFFER)) < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    return;
+                if (errno != ECONNRESET) {
+                    http_target_done (t, STATE_CRITICAL, _("Error on receive"));
+                    return;
+                }
+                n = 0;
+            }
+            t->cb.len += n;
+            t->cb.data[t->cb.len] = '\0';
+
+            ret = http_take_reply (&t->cb, head_only, n == 0, &reply);
+            if (ret == HTTP_READ_MORE)
+                continue;
+            if (ret != HTTP_READ_OK) {
+                http_target_done (t, STATE_CRITICAL, ret == HTTP_READ_CLOSED
+                                  ? _("No data received from host") : _("Error on receive"));
+                return;
+            }
+
+            t->time = (double) deltime (t->start) / 1.0e6;
+            t->size = reply.size;
+            t->state = http_check_reply (u, t->address, &reply, t->time, &t->msg);
+            http_reply_free (&reply);
+            http_target_done (t, t->state, NULL);
+            return;
+        }
+
+    default:
+        return;
+    }
+}
+
+/* the first target not started yet that --max-inflight lets start, and
+ * that --max-rate has a token for; -1 if none may start now */
+static int
+http_target_next (struct http_target *targets, int next, struct http_target **active,
+                  nfds_t nactive, np_rate *rate, double now)
+{
+    nfds_t i, inflight;
+
+    for (; next < target_count; next++) {
+        if (targets[next].started)
+            continue;
+        for (i = inflight = 0; np_net_max_inflight && i < nactive; i++)
+            if (strcmp (active[i]->address, targets[next].address) == 0)
+                inflight++;
+        if (np_net_max_inflight == 0 || inflight < (nfds_t) np_net_max_inflight)
+            break;
+    }
+    if (next == target_count || !np_rate_take (rate, now))
+        return -1;
+    return next;
+}
+
+int
+check_http_parallel (void)
+{
+    struct http_url_check u;
+    struct http_target *targets, **active;
+    struct pollfd *pfd;
+    struct timeval run_start;
+    np_perfdata perf;
+    np_rate rate;
+    char *request, *problems = NULL;
+    char label[MAX_INPUT_BUFFER];
+    size_t request_len;
+    int head_only = strcmp (http_method, "HEAD") == 0;
+    nfds_t nactive = 0, i, j;
+    int next = 0, done = 0, count_ok = 0, result = STATE_OK;
+    int wait, ms, k, held;
+    double now;
+
+    /* -t bounds each target here, not the whole run */
+    alarm (0);
+    signal (SIGPIPE, SIG_IGN);
+    gettimeofday (&run_start, NULL);
+    np_rate_init (&rate, np_net_max_rate, 1);
+
+    targets = calloc (target_count, sizeof (*targets));
+    active = calloc (concurrency, sizeof (*active));
+    pfd = calloc (concurrency, sizeof (*pfd));
+    if (!targets || !active || !pfd)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+
+    memset (&u, 0, sizeof (u));
+    u.url = server_url;
+    u.thlds = thlds;
+    request = http_build_request (http_method, server_url, FALSE);
+    request_len = strlen (request);
+    if (verbose) printf ("%s\n", request);
+
+#ifdef HAVE_SSL
+    if (use_ssl == TRUE &&
+            np_net_ssl_ctx_new (&target_ssl_ctx, ssl_version, client_cert, client_privkey) != STATE_OK)
+        die (STATE_CRITICAL, NULL);
+#endif
+
+    for (k = 0; k < target_count; k++) {
+        targets[k].address = target_hosts[k];
+        targets[k].port = target_ports[k] ? target_ports[k] : server_port;
+        targets[k].host = strdup (target_hosts[k]);
+        if (targets[k].host == NULL)
+            die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+        /* [IPv6] or a :PORT of its own, from --connect-to */
+        if (target_ports[k])
+            *strrchr (targets[k].host, ':') = '\0';
+        if (*targets[k].host == '[') {
+            targets[k].host++;
+            targets[k].host[strcspn (targets[k].host, "]")] = '\0';
+        }
+        targets[k].fd = -1;
+    }
+
+    while (done < target_count) {
+        /* keep the pipe full, as far as the limits let it */
+        now = deltime (run_start) / 1.0e6;
+        while (nactive < (nfds_t) concurrency
+               && (k = http_target_next (targets, next, active, nactive, &rate, now)) >= 0) {
+            targets[k].started = TRUE;
+            http_target_connect (&targets[k]);
+            if (targets[k].step == HTTP_STEP_DONE)
+                done++;
+            else
+                active[nactive++] = &targets[k];
+            while (next < target_count && targets[next].started)
+                next++;
+        }
+        held = nactive < (nfds_t) concurrency && next < target_count;
+        np_rate_held (&rate, held, now);
+        if (nactive == 0 && !held)
+            continue;
+
+        /* till the next token, if that is what holds it */
+        wait = held && np_rate_delay (&rate, now) > 0 ? (int) (np_rate_delay (&rate, now) * 1000) + 1 : -1;
+        for (i = 0; i < nactive; i++) {
+            pfd[i].fd = active[i]->fd;
+            pfd[i].events = active[i]->events;
+            pfd[i].revents = 0;
+            ms = timeout_interval * 1000 - (int) (deltime (active[i]->start) / 1000);
+            if (ms < 0)
+                ms = 0;
+            if (wait < 0 || ms < wait)
+                wait = ms;
+        }
+
+        if (poll (pfd, nactive, wait) < 0 && errno != EINTR)
+            die (STATE_UNKNOWN, "%s %s\n", _("HTTP UNKNOWN - poll failed:"), strerror (errno));
+
+        for (i = 0; i < nactive; i++) {
+            if (pfd[i].revents)
+                http_target_step (active[i], request, request_len, head_only, &u);
+            else if (deltime (active[i]->start) >= (long) timeout_interval * 1000000L)
+                http_target_done (active[i], STATE_CRITICAL, _("Socket timeout"));
+        }
+
+        /* drop the finished ones */
+        for (i = j = 0; i < nactive; i++) {
+            if (active[i]->step == HTTP_STEP_DONE)
+                done++;
+            else
+                active[j++] = active[i];
+        }
+        nactive = j;
+    }
+    np_rate_held (&rate, FALSE, deltime (run_start) / 1.0e6);
+
+#ifdef HAVE_SSL
+    if (target_ssl_ctx) {
+        SSL_CTX_free (target_ssl_ctx);
+        target_ssl_ctx = NULL;
+    }
+#endif
+
+    np_perfdata_init (&perf);
+    for (k = 0; k < target_count; k++) {
+        result = max_state_alt (targets[k].state, result);
+        if (targets[k].state == STATE_OK)
+            count_ok++;
+        else
+            xasprintf (&problems, "%s%s%s", problems ? problems : "", problems ? "; " : "", targets[k].msg);
+
+        if (targets[k].size == 0)
+            continue;
+        snprintf (label, sizeof (label), "%s_time", targets[k].address);
+        np_perfdata_addf (&perf, label, targets[k].time, "s",
+                          thlds->warning ? TRUE : FALSE, thlds->warning ? thlds->warning->end : 0,
+                          thlds->critical ? TRUE : FALSE, thlds->critical ? thlds->critical->end : 0,
+                          TRUE, 0, FALSE, 0);
+        snprintf (label, sizeof (label), "%s_size", targets[k].address);
+        np_perfdata_add (&perf, label, (long) targets[k].size, "B",
+                         FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+    }
+    if (np_net_max_rate || np_net_max_inflight)
+        np_perfdata_addf (&perf, "throttled", rate.throttled, "s",
+                          FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+
+    /* with cluster thresholds, as check_cluster, by how many are down */
+    if (cluster_thlds) {
+        result = get_status (target_count - count_ok, cluster_thlds);
+        np_perfdata_add (&perf, "hosts_down", target_count - count_ok, "",
+                         cluster_thlds->warning ? TRUE : FALSE,
+                         cluster_thlds->warning ? (long) cluster_thlds->warning->end : 0,
+                         cluster_thlds->critical ? TRUE : FALSE,
+                         cluster_thlds->critical ? (long) cluster_thlds->critical->end : 0,
+                         TRUE, 0, TRUE, target_count);
+    }
+
+    printf ("HTTP %s: %d of %d hosts OK%s%s|%s\n", state_text (result), count_ok, target_count,
+            problems ? " - " : "", problems ? problems : "", np_perfdata_string (&perf));
+    for (k = 0; k < target_count; k++)
+        printf ("[%s] %s\n", state_text (targets[k].state), targets[k].msg);
+
+    np_exit (result);
+    return STATE_UNKNOWN;
+}
+#endif /* HAVE_POLL */
+
+
+/* per RFC 2396 */
+#define URI_HTTP "%5[HTPShtps]"
+#define URI_HOST "%255[-.abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789]"
+#define URI_PORT "%6d" /* MAX_PORT's width is 5 chars, 6 to detect overflow */
+#define URI_PATH "%[-_.!~*'();/?:@&=+$,%#abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789]"
 #define HD1 URI_HTTP "://" URI_HOST ":" URI_PORT "/" URI_PATH
 #define HD2 URI_HTTP "://" URI_HOST "/" URI_PATH
 #define HD3 URI_HTTP "://" URI_HOST ":" URI_PORT
@@ -1547,11 +4464,11 @@ check_http (void)
 #define HD6 URI_PATH
 
 void
-redir (char *pos, char *status_line)
+redir (const struct http_headers *headers, char *status_line)
 {
     int i = 0;
     char *x;
-    char xx[2];
+    char *location, *pos;
     char type[6];
     char *addr;
     char *url;
@@ -1561,100 +4478,79 @@ redir (char *pos, char *status_line)
         die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate addr\n"));
 
     memset(addr, 0, MAX_IPV4_HOSTLENGTH);
-    url = malloc (strcspn (pos, "\r\n"));
-    if (url == NULL)
-        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate URL\n"));
-
-    while (pos) {
-        sscanf (pos, "%1[Ll]%*1[Oo]%*1[Cc]%*1[Aa]%*1[Tt]%*1[Ii]%*1[Oo]%*1[Nn]:%n", xx, &i);
-        if (i == 0) {
-            pos += (size_t) strcspn (pos, "\r\n");
-            pos += (size_t) strspn (pos, "\r\n");
-            if (strlen(pos) == 0)
-                die (STATE_UNKNOWN,
-                     _("HTTP UNKNOWN - Could not find redirect location - %s%s\n"),
-                     status_line, (display_html ? "</A>" : ""));
-            continue;
-        }
 
-        pos += i;
-        pos += strspn (pos, " \t");
+    if ((location = header_value (headers, "Location")) == NULL)
+        die (STATE_UNKNOWN,
+             _("HTTP UNKNOWN - Could not find redirect location - %s%s\n"),
+             status_line, (display_html ? "</A>" : ""));
 
-        /*
-         * RFC 2616 (4.2):  ``Header fields can be extended over multiple lines by
-         * preceding each extra line with at least one SP or HT.''
-         */
-        for (; (i = strspn (pos, "\r\n")); pos += i) {
-            pos += i;
-            if (!(i = strspn (pos, " \t"))) {
-                die (STATE_UNKNOWN, _("HTTP UNKNOWN - Empty redirect location%s\n"),
-                     display_html ? "</A>" : "");
-            }
-        }
+    /* a value folded onto the next line (RFC 2616, 4.2) starts there */
+    pos = location + strspn (location, " \t\r\n");
+    if (*pos == '\0')
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Empty redirect location%s\n"),
+             display_html ? "</A>" : "");
 
-        url = realloc (url, strcspn (pos, "\r\n") + 1);
-        if (url == NULL)
-            die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate URL\n"));
+    url = malloc (strlen (pos) + 1);
+    if (url == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate URL\n"));
 
-        /* URI_HTTP, URI_HOST, URI_PORT, URI_PATH */
-        if (sscanf (pos, HD1, type, addr, &i, url) == 4) {
-            url = prepend_slash (url);
-            use_ssl = server_type_check (type);
-        }
+    /* URI_HTTP, URI_HOST, URI_PORT, URI_PATH */
+    if (sscanf (pos, HD1, type, addr, &i, url) == 4) {
+        url = prepend_slash (url);
+        use_ssl = server_type_check (type);
+    }
 
-        /* URI_HTTP URI_HOST URI_PATH */
-        else if (sscanf (pos, HD2, type, addr, url) == 3 ) {
-            url = prepend_slash (url);
-            use_ssl = server_type_check (type);
-            i = server_port_check (use_ssl);
-        }
+    /* URI_HTTP URI_HOST URI_PATH */
+    else if (sscanf (pos, HD2, type, addr, url) == 3 ) {
+        url = prepend_slash (url);
+        use_ssl = server_type_check (type);
+        i = server_port_check (use_ssl);
+    }
 
-        /* URI_HTTP URI_HOST URI_PORT */
-        else if (sscanf (pos, HD3, type, addr, &i) == 3) {
-            strcpy (url, HTTP_URL);
-            use_ssl = server_type_check (type);
-        }
+    /* URI_HTTP URI_HOST URI_PORT */
+    else if (sscanf (pos, HD3, type, addr, &i) == 3) {
+        strcpy (url, HTTP_URL);
+        use_ssl = server_type_check (type);
+    }
 
-        /* URI_HTTP URI_HOST */
-        else if (sscanf (pos, HD4, type, addr) == 2) {
-            strcpy (url, HTTP_URL);
-            use_ssl = server_type_check (type);
-            i = server_port_check (use_ssl);
-        }
+    /* URI_HTTP URI_HOST */
+    else if (sscanf (pos, HD4, type, addr) == 2) {
+        strcpy (url, HTTP_URL);
+        use_ssl = server_type_check (type);
+        i = server_port_check (use_ssl);
+    }
 
-        /* URI_HTTP, URI_HOST, URI_PATH */
-        else if (sscanf (pos, HD5, addr, url) == 2) {
-            if(use_ssl)
-                strcpy (type,"https");
-            else
-                strcpy (type,server_type);
-            xasprintf(&url, "/%s", url);
-            use_ssl = server_type_check (type);
-            i = server_port_check (use_ssl);
-        }
-
-        /* URI_PATH */
-        else if (sscanf (pos, HD6, url) == 1) {
-            /* relative url */
-            if ((url[0] != '/')) {
-                if ((x = strrchr(server_url, '/')))
-                    *x = '\0';
-                xasprintf (&url, "%s/%s", server_url, url);
-            }
-            i = server_port;
-            strcpy (type, server_type);
-            strcpy (addr, host_name ? host_name : server_address);
-        }
+    /* URI_HTTP, URI_HOST, URI_PATH */
+    else if (sscanf (pos, HD5, addr, url) == 2) {
+        if(use_ssl)
+            strcpy (type,"https");
+        else
+            strcpy (type,server_type);
+        xasprintf(&url, "/%s", url);
+        use_ssl = server_type_check (type);
+        i = server_port_check (use_ssl);
+    }
 
-        else {
-            die (STATE_UNKNOWN,
-                 _("HTTP UNKNOWN - Could not parse redirect location - %s%s\n"),
-                 pos, (display_html ? "</A>" : ""));
+    /* URI_PATH */
+    else if (sscanf (pos, HD6, url) == 1) {
+        /* relative url */
+        if ((url[0] != '/')) {
+            if ((x = strrchr(server_url, '/')))
+                *x = '\0';
+            xasprintf (&url, "%s/%s", server_url, url);
         }
+        i = server_port;
+        strcpy (type, server_type);
+        strcpy (addr, host_name ? host_name : server_address);
+    }
 
-        break;
+    else {
+        die (STATE_UNKNOWN,
+             _("HTTP UNKNOWN - Could not parse redirect location - %s%s\n"),
+             pos, (display_html ? "</A>" : ""));
+    }
 
-    } /* end while (pos) */
+    free (location);
 
     if (++redir_depth > max_depth)
         die (STATE_WARNING,
@@ -1811,13 +4707,41 @@ print_help (void)
     printf ("    %s\n", _(" --continue-after-certificate to override this behavior)"));
     printf (" %s\n", "--continue-after-certificate");
     printf ("    %s\n", _("Allows the HTTP check to continue after performing the certificate check."));
-    printf ("    %s\n", _("Does nothing unless -C is used."));
+    printf ("    %s\n", _("Does nothing unless -C or --ocsp is used."));
     printf (" %s\n", "-J, --client-cert=FILE");
     printf ("   %s\n", _("Name of file that contains the client certificate (PEM format)"));
     printf ("   %s\n", _("to be used in establishing the SSL session"));
     printf (" %s\n", "-K, --private-key=FILE");
     printf ("   %s\n", _("Name of file containing the private key (PEM format)"));
     printf ("   %s\n", _("matching the client certificate"));
+    printf (" %s\n", "--tls-session-cache");
+    printf ("    %s\n", _("Resume TLS sessions from a cache kept in the state directory, and report"));
+    printf ("    %s\n", _("whether the session was resumed as the tls_resumed perfdata."));
+    printf (" %s\n", "--tls-full-handshake");
+    printf ("    %s\n", _("Do not resume a cached session, but cache the new one (for testing a"));
+    printf ("    %s\n", _("certificate rollout)"));
+    printf (" %s\n", "--tls-early-data");
+    printf ("    %s\n", _("Send a GET or HEAD request as TLS 1.3 early data (0-RTT) when the cached"));
+    printf ("    %s\n", _("session allows it, saving a round trip, and report whether the server took"));
+    printf ("    %s\n", _("it as the tls_early_data perfdata; if not, it is sent again after the"));
+    printf ("    %s\n", _("handshake. Implies --tls-session-cache."));
+    printf (" %s\n", "--ocsp[=WARN_HOURS[,CRIT_HOURS]]");
+    printf ("    %s\n", _("Ask the server to staple the OCSP status of its certificate to the handshake"));
+    printf ("    %s\n", _("and check it like -C: CRITICAL if it is revoked, unknown or cannot be"));
+    printf ("    %s\n", _("verified, and WARNING or CRITICAL when its next update is no more than the"));
+    printf ("    %s\n", _("given hours away (default: 24,4), as a stapling server failing to refresh it"));
+    printf ("    %s\n", _("would have it. Nothing stapled is a WARNING."));
+    printf (" %s\n", "--ocsp-fetch");
+    printf ("    %s\n", _("With nothing stapled, ask the certificate's OCSP responder instead, keeping"));
+    printf ("    %s\n", _("its answer in the state directory until its next update. Implies --ocsp."));
+#endif
+#ifdef HAVE_NGHTTP2
+    printf (" %s\n", "--http2");
+    printf ("    %s\n", _("Use HTTP/2, negotiated through ALPN (with -S). It is CRITICAL if the server"));
+    printf ("    %s\n", _("does not agree to it. --multi-url URLs are sent as concurrent streams."));
+    printf ("    %s\n", _("Note that HTTP/2 header names are lower case, which matters to -d."));
+    printf (" %s\n", "--http2-prior-knowledge");
+    printf ("    %s\n", _("Use HTTP/2 without negotiating it first, for plaintext h2c servers"));
 #endif
 
     printf (" %s\n", "-e, --expect=STRING");
@@ -1835,11 +4759,17 @@ print_help (void)
     printf ("    %s\n", _("(deprecated) URL to GET or POST (default: /)"));
     printf (" %s\n", "-P, --post=STRING");
     printf ("    %s\n", _("URL encoded http POST data"));
+    printf (" %s\n", "--post-file=FILE");
+    printf ("    %s\n", _("POST the contents of FILE, sent from a mapping of it rather than read into memory"));
     printf (" %s\n", "-j, --method=STRING  (for example: HEAD, OPTIONS, TRACE, PUT, DELETE, CONNECT)");
     printf ("    %s\n", _("Set HTTP method."));
     printf (" %s\n", "-N, --no-body");
     printf ("    %s\n", _("Don't wait for document body: stop reading after headers."));
     printf ("    %s\n", _("(Note that this still does an HTTP GET or POST, not a HEAD.)"));
+    printf (" %s\n", "--max-body=BYTES");
+    printf ("    %s\n", _("Stop reading the body after BYTES. -s and -r only see that much."));
+    printf (" %s\n", "--stop-on-match");
+    printf ("    %s\n", _("Stop reading the body once -s and -r have matched"));
     printf (" %s\n", "-M, --max-age=SECONDS");
     printf ("    %s\n", _("Warn if document is more than SECONDS old. the number can also be of"));
     printf ("    %s\n", _("the form \"10m\" for minutes, \"10h\" for hours, or \"10d\" for days."));
@@ -1872,13 +4802,51 @@ print_help (void)
     printf (" %s\n", "-f, --onredirect=<ok|warning|critical|follow|sticky|stickyport>");
     printf ("    %s\n", _("How to handle redirected pages. sticky is like follow but stick to the"));
     printf ("    %s\n", _("specified IP address. stickyport also ensures port stays the same."));
+    printf ("    %s\n", _("Redirects to the same origin reuse the connection. The time of each"));
+    printf ("    %s\n", _("hop is reported as redirect<N>_time perfdata."));
     printf (" %s\n", "-m, --pagesize=INTEGER<:INTEGER>");
     printf ("    %s\n", _("Minimum page size required (bytes) : Maximum page size required (bytes)"));
+    printf (" %s\n", "--compressed");
+    printf ("    %s\n", _("Ask for a compressed body (Accept-Encoding), decoded as it arrives for -s and"));
+    printf ("    %s\n", _("-r, and add the decoded size_decoded to the perfdata"));
+    printf (" %s\n", "--decoded-size");
+    printf ("    %s\n", _("Check -m against the decoded size rather than the bytes received"));
+    printf (" %s\n", "--conditional");
+    printf ("    %s\n", _("Keep the ETag and Last-Modified of the page, and ask with If-None-Match and"));
+    printf ("    %s\n", _("If-Modified-Since on the next run; a 304 Not Modified reply is the page"));
+    printf ("    %s\n", _("unchanged, and -s, -r and -m keep the results of the run that got it"));
+    printf (" %s\n", "--multi-url=PATH");
+    printf ("    %s\n", _("URL to check over one shared keep-alive connection, instead of -u."));
+    printf ("    %s\n", _("Repeat for each URL. The state is the worst of all URLs."));
+    printf (" %s\n", "--url-expect=STRING, --url-string=STRING, --url-regex=STRING");
+    printf (" %s\n", "--url-warning=DOUBLE, --url-critical=DOUBLE");
+    printf ("    %s\n", _("Like -e, -s, -r, -w and -c, for the --multi-url given last. They default"));
+    printf ("    %s\n", _("to the values of those options."));
+    printf (" %s\n", "--pipeline");
+    printf ("    %s\n", _("Send all --multi-url requests at once rather than waiting for each reply"));
+    printf (" %s\n", "--hosts=ADDRESS[,ADDRESS...]");
+    printf ("    %s\n", _("Run the check against each of these servers in parallel, instead of -I."));
+    printf ("    %s\n", _("May be repeated. The state is the worst of all hosts and -t is per host."));
+    printf (" %s\n", "--connect-to=HOST:PORT:ADDRESS[,ADDRESS...]");
+    printf ("    %s\n", _("Check HOST:PORT (-H and -p; empty for any) at each ADDRESS[:PORT] instead,"));
+    printf ("    %s\n", _("in parallel as with --hosts, with the Host header and SNI of -H. May be"));
+    printf ("    %s\n", _("repeated; the first that matches is used."));
+    printf (" %s\n", "--cluster-warning=THRESHOLD, --cluster-critical=THRESHOLD");
+    printf ("    %s\n", _("As check_cluster, the number of --hosts or --connect-to servers that may"));
+    printf ("    %s\n", _("be other than OK, instead of the state being the worst of them"));
+    printf (" %s\n", "--concurrency=INTEGER");
+    printf ("    %s\n", _("Number of --hosts checked at the same time (default: 64)"));
+    printf (UT_MAX_RATE, _("--hosts checks"));
+    printf (UT_MAX_INFLIGHT, _("--hosts checks"));
 
     printf (UT_WARN_CRIT);
 
     printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
+    printf (UT_TCP_FASTOPEN);
+
+    printf (UT_ADAPTIVE_TIMEOUT);
+
     printf (UT_VERBOSE);
 
     printf ("\n");
@@ -1926,6 +4894,9 @@ print_help (void)
     printf (" %s\n", _("a STATE_OK will be returned. When the server returns its content but exceeds"));
     printf (" %s\n", _("the 5-second threshold, a STATE_WARNING will be returned. When an error occurs,"));
     printf (" %s\n", _("a STATE_CRITICAL will be returned."));
+    printf (" %s\n", _("The proxy must answer the CONNECT with 2xx, -b is sent with it rather than to"));
+    printf (" %s\n", _("the server, and -E adds the time the tunnel took as time_proxy. With --multi-url"));
+    printf (" %s\n", _("all the URLs go through one tunnel, opened again only if it is closed."));
 
 #endif
 
@@ -1944,7 +4915,18 @@ print_usage (void)
     printf ("       [-w <warn time>] [-c <critical time>] [-t <timeout>] [-L] [-E] [-U] [-a auth]\n");
     printf ("       [-b proxy_auth] [-f <ok|warning|critical|follow|sticky|stickyport>]\n");
     printf ("       [-e <expect>] [-d string] [-s string] [-l] [-r <regex> | -R <case-insensitive regex>]\n");
-    printf ("       [-P string] [-m <min_pg_size>:<max_pg_size>] [-4|-6] [-N] [-M <age>]\n");
+    printf ("       [-P string] [--post-file=FILE] [-m <min_pg_size>:<max_pg_size>] [-4|-6] [-N] [-M <age>]\n");
+    printf ("       [--max-body <bytes>] [--stop-on-match] [--compressed] [--decoded-size]\n");
+    printf ("       [--conditional]\n");
+    printf ("       [--multi-url <uri> [--url-expect|--url-string|--url-regex <string>]\n");
+    printf ("       [--url-warning|--url-critical <time>]]... [--pipeline]\n");
+    printf ("       [--hosts <address>[,<address>...]] [--concurrency <n>]\n");
+    printf ("       [--connect-to <host>:<port>:<address>[,<address>...]]\n");
+    printf ("       [--cluster-warning <range>] [--cluster-critical <range>]\n");
+    printf ("       [--max-rate <rate>] [--max-inflight <n>]\n");
+    printf ("       [--tls-session-cache] [--tls-full-handshake] [--tls-early-data]\n");
+    printf ("       [--ocsp[=<warn hours>[,<crit hours>]]] [--ocsp-fetch]\n");
+    printf ("       [--http2 | --http2-prior-knowledge] [--tcp-fastopen] [--adaptive-timeout]\n");
 
 #if OPENSSL_VERSION_NUMBER >= 0x10002000L
     printf ("       [-A string] [-k string] [-S <version>] [--sni] [--verify-host]\n");
@@ -0,0 +1,628 @@
+/*****************************************************************************
+*
+* Nagios check_hwmon plugin
+*
+* License: GPL
+* Copyright (c) 2026 Nagios Plugins Development Team
+*
+* Description:
+*
+* This file contains the check_hwmon plugin
+*
+* Checks the temperature, fan and voltage sensors the kernel has under
+* /sys/class/hwmon, as check_sensors does through lm-sensors but with
+* neither a shell nor sensors(1): each hwmon device is read in one pass
+* over its directory, the attributes of its sensors relative to one
+* descriptor of it.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+const char *progname = "check_hwmon";
+const char *copyright = "2026";
+const char *email = "devel@nagios-plugins.org";
+
+#include "common.h"
+#include "utils.h"
+#include "utils_base.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+
+#define HWMON_DIR "/sys/class/hwmon"
+
+enum {
+	HWMON_DIR_OPTION = CHAR_MAX + 1
+};
+
+enum {
+	SENSOR_TEMP,
+	SENSOR_FAN,
+	SENSOR_IN
+};
+
+/* the attributes read of each sensor, as the bits of hwmon_sensor.have */
+#define HAVE_INPUT 1
+#define HAVE_LABEL 2
+#define HAVE_MAX   4
+#define HAVE_CRIT  8
+
+typedef struct hwmon_sensor {
+	char *id;                 /* chip/label, or chip/temp1 without a label */
+	char *attr_id;            /* chip/temp1 whatever the label */
+	const char *name;         /* as shown: its --label, or the id */
+	int type;
+	int index;
+	int chip;                 /* the order of its chip, for sorting */
+	unsigned int have;
+	double value;
+	double max;
+	double crit;
+	int alarm;                /* the state the kernel's alarm flags give it */
+	int fault;
+	struct sensor_check *check;
+	int state;
+	char *label;
+} hwmon_sensor;
+
+/* what each -s applies to its sensors: the -w and -c before it */
+typedef struct sensor_check {
+	const char *pattern;
+	char *warning;
+	char *critical;
+	thresholds *limits;
+	int matched;
+} sensor_check;
+
+typedef struct sensor_label {
+	const char *pattern;
+	const char *name;
+} sensor_label;
+
+static const struct {
+	const char *prefix;
+	const char *uom;
+	double scale;
+	const char *format;
+} sensor_types[] = {
+	{ "temp", "C", 1000, "%.1f C" },
+	{ "fan", "RPM", 1, "%.0f RPM" },
+	{ "in", "V", 1000, "%.3f V" }
+};
+
+int process_arguments (int, char **);
+void print_help (void);
+void print_usage (void);
+void scan_hwmon (void);
+void scan_chip (int dirfd, const char *chip, int seq);
+int read_attr (int dirfd, const char *name, char *buf, size_t size);
+int parse_attr (const char *name, int *type, int *index, const char **attr);
+hwmon_sensor *find_sensor (int chip, int type, int index);
+int sensor_matches (const hwmon_sensor *, const char *pattern);
+int sensor_cmp (const void *, const void *);
+
+const char *hwmon_dir = HWMON_DIR;
+sensor_check *checks = NULL;
+size_t nchecks = 0;
+char **excludes = NULL;
+size_t nexcludes = 0;
+sensor_label *labels = NULL;
+size_t nlabels = 0;
+char *warning = NULL;
+char *critical = NULL;
+int ignore_fault = FALSE;
+int verbose = 0;
+
+hwmon_sensor *sensors = NULL;
+size_t nsensors = 0;
+size_t sensors_size = 0;
+/* the sensors of the chip being scanned start here */
+size_t chip_start = 0;
+/* the name of each chip so far, for telling those of the same name apart */
+char **chips = NULL;
+
+int
+main (int argc, char **argv)
+{
+	int result = STATE_OK, count_ok = 0, count = 0;
+	char *problems = NULL, value[64], warn[32], crit[32];
+	hwmon_sensor *s;
+	np_perfdata perf;
+	size_t i, j;
+
+	/* Parse extra opts if any */
+	argv = np_extra_opts (&argc, argv, progname);
+
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	/* Set signal handling and alarm timeout */
+	if (signal (SIGALRM, timeout_alarm_handler) == SIG_ERR)
+		usage4 (_("Cannot catch SIGALRM"));
+	alarm (timeout_interval);
+
+	scan_hwmon ();
+	if (nsensors == 0)
+		die (STATE_UNKNOWN, _("SENSORS UNKNOWN: No sensors found in %s\n"), hwmon_dir);
+	qsort (sensors, nsensors, sizeof (hwmon_sensor), sensor_cmp);
+
+	np_perfdata_init (&perf);
+	for (i = 0; i < nsensors; i++) {
+		s = &sensors[i];
+
+		for (j = 0; j < nexcludes; j++)
+			if (sensor_matches (s, excludes[j]))
+				break;
+		if (j < nexcludes)
+			continue;
+
+		/* the first -s a sensor matches checks it; without any, all are */
+		s->check = NULL;
+		for (j = 0; j < nchecks; j++)
+			if (sensor_matches (s, checks[j].pattern)) {
+				s->check = &checks[j];
+				checks[j].matched++;
+				break;
+			}
+		if (nchecks && s->check == NULL)
+			continue;
+
+		s->name = s->id;
+		for (j = 0; j < nlabels; j++)
+			if (sensor_matches (s, labels[j].pattern)) {
+				s->name = labels[j].name;
+				break;
+			}
+
+		if (s->fault || !(s->have & HAVE_INPUT)) {
+			if (ignore_fault)
+				continue;
+			s->state = STATE_UNKNOWN;
+			xasprintf (&s->label, _("fault"));
+		} else {
+			snprintf (value, sizeof (value), sensor_types[s->type].format, s->value);
+			s->state = s->alarm;
+
+			/* the chip's own limits, where it has no alarm flags for them */
+			if (s->type == SENSOR_TEMP && s->alarm == STATE_OK) {
+				if ((s->have & HAVE_CRIT) && s->value >= s->crit)
+					s->state = STATE_CRITICAL;
+				else if ((s->have & HAVE_MAX) && s->value >= s->max)
+					s->state = STATE_WARNING;
+			}
+			if (s->check && s->check->limits)
+				s->state = max_state_alt (s->state, get_status (s->value, s->check->limits));
+
+			xasprintf (&s->label, "%s%s", value, s->alarm != STATE_OK ? _(" (alarm)") : "");
+
+			warn[0] = crit[0] = '\0';
+			if (s->check && (s->check->warning || s->check->critical)) {
+				snprintf (warn, sizeof (warn), "%s", s->check->warning ? s->check->warning : "");
+				snprintf (crit, sizeof (crit), "%s", s->check->critical ? s->check->critical : "");
+			} else if (s->type == SENSOR_TEMP) {
+				if (s->have & HAVE_MAX)
+					snprintf (warn, sizeof (warn), "%g", s->max);
+				if (s->have & HAVE_CRIT)
+					snprintf (crit, sizeof (crit), "%g", s->crit);
+			}
+			np_perfdata_adds (&perf, s->name, s->value, sensor_types[s->type].uom,
+			                  warn, crit, FALSE, 0, FALSE, 0);
+		}
+
+		count++;
+		result = max_state_alt (s->state, result);
+		if (s->state == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           s->name, s->label);
+	}
+
+	/* a -s for a sensor that is not there is as bad as its not being looked at */
+	for (j = 0; j < nchecks; j++)
+		if (!checks[j].matched) {
+			result = max_state_alt (STATE_UNKNOWN, result);
+			xasprintf (&problems, _("%s%sno sensor matches %s"), problems ? problems : "",
+			           problems ? "; " : "", checks[j].pattern);
+		}
+
+	printf (_("SENSORS %s: %d of %d sensors OK%s%s|%s\n"), state_text (result), count_ok, count,
+	        problems ? " - " : "", problems ? problems : "", np_perfdata_string (&perf));
+	if (verbose)
+		for (i = 0; i < nsensors; i++)
+			if (sensors[i].label)
+				printf ("[%s] %s: %s\n", state_text (sensors[i].state), sensors[i].name, sensors[i].label);
+	np_perfdata_free (&perf);
+
+	return result;
+}
+
+
+
+/* every hwmon device of hwmon_dir, in the order of their numbers */
+void
+scan_hwmon (void)
+{
+	struct dirent **entries;
+	int n, i, top, fd, seq = 0;
+
+	if ((top = open (hwmon_dir, O_RDONLY | O_DIRECTORY)) < 0
+	    || (n = scandir (hwmon_dir, &entries, NULL, versionsort)) < 0)
+		die (STATE_UNKNOWN, _("SENSORS UNKNOWN: Cannot read %s: %s\n"), hwmon_dir, strerror (errno));
+
+	for (i = 0; i < n; i++) {
+		if (entries[i]->d_name[0] != '.'
+		    && (fd = openat (top, entries[i]->d_name, O_RDONLY | O_DIRECTORY)) >= 0)
+			scan_chip (fd, entries[i]->d_name, seq++);
+		free (entries[i]);
+	}
+	free (entries);
+	close (top);
+}
+
+
+
+/* the sensors of one hwmon device; fd is closed. Older kernels keep the
+ * attributes in its device directory instead. */
+void
+scan_chip (int fd, const char *dev, int seq)
+{
+	char chip[128], buf[128], *id;
+	const char *attr;
+	struct dirent *de;
+	hwmon_sensor *s;
+	DIR *dir;
+	int type, index, sub, dups;
+	size_t i;
+
+	if (read_attr (fd, "name", chip, sizeof (chip)) < 0) {
+		if ((sub = openat (fd, "device", O_RDONLY | O_DIRECTORY)) >= 0
+		    && read_attr (sub, "name", chip, sizeof (chip)) == 0) {
+			close (fd);
+			fd = sub;
+		} else {
+			if (sub >= 0)
+				close (sub);
+			snprintf (chip, sizeof (chip), "%s", dev);
+		}
+	}
+
+	/* a second chip of the same name is chip.1, and so on */
+	chips = realloc (chips, (seq + 1) * sizeof (char *));
+	chips[seq] = strdup (chip);
+	for (dups = i = 0; i < (size_t) seq; i++)
+		if (!strcmp (chips[i], chips[seq]))
+			dups++;
+	if (dups)
+		snprintf (chip + strlen (chip), sizeof (chip) - strlen (chip), ".%d", dups);
+
+	if ((dir = fdopendir (fd)) == NULL) {
+		close (fd);
+		return;
+	}
+
+	chip_start = nsensors;
+	while ((de = readdir (dir)) != NULL) {
+		if (!parse_attr (de->d_name, &type, &index, &attr))
+			continue;
+		s = find_sensor (seq, type, index);
+
+		if (!strcmp (attr, "input")) {
+			/* faulty sensors fail to be read */
+			if (read_attr (fd, de->d_name, buf, sizeof (buf)) < 0)
+				s->fault = TRUE;
+			else {
+				s->value = strtod (buf, NULL) / sensor_types[type].scale;
+				s->have |= HAVE_INPUT;
+			}
+		} else if (read_attr (fd, de->d_name, buf, sizeof (buf)) < 0)
+			continue;
+		else if (!strcmp (attr, "label")) {
+			s->id = strdup (buf);
+			s->have |= HAVE_LABEL;
+		} else if (!strcmp (attr, "max")) {
+			s->max = strtod (buf, NULL) / sensor_types[type].scale;
+			s->have |= HAVE_MAX;
+		} else if (!strcmp (attr, "crit")) {
+			s->crit = strtod (buf, NULL) / sensor_types[type].scale;
+			s->have |= HAVE_CRIT;
+		} else if (!strcmp (attr, "fault"))
+			s->fault = atoi (buf) != 0;
+		else if (atoi (buf) == 0)
+			;
+		else if (!strcmp (attr, "alarm") || !strcmp (attr, "crit_alarm")
+		         || !strcmp (attr, "lcrit_alarm") || !strcmp (attr, "emergency_alarm"))
+			s->alarm = STATE_CRITICAL;
+		else if (!strcmp (attr, "max_alarm") || !strcmp (attr, "min_alarm"))
+			s->alarm = max_state_alt (s->alarm, STATE_WARNING);
+	}
+	closedir (dir);
+
+	for (i = chip_start; i < nsensors; i++) {
+		s = &sensors[i];
+		xasprintf (&s->attr_id, "%s/%s%d", chip, sensor_types[s->type].prefix, s->index);
+		if (s->id) {
+			xasprintf (&id, "%s/%s", chip, s->id);
+			free (s->id);
+			s->id = id;
+		} else
+			s->id = s->attr_id;
+	}
+}
+
+
+
+/* the first line of attribute name of dirfd, or -1 */
+int
+read_attr (int dirfd, const char *name, char *buf, size_t size)
+{
+	ssize_t len;
+	int fd;
+
+	if ((fd = openat (dirfd, name, O_RDONLY)) < 0)
+		return -1;
+	len = read (fd, buf, size - 1);
+	close (fd);
+	if (len < 0)
+		return -1;
+	buf[len] = '\0';
+	buf[strcspn (buf, "\n")] = '\0';
+	return 0;
+}
+
+
+
+/* temp1_input and the like: TRUE for the attributes of sensors of a type
+ * checked here, with the type, the number and what follows the '_' */
+int
+parse_attr (const char *name, int *type, int *index, const char **attr)
+{
+	size_t i, len;
+	char *end;
+
+	for (i = 0; i < sizeof (sensor_types) / sizeof (sensor_types[0]); i++) {
+		len = strlen (sensor_types[i].prefix);
+		if (strncmp (name, sensor_types[i].prefix, len) || !isdigit ((unsigned char) name[len]))
+			continue;
+		*index = (int) strtol (name + len, &end, 10);
+		if (*end != '_')
+			return FALSE;
+		*type = (int) i;
+		*attr = end + 1;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+
+
+/* the sensor of the chip being scanned, added if it is new */
+hwmon_sensor *
+find_sensor (int chip, int type, int index)
+{
+	size_t i;
+
+	for (i = chip_start; i < nsensors; i++)
+		if (sensors[i].type == type && sensors[i].index == index)
+			return &sensors[i];
+
+	if (nsensors == sensors_size) {
+		sensors_size = sensors_size ? sensors_size * 2 : 32;
+		sensors = realloc (sensors, sensors_size * sizeof (hwmon_sensor));
+		if (sensors == NULL)
+			die (STATE_UNKNOWN, _("SENSORS UNKNOWN: %s\n"), _("Cannot allocate memory"));
+	}
+	memset (&sensors[nsensors], 0, sizeof (hwmon_sensor));
+	sensors[nsensors].chip = chip;
+	sensors[nsensors].type = type;
+	sensors[nsensors].index = index;
+	sensors[nsensors].alarm = STATE_OK;
+	return &sensors[nsensors++];
+}
+
+
+
+/* patterns match the chip/label of a sensor or its chip/temp1 */
+int
+sensor_matches (const hwmon_sensor *s, const char *pattern)
+{
+	return fnmatch (pattern, s->id, 0) == 0 || fnmatch (pattern, s->attr_id, 0) == 0;
+}
+
+
+
+/* by chip, then temperatures, fans and voltages, each by number */
+int
+sensor_cmp (const void *a, const void *b)
+{
+	const hwmon_sensor *x = a, *y = b;
+
+	if (x->chip != y->chip)
+		return x->chip - y->chip;
+	if (x->type != y->type)
+		return x->type - y->type;
+	return x->index - y->index;
+}
+
+
+
+/* process command-line arguments */
+int
+process_arguments (int argc, char **argv)
+{
+	int c;
+	char *p;
+
+	int option = 0;
+	static struct option longopts[] = {
+		{"sensor", required_argument, 0, 's'},
+		{"exclude", required_argument, 0, 'x'},
+		{"label", required_argument, 0, 'l'},
+		{"warning", required_argument, 0, 'w'},
+		{"critical", required_argument, 0, 'c'},
+		{"ignore-fault", no_argument, 0, 'i'},
+		{"timeout", required_argument, 0, 't'},
+		{"hwmon-dir", required_argument, 0, HWMON_DIR_OPTION},
+		{"version", no_argument, 0, 'V'},
+		{"help", no_argument, 0, 'h'},
+		{"verbose", no_argument, 0, 'v'},
+		{0, 0, 0, 0}
+	};
+
+	while (1) {
+		c = getopt_long (argc, argv, "hVvis:x:l:w:c:t:", longopts, &option);
+
+		if (c == -1 || c == EOF)
+			break;
+
+		switch (c) {
+		case 'h':									/* help */
+			print_help ();
+			exit (STATE_OK);
+		case 'V':									/* version */
+			print_revision (progname, NP_VERSION);
+			exit (STATE_OK);
+		case 's':									/* sensors, with the -w and -c so far */
+			checks = realloc (checks, (nchecks + 1) * sizeof (sensor_check));
+			checks[nchecks].pattern = optarg;
+			checks[nchecks].warning = warning;
+			checks[nchecks].critical = critical;
+			checks[nchecks].limits = NULL;
+			checks[nchecks].matched = 0;
+			if (warning || critical)
+				set_thresholds (&checks[nchecks].limits, warning, critical);
+			nchecks++;
+			break;
+		case 'x':
+			excludes = realloc (excludes, (nexcludes + 1) * sizeof (char *));
+			excludes[nexcludes++] = optarg;
+			break;
+		case 'l':									/* PATTERN=NAME */
+			if ((p = strchr (optarg, '=')) == NULL || p == optarg || !p[1])
+				usage2 (_("Labels are given as SENSOR=NAME"), optarg);
+			labels = realloc (labels, (nlabels + 1) * sizeof (sensor_label));
+			*p = '\0';
+			labels[nlabels].pattern = optarg;
+			labels[nlabels].name = p + 1;
+			nlabels++;
+			break;
+		case 'w':
+			warning = optarg;
+			break;
+		case 'c':
+			critical = optarg;
+			break;
+		case 'i':
+			ignore_fault = TRUE;
+			break;
+		case 't':									/* timeout */
+			timeout_interval = parse_timeout_string (optarg);
+			break;
+		case HWMON_DIR_OPTION:
+			hwmon_dir = optarg;
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			usage5 ();
+		}
+	}
+
+	/* thresholds without a -s after them are for all sensors */
+	if ((warning || critical)
+	    && (nchecks == 0 || checks[nchecks - 1].warning != warning
+	        || checks[nchecks - 1].critical != critical)) {
+		if (nchecks)
+			usage4 (_("-w and -c apply to the -s after them"));
+		checks = malloc (sizeof (sensor_check));
+		checks[0].pattern = "*";
+		checks[0].warning = warning;
+		checks[0].critical = critical;
+		checks[0].limits = NULL;
+		checks[0].matched = 0;
+		set_thresholds (&checks[0].limits, warning, critical);
+		nchecks = 1;
+	}
+
+	return OK;
+}
+
+
+
+void
+print_help (void)
+{
+	print_revision (progname, NP_VERSION);
+
+	printf (_(COPYRIGHT), copyright, email);
+
+	printf ("%s\n", _("This plugin checks the temperature, fan and voltage sensors of the kernel's"));
+	printf ("%s\n", _("hwmon drivers, reading them from sysfs itself."));
+
+	printf ("\n\n");
+
+	print_usage ();
+
+	printf (UT_HELP_VRSN);
+	printf (UT_EXTRA_OPTS);
+
+	printf (" %s\n", "-s, --sensor=SENSOR");
+	printf ("    %s\n", _("Check the sensors matching this glob pattern against the -w and -c given"));
+	printf ("    %s\n", _("before it; may be repeated, and only these sensors are checked then"));
+	printf (" %s\n", "-x, --exclude=SENSOR");
+	printf ("    %s\n", _("Leave out the sensors matching this pattern (may be repeated)"));
+	printf (" %s\n", "-l, --label=SENSOR=NAME");
+	printf ("    %s\n", _("Show the sensors matching the pattern as NAME (may be repeated)"));
+	printf (" %s\n", "-w, --warning=RANGE");
+	printf ("    %s\n", _("Warning range for the -s after it, or for all sensors without -s"));
+	printf (" %s\n", "-c, --critical=RANGE");
+	printf ("    %s\n", _("Critical range for the -s after it, or for all sensors without -s"));
+	printf (" %s\n", "-i, --ignore-fault");
+	printf ("    %s\n", _("Leave out faulty sensors instead of returning UNKNOWN for them"));
+	printf (" %s\n", "--hwmon-dir=DIR");
+	printf ("    %s\n", _("Where the hwmon devices are (default: /sys/class/hwmon)"));
+	printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+	printf (UT_VERBOSE);
+
+	printf ("\n");
+	printf ("%s\n", _("Notes:"));
+	printf (" %s\n", _("Sensors are named CHIP/LABEL, such as coretemp/Core 0, and may also be"));
+	printf (" %s\n", _("matched as CHIP/temp1, CHIP/fan2 or CHIP/in3; a second chip of the same name"));
+	printf (" %s\n", _("is CHIP.1. Temperatures are in degrees Celsius, fans in RPM and voltages in"));
+	printf (" %s\n", _("volts."));
+	printf (" %s\n", _("A sensor whose chip raises an alarm for it is CRITICAL, or WARNING for a"));
+	printf (" %s\n", _("min or max alarm, and a temperature at the chip's max or crit without alarm"));
+	printf (" %s\n", _("flags is WARNING or CRITICAL, whatever -w and -c say. A -s that matches no"));
+	printf (" %s\n", _("sensor is UNKNOWN."));
+
+	printf ("\n");
+	printf ("%s\n", _("Examples:"));
+	printf (" %s\n", "check_hwmon -w 75 -c 90 -s 'coretemp*/*' -w 800: -c 400: -s '*/fan*' -l '*/fan1=CPU fan'");
+
+	printf (UT_SUPPORT);
+}
+
+
+
+void
+print_usage (void)
+{
+	printf ("%s\n", _("Usage:"));
+	printf ("%s [-w <range>] [-c <range>] [-s <sensor>]... [-x <sensor>]... [-l <sensor>=<name>]... [-i]\n", progname);
+}
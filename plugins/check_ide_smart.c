@@ -45,10 +45,18 @@ void print_usage (void);
 
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/wait.h>
 #include <fcntl.h>
+#include <glob.h>
 #ifdef __linux__
 #include <linux/hdreg.h>
 #include <linux/types.h>
+#ifdef HAVE_SCSI_SG_H
+#include <scsi/sg.h>
+#endif
+#ifdef HAVE_LINUX_NVME_IOCTL_H
+#include <linux/nvme_ioctl.h>
+#endif
 
 #define OPEN_MODE O_RDONLY
 #endif /* __linux__ */
@@ -125,6 +133,30 @@ typedef struct values_s
 }
 __attribute__ ((packed)) values_t;
 
+/* the SMART / Health Information log page of NVMe, its counters 128 bit
+ * little endian */
+typedef struct nvme_health_s
+{
+	__u8 critical_warning;
+	__u8 temperature[2];
+	__u8 avail_spare;
+	__u8 spare_thresh;
+	__u8 percent_used;
+	__u8 reserved1[26];
+	__u8 data_units_read[16];
+	__u8 data_units_written[16];
+	__u8 host_reads[16];
+	__u8 host_writes[16];
+	__u8 ctrl_busy_time[16];
+	__u8 power_cycles[16];
+	__u8 power_on_hours[16];
+	__u8 unsafe_shutdowns[16];
+	__u8 media_errors[16];
+	__u8 num_err_log_entries[16];
+	__u8 reserved2[320];
+}
+__attribute__ ((packed)) nvme_health_t;
+
 struct
 {
 	__u8 value;
@@ -172,18 +204,34 @@ void print_value (value_t *, threshold_t *);
 void print_values (values_t *, thresholds_t *);
 int smart_cmd_simple (int, enum SmartCommand, __u8, char);
 int smart_read_thresholds (int, thresholds_t *);
+int check_device (const char *, int);
+int check_devices (int);
+void add_device (const char *);
+#ifdef __linux__
+int ata_drive_cmd (int, __u8 *);
+int nvme_read_health (int, nvme_health_t *);
+int nvme_nagios (nvme_health_t *);
+#endif
+
+/* the devices of -d and the arguments, with the patterns expanded */
+char **devices = NULL;
+int device_count = 0;
+/* TRUE once a pattern or a second device came along: each device is then
+ * checked by a child of its own and all are reported in one output */
+int multi_device = FALSE;
+pid_t *children = NULL;
+#if defined(__linux__) && defined(HAVE_SCSI_SG_H)
+/* through the SCSI layer with ATA PASS-THROUGH(16), which reaches drives
+ * behind SAS and USB bridges that HDIO_DRIVE_CMD does not */
+int use_sg_io = FALSE;
+#endif
 
 int
 main (int argc, char *argv[]) 
 {
-	char *device = NULL;
 	int command = -1;
 	int o, longindex;
-	int retval = 0;
-
-	thresholds_t thresholds;
-	values_t values;
-	int fd;
+	int timeout_set = FALSE;
 
 	static struct option longopts[] = { 
 		{"device", required_argument, 0, 'd'}, 
@@ -192,6 +240,7 @@ main (int argc, char *argv[])
 		{"auto-on", no_argument, 0, '1'}, 
 		{"auto-off", no_argument, 0, '0'}, 
 		{"nagios", no_argument, 0, 'n'}, 
+		{"timeout", required_argument, 0, 't'}, 
 		{"help", no_argument, 0, 'h'}, 
 		{"version", no_argument, 0, 'V'},
 		{0, 0, 0, 0}
@@ -200,20 +249,16 @@ main (int argc, char *argv[])
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	while (1) {
 		
-		o = getopt_long (argc, argv, "+d:iq10nhV", longopts, &longindex);
+		o = getopt_long (argc, argv, "+d:iq10nt:hV", longopts, &longindex);
 
 		if (o == -1 || o == EOF || o == 1)
 			break;
 
 		switch (o) {
 		case 'd':
-			device = optarg;
+			add_device (optarg);
 			break;
 		case 'q':
 			command = 3;
@@ -230,6 +275,12 @@ main (int argc, char *argv[])
 		case 'n':
 			command = 4;
 			break;
+		case 't':
+			if (!is_intnonneg (optarg))
+				usage2 (_("Timeout interval must be a positive integer"), optarg);
+			timeout_interval = atoi (optarg);
+			timeout_set = TRUE;
+			break;
 		case 'h':
 			print_help ();
 			return STATE_OK;
@@ -241,15 +292,77 @@ main (int argc, char *argv[])
 		}
 	}
 
-	if (optind < argc) {
-		device = argv[optind];
-	}
+	for (; optind < argc; optind++)
+		add_device (argv[optind]);
 
-	if (!device) {
+	if (device_count == 0) {
 		print_help ();
 		return STATE_OK;
 	}
 
+	if (!multi_device) {
+		if (timeout_set) {
+			signal (SIGALRM, timeout_alarm_handler);
+			alarm (timeout_interval);
+		}
+		return check_device (devices[0], command);
+	}
+
+	if (command != -1 && command != 4)
+		usage4 (_("-i, -q, -1 and -0 take a single device"));
+	return check_devices (command);
+}
+
+
+
+/* Adds the device, or each device a pattern such as /dev/sd? matches */
+void
+add_device (const char *device)
+{
+	glob_t matches;
+	size_t i;
+	int e;
+
+	if (strpbrk (device, "*?[") == NULL) {
+		if (device_count)
+			multi_device = TRUE;
+		devices = realloc (devices, (device_count + 1) * sizeof (char *));
+		if (devices == NULL)
+			die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+		devices[device_count++] = (char *) device;
+		return;
+	}
+
+	multi_device = TRUE;
+	if ((e = glob (device, 0, NULL, &matches)) != 0) {
+		if (e == GLOB_NOMATCH)
+			die (STATE_UNKNOWN, _("UNKNOWN - No device matches %s\n"), device);
+		die (STATE_UNKNOWN, _("UNKNOWN - Could not expand %s\n"), device);
+	}
+	devices = realloc (devices, (device_count + matches.gl_pathc) * sizeof (char *));
+	if (devices == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	/* the names stay with matches, which is never freed */
+	for (i = 0; i < matches.gl_pathc; i++)
+		devices[device_count++] = matches.gl_pathv[i];
+}
+
+
+
+/* Enables SMART on the device and runs the command on it, printing what
+ * comes of it */
+int
+check_device (const char *device, int command)
+{
+	int retval = 0;
+	thresholds_t thresholds;
+	values_t values;
+	int fd;
+#ifdef __linux__
+	nvme_health_t health;
+	int e;
+#endif
+
 	fd = open (device, OPEN_MODE);
 
 	if (fd < 0) {
@@ -257,6 +370,34 @@ main (int argc, char *argv[])
 		return STATE_CRITICAL;
 	}
 
+#ifdef __linux__
+	/* NVMe has no SMART commands to send, just its health log to read;
+	 * anything else turns the admin command down as an unknown ioctl */
+	e = nvme_read_health (fd, &health);
+	if (e != ENOTTY && e != EINVAL) {
+		close (fd);
+		if (command != -1 && command != 4) {
+			printf (_("UNKNOWN - %s is an NVMe device, which only takes the health check\n"), device);
+			return STATE_UNKNOWN;
+		}
+		if (e < 0) {
+			printf (_("CRITICAL - NVMe Get Log Page status 0x%x\n"), -e);
+			return STATE_CRITICAL;
+		}
+		if (e) {
+			printf (_("CRITICAL - NVMe Get Log Page: %s\n"), strerror (e));
+			return STATE_CRITICAL;
+		}
+		return nvme_nagios (&health);
+	}
+#ifdef HAVE_SCSI_SG_H
+	{
+		int version;
+		use_sg_io = ioctl (fd, SG_GET_VERSION_NUM, &version) == 0 && version >= 30000;
+	}
+#endif
+#endif /* __linux__ */
+
 	if (smart_cmd_simple (fd, SMART_CMD_ENABLE, 0, TRUE)) {
 		printf (_("CRITICAL - SMART_CMD_ENABLE\n"));
 		return STATE_CRITICAL;
@@ -295,6 +436,107 @@ main (int argc, char *argv[])
 
 
 
+RETSIGTYPE
+children_timeout (int sig)
+{
+	int i;
+	for (i = 0; i < device_count; i++)
+		if (children[i] > 0)
+			kill (children[i], SIGKILL);
+	timeout_alarm_handler (sig);
+}
+
+
+
+/* Checks every device at once, each in a child with its output going to
+ * a pipe: a drive that takes its time (spinning up, or stuck on a bad
+ * bridge) holds up its own line and not the others */
+int
+check_devices (int command)
+{
+	int *pipes;
+	int *states;
+	char **messages;
+	char *problems = NULL;
+	int result = STATE_OK;
+	int count_ok = 0;
+	int fds[2];
+	int i;
+
+	children = calloc (device_count, sizeof (pid_t));
+	pipes = calloc (device_count, sizeof (int));
+	states = calloc (device_count, sizeof (int));
+	messages = calloc (device_count, sizeof (char *));
+	if (children == NULL || pipes == NULL || states == NULL || messages == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+
+	signal (SIGALRM, children_timeout);
+	alarm (timeout_interval);
+
+	fflush (stdout);
+	for (i = 0; i < device_count; i++) {
+		if (pipe (fds) < 0)
+			die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), strerror (errno));
+		if ((children[i] = fork ()) < 0)
+			die (STATE_UNKNOWN, _("Could not fork: %s\n"), strerror (errno));
+		if (children[i] == 0) {
+			signal (SIGALRM, SIG_DFL);
+			close (fds[0]);
+			dup2 (fds[1], STDOUT_FILENO);
+			close (fds[1]);
+			/* the line of nagios() without the deprecation notice of -n */
+			exit (check_device (devices[i], command == 4 ? -1 : command));
+		}
+		close (fds[1]);
+		pipes[i] = fds[0];
+	}
+
+	for (i = 0; i < device_count; i++) {
+		char buf[MAX_INPUT_BUFFER];
+		size_t len = 0;
+		ssize_t n;
+		char *message;
+		int status;
+
+		while (len < sizeof (buf) - 1 &&
+		       ((n = read (pipes[i], buf + len, sizeof (buf) - 1 - len)) > 0 ||
+		        (n < 0 && errno == EINTR)))
+			if (n > 0)
+				len += n;
+		buf[len] = '\0';
+		close (pipes[i]);
+		buf[strcspn (buf, "\n")] = '\0';
+
+		while (waitpid (children[i], &status, 0) < 0 && errno == EINTR)
+			;
+		children[i] = 0;
+		if (WIFEXITED (status) && WEXITSTATUS (status) <= STATE_DEPENDENT)
+			states[i] = WEXITSTATUS (status);
+		else
+			states[i] = STATE_UNKNOWN;
+
+		/* "OK - Operational (...)" as "Operational (...)" */
+		message = strstr (buf, " - ");
+		message = message ? message + 3 : buf;
+		messages[i] = strdup (*message ? message : _("No output"));
+
+		result = max_state_alt (result, states[i]);
+		if (states[i] == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           devices[i], messages[i]);
+	}
+	alarm (0);
+
+	printf ("SMART %s: %d of %d %s%s%s\n", state_text (result), count_ok, device_count,
+	        _("devices OK"), problems ? " - " : "", problems ? problems : "");
+	for (i = 0; i < device_count; i++)
+		printf ("[%s] %s: %s\n", state_text (states[i]), devices[i], messages[i]);
+	return result;
+}
+
+
 char *
 get_offline_text (int status) 
 {
@@ -319,9 +561,8 @@ smart_read_values (int fd, values_t * values)
 	args[1] = 0;
 	args[2] = SMART_READ_VALUES;
 	args[3] = 1;
-	if (ioctl (fd, HDIO_DRIVE_CMD, &args)) {
-		e = errno;
-		printf (_("CRITICAL - SMART_READ_VALUES: %s\n"), strerror (errno));
+	if ((e = ata_drive_cmd (fd, args))) {
+		printf (_("CRITICAL - SMART_READ_VALUES: %s\n"), strerror (e));
 		return e;
 	}
 	memcpy (values, args + 4, 512);
@@ -503,10 +744,9 @@ smart_cmd_simple (int fd, enum SmartCommand command, __u8 val0, char show_error)
 	args[1] = val0;
 	args[2] = smart_command[command].value;
 	args[3] = 0;
-	if (ioctl (fd, HDIO_DRIVE_CMD, &args)) {
-		e = errno;
+	if ((e = ata_drive_cmd (fd, args))) {
 		if (show_error) {
-			printf (_("CRITICAL - %s: %s\n"), smart_command[command].text, strerror (errno));
+			printf (_("CRITICAL - %s: %s\n"), smart_command[command].text, strerror (e));
 		}
 	}
 #endif /* __linux__ */
@@ -549,9 +789,8 @@ smart_read_thresholds (int fd, thresholds_t * thresholds)
   args[1] = 0;
   args[2] = SMART_READ_THRESHOLDS;
   args[3] = 1;
-	if (ioctl (fd, HDIO_DRIVE_CMD, &args)) {
-		e = errno;
-		printf (_("CRITICAL - SMART_READ_THRESHOLDS: %s\n"), strerror (errno));
+	if ((e = ata_drive_cmd (fd, args))) {
+		printf (_("CRITICAL - SMART_READ_THRESHOLDS: %s\n"), strerror (e));
 		return e;
 	}
 	memcpy (thresholds, args + 4, 512);
@@ -588,6 +827,145 @@ smart_read_thresholds (int fd, thresholds_t * thresholds)
 }
 
 
+#ifdef __linux__
+/* Sends the command of args as HDIO_DRIVE_CMD takes it (command,
+ * sector number, feature, sector count, then the sectors read) through
+ * SG_IO if the device has it, mapped onto the registers as libata does,
+ * or through HDIO_DRIVE_CMD. Returns 0 or the errno. */
+int
+ata_drive_cmd (int fd, __u8 *args)
+{
+#ifdef HAVE_SCSI_SG_H
+	if (use_sg_io) {
+		unsigned char cdb[16];
+		unsigned char sense[32];
+		sg_io_hdr_t io;
+		int e = 0;
+
+		memset (cdb, 0, sizeof (cdb));
+		cdb[0] = 0x85;                 /* ATA PASS-THROUGH(16) */
+		if (args[3]) {
+			cdb[1] = 4 << 1;       /* PIO data-in */
+			cdb[2] = 0x0e;         /* from the device, in sectors of sector count */
+		}
+		else {
+			cdb[1] = 3 << 1;       /* non-data */
+		}
+		cdb[4] = args[2];
+		cdb[6] = args[3];
+		cdb[8] = args[1];
+		cdb[10] = 0x4f;                /* the SMART signature in LBA mid and high */
+		cdb[12] = 0xc2;
+		cdb[14] = args[0];
+
+		memset (&io, 0, sizeof (io));
+		io.interface_id = 'S';
+		io.cmd_len = sizeof (cdb);
+		io.cmdp = cdb;
+		io.mx_sb_len = sizeof (sense);
+		io.sbp = sense;
+		io.dxfer_direction = args[3] ? SG_DXFER_FROM_DEV : SG_DXFER_NONE;
+		io.dxfer_len = args[3] * 512;
+		io.dxferp = args[3] ? args + 4 : NULL;
+		io.timeout = timeout_interval * 1000;
+
+		if (ioctl (fd, SG_IO, &io) < 0)
+			e = errno;
+		else if ((io.info & SG_INFO_OK_MASK) != SG_INFO_OK)
+			e = EIO;
+		if (e == 0)
+			return 0;
+		/* a bridge without SAT may still take the old ioctl */
+		if (ioctl (fd, HDIO_DRIVE_CMD, args) == 0) {
+			use_sg_io = FALSE;
+			return 0;
+		}
+		return e;
+	}
+#endif /* HAVE_SCSI_SG_H */
+	if (ioctl (fd, HDIO_DRIVE_CMD, args))
+		return errno;
+	return 0;
+}
+
+
+
+/* Reads the SMART / Health Information log of an NVMe controller or
+ * namespace. Returns 0, the errno (ENOTTY or EINVAL for what is not
+ * NVMe), or the NVMe status negated. */
+int
+nvme_read_health (int fd, nvme_health_t *health)
+{
+#ifdef HAVE_LINUX_NVME_IOCTL_H
+	struct nvme_admin_cmd cmd;
+	int e;
+
+	memset (health, 0, sizeof (*health));
+	memset (&cmd, 0, sizeof (cmd));
+	cmd.opcode = 0x02;                    /* Get Log Page */
+	cmd.nsid = 0xffffffff;                /* for the controller as a whole */
+	cmd.addr = (__u64) (uintptr_t) health;
+	cmd.data_len = sizeof (*health);
+	cmd.cdw10 = ((sizeof (*health) / 4 - 1) << 16) | 0x02;
+	cmd.timeout_ms = timeout_interval * 1000;
+
+	e = ioctl (fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+	if (e < 0)
+		return errno;
+	return e > 0 ? -e : 0;
+#else
+	return ENOTTY;
+#endif /* HAVE_LINUX_NVME_IOCTL_H */
+}
+
+
+
+/* the low 64 bits of a 128 bit counter of the health log */
+static unsigned long long
+nvme_counter (const __u8 *p)
+{
+	unsigned long long n = 0;
+	int i;
+	for (i = 7; i >= 0; i--)
+		n = (n << 8) | p[i];
+	return n;
+}
+
+
+
+int
+nvme_nagios (nvme_health_t *health)
+{
+	static const char *warnings[] = {
+		"spare below threshold", "temperature", "reliability degraded",
+		"read only", "volatile memory backup failed"
+	};
+	char *text = NULL;
+	int status = STATE_OK;
+	int i;
+
+	for (i = 0; i < 5; i++)
+		if (health->critical_warning & (1 << i))
+			xasprintf (&text, "%s%s%s", text ? text : "", text ? ", " : "", warnings[i]);
+	/* over temperature alone, or worn past the rated endurance, go on
+	 * working; the rest is the drive giving up */
+	if (health->critical_warning & ~0x02)
+		status = STATE_CRITICAL;
+	else if (health->critical_warning || health->percent_used >= 100)
+		status = STATE_WARNING;
+
+	printf (_("%s - NVMe %s%s (spare %d%%, %d%% used, %d C, %llu media errors)\n"),
+	        state_text (status),
+	        text ? _("critical warning: ") : (status == STATE_OK ? _("healthy") : _("worn out")),
+	        text ? text : "",
+	        health->avail_spare, health->percent_used,
+	        (health->temperature[0] | (health->temperature[1] << 8)) - 273,
+	        nvme_counter (health->media_errors));
+	return status;
+}
+#endif /* __linux__ */
+
+
 void
 print_help (void)
 {
@@ -609,6 +987,8 @@ print_help (void)
   printf (" %s\n", "-d, --device=DEVICE");
   printf ("    %s\n", _("Select device DEVICE"));
   printf ("    %s\n", _("Note: if the device is selected with this option, _no_ other options are accepted"));
+  printf ("    %s\n", _("May be given more than once, and DEVICE may be a pattern such as /dev/sd?;"));
+  printf ("    %s\n", _("each device is then checked at the same time and reported on its own line"));
   printf (" %s\n", "-i, --immediate");
   printf ("    %s\n", _("Perform immediately offline tests"));
   printf (" %s\n", "-q, --quiet-check");
@@ -619,6 +999,15 @@ print_help (void)
   printf ("    %s\n", _("Turn off automatic offline tests"));
   printf (" %s\n", "-n, --nagios");
   printf ("    %s\n", _("Output suitable for Nagios"));
+  printf (" %s\n", "-t, --timeout=INTEGER");
+  printf ("    %s\n", _("Seconds before the check of several devices times out (default: 10)"));
+
+  printf ("\n");
+  printf ("%s\n", _("Notes:"));
+  printf (" %s\n", _("On Linux, drives that take SG_IO are sent ATA PASS-THROUGH commands, which"));
+  printf (" %s\n", _("also reach those behind SAS HBAs and USB bridges. NVMe devices are checked"));
+  printf (" %s\n", _("from their health log: CRITICAL on a critical warning other than temperature,"));
+  printf (" %s\n", _("WARNING on that one or with the rated endurance used up."));
 
   printf (UT_SUPPORT);
 }
@@ -640,5 +1029,5 @@ print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
   printf ("%s [-d <device>] [-i <immediate>] [-q quiet] [-1 <auto-on>]",progname);
-  printf (" [-O <auto-off>] [-n <nagios>]\n");
+  printf (" [-O <auto-off>] [-n <nagios>] [-t timeout]\n");
 }
@@ -34,7 +34,9 @@ const char *email = "devel@nagios-plugins.org";
 #include "common.h"
 #include "netutils.h"
 #include "utils.h"
+#include "resident.h"
 
+#include <fcntl.h>
 #include <lber.h>
 #define LDAP_DEPRECATED 1
 #include <ldap.h>
@@ -44,7 +46,8 @@ enum {
 #ifdef HAVE_LDAP_SET_OPTION
 	DEFAULT_PROTOCOL = 2,
 #endif
-	DEFAULT_PORT = 389
+	DEFAULT_PORT = 389,
+	DEFAULT_PAGE_SIZE = 1000
 };
 
 int process_arguments (int, char **);
@@ -53,68 +56,191 @@ int ldap_check_cert (LDAP *ld);
 void print_help (void);
 void print_usage (void);
 
+static int run_check (int, char **);
+static void reset_state (void);
+
+/* the steps of checking a server, each with a deadline of its own */
+enum {
+	STEP_CONNECT,
+	STEP_TLS,
+	STEP_BIND,
+	STEP_SEARCH,
+	STEP_DONE
+};
+
+static const char *step_names[STEP_DONE] = { "connect", "tls", "bind", "search" };
+
+/* one -H or -U */
+typedef struct ldap_target {
+	char *host;               /* -H, NULL for a -U */
+	char *uri;
+	char *name;
+	int port;
+	int tls_on_connect;
+	char *url;                /* for ldap_init_fd() */
+	char *key;                /* in the resident pool, NULL if not pooled */
+	LDAP *ld;
+	int fd;                   /* -1 until it is known */
+	short events;
+	int lazy;                 /* the library connects as it sends the first request */
+	int step;
+	int msgid;                /* of the request the step waits for, -1 for none */
+	struct timeval start;
+	struct timeval step_start;
+	int64_t deadline;         /* of the step */
+	double time[STEP_DONE];   /* seconds each step took, -1 if it did not */
+	double elapsed;
+	int entries;
+	struct berval cookie;     /* of the next page of entries */
+	struct search_result *results; /* of each --search */
+	int pending;              /* searches without their result yet */
+	int cert;                 /* TRUE if state is that of the certificate */
+	int state;
+	char *msg;
+} ldap_target;
+
+/* a --search, sent at once with the others on the bound connection */
+typedef struct search_spec {
+	char *base;               /* NULL for that of -b */
+	char *filter;             /* NULL for that of -a */
+	int scope;
+	char *range;              /* of the entries expected, NULL for any */
+	thresholds *expect;
+} search_spec;
+
+/* how a search went on one server */
+typedef struct search_result {
+	int msgid;
+	int entries;
+	double time;              /* seconds to its result, -1 until it came */
+	int code;                 /* of the result */
+	int state;
+} search_result;
+
+static void target_add (char *, char *);
+static void search_add (char *);
+static void target_search_status (ldap_target *);
+static void search_perfdata (np_perfdata *, ldap_target *, const char *);
+static void search_print (search_spec *, search_result *, int);
+static void check_targets (void);
+
+/* defaults are set in reset_state() so resident mode can restore them */
 char ld_defattr[] = "(objectclass=*)";
-char *ld_attr = ld_defattr;
-char *ld_uri = NULL;
-char *ld_host = NULL;
-char *ld_base = NULL;
-char *ld_passwd = NULL;
-char *ld_binddn = NULL;
-int ld_port = -1;
+char *ld_attr;
+char *ld_uri;
+char *ld_host;
+char *ld_base;
+char *ld_passwd;
+char *ld_binddn;
+int ld_port;
 #ifdef HAVE_LDAP_SET_OPTION
-int ld_protocol = DEFAULT_PROTOCOL;
+int ld_protocol;
 #endif
 #ifndef LDAP_OPT_SUCCESS
 # define LDAP_OPT_SUCCESS LDAP_SUCCESS
 #endif
-double warn_time = UNDEFINED;
-double crit_time = UNDEFINED;
-thresholds *entries_thresholds = NULL;
-struct timeval tv;
-char* warn_entries = NULL;
-char* crit_entries = NULL;
-int starttls = FALSE;
-int ssl_on_connect = FALSE;
-int verbose = 0;
-
-int check_cert = FALSE;
+#ifndef LDAP_NO_ATTRS
+# define LDAP_NO_ATTRS "1.1"
+#endif
+double warn_time;
+double crit_time;
+thresholds *entries_thresholds;
+char* warn_entries;
+char* crit_entries;
+int starttls;
+int ssl_on_connect;
+int verbose;
+int trace_timing;
+int page_size;
+ldap_target *targets;
+int target_count;
+search_spec *searches;
+int search_count;
+
+int check_cert;
 int days_till_exp_warn, days_till_exp_crit;
 
 /* for ldap tls */
 
-char *SERVICE = "LDAP";
+char *SERVICE;
 
-int
-main (int argc, char *argv[])
+/* connections kept bound between the checks of a resident worker */
+static int
+pool_fd (void *ld)
 {
+	int fd = -1;
 
-	LDAP *ld;
-	LDAPMessage *result;
+	if (ldap_get_option (ld, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS)
+		return -1;
+	return fd;
+}
+
+static void
+pool_close (void *ld)
+{
+	ldap_unbind (ld);
+}
 
-	/* should be 	int result = STATE_UNKNOWN; */
+static const np_pool_ops pool_ops = { pool_fd, NULL, pool_close };
 
-	int status = STATE_UNKNOWN;
-	long microsec;
-	double elapsed_time;
+int
+main (int argc, char *argv[])
+{
+	if (strstr(argv[0],"check_ldaps")) {
+		xasprintf (&progname, "check_ldaps");
+ 	}
 
-	/* for ldap tls */
+	if (np_resident_requested (argc, argv))
+		return np_resident_main (argc, argv, run_check, reset_state);
 
-	int tls;
-	int version=3;
+	reset_state ();
+	return run_check (argc, argv);
+}
 
-	/* for entry counting */
 
-	LDAPMessage *next_entry;
-	int status_entries = STATE_OK;
-	int num_entries = 0;
+static void
+reset_state (void)
+{
+	ld_attr = ld_defattr;
+	ld_uri = NULL;
+	ld_host = NULL;
+	ld_base = NULL;
+	ld_passwd = NULL;
+	ld_binddn = NULL;
+	ld_port = -1;
+#ifdef HAVE_LDAP_SET_OPTION
+	ld_protocol = DEFAULT_PROTOCOL;
+#endif
+	warn_time = UNDEFINED;
+	crit_time = UNDEFINED;
+	entries_thresholds = NULL;
+	warn_entries = NULL;
+	crit_entries = NULL;
+	starttls = FALSE;
+	ssl_on_connect = FALSE;
+	verbose = 0;
+	trace_timing = FALSE;
+	page_size = DEFAULT_PAGE_SIZE;
+	targets = NULL;
+	target_count = 0;
+	searches = NULL;
+	search_count = 0;
+	check_cert = FALSE;
+	SERVICE = "LDAP";
+	np_net_reset ();
+}
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
 
-	if (strstr(argv[0],"check_ldaps")) {
-		xasprintf (&progname, "check_ldaps");
- 	}
+static int
+run_check (int argc, char **argv)
+{
+	ldap_target *t;
+	int status = STATE_OK;
+	int count_ok = 0;
+	char *problems = NULL;
+	np_perfdata perf;
+	char label[64];
+	int k, i;
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -128,177 +254,917 @@ main (int argc, char *argv[])
 	/* initialize alarm signal handling */
 	signal (SIGALRM, socket_timeout_alarm_handler);
 
-	/* set socket timeout */
+	/* set socket timeout; each step has a deadline of its own, this is the
+	 * backstop */
 	alarm (timeout_interval);
 
-	/* get the start time */
-	gettimeofday (&tv, NULL);
+	check_targets ();
+
+	/* reset the alarm handler */
+	alarm (0);
+
+	/* compare to thresholds */
+	for (k = 0; k < target_count; k++) {
+		t = &targets[k];
+		if (t->cert || t->state != STATE_OK)
+			continue;
+		if (crit_time!=UNDEFINED && t->elapsed>crit_time)
+			t->state = STATE_CRITICAL;
+		else if (warn_time!=UNDEFINED && t->elapsed>warn_time)
+			t->state = STATE_WARNING;
+
+		if (search_count > 0) {
+			target_search_status (t);
+			continue;
+		}
+
+		if(entries_thresholds != NULL) {
+			if (verbose) {
+				printf ("entries found on %s: %d\n", t->name, t->entries);
+				print_thresholds("entry thresholds", entries_thresholds);
+			}
+			t->state = max_state (t->state, get_status(t->entries, entries_thresholds));
+		}
+
+		if (entries_thresholds != NULL)
+			xasprintf (&t->msg, _("found %d entries in %.3f seconds"), t->entries, t->elapsed);
+		else
+			xasprintf (&t->msg, _("%.3f seconds response time"), t->elapsed);
+	}
+
+	if (trace_timing) {
+		for (k = 0; k < target_count; k++) {
+			if (target_count > 1)
+				fprintf (stderr, "%s:\n", targets[k].name);
+			for (i = 0; i < STEP_DONE; i++) {
+				if (targets[k].time[i] >= 0)
+					fprintf (stderr, "%-10s %.6f s\n", step_names[i], targets[k].time[i]);
+				else
+					fprintf (stderr, "%-10s -\n", step_names[i]);
+			}
+		}
+	}
+
+	if (target_count == 1) {
+		t = &targets[0];
+		/* ldap_check_cert() or the failed step said what there is to say */
+		if (t->cert)
+			return t->state;
+		if (t->step != STEP_DONE || t->ld != NULL || t->msg == NULL)
+			die (STATE_UNKNOWN, "%s\n", _("LDAP check did not finish"));
+		if (t->time[STEP_SEARCH] < 0) {
+			printf ("%s\n", t->msg);
+			return t->state;
+		}
+
+		np_perfdata_init (&perf);
+		np_perfdata_addf (&perf, "time", t->elapsed, "s",
+			(int)warn_time, warn_time,
+			(int)crit_time, crit_time,
+			TRUE, 0, FALSE, 0);
+		for (i = 0; i < STEP_DONE; i++) {
+			if (t->time[i] < 0)
+				continue;
+			snprintf (label, sizeof (label), "time_%s", step_names[i]);
+			np_perfdata_addf (&perf, label, t->time[i], "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+		}
+
+		if (search_count > 0) {
+			search_perfdata (&perf, t, NULL);
+			printf ("LDAP %s - %s|%s\n", state_text (t->state), t->msg, np_perfdata_string (&perf));
+			for (k = 0; k < search_count && t->results != NULL; k++)
+				search_print (&searches[k], &t->results[k], k);
+			np_perfdata_free (&perf);
+			return t->state;
+		}
+
+		/* print out the result */
+		if (crit_entries!=NULL || warn_entries!=NULL) {
+			printf (_("LDAP %s - found %d entries in %.3f seconds|%s %s\n"),
+				state_text (t->state),
+				t->entries,
+				t->elapsed,
+				np_perfdata_string (&perf),
+				sperfdata ("entries", (double)t->entries, "",
+					warn_entries,
+					crit_entries,
+					TRUE, 0.0, FALSE, 0.0));
+		} else {
+			printf (_("LDAP %s - %.3f seconds response time|%s\n"),
+				state_text (t->state),
+				t->elapsed,
+				np_perfdata_string (&perf));
+		}
+		np_perfdata_free (&perf);
+
+		return t->state;
+	}
+
+	/* every server, with a line for each after the summary */
+	np_perfdata_init (&perf);
+	for (k = 0; k < target_count; k++) {
+		t = &targets[k];
+		status = max_state (status, t->state);
+		if (t->state == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "",
+			           problems ? "; " : "", t->name, t->msg);
+		if (t->time[STEP_SEARCH] < 0)
+			continue;
+		snprintf (label, sizeof (label), "time@%s", t->name);
+		np_perfdata_addf (&perf, label, t->elapsed, "s",
+			(int)warn_time, warn_time,
+			(int)crit_time, crit_time,
+			TRUE, 0, FALSE, 0);
+		for (i = 0; i < STEP_DONE; i++) {
+			if (t->time[i] < 0)
+				continue;
+			snprintf (label, sizeof (label), "time_%s@%s", step_names[i], t->name);
+			np_perfdata_addf (&perf, label, t->time[i], "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+		}
+		if (search_count > 0)
+			search_perfdata (&perf, t, t->name);
+		if (entries_thresholds != NULL) {
+			snprintf (label, sizeof (label), "entries@%s", t->name);
+			np_perfdata_adds (&perf, label, (double)t->entries, "",
+				warn_entries, crit_entries, TRUE, 0.0, FALSE, 0.0);
+		}
+	}
+
+	printf (_("LDAP %s: %d of %d servers OK%s%s|%s\n"), state_text (status), count_ok,
+	        target_count, problems ? " - " : "", problems ? problems : "",
+	        np_perfdata_string (&perf));
+	for (k = 0; k < target_count; k++)
+		printf ("[%s] %s: %s\n", state_text (targets[k].state), targets[k].name, targets[k].msg);
+	np_perfdata_free (&perf);
+
+	return status;
+}
+
+static void
+target_add (char *host, char *uri)
+{
+	ldap_target *t;
+
+	targets = realloc (targets, (target_count + 1) * sizeof (*targets));
+	if (targets == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory for the servers\n"));
+	t = &targets[target_count++];
+	memset (t, 0, sizeof (*t));
+	t->host = host;
+	t->uri = uri;
+	t->name = uri ? uri : host;
+	t->fd = -1;
+}
+
+/* BASE[;FILTER[;SCOPE[;RANGE]]] of a --search; the fields left out or
+ * empty are those of -b and -a, a subtree search and any count */
+static void
+search_add (char *spec)
+{
+	search_spec *s;
+	char *field[4] = { NULL, NULL, NULL, NULL };
+	char *p;
+	int i;
+
+	searches = realloc (searches, (search_count + 1) * sizeof (*searches));
+	if (searches == NULL || (p = strdup (spec)) == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory for the searches\n"));
+	s = &searches[search_count++];
+	memset (s, 0, sizeof (*s));
+	for (i = 0; i < 4 && p != NULL; i++) {
+		field[i] = p;
+		if ((p = strchr (p, ';')) != NULL)
+			*p++ = '\0';
+	}
+	if (p != NULL)
+		usage2 (_("A search has at most a base, filter, scope and range"), spec);
+
+	s->base = field[0] && *field[0] ? field[0] : NULL;
+	s->filter = field[1] && *field[1] ? field[1] : NULL;
+	if (field[2] == NULL || *field[2] == '\0' || !strcasecmp (field[2], "sub"))
+		s->scope = LDAP_SCOPE_SUBTREE;
+	else if (!strcasecmp (field[2], "one"))
+		s->scope = LDAP_SCOPE_ONELEVEL;
+	else if (!strcasecmp (field[2], "base"))
+		s->scope = LDAP_SCOPE_BASE;
+	else
+		usage2 (_("The scope of a search must be base, one or sub"), field[2]);
+	if (field[3] != NULL && *field[3]) {
+		s->range = field[3];
+		set_thresholds (&s->expect, NULL, s->range);
+	}
+}
+
+static const char *
+search_scope (int scope)
+{
+	return scope == LDAP_SCOPE_BASE ? "base" : scope == LDAP_SCOPE_ONELEVEL ? "one" : "sub";
+}
+
+/* the state of each search on the server, and of the server */
+static void
+target_search_status (ldap_target *t)
+{
+	search_result *r;
+	char *problems = NULL;
+	int k, count_ok = 0;
+
+	for (k = 0; k < search_count; k++) {
+		r = &t->results[k];
+		if (r->code != LDAP_SUCCESS) {
+			r->state = STATE_CRITICAL;
+			xasprintf (&problems, "%s%ssearch %d: %s", problems ? problems : "",
+			           problems ? ", " : "", k + 1, ldap_err2string (r->code));
+		}
+		else if (searches[k].expect != NULL &&
+		         (r->state = get_status (r->entries, searches[k].expect)) != STATE_OK)
+			xasprintf (&problems, _("%s%ssearch %d: %d entries, expected %s"),
+			           problems ? problems : "", problems ? ", " : "", k + 1,
+			           r->entries, searches[k].range);
+		if (r->state == STATE_OK)
+			count_ok++;
+		t->state = max_state (t->state, r->state);
+	}
+	xasprintf (&t->msg, _("%d of %d searches OK in %.3f seconds%s%s"), count_ok, search_count,
+	           t->elapsed, problems ? " - " : "", problems ? problems : "");
+	free (problems);
+}
+
+/* the entries and time of each search, labelled @server unless NULL */
+static void
+search_perfdata (np_perfdata *perf, ldap_target *t, const char *server)
+{
+	char label[64];
+	int k;
+
+	for (k = 0; k < search_count && t->results != NULL; k++) {
+		if (t->results[k].time < 0)
+			continue;
+		snprintf (label, sizeof (label), "search%d_entries%s%s", k + 1,
+		          server ? "@" : "", server ? server : "");
+		np_perfdata_adds (perf, label, (double)t->results[k].entries, "",
+			NULL, searches[k].range, TRUE, 0.0, FALSE, 0.0);
+		snprintf (label, sizeof (label), "search%d_time%s%s", k + 1,
+		          server ? "@" : "", server ? server : "");
+		np_perfdata_addf (perf, label, t->results[k].time, "s",
+			FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+	}
+}
+
+/* a line for the search, after the summary */
+static void
+search_print (search_spec *s, search_result *r, int k)
+{
+	printf ("[%s] search %d (%s %s %s): ", state_text (r->time < 0 ? STATE_CRITICAL : r->state),
+	        k + 1, s->base, search_scope (s->scope), s->filter);
+	if (r->time < 0)
+		printf ("%s\n", _("no result"));
+	else if (r->code != LDAP_SUCCESS)
+		printf ("%s\n", ldap_err2string (r->code));
+	else
+		printf (_("%d entries in %.3f seconds\n"), r->entries, r->time);
+}
+
+/* on to the next step, with a deadline of its own from now on */
+static void
+target_next (ldap_target *t, int step)
+{
+	if (! t->lazy && t->step < STEP_DONE)
+		t->time[t->step] = (double)deltime (t->step_start) / 1.0e6;
+	t->step = step;
+	t->msgid = -1;
+	if (! t->lazy)
+		gettimeofday (&t->step_start, NULL);
+	t->deadline = np_net_deadline (step == STEP_CONNECT ? np_net_connect_timeout : np_net_io_timeout);
+}
+
+/* the end of the check of a server, with the connection kept for the
+ * next check if it went well */
+static void
+target_finish (ldap_target *t, int state)
+{
+	if (t->step < STEP_DONE)
+		t->time[t->step] = (double)deltime (t->step_start) / 1.0e6;
+	t->step = STEP_DONE;
+	t->state = state;
+	t->elapsed = (double)deltime (t->start) / 1.0e6;
+	if (t->ld != NULL) {
+		if (state == STATE_OK && np_pool_release (t->ld)) {
+			if (verbose)
+				printf ("Keeping connection to %s for the next check\n", t->name);
+		}
+		else
+			np_pool_close (t->ld, &pool_ops);
+		t->ld = NULL;
+	}
+	else if (t->fd >= 0)
+		close (t->fd);
+	t->fd = -1;
+	t->pending = 0;
+	ber_memfree (t->cookie.bv_val);
+	t->cookie.bv_val = NULL;
+	t->cookie.bv_len = 0;
+}
+
+/* what went wrong at the step, and why */
+static void
+target_fail (ldap_target *t, const char *why)
+{
+	switch (t->step) {
+	case STEP_CONNECT:
+		xasprintf (&t->msg, _("Could not connect to the server at port %i"), t->port);
+		break;
+	case STEP_TLS:
+		if (starttls)
+			xasprintf (&t->msg, _("Could not init startTLS at port %i!"), t->port);
+		else
+			xasprintf (&t->msg, _("Could not init TLS at port %i!"), t->port);
+		break;
+	case STEP_BIND:
+		xasprintf (&t->msg, "%s", _("Could not bind to the LDAP server"));
+		break;
+	default:
+		if (search_count > 0)
+			xasprintf (&t->msg, "%s", _("Could not search the LDAP server"));
+		else
+			xasprintf (&t->msg, _("Could not search/find objectclasses in %s"), ld_base);
+	}
+	if (why != NULL)
+		xasprintf (&t->msg, "%s (%s)", t->msg, why);
+	target_finish (t, STATE_CRITICAL);
+}
+
+/* after a request has gone out; the library may have connected to send it */
+static void
+target_sent (ldap_target *t)
+{
+	t->events = POLLIN;
+	if (t->lazy) {
+		t->lazy = FALSE;
+		t->time[STEP_CONNECT] = (double)deltime (t->step_start) / 1.0e6;
+		gettimeofday (&t->step_start, NULL);
+		t->fd = pool_fd (t->ld);
+		/* with TLS set up as it connected */
+		if (t->tls_on_connect && check_cert == TRUE) {
+			t->cert = TRUE;
+			target_finish (t, ldap_check_cert (t->ld));
+		}
+	}
+}
 
-	/* initialize ldap */
-	if (ld_uri != NULL)
+static void target_bind (ldap_target *);
+static void target_starttls (ldap_target *);
+
+/* with TLS up, check the certificate or go on */
+static void
+target_secure (ldap_target *t)
+{
+	if (check_cert == TRUE) {
+		t->cert = TRUE;
+		target_finish (t, ldap_check_cert (t->ld));
+	}
+	else
+		target_bind (t);
+}
+
+static void
+target_starttls (ldap_target *t)
+{
+#if defined(HAVE_LDAP_SET_OPTION) && (defined(HAVE_LDAP_INSTALL_TLS) || defined(HAVE_LDAP_START_TLS_S))
+	int version = 3;
+	int ret;
+
+	xasprintf (&SERVICE, "LDAP-TLS");
+	target_next (t, STEP_TLS);
+	/* ldap with startTLS: set option version */
+	if (ldap_get_option(t->ld,LDAP_OPT_PROTOCOL_VERSION, &version) == LDAP_OPT_SUCCESS )
 	{
-#ifdef HAVE_LDAP_INITIALIZE
-		int result = ldap_initialize(&ld, ld_uri);
-		if (result != LDAP_SUCCESS)
+		if (version < LDAP_VERSION3)
 		{
-			printf ("Failed to connect to LDAP server at %s: %s\n",
-				ld_uri, ldap_err2string(result));
-			return STATE_CRITICAL;
+			version = LDAP_VERSION3;
+			ldap_set_option(t->ld, LDAP_OPT_PROTOCOL_VERSION, &version);
 		}
+	}
+# ifdef HAVE_LDAP_INSTALL_TLS
+	/* the handshake follows the response */
+	ret = ldap_start_tls (t->ld, NULL, NULL, &t->msgid);
+	if (ret != LDAP_SUCCESS) {
+		target_fail (t, ldap_err2string (ret));
+		return;
+	}
+	target_sent (t);
+# else
+	ret = ldap_start_tls_s (t->ld, NULL, NULL);
+	if (ret != LDAP_SUCCESS) {
+		target_fail (t, ldap_err2string (ret));
+		return;
+	}
+	target_sent (t);
+	target_secure (t);
+# endif
 #else
-		printf ("Sorry, this version of %s was compiled without URI support!\n",
-			argv[0]);
-		return STATE_CRITICAL;
+	target_fail (t, _("startTLS not supported by the library, needs LDAPv3"));
 #endif
+}
+
+static void
+target_bind (ldap_target *t)
+{
+	struct berval cred;
+	int ret;
+
+	target_next (t, STEP_BIND);
+	cred.bv_val = ld_passwd;
+	cred.bv_len = ld_passwd ? strlen (ld_passwd) : 0;
+	ret = ldap_sasl_bind (t->ld, ld_binddn, LDAP_SASL_SIMPLE, &cred, NULL, NULL, &t->msgid);
+	if (ret != LDAP_SUCCESS) {
+		target_fail (t, ldap_err2string (ret));
+		return;
 	}
-#ifdef HAVE_LDAP_INIT
-	else if (!(ld = ldap_init (ld_host, ld_port))) {
-		printf ("Could not connect to the server at port %i\n", ld_port);
-		return STATE_CRITICAL;
+	target_sent (t);
+}
+
+/* The search of all objectclasses in the base dn, or a page of the
+ * subtree search that counts the entries below it: without any of their
+ * attributes ("1.1"), page_size at a time with the paged results control
+ * unless that is 0. */
+static void
+target_search_page (ldap_target *t)
+{
+	char *no_attrs[] = { LDAP_NO_ATTRS, NULL };
+	LDAPControl *controls[2] = { NULL, NULL };
+	int ret;
+
+	if (entries_thresholds == NULL)
+		ret = ldap_search_ext (t->ld, ld_base, LDAP_SCOPE_BASE, ld_attr, NULL, 0,
+		                       NULL, NULL, NULL, LDAP_NO_LIMIT, &t->msgid);
+	else {
+#ifdef HAVE_LDAP_PARSE_PAGERESPONSE_CONTROL
+		if (page_size > 0) {
+			ret = ldap_create_page_control (t->ld, page_size, &t->cookie, 0, &controls[0]);
+			ber_memfree (t->cookie.bv_val);
+			t->cookie.bv_val = NULL;
+			t->cookie.bv_len = 0;
+			if (ret != LDAP_SUCCESS) {
+				target_fail (t, ldap_err2string (ret));
+				return;
+			}
+		}
+#endif
+		ret = ldap_search_ext (t->ld, ld_base, LDAP_SCOPE_SUBTREE, ld_attr, no_attrs, 0,
+		                       controls[0] ? controls : NULL, NULL, NULL, LDAP_NO_LIMIT, &t->msgid);
+		if (controls[0] != NULL)
+			ldap_control_free (controls[0]);
 	}
-#else
-	else if (!(ld = ldap_open (ld_host, ld_port))) {
-		if (verbose)
-			ldap_perror(ld, "ldap_open");
-		printf (_("Could not connect to the server at port %i\n"), ld_port);
-		return STATE_CRITICAL;
+	if (ret != LDAP_SUCCESS) {
+		target_fail (t, ldap_err2string (ret));
+		return;
 	}
-#endif /* HAVE_LDAP_INIT */
+	target_sent (t);
+}
+
+/* Every --search at once, each with a message id of its own and counting
+ * the entries without their attributes; they are not paged. */
+static void
+target_searches (ldap_target *t)
+{
+	char *no_attrs[] = { LDAP_NO_ATTRS, NULL };
+	search_spec *s;
+	int k, ret;
+
+	if ((t->results = calloc (search_count, sizeof (*t->results))) == NULL)
+		die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+	for (k = 0; k < search_count; k++) {
+		s = &searches[k];
+		t->results[k].time = -1;
+		ret = ldap_search_ext (t->ld, s->base, s->scope, s->filter, no_attrs, 0,
+		                       NULL, NULL, NULL, LDAP_NO_LIMIT, &t->results[k].msgid);
+		if (ret != LDAP_SUCCESS) {
+			target_fail (t, ldap_err2string (ret));
+			return;
+		}
+		t->pending++;
+	}
+	target_sent (t);
+}
+
+static void
+target_search (ldap_target *t)
+{
+	target_next (t, STEP_SEARCH);
+	if (search_count > 0)
+		target_searches (t);
+	else
+		target_search_page (t);
+}
+
+/* an entry or the result of one of the searches, told by its message id */
+static void
+target_search_message (ldap_target *t, LDAPMessage *msg)
+{
+	search_result *r = NULL;
+	int k, ret, code;
+
+	for (k = 0; k < search_count; k++) {
+		if (t->results[k].msgid == ldap_msgid (msg)) {
+			r = &t->results[k];
+			break;
+		}
+	}
+	if (r == NULL || r->time >= 0)
+		return;
+	if (ldap_msgtype (msg) == LDAP_RES_SEARCH_ENTRY) {
+		r->entries++;
+		return;
+	}
+	if (ldap_msgtype (msg) == LDAP_RES_SEARCH_REFERENCE)
+		return;
+
+	ret = ldap_parse_result (t->ld, msg, &code, NULL, NULL, NULL, NULL, 0);
+	r->code = ret == LDAP_SUCCESS ? code : ret;
+	r->time = (double)deltime (t->step_start) / 1.0e6;
+	if (verbose > 1)
+		printf ("search %d on %s: %d entries in %.3f seconds (%s)\n", k + 1, t->name,
+		        r->entries, r->time, ldap_err2string (r->code));
+	if (--t->pending == 0)
+		target_finish (t, STATE_OK);
+}
+
+/* the response for the step, or an entry of the search */
+static void
+target_message (ldap_target *t, LDAPMessage *msg)
+{
+	LDAPControl **returned = NULL;
+	int ret, code;
+
+	if (t->step == STEP_SEARCH && search_count > 0) {
+		target_search_message (t, msg);
+		return;
+	}
+
+	if (ldap_msgtype (msg) == LDAP_RES_SEARCH_ENTRY) {
+		t->entries++;
+		return;
+	}
+	if (ldap_msgtype (msg) == LDAP_RES_SEARCH_REFERENCE)
+		return;
+
+	ret = ldap_parse_result (t->ld, msg, &code, NULL, NULL, NULL, &returned, 0);
+	if (ret == LDAP_SUCCESS)
+		ret = code;
+	if (ret != LDAP_SUCCESS) {
+		if (returned != NULL)
+			ldap_controls_free (returned);
+		target_fail (t, ldap_err2string (ret));
+		return;
+	}
+
+	switch (t->step) {
+	case STEP_TLS:
+#ifdef HAVE_LDAP_INSTALL_TLS
+		if ((ret = ldap_install_tls (t->ld)) != LDAP_SUCCESS)
+			target_fail (t, ldap_err2string (ret));
+		else
+			target_secure (t);
+#endif
+		break;
+	case STEP_BIND:
+		if (t->key != NULL)
+			np_pool_add (t->key, t->ld, &pool_ops);
+		target_search (t);
+		break;
+	case STEP_SEARCH:
+#ifdef HAVE_LDAP_PARSE_PAGERESPONSE_CONTROL
+		/* the cookie of the next page, empty after the last one */
+		if (returned != NULL) {
+			LDAPControl *page;
+			ber_int_t estimate;
+
+			page = ldap_control_find (LDAP_CONTROL_PAGEDRESULTS, returned, NULL);
+			if (page != NULL)
+				ldap_parse_pageresponse_control (t->ld, page, &estimate, &t->cookie);
+		}
+#endif
+		if (t->cookie.bv_len > 0)
+			target_search_page (t);
+		else {
+			if (verbose > 1 && entries_thresholds != NULL)
+				printf ("counted %d entries on %s\n", t->entries, t->name);
+			target_finish (t, STATE_OK);
+		}
+		break;
+	}
+	if (returned != NULL)
+		ldap_controls_free (returned);
+}
+
+/* everything the library has for the step, without waiting */
+static void
+target_read (ldap_target *t)
+{
+	struct timeval zero = { 0, 0 };
+	LDAPMessage *msg;
+	int ret;
+
+	/* the results of the searches come as the server has them */
+	while (t->step < STEP_DONE && (t->msgid >= 0 || t->pending > 0)) {
+		ret = ldap_result (t->ld, t->pending > 0 ? LDAP_RES_ANY : t->msgid, LDAP_MSG_ONE,
+		                   &zero, &msg);
+		if (ret == 0)
+			break;
+		if (ret < 0) {
+			ldap_get_option (t->ld, LDAP_OPT_ERROR_NUMBER, &ret);
+			target_fail (t, ldap_err2string (ret != LDAP_SUCCESS ? ret : LDAP_SERVER_DOWN));
+			break;
+		}
+		target_message (t, msg);
+		ldap_msgfree (msg);
+	}
+}
+
+/* the options of a new handle, with what the library does blocking
+ * bounded by ms */
+static int
+target_options (ldap_target *t, int ms)
+{
+	struct timeval net;
 
+	net.tv_sec = ms / 1000;
+	net.tv_usec = (ms % 1000) * 1000;
+	ldap_set_option (t->ld, LDAP_OPT_NETWORK_TIMEOUT, &net);
 #ifdef HAVE_LDAP_SET_OPTION
 	/* set ldap options */
-	if (ldap_set_option (ld, LDAP_OPT_PROTOCOL_VERSION, &ld_protocol) !=
+	if (ldap_set_option (t->ld, LDAP_OPT_PROTOCOL_VERSION, &ld_protocol) !=
 			LDAP_OPT_SUCCESS ) {
-		printf(_("Could not set protocol version %d\n"), ld_protocol);
-		return STATE_CRITICAL;
+		xasprintf (&t->msg, _("Could not set protocol version %d"), ld_protocol);
+		target_finish (t, STATE_CRITICAL);
+		return FALSE;
 	}
 #endif
+	return TRUE;
+}
+
+/* A handle that connects as it sends the first request, for when we
+ * cannot connect ourselves: everything but the connect is asynchronous. */
+static void
+target_init (ldap_target *t)
+{
+	if (t->uri != NULL)
+	{
+#ifdef HAVE_LDAP_INITIALIZE
+		int result = ldap_initialize(&t->ld, t->uri);
+		if (result != LDAP_SUCCESS)
+		{
+			xasprintf (&t->msg, "Failed to connect to LDAP server at %s: %s",
+				t->uri, ldap_err2string(result));
+			target_finish (t, STATE_CRITICAL);
+			return;
+		}
+#else
+		xasprintf (&t->msg, "Sorry, this version of %s was compiled without URI support!",
+			progname);
+		target_finish (t, STATE_CRITICAL);
+		return;
+#endif
+	}
+#ifdef HAVE_LDAP_INIT
+	else if (!(t->ld = ldap_init (t->host, t->port))) {
+		target_fail (t, NULL);
+		return;
+	}
+#else
+	else if (!(t->ld = ldap_open (t->host, t->port))) {
+		target_fail (t, NULL);
+		return;
+	}
+#endif /* HAVE_LDAP_INIT */
+
+	t->lazy = TRUE;
+	if (! target_options (t, np_net_time_left (t->deadline)))
+		return;
 
-	if (ld_port == LDAPS_PORT || ssl_on_connect) {
+	if (t->tls_on_connect) {
 		xasprintf (&SERVICE, "LDAPS");
 #if defined(HAVE_LDAP_SET_OPTION) && defined(LDAP_OPT_X_TLS)
 		/* ldaps: set option tls */
-		tls = LDAP_OPT_X_TLS_HARD;
+		int tls = LDAP_OPT_X_TLS_HARD;
 
-		if (ldap_set_option (ld, LDAP_OPT_X_TLS, &tls) != LDAP_SUCCESS)
+		if (ldap_set_option (t->ld, LDAP_OPT_X_TLS, &tls) != LDAP_SUCCESS)
 		{
-			if (verbose)
-				ldap_perror(ld, "ldaps_option");
-			printf (_("Could not init TLS at port %i!\n"), ld_port);
-			return STATE_CRITICAL;
+			xasprintf (&t->msg, _("Could not init TLS at port %i!"), t->port);
+			target_finish (t, STATE_CRITICAL);
+			return;
 		}
-
-		if (check_cert == TRUE)
-			return ldap_check_cert(ld);
 #else
-		printf (_("TLS not supported by the libraries!\n"));
-		return STATE_CRITICAL;
+		xasprintf (&t->msg, "%s", _("TLS not supported by the libraries!"));
+		target_finish (t, STATE_CRITICAL);
+		return;
 #endif /* LDAP_OPT_X_TLS */
-	} else if (starttls) {
-		xasprintf (&SERVICE, "LDAP-TLS");
-#if defined(HAVE_LDAP_SET_OPTION) && defined(HAVE_LDAP_START_TLS_S)
-		/* ldap with startTLS: set option version */
-		if (ldap_get_option(ld,LDAP_OPT_PROTOCOL_VERSION, &version) == LDAP_OPT_SUCCESS )
-		{
-			if (version < LDAP_VERSION3)
-			{
-				version = LDAP_VERSION3;
-				ldap_set_option(ld, LDAP_OPT_PROTOCOL_VERSION, &version);
-			}
-		}
-		/* call start_tls */
-		if (ldap_start_tls_s(ld, NULL, NULL) != LDAP_SUCCESS)
-		{
-			if (verbose)
-				ldap_perror(ld, "ldap_start_tls");
-			printf (_("Could not init startTLS at port %i!\n"), ld_port);
-			return STATE_CRITICAL;
-		}
-
-		if (check_cert == TRUE)
-			return ldap_check_cert(ld);
-#else
-		printf (_("startTLS not supported by the library, needs LDAPv3!\n"));
-		return STATE_CRITICAL;
-#endif /* HAVE_LDAP_START_TLS_S */
 	}
 
-	/* bind to the ldap server */
-	if (ldap_bind_s (ld, ld_binddn, ld_passwd, LDAP_AUTH_SIMPLE) !=
-			LDAP_SUCCESS) {
-		if (verbose)
-			ldap_perror(ld, "ldap_bind");
-		printf (_("Could not bind to the LDAP server\n"));
-		return STATE_CRITICAL;
+	if (starttls)
+		target_starttls (t);
+	else
+		target_bind (t);
+}
+
+#ifdef HAVE_LDAP_INIT_FD
+/* Connect to the server of a -H, or of an ldap:// or ldaps:// -U, without
+ * waiting, so that all servers connect at once. FALSE leaves it to the
+ * library. */
+static int
+target_connect (ldap_target *t)
+{
+	struct addrinfo hints, *res;
+	LDAPURLDesc *lud;
+	char *host = t->host;
+	char port[8];
+	int ret;
+
+	if (t->uri != NULL) {
+		if (ldap_url_parse (t->uri, &lud) != LDAP_URL_SUCCESS)
+			return FALSE;
+		if (lud->lud_host == NULL || *lud->lud_host == '\0' || lud->lud_scheme == NULL ||
+		    (strcasecmp (lud->lud_scheme, "ldap") && strcasecmp (lud->lud_scheme, "ldaps"))) {
+			ldap_free_urldesc (lud);
+			return FALSE;
+		}
+		host = strdup (lud->lud_host);
+		if (strcasecmp (lud->lud_scheme, "ldaps") == 0)
+			t->tls_on_connect = TRUE;
+		t->port = lud->lud_port > 0 ? lud->lud_port : t->tls_on_connect ? LDAPS_PORT : DEFAULT_PORT;
+		ldap_free_urldesc (lud);
 	}
+	if (t->tls_on_connect)
+		xasprintf (&SERVICE, "LDAPS");
 
-	/* do a search of all objectclasses in the base dn */
-	if (ldap_search_s (ld, ld_base, (crit_entries!=NULL || warn_entries!=NULL) ? LDAP_SCOPE_SUBTREE : LDAP_SCOPE_BASE, ld_attr, NULL, 0, &result)
-			!= LDAP_SUCCESS) {
-		if (verbose)
-			ldap_perror(ld, "ldap_search");
-		printf (_("Could not search/find objectclasses in %s\n"), ld_base);
-		return STATE_CRITICAL;
-	} else if (crit_entries!=NULL || warn_entries!=NULL) {
-		num_entries = ldap_count_entries(ld, result);
+	/* the name the library checks the certificate for */
+	xasprintf (&t->url, "ldap://%s%s%s:%d", strchr (host, ':') ? "[" : "", host,
+	           strchr (host, ':') ? "]" : "", t->port);
+
+	snprintf (port, sizeof (port), "%d", t->port);
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = address_family;
+	hints.ai_socktype = SOCK_STREAM;
+	if ((ret = np_net_getaddrinfo (host, port, &hints, &res)) != 0) {
+		target_fail (t, gai_strerror (ret));
+		return TRUE;
+	}
+	if ((t->fd = socket (res->ai_family, SOCK_STREAM, 0)) < 0) {
+		target_fail (t, strerror (errno));
+		return TRUE;
+	}
+	fcntl (t->fd, F_SETFL, fcntl (t->fd, F_GETFL) | O_NONBLOCK);
+	if (connect (t->fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS) {
+		target_fail (t, strerror (errno));
+		return TRUE;
 	}
+	t->events = POLLOUT;
+	return TRUE;
+}
 
-	/* unbind from the ldap server */
-	ldap_unbind (ld);
+/* the socket is connected, or failed to; TLS or the bind next */
+static void
+target_connected (ldap_target *t)
+{
+	socklen_t len = sizeof (int);
+	int err = 0, ret;
+
+	if (getsockopt (t->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+		err = errno;
+	if (err != 0) {
+		target_fail (t, strerror (err));
+		return;
+	}
+	/* the library reads and writes it as one it connected itself */
+	fcntl (t->fd, F_SETFL, fcntl (t->fd, F_GETFL) & ~O_NONBLOCK);
+	if ((ret = ldap_init_fd (t->fd, LDAP_PROTO_TCP, t->url, &t->ld)) != LDAP_SUCCESS) {
+		target_fail (t, ldap_err2string (ret));
+		return;
+	}
+	if (! target_options (t, np_net_time_left (np_net_deadline (np_net_io_timeout))))
+		return;
+
+	if (t->tls_on_connect) {
+		target_next (t, STEP_TLS);
+		if ((ret = ldap_install_tls (t->ld)) != LDAP_SUCCESS)
+			target_fail (t, ldap_err2string (ret));
+		else
+			target_secure (t);
+	}
+	else if (starttls)
+		target_starttls (t);
+	else
+		target_bind (t);
+}
+#endif /* HAVE_LDAP_INIT_FD */
 
-	/* reset the alarm handler */
-	alarm (0);
+static void
+target_start (ldap_target *t)
+{
+	int i;
+
+	gettimeofday (&t->start, NULL);
+	for (i = 0; i < STEP_DONE; i++)
+		t->time[i] = -1;
+	t->step = STEP_DONE;
+	t->state = STATE_OK;
+	t->port = ld_port;
+	t->tls_on_connect = (ld_port == LDAPS_PORT || ssl_on_connect);
+	t->results = NULL;
+	t->pending = 0;
+
+	/* a resident worker may have kept a connection bound with the same
+	 * options, unless it is the certificate that is checked */
+	if (! check_cert) {
+		xasprintf (&t->key, "%s:%s:%d:%d:%d:%d:%s:%s", t->uri ? t->uri : "",
+		           t->host ? t->host : "", ld_port,
+#ifdef HAVE_LDAP_SET_OPTION
+		           ld_protocol,
+#else
+		           0,
+#endif
+		           starttls, ssl_on_connect,
+		           ld_binddn ? ld_binddn : "", ld_passwd ? ld_passwd : "");
+		if ((t->ld = np_pool_get (t->key, &pool_ops)) != NULL) {
+			if (verbose)
+				printf ("Reusing the connection to %s of an earlier check\n", t->name);
+			t->fd = pool_fd (t->ld);
+			target_search (t);
+			return;
+		}
+	}
 
-	/* calcutate the elapsed time and compare to thresholds */
+	target_next (t, STEP_CONNECT);
+#ifdef HAVE_LDAP_INIT_FD
+	if (target_connect (t))
+		return;
+#endif
+	target_init (t);
+}
 
-	microsec = deltime (tv);
-	elapsed_time = (double)microsec / 1.0e6;
+/* Check every server at once: each connection is driven by the responses
+ * read from it, and fails when a step does not finish by its deadline. */
+static void
+check_targets (void)
+{
+	struct pollfd *pfd;
+	ldap_target **active;
+	nfds_t nactive, i;
+	int k, ms, wait;
+
+	pfd = calloc (target_count, sizeof (*pfd));
+	active = calloc (target_count, sizeof (*active));
+	if (pfd == NULL || active == NULL)
+		die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+
+	for (k = 0; k < target_count; k++)
+		target_start (&targets[k]);
+
+	for (;;) {
+		nactive = 0;
+		wait = -1;
+		for (k = 0; k < target_count; k++) {
+			ldap_target *t = &targets[k];
+
+			if (t->step == STEP_DONE)
+				continue;
+			if ((ms = np_net_time_left (t->deadline)) == 0) {
+				target_fail (t, _("timed out"));
+				continue;
+			}
+			/* the library did not say which socket it reads; look again soon */
+			if (t->fd < 0 && ms > 10)
+				ms = 10;
+			pfd[nactive].fd = t->fd;
+			pfd[nactive].events = t->events;
+			pfd[nactive].revents = 0;
+			active[nactive++] = t;
+			if (wait < 0 || ms < wait)
+				wait = ms;
+		}
+		if (nactive == 0)
+			break;
 
-	if (crit_time!=UNDEFINED && elapsed_time>crit_time)
-		status = STATE_CRITICAL;
-	else if (warn_time!=UNDEFINED && elapsed_time>warn_time)
-		status = STATE_WARNING;
-	else
-		status = STATE_OK;
+		if (poll (pfd, nactive, wait) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, "%s %s\n", _("poll failed:"), strerror (errno));
 
-	if(entries_thresholds != NULL) {
-		if (verbose) {
-			printf ("entries found: %d\n", num_entries);
-			print_thresholds("entry thresholds", entries_thresholds);
-		}
-		status_entries = get_status(num_entries, entries_thresholds);
-		if (status_entries == STATE_CRITICAL) {
-			status = STATE_CRITICAL;
-		} else if (status != STATE_CRITICAL) {
-			status = status_entries;
+		for (i = 0; i < nactive; i++) {
+			if (pfd[i].revents == 0 && active[i]->fd >= 0)
+				continue;
+#ifdef HAVE_LDAP_INIT_FD
+			if (active[i]->step == STEP_CONNECT && active[i]->ld == NULL)
+				target_connected (active[i]);
+			else
+#endif
+				target_read (active[i]);
 		}
 	}
 
-	/* print out the result */
-	if (crit_entries!=NULL || warn_entries!=NULL) {
-		printf (_("LDAP %s - found %d entries in %.3f seconds|%s %s\n"),
-			state_text (status),
-			num_entries,
-			elapsed_time,
-			fperfdata ("time", elapsed_time, "s",
-				(int)warn_time, warn_time,
-				(int)crit_time, crit_time,
-				TRUE, 0, FALSE, 0),
-			sperfdata ("entries", (double)num_entries, "",
-				warn_entries,
-				crit_entries,
-				TRUE, 0.0, FALSE, 0.0));
-	} else {
-		printf (_("LDAP %s - %.3f seconds response time|%s\n"),
-			state_text (status),
-			elapsed_time,
-			fperfdata ("time", elapsed_time, "s",
-				(int)warn_time, warn_time,
-				(int)crit_time, crit_time,
-				TRUE, 0, FALSE, 0));
-	}
-
-	return status;
+	free (pfd);
+	free (active);
 }
 
 /* process command-line arguments */
@@ -308,6 +1174,13 @@ process_arguments (int argc, char **argv)
 	int c;
 	char *temp;
 
+	enum {
+		TRACE_TIMING_OPTION = CHAR_MAX + 1,
+		PAGE_SIZE_OPTION,
+		PHASE_TIMEOUT_OPTION,
+		SEARCH_OPTION
+	};
+
 	int option = 0;
 	/* initialize the long option struct */
 	static struct option longopts[] = {
@@ -334,7 +1207,11 @@ process_arguments (int argc, char **argv)
 		{"crit", required_argument, 0, 'c'},
 		{"warn-entries", required_argument, 0, 'W'},
 		{"crit-entries", required_argument, 0, 'C'},
+		{"page-size", required_argument, 0, PAGE_SIZE_OPTION},
+		{"search", required_argument, 0, SEARCH_OPTION},
+		{"phase-timeout", required_argument, 0, PHASE_TIMEOUT_OPTION},
 		{"verbose", no_argument, 0, 'v'},
+		{"trace-timing", no_argument, 0, TRACE_TIMING_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -355,18 +1232,20 @@ process_arguments (int argc, char **argv)
 		switch (c) {
 		case 'h':									/* help */
 			print_help ();
-			exit (STATE_OK);
+			np_exit (STATE_OK);
 		case 'V':									/* version */
 			print_revision (progname, NP_VERSION);
-			exit (STATE_OK);
+			np_exit (STATE_OK);
 		case 't':									/* timeout period */
 			timeout_interval = parse_timeout_string(optarg);
 			break;
 		case 'U':
 			ld_uri = optarg;
+			target_add (NULL, optarg);
 			break;
 		case 'H':
 			ld_host = optarg;
+			target_add (optarg, NULL);
 			break;
 		case 'b':
 			ld_base = optarg;
@@ -409,6 +1288,22 @@ process_arguments (int argc, char **argv)
 		case 'v':
 			verbose++;
 			break;
+		case TRACE_TIMING_OPTION:
+			trace_timing = TRUE;
+			break;
+		case PAGE_SIZE_OPTION:
+			if (!is_intnonneg (optarg))
+				usage2 (_("Page size must be a positive integer"), optarg);
+			page_size = atoi (optarg);
+			break;
+		case SEARCH_OPTION:
+			search_add (optarg);
+			break;
+		case PHASE_TIMEOUT_OPTION:
+			if (!is_positive (optarg))
+				usage2 (_("Phase timeout must be a positive number of seconds"), optarg);
+			np_net_connect_timeout = np_net_io_timeout = (int)(strtod (optarg, NULL) * 1000);
+			break;
 		case 'T':
 			if (! ssl_on_connect)
 				starttls = TRUE;
@@ -463,8 +1358,10 @@ process_arguments (int argc, char **argv)
 	}
 
 	c = optind;
-	if (ld_host == NULL && is_host(argv[c]))
+	if (target_count == 0 && argv[c] && is_host(argv[c])) {
 		ld_host = strdup (argv[c++]);
+		target_add (ld_host, NULL);
+	}
 
 	if (ld_base == NULL && argv[c])
 		ld_base = strdup (argv[c++]);
@@ -479,13 +1376,28 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments ()
 {
+	int k;
+
 	if ((ld_host==NULL || strlen(ld_host)==0) &&
 		(ld_uri==NULL || strlen(ld_uri)==0))
 		usage4 (_("Please specify the host name or LDAP URI\n"));
 
-	if (ld_base==NULL)
+	if (ld_base==NULL && search_count == 0)
 		usage4 (_("Please specify the LDAP base DN\n"));
 
+	if (search_count > 0 && (crit_entries!=NULL || warn_entries!=NULL))
+		usage4 (_("-W/--warn-entries and -C/--crit-entries cannot be combined with --search, give each search a range instead\n"));
+
+	for (k = 0; k < search_count; k++) {
+		if (searches[k].base == NULL)
+			searches[k].base = ld_base ? ld_base : "";
+		if (searches[k].filter == NULL)
+			searches[k].filter = ld_attr;
+	}
+
+	if (check_cert && target_count > 1)
+		usage4 (_("-A/--age takes a single server\n"));
+
 	if (crit_entries!=NULL || warn_entries!=NULL) {
 		set_thresholds(&entries_thresholds,
 			warn_entries, crit_entries);
@@ -545,8 +1457,22 @@ print_help (void)
   printf ("    %s\n", _("Number of found entries to result in warning status"));
   printf (" %s\n", "-C, --crit-entries=INTEGER");
   printf ("    %s\n", _("Number of found entries to result in critical status"));
+  printf (" %s\n", "--page-size=INTEGER");
+  printf ("    %s\n", _("Entries the server sends at a time when counting them, 0 to not ask for"));
+  printf ("    %s %d)\n", _("pages (default:"), DEFAULT_PAGE_SIZE);
+  printf (" %s\n", "--search=BASE[;FILTER[;SCOPE[;RANGE]]]");
+  printf ("    %s\n", _("A search to send, may be repeated; all are sent at once after the bind and"));
+  printf ("    %s\n", _("the entries each finds counted. SCOPE is base, one or sub (the default), the"));
+  printf ("    %s\n", _("entries outside RANGE are critical; BASE and FILTER default to -b and -a"));
 
 	printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+	printf (" %s\n", "--phase-timeout=SECONDS");
+	printf ("    %s\n", _("Time limit for each of the connect, TLS, bind and search steps of a server"));
+	printf ("    %s\n", _("(default: one second less than the timeout)"));
+
+	printf (" %s\n", "--trace-timing");
+	printf ("    %s\n", _("Print the time spent connecting, in TLS, binding and searching to stderr;"));
+	printf ("    %s\n", _("the perfdata has it as time_connect, time_tls, time_bind and time_search"));
 
 	printf (UT_VERBOSE);
 
@@ -558,6 +1484,13 @@ print_help (void)
 	printf (" %s\n", _("This detection is deprecated, please use 'check_ldap' with the '--starttls' or '--ssl' flags"));
 	printf (" %s\n", _("to define the behaviour explicitly instead."));
 	printf (" %s\n", _("The parameters --warn-entries and --crit-entries are optional."));
+	printf (" %s\n", _("With either, the entries below the base are counted without their attributes,"));
+	printf (" %s\n", _("one page at a time where the server supports paged results."));
+	printf (" %s\n", _("With --search, each search has a line after the summary and a count and time"));
+	printf (" %s\n", _("of its own in the perfdata, search1_entries and search1_time for the first."));
+	printf (" %s\n", _("The searches are not paged."));
+	printf (" %s\n", _("-H and -U may be repeated to check several servers at once, with a line for"));
+	printf (" %s\n", _("each after the summary."));
 
 	printf (UT_SUPPORT);
 }
@@ -574,6 +1507,9 @@ print_usage (void)
 			""
 #endif
 			);
+  printf ("       [-W <warn_entries>] [-C <crit_entries>] [--page-size <entries>]\n");
+  printf ("       [--search <base>[;<filter>[;<scope>[;<range>]]]]...\n");
+  printf ("       [--trace-timing]\n");
 }
 
 #ifdef HAVE_SSL
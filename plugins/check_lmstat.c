@@ -0,0 +1,647 @@
+/*****************************************************************************
+*
+* Nagios check_lmstat plugin
+*
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+*
+* Description:
+*
+* This file contains the check_lmstat plugin
+*
+* This plugin checks FlexLM license servers, as check_flexlm does, and the
+* seats in use of any number of features, each with thresholds of its own.
+* lmstat -a is run once for all of them and the table of servers and
+* features parsed from it is kept for --cache-ttl seconds, so that the
+* checks of one license file share a single lmstat call.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+const char *progname = "check_lmstat";
+const char *copyright = "2014";
+const char *email = "devel@nagios-plugins.org";
+
+#include "common.h"
+#include "utils.h"
+#include "utils_cmd.h"
+#include "sha1.h"
+#include <ctype.h>
+
+#define DEFAULT_CACHE_TTL 30
+/* of the cached table, see lmstat_parse() */
+#define LMSTAT_TABLE_VERSION 1
+
+/* -w or -c: seats in use, or percent of those issued */
+struct lm_threshold {
+	double value;
+	int percent;
+	int set;
+};
+
+/* a -f feature to check */
+struct lm_check {
+	char *name;
+	struct lm_threshold warn;
+	struct lm_threshold crit;
+};
+
+/* a line of the table */
+struct lm_feature {
+	char *name;
+	long issued;    /* -1 if uncounted */
+	long used;
+	char *error;    /* what lmstat says instead of the counts */
+};
+
+struct lm_server {
+	char *name;
+	int up;
+};
+
+char *license_file = NULL;
+#ifdef PATH_TO_LMSTAT
+char *lmstat_path = PATH_TO_LMSTAT;
+#else
+char *lmstat_path = NULL;
+#endif
+unsigned int cache_ttl = DEFAULT_CACHE_TTL;
+int verbose = 0;
+struct lm_check *checks = NULL;
+int check_count = 0;
+struct lm_threshold warn_opt, crit_opt;
+/* -w or -c came after the last -f */
+int thresholds_last = FALSE;
+
+struct lm_feature *features = NULL;
+size_t feature_count = 0, feature_size = 0;
+struct lm_server *servers = NULL;
+size_t server_count = 0, server_size = 0;
+char *lmstat_error = NULL;
+
+int process_arguments (int, char **);
+int validate_arguments (void);
+void print_help (void);
+void print_usage (void);
+
+/* the table is kept under a key of lmstat and the license file, whatever
+ * the features and thresholds of the check */
+static void
+lmstat_enable_state (void)
+{
+	struct sha1_ctx ctx;
+	unsigned char key[SHA1_DIGEST_SIZE];
+	char keyname[2 * SHA1_DIGEST_SIZE + 1];
+	int i;
+
+	sha1_init_ctx (&ctx);
+	sha1_process_bytes (lmstat_path, strlen (lmstat_path) + 1, &ctx);
+	sha1_process_bytes (license_file, strlen (license_file) + 1, &ctx);
+	sha1_finish_ctx (&ctx, key);
+	for (i = 0; i < SHA1_DIGEST_SIZE; i++)
+		sprintf (&keyname[2 * i], "%02x", key[i]);
+
+	np_enable_state (keyname, LMSTAT_TABLE_VERSION);
+}
+
+/* N of the next "Total of N license(s)" in *s, which moves past it; -1 if
+ * there is none */
+static long
+total_of (const char **s)
+{
+	const char *p = strstr (*s, "Total of ");
+	char *end;
+	long n;
+
+	if (p == NULL)
+		return -1;
+	n = strtol (p + 9, &end, 10);
+	if (end == p + 9)
+		return -1;
+	*s = end;
+	return n;
+}
+
+/*
+ * The output of lmstat -a as the table that is cached, a line for each
+ * license server and feature:
+ *
+ *   S UP|DOWN NAME
+ *   F ISSUED USED NAME       ISSUED is -1 for an uncounted feature
+ *   X NAME TEXT              an error in place of the counts
+ *   E TEXT                   why lmstat found no server at all
+ *
+ * Anything else in the output, the users of each feature among it, is
+ * left out.
+ */
+static void
+lmstat_parse (const output *out, const output *err, np_strbuf *table)
+{
+	const char *line, *p, *colon;
+	const char *first = NULL;
+	long issued, used;
+	int servers_seen = 0;
+	size_t i, n;
+
+	for (i = 0; i < out->lines; i++) {
+		line = out->line[i];
+		if (verbose > 1)
+			printf ("%s\n", line);
+		line += strspn (line, " \t");
+
+		if (!strncmp (line, "Users of ", 9) && (colon = strchr (line + 9, ':')) != NULL) {
+			n = colon - (line + 9);
+			p = colon;
+			if ((issued = total_of (&p)) >= 0 && (used = total_of (&p)) >= 0) {
+				np_strbuf_appendf (table, "F %ld %ld ", issued, used);
+			} else if (strstr (colon, "Uncounted")) {
+				np_strbuf_puts (table, "F -1 0 ");
+			} else {
+				p = colon + 1 + strspn (colon + 1, " \t(");
+				np_strbuf_puts (table, "X ");
+				np_strbuf_append (table, line + 9, n);
+				np_strbuf_appendf (table, " %.*s\n", (int) strcspn (p, ")"), p);
+				continue;
+			}
+			np_strbuf_append (table, line + 9, n);
+			np_strbuf_puts (table, "\n");
+		} else if ((p = strstr (line, ": license server ")) != NULL) {
+			np_strbuf_appendf (table, "S %s %.*s\n", strstr (p, "UP") ? "UP" : "DOWN",
+			                   (int) (p - line), line);
+			servers_seen++;
+		} else if (first == NULL && *line && strncmp (line, "lmstat", 6) &&
+		           strncmp (line, "Flexible License Manager", 24)) {
+			first = line;
+		}
+	}
+
+	if (!servers_seen) {
+		if (err->lines)
+			first = err->line[0];
+		np_strbuf_appendf (table, "E %s\n", first ? first : _("No license server found"));
+	}
+}
+
+static int
+feature_compare (const void *a, const void *b)
+{
+	return strcmp (((const struct lm_feature *) a)->name, ((const struct lm_feature *) b)->name);
+}
+
+/* the table back into servers[] and features[], sorted by name, with the
+ * counts of a feature served more than once added up */
+static void
+lmstat_load (char *table)
+{
+	struct lm_feature *f;
+	char *line, *next, *name;
+	size_t i, n;
+	int len;
+
+	for (line = table; *line; line = next) {
+		if ((next = strchr (line, '\n')) != NULL)
+			*next++ = '\0';
+		else
+			next = line + strlen (line);
+
+		if (line[0] == 'S' && line[1] == ' ' && (name = strchr (line + 2, ' ')) != NULL) {
+			if (server_count == server_size) {
+				server_size = server_size ? server_size * 2 : 4;
+				if ((servers = realloc (servers, server_size * sizeof (*servers))) == NULL)
+					die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+			}
+			servers[server_count].up = !strncmp (line + 2, "UP ", 3);
+			servers[server_count++].name = name + 1;
+		} else if ((line[0] == 'F' || line[0] == 'X') && line[1] == ' ') {
+			if (feature_count == feature_size) {
+				feature_size = feature_size ? feature_size * 2 : 64;
+				if ((features = realloc (features, feature_size * sizeof (*features))) == NULL)
+					die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+			}
+			f = &features[feature_count];
+			memset (f, 0, sizeof (*f));
+			if (line[0] == 'F') {
+				if (sscanf (line + 2, "%ld %ld %n", &f->issued, &f->used, &len) < 2)
+					continue;
+				f->name = line + 2 + len;
+			} else {
+				f->name = line + 2;
+				if ((f->error = strchr (f->name, ' ')) != NULL)
+					*f->error++ = '\0';
+				else
+					f->error = "";
+			}
+			feature_count++;
+		} else if (line[0] == 'E' && line[1] == ' ') {
+			lmstat_error = line + 2;
+		}
+	}
+
+	qsort (features, feature_count, sizeof (*features), feature_compare);
+	for (i = 0, n = 0; i < feature_count; i++) {
+		if (n > 0 && !strcmp (features[n - 1].name, features[i].name)) {
+			f = &features[n - 1];
+			if (features[i].error || f->error) {
+				f->error = f->error ? f->error : features[i].error;
+			} else if (f->issued < 0 || features[i].issued < 0) {
+				f->issued = -1;
+				f->used += features[i].used;
+			} else {
+				f->issued += features[i].issued;
+				f->used += features[i].used;
+			}
+			continue;
+		}
+		features[n++] = features[i];
+	}
+	feature_count = n;
+}
+
+/* the table of a run of lmstat less than cache_ttl seconds old, or of a
+ * new one; runs at the same time wait for the one that runs lmstat */
+static char *
+lmstat_table (void)
+{
+	char *argv[5];
+	char *table_path = NULL, *lock_path = NULL, *table;
+	output chld_out, chld_err;
+	np_strbuf buf;
+	size_t length;
+	int lock = -1, status;
+
+	if (cache_ttl) {
+		lmstat_enable_state ();
+		table_path = np_state_path (".table");
+		lock_path = np_state_path (".lock");
+	}
+	if (table_path && lock_path) {
+		if (np_cache_read (table_path, time (NULL), cache_ttl, &status, &table, &length) ||
+		    ((lock = np_cache_lock (lock_path)) >= 0 &&
+		     np_cache_read (table_path, time (NULL), cache_ttl, &status, &table, &length))) {
+			if (lock >= 0)
+				close (lock);
+			if (verbose)
+				printf (_("lmstat table of %s from the cache\n"), license_file);
+			return table;
+		}
+	}
+
+	argv[0] = lmstat_path;
+	argv[1] = "-a";
+	argv[2] = "-c";
+	argv[3] = license_file;
+	argv[4] = NULL;
+	if (verbose)
+		printf ("%s -a -c %s\n", lmstat_path, license_file);
+	if ((status = cmd_run_array (argv, &chld_out, &chld_err, 0)) < 0)
+		die (STATE_UNKNOWN, _("Could not run %s\n"), lmstat_path);
+
+	np_strbuf_init (&buf, NULL);
+	lmstat_parse (&chld_out, &chld_err, &buf);
+	if ((table = strdup (np_strbuf_string (&buf))) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	if (lock >= 0) {
+		np_cache_write (table_path, time (NULL), status, table, strlen (table));
+		close (lock);
+	}
+	return table;
+}
+
+/* the threshold's number of seats of those issued */
+static double
+threshold_seats (const struct lm_threshold *t, long issued)
+{
+	return t->percent ? t->value * issued / 100 : t->value;
+}
+
+static int
+check_feature (const struct lm_check *c, np_perfdata *perf, char **msg)
+{
+	struct lm_feature key, *f;
+	int state = STATE_OK;
+
+	key.name = c->name;
+	f = bsearch (&key, features, feature_count, sizeof (*features), feature_compare);
+	if (f == NULL) {
+		xasprintf (msg, _("%s: not served"), c->name);
+		return STATE_CRITICAL;
+	}
+	if (f->error) {
+		xasprintf (msg, "%s: %s", c->name, f->error);
+		return STATE_CRITICAL;
+	}
+	if (f->issued < 0) {
+		xasprintf (msg, _("%s: %ld licenses in use, uncounted"), c->name, f->used);
+		np_perfdata_add (perf, c->name, f->used, "", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+		return STATE_OK;
+	}
+
+	if (c->crit.set && f->used > threshold_seats (&c->crit, f->issued))
+		state = STATE_CRITICAL;
+	else if (c->warn.set && f->used > threshold_seats (&c->warn, f->issued))
+		state = STATE_WARNING;
+	xasprintf (msg, _("%s: %ld of %ld licenses in use"), c->name, f->used, f->issued);
+	np_perfdata_add (perf, c->name, f->used, "",
+	                 c->warn.set, (long) threshold_seats (&c->warn, f->issued),
+	                 c->crit.set, (long) threshold_seats (&c->crit, f->issued),
+	                 TRUE, 0, TRUE, f->issued);
+	return state;
+}
+
+/* the servers as check_flexlm judges them: all up is OK, some WARNING,
+ * none CRITICAL */
+static int
+check_servers (char **up, char **down, int *up_count)
+{
+	size_t i;
+
+	*up = *down = NULL;
+	*up_count = 0;
+	for (i = 0; i < server_count; i++) {
+		if (servers[i].up) {
+			(*up_count)++;
+			xasprintf (up, "%s%s%s", *up ? *up : "", *up ? ", " : "", servers[i].name);
+		} else {
+			xasprintf (down, "%s%s%s", *down ? *down : "", *down ? ", " : "", servers[i].name);
+		}
+	}
+	if (*down == NULL)
+		return STATE_OK;
+	return *up_count ? STATE_WARNING : STATE_CRITICAL;
+}
+
+int
+main (int argc, char **argv)
+{
+	np_perfdata perf;
+	char *up, *down, *msg, *lines = "", *problems = NULL;
+	int result, state, up_count, count_ok = 0;
+	int i;
+
+	setlocale (LC_ALL, "");
+	bindtextdomain (PACKAGE, LOCALEDIR);
+	textdomain (PACKAGE);
+
+	/* Parse extra opts if any */
+	argv = np_extra_opts (&argc, argv, progname);
+	np_init ((char *) progname, argc, argv);
+
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	if (signal (SIGALRM, timeout_alarm_handler) == SIG_ERR)
+		die (STATE_UNKNOWN, _("Cannot catch SIGALRM"));
+	alarm (timeout_interval);
+
+	lmstat_load (lmstat_table ());
+	alarm (0);
+
+	if (server_count == 0)
+		die (STATE_CRITICAL, "FLEXLM %s - %s\n", state_text (STATE_CRITICAL),
+		     lmstat_error ? lmstat_error : _("No license server found"));
+	result = check_servers (&up, &down, &up_count);
+
+	np_perfdata_init (&perf);
+	if (check_count == 0) {
+		np_perfdata_add (&perf, "up", up_count, "", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, server_count);
+		np_perfdata_add (&perf, "down", server_count - up_count, "", FALSE, 0, FALSE, 0,
+		                 TRUE, 0, TRUE, server_count);
+		printf ("FLEXLM %s - %s%s%s%s%s|%s\n", state_text (result),
+		        up ? _("License servers running: ") : "", up ? up : "", up && down ? "; " : "",
+		        down ? _("License servers NOT running: ") : "", down ? down : "",
+		        np_perfdata_string (&perf));
+		return result;
+	}
+
+	/* servers down count against all the features */
+	if (down)
+		xasprintf (&problems, "%s%s", _("License servers NOT running: "), down);
+	for (i = 0; i < check_count; i++) {
+		state = check_feature (&checks[i], &perf, &msg);
+		result = max_state (result, state);
+		if (state == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s", problems ? problems : "", problems ? "; " : "", msg);
+		xasprintf (&lines, "%s\n[%s] %s", lines, state_text (state), msg);
+	}
+
+	if (check_count == 1 && !down)
+		printf ("FLEXLM %s - %s|%s\n", state_text (result), msg, np_perfdata_string (&perf));
+	else
+		printf ("FLEXLM %s: %d of %d %s%s%s|%s%s\n", state_text (result), count_ok, check_count,
+		        _("features OK"), problems ? " - " : "", problems ? problems : "",
+		        np_perfdata_string (&perf), lines);
+	np_perfdata_free (&perf);
+	return result;
+}
+
+
+/* INTEGER seats in use, or INTEGER% of those issued */
+static int
+parse_threshold (const char *opt, struct lm_threshold *t)
+{
+	char *end;
+
+	if (!isdigit ((unsigned char) opt[0]))
+		return FALSE;
+	t->value = strtod (opt, &end);
+	t->percent = end[0] == '%';
+	t->set = TRUE;
+	return end[t->percent] == '\0' && (!t->percent || t->value <= 100);
+}
+
+/* a -f feature, with the thresholds given so far */
+static void
+add_check (char *name)
+{
+	if ((checks = realloc (checks, (check_count + 1) * sizeof (*checks))) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	checks[check_count].name = name;
+	checks[check_count].warn = warn_opt;
+	checks[check_count].crit = crit_opt;
+	check_count++;
+}
+
+/* process command-line arguments */
+int
+process_arguments (int argc, char **argv)
+{
+	int c, i;
+	char *p;
+
+	int option = 0;
+	static struct option longopts[] = {
+		{"filename", required_argument, 0, 'F'},
+		{"feature", required_argument, 0, 'f'},
+		{"warning", required_argument, 0, 'w'},
+		{"critical", required_argument, 0, 'c'},
+		{"lmstat", required_argument, 0, 'L'},
+		{"cache-ttl", required_argument, 0, 'C'},
+		{"timeout", required_argument, 0, 't'},
+		{"verbose", no_argument, 0, 'v'},
+		{"version", no_argument, 0, 'V'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while (1) {
+		c = getopt_long (argc, argv, "hVvF:f:w:c:L:C:t:", longopts, &option);
+
+		if (c == -1 || c == EOF)
+			break;
+
+		switch (c) {
+		case '?':									/* print short usage statement if args not parsable */
+			usage5 ();
+		case 'h':									/* help */
+			print_help ();
+			exit (STATE_OK);
+		case 'V':									/* version */
+			print_revision (progname, NP_VERSION);
+			exit (STATE_OK);
+		case 'v':									/* verbose */
+			verbose++;
+			break;
+		case 'F':									/* license file */
+			license_file = optarg;
+			break;
+		case 'f':									/* feature, or a list of them */
+			for (p = strtok (optarg, ","); p; p = strtok (NULL, ","))
+				add_check (p);
+			thresholds_last = FALSE;
+			break;
+		case 'w':									/* warning threshold */
+			if (!parse_threshold (optarg, &warn_opt))
+				usage2 (_("Invalid warning threshold"), optarg);
+			thresholds_last = TRUE;
+			break;
+		case 'c':									/* critical threshold */
+			if (!parse_threshold (optarg, &crit_opt))
+				usage2 (_("Invalid critical threshold"), optarg);
+			thresholds_last = TRUE;
+			break;
+		case 'L':									/* lmstat */
+			lmstat_path = optarg;
+			break;
+		case 'C':									/* how long the table is kept */
+			if (!is_integer (optarg) || atoi (optarg) < 0)
+				usage4 (_("Cache TTL must be a number of seconds"));
+			cache_ttl = atoi (optarg);
+			break;
+		case 't':									/* timeout */
+			timeout_interval = parse_timeout_string (optarg);
+			break;
+		}
+	}
+
+	c = optind;
+	if (license_file == NULL && c < argc)
+		license_file = argv[c++];
+
+	/* thresholds after the last -f are for the features given without any */
+	for (i = 0; thresholds_last && i < check_count; i++) {
+		if (!checks[i].warn.set && !checks[i].crit.set) {
+			checks[i].warn = warn_opt;
+			checks[i].crit = crit_opt;
+		}
+	}
+
+	return validate_arguments ();
+}
+
+
+int
+validate_arguments (void)
+{
+	if (license_file == NULL)
+		license_file = getenv ("LM_LICENSE_FILE");
+	if (license_file == NULL)
+		usage4 (_("Missing license.dat file"));
+	if (lmstat_path == NULL)
+		usage4 (_("lmstat was not found when the plugins were built, give its path with -L"));
+	if (access (lmstat_path, X_OK) != 0)
+		usage2 (_("Cannot find \"lmstat\""), lmstat_path);
+	return OK;
+}
+
+
+void
+print_help (void)
+{
+	print_revision (progname, NP_VERSION);
+
+	printf (COPYRIGHT, copyright, email);
+
+	printf ("%s\n", _("This plugin checks FlexLM license servers and the licenses in use of any"));
+	printf ("%s\n", _("number of features. lmstat -a is run once for all of them, and what it says"));
+	printf ("%s\n", _("is kept for the other checks of the license file for a while."));
+
+	printf ("\n\n");
+
+	print_usage ();
+
+	printf (UT_HELP_VRSN);
+	printf (UT_EXTRA_OPTS);
+
+	printf (" %s\n", "-F, --filename=FILE");
+	printf ("    %s\n", _("License file or port@host, as lmstat -c takes it (default: $LM_LICENSE_FILE)"));
+	printf (" %s\n", "-f, --feature=NAME[,NAME...]");
+	printf ("    %s\n", _("Feature to check the licenses in use of; may be repeated, or a list"));
+	printf (" %s\n", "-w, --warning=INTEGER or INTEGER%");
+	printf ("    %s\n", _("Licenses in use, or percent of those issued, above which a feature is a"));
+	printf ("    %s\n", _("warning"));
+	printf (" %s\n", "-c, --critical=INTEGER or INTEGER%");
+	printf ("    %s\n", _("Licenses in use, or percent of those issued, above which a feature is"));
+	printf ("    %s\n", _("critical"));
+	printf (" %s\n", "-L, --lmstat=PATH");
+#ifdef PATH_TO_LMSTAT
+	printf ("    %s %s)\n", _("Path to lmstat (default:"), PATH_TO_LMSTAT);
+#else
+	printf ("    %s\n", _("Path to lmstat"));
+#endif
+	printf (" %s\n", "-C, --cache-ttl=SECONDS");
+	printf ("    %s\n", _("How long the servers and features lmstat reported are used again by the"));
+	printf ("    %s\n", _("checks of the same license file, 0 to run lmstat every time"));
+	printf ("    %s %d)\n", _("(default:"), DEFAULT_CACHE_TTL);
+	printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+	printf (UT_VERBOSE);
+
+	printf ("\n");
+	printf ("%s\n", _("Notes:"));
+	printf (" %s\n", _("Without -f, the license servers are checked as check_flexlm does: OK if all"));
+	printf (" %s\n", _("of them are running, WARNING if some are and CRITICAL if none is. With -f"));
+	printf (" %s\n", _("each feature is checked too, with the -w and -c given before it, or those"));
+	printf (" %s\n", _("given after the last -f if it had none, and there is a line for each."));
+	printf (" %s\n", _("A feature lmstat does not list is CRITICAL, an uncounted one is OK."));
+	printf (" %s\n", _("The table is kept in the state directory, see NAGIOS_PLUGIN_STATE_DIRECTORY."));
+
+	printf ("\n");
+	printf ("%s\n", _("Examples:"));
+	printf (" %s\n", "check_lmstat -F 27000@lic1 -w 90% -c 99% -f MATLAB,Simulink -c 4 -f SOLVER");
+
+	printf (UT_SUPPORT);
+}
+
+
+void
+print_usage (void)
+{
+	printf ("%s\n", _("Usage:"));
+	printf ("%s [-F <license file>] [-L <lmstat>] [-C <cache ttl>]\n", progname);
+	printf ("  [[-w <warn>] [-c <crit>] -f <feature>[,<feature>...]]... [-t timeout] [-v]\n");
+}
@@ -36,6 +36,7 @@ const char *email = "devel@nagios-plugins.org";
 #include "runcmd.h"
 #include "utils.h"
 #include "popen.h"
+#include "utils_proc.h"
 
 #ifdef HAVE_SYS_LOADAVG_H
 #include <sys/loadavg.h>
@@ -54,9 +55,17 @@ static int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
 static int print_top_consuming_processes();
+static int print_top_native (void);
+static int snapshot_loadavg (double *);
+
+/* the CPU of the top processes is taken over this many milliseconds */
+#define TOP_SAMPLE_MSEC 500
 
 static int n_procs_to_show = 0;
 
+/* --snapshot: the oldest a shared snapshot may be to take the load from */
+static int snapshot_age = 0;
+
 /* strictly for pretty-print usage in loops */
 static const int nums[3] = { 1, 5, 15 };
 
@@ -108,12 +117,10 @@ main (int argc, char **argv)
 	double la[3] = { 0.0, 0.0, 0.0 };	/* NetBSD complains about uninitialized arrays */
 #ifndef HAVE_GETLOADAVG
 	char input_buffer[MAX_INPUT_BUFFER];
+	char *const uptime_argv[] = { PATH_TO_UPTIME, NULL };
 	int len;
 #endif
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
 	setlocale(LC_NUMERIC, "POSIX");
 
 	/* Parse extra opts if any */
@@ -122,52 +129,60 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
+	/* the load another check has just read, if there is one */
+	if (snapshot_age && snapshot_loadavg (la))
+		result = 3;
+	else {
 #ifdef HAVE_GETLOADAVG
 	result = getloadavg (la, 3);
 	if (result != 3)
 		return STATE_UNKNOWN;
 #else
-	child_process = spopen (PATH_TO_UPTIME);
-	if (child_process == NULL) {
-		printf (_("Error opening %s\n"), PATH_TO_UPTIME);
-		return STATE_UNKNOWN;
-	}
-	child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
-	if (child_stderr == NULL) {
-		printf (_("Could not open stderr for %s\n"), PATH_TO_UPTIME);
-	}
-	fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_process);
-
-	/* Some platforms include commas in load averages, some don't. */
-	/* Strip out any commas in the uptime output */
-	len = strlen(input_buffer);
-
-	for (i = 0, j = 0; i < len, j < len; i++, j++) {
-		while (input_buffer[j] == ',') {
-			j += 1;
+	/* /proc/loadavg where there is one, rather than running uptime */
+	if (!np_proc_loadavg (la)) {
+		child_process = spopenv (uptime_argv);
+		if (child_process == NULL) {
+			printf (_("Error opening %s\n"), PATH_TO_UPTIME);
+			return STATE_UNKNOWN;
 		}
-		input_buffer[i] = input_buffer[j];
-	}
+		child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
+		if (child_stderr == NULL) {
+			printf (_("Could not open stderr for %s\n"), PATH_TO_UPTIME);
+		}
+		fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_process);
 
-	input_buffer[i] = '\0';
+		/* Some platforms include commas in load averages, some don't. */
+		/* Strip out any commas in the uptime output */
+		len = strlen(input_buffer);
 
-    if(strstr(input_buffer, "load average:")) {
-	    sscanf (input_buffer, "%*[^l]load average: %lf %lf %lf", &la1, &la5, &la15);
-    }
-    else if(strstr(input_buffer, "load averages:")) {
-	    sscanf (input_buffer, "%*[^l]load averages: %lf %lf %lf", &la1, &la5, &la15);
-    }
-    else {
-		printf (_("could not parse load %d from uptime: %s\n"), result, PATH_TO_UPTIME);
-		return STATE_UNKNOWN;
-    }
+		for (i = 0, j = 0; i < len, j < len; i++, j++) {
+			while (input_buffer[j] == ',') {
+				j += 1;
+			}
+			input_buffer[i] = input_buffer[j];
+		}
 
-	result = spclose (child_process);
-	if (result) {
-		printf (_("Error code %d returned in %s\n"), result, PATH_TO_UPTIME);
-		return STATE_UNKNOWN;
+		input_buffer[i] = '\0';
+
+	    if(strstr(input_buffer, "load average:")) {
+		    sscanf (input_buffer, "%*[^l]load average: %lf %lf %lf", &la1, &la5, &la15);
+	    }
+	    else if(strstr(input_buffer, "load averages:")) {
+		    sscanf (input_buffer, "%*[^l]load averages: %lf %lf %lf", &la1, &la5, &la15);
+	    }
+	    else {
+			printf (_("could not parse load %d from uptime: %s\n"), result, PATH_TO_UPTIME);
+			return STATE_UNKNOWN;
+	    }
+
+		result = spclose (child_process);
+		if (result) {
+			printf (_("Error code %d returned in %s\n"), result, PATH_TO_UPTIME);
+			return STATE_UNKNOWN;
+		}
 	}
 #endif
+	}
 
 	if (take_into_account_cpus == 1) {
 		if ((numcpus = GET_NUMBER_OF_CPUS()) > 0) {
@@ -229,6 +244,7 @@ process_arguments (int argc, char **argv)
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
 		{"procs-to-show", required_argument, 0, 'n'},
+		{"snapshot", required_argument, 0, CHAR_MAX+1},
 		{0, 0, 0, 0}
 	};
 
@@ -260,6 +276,11 @@ process_arguments (int argc, char **argv)
 		case 'n':
 			n_procs_to_show = atoi(optarg);
 			break;
+		case CHAR_MAX+1:
+			if (!is_intpos (optarg))
+				usage2 (_("Snapshot age must be a positive integer"), optarg);
+			snapshot_age = atoi (optarg);
+			break;
 		case '?':									/* help */
 			usage5 ();
 		}
@@ -332,6 +353,12 @@ print_help (void)
   printf (" %s\n", "-n, --procs-to-show=NUMBER_OF_PROCS");
   printf ("    %s\n", _("Number of processes to show when printing the top consuming processes."));
   printf ("    %s\n", _("NUMBER_OF_PROCS=0 disables this feature. Default value is 0"));
+  printf ("    %s\n", _("Where there is a /proc, their CPU usage is taken over half a second"));
+  printf ("    %s\n", _("from it rather than from ps, which shows the average over their lifetime"));
+  printf (" %s\n", "--snapshot=SECONDS");
+  printf ("    %s\n", _("Take the load averages from the snapshot check_procs, check_load,"));
+  printf ("    %s\n", _("check_swap and check_users share if it is at most SECONDS old, or take"));
+  printf ("    %s\n", _("one for them"));
 
 	printf (UT_SUPPORT);
 }
@@ -366,9 +393,143 @@ int cmpstringp(const void *p1, const void *p2) {
 }
 #endif /* PS_USES_PROCPCPU */
 
+/* A bounded min-heap of the n_procs_to_show busiest processes seen so
+ * far, the least busy of them at the top, to be replaced by the next that
+ * beats it */
+struct top_proc {
+	np_proc_entry pe;
+	char *args;
+};
+
+static void
+top_sift_down (struct top_proc *heap, int n, int i)
+{
+	struct top_proc tmp;
+	int child;
+
+	while ((child = 2 * i + 1) < n) {
+		if (child + 1 < n && heap[child + 1].pe.pcpu < heap[child].pe.pcpu)
+			child++;
+		if (heap[i].pe.pcpu <= heap[child].pe.pcpu)
+			break;
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
+
+static void
+top_sift_up (struct top_proc *heap, int i)
+{
+	struct top_proc tmp;
+
+	for (; i > 0 && heap[(i - 1) / 2].pe.pcpu > heap[i].pe.pcpu; i = (i - 1) / 2) {
+		tmp = heap[i];
+		heap[i] = heap[(i - 1) / 2];
+		heap[(i - 1) / 2] = tmp;
+	}
+}
+
+static int
+top_compare (const void *a, const void *b)
+{
+	const struct top_proc *pa = a, *pb = b;
+
+	if (pa->pe.pcpu != pb->pe.pcpu)
+		return pa->pe.pcpu < pb->pe.pcpu ? 1 : -1;
+	return pa->pe.pid < pb->pe.pid ? -1 : pa->pe.pid > pb->pe.pid;
+}
+
+/* the load averages of the shared snapshot, FALSE if it has none */
+static int
+snapshot_loadavg (double *la)
+{
+	np_proc_snapshot snap;
+	int ok;
+
+	if (!np_proc_snapshot_open (&snap, NULL, snapshot_age))
+		return FALSE;
+	ok = (snap.header->have & NP_PROC_SNAPSHOT_LOADAVG) != 0;
+	if (ok)
+		memcpy (la, snap.header->load, sizeof (snap.header->load));
+	np_proc_snapshot_close (&snap);
+	return ok;
+}
+
+/* the top processes by their CPU over TOP_SAMPLE_MSEC, from two scans of
+ * /proc rather than ps' averages over their lifetime; STATE_UNKNOWN if
+ * there is no /proc to scan */
+static int
+print_top_native (void)
+{
+	np_proc_scan scan;
+	np_proc_entry pe;
+	np_proc_cpu cpu;
+	struct top_proc *heap;
+	struct timespec pause;
+	int i, n = 0;
+
+	memset (&cpu, 0, sizeof (cpu));
+	if (!np_proc_scan_open (&scan))
+		return STATE_UNKNOWN;
+	np_proc_cpu_begin (&cpu, &scan);
+	while (np_proc_scan_next (&scan, &pe))
+		np_proc_cpu_update (&cpu, &pe);
+	np_proc_scan_close (&scan);
+	np_proc_cpu_next (&cpu);
+
+	pause.tv_sec = TOP_SAMPLE_MSEC / 1000;
+	pause.tv_nsec = TOP_SAMPLE_MSEC % 1000 * 1000000L;
+	while (nanosleep (&pause, &pause) == -1 && errno == EINTR)
+		;
+
+	if (!np_proc_scan_open (&scan)) {
+		np_proc_cpu_free (&cpu);
+		return STATE_UNKNOWN;
+	}
+	if ((heap = calloc (n_procs_to_show, sizeof (*heap))) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	np_proc_cpu_begin (&cpu, &scan);
+	while (np_proc_scan_next (&scan, &pe)) {
+		np_proc_cpu_update (&cpu, &pe);
+		if (n == n_procs_to_show && pe.pcpu <= heap[0].pe.pcpu)
+			continue;
+		/* only those that make it this far have their other files read */
+		if (!np_proc_scan_status (&scan, &pe) || !np_proc_scan_args (&scan, &pe))
+			continue;
+		if (n < n_procs_to_show) {
+			heap[n].pe = pe;
+			heap[n].args = strdup (pe.args);
+			top_sift_up (heap, n++);
+		} else {
+			free (heap[0].args);
+			heap[0].pe = pe;
+			heap[0].args = strdup (pe.args);
+			top_sift_down (heap, n, 0);
+		}
+	}
+	np_proc_scan_close (&scan);
+	np_proc_cpu_free (&cpu);
+
+	qsort (heap, n, sizeof (*heap), top_compare);
+	printf ("%-5s %5s %7s %7s %8s %8s %5s %s\n", "STAT", "UID", "PID", "PPID", "VSZ", "RSS", "%CPU", "COMMAND");
+	for (i = 0; i < n; i++) {
+		printf ("%-5s %5d %7d %7d %8d %8d %5.1f %s\n", heap[i].pe.stat, heap[i].pe.uid,
+		        (int) heap[i].pe.pid, (int) heap[i].pe.ppid, heap[i].pe.vsz, heap[i].pe.rss,
+		        heap[i].pe.pcpu, heap[i].args ? heap[i].args : heap[i].pe.prog);
+		free (heap[i].args);
+	}
+	free (heap);
+	return OK;
+}
+
 static int print_top_consuming_processes() {
 	int i = 0;
 	struct output chld_out, chld_err;
+
+	if (print_top_native () == OK)
+		return OK;
 	if(np_runcmd(PS_COMMAND, &chld_out, &chld_err, 0) != 0){
 		fprintf(stderr, _("'%s' exited with non-zero status.\n"), PS_COMMAND);
 		return STATE_UNKNOWN;
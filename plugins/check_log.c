@@ -0,0 +1,363 @@
+/*****************************************************************************
+*
+* Nagios check_log plugin
+*
+* License: GPL
+* Copyright (c) 1999-2014 Nagios Plugins Development Team
+*
+* Description:
+*
+* This file contains the check_log plugin
+*
+* This plugin scans a log file for lines matching a pattern. Successive
+* runs only report the lines added since the last one: the inode and the
+* offset read up to are kept in a state file, so each run reads only the
+* new bytes. A log that was rotated (a new inode) or truncated is read
+* from its start.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+const char *progname = "check_log";
+const char *copyright = "1999-2014";
+const char *email = "devel@nagios-plugins.org";
+
+#include "common.h"
+#include "utils.h"
+#include "regex.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* where the last run stopped in the log */
+#define LOG_STATE_MAGIC "NPLOG\0\0\1"
+
+typedef struct log_state {
+	char magic[8];
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t offset;
+} log_state;
+
+/* the read size; a longer line grows the buffer */
+#define LOG_BUFSIZE 65536
+
+int process_arguments (int, char **);
+void print_help (void);
+void print_usage (void);
+int state_load (const char *path, log_state *);
+int state_save (const char *path, log_state *);
+
+char *log_file = NULL;
+char *state_file = NULL;
+char *query = NULL;
+int max_warning = -1;
+int cflags = REG_EXTENDED | REG_NOSUB;
+regex_t preg;
+int verbose = 0;
+
+int
+main (int argc, char **argv)
+{
+	int result = STATE_OK;
+	log_state last, now;
+	struct stat st;
+	char *buf, *line, *end, *lastentry = NULL;
+	size_t size = LOG_BUFSIZE, len = 0;
+	uint64_t offset;
+	unsigned long count = 0;
+	ssize_t n;
+	int fd;
+
+	np_init ((char *) progname, argc, argv);
+
+	/* Parse extra opts if any */
+	argv=np_extra_opts (&argc, argv, progname);
+
+	np_set_args (argc, argv);
+
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	if (state_file == NULL) {
+		np_enable_state (NULL, 1);
+		if ((state_file = np_state_path (".offset")) == NULL)
+			die (STATE_UNKNOWN, "%s\n", _("Cannot create the state directory"));
+	}
+
+	/* Set signal handling and alarm timeout */
+	if (signal (SIGALRM, timeout_alarm_handler) == SIG_ERR)
+		usage4 (_("Cannot catch SIGALRM"));
+	alarm (timeout_interval);
+
+	if ((fd = open (log_file, O_RDONLY)) < 0) {
+		if (errno == ENOENT)
+			die (STATE_UNKNOWN, _("Log check error: Log file %s does not exist!\n"), log_file);
+		die (STATE_UNKNOWN, _("Log check error: Log file %s is not readable!\n"), log_file);
+	}
+	if (fstat (fd, &st) != 0)
+		die (STATE_UNKNOWN, _("Log check error: Log file %s is not readable!\n"), log_file);
+
+	memset (&now, 0, sizeof (now));
+	memcpy (now.magic, LOG_STATE_MAGIC, sizeof (now.magic));
+	now.dev = st.st_dev;
+	now.ino = st.st_ino;
+
+	/* the first run only records where the log ends */
+	if (!state_load (state_file, &last)) {
+		now.offset = st.st_size;
+		if (!state_save (state_file, &now))
+			die (STATE_UNKNOWN, _("Log check error: Cannot write %s: %s\n"), state_file, strerror (errno));
+		printf ("%s\n", _("Log check data initialized..."));
+		return STATE_OK;
+	}
+
+	/* a rotated or truncated log is read from its start */
+	if (last.dev != now.dev || last.ino != now.ino || last.offset > (uint64_t) st.st_size)
+		offset = 0;
+	else
+		offset = last.offset;
+	if (verbose)
+		printf (_("Reading %s from offset %llu of %llu\n"), log_file,
+		        (unsigned long long) offset, (unsigned long long) st.st_size);
+	if (offset && lseek (fd, (off_t) offset, SEEK_SET) == (off_t) -1)
+		die (STATE_UNKNOWN, _("Log check error: Cannot seek in %s: %s\n"), log_file, strerror (errno));
+
+	/* the complete lines added since, a line still being written is left
+	 * for the next run */
+	if ((buf = malloc (size + 1)) == NULL)
+		die (STATE_UNKNOWN, _("Log check error: Cannot allocate memory: %s\n"), strerror (errno));
+	while ((n = read (fd, buf + len, size - len)) > 0) {
+		len += n;
+		buf[len] = '\0';
+		for (line = buf; (end = memchr (line, '\n', len - (line - buf))) != NULL; line = end + 1) {
+			*end = '\0';
+			if (regexec (&preg, line, 0, NULL, 0) == 0) {
+				count++;
+				free (lastentry);
+				lastentry = strdup (line);
+			}
+		}
+		offset += line - buf;
+		len -= line - buf;
+		memmove (buf, line, len);
+		if (len == size) {
+			size *= 2;
+			if ((buf = realloc (buf, size + 1)) == NULL)
+				die (STATE_UNKNOWN, _("Log check error: Cannot allocate memory: %s\n"), strerror (errno));
+		}
+	}
+	if (n < 0)
+		die (STATE_UNKNOWN, _("Log check error: Cannot read %s: %s\n"), log_file, strerror (errno));
+	close (fd);
+	free (buf);
+
+	now.offset = offset;
+	if (!state_save (state_file, &now))
+		die (STATE_UNKNOWN, _("Log check error: Cannot write %s: %s\n"), state_file, strerror (errno));
+
+	if (count == 0) {
+		printf (_("Log check ok - 0 pattern matches found|match=%lu;;;0\n"), count);
+	} else {
+		printf ("(%lu) %s|match=%lu;;;0\n", count, lastentry, count);
+		if (max_warning >= 0 && count <= (unsigned long) max_warning)
+			result = STATE_WARNING;
+		else
+			result = STATE_CRITICAL;
+	}
+	return result;
+}
+
+
+
+int
+state_load (const char *path, log_state *state)
+{
+	struct stat st;
+	int fd, ok;
+
+	if ((fd = open (path, O_RDONLY)) < 0)
+		return FALSE;
+	/* an old log of check_log.sh's -O is not a state, and starts over */
+	ok = fstat (fd, &st) == 0 && st.st_size == sizeof (*state) &&
+	     read (fd, state, sizeof (*state)) == sizeof (*state) &&
+	     !memcmp (state->magic, LOG_STATE_MAGIC, sizeof (state->magic));
+	close (fd);
+	return ok;
+}
+
+int
+state_save (const char *path, log_state *state)
+{
+	char *tmp;
+	int fd, ok = FALSE;
+
+	xasprintf (&tmp, "%s.XXXXXX", path);
+	if ((fd = mkstemp (tmp)) >= 0) {
+		ok = write (fd, state, sizeof (*state)) == sizeof (*state) &&
+		     fchmod (fd, S_IRUSR | S_IWUSR | S_IRGRP) == 0;
+		ok = close (fd) == 0 && ok;
+		ok = ok && rename (tmp, path) == 0;
+		if (!ok)
+			unlink (tmp);
+	}
+	free (tmp);
+	return ok;
+}
+
+
+
+/* process command-line arguments */
+int
+process_arguments (int argc, char **argv)
+{
+	int c, err;
+	char errbuf[MAX_INPUT_BUFFER];
+
+	int option = 0;
+	static struct option longopts[] = {
+		{"filename", required_argument, 0, 'F'},
+		{"oldlog", required_argument, 0, 'O'},
+		{"query", required_argument, 0, 'q'},
+		{"max_warning", required_argument, 0, 'w'},
+		{"exitstatus", required_argument, 0, 'x'},
+		{"ignore-case", no_argument, 0, 'i'},
+		{"timeout", required_argument, 0, 't'},
+		{"version", no_argument, 0, 'V'},
+		{"help", no_argument, 0, 'h'},
+		{"verbose", no_argument, 0, 'v'},
+		{0, 0, 0, 0}
+	};
+
+	if (argc < 2)
+		return ERROR;
+
+	while (1) {
+		c = getopt_long (argc, argv, "hVvF:O:q:w:x:it:", longopts, &option);
+
+		if (c == -1 || c == EOF)
+			break;
+
+		switch (c) {
+		case 'h':									/* help */
+			print_help ();
+			exit (STATE_OK);
+		case 'V':									/* version */
+			print_revision (progname, NP_VERSION);
+			exit (STATE_OK);
+		case 'F':									/* log file */
+			log_file = optarg;
+			break;
+		case 'O':									/* state file */
+			if (optarg[0] == '-')
+				die (STATE_UNKNOWN, "%s\n", _("Log check error: You must supply an Old Log File name using '-O'!"));
+			state_file = optarg;
+			break;
+		case 'q':									/* pattern */
+			query = optarg;
+			break;
+		case 'w':									/* matches that are only a warning */
+			if (!is_intnonneg (optarg))
+				usage2 (_("Maximum warning matches must be a non-negative integer"), optarg);
+			max_warning = atoi (optarg);
+			break;
+		case 'x':									/* no longer used, as in check_log.sh */
+			break;
+		case 'i':
+			cflags |= REG_ICASE;
+			break;
+		case 't':									/* timeout */
+			timeout_interval = parse_timeout_string (optarg);
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			usage5 ();
+		}
+	}
+
+	if (log_file == NULL)
+		die (STATE_UNKNOWN, "%s\n", _("Log check error: You must supply a log file using '-F'!"));
+	if (query == NULL)
+		die (STATE_UNKNOWN, "%s\n", _("Log check error: You must supply a pattern using '-q'!"));
+
+	if ((err = regcomp (&preg, query, cflags)) != 0) {
+		regerror (err, &preg, errbuf, MAX_INPUT_BUFFER);
+		die (STATE_UNKNOWN, "Log check error: %s %s\n", _("Could not compile regular expression:"), errbuf);
+	}
+
+	return OK;
+}
+
+
+
+void
+print_help (void)
+{
+	print_revision (progname, NP_VERSION);
+
+	printf (_(COPYRIGHT), copyright, email);
+
+	printf ("%s\n", _("This plugin scans a log file for lines matching a pattern, and only reports"));
+	printf ("%s\n", _("the lines added since its last run."));
+
+	printf ("\n\n");
+
+	print_usage ();
+
+	printf (UT_HELP_VRSN);
+	printf (UT_EXTRA_OPTS);
+
+	printf (" %s\n", "-F, --filename=FILE");
+	printf ("    %s\n", _("The log file to scan"));
+	printf (" %s\n", "-q, --query=REGEX");
+	printf ("    %s\n", _("The extended regular expression to match the lines with"));
+	printf (" %s\n", "-i, --ignore-case");
+	printf ("    %s\n", _("Match the expression without regard to case"));
+	printf (" %s\n", "-w, --max_warning=INTEGER");
+	printf ("    %s\n", _("Up to INTEGER matches are a WARNING, more are CRITICAL. If not set, any"));
+	printf ("    %s\n", _("match is CRITICAL"));
+	printf (" %s\n", "-O, --oldlog=FILE");
+	printf ("    %s\n", _("Where to keep the position read up to. Default: a file of the state"));
+	printf ("    %s\n", _("directory, for this log and these options"));
+	printf (UT_PLUG_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+	printf (UT_VERBOSE);
+
+	printf ("\n");
+	printf ("%s\n", _("Notes:"));
+	printf (" %s\n", _("The first run returns OK with \"Log check data initialized...\". Later runs"));
+	printf (" %s\n", _("read only the lines added since, and print their number of matches and the"));
+	printf (" %s\n", _("last of them. A log that has a new inode or that shrank is read from its"));
+	printf (" %s\n", _("start; lines written to the old file after the last run are not seen."));
+	printf (" %s\n", _("Set max_check_attempts to 1 for the service, as matches are only reported"));
+	printf (" %s\n", _("once."));
+
+	printf ("\n");
+	printf ("%s\n", _("Examples:"));
+	printf (" %s\n", "check_log -F /var/log/messages -q 'LOGIN FAILURE'");
+
+	printf (UT_SUPPORT);
+}
+
+
+
+void
+print_usage (void)
+{
+	printf ("%s\n", _("Usage:"));
+	printf ("%s -F logfile -q query [-O oldlog] [-w max_warning] [-i] [-t timeout]\n", progname);
+}
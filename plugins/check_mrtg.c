@@ -37,11 +37,14 @@ const char *email = "devel@nagios-plugins.org";
 #include "utils.h"
 
 int process_arguments (int, char **);
+int check_log (const char *, int, unsigned long, unsigned long, const char *, char **, char **);
+int check_batch (const char *);
 int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
 
 char *log_file = NULL;
+char *batch_file = NULL;
 int expire_minutes = 0;
 int use_average = TRUE;
 int variable_number = -1;
@@ -53,20 +56,8 @@ char *units;
 int
 main (int argc, char **argv)
 {
-	int result = STATE_OK;
-	FILE *fp;
-	int line;
-	char input_buffer[MAX_INPUT_BUFFER];
-	char *temp_buffer;
-	time_t current_time;
-	time_t timestamp = 0L;
-	unsigned long average_value_rate = 0L;
-	unsigned long maximum_value_rate = 0L;
-	unsigned long rate = 0L;
-
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	int result;
+	char *text, *perf;
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -74,88 +65,153 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments\n"));
 
-	/* open the MRTG log file for reading */
-	fp = fopen (log_file, "r");
-	if (fp == NULL) {
-		printf (_("Unable to open MRTG log file\n"));
-		return STATE_UNKNOWN;
-	}
-
-	line = 0;
-	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
-
-		line++;
+	if (batch_file)
+		return check_batch (batch_file);
 
-		/* skip the first line of the log file */
-		if (line == 1)
-			continue;
+	result = check_log (log_file, variable_number, value_warning_threshold,
+	                    value_critical_threshold, label, &text, &perf);
+	if (perf)
+		printf ("%s|%s\n", text, perf);
+	else
+		printf ("%s\n", text);
+	return result;
+}
 
-		/* break out of read loop if we've passed the number of entries we want to read */
-		if (line > 2)
-			break;
 
-		/* grab the timestamp */
-		temp_buffer = strtok (input_buffer, " ");
-		timestamp = strtoul (temp_buffer, NULL, 10);
-
-		/* grab the average value 1 rate */
-		temp_buffer = strtok (NULL, " ");
-		if (variable_number == 1)
-			average_value_rate = strtoul (temp_buffer, NULL, 10);
-
-		/* grab the average value 2 rate */
-		temp_buffer = strtok (NULL, " ");
-		if (variable_number == 2)
-			average_value_rate = strtoul (temp_buffer, NULL, 10);
-
-		/* grab the maximum value 1 rate */
-		temp_buffer = strtok (NULL, " ");
-		if (variable_number == 1)
-			maximum_value_rate = strtoul (temp_buffer, NULL, 10);
-
-		/* grab the maximum value 2 rate */
-		temp_buffer = strtok (NULL, " ");
-		if (variable_number == 2)
-			maximum_value_rate = strtoul (temp_buffer, NULL, 10);
-	}
 
-	/* close the log file */
-	fclose (fp);
+/* the state of one variable of one log; text is what the plugin prints
+ * for it, perf its perfdata, or NULL if there is no value */
+int
+check_log (const char *file, int variable, unsigned long warning,
+           unsigned long critical, const char *name, char **text, char **perf)
+{
+	int result = STATE_OK;
+	mrtg_sample sample;
+	time_t current_time;
+	unsigned long rate;
 
-	/* if we couldn't read enough data, return an unknown error */
-	if (line <= 2) {
-		printf (_("Unable to process MRTG log file\n"));
+	*text = *perf = NULL;
+	switch (mrtg_read_sample (file, &sample)) {
+	case -1:
+		xasprintf (text, "%s", _("Unable to open MRTG log file"));
+		return STATE_UNKNOWN;
+	case FALSE:
+		xasprintf (text, "%s", _("Unable to process MRTG log file"));
 		return STATE_UNKNOWN;
 	}
 
 	/* make sure the MRTG data isn't too old */
 	time (&current_time);
 	if (expire_minutes > 0
-			&& (current_time - timestamp) > (expire_minutes * 60)) {
-		printf (_("MRTG data has expired (%d minutes old)\n"),
-		        (int) ((current_time - timestamp) / 60));
+			&& (current_time - sample.timestamp) > (expire_minutes * 60)) {
+		xasprintf (text, _("MRTG data has expired (%d minutes old)"),
+		           (int) ((current_time - sample.timestamp) / 60));
 		return STATE_WARNING;
 	}
 
 	/* else check the incoming/outgoing rates */
 	if (use_average == TRUE)
-		rate = average_value_rate;
+		rate = sample.average[variable - 1];
 	else
-		rate = maximum_value_rate;
+		rate = sample.maximum[variable - 1];
 
-	if (rate > value_critical_threshold)
+	if (rate > critical)
 		result = STATE_CRITICAL;
-	else if (rate > value_warning_threshold)
+	else if (rate > warning)
 		result = STATE_WARNING;
 
-	printf("%s - %s. %s = %lu %s|%s\n", state_text(result),
-	       (use_average == TRUE) ? _("Avg") : _("Max"),
-	       label, rate, units,
-	       perfdata(label, (long) rate, units,
-		        (int) value_warning_threshold, (long) value_warning_threshold,
-		        (int) value_critical_threshold, (long) value_critical_threshold,
-		        0, 0, 0, 0));
+	xasprintf (text, "%s - %s. %s = %lu %s", state_text(result),
+	           (use_average == TRUE) ? _("Avg") : _("Max"),
+	           name, rate, units);
+	*perf = perfdata(name, (long) rate, units,
+	                 (int) warning, (long) warning,
+	                 (int) critical, (long) critical,
+	                 0, 0, 0, 0);
+	return result;
+}
+
 
+
+/* Each line of the batch file, or of stdin for -, is
+ *   LOGFILE [VARIABLE [WARNING CRITICAL [LABEL]]]
+ * with what is left out taken from the command line. The first line of
+ * the output counts the states, one line follows for each log and the
+ * perfdata of all of them comes last. */
+int
+check_batch (const char *path)
+{
+	FILE *fp;
+	char input_buffer[MAX_INPUT_BUFFER];
+	char file[MAX_INPUT_BUFFER], name[MAX_INPUT_BUFFER], *base;
+	char *text, *perf, *lines, *failed;
+	unsigned long warning, critical;
+	int variable, fields, pos;
+	int result = STATE_OK, logs = 0, state;
+	int count[4] = { 0, 0, 0, 0 };
+	np_perfdata perfs;
+
+	if (!strcmp (path, "-"))
+		fp = stdin;
+	else if ((fp = fopen (path, "r")) == NULL)
+		die (STATE_UNKNOWN, _("Unable to open batch file %s: %s\n"), path, strerror (errno));
+
+	lines = strdup ("");
+	failed = strdup ("");
+	np_perfdata_init (&perfs);
+	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
+		strip (input_buffer);
+		if (input_buffer[0] == '\0' || input_buffer[0] == '#')
+			continue;
+		variable = variable_number;
+		warning = value_warning_threshold;
+		critical = value_critical_threshold;
+		pos = 0;
+		fields = sscanf (input_buffer, "%s %d %lu %lu %n", file, &variable, &warning, &critical, &pos);
+		if (fields == 4 && input_buffer[pos])
+			strcpy (name, input_buffer + pos);
+		else {
+			/* the log's name, and the variable if there can be two */
+			base = strrchr (file, '/') ? strrchr (file, '/') + 1 : file;
+			strcpy (name, base);
+			if (strlen (name) > 4 && !strcmp (name + strlen (name) - 4, ".log"))
+				name[strlen (name) - 4] = '\0';
+			if (fields >= 2)
+				sprintf (name + strlen (name), "_%d", variable);
+		}
+		logs++;
+
+		if (variable < 1 || variable > 2) {
+			state = STATE_UNKNOWN;
+			xasprintf (&text, "%s", _("Invalid variable number"));
+			perf = NULL;
+		}
+		else
+			state = check_log (file, variable, warning, critical, name, &text, &perf);
+		count[state]++;
+		result = max_state_alt (result, state);
+		if (state != STATE_OK)
+			xasprintf (&failed, "%s%s%s", failed, *failed ? ", " : "", name);
+		xasprintf (&lines, "%s%s: %s\n", lines, name, text);
+		if (perf) {
+			if (perfs.len)
+				np_perfdata_append (&perfs, " ", 1);
+			np_perfdata_append (&perfs, perf, strlen (perf));
+		}
+		free (text);
+		free (perf);
+	}
+	if (fp != stdin)
+		fclose (fp);
+	if (logs == 0)
+		die (STATE_UNKNOWN, _("No MRTG logs in batch file %s\n"), path);
+
+	printf ("MRTG %s: ", state_text (result));
+	printf (ngettext ("%d log", "%d logs", logs), logs);
+	printf (_(", %d critical, %d warning, %d unknown"), count[STATE_CRITICAL], count[STATE_WARNING], count[STATE_UNKNOWN]);
+	if (*failed)
+		printf (" [%s]", failed);
+	printf ("\n%s| %s\n", lines, np_perfdata_string (&perfs));
+	np_perfdata_free (&perfs);
 	return result;
 }
 
@@ -177,6 +233,7 @@ process_arguments (int argc, char **argv)
 		{"warning", required_argument, 0, 'w'},
 		{"label", required_argument, 0, 'l'},
 		{"units", required_argument, 0, 'u'},
+		{"batch", required_argument, 0, 'B'},
 		{"variable", required_argument, 0, 'v'},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
@@ -196,7 +253,7 @@ process_arguments (int argc, char **argv)
 	}
 
 	while (1) {
-		c = getopt_long (argc, argv, "hVF:e:a:v:c:w:l:u:", longopts,
+		c = getopt_long (argc, argv, "hVF:B:e:a:v:c:w:l:u:", longopts,
 									 &option);
 
 		if (c == -1 || c == EOF)
@@ -206,6 +263,9 @@ process_arguments (int argc, char **argv)
 		case 'F':									/* input file */
 			log_file = optarg;
 			break;
+		case 'B':									/* batch file */
+			batch_file = optarg;
+			break;
 		case 'e':									/* ups name */
 			expire_minutes = atoi (optarg);
 			break;
@@ -296,7 +356,7 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments (void)
 {
-	if (variable_number == -1)
+	if (variable_number == -1 && batch_file == NULL)
 		usage4 (_("You must supply the variable number"));
 
 	if (label == NULL)
@@ -345,6 +405,9 @@ print_help (void)
   printf (" %s\n", "-u, --units=STRING");
   printf ("   %s\n", _("Option units label for data (Example: Packets/Sec, Errors/Sec,"));
   printf ("   %s\n", _("\"Bytes Per Second\", \"%% Utilization\")"));
+  printf (" %s\n", "-B, --batch=FILE");
+  printf ("   %s\n", _("Check each log of FILE (- for stdin), with a line for each of"));
+  printf ("   %s\n", _("LOGFILE [VARIABLE [WARNING CRITICAL [LABEL]]], the rest from the options"));
 
   printf ("\n");
 	printf (" %s\n", _("If the value exceeds the <vwl> threshold, a WARNING status is returned. If"));
@@ -382,4 +445,6 @@ print_usage (void)
   printf ("%s\n", _("Usage:"));
 	printf ("%s -F log_file -a <AVG | MAX> -v variable -w warning -c critical\n",progname);
   printf ("[-l label] [-u units] [-e expire_minutes] [-t timeout] [-v]\n");
+  printf ("%s -B batch_file [-a <AVG | MAX>] [-v variable] [-w warning] [-c critical]\n",progname);
+  printf ("[-u units] [-e expire_minutes]\n");
 }
@@ -37,12 +37,16 @@ const char *copyright = "1999-2014";
 const char *email = "devel@nagios-plugins.org";
 
 int process_arguments (int, char **);
+int check_sample (mrtg_sample *, const char *, unsigned long, unsigned long,
+                  unsigned long, unsigned long, char **, char **);
+int check_batch (const char *);
 int validate_arguments (void);
 void print_help(void);
 void print_usage(void);
 
 int verbose = false;
 char *log_file = NULL;
+char *batch_file = NULL;
 int expire_minutes = -1;
 int use_average = TRUE;
 unsigned long incoming_warning_threshold = 0L;
@@ -55,30 +59,10 @@ unsigned long max_interface_bandwidth = 0L;
 int
 main (int argc, char **argv)
 {
-	int result = STATE_OK;
-	FILE *fp;
-	int line;
-	char input_buffer[MAX_INPUT_BUFFER];
-	char *temp_buffer;
+	int result;
+	mrtg_sample sample;
 	time_t current_time;
-	char *error_message;
-	time_t timestamp = 0L;
-	unsigned long average_incoming_rate = 0L;
-	unsigned long average_outgoing_rate = 0L;
-	unsigned long maximum_incoming_rate = 0L;
-	unsigned long maximum_outgoing_rate = 0L;
-	unsigned long incoming_rate = 0L;
-	unsigned long outgoing_rate = 0L;
-	double adjusted_incoming_rate = 0.0;
-	double adjusted_outgoing_rate = 0.0;
-	double incoming_percent = 0.0;
-	double outgoing_percent = 0.0;
-	char incoming_speed_rating[8];
-	char outgoing_speed_rating[8];
-
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	char *text, *perf;
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -86,154 +70,244 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
-	/* open the MRTG log file for reading */
-	fp = fopen (log_file, "r");
-	if (fp == NULL)
-		usage4 (_("Unable to open MRTG log file"));
-
-	line = 0;
-
-	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
-
-		line++;
-
-		/* skip the first line of the log file */
-		if (line == 1)
-			continue;
-
-		/* break out of read loop */
-		/* if we've passed the number of entries we want to read */
-		if (line > 2)
-			break;
-
-		/* grab the timestamp */
-		temp_buffer = strtok (input_buffer, " ");
-		timestamp = strtoul (temp_buffer, NULL, 10);
-		if (verbose)
-			printf("%s %lu\n", _("Found timestamp of:"), timestamp);
-
-		/* grab the average incoming transfer rate */
-		temp_buffer = strtok (NULL, " ");
-		average_incoming_rate = strtoul (temp_buffer, NULL, 10);
-		if (verbose)
-			printf("%s %lu\n", _("Found average incoming rate of:"), average_incoming_rate);
-
-		/* grab the average outgoing transfer rate */
-		temp_buffer = strtok (NULL, " ");
-		average_outgoing_rate = strtoul (temp_buffer, NULL, 10);
-		if (verbose)
-			printf("%s %lu\n", _("Found average outgoing rate of:"), average_outgoing_rate);
-
-		/* grab the maximum incoming transfer rate */
-		temp_buffer = strtok (NULL, " ");
-		maximum_incoming_rate = strtoul (temp_buffer, NULL, 10);
-		if (verbose)
-			printf("%s %lu\n", _("Found maximum incoming rate of:"), maximum_incoming_rate);
-
-		/* grab the maximum outgoing transfer rate */
-		temp_buffer = strtok (NULL, " ");
-		maximum_outgoing_rate = strtoul (temp_buffer, NULL, 10);
-		if (verbose)
-			printf("%s %lu\n", _("Found maximum outgoing rate of:"), maximum_outgoing_rate);
-	}
-
-	/* close the log file */
-	fclose (fp);
+	if (batch_file)
+		return check_batch (batch_file);
 
-	/* if we couldn't read enough data, return an unknown error */
-	if (line <= 2)
+	/* the newest sample, from the head of the MRTG log */
+	switch (mrtg_read_sample (log_file, &sample)) {
+	case -1:
+		usage4 (_("Unable to open MRTG log file"));
+	case FALSE:
 		usage4 (_("Unable to process MRTG log file"));
+	}
+	if (verbose) {
+		printf("%s %lu\n", _("Found timestamp of:"), (unsigned long) sample.timestamp);
+		printf("%s %lu\n", _("Found average incoming rate of:"), sample.average[0]);
+		printf("%s %lu\n", _("Found average outgoing rate of:"), sample.average[1]);
+		printf("%s %lu\n", _("Found maximum incoming rate of:"), sample.maximum[0]);
+		printf("%s %lu\n", _("Found maximum outgoing rate of:"), sample.maximum[1]);
+	}
 
 	/* make sure the MRTG data isn't too old */
 	time (&current_time);
 	if ((expire_minutes > 0) &&
-	    (current_time - timestamp) > (expire_minutes * 60))
+	    (current_time - sample.timestamp) > (expire_minutes * 60))
 		die (STATE_WARNING,	_("MRTG data has expired (%d minutes old)\n"),
-		     (int) ((current_time - timestamp) / 60));
+		     (int) ((current_time - sample.timestamp) / 60));
 
-	/* else check the incoming/outgoing rates */
-	if (use_average == TRUE) {
-		if (verbose) printf("%s\n", _("Using average rates not maximum."));
-		incoming_rate = average_incoming_rate;
-		outgoing_rate = average_outgoing_rate;
-	}
-	else {
-		if (verbose) printf("%s\n", _("Using default maximum rates."));
-		incoming_rate = maximum_incoming_rate;
-		outgoing_rate = maximum_outgoing_rate;
-	}
+	if (verbose)
+		printf("%s\n", use_average == TRUE ? _("Using average rates not maximum.") : _("Using default maximum rates."));
+	result = check_sample (&sample, "", incoming_warning_threshold, outgoing_warning_threshold,
+	                       incoming_critical_threshold, outgoing_critical_threshold, &text, &perf);
+	printf (_("Traffic %s - %s\n"), state_text(result), text);
 
-	/* report incoming traffic in Bytes/sec */
-	if (incoming_rate < 1024) {
-		strcpy (incoming_speed_rating, "B");
-		adjusted_incoming_rate = (double) incoming_rate;
-	}
+	return result;
+}
 
-	/* report incoming traffic in KBytes/sec */
-	else if (incoming_rate < (1024 * 1024)) {
-		strcpy (incoming_speed_rating, "KB");
-		adjusted_incoming_rate = (double) (incoming_rate / 1024.0);
-	}
 
-	/* report incoming traffic in MBytes/sec */
-	else {
-		strcpy (incoming_speed_rating, "MB");
-		adjusted_incoming_rate = (double) (incoming_rate / 1024.0 / 1024.0);
-	}
 
-	/* report outgoing traffic in Bytes/sec */
-	if (outgoing_rate < 1024) {
-		strcpy (outgoing_speed_rating, "B");
-		adjusted_outgoing_rate = (double) outgoing_rate;
+/* scale a rate in Bytes/sec to B, KB or MB */
+static double
+adjust_rate (unsigned long rate, char *rating)
+{
+	/* report traffic in Bytes/sec */
+	if (rate < 1024) {
+		strcpy (rating, "B");
+		return (double) rate;
 	}
 
-	/* report outgoing traffic in KBytes/sec */
-	else if (outgoing_rate < (1024 * 1024)) {
-		strcpy (outgoing_speed_rating, "KB");
-		adjusted_outgoing_rate = (double) (outgoing_rate / 1024.0);
+	/* report traffic in KBytes/sec */
+	else if (rate < (1024 * 1024)) {
+		strcpy (rating, "KB");
+		return (double) (rate / 1024.0);
 	}
 
-	/* report outgoing traffic in MBytes/sec */
+	/* report traffic in MBytes/sec */
+	strcpy (rating, "MB");
+	return (double) (rate / 1024.0 / 1024.0);
+}
+
+
+
+/* the state of the incoming/outgoing rates of a sample; text is what the
+ * plugin prints after its state, with the perfdata, perf the perfdata
+ * alone with its labels after prefix */
+int
+check_sample (mrtg_sample *sample, const char *prefix,
+              unsigned long incoming_warning, unsigned long outgoing_warning,
+              unsigned long incoming_critical, unsigned long outgoing_critical,
+              char **text, char **perf)
+{
+	int result = STATE_OK;
+	unsigned long incoming_rate, outgoing_rate;
+	double adjusted_incoming_rate, adjusted_outgoing_rate;
+	double incoming_percent, outgoing_percent;
+	char incoming_speed_rating[8];
+	char outgoing_speed_rating[8];
+	char *label_in, *label_out, *label_in_pct, *label_out_pct;
+
+	/* check the incoming/outgoing rates */
+	if (use_average == TRUE) {
+		incoming_rate = sample->average[0];
+		outgoing_rate = sample->average[1];
+	}
 	else {
-		strcpy (outgoing_speed_rating, "MB");
-		adjusted_outgoing_rate = (double) (outgoing_rate / 1024.0 / 1024.0);
+		incoming_rate = sample->maximum[0];
+		outgoing_rate = sample->maximum[1];
 	}
 
-	if (incoming_rate > incoming_critical_threshold
-			|| outgoing_rate > outgoing_critical_threshold) {
+	adjusted_incoming_rate = adjust_rate (incoming_rate, incoming_speed_rating);
+	adjusted_outgoing_rate = adjust_rate (outgoing_rate, outgoing_speed_rating);
+
+	if (incoming_rate > incoming_critical
+			|| outgoing_rate > outgoing_critical) {
 		result = STATE_CRITICAL;
 	}
-	else if (incoming_rate > incoming_warning_threshold
-					 || outgoing_rate > outgoing_warning_threshold) {
+	else if (incoming_rate > incoming_warning
+					 || outgoing_rate > outgoing_warning) {
 		result = STATE_WARNING;
 	}
 
-	xasprintf (&error_message, _("%s. In = %0.1f %s/s, %s. Out = %0.1f %s/s|%s %s"),
-	          (use_average == TRUE) ? _("Avg") : _("Max"), adjusted_incoming_rate,
-	          incoming_speed_rating, (use_average == TRUE) ? _("Avg") : _("Max"),
-	          adjusted_outgoing_rate, outgoing_speed_rating,
-	          fperfdata("in", adjusted_incoming_rate, incoming_speed_rating,
-	                   (int)incoming_warning_threshold, incoming_warning_threshold,
-	                   (int)incoming_critical_threshold, incoming_critical_threshold,
+	xasprintf (&label_in, "%sin", prefix);
+	xasprintf (&label_out, "%sout", prefix);
+	xasprintf (perf, "%s %s",
+	          fperfdata(label_in, adjusted_incoming_rate, incoming_speed_rating,
+	                   (int)incoming_warning, incoming_warning,
+	                   (int)incoming_critical, incoming_critical,
 	                   TRUE, 0, FALSE, 0),
-	          fperfdata("out", adjusted_outgoing_rate, outgoing_speed_rating,
-	                   (int)outgoing_warning_threshold, outgoing_warning_threshold,
-	                   (int)outgoing_critical_threshold, outgoing_critical_threshold,
+	          fperfdata(label_out, adjusted_outgoing_rate, outgoing_speed_rating,
+	                   (int)outgoing_warning, outgoing_warning,
+	                   (int)outgoing_critical, outgoing_critical,
 	                   TRUE, 0, FALSE, 0));
 	if (max_interface_bandwidth) {
 		incoming_percent = (incoming_rate * 100.0) / (double)max_interface_bandwidth;
 		outgoing_percent = (incoming_rate * 100.0) / (double)max_interface_bandwidth;
-		xasprintf(&error_message, "%s %s %s", error_message,
-			fperfdata("in_pct", incoming_percent, "%",
+		xasprintf (&label_in_pct, "%sin_pct", prefix);
+		xasprintf (&label_out_pct, "%sout_pct", prefix);
+		xasprintf(perf, "%s %s %s", *perf,
+			fperfdata(label_in_pct, incoming_percent, "%",
 					 FALSE, 0.0, FALSE, 0.0,
 					 TRUE, 0.0, TRUE, 100.0),
-			fperfdata("out_pct", outgoing_percent, "%",
+			fperfdata(label_out_pct, outgoing_percent, "%",
 					 FALSE, 0.0, FALSE, 0.0,
 					 TRUE, 0.0, TRUE, 100.0));
 	}
 
-	printf (_("Traffic %s - %s\n"), state_text(result), error_message);
+	xasprintf (text, _("%s. In = %0.1f %s/s, %s. Out = %0.1f %s/s|%s"),
+	          (use_average == TRUE) ? _("Avg") : _("Max"), adjusted_incoming_rate,
+	          incoming_speed_rating, (use_average == TRUE) ? _("Avg") : _("Max"),
+	          adjusted_outgoing_rate, outgoing_speed_rating, *perf);
+	return result;
+}
+
+
+
+/* Each line of the batch file, or of stdin for -, is
+ *   LOGFILE [WARNING_PAIR CRITICAL_PAIR [NAME]]
+ * with the thresholds left out taken from the command line and the name
+ * from the log's, as the prefix of its perfdata labels. The first line of
+ * the output counts the states, one line follows for each log and the
+ * perfdata of all of them comes last. */
+int
+check_batch (const char *path)
+{
+	FILE *fp;
+	char input_buffer[MAX_INPUT_BUFFER];
+	char file[MAX_INPUT_BUFFER], name[MAX_INPUT_BUFFER], warn[64], crit[64], *base, *prefix;
+	char *text, *perf, *lines, *failed, *bar;
+	unsigned long incoming_warning, outgoing_warning, incoming_critical, outgoing_critical;
+	int fields, pos, result = STATE_OK, logs = 0, state;
+	int count[4] = { 0, 0, 0, 0 };
+	mrtg_sample sample;
+	time_t current_time;
+	np_perfdata perfs;
+
+	if (!strcmp (path, "-"))
+		fp = stdin;
+	else if ((fp = fopen (path, "r")) == NULL)
+		die (STATE_UNKNOWN, _("Unable to open batch file %s: %s\n"), path, strerror (errno));
+
+	lines = strdup ("");
+	failed = strdup ("");
+	np_perfdata_init (&perfs);
+	time (&current_time);
+	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
+		strip (input_buffer);
+		if (input_buffer[0] == '\0' || input_buffer[0] == '#')
+			continue;
+		incoming_warning = incoming_warning_threshold;
+		outgoing_warning = outgoing_warning_threshold;
+		incoming_critical = incoming_critical_threshold;
+		outgoing_critical = outgoing_critical_threshold;
+		pos = 0;
+		fields = sscanf (input_buffer, "%s %63s %63s %n", file, warn, crit, &pos);
+		if (fields == 3) {
+			sscanf (warn, "%lu,%lu", &incoming_warning, &outgoing_warning);
+			sscanf (crit, "%lu,%lu", &incoming_critical, &outgoing_critical);
+		}
+		if (fields == 3 && input_buffer[pos])
+			strcpy (name, input_buffer + pos);
+		else {
+			base = strrchr (file, '/') ? strrchr (file, '/') + 1 : file;
+			strcpy (name, base);
+			if (strlen (name) > 4 && !strcmp (name + strlen (name) - 4, ".log"))
+				name[strlen (name) - 4] = '\0';
+		}
+		logs++;
 
+		perf = NULL;
+		switch (mrtg_read_sample (file, &sample)) {
+		case -1:
+			state = STATE_UNKNOWN;
+			xasprintf (&text, "%s", _("Unable to open MRTG log file"));
+			break;
+		case FALSE:
+			state = STATE_UNKNOWN;
+			xasprintf (&text, "%s", _("Unable to process MRTG log file"));
+			break;
+		default:
+			if ((expire_minutes > 0) &&
+			    (current_time - sample.timestamp) > (expire_minutes * 60)) {
+				state = STATE_WARNING;
+				xasprintf (&text, _("MRTG data has expired (%d minutes old)"),
+				           (int) ((current_time - sample.timestamp) / 60));
+				break;
+			}
+			xasprintf (&prefix, "%s_", name);
+			state = check_sample (&sample, prefix, incoming_warning, outgoing_warning,
+			                      incoming_critical, outgoing_critical, &text, &perf);
+			/* the perfdata goes to the end */
+			if ((bar = strrchr (text, '|')) != NULL)
+				*bar = '\0';
+			free (prefix);
+		}
+		count[state]++;
+		result = max_state_alt (result, state);
+		if (state != STATE_OK)
+			xasprintf (&failed, "%s%s%s", failed, *failed ? ", " : "", name);
+		if (perf) {
+			xasprintf (&lines, "%s%s: %s - %s\n", lines, name, state_text (state), text);
+			if (perfs.len)
+				np_perfdata_append (&perfs, " ", 1);
+			np_perfdata_append (&perfs, perf, strlen (perf));
+		}
+		else
+			xasprintf (&lines, "%s%s: %s\n", lines, name, text);
+		free (text);
+		free (perf);
+	}
+	if (fp != stdin)
+		fclose (fp);
+	if (logs == 0)
+		die (STATE_UNKNOWN, _("No MRTG logs in batch file %s\n"), path);
+
+	printf (_("Traffic %s: "), state_text (result));
+	printf (ngettext ("%d log", "%d logs", logs), logs);
+	printf (_(", %d critical, %d warning, %d unknown"), count[STATE_CRITICAL], count[STATE_WARNING], count[STATE_UNKNOWN]);
+	if (*failed)
+		printf (" [%s]", failed);
+	printf ("\n%s| %s\n", lines, np_perfdata_string (&perfs));
+	np_perfdata_free (&perfs);
 	return result;
 }
 
@@ -254,6 +328,7 @@ process_arguments (int argc, char **argv)
 		{"warning", required_argument, 0, 'w'},
 		{"verbose", no_argument, 0, 'v'},
 		{"interface-maximum", required_argument, 0, 'i'},
+		{"batch", required_argument, 0, 'B'},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
 		{0, 0, 0, 0}
@@ -272,7 +347,7 @@ process_arguments (int argc, char **argv)
 	}
 
 	while (1) {
-		c = getopt_long (argc, argv, "hVvF:e:a:c:w:", longopts, &option);
+		c = getopt_long (argc, argv, "hVvF:B:e:a:c:w:", longopts, &option);
 
 		if (c == -1 || c == EOF)
 			break;
@@ -281,6 +356,9 @@ process_arguments (int argc, char **argv)
 		case 'F':									/* input file */
 			log_file = optarg;
 			break;
+		case 'B':									/* batch file */
+			batch_file = optarg;
+			break;
 		case 'e':									/* expiration time */
 			expire_minutes = atoi (optarg);
 			break;
@@ -397,6 +475,9 @@ print_help (void)
   printf (" %s\n", _("-i, --interface-maximum"));
   printf ("    %s\n", _("Define the maximum bandwidth on the port being monitored (Bytes/sec)"));
   printf ("    %s\n", _("This adds percentages to performance data output"));
+  printf (" %s\n", "-B, --batch=FILE");
+  printf ("    %s\n", _("Check each log of FILE (- for stdin), with a line for each of"));
+  printf ("    %s\n", _("LOGFILE [WARNING_PAIR CRITICAL_PAIR [NAME]], the rest from the options"));
 
   printf ("\n");
   printf ("%s\n", _("Notes:"));
@@ -419,4 +500,6 @@ print_usage (void)
 	printf (_("Usage"));
   printf (" %s -F <log_file> -a <AVG | MAX> -w <warning_pair>\n",progname);
   printf ("-c <critical_pair> [-e expire_minutes]\n");
+  printf (" %s -B <batch_file> [-a <AVG | MAX>] [-w <warning_pair>] [-c <critical_pair>]\n",progname);
+  printf ("[-e expire_minutes] [-i <interface_maximum>]\n");
 }
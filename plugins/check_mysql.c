@@ -35,6 +35,8 @@ const char *copyright = "1999-2014";
 const char *email = "devel@nagios-plugins.org";
 
 #define SLAVERESULTSIZE 70
+#define DEFAULT_PERCENTILE 95
+#define DEFAULT_LATENCY_QUERY "SELECT 1"
 
 #include "common.h"
 #include "utils.h"
@@ -60,8 +62,16 @@ char *opt_file = NULL;
 char *opt_group = NULL;
 unsigned int db_port = MYSQL_PORT;
 int check_slave = 0, warn_sec = 0, crit_sec = 0;
+int per_channel = 0;
 int ignore_auth = 0;
 int verbose = 0;
+int repeat = 0;
+int repeat_interval = 0;
+char *latency_query = DEFAULT_LATENCY_QUERY;
+double latency_percentile = DEFAULT_PERCENTILE;
+char *latency_warning = NULL;
+char *latency_critical = NULL;
+thresholds *latency_threshold = NULL;
 
 static double warning_time = 0;
 static double critical_time = 0;
@@ -91,6 +101,36 @@ static const char *metric_counter[LENGTH_METRIC_COUNTER] = {
 
 thresholds *my_threshold = NULL;
 
+/* one replication channel, from a row of SHOW SLAVE STATUS or of the
+ * performance_schema replication tables */
+typedef struct slave_channel {
+	char *name;
+	char *io;
+	char *sql;
+	char *behind;		/* NULL while the server cannot tell */
+} slave_channel;
+
+/* MySQL 8 keeps the state of each channel in performance_schema, where only
+ * the columns the check needs have to be asked for instead of the fifty or
+ * so of SHOW SLAVE STATUS. The lag is that of the oldest transaction a
+ * worker is applying, 0 while they are idle; NULL, as Seconds_Behind_Master
+ * is, while either thread is stopped. */
+#define PS_SLAVE_QUERY \
+	"SELECT c.CHANNEL_NAME," \
+	" IF(c.SERVICE_STATE = 'ON', 'Yes', IF(c.SERVICE_STATE = 'CONNECTING', 'Connecting', 'No'))," \
+	" IF(a.SERVICE_STATE = 'ON', 'Yes', 'No')," \
+	" IF(c.SERVICE_STATE = 'ON' AND a.SERVICE_STATE = 'ON'," \
+	" (SELECT IFNULL(MAX(IF(w.APPLYING_TRANSACTION = '', 0," \
+	" TIMESTAMPDIFF(SECOND, w.APPLYING_TRANSACTION_ORIGINAL_COMMIT_TIMESTAMP, NOW(6)))), 0)" \
+	" FROM performance_schema.replication_applier_status_by_worker w" \
+	" WHERE w.CHANNEL_NAME = c.CHANNEL_NAME), NULL)" \
+	" FROM performance_schema.replication_connection_status c" \
+	" JOIN performance_schema.replication_applier_status a USING (CHANNEL_NAME)" \
+	" ORDER BY c.CHANNEL_NAME"
+
+int read_slave_status (MYSQL *, slave_channel **, int *);
+int check_channels (slave_channel *, int, char *);
+int check_latency (MYSQL *, char **, char **);
 int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
@@ -110,13 +150,11 @@ main (int argc, char **argv)
 	char *error = NULL;
 	char slaveresult[SLAVERESULTSIZE];
 	char* perf;
+	char *latency = NULL;
+	int status = STATE_OK;
 
         perf = strdup ("");
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
 
@@ -206,94 +244,40 @@ main (int argc, char **argv)
 	}
 
 	if(check_slave) {
-		/* check the slave status */
-		if (mysql_query (&mysql, "show slave status") != 0) {
-			error = strdup(mysql_error(&mysql));
-			mysql_close (&mysql);
-			die (STATE_CRITICAL, _("slave query error: %s\n"), error);
-		}
-
-		/* store the result */
-		if ( (res = mysql_store_result (&mysql)) == NULL) {
-			error = strdup(mysql_error(&mysql));
-			mysql_close (&mysql);
-			die (STATE_CRITICAL, _("slave store_result error: %s\n"), error);
-		}
+		int count, legacy = 0, status;
+		slave_channel *channels, *ch;
 
-		/* Check there is some data */
-		if (mysql_num_rows(res) == 0) {
-			mysql_close(&mysql);
-			die (STATE_WARNING, "%s\n", _("No slaves defined"));
-		}
+		count = read_slave_status (&mysql, &channels, &legacy);
 
-		/* fetch the first row */
-		if ( (row = mysql_fetch_row (res)) == NULL) {
-			error = strdup(mysql_error(&mysql));
-			mysql_free_result (res);
+		if (per_channel) {
 			mysql_close (&mysql);
-			die (STATE_CRITICAL, _("slave fetch row error: %s\n"), error);
+			return check_channels (channels, count, perf);
 		}
 
-		if (mysql_field_count (&mysql) == 12) {
+		/* the first channel, as there was only one before multi-source
+		 * replication */
+		ch = &channels[0];
+		if (legacy) {
 			/* mysql 3.23.x */
-			snprintf (slaveresult, SLAVERESULTSIZE, _("Slave running: %s"), row[6]);
-			if (strcmp (row[6], "Yes") != 0) {
-				mysql_free_result (res);
+			snprintf (slaveresult, SLAVERESULTSIZE, _("Slave running: %s"), ch->io);
+			if (strcmp (ch->io, "Yes") != 0) {
 				mysql_close (&mysql);
 				die (STATE_CRITICAL, "%s\n", slaveresult);
 			}
 
 		} else {
-			/* mysql 4.x.x and mysql 5.x.x */
-			int slave_io_field = -1 , slave_sql_field = -1, seconds_behind_field = -1, i, num_fields;
-			MYSQL_FIELD* fields;
-
-			num_fields = mysql_num_fields(res);
-			fields = mysql_fetch_fields(res);
-			for(i = 0; i < num_fields; i++) {
-				if (strcmp(fields[i].name, "Slave_IO_Running") == 0) {
-					slave_io_field = i;
-					continue;
-				}
-				if (strcmp(fields[i].name, "Slave_SQL_Running") == 0) {
-					slave_sql_field = i;
-					continue;
-				}
-				if (strcmp(fields[i].name, "Seconds_Behind_Master") == 0) {
-					seconds_behind_field = i;
-					continue;
-				}
-			}
-
-			/* Check if slave status is available */
-			if ((slave_io_field < 0) || (slave_sql_field < 0) || (num_fields == 0)) {
-				mysql_free_result (res);
-				mysql_close (&mysql);
-				die (STATE_CRITICAL, "Slave status unavailable\n");
-			}
-
 			/* Save slave status in slaveresult */
-			snprintf (slaveresult, SLAVERESULTSIZE, "Slave IO: %s Slave SQL: %s Seconds Behind Master: %s", row[slave_io_field], row[slave_sql_field], seconds_behind_field!=-1?row[seconds_behind_field]:"Unknown");
+			snprintf (slaveresult, SLAVERESULTSIZE, "Slave IO: %s Slave SQL: %s Seconds Behind Master: %s", ch->io, ch->sql, ch->behind ? ch->behind : "Unknown");
 
 			/* Raise critical error if SQL THREAD or IO THREAD are stopped */
-			if (strcmp (row[slave_io_field], "Yes") != 0 || strcmp (row[slave_sql_field], "Yes") != 0) {
-				mysql_free_result (res);
+			if (strcmp (ch->io, "Yes") != 0 || strcmp (ch->sql, "Yes") != 0) {
 				mysql_close (&mysql);
 				die (STATE_CRITICAL, "%s\n", slaveresult);
 			}
 
-			if (verbose >=3) {
-				if (seconds_behind_field == -1) {
-					printf("seconds_behind_field not found\n");
-				} else {
-					printf ("seconds_behind_field(index %d)=%s\n", seconds_behind_field, row[seconds_behind_field]);
-				}
-			}
-
 			/* Check Seconds Behind against threshold */
-			if ((seconds_behind_field != -1) && (strcmp (row[seconds_behind_field], "NULL") != 0)) {
-				double value = atof(row[seconds_behind_field]);
-				int status;
+			if (ch->behind != NULL) {
+				double value = atof(ch->behind);
 
 				status = get_status(value, my_threshold);
 
@@ -312,22 +296,244 @@ main (int argc, char **argv)
 				}
 			}
 		}
-
-		/* free the result */
-		mysql_free_result (res);
 	}
 
+	if (repeat > 0)
+		status = check_latency (&mysql, &latency, &perf);
+
 	/* close the connection */
 	mysql_close (&mysql);
 
 	/* print out the result of stats */
+	if (status != STATE_OK)
+		printf ("LATENCY %s: ", state_text (status));
 	if (check_slave) {
-		printf ("%s %s|%s\n", result, slaveresult, perf);
+		printf ("%s %s%s%s|%s\n", result, slaveresult, latency ? _(" Latency of ") : "", latency ? latency : "", perf);
 	} else {
-		printf ("%s|%s\n", result, perf);
+		printf ("%s%s%s|%s\n", result, latency ? _(" Latency of ") : "", latency ? latency : "", perf);
+	}
+
+	return status;
+}
+
+
+/* Runs the --latency-query repeat times, pausing repeat_interval
+ * milliseconds in between, with the spread of their times in msg and
+ * perf. They are counted in a histogram, so any number of runs takes the
+ * same memory. Returns the state of --percentile against the latency
+ * thresholds; dies if a query fails. */
+int
+check_latency (MYSQL *mysql, char **msg, char **perf)
+{
+	np_histogram *h;
+	np_perfdata pd;
+	MYSQL_RES *res;
+	struct timeval tv;
+	struct timespec pause;
+	char *error;
+	int i, status;
+
+	if ((h = malloc (sizeof (np_histogram))) == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	np_histogram_init (h);
+	if (verbose)
+		printf ("Running \"%s\" %d times\n", latency_query, repeat);
+	for (i = 0; i < repeat; i++) {
+		if (i > 0 && repeat_interval > 0) {
+			pause.tv_sec = repeat_interval / 1000;
+			pause.tv_nsec = repeat_interval % 1000 * 1000000L;
+			while (nanosleep (&pause, &pause) == -1 && errno == EINTR)
+				;
+		}
+		gettimeofday (&tv, NULL);
+		if (mysql_query (mysql, latency_query) != 0 ||
+		    ((res = mysql_store_result (mysql)) == NULL && mysql_field_count (mysql) != 0)) {
+			error = strdup (mysql_error (mysql));
+			mysql_close (mysql);
+			die (STATE_CRITICAL, _("latency query error: %s\n"), error);
+		}
+		if (res != NULL)
+			mysql_free_result (res);
+		np_histogram_add (h, delta_time (tv));
+	}
+
+	np_perfdata_init (&pd);
+	np_perfdata_append (&pd, *perf, strlen (*perf));
+	status = np_latency_report (h, "latency", latency_percentile, latency_warning,
+	                            latency_critical, latency_threshold, msg, &pd);
+	*perf = np_perfdata_release (&pd);
+	free (h);
+	return status;
+}
+
+/* The channels of the replica, from performance_schema where the server
+ * has the tables (MySQL 8.0.2 and later) and the user may read them, from
+ * SHOW SLAVE STATUS otherwise (SHOW ALL SLAVES STATUS for every
+ * connection of MariaDB with per_channel). legacy is set for the one-thread status of
+ * mysql 3.23. Dies when there are none. */
+int
+read_slave_status (MYSQL *mysql, slave_channel **channels, int *legacy)
+{
+	MYSQL_RES *res = NULL;
+	MYSQL_ROW row;
+	MYSQL_FIELD *fields;
+	char *error = NULL;
+	int io_field = -1, sql_field = -1, behind_field = -1, channel_field = -1;
+	int i, count = 0, num_fields;
+	int mariadb = strstr (mysql_get_server_info (mysql), "MariaDB") != NULL;
+
+	if (mysql_get_server_version (mysql) >= 80002 && !mariadb) {
+		if (mysql_query (mysql, PS_SLAVE_QUERY) == 0 &&
+		    (res = mysql_store_result (mysql)) != NULL) {
+			channel_field = 0;
+			io_field = 1;
+			sql_field = 2;
+			behind_field = 3;
+		} else if (verbose >= 2) {
+			printf ("performance_schema query error, using SHOW SLAVE STATUS: %s\n",
+			        mysql_error (mysql));
+		}
+	}
+
+	if (res == NULL) {
+		/* check the slave status; MariaDB shows only the default
+		 * connection unless asked for all of them */
+		if (mysql_query (mysql, mariadb && per_channel ? "show all slaves status" : "show slave status") != 0) {
+			error = strdup(mysql_error(mysql));
+			mysql_close (mysql);
+			die (STATE_CRITICAL, _("slave query error: %s\n"), error);
+		}
+
+		/* store the result */
+		if ( (res = mysql_store_result (mysql)) == NULL) {
+			error = strdup(mysql_error(mysql));
+			mysql_close (mysql);
+			die (STATE_CRITICAL, _("slave store_result error: %s\n"), error);
+		}
+
+		num_fields = mysql_num_fields (res);
+		if (mysql_field_count (mysql) == 12) {
+			/* mysql 3.23.x */
+			*legacy = 1;
+			io_field = sql_field = 6;
+		} else {
+			/* mysql 4.x.x and later: the columns are looked up once for
+			 * the result, whatever the number of channels */
+			fields = mysql_fetch_fields (res);
+			for (i = 0; i < num_fields; i++) {
+				if (strcmp (fields[i].name, "Slave_IO_Running") == 0 ||
+				    strcmp (fields[i].name, "Replica_IO_Running") == 0)
+					io_field = i;
+				else if (strcmp (fields[i].name, "Slave_SQL_Running") == 0 ||
+				         strcmp (fields[i].name, "Replica_SQL_Running") == 0)
+					sql_field = i;
+				else if (strcmp (fields[i].name, "Seconds_Behind_Master") == 0 ||
+				         strcmp (fields[i].name, "Seconds_Behind_Source") == 0)
+					behind_field = i;
+				else if (strcmp (fields[i].name, "Channel_Name") == 0 ||
+				         strcmp (fields[i].name, "Connection_name") == 0)
+					channel_field = i;
+			}
+		}
+
+		/* Check if slave status is available */
+		if (mysql_num_rows (res) > 0 && (io_field < 0 || sql_field < 0 || num_fields == 0)) {
+			mysql_free_result (res);
+			mysql_close (mysql);
+			die (STATE_CRITICAL, "Slave status unavailable\n");
+		}
+	}
+
+	/* Check there is some data */
+	if (mysql_num_rows (res) == 0) {
+		mysql_free_result (res);
+		mysql_close (mysql);
+		die (STATE_WARNING, "%s\n", _("No slaves defined"));
 	}
 
-	return STATE_OK;
+	*channels = calloc (mysql_num_rows (res), sizeof (slave_channel));
+	if (*channels == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	while ( (row = mysql_fetch_row (res)) != NULL) {
+		slave_channel *ch = &(*channels)[count++];
+
+		ch->name = strdup (channel_field >= 0 && row[channel_field] ? row[channel_field] : "");
+		ch->io = strdup (row[io_field] ? row[io_field] : "NULL");
+		ch->sql = strdup (row[sql_field] ? row[sql_field] : "NULL");
+		if (behind_field >= 0 && row[behind_field] != NULL && strcmp (row[behind_field], "NULL") != 0)
+			ch->behind = strdup (row[behind_field]);
+
+		if (verbose >= 3) {
+			if (behind_field == -1)
+				printf ("seconds_behind_field not found\n");
+			else
+				printf ("channel '%s' seconds_behind_field(index %d)=%s\n", ch->name,
+				        behind_field, ch->behind ? ch->behind : "NULL");
+		}
+	}
+	if (count == 0) {
+		error = strdup(mysql_error(mysql));
+		mysql_free_result (res);
+		mysql_close (mysql);
+		die (STATE_CRITICAL, _("slave fetch row error: %s\n"), error);
+	}
+
+	mysql_free_result (res);
+	return count;
+}
+
+
+/* Prints the state of every channel, with a summary of those that are not
+ * OK first, and returns the worst */
+int
+check_channels (slave_channel *channels, int count, char *perf)
+{
+	int i, status = STATE_OK, count_ok = 0;
+	int *states;
+	char **msgs;
+	char *problems = NULL, *label;
+
+	states = calloc (count, sizeof (int));
+	msgs = calloc (count, sizeof (char *));
+	if (states == NULL || msgs == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+
+	for (i = 0; i < count; i++) {
+		slave_channel *ch = &channels[i];
+		const char *name = ch->name[0] ? ch->name : _("default");
+
+		xasprintf (&msgs[i], "Slave IO: %s Slave SQL: %s Seconds Behind Master: %s",
+		           ch->io, ch->sql, ch->behind ? ch->behind : "Unknown");
+		if (strcmp (ch->io, "Yes") != 0 || strcmp (ch->sql, "Yes") != 0)
+			states[i] = STATE_CRITICAL;
+		else if (ch->behind != NULL) {
+			double value = atof (ch->behind);
+
+			states[i] = get_status (value, my_threshold);
+			if (ch->name[0])
+				xasprintf (&label, "seconds behind master@%s", ch->name);
+			else
+				label = strdup ("seconds behind master");
+			xasprintf (&perf, "%s %s", perf, fperfdata (label, value, "s",
+			           TRUE, (double) warning_time, TRUE, (double) critical_time,
+			           FALSE, 0, FALSE, 0));
+			free (label);
+		}
+
+		status = max_state (status, states[i]);
+		if (states[i] == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           name, msgs[i]);
+	}
+
+	printf ("SLAVE %s: %d of %d %s%s%s|%s\n", state_text (status), count_ok, count,
+	        _("channels OK"), problems ? " - " : "", problems ? problems : "", perf);
+	for (i = 0; i < count; i++)
+		printf ("[%s] %s: %s\n", state_text (states[i]),
+		        channels[i].name[0] ? channels[i].name : _("default"), msgs[i]);
+	return status;
 }
 
 
@@ -340,6 +546,14 @@ process_arguments (int argc, char **argv)
 	char *critical = NULL;
 
 	int option = 0;
+	enum {
+		REPEAT_OPTION = CHAR_MAX + 1,
+		INTERVAL_OPTION,
+		LATENCY_QUERY_OPTION,
+		PERCENTILE_OPTION,
+		LATENCY_WARNING_OPTION,
+		LATENCY_CRITICAL_OPTION
+	};
 	static struct option longopts[] = {
 		{"hostname", required_argument, 0, 'H'},
 		{"socket", required_argument, 0, 's'},
@@ -352,6 +566,7 @@ process_arguments (int argc, char **argv)
 		{"critical", required_argument, 0, 'c'},
 		{"warning", required_argument, 0, 'w'},
 		{"check-slave", no_argument, 0, 'S'},
+		{"per-channel", no_argument, 0, 'm'},
 		{"ignore-auth", no_argument, 0, 'n'},
 		{"verbose", no_argument, 0, 'v'},
 		{"version", no_argument, 0, 'V'},
@@ -362,6 +577,12 @@ process_arguments (int argc, char **argv)
 		{"cert", required_argument,0,'a'},
 		{"ca-dir", required_argument, 0, 'D'},
 		{"ciphers", required_argument, 0, 'L'},
+		{"repeat", required_argument, 0, REPEAT_OPTION},
+		{"interval", required_argument, 0, INTERVAL_OPTION},
+		{"latency-query", required_argument, 0, LATENCY_QUERY_OPTION},
+		{"percentile", required_argument, 0, PERCENTILE_OPTION},
+		{"latency-warning", required_argument, 0, LATENCY_WARNING_OPTION},
+		{"latency-critical", required_argument, 0, LATENCY_CRITICAL_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -369,7 +590,7 @@ process_arguments (int argc, char **argv)
 		return ERROR;
 
 	while (1) {
-		c = getopt_long (argc, argv, "hlvVnSP:p:u:d:H:s:c:w:a:k:C:D:L:f:g:", longopts, &option);
+		c = getopt_long (argc, argv, "hlvVnSmP:p:u:d:H:s:c:w:a:k:C:D:L:f:g:", longopts, &option);
 
 		if (c == -1 || c == EOF)
 			break;
@@ -431,6 +652,10 @@ process_arguments (int argc, char **argv)
 		case 'S':
 			check_slave = 1;							/* check-slave */
 			break;
+		case 'm':
+			check_slave = 1;							/* per-channel */
+			per_channel = 1;
+			break;
 		case 'n':
 			ignore_auth = 1;							/* ignore-auth */
 			break;
@@ -451,6 +676,30 @@ process_arguments (int argc, char **argv)
 		case 'v':
 			verbose++;
 			break;
+		case REPEAT_OPTION:
+			if (!is_intpos (optarg))
+				usage2 (_("Repeat count must be a positive integer"), optarg);
+			repeat = atoi (optarg);
+			break;
+		case INTERVAL_OPTION:
+			if (!is_intnonneg (optarg))
+				usage2 (_("Interval must be a positive integer"), optarg);
+			repeat_interval = atoi (optarg);
+			break;
+		case LATENCY_QUERY_OPTION:
+			latency_query = optarg;
+			break;
+		case PERCENTILE_OPTION:
+			if (!is_nonnegative (optarg) || strtod (optarg, NULL) > 100)
+				usage2 (_("Percentile must be between 0 and 100"), optarg);
+			latency_percentile = strtod (optarg, NULL);
+			break;
+		case LATENCY_WARNING_OPTION:
+			latency_warning = optarg;
+			break;
+		case LATENCY_CRITICAL_OPTION:
+			latency_critical = optarg;
+			break;
 		case '?':									/* help */
 			usage5 ();
 		}
@@ -459,6 +708,7 @@ process_arguments (int argc, char **argv)
 	c = optind;
 
 	set_thresholds(&my_threshold, warning, critical);
+	set_thresholds(&latency_threshold, latency_warning, latency_critical);
 
 	while ( argc > c ) {
 
@@ -541,6 +791,9 @@ print_help (void)
   printf ("    %s\n", _("Your clear-text password could be visible as a process table entry"));
   printf (" %s\n", "-S, --check-slave");
   printf ("    %s\n", _("Check if the slave thread is running properly."));
+  printf (" %s\n", "-m, --per-channel");
+  printf ("    %s\n", _("As -S, for every replication channel of a multi-source slave, with one"));
+  printf ("    %s\n", _("result line each. Without it only the first channel is checked."));
   printf (" %s\n", "-w, --warning");
   printf ("    %s\n", _("Exit with WARNING status if slave server is more than INTEGER seconds"));
   printf ("    %s\n", _("behind master"));
@@ -559,6 +812,21 @@ print_help (void)
   printf ("    %s\n", _("Path to CA directory"));
   printf (" %s\n", "-L, --ciphers=STRING");
   printf ("    %s\n", _("List of valid SSL ciphers"));
+  printf (" %s\n", "--repeat=INTEGER");
+  printf ("    %s\n", _("Run the latency query this many times over the connection, for the"));
+  printf ("    %s\n", _("spread of its latency"));
+  printf (" %s\n", "--interval=MILLISECONDS");
+  printf ("    %s\n", _("Pause between those runs (default 0)"));
+  printf (" %s\n", "--latency-query=STRING");
+  printf ("    %s", _("The query to run "));
+  printf (_("(default: %s)\n"), DEFAULT_LATENCY_QUERY);
+  printf (" %s\n", "--percentile=DOUBLE");
+  printf ("    %s", _("Percentile of the latencies the thresholds below are for "));
+  printf (_("(default: %d)\n"), DEFAULT_PERCENTILE);
+  printf (" %s\n", "--latency-warning=RANGE");
+  printf ("    %s\n", _("Latency of that percentile, in seconds, to result in warning status"));
+  printf (" %s\n", "--latency-critical=RANGE");
+  printf ("    %s\n", _("Latency of that percentile, in seconds, to result in critical status"));
 
 
   printf ("\n");
@@ -570,6 +838,11 @@ print_help (void)
 	printf ("%s\n", _("Notes:"));
 	printf (" %s\n", _("You must specify -p with an empty string to force an empty password,"));
 	printf (" %s\n", _("overriding any my.cnf settings."));
+	printf (" %s\n", _("The slave status of MySQL 8 is read from performance_schema when the user"));
+	printf (" %s\n", _("may select from its replication tables, from SHOW SLAVE STATUS otherwise."));
+	printf (" %s\n", _("With --repeat the minimum, median, percentile and maximum latency of the"));
+	printf (" %s\n", _("runs are added to the output and the perfdata. All of them have to fit in"));
+	printf (" %s\n", _("the time the plugin is given, pauses included."));
 
 	printf (UT_SUPPORT);
 }
@@ -580,6 +853,8 @@ print_usage (void)
 {
 	printf ("%s\n", _("Usage:"));
   printf (" %s [-d database] [-H host] [-P port] [-s socket]\n",progname);
-  printf ("       [-u user] [-p password] [-S] [-l] [-a cert] [-k key]\n");
+  printf ("       [-u user] [-p password] [-S] [-m] [-l] [-a cert] [-k key]\n");
   printf ("       [-C ca-cert] [-D ca-dir] [-L ciphers] [-f optfile] [-g group]\n");
+  printf ("       [--repeat=count [--interval=ms] [--latency-query=query]\n");
+  printf ("        [--percentile=p] [--latency-warning=range] [--latency-critical=range]]\n");
 }
@@ -37,124 +37,231 @@ const char *email = "devel@nagios-plugins.org";
 #include "utils.h"
 #include "utils_base.h"
 #include "netutils.h"
+#include "resident.h"
 
 #include <mysql.h>
 #include <errmsg.h>
 
-char *db_user = NULL;
-char *db_host = NULL;
-char *db_socket = NULL;
-char *db_pass = NULL;
-char *db_char_set = NULL;
-char *db = NULL;
-char *opt_file = NULL;
-char *opt_group = NULL;
-unsigned int db_port = MYSQL_PORT;
+/* defaults are set in reset_state() so resident mode can restore them */
+char *db_user;
+char *db_host;
+char *db_socket;
+char *db_pass;
+char *db_char_set;
+char *db;
+char *opt_file;
+char *opt_group;
+unsigned int db_port;
 
 int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
+static int run_check (int, char **);
+static void reset_state (void);
+
+char *sql_query;
+int verbose;
+thresholds *my_thresholds;
+
+/* one -q, with the -n, -w and -c that follow it */
+typedef struct named_query {
+	char *name;
+	char *sql;
+	char *warning;
+	char *critical;
+	thresholds *thresholds;
+	int state;
+	double value;
+	int has_value;
+	double time;             /* seconds, or < 0 if run with the others */
+	char *msg;
+} named_query;
+
+named_query *queries;
+int query_count;
+int multi_statement;  /* all queries in one round trip */
+
+int check_queries (MYSQL *);
+static void close_connection (MYSQL *);
+
+/* connections kept between the checks of a resident worker */
+static int
+pool_fd (void *conn)
+{
+#ifdef MARIADB_BASE_VERSION
+	return mysql_get_socket (conn);
+#else
+	return ((MYSQL *)conn)->net.fd;
+#endif
+}
+
+/* one round trip instead of the handshake and authentication; fails too
+ * on results a check left unread */
+static int
+pool_alive (void *conn)
+{
+	return mysql_ping (conn) == 0;
+}
 
-char *sql_query = NULL;
-int verbose = 0;
-thresholds *my_thresholds = NULL;
+static void
+pool_close (void *conn)
+{
+	mysql_close (conn);
+}
+
+static const np_pool_ops pool_ops = { pool_fd, pool_alive, pool_close };
 
 
 int
 main (int argc, char **argv)
+{
+	if (np_resident_requested (argc, argv))
+		return np_resident_main (argc, argv, run_check, reset_state);
+
+	reset_state ();
+	return run_check (argc, argv);
+}
+
+
+static void
+reset_state (void)
+{
+	db_user = NULL;
+	db_host = NULL;
+	db_socket = NULL;
+	db_pass = NULL;
+	db_char_set = NULL;
+	db = NULL;
+	opt_file = NULL;
+	opt_group = NULL;
+	db_port = MYSQL_PORT;
+	sql_query = NULL;
+	verbose = 0;
+	my_thresholds = NULL;
+	queries = NULL;
+	query_count = 0;
+	multi_statement = FALSE;
+}
+
+
+static int
+run_check (int argc, char **argv)
 {
 
-	MYSQL mysql;
+	MYSQL *mysql;
 	MYSQL_RES *res;
 	MYSQL_ROW row;
 	
 	double value;
 	char *error = NULL;
+	char *key;
 	int status;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
 
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
-	/* initialize mysql  */
-	mysql_init (&mysql);
+	/* a resident worker may have kept a connection from an earlier check
+	 * made with the same options */
+	xasprintf (&key, "%s:%u:%s:%s:%s:%s:%s:%s:%s:%d",
+	           db_host ? db_host : "", db_port, db_socket ? db_socket : "",
+	           db_user ? db_user : "", db_pass ? db_pass : "", db ? db : "",
+	           opt_file ? opt_file : "", opt_group ? opt_group : "",
+	           db_char_set ? db_char_set : "", multi_statement);
+	if ((mysql = np_pool_get (key, &pool_ops)) != NULL) {
+		if (verbose)
+			printf ("Reusing the connection of an earlier check\n");
+	}
+	else {
+		/* initialize mysql  */
+		if ((mysql = mysql_init (NULL)) == NULL)
+			die (STATE_UNKNOWN, "QUERY %s: %s\n", _("UNKNOWN"), _("Could not allocate memory"));
 
-	if (opt_file != NULL)
-		mysql_options(&mysql,MYSQL_READ_DEFAULT_FILE,opt_file);
+		if (opt_file != NULL)
+			mysql_options(mysql,MYSQL_READ_DEFAULT_FILE,opt_file);
 
-	if (opt_group != NULL)
-		mysql_options(&mysql,MYSQL_READ_DEFAULT_GROUP,opt_group);
-	else
-		mysql_options(&mysql,MYSQL_READ_DEFAULT_GROUP,"client");
-
-	/* establish a connection to the server and error checking */
-	if (!mysql_real_connect(&mysql,db_host,db_user,db_pass,db,db_port,db_socket,0)) {
-		if (mysql_errno (&mysql) == CR_UNKNOWN_HOST)
-			die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (&mysql));
-		else if (mysql_errno (&mysql) == CR_VERSION_ERROR)
-			die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (&mysql));
-		else if (mysql_errno (&mysql) == CR_OUT_OF_MEMORY)
-			die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (&mysql));
-		else if (mysql_errno (&mysql) == CR_IPSOCK_ERROR)
-			die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (&mysql));
-		else if (mysql_errno (&mysql) == CR_SOCKET_CREATE_ERROR)
-			die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (&mysql));
+		if (opt_group != NULL)
+			mysql_options(mysql,MYSQL_READ_DEFAULT_GROUP,opt_group);
 		else
-			die (STATE_CRITICAL, "QUERY %s: %s\n", _("CRITICAL"), mysql_error (&mysql));
+			mysql_options(mysql,MYSQL_READ_DEFAULT_GROUP,"client");
+
+		/* establish a connection to the server and error checking */
+		if (!mysql_real_connect(mysql,db_host,db_user,db_pass,db,db_port,db_socket,
+		                        multi_statement ? CLIENT_MULTI_STATEMENTS : 0)) {
+			if (mysql_errno (mysql) == CR_UNKNOWN_HOST)
+				die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (mysql));
+			else if (mysql_errno (mysql) == CR_VERSION_ERROR)
+				die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (mysql));
+			else if (mysql_errno (mysql) == CR_OUT_OF_MEMORY)
+				die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (mysql));
+			else if (mysql_errno (mysql) == CR_IPSOCK_ERROR)
+				die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (mysql));
+			else if (mysql_errno (mysql) == CR_SOCKET_CREATE_ERROR)
+				die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (mysql));
+			else
+				die (STATE_CRITICAL, "QUERY %s: %s\n", _("CRITICAL"), mysql_error (mysql));
+		}
+
+		if (db_char_set != NULL && mysql_set_character_set(mysql, db_char_set)) { // mysql_set_character_set() returns nonzero on error
+			error = strdup(mysql_error(mysql));
+			mysql_close(mysql);
+			die (STATE_CRITICAL, "QUERY %s: %s - %s\n", _("CRITICAL"), _("Could not set character set"), error);
+		}
+		np_pool_add (key, mysql, &pool_ops);
 	}
 
-	if (db_char_set != NULL && mysql_set_character_set(&mysql, db_char_set)) { // mysql_set_character_set() returns nonzero on error
-		error = strdup(mysql_error(&mysql));
-		mysql_close(&mysql);
-		die (STATE_CRITICAL, "QUERY %s: %s - %s\n", _("CRITICAL"), _("Could not set character set"), error);
+	if (query_count > 1) {
+		status = check_queries (mysql);
+		close_connection (mysql);
+		return status;
 	}
 
-	if (mysql_query (&mysql, sql_query) != 0) {
-		error = strdup(mysql_error(&mysql));
-		mysql_close (&mysql);
+	if (mysql_query (mysql, sql_query) != 0) {
+		error = strdup(mysql_error(mysql));
+		np_pool_close (mysql, &pool_ops);
 		die (STATE_CRITICAL, "QUERY %s: %s - %s\n", _("CRITICAL"), _("Error with query"), error);
 	}
 
 	/* store the result */
-	if ( (res = mysql_store_result (&mysql)) == NULL) {
-		error = strdup(mysql_error(&mysql));
-		mysql_close (&mysql);
+	if ( (res = mysql_store_result (mysql)) == NULL) {
+		error = strdup(mysql_error(mysql));
+		np_pool_close (mysql, &pool_ops);
 		die (STATE_CRITICAL, "QUERY %s: Error with store_result - %s\n", _("CRITICAL"), error);
 	}
 
 	/* Check there is some data */
 	if (mysql_num_rows(res) == 0) {
-		mysql_close(&mysql);
+		mysql_free_result (res);
+		close_connection (mysql);
 		die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), _("No rows returned"));
 	}
 
 	/* fetch the first row */
 	if ( (row = mysql_fetch_row (res)) == NULL) {
-		error = strdup(mysql_error(&mysql));
+		error = strdup(mysql_error(mysql));
 		mysql_free_result (res);
-		mysql_close (&mysql);
+		np_pool_close (mysql, &pool_ops);
 		die (STATE_CRITICAL, "QUERY %s: Fetch row error - %s\n", _("CRITICAL"), error);
 	}
 
-	/* free the result */
-	mysql_free_result (res);
-
-	/* close the connection */
-	mysql_close (&mysql);
-
 	if (! is_numeric(row[0])) {
-		die (STATE_CRITICAL, "QUERY %s: %s - '%s'\n", _("CRITICAL"), _("Is not a numeric"), row[0]);
+		error = strdup(row[0]);
+		mysql_free_result (res);
+		close_connection (mysql);
+		die (STATE_CRITICAL, "QUERY %s: %s - '%s'\n", _("CRITICAL"), _("Is not a numeric"), error);
 	}
 
 	value = strtod(row[0], NULL);
 
+	/* free the result */
+	mysql_free_result (res);
+
+	/* close the connection, or keep it for the next check */
+	close_connection (mysql);
+
 	if (verbose >= 3)
 		printf("mysql result: %f\n", value);
 
@@ -181,6 +288,145 @@ main (int argc, char **argv)
 }
 
 
+/* the first column of the first row of a result, against the thresholds
+ * of the query, as for a single -q */
+/* done with the connection; closed unless the pool keeps it */
+static void
+close_connection (MYSQL *mysql)
+{
+	if (np_pool_release (mysql)) {
+		if (verbose)
+			printf ("Keeping connection for the next check\n");
+	}
+	else
+		mysql_close (mysql);
+}
+
+
+static void
+check_result (MYSQL *mysql, MYSQL_RES *res, named_query *q)
+{
+	MYSQL_ROW row;
+
+	if (res == NULL) {
+		q->state = STATE_CRITICAL;
+		xasprintf (&q->msg, "Error with store_result - %s", mysql_error (mysql));
+		return;
+	}
+	if (mysql_num_rows (res) == 0) {
+		q->state = STATE_WARNING;
+		xasprintf (&q->msg, "%s", _("No rows returned"));
+	} else if ((row = mysql_fetch_row (res)) == NULL) {
+		q->state = STATE_CRITICAL;
+		xasprintf (&q->msg, "Fetch row error - %s", mysql_error (mysql));
+	} else if (! is_numeric (row[0])) {
+		q->state = STATE_CRITICAL;
+		xasprintf (&q->msg, "%s - '%s'", _("Is not a numeric"), row[0]);
+	} else {
+		q->value = strtod (row[0], NULL);
+		q->has_value = TRUE;
+		q->state = get_status (q->value, q->thresholds);
+		xasprintf (&q->msg, _("'%s' returned %f"), q->sql, q->value);
+		if (verbose >= 3)
+			printf ("mysql result of %s: %f\n", q->name, q->value);
+	}
+	mysql_free_result (res);
+}
+
+/* Runs every -q over the one connection, one after the other or, with
+ * --multi-statement, all in one round trip (and then without a time of
+ * their own), and prints a summary and a line for each. */
+int
+check_queries (MYSQL *mysql)
+{
+	struct timeval tv;
+	char *all = NULL, *problems = NULL, *label;
+	int i, status = STATE_OK, count_ok = 0, more, done = 0;
+	double total;
+	np_perfdata perf;
+
+	gettimeofday (&tv, NULL);
+	if (multi_statement) {
+		for (i = 0; i < query_count; i++) {
+			queries[i].time = -1;
+			xasprintf (&all, "%s%s%s", all ? all : "", all ? ";\n" : "", queries[i].sql);
+		}
+		if (mysql_query (mysql, all) != 0) {
+			queries[0].state = STATE_CRITICAL;
+			xasprintf (&queries[0].msg, "%s - %s", _("Error with query"), mysql_error (mysql));
+			done = 1;
+		} else {
+			while (done < query_count) {
+				check_result (mysql, mysql_store_result (mysql), &queries[done++]);
+				if (done == query_count)
+					break;
+				/* a statement that fails ends the round trip */
+				if ((more = mysql_next_result (mysql)) != 0) {
+					if (more > 0) {
+						queries[done].state = STATE_CRITICAL;
+						xasprintf (&queries[done].msg, "%s - %s", _("Error with query"), mysql_error (mysql));
+						done++;
+					}
+					break;
+				}
+			}
+		}
+		for (i = done; i < query_count; i++) {
+			queries[i].state = STATE_CRITICAL;
+			xasprintf (&queries[i].msg, "%s", _("Not run after an earlier error"));
+		}
+	} else {
+		for (i = 0; i < query_count; i++) {
+			struct timeval start;
+
+			gettimeofday (&start, NULL);
+			if (mysql_query (mysql, queries[i].sql) != 0) {
+				queries[i].state = STATE_CRITICAL;
+				xasprintf (&queries[i].msg, "%s - %s", _("Error with query"), mysql_error (mysql));
+			} else
+				check_result (mysql, mysql_store_result (mysql), &queries[i]);
+			queries[i].time = delta_time (start);
+		}
+	}
+	total = delta_time (tv);
+
+	np_perfdata_init (&perf);
+	for (i = 0; i < query_count; i++) {
+		named_query *q = &queries[i];
+
+		status = max_state (status, q->state);
+		if (q->state == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           q->name, q->msg);
+		if (q->has_value)
+			np_perfdata_addf (&perf, q->name, q->value, "",
+			                  q->thresholds->warning != NULL, q->thresholds->warning ? q->thresholds->warning->end : 0,
+			                  q->thresholds->critical != NULL, q->thresholds->critical ? q->thresholds->critical->end : 0,
+			                  FALSE, 0, FALSE, 0);
+		if (q->time >= 0) {
+			xasprintf (&label, "%s_time", q->name);
+			np_perfdata_addf (&perf, label, q->time, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+			free (label);
+		}
+	}
+	np_perfdata_addf (&perf, "time", total, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+
+	printf ("QUERY %s: %d of %d %s%s%s|%s\n", state_text (status), count_ok, query_count,
+	        _("queries OK"), problems ? " - " : "", problems ? problems : "",
+	        np_perfdata_string (&perf));
+	for (i = 0; i < query_count; i++) {
+		printf ("[%s] %s: %s", state_text (queries[i].state), queries[i].name, queries[i].msg);
+		if (queries[i].time >= 0)
+			printf (_(" (%.6f seconds)"), queries[i].time);
+		printf ("\n");
+	}
+	np_perfdata_free (&perf);
+	return status;
+}
+
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
@@ -206,6 +452,8 @@ process_arguments (int argc, char **argv)
 		{"query", required_argument, 0, 'q'},
 		{"warning", required_argument, 0, 'w'},
 		{"critical", required_argument, 0, 'c'},
+		{"name", required_argument, 0, 'n'},
+		{"multi-statement", no_argument, 0, 'M'},
 		{0, 0, 0, 0}
 	};
 
@@ -213,7 +461,7 @@ process_arguments (int argc, char **argv)
 		return ERROR;
 
 	while (1) {
-		c = getopt_long (argc, argv, "hvVP:p:u:d:H:s:q:w:c:f:g:a:", longopts, &option);
+		c = getopt_long (argc, argv, "hvVP:p:u:d:H:s:q:w:c:f:g:a:n:M", longopts, &option);
 
 		if (c == -1 || c == EOF)
 			break;
@@ -262,18 +510,43 @@ process_arguments (int argc, char **argv)
 			break;
 		case 'V':									/* version */
 			print_revision (progname, NP_VERSION);
-			exit (STATE_OK);
+			np_exit (STATE_OK);
 		case 'h':									/* help */
 			print_help ();
-			exit (STATE_OK);
+			np_exit (STATE_OK);
 		case 'q':
 			xasprintf(&sql_query, "%s", optarg);
+			queries = realloc (queries, (query_count + 1) * sizeof (named_query));
+			if (queries == NULL)
+				die (STATE_UNKNOWN, _("Could not allocate memory for the queries\n"));
+			memset (&queries[query_count], 0, sizeof (named_query));
+			queries[query_count].sql = sql_query;
+			queries[query_count].warning = warning;
+			queries[query_count].critical = critical;
+			xasprintf (&queries[query_count].name, "query%d", query_count + 1);
+			query_count++;
 			break;
+		/* before the first -q these apply to every query, after it to the
+		 * last one */
 		case 'w':
-			warning = optarg;
+			if (query_count > 0)
+				queries[query_count - 1].warning = optarg;
+			else
+				warning = optarg;
 			break;
 		case 'c':
-			critical = optarg;
+			if (query_count > 0)
+				queries[query_count - 1].critical = optarg;
+			else
+				critical = optarg;
+			break;
+		case 'n':
+			if (query_count == 0)
+				usage2 (_("A query name must follow its query"), optarg);
+			queries[query_count - 1].name = optarg;
+			break;
+		case 'M':
+			multi_statement = TRUE;
 			break;
 		case '?':									/* help */
 			usage5 ();
@@ -282,7 +555,12 @@ process_arguments (int argc, char **argv)
 
 	c = optind;
 
-	set_thresholds(&my_thresholds, warning, critical);
+	for (c = 0; c < query_count; c++)
+		set_thresholds(&queries[c].thresholds, queries[c].warning, queries[c].critical);
+	if (query_count == 1)
+		my_thresholds = queries[0].thresholds;
+	else
+		set_thresholds(&my_thresholds, warning, critical);
 
 	return validate_arguments ();
 }
@@ -327,7 +605,14 @@ print_help (void)
 	printf (UT_EXTRA_OPTS);
 	printf (" -q, --query=STRING\n");
 	printf ("    %s\n", _("SQL query to run. Only first column in first row will be read"));
+	printf ("    %s\n", _("May be repeated: the queries then run over one connection, with a"));
+	printf ("    %s\n", _("summary line followed by a line for each, and its time as perfdata"));
+	printf (" -n, --name=STRING\n");
+	printf ("    %s\n", _("Name of the query before it in its line and perfdata (default queryN)"));
+	printf (" -M, --multi-statement\n");
+	printf ("    %s\n", _("Send all queries in one round trip, as statements of one request"));
 	printf (UT_WARN_CRIT_RANGE);
+	printf ("    %s\n", _("Given after a -q, for that query only; before the first one, for all"));
 	printf (UT_HOST_PORT, 'P', myport);
 	printf (" %s\n", "-s, --socket=STRING");
 	printf ("    %s\n", _("Use the specified socket (has no effect if -H is used)"));
@@ -363,6 +648,7 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-  printf (" %s -q SQL_query [-w warn] [-c crit] [-H host] [-P port] [-s socket]\n",progname);
+  printf (" %s -q SQL_query [-n name] [-w warn] [-c crit] [-q ...] [-M]\n",progname);
+  printf ("       [-H host] [-P port] [-s socket]\n");
   printf ("       [-d database] [-u user] [-p password] [-f optfile] [-g group] [-a character-set]\n");
 }
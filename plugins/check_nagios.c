@@ -39,14 +39,25 @@ const char *email = "devel@nagios-plugins.org";
 #include "common.h"
 #include "runcmd.h"
 #include "utils.h"
+#include "utils_proc.h"
+#include <sys/stat.h>
+#include <ctype.h>
+#include <fcntl.h>
 
 int process_arguments (int, char **);
+int count_native (const char *self);
+void check_lock (void) __attribute__((noreturn));
 void print_help (void);
 void print_usage (void);
 
 char *status_log = NULL;
 char *process_string = NULL;
 int expire_minutes = 0;
+int use_mtime = FALSE;
+char *lock_file = NULL;
+char *cpu_warning = NULL;
+char *cpu_critical = NULL;
+thresholds *cpu_thresholds = NULL;
 
 int verbose = 0;
 
@@ -80,11 +91,10 @@ main (int argc, char **argv)
 	const char *zombie = "Z";
 	char *temp_string;
 	output chld_out, chld_err;
+	struct stat st;
 	size_t i;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_init ((char *) progname, argc, argv);
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -92,6 +102,9 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage_va(_("Could not parse arguments"));
 
+	if (lock_file)
+		check_lock ();
+
 	/* Set signal handling and alarm timeout */
 	if (signal (SIGALRM, timeout_alarm_handler) == SIG_ERR) {
 		usage_va(_("Cannot catch SIGALRM"));
@@ -106,8 +119,17 @@ main (int argc, char **argv)
 		die (STATE_CRITICAL, "NAGIOS %s: %s\n", _("CRITICAL"), _("Cannot open status log for reading!"));
 	}
 
-	/* get the date/time of the last item updated in the log */
-	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
+	/* get the date/time of the last item updated in the log, or of the
+	 * log itself, which Nagios rewrites every status_update_interval */
+	if (use_mtime) {
+		if (fstat (fileno (fp), &st) == 0)
+			latest_entry_time = st.st_mtime;
+		if (verbose >= 2)
+			printf ("mtime: %lu\n", latest_entry_time);
+	}
+	/* status.dat has created= in its first block, an old status.log has
+	 * the time of each entry */
+	else while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
 		if ((temp_ptr = strstr (input_buffer, "created=")) != NULL) {
 			temp_entry_time = strtoul (temp_ptr + 8, NULL, 10);
 			latest_entry_time = temp_entry_time;
@@ -120,12 +142,19 @@ main (int argc, char **argv)
 	}
 	fclose (fp);
 
-	if (verbose >= 2)
-		printf("command: %s\n", PS_COMMAND);
+	/* count the Nagios processes from /proc where there is one */
+	if ((proc_entries = count_native (argv[0])) >= 0) {
+		chld_out.lines = 0;
+		chld_err.buflen = 0;
+	} else {
+		proc_entries = 0;
+		if (verbose >= 2)
+			printf("command: %s\n", PS_COMMAND);
 
-	/* run the command to check for the Nagios process.. */
-	if((result = np_runcmd(PS_COMMAND, &chld_out, &chld_err, 0)) != 0)
-		result = STATE_WARNING;
+		/* run the command to check for the Nagios process.. */
+		if((result = np_runcmd(PS_COMMAND, &chld_out, &chld_err, 0)) != 0)
+			result = STATE_WARNING;
+	}
 
 	/* count the number of matching Nagios processes... */
 	for(i = 0; i < chld_out.lines; i++) {
@@ -196,17 +225,131 @@ main (int argc, char **argv)
 
 
 
+/* The processes with process_string in their arguments, other than this
+ * one, from a scan of /proc; -1 if there is no /proc to scan */
+int
+count_native (const char *self)
+{
+	np_proc_scan scan;
+	np_proc_entry pe;
+	pid_t me = getpid ();
+	int count = 0;
+
+	if (!np_proc_scan_open (&scan))
+		return -1;
+	while (np_proc_scan_next (&scan, &pe)) {
+		/* zombies have no arguments left, as with ps */
+		if (pe.pid == me || pe.stat[0] == 'Z' || !np_proc_scan_args (&scan, &pe))
+			continue;
+		if (!strstr (pe.args, self) && strstr (pe.args, process_string) && strcmp (pe.args, "")) {
+			count++;
+			if (verbose >= 2)
+				printf (_("Found process: %s %s\n"), pe.prog, pe.args);
+		}
+	}
+	np_proc_scan_close (&scan);
+	return count;
+}
+
+
+
+/*
+ * Whether Nagios runs, how old its status is and how much CPU it uses,
+ * from the pid in its lock file, one read of /proc/<pid>/stat (and of its
+ * cmdline with -C) and a stat() of the status log: no ps, no scan of the
+ * process table and no reading of the log, so that it can run every few
+ * seconds. The CPU is that since the last run, whose sample is kept in
+ * the state directory, or the average since Nagios started.
+ */
+void
+check_lock (void)
+{
+	np_proc_scan scan;
+	np_proc_entry pe;
+	state_data *previous;
+	struct stat st;
+	char buf[32], *end, *sample;
+	unsigned long long start, ticks, last_ms, uptime_ms;
+	long pid, last_pid, hz;
+	ssize_t len;
+	time_t now;
+	double pcpu;
+	int fd, age, result;
+
+	if ((fd = open (lock_file, O_RDONLY)) < 0)
+		die (STATE_CRITICAL, "NAGIOS %s: %s %s: %s\n", _("CRITICAL"), _("Cannot open lock file"),
+		     lock_file, strerror (errno));
+	len = read (fd, buf, sizeof (buf) - 1);
+	close (fd);
+	buf[len > 0 ? len : 0] = '\0';
+	pid = strtol (buf, &end, 10);
+	if (pid <= 0 || (*end && !isspace ((unsigned char) *end)))
+		die (STATE_CRITICAL, "NAGIOS %s: %s %s\n", _("CRITICAL"), _("No pid in lock file"), lock_file);
+
+	if (!np_proc_scan_open (&scan))
+		die (STATE_UNKNOWN, "NAGIOS %s: %s\n", _("UNKNOWN"), _("Cannot read the process of the lock file without /proc"));
+	if (!np_proc_scan_pid (&scan, (pid_t) pid, &pe) || pe.stat[0] == 'Z')
+		die (STATE_CRITICAL, "NAGIOS %s: %s %ld %s %s\n", _("CRITICAL"), _("Nagios is not running, pid"),
+		     pid, _("of"), lock_file);
+	if (process_string && (!np_proc_scan_args (&scan, &pe) || !strstr (pe.args, process_string)))
+		die (STATE_CRITICAL, "NAGIOS %s: %s %ld %s '%s'\n", _("CRITICAL"), _("pid"), pid,
+		     _("of the lock file does not match"), process_string);
+	uptime_ms = scan.uptime_ms;
+	hz = scan.hz;
+	np_proc_scan_close (&scan);
+	if (verbose >= 2)
+		printf ("pid %ld: %s, %llu ticks since %llu\n", pid, pe.prog, pe.ticks, pe.start);
+
+	/* the same process as at the last run: what it used since then */
+	pcpu = pe.pcpu;
+	if ((previous = np_state_read ()) != NULL && previous->data
+	    && sscanf (previous->data, "%ld %llu %llu %llu", &last_pid, &start, &ticks, &last_ms) == 4
+	    && last_pid == pid && start == pe.start && ticks <= pe.ticks && last_ms < uptime_ms)
+		pcpu = (pe.ticks - ticks) * 100000.0 / hz / (uptime_ms - last_ms);
+	xasprintf (&sample, "%ld %llu %llu %llu", pid, pe.start, pe.ticks, uptime_ms);
+	np_state_write_string (0, sample);
+
+	if (stat (status_log, &st) != 0)
+		die (STATE_CRITICAL, "NAGIOS %s: %s %s: %s\n", _("CRITICAL"), _("Cannot stat status log"),
+		     status_log, strerror (errno));
+	time (&now);
+	age = now > st.st_mtime ? (int) (now - st.st_mtime) : 0;
+
+	result = age > expire_minutes * 60 ? STATE_WARNING : STATE_OK;
+	result = max_state (result, get_status (pcpu, cpu_thresholds));
+
+	printf ("NAGIOS %s: ", state_text (result));
+	printf (_("pid %ld, "), pid);
+	printf (ngettext ("status log updated %d second ago", "status log updated %d seconds ago", age), age);
+	printf (_(", %.1f%% CPU"), pcpu);
+	printf ("|%s %s\n",
+	        perfdata ("age", age, "s", expire_minutes > 0, expire_minutes * 60, FALSE, 0, TRUE, 0, FALSE, 0),
+	        sperfdata ("cpu", pcpu, "%", cpu_warning, cpu_critical, TRUE, 0, FALSE, 0));
+	exit (result);
+}
+
+
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
 {
 	int c;
 
+	enum {
+		CPU_WARNING_OPTION = CHAR_MAX + 1,
+		CPU_CRITICAL_OPTION
+	};
+
 	int option = 0;
 	static struct option longopts[] = {
 		{"filename", required_argument, 0, 'F'},
+		{"lock-file", required_argument, 0, 'L'},
+		{"cpu-warning", required_argument, 0, CPU_WARNING_OPTION},
+		{"cpu-critical", required_argument, 0, CPU_CRITICAL_OPTION},
 		{"expires", required_argument, 0, 'e'},
 		{"command", required_argument, 0, 'C'},
+		{"mtime", no_argument, 0, 'm'},
 		{"timeout", optional_argument, 0, 't'},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
@@ -229,7 +372,7 @@ process_arguments (int argc, char **argv)
 	}
 
 	while (1) {
-		c = getopt_long (argc, argv, "+hVvF:C:e:t:", longopts, &option);
+		c = getopt_long (argc, argv, "+hVvmF:L:C:e:t:", longopts, &option);
 
 		if (c == -1 || c == EOF || c == 1)
 			break;
@@ -244,6 +387,15 @@ process_arguments (int argc, char **argv)
 		case 'F':									/* status log */
 			status_log = optarg;
 			break;
+		case 'L':									/* lock file of the daemon */
+			lock_file = optarg;
+			break;
+		case CPU_WARNING_OPTION:
+			cpu_warning = optarg;
+			break;
+		case CPU_CRITICAL_OPTION:
+			cpu_critical = optarg;
+			break;
 		case 'C':									/* command */
 			process_string = optarg;
 			break;
@@ -254,6 +406,9 @@ process_arguments (int argc, char **argv)
 				die (STATE_UNKNOWN,
 				     _("Expiration time must be an integer (seconds)\n"));
 			break;
+		case 'm':									/* time of the log itself */
+			use_mtime = TRUE;
+			break;
 		case 't':									/* timeout */
 			timeout_interval = parse_timeout_string (optarg);
 			break;
@@ -269,9 +424,16 @@ process_arguments (int argc, char **argv)
 	if (status_log == NULL)
 		die (STATE_UNKNOWN, _("You must provide the status_log\n"));
 
-	if (process_string == NULL)
+	/* the lock file names the process, -C only makes sure it is Nagios */
+	if (process_string == NULL && lock_file == NULL)
 		die (STATE_UNKNOWN, _("You must provide a process string\n"));
 
+	if ((cpu_warning || cpu_critical) && lock_file == NULL)
+		usage4 (_("--cpu-warning and --cpu-critical need --lock-file"));
+	set_thresholds (&cpu_thresholds, cpu_warning, cpu_critical);
+	if (lock_file)
+		np_enable_state (NULL, 1);
+
 	return OK;
 }
 
@@ -302,6 +464,15 @@ print_help (void)
   printf ("    %s\n", _("Minutes aging after which logfile is considered stale"));
   printf (" %s\n", "-C, --command=STRING");
   printf ("    %s\n", _("Substring to search for in process arguments"));
+  printf (" %s\n", "-L, --lock-file=FILE");
+  printf ("    %s\n", _("The lock_file of Nagios: check the process of the pid in it, and the age"));
+  printf ("    %s\n", _("of the status log from its modification time, without a process scan"));
+  printf ("    %s\n", _("(Linux); -C is then optional and checked against that process only"));
+  printf (" %s\n", "--cpu-warning=RANGE, --cpu-critical=RANGE");
+  printf ("    %s\n", _("With -L, the %CPU of Nagios since the last run with these arguments"));
+  printf (" %s\n", "-m, --mtime");
+  printf ("    %s\n", _("Take the time of the last update from the modification time of the log"));
+  printf ("    %s\n", _("rather than from its contents, without reading it"));
   printf (" %s\n", "-t, --timeout=INTEGER");
   printf ("    %s\n", _("Timeout for the plugin in seconds"));
   printf (UT_VERBOSE);
@@ -309,6 +480,7 @@ print_help (void)
   printf ("\n");
   printf ("%s\n", _("Examples:"));
   printf (" %s\n", "check_nagios -t 20 -e 5 -F /usr/local/nagios/var/status.log -C /usr/local/nagios/bin/nagios");
+  printf (" %s\n", "check_nagios -e 1 -F /usr/local/nagios/var/status.dat -L /usr/local/nagios/var/nagios.lock --cpu-warning=50");
 
   printf (UT_SUPPORT);
 }
@@ -319,5 +491,7 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-	printf ("%s -F <status log file> -t <timeout_seconds> -e <expire_minutes> -C <process_string>\n", progname);
+	printf ("%s -F <status log file> -t <timeout_seconds> -e <expire_minutes> -C <process_string> [-m]\n", progname);
+	printf ("%s -F <status log file> -L <lock file> -e <expire_minutes> [-C <process_string>]\n", progname);
+	printf ("       [--cpu-warning=RANGE] [--cpu-critical=RANGE]\n");
 }
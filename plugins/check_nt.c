@@ -72,9 +72,29 @@ int check_critical_value=FALSE;
 enum checkvars vars_to_check = CHECK_NONE;
 int show_all=FALSE;
 
+/* one -v, with the -l, -w, -c and -d that follow it (or, for the first,
+ * that come before the second -v) */
+typedef struct nt_variable {
+	enum checkvars vars_to_check;
+	char *name;
+	char *value_list;
+	unsigned long warning_value;
+	unsigned long critical_value;
+	int check_warning_value;
+	int check_critical_value;
+	int show_all;
+} nt_variable;
+
+nt_variable *variables=NULL;
+int variable_count=0;
+
 char recv_buffer[MAX_INPUT_BUFFER];
+/* the connection of the last request, tried again for the next one */
+int server_sd=-1;
 
 void fetch_data (const char* address, int port, const char* sendb);
+int check_variable (char **, char **);
+void add_variable (const char *);
 int process_arguments(int, char **);
 void preparelist(char *string);
 int strtoularray(unsigned long *array, char *string, const char *delim);
@@ -86,9 +106,104 @@ int main(int argc, char **argv){
 /* should be 	int result = STATE_UNKNOWN; */
 
 	int return_code = STATE_UNKNOWN;
-	char *send_buffer=NULL;
 	char *output_message=NULL;
 	char *perfdata=NULL;
+	char **messages, *perf, *problems=NULL;
+	int *states;
+	int i, count_ok=0;
+
+	/* Parse extra opts if any */
+	argv=np_extra_opts (&argc, argv, progname);
+
+	if(process_arguments(argc,argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	/* initialize alarm signal handling */
+	signal(SIGALRM,socket_timeout_alarm_handler);
+	/* a kept connection the server closed fails to send, and is made anew */
+	signal(SIGPIPE,SIG_IGN);
+
+	/* set socket timeout */
+	alarm(timeout_interval);
+
+	if (variable_count == 1) {
+		return_code = check_variable (&output_message, &perfdata);
+
+		/* reset timeout */
+		alarm(0);
+
+		if (perfdata==NULL)
+			printf("%s\n",output_message);
+		else
+			printf("%s | %s\n",output_message,perfdata);
+		return return_code;
+	}
+
+	/* several -v: each is checked as on its own, over the same connection
+	 * where the server keeps it open, and what the checks put after a
+	 * '|' goes into the perfdata of the summary */
+	states = calloc (variable_count, sizeof (int));
+	messages = calloc (variable_count, sizeof (char *));
+	if (states == NULL || messages == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	perf = strdup ("");
+	return_code = STATE_OK;
+	for (i = 0; i < variable_count; i++) {
+		char *pipe;
+
+		vars_to_check = variables[i].vars_to_check;
+		value_list = variables[i].value_list;
+		warning_value = variables[i].warning_value;
+		critical_value = variables[i].critical_value;
+		check_warning_value = variables[i].check_warning_value;
+		check_critical_value = variables[i].check_critical_value;
+		show_all = variables[i].show_all;
+
+		output_message = NULL;
+		perfdata = NULL;
+		states[i] = check_variable (&output_message, &perfdata);
+		if (output_message == NULL)
+			output_message = strdup ("");
+		if ((pipe = strchr (output_message, '|')) != NULL) {
+			*pipe = '\0';
+			if (perfdata == NULL)
+				perfdata = pipe + 1;
+		}
+		strip (output_message);
+		messages[i] = output_message;
+		if (perfdata != NULL) {
+			perfdata += strspn (perfdata, " ");
+			if (*perfdata)
+				xasprintf (&perf, "%s%s%s", perf, *perf ? " " : "", perfdata);
+		}
+
+		return_code = max_state_alt (return_code, states[i]);
+		if (states[i] == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           variables[i].name, messages[i]);
+	}
+
+	/* reset timeout */
+	alarm(0);
+
+	printf ("NSClient %s: %d of %d %s%s%s|%s\n", state_text (return_code), count_ok, variable_count,
+	        _("variables OK"), problems ? " - " : "", problems ? problems : "", perf);
+	for (i = 0; i < variable_count; i++)
+		printf ("[%s] %s: %s\n", state_text (states[i]), variables[i].name, messages[i]);
+	return return_code;
+}
+
+
+
+/* Fetches and checks the variable of vars_to_check, value_list and the
+ * thresholds, with the message and the perfdata (if kept apart from it)
+ * of its output */
+int check_variable (char **message, char **perf){
+
+	int return_code = STATE_UNKNOWN;
+	char *send_buffer=NULL;
 	char *temp_string=NULL;
 	char *temp_string_perf=NULL;
 	char *description=NULL,*counter_unit = NULL;
@@ -116,21 +231,8 @@ int main(int argc, char **argv){
 	int isPercent = FALSE;
 	int allRight = FALSE;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
-	/* Parse extra opts if any */
-	argv=np_extra_opts (&argc, argv, progname);
-
-	if(process_arguments(argc,argv) == ERROR)
-		usage4 (_("Could not parse arguments"));
-
-	/* initialize alarm signal handling */
-	signal(SIGALRM,socket_timeout_alarm_handler);
-
-	/* set socket timeout */
-	alarm(timeout_interval);
+	char *output_message=NULL;
+	char *perfdata=NULL;
 
 	switch (vars_to_check) {
 
@@ -488,13 +590,8 @@ int main(int argc, char **argv){
 
 	}
 
-	/* reset timeout */
-	alarm(0);
-
-	if (perfdata==NULL)
-		printf("%s\n",output_message);
-	else
-		printf("%s | %s\n",output_message,perfdata);
+	*message = output_message;
+	*perf = perfdata;
 	return return_code;
 }
 
@@ -503,6 +600,7 @@ int main(int argc, char **argv){
 /* process command-line arguments */
 int process_arguments(int argc, char **argv){
 	int c;
+	char *variable_name=NULL;
 
 	int option = 0;
 	static struct option longopts[] =
@@ -517,6 +615,7 @@ int process_arguments(int argc, char **argv){
 		{"secret",   required_argument,0,'s'},
 		{"display",  required_argument,0,'d'},
 		{"unknown-timeout", no_argument, 0, 'u'},
+		{"tcp-fastopen", no_argument, 0, CHAR_MAX+1},
 		{"version",  no_argument,      0,'V'},
 		{"help",     no_argument,      0,'h'},
 		{0,0,0,0}
@@ -572,6 +671,17 @@ int process_arguments(int argc, char **argv){
 			case 'v':
 				if(strlen(optarg)<4)
 					return ERROR;
+				/* the one before is complete: its options start over */
+				if (vars_to_check!=CHECK_NONE) {
+					add_variable(variable_name);
+					value_list=NULL;
+					warning_value=0L;
+					critical_value=0L;
+					check_warning_value=FALSE;
+					check_critical_value=FALSE;
+					show_all=FALSE;
+				}
+				variable_name=optarg;
 				if(!strcmp(optarg,"CLIENTVERSION"))
 					vars_to_check=CHECK_CLIENTVERSION;
 				else if(!strcmp(optarg,"CPULOAD"))
@@ -613,6 +723,9 @@ int process_arguments(int argc, char **argv){
 			case 'u':
 				timeout_state=STATE_UNKNOWN;
 				break;
+			case CHAR_MAX+1: /* tcp-fastopen */
+				np_net_fastopen = TRUE;
+				break;
 			case 't': /* timeout */
 				timeout_interval = parse_timeout_string(optarg);
 				break;
@@ -624,6 +737,7 @@ int process_arguments(int argc, char **argv){
 
 	if (vars_to_check==CHECK_NONE)
 		return ERROR;
+	add_variable(variable_name);
 
 	if (req_password == NULL)
 		req_password = strdup (_("None"));
@@ -633,10 +747,51 @@ int process_arguments(int argc, char **argv){
 
 
 
+void add_variable (const char *name) {
+	nt_variable *v;
+
+	variables = realloc (variables, (variable_count + 1) * sizeof (nt_variable));
+	if (variables == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	v = &variables[variable_count++];
+	v->vars_to_check = vars_to_check;
+	v->value_list = value_list;
+	v->warning_value = warning_value;
+	v->critical_value = critical_value;
+	v->check_warning_value = check_warning_value;
+	v->check_critical_value = check_critical_value;
+	v->show_all = show_all;
+	/* before the checks change value_list */
+	if (value_list != NULL)
+		xasprintf (&v->name, "%s %s", name, value_list);
+	else
+		v->name = strdup (name);
+}
+
+/* Sends the request over the connection of the one before where the
+ * server kept it open. NSClient++ closes it after each reply: that shows
+ * as the socket being readable before anything was sent, or as an empty
+ * reply, and the request is then sent again over a new connection. */
 void fetch_data (const char *address, int port, const char *sendb) {
-	int result;
+	int result, reused = FALSE;
 
-	result=process_tcp_request(address, port, sendb, recv_buffer,sizeof(recv_buffer));
+	/* a deadline already past only looks */
+	if (server_sd >= 0 && np_net_wait (server_sd, POLLIN, 0) != 0) {
+		close (server_sd);
+		server_sd = -1;
+	}
+	if (server_sd >= 0)
+		reused = TRUE;
+	else if ((result = my_tcp_connect (address, port, &server_sd)) != STATE_OK)
+		die (STATE_CRITICAL, _("could not fetch information from server\n"));
+
+	result=send_request(server_sd, IPPROTO_TCP, sendb, recv_buffer,sizeof(recv_buffer));
+	if (reused && (result != STATE_OK || recv_buffer[0] == '\0')) {
+		close (server_sd);
+		if (my_tcp_connect (address, port, &server_sd) != STATE_OK)
+			die (STATE_CRITICAL, _("could not fetch information from server\n"));
+		result=send_request(server_sd, IPPROTO_TCP, sendb, recv_buffer,sizeof(recv_buffer));
+	}
 
 	if(result!=STATE_OK)
 		die (result, _("could not fetch information from server\n"));
@@ -714,12 +869,14 @@ void print_help(void)
 	printf (" %s\n", "-u, --unknown-timeout  (DEPRECATED)");
 	printf ("   %s", _("Return UNKNOWN on timeouts"));
 	printf ("%d)\n", DEFAULT_SOCKET_TIMEOUT);
+	printf (UT_TCP_FASTOPEN);
 	printf (" %s\n", "-h, --help");
 	printf ("   %s\n", _("Print this help screen"));
 	printf (" %s\n", "-V, --version");
 	printf ("   %s\n", _("Print version information"));
 	printf (" %s\n", "-v, --variable=STRING");
-	printf ("   %s\n\n", _("Variable to check"));
+	printf ("   %s\n", _("Variable to check. May be given more than once, each followed by its"));
+	printf ("   %s\n\n", _("own -l, -w, -c and -d, for a summary with a line for each (see below)"));
 	printf ("%s\n", _("Valid variables are:"));
 	printf (" %s", "CLIENTVERSION =");
 	printf (" %s\n", _("Get the NSClient version"));
@@ -785,6 +942,8 @@ void print_help(void)
 	printf ("   %s\n", _("output when this happens contains \"Cannot map xxxxx to protocol number\"."));
 	printf ("   %s\n", _("One fix for this is to change the port to something else on check_nt "));
 	printf ("   %s\n", _("and on the client service it\'s connecting to."));
+	printf (" %s\n", _("- With several -v all requests go over one connection where the server keeps"));
+	printf ("   %s\n", _("it open, and over a new one for each where it closes it after a reply."));
 
 	printf (UT_SUPPORT);
 }
@@ -795,6 +954,7 @@ void print_usage(void)
 {
 	printf ("%s\n", _("Usage:"));
 	printf ("%s -H host -v variable [-p port] [-w warning] [-c critical]\n",progname);
-	printf ("[-l params] [-d SHOWALL] [-u](DEPRECATED) [-t timeout]\n");
+	printf ("[-v variable [-l params] [-w warning] [-c critical] ...]\n");
+	printf ("[-l params] [-d SHOWALL] [-u](DEPRECATED) [-t timeout] [--tcp-fastopen]\n");
 }
 
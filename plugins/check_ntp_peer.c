@@ -188,6 +188,98 @@ setup_control_request(ntp_control_message *p, uint8_t opcode, uint16_t seq){
 	/* Remaining fields are zero for requests */
 }
 
+/* the READVAR reply of one association, put together from its fragments */
+typedef struct {
+	uint16_t assoc;
+	const char *getvar;  /* the variables asked for */
+	char *data;
+	int size;            /* of the data received */
+	int received;        /* octets of it, over all fragments */
+	int end;             /* the length given by the last fragment, -1 before that */
+	int tries;
+	int done;
+	int error;           /* REM_ERROR was set */
+} ntp_peer_vars;
+
+/* Send the READVAR request of every peer at once, each with its own
+ * sequence number, and sort the fragments of the replies as they arrive.
+ * Those that get no complete reply are asked again every second until the
+ * time runs out. */
+void
+read_peer_vars(int conn, ntp_peer_vars *vars, int nvars){
+	ntp_control_message req;
+	int64_t deadline = np_net_deadline(0), resend = 0, now;
+	int i, pending, off, count, wait;
+	char *tmp;
+
+	for(;;){
+		now = np_net_deadline(1) - 1;
+		pending = 0;
+		for(i = 0; i < nvars; i++){
+			if(vars[i].done)
+				continue;
+			pending++;
+			if(now < resend || vars[i].tries >= 3)
+				continue;
+			setup_control_request(&req, OP_READVAR, (uint16_t)(2 + i));
+			req.assoc = vars[i].assoc;
+			/* Putting the wanted variable names in the request
+			 * cause the server to provide _only_ the requested values.
+			 * thus reducing net traffic, and making interpretation
+			 * much simpler */
+			strncpy(req.data, vars[i].getvar, MAX_CM_SIZE-1);
+			req.count = htons(strlen(vars[i].getvar));
+			DBG(printf("sending READVAR request for peer %.2x...\n", ntohs(vars[i].assoc)));
+			write(conn, &req, SIZEOF_NTPCM(req));
+			DBG(print_ntp_control_message(&req));
+			vars[i].tries++;
+			vars[i].received = 0;
+			vars[i].end = -1;
+		}
+		if(pending == 0 || now >= deadline)
+			break;
+		if(now >= resend)
+			resend = now + 1000;
+
+		wait = np_net_wait(conn, POLLIN, resend < deadline ? resend : deadline);
+		if(wait < 0)
+			break;
+		if(wait == 0)
+			continue;
+		req.count = htons(MAX_CM_SIZE);
+		DBG(printf("receiving READVAR response...\n"));
+		if((count = read(conn, &req, sizeof(req))) < 12)
+			continue;
+		DBG(print_ntp_control_message(&req));
+		i = ntohs(req.seq) - 2;
+		if(!(req.op&REM_RESP) || (req.op&OP_MASK) != OP_READVAR || i < 0 || i >= nvars ||
+		   vars[i].done || req.assoc != vars[i].assoc)
+			continue;
+		off = ntohs(req.offset);
+		count = ntohs(req.count);
+		if(count > MAX_CM_SIZE)
+			continue;
+		if(req.op&REM_ERROR){
+			vars[i].error = 1;
+			vars[i].done = 1;
+			continue;
+		}
+		if(off + count + 1 > vars[i].size){
+			if((tmp = realloc(vars[i].data, off + count + 1)) == NULL)
+				die(STATE_UNKNOWN, "can not (re)allocate 'data' buffer\n");
+			memset(tmp + vars[i].size, 0, off + count + 1 - vars[i].size);
+			vars[i].data = tmp;
+			vars[i].size = off + count + 1;
+		}
+		memcpy(vars[i].data + off, req.data, count);
+		vars[i].received += count;
+		if(!(req.op&REM_MORE))
+			vars[i].end = off + count;
+		if(vars[i].end >= 0 && vars[i].received >= vars[i].end)
+			vars[i].done = 1;
+	}
+}
+
 /* This function does all the actual work; roughly here's what it does
  * beside setting the offest, jitter and stratum passed as argument:
  *  - offset can be negative, so if it cannot get the offset, offset_result
@@ -200,12 +292,13 @@ setup_control_request(ntp_control_message *p, uint8_t opcode, uint16_t seq){
  *  used later in main to check is the server was synchronized. It works
  *  so I left it alone */
 int ntp_request(const char *host, double *offset, int *offset_result, double *jitter, int *stratum, int *num_truechimers){
-	int conn=-1, i, npeers=0, num_candidates=0;
+	int conn=-1, i, j, k, npeers=0, num_candidates=0, nvars=0;
 	double tmp_offset = 0;
 	int min_peer_sel=PEER_INCLUDED;
 	int peers_size=0, peer_offset=0;
 	int status;
 	ntp_assoc_status_pair *peers=NULL;
+	ntp_peer_vars *vars=NULL;
 	ntp_control_message req;
 	const char *getvar = "stratum,offset,jitter";
 	char *data, *value, *nptr;
@@ -294,119 +387,108 @@ int ntp_request(const char *host, double *offset, int *offset_result, double *ji
 	}
 
 
+	/* Only query this server if it is the current sync source */
+	/* If there's no sync.peer, query all candidates and use the best one */
 	for (i = 0; i < npeers; i++){
-		/* Only query this server if it is the current sync source */
-		/* If there's no sync.peer, query all candidates and use the best one */
 		if (PEER_SEL(peers[i].status) >= min_peer_sel){
-			if(verbose) printf("Getting offset, jitter and stratum for peer %.2x\n", ntohs(peers[i].assoc));
-			xasprintf(&data, "");
-			do{
-				setup_control_request(&req, OP_READVAR, 2);
-				req.assoc = peers[i].assoc;
-				/* Putting the wanted variable names in the request
-				 * cause the server to provide _only_ the requested values.
-				 * thus reducing net traffic, guaranteeing us only a single
-				 * datagram in reply, and making interpretation much simpler
-				 */
-				/* Older servers doesn't know what jitter is, so if we get an
-				 * error on the first pass we redo it with "dispersion" */
-				strncpy(req.data, getvar, MAX_CM_SIZE-1);
-				req.count = htons(strlen(getvar));
-				DBG(printf("sending READVAR request...\n"));
-				write(conn, &req, SIZEOF_NTPCM(req));
-				DBG(print_ntp_control_message(&req));
-
-				do {
-					req.count = htons(MAX_CM_SIZE);
-					DBG(printf("receiving READVAR response...\n"));
-					read(conn, &req, SIZEOF_NTPCM(req));
-					DBG(print_ntp_control_message(&req));
-				} while (!(req.op&OP_READVAR && ntohs(req.seq) == 2));
-
-				if(!(req.op&REM_ERROR))
-					xasprintf(&data, "%s%s", data, req.data);
-			} while(req.op&REM_MORE);
-
-			if(req.op&REM_ERROR) {
-				if(strstr(getvar, "jitter")) {
-					if(verbose) printf("The command failed. This is usually caused by servers refusing the 'jitter'\nvariable. Restarting with 'dispersion'...\n");
-					getvar = "stratum,offset,dispersion";
-					i--;
-					continue;
-				} else if(strlen(getvar)) {
-					if(verbose) printf("Server didn't like dispersion either; will retrieve everything\n");
-					getvar = "";
-					i--;
-					continue;
-				}
-			}
-
-			if(verbose > 1)
-				printf("Server responded: >>>%s<<<\n", data);
+			if((vars=realloc(vars, sizeof(ntp_peer_vars)*(nvars+1))) == NULL)
+				die(STATE_UNKNOWN, "can not (re)allocate 'vars' buffer\n");
+			memset(&vars[nvars], 0, sizeof(ntp_peer_vars));
+			vars[nvars].assoc = peers[i].assoc;
+			vars[nvars++].getvar = getvar;
+		}
+	}
+	if(verbose) printf("Getting offset, jitter and stratum for %d peers\n", nvars);
+	read_peer_vars(conn, vars, nvars);
+	/* Older servers doesn't know what jitter is, so the ones that refused
+	 * are asked again for "dispersion", then for everything */
+	for (j = 0; j < 2; j++){
+		for (k = 0, i = 0; i < nvars; i++){
+			if(!vars[i].error)
+				continue;
+			vars[i].getvar = j == 0 ? "stratum,offset,dispersion" : "";
+			vars[i].error = vars[i].done = vars[i].tries = 0;
+			k++;
+		}
+		if(k == 0)
+			break;
+		if(verbose && j == 0) printf("The command failed. This is usually caused by servers refusing the 'jitter'\nvariable. Restarting with 'dispersion'...\n");
+		if(verbose && j == 1) printf("Server didn't like dispersion either; will retrieve everything\n");
+		read_peer_vars(conn, vars, nvars);
+	}
 
-			/* get the offset */
-			if(verbose)
-				printf("parsing offset from peer %.2x: ", ntohs(peers[i].assoc));
+	for (k = 0; k < nvars; k++){
+		data = vars[k].data != NULL && !vars[k].error ? vars[k].data : "";
+		getvar = vars[k].getvar;
+		if(!vars[k].done && verbose)
+			printf("no complete response for peer %.2x\n", ntohs(vars[k].assoc));
+		if(verbose > 1)
+			printf("Server responded: >>>%s<<<\n", data);
+
+		/* get the offset */
+		if(verbose)
+			printf("parsing offset from peer %.2x: ", ntohs(vars[k].assoc));
+
+		value = np_extract_ntpvar(data, "offset");
+		nptr=NULL;
+		/* Convert the value if we have one */
+		if(value != NULL)
+			tmp_offset = strtod(value, &nptr) / 1000;
+		/* If value is null or no conversion was performed */
+		if(value == NULL || value==nptr) {
+			if(verbose) printf("error: unable to read server offset response.\n");
+		} else {
+			if(verbose) printf("%.10g\n", tmp_offset);
+			if(*offset_result == STATE_UNKNOWN || fabs(tmp_offset) < fabs(*offset)) {
+				*offset = tmp_offset;
+				*offset_result = STATE_OK;
+			} else {
+				/* Skip this one; move to the next */
+				continue;
+			}
+		}
 
-			value = np_extract_ntpvar(data, "offset");
+		if(do_jitter) {
+			/* get the jitter */
+			if(verbose) {
+				printf("parsing %s from peer %.2x: ", strstr(getvar, "dispersion") != NULL ? "dispersion" : "jitter", ntohs(vars[k].assoc));
+			}
+			value = np_extract_ntpvar(data, strstr(getvar, "dispersion") != NULL ? "dispersion" : "jitter");
 			nptr=NULL;
 			/* Convert the value if we have one */
 			if(value != NULL)
-				tmp_offset = strtod(value, &nptr) / 1000;
+				*jitter = strtod(value, &nptr);
 			/* If value is null or no conversion was performed */
 			if(value == NULL || value==nptr) {
-				if(verbose) printf("error: unable to read server offset response.\n");
-			} else {
-				if(verbose) printf("%.10g\n", tmp_offset);
-				if(*offset_result == STATE_UNKNOWN || fabs(tmp_offset) < fabs(*offset)) {
-					*offset = tmp_offset;
-					*offset_result = STATE_OK;
-				} else {
-					/* Skip this one; move to the next */
-					continue;
-				}
+				if(verbose) printf("error: unable to read server jitter/dispersion response.\n");
+				*jitter = -1;
+			} else if(verbose) {
+				printf("%.10g\n", *jitter);
 			}
+		}
 
-			if(do_jitter) {
-				/* get the jitter */
-				if(verbose) {
-					printf("parsing %s from peer %.2x: ", strstr(getvar, "dispersion") != NULL ? "dispersion" : "jitter", ntohs(peers[i].assoc));
-				}
-				value = np_extract_ntpvar(data, strstr(getvar, "dispersion") != NULL ? "dispersion" : "jitter");
-				nptr=NULL;
-				/* Convert the value if we have one */
-				if(value != NULL)
-					*jitter = strtod(value, &nptr);
-				/* If value is null or no conversion was performed */
-				if(value == NULL || value==nptr) {
-					if(verbose) printf("error: unable to read server jitter/dispersion response.\n");
-					*jitter = -1;
-				} else if(verbose) {
-					printf("%.10g\n", *jitter);
-				}
+		if(do_stratum) {
+			/* get the stratum */
+			if(verbose) {
+				printf("parsing stratum from peer %.2x: ", ntohs(vars[k].assoc));
 			}
-
-			if(do_stratum) {
-				/* get the stratum */
-				if(verbose) {
-					printf("parsing stratum from peer %.2x: ", ntohs(peers[i].assoc));
-				}
-				value = np_extract_ntpvar(data, "stratum");
-				nptr=NULL;
-				/* Convert the value if we have one */
-				if(value != NULL)
-					*stratum = strtol(value, &nptr, 10);
-				if(value == NULL || value==nptr) {
-					if(verbose) printf("error: unable to read server stratum response.\n");
-					*stratum = -1;
-				} else {
-					if(verbose) printf("%i\n", *stratum);
-				}
+			value = np_extract_ntpvar(data, "stratum");
+			nptr=NULL;
+			/* Convert the value if we have one */
+			if(value != NULL)
+				*stratum = strtol(value, &nptr, 10);
+			if(value == NULL || value==nptr) {
+				if(verbose) printf("error: unable to read server stratum response.\n");
+				*stratum = -1;
+			} else {
+				if(verbose) printf("%i\n", *stratum);
 			}
-		} /* if (PEER_SEL(peers[i].status) >= min_peer_sel) */
-	} /* for (i = 0; i < npeers; i++) */
+		}
+	} /* for (k = 0; k < nvars; k++) */
 
 	close(conn);
+	for (k = 0; k < nvars; k++) free(vars[k].data);
+	free(vars);
 	if(peers!=NULL) free(peers);
 
 	return status;
@@ -564,11 +646,6 @@ int main(int argc, char *argv[]){
 	double offset=0, jitter=0;
 	char *result_line, *perfdata_line;
 
-	setlocale (LC_ALL, "");
-	setlocale (LC_NUMERIC, "C");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
 
@@ -43,6 +43,8 @@ const char *email = "devel@nagios-plugins.org";
 #include "utils.h"
 
 static char *server_address=NULL;
+static char **hosts=NULL;
+static int num_servers=0;
 static char *port="123";
 static int verbose=0;
 static int quiet=0;
@@ -84,7 +86,7 @@ typedef struct {
 
 /* this structure holds data about results from querying offset from a peer */
 typedef struct {
-	time_t waiting;         /* ts set when we started waiting for a response */
+	double waiting;         /* ts set when we started waiting for a response */
 	int connected;          /* don't try to "write()" if "connect()" fails */
 	int num_requests;
 	int num_responses;      /* number of successfully received responses */
@@ -92,7 +94,16 @@ typedef struct {
 	double rtdelay;         /* converted from the ntp_message */
 	double rtdisp;          /* converted from the ntp_message */
 	double offset[AVG_NUM]; /* offsets from each response */
+	double delay[AVG_NUM];  /* and our round trip for each */
 	uint8_t flags;       /* byte with leapindicator,vers,mode. see macros */
+	int host;               /* the -H this address is one of */
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int sd;
+	uint64_t txts;          /* of the request in flight, echoed in the response */
+	uint32_t tx_id;         /* its number among those sent on sd */
+	double tx_time;         /* the time the kernel sent it, 0 if not known */
+	int falseticker;        /* outside the interval most of the others agree on */
 } ntp_server_results;
 
 /* define this globally to be able to do other checks */
@@ -197,10 +208,10 @@ ntp_server_results *servers=NULL;
 		printf("%u.%u.%u.%u", (x>>24)&0xff, (x>>16)&0xff, (x>>8)&0xff, x&0xff);\
 	}while(0);
 
-/* calculate the offset of the local clock */
-static inline double calc_offset(const ntp_message *m, const struct timeval *t){
-	double client_tx, peer_rx, peer_tx, client_rx;
-	client_tx = NTP64asDOUBLE(m->origts);
+/* calculate the offset of the local clock, from the time the request left
+ * (its origts unless better known) and the time the response arrived */
+static inline double calc_offset(const ntp_message *m, double client_tx, const struct timeval *t){
+	double peer_rx, peer_tx, client_rx;
 	peer_rx = NTP64asDOUBLE(m->rxts);
 	peer_tx = NTP64asDOUBLE(m->txts);
 	client_rx=TVasDOUBLE((*t));
@@ -270,6 +281,11 @@ int best_offset_server(const ntp_server_results *slist, int nservers){
 			if (verbose) printf("discarding peer %d: flags=%d\n", cserver, LI(slist[cserver].flags));
 			continue;
 		}
+		/* and those the others disagree with */
+		if ( slist[cserver].falseticker ){
+			if (verbose) printf("discarding peer %d: falseticker\n", cserver);
+			continue;
+		}
 
 		/* If we don't have a server yet, use the first one */
 		if (best_server == -1) {
@@ -305,21 +321,119 @@ int best_offset_server(const ntp_server_results *slist, int nservers){
 	}
 }
 
+/* the average offset and round trip of a peer's responses */
+static double peer_offset(const ntp_server_results *p){
+	double sum=0.;
+	int i;
+
+	for(i=0; i<p->num_responses; i++) sum+=p->offset[i];
+	return p->num_responses ? sum/p->num_responses : 0.;
+}
+
+static double peer_delay(const ntp_server_results *p){
+	double sum=0.;
+	int i;
+
+	for(i=0; i<p->num_responses; i++) sum+=p->delay[i];
+	return p->num_responses ? sum/p->num_responses : 0.;
+}
+
+/* Clock selection across the peers, after Marzullo as NTP does it: each
+ * peer's offset is good to within its root distance, and the peers whose
+ * intervals miss the one that most of them share are falsetickers. Nothing
+ * is thrown out unless more than half agree. */
+void select_truechimers(ntp_server_results *slist, int nservers){
+	double *lo, *hi, best_x=0., x, dist;
+	int i, j, n=0, count, best=0;
+
+	lo=(double*)malloc(sizeof(double)*nservers);
+	hi=(double*)malloc(sizeof(double)*nservers);
+	if(lo==NULL || hi==NULL) die(STATE_UNKNOWN, "can not allocate interval array");
+	for(i=0; i<nservers; i++){
+		if(slist[i].num_responses==0 || slist[i].stratum==0 || LI(slist[i].flags)==LI_ALARM)
+			continue;
+		dist=peer_delay(&slist[i])/2 + slist[i].rtdelay/2 + slist[i].rtdisp;
+		lo[i]=peer_offset(&slist[i])-dist;
+		hi[i]=peer_offset(&slist[i])+dist;
+		n++;
+	}
+	/* the intersection is bounded by some interval's low end */
+	for(i=0; i<nservers; i++){
+		if(slist[i].num_responses==0 || slist[i].stratum==0 || LI(slist[i].flags)==LI_ALARM)
+			continue;
+		x=lo[i];
+		for(count=0, j=0; j<nservers; j++){
+			if(slist[j].num_responses==0 || slist[j].stratum==0 || LI(slist[j].flags)==LI_ALARM)
+				continue;
+			if(lo[j]<=x && x<=hi[j]) count++;
+		}
+		if(count>best){
+			best=count;
+			best_x=x;
+		}
+	}
+	if(best*2 > n){
+		for(i=0; i<nservers; i++){
+			if(slist[i].num_responses==0 || slist[i].stratum==0 || LI(slist[i].flags)==LI_ALARM)
+				continue;
+			slist[i].falseticker = best_x<lo[i] || best_x>hi[i];
+			if(slist[i].falseticker && verbose)
+				printf("peer %d is a falseticker: offset %.10g, distance %.10g\n", i,
+				       peer_offset(&slist[i]), (hi[i]-lo[i])/2);
+		}
+	} else if(verbose && n>1){
+		printf("no majority of peers agree, none are discarded\n");
+	}
+	free(lo);
+	free(hi);
+}
+
+static double now_double(void){
+	struct timeval t;
+
+	gettimeofday(&t, NULL);
+	return TVasDOUBLE(t);
+}
+
+/* match the send times the kernel queued on fd to the requests in flight */
+static void read_sent_times(ntp_server_results *slist, int nservers, int fd){
+	struct timeval sent;
+	uint32_t id;
+	int i;
+
+	while(np_net_sent_time(fd, &id, &sent)){
+		for(i=0; i<nservers; i++){
+			if(slist[i].sd==fd && slist[i].txts && slist[i].tx_id==id){
+				slist[i].tx_time=TVasDOUBLE(sent);
+				break;
+			}
+		}
+	}
+}
+
 /* do everything we need to get the total average offset
- * - we use a certain amount of parallelization with poll() to ensure
- *   we don't waste time sitting around waiting for single packets.
- * - we also "manually" handle resolving host names and connecting, because
- *   we have to do it in a way that our lazy macros don't handle currently :( */
-double offset_request(const char *host, int *status){
-  int i=0, j=0, ga_result=0, *socklist=NULL, respnum=0;
+ * - every address of every host is asked from one socket per address
+ *   family, and responses are taken with poll() as they arrive, by their
+ *   source address and the transmit timestamp they echo.
+ * - we also "manually" handle resolving host names, because we have to
+ *   do it in a way that our lazy macros don't handle currently :( */
+double offset_request(char **host_list, int nhosts, int *status){
+	int i=0, h=0, ga_result=0, respnum=0, sd[2]={-1, -1}, nfds=0;
+	int stamps[2]={0, 0};
+	uint32_t sent[2]={0, 0};
 	int servers_completed=0, one_read=0, servers_readable=0, best_index=-1;
-	time_t now_time=0, start_ts=0;
-	ntp_message *req=NULL;
+	double now_time=0, start_ts=0, next;
+	ntp_message req;
 	double avg_offset=0.;
-	num_hosts = 0;
 	struct timeval recv_time;
 	struct addrinfo *ai=NULL, *ai_tmp=NULL, hints;
-	struct pollfd *ufds=NULL;
+	struct pollfd ufds[2];
+	struct sockaddr_storage from;
+	socklen_t fromlen;
+	ssize_t got;
+	uint64_t txts;
+	double client_tx;
+	num_hosts = 0;
 
 
 	/* setup hints to only return results from getaddrinfo that we'd like */
@@ -328,107 +442,147 @@ double offset_request(const char *host, int *status){
 	hints.ai_protocol = IPPROTO_UDP;
 	hints.ai_socktype = SOCK_DGRAM;
 
-	/* fill in ai with the list of hosts resolved by the host name */
-	ga_result = getaddrinfo(host, port, &hints, &ai);
-	if(ga_result!=0){
-		die(STATE_UNKNOWN, "error getting address for %s: %s\n",
-		    host, gai_strerror(ga_result));
+	/* fill in servers with the addresses each host name resolves to */
+	for(h=0; h<nhosts; h++){
+		ga_result = getaddrinfo(host_list[h], port, &hints, &ai);
+		if(ga_result!=0){
+			die(STATE_UNKNOWN, "error getting address for %s: %s\n",
+			    host_list[h], gai_strerror(ga_result));
+		}
+		for(ai_tmp=ai; ai_tmp!=NULL; ai_tmp=ai_tmp->ai_next){
+			servers=(ntp_server_results*)realloc(servers, sizeof(ntp_server_results)*(num_hosts+1));
+			if(servers==NULL) die(STATE_UNKNOWN, "can not allocate server array");
+			memset(&servers[num_hosts], 0, sizeof(ntp_server_results));
+			servers[num_hosts].host=h;
+			memcpy(&servers[num_hosts].addr, ai_tmp->ai_addr, ai_tmp->ai_addrlen);
+			servers[num_hosts].addrlen=ai_tmp->ai_addrlen;
+			num_hosts++;
+		}
+		freeaddrinfo(ai);
 	}
-
-	/* count the number of returned hosts, and allocate stuff accordingly */
-	for(ai_tmp=ai; ai_tmp!=NULL; ai_tmp=ai_tmp->ai_next){ num_hosts++; }
-	req=(ntp_message*)malloc(sizeof(ntp_message)*num_hosts);
-	if(req==NULL) die(STATE_UNKNOWN, "can not allocate ntp message array");
-	socklist=(int*)malloc(sizeof(int)*num_hosts);
-	if(socklist==NULL) die(STATE_UNKNOWN, "can not allocate socket array");
-	ufds=(struct pollfd*)malloc(sizeof(struct pollfd)*num_hosts);
-	if(ufds==NULL) die(STATE_UNKNOWN, "can not allocate socket array");
-	servers=(ntp_server_results*)malloc(sizeof(ntp_server_results)*num_hosts);
-	if(servers==NULL) die(STATE_UNKNOWN, "can not allocate server array");
-	memset(servers, 0, sizeof(ntp_server_results)*num_hosts);
 	DBG(printf("Found %d peers to check\n", num_hosts));
 
-	/* setup each socket for writing, and the corresponding struct pollfd */
-	ai_tmp=ai;
-	for(i=0;ai_tmp;i++){
-		socklist[i]=socket(ai_tmp->ai_family, SOCK_DGRAM, IPPROTO_UDP);
-		if(socklist[i] == -1) {
-			perror(NULL);
-			die(STATE_UNKNOWN, "can not create new socket");
+	/* one socket for each address family, and the corresponding struct pollfd */
+	for(i=0; i<num_hosts; i++){
+		h = servers[i].addr.ss_family == AF_INET6;
+		if(sd[h] == -1){
+			sd[h]=socket(servers[i].addr.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+			if(sd[h] == -1) {
+				/* don't die here, because it is enough if there is one server
+				   answering in time. This also would break for dual ipv4/6 stacked
+				   ntp servers when the client only supports on of them.
+				 */
+				DBG(printf("can't create socket for peer %i: %s\n", i, strerror(errno)));
+				sd[h]=-2;
+				continue;
+			}
+			/* the kernel's time of arrival and departure of each
+			 * datagram, rather than when we got round to it */
+			stamps[h]=np_net_timestamps(sd[h]);
+			if(verbose>1) printf("kernel time stamps of %s: %s%s\n", h ? "IPv6" : "IPv4",
+			                     stamps[h]&NP_NET_RX_STAMPS ? "receive" : "none",
+			                     stamps[h]&NP_NET_TX_STAMPS ? ", send" : "");
+			ufds[nfds].fd=sd[h];
+			ufds[nfds].events=POLLIN;
+			ufds[nfds++].revents=0;
 		}
-		if(connect(socklist[i], ai_tmp->ai_addr, ai_tmp->ai_addrlen)){
-			/* don't die here, because it is enough if there is one server
-			   answering in time. This also would break for dual ipv4/6 stacked
-			   ntp servers when the client only supports on of them.
-			 */
-			DBG(printf("can't create socket connection on peer %i: %s\n", i, strerror(errno)));
-		} else {
-			ufds[i].fd=socklist[i];
-			ufds[i].events=POLLIN;
-			ufds[i].revents=0;
+		if(sd[h] >= 0){
+			servers[i].sd=sd[h];
 			servers[i].connected=1;
 		}
-		ai_tmp = ai_tmp->ai_next;
 	}
 
 	/* now do AVG_NUM checks to each host. We stop before timeout/2 seconds
 	 * have passed in order to ensure post-processing and jitter time. */
-	now_time=start_ts=time(NULL);
+	now_time=start_ts=now_double();
 	while(servers_completed<num_hosts && now_time-start_ts <= timeout_interval - 1){
 		/* loop through each server and find each one which hasn't
 		 * timed out yet and is still lacking some responses. For each
 		 * of these servers, send a new request, and update the
 		 * "waiting" timestamp with the current time. */
-		now_time=time(NULL);
+		now_time=now_double();
+		next=now_time+1;
 
 		for(i=0; i<num_hosts; i++){
-			if(servers[i].connected == 0)
+			if(servers[i].connected == 0 || servers[i].num_responses>=AVG_NUM)
 				continue;
-			if(servers[i].waiting<now_time && servers[i].num_responses<AVG_NUM){
+			if(servers[i].waiting<now_time){
 				if(verbose && servers[i].num_requests != servers[i].num_responses) printf("re-");
 				if(verbose) printf("sending request to peer %d\n", i);
-				setup_request(&req[i]);
-				write(socklist[i], &req[i], sizeof(ntp_message));
+				setup_request(&req);
+				servers[i].txts=req.txts;
+				servers[i].tx_time=0;
+				if(sendto(servers[i].sd, &req, sizeof(ntp_message), 0,
+				          (struct sockaddr *)&servers[i].addr, servers[i].addrlen) < 0){
+					DBG(printf("can't send to peer %i: %s\n", i, strerror(errno)));
+					servers[i].connected=0;
+					servers_completed++;
+					continue;
+				}
+				h = servers[i].addr.ss_family == AF_INET6;
+				if(stamps[h]&NP_NET_TX_STAMPS) servers[i].tx_id=sent[h]++;
 				servers[i].waiting=now_time+delay;
 				if(servers[i].num_requests == servers[i].num_responses) {
 					servers[i].num_requests++;
 				}
-				break;
 			}
+			if(servers[i].waiting<next) next=servers[i].waiting;
 		}
 
-		/* quickly poll for any sockets with pending data */
-		servers_readable=poll(ufds, num_hosts, 100);
+		/* poll for any sockets with pending data until the next request is due */
+		servers_readable=poll(ufds, nfds, next>now_time ? (int)((next-now_time)*1000)+1 : 0);
 		if(servers_readable==-1){
+			if(errno==EINTR) continue;
 			perror("polling ntp sockets");
 			die(STATE_UNKNOWN, "communication errors");
 		}
 
 		/* read from any sockets with pending data */
-		for(i=0; servers_readable && i<num_hosts; i++){
-			if(ufds[i].revents&POLLIN && servers[i].num_responses < AVG_NUM){
-				if(verbose) {
-					printf("response from peer %d: ", i);
-				}
+		for(h=0; servers_readable && h<nfds; h++){
+			/* send times are queued as errors, which poll() reports */
+			if(ufds[h].revents&(POLLIN|POLLERR))
+				read_sent_times(servers, num_hosts, ufds[h].fd);
+			if(!(ufds[h].revents&POLLIN))
+				continue;
+			fromlen=sizeof(from);
+			got=np_net_recvfrom_time(ufds[h].fd, &req, sizeof(ntp_message), MSG_DONTWAIT,
+			                         (struct sockaddr *)&from, &fromlen, &recv_time);
+			if(got < (ssize_t)sizeof(ntp_message))
+				continue;
+			/* to the request in flight, from the address it went to */
+			txts=req.origts;
+			for(i=0; i<num_hosts; i++){
+				if(servers[i].connected && servers[i].txts==txts && servers[i].addrlen==fromlen &&
+				   !memcmp(&servers[i].addr, &from, fromlen))
+					break;
+			}
+			if(i==num_hosts || servers[i].num_responses >= AVG_NUM){
+				DBG(printf("discarding a stray response\n"));
+				continue;
+			}
+			if(verbose) {
+				printf("response from peer %d: ", i);
+			}
 
-				read(ufds[i].fd, &req[i], sizeof(ntp_message));
-				gettimeofday(&recv_time, NULL);
-				DBG(print_ntp_message(&req[i]));
-				respnum=servers[i].num_responses++;
-				servers[i].offset[respnum]=calc_offset(&req[i], &recv_time)+time_offset;
-				if(verbose) {
-					printf("offset %.10g\n", servers[i].offset[respnum]);
-				}
-				servers[i].stratum=req[i].stratum;
-				servers[i].rtdisp=NTP32asDOUBLE(req[i].rtdisp);
-				servers[i].rtdelay=NTP32asDOUBLE(req[i].rtdelay);
-				servers[i].waiting--;
-				servers[i].flags=req[i].flags;
-				servers_readable--;
-				one_read = 1;
-				if(servers[i].num_responses==AVG_NUM) servers_completed++;
+			DBG(print_ntp_message(&req));
+			respnum=servers[i].num_responses++;
+			client_tx=servers[i].tx_time ? servers[i].tx_time : NTP64asDOUBLE(req.origts);
+			servers[i].offset[respnum]=calc_offset(&req, client_tx, &recv_time)+time_offset;
+			servers[i].delay[respnum]=(TVasDOUBLE(recv_time)-client_tx) -
+			                          (NTP64asDOUBLE(req.txts)-NTP64asDOUBLE(req.rxts));
+			if(verbose) {
+				printf("offset %.10g\n", servers[i].offset[respnum]);
 			}
+			servers[i].stratum=req.stratum;
+			servers[i].rtdisp=NTP32asDOUBLE(req.rtdisp);
+			servers[i].rtdelay=NTP32asDOUBLE(req.rtdelay);
+			servers[i].waiting--;
+			servers[i].txts=0;
+			servers[i].flags=req.flags;
+			one_read = 1;
+			if(servers[i].num_responses==AVG_NUM) servers_completed++;
 		}
+		now_time=now_double();
 		/* lather, rinse, repeat. */
 		/* break if we have one response but other ntp servers doesn't response */
 		/* greater than timeout_interval/2 */
@@ -439,25 +593,18 @@ double offset_request(const char *host, int *status){
 		die(timeout_state, "%s: No response from NTP server\n", state_text(timeout_state));
 	}
 
-	/* now, pick the best server from the list */
+	/* now, pick the best server from those that agree */
+	select_truechimers(servers, num_hosts);
 	best_index=best_offset_server(servers, num_hosts);
 	if(best_index < 0){
 		*status=STATE_UNKNOWN;
 	} else {
 		/* finally, calculate the average offset */
-		for(i=0; i<servers[best_index].num_responses;i++){
-			avg_offset+=servers[best_index].offset[j];
-		}
-		avg_offset/=servers[best_index].num_responses;
+		avg_offset=peer_offset(&servers[best_index]);
 	}
 
 	/* cleanup */
-	for(j=0; j<num_hosts; j++){ close(socklist[j]); }
-	free(socklist);
-	free(ufds);
-
-	free(req);
-	freeaddrinfo(ai);
+	for(h=0; h<2; h++){ if(sd[h] >= 0) close(sd[h]); }
 
 	if(verbose) printf("overall average offset: %.10g\n", avg_offset);
 	return avg_offset;
@@ -466,6 +613,7 @@ double offset_request(const char *host, int *status){
 int process_arguments(int argc, char **argv){
 	int c;
 	int option=0;
+	char *host;
 	static struct option longopts[] = {
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
@@ -522,9 +670,14 @@ int process_arguments(int argc, char **argv){
 			scrit = optarg;
 			break;
 		case 'H':
-			if(is_host(optarg) == FALSE)
-				usage2(_("Invalid hostname/address"), optarg);
-			server_address = strdup(optarg);
+			for(host=strtok(optarg, ","); host!=NULL; host=strtok(NULL, ",")){
+				if(is_host(host) == FALSE)
+					usage2(_("Invalid hostname/address"), host);
+				hosts=(char**)realloc(hosts, sizeof(char*)*(num_servers+1));
+				if(hosts==NULL) die(STATE_UNKNOWN, "can not allocate host array");
+				hosts[num_servers++]=strdup(host);
+			}
+			server_address = hosts[0];
 			break;
 		case 'p':
 			port = strdup(optarg);
@@ -575,11 +728,6 @@ int main(int argc, char *argv[]){
 	double offset=0;
 	char *result_line, *perfdata_line;
 
-	setlocale (LC_ALL, "");
-	setlocale (LC_NUMERIC, "C");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	offset_result = STATE_OK;
 
 	/* Parse extra opts if any */
@@ -596,20 +744,25 @@ int main(int argc, char *argv[]){
 	/* set socket timeout */
 	alarm (timeout_interval);
 
-	offset = offset_request(server_address, &offset_result);
+	offset = offset_request(hosts, num_servers, &offset_result);
 	if (offset_result == STATE_UNKNOWN) {
 		result = (quiet == 1 ? STATE_UNKNOWN : STATE_CRITICAL);
 	} else {
 		result = get_status(fabs(offset), offset_thresholds);
 	}
 
-	int i;
+	int i, h, hosts_ok=0;
+	char *host_lines="", *host_perfdata="", *host_problems="";
 	int servers_warn_stratum=0;
 	int servers_crit_stratum=0;
 	int servers_worst_stratum=0;
 	int servers_best_stratum=16;
 
 	for (i=0; i<num_hosts; i++) {
+	  // a server that never answered has no stratum
+	  if (servers[i].num_responses == 0)
+	    continue;
+
 	  // set best stratum
 	  if (servers[i].stratum < servers_best_stratum)
 	    servers_best_stratum = servers[i].stratum;
@@ -633,6 +786,51 @@ int main(int argc, char *argv[]){
 	if (result == STATE_OK && servers_warn_stratum > 0)
 	  result = STATE_WARNING;
 
+	/* with several hosts, each of them is judged too */
+	if (num_servers > 1) {
+		host_lines = host_perfdata = host_problems = "";
+		for (h=0; h<num_servers; h++) {
+			int best=-1, host_result;
+			char *host_msg, *host_label;
+
+			for (i=0; i<num_hosts; i++) {
+				if (servers[i].host != h || servers[i].num_responses == 0)
+					continue;
+				if (best < 0 || (servers[best].falseticker && !servers[i].falseticker) ||
+				    (servers[best].falseticker == servers[i].falseticker && peer_delay(&servers[i]) < peer_delay(&servers[best])))
+					best = i;
+			}
+			if (best < 0) {
+				host_result = timeout_state;
+				xasprintf(&host_msg, _("No response from NTP server"));
+			} else {
+				host_result = get_status(fabs(peer_offset(&servers[best])), offset_thresholds);
+				if (servers[best].stratum >= atoi(scrit))
+					host_result = STATE_CRITICAL;
+				else if (servers[best].stratum >= atoi(swarn))
+					host_result = max_state(host_result, STATE_WARNING);
+				if (servers[best].falseticker)
+					host_result = max_state(host_result, STATE_WARNING);
+				xasprintf(&host_msg, _("Offset %.10g secs, stratum %d, delay %.6f secs%s"),
+				          peer_offset(&servers[best]), servers[best].stratum, peer_delay(&servers[best]),
+				          servers[best].falseticker ? _(" (falseticker)") : "");
+				xasprintf(&host_label, "offset@%s", hosts[h]);
+				xasprintf(&host_perfdata, "%s %s", host_perfdata,
+				          sperfdata(host_label, peer_offset(&servers[best]), "s",
+				                    offset_thresholds->warning_string, offset_thresholds->critical_string,
+				                    FALSE, 0, FALSE, 0));
+			}
+			if (host_result == STATE_OK)
+				hosts_ok++;
+			else
+				xasprintf(&host_problems, "%s%s%s: %s", host_problems, *host_problems ? "; " : "",
+				          hosts[h], host_msg);
+			xasprintf(&host_lines, "%s\n[%s] %s: %s", host_lines, state_text(host_result), hosts[h], host_msg);
+			if (offset_result != STATE_UNKNOWN)
+				result = max_state_alt(result, host_result);
+		}
+	}
+
 	switch (result) {
 		case STATE_CRITICAL :
 			xasprintf(&result_line, _("NTP CRITICAL:"));
@@ -654,11 +852,15 @@ int main(int argc, char *argv[]){
 	  xasprintf(&result_line, "%s %s %.10g secs, stratum best:%d worst:%d", result_line, _("Offset"), offset, servers_best_stratum, servers_worst_stratum);
 	  xasprintf(&perfdata_line, "%s stratum_best=%d stratum_worst=%d num_warn_stratum=%d num_crit_stratum=%d", perfd_offset(offset), servers_best_stratum, servers_worst_stratum, servers_warn_stratum, servers_crit_stratum);
 	}
-	printf("%s|%s\n", result_line, perfdata_line);
+	if (num_servers > 1)
+		xasprintf(&result_line, "%s, %d of %d servers OK%s%s", result_line, hosts_ok, num_servers,
+		          *host_problems ? " - " : "", host_problems);
+	printf("%s|%s%s%s\n", result_line, perfdata_line, host_perfdata, host_lines);
 
 	free(servers);
 
-	if(server_address!=NULL) free(server_address);
+	for (h=0; h<num_servers; h++) free(hosts[h]);
+	free(hosts);
 	return result;
 }
 
@@ -677,6 +879,9 @@ void print_help(void){
 	printf (UT_EXTRA_OPTS);
 	printf (UT_IPv46);
 	printf (UT_HOST_PORT, 'p', "123");
+	printf ("    %s\n", _("-H may be repeated, or given a comma separated list; all the servers are"));
+	printf ("    %s\n", _("asked at once, the ones that disagree with most of the others are left out"));
+	printf ("    %s\n", _("as falsetickers, and each server is reported on its own line"));
 	printf (" %s\n", "-q, --quiet");
 	printf ("    %s\n", _("Returns UNKNOWN instead of CRITICAL if offset cannot be found"));
 	printf (" %s\n", "-w, --warning=THRESHOLD");
@@ -722,6 +927,6 @@ void
 print_usage(void)
 {
 	printf ("%s\n", _("Usage:"));
-	printf(" %s -H <host> [-4|-6] [-w <warn>] [-c <crit>] [-v verbose] [-o <time offset>] [-d <delay>]\n", progname);
+	printf(" %s -H <host>[,<host>...] [-4|-6] [-w <warn>] [-c <crit>] [-v verbose] [-o <time offset>] [-d <delay>]\n", progname);
 }
 
@@ -110,6 +110,35 @@ int check_netware_version=FALSE;
 enum checkvar vars_to_check = NONE;
 int sap_number=-1;
 
+/* one -v, with the -w and -c that follow it (or, for the first, that
+ * come before the second -v) */
+typedef struct nwstat_variable {
+	enum checkvar vars_to_check;
+	char *name;
+	char *volume_name;
+	char *nlm_name;
+	char *nrmp_name;
+	char *nrmm_name;
+	char *nrms_name;
+	char *nss_name[7];
+	int sap_number;
+	unsigned long warning_value;
+	unsigned long critical_value;
+	int check_warning_value;
+	int check_critical_value;
+} nwstat_variable;
+
+nwstat_variable *variables=NULL;
+int variable_count=0;
+
+/* the connection to MRTGEXT, which answers one request after the other
+ * on it, kept for the whole run */
+int server_sd=-1;
+
+int nwstat_request (const char *, char *, int);
+int check_variable (char **);
+void add_variable (const char *);
+void use_variable (const nwstat_variable *);
 int process_arguments(int, char **);
 void print_help(void);
 void print_usage(void);
@@ -119,12 +148,116 @@ void print_usage(void);
 int
 main(int argc, char **argv) {
 	int result = STATE_UNKNOWN;
-	int sd;
 	char *send_buffer=NULL;
 	char recv_buffer[MAX_INPUT_BUFFER];
 	char *output_message=NULL;
-	char *temp_buffer=NULL;
 	char *netware_version=NULL;
+	char **messages, *perf, *problems=NULL;
+	int *states;
+	int i, count_ok=0;
+
+	/* Parse extra opts if any */
+	argv=np_extra_opts(&argc, argv, progname);
+
+	if (process_arguments(argc,argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	/* initialize alarm signal handling */
+	signal(SIGALRM,socket_timeout_alarm_handler);
+	/* a kept connection the server closed fails to send, and is made anew */
+	signal(SIGPIPE,SIG_IGN);
+
+	/* set socket timeout */
+	alarm(timeout_interval);
+
+	/* get OS version string */
+	if (check_netware_version==TRUE) {
+		send_buffer = strdup ("S19\r\n");
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
+		if (result!=STATE_OK)
+			return result;
+		if (!strcmp(recv_buffer,"-1\n"))
+			netware_version = strdup("");
+		else {
+			recv_buffer[strlen(recv_buffer)-1]=0;
+			xasprintf (&netware_version,_("NetWare %s: "),recv_buffer);
+		}
+	} else
+		netware_version = strdup("");
+
+	if (variable_count == 1) {
+		result = check_variable (&output_message);
+
+		if (server_sd >= 0)
+			close (server_sd);
+
+		/* reset timeout */
+		alarm(0);
+
+		if (output_message != NULL)
+			printf("%s%s\n",netware_version,output_message);
+
+		return result;
+	}
+
+	/* several -v: each is checked as on its own, all over the same
+	 * connection, and what the checks put after a '|' goes into the
+	 * perfdata of the summary */
+	states = calloc (variable_count, sizeof (int));
+	messages = calloc (variable_count, sizeof (char *));
+	if (states == NULL || messages == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	perf = strdup ("");
+	result = STATE_OK;
+	for (i = 0; i < variable_count; i++) {
+		char *pipe;
+
+		use_variable (&variables[i]);
+
+		output_message = NULL;
+		states[i] = check_variable (&output_message);
+		if (output_message == NULL)
+			output_message = strdup (_("No data was received from host!"));
+		if ((pipe = strchr (output_message, '|')) != NULL) {
+			*pipe = '\0';
+			pipe += strspn (pipe + 1, " ") + 1;
+			if (*pipe)
+				xasprintf (&perf, "%s%s%s", perf, *perf ? " " : "", pipe);
+		}
+		strip (output_message);
+		messages[i] = output_message;
+
+		result = max_state_alt (result, states[i]);
+		if (states[i] == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           variables[i].name, messages[i]);
+	}
+
+	if (server_sd >= 0)
+		close (server_sd);
+
+	/* reset timeout */
+	alarm(0);
+
+	printf ("%sNWSTAT %s: %d of %d %s%s%s|%s\n", netware_version, state_text (result), count_ok,
+	        variable_count, _("variables OK"), problems ? " - " : "", problems ? problems : "", perf);
+	for (i = 0; i < variable_count; i++)
+		printf ("[%s] %s: %s\n", state_text (states[i]), variables[i].name, messages[i]);
+	return result;
+}
+
+
+
+/* Fetches and checks the variable of vars_to_check, its name and the
+ * thresholds, with the output for it in message */
+int check_variable (char **message) {
+	int result = STATE_UNKNOWN;
+	char *send_buffer=NULL;
+	char recv_buffer[MAX_INPUT_BUFFER];
+	char *output_message=NULL;
+	char *temp_buffer=NULL;
 
 	int time_sync_status=0;
 	int nrm_health_status=0;
@@ -162,41 +295,6 @@ main(int argc, char **argv) {
 	unsigned long sap_entries=0;
 	char uptime[MAX_INPUT_BUFFER];
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
-	/* Parse extra opts if any */
-	argv=np_extra_opts(&argc, argv, progname);
-
-	if (process_arguments(argc,argv) == ERROR)
-		usage4 (_("Could not parse arguments"));
-
-	/* initialize alarm signal handling */
-	signal(SIGALRM,socket_timeout_alarm_handler);
-
-	/* set socket timeout */
-	alarm(timeout_interval);
-
-	/* open connection */
-	my_tcp_connect (server_address, server_port, &sd);
-
-	/* get OS version string */
-	if (check_netware_version==TRUE) {
-		send_buffer = strdup ("S19\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
-		if (result!=STATE_OK)
-			return result;
-		if (!strcmp(recv_buffer,"-1\n"))
-			netware_version = strdup("");
-		else {
-			recv_buffer[strlen(recv_buffer)-1]=0;
-			xasprintf (&netware_version,_("NetWare %s: "),recv_buffer);
-		}
-	} else
-		netware_version = strdup("");
-
-
 	/* check CPU load */
 	if (vars_to_check==LOAD1 || vars_to_check==LOAD5 || vars_to_check==LOAD15) {
 
@@ -212,20 +310,14 @@ main(int argc, char **argv) {
 			break;
 		}
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"UTIL%s\r\n",temp_buffer);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		utilization=strtoul(recv_buffer,NULL,10);
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("UPTIME\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		recv_buffer[strlen(recv_buffer)-1]=0;
@@ -250,11 +342,8 @@ main(int argc, char **argv) {
 		/* check number of user connections */
 	} else if (vars_to_check==CONNS) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("CONNECT\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		current_connections=strtoul(recv_buffer,NULL,10);
@@ -275,11 +364,8 @@ main(int argc, char **argv) {
 		/* check % long term cache hits */
 	} else if (vars_to_check==LTCH) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S1\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		cache_hits=atoi(recv_buffer);
@@ -297,11 +383,8 @@ main(int argc, char **argv) {
 		/* check cache buffers */
 	} else if (vars_to_check==CBUFF) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S2\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		cache_buffers=strtoul(recv_buffer,NULL,10);
@@ -322,11 +405,8 @@ main(int argc, char **argv) {
 		/* check dirty cache buffers */
 	} else if (vars_to_check==CDBUFF) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S3\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		cache_buffers=strtoul(recv_buffer,NULL,10);
@@ -347,11 +427,8 @@ main(int argc, char **argv) {
 		/* check LRU sitting time in minutes */
 	} else if (vars_to_check==LRUM) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S5\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		lru_time=strtoul(recv_buffer,NULL,10);
@@ -370,11 +447,8 @@ main(int argc, char **argv) {
 		/* check KB free space on volume */
 	} else if (vars_to_check==VKF) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"VKF%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -402,7 +476,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==VMF) {
 
 		xasprintf (&send_buffer,"VMF%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -429,7 +503,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==VMU) {
 
 		xasprintf (&send_buffer,"VMU%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -457,11 +531,8 @@ main(int argc, char **argv) {
 		/* check % free space on volume */
 	} else if (vars_to_check==VPF) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"VKF%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -474,11 +545,8 @@ main(int argc, char **argv) {
 
 			free_disk_space=strtoul(recv_buffer,NULL,10);
 
-			close(sd);
-			my_tcp_connect (server_address, server_port, &sd);
-
 			xasprintf (&send_buffer,"VKS%s\r\n",volume_name);
-			result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+			result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 			if (result!=STATE_OK)
 				return result;
 			total_disk_space=strtoul(recv_buffer,NULL,10);
@@ -506,19 +574,13 @@ main(int argc, char **argv) {
 		/* check to see if DS Database is open or closed */
 	} else if (vars_to_check==DSDB) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S11\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S13\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		temp_buffer=strtok(recv_buffer,"\r\n");
 
 		xasprintf (&output_message,_("Directory Services Database is %s (DS version %s)"),(result==STATE_OK)?"open":"closed",temp_buffer);
@@ -526,11 +588,8 @@ main(int argc, char **argv) {
 		/* check to see if logins are enabled */
 	} else if (vars_to_check==LOGINS) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S12\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		if (atoi(recv_buffer)==1)
@@ -545,7 +604,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NRMH) {
 
 		xasprintf (&send_buffer,"NRMH\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -569,21 +628,15 @@ main(int argc, char **argv) {
 		/* check packet receive buffers */
 	} else if (vars_to_check==UPRB || vars_to_check==PUPRB) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S15\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
 		used_packet_receive_buffers=atoi(recv_buffer);
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S16\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -608,14 +661,11 @@ main(int argc, char **argv) {
 		/* check SAP table entries */
 	} else if (vars_to_check==SAPENTRIES) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		if (sap_number==-1)
 			xasprintf (&send_buffer,"S9\r\n");
 		else
 			xasprintf (&send_buffer,"S9.%d\r\n",sap_number);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -634,11 +684,8 @@ main(int argc, char **argv) {
 		/* check KB purgeable space on volume */
 	} else if (vars_to_check==VKP) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"VKP%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -664,7 +711,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==VMP) {
 
 		xasprintf (&send_buffer,"VMP%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -690,11 +737,8 @@ main(int argc, char **argv) {
 		/* check % purgeable space on volume */
 	} else if (vars_to_check==VPP) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"VKP%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -707,11 +751,8 @@ main(int argc, char **argv) {
 
 			purgeable_disk_space=strtoul(recv_buffer,NULL,10);
 
-			close(sd);
-			my_tcp_connect (server_address, server_port, &sd);
-
 			xasprintf (&send_buffer,"VKS%s\r\n",volume_name);
-			result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+			result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 			if (result!=STATE_OK)
 				return result;
 			total_disk_space=strtoul(recv_buffer,NULL,10);
@@ -737,11 +778,8 @@ main(int argc, char **argv) {
 		/* check KB not yet purgeable space on volume */
 	} else if (vars_to_check==VKNP) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"VKNP%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -760,11 +798,8 @@ main(int argc, char **argv) {
 		/* check % not yet purgeable space on volume */
 	} else if (vars_to_check==VPNP) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"VKNP%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -777,11 +812,8 @@ main(int argc, char **argv) {
 
 			non_purgeable_disk_space=strtoul(recv_buffer,NULL,10);
 
-			close(sd);
-			my_tcp_connect (server_address, server_port, &sd);
-
 			xasprintf (&send_buffer,"VKS%s\r\n",volume_name);
-			result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+			result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 			if (result!=STATE_OK)
 				return result;
 			total_disk_space=strtoul(recv_buffer,NULL,10);
@@ -798,11 +830,8 @@ main(int argc, char **argv) {
 		/* check # of open files */
 	} else if (vars_to_check==OFILES) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S18\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -823,11 +852,8 @@ main(int argc, char **argv) {
 		/* check # of abended threads (Netware > 5.x only) */
 	} else if (vars_to_check==ABENDS) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S17\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -847,21 +873,15 @@ main(int argc, char **argv) {
 		/* check # of current service processes (Netware 5.x only) */
 	} else if (vars_to_check==CSPROCS) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S20\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
 		max_service_processes=atoi(recv_buffer);
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S21\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -884,11 +904,8 @@ main(int argc, char **argv) {
 		/* check # Timesync Status */
 	} else if (vars_to_check==TSYNC) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S22\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -909,11 +926,8 @@ main(int argc, char **argv) {
 		/* check LRU sitting time in secondss */
 	} else if (vars_to_check==LRUS) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S4\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		lru_time=strtoul(recv_buffer,NULL,10);
@@ -928,11 +942,8 @@ main(int argc, char **argv) {
 		/* check % dirty cacheobuffers as a percentage of the total*/
 	} else if (vars_to_check==DCB) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S6\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		dirty_cache_buffers=atoi(recv_buffer);
@@ -950,11 +961,8 @@ main(int argc, char **argv) {
 		/* check % total cache buffers as a percentage of the original*/
 	} else if (vars_to_check==TCB) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S7\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		total_cache_buffers=atoi(recv_buffer);
@@ -971,11 +979,8 @@ main(int argc, char **argv) {
 
 	} else if (vars_to_check==DSVER) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S13\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -985,11 +990,8 @@ main(int argc, char **argv) {
 
 	} else if (vars_to_check==UPTIME) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"UPTIME\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 	 		return result;
 
@@ -1001,11 +1003,8 @@ main(int argc, char **argv) {
 
 	} else if (vars_to_check==NLM) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S24:%s\r\n",nlm_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1020,7 +1019,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NRMP) {
 
 		xasprintf (&send_buffer,"NRMP:%s\r\n",nrmp_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1046,7 +1045,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NRMM) {
 
 		xasprintf (&send_buffer,"NRMM:%s\r\n",nrmm_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1072,7 +1071,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NRMS) {
 
 		xasprintf (&send_buffer,"NRMS:%s\r\n",nrms_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1098,7 +1097,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NSS1) {
 
 		xasprintf (&send_buffer,"NSS1:%s\r\n",nss1_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1124,7 +1123,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NSS2) {
 
 		xasprintf (&send_buffer,"NSS2:%s\r\n",nss2_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1150,7 +1149,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NSS3) {
 
 		xasprintf (&send_buffer,"NSS3:%s\r\n",nss3_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1176,7 +1175,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NSS4) {
 
 		xasprintf (&send_buffer,"NSS4:%s\r\n",nss4_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1202,7 +1201,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NSS5) {
 
 		xasprintf (&send_buffer,"NSS5:%s\r\n",nss5_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1228,7 +1227,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NSS6) {
 
 		xasprintf (&send_buffer,"NSS6:%s\r\n",nss6_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1254,7 +1253,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NSS7) {
 
 		xasprintf (&send_buffer,"NSS7:%s\r\n",nss7_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nwstat_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1286,21 +1285,102 @@ main(int argc, char **argv) {
 
 	}
 
-	close (sd);
+	*message = output_message;
+	return result;
+}
 
-	/* reset timeout */
-	alarm(0);
 
-	printf("%s%s\n",netware_version,output_message);
 
+/* send_tcp_request() over the kept connection, made anew when there is
+ * none yet or the server closed it (it is readable before anything was
+ * sent, or the reply comes back empty) */
+int nwstat_request (const char *send_buffer, char *recv_buffer, int recv_size) {
+	int result, reused = FALSE;
+
+	/* a deadline already past only looks */
+	if (server_sd >= 0 && np_net_wait (server_sd, POLLIN, 0) != 0) {
+		close (server_sd);
+		server_sd = -1;
+	}
+	if (server_sd >= 0)
+		reused = TRUE;
+	else if ((result = my_tcp_connect (server_address, server_port, &server_sd)) != STATE_OK) {
+		server_sd = -1;
+		return result;
+	}
+
+	result = send_tcp_request (server_sd, send_buffer, recv_buffer, recv_size);
+	if (reused && (result != STATE_OK || recv_buffer[0] == '\0')) {
+		close (server_sd);
+		if ((result = my_tcp_connect (server_address, server_port, &server_sd)) != STATE_OK) {
+			server_sd = -1;
+			return result;
+		}
+		result = send_tcp_request (server_sd, send_buffer, recv_buffer, recv_size);
+	}
 	return result;
 }
 
 
 
+void add_variable (const char *name) {
+	nwstat_variable *v;
+
+	variables = realloc (variables, (variable_count + 1) * sizeof (nwstat_variable));
+	if (variables == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	v = &variables[variable_count++];
+	v->vars_to_check = vars_to_check;
+	v->name = strdup (name ? name : "");
+	v->volume_name = volume_name;
+	v->nlm_name = nlm_name;
+	v->nrmp_name = nrmp_name;
+	v->nrmm_name = nrmm_name;
+	v->nrms_name = nrms_name;
+	v->nss_name[0] = nss1_name;
+	v->nss_name[1] = nss2_name;
+	v->nss_name[2] = nss3_name;
+	v->nss_name[3] = nss4_name;
+	v->nss_name[4] = nss5_name;
+	v->nss_name[5] = nss6_name;
+	v->nss_name[6] = nss7_name;
+	v->sap_number = sap_number;
+	v->warning_value = warning_value;
+	v->critical_value = critical_value;
+	v->check_warning_value = check_warning_value;
+	v->check_critical_value = check_critical_value;
+}
+
+
+
+/* makes v the variable check_variable() looks at */
+void use_variable (const nwstat_variable *v) {
+	vars_to_check = v->vars_to_check;
+	volume_name = v->volume_name;
+	nlm_name = v->nlm_name;
+	nrmp_name = v->nrmp_name;
+	nrmm_name = v->nrmm_name;
+	nrms_name = v->nrms_name;
+	nss1_name = v->nss_name[0];
+	nss2_name = v->nss_name[1];
+	nss3_name = v->nss_name[2];
+	nss4_name = v->nss_name[3];
+	nss5_name = v->nss_name[4];
+	nss6_name = v->nss_name[5];
+	nss7_name = v->nss_name[6];
+	sap_number = v->sap_number;
+	warning_value = v->warning_value;
+	critical_value = v->critical_value;
+	check_warning_value = v->check_warning_value;
+	check_critical_value = v->check_critical_value;
+}
+
+
+
 /* process command-line arguments */
 int process_arguments(int argc, char **argv) {
 	int c;
+	char *variable_name=NULL;
 
 	int option = 0;
 	static struct option longopts[] =
@@ -1368,6 +1448,15 @@ int process_arguments(int argc, char **argv) {
 			case 'v':
 				if (strlen(optarg)<3)
 					return ERROR;
+				/* the one before is complete: its thresholds start over */
+				if (vars_to_check!=NONE) {
+					add_variable(variable_name);
+					warning_value=0L;
+					critical_value=0L;
+					check_warning_value=FALSE;
+					check_critical_value=FALSE;
+				}
+				variable_name=optarg;
 				if (!strcmp(optarg,"LOAD1"))
 					vars_to_check=LOAD1;
 				else if (!strcmp(optarg,"LOAD5"))
@@ -1576,6 +1665,8 @@ int process_arguments(int argc, char **argv) {
 
 	}
 
+	add_variable(variable_name);
+
 	return OK;
 }
 
@@ -1650,6 +1741,8 @@ void print_help(void)
   printf ("    %s\n", _("    NLM:<nlm> = check if NLM is loaded and report version"));
   printf ("    %s\n", _("                (e.g. NLM:TSANDS.NLM)"));
   printf ("\n");
+  printf ("   %s\n", _("May be repeated to check several variables over one connection, each"));
+  printf ("   %s\n", _("with the -w and -c that follow it."));
 	printf (" %s\n", "-w, --warning=INTEGER");
   printf ("    %s\n", _("Threshold which will result in a warning status"));
   printf (" %s\n", "-c, --critical=INTEGER");
@@ -1676,5 +1769,5 @@ void print_help(void)
 void print_usage(void)
 {
   printf ("%s\n", _("Usage:"));
-	printf ("%s -H host [-p port] [-v variable] [-w warning] [-c critical] [-t timeout]\n",progname);
+	printf ("%s -H host [-p port] [-v variable [-w warning] [-c critical]]... [-t timeout]\n",progname);
 }
@@ -52,239 +52,271 @@ enum {
 	PORT = 2000
 };
 
+/* the -v variables of a run, at most */
+#define MAX_VARS 32
+
+/* A variable of -v, with the thresholds of its place in the lists of -w
+ * and -c. All of them are asked for on one connection: each command once,
+ * in the daemon's multi-command form ending with QUIT, and DISKSPACE last
+ * since its reply runs to the end. */
+struct overcr_var {
+	enum checkvar type;
+	char *name;               /* of the disk or process */
+	int port;                 /* of NET */
+	int check_warning;
+	int check_critical;
+	double warning;
+	double critical;
+	int command;              /* what it reads the reply of */
+};
+
+struct overcr_command {
+	char *text;
+	int first;                /* the first line of its reply */
+	int count;
+};
+
 char *server_address = NULL;
 int server_port = PORT;
-double warning_value = 0L;
-double critical_value = 0L;
-int check_warning_value = FALSE;
-int check_critical_value = FALSE;
-enum checkvar vars_to_check = NONE;
+struct overcr_var vars[MAX_VARS];
+int var_count = 0;
+char *warning_list = NULL;
+char *critical_list = NULL;
 int cmd_timeout = 1;
 
-int netstat_port = 0;
-char *disk_name = NULL;
-char *process_name = NULL;
-	char send_buffer[MAX_INPUT_BUFFER];
+struct overcr_command commands[MAX_VARS];
+int command_count = 0;
+char *lines[MAX_INPUT_BUFFER / 2];
+int line_count = 0;
 
 int process_arguments (int, char **);
 void print_usage (void);
 void print_help (void);
 
-int
-main (int argc, char **argv)
+/* the command of the variable, sent once however many need it */
+static int
+add_command (const char *text)
 {
-	int result = STATE_UNKNOWN;
-	char recv_buffer[MAX_INPUT_BUFFER];
-	char temp_buffer[MAX_INPUT_BUFFER];
-	char *temp_ptr = NULL;
-	int found_disk = FALSE;
-	unsigned long percent_used_disk_space = 100;
-	double load;
-	double load_1min;
-	double load_5min;
-	double load_15min;
-	int port_connections = 0;
-	int processes = 0;
-	double uptime_raw_hours;
-	int uptime_raw_minutes = 0;
-	int uptime_days = 0;
-	int uptime_hours = 0;
-	int uptime_minutes = 0;
-
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	int i;
 
-	/* Parse extra opts if any */
-	argv=np_extra_opts (&argc, argv, progname);
+	for (i = 0; i < command_count; i++)
+		if (!strcmp (commands[i].text, text))
+			return i;
+	commands[command_count].text = strdup (text);
+	return command_count++;
+}
 
-	if (process_arguments (argc, argv) == ERROR)
-		usage4 (_("Could not parse arguments"));
+/* the reply split into its lines, handed out to the commands in the
+ * order they were sent: three for LOAD, one each for the others, and the
+ * rest for DISKSPACE */
+static void
+split_reply (char *reply)
+{
+	char *line;
+	int i, next = 0;
 
-	/* initialize alarm signal handling */
-	signal (SIGALRM, socket_timeout_alarm_handler);
+	for (line = strtok (reply, "\r\n"); line && line_count < (int) (sizeof (lines) / sizeof (*lines));
+	     line = strtok (NULL, "\r\n"))
+		lines[line_count++] = line;
 
-	/* set socket timeout */
-	alarm (timeout_interval);
+	for (i = 0; i < command_count; i++) {
+		commands[i].first = next;
+		if (!strcmp (commands[i].text, "DISKSPACE"))
+			commands[i].count = line_count - next;
+		else
+			commands[i].count = strncmp (commands[i].text, "LOAD", 4) ? 1 : 3;
+		if (next + commands[i].count > line_count)
+			commands[i].count = line_count - next;
+		next += commands[i].count;
+	}
+}
 
-	result = process_tcp_request2 (server_address,
-	                               server_port,
-	                               send_buffer,
-	                               recv_buffer,
-	                               sizeof (recv_buffer));
+static int
+var_state (const struct overcr_var *v, double value)
+{
+	/* a short uptime is the problem, not a long one */
+	if (v->type == UPTIME) {
+		if (v->check_critical && value <= v->critical)
+			return STATE_CRITICAL;
+		if (v->check_warning && value <= v->warning)
+			return STATE_WARNING;
+		return STATE_OK;
+	}
+	if (v->check_critical && value >= v->critical)
+		return STATE_CRITICAL;
+	if (v->check_warning && value >= v->warning)
+		return STATE_WARNING;
+	return STATE_OK;
+}
 
-	switch (vars_to_check) {
+/* the state of the variable from its command's reply, and what to say */
+static int
+check_var (const struct overcr_var *v, char **msg)
+{
+	const struct overcr_command *c = &commands[v->command];
+	char **reply = lines + c->first;
+	char *p;
+	double value;
+	int result, minutes, i;
 
+	switch (v->type) {
 	case LOAD1:
 	case LOAD5:
 	case LOAD15:
-	
-		if (result != STATE_OK)
-			die (result, _("Unknown error fetching load data\n"));
-
-		temp_ptr = (char *) strtok (recv_buffer, "\r\n");
-		if (temp_ptr == NULL)
-			die (STATE_CRITICAL, _("Invalid response from server - no load information\n"));
-		else
-			load_1min = strtod (temp_ptr, NULL);
-
-		temp_ptr = (char *) strtok (NULL, "\r\n");
-		if (temp_ptr == NULL)
-			die (STATE_CRITICAL, _("Invalid response from server after load 1\n"));
-		else
-			load_5min = strtod (temp_ptr, NULL);
-
-		temp_ptr = (char *) strtok (NULL, "\r\n");
-		if (temp_ptr == NULL)
-			die (STATE_CRITICAL, _("Invalid response from server after load 5\n"));
-		else
-			load_15min = strtod (temp_ptr, NULL);
-
-		switch (vars_to_check) {
-		case LOAD1:
-			strcpy (temp_buffer, "1");
-			load = load_1min;
-			break;
-		case LOAD5:
-			strcpy (temp_buffer, "5");
-			load = load_5min;
-			break;
-		default:
-			strcpy (temp_buffer, "15");
-			load = load_15min;
-			break;
+		i = v->type == LOAD1 ? 0 : v->type == LOAD5 ? 1 : 2;
+		if (c->count <= i) {
+			xasprintf (msg, _("Invalid response from server - no load information"));
+			return STATE_CRITICAL;
 		}
-
-		if (check_critical_value == TRUE && (load >= critical_value))
-			result = STATE_CRITICAL;
-		else if (check_warning_value == TRUE && (load >= warning_value))
-			result = STATE_WARNING;
-
-		die (result,
-		          _("Load %s - %s-min load average = %0.2f"),
-							 state_text(result),
-		          temp_buffer,
-		          load);
-
-			break;
+		value = strtod (reply[i], NULL);
+		result = var_state (v, value);
+		xasprintf (msg, _("Load %s - %s-min load average = %0.2f"), state_text (result),
+		           v->type == LOAD1 ? "1" : v->type == LOAD5 ? "5" : "15", value);
+		return result;
 
 	case DPU:
-
-		if (result != STATE_OK)
-			die (result, _("Unknown error fetching disk data\n"));
-
-		for (temp_ptr = (char *) strtok (recv_buffer, " ");
-		     temp_ptr != NULL;
-		     temp_ptr = (char *) strtok (NULL, " ")) {
-
-			if (!strcmp (temp_ptr, disk_name)) {
-				found_disk = TRUE;
-				temp_ptr = (char *) strtok (NULL, "%");
-				if (temp_ptr == NULL)
-					die (STATE_CRITICAL, _("Invalid response from server\n"));
-				else
-					percent_used_disk_space = strtoul (temp_ptr, NULL, 10);
-				break;
+		for (i = 0; i < c->count; i++) {
+			p = reply[i] + strcspn (reply[i], " ");
+			if (p - reply[i] != (int) strlen (v->name) || strncmp (reply[i], v->name, p - reply[i]))
+				continue;
+			if (strchr (p, '%') == NULL) {
+				xasprintf (msg, _("Invalid response from server"));
+				return STATE_CRITICAL;
 			}
-
-			temp_ptr = (char *) strtok (NULL, "\r\n");
+			value = strtoul (p, NULL, 10);
+			result = var_state (v, value);
+			xasprintf (msg, "Disk %s - %lu%% used on %s", state_text (result), (unsigned long) value, v->name);
+			return result;
 		}
-
-		/* error if we couldn't find the info for the disk */
-		if (found_disk == FALSE)
-			die (STATE_CRITICAL,
-			           "CRITICAL - Disk '%s' non-existent or not mounted",
-			           disk_name);
-
-		if (check_critical_value == TRUE && (percent_used_disk_space >= critical_value))
-			result = STATE_CRITICAL;
-		else if (check_warning_value == TRUE && (percent_used_disk_space >= warning_value))
-			result = STATE_WARNING;
-
-		die (result, "Disk %s - %lu%% used on %s", state_text(result), percent_used_disk_space, disk_name);
-
-		break;
+		xasprintf (msg, "CRITICAL - Disk '%s' non-existent or not mounted", v->name);
+		return STATE_CRITICAL;
 
 	case NETSTAT:
-
-		if (result != STATE_OK)
-			die (result, _("Unknown error fetching network status\n"));
-		else
-			port_connections = strtod (recv_buffer, NULL);
-
-		if (check_critical_value == TRUE && (port_connections >= critical_value))
-			result = STATE_CRITICAL;
-		else if (check_warning_value == TRUE && (port_connections >= warning_value))
-			result = STATE_WARNING;
-
-		die (result,
-		           _("Net %s - %d connection%s on port %d"),
-		           state_text(result),
-		           port_connections,
-		           (port_connections == 1) ? "" : "s",
-		           netstat_port);
-
-		break;
+		if (c->count < 1) {
+			xasprintf (msg, _("Unknown error fetching network status"));
+			return STATE_UNKNOWN;
+		}
+		value = (int) strtod (reply[0], NULL);
+		result = var_state (v, value);
+		xasprintf (msg, _("Net %s - %d connection%s on port %d"), state_text (result), (int) value,
+		           (value == 1) ? "" : "s", v->port);
+		return result;
 
 	case PROCS:
+		if (c->count < 1 || (p = strchr (reply[0], '(')) == NULL || strchr (p, ')') == NULL) {
+			xasprintf (msg, _("Invalid response from server"));
+			return STATE_CRITICAL;
+		}
+		value = (int) strtod (p + 1, NULL);
+		result = var_state (v, value);
+		xasprintf (msg, _("Process %s - %d instance%s of %s running"), state_text (result), (int) value,
+		           (value == 1) ? "" : "s", v->name);
+		return result;
 
-		if (result != STATE_OK)
-			die (result, _("Unknown error fetching process status\n"));
+	case UPTIME:
+		if (c->count < 1) {
+			xasprintf (msg, _("Unknown error fetching uptime"));
+			return STATE_UNKNOWN;
+		}
+		minutes = (unsigned long) (strtod (reply[0], NULL) * 60.0);
+		result = var_state (v, minutes);
+		xasprintf (msg, _("Uptime %s - Up %d days %d hours %d minutes"), state_text (result),
+		           minutes / 1440, minutes % 1440 / 60, minutes % 60);
+		return result;
 
-		temp_ptr = (char *) strtok (recv_buffer, "(");
-		if (temp_ptr == NULL)
-			die (STATE_CRITICAL, _("Invalid response from server\n"));
+	default:
+		xasprintf (msg, _("Nothing to check!"));
+		return STATE_UNKNOWN;
+	}
+}
 
-		temp_ptr = (char *) strtok (NULL, ")");
-		if (temp_ptr == NULL)
-			die (STATE_CRITICAL, _("Invalid response from server\n"));
-		else
-			processes = strtod (temp_ptr, NULL);
+int
+main (int argc, char **argv)
+{
+	int result = STATE_UNKNOWN;
+	char send_buffer[MAX_INPUT_BUFFER];
+	char recv_buffer[MAX_INPUT_BUFFER];
+	char command[MAX_INPUT_BUFFER];
+	char *msg, *output = NULL;
+	int i, state;
 
-		if (check_critical_value == TRUE && (processes >= critical_value))
-			result = STATE_CRITICAL;
-		else if (check_warning_value == TRUE && (processes >= warning_value))
-			result = STATE_WARNING;
+	/* Parse extra opts if any */
+	argv=np_extra_opts (&argc, argv, progname);
 
-		die (result,
-		           _("Process %s - %d instance%s of %s running"),
-		           state_text(result),
-		           processes,
-		           (processes == 1) ? "" : "s",
-		           process_name);
-		break;
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
 
-	case UPTIME:
+	if (var_count == 0)
+		die (STATE_UNKNOWN, _("Nothing to check!\n"));
 
-		if (result != STATE_OK)
-			return result;
+	/* DISKSPACE goes last, the others in the order of -v */
+	for (i = 0; i < var_count; i++) {
+		if (vars[i].type == DPU)
+			continue;
+		if (vars[i].type == PROCS)
+			snprintf (command, sizeof (command), "PROCESS %s", vars[i].name);
+		else if (vars[i].type == NETSTAT)
+			snprintf (command, sizeof (command), "NETSTAT %d", vars[i].port);
+		else
+			snprintf (command, sizeof (command), "%s", vars[i].type == UPTIME ? "UPTIME" : "LOAD");
+		vars[i].command = add_command (command);
+	}
+	for (i = 0; i < var_count; i++)
+		if (vars[i].type == DPU)
+			vars[i].command = add_command ("DISKSPACE");
+
+	/* one command is sent as it always was, more in one go before QUIT */
+	send_buffer[0] = '\0';
+	for (i = 0; i < command_count; i++)
+		snprintf (send_buffer + strlen (send_buffer), sizeof (send_buffer) - strlen (send_buffer), "%s\r\n",
+		          commands[i].text);
+	if (command_count > 1 || !strcmp (commands[0].text, "LOAD"))
+		strncat (send_buffer, "QUIT\r\n", sizeof (send_buffer) - strlen (send_buffer) - 1);
 
-		uptime_raw_hours = strtod (recv_buffer, NULL);
-		uptime_raw_minutes = (unsigned long) (uptime_raw_hours * 60.0);
+	/* initialize alarm signal handling */
+	signal (SIGALRM, socket_timeout_alarm_handler);
 
-		if (check_critical_value == TRUE && (uptime_raw_minutes <= critical_value))
-			result = STATE_CRITICAL;
-		else if (check_warning_value == TRUE && (uptime_raw_minutes <= warning_value))
-			result = STATE_WARNING;
+	/* set socket timeout */
+	alarm (timeout_interval);
 
-		uptime_days = uptime_raw_minutes / 1440;
-		uptime_raw_minutes %= 1440;
-		uptime_hours = uptime_raw_minutes / 60;
-		uptime_raw_minutes %= 60;
-		uptime_minutes = uptime_raw_minutes;
+	result = process_tcp_request2 (server_address,
+	                               server_port,
+	                               send_buffer,
+	                               recv_buffer,
+	                               sizeof (recv_buffer));
+	if (result != STATE_OK)
+		die (result, _("Unknown error fetching data from the Over-CR daemon\n"));
+	split_reply (recv_buffer);
+
+	result = STATE_OK;
+	for (i = 0; i < var_count; i++) {
+		state = check_var (&vars[i], &msg);
+		result = max_state_alt (result, state);
+		xasprintf (&output, "%s%s%s", output ? output : "", output ? "; " : "", msg);
+		free (msg);
+	}
+	die (result, "%s\n", output);
+}
 
-		die (result,
-		           _("Uptime %s - Up %d days %d hours %d minutes"),
-		           state_text(result),
-		           uptime_days,
-		           uptime_hours,
-		           uptime_minutes);
-		break;
 
-	default:
-		die (STATE_UNKNOWN, _("Nothing to check!\n"));
-		break;
-	}
+/* the WARN,CRIT... list entry of the variable: one for all of them, or
+ * one each, where an empty one leaves it unchecked */
+static int
+threshold_entry (const char *list, int index, double *value)
+{
+	const char *p = list;
+	int i;
+
+	if (list == NULL)
+		return FALSE;
+	if (strchr (list, ',') != NULL)
+		for (i = 0; i < index && p; i++)
+			if ((p = strchr (p, ',')) != NULL)
+				p++;
+	if (p == NULL || *p == ',' || *p == '\0')
+		return FALSE;
+	*value = strtod (p, NULL);
+	return TRUE;
 }
 
 
@@ -293,6 +325,7 @@ int
 process_arguments (int argc, char **argv)
 {
 	int c;
+	struct overcr_var *v;
 
 	int option = 0;
 	static struct option longopts[] = {
@@ -355,50 +388,50 @@ process_arguments (int argc, char **argv)
 									 _("Server port an integer\n"));
 			break;
 		case 'v':									/* variable */
-			if (strcmp (optarg, "LOAD") == 0) {
-				strcpy (send_buffer, "LOAD\r\nQUIT\r\n");
-				if (strcmp (optarg, "LOAD1") == 0)
-					vars_to_check = LOAD1;
-				else if (strcmp (optarg, "LOAD5") == 0)
-					vars_to_check = LOAD5;
-				else if (strcmp (optarg, "LOAD15") == 0)
-					vars_to_check = LOAD15;
-			}
-			else if (strcmp (optarg, "UPTIME") == 0) {
-				vars_to_check = UPTIME;
-				strcpy (send_buffer, "UPTIME\r\n");
-			}
+			if (var_count == MAX_VARS)
+				usage2 (_("Too many variables"), optarg);
+			v = &vars[var_count];
+			memset (v, 0, sizeof (*v));
+			if (strcmp (optarg, "LOAD1") == 0)
+				v->type = LOAD1;
+			else if (strcmp (optarg, "LOAD5") == 0)
+				v->type = LOAD5;
+			else if (strcmp (optarg, "LOAD15") == 0)
+				v->type = LOAD15;
+			else if (strcmp (optarg, "UPTIME") == 0)
+				v->type = UPTIME;
 			else if (strstr (optarg, "PROC") == optarg) {
-				vars_to_check = PROCS;
-				process_name = strscpy (process_name, optarg + 4);
-				sprintf (send_buffer, "PROCESS %s\r\n", process_name);
+				v->type = PROCS;
+				v->name = optarg + 4;
 			}
 			else if (strstr (optarg, "NET") == optarg) {
-				vars_to_check = NETSTAT;
-				netstat_port = atoi (optarg + 3);
-				sprintf (send_buffer, "NETSTAT %d\r\n", netstat_port);
+				v->type = NETSTAT;
+				v->port = atoi (optarg + 3);
 			}
 			else if (strstr (optarg, "DPU") == optarg) {
-				vars_to_check = DPU;
-				strcpy (send_buffer, "DISKSPACE\r\n");
-				disk_name = strscpy (disk_name, optarg + 3);
+				v->type = DPU;
+				v->name = optarg + 3;
 			}
 			else
 				return ERROR;
+			var_count++;
 			break;
 		case 'w':									/* warning threshold */
-			warning_value = strtoul (optarg, NULL, 10);
-			check_warning_value = TRUE;
+			warning_list = optarg;
 			break;
 		case 'c':									/* critical threshold */
-			critical_value = strtoul (optarg, NULL, 10);
-			check_critical_value = TRUE;
+			critical_list = optarg;
 			break;
 		case 't':									/* timeout */
 			timeout_interval = parse_timeout_string (optarg);
 		}
 
 	}
+
+	for (c = 0; c < var_count; c++) {
+		vars[c].check_warning = threshold_entry (warning_list, c, &vars[c].warning);
+		vars[c].check_critical = threshold_entry (critical_list, c, &vars[c].critical);
+	}
 	return OK;
 }
 
@@ -426,12 +459,15 @@ print_help (void)
 
 	printf (UT_HOST_PORT, 'p', myport);
 
-  printf (" %s\n", "-w, --warning=INTEGER");
+  printf (" %s\n", "-w, --warning=INTEGER[,INTEGER...]");
   printf ("    %s\n", _("Threshold which will result in a warning status"));
-  printf (" %s\n", "-c, --critical=INTEGER");
+  printf (" %s\n", "-c, --critical=INTEGER[,INTEGER...]");
   printf ("    %s\n", _("Threshold which will result in a critical status"));
+  printf ("    %s\n", _("With several -v, a list has a threshold for each in turn, an empty one for"));
+  printf ("    %s\n", _("none, and a single value is for all of them"));
   printf (" %s\n", "-v, --variable=STRING");
-  printf ("    %s\n", _("Variable to check.  Valid variables include:"));
+  printf ("    %s\n", _("Variable to check, which may be repeated to ask for up to 32 of them over"));
+  printf ("    %s\n", _("one connection.  Valid variables include:"));
   printf ("    %s\n", _("LOAD1         = 1 minute average CPU load"));
   printf ("    %s\n", _("LOAD5         = 5 minute average CPU load"));
   printf ("    %s\n", _("LOAD15        = 15 minute average CPU load"));
@@ -463,5 +499,5 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-	printf ("%s -H host [-p port] [-v variable] [-w warning] [-c critical] [-t timeout]\n", progname);
+	printf ("%s -H host [-p port] [-v variable ...] [-w warning[,warning...]] [-c critical[,critical...]] [-t timeout]\n", progname);
 }
@@ -0,0 +1,509 @@
+/*****************************************************************************
+*
+* Nagios check_parallel plugin
+*
+* License: GPL
+* Copyright (c) 2026 Nagios Plugins Development Team
+*
+* Description:
+*
+* This file contains the check_parallel plugin
+*
+* Runs a group of plugins at the same time, concurrency of them at once,
+* within one overall timeout, and returns the worst of their states with
+* a line and the perfdata of each.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+const char *progname = "check_parallel";
+const char *copyright = "2026";
+const char *email = "devel@nagios-plugins.org";
+
+#include "common.h"
+#include "utils.h"
+#include "utils_cmd.h"
+#include <ctype.h>
+#ifdef HAVE_SYS_WAIT_H
+# include <sys/wait.h>
+#endif
+
+extern char **environ;
+
+/* checks run at a time */
+#define DEFAULT_CONCURRENCY 16
+/* what of a child's time is left for it to time out by itself */
+#define CHILD_TIMEOUT_MARGIN 1
+#define TIMEOUT_MACRO "$TIMEOUT$"
+
+/* one command[ name ] = command line */
+typedef struct check_child {
+	char *name;
+	char *command;
+	char **argv;
+	pid_t pid;
+	int state;
+	int timed_out;
+	char *message;
+	output out;
+	output err;
+} check_child;
+
+int process_arguments (int, char **);
+void add_child (const char *, const char *, int);
+void read_spec (const char *);
+int run_children (void);
+void child_result (check_child *, int, np_perfdata *);
+void add_perfdata (np_perfdata *, const char *, const char *);
+void print_help (void);
+void print_usage (void);
+
+check_child *children = NULL;
+int child_count = 0;
+int concurrency = DEFAULT_CONCURRENCY;
+int child_timeout = 0;
+int verbose = 0;
+
+int
+main (int argc, char **argv)
+{
+	setlocale (LC_ALL, "");
+	bindtextdomain (PACKAGE, LOCALEDIR);
+	textdomain (PACKAGE);
+
+	/* Parse extra opts if any */
+	argv = np_extra_opts (&argc, argv, progname);
+
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	/* the children are killed at the deadline; this is for the rest */
+	signal (SIGALRM, timeout_alarm_handler);
+	alarm (timeout_interval + CHILD_TIMEOUT_MARGIN + 1);
+
+	return run_children ();
+}
+
+
+/* command with $TIMEOUT$ as the seconds it has, split as cmd_run() would
+ * or else for the shell */
+static char **
+child_argv (const char *command, unsigned int budget)
+{
+	char *line = strdup (command), *at, *expanded, seconds[16];
+	char **argv;
+
+	snprintf (seconds, sizeof (seconds), "%u",
+	          budget > CHILD_TIMEOUT_MARGIN ? budget - CHILD_TIMEOUT_MARGIN : budget);
+	while ((at = strstr (line, TIMEOUT_MACRO)) != NULL) {
+		*at = '\0';
+		xasprintf (&expanded, "%s%s%s", line, seconds, at + strlen (TIMEOUT_MACRO));
+		free (line);
+		line = expanded;
+	}
+
+	if ((argv = cmd_argv (line)) != NULL && strchr (argv[0], '/') != NULL)
+		return argv;
+	free (argv);
+	if ((argv = calloc (4, sizeof (char *))) == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	argv[0] = "/bin/sh";
+	argv[1] = "-c";
+	argv[2] = line;
+	return argv;
+}
+
+/* Run the children concurrency at a time, each round drained by one poll
+ * loop and given what is left of -t (or -T, if that is less); children
+ * still running at the end of it are killed. */
+int
+run_children (void)
+{
+	cmd_child *fetch;
+	check_child *ch;
+	np_perfdata perf;
+	char *problems = NULL;
+	time_t deadline = time (NULL) + timeout_interval;
+	unsigned int budget;
+	int pfd[2], pfderr[2];
+	int i, j, round, count_ok = 0;
+	int result = STATE_OK;
+
+	fetch = calloc (concurrency, sizeof (cmd_child));
+	if (fetch == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	np_perfdata_init (&perf);
+
+	for (i = 0; i < child_count; i += round) {
+		round = child_count - i < concurrency ? child_count - i : concurrency;
+		if (deadline - time (NULL) <= 0) {
+			for (j = i; j < child_count; j++) {
+				children[j].state = STATE_UNKNOWN;
+				xasprintf (&children[j].message, _("Not run, the %d seconds are over"), timeout_interval);
+			}
+			break;
+		}
+		budget = (unsigned int) (deadline - time (NULL));
+		if (child_timeout > 0 && (unsigned int) child_timeout < budget)
+			budget = child_timeout;
+
+		for (j = 0; j < round; j++) {
+			ch = &children[i + j];
+			ch->argv = child_argv (ch->command, budget);
+			if (verbose)
+				printf ("%s: %s (%u seconds)\n", ch->name, ch->command, budget);
+			if (pipe (pfd) < 0 || pipe (pfderr) < 0 ||
+			    (ch->pid = cmd_spawn (ch->argv, environ, pfd, pfderr)) < 0)
+				die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), ch->argv[0]);
+			close (pfd[1]);
+			close (pfderr[1]);
+			fetch[j].out_fd = pfd[0];
+			fetch[j].err_fd = pfderr[0];
+			fetch[j].out = &ch->out;
+			fetch[j].err = &ch->err;
+			fetch[j].pid = ch->pid;
+		}
+
+		/* each child is killed at the end of its budget and reaped there */
+		cmd_fetch_children (fetch, round, 0, budget);
+		for (j = 0; j < round; j++) {
+			ch = &children[i + j];
+			close (fetch[j].out_fd);
+			close (fetch[j].err_fd);
+			if (fetch[j].timed_out) {
+				ch->timed_out = TRUE;
+				xasprintf (&ch->message, _("Timed out after %u seconds"), budget);
+			}
+			child_result (ch, fetch[j].status, &perf);
+		}
+	}
+
+	for (i = 0; i < child_count; i++) {
+		ch = &children[i];
+		result = max_state_alt (result, ch->state);
+		if (ch->state == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           ch->name, ch->message);
+	}
+
+	printf ("PARALLEL %s: %d of %d %s%s%s%s%s\n", state_text (result), count_ok, child_count,
+	        _("checks OK"), problems ? " - " : "", problems ? problems : "",
+	        perf.len ? "|" : "", np_perfdata_string (&perf));
+	for (i = 0; i < child_count; i++) {
+		ch = &children[i];
+		printf ("[%s] %s: %s\n", state_text (ch->state), ch->name, ch->message);
+		/* the long output, up to more perfdata */
+		for (j = 1; j < (int) ch->out.lines && !ch->timed_out; j++) {
+			if (strchr (ch->out.line[j], '|'))
+				break;
+			printf ("    %s\n", ch->out.line[j]);
+		}
+	}
+	np_perfdata_free (&perf);
+	return result;
+}
+
+/* the state, message and perfdata of a child that is done */
+void
+child_result (check_child *ch, int status, np_perfdata *perf)
+{
+	char *line, *bar;
+	size_t i;
+
+	if (ch->timed_out) {
+		ch->state = STATE_UNKNOWN;
+		return;
+	}
+	if (WIFEXITED (status) && WEXITSTATUS (status) <= STATE_UNKNOWN)
+		ch->state = WEXITSTATUS (status);
+	else
+		ch->state = STATE_UNKNOWN;
+
+	if (ch->out.lines == 0) {
+		xasprintf (&ch->message, "%s%s%s", _("(No output on stdout)"),
+		           ch->err.lines ? " stderr: " : "", ch->err.lines ? ch->err.line[0] : "");
+	} else {
+		line = strdup (ch->out.line[0]);
+		if ((bar = strchr (line, '|')) != NULL) {
+			*bar = '\0';
+			add_perfdata (perf, ch->name, bar + 1);
+		}
+		ch->message = line;
+		/* more perfdata after a | in the long output */
+		for (i = 1; i < ch->out.lines; i++) {
+			if ((bar = strchr (ch->out.line[i], '|')) != NULL) {
+				add_perfdata (perf, ch->name, bar + 1);
+				while (++i < ch->out.lines)
+					add_perfdata (perf, ch->name, ch->out.line[i]);
+			}
+		}
+	}
+
+	if (WIFSIGNALED (status))
+		xasprintf (&ch->message, _("Killed by signal %d: %s"), WTERMSIG (status), ch->message);
+	else if (WIFEXITED (status) && WEXITSTATUS (status) > STATE_UNKNOWN)
+		xasprintf (&ch->message, _("Return code of %d is out of bounds: %s"), WEXITSTATUS (status), ch->message);
+}
+
+/* perfdata of a child, each label as name::label */
+void
+add_perfdata (np_perfdata *perf, const char *name, const char *data)
+{
+	const char *p = data, *start, *end;
+	char *label;
+	size_t len;
+
+	for (;;) {
+		while (isspace ((unsigned char) *p))
+			p++;
+		if (*p == '\0')
+			return;
+
+		/* 'a label'=value, with '' for a quote */
+		label = NULL;
+		if (*p == '\'') {
+			for (start = ++p; *p && !(*p == '\'' && p[1] != '\''); p += *p == '\'' ? 2 : 1)
+				;
+			len = p - start;
+			if (*p)
+				p++;
+		} else {
+			for (start = p; *p && *p != '=' && !isspace ((unsigned char) *p); p++)
+				;
+			len = p - start;
+		}
+		if (*p != '=') {
+			/* not perfdata, skip the word */
+			while (*p && !isspace ((unsigned char) *p))
+				p++;
+			continue;
+		}
+		for (end = ++p; *end && !isspace ((unsigned char) *end); end++)
+			;
+
+		xasprintf (&label, "%s::%.*s", name, (int) len, start);
+		if (perf->len)
+			np_perfdata_append (perf, " ", 1);
+		if (strpbrk (label, "'= ")) {
+			np_perfdata_append (perf, "'", 1);
+			np_perfdata_append (perf, label, strlen (label));
+			np_perfdata_append (perf, "'", 1);
+		} else {
+			np_perfdata_append (perf, label, strlen (label));
+		}
+		np_perfdata_append (perf, "=", 1);
+		np_perfdata_append (perf, p, end - p);
+		free (label);
+		p = end;
+	}
+}
+
+void
+add_child (const char *name, const char *command, int where)
+{
+	int i;
+
+	for (i = 0; i < child_count; i++)
+		if (strcmp (children[i].name, name) == 0)
+			die (STATE_UNKNOWN, _("%s: line %d: command[ %s ] is there twice\n"), progname, where, name);
+	if ((children = realloc (children, (child_count + 1) * sizeof (check_child))) == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	memset (&children[child_count], 0, sizeof (check_child));
+	children[child_count].name = strdup (name);
+	children[child_count].command = strdup (command);
+	child_count++;
+}
+
+/* command[ name ] = command line; returns FALSE if line is not one */
+static int
+parse_spec_line (char *line, int where)
+{
+	char *name, *end, *command;
+
+	while (isspace ((unsigned char) *line))
+		line++;
+	if (*line == '\0' || *line == '#')
+		return TRUE;
+	if (strncmp (line, "command[", 8) != 0 || (end = strchr (line, ']')) == NULL)
+		return FALSE;
+	for (name = line + 8; isspace ((unsigned char) *name); name++)
+		;
+	for (command = end + 1; isspace ((unsigned char) *command); command++)
+		;
+	while (end > name && isspace ((unsigned char) end[-1]))
+		end--;
+	*end = '\0';
+	if (*name == '\0' || *command++ != '=')
+		return FALSE;
+	while (isspace ((unsigned char) *command))
+		command++;
+	for (end = command + strlen (command); end > command && isspace ((unsigned char) end[-1]); end--)
+		end[-1] = '\0';
+	if (*command == '\0')
+		return FALSE;
+	add_child (name, command, where);
+	return TRUE;
+}
+
+/* a file of command[ name ] = lines, - for stdin */
+void
+read_spec (const char *file)
+{
+	char line[MAX_INPUT_BUFFER * 4];
+	FILE *fp;
+	int where = 0;
+
+	if (strcmp (file, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen (file, "r")) == NULL)
+		die (STATE_UNKNOWN, _("%s: Cannot read %s: %s\n"), progname, file, strerror (errno));
+	while (fgets (line, sizeof (line), fp)) {
+		where++;
+		line[strcspn (line, "\r\n")] = '\0';
+		if (!parse_spec_line (line, where))
+			die (STATE_UNKNOWN, _("%s: %s line %d: expected command[ NAME ] = COMMAND\n"), progname, file, where);
+	}
+	if (fp != stdin)
+		fclose (fp);
+}
+
+/* process command-line arguments */
+int
+process_arguments (int argc, char **argv)
+{
+	int c;
+	int option = 0;
+	enum {
+		CONCURRENCY = CHAR_MAX + 1
+	};
+	static struct option longopts[] = {
+		{"version", no_argument, 0, 'V'},
+		{"help", no_argument, 0, 'h'},
+		{"verbose", no_argument, 0, 'v'},
+		{"timeout", required_argument, 0, 't'},
+		{"child-timeout", required_argument, 0, 'T'},
+		{"file", required_argument, 0, 'f'},
+		{"execute", required_argument, 0, 'x'},
+		{"concurrency", required_argument, 0, CONCURRENCY},
+		{0, 0, 0, 0}
+	};
+
+	if (argc < 2)
+		return ERROR;
+
+	while (1) {
+		c = getopt_long (argc, argv, "Vhvt:T:f:x:", longopts, &option);
+
+		if (c == -1 || c == EOF)
+			break;
+
+		switch (c) {
+		case 'V':
+			print_revision (progname, NP_VERSION);
+			exit (STATE_OK);
+		case 'h':
+			print_help ();
+			exit (STATE_OK);
+		case 'v':
+			verbose++;
+			break;
+		case 't':
+			timeout_interval = parse_timeout_string (optarg);
+			break;
+		case 'T':
+			if (!is_intpos (optarg))
+				usage2 (_("Child timeout must be a positive integer"), optarg);
+			child_timeout = atoi (optarg);
+			break;
+		case 'f':
+			read_spec (optarg);
+			break;
+		case 'x':
+			if (!parse_spec_line (optarg, 0))
+				usage2 (_("Expected command[ NAME ] = COMMAND"), optarg);
+			break;
+		case CONCURRENCY:
+			if (!is_intpos (optarg))
+				usage2 (_("Concurrency must be a positive integer"), optarg);
+			concurrency = atoi (optarg);
+			break;
+		default:
+			usage5 ();
+		}
+	}
+
+	if (child_count == 0)
+		usage4 (_("No commands to run, give -f or -x"));
+	return OK;
+}
+
+
+void
+print_help (void)
+{
+	print_revision (progname, NP_VERSION);
+
+	printf (COPYRIGHT, copyright, email);
+
+	printf ("%s\n", _("Runs several plugins at the same time and returns the worst of their states,"));
+	printf ("%s\n", _("with a line and the perfdata of each."));
+
+	printf ("\n\n");
+
+	print_usage ();
+
+	printf (UT_HELP_VRSN);
+	printf (UT_EXTRA_OPTS);
+
+	printf (" %s\n", "-f, --file=FILE");
+	printf ("    %s\n", _("The checks to run, one command[ NAME ] = COMMAND line each (- for stdin)"));
+	printf (" %s\n", "-x, --execute='command[ NAME ] = COMMAND'");
+	printf ("    %s\n", _("A check to run; may be repeated, and mixed with -f"));
+	printf (" %s\n", "--concurrency=INTEGER");
+	printf ("    %s (%s: %d)\n", _("How many checks run at a time"), _("default"), DEFAULT_CONCURRENCY);
+	printf (UT_PLUG_TIMEOUT, timeout_interval);
+	printf ("    %s\n", _("For all of the checks: each gets what is left of it when it starts"));
+	printf (" %s\n", "-T, --child-timeout=INTEGER");
+	printf ("    %s\n", _("Seconds each check gets at most, if that is less"));
+	printf (UT_VERBOSE);
+
+	printf ("\n");
+	printf ("%s\n", _("Notes:"));
+	printf (" %s\n", _("A COMMAND is run as negate runs one, or with /bin/sh -c when it has double"));
+	printf (" %s\n", _("quotes or no path. $TIMEOUT$ in it is the seconds the check has, less one,"));
+	printf (" %s\n", _("for its own -t; a check still running when its time is over is killed and"));
+	printf (" %s\n", _("is UNKNOWN. The perfdata of each check is given as NAME::label."));
+	printf ("\n");
+	printf ("%s\n", _("Examples:"));
+	printf (" %s\n", "check_parallel -t 20 \\");
+	printf (" %s\n", "  -x 'command[ load ] = /usr/local/nagios/libexec/check_load -w 5 -c 10' \\");
+	printf (" %s\n", "  -x 'command[ root ] = /usr/local/nagios/libexec/check_disk -t $TIMEOUT$ -w 10% -p /'");
+	printf ("    %s\n", _("Both checks at once, OK if both are"));
+
+	printf (UT_SUPPORT);
+}
+
+
+void
+print_usage (void)
+{
+	printf ("%s\n", _("Usage:"));
+	printf (" %s {-f FILE | -x 'command[ NAME ] = COMMAND'}... [--concurrency=INTEGER]\n", progname);
+	printf ("       [-t timeout] [-T child-timeout] [-v]\n");
+}
@@ -36,6 +36,7 @@ const char *email = "devel@nagios-plugins.org";
 #include "utils.h"
 
 #include "netutils.h"
+#include "resident.h"
 #include <libpq-fe.h>
 #include <pg_config_manual.h>
 
@@ -59,7 +60,8 @@ const char *email = "devel@nagios-plugins.org";
 enum {
 	DEFAULT_PORT = 5432,
 	DEFAULT_WARN = 2,
-	DEFAULT_CRIT = 8
+	DEFAULT_CRIT = 8,
+	DEFAULT_PERCENTILE = 95
 };
 
 
@@ -71,24 +73,78 @@ void print_help (void);
 int is_pg_dbname (char *);
 int is_pg_logname (char *);
 int do_query (PGconn *, char *);
+PGconn *connect_db (const char *);
+int check_queries (PGconn *);
+int check_latency (PGconn *, const char *);
+int check_databases (PGconn *, const char *, double);
+static int run_check (int, char **);
+static void reset_state (void);
+
+/* defaults are set in reset_state() so resident mode can restore them */
+char *pghost;							/* host name of the backend server */
+char *pgport;							/* port of the backend server */
+int default_port;
+char *pgoptions;
+char *pgtty;
+char dbName[NAMEDATALEN];
+char *pguser;
+char *pgpasswd;
+char *pgparams;
+double twarn;
+double tcrit;
+char *pgquery;
+char *query_warning;
+char *query_critical;
+static int print_query;
+thresholds *qthresholds;
+int verbose;
+int repeat;
+int repeat_interval;
+double latency_percentile;
+char *latency_warning;
+char *latency_critical;
+thresholds *lthresholds;
+int all_databases;
+int db_concurrency;
+
+/* one -q, with the -n, -W and -C that follow it */
+typedef struct named_query {
+	char *name;
+	char *sql;
+	char *warning;
+	char *critical;
+	thresholds *thresholds;
+	int state;
+	double value;
+	int has_value;
+	double time;
+	char *msg;
+} named_query;
+
+named_query *queries;
+int query_count;
+
+/* connections kept between the checks of a resident worker */
+static int
+pool_fd (void *conn)
+{
+	return PQsocket (conn);
+}
+
+/* not in the middle of something a check left behind */
+static int
+pool_alive (void *conn)
+{
+	return PQstatus (conn) == CONNECTION_OK && PQtransactionStatus (conn) == PQTRANS_IDLE;
+}
+
+static void
+pool_close (void *conn)
+{
+	PQfinish (conn);
+}
 
-char *pghost = NULL;						/* host name of the backend server */
-char *pgport = NULL;						/* port of the backend server */
-int default_port = DEFAULT_PORT;
-char *pgoptions = NULL;
-char *pgtty = NULL;
-char dbName[NAMEDATALEN] = DEFAULT_DB;
-char *pguser = NULL;
-char *pgpasswd = NULL;
-char *pgparams = NULL;
-double twarn = (double)DEFAULT_WARN;
-double tcrit = (double)DEFAULT_CRIT;
-char *pgquery = NULL;
-char *query_warning = NULL;
-char *query_critical = NULL;
-static int print_query = 0;
-thresholds *qthresholds = NULL;
-int verbose = 0;
+static const np_pool_ops pool_ops = { pool_fd, pool_alive, pool_close };
 
 /******************************************************************************
 
@@ -144,6 +200,50 @@ Please note that all tags must be lowercase to use the DocBook XML DTD.
 
 int
 main (int argc, char **argv)
+{
+	if (np_resident_requested (argc, argv))
+		return np_resident_main (argc, argv, run_check, reset_state);
+
+	reset_state ();
+	return run_check (argc, argv);
+}
+
+
+static void
+reset_state (void)
+{
+	pghost = NULL;
+	pgport = NULL;
+	default_port = DEFAULT_PORT;
+	pgoptions = NULL;
+	pgtty = NULL;
+	strcpy (dbName, DEFAULT_DB);
+	pguser = NULL;
+	pgpasswd = NULL;
+	pgparams = NULL;
+	twarn = (double)DEFAULT_WARN;
+	tcrit = (double)DEFAULT_CRIT;
+	pgquery = NULL;
+	query_warning = NULL;
+	query_critical = NULL;
+	print_query = 0;
+	qthresholds = NULL;
+	verbose = 0;
+	queries = NULL;
+	query_count = 0;
+	repeat = 0;
+	repeat_interval = 0;
+	latency_percentile = DEFAULT_PERCENTILE;
+	latency_warning = NULL;
+	latency_critical = NULL;
+	lthresholds = NULL;
+	all_databases = FALSE;
+	db_concurrency = 16;
+}
+
+
+static int
+run_check (int argc, char **argv)
 {
 	PGconn *conn;
 	char *conninfo = NULL;
@@ -153,6 +253,7 @@ main (int argc, char **argv)
 	double elapsed_time;
 	int status = STATE_UNKNOWN;
 	int query_status = STATE_UNKNOWN;
+	int latency_status = STATE_OK;
 
 	/* begin, by setting the parameters for a backend connection if the
 	 * parameters are null, then the system will try to use reasonable
@@ -162,10 +263,6 @@ main (int argc, char **argv)
 	pgoptions = NULL;  /* special options to start up the backend server */
 	pgtty = NULL;      /* debugging tty for the backend server */
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
 
@@ -201,9 +298,15 @@ main (int argc, char **argv)
 	if (pgpasswd)
 		asprintf (&conninfo, "%s password = '%s'", conninfo, pgpasswd);
 
-	/* make a connection to the database */
+	/* make a connection to the database, unless a resident worker kept
+	 * one from an earlier check */
 	gettimeofday (&start_timeval, NULL);
-	conn = PQconnectdb (conninfo);
+	if ((conn = np_pool_get (conninfo, &pool_ops)) != NULL) {
+		if (verbose)
+			printf ("Reusing the connection of an earlier check\n");
+	}
+	else if ((conn = connect_db (conninfo)) != NULL && PQstatus (conn) != CONNECTION_BAD)
+		np_pool_add (conninfo, conn, &pool_ops);
 	gettimeofday (&end_timeval, NULL);
 
 	while (start_timeval.tv_usec > end_timeval.tv_usec) {
@@ -219,7 +322,12 @@ main (int argc, char **argv)
 	/* check to see that the backend connection was successfully made */
 	if (verbose)
 		printf("Verifying connection\n");
-	if (PQstatus (conn) == CONNECTION_BAD) {
+	if (conn == NULL) {
+		printf (_("CRITICAL - no connection to '%s' (%s).\n"),
+		        dbName,	_("Connection timed out"));
+		return STATE_CRITICAL;
+	}
+	else if (PQstatus (conn) == CONNECTION_BAD) {
 		printf (_("CRITICAL - no connection to '%s' (%s).\n"),
 		        dbName,	PQerrorMessage (conn));
 		PQfinish (conn);
@@ -248,18 +356,34 @@ main (int argc, char **argv)
 				PQprotocolVersion (conn), PQbackendPID (conn));
 	}
 
-	printf (_(" %s - database %s (%f sec.)|%s\n"),
-	        state_text(status), dbName, elapsed_time,
-	        fperfdata("time", elapsed_time, "s",
-	                 !!(twarn > 0.0), twarn, !!(tcrit > 0.0), tcrit, TRUE, 0, FALSE,0));
-
-	if (pgquery)
-		query_status = do_query (conn, pgquery);
+	if (all_databases)
+		status = query_status = check_databases (conn, conninfo, elapsed_time);
+	else {
+		printf (_(" %s - database %s (%f sec.)|%s\n"),
+		        state_text(status), dbName, elapsed_time,
+		        fperfdata("time", elapsed_time, "s",
+		                 !!(twarn > 0.0), twarn, !!(tcrit > 0.0), tcrit, TRUE, 0, FALSE,0));
+
+		if (query_count > 1)
+			query_status = check_queries (conn);
+		else if (pgquery)
+			query_status = do_query (conn, pgquery);
+		if (repeat > 0)
+			latency_status = check_latency (conn, pgquery ? pgquery : "SELECT 1");
+	}
 
-	if (verbose)
-		printf("Closing connection\n");
-	PQfinish (conn);
-	return (pgquery && query_status > status) ? query_status : status;
+	if (np_pool_release (conn)) {
+		if (verbose)
+			printf("Keeping connection for the next check\n");
+	}
+	else {
+		if (verbose)
+			printf("Closing connection\n");
+		PQfinish (conn);
+	}
+	if (pgquery && query_status > status)
+		status = query_status;
+	return max_state (status, latency_status);
 }
 
 
@@ -271,6 +395,15 @@ process_arguments (int argc, char **argv)
 	int c;
 
 	int option = 0;
+	enum {
+		REPEAT_OPTION = CHAR_MAX + 1,
+		INTERVAL_OPTION,
+		PERCENTILE_OPTION,
+		LATENCY_WARNING_OPTION,
+		LATENCY_CRITICAL_OPTION,
+		ALL_DATABASES_OPTION,
+		CONCURRENCY_OPTION
+	};
 	static struct option longopts[] = {
 		{"help", no_argument, 0, 'h'},
 		{"version", no_argument, 0, 'V'},
@@ -285,15 +418,23 @@ process_arguments (int argc, char **argv)
 		{"database", required_argument, 0, 'd'},
 		{"option", required_argument, 0, 'o'},
 		{"query", required_argument, 0, 'q'},
+		{"query-name", required_argument, 0, 'n'},
 		{"query_critical", required_argument, 0, 'C'},
 		{"query_warning", required_argument, 0, 'W'},
 		{"print-query", no_argument, 0, 'r'},
 		{"verbose", no_argument, 0, 'v'},
+		{"repeat", required_argument, 0, REPEAT_OPTION},
+		{"interval", required_argument, 0, INTERVAL_OPTION},
+		{"percentile", required_argument, 0, PERCENTILE_OPTION},
+		{"latency-warning", required_argument, 0, LATENCY_WARNING_OPTION},
+		{"latency-critical", required_argument, 0, LATENCY_CRITICAL_OPTION},
+		{"all-databases", no_argument, 0, ALL_DATABASES_OPTION},
+		{"concurrency", required_argument, 0, CONCURRENCY_OPTION},
 		{0, 0, 0, 0}
 	};
 
 	while (1) {
-		c = getopt_long (argc, argv, "hVt:c:w:H:P:d:l:p:a:o:q:C:W:v",
+		c = getopt_long (argc, argv, "hVt:c:w:H:P:d:l:p:a:o:q:n:C:W:rv",
 		                 longopts, &option);
 
 		if (c == EOF)
@@ -304,10 +445,10 @@ process_arguments (int argc, char **argv)
 			usage5 ();
 		case 'h':     /* help */
 			print_help ();
-			exit (STATE_OK);
+			np_exit (STATE_OK);
 		case 'V':     /* version */
 			print_revision (progname, NP_VERSION);
-			exit (STATE_OK);
+			np_exit (STATE_OK);
 		case 't':     /* timeout period */
 			timeout_interval = parse_timeout_string (optarg);
 			break;
@@ -323,11 +464,19 @@ process_arguments (int argc, char **argv)
 			else
 				twarn = strtod (optarg, NULL);
 			break;
+		/* before the first -q these apply to every query, after it to the
+		 * last one */
 		case 'C':     /* critical query threshold */
-			query_critical = optarg;
+			if (query_count > 0)
+				queries[query_count - 1].critical = optarg;
+			else
+				query_critical = optarg;
 			break;
 		case 'W':     /* warning query threshold */
-			query_warning = optarg;
+			if (query_count > 0)
+				queries[query_count - 1].warning = optarg;
+			else
+				query_warning = optarg;
 			break;
 		case 'r':
 			print_query = 1;
@@ -368,14 +517,64 @@ process_arguments (int argc, char **argv)
 			break;
 		case 'q':
 			pgquery = optarg;
+			queries = realloc (queries, (query_count + 1) * sizeof (named_query));
+			if (queries == NULL)
+				die (STATE_UNKNOWN, _("Could not allocate memory for the queries\n"));
+			memset (&queries[query_count], 0, sizeof (named_query));
+			queries[query_count].sql = optarg;
+			queries[query_count].warning = query_warning;
+			queries[query_count].critical = query_critical;
+			xasprintf (&queries[query_count].name, "query%d", query_count + 1);
+			query_count++;
+			break;
+		case 'n':
+			if (query_count == 0)
+				usage2 (_("A query name must follow its query"), optarg);
+			queries[query_count - 1].name = optarg;
 			break;
 		case 'v':
 			verbose++;
 			break;
+		case REPEAT_OPTION:
+			if (!is_intpos (optarg))
+				usage2 (_("Repeat count must be a positive integer"), optarg);
+			repeat = atoi (optarg);
+			break;
+		case INTERVAL_OPTION:
+			if (!is_intnonneg (optarg))
+				usage2 (_("Interval must be a positive integer"), optarg);
+			repeat_interval = atoi (optarg);
+			break;
+		case PERCENTILE_OPTION:
+			if (!is_nonnegative (optarg) || strtod (optarg, NULL) > 100)
+				usage2 (_("Percentile must be between 0 and 100"), optarg);
+			latency_percentile = strtod (optarg, NULL);
+			break;
+		case LATENCY_WARNING_OPTION:
+			latency_warning = optarg;
+			break;
+		case LATENCY_CRITICAL_OPTION:
+			latency_critical = optarg;
+			break;
+		case ALL_DATABASES_OPTION:
+			all_databases = TRUE;
+			break;
+		case CONCURRENCY_OPTION:
+			if (!is_intpos (optarg))
+				usage2 (_("Concurrency must be a positive integer"), optarg);
+			db_concurrency = atoi (optarg);
+			break;
 		}
 	}
 
+	if (query_count == 1) {
+		query_warning = queries[0].warning;
+		query_critical = queries[0].critical;
+	}
 	set_thresholds (&qthresholds, query_warning, query_critical);
+	for (c = 0; c < query_count; c++)
+		set_thresholds (&queries[c].thresholds, queries[c].warning, queries[c].critical);
+	set_thresholds (&lthresholds, latency_warning, latency_critical);
 
 	return validate_arguments ();
 }
@@ -406,6 +605,10 @@ first character cannot be a number, however.</para>
 int
 validate_arguments ()
 {
+	if (repeat > 0 && query_count > 1)
+		usage4 (_("--repeat takes a single -q"));
+	if (all_databases && (query_count > 1 || repeat > 0))
+		usage4 (_("--all-databases takes a single -q and no --repeat"));
 	return OK;
 }
 
@@ -531,12 +734,34 @@ print_help (void)
 
 	printf (" %s\n", "-q, --query=STRING");
 	printf ("    %s\n", _("SQL query to run. Only first column in first row will be read"));
+	printf ("    %s\n", _("May be given more than once, see below"));
+	printf (" %s\n", "-n, --query-name=STRING");
+	printf ("    %s\n", _("Name of the -q before it in the output (default: query1, query2, ...)"));
 	printf (" %s\n", "-W, --query-warning=RANGE");
 	printf ("    %s\n", _("SQL query value to result in warning status (double)"));
 	printf (" %s\n", "-C, --query-critical=RANGE");
 	printf ("    %s\n", _("SQL query value to result in critical status (double)"));
+	printf ("    %s\n", _("-W and -C after a -q apply to it alone, before the first -q to all"));
 	printf (" %s\n", "-r,  --print-query");
 	printf ("    %s\n", _("Print the output of the entire query to extended plugin output."));
+	printf (" %s\n", "--repeat=INTEGER");
+	printf ("    %s\n", _("Run the -q query (SELECT 1 without one) this many times more over the"));
+	printf ("    %s\n", _("connection, for the spread of its latency"));
+	printf (" %s\n", "--interval=MILLISECONDS");
+	printf ("    %s\n", _("Pause between those runs (default 0)"));
+	printf (" %s\n", "--percentile=DOUBLE");
+	printf ("    %s", _("Percentile of the latencies the thresholds below are for "));
+	printf (_("(default: %d)\n"), DEFAULT_PERCENTILE);
+	printf (" %s\n", "--latency-warning=RANGE");
+	printf ("    %s\n", _("Latency of that percentile, in seconds, to result in warning status"));
+	printf (" %s\n", "--latency-critical=RANGE");
+	printf ("    %s\n", _("Latency of that percentile, in seconds, to result in critical status"));
+	printf (" %s\n", "--all-databases");
+	printf ("    %s\n", _("Check every database of the server that takes connections, as listed in"));
+	printf ("    %s\n", _("pg_database of -d: each is connected to, held to -w and -c, and the -q run"));
+	printf ("    %s\n", _("on it, with a summary and a line for each"));
+	printf (" %s\n", "--concurrency=INTEGER");
+	printf ("    %s\n", _("Databases connected to at a time with --all-databases (default: 16)"));
 
 	printf (UT_VERBOSE);
 
@@ -554,6 +779,17 @@ print_help (void)
 	printf (" %s\n", _("of the last command is taken into account only. The value of the first"));
 	printf (" %s\n\n", _("column in the first row is used as the check result."));
 
+	printf (" %s\n", _("With several -q each is checked against its own thresholds, and a summary"));
+	printf (" %s\n", _("is printed with a line for each query after it. They are sent all at once"));
+	printf (" %s\n", _("in libpq's pipeline mode where libpq has it (PostgreSQL 14 and later), so"));
+	printf (" %s\n", _("each must then be a single SQL command."));
+	printf ("\n");
+
+	printf (" %s\n", _("With --repeat the minimum, median, percentile and maximum latency of the"));
+	printf (" %s\n", _("runs are printed on a line of their own and in the perfdata. All of them"));
+	printf (" %s\n", _("have to fit in the timeout, pauses included."));
+	printf ("\n");
+
 	printf (" %s\n", _("See the chapter \"Monitoring Database Activity\" of the PostgreSQL manual"));
 	printf (" %s\n\n", _("for details about how to access internal statistics of the database server."));
 
@@ -583,7 +819,9 @@ print_usage (void)
 	printf ("%s\n", _("Usage:"));
 	printf ("%s [-H <host>] [-P <port>] [-c <critical time>] [-w <warning time>]\n", progname);
 	printf (" [-t <timeout>] [-d <database>] [-l <logname>] [-p <password>]\n"
-			"[-q <query>] [-C <critical query range>] [-W <warning query range>] [-r]\n");
+			"[-q <query> [-n <name>]] [-C <critical query range>] [-W <warning query range>] [-r]\n"
+			"[--repeat=<count> [--interval=<ms>] [--percentile=<p>] [--latency-warning=<range>]\n"
+			" [--latency-critical=<range>]] [--all-databases [--concurrency=<n>]]\n");
 }
 
 int
@@ -673,3 +911,456 @@ do_query (PGconn *conn, char *query)
 	return my_status;
 }
 
+
+/* PQconnectdb() with a deadline: the connection is made with
+ * PQconnectStart() and PQconnectPoll(), waiting on its socket until the
+ * connect timeout (one second less than the plugin timeout) instead of
+ * blocking until the alarm. NULL if it timed out. */
+PGconn *
+connect_db (const char *conninfo)
+{
+	PGconn *conn;
+	PostgresPollingStatusType poll_status = PGRES_POLLING_WRITING;
+	int64_t deadline = np_net_deadline (np_net_connect_timeout);
+
+	if ((conn = PQconnectStart (conninfo)) == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+
+	/* the socket may change as libpq tries each address of the host */
+	while (PQstatus (conn) != CONNECTION_BAD &&
+	       poll_status != PGRES_POLLING_OK && poll_status != PGRES_POLLING_FAILED) {
+		if (np_net_wait (PQsocket (conn), poll_status == PGRES_POLLING_READING ? POLLIN : POLLOUT,
+		                 deadline) == 0) {
+			PQfinish (conn);
+			return NULL;
+		}
+		poll_status = PQconnectPoll (conn);
+	}
+	return conn;
+}
+
+/* the first column of the first row of a result, against the thresholds
+ * of the query, as for a single -q */
+static void
+check_result (PGconn *conn, PGresult *res, named_query *q)
+{
+	char *val_str, *endptr = NULL;
+
+	if (res == NULL || PGRES_TUPLES_OK != PQresultStatus (res)) {
+		q->state = STATE_CRITICAL;
+		xasprintf (&q->msg, "%s: %s", _("Error with query"),
+		           res != NULL ? PQresultErrorMessage (res) : PQerrorMessage (conn));
+		/* libpq's messages end with a newline */
+		q->msg[strcspn (q->msg, "\n")] = '\0';
+	} else if (PQntuples (res) < 1) {
+		q->state = STATE_WARNING;
+		xasprintf (&q->msg, "%s", _("No rows returned"));
+	} else if (PQnfields (res) < 1) {
+		q->state = STATE_WARNING;
+		xasprintf (&q->msg, "%s", _("No columns returned"));
+	} else if ((val_str = PQgetvalue (res, 0, 0)) == NULL) {
+		q->state = STATE_CRITICAL;
+		xasprintf (&q->msg, "%s", _("No data returned"));
+	} else {
+		q->value = strtod (val_str, &endptr);
+		if (endptr == val_str) {
+			q->state = STATE_CRITICAL;
+			xasprintf (&q->msg, "%s: %s", _("Is not a numeric"), val_str);
+		} else {
+			q->has_value = TRUE;
+			q->state = get_status (q->value, q->thresholds);
+			xasprintf (&q->msg, _("'%s' returned %f"), q->sql, q->value);
+			if (verbose)
+				printf ("Query result of %s: %f\n", q->name, q->value);
+		}
+	}
+	PQclear (res);
+}
+
+/* Runs every -q over the connection and prints a summary and a line for
+ * each. With pipeline mode they all go out before the first result is
+ * read, each with a sync of its own so that an error stops only its own
+ * query, and the time of each is from the result before it. */
+int
+check_queries (PGconn *conn)
+{
+	struct timeval tv;
+	char *problems = NULL, *label;
+	int i, status = STATE_OK, count_ok = 0;
+	np_perfdata perf;
+	named_query *q;
+
+	gettimeofday (&tv, NULL);
+#ifdef LIBPQ_HAS_PIPELINING
+	if (PQenterPipelineMode (conn)) {
+		int sent;
+
+		if (verbose)
+			printf ("Sending %d queries in pipeline mode\n", query_count);
+		for (sent = 0; sent < query_count; sent++)
+			if (!PQsendQueryParams (conn, queries[sent].sql, 0, NULL, NULL, NULL, NULL, 0) ||
+			    !PQpipelineSync (conn))
+				break;
+		for (i = 0; i < query_count; i++) {
+			PGresult *res;
+
+			q = &queries[i];
+			if (i >= sent) {
+				q->state = STATE_CRITICAL;
+				xasprintf (&q->msg, "%s: %s", _("Could not send query"), PQerrorMessage (conn));
+				q->msg[strcspn (q->msg, "\n")] = '\0';
+				continue;
+			}
+			/* the result of the query, then NULL at its end and that
+			 * of its sync */
+			res = PQgetResult (conn);
+			q->time = delta_time (tv);
+			gettimeofday (&tv, NULL);
+			check_result (conn, res, q);
+			if (res != NULL)
+				PQclear (PQgetResult (conn));
+			PQclear (PQgetResult (conn));
+		}
+		PQexitPipelineMode (conn);
+	} else
+#endif
+	for (i = 0; i < query_count; i++) {
+		q = &queries[i];
+		if (verbose)
+			printf ("Executing SQL query \"%s\".\n", q->sql);
+		gettimeofday (&tv, NULL);
+		check_result (conn, PQexec (conn, q->sql), q);
+		q->time = delta_time (tv);
+	}
+
+	np_perfdata_init (&perf);
+	for (i = 0; i < query_count; i++) {
+		q = &queries[i];
+		status = max_state (status, q->state);
+		if (q->state == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           q->name, q->msg);
+		if (q->has_value)
+			np_perfdata_addf (&perf, q->name, q->value, "",
+			                  q->thresholds->warning != NULL, q->thresholds->warning ? q->thresholds->warning->end : 0,
+			                  q->thresholds->critical != NULL, q->thresholds->critical ? q->thresholds->critical->end : 0,
+			                  FALSE, 0, FALSE, 0);
+		xasprintf (&label, "%s_time", q->name);
+		np_perfdata_addf (&perf, label, q->time, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+		free (label);
+	}
+
+	printf ("QUERY %s: %d of %d %s%s%s|%s\n", state_text (status), count_ok, query_count,
+	        _("queries OK"), problems ? " - " : "", problems ? problems : "",
+	        np_perfdata_string (&perf));
+	for (i = 0; i < query_count; i++)
+		printf ("[%s] %s: %s (%.6f seconds)\n", state_text (queries[i].state), queries[i].name,
+		        queries[i].msg, queries[i].time);
+	np_perfdata_free (&perf);
+	return status;
+}
+
+/* Runs the query again and again, repeat times, pausing repeat_interval
+ * milliseconds in between, and prints a line on the spread of their
+ * times, counted in a histogram so that any number of runs takes the same
+ * memory. The state is that of --percentile against the latency
+ * thresholds; an error stops the runs and is CRITICAL. */
+int
+check_latency (PGconn *conn, const char *query)
+{
+	np_histogram *h;
+	np_perfdata perf;
+	struct timeval tv;
+	struct timespec pause;
+	PGresult *res;
+	char *msg;
+	int i, status;
+
+	if ((h = malloc (sizeof (np_histogram))) == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	np_histogram_init (h);
+	if (verbose)
+		printf ("Running \"%s\" %d times\n", query, repeat);
+	for (i = 0; i < repeat; i++) {
+		if (i > 0 && repeat_interval > 0) {
+			pause.tv_sec = repeat_interval / 1000;
+			pause.tv_nsec = repeat_interval % 1000 * 1000000L;
+			while (nanosleep (&pause, &pause) == -1 && errno == EINTR)
+				;
+		}
+		gettimeofday (&tv, NULL);
+		res = PQexec (conn, query);
+		if (PQresultStatus (res) != PGRES_TUPLES_OK && PQresultStatus (res) != PGRES_COMMAND_OK) {
+			printf (_("LATENCY %s - %s: %s"), _("CRITICAL"), _("Error with query"),
+			        PQerrorMessage (conn));
+			PQclear (res);
+			free (h);
+			return STATE_CRITICAL;
+		}
+		PQclear (res);
+		np_histogram_add (h, delta_time (tv));
+	}
+
+	np_perfdata_init (&perf);
+	status = np_latency_report (h, "latency", latency_percentile, latency_warning,
+	                            latency_critical, lthresholds, &msg, &perf);
+	printf ("LATENCY %s - %s|%s\n", state_text (status), msg, np_perfdata_string (&perf));
+	np_perfdata_free (&perf);
+	free (msg);
+	free (h);
+	return status;
+}
+
+/* --all-databases: a database of the sweep, from its connection to the
+ * result of the -q on it */
+enum {
+	PG_STEP_CONNECT,
+	PG_STEP_QUERY,
+	PG_STEP_DONE
+};
+
+typedef struct pg_database {
+	char *name;
+	PGconn *conn;
+	int step;
+	PostgresPollingStatusType poll_status;
+	short events;
+	int64_t deadline;
+	struct timeval start;
+	double time;        /* to connect */
+	PGresult *last;     /* of the query so far, the last one counts */
+	named_query q;
+	int state;
+	char *msg;
+} pg_database;
+
+static void
+pg_database_done (pg_database *d, int state, const char *msg, const char *detail)
+{
+	/* detail may be the connection's */
+	if (msg) {
+		xasprintf (&d->msg, "%s%s%s", msg, detail ? ": " : "", detail ? detail : "");
+		/* libpq's messages end with a newline */
+		d->msg[strcspn (d->msg, "\n")] = '\0';
+	}
+	if (d->last)
+		PQclear (d->last);
+	d->last = NULL;
+	if (d->conn)
+		PQfinish (d->conn);
+	d->conn = NULL;
+	d->step = PG_STEP_DONE;
+	d->state = max_state (d->state, state);
+}
+
+/* PQconnectStartParams() with the -H, -P, -l, -p and -o of the check and
+ * the database's name in place of -d's */
+static void
+pg_database_start (pg_database *d, const char *conninfo)
+{
+	const char *keywords[] = { "dbname", "dbname", NULL };
+	const char *values[3];
+
+	values[0] = conninfo;
+	values[1] = d->name;
+	values[2] = NULL;
+	gettimeofday (&d->start, NULL);
+	d->deadline = np_net_deadline (np_net_connect_timeout);
+	if ((d->conn = PQconnectStartParams (keywords, values, 1)) == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	d->step = PG_STEP_CONNECT;
+	d->events = POLLOUT;
+	if (PQstatus (d->conn) == CONNECTION_BAD)
+		pg_database_done (d, STATE_CRITICAL, _("No connection"), PQerrorMessage (d->conn));
+}
+
+/* move a database on as far as it goes without blocking */
+static void
+pg_database_step (pg_database *d)
+{
+	PGresult *res;
+
+	switch (d->step) {
+	case PG_STEP_CONNECT:
+		d->poll_status = PQconnectPoll (d->conn);
+		if (d->poll_status == PGRES_POLLING_FAILED) {
+			pg_database_done (d, STATE_CRITICAL, _("No connection"), PQerrorMessage (d->conn));
+			return;
+		}
+		if (d->poll_status != PGRES_POLLING_OK) {
+			d->events = d->poll_status == PGRES_POLLING_READING ? POLLIN : POLLOUT;
+			return;
+		}
+		d->time = delta_time (d->start);
+		d->state = d->time > tcrit ? STATE_CRITICAL : d->time > twarn ? STATE_WARNING : STATE_OK;
+		if (verbose)
+			printf ("Connected to database %s in %f sec.\n", d->name, d->time);
+		if (pgquery == NULL) {
+			pg_database_done (d, STATE_OK, NULL, NULL);
+			return;
+		}
+		if (PQsetnonblocking (d->conn, 1) != 0 || !PQsendQuery (d->conn, pgquery)) {
+			pg_database_done (d, STATE_CRITICAL, _("Could not send query"), PQerrorMessage (d->conn));
+			return;
+		}
+		d->deadline = np_net_deadline (np_net_io_timeout);
+		d->step = PG_STEP_QUERY;
+		/* FALLTHROUGH */
+
+	case PG_STEP_QUERY:
+		if (PQflush (d->conn) == 1) {
+			d->events = POLLIN | POLLOUT;
+			return;
+		}
+		d->events = POLLIN;
+		if (!PQconsumeInput (d->conn)) {
+			pg_database_done (d, STATE_CRITICAL, _("Error with query"), PQerrorMessage (d->conn));
+			return;
+		}
+		while (!PQisBusy (d->conn)) {
+			if ((res = PQgetResult (d->conn)) == NULL) {
+				check_result (d->conn, d->last, &d->q);
+				d->last = NULL;
+				pg_database_done (d, d->q.state, NULL, NULL);
+				return;
+			}
+			if (d->last)
+				PQclear (d->last);
+			d->last = res;
+		}
+		return;
+
+	default:
+		return;
+	}
+}
+
+/* The databases of the server that take connections, connected to and
+ * queried at --concurrency at a time from the one process; the summary
+ * and a line for each, with conn the connection to -d that lists them */
+int
+check_databases (PGconn *conn, const char *conninfo, double list_time)
+{
+	PGresult *res;
+	pg_database *dbs, **active;
+	struct pollfd *pfd;
+	np_perfdata perf;
+	char *problems = NULL, *label;
+	nfds_t nactive = 0, i, j;
+	int count, next = 0, done = 0, count_ok = 0, status = STATE_OK;
+	int k, wait, ms;
+
+	res = PQexec (conn, "SELECT datname FROM pg_database WHERE datallowconn AND NOT datistemplate"
+	                    " ORDER BY datname");
+	if (PQresultStatus (res) != PGRES_TUPLES_OK) {
+		printf (_("CRITICAL - Could not list the databases: %s"), PQerrorMessage (conn));
+		PQclear (res);
+		return STATE_CRITICAL;
+	}
+	count = PQntuples (res);
+	dbs = calloc (count ? count : 1, sizeof (*dbs));
+	active = calloc (db_concurrency, sizeof (*active));
+	pfd = calloc (db_concurrency, sizeof (*pfd));
+	if (!dbs || !active || !pfd)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	for (k = 0; k < count; k++) {
+		dbs[k].name = strdup (PQgetvalue (res, k, 0));
+		dbs[k].q.name = dbs[k].name;
+		dbs[k].q.sql = pgquery;
+		dbs[k].q.thresholds = qthresholds;
+	}
+	PQclear (res);
+	if (verbose)
+		printf ("Checking %d databases, %d at a time\n", count, db_concurrency);
+
+	while (done < count) {
+		while (nactive < (nfds_t) db_concurrency && next < count) {
+			pg_database_start (&dbs[next], conninfo);
+			if (dbs[next].step == PG_STEP_DONE)
+				done++;
+			else
+				active[nactive++] = &dbs[next];
+			next++;
+		}
+		if (nactive == 0)
+			continue;
+
+		wait = -1;
+		for (i = 0; i < nactive; i++) {
+			/* the socket may change as libpq tries each address of the host */
+			pfd[i].fd = PQsocket (active[i]->conn);
+			pfd[i].events = active[i]->events;
+			pfd[i].revents = 0;
+			ms = np_net_time_left (active[i]->deadline);
+			if (wait < 0 || ms < wait)
+				wait = ms;
+		}
+
+		if (poll (pfd, nactive, wait) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, "%s %s\n", _("poll failed:"), strerror (errno));
+
+		for (i = 0; i < nactive; i++) {
+			if (pfd[i].revents)
+				pg_database_step (active[i]);
+			else if (np_net_time_left (active[i]->deadline) == 0)
+				pg_database_done (active[i], STATE_CRITICAL, active[i]->step == PG_STEP_CONNECT
+				                  ? _("Connection timed out") : _("Query timed out"), NULL);
+		}
+
+		/* drop the finished ones */
+		for (i = j = 0; i < nactive; i++) {
+			if (active[i]->step == PG_STEP_DONE)
+				done++;
+			else
+				active[j++] = active[i];
+		}
+		nactive = j;
+	}
+
+	np_perfdata_init (&perf);
+	np_perfdata_addf (&perf, "time", list_time, "s",
+	                  !!(twarn > 0.0), twarn, !!(tcrit > 0.0), tcrit, TRUE, 0, FALSE, 0);
+	for (k = 0; k < count; k++) {
+		status = max_state (status, dbs[k].state);
+		if (dbs[k].state == STATE_OK)
+			count_ok++;
+		else if (dbs[k].msg || (dbs[k].q.msg && dbs[k].q.state != STATE_OK))
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           dbs[k].name, dbs[k].msg ? dbs[k].msg : dbs[k].q.msg);
+		else
+			xasprintf (&problems, _("%s%s%s: %f sec. to connect"), problems ? problems : "",
+			           problems ? "; " : "", dbs[k].name, dbs[k].time);
+		if (dbs[k].time == 0)
+			continue;
+		xasprintf (&label, "%s_time", dbs[k].name);
+		np_perfdata_addf (&perf, label, dbs[k].time, "s",
+		                  !!(twarn > 0.0), twarn, !!(tcrit > 0.0), tcrit, TRUE, 0, FALSE, 0);
+		free (label);
+		if (dbs[k].q.has_value)
+			np_perfdata_addf (&perf, dbs[k].name, dbs[k].q.value, "",
+			                  qthresholds->warning != NULL, qthresholds->warning ? qthresholds->warning->end : 0,
+			                  qthresholds->critical != NULL, qthresholds->critical ? qthresholds->critical->end : 0,
+			                  FALSE, 0, FALSE, 0);
+	}
+
+	printf ("%s: %d of %d %s%s%s|%s\n", state_text (status), count_ok, count, _("databases OK"),
+	        problems ? " - " : "", problems ? problems : "", np_perfdata_string (&perf));
+	for (k = 0; k < count; k++) {
+		if (dbs[k].msg)
+			printf ("[%s] %s: %s\n", state_text (dbs[k].state), dbs[k].name, dbs[k].msg);
+		else
+			printf (_("[%s] %s: %f sec.%s%s\n"), state_text (dbs[k].state), dbs[k].name, dbs[k].time,
+			        dbs[k].q.msg ? ", " : "", dbs[k].q.msg ? dbs[k].q.msg : "");
+		free (dbs[k].q.msg);
+		free (dbs[k].msg);
+		free (dbs[k].name);
+	}
+	np_perfdata_free (&perf);
+	free (problems);
+	free (dbs);
+	free (active);
+	free (pfd);
+	return status;
+}
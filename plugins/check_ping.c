@@ -9,7 +9,8 @@
 * 
 * This file contains the check_ping plugin
 * 
-* Use the ping program to check connection statistics for a remote host.
+* Check connection statistics for a remote host, with ICMP sockets of its
+* own where the system allows them and the ping program where it does not.
 * 
 * 
 * This program is free software: you can redistribute it and/or modify
@@ -34,11 +35,13 @@ const char *email = "devel@nagios-plugins.org";
 
 #include "common.h"
 #include "netutils.h"
+#include "icmputils.h"
 #include "popen.h"
 #include "utils.h"
 
 #define WARN_DUPLICATES "DUPLICATES FOUND! "
 #define UNKNOWN_TRIP_TIME -1.0	/* -1 seconds */
+#define PING_INTERVAL 200	/* milliseconds between packets, the least ping(8) allows users */
 
 enum {
 	UNKNOWN_PACKET_LOSS = 200,    /* 200% */
@@ -48,6 +51,8 @@ enum {
 int process_arguments (int, char **);
 int get_threshold (char *, float *, int *);
 int validate_arguments (void);
+int ping_native (const char *addr);
+int ping_command (const char *addr);
 int run_ping (const char *cmd, const char *addr);
 int error_scan (char buf[MAX_INPUT_BUFFER], const char *addr);
 void print_usage (void);
@@ -77,17 +82,10 @@ char *warn_text;
 int
 main (int argc, char **argv)
 {
-	char *cmd = NULL;
-	char *rawcmd = NULL;
 	int result = STATE_UNKNOWN;
 	int this_result = STATE_UNKNOWN;
 	int i;
 
-	setlocale (LC_ALL, "");
-	setlocale (LC_NUMERIC, "C");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	addresses = malloc (sizeof(char*) * max_addr);
 	addresses[0] = NULL;
 
@@ -98,7 +96,7 @@ main (int argc, char **argv)
 		usage4 (_("Could not parse arguments"));
 
 	/* Set signal handling and alarm */
-	if (signal (SIGALRM, popen_timeout_alarm_handler) == SIG_ERR) {
+	if (signal (SIGALRM, timeout_alarm_handler) == SIG_ERR) {
 		usage4 (_("Cannot catch SIGALRM"));
 	}
 
@@ -112,31 +110,9 @@ main (int argc, char **argv)
 
 	for (i = 0 ; i < n_addresses ; i++) {
 
-#ifdef PING6_COMMAND
-		if (address_family != AF_INET && is_inet6_addr(addresses[i]))
-			rawcmd = strdup(PING6_COMMAND);
-		else
-			rawcmd = strdup(PING_COMMAND);
-#else
-		rawcmd = strdup(PING_COMMAND);
-#endif
-
-		/* does the host address of number of packets argument come first? */
-#ifdef PING_PACKETS_FIRST
-# ifdef PING_HAS_TIMEOUT
-		xasprintf (&cmd, rawcmd, timeout_interval, max_packets, addresses[i]);
-# else
-		xasprintf (&cmd, rawcmd, max_packets, addresses[i]);
-# endif
-#else
-		xasprintf (&cmd, rawcmd, addresses[i], max_packets);
-#endif
-
-		if (verbose >= 2)
-			printf ("CMD: %s\n", cmd);
-
-		/* run the command */
-		this_result = run_ping (cmd, addresses[i]);
+		/* the ping command when there are no ICMP sockets to use */
+		if ((this_result = ping_native (addresses[i])) < 0)
+			this_result = ping_command (addresses[i]);
 
 		if (pl == UNKNOWN_PACKET_LOSS || rta < 0.0) {
 			die (STATE_UNKNOWN,
@@ -184,8 +160,6 @@ main (int argc, char **argv)
 			printf ("%f:%d%% %f:%d%%\n", wrta, wpl, crta, cpl);
 
 		result = max_state (result, this_result);
-		free (rawcmd);
-		free (cmd);
 	}
 
 	return result;
@@ -439,6 +413,126 @@ validate_arguments ()
 
 
 
+/* Pings addr with the ping command configure found */
+int
+ping_command (const char *addr)
+{
+	char *cmd = NULL;
+	char *rawcmd = NULL;
+	int result;
+
+	/* the ping command has a child to kill on timeouts */
+	signal (SIGALRM, popen_timeout_alarm_handler);
+
+#ifdef PING6_COMMAND
+	if (address_family != AF_INET && is_inet6_addr(addr))
+		rawcmd = strdup(PING6_COMMAND);
+	else
+		rawcmd = strdup(PING_COMMAND);
+#else
+	rawcmd = strdup(PING_COMMAND);
+#endif
+
+	/* does the host address of number of packets argument come first? */
+#ifdef PING_PACKETS_FIRST
+# ifdef PING_HAS_TIMEOUT
+	xasprintf (&cmd, rawcmd, timeout_interval, max_packets, addr);
+# else
+	xasprintf (&cmd, rawcmd, max_packets, addr);
+# endif
+#else
+	xasprintf (&cmd, rawcmd, addr, max_packets);
+#endif
+
+	if (verbose >= 2)
+		printf ("CMD: %s\n", cmd);
+
+	/* run the command */
+	result = run_ping (cmd, addr);
+	free (rawcmd);
+	free (cmd);
+	return result;
+}
+
+
+
+/* Pings addr with the packets sent and read here: no command, and no
+ * output of one to make sense of. Returns -1 if there is no ICMP socket
+ * to do that with, for the ping command to do it instead. */
+int
+ping_native (const char *addr)
+{
+	np_icmp_host host;
+	np_icmp_options opts;
+	int left;
+
+	if (np_icmp_resolve (&host, addr, address_family) != 0)
+		die (STATE_CRITICAL, _("CRITICAL - Host not found (%s)\n"), addr);
+
+	memset (&opts, 0, sizeof (opts));
+	opts.packets = max_packets;
+	opts.interval = PING_INTERVAL;
+	opts.size = NP_ICMP_DEFAULT_SIZE;
+	opts.verbose = verbose >= 3;
+	/* a reply may take twice the critical RTA, or a second, as long as
+	 * the last one is in before the timeout */
+	opts.wait = crta * 2 > 1000 ? (unsigned int) (crta * 2) : 1000;
+	left = timeout_interval * 1000 - (max_packets > 0 ? max_packets - 1 : 0) * PING_INTERVAL - 500;
+	if ((int) opts.wait > left)
+		opts.wait = left > 100 ? left : 100;
+
+	getnameinfo ((struct sockaddr *) &host.addr, host.addrlen, ping_ip_addr, sizeof (ping_ip_addr),
+	             NULL, 0, NI_NUMERICHOST);
+	snprintf (ping_name, sizeof (ping_name), "%s", addr);
+	if (verbose >= 2)
+		printf ("ICMP: %s (%s), %d packets\n", ping_name, ping_ip_addr, max_packets);
+
+	if (np_icmp_ping (&host, 1, &opts) < 0) {
+		if (verbose >= 2)
+			printf (_("No ICMP socket (%s), running ping\n"), strerror (errno));
+		return -1;
+	}
+
+	switch (host.error) {
+	case NP_ICMP_NET_UNREACH:
+		die (STATE_CRITICAL, _("CRITICAL - Network Unreachable (%s)\n"), addr);
+	case NP_ICMP_HOST_UNREACH:
+		die (STATE_CRITICAL, _("CRITICAL - Host Unreachable (%s)\n"), addr);
+	case NP_ICMP_PORT_UNREACH:
+		die (STATE_CRITICAL, _("CRITICAL - Bogus ICMP: Port Unreachable (%s)\n"), addr);
+	case NP_ICMP_PROTO_UNREACH:
+		die (STATE_CRITICAL, _("CRITICAL - Bogus ICMP: Protocol Unreachable (%s)\n"), addr);
+	case NP_ICMP_NET_PROHIB:
+		die (STATE_CRITICAL, _("CRITICAL - Network Prohibited (%s)\n"), addr);
+	case NP_ICMP_HOST_PROHIB:
+		die (STATE_CRITICAL, _("CRITICAL - Host Prohibited (%s)\n"), addr);
+	case NP_ICMP_FILTERED:
+		die (STATE_CRITICAL, _("CRITICAL - Packet Filtered (%s)\n"), addr);
+	case NP_ICMP_TTL_EXCEEDED:
+		die (STATE_CRITICAL, _("CRITICAL - Time to live exceeded (%s)\n"), addr);
+	case NP_ICMP_UNREACH:
+		die (STATE_CRITICAL, _("CRITICAL - Destination Unreachable (%s)\n"), addr);
+	}
+
+	if (host.sent > 0) {
+		pl = (host.sent - host.received) * 100 / host.sent;
+		/* there is no rta if all packets are lost */
+		rta = host.received ? host.rtt_sum / host.received : crta;
+	}
+
+	if (warn_text == NULL)
+		warn_text = strdup ("");
+	if (host.duplicates) {
+		if (! strstr (warn_text, _(WARN_DUPLICATES)) &&
+		    xasprintf (&warn_text, "%s%s", warn_text, _(WARN_DUPLICATES)) == -1)
+			die (STATE_UNKNOWN, _("Unable to realloc warn_text\n"));
+		return STATE_WARNING;
+	}
+	return STATE_OK;
+}
+
+
+
 int
 run_ping (const char *cmd, const char *addr)
 {
@@ -580,7 +674,7 @@ print_help (void)
 	printf ("Copyright (c) 1999 Ethan Galstad <nagios@nagios.org>\n");
 	printf (COPYRIGHT, copyright, email);
 
-	printf (_("Use ping to check connection statistics for a remote host."));
+	printf (_("Ping a remote host to check its connection statistics."));
 
   printf ("\n\n");
 
@@ -613,8 +707,10 @@ print_help (void)
   printf ("%s\n", _("percentage of packet loss to trigger an alarm state."));
 
   printf ("\n");
-	printf ("%s\n", _("This plugin uses the ping command to probe the specified host for packet loss"));
-  printf ("%s\n", _("(percentage) and round trip average (milliseconds). It can produce HTML output"));
+	printf ("%s\n", _("This plugin sends ICMP ECHO packets to the specified host for packet loss"));
+  printf ("%s\n", _("(percentage) and round trip average (milliseconds), through ICMP sockets where"));
+  printf ("%s\n", _("the system allows them (net.ipv4.ping_group_range on Linux) and otherwise"));
+  printf ("%s\n", _("with the ping command. It can produce HTML output"));
   printf ("%s\n", _("linking to a traceroute CGI contributed by Ian Cass. The CGI can be found in"));
   printf ("%s\n", _("the contrib area of the downloads section at http://www.nagios.org/"));
 
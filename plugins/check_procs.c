@@ -39,7 +39,9 @@ const char *email = "devel@nagios-plugins.org";
 #include "common.h"
 #include "utils.h"
 #include "utils_cmd.h"
-#include "regex.h"
+#include "utils_proc.h"
+#include "utils_regex.h"
+#include "resident.h"
 
 #include <pwd.h>
 #include <errno.h>
@@ -48,17 +50,15 @@ const char *email = "devel@nagios-plugins.org";
 #include <sys/stat.h>
 #endif
 
+
+static int run_check (int, char **);
+static void reset_state (void);
 int process_arguments (int, char **);
 int validate_arguments (void);
 int convert_to_seconds (char *); 
 void print_help (void);
 void print_usage (void);
 
-char *warning_range = NULL;
-char *critical_range = NULL;
-thresholds *procs_thresholds = NULL;
-
-int options = 0; /* bitmask of filter criteria to test against */
 #define ALL 1
 #define STAT 2
 #define PPID 4
@@ -78,7 +78,6 @@ int options = 0; /* bitmask of filter criteria to test against */
 							ppid of procs are compared to pid of this proc*/
 
 /* Different metrics */
-char *metric_name;
 enum metric {
 	METRIC_PROCS,
 	METRIC_VSZ,
@@ -86,29 +85,111 @@ enum metric {
 	METRIC_CPU,
 	METRIC_ELAPSED
 };
-enum metric metric = METRIC_PROCS;
+
+/* What the processes of one cgroup add up to, with --group-by=cgroup */
+struct procs_group {
+	char *name;
+	int procs;
+	int vsz;
+	int rss;
+	float pcpu;
+	int seconds; /* of the oldest */
+	int result;
+	struct procs_group *next; /* in its hash bucket */
+};
+
+#define GROUP_BUCKETS 1024
+
+/* One set of filters with its metric and thresholds, and what the scan
+ * counted for it. The command line is one rule; --rule and --rule-file
+ * give several, all evaluated in the same scan */
+struct procs_rule {
+	char *name; /* NULL for the command line's rule */
+	int options; /* bitmask of filter criteria to test against */
+	int uid;
+	pid_t ppid;
+	int vsz;
+	int rss;
+	float pcpu;
+	int jid;
+	char *statopts;
+	char *prog;
+	char *exclude_progs;
+	char **exclude_progs_arr;
+	int exclude_progs_counter;
+	char *cgroup_hierarchy;
+	char *args;
+	np_regex_t re_args;
+	int kthread_filter;
+	enum metric metric;
+	char *metric_name;
+	char *warning_range;
+	char *critical_range;
+	thresholds *procs_thresholds;
+	char *fmt;
+	np_strbuf fails; /* what is over the thresholds, comma separated */
+	int group_by; /* thresholds per cgroup rather than per process */
+	int group_depth; /* of the cgroup path, 0 for all of it */
+	struct procs_group **group_table;
+	struct procs_group **groups; /* in the order they were found */
+	int ngroups;
+
+	int procs; /* counter for number of processes meeting filter criteria */
+	int warn; /* number of processes in warn state */
+	int crit; /* number of processes in crit state */
+	int result;
+	int total_procvsz;
+	int total_procrss;
+	int total_procseconds;
+	float total_procpcpu;
+	struct procs_rule *next;
+};
+
+struct procs_rule *rules = NULL;
+struct procs_rule *last_rule = NULL;
+
+/* the fields of the process being looked at */
+#define PROC_STATUS 1
+#define PROC_ARGS 2
+#define PROC_CGROUP 4
+#define PROC_LIVE 8 /* what the process table of a resident worker has to read again */
+struct proc_info {
+	int uid;
+	pid_t pid;
+	pid_t ppid;
+	int jid;
+	int vsz;
+	int rss;
+	float pcpu;
+	int seconds;
+	char *stat;
+	char *prog;
+	char *args;
+	char *cgroup;
+	char *etime;
+	int loaded; /* PROC_ flags of what has been read, on the /proc path */
+	int self; /* whether it is ourselves, -1 until looked up */
+};
+
+enum {
+	RULES_MULTILINE,
+	RULES_PASSIVE
+};
+int rule_output = RULES_MULTILINE;
+char *passive_host = NULL;
 
 int verbose = 0;
-int uid;
-pid_t ppid;
-int vsz;
-int rss;
-float pcpu;
-char *statopts;
-char *prog;
-char *exclude_progs;
-char ** exclude_progs_arr = NULL;
-char exclude_progs_counter = 0; 
-char *cgroup_hierarchy;
-char *args;
 char *input_filename = NULL;
-regex_t re_args;
-char *fmt;
-char *fails;
 char tmp[MAX_INPUT_BUFFER];
-int kthread_filter = 0;
 int usepid = 0; /* whether to test for pid or /proc/pid/exe */
-int jid;
+int use_ps = 0; /* run PS_COMMAND even where /proc can be read directly */
+int lazy; /* whether fields are read only once the filters need them */
+int cpu_delta = FALSE; /* %CPU since the last run, from the state file */
+int cpu_sample = 0; /* or since a scan this many ms before */
+int snapshot_age = 0; /* --snapshot: the oldest a shared snapshot may be */
+int elapsed_metric = FALSE; /* whether a rule has --metric=ELAPSED */
+dev_t mydev = 0;
+ino_t myino = 0;
 
 FILE *ps_input = NULL;
 
@@ -123,10 +204,493 @@ stat_exe (const pid_t pid, struct stat *buf) {
 }
 
 
+#ifdef __linux__
+np_proc_scan proc_scan;
+np_proc_entry entry;
+np_proc_cpu cpu;
+np_proc_snapshot snapshot;
+#endif
+int native = FALSE; /* whether the processes come from proc_scan */
+int from_snapshot = FALSE; /* or from the shared snapshot, all read already */
+#ifdef __linux__
+np_proc_table *table = NULL; /* or from the table a resident worker keeps */
+np_proc_table_entry *table_entry = NULL;
+
+/* The table is one of the worker's pooled connections, kept open for as
+ * long as the worker runs */
+static int
+proc_table_fd (void *t)
+{
+	return ((np_proc_table *) t)->fd;
+}
+
+static void
+proc_table_close (void *t)
+{
+	np_proc_table_free (t);
+	free (t);
+}
+
+static const np_pool_ops proc_table_ops = { proc_table_fd, NULL, proc_table_close, TRUE };
+
+/* the worker's table, brought up to date; NULL if /proc cannot be read */
+static np_proc_table *
+proc_table_get (void)
+{
+	np_proc_table *t;
+
+	if ((t = np_pool_get ("procs", &proc_table_ops)) == NULL) {
+		if ((t = malloc (sizeof (*t))) == NULL)
+			die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+		np_proc_table_init (t);
+		if (!np_proc_table_listen (t) && verbose >= 2)
+			printf (_("No process events, the table is scanned at each check\n"));
+		np_pool_add ("procs", t, &proc_table_ops);
+	}
+	if (!np_proc_table_update (t)) {
+		np_pool_close (t, &proc_table_ops);
+		return NULL;
+	}
+	return t;
+}
+#endif
+
+/* read the fields in what that the scan has not read yet, FALSE (and the
+ * process taken as gone) if it has gone meanwhile */
+static int
+proc_load (struct proc_info *p, int what)
+{
+	what &= ~p->loaded;
+	if (what == 0)
+		return TRUE;
+	p->loaded |= what;
+#ifdef __linux__
+	if (table_entry) {
+		/* all but what changes without an event is in the table */
+		if (!np_proc_table_live (table, table_entry)) {
+			p->self = 1;
+			return FALSE;
+		}
+		p->uid = table_entry->pe.uid;
+		p->vsz = table_entry->pe.vsz;
+		p->rss = table_entry->pe.rss;
+		p->pcpu = table_entry->pe.pcpu;
+		p->seconds = table_entry->pe.seconds;
+		p->stat = table_entry->pe.stat;
+		return TRUE;
+	}
+	if (native) {
+		if (((what & PROC_STATUS) && !np_proc_scan_status (&proc_scan, &entry)) ||
+		    ((what & PROC_ARGS) && !np_proc_scan_args (&proc_scan, &entry))) {
+			p->self = 1;
+			return FALSE;
+		}
+		if (what & PROC_CGROUP)
+			np_proc_scan_cgroup (&proc_scan, &entry);
+		p->uid = entry.uid;
+		p->rss = entry.rss;
+		p->args = entry.args;
+		p->cgroup = entry.cgroup;
+		return TRUE;
+	}
+#endif
+	/* the args are the rest of the ps line, used where they are */
+	if (what & PROC_ARGS)
+		strip (p->args);
+	return TRUE;
+}
+
+/* whether a process passes all filters of a rule, rejecting it on the
+ * first one it fails, the ones on fields that are cheap to get first */
+static int
+rule_match (struct procs_rule *r, struct proc_info *p, pid_t kthread_ppid)
+{
+	struct stat statbuf;
+	char *tmp;
+	int i, ret = 0;
+
+	if (p->self == 1)
+		return FALSE;
+
+	/* filter kernel threads (childs of KTHREAD_PARENT)*/
+	/* TODO adapt for other OSes than GNU/Linux
+			sorry for not doing that, but I've no other OSes to test :-( */
+	if (r->kthread_filter == 1 && kthread_ppid == p->ppid) {
+		if (verbose >= 2)
+			printf ("Ignore kernel thread: pid=%d ppid=%d prog=%s args=%s\n", p->pid, p->ppid, p->prog, p->args);
+		return FALSE;
+	}
+
+	/* Ignore excluded processes by name */
+	if (r->options & EXCLUDE_PROGS) {
+		for (i = 0; i < r->exclude_progs_counter; i++)
+			if (!strcmp (p->prog, r->exclude_progs_arr[i]))
+				break;
+		if (i < r->exclude_progs_counter) {
+			if (verbose >= 3)
+				printf ("excluding - by ignorelist\n");
+			return FALSE;
+		}
+	}
+
+	if ((r->options & PROG) && strcmp (r->prog, p->prog) != 0)
+		return FALSE;
+	if ((r->options & PPID) && p->ppid != r->ppid)
+		return FALSE;
+	if ((r->options & JID) && p->jid != r->jid)
+		return FALSE;
+	if ((r->options & (VSZ | PCPU)) && !proc_load (p, PROC_LIVE))
+		return FALSE;
+	if ((r->options & VSZ) && p->vsz < r->vsz)
+		return FALSE;
+	if ((r->options & PCPU) && p->pcpu < r->pcpu)
+		return FALSE;
+
+	if ((r->options & USER) && !proc_load (p, PROC_STATUS))
+		return FALSE;
+	if ((r->options & USER) && p->uid != r->uid)
+		return FALSE;
+	if ((r->options & (RSS | STAT)) && !proc_load (p, PROC_STATUS | PROC_LIVE))
+		return FALSE;
+	if ((r->options & RSS) && p->rss < r->rss)
+		return FALSE;
+	if ((r->options & STAT) && strstr (r->statopts, p->stat) == NULL)
+		return FALSE;
+
+	if ((r->options & (ARGS | EREG_ARGS)) && !proc_load (p, PROC_ARGS))
+		return FALSE;
+	if ((r->options & ARGS) && strstr (p->args, r->args) == NULL)
+		return FALSE;
+	if ((r->options & EREG_ARGS) && np_regexec (&r->re_args, p->args, (size_t) 0, NULL, 0) != 0)
+		return FALSE;
+
+	if (r->options & CGROUP_HIERARCHY) {
+		proc_load (p, PROC_CGROUP);
+		if (!strncmp (p->cgroup, "-", 2)) {
+			if (strncmp (r->cgroup_hierarchy, "/", 2))
+				return FALSE;
+		} else if ((tmp = strstr (p->cgroup, ":/")) == NULL || strcmp (tmp + 1, r->cgroup_hierarchy))
+			return FALSE;
+	}
+
+	if ((r->metric == METRIC_VSZ || r->metric == METRIC_RSS || r->metric == METRIC_CPU) &&
+	    !proc_load (p, PROC_STATUS | PROC_LIVE))
+		return FALSE;
+
+	/* Ignore self, looked for by the executable only now that the process
+	 * would otherwise count */
+	if (p->self < 0) {
+		p->self = !usepid && (((ret = stat_exe(p->pid, &statbuf) != -1) && statbuf.st_dev == mydev && statbuf.st_ino == myino) ||
+		                      (ret == -1 && errno == ENOENT));
+		if (p->self && verbose >= 3)
+			printf("not considering - is myself or gone\n");
+	}
+	return !p->self;
+}
+
+/* the cgroup a process is grouped in: the unified (v2) hierarchy's path,
+ * or the first one's, cut to depth components */
+static void
+group_name (const char *cgroup, int depth, char *buf, size_t size)
+{
+	const char *entry, *path = NULL, *end;
+	size_t len, i;
+	int n = 0;
+
+	for (entry = cgroup; entry && *entry; entry = (end = strchr (entry, ',')) ? end + 1 : NULL) {
+		if ((end = strchr (entry, ':')) == NULL || (end = strchr (end + 1, ':')) == NULL)
+			continue;
+		if (path == NULL || !strncmp (entry, "0::", 3))
+			path = end + 1;
+		if (!strncmp (entry, "0::", 3))
+			break;
+	}
+	if (path == NULL || *path != '/')
+		path = "/";
+	len = strcspn (path, ",");
+	for (i = 1; depth > 0 && i < len; i++)
+		if (path[i] == '/' && ++n == depth)
+			len = i;
+	if (len >= size)
+		len = size - 1;
+	memcpy (buf, path, len);
+	buf[len] = '\0';
+}
+
+static void
+group_add (struct procs_rule *r, struct proc_info *p)
+{
+	struct procs_group *g;
+	char name[MAX_INPUT_BUFFER];
+	unsigned long h = 5381;
+	const char *c;
+
+	proc_load (p, PROC_CGROUP);
+	group_name (p->cgroup, r->group_depth, name, sizeof (name));
+	for (c = name; *c; c++)
+		h = h * 33 + (unsigned char) *c;
+	h %= GROUP_BUCKETS;
+
+	if (r->group_table == NULL && (r->group_table = calloc (GROUP_BUCKETS, sizeof (*r->group_table))) == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	for (g = r->group_table[h]; g; g = g->next)
+		if (!strcmp (g->name, name))
+			break;
+	if (g == NULL) {
+		if ((g = calloc (1, sizeof (*g))) == NULL || (g->name = strdup (name)) == NULL ||
+		    (r->groups = realloc (r->groups, (r->ngroups + 1) * sizeof (*r->groups))) == NULL)
+			die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+		g->next = r->group_table[h];
+		r->group_table[h] = g;
+		r->groups[r->ngroups++] = g;
+	}
+	g->procs++;
+	g->vsz += p->vsz;
+	g->rss += p->rss;
+	g->pcpu += p->pcpu;
+	if (p->seconds > g->seconds)
+		g->seconds = p->seconds;
+}
+
+static double
+group_value (struct procs_rule *r, struct procs_group *g)
+{
+	switch (r->metric) {
+	case METRIC_VSZ:
+		return g->vsz;
+	case METRIC_RSS:
+		return g->rss;
+	case METRIC_CPU:
+		return g->pcpu;
+	case METRIC_ELAPSED:
+		return g->seconds;
+	default:
+		return g->procs;
+	}
+}
+
+static int
+group_compare (const void *a, const void *b)
+{
+	return strcmp ((*(struct procs_group **) a)->name, (*(struct procs_group **) b)->name);
+}
+
+/* one more name in the list of those over the thresholds */
+static void
+rule_fails (struct procs_rule *r, const char *name)
+{
+	if (r->fails.len)
+		np_strbuf_puts (&r->fails, ", ");
+	np_strbuf_puts (&r->fails, name);
+}
+
+/* add a process that matched to the rule's counts */
+static void
+rule_count (struct procs_rule *r, struct proc_info *p)
+{
+	int i = STATE_OK;
+
+	r->procs++;
+	if (verbose >= 2) {
+		printf ("Matched: uid=%d vsz=%d rss=%d pid=%d ppid=%d jid=%d pcpu=%.2f stat=%s etime=%s prog=%s args=%s\n",
+			p->uid, p->vsz, p->rss,
+			p->pid, p->ppid, p->jid, p->pcpu, p->stat,
+			p->etime, p->prog, p->args);
+		if (strstr(PS_COMMAND, "cgroup") != NULL) {
+			printf(" cgroup_hierarchy=%s\n", r->cgroup_hierarchy);
+		} else {
+			printf("\n");
+		}
+	}
+
+	if (r->group_by) {
+		group_add (r, p);
+		return;
+	}
+
+	if (r->metric == METRIC_VSZ) {
+		i = get_status ((double)p->vsz, r->procs_thresholds);
+		r->total_procvsz += p->vsz;
+	} else if (r->metric == METRIC_RSS) {
+		i = get_status ((double)p->rss, r->procs_thresholds);
+		r->total_procrss += p->rss;
+	}
+	/* TODO? float thresholds for --metric=CPU */
+	else if (r->metric == METRIC_CPU) {
+		i = get_status (p->pcpu, r->procs_thresholds);
+		r->total_procpcpu += p->pcpu;
+	}
+	else if (r->metric == METRIC_ELAPSED) {
+		i = get_status ((double)p->seconds, r->procs_thresholds);
+		r->total_procseconds += p->seconds;
+	}
+	if (r->metric != METRIC_PROCS) {
+		if (i == STATE_WARNING) {
+			r->warn++;
+			rule_fails (r, p->prog);
+			r->result = max_state (r->result, i);
+		}
+		if (i == STATE_CRITICAL) {
+			r->crit++;
+			rule_fails (r, p->prog);
+			r->result = max_state (r->result, i);
+		}
+	}
+}
+
+/* the rule's state, once the scan is done */
+static void
+rule_finish (struct procs_rule *r)
+{
+	struct procs_group *g;
+	int i;
+
+	/* the thresholds are for each cgroup */
+	if (r->group_by) {
+		qsort (r->groups, r->ngroups, sizeof (*r->groups), group_compare);
+		r->result = STATE_OK;
+		for (i = 0; i < r->ngroups; i++) {
+			g = r->groups[i];
+			g->result = get_status (group_value (r, g), r->procs_thresholds);
+			if (g->result == STATE_WARNING)
+				r->warn++;
+			else if (g->result == STATE_CRITICAL)
+				r->crit++;
+			else
+				continue;
+			rule_fails (r, g->name);
+			r->result = max_state (r->result, g->result);
+		}
+		return;
+	}
+
+	if ( r->result == STATE_UNKNOWN )
+		r->result = STATE_OK;
+
+	/* Needed if procs found, but none match filter */
+	if ( r->metric == METRIC_PROCS ) {
+		r->result = max_state (r->result, get_status ((double)r->procs, r->procs_thresholds) );
+	}
+}
+
+static void
+print_rule (struct procs_rule *r)
+{
+	if (r->group_by) {
+		printf ("%s %s: ", r->metric_name, state_text (r->result));
+		if (r->result == STATE_CRITICAL)
+			printf (_("%d crit, %d warn out of "), r->crit, r->warn);
+		else if (r->result == STATE_WARNING)
+			printf (_("%d warn out of "), r->warn);
+		printf (ngettext ("%d cgroup", "%d cgroups", (unsigned long) r->ngroups), r->ngroups);
+		printf (ngettext (" with %d process", " with %d processes", (unsigned long) r->procs), r->procs);
+		if (strcmp(r->fmt,"") != 0)
+			printf (_(", %s"), r->fmt);
+		/* which groups it is, whatever the verbosity */
+		if (r->fails.len)
+			printf (" [%s]", np_strbuf_string (&r->fails));
+		return;
+	}
+
+	if ( r->result == STATE_OK ) {
+		printf ("%s %s: ", r->metric_name, _("OK"));
+	} else if (r->result == STATE_WARNING) {
+		printf ("%s %s: ", r->metric_name, _("WARNING"));
+		if ( r->metric != METRIC_PROCS ) {
+			printf (_("%d warn out of "), r->warn);
+		}
+	} else if (r->result == STATE_CRITICAL) {
+		printf ("%s %s: ", r->metric_name, _("CRITICAL"));
+		if (r->metric != METRIC_PROCS) {
+			printf (_("%d crit, %d warn out of "), r->crit, r->warn);
+		}
+	}
+	printf (ngettext ("%d process", "%d processes", (unsigned long) r->procs), r->procs);
+
+	if (strcmp(r->fmt,"") != 0) {
+		printf (_(" with %s"), r->fmt);
+	}
+
+	if ( verbose >= 1 && r->fails.len )
+		printf (" [%s]", np_strbuf_string (&r->fails));
+}
+
+/* the rule's perfdata, its labels prefixed with label_ if given */
+static void
+print_rule_perfdata (struct procs_rule *r, const char *label)
+{
+	const char *l = label ? label : "", *u = label ? "_" : "";
+	static const char *units[] = { "procs", "procvsz", "procrss", "procpcpu", "procseconds" };
+	int i;
+
+	if (r->group_by) {
+		printf ("%s%sprocs=%d;;;0; %s%scgroups=%d;;;0;", l, u, r->procs, l, u, r->ngroups);
+		for (i = 0; i < r->ngroups; i++)
+			printf (" '%s%s%s:%s'=%g;%s;%s;0;", l, u, units[r->metric], r->groups[i]->name,
+			        group_value (r, r->groups[i]),
+			        r->warning_range ? r->warning_range : "",
+			        r->critical_range ? r->critical_range : "");
+		return;
+	}
+
+	if (r->metric == METRIC_PROCS)
+		printf ("%s%sprocs=%d;%s;%s;0;", l, u, r->procs,
+				r->warning_range ? r->warning_range : "",
+				r->critical_range ? r->critical_range : "");
+	else {
+		printf ("%s%sprocs=%d;;;0; %s%sprocs_warn=%d;;;0; %s%sprocs_crit=%d;;;0;", l, u, r->procs, l, u, r->warn, l, u, r->crit);
+		if (r->metric == METRIC_VSZ)
+			printf (" %s%sprocvsz=%d;", l, u, r->total_procvsz);
+		else if (r->metric == METRIC_RSS)
+			printf (" %s%sprocrss=%d;", l, u, r->total_procrss);
+		else if (r->metric == METRIC_CPU)
+			printf (" %s%sprocpcpu=%f;", l, u, r->total_procpcpu);
+		else if (r->metric == METRIC_ELAPSED)
+			printf (" %s%sprocseconds=%d;", l, u, r->total_procseconds);
+	}
+}
+
+
 int
 main (int argc, char **argv)
 {
-	char *input_buffer;
+	if (np_resident_requested (argc, argv))
+		return np_resident_main (argc, argv, run_check, reset_state);
+
+	reset_state ();
+	return run_check (argc, argv);
+}
+
+
+static void
+reset_state (void)
+{
+	rules = last_rule = NULL;
+	rule_output = RULES_MULTILINE;
+	passive_host = NULL;
+	verbose = 0;
+	input_filename = NULL;
+	usepid = 0;
+	use_ps = 0;
+	cpu_delta = FALSE;
+	cpu_sample = 0;
+	snapshot_age = 0;
+	elapsed_metric = FALSE;
+	mydev = 0;
+	myino = 0;
+	ps_input = NULL;
+	native = FALSE;
+	from_snapshot = FALSE;
+#ifdef __linux__
+	table = NULL;
+	table_entry = NULL;
+#endif
+}
+
+
+static int
+run_check (int argc, char **argv)
+{
 	char *input_line;
 	char *procprog;
 	char *proc_cgroup_hierarchy;
@@ -134,56 +698,51 @@ main (int argc, char **argv)
 	pid_t mypid = 0;
 	pid_t myppid = 0;
 	struct stat statbuf;
-	dev_t mydev = 0;
-	ino_t myino = 0;
 	int procuid = 0;
 	pid_t procpid = 0;
 	pid_t procppid = 0;
 	int procjid = 0;
 	pid_t kthread_ppid = 0;
 	int procvsz = 0;
-	int total_procvsz = 0;
 	int procrss = 0;
-	int total_procrss = 0;
 	int procseconds = 0;
-	int total_procseconds = 0;
 	float procpcpu = 0;
-	float total_procpcpu = 0;
 	char procstat[8];
 	char procetime[MAX_INPUT_BUFFER] = { '\0' };
-	char *procargs;
-	char *tmp;
+	struct proc_info proc;
+	struct procs_rule *r;
+	char *names = NULL;
+	time_t now;
 
 	const char *zombie = "Z";
 
-	int resultsum = 0; /* bitmask of the filter criteria met by a process */
 	int found = 0; /* counter for number of lines returned in `ps` output */
-	int procs = 0; /* counter for number of processes meeting filter criteria */
 	int pos; /* number of spaces before 'args' in `ps` output */
 	int cols; /* number of columns in ps output */
 	int expected_cols = PS_COLS - 1;
-	int warn = 0; /* number of processes in warn state */
-	int crit = 0; /* number of processes in crit state */
-	int i = 0, j = 0;
+	int nrules = 0, ncrit = 0, nwarn = 0;
+	int j = 0;
 	int result = STATE_UNKNOWN;
-	int ret = 0;
 	output chld_out, chld_err;
+#ifdef __linux__
+	size_t next = 0;
+	char *cpu_file = NULL;
+	char *snapshot_file = NULL;
+	struct timespec pause;
+#endif
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
 	setlocale(LC_NUMERIC, "POSIX");
 
-	input_buffer = malloc (MAX_INPUT_BUFFER);
 	procprog = malloc (MAX_INPUT_BUFFER);
 	proc_cgroup_hierarchy = malloc (MAX_INPUT_BUFFER);
 
-	xasprintf (&metric_name, "PROCS");
-	metric = METRIC_PROCS;
+	np_init ((char *) progname, argc, argv);
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
 
+	np_set_args (argc, argv);
+
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
@@ -205,13 +764,66 @@ main (int argc, char **argv)
 	}
 	(void) alarm ((unsigned) timeout_interval);
 
+#ifdef __linux__
+	if ((cpu_delta || cpu_sample) && input_filename == NULL && !use_ps) {
+		if (cpu_delta) {
+			np_enable_state (NULL, 1);
+			if ((cpu_file = np_state_path (".cpu")) == NULL)
+				die (STATE_UNKNOWN, "%s\n", _("Cannot create the state directory"));
+			np_proc_cpu_load (&cpu, cpu_file);
+		} else if (np_proc_scan_open (&proc_scan)) {
+			/* the first sample, here and now */
+			memset (&cpu, 0, sizeof (cpu));
+			np_proc_cpu_begin (&cpu, &proc_scan);
+			while (np_proc_scan_next (&proc_scan, &entry))
+				np_proc_cpu_update (&cpu, &entry);
+			np_proc_scan_close (&proc_scan);
+			np_proc_cpu_next (&cpu);
+			pause.tv_sec = cpu_sample / 1000;
+			pause.tv_nsec = cpu_sample % 1000 * 1000000L;
+			while (nanosleep (&pause, &pause) == -1 && errno == EINTR)
+				;
+		}
+	}
+
+	/* the process table another check has just read, if there is one */
+	if (snapshot_age && (snapshot_file = np_proc_snapshot_path ()) != NULL &&
+	    np_proc_snapshot_open (&snapshot, snapshot_file, snapshot_age)) {
+		if (snapshot.header->have & NP_PROC_SNAPSHOT_PROCS)
+			native = from_snapshot = TRUE;
+		else
+			np_proc_snapshot_close (&snapshot);
+	}
+	if (from_snapshot) {
+		if (verbose >= 2)
+			printf (_("CMD: %s (%ld seconds old)\n"), snapshot_file, snapshot.age);
+	} else
+	/* the table of a resident worker, read again where it changed */
+	if (input_filename == NULL && !use_ps && !cpu_delta && !cpu_sample && np_resident_active () &&
+	    (table = proc_table_get ()) != NULL) {
+		native = TRUE;
+		if (verbose >= 2)
+			printf (_("CMD: %s (%lu of %lu processes read)\n"), "/proc", table->reads, (unsigned long) table->count);
+	} else
+	/* read /proc rather than fork ps to do it and parse its output */
+	if (input_filename == NULL && !use_ps && np_proc_scan_open (&proc_scan)) {
+		native = TRUE;
+		if (verbose >= 2)
+			printf (_("CMD: %s\n"), "/proc");
+		if (cpu_delta || cpu_sample)
+			np_proc_cpu_begin (&cpu, &proc_scan);
+	} else
+#endif
+	if (cpu_delta || cpu_sample)
+		usage4 (_("--cpu-delta and --cpu-sample need the process table from /proc (Linux)"));
+	else
 	if (input_filename == NULL) {
 	    if (verbose >= 2)
 		    printf (_("CMD: %s\n"), PS_COMMAND);
 		result = cmd_run( PS_COMMAND, &chld_out, &chld_err, 0);
 		if (chld_err.lines > 0) {
 			printf ("%s: %s", _("System call sent warnings to stderr"), chld_err.line[0]);
-			exit(STATE_WARNING);
+			np_exit (STATE_WARNING);
 		}
 	} else {
 	    if (verbose >= 2)
@@ -219,50 +831,100 @@ main (int argc, char **argv)
 		result = cmd_file_read( input_filename, &chld_out, 0);
 	}
 
+	/* Everything is read for the verbose listing; otherwise the fields
+	 * are only read once a filter needs them */
+	lazy = verbose < 2;
+
 	/* flush first line: j starts at 1 */
-	for (j = 1; j < chld_out.lines; j++) {
-		input_line = chld_out.line[j];
+	for (j = 1; native || j < chld_out.lines; j++) {
+		memset (&proc, 0, sizeof (proc));
+		proc.self = -1;
+		proc.loaded = PROC_LIVE;
+#ifdef __linux__
+		if (native) {
+			if (from_snapshot) {
+				if (!np_proc_snapshot_next (&snapshot, &entry))
+					break;
+				proc.loaded = PROC_LIVE | PROC_STATUS | PROC_ARGS | PROC_CGROUP;
+			} else if (table) {
+				if (next == table->count)
+					break;
+				table_entry = &table->entries[next++];
+				entry = table_entry->pe;
+				proc.loaded = PROC_STATUS | PROC_ARGS | PROC_CGROUP;
+			} else if (!np_proc_scan_next (&proc_scan, &entry))
+				break;
+			if (cpu_delta || cpu_sample)
+				np_proc_cpu_update (&cpu, &entry);
+			procuid = entry.uid;
+			procpid = entry.pid;
+			procppid = entry.ppid;
+			procvsz = entry.vsz;
+			procrss = entry.rss;
+			procpcpu = entry.pcpu;
+			procseconds = entry.seconds;
+			strcpy (procprog, entry.prog);
+			proc.stat = entry.stat;
+			proc.args = entry.args;
+			proc.cgroup = entry.cgroup;
+			cols = expected_cols;
+		} else
+#endif
+		{
+			input_line = chld_out.line[j];
 
-		if (verbose >= 3)
-			printf ("%s", input_line);
+			if (verbose >= 3)
+				printf ("%s", input_line);
 
-		strcpy (procprog, "");
-		strcpy (proc_cgroup_hierarchy, "");
-		xasprintf (&procargs, "%s", "");
+			strcpy (procprog, "");
+			strcpy (proc_cgroup_hierarchy, "");
 
-		cols = sscanf (input_line, PS_FORMAT, PS_VARLIST);
+			cols = sscanf (input_line, PS_FORMAT, PS_VARLIST);
 
-		/* Zombie processes do not give a procprog command */
-		if ( cols < expected_cols && strstr(procstat, zombie) ) {
-			cols = expected_cols;
+			/* Zombie processes do not give a procprog command */
+			if ( cols < expected_cols && strstr(procstat, zombie) ) {
+				cols = expected_cols;
+			}
+			if ( cols >= expected_cols ) {
+				proc.stat = procstat;
+				proc.args = input_line + pos;
+				proc.cgroup = proc_cgroup_hierarchy;
+
+				/* we need to convert the elapsed time to seconds */
+				procseconds = convert_to_seconds(procetime);
+			}
 		}
 		if ( cols >= expected_cols ) {
-			resultsum = 0;
-			xasprintf (&procargs, "%s", input_line + pos);
-			strip (procargs);
-
 			/* Some ps return full pathname for command. This removes path */
 			strcpy(procprog, base_name(procprog));
 
-			/* we need to convert the elapsed time to seconds */
-			procseconds = convert_to_seconds(procetime);
+			proc.uid = procuid;
+			proc.pid = procpid;
+			proc.ppid = procppid;
+			proc.jid = procjid;
+			proc.vsz = procvsz;
+			proc.rss = procrss;
+			proc.pcpu = procpcpu;
+			proc.seconds = procseconds;
+			proc.prog = procprog;
+			proc.etime = procetime;
+			if (!lazy && !proc_load (&proc, PROC_LIVE | PROC_STATUS | PROC_ARGS | PROC_CGROUP))
+				continue;
 
 			if (verbose >= 3) {
-+				printf ("proc#=%d uid=%d vsz=%d rss=%d pid=%d ppid=%d jid=%d pcpu=%.2f stat=%s etime=%s prog=%s args=%s\n",
-					procs, procuid, procvsz, procrss,
-					procpid, procppid, procjid, procpcpu, procstat,
-					procetime, procprog, procargs);
+				printf ("proc#=%d uid=%d vsz=%d rss=%d pid=%d ppid=%d jid=%d pcpu=%.2f stat=%s etime=%s prog=%s args=%s\n",
+					rules->procs, proc.uid, proc.vsz, proc.rss,
+					proc.pid, proc.ppid, proc.jid, proc.pcpu, proc.stat,
+					proc.etime, proc.prog, proc.args);
 				if (strstr(PS_COMMAND, "cgroup") != NULL) {
-					printf(" proc_cgroup_hierarchy=%s\n", proc_cgroup_hierarchy);
+					printf(" proc_cgroup_hierarchy=%s\n", proc.cgroup);
 				} else {
 					printf("\n");
 				}
 			}
 
-			/* Ignore self */
-			if ((usepid && mypid == procpid) ||
-				((!usepid && ((ret = stat_exe(procpid, &statbuf) != -1) && statbuf.st_dev == mydev && statbuf.st_ino == myino)) ||
-				 (ret == -1 && errno == ENOENT))) {
+			/* Ignore self, when that is just a comparison */
+			if (usepid && mypid == procpid) {
 				if (verbose >= 3)
 					 printf("not considering - is myself or gone\n");
 				continue;
@@ -274,429 +936,536 @@ main (int argc, char **argv)
 				continue;
 			}
 
-			/* Ignore excluded processes by name */
-			if(options & EXCLUDE_PROGS) {
-			  int found = 0;
-			  int i = 0;
-			 
-			  
-			  for(i=0; i < (exclude_progs_counter); i++) {
-			    if(!strcmp(procprog, exclude_progs_arr[i])) {
-			      found = 1;
-			    }
-			  }
-			  if(found == 0) {
-			    resultsum |= EXCLUDE_PROGS;
-			  }else
-			  {
-                            if(verbose >= 3)
-			      printf("excluding - by ignorelist\n");
-                          }
-			}
-
-			/* filter kernel threads (childs of KTHREAD_PARENT)*/
-			/* TODO adapt for other OSes than GNU/Linux
-					sorry for not doing that, but I've no other OSes to test :-( */
-			if (kthread_filter == 1) {
-				/* get pid KTHREAD_PARENT */
-				if (kthread_ppid == 0 && !strcmp(procprog, KTHREAD_PARENT) )
-					kthread_ppid = procpid;
-
-				if (kthread_ppid == procppid) {
-					if (verbose >= 2)
-						printf ("Ignore kernel thread: pid=%d ppid=%d prog=%s args=%s\n", procpid, procppid, procprog, procargs);
-					continue;
-				}
-			}
-
-			if ((options & STAT) && (strstr (statopts, procstat)))
-				resultsum |= STAT;
-			if ((options & ARGS) && procargs && (strstr (procargs, args) != NULL))
-				resultsum |= ARGS;
-			if ((options & EREG_ARGS) && procargs && (regexec(&re_args, procargs, (size_t) 0, NULL, 0) == 0))
-				resultsum |= EREG_ARGS;
-			if ((options & PROG) && procprog && (strcmp (prog, procprog) == 0))
-				resultsum |= PROG;
-			if ((options & PPID) && (procppid == ppid))
-				resultsum |= PPID;
-			if ((options & JID) && (procjid == jid))
-				resultsum |= JID;
-			if ((options & USER) && (procuid == uid))
-				resultsum |= USER;
-			if ((options & VSZ)  && (procvsz >= vsz))
-				resultsum |= VSZ;
-			if ((options & RSS)  && (procrss >= rss))
-				resultsum |= RSS;
-			if ((options & PCPU)  && (procpcpu >= pcpu))
-				resultsum |= PCPU;
-			if (options & CGROUP_HIERARCHY) {
-				if(!strncmp(proc_cgroup_hierarchy,"-", 2) && !strncmp(cgroup_hierarchy,"/", 2)) {
-					resultsum |= CGROUP_HIERARCHY;
-				} else {
-					if((tmp = strstr(proc_cgroup_hierarchy,":/")) != NULL) {
-						if(!strcmp(tmp+1,cgroup_hierarchy)) {
-							resultsum |= CGROUP_HIERARCHY;
-						};
-					};
-				};
-			};
+			/* get pid KTHREAD_PARENT */
+			if (kthread_ppid == 0 && !strcmp(procprog, KTHREAD_PARENT) )
+				kthread_ppid = procpid;
 
 			found++;
 
-			/* Next line if filters not matched */
-			if (!(options == resultsum || options == ALL))
-				continue;
-
-			procs++;
-			if (verbose >= 2) {
-+				printf ("Matched: uid=%d vsz=%d rss=%d pid=%d ppid=%d jid=%d pcpu=%.2f stat=%s etime=%s prog=%s args=%s\n",
-					procuid, procvsz, procrss,
-					procpid, procppid, procjid, procpcpu, procstat,
-					procetime, procprog, procargs);
-				if (strstr(PS_COMMAND, "cgroup") != NULL) {
-					printf(" cgroup_hierarchy=%s\n", cgroup_hierarchy);
-				} else {
-					printf("\n");
-				}
-			}
-
-			if (metric == METRIC_VSZ) {
-				i = get_status ((double)procvsz, procs_thresholds);
-				total_procvsz += procvsz;
-			} else if (metric == METRIC_RSS) {
-				i = get_status ((double)procrss, procs_thresholds);
-				total_procrss += procrss;
-			}
-			/* TODO? float thresholds for --metric=CPU */
-			else if (metric == METRIC_CPU) {
-				i = get_status (procpcpu, procs_thresholds);
-				total_procpcpu += procpcpu;
-			}
-			else if (metric == METRIC_ELAPSED) {
-				i = get_status ((double)procseconds, procs_thresholds);
-				total_procseconds += procseconds;
-			}
-			if (metric != METRIC_PROCS) {
-				if (i == STATE_WARNING) {
-					warn++;
-					xasprintf (&fails, "%s%s%s", fails, (strcmp(fails,"") ? ", " : ""), procprog);
-					result = max_state (result, i);
-				}
-				if (i == STATE_CRITICAL) {
-					crit++;
-					xasprintf (&fails, "%s%s%s", fails, (strcmp(fails,"") ? ", " : ""), procprog);
-					result = max_state (result, i);
-				}
-			}
-		} 
+			for (r = rules; r; r = r->next)
+				if (rule_match (r, &proc, kthread_ppid))
+					rule_count (r, &proc);
+		}
 		/* This should not happen */
 		else if (verbose) {
-			printf(_("Not parseable: %s"), input_buffer);
+			printf(_("Not parseable: %s"), input_line);
 		}
 	}
 
+#ifdef __linux__
+	if (from_snapshot)
+		np_proc_snapshot_close (&snapshot);
+	else if (table) {
+		table_entry = NULL;
+		np_proc_table_done (table);
+		if (!np_pool_release (table))
+			proc_table_close (table);
+	} else if (native)
+		np_proc_scan_close (&proc_scan);
+	if (native && cpu_delta && !np_proc_cpu_save (&cpu, cpu_file) && verbose)
+		printf (_("Cannot write the CPU times to %s\n"), cpu_file);
+#endif
+
 	if (found == 0) {							/* no process lines parsed so return STATE_UNKNOWN */
 		printf (_("Unable to read output\n"));
 		return STATE_UNKNOWN;
 	}
 
-	if ( result == STATE_UNKNOWN ) 
-		result = STATE_OK;
+	for (r = rules; r; r = r->next)
+		rule_finish (r);
 
-	/* Needed if procs found, but none match filter */
-	if ( metric == METRIC_PROCS ) {
-		result = max_state (result, get_status ((double)procs, procs_thresholds) );
+	/* just the command line's rule */
+	if (rules->name == NULL) {
+		print_rule (rules);
+		printf (" | ");
+		print_rule_perfdata (rules, NULL);
+		printf ("\n");
+		return rules->result;
 	}
 
-	if ( result == STATE_OK ) {
-		printf ("%s %s: ", metric_name, _("OK"));
-	} else if (result == STATE_WARNING) {
-		printf ("%s %s: ", metric_name, _("WARNING"));
-		if ( metric != METRIC_PROCS ) {
-			printf (_("%d warn out of "), warn);
-		}
-	} else if (result == STATE_CRITICAL) {
-		printf ("%s %s: ", metric_name, _("CRITICAL"));
-		if (metric != METRIC_PROCS) {
-			printf (_("%d crit, %d warn out of "), crit, warn);
+	/* every rule as a passive result, or a line of its own, under a
+	 * summary of them all */
+	result = STATE_OK;
+	now = time (NULL);
+	for (r = rules; r; r = r->next) {
+		nrules++;
+		result = max_state (result, r->result);
+		if (r->result == STATE_CRITICAL)
+			ncrit++;
+		else if (r->result == STATE_WARNING)
+			nwarn++;
+		if (r->result != STATE_OK)
+			xasprintf (&names, "%s%s%s", names ? names : "", names ? ", " : "", r->name);
+		if (rule_output == RULES_PASSIVE) {
+			printf ("[%lu] PROCESS_SERVICE_CHECK_RESULT;%s;%s;%d;",
+			        (unsigned long) now, passive_host, r->name, r->result);
+			print_rule (r);
+			printf ("|");
+			print_rule_perfdata (r, NULL);
+			printf ("\n");
 		}
-	} 
-	printf (ngettext ("%d process", "%d processes", (unsigned long) procs), procs);
-	
-	if (strcmp(fmt,"") != 0) {
-		printf (_(" with %s"), fmt);
-	}
-
-	if ( verbose >= 1 && strcmp(fails,"") )
-		printf (" [%s]", fails);
-
-	if (metric == METRIC_PROCS)
-		printf (" | procs=%d;%s;%s;0;", procs,
-				warning_range ? warning_range : "",
-				critical_range ? critical_range : "");
-	else if (metric == METRIC_VSZ)
-		printf (" | procs=%d;;;0; procs_warn=%d;;;0; procs_crit=%d;;;0; procvsz=%d;", procs, warn, crit, total_procvsz);
-	else if (metric == METRIC_RSS)
-		printf (" | procs=%d;;;0; procs_warn=%d;;;0; procs_crit=%d;;;0; procrss=%d;", procs, warn, crit, total_procrss);
-	else if (metric == METRIC_CPU)
-		printf (" | procs=%d;;;0; procs_warn=%d;;;0; procs_crit=%d;;;0; procpcpu=%f;", procs, warn, crit, total_procpcpu);
-	else if (metric == METRIC_ELAPSED)
-		printf (" | procs=%d;;;0; procs_warn=%d;;;0; procs_crit=%d;;;0; procseconds=%d;", procs, warn, crit, total_procseconds);
-	else
-		printf (" | procs=%d;;;0; procs_warn=%d;;;0; procs_crit=%d;;;0;", procs, warn, crit);
+	}
 
+	printf ("PROCS %s: ", state_text (result));
+	printf (ngettext ("%d rule", "%d rules", (unsigned long) nrules), nrules);
+	printf (_(", %d critical, %d warning"), ncrit, nwarn);
+	if (names)
+		printf (" [%s]", names);
 	printf ("\n");
+	if (rule_output == RULES_MULTILINE) {
+		for (r = rules; r; r = r->next) {
+			printf ("%s: ", r->name);
+			print_rule (r);
+			printf ("\n");
+		}
+		/* the perfdata of all rules after the long output */
+		printf ("|");
+		for (r = rules; r; r = r->next) {
+			printf (" ");
+			print_rule_perfdata (r, r->name);
+		}
+		printf ("\n");
+	}
 	return result;
 }
 
 
+static struct procs_rule *
+rule_new (const char *name)
+{
+	struct procs_rule *r;
+
+	if ((r = calloc (1, sizeof (*r))) == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	if (name)
+		r->name = strdup (name);
+	r->metric = METRIC_PROCS;
+	xasprintf (&r->metric_name, "PROCS");
+	np_strbuf_init (&r->fails, NULL);
+	r->result = STATE_UNKNOWN;
+	if (last_rule)
+		last_rule->next = r;
+	else
+		rules = r;
+	last_rule = r;
+	return r;
+}
 
-/* process command-line arguments */
-int
-process_arguments (int argc, char **argv)
+/* an option that is one of a rule's filters, metric or thresholds;
+ * FALSE for any other */
+static int
+rule_option (struct procs_rule *r, int c, char *optarg)
 {
-	int c = 1;
 	char *user;
 	struct passwd *pw;
-	int option = 0;
 	int err;
 	int cflags = REG_NOSUB | REG_EXTENDED;
 	char errbuf[MAX_INPUT_BUFFER];
 	char *temp_string;
+	char *p;
 	int i=0;
-	static struct option longopts[] = {
-		{"warning", required_argument, 0, 'w'},
-		{"critical", required_argument, 0, 'c'},
-		{"metric", required_argument, 0, 'm'},
-		{"timeout", required_argument, 0, 't'},
-		{"status", required_argument, 0, 's'},
-		{"ppid", required_argument, 0, 'p'},
-		{"user", required_argument, 0, 'u'},
-		{"command", required_argument, 0, 'C'},
-		{"vsz", required_argument, 0, 'z'},
-		{"rss", required_argument, 0, 'r'},
-		{"pcpu", required_argument, 0, 'P'},
-		{"elapsed", required_argument, 0, 'e'},
-		{"argument-array", required_argument, 0, 'a'},
-		{"help", no_argument, 0, 'h'},
-		{"version", no_argument, 0, 'V'},
-		{"verbose", no_argument, 0, 'v'},
-		{"ereg-argument-array", required_argument, 0, CHAR_MAX+1},
-		{"input-file", required_argument, 0, CHAR_MAX+2},
-		{"no-kthreads", required_argument, 0, 'k'},
-		{"traditional-filter", no_argument, 0, 'T'},
-		{"cgroup-hierarchy", required_argument, 0, 'g'},
-		{"exclude-process", required_argument, 0, 'X'},
-		{"jid", required_argument, 0, 'j'},
-		{0, 0, 0, 0}
-	};
+
+	switch (c) {
+	case 'c':									/* critical threshold */
+		r->critical_range = optarg;
+		break;
+	case 'w':									/* warning threshold */
+		r->warning_range = optarg;
+		break;
+	case 'p':									/* process id */
+		if (sscanf (optarg, "%d%[^0-9]", &r->ppid, tmp) == 1) {
+			xasprintf (&r->fmt, "%s%sPPID = %d", (r->fmt ? r->fmt : "") , (r->options ? ", " : ""), r->ppid);
+			r->options |= PPID;
+			break;
+		}
+		usage4 (_("Parent Process ID must be an integer!"));
+	case 'j':                                   /* jail id */
+		if (sscanf (optarg, "%d%[^0-9]", &r->jid, tmp) == 1) {
+			xasprintf (&r->fmt, "%s%sJID = %d", (r->fmt ? r->fmt : "") , (r->options ? ", " : ""), r->jid);
+			r->options |= JID;
+			break;
+		}
+	case 's':									/* status */
+		if (r->statopts)
+			break;
+		else
+			r->statopts = optarg;
+		xasprintf (&r->fmt, _("%s%sSTATE = %s"), (r->fmt ? r->fmt : ""), (r->options ? ", " : ""), r->statopts);
+		r->options |= STAT;
+		break;
+	case 'u':									/* user or user id */
+		if (is_integer (optarg)) {
+			r->uid = atoi (optarg);
+			pw = getpwuid ((uid_t) r->uid);
+			/*  check to be sure user exists */
+			if (pw == NULL)
+				usage2 (_("UID was not found"), optarg);
+		}
+		else {
+			pw = getpwnam (optarg);
+			/*  check to be sure user exists */
+			if (pw == NULL)
+				usage2 (_("User name was not found"), optarg);
+			/*  then get uid */
+			r->uid = pw->pw_uid;
+		}
+		user = pw->pw_name;
+		xasprintf (&r->fmt, "%s%sUID = %d (%s)", (r->fmt ? r->fmt : ""), (r->options ? ", " : ""),
+		          r->uid, user);
+		r->options |= USER;
+		break;
+	case 'C':									/* command */
+		/* TODO: allow this to be passed in with --metric */
+		if (r->prog)
+			break;
+		else
+			r->prog = optarg;
+		xasprintf (&r->fmt, _("%s%scommand name '%s'"), (r->fmt ? r->fmt : ""), (r->options ? ", " : ""),
+		          r->prog);
+		r->options |= PROG;
+		break;
+	case 'X':
+	        if(r->exclude_progs)
+		  break;
+		else
+		  r->exclude_progs = optarg;
+		xasprintf (&r->fmt, _("%s%sexclude progs '%s'"), (r->fmt ? r->fmt : ""), (r->options ? ", " : ""),
+			   r->exclude_progs);
+		p = strtok(r->exclude_progs, ",");
+
+		while(p){
+		  r->exclude_progs_arr = realloc(r->exclude_progs_arr, sizeof(char*) * ++r->exclude_progs_counter);
+		  r->exclude_progs_arr[r->exclude_progs_counter-1] = p;
+		  p = strtok(NULL, ",");
+		}
+
+		r->options |= EXCLUDE_PROGS;
+		break;
+	case 'g':									/* cgroup hierarchy */
+		if (r->cgroup_hierarchy)
+			break;
+		else
+			r->cgroup_hierarchy = optarg;
+		xasprintf (&r->fmt, _("%s%scgroup hierarchy '%s'"), (r->fmt ? r->fmt : ""), (r->options ? ", " : ""),
+		          r->cgroup_hierarchy);
+		r->options |= CGROUP_HIERARCHY;
+		break;
+	case 'a':									/* args (full path name with args) */
+		/* TODO: allow this to be passed in with --metric */
+		if (r->args)
+			break;
+		else
+			r->args = optarg;
+		xasprintf (&r->fmt, "%s%sargs '%s'", (r->fmt ? r->fmt : ""), (r->options ? ", " : ""), r->args);
+		r->options |= ARGS;
+		break;
+	case CHAR_MAX+1:
+		err = np_regcomp(&r->re_args, optarg, cflags);
+		if (err != 0) {
+			np_regerror (err, &r->re_args, errbuf, MAX_INPUT_BUFFER);
+			die (STATE_UNKNOWN, "PROCS %s: %s - %s\n", _("UNKNOWN"), _("Could not compile regular expression"), errbuf);
+		}
+		/* Strip off any | within the regex optarg */
+		temp_string = strdup(optarg);
+		while(temp_string[i]!='\0'){
+			if(temp_string[i]=='|')
+				temp_string[i]=',';
+			i++;
+		}
+		xasprintf (&r->fmt, "%s%sregex args '%s'", (r->fmt ? r->fmt : ""), (r->options ? ", " : ""), temp_string);
+		r->options |= EREG_ARGS;
+		break;
+	case 'r': 					/* RSS */
+		if (sscanf (optarg, "%d%[^0-9]", &r->rss, tmp) == 1) {
+			xasprintf (&r->fmt, "%s%sRSS >= %d", (r->fmt ? r->fmt : ""), (r->options ? ", " : ""), r->rss);
+			r->options |= RSS;
+			break;
+		}
+		usage4 (_("RSS must be an integer!"));
+	case 'z':					/* VSZ */
+		if (sscanf (optarg, "%d%[^0-9]", &r->vsz, tmp) == 1) {
+			xasprintf (&r->fmt, "%s%sVSZ >= %d", (r->fmt ? r->fmt : ""), (r->options ? ", " : ""), r->vsz);
+			r->options |= VSZ;
+			break;
+		}
+		usage4 (_("VSZ must be an integer!"));
+	case 'P':					/* PCPU */
+		/* TODO: -P 1.5.5 is accepted */
+		if (sscanf (optarg, "%f%[^0-9.]", &r->pcpu, tmp) == 1) {
+			xasprintf (&r->fmt, "%s%sPCPU >= %.2f", (r->fmt ? r->fmt : ""), (r->options ? ", " : ""), r->pcpu);
+			r->options |= PCPU;
+			break;
+		}
+		usage4 (_("PCPU must be a float!"));
+	case 'm':
+		xasprintf (&r->metric_name, "%s", optarg);
+		if ( strcmp(optarg, "PROCS") == 0) {
+			r->metric = METRIC_PROCS;
+			break;
+		}
+		else if ( strcmp(optarg, "VSZ") == 0) {
+			r->metric = METRIC_VSZ;
+			break;
+		}
+		else if ( strcmp(optarg, "RSS") == 0 ) {
+			r->metric = METRIC_RSS;
+			break;
+		}
+		else if ( strcmp(optarg, "CPU") == 0 ) {
+			r->metric = METRIC_CPU;
+			break;
+		}
+		else if ( strcmp(optarg, "ELAPSED") == 0) {
+			r->metric = METRIC_ELAPSED;
+			break;
+		}
+
+		usage4 (_("Metric must be one of PROCS, VSZ, RSS, CPU, ELAPSED!"));
+	case CHAR_MAX+9:
+		if (strcmp (optarg, "cgroup"))
+			usage2 (_("Processes can only be grouped by cgroup"), optarg);
+		r->group_by = TRUE;
+		break;
+	case CHAR_MAX+10:
+		if (!is_intnonneg (optarg))
+			usage2 (_("Group depth must be a positive integer"), optarg);
+		r->group_depth = atoi (optarg);
+		break;
+	case 'k':	/* linux kernel thread filter */
+		r->kthread_filter = 1;
+		break;
+	default:
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static struct option longopts[] = {
+	{"warning", required_argument, 0, 'w'},
+	{"critical", required_argument, 0, 'c'},
+	{"metric", required_argument, 0, 'm'},
+	{"timeout", required_argument, 0, 't'},
+	{"status", required_argument, 0, 's'},
+	{"ppid", required_argument, 0, 'p'},
+	{"user", required_argument, 0, 'u'},
+	{"command", required_argument, 0, 'C'},
+	{"vsz", required_argument, 0, 'z'},
+	{"rss", required_argument, 0, 'r'},
+	{"pcpu", required_argument, 0, 'P'},
+	{"elapsed", required_argument, 0, 'e'},
+	{"argument-array", required_argument, 0, 'a'},
+	{"help", no_argument, 0, 'h'},
+	{"version", no_argument, 0, 'V'},
+	{"verbose", no_argument, 0, 'v'},
+	{"ereg-argument-array", required_argument, 0, CHAR_MAX+1},
+	{"input-file", required_argument, 0, CHAR_MAX+2},
+	{"no-kthreads", required_argument, 0, 'k'},
+	{"traditional-filter", no_argument, 0, 'T'},
+	{"cgroup-hierarchy", required_argument, 0, 'g'},
+	{"exclude-process", required_argument, 0, 'X'},
+	{"jid", required_argument, 0, 'j'},
+	{"use-ps", no_argument, 0, CHAR_MAX+3},
+	{"rule", required_argument, 0, 'R'},
+	{"rule-file", required_argument, 0, CHAR_MAX+4},
+	{"rule-output", required_argument, 0, CHAR_MAX+5},
+	{"passive-host", required_argument, 0, CHAR_MAX+6},
+	{"cpu-delta", no_argument, 0, CHAR_MAX+7},
+	{"group-by", required_argument, 0, CHAR_MAX+9},
+	{"group-depth", required_argument, 0, CHAR_MAX+10},
+	{"cpu-sample", required_argument, 0, CHAR_MAX+8},
+	{"snapshot", required_argument, 0, CHAR_MAX+11},
+	{0, 0, 0, 0}
+};
+static const char *shortopts = "Vvhkt:c:w:p:s:u:C:a:z:r:m:P:Tg:X:j:R:";
+
+/* a rule from NAME:OPTIONS, the options split at white space like a
+ * command line, with '' quoting */
+static void
+add_rule (const char *spec)
+{
+	struct procs_rule *r;
+	char *str, *opts, *arg, **rargv;
+	int rargc = 1, c, option = 0;
+
+	str = strdup (spec);
+	if ((opts = strchr (str, ':')) == NULL)
+		usage2 (_("A rule is NAME:OPTIONS"), spec);
+	*opts++ = '\0';
+	if (*str == '\0' || strspn (str, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_.-") != strlen (str))
+		usage2 (_("A rule name is letters, digits, '_', '.' and '-'"), spec);
+	for (r = rules; r; r = r->next)
+		if (r->name && !strcmp (r->name, str))
+			usage2 (_("Duplicate rule name"), str);
+
+	rargv = calloc (strlen (opts) / 2 + 3, sizeof (char *));
+	rargv[0] = (char *) progname;
+	while (*(opts += strspn (opts, " \t\r\n"))) {
+		if (*opts == '\'') {
+			arg = ++opts;
+			if ((opts = strchr (opts, '\'')) == NULL)
+				usage2 (_("Unbalanced quote in rule"), spec);
+		} else {
+			arg = opts;
+			opts += strcspn (opts, " \t\r\n");
+		}
+		if (*opts)
+			*opts++ = '\0';
+		rargv[rargc++] = arg;
+	}
+
+	r = rule_new (str);
+	optind = 0;
+	while ((c = getopt_long (rargc, rargv, shortopts, longopts, &option)) != -1)
+		if (!rule_option (r, c, optarg))
+			usage2 (_("Only filters, a metric and thresholds can be given in a rule"), spec);
+	if (optind < rargc)
+		usage2 (_("Unexpected argument in rule"), rargv[optind]);
+}
+
+/* rules from FILE, one NAME:OPTIONS per line; # starts a comment */
+static void
+add_rule_file (const char *file)
+{
+	char line[MAX_INPUT_BUFFER];
+	FILE *fp;
+	size_t len;
+
+	if ((fp = fopen (file, "r")) == NULL)
+		die (STATE_UNKNOWN, "PROCS %s: %s %s - %s\n", _("UNKNOWN"), _("Cannot read rule file"), file, strerror (errno));
+	while (fgets (line, sizeof (line), fp)) {
+		len = strlen (line);
+		while (len > 0 && strchr (" \t\r\n", line[len - 1]))
+			line[--len] = '\0';
+		len = strspn (line, " \t");
+		if (line[len] == '\0' || line[len] == '#')
+			continue;
+		add_rule (line + len);
+	}
+	fclose (fp);
+}
+
+/* process command-line arguments */
+int
+process_arguments (int argc, char **argv)
+{
+	int c = 1;
+	int option = 0;
+	char **rule_specs = NULL;
+	char **rule_files = NULL;
+	int nspecs = 0, nfiles = 0, i;
+	struct procs_rule *cmdline, *r;
 
 	for (c = 1; c < argc; c++)
 		if (strcmp ("-to", argv[c]) == 0)
 			strcpy (argv[c], "-t");
 
+	cmdline = rule_new (NULL);
+
 	while (1) {
-		c = getopt_long (argc, argv, "Vvhkt:c:w:p:s:u:C:a:z:r:m:P:Tg:X:j:",
+		c = getopt_long (argc, argv, shortopts,
 			longopts, &option);
 
 		if (c == -1 || c == EOF)
 			break;
 
+		if (rule_option (cmdline, c, optarg))
+			continue;
+
 		switch (c) {
 		case '?':									/* help */
 			usage5 ();
 		case 'h':									/* help */
 			print_help ();
-			exit (STATE_OK);
+			np_exit (STATE_OK);
 		case 'V':									/* version */
 			print_revision (progname, NP_VERSION);
-			exit (STATE_OK);
+			np_exit (STATE_OK);
 		case 't':									/* timeout period */
 			timeout_interval = parse_timeout_string (optarg);
 			break;
-		case 'c':									/* critical threshold */
-			critical_range = optarg;
-			break;							 
-		case 'w':									/* warning threshold */
-			warning_range = optarg;
+		case 'v':									/* command */
+			verbose++;
 			break;
-		case 'p':									/* process id */
-			if (sscanf (optarg, "%d%[^0-9]", &ppid, tmp) == 1) {
-				xasprintf (&fmt, "%s%sPPID = %d", (fmt ? fmt : "") , (options ? ", " : ""), ppid);
-				options |= PPID;
-				break;
-			}
-			usage4 (_("Parent Process ID must be an integer!"));
-		case 'j':                                   /* jail id */
-			if (sscanf (optarg, "%d%[^0-9]", &jid, tmp) == 1) {
-				xasprintf (&fmt, "%s%sJID = %d", (fmt ? fmt : "") , (options ? ", " : ""), jid);
-				options |= JID;
-				break;
-			}
-		case 's':									/* status */
-			if (statopts)
-				break;
-			else
-				statopts = optarg;
-			xasprintf (&fmt, _("%s%sSTATE = %s"), (fmt ? fmt : ""), (options ? ", " : ""), statopts);
-			options |= STAT;
+		case 'T':
+			usepid = 1;
 			break;
-		case 'u':									/* user or user id */
-			if (is_integer (optarg)) {
-				uid = atoi (optarg);
-				pw = getpwuid ((uid_t) uid);
-				/*  check to be sure user exists */
-				if (pw == NULL)
-					usage2 (_("UID was not found"), optarg);
-			}
-			else {
-				pw = getpwnam (optarg);
-				/*  check to be sure user exists */
-				if (pw == NULL)
-					usage2 (_("User name was not found"), optarg);
-				/*  then get uid */
-				uid = pw->pw_uid;
-			}
-			user = pw->pw_name;
-			xasprintf (&fmt, "%s%sUID = %d (%s)", (fmt ? fmt : ""), (options ? ", " : ""),
-			          uid, user);
-			options |= USER;
+		case CHAR_MAX+2:
+			input_filename = optarg;
 			break;
-		case 'C':									/* command */
-			/* TODO: allow this to be passed in with --metric */
-			if (prog)
-				break;
-			else
-				prog = optarg;
-			xasprintf (&fmt, _("%s%scommand name '%s'"), (fmt ? fmt : ""), (options ? ", " : ""),
-			          prog);
-			options |= PROG;
+		case CHAR_MAX+3:
+			use_ps = 1;
 			break;
-		case 'X':
-		        if(exclude_progs)
-			  break;
-			else
-			  exclude_progs = optarg;
-			xasprintf (&fmt, _("%s%sexclude progs '%s'"), (fmt ? fmt : ""), (options ? ", " : ""),
-				   exclude_progs);
-			char *p = strtok(exclude_progs, ",");
-
-			while(p){
-			  exclude_progs_arr = realloc(exclude_progs_arr, sizeof(char*) * ++exclude_progs_counter);
-			  exclude_progs_arr[exclude_progs_counter-1] = p;
-			  p = strtok(NULL, ",");
-			}
-
-			options |= EXCLUDE_PROGS;
+		case 'R':
+			rule_specs = realloc (rule_specs, ++nspecs * sizeof (char *));
+			rule_specs[nspecs - 1] = optarg;
 			break;
-		case 'g':									/* cgroup hierarchy */
-			if (cgroup_hierarchy)
-				break;
-			else
-				cgroup_hierarchy = optarg;
-			xasprintf (&fmt, _("%s%scgroup hierarchy '%s'"), (fmt ? fmt : ""), (options ? ", " : ""),
-			          cgroup_hierarchy);
-			options |= CGROUP_HIERARCHY;
+		case CHAR_MAX+4:
+			rule_files = realloc (rule_files, ++nfiles * sizeof (char *));
+			rule_files[nfiles - 1] = optarg;
 			break;
-		case 'a':									/* args (full path name with args) */
-			/* TODO: allow this to be passed in with --metric */
-			if (args)
-				break;
+		case CHAR_MAX+5:
+			if (!strcmp (optarg, "multiline"))
+				rule_output = RULES_MULTILINE;
+			else if (!strcmp (optarg, "passive"))
+				rule_output = RULES_PASSIVE;
 			else
-				args = optarg;
-			xasprintf (&fmt, "%s%sargs '%s'", (fmt ? fmt : ""), (options ? ", " : ""), args);
-			options |= ARGS;
+				usage2 (_("Rule output must be multiline or passive"), optarg);
 			break;
-		case CHAR_MAX+1:
-			err = regcomp(&re_args, optarg, cflags);
-			if (err != 0) {
-				regerror (err, &re_args, errbuf, MAX_INPUT_BUFFER);
-				die (STATE_UNKNOWN, "PROCS %s: %s - %s\n", _("UNKNOWN"), _("Could not compile regular expression"), errbuf);
-			}
-			/* Strip off any | within the regex optarg */
-			temp_string = strdup(optarg);
-			while(temp_string[i]!='\0'){
-				if(temp_string[i]=='|')
-					temp_string[i]=',';
-				i++;
-			}
-			xasprintf (&fmt, "%s%sregex args '%s'", (fmt ? fmt : ""), (options ? ", " : ""), temp_string);
-			options |= EREG_ARGS;
+		case CHAR_MAX+6:
+			passive_host = optarg;
 			break;
-		case 'r': 					/* RSS */
-			if (sscanf (optarg, "%d%[^0-9]", &rss, tmp) == 1) {
-				xasprintf (&fmt, "%s%sRSS >= %d", (fmt ? fmt : ""), (options ? ", " : ""), rss);
-				options |= RSS;
-				break;
-			}
-			usage4 (_("RSS must be an integer!"));
-		case 'z':					/* VSZ */
-			if (sscanf (optarg, "%d%[^0-9]", &vsz, tmp) == 1) {
-				xasprintf (&fmt, "%s%sVSZ >= %d", (fmt ? fmt : ""), (options ? ", " : ""), vsz);
-				options |= VSZ;
-				break;
-			}
-			usage4 (_("VSZ must be an integer!"));
-		case 'P':					/* PCPU */
-			/* TODO: -P 1.5.5 is accepted */
-			if (sscanf (optarg, "%f%[^0-9.]", &pcpu, tmp) == 1) {
-				xasprintf (&fmt, "%s%sPCPU >= %.2f", (fmt ? fmt : ""), (options ? ", " : ""), pcpu);
-				options |= PCPU;
-				break;
-			}
-			usage4 (_("PCPU must be a float!"));
-		case 'm':
-			xasprintf (&metric_name, "%s", optarg);
-			if ( strcmp(optarg, "PROCS") == 0) {
-				metric = METRIC_PROCS;
-				break;
-			} 
-			else if ( strcmp(optarg, "VSZ") == 0) {
-				metric = METRIC_VSZ;
-				break;
-			} 
-			else if ( strcmp(optarg, "RSS") == 0 ) {
-				metric = METRIC_RSS;
-				break;
-			}
-			else if ( strcmp(optarg, "CPU") == 0 ) {
-				metric = METRIC_CPU;
-				break;
-			}
-			else if ( strcmp(optarg, "ELAPSED") == 0) {
-				metric = METRIC_ELAPSED;
-				break;
-			}
-
-			usage4 (_("Metric must be one of PROCS, VSZ, RSS, CPU, ELAPSED!"));
-		case 'k':	/* linux kernel thread filter */
-			kthread_filter = 1;
+		case CHAR_MAX+7:
+			cpu_delta = TRUE;
 			break;
-		case 'v':									/* command */
-			verbose++;
+		case CHAR_MAX+8:
+			if (!is_intpos (optarg) || (cpu_sample = atoi (optarg)) > 60000)
+				usage2 (_("CPU sample interval must be 1 to 60000 ms"), optarg);
 			break;
-		case 'T':
-			usepid = 1;
-			break;
-		case CHAR_MAX+2:
-			input_filename = optarg;
+		case CHAR_MAX+11:
+			if (!is_intpos (optarg))
+				usage2 (_("Snapshot age must be a positive integer"), optarg);
+			snapshot_age = atoi (optarg);
 			break;
 		}
 	}
 
 	c = optind;
-	if ((! warning_range) && argv[c])
-		warning_range = argv[c++];
-	if ((! critical_range) && argv[c])
-		critical_range = argv[c++];
-	if (statopts == NULL && argv[c]) {
-		xasprintf (&statopts, "%s", argv[c++]);
-		xasprintf (&fmt, _("%s%sSTATE = %s"), (fmt ? fmt : ""), (options ? ", " : ""), statopts);
-		options |= STAT;
+	if ((! cmdline->warning_range) && argv[c])
+		cmdline->warning_range = argv[c++];
+	if ((! cmdline->critical_range) && argv[c])
+		cmdline->critical_range = argv[c++];
+	if (cmdline->statopts == NULL && argv[c]) {
+		xasprintf (&cmdline->statopts, "%s", argv[c++]);
+		xasprintf (&cmdline->fmt, _("%s%sSTATE = %s"), (cmdline->fmt ? cmdline->fmt : ""), (cmdline->options ? ", " : ""), cmdline->statopts);
+		cmdline->options |= STAT;
+	}
+
+	/* the rules, once the command line has been read */
+	for (i = 0; i < nfiles; i++)
+		add_rule_file (rule_files[i]);
+	for (i = 0; i < nspecs; i++)
+		add_rule (rule_specs[i]);
+	if (cmdline->next) {
+		if (cmdline->options || cmdline->warning_range || cmdline->critical_range ||
+		    cmdline->metric != METRIC_PROCS || cmdline->kthread_filter || cmdline->group_by)
+			usage4 (_("Filters, metric and thresholds go in the rules when --rule or --rule-file is given"));
+		rules = cmdline->next;
+		free (cmdline);
+	}
+	if (cpu_delta && cpu_sample)
+		usage4 (_("Only one of --cpu-delta and --cpu-sample can be given"));
+	if (snapshot_age && (cpu_delta || cpu_sample || use_ps || input_filename))
+		usage4 (_("--snapshot cannot be combined with --cpu-delta, --cpu-sample, --use-ps or --input-file"));
+	if (rule_output == RULES_PASSIVE && passive_host == NULL) {
+		if (gethostname (tmp, sizeof (tmp)) != 0)
+			die (STATE_UNKNOWN, "PROCS %s: %s\n", _("UNKNOWN"), _("Cannot get the host name, give --passive-host"));
+		tmp[sizeof (tmp) - 1] = '\0';
+		passive_host = strdup (tmp);
 	}
 
 	/* this will abort in case of invalid ranges */
-	set_thresholds (&procs_thresholds, warning_range, critical_range);
+	for (r = rules; r; r = r->next)
+		set_thresholds (&r->procs_thresholds, r->warning_range, r->critical_range);
 
 	return validate_arguments ();
 }
@@ -706,25 +1475,33 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments ()
 {
-	if (options == 0)
-		options = ALL;
+	struct procs_rule *r;
+
+	for (r = rules; r; r = r->next) {
+		if (r->metric == METRIC_ELAPSED)
+			elapsed_metric = TRUE;
+
+		if (r->options == 0)
+			r->options = ALL;
 
-	if (statopts==NULL)
-		statopts = strdup("");
+		if (r->statopts==NULL)
+			r->statopts = strdup("");
 
-	if (prog==NULL)
-		prog = strdup("");
+		if (r->prog==NULL)
+			r->prog = strdup("");
 
-	if (args==NULL)
-		args = strdup("");
+		if (r->args==NULL)
+			r->args = strdup("");
 
-	if (fmt==NULL)
-		fmt = strdup("");
+		if (r->cgroup_hierarchy==NULL)
+			r->cgroup_hierarchy = strdup("");
 
-	if (fails==NULL)
-		fails = strdup("");
+		if (r->fmt==NULL)
+			r->fmt = strdup("");
+
+	}
 
-	return options;
+	return OK;
 }
 
 
@@ -784,7 +1561,7 @@ convert_to_seconds(char *etime) {
 		(minutes * 60) +
 		seconds;
 
-	if (verbose >= 3 && metric == METRIC_ELAPSED) {
+	if (verbose >= 3 && elapsed_metric) {
 			printf("seconds: %d\n", total);
 	}
 	return total;
@@ -861,11 +1638,50 @@ print_help (void)
   printf ("   %s\n", _("Only scan for non kernel threads (works on Linux only)."));
   printf (" %s\n", "-g, --cgroup-hierarchy");
   printf ("   %s\n", _("Only scan for processes belonging to STRING hierarchy (works on Linux only)."));
+  printf (" %s\n", "--group-by=cgroup");
+  printf ("   %s\n", _("Apply the thresholds to each cgroup the processes are in: their number,"));
+  printf ("   %s\n", _("the sum of their VSZ, RSS or CPU, or the ELAPSED time of the oldest"));
+  printf (" %s\n", "--group-depth=N");
+  printf ("   %s\n", _("Group by the first N components of the cgroup path, e.g. 3 for the pods"));
+  printf ("   %s\n", _("of /kubepods.slice/kubepods-burstable.slice/kubepods-burstable-pod*.slice"));
+
+  printf ("\n");
+	printf ("%s\n", "Rules:");
+  printf (" %s\n", "-R, --rule='NAME:OPTIONS'");
+  printf ("   %s\n", _("Check the filters, metric and thresholds in OPTIONS as rule NAME. Can be"));
+  printf ("   %s\n", _("given several times; all rules are checked in one scan of the processes."));
+  printf ("   %s\n", _("NAME is letters, digits, '_', '.' and '-'; quote arguments with ''"));
+  printf (" %s\n", "--rule-file=FILE");
+  printf ("   %s\n", _("Read the rules from FILE, one NAME:OPTIONS per line, # starts a comment"));
+  printf (" %s\n", "--rule-output=multiline|passive");
+  printf ("   %s\n", _("Print a line for each rule after the summary (default), or a passive"));
+  printf ("   %s\n", _("PROCESS_SERVICE_CHECK_RESULT with the rule name as the service for each"));
+  printf (" %s\n", "--passive-host=HOST");
+  printf ("   %s\n", _("Host name for the passive results (default: this host's name)"));
 
   printf ("\n");
 	printf ("%s\n", "Extra:");
   printf (" %s\n", "--input-file=FILE");
   printf ("   %s\n", _("Use FILE content instead of /bin/ps output."));
+#if defined( __linux__ )
+  printf (" %s\n", "--use-ps");
+  printf ("   %s\n", _("Run ps rather than read the process table from /proc."));
+  printf (" %s\n", "--cpu-delta");
+  printf ("   %s\n", _("Take %CPU over the time since the last run of the check rather than the"));
+  printf ("   %s\n", _("lifetime average ps shows; the CPU times are kept in the state directory"));
+  printf ("   %s\n", _("for the next run. The first run has the lifetime average."));
+  printf (" %s\n", "--cpu-sample=MSEC");
+  printf ("   %s\n", _("Take %CPU over MSEC milliseconds, between two scans of the processes."));
+  printf (" %s\n", "--snapshot=SECONDS");
+  printf ("   %s\n", _("Use the snapshot of the process table check_procs, check_load, check_swap"));
+  printf ("   %s\n", _("and check_users share if it is at most SECONDS old, or take one for them."));
+  printf ("   %s\n", _("It is kept in the state directory; %CPU is the lifetime average."));
+  printf (" %s\n", "--resident[=SOCKET]");
+  printf ("   %s\n", _("Stay in memory and run a check per request line (see resident.h). The"));
+  printf ("   %s\n", _("process table is kept from one check to the next: run as root, the kernel's"));
+  printf ("   %s\n", _("process events tell which processes to read again, and it is scanned"));
+  printf ("   %s\n", _("whole only every 5 minutes; without them, at each check."));
+#endif
 
 	printf(_("\n\
 RANGEs are prefixed with @ and specified 'min:max' or 'min:' or ':max' (or 'max'). If\n\
@@ -891,7 +1707,11 @@ be the total number of running processes\n\n"));
   printf (" %s\n", "check_procs -w 50000 -c 100000 --metric=VSZ");
   printf ("  %s\n\n", _("Alert if VSZ of any processes over 50K or 100K"));
   printf (" %s\n", "check_procs -w 10 -c 20 --metric=CPU");
-  printf ("  %s\n", _("Alert if CPU of any processes over 10%% or 20%%"));
+  printf ("  %s\n\n", _("Alert if CPU of any processes over 10%% or 20%%"));
+  printf (" %s\n", "check_procs -R 'sshd:-C sshd -c 1:' -R 'zombies:-s Z -w 5 -c 20'");
+  printf ("  %s\n\n", _("Critical if no sshd is running, and alert on zombies, in one check"));
+  printf (" %s\n", "check_procs --group-by=cgroup --group-depth=2 --metric=RSS -w 1000000 -c 2000000");
+  printf ("  %s\n", _("Alert if the processes of any systemd service use over 1GB or 2GB"));
 
 	printf (UT_SUPPORT);
 }
@@ -903,5 +1723,7 @@ print_usage (void)
 	printf ("%s -w <range> -c <range> [-m metric] [-s state] [-p ppid] [-j jid]\n", progname);
   printf (" [-u user] [-r rss] [-z vsz] [-P %%cpu] [-a argument-array]\n");
   printf (" [-C command] [-X process_to_exclude] [-k] [-t timeout] [-v]\n");
+  printf ("%s -R 'name:options' [-R ...] [--rule-file=file]\n", progname);
+  printf (" [--rule-output=multiline|passive] [--passive-host=host] [-t timeout] [-v]\n");
 }
 
@@ -59,6 +59,7 @@ int process_arguments (int, char **);
 void print_help (void);
 void print_usage (void);
 char *get_ether_addr(uint32_t client_id);
+int check_servers (VALUE_PAIR *);
 
 #if defined(HAVE_LIBFREERADIUS_CLIENT) || defined(HAVE_LIBRADIUSCLIENT_NG)
 #define my_rc_conf_str(a) rc_conf_str(rch,a)
@@ -93,6 +94,9 @@ rc_handle *rch = NULL;
 #endif
 
 char *server = NULL;
+char **servers = NULL;     /* every -H, server being the first */
+int server_count = 0;
+int burst = 1;             /* requests to send each server at once */
 char *username = NULL;
 char *password = NULL;
 char *nasid = NULL;
@@ -170,10 +174,6 @@ main (int argc, char **argv)
 	char *ether;
 	char *str;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
 
@@ -219,6 +219,12 @@ main (int argc, char **argv)
 			die (STATE_UNKNOWN, _("Invalid Calling-Station-Id\n"));
 	}
 
+	if (server_count > 1 || burst > 1) {
+		result = check_servers (data.send_pairs);
+		rc_avpair_free (data.send_pairs);
+		return result;
+	}
+
 	my_rc_buildreq (&data, PW_ACCESS_REQUEST, server, port, (int)timeout_interval,
 	             retries);
 
@@ -245,15 +251,426 @@ main (int argc, char **argv)
 
 
 
+/* Several servers, or several requests each, are asked without the
+ * library, which sends one request and waits for its reply: its send
+ * pairs are put into each Access-Request here, as rc_send_server() would,
+ * and the replies checked as it does. */
+#define RADIUS_HEADER_LEN 20
+#define RADIUS_MAX_PACKET 4096
+#define MAX_BURST 256
+
+typedef struct radius_host {
+	char *name;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int sd;
+	char secret[MAX_SECRET_LENGTH + 1];
+	int replies;
+	int state;
+	char msg[BUFFER_LEN];
+} radius_host;
+
+typedef struct radius_request {
+	radius_host *host;
+	unsigned char packet[RADIUS_MAX_PACKET];
+	int length;
+	double sent;              /* the last try */
+	int64_t deadline;         /* of the last try */
+	int tries;
+	int result;               /* TIMEOUT_RC until a reply came */
+	double time;
+	char msg[BUFFER_LEN];     /* Reply-Message */
+} radius_request;
+
+static double
+now_double (void)
+{
+	struct timeval t;
+
+	gettimeofday (&t, NULL);
+	return t.tv_sec + t.tv_usec / 1e6;
+}
+
+/* the secret of the host in the servers file, "host[:port] secret" lines
+ * as the library reads them */
+static int
+find_secret (radius_host *host)
+{
+	char line[BUFFER_LEN], name[BUFFER_LEN], secret[BUFFER_LEN];
+	char *str, *colon;
+	struct addrinfo hints, *res;
+	FILE *fp;
+	int found = FALSE;
+
+	str = strdup ("servers");
+	if (my_rc_conf_str (str) == NULL || (fp = fopen (my_rc_conf_str (str), "r")) == NULL) {
+		free (str);
+		return FALSE;
+	}
+	free (str);
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = host->addr.ss_family;
+	hints.ai_socktype = SOCK_DGRAM;
+	while (!found && fgets (line, sizeof (line), fp) != NULL) {
+		if (line[0] == '#' || sscanf (line, "%s %s", name, secret) != 2)
+			continue;
+		if ((colon = strchr (name, ':')) != NULL)
+			*colon = '\0';
+		if (!strcmp (name, host->name))
+			found = TRUE;
+		else if (getaddrinfo (name, NULL, &hints, &res) == 0) {
+			found = res->ai_family == AF_INET && host->addr.ss_family == AF_INET &&
+				((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr ==
+				((struct sockaddr_in *)&host->addr)->sin_addr.s_addr;
+			freeaddrinfo (res);
+		}
+		if (found)
+			snprintf (host->secret, sizeof (host->secret), "%s", secret);
+	}
+	fclose (fp);
+	return found;
+}
+
+/* An Access-Request with the pairs, for the host. Returns its length, or
+ * -1 if the pairs do not fit. */
+static int
+build_request (radius_request *req, unsigned char id, VALUE_PAIR *pairs)
+{
+	unsigned char *p = req->packet, *end = req->packet + sizeof (req->packet);
+	unsigned char md5buf[MAX_SECRET_LENGTH + AUTH_VECTOR_LEN], digest[AUTH_VECTOR_LEN];
+	unsigned char *auth = req->packet + 4, *last;
+	size_t secretlen = strlen (req->host->secret), len, padded, i, j;
+	uint32_t lvalue;
+	VALUE_PAIR *vp;
+
+	p[0] = PW_ACCESS_REQUEST;
+	p[1] = id;
+	rc_random_vector (auth);
+	p += RADIUS_HEADER_LEN;
+
+	for (vp = pairs; vp != NULL; vp = vp->next) {
+		/* the plugin adds no vendor attributes */
+		if (vp->attribute > 255)
+			continue;
+		switch (vp->type) {
+		case PW_TYPE_STRING:
+			len = vp->lvalue;
+			if (vp->attribute == PW_USER_PASSWORD) {
+				/* RFC 2865 5.2: xor the password, padded to 16 octets, with
+				 * MD5(secret + authenticator), then with MD5(secret + the
+				 * previous 16 encrypted octets) */
+				padded = len == 0 ? AUTH_VECTOR_LEN : (len + AUTH_VECTOR_LEN - 1) & ~(AUTH_VECTOR_LEN - 1);
+				if (padded > AUTH_PASS_LEN || p + 2 + padded > end)
+					return -1;
+				*p++ = vp->attribute;
+				*p++ = 2 + padded;
+				memset (p, 0, padded);
+				memcpy (p, vp->strvalue, len);
+				memcpy (md5buf, req->host->secret, secretlen);
+				for (last = auth, i = 0; i < padded; i += AUTH_VECTOR_LEN) {
+					memcpy (md5buf + secretlen, last, AUTH_VECTOR_LEN);
+					rc_md5_calc (digest, md5buf, secretlen + AUTH_VECTOR_LEN);
+					for (j = 0; j < AUTH_VECTOR_LEN; j++)
+						p[i + j] ^= digest[j];
+					last = p + i;
+				}
+				p += padded;
+				continue;
+			}
+			if (len > 253 || p + 2 + len > end)
+				return -1;
+			*p++ = vp->attribute;
+			*p++ = 2 + len;
+			memcpy (p, vp->strvalue, len);
+			p += len;
+			break;
+		case PW_TYPE_INTEGER:
+		case PW_TYPE_IPADDR:
+		case PW_TYPE_DATE:
+			if (p + 6 > end)
+				return -1;
+			*p++ = vp->attribute;
+			*p++ = 6;
+			lvalue = htonl (vp->lvalue);
+			memcpy (p, &lvalue, 4);
+			p += 4;
+			break;
+		}
+	}
+
+	req->length = p - req->packet;
+	req->packet[2] = req->length >> 8;
+	req->packet[3] = req->length & 0xff;
+	return req->length;
+}
+
+/* Checks a reply to the request as rc_send_server() does: its length, the
+ * response authenticator made with the secret, and its code. The
+ * Reply-Messages go into msg. */
+static int
+check_reply (radius_request *req, unsigned char *reply, int length)
+{
+	unsigned char md5buf[RADIUS_MAX_PACKET + MAX_SECRET_LENGTH], digest[AUTH_VECTOR_LEN];
+	size_t secretlen = strlen (req->host->secret), msglen = 0;
+	int i, len;
+
+	len = (reply[2] << 8) | reply[3];
+	if (length < RADIUS_HEADER_LEN || len < RADIUS_HEADER_LEN || len > length)
+		return BADRESP_RC;
+	memcpy (md5buf, reply, len);
+	memcpy (md5buf + 4, req->packet + 4, AUTH_VECTOR_LEN);
+	memcpy (md5buf + len, req->host->secret, secretlen);
+	rc_md5_calc (digest, md5buf, len + secretlen);
+	if (memcmp (digest, reply + 4, AUTH_VECTOR_LEN))
+		return BADRESP_RC;
+
+	req->msg[0] = '\0';
+	for (i = RADIUS_HEADER_LEN; i + 2 <= len && reply[i + 1] >= 2 && i + reply[i + 1] <= len; i += reply[i + 1]) {
+		if (reply[i] == PW_REPLY_MESSAGE && msglen + reply[i + 1] - 2 < sizeof (req->msg)) {
+			memcpy (req->msg + msglen, reply + i + 2, reply[i + 1] - 2);
+			msglen += reply[i + 1] - 2;
+			req->msg[msglen] = '\0';
+		}
+	}
+
+	if (reply[0] == PW_ACCESS_ACCEPT)
+		return OK_RC;
+	if (reply[0] == PW_ACCESS_REJECT)
+		return REJECT_RC;
+	return BADRESP_RC;
+}
+
+static int
+compare_times (const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Sends the requests to all servers at once, burst of them to each with
+ * identifiers unique on the socket as long as there are at most 256, and
+ * takes the replies as they come, by the address they come from and their
+ * identifier. A request is sent again after each timeout, up to retries
+ * tries in all. */
+int
+check_servers (VALUE_PAIR *pairs)
+{
+	radius_host *hosts;
+	radius_request *reqs, *req;
+	struct addrinfo hints, *res;
+	struct pollfd ufds[2];
+	struct sockaddr_storage from;
+	socklen_t fromlen;
+	unsigned char reply[RADIUS_MAX_PACKET];
+	char portstr[8], label[BUFFER_LEN];
+	double *times, now;
+	int sd[2] = {-1, -1}, nfds = 0, nreqs = server_count * burst, pending, wait, got;
+	int i, k, h, n, result = STATE_OK, count_ok = 0;
+	int64_t next;
+	char *problems = NULL, *lines = strdup ("");
+	np_perfdata perf;
+
+	hosts = calloc (server_count, sizeof (radius_host));
+	reqs = calloc (nreqs, sizeof (radius_request));
+	times = calloc (burst, sizeof (double));
+	if (hosts == NULL || reqs == NULL || times == NULL)
+		die (STATE_UNKNOWN, _("Out of Memory?\n"));
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = address_family;
+	hints.ai_socktype = SOCK_DGRAM;
+	snprintf (portstr, sizeof (portstr), "%u", port);
+	for (i = 0; i < server_count; i++) {
+		hosts[i].name = servers[i];
+		if ((k = getaddrinfo (servers[i], portstr, &hints, &res)) != 0)
+			die (STATE_UNKNOWN, _("Could not resolve %s: %s\n"), servers[i], gai_strerror (k));
+		memcpy (&hosts[i].addr, res->ai_addr, res->ai_addrlen);
+		hosts[i].addrlen = res->ai_addrlen;
+		freeaddrinfo (res);
+		if (!find_secret (&hosts[i]))
+			die (STATE_UNKNOWN, _("No secret for %s in the servers file\n"), servers[i]);
+		h = hosts[i].addr.ss_family == AF_INET6;
+		if (sd[h] < 0) {
+			if ((sd[h] = socket (hosts[i].addr.ss_family, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+				die (STATE_UNKNOWN, _("Could not create socket: %s\n"), strerror (errno));
+			ufds[nfds].fd = sd[h];
+			ufds[nfds++].events = POLLIN;
+		}
+		hosts[i].sd = sd[h];
+		for (k = 0; k < burst; k++) {
+			req = &reqs[i * burst + k];
+			req->host = &hosts[i];
+			req->result = TIMEOUT_RC;
+			if (build_request (req, (unsigned char)(i * burst + k), pairs) < 0)
+				die (STATE_UNKNOWN, _("Request too large\n"));
+		}
+	}
+
+	for (pending = nreqs; pending > 0;) {
+		/* (re)send what is due, and find when the next try is */
+		next = 0;
+		for (n = 0; n < nreqs; n++) {
+			req = &reqs[n];
+			if (req->result != TIMEOUT_RC || req->tries < 0)
+				continue;
+			if (req->tries == 0 || np_net_time_left (req->deadline) == 0) {
+				/* retries is the number of tries, as for rc_send_server() */
+				if (req->tries >= retries) {
+					req->tries = -1;
+					pending--;
+					continue;
+				}
+				if (verbose)
+					printf ("%s request %d to %s\n", req->tries ? "resending" : "sending",
+					        req->packet[1], req->host->name);
+				req->sent = now_double ();
+				req->deadline = np_net_deadline ((int)timeout_interval * 1000);
+				req->tries++;
+				if (sendto (req->host->sd, req->packet, req->length, 0,
+				            (struct sockaddr *)&req->host->addr, req->host->addrlen) < 0 && verbose)
+					printf ("sendto %s: %s\n", req->host->name, strerror (errno));
+			}
+			if (next == 0 || req->deadline < next)
+				next = req->deadline;
+		}
+		if (pending == 0)
+			break;
+
+		wait = np_net_time_left (next);
+		if ((got = poll (ufds, nfds, wait)) < 0) {
+			if (errno == EINTR)
+				continue;
+			die (STATE_UNKNOWN, _("Error polling sockets: %s\n"), strerror (errno));
+		}
+		for (h = 0; got > 0 && h < nfds; h++) {
+			if (!(ufds[h].revents & POLLIN))
+				continue;
+			fromlen = sizeof (from);
+			k = recvfrom (ufds[h].fd, reply, sizeof (reply), MSG_DONTWAIT,
+			              (struct sockaddr *)&from, &fromlen);
+			now = now_double ();
+			if (k < RADIUS_HEADER_LEN)
+				continue;
+			for (n = 0; n < nreqs; n++) {
+				req = &reqs[n];
+				if (req->result == TIMEOUT_RC && req->tries > 0 &&
+				    req->packet[1] == reply[1] && req->host->sd == ufds[h].fd &&
+				    req->host->addrlen == fromlen && !memcmp (&req->host->addr, &from, fromlen))
+					break;
+			}
+			if (n == nreqs) {
+				if (verbose)
+					printf ("discarding a stray reply\n");
+				continue;
+			}
+			req->result = check_reply (req, reply, k);
+			req->time = now - req->sent;
+			pending--;
+			if (verbose)
+				printf ("reply %d from %s: result %d in %.6f seconds\n", reply[1],
+				        req->host->name, req->result, req->time);
+		}
+	}
+	for (h = 0; h < 2; h++)
+		if (sd[h] >= 0)
+			close (sd[h]);
+
+	np_perfdata_init (&perf);
+	for (i = 0; i < server_count; i++) {
+		radius_host *host = &hosts[i];
+		int accepted = 0, rejected = 0, bad = 0, unexpected = 0;
+		const char *reply_msg = NULL;
+
+		for (k = 0; k < burst; k++) {
+			req = &reqs[i * burst + k];
+			if (req->result == TIMEOUT_RC)
+				continue;
+			times[host->replies++] = req->time;
+			if (req->result == OK_RC)
+				accepted++;
+			else if (req->result == REJECT_RC)
+				rejected++;
+			else
+				bad++;
+			if (expect && req->result != BADRESP_RC && !strstr (req->msg, expect)) {
+				unexpected++;
+				reply_msg = req->msg;
+			}
+		}
+		/* the result of a single request, as the plugin always gave it */
+		if (host->replies == 0) {
+			host->state = STATE_CRITICAL;
+			snprintf (host->msg, sizeof (host->msg), "%s", _("Timeout"));
+		} else if (bad) {
+			host->state = STATE_WARNING;
+			snprintf (host->msg, sizeof (host->msg), "%s", _("Bad Response"));
+		} else if (rejected) {
+			host->state = STATE_WARNING;
+			snprintf (host->msg, sizeof (host->msg), "%s", _("Auth Failed"));
+		} else if (unexpected) {
+			host->state = STATE_WARNING;
+			snprintf (host->msg, sizeof (host->msg), "%s", reply_msg);
+		} else {
+			host->state = host->replies < burst ? STATE_WARNING : STATE_OK;
+			snprintf (host->msg, sizeof (host->msg), "%s", _("Auth OK"));
+		}
+		result = max_state (result, host->state);
+		if (host->state == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           host->name, host->msg);
+		if (host->replies == 0) {
+			xasprintf (&lines, "%s\n[%s] %s: %s", lines, state_text (host->state), host->name, host->msg);
+			continue;
+		}
+
+		qsort (times, host->replies, sizeof (double), compare_times);
+		snprintf (label, sizeof (label), "time@%s", host->name);
+		np_perfdata_addf (&perf, label, times[(host->replies - 1) / 2], "s",
+		                  FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+		if (burst == 1) {
+			xasprintf (&lines, "%s\n[%s] %s: %s, %.6f seconds response time", lines,
+			           state_text (host->state), host->name, host->msg, times[0]);
+			continue;
+		}
+		/* nearest rank */
+		n = (host->replies * 9 + 9) / 10 - 1;
+		snprintf (label, sizeof (label), "time_p90@%s", host->name);
+		np_perfdata_addf (&perf, label, times[n], "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+		snprintf (label, sizeof (label), "time_max@%s", host->name);
+		np_perfdata_addf (&perf, label, times[host->replies - 1], "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+		snprintf (label, sizeof (label), "replies@%s", host->name);
+		np_perfdata_add (&perf, label, host->replies, "", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, burst);
+		xasprintf (&lines, "%s\n[%s] %s: %s, %d of %d replies, median %.6f, 90th percentile %.6f, slowest %.6f seconds",
+		           lines, state_text (host->state), host->name, host->msg, host->replies, burst,
+		           times[(host->replies - 1) / 2], times[n], times[host->replies - 1]);
+	}
+
+	printf ("RADIUS %s: %d of %d %s%s%s|%s%s\n", state_text (result), count_ok, server_count,
+	        _("servers OK"), problems ? " - " : "", problems ? problems : "",
+	        np_perfdata_string (&perf), lines);
+	np_perfdata_free (&perf);
+	free (hosts);
+	free (reqs);
+	free (times);
+	return result;
+}
+
+
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
 {
 	int c;
+	char *name;
 
 	int option = 0;
 	static struct option longopts[] = {
 		{"hostname", required_argument, 0, 'H'},
+		{"burst", required_argument, 0, 'b'},
 		{"port", required_argument, 0, 'P'},
 		{"username", required_argument, 0, 'u'},
 		{"password", required_argument, 0, 'p'},
@@ -271,7 +688,7 @@ process_arguments (int argc, char **argv)
 	};
 
 	while (1) {
-		c = getopt_long (argc, argv, "+hVvH:P:F:u:p:n:N:c:t:r:e:", longopts,
+		c = getopt_long (argc, argv, "+hVvH:P:F:u:p:n:N:c:t:r:e:b:", longopts,
 									   &option);
 
 		if (c == -1 || c == EOF || c == 1)
@@ -289,11 +706,22 @@ process_arguments (int argc, char **argv)
 		case 'v':									/* verbose mode */
 			verbose = TRUE;
 			break;
-		case 'H':									/* hostname */
-			if (is_host (optarg) == FALSE) {
-				usage2 (_("Invalid hostname/address"), optarg);
+		case 'H':									/* hostname, or several */
+			for (name = strtok (optarg, ","); name != NULL; name = strtok (NULL, ",")) {
+				if (is_host (name) == FALSE) {
+					usage2 (_("Invalid hostname/address"), name);
+				}
+				servers = realloc (servers, (server_count + 1) * sizeof (char *));
+				if (servers == NULL)
+					die (STATE_UNKNOWN, _("Out of Memory?\n"));
+				servers[server_count++] = name;
 			}
-			server = optarg;
+			server = servers[0];
+			break;
+		case 'b':									/* requests per server */
+			if (!is_intpos (optarg) || atoi (optarg) > MAX_BURST)
+				usage2 (_("Burst must be a positive integer up to 256"), optarg);
+			burst = atoi (optarg);
 			break;
 		case 'P':									/* port */
 			if (is_intnonneg (optarg))
@@ -392,6 +820,9 @@ print_help (void)
   printf ("    %s\n", _("Response string to expect from the server"));
   printf (" %s\n", "-r, --retries=INTEGER");
   printf ("    %s\n", _("Number of times to retry a failed connection"));
+  printf (" %s\n", "-b, --burst=INTEGER");
+  printf ("    %s\n", _("Send this many requests to each server at once, and report the"));
+  printf ("    %s\n", _("median, 90th percentile and slowest reply times (default 1)"));
 
 	printf (UT_CONN_TIMEOUT, timeout_interval);
 
@@ -400,6 +831,11 @@ print_help (void)
   printf ("%s\n", _("The server to test must be specified in the invocation, as well as a user"));
   printf ("%s\n", _("name and password. A configuration file may also be present. The format of"));
   printf ("%s\n", _("the configuration file is described in the radiusclient library sources."));
+  printf ("\n");
+  printf ("%s\n", _("-H may be repeated or list several servers. The requests then go to all of"));
+  printf ("%s\n", _("them at once from one socket, each with its own identifier, with the secret"));
+  printf ("%s\n", _("of each server taken from the servers file of the configuration. A summary"));
+  printf ("%s\n", _("line is followed by a line for each server, with its reply time as perfdata."));
 	printf ("%s\n", _("The password option presents a substantial security issue because the"));
   printf ("%s\n", _("password can possibly be determined by careful watching of the command line"));
   printf ("%s\n", _("in a process listing. This risk is exacerbated because nagios will"));
@@ -415,8 +851,8 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-	printf ("%s -H host -F config_file -u username -p password\n\
-			[-P port] [-t timeout] [-r retries] [-e expect]\n\
+	printf ("%s -H host[,host...] -F config_file -u username -p password\n\
+			[-P port] [-t timeout] [-r retries] [-e expect] [-b burst]\n\
 			[-n nas-id] [-N nas-ip-addr]\n", progname);
 }
 
@@ -11,6 +11,8 @@
 * 
 * This plugin tests the REAL service on the specified host.
 * 
+* With several -u or --hosts, the streams of each server are asked for
+* on one connection and the servers are checked concurrently.
 * 
 * This program is free software: you can redistribute it and/or modify
 * it under the terms of the GNU General Public License as published by
@@ -36,6 +38,8 @@ const char *email = "devel@nagios-plugins.org";
 #include "netutils.h"
 #include "utils.h"
 
+#include <fcntl.h>
+
 enum {
 	PORT	= 554
 };
@@ -47,11 +51,17 @@ int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
+static int real_status_state (const char *);
+static int check_streams (void);
 
 int server_port = PORT;
 char *server_address;
 char *host_name;
 char *server_url = NULL;
+char **server_urls = NULL;
+int server_url_count = 0;
+char **hosts = NULL;
+int host_count = 0;
 char *server_expect;
 int warning_time = 0;
 int check_warning_time = FALSE;
@@ -69,10 +79,6 @@ main (int argc, char **argv)
 	char buffer[MAX_INPUT_BUFFER];
 	char *status_line = NULL;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
 
@@ -86,6 +92,9 @@ main (int argc, char **argv)
 	alarm (timeout_interval);
 	time (&start_time);
 
+	if (host_count || server_url_count > 1)
+		return check_streams ();
+
 	/* try to connect to the host at the given port number */
 	if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
 		die (STATE_CRITICAL, _("Unable to connect to %s on port %d\n"),
@@ -129,33 +138,7 @@ main (int argc, char **argv)
 
 		status_line = (char *) strtok (buffer, "\n");
 
-		if (strstr (status_line, "200"))
-			result = STATE_OK;
-
-		/* client errors result in a warning state */
-		else if (strstr (status_line, "400"))
-			result = STATE_WARNING;
-		else if (strstr (status_line, "401"))
-			result = STATE_WARNING;
-		else if (strstr (status_line, "402"))
-			result = STATE_WARNING;
-		else if (strstr (status_line, "403"))
-			result = STATE_WARNING;
-		else if (strstr (status_line, "404"))
-			result = STATE_WARNING;
-
-		/* server errors result in a critical state */
-		else if (strstr (status_line, "500"))
-			result = STATE_CRITICAL;
-		else if (strstr (status_line, "501"))
-			result = STATE_CRITICAL;
-		else if (strstr (status_line, "502"))
-			result = STATE_CRITICAL;
-		else if (strstr (status_line, "503"))
-			result = STATE_CRITICAL;
-
-		else
-			result = STATE_UNKNOWN;
+		result = real_status_state (status_line);
 	}
 
 	/* Part II - Check stream exists and is ok */
@@ -205,33 +188,7 @@ main (int argc, char **argv)
 
 				status_line = (char *) strtok (buffer, "\n");
 
-				if (strstr (status_line, "200"))
-					result = STATE_OK;
-
-				/* client errors result in a warning state */
-				else if (strstr (status_line, "400"))
-					result = STATE_WARNING;
-				else if (strstr (status_line, "401"))
-					result = STATE_WARNING;
-				else if (strstr (status_line, "402"))
-					result = STATE_WARNING;
-				else if (strstr (status_line, "403"))
-					result = STATE_WARNING;
-				else if (strstr (status_line, "404"))
-					result = STATE_WARNING;
-
-				/* server errors result in a critical state */
-				else if (strstr (status_line, "500"))
-					result = STATE_CRITICAL;
-				else if (strstr (status_line, "501"))
-					result = STATE_CRITICAL;
-				else if (strstr (status_line, "502"))
-					result = STATE_CRITICAL;
-				else if (strstr (status_line, "503"))
-					result = STATE_CRITICAL;
-
-				else
-					result = STATE_UNKNOWN;
+				result = real_status_state (status_line);
 			}
 		}
 	}
@@ -263,12 +220,360 @@ main (int argc, char **argv)
 }
 
 
+/* the state of an RTSP status line: 2xx are OK, client errors WARNING,
+ * server errors CRITICAL */
+static int
+real_status_state (const char *status_line)
+{
+	if (strstr (status_line, "200"))
+		return STATE_OK;
+
+	/* client errors result in a warning state */
+	else if (strstr (status_line, "400"))
+		return STATE_WARNING;
+	else if (strstr (status_line, "401"))
+		return STATE_WARNING;
+	else if (strstr (status_line, "402"))
+		return STATE_WARNING;
+	else if (strstr (status_line, "403"))
+		return STATE_WARNING;
+	else if (strstr (status_line, "404"))
+		return STATE_WARNING;
+
+	/* server errors result in a critical state */
+	else if (strstr (status_line, "500"))
+		return STATE_CRITICAL;
+	else if (strstr (status_line, "501"))
+		return STATE_CRITICAL;
+	else if (strstr (status_line, "502"))
+		return STATE_CRITICAL;
+	else if (strstr (status_line, "503"))
+		return STATE_CRITICAL;
+
+	return STATE_UNKNOWN;
+}
+
+
+/*
+ * Several servers or streams: each server gets one connection, on which
+ * the OPTIONS request and a DESCRIBE for each -u are sent at once with
+ * CSeq 1, 2, ... and their responses are matched back by it. The servers
+ * are checked at the same time, by one poll loop.
+ */
+enum {
+	REAL_STEP_CONNECT,
+	REAL_STEP_SEND,
+	REAL_STEP_RECV,
+	REAL_STEP_DONE
+};
+
+struct real_target {
+	const char *address;
+	int fd;
+	int step;
+	short events;
+	char *out;			/* the requests, all of them */
+	size_t out_len;
+	size_t sent;
+	char *in;			/* what has arrived and is not parsed yet */
+	size_t in_len;
+	size_t in_size;
+	int answered;			/* responses so far */
+	struct timeval start;
+	/* of each request: OPTIONS, then the DESCRIBE of each -u */
+	int *states;
+	char **msgs;
+	double *times;			/* seconds until its response, -1 without one */
+};
+
+static int real_requests;		/* in each connection */
+
+static void
+real_target_done (struct real_target *t, int state, const char *msg)
+{
+	int k;
+
+	for (k = 0; k < real_requests; k++) {
+		if (t->msgs[k] == NULL) {
+			t->states[k] = state;
+			t->msgs[k] = strdup (msg);
+		}
+	}
+	if (t->fd >= 0)
+		close (t->fd);
+	t->fd = -1;
+	t->step = REAL_STEP_DONE;
+}
+
+/* request k has its response, with status_line */
+static void
+real_request_answered (struct real_target *t, int k, char *status_line)
+{
+	char *p;
+
+	if (k < 0 || k >= real_requests || t->msgs[k] != NULL)
+		return;
+	if ((p = strpbrk (status_line, "\r\n")) != NULL)
+		*p = '\0';
+	t->times[k] = (double) deltime (t->start) / 1.0e6;
+
+	if (!strstr (status_line, server_expect)) {
+		t->states[k] = STATE_UNKNOWN;
+		t->msgs[k] = strdup (_("Invalid REAL response received from host"));
+		return;
+	}
+	t->states[k] = real_status_state (status_line);
+	if (t->states[k] != STATE_OK) {
+		t->msgs[k] = strdup (status_line);
+		return;
+	}
+	if (check_critical_time == TRUE && t->times[k] > critical_time)
+		t->states[k] = STATE_CRITICAL;
+	else if (check_warning_time == TRUE && t->times[k] > warning_time)
+		t->states[k] = STATE_WARNING;
+	xasprintf (&t->msgs[k], _("%.3f second response time"), t->times[k]);
+}
+
+/* the responses in t->in that are complete: their headers, and as much
+ * of a body as Content-Length has */
+static void
+real_target_parse (struct real_target *t)
+{
+	char *end, *p, *eol;
+	size_t head, body;
+	int cseq;
+
+	for (;;) {
+		t->in[t->in_len] = '\0';
+		if ((end = strstr (t->in, "\r\n\r\n")) != NULL)
+			head = end - t->in + 4;
+		else if ((end = strstr (t->in, "\n\n")) != NULL)
+			head = end - t->in + 2;
+		else
+			return;
+
+		body = 0;
+		cseq = t->answered + 1;
+		for (p = t->in; p < end && (eol = strchr (p, '\n')) != NULL; p = eol + 1) {
+			if (strncasecmp (p, "Content-Length:", 15) == 0)
+				body = strtoul (p + 15, NULL, 10);
+			else if (strncasecmp (p, "CSeq:", 5) == 0)
+				cseq = atoi (p + 5);
+		}
+		if (t->in_len < head + body)
+			return;
+
+		*end = '\0';
+		real_request_answered (t, cseq - 1, t->in);
+		t->answered++;
+		t->in_len -= head + body;
+		memmove (t->in, t->in + head + body, t->in_len);
+		if (t->answered >= real_requests) {
+			real_target_done (t, STATE_CRITICAL, _("No data received from host"));
+			return;
+		}
+	}
+}
+
+static void
+real_target_connect (struct real_target *t)
+{
+	struct addrinfo hints, *res;
+	char port_str[6];
+	int k, ret;
+
+	t->states = calloc (real_requests, sizeof (int));
+	t->msgs = calloc (real_requests, sizeof (char *));
+	t->times = malloc (real_requests * sizeof (double));
+	t->in_size = MAX_INPUT_BUFFER;
+	t->in = malloc (t->in_size);
+	if (t->states == NULL || t->msgs == NULL || t->times == NULL || t->in == NULL)
+		die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+	for (k = 0; k < real_requests; k++)
+		t->times[k] = -1;
+
+	xasprintf (&t->out, "OPTIONS rtsp://%s:%d RTSP/1.0\r\nCSeq: 1\r\n\r\n", t->address, server_port);
+	for (k = 0; k < server_url_count; k++)
+		xasprintf (&t->out, "%sDESCRIBE rtsp://%s:%d%s RTSP/1.0\r\nCSeq: %d\r\n\r\n",
+		           t->out, t->address, server_port, server_urls[k], k + 2);
+	t->out_len = strlen (t->out);
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = address_family;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf (port_str, sizeof (port_str), "%d", server_port);
+
+	gettimeofday (&t->start, NULL);
+	t->fd = -1;
+	if ((ret = np_net_getaddrinfo (t->address, port_str, &hints, &res)) != 0) {
+		real_target_done (t, STATE_CRITICAL, gai_strerror (ret));
+		return;
+	}
+	t->fd = socket (res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (t->fd < 0 || fcntl (t->fd, F_SETFL, O_NONBLOCK) < 0 ||
+	    (connect (t->fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS)) {
+		real_target_done (t, STATE_CRITICAL, strerror (errno));
+		return;
+	}
+	t->step = REAL_STEP_CONNECT;
+	t->events = POLLOUT;
+}
+
+/* move a server on as far as it goes without blocking */
+static void
+real_target_step (struct real_target *t)
+{
+	socklen_t len;
+	ssize_t n;
+	int err;
+
+	switch (t->step) {
+	case REAL_STEP_CONNECT:
+		len = sizeof (err);
+		if (getsockopt (t->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+			err = errno;
+		if (err) {
+			real_target_done (t, STATE_CRITICAL, strerror (err));
+			return;
+		}
+		t->step = REAL_STEP_SEND;
+		/* FALLTHROUGH */
+
+	case REAL_STEP_SEND:
+		while (t->sent < t->out_len) {
+			if ((n = send (t->fd, t->out + t->sent, t->out_len - t->sent, 0)) < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+					t->events = POLLOUT;
+				else
+					real_target_done (t, STATE_CRITICAL, _("Can not send data to host"));
+				return;
+			}
+			t->sent += n;
+		}
+		t->step = REAL_STEP_RECV;
+		t->events = POLLIN;
+		/* FALLTHROUGH */
+
+	case REAL_STEP_RECV:
+		for (;;) {
+			if (t->in_len + 1 >= t->in_size) {
+				t->in_size *= 2;
+				if ((t->in = realloc (t->in, t->in_size)) == NULL)
+					die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+			}
+			if ((n = read (t->fd, t->in + t->in_len, t->in_size - t->in_len - 1)) < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+					return;
+				n = 0;
+			}
+			if (n == 0) {
+				real_target_done (t, STATE_CRITICAL, _("No data received from host"));
+				return;
+			}
+			t->in_len += n;
+			real_target_parse (t);
+			if (t->step == REAL_STEP_DONE)
+				return;
+		}
+
+	default:
+		return;
+	}
+}
+
+/* the summary line, then a line for each request of each server */
+static int
+check_streams (void)
+{
+	struct real_target *targets;
+	struct pollfd *pfd;
+	int *active;
+	np_perfdata perf;
+	char *name, *problems = NULL;
+	int count, n, i, j, k, wait, count_ok = 0, result = STATE_OK;
+	int64_t deadline;
+
+	real_requests = 1 + server_url_count;
+	count = (server_address ? 1 : 0) + host_count;
+	targets = calloc (count, sizeof (*targets));
+	pfd = calloc (count, sizeof (*pfd));
+	active = calloc (count, sizeof (int));
+	if (targets == NULL || pfd == NULL || active == NULL)
+		die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+
+	deadline = np_net_deadline (0);
+	for (i = 0; i < count; i++) {
+		targets[i].address = (server_address && i == 0) ? server_address
+		                                                : hosts[i - (server_address ? 1 : 0)];
+		real_target_connect (&targets[i]);
+	}
+
+	for (;;) {
+		for (i = n = 0; i < count; i++) {
+			if (targets[i].step == REAL_STEP_DONE)
+				continue;
+			pfd[n].fd = targets[i].fd;
+			pfd[n].events = targets[i].events;
+			pfd[n].revents = 0;
+			active[n++] = i;
+		}
+		if (n == 0)
+			break;
+		if ((wait = np_net_time_left (deadline)) == 0) {
+			for (j = 0; j < n; j++)
+				real_target_done (&targets[active[j]], STATE_CRITICAL, _("No response before the timeout"));
+			break;
+		}
+		if (poll (pfd, n, wait) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, "%s %s\n", _("poll failed:"), strerror (errno));
+		for (j = 0; j < n; j++)
+			if (pfd[j].revents)
+				real_target_step (&targets[active[j]]);
+	}
+
+	np_perfdata_init (&perf);
+	for (i = 0; i < count; i++) {
+		for (k = 0; k < real_requests; k++) {
+			result = max_state_alt (result, targets[i].states[k]);
+			xasprintf (&name, "rtsp://%s:%d%s", targets[i].address, server_port,
+			           k ? server_urls[k - 1] : "");
+			if (targets[i].states[k] == STATE_OK)
+				count_ok++;
+			else
+				xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+				           name, targets[i].msgs[k]);
+			if (targets[i].times[k] >= 0) {
+				xasprintf (&name, "%s%s_time", targets[i].address, k ? server_urls[k - 1] : "");
+				np_perfdata_addf (&perf, name, targets[i].times[k], "s",
+				                  check_warning_time, warning_time, check_critical_time, critical_time,
+				                  TRUE, 0, FALSE, 0);
+			}
+		}
+	}
+
+	printf ("REAL %s: %d of %d streams OK%s%s|%s\n", state_text (result), count_ok, count * real_requests,
+	        problems ? " - " : "", problems ? problems : "", np_perfdata_string (&perf));
+	for (i = 0; i < count; i++)
+		for (k = 0; k < real_requests; k++)
+			printf ("[%s] rtsp://%s:%d%s: %s\n", state_text (targets[i].states[k]), targets[i].address,
+			        server_port, k ? server_urls[k - 1] : "", targets[i].msgs[k]);
+
+	alarm (0);
+	return result;
+}
+
+
 
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
 {
 	int c;
+	char *p;
+
+	enum {
+		HOSTS_OPTION = CHAR_MAX + 1
+	};
 
 	int option = 0;
 	static struct option longopts[] = {
@@ -276,6 +581,7 @@ process_arguments (int argc, char **argv)
 		{"IPaddress", required_argument, 0, 'I'},
 		{"expect", required_argument, 0, 'e'},
 		{"url", required_argument, 0, 'u'},
+		{"hosts", required_argument, 0, HOSTS_OPTION},
 		{"port", required_argument, 0, 'p'},
 		{"critical", required_argument, 0, 'c'},
 		{"warning", required_argument, 0, 'w'},
@@ -318,8 +624,23 @@ process_arguments (int argc, char **argv)
 		case 'e':									/* string to expect in response header */
 			server_expect = optarg;
 			break;
-		case 'u':									/* server URL */
-			server_url = optarg;
+		case 'u':									/* server URL, may be repeated */
+			if (server_url == NULL)
+				server_url = optarg;
+			server_urls = realloc (server_urls, (server_url_count + 1) * sizeof (char *));
+			if (server_urls == NULL)
+				die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+			server_urls[server_url_count++] = optarg;
+			break;
+		case HOSTS_OPTION:							/* more servers, checked concurrently */
+			for (p = strtok (optarg, ","); p != NULL; p = strtok (NULL, ",")) {
+				if (!is_host (p))
+					usage2 (_("Invalid hostname/address"), p);
+				hosts = realloc (hosts, (host_count + 1) * sizeof (char *));
+				if (hosts == NULL)
+					die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+				hosts[host_count++] = p;
+			}
 			break;
 		case 'p':									/* port */
 			if (is_intpos (optarg)) {
@@ -349,6 +670,7 @@ process_arguments (int argc, char **argv)
 			break;
 		case 'v':									/* verbose */
 			verbose = TRUE;
+			np_net_verbose = TRUE;
 			break;
 		case 't':									/* timeout */
 			timeout_interval = parse_timeout_string (optarg);
@@ -374,10 +696,10 @@ process_arguments (int argc, char **argv)
 		}
 	}
 
-	if (server_address==NULL)
+	if (server_address==NULL && host_count==0)
 		usage4 (_("You must provide a server to check"));
 
-	if (host_name==NULL)
+	if (host_name==NULL && server_address)
 		host_name = strdup (server_address);
 
 	if (server_expect == NULL)
@@ -419,7 +741,11 @@ print_help (void)
 	printf (UT_HOST_PORT, 'p', myport);
 
 	printf (" %s\n", "-u, --url=STRING");
-  printf ("    %s\n", _("Connect to this url"));
+  printf ("    %s\n", _("Connect to this url; may be repeated, to ask for each of them with one"));
+  printf ("    %s\n", _("DESCRIBE request on the same connection"));
+  printf (" %s\n", "--hosts=HOST[,HOST...]");
+  printf ("    %s\n", _("Also check these servers (may be repeated), all at the same time, with a"));
+  printf ("    %s\n", _("line and response time perfdata for each request of each server"));
   printf (" %s\n", "-e, --expect=STRING");
   printf (_("String to expect in first line of server response (default: %s)\n"),
 	       EXPECT);
@@ -447,4 +773,5 @@ print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
 	printf ("%s -H host [-e expect] [-p port] [-w warn] [-c crit] [-t timeout] [-v]\n", progname);
+	printf ("  [-u url [-u url...]] [--hosts=host[,host...]]\n");
 }
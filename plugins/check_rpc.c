@@ -0,0 +1,882 @@
+/*****************************************************************************
+*
+* Nagios check_rpc plugin
+*
+* License: GPL
+* Copyright (c) 2000-2002 Karl DeBisschop, Truongchinh Nguyen, Subhendu Ghosh
+* Copyright (c) 2026 Nagios Plugins Development Team
+*
+* Description:
+*
+* This file contains the check_rpc plugin
+*
+* Checks that RPC programs are registered with the portmapper of a host
+* and answer calls of their NULL procedure. The registrations come from
+* one PMAPPROC_DUMP; the NULL calls to all the programs and versions then
+* go out at once, over UDP from one socket or over a TCP connection each,
+* and are timed each. This replaces check_rpc.pl, which ran rpcinfo for
+* each version in turn.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+const char *progname = "check_rpc";
+const char *copyright = "2000-2026";
+const char *email = "devel@nagios-plugins.org";
+
+#include "common.h"
+#include "netutils.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <poll.h>
+
+#define PMAP_PROG 100000
+#define PMAP_VERS 2
+#define PMAP_PORT 111
+#define PMAPPROC_DUMP 4
+
+#define RPC_CALL 0
+#define RPC_REPLY 1
+#define RPC_MSG_ACCEPTED 0
+#define RPC_SUCCESS 0
+#define RPC_PROG_UNAVAIL 1
+#define RPC_PROG_MISMATCH 2
+#define RPC_LAST_FRAGMENT 0x80000000UL
+
+/* how often an unanswered call over UDP is sent again, in milliseconds */
+#define RPC_RESEND_MS 1000
+#define RPC_MAX_VERSIONS 32
+
+enum {
+	TIMEOUT_OPTION = CHAR_MAX + 1,
+	PORTMAPPER_OPTION
+};
+
+enum {
+	PROBE_CONNECTING,
+	PROBE_WAITING,
+	PROBE_DONE
+};
+
+/* The programs rpcinfo and check_rpc.pl knew by name */
+static const struct {
+	const char *name;
+	unsigned long number;
+} rpc_programs[] = {
+	{ "portmapper", 100000 }, { "portmap", 100000 }, { "sunrpc", 100000 },
+	{ "rpcbind", 100000 }, { "rstatd", 100001 }, { "rstat", 100001 },
+	{ "rup", 100001 }, { "perfmeter", 100001 }, { "rstat_svc", 100001 },
+	{ "rusersd", 100002 }, { "rusers", 100002 }, { "nfs", 100003 },
+	{ "nfsprog", 100003 }, { "ypserv", 100004 }, { "ypprog", 100004 },
+	{ "mountd", 100005 }, { "mount", 100005 }, { "showmount", 100005 },
+	{ "ypbind", 100007 }, { "walld", 100008 }, { "rwall", 100008 },
+	{ "shutdown", 100008 }, { "yppasswdd", 100009 }, { "yppasswd", 100009 },
+	{ "etherstatd", 100010 }, { "etherstat", 100010 }, { "rquotad", 100011 },
+	{ "rquotaprog", 100011 }, { "quota", 100011 }, { "rquota", 100011 },
+	{ "sprayd", 100012 }, { "spray", 100012 }, { "3270_mapper", 100013 },
+	{ "rje_mapper", 100014 }, { "selection_svc", 100015 }, { "selnsvc", 100015 },
+	{ "database_svc", 100016 }, { "rexd", 100017 }, { "rex", 100017 },
+	{ "alis", 100018 }, { "sched", 100019 }, { "llockmgr", 100020 },
+	{ "nlockmgr", 100021 }, { "x25_inr", 100022 }, { "statmon", 100023 },
+	{ "status", 100024 }, { "bootparam", 100026 }, { "ypupdated", 100028 },
+	{ "ypupdate", 100028 }, { "keyserv", 100029 }, { "keyserver", 100029 },
+	{ "sunlink_mapper", 100033 }, { "tfsd", 100037 }, { "nsed", 100038 },
+	{ "nsemntd", 100039 }, { "showfhd", 100043 }, { "showfh", 100043 },
+	{ "ioadmd", 100055 }, { "rpc.ioadmd", 100055 }, { "NETlicense", 100062 },
+	{ "sunisamd", 100065 }, { "debug_svc", 100066 }, { "dbsrv", 100066 },
+	{ "ypxfrd", 100069 }, { "rpc.ypxfrd", 100069 }, { "bugtraqd", 100071 },
+	{ "kerbd", 100078 }, { "event", 100101 }, { "na.event", 100101 },
+	{ "logger", 100102 }, { "na.logger", 100102 }, { "sync", 100104 },
+	{ "na.sync", 100104 }, { "hostperf", 100107 }, { "na.hostperf", 100107 },
+	{ "activity", 100109 }, { "na.activity", 100109 }, { "hostmem", 100112 },
+	{ "na.hostmem", 100112 }, { "sample", 100113 }, { "na.sample", 100113 },
+	{ "x25", 100114 }, { "na.x25", 100114 }, { "ping", 100115 },
+	{ "na.ping", 100115 }, { "rpcnfs", 100116 }, { "na.rpcnfs", 100116 },
+	{ "hostif", 100117 }, { "na.hostif", 100117 }, { "etherif", 100118 },
+	{ "na.etherif", 100118 }, { "iproutes", 100120 }, { "na.iproutes", 100120 },
+	{ "layers", 100121 }, { "na.layers", 100121 }, { "snmp", 100122 },
+	{ "na.snmp", 100122 }, { "snmp-cmc", 100122 }, { "snmp-synoptics", 100122 },
+	{ "snmp-unisys", 100122 }, { "snmp-utk", 100122 }, { "traffic", 100123 },
+	{ "na.traffic", 100123 }, { "nfs_acl", 100227 }, { "sadmind", 100232 },
+	{ "nisd", 100300 }, { "rpc.nisd", 100300 }, { "nispasswd", 100303 },
+	{ "rpc.nispasswdd", 100303 }, { "ufsd", 100233 }, { "pcnfsd", 150001 },
+	{ "pcnfs", 150001 }, { "amd", 300019 }, { "amq", 300019 },
+	{ "bwnfsd", 545580417 }, { "fypxfrd", 600100069 }, { "freebsd-ypxfrd", 600100069 },
+	{ NULL, 0 }
+};
+
+/* a program of -C, with its versions of -c or its own */
+typedef struct rpc_request {
+	const char *name;
+	unsigned long number;
+	unsigned long versions[RPC_MAX_VERSIONS];
+	int nversions;
+} rpc_request;
+
+/* a registration of PMAPPROC_DUMP */
+typedef struct rpc_mapping {
+	unsigned long prog;
+	unsigned long vers;
+	unsigned long prot;
+	unsigned long port;
+} rpc_mapping;
+
+/* one NULL call, of one version of a program */
+typedef struct rpc_probe {
+	const rpc_request *request;
+	unsigned long version;        /* 0 for any, with -p and no -c */
+	unsigned long low, high;      /* the versions there are, for any */
+	int port;
+	uint32_t xid;
+	int sd;                       /* its connection, over TCP */
+	int step;
+	struct timeval start;
+	int64_t resend;               /* when to send it again, over UDP */
+	unsigned char reply[128];
+	size_t got;
+	double time;
+	int state;
+	char msg[96];
+} rpc_probe;
+
+int process_arguments (int, char **);
+void print_help (void);
+void print_usage (void);
+void add_request (const char *);
+int parse_versions (const char *, unsigned long *, int);
+int rpc_call (unsigned char *, uint32_t, unsigned long, unsigned long, unsigned long, int);
+int get_portmap (rpc_mapping **);
+void run_probes (rpc_probe *, int);
+void probe_reply (rpc_probe *, const unsigned char *, size_t);
+void probe_done (rpc_probe *, int, const char *);
+void print_programs (void);
+
+char *server_address = NULL;
+int server_port = 0;
+int portmapper_port = PMAP_PORT;
+int use_tcp = FALSE;
+int use_udp = FALSE;
+rpc_request *requests = NULL;
+int nrequests = 0;
+char *versions_arg = NULL;
+int verbose = 0;
+struct sockaddr_storage server_addr;
+socklen_t server_addrlen;
+
+/* the XDR integers of the messages, in network order */
+#define PUT32(p, v) ((p)[0] = ((v) >> 24) & 0xff, (p)[1] = ((v) >> 16) & 0xff, \
+                     (p)[2] = ((v) >> 8) & 0xff, (p)[3] = (v) & 0xff)
+#define GET32(p) (((uint32_t) (p)[0] << 24) | ((uint32_t) (p)[1] << 16) | \
+                  ((uint32_t) (p)[2] << 8) | (uint32_t) (p)[3])
+
+int
+main (int argc, char **argv)
+{
+	int result = STATE_OK, nmaps = 0, nprobes = 0, count_ok = 0, i, j, k, proto;
+	rpc_mapping *maps = NULL;
+	rpc_probe *probes, *p;
+	rpc_request *r;
+	struct addrinfo hints, *res;
+	char *problems = NULL, *running = NULL, *stopped = NULL, port[8], label[64];
+	const char *proto_name;
+	np_perfdata perf;
+
+	/* Parse extra opts if any */
+	argv = np_extra_opts (&argc, argv, progname);
+
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	proto = use_tcp ? IPPROTO_TCP : IPPROTO_UDP;
+	proto_name = use_tcp ? "tcp" : "udp";
+
+	/* Just in case of problems, let's not hang Nagios */
+	signal (SIGALRM, socket_timeout_alarm_handler);
+	alarm (timeout_interval);
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = address_family;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+	snprintf (port, sizeof (port), "%d", portmapper_port);
+	if ((i = np_net_getaddrinfo (server_address, port, &hints, &res)) != 0)
+		die (STATE_UNKNOWN, _("RPC UNKNOWN: %s: %s\n"), server_address, gai_strerror (i));
+	memcpy (&server_addr, res->ai_addr, res->ai_addrlen);
+	server_addrlen = res->ai_addrlen;
+
+	/* the versions each program has registered, unless the port is given */
+	if (server_port == 0)
+		nmaps = get_portmap (&maps);
+
+	probes = calloc (nrequests * RPC_MAX_VERSIONS, sizeof (rpc_probe));
+	if (probes == NULL)
+		die (STATE_UNKNOWN, _("RPC UNKNOWN: %s\n"), _("Cannot allocate memory"));
+	for (i = 0; i < nrequests; i++) {
+		r = &requests[i];
+		if (r->nversions == 0 && server_port == 0) {
+			for (j = 0; j < nmaps; j++) {
+				if (maps[j].prog != r->number || maps[j].prot != (unsigned long) proto)
+					continue;
+				for (k = 0; k < r->nversions && r->versions[k] != maps[j].vers; k++)
+					;
+				if (k == r->nversions && r->nversions < RPC_MAX_VERSIONS)
+					r->versions[r->nversions++] = maps[j].vers;
+			}
+			if (r->nversions == 0) {
+				result = STATE_CRITICAL;
+				xasprintf (&problems, _("%s%sprogram %s is not registered for %s"),
+				           problems ? problems : "", problems ? "; " : "", r->name, proto_name);
+				continue;
+			}
+		}
+		if (r->nversions == 0) {
+			p = &probes[nprobes++];
+			p->request = r;
+			p->port = server_port;
+			continue;
+		}
+		for (j = 0; j < r->nversions; j++) {
+			p = &probes[nprobes++];
+			p->request = r;
+			p->version = r->versions[j];
+			p->port = server_port;
+			for (k = 0; k < nmaps && !p->port; k++)
+				if (maps[k].prog == r->number && maps[k].vers == p->version
+				    && maps[k].prot == (unsigned long) proto)
+					p->port = (int) maps[k].port;
+			if (p->port == 0)
+				probe_done (p, STATE_CRITICAL, _("not registered"));
+		}
+	}
+
+	run_probes (probes, nprobes);
+
+	np_perfdata_init (&perf);
+	for (i = 0; i < nprobes; i++) {
+		p = &probes[i];
+		result = max_state_alt (p->state, result);
+		if (p->state == STATE_OK && p->version == 0) {
+			count_ok++;
+			for (k = p->low; k <= (int) p->high && k < (int) p->low + RPC_MAX_VERSIONS; k++)
+				xasprintf (&running, "%s version %d", running ? running : "", k);
+			snprintf (label, sizeof (label), "%s_%s", p->request->name, proto_name);
+			np_perfdata_addf (&perf, label, p->time, "s",
+			                  FALSE, 0, FALSE, 0, TRUE, 0, TRUE, (double) timeout_interval);
+		} else if (p->state == STATE_OK) {
+			count_ok++;
+			xasprintf (&running, "%s version %lu", running ? running : "", p->version);
+			snprintf (label, sizeof (label), "%s_v%lu_%s", p->request->name, p->version, proto_name);
+			np_perfdata_addf (&perf, label, p->time, "s",
+			                  FALSE, 0, FALSE, 0, TRUE, 0, TRUE, (double) timeout_interval);
+		} else {
+			if (p->version)
+				xasprintf (&stopped, "%s version %lu", stopped ? stopped : "", p->version);
+			xasprintf (&problems, "%s%s%s version %lu %s: %s", problems ? problems : "",
+			           problems ? "; " : "", p->request->name, p->version, proto_name, p->msg);
+		}
+	}
+
+	/* one program says what check_rpc.pl said of it */
+	if (nrequests == 1) {
+		if (result == STATE_OK)
+			printf (_("OK: RPC program %s%s %s running"), requests[0].name, running, proto_name);
+		else if (running)
+			printf (_("%s: RPC program %s%s %s is not running,%s %s is running"), state_text (result),
+			        requests[0].name, stopped ? stopped : "", proto_name, running, proto_name);
+		else
+			printf (_("%s: RPC program %s%s %s is not running"), state_text (result),
+			        requests[0].name, stopped ? stopped : "", proto_name);
+		if (problems && verbose)
+			printf (" - %s", problems);
+		printf ("|%s\n", np_perfdata_string (&perf));
+	} else {
+		printf (_("RPC %s: %d of %d program versions running%s%s|%s\n"), state_text (result),
+		        count_ok, nprobes, problems ? " - " : "", problems ? problems : "",
+		        np_perfdata_string (&perf));
+		for (i = 0; i < nprobes; i++)
+			printf ("[%s] %s version %lu %s: %s\n", state_text (probes[i].state),
+			        probes[i].request->name, probes[i].version, proto_name, probes[i].msg);
+	}
+	np_perfdata_free (&perf);
+
+	return result;
+}
+
+
+
+/* a call message of procedure proc, with the record mark over TCP;
+ * returns its length */
+int
+rpc_call (unsigned char *buf, uint32_t xid, unsigned long prog, unsigned long vers,
+          unsigned long proc, int tcp)
+{
+	unsigned char *p = buf + (tcp ? 4 : 0);
+	uint32_t fields[] = { xid, RPC_CALL, 2, prog, vers, proc, 0, 0, 0, 0 };
+	size_t i;
+
+	/* xid, call, RPC version 2, program, version, procedure and
+	 * AUTH_NONE credentials and verifier */
+	for (i = 0; i < sizeof (fields) / sizeof (fields[0]); i++, p += 4)
+		PUT32 (p, fields[i]);
+	if (tcp)
+		PUT32 (buf, RPC_LAST_FRAGMENT | (uint32_t) (p - buf - 4));
+	return (int) (p - buf);
+}
+
+
+
+/* The registrations of PMAPPROC_DUMP, over TCP as rpcinfo -p does, for
+ * the list does not always fit a datagram */
+int
+get_portmap (rpc_mapping **maps)
+{
+	unsigned char call[64], head[4], *reply = NULL, *p, *end;
+	size_t len = 0, size = 0, frag;
+	int sd, n = 0, last = 0, ret;
+	uint32_t mark, xid = (uint32_t) getpid () ^ 0x706d6170;
+	int64_t deadline = np_net_deadline (0);
+
+	if (np_net_connect (server_address, portmapper_port, &sd, IPPROTO_TCP) != STATE_OK)
+		die (STATE_CRITICAL, _("CRITICAL: RPC portmapper on %s: %s\n"), server_address,
+		     was_refused ? _("Connection refused") : _("No connection"));
+
+	ret = rpc_call (call, xid, PMAP_PROG, PMAP_VERS, PMAPPROC_DUMP, TRUE);
+	if (send (sd, call, ret, 0) != ret)
+		die (STATE_CRITICAL, _("CRITICAL: RPC portmapper on %s: %s\n"), server_address, strerror (errno));
+
+	/* the fragments of the record, each after its mark */
+	while (!last) {
+		for (frag = 0; frag < 4; frag += ret)
+			if (np_net_wait (sd, POLLIN, deadline) <= 0
+			    || (ret = recv (sd, head + frag, 4 - frag, 0)) <= 0)
+				die (STATE_CRITICAL, _("CRITICAL: RPC portmapper on %s: %s\n"), server_address,
+				     _("No reply to PMAPPROC_DUMP"));
+		mark = GET32 (head);
+		last = (mark & RPC_LAST_FRAGMENT) != 0;
+		frag = mark & ~RPC_LAST_FRAGMENT;
+		if (len + frag > 1 << 20)
+			die (STATE_CRITICAL, _("CRITICAL: RPC portmapper on %s: %s\n"), server_address,
+			     _("Reply too long"));
+		if (len + frag > size) {
+			size = len + frag;
+			if ((reply = realloc (reply, size)) == NULL)
+				die (STATE_UNKNOWN, _("RPC UNKNOWN: %s\n"), _("Cannot allocate memory"));
+		}
+		for (; frag > 0; frag -= ret, len += ret)
+			if (np_net_wait (sd, POLLIN, deadline) <= 0
+			    || (ret = recv (sd, reply + len, frag, 0)) <= 0)
+				die (STATE_CRITICAL, _("CRITICAL: RPC portmapper on %s: %s\n"), server_address,
+				     _("No reply to PMAPPROC_DUMP"));
+	}
+	close (sd);
+
+	/* xid, reply, accepted, a verifier, success and the list */
+	p = reply;
+	end = reply + len;
+	if (len < 24 || GET32 (p) != xid || GET32 (p + 4) != RPC_REPLY || GET32 (p + 8) != RPC_MSG_ACCEPTED)
+		die (STATE_CRITICAL, _("CRITICAL: RPC portmapper on %s: %s\n"), server_address,
+		     _("Invalid reply to PMAPPROC_DUMP"));
+	p += 16 + ((GET32 (p + 16) + 3) & ~3U) + 4;
+	if (p + 4 > end || GET32 (p) != RPC_SUCCESS)
+		die (STATE_CRITICAL, _("CRITICAL: RPC portmapper on %s: %s\n"), server_address,
+		     _("PMAPPROC_DUMP failed"));
+	for (p += 4; p + 4 <= end && GET32 (p) == 1 && p + 20 <= end; p += 20) {
+		*maps = realloc (*maps, (n + 1) * sizeof (rpc_mapping));
+		(*maps)[n].prog = GET32 (p + 4);
+		(*maps)[n].vers = GET32 (p + 8);
+		(*maps)[n].prot = GET32 (p + 12);
+		(*maps)[n].port = GET32 (p + 16);
+		if (verbose >= 2)
+			printf ("portmapper: program %lu version %lu %s port %lu\n", (*maps)[n].prog,
+			        (*maps)[n].vers, (*maps)[n].prot == IPPROTO_TCP ? "tcp" : "udp", (*maps)[n].port);
+		n++;
+	}
+	free (reply);
+	return n;
+}
+
+
+
+/* All the NULL calls at once: over UDP from one socket, sent again until
+ * answered, or over a connection each for TCP, until all are answered or
+ * the deadline passes */
+void
+run_probes (rpc_probe *probes, int nprobes)
+{
+	struct pollfd *pfds;
+	struct sockaddr_storage addr;
+	unsigned char call[64], buf[512];
+	int64_t deadline = np_net_deadline (0);
+	int udp = -1, i, n, len, pending, ret, wait, family = server_addr.ss_family;
+	uint32_t base = (uint32_t) getpid () << 12;
+	socklen_t addrlen;
+	rpc_probe *p;
+
+	if ((pfds = calloc (nprobes + 1, sizeof (struct pollfd))) == NULL)
+		die (STATE_UNKNOWN, _("RPC UNKNOWN: %s\n"), _("Cannot allocate memory"));
+
+	for (i = 0; i < nprobes; i++) {
+		p = &probes[i];
+		if (p->step == PROBE_DONE)
+			continue;
+		p->xid = base + i;
+		p->sd = -1;
+		gettimeofday (&p->start, NULL);
+		memcpy (&addr, &server_addr, server_addrlen);
+		if (family == AF_INET6)
+			((struct sockaddr_in6 *) &addr)->sin6_port = htons (p->port);
+		else
+			((struct sockaddr_in *) &addr)->sin_port = htons (p->port);
+
+		if (!use_tcp) {
+			if (udp < 0 && (udp = socket (family, SOCK_DGRAM, 0)) < 0)
+				die (STATE_UNKNOWN, _("RPC UNKNOWN: %s\n"), strerror (errno));
+			len = rpc_call (call, p->xid, p->request->number, p->version, 0, FALSE);
+			sendto (udp, call, len, 0, (struct sockaddr *) &addr, server_addrlen);
+			p->resend = np_net_deadline (RPC_RESEND_MS);
+			p->step = PROBE_WAITING;
+			continue;
+		}
+
+		if ((p->sd = socket (family, SOCK_STREAM, 0)) < 0) {
+			probe_done (p, STATE_UNKNOWN, strerror (errno));
+			continue;
+		}
+		fcntl (p->sd, F_SETFL, fcntl (p->sd, F_GETFL) | O_NONBLOCK);
+		if (connect (p->sd, (struct sockaddr *) &addr, server_addrlen) < 0 && errno != EINPROGRESS)
+			probe_done (p, STATE_CRITICAL, strerror (errno));
+		else
+			p->step = PROBE_CONNECTING;
+	}
+
+	while (np_net_time_left (deadline) > 0) {
+		n = pending = 0;
+		wait = np_net_time_left (deadline);
+		if (udp >= 0) {
+			pfds[n].fd = udp;
+			pfds[n++].events = POLLIN;
+		}
+		for (i = 0; i < nprobes; i++) {
+			p = &probes[i];
+			if (p->step == PROBE_DONE)
+				continue;
+			pending++;
+			if (p->sd < 0) {
+				/* a datagram that may have been lost goes again */
+				if (np_net_time_left (p->resend) == 0) {
+					len = rpc_call (call, p->xid, p->request->number, p->version, 0, FALSE);
+					memcpy (&addr, &server_addr, server_addrlen);
+					if (family == AF_INET6)
+						((struct sockaddr_in6 *) &addr)->sin6_port = htons (p->port);
+					else
+						((struct sockaddr_in *) &addr)->sin_port = htons (p->port);
+					sendto (udp, call, len, 0, (struct sockaddr *) &addr, server_addrlen);
+					p->resend = np_net_deadline (RPC_RESEND_MS);
+				}
+				if (np_net_time_left (p->resend) < wait)
+					wait = np_net_time_left (p->resend);
+				continue;
+			}
+			pfds[n].fd = p->sd;
+			pfds[n++].events = p->step == PROBE_CONNECTING ? POLLOUT : POLLIN;
+		}
+		if (pending == 0)
+			break;
+
+		if ((ret = poll (pfds, n, wait)) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, _("RPC UNKNOWN: %s\n"), strerror (errno));
+		if (ret <= 0)
+			continue;
+
+		for (i = 0; i < n; i++) {
+			if (!pfds[i].revents)
+				continue;
+
+			/* replies over UDP, told apart by their xid */
+			if (pfds[i].fd == udp) {
+				while ((len = recv (udp, buf, sizeof (buf), MSG_DONTWAIT)) >= 4) {
+					ret = (int) (GET32 (buf) - base);
+					if (ret >= 0 && ret < nprobes && probes[ret].step == PROBE_WAITING
+					    && probes[ret].sd < 0)
+						probe_reply (&probes[ret], buf, len);
+				}
+				continue;
+			}
+
+			for (p = probes; p->sd != pfds[i].fd; p++)
+				;
+			if (p->step == PROBE_CONNECTING) {
+				addrlen = sizeof (ret);
+				if (getsockopt (p->sd, SOL_SOCKET, SO_ERROR, &ret, &addrlen) < 0 || ret != 0) {
+					probe_done (p, STATE_CRITICAL, strerror (ret ? ret : errno));
+					continue;
+				}
+				len = rpc_call (call, p->xid, p->request->number, p->version, 0, TRUE);
+				if (send (p->sd, call, len, 0) != len) {
+					probe_done (p, STATE_CRITICAL, strerror (errno));
+					continue;
+				}
+				p->step = PROBE_WAITING;
+				continue;
+			}
+
+			/* the record over TCP, whole once its mark's length is there */
+			len = recv (p->sd, p->reply + p->got, sizeof (p->reply) - p->got, 0);
+			if (len <= 0) {
+				probe_done (p, STATE_CRITICAL, len < 0 ? strerror (errno) : _("Connection closed"));
+				continue;
+			}
+			p->got += len;
+			if (p->got >= 4 && (p->got >= 4 + (GET32 (p->reply) & ~RPC_LAST_FRAGMENT)
+			                    || p->got == sizeof (p->reply)))
+				probe_reply (p, p->reply + 4, p->got - 4);
+		}
+	}
+
+	for (i = 0; i < nprobes; i++)
+		if (probes[i].step != PROBE_DONE)
+			probe_done (&probes[i], STATE_CRITICAL, _("No response"));
+	if (udp >= 0)
+		close (udp);
+	free (pfds);
+}
+
+
+
+/* what the reply to a NULL call says of the program */
+void
+probe_reply (rpc_probe *p, const unsigned char *buf, size_t len)
+{
+	const unsigned char *q;
+	char msg[64];
+
+	p->time = (double) deltime (p->start) / 1.0e6;
+	if (len < 24 || GET32 (buf) != p->xid || GET32 (buf + 4) != RPC_REPLY) {
+		probe_done (p, STATE_CRITICAL, _("Invalid reply"));
+		return;
+	}
+	if (GET32 (buf + 8) != RPC_MSG_ACCEPTED) {
+		probe_done (p, STATE_CRITICAL, _("Call rejected"));
+		return;
+	}
+
+	/* after the verifier, whatever its length */
+	q = buf + 16 + ((GET32 (buf + 16) + 3) & ~3U) + 4;
+	if (q + 4 > buf + len) {
+		probe_done (p, STATE_CRITICAL, _("Invalid reply"));
+		return;
+	}
+	switch (GET32 (q)) {
+	case RPC_SUCCESS:
+		snprintf (msg, sizeof (msg), _("running, %.1f ms"), p->time * 1000);
+		probe_done (p, STATE_OK, msg);
+		break;
+	case RPC_PROG_UNAVAIL:
+		probe_done (p, STATE_CRITICAL, _("program not available"));
+		break;
+	case RPC_PROG_MISMATCH:
+		if (q + 12 > buf + len) {
+			probe_done (p, STATE_CRITICAL, _("version not available"));
+			break;
+		}
+		/* any version will do, and these are there */
+		if (p->version == 0) {
+			p->low = GET32 (q + 4);
+			p->high = GET32 (q + 8);
+			snprintf (msg, sizeof (msg), _("versions %lu to %lu running, %.1f ms"),
+			          (unsigned long) GET32 (q + 4), (unsigned long) GET32 (q + 8), p->time * 1000);
+			probe_done (p, STATE_OK, msg);
+		} else {
+			snprintf (msg, sizeof (msg), _("version not available, only %lu to %lu"),
+			          (unsigned long) GET32 (q + 4), (unsigned long) GET32 (q + 8));
+			probe_done (p, STATE_CRITICAL, msg);
+		}
+		break;
+	default:
+		probe_done (p, STATE_CRITICAL, _("NULL procedure failed"));
+	}
+}
+
+
+
+void
+probe_done (rpc_probe *p, int state, const char *msg)
+{
+	p->state = state;
+	p->step = PROBE_DONE;
+	snprintf (p->msg, sizeof (p->msg), "%s", msg);
+	if (p->sd >= 0) {
+		close (p->sd);
+		p->sd = -1;
+	}
+	if (verbose)
+		printf ("%s version %lu port %d: %s\n", p->request->name, p->version, p->port, p->msg);
+}
+
+
+
+/* PROGRAM or PROGRAM:VERSION[,VERSION...], by name or number */
+void
+add_request (const char *arg)
+{
+	rpc_request *r;
+	char *name = strdup (arg), *versions, *end;
+	int i;
+
+	if ((versions = strchr (name, ':')) != NULL)
+		*versions++ = '\0';
+
+	requests = realloc (requests, (nrequests + 1) * sizeof (rpc_request));
+	r = &requests[nrequests++];
+	memset (r, 0, sizeof (rpc_request));
+	r->name = name;
+	r->number = strtoul (name, &end, 10);
+	if (*name == '\0' || *end != '\0') {
+		for (i = 0; rpc_programs[i].name && strcmp (rpc_programs[i].name, name); i++)
+			;
+		if (rpc_programs[i].name == NULL)
+			die (STATE_UNKNOWN, _("Program %s is not defined\n"), name);
+		r->number = rpc_programs[i].number;
+	}
+	if (versions)
+		r->nversions = parse_versions (versions, r->versions, RPC_MAX_VERSIONS);
+}
+
+
+
+int
+parse_versions (const char *arg, unsigned long *versions, int max)
+{
+	const char *p = arg;
+	char *end;
+	int n = 0;
+
+	while (*p) {
+		if (n == max)
+			usage2 (_("Too many versions"), arg);
+		versions[n] = strtoul (p, &end, 10);
+		if (end == p || (*end && *end != ',') || versions[n] == 0)
+			usage2 (_("Versions must be positive integers, separated by commas"), arg);
+		n++;
+		p = *end ? end + 1 : end;
+	}
+	return n;
+}
+
+
+
+/* process command-line arguments */
+int
+process_arguments (int argc, char **argv)
+{
+	int c, i;
+	unsigned long versions[RPC_MAX_VERSIONS];
+
+	int option = 0;
+	static struct option longopts[] = {
+		{"hostname", required_argument, 0, 'H'},
+		{"command", required_argument, 0, 'C'},
+		{"progver", required_argument, 0, 'c'},
+		{"port", required_argument, 0, 'p'},
+		{"udp", no_argument, 0, 'u'},
+		{"tcp", no_argument, 0, 't'},
+		{"timeout", required_argument, 0, TIMEOUT_OPTION},
+		{"portmapper", required_argument, 0, PORTMAPPER_OPTION},
+		{"use-ipv4", no_argument, 0, '4'},
+		{"use-ipv6", no_argument, 0, '6'},
+		{"verbose", no_argument, 0, 'v'},
+		{"version", no_argument, 0, 'V'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while (1) {
+		c = getopt_long (argc, argv, "hVvut46H:C:c:p:", longopts, &option);
+
+		if (c == -1 || c == EOF)
+			break;
+
+		switch (c) {
+		case 'h':									/* help */
+			print_help ();
+			exit (STATE_OK);
+		case 'V':									/* version */
+			print_revision (progname, NP_VERSION);
+			exit (STATE_OK);
+		case 'H':									/* host */
+			if (!is_host (optarg))
+				usage2 (_("Invalid hostname/address"), optarg);
+			server_address = optarg;
+			break;
+		case 'C':									/* program, by name or number */
+			add_request (optarg);
+			break;
+		case 'c':									/* versions */
+			versions_arg = optarg;
+			break;
+		case 'p':									/* the program's own port */
+			if (!is_intpos (optarg) || atoi (optarg) > 65535)
+				usage2 (_("Port must be a positive integer"), optarg);
+			server_port = atoi (optarg);
+			break;
+		case 'u':
+			use_udp = TRUE;
+			break;
+		case 't':
+			use_tcp = TRUE;
+			break;
+		case TIMEOUT_OPTION:
+			timeout_interval = parse_timeout_string (optarg);
+			break;
+		case PORTMAPPER_OPTION:
+			if (!is_intpos (optarg) || atoi (optarg) > 65535)
+				usage2 (_("Port must be a positive integer"), optarg);
+			portmapper_port = atoi (optarg);
+			break;
+		case '4':
+			address_family = AF_INET;
+			break;
+		case '6':
+#ifdef USE_IPV6
+			address_family = AF_INET6;
+#else
+			usage4 (_("IPv6 support not available"));
+#endif
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			usage5 ();
+		}
+	}
+
+	/* -v -v without a host, as check_rpc.pl had it */
+	if (verbose > 1 && server_address == NULL) {
+		print_programs ();
+		exit (STATE_OK);
+	}
+
+	if (server_address == NULL && optind < argc) {
+		if (!is_host (argv[optind]))
+			usage2 (_("Invalid hostname/address"), argv[optind]);
+		server_address = argv[optind++];
+	}
+	for (; optind < argc; optind++)
+		add_request (argv[optind]);
+
+	if (server_address == NULL)
+		usage4 (_("Hostname was not supplied"));
+	if (nrequests == 0)
+		usage4 (_("No RPC program given"));
+	if (use_tcp && use_udp)
+		usage4 (_("Cannot define tcp AND udp"));
+
+	/* -c for the programs without versions of their own */
+	if (versions_arg) {
+		c = parse_versions (versions_arg, versions, RPC_MAX_VERSIONS);
+		for (i = 0; i < nrequests; i++)
+			if (requests[i].nversions == 0) {
+				memcpy (requests[i].versions, versions, c * sizeof (unsigned long));
+				requests[i].nversions = c;
+			}
+	}
+
+	return OK;
+}
+
+
+
+void
+print_programs (void)
+{
+	int i;
+
+	printf ("%s\n", _("Supported programs:"));
+	printf ("    %s\t=>\t%s\n", _("name"), _("number"));
+	printf (" ===============================\n");
+	for (i = 0; rpc_programs[i].name; i++)
+		printf ("   %s \t=>\t%lu \n", rpc_programs[i].name, rpc_programs[i].number);
+	printf ("\n\n");
+	print_usage ();
+}
+
+
+
+void
+print_help (void)
+{
+	print_revision (progname, NP_VERSION);
+
+	printf ("Copyright (c) 2002 Karl DeBisschop/Truongchinh Nguyen/Subhendu Ghosh\n");
+	printf (_(COPYRIGHT), copyright, email);
+
+	printf ("%s\n", _("This plugin checks that RPC programs are registered with the portmapper and"));
+	printf ("%s\n", _("answer calls, all of them at once."));
+
+	printf ("\n\n");
+
+	print_usage ();
+
+	printf (UT_HELP_VRSN);
+	printf (UT_EXTRA_OPTS);
+
+	printf (" %s\n", "-H, --hostname=HOST");
+	printf ("    %s\n", _("The server providing the RPC programs"));
+	printf (UT_IPv46);
+	printf (" %s\n", "-C, --command=PROGRAM[:VERSION[,VERSION...]]");
+	printf ("    %s\n", _("The program's name or number, with the versions to check (default: those"));
+	printf ("    %s\n", _("it has registered); may be repeated, and programs may follow the host"));
+	printf (" %s\n", "-c, --progver=VERSION[,VERSION...]");
+	printf ("    %s\n", _("The versions to check of the programs without versions of their own"));
+	printf (" %s\n", "-p, --port=PORT");
+	printf ("    %s\n", _("Call the programs at this port instead of asking the portmapper"));
+	printf (" %s\n", "--portmapper=PORT");
+	printf ("    %s\n", _("The portmapper's port (default: 111)"));
+	printf (" %s\n", "-u, --udp");
+	printf ("    %s\n", _("Call the programs over UDP (default)"));
+	printf (" %s\n", "-t, --tcp");
+	printf ("    %s\n", _("Call the programs over TCP"));
+	printf (" %s\n", "--timeout=INTEGER");
+	printf ("    %s", _("Seconds before the calls time out (default:"));
+	printf (" %d)\n", DEFAULT_SOCKET_TIMEOUT);
+	printf (UT_VERBOSE);
+	printf ("    %s\n", _("-v -v without a host lists the programs known by name"));
+
+	printf ("\n");
+	printf ("%s\n", _("Notes:"));
+	printf (" %s\n", _("The registrations come from one PMAPPROC_DUMP of the portmapper over TCP, and"));
+	printf (" %s\n", _("then the NULL procedure of all the versions is called at once, over UDP again"));
+	printf (" %s\n", _("each second until answered. A version that is not registered or does not"));
+	printf (" %s\n", _("answer is CRITICAL. With one program the output is that of check_rpc.pl, with"));
+	printf (" %s\n", _("more a line counts the versions running and one follows for each."));
+
+	printf ("\n");
+	printf ("%s\n", _("Examples:"));
+	printf (" %s\n", "check_rpc -H filer -C nfs:3,4 -C mountd -C nlockmgr -C status");
+
+	printf (UT_SUPPORT);
+}
+
+
+
+void
+print_usage (void)
+{
+	printf ("%s\n", _("Usage:"));
+	printf ("%s -H host -C rpc_command [-C rpc_command...] [-p port] [-c program_version] [-u|-t] [-v]\n", progname);
+}
@@ -0,0 +1,504 @@
+/*****************************************************************************
+*
+* Nagios check_smb plugin
+*
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+*
+* Description:
+*
+* This file contains the check_smb plugin
+*
+* This plugin checks the free space of SMB shares with libsmbclient, as
+* check_disk_smb does with smbclient. The server is logged on to once and
+* each share is asked for its size on that session, with a tree connect of
+* its own and an FS_FULL_SIZE_INFORMATION query.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+const char *progname = "check_smb";
+const char *copyright = "2014";
+const char *email = "devel@nagios-plugins.org";
+
+#include "common.h"
+#include "utils.h"
+#include <ctype.h>
+#include <sys/statvfs.h>
+#include <libsmbclient.h>
+
+/* the -s shares of a run, at most */
+#define MAX_SHARES 64
+
+struct smb_share {
+	char *name;
+	int state;
+	char msg[256];
+	unsigned long long total;   /* bytes */
+	unsigned long long avail;
+};
+
+char *server_host = NULL;
+char *server_address = NULL;
+char *user = "guest";
+char *password = "";
+char *workgroup = NULL;
+char *max_protocol = NULL;
+char *config_file = NULL;
+int server_port = 0;
+int use_kerberos = FALSE;
+int verbose = 0;
+struct smb_share shares[MAX_SHARES];
+int share_count = 0;
+
+/* -w and -c, as percent used or kB free */
+char *warn_opt = "85";
+char *crit_opt = "95";
+int size_thresholds = FALSE;
+double warn_value;
+double crit_value;
+
+int process_arguments (int, char **);
+int validate_arguments (void);
+void print_help (void);
+void print_usage (void);
+
+static void
+smb_timeout_alarm_handler (int sig)
+{
+	die (STATE_UNKNOWN, _("No Answer from Client\n"));
+}
+
+static void
+smb_auth (SMBCCTX *ctx, const char *srv, const char *shr, char *wg, int wglen,
+          char *un, int unlen, char *pw, int pwlen)
+{
+	if (workgroup)
+		snprintf (wg, wglen, "%s", workgroup);
+	snprintf (un, unlen, "%s", user);
+	snprintf (pw, pwlen, "%s", password);
+}
+
+/* the size of the share, on the session to the server that the context
+ * keeps from one share to the next */
+static void
+check_share (SMBCCTX *ctx, smbc_statvfs_fn statvfs_fn, struct smb_share *s)
+{
+	struct statvfs st;
+	unsigned long long block;
+	char *url;
+
+	xasprintf (&url, "smb://%s/%s", server_address ? server_address : server_host, s->name);
+	if (verbose)
+		printf ("%s\n", url);
+	if (statvfs_fn (ctx, url, &st) < 0) {
+		s->state = STATE_CRITICAL;
+		if (errno == EACCES || errno == EPERM)
+			snprintf (s->msg, sizeof (s->msg), share_count == 1 ? "%s" : _("%s on \\\\%s\\%s"),
+			          _("Access Denied"), server_host, s->name);
+		else if (errno == ENOENT || errno == ENODEV)
+			snprintf (s->msg, sizeof (s->msg), _("Invalid share name \\\\%s\\%s"), server_host, s->name);
+		else if (errno == ECONNREFUSED || errno == EHOSTUNREACH || errno == ETIMEDOUT || errno == ENETUNREACH)
+			snprintf (s->msg, sizeof (s->msg), _("Connection to %s failed (%s)"), server_host, strerror (errno));
+		else {
+			s->state = STATE_UNKNOWN;
+			snprintf (s->msg, sizeof (s->msg), _("Cannot get the size of \\\\%s\\%s: %s"),
+			          server_host, s->name, strerror (errno));
+		}
+		free (url);
+		return;
+	}
+	free (url);
+
+	block = st.f_frsize ? st.f_frsize : st.f_bsize;
+	s->total = (unsigned long long) st.f_blocks * block;
+	s->avail = (unsigned long long) st.f_bavail * block;
+}
+
+/* the share's state and message as check_disk_smb gives them */
+static void
+share_state (struct smb_share *s, double *warn_bytes, double *crit_bytes)
+{
+	unsigned long long used = s->total - s->avail;
+	double avail = s->avail / 1024.0;
+	char size[32];
+	int capper;
+
+	if (size_thresholds) {
+		*warn_bytes = s->total - warn_value * 1024;
+		*crit_bytes = s->total - crit_value * 1024;
+	} else {
+		*warn_bytes = warn_value * s->total / 100;
+		*crit_bytes = crit_value * s->total / 100;
+	}
+
+	capper = s->total ? (int) ((double) s->avail / s->total * 100) : 0;
+	if ((unsigned long long) (avail / 1024) > 0) {
+		avail = (unsigned long long) (avail / 1024);
+		if ((unsigned long long) (avail / 1024) > 0)
+			snprintf (size, sizeof (size), "%gG", (double) (unsigned long long) (avail / 1024 * 100) / 100);
+		else
+			snprintf (size, sizeof (size), "%.0fM", avail);
+	} else
+		snprintf (size, sizeof (size), "%gK", avail);
+
+	if (used > *crit_bytes) {
+		s->state = STATE_CRITICAL;
+		snprintf (s->msg, sizeof (s->msg), _("CRITICAL: Only %s (%d%%) free on \\\\%s\\%s"),
+		          size, capper, server_host, s->name);
+	} else if (used > *warn_bytes) {
+		s->state = STATE_WARNING;
+		snprintf (s->msg, sizeof (s->msg), _("WARNING: Only %s (%d%%) free on \\\\%s\\%s"),
+		          size, capper, server_host, s->name);
+	} else {
+		s->state = STATE_OK;
+		snprintf (s->msg, sizeof (s->msg), _("Disk ok - %s (%d%%) free on \\\\%s\\%s"),
+		          size, capper, server_host, s->name);
+	}
+}
+
+int
+main (int argc, char **argv)
+{
+	SMBCCTX *ctx;
+	smbc_statvfs_fn statvfs_fn;
+	np_perfdata perf;
+	struct smb_share *s;
+	double warn_bytes, crit_bytes;
+	char *lines = "", *problems = NULL;
+	int result = STATE_OK, count_ok = 0;
+
+	setlocale (LC_ALL, "");
+	bindtextdomain (PACKAGE, LOCALEDIR);
+	textdomain (PACKAGE);
+
+	/* Parse extra opts if any */
+	argv = np_extra_opts (&argc, argv, progname);
+
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	signal (SIGALRM, smb_timeout_alarm_handler);
+	alarm (timeout_interval);
+
+	if ((ctx = smbc_new_context ()) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	smbc_setDebug (ctx, verbose > 2 ? verbose - 2 : 0);
+	smbc_setFunctionAuthDataWithContext (ctx, smb_auth);
+	smbc_setUser (ctx, user);
+	if (workgroup)
+		smbc_setWorkgroup (ctx, workgroup);
+	if (server_port)
+		smbc_setPort (ctx, server_port);
+	if (use_kerberos)
+		smbc_setOptionUseKerberos (ctx, TRUE);
+	if (config_file) {
+#ifdef HAVE_SMBC_SETCONFIGURATION
+		if (smbc_setConfiguration (ctx, config_file) < 0)
+			usage2 (_("Unable to read config file"), config_file);
+#else
+		usage4 (_("This libsmbclient cannot read another config file"));
+#endif
+	}
+	if (smbc_init_context (ctx) == NULL)
+		die (STATE_UNKNOWN, "%s: %s\n", _("Cannot initialize libsmbclient"), strerror (errno));
+	/* one logon to the server, each share a tree connect on it */
+	smbc_setOptionOneSharePerServer (ctx, TRUE);
+	if (max_protocol) {
+#ifdef HAVE_SMBC_SETOPTIONPROTOCOLS
+		if (!smbc_setOptionProtocols (ctx, NULL, max_protocol))
+			usage2 (_("Invalid protocol"), max_protocol);
+#else
+		usage4 (_("This libsmbclient cannot limit the protocol"));
+#endif
+	}
+	statvfs_fn = smbc_getFunctionStatVFS (ctx);
+
+	for (s = shares; s < shares + share_count; s++)
+		check_share (ctx, statvfs_fn, s);
+	alarm (0);
+	smbc_free_context (ctx, TRUE);
+
+	np_perfdata_init (&perf);
+	for (s = shares; s < shares + share_count; s++) {
+		if (s->msg[0] == '\0') {
+			share_state (s, &warn_bytes, &crit_bytes);
+			np_perfdata_add (&perf, s->name, (long int) (s->total - s->avail), "B",
+			                 TRUE, (long int) warn_bytes, TRUE, (long int) crit_bytes,
+			                 TRUE, 0, TRUE, (long int) s->total);
+		}
+		result = max_state_alt (result, s->state);
+		if (s->state == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s", problems ? problems : "", problems ? "; " : "", s->msg);
+		xasprintf (&lines, "%s\n[%s] %s", lines, state_text (s->state), s->msg);
+	}
+
+	/* a single share, as check_disk_smb gave it */
+	if (share_count == 1)
+		printf ("%s%s%s\n", shares[0].msg, perf.len ? " | " : "", np_perfdata_string (&perf));
+	else
+		printf ("SMB %s: %d of %d %s%s%s|%s%s\n", state_text (result), count_ok, share_count,
+		        _("shares OK"), problems ? " - " : "", problems ? problems : "",
+		        np_perfdata_string (&perf), lines);
+	if (verbose)
+		printf ("%s\n", state_text (result));
+	np_perfdata_free (&perf);
+	return result;
+}
+
+
+/* the name has none of the characters check_disk_smb refuses */
+static int
+valid_name (const char *name, const char *refused)
+{
+	return name[0] != '\0' && strpbrk (name, refused) == NULL;
+}
+
+/* INTEGER or INTEGER% as percent used, INTEGER[kMG] as kB free */
+static int
+parse_threshold (const char *opt, double *value, int *size)
+{
+	char *end;
+
+	if (!isdigit ((unsigned char) opt[0]))
+		return FALSE;
+	*value = strtod (opt, &end);
+	*size = TRUE;
+	if (end[0] == '\0' || (end[0] == '%' && end[1] == '\0')) {
+		*size = FALSE;
+		return *value <= 100;
+	}
+	if (end[1] != '\0')
+		return FALSE;
+	if (end[0] == 'M')
+		*value *= 1024;
+	else if (end[0] == 'G')
+		*value *= 1048576;
+	else if (end[0] != 'k')
+		return FALSE;
+	return TRUE;
+}
+
+/* process command-line arguments */
+int
+process_arguments (int argc, char **argv)
+{
+	int c;
+	char *p, *dollar;
+
+	int option = 0;
+	static struct option longopts[] = {
+		{"hostname", required_argument, 0, 'H'},
+		{"share", required_argument, 0, 's'},
+		{"workgroup", required_argument, 0, 'W'},
+		{"address", required_argument, 0, 'a'},
+		{"user", required_argument, 0, 'u'},
+		{"password", required_argument, 0, 'p'},
+		{"port", required_argument, 0, 'P'},
+		{"kerberos", no_argument, 0, 'k'},
+		{"maxprotocol", required_argument, 0, 'm'},
+		{"configfile", required_argument, 0, 'C'},
+		{"warning", required_argument, 0, 'w'},
+		{"critical", required_argument, 0, 'c'},
+		{"timeout", required_argument, 0, 't'},
+		{"verbose", no_argument, 0, 'v'},
+		{"version", no_argument, 0, 'V'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	if (argc < 2)
+		return ERROR;
+
+	while (1) {
+		c = getopt_long (argc, argv, "hVvkH:s:W:a:u:p:P:m:C:w:c:t:", longopts, &option);
+
+		if (c == -1 || c == EOF)
+			break;
+
+		switch (c) {
+		case '?':									/* print short usage statement if args not parsable */
+			usage5 ();
+		case 'h':									/* help */
+			print_help ();
+			exit (STATE_OK);
+		case 'V':									/* version */
+			print_revision (progname, NP_VERSION);
+			exit (STATE_OK);
+		case 'v':									/* verbose */
+			verbose++;
+			break;
+		case 'H':									/* hostname */
+			if (!valid_name (optarg, "\":|<>*?\\/"))
+				usage2 (_("Invalid host"), optarg);
+			server_host = optarg;
+			break;
+		case 's':									/* share, or a list of them */
+			for (p = strtok (optarg, ","); p; p = strtok (NULL, ",")) {
+				dollar = strchr (p, '$');
+				if (!valid_name (p, "\":|<>*?\\/") || (dollar && dollar[1] != '\0'))
+					usage2 (_("Invalid share"), p);
+				if (share_count == MAX_SHARES)
+					usage2 (_("Too many shares"), p);
+				memset (&shares[share_count], 0, sizeof (shares[share_count]));
+				shares[share_count++].name = p;
+			}
+			break;
+		case 'W':									/* workgroup */
+			workgroup = optarg;
+			break;
+		case 'a':									/* address */
+			server_address = optarg;
+			break;
+		case 'u':									/* user */
+			if (!valid_name (optarg, "\":|<>*?/"))
+				usage2 (_("Invalid user"), optarg);
+			user = optarg;
+			break;
+		case 'p':									/* password */
+			password = optarg;
+			break;
+		case 'P':									/* port */
+			if (!is_intpos (optarg))
+				usage2 (_("Port must be a positive integer"), optarg);
+			server_port = atoi (optarg);
+			break;
+		case 'k':									/* kerberos */
+			use_kerberos = TRUE;
+			break;
+		case 'm':									/* maxprotocol */
+			max_protocol = optarg;
+			break;
+		case 'C':									/* configfile */
+			if (access (optarg, R_OK) != 0)
+				usage2 (_("Unable to read config file"), optarg);
+			config_file = optarg;
+			break;
+		case 'w':									/* warning threshold */
+			warn_opt = optarg;
+			break;
+		case 'c':									/* critical threshold */
+			crit_opt = optarg;
+			break;
+		case 't':									/* timeout */
+			timeout_interval = parse_timeout_string (optarg);
+			break;
+		}
+	}
+
+	c = optind;
+	if (server_host == NULL && c < argc)
+		server_host = argv[c++];
+	if (share_count == 0 && c < argc) {
+		memset (&shares[0], 0, sizeof (shares[0]));
+		shares[share_count++].name = argv[c++];
+	}
+
+	return validate_arguments ();
+}
+
+
+int
+validate_arguments (void)
+{
+	int warn_size, crit_size;
+
+	if (server_host == NULL)
+		usage4 (_("Host name not specified"));
+	if (share_count == 0)
+		usage4 (_("Share volume not specified"));
+	if (!parse_threshold (warn_opt, &warn_value, &warn_size))
+		usage2 (_("Invalid warning threshold"), warn_opt);
+	if (!parse_threshold (crit_opt, &crit_value, &crit_size))
+		usage2 (_("Invalid critical threshold"), crit_opt);
+	if (warn_size != crit_size)
+		usage4 (_("Both warning and critical should be same type"));
+	size_thresholds = warn_size;
+	if (size_thresholds && warn_value <= crit_value)
+		usage4 (_("Disk size: warning should be greater than critical"));
+	if (!size_thresholds && warn_value >= crit_value)
+		usage4 (_("Percentage: warning should be less than critical"));
+	return OK;
+}
+
+
+void
+print_help (void)
+{
+	print_revision (progname, NP_VERSION);
+
+	printf (COPYRIGHT, copyright, email);
+
+	printf ("%s\n", _("This plugin checks the free space of SMB shares with libsmbclient. The server"));
+	printf ("%s\n", _("is logged on to once, and the size of each share is asked for on that session."));
+
+	printf ("\n\n");
+
+	print_usage ();
+
+	printf (UT_HELP_VRSN);
+	printf (UT_EXTRA_OPTS);
+
+	printf (" %s\n", "-H, --hostname=HOST");
+	printf ("    %s\n", _("NetBIOS name of the server"));
+	printf (" %s\n", "-s, --share=STRING[,STRING...]");
+	printf ("    %s\n", _("Share name to be tested; may be repeated, or a list, for up to 64 shares"));
+	printf (" %s\n", "-W, --workgroup=STRING");
+	printf ("    %s\n", _("Workgroup or Domain used (Defaults to \"WORKGROUP\")"));
+	printf (" %s\n", "-a, --address=IP");
+	printf ("    %s\n", _("IP-address of HOST (only necessary if HOST is in another network)"));
+	printf (" %s\n", "-u, --user=STRING");
+	printf ("    %s\n", _("Username to log in to server. (Defaults to \"guest\")"));
+	printf (" %s\n", "-p, --password=STRING");
+	printf ("    %s\n", _("Password to log in to server. (Defaults to an empty password)"));
+	printf (" %s\n", "-P, --port=INTEGER");
+	printf ("    %s\n", _("Port to be used to connect to. Some Windows boxes use 139, others 445"));
+	printf (" %s\n", "-k, --kerberos");
+	printf ("    %s\n", _("Use Kerberos authentication"));
+	printf (" %s\n", "-m, --maxprotocol=STRING");
+	printf ("    %s\n", _("Maximum protocol to use, e.g. SMB2 or SMB3"));
+	printf (" %s\n", "-C, --configfile=STRING");
+	printf ("    %s\n", _("Path to an smb.conf to read in place of the default one"));
+	printf (" %s\n", "-w, --warning=INTEGER or INTEGER[kMG]");
+	printf ("    %s\n", _("Percent of used space at which a warning will be generated (Default: 85%)"));
+	printf (" %s\n", "-c, --critical=INTEGER or INTEGER[kMG]");
+	printf ("    %s\n", _("Percent of used space at which a critical will be generated (Defaults: 95%)"));
+	printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+	printf (UT_VERBOSE);
+
+	printf ("\n");
+	printf ("%s\n", _("Notes:"));
+	printf (" %s\n", _("If thresholds are followed by either a k, M, or G then check to see if that"));
+	printf (" %s\n", _("much disk space is available (kilobytes, Megabytes, Gigabytes)"));
+	printf (" %s\n", _("Warning percentage should be less than critical"));
+	printf (" %s\n", _("Warning (remaining) disk space should be greater than critical."));
+	printf (" %s\n", _("The thresholds apply to each share, and with several of them there is a"));
+	printf (" %s\n", _("line for each after the summary."));
+
+	printf (UT_SUPPORT);
+}
+
+
+void
+print_usage (void)
+{
+	printf ("%s\n", _("Usage:"));
+	printf ("%s -H <host> -s <share>[,<share>...] [-u <user>] [-p <password>] [-w <warn>] [-c <crit>]\n", progname);
+	printf ("  [-W <workgroup>] [-P <port>] [-a <IP>] [-k] [-m <maxprotocol>] [-C <configfile>] [-t timeout]\n");
+}
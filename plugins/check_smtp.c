@@ -36,8 +36,10 @@ const char *email = "devel@nagios-plugins.org";
 #include "netutils.h"
 #include "utils.h"
 #include "base64.h"
+#include "utils_dns.h"
 
 #include <ctype.h>
+#include <fcntl.h>
 
 #ifdef HAVE_SSL
 int check_cert = FALSE;
@@ -72,9 +74,14 @@ int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
 void smtp_quit(void);
-int recvline(char *, size_t);
+void smtp_quit_response(void);
 int recvlines(char *, size_t);
+int check_response(int);
+int pipelinable(void);
 int my_close(void);
+#ifdef HAVE_POLL
+int check_smtp_mx (const char *, const char *);
+#endif
 
 #include "regex.h"
 char regex_expect[MAX_INPUT_BUFFER] = "";
@@ -108,25 +115,34 @@ int check_critical_time = FALSE;
 int verbose = 0;
 int use_ssl = FALSE;
 int use_sni = FALSE;
+int trace_timing = FALSE;
 short use_proxy_prefix = FALSE;
 short use_ehlo = FALSE;
 short use_lhlo = FALSE;
 short ssl_established = 0;
 char *localhostname = NULL;
 int sd;
+np_line_reader reader;
 char buffer[MAX_INPUT_BUFFER];
 enum {
   TCP_PROTOCOL = 1,
   UDP_PROTOCOL = 2,
 };
 int ignore_send_quit_failure = FALSE;
+/* --mx/--hosts, see check_smtp_mx() */
+char *mx_domain = NULL;
+char **mx_hosts = NULL;
+int mx_host_count = 0;
+int mx_concurrency = 16;
 
 
 int
 main (int argc, char **argv)
 {
 	short supports_tls=FALSE;
-	int n = 0;
+	int n = 0, i;
+	int supports_pipelining = FALSE, pipelined;
+	np_perfdata perf;
 	double elapsed_time;
 	long microsec;
 	int result = STATE_UNKNOWN;
@@ -148,10 +164,6 @@ main (int argc, char **argv)
 	(void) signal (SIGPIPE, SIG_IGN);
 #endif /* HAVE_SIGACTION */
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
 
@@ -186,6 +198,11 @@ main (int argc, char **argv)
 	if (verbose && send_mail_from)
 		printf ("FROM CMD: %s", cmd_str);
 
+#ifdef HAVE_POLL
+	if (mx_domain || mx_host_count)
+		return check_smtp_mx (helocmd, cmd_str);
+#endif
+
 	/* initialize alarm signal handling */
 	(void) signal (SIGALRM, socket_timeout_alarm_handler);
 
@@ -199,6 +216,7 @@ main (int argc, char **argv)
 	result = my_tcp_connect (server_address, server_port, &sd);
 
 	if (result == STATE_OK) { /* we connected */
+		np_line_reader_init (&reader, sd, NULL);
 
 		/* If requested, send PROXY header */
 		if (use_proxy_prefix) {
@@ -209,7 +227,12 @@ main (int argc, char **argv)
 
 		/* watch for the SMTP connection string and */
 		/* return a WARNING status if we couldn't read any data */
-		if (recvlines(buffer, MAX_INPUT_BUFFER) <= 0) {
+		np_timer_phase_begin (NP_PHASE_FIRSTBYTE);
+		n = recvlines(buffer, MAX_INPUT_BUFFER);
+		np_timer_phase_end (NP_PHASE_FIRSTBYTE);
+		/* the rest of the dialogue counts as transfer */
+		np_timer_phase_begin (NP_PHASE_TRANSFER);
+		if (n <= 0) {
 			printf (_("recv() failed\n"));
 			return STATE_WARNING;
 		}
@@ -241,6 +264,9 @@ main (int argc, char **argv)
 			   strstr(buffer, "250-STARTTLS") != NULL){
 				supports_tls=TRUE;
 			}
+			if (strstr (buffer, "250 PIPELINING") != NULL ||
+			    strstr (buffer, "250-PIPELINING") != NULL)
+				supports_pipelining = TRUE;
 		}
 
 		if(use_ssl && ! supports_tls){
@@ -268,6 +294,8 @@ main (int argc, char **argv)
 		    return STATE_CRITICAL;
 		  } else {
 			ssl_established = 1;
+			/* nothing sent before the handshake is part of the session */
+			np_line_reader_init (&reader, sd, np_net_ssl_read);
 		  }
 
 		/*
@@ -296,6 +324,9 @@ main (int argc, char **argv)
 		if (verbose) {
 			printf("%s", buffer);
 		}
+		/* only what the server says within TLS counts now (RFC 3207) */
+		supports_pipelining = (strstr (buffer, "250 PIPELINING") != NULL ||
+		                       strstr (buffer, "250-PIPELINING") != NULL);
 
 #  ifdef USE_OPENSSL
 		  if ( check_cert ) {
@@ -308,41 +339,40 @@ main (int argc, char **argv)
 		}
 #endif
 
+		/* with PIPELINING (RFC 2920), MAIL FROM, the commands and QUIT go
+		 * out together and the replies are read in turn */
+		pipelined = supports_pipelining && authtype == NULL && (send_mail_from || ncommands) && pipelinable ();
+		if (pipelined) {
+			char *all = NULL;
+
+			xasprintf (&all, "%s", send_mail_from ? cmd_str : "");
+			for (i = 0; i < ncommands; i++)
+				xasprintf (&all, "%s%s\r\n", all, commands[i]);
+			xasprintf (&all, "%s%s", all, SMTP_QUIT);
+			if (verbose)
+				printf (_("sent pipelined:\n%s"), all);
+			if (my_send (all, strlen (all)) < 0 && !ignore_send_quit_failure)
+				die (STATE_UNKNOWN, _("Connection closed by server before sending QUIT command\n"));
+			free (all);
+		}
+
 		if (send_mail_from) {
-		  my_send(cmd_str, strlen(cmd_str));
+		  if (!pipelined)
+		    my_send(cmd_str, strlen(cmd_str));
 		  if (recvlines(buffer, MAX_INPUT_BUFFER) >= 1 && verbose)
 		    printf("%s", buffer);
 		}
 
-		while (n < ncommands) {
-			xasprintf (&cmd_str, "%s%s", commands[n], "\r\n");
-			my_send(cmd_str, strlen(cmd_str));
+		for (i = 0; i < ncommands; i++) {
+			if (!pipelined) {
+				xasprintf (&cmd_str, "%s%s", commands[i], "\r\n");
+				my_send(cmd_str, strlen(cmd_str));
+			}
 			if (recvlines(buffer, MAX_INPUT_BUFFER) >= 1 && verbose)
 				printf("%s", buffer);
 			strip (buffer);
-			if (n < nresponses) {
-				cflags |= REG_EXTENDED | REG_NOSUB | REG_NEWLINE;
-				errcode = regcomp (&preg, responses[n], cflags);
-				if (errcode != 0) {
-					regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
-					printf (_("Could Not Compile Regular Expression"));
-					return ERROR;
-				}
-				excode = regexec (&preg, buffer, 10, pmatch, eflags);
-				if (excode == 0) {
-					result = STATE_OK;
-				}
-				else if (excode == REG_NOMATCH) {
-					result = STATE_WARNING;
-					printf (_("SMTP %s - Invalid response '%s' to command '%s'\n"), state_text (result), buffer, commands[n]);
-				}
-				else {
-					regerror (excode, &preg, errbuf, MAX_INPUT_BUFFER);
-					printf (_("Execute Error: %s\n"), errbuf);
-					result = STATE_UNKNOWN;
-				}
-			}
-			n++;
+			if (i < nresponses && (result = check_response (i)) == ERROR)
+				return ERROR;
 		}
 
 		if (authtype != NULL) {
@@ -429,10 +459,14 @@ main (int argc, char **argv)
 		}
 
 		/* tell the server we're done */
-		smtp_quit();
+		if (pipelined)
+			smtp_quit_response ();
+		else
+			smtp_quit();
 
 		/* finally close the connection */
 		close (sd);
+		np_timer_phase_end (NP_PHASE_TRANSFER);
 	}
 
 	/* reset the alarm */
@@ -448,19 +482,650 @@ main (int argc, char **argv)
 			result = STATE_WARNING;
 	}
 
+	np_perfdata_init (&perf);
+	np_perfdata_addf (&perf, "time", elapsed_time, "s",
+		(int)check_warning_time, warning_time,
+		(int)check_critical_time, critical_time,
+		TRUE, 0, FALSE, 0);
+	if (trace_timing) {
+		np_timer_phase_perfdata (&perf, 0);
+		np_timer_phase_report (stderr);
+	}
+
 	printf (_("SMTP %s - %s%.3f sec. response time%s%s|%s\n"),
 			state_text (result),
 			error_msg,
 			elapsed_time,
 			verbose?", ":"", verbose?buffer:"",
-			fperfdata ("time", elapsed_time, "s",
-				(int)check_warning_time, warning_time,
-				(int)check_critical_time, critical_time,
-				TRUE, 0, FALSE, 0));
+			np_perfdata_string (&perf));
+	np_perfdata_free (&perf);
+
+	return result;
+}
+
+
+
+#ifdef HAVE_POLL
+/*
+ * --mx/--hosts: the dialog of a check against every host of a domain's MX
+ * set, or of a list, from one process. Each host is a non-blocking socket
+ * that goes through connect, the banner, EHLO, STARTTLS and its handshake
+ * and EHLO again, and the transaction up to QUIT as poll() reports it
+ * ready; at most --concurrency hosts are in flight at a time. Replies are
+ * taken from a buffer of each host's, so what a server sends in one
+ * segment is read once. With PIPELINING, MAIL FROM, the commands and QUIT
+ * go out in one write. -t bounds each host.
+ */
+
+enum {
+	SMTP_STEP_CONNECT,
+	SMTP_STEP_BANNER,
+	SMTP_STEP_EHLO,
+	SMTP_STEP_STARTTLS,
+	SMTP_STEP_TLS,
+	SMTP_STEP_COMMANDS,
+	SMTP_STEP_DONE
+};
+
+/* the phases each host is timed in, as smtp_phase_names[] */
+enum {
+	SMTP_PHASE_CONNECT,
+	SMTP_PHASE_BANNER,
+	SMTP_PHASE_EHLO,
+	SMTP_PHASE_STARTTLS,
+	SMTP_PHASE_QUIT,
+	SMTP_PHASES
+};
+
+static const char *smtp_phase_names[SMTP_PHASES] = { "connect", "banner", "ehlo", "starttls", "quit" };
+
+struct smtp_mx {
+	char *host;
+	int preference;     /* of its MX record, -1 for --hosts */
+	int fd;
+	int step;
+	short events;       /* what the current step waits for */
+#ifdef HAVE_SSL
+	SSL *ssl;
+#endif
+	int tls;            /* the handshake is done */
+	int pipelining;     /* offered in the last EHLO reply */
+	int pipelined;
+	struct timeval start;
+	struct timeval phase_start;
+	double phase[SMTP_PHASES];
+	char in[MAX_INPUT_BUFFER];
+	size_t in_len;
+	char *out;          /* what is to be sent, from out_sent on */
+	size_t out_len;
+	size_t out_sent;
+	int command;        /* whose reply comes next */
+	int started;
+	int state;
+	char *msg;
+	char *cert_msg;     /* -D's verdict, once it has passed */
+	double time;
+};
+
+/* MAIL FROM, the -C commands and QUIT, each with its CRLF */
+static char **mx_commands;
+static int mx_command_count;
+static regex_t *mx_responses;
+#ifdef HAVE_SSL
+static SSL_CTX *mx_ssl_ctx;
+#endif
+
+/* the MX hosts of the domain by preference, or the domain itself if it
+ * has none (RFC 5321, 5.1) */
+static struct smtp_mx *
+smtp_mx_resolve (const char *domain, int *count)
+{
+	struct smtp_mx *mx, tmp;
+	struct addrinfo hints, *res;
+	np_dns_message resp;
+	unsigned char query[NP_DNS_MAX_NAME + 32];
+	char server[NP_DNS_MAX_NAME], name[NP_DNS_MAX_NAME];
+	struct timeval now;
+	size_t k;
+	int len, ret, preference, i, j;
+
+	np_dns_default_server (NULL, server, sizeof (server));
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICHOST;
+	if ((ret = np_net_getaddrinfo (server, "53", &hints, &res)) != 0)
+		die (STATE_UNKNOWN, _("SMTP UNKNOWN - Invalid DNS server %s: %s\n"), server, gai_strerror (ret));
+	gettimeofday (&now, NULL);
+	len = np_dns_encode_query ((uint16_t) (getpid () ^ now.tv_usec), domain, NP_DNS_MX, NP_DNS_CLASS_IN,
+	                           NP_DNS_RD, NP_DNS_EDNS_SIZE, query, sizeof (query));
+	if (len < 0)
+		usage2 (_("Invalid domain"), domain);
+	if ((ret = np_dns_query (res->ai_addr, res->ai_addrlen, query, len, &resp, 0,
+	                         timeout_interval * 1000, 1)) != NP_DNS_OK)
+		die (STATE_CRITICAL, _("SMTP CRITICAL - No answer from DNS server %s for the MX records of %s%s%s\n"),
+		     server, domain, ret == NP_DNS_ERROR ? ": " : "", ret == NP_DNS_ERROR ? strerror (errno) : "");
+	if (resp.rcode != NP_DNS_NOERROR)
+		die (STATE_CRITICAL, _("SMTP CRITICAL - MX records of %s: %s\n"), domain, np_dns_rcode_name (resp.rcode));
+
+	if ((mx = calloc (resp.counts[NP_DNS_ANSWER] + 1, sizeof (*mx))) == NULL)
+		die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+	*count = 0;
+	for (k = 0; k < resp.count; k++) {
+		if (resp.rr[k].section != NP_DNS_ANSWER || resp.rr[k].type != NP_DNS_MX ||
+		    sscanf (resp.rr[k].data, "%d %1024s", &preference, name) != 2)
+			continue;
+		if ((len = strlen (name)) > 1 && name[len - 1] == '.')
+			name[len - 1] = '\0';
+		/* a null MX (RFC 7505) says the domain takes no mail */
+		if (!strcmp (name, ".")) {
+			np_dns_message_free (&resp);
+			die (STATE_CRITICAL, _("SMTP CRITICAL - %s accepts no mail (null MX)\n"), domain);
+		}
+		mx[*count].host = strdup (name);
+		mx[*count].preference = preference;
+		mx[(*count)++].fd = -1;
+	}
+	np_dns_message_free (&resp);
+	if (*count == 0) {
+		mx[0].host = strdup (domain);
+		mx[0].preference = 0;
+		mx[0].fd = -1;
+		*count = 1;
+	}
+	for (i = 1; i < *count; i++)
+		for (j = i; j > 0 && mx[j - 1].preference > mx[j].preference; j--) {
+			tmp = mx[j];
+			mx[j] = mx[j - 1];
+			mx[j - 1] = tmp;
+		}
+	return mx;
+}
+
+static void
+smtp_mx_done (struct smtp_mx *m, int state, const char *msg)
+{
+#ifdef HAVE_SSL
+	if (m->ssl) {
+		SSL_free (m->ssl);
+		m->ssl = NULL;
+	}
+#endif
+	if (m->fd >= 0)
+		close (m->fd);
+	m->fd = -1;
+	free (m->out);
+	m->out = NULL;
+	m->time = (double) deltime (m->start) / 1.0e6;
+	m->step = SMTP_STEP_DONE;
+	m->state = state;
+	if (msg)
+		m->msg = strdup (msg);
+}
+
+/* the time since the last phase ended, to phase */
+static void
+smtp_mx_phase (struct smtp_mx *m, int phase)
+{
+	struct timeval now;
+
+	gettimeofday (&now, NULL);
+	m->phase[phase] += (now.tv_sec - m->phase_start.tv_sec) + (now.tv_usec - m->phase_start.tv_usec) / 1.0e6;
+	m->phase_start = now;
+}
+
+#ifdef HAVE_SSL
+/* what a non-blocking SSL call that did not finish is waiting for;
+ * 0 if it failed */
+static short
+smtp_ssl_wants (SSL *ssl, int ret)
+{
+	switch (SSL_get_error (ssl, ret)) {
+	case SSL_ERROR_WANT_READ:
+		return POLLIN;
+	case SSL_ERROR_WANT_WRITE:
+		return POLLOUT;
+	default:
+		return 0;
+	}
+}
+#endif
+
+/* s to be sent next, after anything that has not gone yet */
+static void
+smtp_mx_queue (struct smtp_mx *m, const char *s)
+{
+	size_t len = strlen (s);
+
+	if ((m->out = realloc (m->out, m->out_len + len + 1)) == NULL)
+		die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+	memcpy (m->out + m->out_len, s, len + 1);
+	m->out_len += len;
+}
+
+/* what is queued, as far as the socket takes it; TRUE once it is all sent */
+static int
+smtp_mx_flush (struct smtp_mx *m)
+{
+	ssize_t n;
+
+	while (m->out_sent < m->out_len) {
+#ifdef HAVE_SSL
+		if (m->ssl) {
+			if ((n = SSL_write (m->ssl, m->out + m->out_sent, m->out_len - m->out_sent)) <= 0) {
+				if ((m->events = smtp_ssl_wants (m->ssl, n)) == 0)
+					smtp_mx_done (m, STATE_CRITICAL, _("Connection closed by server"));
+				return FALSE;
+			}
+		}
+		else
+#endif
+		if ((n = send (m->fd, m->out + m->out_sent, m->out_len - m->out_sent, 0)) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				m->events = POLLOUT;
+			else
+				smtp_mx_done (m, STATE_CRITICAL, strerror (errno));
+			return FALSE;
+		}
+		m->out_sent += n;
+	}
+	m->out_len = m->out_sent = 0;
+	return TRUE;
+}
+
+/* The next whole reply, its lines up to "250 ..." as np_recvlines()
+ * takes them, into reply without its last CRLF; TRUE if there is one, or
+ * FALSE to wait for more, or with the host done if there will be none */
+static int
+smtp_mx_reply (struct smtp_mx *m, char *reply, size_t size)
+{
+	char *line, *nl;
+	ssize_t n;
+	size_t len;
+
+	for (;;) {
+		for (line = m->in; (nl = memchr (line, '\n', m->in + m->in_len - line)) != NULL; line = nl + 1) {
+			if (nl - line >= 3 && line[3] == '-')
+				continue;
+			len = nl - m->in;
+			while (len > 0 && (m->in[len - 1] == '\r' || m->in[len - 1] == '\n'))
+				len--;
+			if (len >= size)
+				len = size - 1;
+			memcpy (reply, m->in, len);
+			reply[len] = '\0';
+			m->in_len -= nl + 1 - m->in;
+			memmove (m->in, nl + 1, m->in_len);
+			return TRUE;
+		}
+		if (m->in_len == sizeof (m->in)) {
+			smtp_mx_done (m, STATE_WARNING, _("Reply too long"));
+			return FALSE;
+		}
+#ifdef HAVE_SSL
+		if (m->ssl) {
+			if ((n = SSL_read (m->ssl, m->in + m->in_len, sizeof (m->in) - m->in_len)) <= 0) {
+				if ((m->events = smtp_ssl_wants (m->ssl, n)) == 0)
+					smtp_mx_done (m, STATE_WARNING, _("Connection closed by server"));
+				return FALSE;
+			}
+		}
+		else
+#endif
+		if ((n = read (m->fd, m->in + m->in_len, sizeof (m->in) - m->in_len)) <= 0) {
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+				m->events = POLLIN;
+			else
+				smtp_mx_done (m, STATE_WARNING, n < 0 ? strerror (errno) : _("Connection closed by server"));
+			return FALSE;
+		}
+		m->in_len += n;
+	}
+}
+
+static int
+smtp_mx_offers (const char *reply, const char *extension)
+{
+	const char *s;
+	size_t len = strlen (extension);
+
+	for (s = reply; s; s = strchr (s, '\n')) {
+		s += *s == '\n';
+		if (strlen (s) >= 4 + len && !strncasecmp (s + 4, extension, len) && strchr (" \r\n", s[4 + len]))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void
+smtp_mx_connect (struct smtp_mx *m)
+{
+	struct addrinfo hints, *res;
+	char port_str[6];
+	int ret;
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = address_family;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf (port_str, sizeof (port_str), "%d", server_port);
+
+	gettimeofday (&m->start, NULL);
+	m->phase_start = m->start;
+	if ((ret = np_net_getaddrinfo (m->host, port_str, &hints, &res)) != 0) {
+		smtp_mx_done (m, STATE_CRITICAL, gai_strerror (ret));
+		return;
+	}
+	m->fd = socket (res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (m->fd < 0 || fcntl (m->fd, F_SETFL, O_NONBLOCK) < 0 ||
+	    (connect (m->fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS)) {
+		smtp_mx_done (m, STATE_CRITICAL, strerror (errno));
+		return;
+	}
+	m->step = SMTP_STEP_CONNECT;
+	m->events = POLLOUT;
+}
+
+/* move a host on as far as it goes without blocking */
+static void
+smtp_mx_step (struct smtp_mx *m, const char *helocmd)
+{
+	char reply[MAX_INPUT_BUFFER], *msg = NULL;
+	socklen_t len;
+	int err, state, i;
+#ifdef HAVE_SSL
+	double days;
+	int ret;
+#endif
+
+	switch (m->step) {
+	case SMTP_STEP_CONNECT:
+		len = sizeof (err);
+		if (getsockopt (m->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+			err = errno;
+		if (err) {
+			smtp_mx_done (m, STATE_CRITICAL, strerror (err));
+			return;
+		}
+		smtp_mx_phase (m, SMTP_PHASE_CONNECT);
+		if (use_proxy_prefix)
+			smtp_mx_queue (m, PROXY_PREFIX);
+		m->step = SMTP_STEP_BANNER;
+		/* FALLTHROUGH */
+
+	case SMTP_STEP_BANNER:
+		if (!smtp_mx_flush (m) || !smtp_mx_reply (m, reply, sizeof (reply)))
+			return;
+		if (verbose)
+			printf ("%s: %s\n", m->host, reply);
+		if (!strstr (reply, server_expect)) {
+			xasprintf (&msg, _("Invalid SMTP response received from host: %s"), reply);
+			smtp_mx_done (m, STATE_WARNING, msg);
+			free (msg);
+			return;
+		}
+		smtp_mx_phase (m, SMTP_PHASE_BANNER);
+		smtp_mx_queue (m, helocmd);
+		m->step = SMTP_STEP_EHLO;
+		/* FALLTHROUGH */
+
+	case SMTP_STEP_EHLO:
+	ehlo:
+		if (!smtp_mx_flush (m) || !smtp_mx_reply (m, reply, sizeof (reply)))
+			return;
+		if (verbose)
+			printf ("%s: %s\n", m->host, reply);
+		smtp_mx_phase (m, SMTP_PHASE_EHLO);
+		if (reply[0] != '2') {
+			xasprintf (&msg, _("Invalid response '%s' to %.4s"), reply, helocmd);
+			smtp_mx_done (m, STATE_WARNING, msg);
+			free (msg);
+			return;
+		}
+		/* only what the server says within TLS counts then (RFC 3207) */
+		m->pipelining = (use_ehlo || use_lhlo) && smtp_mx_offers (reply, "PIPELINING");
+		if (use_ssl && !m->tls) {
+			if (!smtp_mx_offers (reply, "STARTTLS")) {
+				smtp_mx_done (m, STATE_WARNING, _("TLS not supported by server"));
+				return;
+			}
+			smtp_mx_queue (m, SMTP_STARTTLS);
+			m->step = SMTP_STEP_STARTTLS;
+		}
+		else {
+			m->pipelined = m->pipelining && pipelinable ();
+			for (i = 0; i < (m->pipelined ? mx_command_count : 1); i++)
+				smtp_mx_queue (m, mx_commands[i]);
+			m->step = SMTP_STEP_COMMANDS;
+			goto commands;
+		}
+		/* FALLTHROUGH */
+
+	case SMTP_STEP_STARTTLS:
+		if (!smtp_mx_flush (m) || !smtp_mx_reply (m, reply, sizeof (reply)))
+			return;
+#ifdef HAVE_SSL
+		if (strncmp (reply, SMTP_EXPECT, 3)) {
+			smtp_mx_done (m, STATE_UNKNOWN, _("Server does not support STARTTLS"));
+			return;
+		}
+		if ((m->ssl = SSL_new (mx_ssl_ctx)) == NULL) {
+			smtp_mx_done (m, STATE_CRITICAL, _("Cannot initiate SSL handshake"));
+			return;
+		}
+#ifdef SSL_set_tlsext_host_name
+		if (use_sni)
+			SSL_set_tlsext_host_name (m->ssl, m->host);
+#endif
+		SSL_set_fd (m->ssl, m->fd);
+		/* nothing sent before the handshake is part of the session */
+		m->in_len = 0;
+		m->step = SMTP_STEP_TLS;
+#else
+		smtp_mx_done (m, STATE_UNKNOWN, _("SSL support not available"));
+		return;
+#endif
+		/* FALLTHROUGH */
+
+	case SMTP_STEP_TLS:
+#ifdef HAVE_SSL
+		if ((ret = SSL_connect (m->ssl)) != 1) {
+			if ((m->events = smtp_ssl_wants (m->ssl, ret)) == 0)
+				smtp_mx_done (m, STATE_CRITICAL, _("Cannot make SSL connection"));
+			return;
+		}
+		smtp_mx_phase (m, SMTP_PHASE_STARTTLS);
+		m->tls = TRUE;
+		if (check_cert) {
+			if ((state = np_net_ssl_cert_state (m->ssl, days_till_exp_warn, days_till_exp_crit,
+			                                    reply, sizeof (reply), &days)) != STATE_OK) {
+				smtp_mx_done (m, state, reply);
+				return;
+			}
+			m->cert_msg = strdup (reply);
+		}
+		smtp_mx_queue (m, helocmd);
+		m->step = SMTP_STEP_EHLO;
+		goto ehlo;
+#endif
+
+	case SMTP_STEP_COMMANDS:
+		for (;;) {
+	commands:
+			if (!smtp_mx_flush (m) || !smtp_mx_reply (m, reply, sizeof (reply)))
+				return;
+			if (verbose)
+				printf ("%s: %s\n", m->host, reply);
+			i = m->command - send_mail_from;
+			if (i >= 0 && i < ncommands && i < nresponses && regexec (&mx_responses[i], reply, 0, NULL, 0) != 0) {
+				xasprintf (&msg, _("Invalid response '%s' to command '%s'"), reply, commands[i]);
+				smtp_mx_done (m, STATE_WARNING, msg);
+				free (msg);
+				return;
+			}
+			if (++m->command == mx_command_count)
+				break;
+			if (!m->pipelined)
+				smtp_mx_queue (m, mx_commands[m->command]);
+		}
+		smtp_mx_phase (m, SMTP_PHASE_QUIT);
+		m->time = (double) deltime (m->start) / 1.0e6;
+		if (check_critical_time && m->time > critical_time)
+			state = STATE_CRITICAL;
+		else if (check_warning_time && m->time > warning_time)
+			state = STATE_WARNING;
+		else
+			state = STATE_OK;
+		xasprintf (&msg, _("%s%s%.3f sec. response time%s"), m->cert_msg ? m->cert_msg : "",
+		           m->cert_msg ? " " : "", m->time, m->pipelined ? _(", pipelined") : "");
+		smtp_mx_done (m, state, msg);
+		free (msg);
+		return;
+
+	default:
+		return;
+	}
+}
+
+/* the summary line, then a line for each host, with its phase times */
+static int
+smtp_mx_report (struct smtp_mx *mx, int count)
+{
+	np_perfdata perf;
+	char *problems = NULL, label[MAX_INPUT_BUFFER];
+	int count_ok = 0, result = STATE_OK;
+	int k, p;
+
+	np_perfdata_init (&perf);
+	for (k = 0; k < count; k++) {
+		result = max_state_alt (mx[k].state, result);
+		if (mx[k].state == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           mx[k].host, mx[k].msg);
+		if (mx[k].time == 0)
+			continue;
+		snprintf (label, sizeof (label), "%s_time", mx[k].host);
+		np_perfdata_addf (&perf, label, mx[k].time, "s",
+		                  check_warning_time, warning_time, check_critical_time, critical_time,
+		                  TRUE, 0, TRUE, timeout_interval);
+		for (p = 0; p < SMTP_PHASES; p++) {
+			if (p == SMTP_PHASE_STARTTLS && !use_ssl)
+				continue;
+			snprintf (label, sizeof (label), "%s_%s", mx[k].host, smtp_phase_names[p]);
+			np_perfdata_addf (&perf, label, mx[k].phase[p], "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+		}
+	}
 
+	printf (_("SMTP %s: %d of %d hosts OK%s%s%s%s|%s\n"), state_text (result), count_ok, count,
+	        mx_domain ? _(" for ") : "", mx_domain ? mx_domain : "",
+	        problems ? " - " : "", problems ? problems : "", np_perfdata_string (&perf));
+	for (k = 0; k < count; k++) {
+		if (mx[k].preference >= 0)
+			printf ("[%s] %s (MX %d): %s\n", state_text (mx[k].state), mx[k].host, mx[k].preference, mx[k].msg);
+		else
+			printf ("[%s] %s: %s\n", state_text (mx[k].state), mx[k].host, mx[k].msg);
+	}
+	np_perfdata_free (&perf);
 	return result;
 }
 
+int
+check_smtp_mx (const char *helocmd, const char *mail_cmd)
+{
+	struct smtp_mx *mx, **active;
+	struct pollfd *pfd;
+	nfds_t nactive = 0, i, j;
+	int count, next = 0, done = 0;
+	int wait, ms, k, c;
+
+	if (mx_domain)
+		mx = smtp_mx_resolve (mx_domain, &count);
+	else {
+		count = mx_host_count;
+		if ((mx = calloc (count, sizeof (*mx))) == NULL)
+			die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+		for (k = 0; k < count; k++) {
+			mx[k].host = mx_hosts[k];
+			mx[k].preference = -1;
+			mx[k].fd = -1;
+		}
+	}
+	/* -t bounds each host here, not the whole run */
+	alarm (0);
+
+	mx_command_count = send_mail_from + ncommands + 1;
+	mx_commands = calloc (mx_command_count, sizeof (*mx_commands));
+	mx_responses = calloc (nresponses + 1, sizeof (*mx_responses));
+	active = calloc (mx_concurrency, sizeof (*active));
+	pfd = calloc (mx_concurrency, sizeof (*pfd));
+	if (!mx_commands || !mx_responses || !active || !pfd)
+		die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+	k = 0;
+	if (send_mail_from)
+		mx_commands[k++] = (char *) mail_cmd;
+	for (c = 0; c < ncommands; c++)
+		xasprintf (&mx_commands[k++], "%s\r\n", commands[c]);
+	mx_commands[k] = SMTP_QUIT;
+	for (k = 0; k < nresponses; k++)
+		if ((errcode = regcomp (&mx_responses[k], responses[k], cflags)) != 0) {
+			regerror (errcode, &mx_responses[k], errbuf, MAX_INPUT_BUFFER);
+			die (STATE_UNKNOWN, _("SMTP UNKNOWN - Could Not Compile Regular Expression: %s\n"), errbuf);
+		}
+
+#ifdef HAVE_SSL
+	if (use_ssl && np_net_ssl_ctx_new (&mx_ssl_ctx, 0, NULL, NULL) != STATE_OK)
+		die (STATE_CRITICAL, NULL);
+#endif
+
+	while (done < count) {
+		while (nactive < (nfds_t) mx_concurrency && next < count) {
+			mx[next].started = TRUE;
+			smtp_mx_connect (&mx[next]);
+			if (mx[next].step == SMTP_STEP_DONE)
+				done++;
+			else
+				active[nactive++] = &mx[next];
+			next++;
+		}
+		if (nactive == 0)
+			continue;
+
+		wait = -1;
+		for (i = 0; i < nactive; i++) {
+			pfd[i].fd = active[i]->fd;
+			pfd[i].events = active[i]->events;
+			pfd[i].revents = 0;
+			ms = timeout_interval * 1000 - (int) (deltime (active[i]->start) / 1000);
+			if (ms < 0)
+				ms = 0;
+			if (wait < 0 || ms < wait)
+				wait = ms;
+		}
+
+		if (poll (pfd, nactive, wait) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, "%s %s\n", _("poll failed:"), strerror (errno));
+
+		for (i = 0; i < nactive; i++) {
+			if (pfd[i].revents)
+				smtp_mx_step (active[i], helocmd);
+			else if (deltime (active[i]->start) >= (long) timeout_interval * 1000000L)
+				smtp_mx_done (active[i], STATE_CRITICAL, _("Socket timeout"));
+		}
+
+		/* drop the finished ones */
+		for (i = j = 0; i < nactive; i++) {
+			if (active[i]->step == SMTP_STEP_DONE)
+				done++;
+			else
+				active[j++] = active[i];
+		}
+		nactive = j;
+	}
+
+	return smtp_mx_report (mx, count);
+}
+#endif /* HAVE_POLL */
 
 
 /* process command-line arguments */
@@ -471,7 +1136,12 @@ process_arguments (int argc, char **argv)
 	char* temp;
 
 	enum {
-	  SNI_OPTION
+	  SNI_OPTION,
+	  TRACE_TIMING_OPTION,
+	  PIPELINING_OPTION,
+	  MX_OPTION,
+	  HOSTS_OPTION,
+	  CONCURRENCY_OPTION
 	};
 
 	int option = 0;
@@ -500,6 +1170,11 @@ process_arguments (int argc, char **argv)
 		{"certificate",required_argument,0,'D'},
 		{"ignore-quit-failure",no_argument,0,'q'},
 		{"proxy",no_argument,0,'r'},
+		{"trace-timing",no_argument,0,TRACE_TIMING_OPTION},
+		{"pipelining",no_argument,0,PIPELINING_OPTION},
+		{"mx",required_argument,0,MX_OPTION},
+		{"hosts",required_argument,0,HOSTS_OPTION},
+		{"concurrency",required_argument,0,CONCURRENCY_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -601,6 +1276,7 @@ process_arguments (int argc, char **argv)
 			break;
 		case 'v':									/* verbose */
 			verbose++;
+			np_net_verbose = TRUE;
 			break;
 		case 'q':
 			ignore_send_quit_failure++;             /* ignore problem sending QUIT */
@@ -638,6 +1314,27 @@ process_arguments (int argc, char **argv)
 			use_ssl = TRUE;
 			use_ehlo = TRUE;
 			break;
+		case TRACE_TIMING_OPTION:
+			trace_timing = TRUE;
+			break;
+		case PIPELINING_OPTION:
+			use_ehlo = TRUE;
+			break;
+		case MX_OPTION:
+			mx_domain = optarg;
+			break;
+		case HOSTS_OPTION: /* comma separated, may be repeated */
+			for (temp = strtok (strdup (optarg), ","); temp != NULL; temp = strtok (NULL, ",")) {
+				if ((mx_hosts = realloc (mx_hosts, sizeof (char *) * (mx_host_count + 1))) == NULL)
+					die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+				mx_hosts[mx_host_count++] = temp;
+			}
+			break;
+		case CONCURRENCY_OPTION:
+			if (!is_intpos (optarg))
+				usage4 (_("Concurrency must be a positive integer"));
+			mx_concurrency = atoi (optarg);
+			break;
 		case SNI_OPTION:
 #ifdef HAVE_SSL
 			use_sni = TRUE;
@@ -702,6 +1399,15 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments (void)
 {
+	if (mx_domain || mx_host_count) {
+#ifndef HAVE_POLL
+		usage4 (_("--mx and --hosts are not supported on this system"));
+#endif
+		if (mx_domain && mx_host_count)
+			usage4 (_("--mx and --hosts cannot be combined"));
+		if (authtype)
+			usage4 (_("SMTP AUTH cannot be checked with --mx or --hosts"));
+	}
 	return OK;
 }
 
@@ -709,7 +1415,6 @@ validate_arguments (void)
 void
 smtp_quit(void)
 {
-	int bytes;
 	int n;
 
 	n = my_send(SMTP_QUIT, strlen(SMTP_QUIT));
@@ -727,6 +1432,15 @@ smtp_quit(void)
 	if (verbose)
 		printf(_("sent %s\n"), "QUIT");
 
+	smtp_quit_response ();
+}
+
+
+void
+smtp_quit_response(void)
+{
+	int bytes;
+
 	/* read the response but don't care about problems */
 	bytes = recvlines(buffer, MAX_INPUT_BUFFER);
 	if (verbose) {
@@ -742,61 +1456,57 @@ smtp_quit(void)
 }
 
 
-/*
- * Receive one line, copy it into buf and nul-terminate it.  Returns the
- * number of bytes written to buf (excluding the '\0') or 0 on EOF or <0 on
- * error.
- *
- * TODO: Reading one byte at a time is very inefficient.  Replace this by a
- * function which buffers the data, move that to netutils.c and change
- * check_smtp and other plugins to use that.  Also, remove (\r)\n.
- */
+/* the reply to the last command, see np_recvlines() */
 int
-recvline(char *buf, size_t bufsize)
+recvlines(char *buf, size_t bufsize)
 {
-	int result;
-	unsigned i;
+	return np_recvlines (&reader, buf, bufsize);
+}
 
-	for (i = result = 0; i < bufsize - 1; i++) {
-		if ((result = my_recv(&buf[i], 1)) != 1)
-			break;
-		if (buf[i] == '\n') {
-			buf[++i] = '\0';
-			return i;
-		}
+
+/* does the reply in buffer to commands[n] match responses[n]? */
+int
+check_response(int n)
+{
+	int result = STATE_UNKNOWN;
+
+	cflags |= REG_EXTENDED | REG_NOSUB | REG_NEWLINE;
+	errcode = regcomp (&preg, responses[n], cflags);
+	if (errcode != 0) {
+		regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
+		printf (_("Could Not Compile Regular Expression"));
+		return ERROR;
+	}
+	excode = regexec (&preg, buffer, 10, pmatch, eflags);
+	if (excode == 0) {
+		result = STATE_OK;
 	}
-	return (result == 1 || i == 0) ? -2 : result;	/* -2 if out of space */
+	else if (excode == REG_NOMATCH) {
+		result = STATE_WARNING;
+		printf (_("SMTP %s - Invalid response '%s' to command '%s'\n"), state_text (result), buffer, commands[n]);
+	}
+	else {
+		regerror (excode, &preg, errbuf, MAX_INPUT_BUFFER);
+		printf (_("Execute Error: %s\n"), errbuf);
+		result = STATE_UNKNOWN;
+	}
+	regfree (&preg);
+	return result;
 }
 
 
-/*
- * Receive one or more lines, copy them into buf and nul-terminate it.  Returns
- * the number of bytes written to buf (excluding the '\0') or 0 on EOF or <0 on
- * error.  Works for all protocols which format multiline replies as follows:
- *
- * ``The format for multiline replies requires that every line, except the last,
- * begin with the reply code, followed immediately by a hyphen, `-' (also known
- * as minus), followed by text.  The last line will begin with the reply code,
- * followed immediately by <SP>, optionally some text, and <CRLF>.  As noted
- * above, servers SHOULD send the <SP> if subsequent text is not sent, but
- * clients MUST be prepared for it to be omitted.'' (RFC 2821, 4.2.1)
- *
- * TODO: Move this to netutils.c.  Also, remove \r and possibly the final \n.
- */
+/* RFC 2920 lets these go anywhere in a group of commands; the others
+ * must come last, and QUIT is */
 int
-recvlines(char *buf, size_t bufsize)
+pipelinable(void)
 {
-	int result, i;
-
-	for (i = 0; /* forever */; i += result)
-		if (!((result = recvline(buf + i, bufsize - i)) > 3 &&
-		    isdigit((int)buf[i]) &&
-		    isdigit((int)buf[i + 1]) &&
-		    isdigit((int)buf[i + 2]) &&
-		    buf[i + 3] == '-'))
-			break;
+	int i;
 
-	return (result <= 0) ? result : result + i;
+	for (i = 0; i < ncommands; i++)
+		if (strncasecmp (commands[i], "MAIL ", 5) && strncasecmp (commands[i], "RCPT ", 5) &&
+		    strncasecmp (commands[i], "RSET", 4))
+			return FALSE;
+	return TRUE;
 }
 
 
@@ -865,6 +1575,20 @@ print_help (void)
   printf ("    %s\n", _("SMTP AUTH password"));
   printf (" %s\n", "-L, --lmtp");
   printf ("    %s\n", _("Send LHLO instead of HELO/EHLO"));
+  printf (" %s\n", "--pipelining");
+  printf ("    %s\n", _("Send EHLO, so that MAIL FROM, -C's MAIL, RCPT and RSET commands and QUIT go"));
+  printf ("    %s\n", _("out together if the server offers PIPELINING (as they do after EHLO or LHLO"));
+  printf ("    %s\n", _("for other reasons)"));
+#ifdef HAVE_POLL
+  printf (" %s\n", "--mx=DOMAIN");
+  printf ("    %s\n", _("Check every host of the MX records of DOMAIN (the domain itself if it has"));
+  printf ("    %s\n", _("none) concurrently, with a line and phase times for each: connect, banner,"));
+  printf ("    %s\n", _("EHLO, STARTTLS with its handshake (-S) and the transaction up to QUIT"));
+  printf (" %s\n", "--hosts=HOST[,HOST...]");
+  printf ("    %s\n", _("Check these hosts in the same way (may be repeated)"));
+  printf (" %s\n", "--concurrency=INTEGER");
+  printf ("    %s\n", _("Hosts checked at a time with --mx or --hosts (default: 16)"));
+#endif
   printf (" %s\n", "-q, --ignore-quit-failure");
   printf ("    %s\n", _("Ignore failure when sending QUIT command to server"));
    
@@ -872,6 +1596,8 @@ print_help (void)
 
 	printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
+	printf (UT_TRACE_TIMING);
+
 	printf (UT_VERBOSE);
 
 	printf("\n");
@@ -892,5 +1618,7 @@ print_usage (void)
   printf ("%s -H host [-p port] [-4|-6] [-e expect] [-C command] [-R response] [-f from addr]\n", progname);
   printf ("[-A authtype -U authuser -P authpass] [-w warn] [-c crit] [-t timeout] [-q]\n");
   printf ("[-F fqdn] [-S] [-L] [-D warn days cert expire[,crit days cert expire]] [--sni] [-v] \n");
+  printf ("[--trace-timing] [--pipelining] [--mx <domain> | --hosts <host>[,<host>...]]\n");
+  printf ("[--concurrency <n>]\n");
 }
 
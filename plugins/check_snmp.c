@@ -36,6 +36,10 @@ const char *email = "devel@nagios-plugins.org";
 #include "runcmd.h"
 #include "utils.h"
 #include "utils_cmd.h"
+#include "utils_snmp.h"
+#include "netutils.h"
+#include "sha1.h"
+#include <ctype.h>
 
 #define DEFAULT_COMMUNITY "public"
 #define DEFAULT_PORT "161"
@@ -46,6 +50,10 @@ const char *email = "devel@nagios-plugins.org";
 #define DEFAULT_PRIV_PROTOCOL "DES"
 #define DEFAULT_DELIMITER "="
 #define DEFAULT_OUTPUT_DELIMITER " "
+#define DEFAULT_MAX_REPETITIONS 10
+#define DEFAULT_CONCURRENCY 64
+#define DEFAULT_IF_EXCLUDE_TYPES "23"
+#define DEFAULT_ENGINE_CACHE_TTL 3600
 
 #define mark(a) ((a)!=0?"*":"")
 
@@ -65,6 +73,20 @@ const char *email = "devel@nagios-plugins.org";
 #define L_INVERT_SEARCH CHAR_MAX+3
 #define L_OFFSET CHAR_MAX+4
 #define STRICT_MODE CHAR_MAX+5
+#define L_USE_SNMPGET CHAR_MAX+6
+#define L_TABLE CHAR_MAX+7
+#define L_MAX_REPETITIONS CHAR_MAX+8
+#define L_HOSTS CHAR_MAX+9
+#define L_CONCURRENCY CHAR_MAX+10
+#define L_ENGINE_CACHE_TTL CHAR_MAX+11
+#define L_IFSTATUS CHAR_MAX+12
+#define L_IFMIB CHAR_MAX+13
+#define L_IF_EXCLUDE_TYPES CHAR_MAX+14
+#define L_IF_UNUSED_PORTS CHAR_MAX+15
+#define L_IF_UNUSED_NAMES CHAR_MAX+16
+#define L_IF_PORTS CHAR_MAX+17
+#define L_IF_NAMES CHAR_MAX+18
+#define L_CACHE_TTL CHAR_MAX+19
 
 /* Gobble to string - stop incrementing c when c[0] match one of the
  * characters in s */
@@ -86,18 +108,47 @@ const char *email = "devel@nagios-plugins.org";
 
 
 int process_arguments (int, char **);
+static void snmp_query_native (output *, int);
+static void snmp_walk_native (output *, int);
+static void snmp_ifstatus (int);
+static void snmp_poll_agents (int);
+static void snmp_query_command (output *, int);
+#ifdef PATH_TO_SNMPGET
+static int snmp_engine_setup (int);
+#endif
+static int snmp_translate_oids (void);
+static int snmp_uptime_native (int, uint64_t *);
+
+/* the value types main() tells apart in snmpget output */
+#define SNMP_VALUE_OTHER 0
+#define SNMP_VALUE_GAUGE 1
+#define SNMP_VALUE_COUNTER 2
+#define SNMP_VALUE_INTEGER 3
+#define SNMP_VALUE_OID 4
+#define SNMP_VALUE_STRING 5
+#define SNMP_VALUE_TIMETICKS 6
+#define SNMP_VALUE_COUNTER64 7
+
+/* one "OID = TYPE: value" line, split where it is */
+struct snmp_value {
+	const char *oid;
+	const char *response;     /* everything after the delimiter */
+	int type;
+	char *value;              /* after the "TYPE: " */
+};
+static int snmp_tokenize (char *, struct snmp_value *);
+static void buf_puts (np_perfdata *, const char *);
 int validate_arguments (void);
 char *thisarg (char *str);
 char *nextarg (char *str);
 void print_usage (void);
 void print_help (void);
 
-#include "regex.h"
+#include "utils_regex.h"
 char regex_expect[MAX_INPUT_BUFFER] = "";
-regex_t preg;
+np_regex_t preg;
 regmatch_t pmatch[10];
 char errbuf[MAX_INPUT_BUFFER] = "";
-char perfstr[MAX_INPUT_BUFFER] = "| ";
 int cflags = REG_EXTENDED | REG_NOSUB | REG_NEWLINE;
 int eflags = 0;
 int errcode, excode;
@@ -133,6 +184,25 @@ int numauthpriv = 0;
 int numcontext = 0;
 int verbose = 0;
 int usesnmpgetnext = FALSE;
+int use_snmpget = FALSE;
+int table_mode = FALSE;
+int max_repetitions = DEFAULT_MAX_REPETITIONS;
+/* --hosts: the same check against each of these, at the same time */
+char **target_hosts = NULL;
+int target_count = 0;
+int concurrency = DEFAULT_CONCURRENCY;
+/* SNMPv3: what snmpget would find out about the agent, kept for this long */
+int engine_cache_ttl = DEFAULT_ENGINE_CACHE_TTL;
+/* --cache-ttl: responses other checks of the agent may use, for so long */
+int response_cache_ttl = 0;
+/* --ifstatus and the interfaces it leaves out */
+int ifstatus_mode = FALSE;
+int ifmib = FALSE;
+char *if_exclude_types = NULL;
+char *if_unused_ports = NULL;
+char *if_unused_names = NULL;
+char *if_ports = NULL;
+char *if_names = NULL;
 char *warning_thresholds = NULL;
 char *critical_thresholds = NULL;
 thresholds **thlds;
@@ -146,13 +216,15 @@ char *delimiter;
 char *output_delim;
 char *miblist = NULL;
 int needmibs = FALSE;
+/* the names given with -o, where they were translated to numeric OIDs */
+static char **oid_labels = NULL;
 int calculate_rate = 0;
 static int strict_mode = 0;
 double offset = 0.0;
 int rate_multiplier = 1;
-state_data *previous_state;
-double *previous_value;
-size_t previous_size = OID_COUNT_STEP;
+/* --rate: the values of the last run, and the sysUpTime.0 of this one */
+np_snmp_rate *rate_state = NULL;
+#define SNMP_UPTIME_OID "1.3.6.1.2.1.1.3.0"
 int perf_labels = 1;
 char* ip_version = "";
 
@@ -180,29 +252,28 @@ static char *fix_snmp_range(char *th)
 int
 main (int argc, char **argv)
 {
-	int i, len, line, total_oids;
+	int i, line;
 	unsigned int bk_count = 0, dq_count = 0;
 	int iresult = STATE_UNKNOWN;
 	int result = STATE_UNKNOWN;
-	int return_code = 0;
-	int external_error = 0;
-	char **command_line = NULL;
-	char *cl_hidden_auth = NULL;
-	char *oidname = NULL;
-	char *response = NULL;
-	char *mult_resp = NULL;
-	char *outbuff;
+	const char *oidname = NULL;
+	const char *response = NULL;
+	struct snmp_value tok;
+	np_strbuf mult_resp, outbuff;
+	np_perfdata perfstr;
 	char *ptr = NULL;
 	char *show = NULL;
 	char *th_warn=NULL;
 	char *th_crit=NULL;
 	char type[8] = "";
-	output chld_out, chld_err;
-	char *previous_string=NULL;
-	char *ap=NULL;
-	char *state_string=NULL;
-	size_t response_length, current_length, string_length;
-	char *temp_string=NULL;
+	output chld_out;
+	char *rate_file;
+	time_t previous_time;
+	uint64_t counter, previous_counter;
+	double previous_double;
+	int agent_restarted = FALSE, rate_missing = FALSE, uptime_ok = FALSE;
+	uint64_t uptime = 0;
+	const char *perf_label;
 	char *quote_string=NULL;
 	time_t current_time;
 	double temp_double;
@@ -210,24 +281,23 @@ main (int argc, char **argv)
 	char *conv = "12345678";
 	int is_counter=0;
 	int command_interval;
+	int native;
 	int is_ticks= 0;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	labels = malloc (labels_size * sizeof(*labels));
 	unitv = malloc (unitv_size * sizeof(*unitv));
 	thlds = malloc (thlds_size * sizeof(*thlds));
 	response_value = malloc (response_size * sizeof(*response_value));
-	previous_value = malloc (previous_size * sizeof(*previous_value));
 	eval_method = calloc (eval_size, sizeof(*eval_method));
 	oids = calloc(oids_size, sizeof (char *));
 
 	label = strdup ("SNMP");
 	units = strdup ("");
 	port = strdup (DEFAULT_PORT);
-	outbuff = strdup ("");
+	np_strbuf_init (&outbuff, NULL);
+	np_strbuf_init (&mult_resp, NULL);
+	np_perfdata_init (&perfstr);
+	buf_puts (&perfstr, "| ");
 	delimiter = strdup (" = ");
 	output_delim = strdup (DEFAULT_OUTPUT_DELIMITER);
 	retries = DEFAULT_RETRIES;
@@ -250,23 +320,49 @@ main (int argc, char **argv)
 		exit (STATE_UNKNOWN);
 	}
 
+	/* names known from an earlier run need no MIBs at all */
+	if (needmibs && !strict_mode && snmp_translate_oids ()) {
+		needmibs = FALSE;
+		miblist = "";
+	}
+
+	/* snmpget is only needed for SNMPv3 and for MIB names */
+	native = !use_snmpget && !needmibs && (!strcmp (proto, "1") || !strcmp (proto, "2c"));
+#ifndef PATH_TO_SNMPGET
+	if (!native)
+		die (STATE_UNKNOWN, _("snmpget is not installed, so SNMPv3 and MIB names cannot be used\n"));
+#endif
+	if (table_mode && !native)
+		usage4 (_("--table needs SNMPv1 or v2c and numeric OIDs"));
+	if (target_count && !native)
+		usage4 (_("--hosts needs SNMPv1 or v2c and numeric OIDs"));
+	if (target_count && (table_mode || calculate_rate))
+		usage4 (_("--hosts cannot be combined with --table or --rate"));
+	if (response_cache_ttl && (!native || table_mode || target_count || ifstatus_mode))
+		usage4 (_("--cache-ttl needs SNMPv1 or v2c and numeric OIDs, without --table, --hosts or --ifstatus"));
+	if (response_cache_ttl && calculate_rate)
+		usage4 (_("--cache-ttl cannot be combined with --rate"));
+	if (ifstatus_mode && !native)
+		usage4 (_("--ifstatus needs SNMPv1 or v2c"));
+	if (ifstatus_mode && (table_mode || calculate_rate || target_count))
+		usage4 (_("--ifstatus cannot be combined with --table, --rate or --hosts"));
+
 	if(calculate_rate) {
 		if (!strcmp(label, "SNMP"))
 			label = strdup("SNMP RATE");
-		i=0;
-		previous_state = np_state_read();
-		if(previous_state!=NULL) {
-			/* Split colon separated values */
-			previous_string = strdup((char *) previous_state->data);
-			while((ap = strsep(&previous_string, ":")) != NULL) {
-				if(verbose>2)
-					printf("Previous State for %d=%s\n", i, ap);
-				while (i >= previous_size) {
-					previous_size += OID_COUNT_STEP;
-					previous_value = realloc(previous_value, previous_size * sizeof(*previous_value));
-				}
-				previous_value[i++]=strtod(ap,NULL);
+		if ((rate_file = np_state_path (".rates")) == NULL)
+			die (STATE_UNKNOWN, "%s\n", _("Cannot create the state directory"));
+		rate_state = np_snmp_rate_open (rate_file);
+		free (rate_file);
+
+		/* sysUpTime.0 goes along with the query, to tell a restart of the
+		 * agent from counters that wrapped */
+		if (!table_mode) {
+			while (numoids >= oids_size) {
+				oids_size += OID_COUNT_STEP;
+				oids = realloc(oids, oids_size * sizeof (*oids));
 			}
+			oids[numoids++] = SNMP_UPTIME_OID;
 		}
 	}
 
@@ -303,50 +399,9 @@ main (int argc, char **argv)
 		}
 	}
 
-	/* Create the command array to execute */
-	if(usesnmpgetnext == TRUE) {
-		snmpcmd = strdup (PATH_TO_SNMPGETNEXT);
-	}else{
-		snmpcmd = strdup (PATH_TO_SNMPGET);
-	}
-
-	/* 10 arguments to pass before context and authpriv options + 1 for host and numoids. Add one for terminating NULL */
-	command_line = calloc (10 + numcontext + numauthpriv + 1 + numoids + 1, sizeof (char *));
-	command_line[0] = snmpcmd;
-	command_line[1] = strdup ("-Le");
-	command_line[2] = strdup ("-t");
-	xasprintf (&command_line[3], "%d", command_interval);
-	command_line[4] = strdup ("-r");
-	xasprintf (&command_line[5], "%d", retries);
-	command_line[6] = strdup ("-m");
-	command_line[7] = strdup (miblist);
-	command_line[8] = "-v";
-	command_line[9] = strdup (proto);
-
-	for (i = 0; i < numcontext; i++) {
-		command_line[10 + i] = contextargs[i];
-	}
-	
-	for (i = 0; i < numauthpriv; i++) {
-		command_line[10 + numcontext + i] = authpriv[i];
-	}
-
-	xasprintf (&command_line[10 + numcontext + numauthpriv], "%s:%s", server_address, port);
-
-	/* This is just for display purposes, so it can remain a string */
-	xasprintf(&cl_hidden_auth, "%s -Le -t %d -r %d -m %s -v %s %s %s %s:%s",
-		snmpcmd, command_interval, retries, strlen(miblist) ? miblist : "''", proto, "[context]", "[authpriv]",
-		server_address, port);
-
-	for (i = 0; i < numoids; i++) {
-		command_line[10 + numcontext + numauthpriv + 1 + i] = oids[i];
-		xasprintf(&cl_hidden_auth, "%s %s", cl_hidden_auth, oids[i]);	
-	}
-
-	command_line[10 + numcontext + numauthpriv + 1 + numoids] = NULL;
-
-	if (verbose)
-		printf ("%s\n", cl_hidden_auth);
+	/* -t is per agent, there is no alarm for the lot */
+	if (target_count)
+		snmp_poll_agents (command_interval);
 
 	/* Set signal handling and alarm */
 	if (signal (SIGALRM, runcmd_timeout_alarm_handler) == SIG_ERR) {
@@ -354,38 +409,36 @@ main (int argc, char **argv)
 	}
 	alarm(timeout_interval + 1);
 
-	/* Run the command */
-	return_code = cmd_run_array (command_line, &chld_out, &chld_err, 0);
+	if (ifstatus_mode)
+		snmp_ifstatus (command_interval);
+	if (table_mode && calculate_rate)
+		uptime_ok = snmp_uptime_native (command_interval, &uptime);
+	if (table_mode)
+		snmp_walk_native (&chld_out, command_interval);
+	else if (native)
+		snmp_query_native (&chld_out, command_interval);
+	else
+		snmp_query_command (&chld_out, command_interval);
 
 	/* disable alarm again */
 	alarm(0);
 
-	/* Due to net-snmp sometimes showing stderr messages with poorly formed MIBs,
-	   only return state unknown if return code is non zero or there is no stdout.
-	   Do this way so that if there is stderr, will get added to output, which helps problem diagnosis
-	*/
-	if (return_code != 0)
-		external_error=1;
-	if (chld_out.lines == 0)
-		external_error=1;
-	if (external_error) {
-		if ((chld_err.lines > 0) && strstr(chld_err.line[0], "Timeout")) {
-			printf (_("%s - External command error: %s\n"), state_text(timeout_state), chld_err.line[0]);
-			for (i = 1; i < chld_err.lines; i++) {
-				printf ("%s\n", chld_err.line[i]);
-			}
-			exit (timeout_state);
-		} else if (chld_err.lines > 0) {
-			printf (_("External command error: %s\n"), chld_err.line[0]);
-			for (i = 1; i < chld_err.lines; i++) {
-				printf ("%s\n", chld_err.line[i]);
+	/* the sysUpTime.0 is the last line */
+	if (calculate_rate && !table_mode) {
+		numoids--;
+		if (chld_out.lines > 0 && snmp_tokenize (chld_out.line[chld_out.lines - 1], &tok)) {
+			chld_out.lines--;
+			if (tok.type == SNMP_VALUE_TIMETICKS && isdigit ((unsigned char) *tok.value)) {
+				uptime = strtoull (tok.value, NULL, 10);
+				uptime_ok = TRUE;
 			}
-			exit (STATE_UNKNOWN);
-		} else {
-			printf(_("External command error with no output (return code: %d)\n"), return_code);
-			exit (STATE_UNKNOWN);
 		}
 	}
+	if (calculate_rate && uptime_ok) {
+		agent_restarted = np_snmp_rate_restarted (rate_state, current_time, uptime);
+		if (verbose > 2)
+			printf ("sysUpTime.0=%llu%s\n", (unsigned long long) uptime, agent_restarted ? _(", restarted") : "");
+	}
 
 	if (verbose) {
 		for (i = 0; i < chld_out.lines; i++) {
@@ -399,12 +452,10 @@ main (int argc, char **argv)
 		else
 			conv = "%.0f";
 
-		ptr = chld_out.line[line];
-		oidname = strpcpy (oidname, ptr, delimiter);
-		response = strstr (ptr, delimiter);
-		if (response == NULL)
+		if (!snmp_tokenize (chld_out.line[line], &tok))
 			break;
-		response = response + 3;
+		oidname = tok.oid;
+		response = tok.response;
 
 		if (verbose > 2) {
 			printf("Processing oid %i (line %i)\n  oidname: %s\n  response: %s\n", i+1, line+1, oidname, response);
@@ -413,39 +464,20 @@ main (int argc, char **argv)
 		if (strict_mode && strncmp(oids[i], oidname, strlen(oids[i]))) {
 			die( STATE_UNKNOWN, _("UNKNOWN - Expected OID %s did not match actual OID %s.\n"), oids[i], oidname);
 		}
+		/* label translated OIDs the way the MIBs would have */
+		if (oid_labels && !table_mode && !usesnmpgetnext && (size_t)i < numoids)
+			oidname = oid_labels[i];
 
 		/* Clean up type array - Sol10 does not necessarily zero it out */
 		bzero(type, sizeof(type));
 
-		is_counter=0;
-		is_ticks = 0;
 		/* We strip out the datatype indicator for PHBs */
-		if (strstr (response, "Gauge: ")) {
-			show = strstr (response, "Gauge: ") + 7;
-		}
-		else if (strstr (response, "Gauge32: ")) {
-			show = strstr (response, "Gauge32: ") + 9;
-		}
-		else if (strstr (response, "Counter32: ")) {
-			show = strstr (response, "Counter32: ") + 11;
-			is_counter=1;
-			if(!calculate_rate)
-				strcpy(type, "c");
-		}
-		else if (strstr (response, "Counter64: ")) {
-			show = strstr (response, "Counter64: ") + 11;
-			is_counter=1;
-			if(!calculate_rate)
-				strcpy(type, "c");
-		}
-		else if (strstr (response, "INTEGER: ")) {
-			show = strstr (response, "INTEGER: ") + 9;
-		}
-		else if (strstr (response, "OID: ")) {
-			show = strstr (response, "OID: ") + 5;
-		}
-		else if (strstr (response, "STRING: ")) {
-			show = strstr (response, "STRING: ") + 8;
+		show = tok.value;
+		is_counter = tok.type == SNMP_VALUE_COUNTER || tok.type == SNMP_VALUE_COUNTER64;
+		is_ticks = tok.type == SNMP_VALUE_TIMETICKS;
+		if (is_counter && !calculate_rate)
+			strcpy(type, "c");
+		if (tok.type == SNMP_VALUE_STRING) {
 			conv = "%.10g";
 
 			/* Get the rest of the string on multi-line strings */
@@ -459,15 +491,18 @@ main (int argc, char **argv)
 
 			if (dq_count) { /* unfinished line */
 				/* copy show verbatim first */
-				if (!mult_resp) mult_resp = strdup("");
-				xasprintf (&mult_resp, "%s%s:\n%s\n", mult_resp, oids[i], show);
+				np_strbuf_puts (&mult_resp, oids[i]);
+				np_strbuf_puts (&mult_resp, ":\n");
+				np_strbuf_puts (&mult_resp, show);
+				np_strbuf_puts (&mult_resp, "\n");
 				/* then strip out unmatched double-quote from single-line output */
 				if (show[0] == '"') show++;
 
 				/* Keep reading until we match end of double-quoted string */
 				for (line++; line < chld_out.lines; line++) {
 					ptr = chld_out.line[line];
-					xasprintf (&mult_resp, "%s%s\n", mult_resp, ptr);
+					np_strbuf_puts (&mult_resp, ptr);
+					np_strbuf_puts (&mult_resp, "\n");
 
 					COUNT_SEQ(ptr, bk_count, dq_count)
 					while (dq_count && ptr[0] != '\n' && ptr[0] != '\0') {
@@ -481,13 +516,6 @@ main (int argc, char **argv)
 			}
 
 		}
-		else if (strstr (response, "Timeticks: ")) {
-			show = strstr (response, "Timeticks: ");
-			show = strpbrk (show, "-0123456789");
-			is_ticks = 1;
-		}
-		else
-			show = response;
 
 		iresult = STATE_DEPENDENT;
 
@@ -505,23 +533,29 @@ main (int argc, char **argv)
 			response_value[i] = strtod (ptr, NULL) + offset;
 
 			if(calculate_rate) {
-				if (previous_state!=NULL) {
-					duration = current_time-previous_state->time;
+				/* counters wrap, so they are kept as they are */
+				counter = is_counter ? strtoull (ptr, NULL, 10) : 0;
+				if (!agent_restarted &&
+				    np_snmp_rate_get (rate_state, tok.oid, &previous_time, &previous_counter, &previous_double)) {
+					if (verbose > 2)
+						printf ("Previous value of %s=%.10g at %lu\n", tok.oid,
+						        is_counter ? (double) previous_counter : previous_double, (unsigned long) previous_time);
+					duration = current_time-previous_time;
 					if(duration<=0)
 						die(STATE_UNKNOWN,_("Time duration between plugin calls is invalid"));
-					temp_double = response_value[i]-previous_value[i];
-					/* Simple overflow catcher (same as in rrdtool, rrd_update.c) */
-					if(is_counter) {
-						if(temp_double<(double)0.0)
-							temp_double+=(double)4294967296.0; /* 2^32 */
-						if(temp_double<(double)0.0)
-							temp_double+=(double)18446744069414584320.0; /* 2^64-2^32 */;
-					}
+					if(is_counter)
+						temp_double = np_snmp_counter_delta (previous_counter, counter,
+						                                     tok.type == SNMP_VALUE_COUNTER64 ? 64 : 32);
+					else
+						temp_double = response_value[i]-previous_double;
 					/* Convert to per second, then use multiplier */
 					temp_double = temp_double/duration*rate_multiplier;
 					iresult = get_status(temp_double, thlds[i]);
 					xasprintf (&show, conv, temp_double);
+				} else {
+					rate_missing = TRUE;
 				}
+				np_snmp_rate_set (rate_state, tok.oid, current_time, counter, response_value[i]);
 			} else {
 				iresult = get_status(response_value[i], thlds[i]);
 				if(is_ticks) {
@@ -543,12 +577,12 @@ main (int argc, char **argv)
 
 		/* Process this block for regex matching */
 		else if (eval_size > i && eval_method[i] & CRIT_REGEX) {
-			excode = regexec (&preg, response, 10, pmatch, eflags);
+			excode = np_regexec (&preg, response, 10, pmatch, eflags);
 			if (excode == 0) {
 				iresult = (invert_search==0) ? STATE_OK : STATE_CRITICAL;
 			}
 			else if (excode != REG_NOMATCH) {
-				regerror (excode, &preg, errbuf, MAX_INPUT_BUFFER);
+				np_regerror (excode, &preg, errbuf, MAX_INPUT_BUFFER);
 				printf (_("Execute Error: %s\n"), errbuf);
 				exit (STATE_CRITICAL);
 			}
@@ -572,24 +606,25 @@ main (int argc, char **argv)
 		result = max_state (result, iresult);
 		
 		/* Prepend a label for this OID if there is one */
-		if (nlabels >= (size_t)1 && (size_t)i < nlabels && labels[i] != NULL)
-			xasprintf (&outbuff, "%s%s%s %s%s%s", outbuff,
-				(i == 0) ? " " : output_delim,
-				labels[i], mark (iresult), show, mark (iresult));
-		else
-			xasprintf (&outbuff, "%s%s%s%s%s", outbuff, (i == 0) ? " " : output_delim,
-				mark (iresult), show, mark (iresult));
+		np_strbuf_puts (&outbuff, (i == 0) ? " " : output_delim);
+		if (nlabels >= (size_t)1 && (size_t)i < nlabels && labels[i] != NULL) {
+			np_strbuf_puts (&outbuff, labels[i]);
+			np_strbuf_puts (&outbuff, " ");
+		}
+		np_strbuf_puts (&outbuff, mark (iresult));
+		np_strbuf_puts (&outbuff, show);
+		np_strbuf_puts (&outbuff, mark (iresult));
 
 		/* Append a unit string for this OID if there is one */
-		if (nunits > (size_t)0 && (size_t)i < nunits && unitv[i] != NULL)
-			xasprintf (&outbuff, "%s %s", outbuff, unitv[i]);
+		if (nunits > (size_t)0 && (size_t)i < nunits && unitv[i] != NULL) {
+			np_strbuf_puts (&outbuff, " ");
+			np_strbuf_puts (&outbuff, unitv[i]);
+		}
 		
 		/* Write perfdata with whatever can be parsed by strtod, if possible */
 		ptr = NULL;
-		if(is_ticks) {
-			show = strstr (response, "Timeticks: ");
-			show = strpbrk (show, "-0123456789");
-		}
+		if(is_ticks)
+			show = tok.value;
 		strtod(show, &ptr);
 		if (ptr > show) {
 
@@ -599,132 +634,1294 @@ main (int argc, char **argv)
 				&& ((size_t)i < nlabels) 
 				&& labels[i] != NULL) {
 
-					temp_string=labels[i];
+					perf_label=labels[i];
 			}
 			else {
-				temp_string = oidname;
+				perf_label = oidname;
 			}
 
 			/* check the label for space, equal, singlequote or doublequote */
-			if (strpbrk(temp_string, " ='\"") == NULL) {
+			if (strpbrk(perf_label, " ='\"") == NULL) {
 
 				/* if it doesn't have any - we can just use it as the label */
-				strncat(perfstr, temp_string, sizeof(perfstr) - strlen(perfstr) - 1);
+				buf_puts (&perfstr, perf_label);
 
 			} else {
 
 				/* if it does have one of those characters, we need
 				   to find a way to adequately quote it */
-				if (strpbrk(temp_string, "'") == NULL) {
+				if (strpbrk(perf_label, "'") == NULL) {
 					quote_string="'";
 				} else {
 					quote_string="\"";
 				}
 
-				strncat(perfstr, quote_string, sizeof(perfstr) - strlen(perfstr) - 1);
-				strncat(perfstr, temp_string, sizeof(perfstr) - strlen(perfstr) - 1);
-				strncat(perfstr, quote_string, sizeof(perfstr) - strlen(perfstr) - 1);
+				buf_puts (&perfstr, quote_string);
+				buf_puts (&perfstr, perf_label);
+				buf_puts (&perfstr, quote_string);
 			}
 
-			/* append the equal */
-			strncat(perfstr, "=", sizeof(perfstr) - strlen(perfstr) - 1);
-			len = sizeof(perfstr) - strlen(perfstr) - 1;
-
-			/* and then the data itself from the response */
-			strncat(perfstr, show, (len > ptr - show) ? ptr - show : len);
+			/* append the equal, and then the data itself from the response */
+			buf_puts (&perfstr, "=");
+			np_perfdata_append (&perfstr, show, ptr - show);
 
 			/* now append the unit of measurement */
 			if ((nunits > (size_t)0) 
 				&& ((size_t)i < nunits) 
 				&& (unitv[i] != NULL)) {
 
-					xasprintf(&temp_string, "%s", unitv[i]);
-					strncat(perfstr, temp_string, sizeof(perfstr) - strlen(perfstr) - 1);
+					buf_puts (&perfstr, unitv[i]);
 			}
 
 			/* and the type, if any */
-			if (type) {
-				strncat(perfstr, type, sizeof(perfstr) - strlen(perfstr) - 1);
-			}
+			buf_puts (&perfstr, type);
 
 			/* add warn/crit to perfdata */
 			if (thlds[i]->warning || thlds[i]->critical) {
+				buf_puts (&perfstr, ";");
+				if (thlds[i]->warning_string)
+					buf_puts (&perfstr, thlds[i]->warning_string);
+				buf_puts (&perfstr, ";");
+				if (thlds[i]->critical_string)
+					buf_puts (&perfstr, thlds[i]->critical_string);
+			}
 
-				strncat(perfstr, ";", sizeof(perfstr) - strlen(perfstr) - 1);
+			/* we do not add any min/max value */
 
-				/* print the warning string if it exists */
-				if (thlds[i]->warning_string) {
+			buf_puts (&perfstr, " ");
+		}
 
-					xasprintf(&temp_string, "%s", thlds[i]->warning_string);
-					strncat(perfstr, temp_string, sizeof(perfstr) - strlen(perfstr) - 1);
-				}
-				strncat(perfstr, ";", sizeof(perfstr)-strlen(perfstr)-1);
+	} /* for (line=0, i=0; line < chld_out.lines; line++, i++) */
 
-				/* print the critical string if it exists */
-				if (thlds[i]->critical_string) {
+	/* Save state data, as all data collected now */
+	if(calculate_rate) {
+		np_snmp_rate_save (rate_state);
+		np_snmp_rate_close (rate_state);
+		if (agent_restarted)
+			die (STATE_OK, _("The agent has restarted, no rate until the next check - assume okay"));
+		if (rate_missing) {
+			/* Or should this be highest state? */
+			die( STATE_OK, _("No previous data to calculate rate - assume okay" ) );
+		}
+	}
+	
+	printf ("%s %s -%s %s\n", label, state_text (result), np_strbuf_string (&outbuff),
+	        np_perfdata_string (&perfstr));
+	printf ("%s", np_strbuf_string (&mult_resp));
 
-					xasprintf(&temp_string, "%s", thlds[i]->critical_string);
-					strncat(perfstr, temp_string, sizeof(perfstr) - strlen(perfstr) - 1);
-				}
-				strncat(perfstr, ";", sizeof(perfstr) - strlen(perfstr) - 1);
+	return result;
+}
+
+
+
+/* Split an snmpget output line in place into its OID, the type of the
+ * value and the value, in one pass. FALSE if there is no delimiter. */
+static int
+snmp_tokenize (char *line, struct snmp_value *v)
+{
+	static const struct {
+		const char *name;
+		size_t len;
+		int type;
+	} types[] = {
+		{ "Gauge", 5, SNMP_VALUE_GAUGE },
+		{ "Gauge32", 7, SNMP_VALUE_GAUGE },
+		{ "Counter32", 9, SNMP_VALUE_COUNTER },
+		{ "Counter64", 9, SNMP_VALUE_COUNTER64 },
+		{ "INTEGER", 7, SNMP_VALUE_INTEGER },
+		{ "OID", 3, SNMP_VALUE_OID },
+		{ "STRING", 6, SNMP_VALUE_STRING },
+		{ "Hex-STRING", 10, SNMP_VALUE_STRING },
+		{ "Timeticks", 9, SNMP_VALUE_TIMETICKS }
+	};
+	char *response, *p;
+	size_t i;
+
+	if ((response = strstr (line, delimiter)) == NULL)
+		return FALSE;
+	*response = '\0';
+	response += strlen (delimiter);
+	v->oid = line;
+	v->response = response;
+	v->type = SNMP_VALUE_OTHER;
+	v->value = response;
+
+	/* "Wrong Type (should be Gauge32): INTEGER: 5" is the INTEGER */
+	if (!strncmp (response, "Wrong Type (", 12) && (p = strstr (response, "): ")) != NULL)
+		response = p + 3;
+	for (p = response; isalnum ((unsigned char) *p) || *p == '-'; p++);
+	if (p[0] != ':' || p[1] != ' ')
+		return TRUE;
+	for (i = 0; i < sizeof (types) / sizeof (*types); i++) {
+		if ((size_t) (p - response) == types[i].len && !memcmp (response, types[i].name, types[i].len)) {
+			v->type = types[i].type;
+			v->value = p + 2;
+			break;
+		}
+	}
+	/* the number of ticks, "Timeticks: (12345) 0:02:03.45" */
+	if (v->type == SNMP_VALUE_TIMETICKS && (p = strpbrk (v->value, "-0123456789")) != NULL)
+		v->value = p;
+	return TRUE;
+}
+
+static void
+buf_puts (np_perfdata *buf, const char *str)
+{
+	np_perfdata_append (buf, str, strlen (str));
+}
+
+/* Connect to the agent for snmp_exchange() */
+static int
+snmp_connect (void)
+{
+	int sd;
+
+	if (my_udp_connect (server_address, atoi (port), &sd) != STATE_OK)
+		die (STATE_UNKNOWN, _("Cannot connect to %s:%s\n"), server_address, port);
+	return sd;
+}
+
+/* One request and its response, which has to be freed; gives up the way
+ * snmpget does if there is no response */
+static void
+snmp_exchange (int sd, const np_snmp_pdu *req, np_snmp_pdu *resp, int command_interval)
+{
+	int result = np_snmp_query (sd, req, resp, command_interval * 1000, retries);
+
+	if (result == NP_SNMP_TIMEOUT) {
+		printf (_("%s - Timeout: No Response from %s:%s.\n"), state_text (timeout_state), server_address, port);
+		exit (timeout_state);
+	} else if (result != NP_SNMP_OK) {
+		die (STATE_UNKNOWN, _("SNMP request to %s:%s failed: %s\n"), server_address, port, strerror (errno));
+	}
+}
+
+/* error-index counts the varbinds of the request from 1 */
+static void
+snmp_packet_error (const np_snmp_pdu *resp, const char *failed)
+{
+	die (STATE_UNKNOWN, _("Error in packet\nReason: %s\nFailed object: %s\n"),
+	     np_snmp_error_string (resp->error_status), failed ? failed : "");
+}
+
+/* Add a line to out, as cmd_run_array() would have read it */
+static void
+snmp_append_line (output *out, const char *line)
+{
+	size_t len = strlen (line);
+
+	if ((out->buf = realloc (out->buf, out->buflen + len + 2)) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	memcpy (out->buf + out->buflen, line, len);
+	out->buflen += len;
+	out->buf[out->buflen++] = '\n';
+	out->buf[out->buflen] = '\0';
+}
+
+/* "OID = TYPE: value", as snmpget -m '' would print it */
+static char *
+snmp_varbind_line (const np_snmp_varbind *vb)
+{
+	char oidstr[NP_SNMP_MAX_OID * 11];
+	char *value, *line;
+
+	np_snmp_oid_string (&vb->oid, TRUE, oidstr, sizeof (oidstr));
+	value = np_snmp_format_value (vb);
+	xasprintf (&line, "%s = %s", oidstr, value);
+	free (value);
+	return line;
+}
+
+/* Add a varbind to out as an "OID = TYPE: value" line */
+static void
+snmp_append_varbind (output *out, const np_snmp_varbind *vb)
+{
+	char *line = snmp_varbind_line (vb);
+
+	snmp_append_line (out, line);
+	free (line);
+}
+
+#ifdef PATH_TO_SNMPTRANSLATE
+/* Run snmptranslate for the names oids[index[0..n-1]], -On for the OID,
+ * the default output for the label and -Td for the SYNTAX, and add what
+ * it says to the cache. FALSE if it did not know every one of them. */
+static int
+snmp_translate_names (np_snmp_mib_cache *cache, const size_t *index, size_t n, char **numeric)
+{
+	static const char *formats[] = { "-On", "-OS", "-Td" };
+	output out[3], err;
+	const char *type;
+	char **argv;
+	size_t i, k, line;
+	int ok = TRUE;
+
+	argv = calloc (5 + n + 1, sizeof (*argv));
+	argv[0] = PATH_TO_SNMPTRANSLATE;
+	argv[1] = "-Le";
+	argv[2] = "-m";
+	argv[3] = miblist;
+	for (i = 0; i < n; i++)
+		argv[5 + i] = oids[index[i]];
+	for (k = 0; k < 3; k++) {
+		argv[4] = (char *) formats[k];
+		if (cmd_run_array (argv, &out[k], &err, 0) != 0 && k < 2)
+			ok = FALSE;
+	}
+	free (argv);
+	if (verbose > 1)
+		printf ("snmptranslate: %lu names, %d OIDs\n", (unsigned long) n, out[0].lines);
+	if (!ok || (size_t) out[0].lines != n || (size_t) out[1].lines != n)
+		return FALSE;
+
+	for (i = 0, line = 0; i < n; i++) {
+		/* the description of each name starts with its OID */
+		type = NULL;
+		for (; line < (size_t) out[2].lines; line++) {
+			if (type == NULL && !strcmp (out[2].line[line], out[0].line[i]))
+				type = "";
+			else if (out[2].line[line][0] == '.')
+				break;
+			else if (type && !strncmp (out[2].line[line], "  SYNTAX\t", 9))
+				type = out[2].line[line] + 9;
+		}
+		numeric[index[i]] = strdup (out[0].line[i] + (out[0].line[i][0] == '.'));
+		oid_labels[index[i]] = strdup (out[1].line[i]);
+		np_snmp_mib_cache_add (cache, oids[index[i]], numeric[index[i]], oid_labels[index[i]], type);
+	}
+	return TRUE;
+}
+#endif
+
+/* Replace the MIB names in oids[] by numeric OIDs from the MIB cache,
+ * running snmptranslate for those it does not have yet. Returns FALSE,
+ * leaving oids[] alone, unless every name could be translated. */
+static int
+snmp_translate_oids (void)
+{
+	np_snmp_mib_cache *cache;
+	np_snmp_mib_entry entry;
+	const char *mibdirs, *env;
+	char *path, *dirs = NULL, *mibs = NULL, **numeric;
+	size_t i, misses = 0;
+	int translated = TRUE;
+
+	if ((path = np_snmp_state_path ("mib-cache")) == NULL)
+		return FALSE;
+	/* the directories and MIBs net-snmp would read, see snmp_config(5) */
+	mibdirs = DEFAULT_MIBDIRS;
+	if ((env = getenv ("MIBDIRS")) != NULL) {
+		if (env[0] == '+')
+			xasprintf (&dirs, "%s:%s", env + 1, mibdirs);
+		else
+			dirs = strdup (env);
+	}
+	env = getenv ("MIBS");
+	xasprintf (&mibs, "%s %s", miblist, env ? env : "");
+	cache = np_snmp_mib_cache_open (path, np_snmp_mib_cache_key (dirs ? dirs : mibdirs, mibs));
+
+	numeric = calloc (numoids, sizeof (*numeric));
+	oid_labels = calloc (numoids, sizeof (*oid_labels));
+	if (numeric == NULL || oid_labels == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	for (i = 0; i < numoids; i++) {
+		if (strspn (oids[i], "0123456789.") == strlen (oids[i]))
+			continue;
+		if (np_snmp_mib_cache_lookup (cache, oids[i], &entry)) {
+			if (verbose > 1)
+				printf ("MIB cache: %s is %s (%s)\n", oids[i], entry.oid,
+				        *entry.type ? entry.type : _("unknown type"));
+			numeric[i] = strdup (entry.oid);
+			oid_labels[i] = strdup (entry.label);
+		} else {
+			misses++;
+		}
+	}
+
+#ifdef PATH_TO_SNMPTRANSLATE
+	if (misses) {
+		size_t *missing, n = 0;
+
+		/* all names in one go, and if one of them does not translate the
+		 * lines no longer add up, so then each name alone */
+		missing = calloc (misses, sizeof (*missing));
+		for (i = 0; i < numoids; i++)
+			if (!numeric[i] && strspn (oids[i], "0123456789.") != strlen (oids[i]))
+				missing[n++] = i;
+		if (snmp_translate_names (cache, missing, n, numeric))
+			misses = 0;
+		else if (n > 1)
+			for (i = 0; i < n; i++)
+				misses -= snmp_translate_names (cache, missing + i, 1, numeric);
+		free (missing);
+		np_snmp_mib_cache_save (cache);
+	}
+#endif
+	np_snmp_mib_cache_close (cache);
+	free (path);
+	free (dirs);
+	free (mibs);
+
+	if (misses) {
+		translated = FALSE;
+		for (i = 0; i < numoids; i++)
+			free (numeric[i]);
+		free (oid_labels);
+		oid_labels = NULL;
+	} else {
+		for (i = 0; i < numoids; i++) {
+			if (numeric[i])
+				oids[i] = numeric[i];
+			else
+				oid_labels[i] = strdup (oids[i]);
+		}
+	}
+	free (numeric);
+	return translated;
+}
+
+/* --cache-ttl: the file of the responses of this agent to this community */
+static char *
+snmp_response_cache_file (void)
+{
+	const char *parts[4];
+	struct sha1_ctx ctx;
+	unsigned char digest[SHA1_DIGEST_SIZE];
+	char name[32];
+	size_t i;
+
+	parts[0] = server_address;
+	parts[1] = port;
+	parts[2] = proto;
+	parts[3] = community;
+	sha1_init_ctx (&ctx);
+	for (i = 0; i < sizeof (parts) / sizeof (*parts); i++)
+		sha1_process_bytes (parts[i] ? parts[i] : "", parts[i] ? strlen (parts[i]) + 1 : 1, &ctx);
+	sha1_finish_ctx (&ctx, digest);
+	strcpy (name, "responses-");
+	for (i = 0; i < 8; i++)
+		sprintf (name + strlen (name), "%02x", digest[i]);
+	return np_snmp_state_path (name);
+}
+
+/* Query the agent over UDP and leave its answer in out the way
+ * "snmpget -m ''" prints it, one "OID = TYPE: value" line per varbind */
+static void
+snmp_query_native (output *out, int command_interval)
+{
+	np_snmp_response_cache *cache = NULL;
+	np_snmp_pdu req, resp;
+	np_snmp_oid oid;
+	const char **cached;
+	char **keys, *file, *line;
+	size_t i, k, *map;
+	int sd;
+
+	cached = calloc (numoids, sizeof (*cached));
+	keys = calloc (numoids, sizeof (*keys));
+	map = calloc (numoids, sizeof (*map));
+	if (cached == NULL || keys == NULL || map == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	if (response_cache_ttl && (file = snmp_response_cache_file ()) != NULL) {
+		cache = np_snmp_response_cache_open (file, time (NULL), response_cache_ttl);
+		free (file);
+	}
+
+	/* only what the cache has no fresh value of goes in the request */
+	np_snmp_pdu_init (&req, strcmp (proto, "1") ? NP_SNMP_VERSION_2C : NP_SNMP_VERSION_1, community,
+	                  usesnmpgetnext ? NP_SNMP_GETNEXT : NP_SNMP_GET);
+	for (i = 0; i < numoids; i++) {
+		if (!np_snmp_parse_oid (oids[i], &oid))
+			die (STATE_UNKNOWN, _("Invalid OID: %s\n"), oids[i]);
+		if (cache) {
+			xasprintf (&keys[i], "%s %s", usesnmpgetnext ? "GETNEXT" : "GET", oids[i]);
+			if ((cached[i] = np_snmp_response_cache_get (cache, keys[i])) != NULL)
+				continue;
+		}
+		map[req.count] = i;
+		np_snmp_pdu_add (&req, &oid);
+	}
+
+	if (verbose && cache)
+		printf ("%lu of %d OIDs from the response cache\n", (unsigned long) (numoids - req.count), numoids);
+
+	memset (&resp, 0, sizeof (resp));
+	if (req.count) {
+		if (verbose)
+			printf ("SNMPv%s %s to %s:%s, %d tries of %d seconds\n", proto,
+			        usesnmpgetnext ? "GETNEXT" : "GET", server_address, port, retries + 1, command_interval);
+
+		sd = snmp_connect ();
+		snmp_exchange (sd, &req, &resp, command_interval);
+		close (sd);
+		if (resp.error_status)
+			snmp_packet_error (&resp, resp.error_index > 0 && (size_t) resp.error_index <= req.count ?
+			                   oids[map[resp.error_index - 1]] : NULL);
+	}
+
+	/* in the order of oids[], whichever way the values came */
+	out->buf = NULL;
+	out->buflen = 0;
+	for (i = 0, k = 0; i < numoids; i++) {
+		if (cached[i]) {
+			snmp_append_line (out, cached[i]);
+		} else if (k < resp.count) {
+			line = snmp_varbind_line (&resp.varbinds[k++]);
+			snmp_append_line (out, line);
+			if (cache)
+				np_snmp_response_cache_put (cache, keys[i], line);
+			free (line);
+		}
+		free (keys[i]);
+	}
+	/* anything more than was asked for, as before */
+	for (; k < resp.count; k++)
+		snmp_append_varbind (out, &resp.varbinds[k]);
+	if (req.count)
+		np_snmp_pdu_free (&resp);
+	np_snmp_pdu_free (&req);
+	if (cache) {
+		np_snmp_response_cache_save (cache);
+		np_snmp_response_cache_close (cache);
+	}
+	free (cached);
+	free (keys);
+	free (map);
+
+	if (out->buflen == 0)
+		die (STATE_UNKNOWN, _("No data was received from %s:%s\n"), server_address, port);
+	cmd_split_lines (out, 0);
+}
+
+/* sysUpTime.0 of the agent, for --table --rate; FALSE if it has none */
+static int
+snmp_uptime_native (int command_interval, uint64_t *uptime)
+{
+	np_snmp_pdu req, resp;
+	np_snmp_oid oid;
+	int sd, found;
+
+	np_snmp_pdu_init (&req, strcmp (proto, "1") ? NP_SNMP_VERSION_2C : NP_SNMP_VERSION_1, community, NP_SNMP_GET);
+	np_snmp_parse_oid (SNMP_UPTIME_OID, &oid);
+	np_snmp_pdu_add (&req, &oid);
+	sd = snmp_connect ();
+	snmp_exchange (sd, &req, &resp, command_interval);
+	close (sd);
+	found = resp.error_status == 0 && resp.count == 1 && resp.varbinds[0].type == NP_SNMP_TIMETICKS;
+	if (found)
+		*uptime = resp.varbinds[0].counter;
+	np_snmp_pdu_free (&resp);
+	np_snmp_pdu_free (&req);
+	return found;
+}
+
+/* one column of --table, the subtree under one -o OID */
+struct table_column {
+	np_snmp_oid root;
+	np_snmp_oid last;         /* where the walk goes on from */
+	int done;
+	size_t rows;
+	output lines;             /* the rows, as snmp_append_varbind() writes them */
+	char **index;             /* the OID of each row after root */
+};
+
+/* what snmp_walk_columns() does with each row of column c */
+typedef void (*table_row_fn) (struct table_column *, size_t, const np_snmp_varbind *);
+
+static void
+table_add_row (struct table_column *col, size_t c, const np_snmp_varbind *vb)
+{
+	char buf[NP_SNMP_MAX_OID * 11];
+	np_snmp_oid suffix;
+
+	(void) c;
+	suffix.len = vb->oid.len - col->root.len;
+	memcpy (suffix.id, vb->oid.id + col->root.len, suffix.len * sizeof (*suffix.id));
+	if ((col->index = realloc (col->index, (col->rows + 1) * sizeof (*col->index))) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	/* a one-part index is formatted on its own, not as the start of an OID */
+	if (suffix.len == 1)
+		snprintf (buf, sizeof (buf), "%lu", (unsigned long) suffix.id[0]);
+	else
+		np_snmp_oid_string (&suffix, FALSE, buf, sizeof (buf));
+	col->index[col->rows++] = strdup (buf);
+	snmp_append_varbind (&col->lines, vb);
+}
+
+/* Walk the subtrees of the columns together, with GETBULK (GETNEXT for
+ * SNMPv1), as many columns in each request as are not done yet, and
+ * hand every row to add_row. */
+static void
+snmp_walk_columns (struct table_column *cols, size_t ncols, table_row_fn add_row, int command_interval)
+{
+	np_snmp_pdu req, resp;
+	np_snmp_varbind *vb;
+	char buf[NP_SNMP_MAX_OID * 11];
+	size_t *map, c, k, n;
+	int sd, version, reps = max_repetitions;
+
+	version = strcmp (proto, "1") ? NP_SNMP_VERSION_2C : NP_SNMP_VERSION_1;
+	if ((map = calloc (ncols, sizeof (*map))) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	for (c = 0; c < ncols; c++)
+		cols[c].last = cols[c].root;
+
+	if (verbose)
+		printf ("SNMPv%s walk of %lu columns on %s:%s with %s\n", proto, (unsigned long) ncols,
+		        server_address, port, version == NP_SNMP_VERSION_1 ? "GETNEXT" : "GETBULK");
+
+	sd = snmp_connect ();
+	for (;;) {
+		np_snmp_pdu_init (&req, version, community,
+		                  version == NP_SNMP_VERSION_1 ? NP_SNMP_GETNEXT : NP_SNMP_GETBULK);
+		if (req.type == NP_SNMP_GETBULK)
+			req.error_index = reps;          /* max-repetitions, no non-repeaters */
+		for (n = 0, c = 0; c < ncols; c++) {
+			if (!cols[c].done) {
+				np_snmp_pdu_add (&req, &cols[c].last);
+				map[n++] = c;
 			}
+		}
+		if (n == 0) {
+			np_snmp_pdu_free (&req);
+			break;
+		}
 
-			/* remove trailing semi-colons for guideline adherence */
-			len = strlen(perfstr) - 1;
-			if (perfstr[len] == ';') {
-				perfstr[len] = '\0';
+		snmp_exchange (sd, &req, &resp, command_interval);
+		if (verbose > 1)
+			printf ("%lu varbinds for %lu columns\n", (unsigned long) resp.count, (unsigned long) n);
+		if (resp.error_status == 1 && req.type == NP_SNMP_GETBULK && reps > 1) {
+			/* tooBig, ask for fewer rows at a time */
+			reps /= 2;
+		} else if (resp.error_status == 2 && version == NP_SNMP_VERSION_1 &&
+		           resp.error_index > 0 && (size_t) resp.error_index <= n) {
+			/* noSuchName is how SNMPv1 says the end of the MIB is reached */
+			cols[map[resp.error_index - 1]].done = 1;
+		} else if (resp.error_status) {
+			snmp_packet_error (&resp, resp.error_index > 0 && (size_t) resp.error_index <= n ?
+			                   np_snmp_oid_string (&cols[map[resp.error_index - 1]].root, FALSE, buf, sizeof (buf)) : NULL);
+		} else if (resp.count == 0) {
+			for (k = 0; k < n; k++)
+				cols[map[k]].done = 1;
+		}
+
+		/* the rows come interleaved, one varbind per column in turn */
+		for (k = 0; !resp.error_status && k < resp.count; k++) {
+			c = map[k % n];
+			vb = &resp.varbinds[k];
+			if (cols[c].done)
+				continue;
+			if (vb->type == NP_SNMP_END_OF_MIB_VIEW || !np_snmp_oid_in_subtree (&vb->oid, &cols[c].root)) {
+				cols[c].done = 1;
+				continue;
 			}
+			if (np_snmp_oid_compare (&vb->oid, &cols[c].last) <= 0)
+				die (STATE_UNKNOWN, _("OID not increasing: %s\n"),
+				     np_snmp_oid_string (&vb->oid, TRUE, buf, sizeof (buf)));
+			add_row (&cols[c], c, vb);
+			cols[c].last = vb->oid;
+		}
+		np_snmp_pdu_free (&resp);
+		np_snmp_pdu_free (&req);
+	}
+	close (sd);
+	free (map);
+}
 
-			/* we do not add any min/max value */
+/* Walk the subtrees under oids[] and leave their rows in out like
+ * snmp_query_native() does, column by column. Every row then takes the
+ * place of its column in oids[], thlds[], labels[], unitv[] and
+ * eval_method[], labelled with the column's label (or OID) and the row
+ * index. */
+static void
+snmp_walk_native (output *out, int command_interval)
+{
+	struct table_column *cols;
+	char **row_oids, **row_labels, **row_units, *name;
+	char buf[NP_SNMP_MAX_OID * 11];
+	thresholds **row_thlds;
+	int *row_eval;
+	size_t c, k, r, total;
+
+	if ((cols = calloc (numoids, sizeof (*cols))) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	for (c = 0; c < numoids; c++)
+		if (!np_snmp_parse_oid (oids[c], &cols[c].root))
+			die (STATE_UNKNOWN, _("Invalid OID: %s\n"), oids[c]);
+	snmp_walk_columns (cols, numoids, table_add_row, command_interval);
+
+	for (total = 0, c = 0; c < numoids; c++)
+		total += cols[c].rows;
+	if (total == 0)
+		die (STATE_UNKNOWN, _("No table rows found under %s\n"), oids[0]);
+
+	row_oids = calloc (total, sizeof (*row_oids));
+	row_labels = calloc (total, sizeof (*row_labels));
+	row_units = calloc (total, sizeof (*row_units));
+	row_thlds = calloc (total, sizeof (*row_thlds));
+	row_eval = calloc (total, sizeof (*row_eval));
+	if (!row_oids || !row_labels || !row_units || !row_thlds || !row_eval)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+
+	out->buf = NULL;
+	out->buflen = 0;
+	for (r = 0, c = 0; c < numoids; c++) {
+		cmd_split_lines (&cols[c].lines, CMD_NO_ASSOC);
+		name = c < nlabels && labels[c] ? labels[c] : np_snmp_oid_string (&cols[c].root, FALSE, buf, sizeof (buf));
+		for (k = 0; k < cols[c].rows; k++, r++) {
+			row_oids[r] = strndup (cols[c].lines.line[k], strcspn (cols[c].lines.line[k], " "));
+			xasprintf (&row_labels[r], "%s.%s", name, cols[c].index[k]);
+			row_units[r] = c < nunits ? unitv[c] : NULL;
+			row_thlds[r] = thlds[c];
+			row_eval[r] = c < eval_size ? eval_method[c] : 0;
+		}
+		if (cols[c].lines.buflen) {
+			if ((out->buf = realloc (out->buf, out->buflen + cols[c].lines.buflen + 1)) == NULL)
+				die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+			memcpy (out->buf + out->buflen, cols[c].lines.buf, cols[c].lines.buflen);
+			out->buflen += cols[c].lines.buflen;
+		}
+	}
+	out->buf[out->buflen] = '\0';
+	cmd_split_lines (out, 0);
+
+	oids = row_oids;
+	labels = row_labels;
+	unitv = row_units;
+	thlds = row_thlds;
+	eval_method = row_eval;
+	numoids = oids_size = thlds_size = total;
+	nlabels = labels_size = nunits = unitv_size = eval_size = total;
+}
+
+/*
+ * --ifstatus: the operational status of every interface that is
+ * administratively up, the way check_ifstatus counts them. The IF-MIB
+ * columns are walked together, so a GETBULK brings a slice of every
+ * column at once.
+ */
+
+#define IF_DESCR 0
+#define IF_TYPE 1
+#define IF_ADMIN 2
+#define IF_OPER 3
+#define IF_NAME 4          /* ifXTable, with --ifmib */
+#define IF_ALIAS 5
+
+static const char *if_columns[] = {
+	"1.3.6.1.2.1.2.2.1.2",
+	"1.3.6.1.2.1.2.2.1.3",
+	"1.3.6.1.2.1.2.2.1.7",
+	"1.3.6.1.2.1.2.2.1.8",
+	"1.3.6.1.2.1.31.1.1.1.1",
+	"1.3.6.1.2.1.31.1.1.1.18"
+};
+
+struct snmp_interface {
+	unsigned long index;
+	long type;
+	long admin;
+	long oper;
+	char *text[IF_ALIAS + 1];  /* ifDescr, ifName and ifAlias, by column */
+};
+
+static struct snmp_interface *interfaces = NULL;
+static size_t ninterfaces = 0;
+
+/* the interface of that ifIndex, added in order if it is new */
+static struct snmp_interface *
+snmp_interface (unsigned long index)
+{
+	size_t lo = 0, hi = ninterfaces, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (interfaces[mid].index == index)
+			return &interfaces[mid];
+		if (interfaces[mid].index < index)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if ((interfaces = realloc (interfaces, (ninterfaces + 1) * sizeof (*interfaces))) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	memmove (&interfaces[lo + 1], &interfaces[lo], (ninterfaces - lo) * sizeof (*interfaces));
+	ninterfaces++;
+	memset (&interfaces[lo], 0, sizeof (*interfaces));
+	interfaces[lo].index = index;
+	interfaces[lo].admin = interfaces[lo].oper = -1;
+	return &interfaces[lo];
+}
+
+static void
+ifstatus_add_row (struct table_column *col, size_t c, const np_snmp_varbind *vb)
+{
+	struct snmp_interface *ifp;
+
+	/* the IF-MIB tables are indexed by ifIndex alone */
+	if (vb->oid.len != col->root.len + 1)
+		return;
+	ifp = snmp_interface (vb->oid.id[col->root.len]);
+	if (c == IF_DESCR || c == IF_NAME || c == IF_ALIAS) {
+		if (vb->type == NP_SNMP_OCTET_STRING && ifp->text[c] == NULL)
+			ifp->text[c] = strndup ((const char *) vb->data, vb->length);
+	} else if (vb->type == NP_SNMP_INTEGER) {
+		if (c == IF_TYPE)
+			ifp->type = (long) vb->integer;
+		else if (c == IF_ADMIN)
+			ifp->admin = (long) vb->integer;
+		else
+			ifp->oper = (long) vb->integer;
+	}
+}
 
-			strncat(perfstr, " ", sizeof(perfstr) - strlen(perfstr) - 1);
+/* TRUE if item is one of the comma separated list */
+static int
+in_list (const char *list, const char *item)
+{
+	size_t len = strlen (item);
+
+	while (list && *list) {
+		if (strncmp (list, item, len) == 0 && (list[len] == ',' || list[len] == '\0'))
+			return TRUE;
+		if ((list = strchr (list, ',')) != NULL)
+			list++;
+	}
+	return FALSE;
+}
+
+static void
+snmp_ifstatus (int command_interval)
+{
+	struct table_column cols[IF_ALIAS + 1];
+	struct snmp_interface *ifp;
+	np_perfdata down;
+	char index[32];
+	const char *descr;
+	size_t c, i, ncols = ifmib ? IF_ALIAS + 1 : IF_OPER + 1;
+	int up = 0, ndown = 0, dormant = 0, excluded = 0, unused = 0;
+
+	memset (cols, 0, sizeof (cols));
+	for (c = 0; c < ncols; c++)
+		np_snmp_parse_oid (if_columns[c], &cols[c].root);
+	snmp_walk_columns (cols, ncols, ifstatus_add_row, command_interval);
+	alarm (0);
+
+	np_perfdata_init (&down);
+	for (i = 0; i < ninterfaces; i++) {
+		ifp = &interfaces[i];
+		if (ifp->oper < 0)
+			continue;          /* not a row of ifTable */
+		snprintf (index, sizeof (index), "%lu", ifp->index);
+		descr = ifp->text[IF_DESCR] ? ifp->text[IF_DESCR] : "";
+		if ((if_ports && !in_list (if_ports, index)) || (if_names && !in_list (if_names, descr)))
+			continue;
+		if (in_list (if_unused_ports, index)) {
+			unused++;
+			continue;
 		}
+		/* only what is administratively up is checked */
+		if (ifp->admin != 1)
+			continue;
+		if (in_list (if_unused_names, descr)) {
+			unused++;
+			continue;
+		}
+		snprintf (index, sizeof (index), "%ld", ifp->type);
+		if (in_list (if_exclude_types, index)) {
+			excluded++;
+			continue;
+		}
+		if (ifp->oper == 1) {
+			up++;
+		} else if (ifp->oper == 2) {
+			ndown++;
+			buf_puts (&down, "\n");
+			if (ifmib) {
+				buf_puts (&down, ifp->text[IF_NAME] ? ifp->text[IF_NAME] : descr);
+				buf_puts (&down, ": down -> ");
+				buf_puts (&down, ifp->text[IF_ALIAS] ? ifp->text[IF_ALIAS] : "");
+			} else {
+				buf_puts (&down, descr);
+				buf_puts (&down, ": down");
+			}
+		} else if (ifp->oper == 5) {
+			dormant++;
+		}
+	}
 
-	} /* for (line=0, i=0; line < chld_out.lines; line++, i++) */
-	
-	total_oids=i;
+	if (up + ndown + dormant + excluded + unused == 0)
+		die (STATE_UNKNOWN, _("No interfaces found on %s\n"), server_address);
+	printf ("%s: host '%s', interfaces up: %d, down: %d, dormant: %d, excluded: %d, unused: %d"
+	        " | up=%d down=%d dormant=%d excluded=%d unused=%d%s\n",
+	        ndown ? _("CRITICAL") : _("OK"), server_address, up, ndown, dormant, excluded, unused,
+	        up, ndown, dormant, excluded, unused, np_perfdata_string (&down));
+	exit (ndown ? STATE_CRITICAL : STATE_OK);
+}
 
-	/* Save state data, as all data collected now */
-	if(calculate_rate) {
-		string_length=1024;
-		state_string=malloc(string_length);
-		if(state_string==NULL)
-			die(STATE_UNKNOWN, _("Cannot malloc"));
-
-		current_length=0;
-		for(i=0; i<total_oids; i++) {
-			xasprintf(&temp_string,"%.0f",response_value[i]);
-			if(temp_string==NULL)
-				die(STATE_UNKNOWN,_("Cannot asprintf()"));
-			response_length = strlen(temp_string);
-			if(current_length+response_length>string_length) {
-				string_length=current_length+1024;
-				state_string=realloc(state_string,string_length);
-				if(state_string==NULL)
-					die(STATE_UNKNOWN, _("Cannot realloc()"));
+/*
+ * --hosts: the same GET (or GETNEXT) sent to many agents at the same
+ * time by np_snmp_query_targets(), at most --concurrency of them waited
+ * for at once. Each is judged on its own against the thresholds.
+ */
+
+struct snmp_agent {
+	char *address;
+	int state;
+	char *msg;                /* "address: values", or what went wrong */
+	np_perfdata perf;
+};
+
+static void
+snmp_agent_finish (struct snmp_agent *a, int state, const char *fmt, ...)
+{
+	va_list ap;
+	char *text;
+
+	va_start (ap, fmt);
+	if (vasprintf (&text, fmt, ap) < 0)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	va_end (ap);
+	xasprintf (&a->msg, "%s: %s", a->address, text);
+	free (text);
+	a->state = state;
+}
+
+/* the tests main() makes of snmpget's output, for one agent's response */
+static void
+snmp_agent_evaluate (struct snmp_agent *a, const np_snmp_pdu *resp)
+{
+	char oidstr[NP_SNMP_MAX_OID * 11];
+	char *text, *show, *values = NULL, *perflabel;
+	const char *quote;
+	const np_snmp_varbind *vb;
+	int state = STATE_OK, iresult, numeric;
+	double value = 0;
+	size_t i;
+
+	if (resp->error_status) {
+		snmp_agent_finish (a, STATE_UNKNOWN, "%s %s", np_snmp_error_string (resp->error_status),
+		                   resp->error_index > 0 && resp->error_index <= numoids ? oids[resp->error_index - 1] : "");
+		return;
+	}
+
+	for (i = 0; i < resp->count && i < numoids; i++) {
+		vb = &resp->varbinds[i];
+		text = np_snmp_format_value (vb);
+		show = strstr (text, ": ") ? strstr (text, ": ") + 2 : text;
+		numeric = TRUE;
+		switch (vb->type) {
+		case NP_SNMP_INTEGER:
+			value = (double) vb->integer + offset;
+			break;
+		case NP_SNMP_COUNTER32:
+		case NP_SNMP_GAUGE32:
+		case NP_SNMP_TIMETICKS:
+		case NP_SNMP_COUNTER64:
+			value = (double) vb->counter + offset;
+			break;
+		default:
+			numeric = FALSE;
+		}
+
+		iresult = STATE_OK;
+		if (thlds[i]->warning || thlds[i]->critical || offset != 0.0) {
+			if (!numeric) {
+				snmp_agent_finish (a, STATE_UNKNOWN, _("No valid data returned (%s)"), show);
+				free (text);
+				free (values);
+				return;
 			}
-			strcpy(&state_string[current_length],temp_string);
-			current_length=current_length+response_length;
-			state_string[current_length]=':';
-			current_length++;
-			free(temp_string);
+			iresult = get_status (value, thlds[i]);
+		} else if (eval_size > i && eval_method[i] & CRIT_STRING) {
+			/* main() compares the text without its quotes */
+			if (vb->type == NP_SNMP_OCTET_STRING ?
+			    vb->length != strlen (string_value) || memcmp (vb->data, string_value, vb->length) :
+			    strcmp (show, string_value) != 0)
+				iresult = invert_search ? STATE_OK : STATE_CRITICAL;
+			else
+				iresult = invert_search ? STATE_CRITICAL : STATE_OK;
+		} else if (eval_size > i && eval_method[i] & CRIT_REGEX) {
+			if (np_regexec (&preg, text, 10, pmatch, eflags) == 0)
+				iresult = invert_search ? STATE_CRITICAL : STATE_OK;
+			else
+				iresult = invert_search ? STATE_OK : STATE_CRITICAL;
+		} else if (eval_size > i && eval_method[i] & CRIT_PRESENT) {
+			iresult = STATE_CRITICAL;
+		} else if (eval_size > i && eval_method[i] & WARN_PRESENT) {
+			iresult = STATE_WARNING;
 		}
-		state_string[--current_length]='\0';
-		if (verbose > 2)
-			printf("State string=%s\n",state_string);
+		state = max_state (state, iresult);
+
+		if (numeric && vb->type != NP_SNMP_TIMETICKS)
+			xasprintf (&show, "%.0f", value);
+		xasprintf (&values, "%s%s%s%s%s%s%s%s%s", values ? values : "", values ? output_delim : "",
+		           i < nlabels && labels[i] ? labels[i] : "", i < nlabels && labels[i] ? " " : "",
+		           mark (iresult), show, mark (iresult),
+		           i < nunits && unitv[i] ? " " : "", i < nunits && unitv[i] ? unitv[i] : "");
+
+		/* written the way main() writes it, without the trailing semicolons */
+		if (numeric) {
+			perflabel = perf_labels && i < nlabels && labels[i] ? labels[i] :
+			            np_snmp_oid_string (&vb->oid, TRUE, oidstr, sizeof (oidstr));
+			quote = strpbrk (a->address, " ='\"") || strpbrk (perflabel, " ='\"") ? "'" : "";
+			xasprintf (&show, "%s%s%s_%s%s=%.0f%s%s", a->perf.len ? " " : "", quote, a->address, perflabel, quote, value,
+			           i < nunits && unitv[i] ? unitv[i] : "",
+			           vb->type == NP_SNMP_COUNTER32 || vb->type == NP_SNMP_COUNTER64 ? "c" : "");
+			np_perfdata_append (&a->perf, show, strlen (show));
+			if (thlds[i]->warning || thlds[i]->critical) {
+				xasprintf (&show, ";%s;%s", thlds[i]->warning_string ? thlds[i]->warning_string : "",
+				           thlds[i]->critical_string ? thlds[i]->critical_string : "");
+				np_perfdata_append (&a->perf, show, strlen (show) - (show[strlen (show) - 1] == ';'));
+			}
+		}
+		free (text);
+	}
+	snmp_agent_finish (a, state, "%s", values ? values : _("No data was received"));
+	free (values);
+}
 
-		/* This is not strictly the same as time now, but any subtle variations will cancel out */
-		np_state_write_string(current_time, state_string );
-		if(previous_state==NULL) {
-			/* Or should this be highest state? */
-			die( STATE_OK, _("No previous data to calculate rate - assume okay" ) );
+static void
+snmp_poll_agents (int command_interval)
+{
+	struct snmp_agent *agents;
+	np_snmp_target *targets;
+	np_snmp_pdu req;
+	np_snmp_oid oid;
+	np_perfdata perf;
+	char *problems = NULL;
+	int i, count_ok = 0, result = STATE_OK;
+
+	np_snmp_pdu_init (&req, strcmp (proto, "1") ? NP_SNMP_VERSION_2C : NP_SNMP_VERSION_1, community,
+	                  usesnmpgetnext ? NP_SNMP_GETNEXT : NP_SNMP_GET);
+	for (i = 0; i < numoids; i++) {
+		if (!np_snmp_parse_oid (oids[i], &oid))
+			die (STATE_UNKNOWN, _("Invalid OID: %s\n"), oids[i]);
+		np_snmp_pdu_add (&req, &oid);
+	}
+
+	agents = calloc (target_count, sizeof (*agents));
+	targets = calloc (target_count, sizeof (*targets));
+	if (agents == NULL || targets == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	for (i = 0; i < target_count; i++)
+		targets[i].host = agents[i].address = target_hosts[i];
+
+	if (verbose)
+		printf ("SNMPv%s %s to %d agents, %d at a time, %d tries of %d seconds\n", proto,
+		        usesnmpgetnext ? "GETNEXT" : "GET", target_count, concurrency, retries + 1, command_interval);
+
+	if (!np_snmp_query_targets (targets, target_count, port, address_family, &req, concurrency,
+	                            command_interval * 1000, retries))
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	np_snmp_pdu_free (&req);
+
+	np_perfdata_init (&perf);
+	for (i = 0; i < target_count; i++) {
+		np_perfdata_init (&agents[i].perf);
+		if (targets[i].status == NP_SNMP_OK)
+			snmp_agent_evaluate (&agents[i], &targets[i].response);
+		else if (targets[i].status == NP_SNMP_TIMEOUT)
+			snmp_agent_finish (&agents[i], timeout_state, _("Timeout: No Response from %s:%s"),
+			                   agents[i].address, port);
+		else
+			snmp_agent_finish (&agents[i], STATE_UNKNOWN, "%s", targets[i].error);
+
+		result = max_state_alt (agents[i].state, result);
+		if (agents[i].state == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s", problems ? problems : "", problems ? "; " : "", agents[i].msg);
+		if (agents[i].perf.len) {
+			if (perf.len)
+				np_perfdata_append (&perf, " ", 1);
+			np_perfdata_append (&perf, agents[i].perf.buf, agents[i].perf.len);
 		}
 	}
+	np_snmp_targets_free (targets, target_count);
+
+	printf ("%s %s: %d of %d agents OK%s%s|%s\n", label, state_text (result), count_ok, target_count,
+	        problems ? " - " : "", problems ? problems : "", perf.len ? np_perfdata_string (&perf) : "");
+	for (i = 0; i < target_count; i++)
+		printf ("[%s] %s\n", state_text (agents[i].state), agents[i].msg);
+	exit (result);
+}
+
+/* Run snmpget (or snmpgetnext) and leave its output in out */
+#ifdef PATH_TO_SNMPGET
+/* --engine-cache-ttl: the file of this agent with these credentials, and
+ * the snmpget arguments to go back to if what it says no longer works */
+static char *engine_cache_file = NULL;
+static int engine_cached = FALSE;
+static char **engine_authpriv;
+static int engine_numauthpriv;
+
+static char *
+snmp_hex (const unsigned char *data, size_t len)
+{
+	char *hex;
+	size_t i;
+
+	if ((hex = malloc (len * 2 + 1)) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	for (i = 0; i < len; i++)
+		sprintf (hex + i * 2, "%02x", data[i]);
+	hex[len * 2] = '\0';
+	return hex;
+}
+
+static int
+snmp_unhex (const char *hex, unsigned char *data, size_t size, size_t *len)
+{
+	unsigned int c;
+
+	for (*len = 0; hex[0] && hex[1] && *len < size; hex += 2) {
+		if (!isxdigit ((unsigned char) hex[0]) || !isxdigit ((unsigned char) hex[1]) ||
+		    sscanf (hex, "%2x", &c) != 1)
+			return FALSE;
+		data[(*len)++] = c;
+	}
+	return *hex == '\0';
+}
+
+/* keyed on everything the cached values depend on, passwords included */
+static char *
+snmp_engine_file (void)
+{
+	const char *parts[8];
+	struct sha1_ctx ctx;
+	unsigned char digest[SHA1_DIGEST_SIZE];
+	char *name, *path;
+	size_t i;
+
+	parts[0] = server_address;
+	parts[1] = port;
+	parts[2] = secname;
+	parts[3] = seclevel;
+	parts[4] = authproto;
+	parts[5] = authpasswd;
+	parts[6] = privproto;
+	parts[7] = privpasswd;
+	sha1_init_ctx (&ctx);
+	for (i = 0; i < sizeof (parts) / sizeof (*parts); i++)
+		sha1_process_bytes (parts[i] ? parts[i] : "", parts[i] ? strlen (parts[i]) + 1 : 1, &ctx);
+	sha1_finish_ctx (&ctx, digest);
+	name = snmp_hex (digest, 8);
+	xasprintf (&path, "engine-%s", name);
+	free (name);
+	name = np_snmp_state_path (path);
+	free (path);
+	return name;
+}
+
+/* Give snmpget the engine of the agent (-e, -Z) and the localized keys
+ * (-3k, -3K) instead of the passwords, from the cache or, if it has
+ * nothing fresh, from an engine discovery of our own. TRUE if authpriv[]
+ * has been changed. */
+static int
+snmp_engine_setup (int command_interval)
+{
+	np_snmp_engine engine;
+	unsigned char auth_key[NP_SNMP_MAX_KEY], priv_key[NP_SNMP_MAX_KEY];
+	size_t auth_len = 0, priv_len = 0;
+	char line[512], id[NP_SNMP_MAX_ENGINE_ID * 2 + 1], akey[NP_SNMP_MAX_KEY * 2 + 1], pkey[NP_SNMP_MAX_KEY * 2 + 1];
+	char *tmp, **args;
+	long saved = 0;
+	time_t now = time (NULL);
+	int fresh = FALSE, sd, fd, i, n;
+	FILE *fp;
+
+	if (engine_cache_ttl == 0 || (engine_cache_file = snmp_engine_file ()) == NULL)
+		return FALSE;
+
+	/* "engine-id boots time saved auth-key priv-key", a key "-" if none */
+	if ((fp = fopen (engine_cache_file, "r")) != NULL) {
+		if (fgets (line, sizeof (line), fp) &&
+		    sscanf (line, "%64s %ld %ld %ld %128s %128s", id, &engine.boots, &engine.time, &saved, akey, pkey) == 6 &&
+		    snmp_unhex (id, engine.id, sizeof (engine.id), &engine.id_len) && engine.id_len &&
+		    (!strcmp (akey, "-") || snmp_unhex (akey, auth_key, sizeof (auth_key), &auth_len)) &&
+		    (!strcmp (pkey, "-") || snmp_unhex (pkey, priv_key, sizeof (priv_key), &priv_len)))
+			fresh = saved <= now && now - saved < engine_cache_ttl;
+		fclose (fp);
+	}
+
+	if (!fresh) {
+		if (my_udp_connect (server_address, atoi (port), &sd) != STATE_OK)
+			return FALSE;
+		n = np_snmp_discover_engine (sd, &engine, command_interval * 1000, retries);
+		close (sd);
+		if (n != NP_SNMP_OK)
+			return FALSE;
+		saved = now;
+		auth_len = priv_len = 0;
+		if (strcmp (seclevel, "noAuthNoPriv") &&
+		    !np_snmp_localize_key (authproto, authpasswd, engine.id, engine.id_len, auth_key, &auth_len))
+			auth_len = 0;
+		/* the longer AES keys need an extension net-snmp does itself */
+		if (auth_len && !strcmp (seclevel, "authPriv") &&
+		    (!strcasecmp (privproto, "DES") || !strcasecmp (privproto, "AES") || !strcasecmp (privproto, "AES128")) &&
+		    !np_snmp_localize_key (authproto, privpasswd, engine.id, engine.id_len, priv_key, &priv_len))
+			priv_len = 0;
+
+		tmp = snmp_hex (engine.id, engine.id_len);
+		snprintf (line, sizeof (line), "%s %ld %ld %ld ", tmp, engine.boots, engine.time, saved);
+		free (tmp);
+		tmp = auth_len ? snmp_hex (auth_key, auth_len) : strdup ("-");
+		strncat (line, tmp, sizeof (line) - strlen (line) - 1);
+		free (tmp);
+		strncat (line, " ", sizeof (line) - strlen (line) - 1);
+		tmp = priv_len ? snmp_hex (priv_key, priv_len) : strdup ("-");
+		strncat (line, tmp, sizeof (line) - strlen (line) - 1);
+		free (tmp);
+		strncat (line, "\n", sizeof (line) - strlen (line) - 1);
+
+		xasprintf (&tmp, "%s.XXXXXX", engine_cache_file);
+		if ((fd = mkstemp (tmp)) >= 0) {
+			if (write (fd, line, strlen (line)) != (ssize_t) strlen (line) || close (fd) != 0 ||
+			    rename (tmp, engine_cache_file) != 0)
+				unlink (tmp);
+		}
+		free (tmp);
+	}
+	if (verbose)
+		printf ("SNMPv3 engine of %s: boots %ld, time %ld, %s\n", server_address, engine.boots,
+		        engine.time + (long) (now - saved), fresh ? _("cached") : _("discovered"));
+
+	/* the same arguments with the keys in place of the passwords */
+	engine_authpriv = authpriv;
+	engine_numauthpriv = numauthpriv;
+	args = calloc (numauthpriv + 4, sizeof (*args));
+	args[0] = "-e";
+	tmp = snmp_hex (engine.id, engine.id_len);
+	xasprintf (&args[1], "0x%s", tmp);
+	free (tmp);
+	args[2] = "-Z";
+	xasprintf (&args[3], "%ld,%ld", engine.boots, engine.time + (long) (now - saved));
+	for (i = 0, n = 4; i < numauthpriv; i++, n++) {
+		if (i + 1 < numauthpriv && !strcmp (authpriv[i], "-A") && auth_len) {
+			args[n++] = "-3k";
+			args[n] = snmp_hex (auth_key, auth_len);
+			i++;
+		} else if (i + 1 < numauthpriv && !strcmp (authpriv[i], "-X") && priv_len) {
+			args[n++] = "-3K";
+			args[n] = snmp_hex (priv_key, priv_len);
+			i++;
+		} else {
+			args[n] = authpriv[i];
+		}
+	}
+	authpriv = args;
+	numauthpriv = n;
+	return TRUE;
+}
+#endif
+
+static void
+snmp_query_command (output *out, int command_interval)
+{
+#ifdef PATH_TO_SNMPGET
+	static int engine_tried = FALSE;
+	char **command_line = NULL;
+	char *cl_hidden_auth = NULL;
+	output chld_err;
+	int return_code = 0;
+	int external_error = 0;
+	int i;
+
+	if (!engine_tried && !strcmp (proto, "3")) {
+		engine_tried = TRUE;
+		engine_cached = snmp_engine_setup (command_interval);
+	}
+
+	/* Create the command array to execute */
+	if(usesnmpgetnext == TRUE) {
+		snmpcmd = strdup (PATH_TO_SNMPGETNEXT);
+	}else{
+		snmpcmd = strdup (PATH_TO_SNMPGET);
+	}
+
+	/* 10 arguments to pass before context and authpriv options + 1 for host and numoids. Add one for terminating NULL */
+	command_line = calloc (10 + numcontext + numauthpriv + 1 + numoids + 1, sizeof (char *));
+	command_line[0] = snmpcmd;
+	command_line[1] = strdup ("-Le");
+	command_line[2] = strdup ("-t");
+	xasprintf (&command_line[3], "%d", command_interval);
+	command_line[4] = strdup ("-r");
+	xasprintf (&command_line[5], "%d", retries);
+	command_line[6] = strdup ("-m");
+	command_line[7] = strdup (miblist);
+	command_line[8] = "-v";
+	command_line[9] = strdup (proto);
+
+	for (i = 0; i < numcontext; i++) {
+		command_line[10 + i] = contextargs[i];
+	}
 	
-	printf ("%s %s -%s %s\n", label, state_text (result), outbuff, perfstr);
-	if (mult_resp) printf ("%s", mult_resp);
+	for (i = 0; i < numauthpriv; i++) {
+		command_line[10 + numcontext + i] = authpriv[i];
+	}
 
-	return result;
+	xasprintf (&command_line[10 + numcontext + numauthpriv], "%s:%s", server_address, port);
+
+	/* This is just for display purposes, so it can remain a string */
+	xasprintf(&cl_hidden_auth, "%s -Le -t %d -r %d -m %s -v %s %s %s %s:%s",
+		snmpcmd, command_interval, retries, strlen(miblist) ? miblist : "''", proto, "[context]", "[authpriv]",
+		server_address, port);
+
+	for (i = 0; i < numoids; i++) {
+		command_line[10 + numcontext + numauthpriv + 1 + i] = oids[i];
+		xasprintf(&cl_hidden_auth, "%s %s", cl_hidden_auth, oids[i]);	
+	}
+
+	command_line[10 + numcontext + numauthpriv + 1 + numoids] = NULL;
+
+	if (verbose)
+		printf ("%s\n", cl_hidden_auth);
+
+	/* Run the command */
+	return_code = cmd_run_array (command_line, out, &chld_err, 0);
+
+	/* the agent has been reset or its keys changed since it was cached:
+	 * forget it, and let snmpget find it the usual way */
+	if ((return_code != 0 || out->lines == 0) && engine_cached) {
+		if (verbose)
+			printf (_("The cached engine of %s did not work, trying without it\n"), server_address);
+		unlink (engine_cache_file);
+		authpriv = engine_authpriv;
+		numauthpriv = engine_numauthpriv;
+		engine_cached = FALSE;
+		snmp_query_command (out, command_interval);
+		return;
+	}
+
+	/* Due to net-snmp sometimes showing stderr messages with poorly formed MIBs,
+	   only return state unknown if return code is non zero or there is no stdout.
+	   Do this way so that if there is stderr, will get added to output, which helps problem diagnosis
+	*/
+	if (return_code != 0)
+		external_error=1;
+	if (out->lines == 0)
+		external_error=1;
+	if (external_error) {
+		if ((chld_err.lines > 0) && strstr(chld_err.line[0], "Timeout")) {
+			printf (_("%s - External command error: %s\n"), state_text(timeout_state), chld_err.line[0]);
+			for (i = 1; i < chld_err.lines; i++) {
+				printf ("%s\n", chld_err.line[i]);
+			}
+			exit (timeout_state);
+		} else if (chld_err.lines > 0) {
+			printf (_("External command error: %s\n"), chld_err.line[0]);
+			for (i = 1; i < chld_err.lines; i++) {
+				printf ("%s\n", chld_err.line[i]);
+			}
+			exit (STATE_UNKNOWN);
+		} else {
+			printf(_("External command error with no output (return code: %d)\n"), return_code);
+			exit (STATE_UNKNOWN);
+		}
+	}
+#endif
 }
 
 
@@ -764,6 +1961,20 @@ process_arguments (int argc, char **argv)
 		{"authpasswd", required_argument, 0, 'A'},
 		{"privpasswd", required_argument, 0, 'X'},
 		{"next", no_argument, 0, 'n'},
+		{"use-snmpget", no_argument, 0, L_USE_SNMPGET},
+		{"table", no_argument, 0, L_TABLE},
+		{"max-repetitions", required_argument, 0, L_MAX_REPETITIONS},
+		{"hosts", required_argument, 0, L_HOSTS},
+		{"concurrency", required_argument, 0, L_CONCURRENCY},
+		{"engine-cache-ttl", required_argument, 0, L_ENGINE_CACHE_TTL},
+		{"cache-ttl", required_argument, 0, L_CACHE_TTL},
+		{"ifstatus", no_argument, 0, L_IFSTATUS},
+		{"ifmib", no_argument, 0, L_IFMIB},
+		{"if-exclude-types", optional_argument, 0, L_IF_EXCLUDE_TYPES},
+		{"if-unused-ports", required_argument, 0, L_IF_UNUSED_PORTS},
+		{"if-unused-names", required_argument, 0, L_IF_UNUSED_NAMES},
+		{"if-ports", required_argument, 0, L_IF_PORTS},
+		{"if-names", required_argument, 0, L_IF_NAMES},
 		{"strict", no_argument, 0, STRICT_MODE},
 		{"rate", no_argument, 0, L_CALCULATE_RATE},
 		{"rate-multiplier", required_argument, 0, L_RATE_MULTIPLIER},
@@ -824,6 +2035,60 @@ process_arguments (int argc, char **argv)
 		case 'n':	/* usesnmpgetnext */
 			usesnmpgetnext = TRUE;
 			break;
+		case L_USE_SNMPGET:
+			use_snmpget = TRUE;
+			break;
+		case L_TABLE:
+			table_mode = TRUE;
+			break;
+		case L_MAX_REPETITIONS:
+			if (!is_intpos (optarg) || (max_repetitions = atoi (optarg)) < 1)
+				usage2 (_("Max repetitions must be a positive integer"), optarg);
+			break;
+		case L_HOSTS: /* comma separated, may be repeated */
+			for (ptr = strtok (strdup (optarg), ","); ptr != NULL; ptr = strtok (NULL, ",")) {
+				target_hosts = realloc (target_hosts, sizeof (char *) * (target_count + 1));
+				if (target_hosts == NULL)
+					die (STATE_UNKNOWN, _("Cannot malloc"));
+				target_hosts[target_count++] = ptr;
+			}
+			break;
+		case L_CONCURRENCY:
+			if (!is_intpos (optarg))
+				usage2 (_("Concurrency must be a positive integer"), optarg);
+			concurrency = atoi (optarg);
+			break;
+		case L_ENGINE_CACHE_TTL:
+			if (!is_integer (optarg) || atoi (optarg) < 0)
+				usage2 (_("Engine cache TTL must be a positive integer or 0"), optarg);
+			engine_cache_ttl = atoi (optarg);
+			break;
+		case L_CACHE_TTL:
+			if (!is_integer (optarg) || atoi (optarg) < 0)
+				usage2 (_("Cache TTL must be a positive integer or 0"), optarg);
+			response_cache_ttl = atoi (optarg);
+			break;
+		case L_IFSTATUS:
+			ifstatus_mode = TRUE;
+			break;
+		case L_IFMIB:
+			ifmib = TRUE;
+			break;
+		case L_IF_EXCLUDE_TYPES: /* PPP if no list is given, as check_ifstatus -x does */
+			if_exclude_types = optarg && *optarg ? optarg : DEFAULT_IF_EXCLUDE_TYPES;
+			break;
+		case L_IF_UNUSED_PORTS:
+			if_unused_ports = optarg;
+			break;
+		case L_IF_UNUSED_NAMES:
+			if_unused_names = optarg;
+			break;
+		case L_IF_PORTS:
+			if_ports = optarg;
+			break;
+		case L_IF_NAMES:
+			if_names = optarg;
+			break;
 		case 'P':	/* SNMP protocol version */
 			proto = optarg;
 			break;
@@ -913,9 +2178,9 @@ process_arguments (int argc, char **argv)
 			cflags |= REG_EXTENDED | REG_NOSUB | REG_NEWLINE;
 			strncpy (regex_expect, optarg, sizeof (regex_expect) - 1);
 			regex_expect[sizeof (regex_expect) - 1] = 0;
-			errcode = regcomp (&preg, regex_expect, cflags);
+			errcode = np_regcomp (&preg, regex_expect, cflags);
 			if (errcode != 0) {
-				regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
+				np_regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
 				printf (_("Could Not Compile Regular Expression"));
 				return ERROR;
 			}
@@ -1014,8 +2279,10 @@ process_arguments (int argc, char **argv)
 			perf_labels=0;
 			break;
 		case '4':
+			address_family = AF_INET;
 			break;
 		case '6':
+			address_family = AF_INET6;
 			xasprintf(&ip_version, "udp6:");
 			if(verbose>2)
 				printf("IPv6 detected! Will pass \"udp6:\" to snmpget.\n");
@@ -1025,6 +2292,8 @@ process_arguments (int argc, char **argv)
 
 	if (server_address == NULL)
 		server_address = argv[optind];
+	if (server_address == NULL && target_count)
+		server_address = target_hosts[0];
 
 	if (community == NULL)
 		community = strdup (DEFAULT_COMMUNITY);
@@ -1073,8 +2342,10 @@ validate_arguments ()
 	if (server_address == NULL)
 		die(STATE_UNKNOWN, _("No host specified\n"));
 
-	/* Check oid is given */
-	if (numoids == 0)
+	/* Check oid is given; --ifstatus knows its own */
+	if (ifstatus_mode && numoids)
+		usage4 (_("--ifstatus takes no -o OIDs"));
+	if (numoids == 0 && !ifstatus_mode)
 		die(STATE_UNKNOWN, _("No OIDs specified\n"));
 
 	if (proto == NULL)
@@ -1264,6 +2535,8 @@ print_help (void)
 	printf (" %s\n", "-m, --miblist=STRING");
 	printf ("    %s\n", _("List of MIBS to be loaded (default = none if using numeric OIDs or 'ALL'"));
 	printf ("    %s\n", _("for symbolic OIDs.)"));
+	printf ("    %s\n", _("Symbolic OIDs are translated once and kept in a cache under the state"));
+	printf ("    %s\n", _("directory until the MIB files change, so later runs need not load them."));
 	printf (" %s\n", "-d, --delimiter=STRING");
 	printf ("    %s \"%s\"\n", _("Delimiter to use when parsing returned data. Default is"), DEFAULT_DELIMITER);
 	printf ("    %s\n", _("Any data on the right hand side of the delimiter is considered"));
@@ -1305,6 +2578,45 @@ print_help (void)
 
 	printf (" %s\n", "-O, --perf-oids");
 	printf ("    %s\n", _("Label performance data with OIDs instead of --label's"));
+	printf (" %s\n", "--table");
+	printf ("    %s\n", _("Walk the table columns given with -o and check every row, labelled with the"));
+	printf ("    %s\n", _("column's label (or OID) and the row index. Thresholds, units and labels go"));
+	printf ("    %s\n", _("by column. Needs SNMPv1 or v2c and numeric OIDs"));
+	printf (" %s\n", "--max-repetitions=INTEGER");
+	printf ("    %s (%s %d)\n", _("Rows to ask for in each GETBULK request of --table"),
+	        _("default:"), DEFAULT_MAX_REPETITIONS);
+	printf (" %s\n", "--ifstatus");
+	printf ("    %s\n", _("Instead of -o, count the interfaces that are administratively up by their"));
+	printf ("    %s\n", _("ifOperStatus, like check_ifstatus: CRITICAL if any is down. The IF-MIB"));
+	printf ("    %s\n", _("columns are walked with GETBULK. Needs SNMPv1 or v2c"));
+	printf (" %s\n", "--ifmib");
+	printf ("    %s\n", _("Also walk ifName and ifAlias of the ifXTable, to name down interfaces"));
+	printf (" %s\n", "--if-exclude-types[=LIST]");
+	printf ("    %s (%s %s)\n", _("Comma separated ifType values counted as excluded"), _("default:"),
+	        DEFAULT_IF_EXCLUDE_TYPES);
+	printf (" %s\n", "--if-unused-ports=LIST, --if-unused-names=LIST");
+	printf ("    %s\n", _("Comma separated ifIndex or ifDescr values counted as unused"));
+	printf (" %s\n", "--if-ports=LIST, --if-names=LIST");
+	printf ("    %s\n", _("Only look at these ifIndex or ifDescr values"));
+	printf (" %s\n", "--hosts=ADDRESS[,ADDRESS...]");
+	printf ("    %s\n", _("Send the query to each of these agents at the same time, instead of -H."));
+	printf ("    %s\n", _("May be repeated. The state is the worst of all agents and -t is per agent."));
+	printf ("    %s\n", _("Needs SNMPv1 or v2c and numeric OIDs"));
+	printf (" %s\n", "--concurrency=INTEGER");
+	printf ("    %s (%s %d)\n", _("Number of --hosts waited for at the same time"), _("default:"), DEFAULT_CONCURRENCY);
+	printf (" %s\n", "--engine-cache-ttl=SECONDS");
+	printf ("    %s\n", _("SNMPv3: keep the engine ID, boots and time of the agent and the keys"));
+	printf ("    %s\n", _("made from the passwords for this long in the state directory, so that"));
+	printf ("    %s (%s %d)\n", _("snmpget need not find them again. 0 turns this off"), _("default:"),
+	        DEFAULT_ENGINE_CACHE_TTL);
+	printf (" %s\n", "--cache-ttl=SECONDS");
+	printf ("    %s\n", _("Keep the values received in the state directory for this long, and take"));
+	printf ("    %s\n", _("those of other checks of the same agent and community from there instead"));
+	printf ("    %s\n", _("of asking the agent again. For slow or rate limited agents; not with --rate."));
+	printf ("    %s\n", _("Needs SNMPv1 or v2c and numeric OIDs (default: 0, off)"));
+	printf (" %s\n", "--use-snmpget");
+	printf ("    %s\n", _("Run snmpget even for SNMPv1/v2c queries of numeric OIDs, which are"));
+	printf ("    %s\n", _("otherwise sent by the plugin itself"));
 	printf (" %s\n", "--strict");
 	printf ("    %s\n", _("Enable strict mode: arguments to -o will be checked against the OID"));
 	printf ("    %s\n", _("returned by snmpget. If they don't match, the plugin returns UNKNOWN."));
@@ -1312,9 +2624,10 @@ print_help (void)
 	printf (UT_VERBOSE);
 
 	printf ("\n");
-	printf ("%s\n", _("This plugin uses the 'snmpget' command included with the NET-SNMP package."));
+	printf ("%s\n", _("SNMPv1 and v2c queries of numeric OIDs are sent by the plugin itself. SNMPv3"));
+	printf ("%s\n", _("and MIB names need the 'snmpget' command included with the NET-SNMP package."));
 	printf ("%s\n", _("if you don't have the package installed, you will need to download it from"));
-	printf ("%s\n", _("http://net-snmp.sourceforge.net before you can use this plugin."));
+	printf ("%s\n", _("http://net-snmp.sourceforge.net to use them."));
 
 	printf ("\n");
 	printf ("%s\n", _("Notes:"));
@@ -1337,6 +2650,9 @@ print_help (void)
 	printf(" %s\n", _("On the first run, there will be no prior state - this will return with OK."));
 	printf(" %s\n", _("The state is uniquely determined by the arguments to the plugin, so"));
 	printf(" %s\n", _("changing the arguments will create a new state file."));
+	printf(" %s\n", _("Counter32 and Counter64 values that wrapped are accounted for. The"));
+	printf(" %s\n", _("sysUpTime.0 of the agent is fetched with them, and when it goes back the"));
+	printf(" %s\n", _("agent has restarted and the check returns OK, as on the first run."));
 
 	printf (UT_SUPPORT);
 }
@@ -1352,4 +2668,8 @@ print_usage (void)
 	printf ("[-l label] [-u units] [-p port-number] [-d delimiter] [-D output-delimiter]\n");
 	printf ("[-m miblist] [-P snmp version] [-N context] [-L seclevel] [-U secname]\n");
 	printf ("[-a authproto] [-A authpasswd] [-x privproto] [-X privpasswd] [--strict]\n");
+	printf ("[--table [--max-repetitions=N]] [--hosts=address[,address...] [--concurrency=N]]\n");
+	printf ("[--engine-cache-ttl=seconds] [--cache-ttl=seconds] [--use-snmpget]\n");
+	printf ("%s -H <ip_address> --ifstatus [--ifmib] [--if-exclude-types[=list]]\n", progname);
+	printf ("[--if-unused-ports=list] [--if-unused-names=list] [--if-ports=list] [--if-names=list]\n");
 }
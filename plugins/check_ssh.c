@@ -35,6 +35,9 @@ const char *email = "devel@nagios-plugins.org";
 #include "common.h"
 #include "netutils.h"
 #include "utils.h"
+#include "resident.h"
+
+#include <fcntl.h>
 
 #ifndef MSG_DONTWAIT
 #define MSG_DONTWAIT 0
@@ -43,29 +46,64 @@ const char *email = "devel@nagios-plugins.org";
 #define SSH_DFL_PORT    22
 #define BUFF_SZ         256
 
-int port = -1;
-char *server_name = NULL;
-char *remote_version = NULL;
-char *remote_protocol = NULL;
-int verbose = FALSE;
-
+/* defaults are set in reset_state() so resident mode can restore them */
+int port;
+char *server_name;
+char *remote_version;
+char *remote_protocol;
+int verbose;
+int trace_timing;
+char **target_hosts;
+int target_host_count;
+int concurrency;
+unsigned int deadline;
+
+static int run_check (int, char **);
+static void reset_state (void);
 int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
 
 int ssh_connect (char *haddr, int hport, char *remote_version, char *remote_protocol);
+#ifdef HAVE_POLL
+static int check_ssh_parallel (void);
+#endif
 
 
 
 int
 main (int argc, char **argv)
 {
-	int result = STATE_UNKNOWN;
+	if (np_resident_requested (argc, argv))
+		return np_resident_main (argc, argv, run_check, reset_state);
+
+	reset_state ();
+	return run_check (argc, argv);
+}
+
+
+static void
+reset_state (void)
+{
+	port = -1;
+	server_name = NULL;
+	remote_version = NULL;
+	remote_protocol = NULL;
+	verbose = FALSE;
+	trace_timing = FALSE;
+	target_hosts = NULL;
+	target_host_count = 0;
+	concurrency = 64;
+	deadline = 0;
+	np_net_reset ();
+}
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+
+static int
+run_check (int argc, char **argv)
+{
+	int result = STATE_UNKNOWN;
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -73,6 +111,11 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
+#ifdef HAVE_POLL
+	if (target_host_count)
+		return check_ssh_parallel ();
+#endif
+
 	/* initialize alarm signal handling */
 	signal (SIGALRM, socket_timeout_alarm_handler);
 
@@ -94,6 +137,15 @@ process_arguments (int argc, char **argv)
 {
 	int c;
 
+	char *temp;
+
+	enum {
+		TRACE_TIMING_OPTION = CHAR_MAX + 1,
+		HOSTS_OPTION,
+		CONCURRENCY_OPTION,
+		DEADLINE_OPTION
+	};
+
 	int option = 0;
 	static struct option longopts[] = {
 		{"help", no_argument, 0, 'h'},
@@ -107,6 +159,10 @@ process_arguments (int argc, char **argv)
 		{"verbose", no_argument, 0, 'v'},
 		{"remote-version", required_argument, 0, 'r'},
 		{"remote-protcol", required_argument, 0, 'P'},
+		{"trace-timing", no_argument, 0, TRACE_TIMING_OPTION},
+		{"hosts", required_argument, 0, HOSTS_OPTION},
+		{"concurrency", required_argument, 0, CONCURRENCY_OPTION},
+		{"deadline", required_argument, 0, DEADLINE_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -128,12 +184,16 @@ process_arguments (int argc, char **argv)
 			usage5 ();
 		case 'V':									/* version */
 			print_revision (progname, NP_VERSION);
-			exit (STATE_OK);
+			np_exit (STATE_OK);
 		case 'h':									/* help */
 			print_help ();
-			exit (STATE_OK);
+			np_exit (STATE_OK);
 		case 'v':									/* verbose */
 			verbose = TRUE;
+			np_net_verbose = TRUE;
+			break;
+		case TRACE_TIMING_OPTION:
+			trace_timing = TRUE;
 			break;
 		case 't':									/* timeout period */
 			timeout_interval = parse_timeout_string (optarg);
@@ -166,6 +226,25 @@ process_arguments (int argc, char **argv)
 			else {
 				usage2 (_("Port number must be a positive integer"), optarg);
 			}
+			break;
+		case HOSTS_OPTION: /* comma separated, may be repeated */
+			for (temp = strtok (strdup (optarg), ","); temp != NULL; temp = strtok (NULL, ",")) {
+				target_hosts = realloc (target_hosts, sizeof (char *) * (target_host_count + 1));
+				if (target_hosts == NULL)
+					die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+				target_hosts[target_host_count++] = temp;
+			}
+			break;
+		case CONCURRENCY_OPTION:
+			if (!is_intpos (optarg))
+				usage2 (_("Concurrency must be a positive integer"), optarg);
+			concurrency = atoi (optarg);
+			break;
+		case DEADLINE_OPTION:
+			if (!is_intpos (optarg))
+				usage2 (_("Deadline must be a positive integer"), optarg);
+			deadline = atoi (optarg);
+			break;
 		}
 	}
 
@@ -182,7 +261,7 @@ process_arguments (int argc, char **argv)
 		}
 		else {
 			print_usage ();
-			exit (STATE_UNKNOWN);
+			np_exit (STATE_UNKNOWN);
 		}
 	}
 
@@ -192,7 +271,14 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments (void)
 {
-	if (server_name == NULL)
+	if (target_host_count) {
+#ifndef HAVE_POLL
+		usage4 (_("--hosts is not supported on this system"));
+#endif
+		if (server_name != NULL)
+			usage4 (_("-H cannot be used with --hosts"));
+	}
+	else if (server_name == NULL)
 		return ERROR;
 	if (port == -1)								/* funky, but allows -p to override stray integer in args */
 		port = SSH_DFL_PORT;
@@ -219,6 +305,8 @@ ssh_connect (char *haddr, int hport, char *remote_version, char *remote_protocol
 	static char *rev_no = VERSION;
 	struct timeval tv;
 	double elapsed_time;
+	np_perfdata perf;
+	np_line_reader reader;
 
 	gettimeofday(&tv, NULL);
 
@@ -229,11 +317,15 @@ ssh_connect (char *haddr, int hport, char *remote_version, char *remote_protocol
 
 	output = (char *) malloc (BUFF_SZ + 1);
 	memset (output, 0, BUFF_SZ + 1);
-	recv (sd, output, BUFF_SZ, 0);
+	np_timer_phase_begin (NP_PHASE_FIRSTBYTE);
+	/* the whole version line, however it arrives */
+	np_line_reader_init (&reader, sd, NULL);
+	np_recvline (&reader, output, BUFF_SZ + 1);
+	np_timer_phase_end (NP_PHASE_FIRSTBYTE);
 	if (strncmp (output, "SSH", 3)) {
 		printf (_("Server answer: %s"), output);
 		close(sd);
-		exit (STATE_CRITICAL);
+		np_exit (STATE_CRITICAL);
 	}
 	else {
 		strip (output);
@@ -253,7 +345,7 @@ ssh_connect (char *haddr, int hport, char *remote_version, char *remote_protocol
 				(_("SSH CRITICAL - %s (protocol %s) version mismatch, expected '%s'\n"),
 				 ssh_server, ssh_proto, remote_version);
 			close(sd);
-			exit (STATE_CRITICAL);
+			np_exit (STATE_CRITICAL);
 		}
 
 		if (remote_protocol && strcmp(remote_protocol, ssh_proto)) {
@@ -261,22 +353,293 @@ ssh_connect (char *haddr, int hport, char *remote_version, char *remote_protocol
 				(_("SSH CRITICAL - %s (protocol %s) protocol version mismatch, expected '%s'\n"),
 				 ssh_server, ssh_proto, remote_protocol);
 			close(sd);
-			exit (STATE_CRITICAL);
+			np_exit (STATE_CRITICAL);
 		}
 
 		elapsed_time = (double)deltime(tv) / 1.0e6;
 
+		np_perfdata_init (&perf);
+		np_perfdata_addf (&perf, "time", elapsed_time, "s",
+			FALSE, 0, FALSE, 0, TRUE, 0, TRUE, (int)timeout_interval);
+		if (trace_timing) {
+			np_timer_phase_perfdata (&perf, timeout_interval);
+			np_timer_phase_report (stderr);
+		}
+
 		printf
 			(_("SSH OK - %s (protocol %s) | %s\n"),
-			 ssh_server, ssh_proto, fperfdata("time", elapsed_time, "s",
-			 FALSE, 0, FALSE, 0, TRUE, 0, TRUE, (int)timeout_interval));
+			 ssh_server, ssh_proto, np_perfdata_string (&perf));
+		np_perfdata_free (&perf);
 		close(sd);
-		exit (STATE_OK);
+		np_exit (STATE_OK);
 	}
 }
 
 
 
+#ifdef HAVE_POLL
+/*
+ * --hosts: the banner of every host from one process. Each host is a
+ * non-blocking socket that connects, reads the version line a block at a
+ * time and sends ours back as poll() reports it ready; at most
+ * --concurrency hosts are in flight at a time. -t bounds each host,
+ * --deadline the whole run.
+ */
+
+enum {
+	SSH_STEP_CONNECT,
+	SSH_STEP_BANNER,
+	SSH_STEP_DONE
+};
+
+struct ssh_target {
+	char *address;
+	int fd;
+	int step;
+	struct timeval start;
+	char banner[BUFF_SZ + 1];
+	size_t received;
+	int state;
+	char *msg;
+	double time;
+};
+
+static void
+ssh_target_done (struct ssh_target *t, int state, const char *msg)
+{
+	if (t->fd >= 0)
+		close (t->fd);
+	t->fd = -1;
+	t->step = SSH_STEP_DONE;
+	t->state = state;
+	if (msg)
+		t->msg = strdup (msg);
+}
+
+/* the same judgement as ssh_connect() makes of the version line */
+static void
+ssh_target_banner (struct ssh_target *t)
+{
+	char *ssh_proto, *ssh_server, *buffer = NULL;
+
+	t->time = (double) deltime (t->start) / 1.0e6;
+	t->banner[t->received] = '\0';
+	t->banner[strcspn (t->banner, "\r\n")] = '\0';
+	if (strncmp (t->banner, "SSH", 3)) {
+		xasprintf (&t->msg, _("Server answer: %s"), t->banner);
+		ssh_target_done (t, STATE_CRITICAL, NULL);
+		return;
+	}
+	ssh_proto = t->banner + 4;
+	ssh_server = ssh_proto + strspn (ssh_proto, "-0123456789. ");
+	ssh_proto[strspn (ssh_proto, "0123456789. ")] = 0;
+
+	xasprintf (&buffer, "SSH-%s-check_ssh_%s\r\n", ssh_proto, VERSION);
+	send (t->fd, buffer, strlen (buffer), MSG_DONTWAIT);
+	free (buffer);
+
+	if (remote_version && strcmp (remote_version, ssh_server)) {
+		xasprintf (&t->msg, _("%s (protocol %s) version mismatch, expected '%s'"),
+		           ssh_server, ssh_proto, remote_version);
+		ssh_target_done (t, STATE_CRITICAL, NULL);
+	}
+	else if (remote_protocol && strcmp (remote_protocol, ssh_proto)) {
+		xasprintf (&t->msg, _("%s (protocol %s) protocol version mismatch, expected '%s'"),
+		           ssh_server, ssh_proto, remote_protocol);
+		ssh_target_done (t, STATE_CRITICAL, NULL);
+	}
+	else {
+		xasprintf (&t->msg, _("%s (protocol %s)"), ssh_server, ssh_proto);
+		ssh_target_done (t, STATE_OK, NULL);
+	}
+}
+
+static void
+ssh_target_connect (struct ssh_target *t)
+{
+	struct addrinfo hints, *res;
+	char port_str[6];
+	int ret;
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = address_family;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf (port_str, sizeof (port_str), "%d", port);
+
+	gettimeofday (&t->start, NULL);
+	if ((ret = np_net_getaddrinfo (t->address, port_str, &hints, &res)) != 0) {
+		ssh_target_done (t, STATE_CRITICAL, gai_strerror (ret));
+		return;
+	}
+	t->fd = socket (res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (t->fd < 0 || fcntl (t->fd, F_SETFL, O_NONBLOCK) < 0 ||
+	    (connect (t->fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS)) {
+		ssh_target_done (t, errno == ECONNREFUSED ? econn_refuse_state : STATE_CRITICAL, strerror (errno));
+		return;
+	}
+	t->step = SSH_STEP_CONNECT;
+}
+
+/* move a host on as far as it goes without blocking */
+static void
+ssh_target_step (struct ssh_target *t)
+{
+	socklen_t len;
+	ssize_t n;
+	int err;
+
+	switch (t->step) {
+	case SSH_STEP_CONNECT:
+		len = sizeof (err);
+		if (getsockopt (t->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+			err = errno;
+		if (err) {
+			ssh_target_done (t, err == ECONNREFUSED ? econn_refuse_state : STATE_CRITICAL, strerror (err));
+			return;
+		}
+		t->step = SSH_STEP_BANNER;
+		return;
+
+	case SSH_STEP_BANNER:
+		/* whatever has come, up to the end of the version line */
+		while (t->received < BUFF_SZ) {
+			if ((n = read (t->fd, t->banner + t->received, BUFF_SZ - t->received)) < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+					return;
+				n = 0;
+			}
+			if (n == 0)
+				break;
+			if (memchr (t->banner + t->received, '\n', n)) {
+				t->received += n;
+				break;
+			}
+			t->received += n;
+		}
+		ssh_target_banner (t);
+		return;
+
+	default:
+		return;
+	}
+}
+
+static int
+check_ssh_parallel (void)
+{
+	struct ssh_target *targets, **active;
+	struct pollfd *pfd;
+	struct timeval run_start;
+	np_perfdata perf;
+	char *problems = NULL;
+	char label[MAX_INPUT_BUFFER];
+	nfds_t nactive = 0, i, j;
+	int count = target_host_count;
+	int next = 0, done = 0, count_ok = 0, result = STATE_OK;
+	int wait, ms, k;
+
+	signal (SIGPIPE, SIG_IGN);
+	gettimeofday (&run_start, NULL);
+
+	targets = calloc (count, sizeof (*targets));
+	active = calloc (concurrency, sizeof (*active));
+	pfd = calloc (concurrency, sizeof (*pfd));
+	if (!targets || !active || !pfd)
+		die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+
+	for (k = 0; k < count; k++) {
+		targets[k].address = target_hosts[k];
+		targets[k].fd = -1;
+	}
+
+	while (done < count) {
+		if (deadline && deltime (run_start) >= (long) deadline * 1000000L) {
+			/* whatever is left fails now */
+			for (i = 0; i < nactive; i++)
+				ssh_target_done (active[i], STATE_CRITICAL, _("Deadline reached"));
+			for (; next < count; next++)
+				ssh_target_done (&targets[next], STATE_CRITICAL, _("Not checked before the deadline"));
+			break;
+		}
+
+		/* keep the pipe full */
+		while (nactive < (nfds_t) concurrency && next < count) {
+			ssh_target_connect (&targets[next]);
+			if (targets[next].step == SSH_STEP_DONE)
+				done++;
+			else
+				active[nactive++] = &targets[next];
+			next++;
+		}
+		if (nactive == 0)
+			continue;
+
+		wait = -1;
+		for (i = 0; i < nactive; i++) {
+			pfd[i].fd = active[i]->fd;
+			pfd[i].events = active[i]->step == SSH_STEP_CONNECT ? POLLOUT : POLLIN;
+			pfd[i].revents = 0;
+			ms = timeout_interval * 1000 - (int) (deltime (active[i]->start) / 1000);
+			if (ms < 0)
+				ms = 0;
+			if (wait < 0 || ms < wait)
+				wait = ms;
+		}
+		if (deadline) {
+			ms = deadline * 1000 - (int) (deltime (run_start) / 1000);
+			if (ms < wait)
+				wait = ms < 0 ? 0 : ms;
+		}
+
+		if (poll (pfd, nactive, wait) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, "%s %s\n", _("poll failed:"), strerror (errno));
+
+		for (i = 0; i < nactive; i++) {
+			if (pfd[i].revents)
+				ssh_target_step (active[i]);
+			else if (deltime (active[i]->start) >= (long) timeout_interval * 1000000L)
+				ssh_target_done (active[i], STATE_CRITICAL, _("Socket timeout"));
+		}
+
+		/* drop the finished ones */
+		for (i = j = 0; i < nactive; i++) {
+			if (active[i]->step == SSH_STEP_DONE)
+				done++;
+			else
+				active[j++] = active[i];
+		}
+		nactive = j;
+	}
+
+	np_perfdata_init (&perf);
+	for (k = 0; k < count; k++) {
+		result = max_state_alt (targets[k].state, result);
+		if (targets[k].state == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           targets[k].address, targets[k].msg);
+
+		if (targets[k].time == 0)
+			continue;
+		snprintf (label, sizeof (label), "%s_time", targets[k].address);
+		np_perfdata_addf (&perf, label, targets[k].time, "s",
+		                  FALSE, 0, FALSE, 0, TRUE, 0, TRUE, (int) timeout_interval);
+	}
+
+	printf ("SSH %s: %d of %d hosts OK%s%s|%s\n", state_text (result), count_ok, count,
+	        problems ? " - " : "", problems ? problems : "", np_perfdata_string (&perf));
+	for (k = 0; k < count; k++)
+		printf ("[%s] %s: %s\n", state_text (targets[k].state), targets[k].address, targets[k].msg);
+	np_perfdata_free (&perf);
+
+	np_exit (result);
+	return STATE_UNKNOWN;
+}
+#endif /* HAVE_POLL */
+
+
+
 void
 print_help (void)
 {
@@ -309,6 +672,18 @@ print_help (void)
 	printf (" %s\n", "-P, --remote-protocol=STRING");
   printf ("    %s\n", _("Alert if protocol doesn't match expected protocol version (ex: 2.0)"));
 
+#ifdef HAVE_POLL
+	printf (" %s\n", "--hosts=ADDRESS[,ADDRESS...]");
+	printf ("    %s\n", _("Check the banner of each of these hosts, concurrently (may be repeated)"));
+	printf (" %s\n", "--concurrency=INTEGER");
+	printf ("    %s\n", _("The most hosts checked at once with --hosts (default: 64)"));
+	printf (" %s\n", "--deadline=INTEGER");
+	printf ("    %s\n", _("Seconds for all the hosts together; -t applies to each. Hosts not done"));
+	printf ("    %s\n", _("by then are CRITICAL (default: no deadline)"));
+#endif
+
+	printf (UT_TRACE_TIMING);
+
 	printf (UT_VERBOSE);
 
 	printf (UT_SUPPORT);
@@ -320,6 +695,8 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-	printf ("%s  [-4|-6] [-t <timeout>] [-r <remote version>] [-p <port>] <host>\n", progname);
+	printf ("%s  [-4|-6] [-t <timeout>] [-r <remote version>] [-p <port>] [--trace-timing] <host>\n", progname);
+	printf ("%s  [-4|-6] [-t <timeout>] [-r <remote version>] [-p <port>] --hosts <host>[,<host>...]\n", progname);
+	printf ("  [--concurrency <n>] [--deadline <seconds>]\n");
 }
 
@@ -34,6 +34,12 @@ const char *email = "devel@nagios-plugins.org";
 #include "common.h"
 #include "popen.h"
 #include "utils.h"
+#include "utils_proc.h"
+
+#ifdef HAVE_PROC_MEMINFO
+# include <fcntl.h>
+# include <sys/stat.h>
+#endif
 
 #ifdef HAVE_DECL_SWAPCTL
 # ifdef HAVE_SYS_PARAM_H
@@ -51,6 +57,22 @@ const char *email = "devel@nagios-plugins.org";
 # define SWAP_CONVERSION 1
 #endif
 
+#ifdef HAVE_PROC_MEMINFO
+/* The swap counters of /proc/vmstat at the last run, for the rates since;
+ * uptime_ms going back means a reboot in between */
+#define SWAP_RATE_MAGIC "NPSWP\0\0\1"
+
+typedef struct swap_rate_sample {
+	char magic[8];
+	uint64_t uptime_ms;
+	uint64_t pswpin;
+	uint64_t pswpout;
+} swap_rate_sample;
+
+int swap_rate_load (const char *path, swap_rate_sample *);
+int swap_rate_save (const char *path, swap_rate_sample *);
+#endif
+
 int check_swap (int usp, double free_swap_mb);
 int process_arguments (int argc, char **argv);
 int validate_arguments (void);
@@ -66,20 +88,36 @@ double crit_size_bytes= 0;
 int verbose;
 int allswaps;
 int no_swap_state = STATE_CRITICAL;
+char *pressure_warn = NULL;
+char *pressure_crit = NULL;
+thresholds *pressure_thresholds = NULL;
+char *swapin_warn = NULL;
+char *swapin_crit = NULL;
+thresholds *swapin_thresholds = NULL;
+int snapshot_age = 0; /* --snapshot: the oldest a shared snapshot may be */
 
 int
 main (int argc, char **argv)
 {
 	int percent_used, percent;
 	double total_swap_mb = 0, used_swap_mb = 0, free_swap_mb = 0;
-	double dsktotal_mb = 0, dskused_mb = 0, dskfree_mb = 0, tmp_mb = 0;
+	double dsktotal_mb = 0, dskused_mb = 0, dskfree_mb = 0;
 	int result = STATE_UNKNOWN;
-	char input_buffer[MAX_INPUT_BUFFER];
 #ifdef HAVE_PROC_MEMINFO
-	FILE *fp;
+	np_proc_meminfo meminfo;
+	np_proc_swap swaps[NP_PROC_MAX_SWAPS];
+	np_proc_pressure psi;
+	np_proc_vmstat vm;
+	np_proc_snapshot snapshot;
+	swap_rate_sample last, now;
+	double uptime, interval, swapin_rate, swapout_rate;
+	char *rate_file;
+	int i, nswaps;
 #else
 	int conv_factor = SWAP_CONVERSION;
 # ifdef HAVE_SWAP
+	char input_buffer[MAX_INPUT_BUFFER];
+	char str[32];
 	char *temp_buffer;
 	char *swap_command;
 	char *swap_format;
@@ -97,18 +135,21 @@ main (int argc, char **argv)
 #  endif /* HAVE_DECL_SWAPCTL */
 # endif
 #endif
-	char str[32];
 	char *status;
-
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	char *extra;
+	char *extra_perf;
 
 	status = strdup ("");
+	extra = strdup ("");
+	extra_perf = strdup ("");
+
+	np_init ((char *) progname, argc, argv);
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
 
+	np_set_args (argc, argv);
+
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
@@ -116,44 +157,104 @@ main (int argc, char **argv)
 	if (verbose >= 3) {
 		printf("Reading PROC_MEMINFO at %s\n", PROC_MEMINFO);
 	}
-	fp = fopen (PROC_MEMINFO, "r");
-	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
-		if (sscanf (input_buffer, "%*[S]%*[w]%*[a]%*[p]%*[:] %lf %lf %lf", &dsktotal_mb, &dskused_mb, &dskfree_mb) == 3) {
-			dsktotal_mb = dsktotal_mb / 1048576;	/* Apply conversion */
-			dskused_mb = dskused_mb / 1048576;
-			dskfree_mb = dskfree_mb / 1048576;
-			total_swap_mb += dsktotal_mb;
-			used_swap_mb += dskused_mb;
-			free_swap_mb += dskfree_mb;
-			if (allswaps) {
-				if (dsktotal_mb == 0)
-					percent=0.0;
-				else
-					percent = 100 * (((double) dskused_mb) / ((double) dsktotal_mb));
-				result = max_state (result, check_swap (percent, dskfree_mb));
-				if (verbose)
-					xasprintf (&status, "%s [%.0f (%d%%)]", status, dskfree_mb, 100 - percent);
-			}
+	/* what another check has just read, if there is a snapshot of it */
+	if (snapshot_age && np_proc_snapshot_open (&snapshot, NULL, snapshot_age)) {
+		if (snapshot.header->have & NP_PROC_SNAPSHOT_MEMINFO)
+			meminfo = snapshot.header->meminfo;
+		else
+			snapshot_age = 0;
+		if (verbose >= 3 && snapshot_age)
+			printf ("Using the snapshot taken %ld seconds ago\n", snapshot.age);
+		np_proc_snapshot_close (&snapshot);
+	} else
+		snapshot_age = 0;
+	if (!snapshot_age && !np_proc_meminfo_read (&meminfo))
+		die (STATE_UNKNOWN, _("Could not read %s\n"), PROC_MEMINFO);
+	if (verbose >= 3)
+		printf ("SwapTotal=%llu kB SwapFree=%llu kB\n", meminfo.swap_total, meminfo.swap_free);
+	total_swap_mb = meminfo.swap_total / 1024.0;
+	free_swap_mb = meminfo.swap_free / 1024.0;
+	used_swap_mb = total_swap_mb - free_swap_mb;
+
+	/* each swap area, from /proc/swaps */
+	if (allswaps && (nswaps = np_proc_swaps (swaps, NP_PROC_MAX_SWAPS)) > 0) {
+		for (i = 0; i < nswaps; i++) {
+			dsktotal_mb = swaps[i].size / 1024.0;
+			dskused_mb = swaps[i].used / 1024.0;
+			dskfree_mb = dsktotal_mb - dskused_mb;
+			if (verbose >= 3)
+				printf ("%s: total=%.0f, free=%.0f\n", swaps[i].name, dsktotal_mb, dskfree_mb);
+			if (dsktotal_mb == 0)
+				percent = 0;
+			else
+				percent = 100 * (dskused_mb / dsktotal_mb);
+			result = max_state (result, check_swap (percent, dskfree_mb));
+			if (verbose)
+				xasprintf (&status, "%s [%.0f (%d%%)]", status, dskfree_mb, 100 - percent);
+			xasprintf (&extra_perf, "%s %s", extra_perf,
+			           perfdata (swaps[i].name, (long) dskfree_mb, "MB",
+			                     TRUE, (long) max (warn_size_bytes/(1024 * 1024), warn_percent/100.0*dsktotal_mb),
+			                     TRUE, (long) max (crit_size_bytes/(1024 * 1024), crit_percent/100.0*dsktotal_mb),
+			                     TRUE, 0,
+			                     TRUE, (long) dsktotal_mb));
 		}
-		else if (sscanf (input_buffer, "%*[S]%*[w]%*[a]%*[p]%[TotalFre]%*[:] %lf %*[k]%*[B]", str, &tmp_mb)) {
-			if (verbose >= 3) {
-				printf("Got %s with %lf\n", str, tmp_mb);
-			}
-			/* I think this part is always in Kb, so convert to mb */
-			if (strcmp ("Total", str) == 0) {
-				dsktotal_mb = tmp_mb / 1024;
-			}
-			else if (strcmp ("Free", str) == 0) {
-				dskfree_mb = tmp_mb / 1024;
-			}
+	}
+
+	/* the share of time tasks were stalled waiting for memory */
+	if (pressure_thresholds) {
+		if (!np_proc_pressure_read ("memory", &psi))
+			die (STATE_UNKNOWN, _("Could not read %s\n"), "/proc/pressure/memory");
+		if (verbose >= 3)
+			printf ("memory pressure: some avg10=%.2f avg60=%.2f avg300=%.2f, full avg10=%.2f avg60=%.2f avg300=%.2f\n",
+			        psi.some_avg10, psi.some_avg60, psi.some_avg300, psi.full_avg10, psi.full_avg60, psi.full_avg300);
+		result = max_state (result, get_status (psi.some_avg60, pressure_thresholds));
+		xasprintf (&extra, "%s [%s %.2f%%]", extra, _("memory pressure"), psi.some_avg60);
+		xasprintf (&extra_perf, "%s %s %s %s %s", extra_perf,
+		           fperfdata ("pressure_some_avg10", psi.some_avg10, "%", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, 100),
+		           sperfdata ("pressure_some_avg60", psi.some_avg60, "%", pressure_warn, pressure_crit, TRUE, 0, TRUE, 100),
+		           fperfdata ("pressure_some_avg300", psi.some_avg300, "%", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, 100),
+		           fperfdata ("pressure_full_avg60", psi.full_avg60, "%", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, 100));
+	}
+
+	/* pages swapped in and out per second since the last run */
+	if (swapin_thresholds) {
+		if (!np_proc_vmstat_read (&vm))
+			die (STATE_UNKNOWN, _("Could not read %s\n"), "/proc/vmstat");
+		if (!np_proc_uptime (&uptime))
+			die (STATE_UNKNOWN, _("Could not read %s\n"), "/proc/uptime");
+		memset (&now, 0, sizeof (now));
+		memcpy (now.magic, SWAP_RATE_MAGIC, sizeof (now.magic));
+		now.uptime_ms = (uint64_t) (uptime * 1000);
+		now.pswpin = vm.pswpin;
+		now.pswpout = vm.pswpout;
+
+		np_enable_state (NULL, 1);
+		if ((rate_file = np_state_path (".vmstat")) == NULL)
+			die (STATE_UNKNOWN, "%s\n", _("Cannot create the state directory"));
+		if (swap_rate_load (rate_file, &last) && now.uptime_ms > last.uptime_ms &&
+		    now.pswpin >= last.pswpin && now.pswpout >= last.pswpout) {
+			interval = (now.uptime_ms - last.uptime_ms) / 1000.0;
+			swapin_rate = (now.pswpin - last.pswpin) / interval;
+			swapout_rate = (now.pswpout - last.pswpout) / interval;
+			if (verbose >= 3)
+				printf ("pswpin=%llu pswpout=%llu over %.1f s\n", vm.pswpin, vm.pswpout, interval);
+			result = max_state (result, get_status (swapin_rate, swapin_thresholds));
+			xasprintf (&extra, "%s [%s %.1f/s, %s %.1f/s]", extra,
+			           _("swap-in"), swapin_rate, _("swap-out"), swapout_rate);
+			xasprintf (&extra_perf, "%s %s %s", extra_perf,
+			           sperfdata ("swap_in", swapin_rate, "", swapin_warn, swapin_crit, TRUE, 0, FALSE, 0),
+			           fperfdata ("swap_out", swapout_rate, "", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
 		}
+		else if (verbose)
+			xasprintf (&extra, "%s [%s]", extra, _("no swap rates before the next run"));
+		if (!swap_rate_save (rate_file, &now))
+			die (STATE_UNKNOWN, "%s %s: %s\n", _("Cannot write the state file"), rate_file, strerror (errno));
+		free (rate_file);
 	}
-	fclose(fp);
-	dskused_mb = dsktotal_mb - dskfree_mb;
-	total_swap_mb = dsktotal_mb;
-	used_swap_mb = dskused_mb;
-	free_swap_mb = dskfree_mb;
 #else
+	if (pressure_thresholds || swapin_thresholds)
+		usage4 (_("Memory pressure and swap rates can only be checked on Linux"));
+
 # ifdef HAVE_SWAP
 	xasprintf(&swap_command, "%s", SWAP_COMMAND);
 	xasprintf(&swap_format, "%s", SWAP_FORMAT);
@@ -359,23 +460,63 @@ main (int argc, char **argv)
 		percent_used = 100;
 		status = "- Swap is either disabled, not present, or of zero size. ";
 	}
+	xasprintf (&status, "%s%s", status, extra);
 
 	result = max_state (result, check_swap (percent_used, free_swap_mb));
 	printf (_("SWAP %s - %d%% free (%d MB out of %d MB) %s|"),
 			state_text (result),
 			(100 - percent_used), (int) free_swap_mb, (int) total_swap_mb, status);
 
-	puts (perfdata ("swap", (long) free_swap_mb, "MB",
+	printf ("%s", perfdata ("swap", (long) free_swap_mb, "MB",
 	                TRUE, (long) max (warn_size_bytes/(1024 * 1024), warn_percent/100.0*total_swap_mb),
 	                TRUE, (long) max (crit_size_bytes/(1024 * 1024), crit_percent/100.0*total_swap_mb),
 	                TRUE, 0,
 	                TRUE, (long) total_swap_mb));
+	printf ("%s\n", extra_perf);
 
 	return result;
 }
 
 
 
+#ifdef HAVE_PROC_MEMINFO
+int
+swap_rate_load (const char *path, swap_rate_sample *sample)
+{
+	struct stat st;
+	int fd, ok;
+
+	if ((fd = open (path, O_RDONLY)) < 0)
+		return FALSE;
+	ok = fstat (fd, &st) == 0 && st.st_size == sizeof (*sample) &&
+	     read (fd, sample, sizeof (*sample)) == sizeof (*sample) &&
+	     !memcmp (sample->magic, SWAP_RATE_MAGIC, sizeof (sample->magic));
+	close (fd);
+	return ok;
+}
+
+int
+swap_rate_save (const char *path, swap_rate_sample *sample)
+{
+	char *tmp;
+	int fd, ok = FALSE;
+
+	xasprintf (&tmp, "%s.XXXXXX", path);
+	if ((fd = mkstemp (tmp)) >= 0) {
+		ok = write (fd, sample, sizeof (*sample)) == sizeof (*sample) &&
+		     fchmod (fd, S_IRUSR | S_IWUSR | S_IRGRP) == 0;
+		ok = close (fd) == 0 && ok;
+		ok = ok && rename (tmp, path) == 0;
+		if (!ok)
+			unlink (tmp);
+	}
+	free (tmp);
+	return ok;
+}
+#endif
+
+
+
 int
 check_swap (int usp, double free_swap_mb)
 {
@@ -410,6 +551,11 @@ process_arguments (int argc, char **argv)
 		{"critical", required_argument, 0, 'c'},
 		{"allswaps", no_argument, 0, 'a'},
 		{"no-swap", required_argument, 0, 'n'},
+		{"pressure-warning", required_argument, 0, CHAR_MAX+1},
+		{"pressure-critical", required_argument, 0, CHAR_MAX+2},
+		{"swapin-warning", required_argument, 0, CHAR_MAX+3},
+		{"swapin-critical", required_argument, 0, CHAR_MAX+4},
+		{"snapshot", required_argument, 0, CHAR_MAX+5},
 		{"verbose", no_argument, 0, 'v'},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
@@ -478,6 +624,23 @@ process_arguments (int argc, char **argv)
 		case 'v':									/* verbose */
 			verbose++;
 			break;
+		case CHAR_MAX+1:
+			pressure_warn = optarg;
+			break;
+		case CHAR_MAX+2:
+			pressure_crit = optarg;
+			break;
+		case CHAR_MAX+3:
+			swapin_warn = optarg;
+			break;
+		case CHAR_MAX+4:
+			swapin_crit = optarg;
+			break;
+		case CHAR_MAX+5:
+			if (!is_intpos (optarg))
+				usage2 (_("Snapshot age must be a positive integer"), optarg);
+			snapshot_age = atoi (optarg);
+			break;
 		case 'V':									/* version */
 			print_revision (progname, NP_VERSION);
 			exit (STATE_OK);
@@ -518,6 +681,11 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments (void)
 {
+	if (pressure_warn || pressure_crit)
+		set_thresholds (&pressure_thresholds, pressure_warn, pressure_crit);
+	if (swapin_warn || swapin_crit)
+		set_thresholds (&swapin_thresholds, swapin_warn, swapin_crit);
+
 	if (have_crit == FALSE && have_warn == FALSE)
 		return ERROR;
 	else if (warn_percent < 0 || crit_percent < 0 || warn_size_bytes < 0
@@ -565,6 +733,16 @@ print_help (void)
   printf ("    %s\n", _("Conduct comparisons for all swap partitions, one by one"));
   printf (" %s\n", "-n, --no-swap=<ok|warning|critical|unknown>");
   printf ("    %s %s\n", _("Resulting state when there is no swap regardless of thresholds. Default:"), state_text(no_swap_state));
+  printf (" %s\n", "--pressure-warning=RANGE, --pressure-critical=RANGE");
+  printf ("    %s\n", _("Thresholds on the percentage of time some tasks were stalled waiting for"));
+  printf ("    %s\n", _("memory over the last minute, from /proc/pressure/memory (Linux 4.20)"));
+  printf (" %s\n", "--swapin-warning=RANGE, --swapin-critical=RANGE");
+  printf ("    %s\n", _("Thresholds on the pages swapped in per second since the last run, from"));
+  printf ("    %s\n", _("/proc/vmstat; the counters are kept in a state file between runs"));
+  printf (" %s\n", "--snapshot=SECONDS");
+  printf ("    %s\n", _("Take the swap totals from the snapshot check_procs, check_load,"));
+  printf ("    %s\n", _("check_swap and check_users share if it is at most SECONDS old, or take"));
+  printf ("    %s\n", _("one for them (Linux)"));
 
   printf (UT_VERBOSE);
 
@@ -572,6 +750,9 @@ print_help (void)
   printf ("%s\n", _("Notes:"));
   printf (" %s\n", _("Both INTEGER and PERCENT thresholds can be specified, they are all checked."));
   printf (" %s\n", _("On AIX, if -a is specified, uses lsps -a, otherwise uses lsps -s."));
+  printf (" %s\n", _("On Linux, -a adds the free space of each swap area of /proc/swaps to the"));
+  printf (" %s\n", _("performance data. The pressure and swap-in thresholds are Linux only."));
+  printf (" %s\n", _("The first run with swap-in thresholds only records the counters."));
 
   printf (UT_SUPPORT);
 }
@@ -583,4 +764,6 @@ print_usage (void)
   printf ("%s\n", _("Usage:"));
   printf (" %s [-av] -w <percent_free>%% -c <percent_free>%%\n",progname);
   printf ("  -w <bytes_free> -c <bytes_free> [-n <state>]\n");
+  printf ("  [--pressure-warning=<range>] [--pressure-critical=<range>]\n");
+  printf ("  [--swapin-warning=<range>] [--swapin-critical=<range>] [--snapshot=<seconds>]\n");
 }
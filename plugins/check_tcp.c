@@ -36,13 +36,17 @@ const char *email = "devel@nagios-plugins.org";
 #include "netutils.h"
 #include "utils.h"
 #include "utils_tcp.h"
+#include "resident.h"
 
 #include <ctype.h>
+#include <fcntl.h>
 #include <sys/select.h>
 
 #ifdef HAVE_SSL
-static int check_cert = FALSE;
+static int check_cert;
 static int days_till_exp_warn, days_till_exp_crit;
+static int check_ocsp, ocsp_fetch;
+static int ocsp_warn_hours, ocsp_crit_hours;
 # define my_recv(buf, len) ((flags & FLAG_SSL) ? np_net_ssl_read(buf, len) : read(sd, buf, len))
 # define my_send(buf, len) ((flags & FLAG_SSL) ? np_net_ssl_write(buf, len) : send(sd, buf, len, 0))
 #else
@@ -56,46 +60,146 @@ void print_help (void);
 void print_usage (void);
 
 #define EXPECT server_expect[0]
-static char *SERVICE = "TCP";
-static char *SEND = NULL;
-static char *QUIT = NULL;
-static int PROTOCOL = IPPROTO_TCP; /* most common is default */
-static int PORT = 0;
-static int READ_TIMEOUT = 2;
-
-static int server_port = 0;
-static char *server_address = NULL;
-static char *server_name = NULL;
-static int host_specified = FALSE;
-static char *server_send = NULL;
-static char *server_quit = NULL;
+/* everything below is (re)initialised by reset_state() */
+static char *SERVICE;
+static char *SEND;
+static char *QUIT;
+static int PROTOCOL; /* most common, IPPROTO_TCP, is default */
+static int PORT;
+static int READ_TIMEOUT;
+
+static int server_port;
+static char *server_address;
+static char *server_name;
+static int host_specified;
+static char *server_send;
+static char *server_quit;
 static char **server_expect;
-static size_t server_expect_count = 0;
-static size_t maxbytes = 0;
-static char **warn_codes = NULL;
-static size_t warn_codes_count = 0;
-static char **crit_codes = NULL;
-static size_t crit_codes_count = 0;
-static unsigned int delay = 0;
-static double warning_time = 0;
-static double critical_time = 0;
-static double elapsed_time = 0;
+static size_t server_expect_count;
+static size_t maxbytes;
+static char **warn_codes;
+static size_t warn_codes_count;
+static char **crit_codes;
+static size_t crit_codes_count;
+static unsigned int delay;
+static double warning_time;
+static double critical_time;
+static double elapsed_time;
 static long microsec;
-static int sd = 0;
+static int sd;
 #define MAXBUF 1024
 static char buffer[MAXBUF];
-static int expect_mismatch_state = STATE_WARNING;
-static int match_flags = NP_MATCH_EXACT;
+static int expect_mismatch_state;
+static int match_flags;
+static char **target_hosts;
+static int target_host_count;
+static int *target_ports;
+static int target_port_count;
+static int concurrency;
+static unsigned int deadline;
+static int udp_retries;
+/* --script-send/--script-expect, a command and its answer a step */
+static char **script_send;
+static char **script_expect;
+static int script_send_count;
+static int script_expect_count;
+
+/* --endpoints: host, port and server name of each, in place of the
+ * --hosts and --ports product */
+struct tcp_endpoint {
+	char *address;
+	int port;
+	char *sni;
+};
+static struct tcp_endpoint *endpoints;
+static int endpoint_count;
 
 #define FLAG_SSL 0x01
 #define FLAG_VERBOSE 0x02
 #define FLAG_TIME_WARN 0x04
 #define FLAG_TIME_CRIT 0x08
 #define FLAG_HIDE_OUTPUT 0x10
+#define FLAG_TRACE_TIMING 0x20
+#define FLAG_TLS_SESSION_CACHE 0x40
+#define FLAG_TLS_FULL_HANDSHAKE 0x80
+#define FLAG_SCRIPT_PIPELINE 0x100
 static size_t flags;
 
+static int run_check (int, char **);
+static void reset_state (void);
+#ifdef HAVE_POLL
+static int check_tcp_parallel (void);
+static int check_udp_parallel (void);
+#endif
+static void add_endpoints (const char *);
+static int run_script (double *, char **);
+
 int
 main (int argc, char **argv)
+{
+	if (np_resident_requested (argc, argv))
+		return np_resident_main (argc, argv, run_check, reset_state);
+
+	reset_state ();
+	return run_check (argc, argv);
+}
+
+
+static void
+reset_state (void)
+{
+#ifdef HAVE_SSL
+	check_cert = FALSE;
+	days_till_exp_warn = days_till_exp_crit = 0;
+	check_ocsp = ocsp_fetch = FALSE;
+	ocsp_warn_hours = 24;
+	ocsp_crit_hours = 4;
+#endif
+	SERVICE = "TCP";
+	SEND = NULL;
+	QUIT = NULL;
+	PROTOCOL = IPPROTO_TCP;
+	PORT = 0;
+	READ_TIMEOUT = 2;
+
+	server_port = 0;
+	server_address = NULL;
+	server_name = NULL;
+	host_specified = FALSE;
+	server_send = NULL;
+	server_quit = NULL;
+	server_expect = NULL;
+	server_expect_count = 0;
+	maxbytes = 0;
+	warn_codes = NULL;
+	warn_codes_count = 0;
+	crit_codes = NULL;
+	crit_codes_count = 0;
+	delay = 0;
+	warning_time = 0;
+	critical_time = 0;
+	elapsed_time = 0;
+	sd = 0;
+	expect_mismatch_state = STATE_WARNING;
+	match_flags = NP_MATCH_EXACT;
+	target_hosts = NULL;
+	target_host_count = 0;
+	target_ports = NULL;
+	target_port_count = 0;
+	endpoints = NULL;
+	endpoint_count = 0;
+	concurrency = 64;
+	deadline = 0;
+	udp_retries = 0;
+	script_send = script_expect = NULL;
+	script_send_count = script_expect_count = 0;
+	flags = 0;
+	np_net_reset ();
+}
+
+
+static int
+run_check (int argc, char **argv)
 {
 	int result = STATE_UNKNOWN;
 	int i;
@@ -104,14 +208,13 @@ main (int argc, char **argv)
 	struct timeval timeout;
 	size_t len;
 	int match = -1;
+	int script_step = 0;
+	double *script_times = NULL;
+	char *script_response = NULL;
 	fd_set rfds;
 
 	FD_ZERO(&rfds);
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	/* determine program- and service-name quickly */
 	progname = strrchr(argv[0], '/');
 	if(progname != NULL) progname++;
@@ -230,6 +333,11 @@ main (int argc, char **argv)
 		usage(_("With UDP checks, a send/expect string must be specified."));
 	}
 
+#ifdef HAVE_POLL
+	if (target_host_count || target_port_count || endpoint_count)
+		return PROTOCOL == IPPROTO_UDP ? check_udp_parallel () : check_tcp_parallel ();
+#endif
+
 	/* set up the timer */
 	signal (SIGALRM, socket_timeout_alarm_handler);
 	alarm (timeout_interval);
@@ -242,10 +350,14 @@ main (int argc, char **argv)
 
 #ifdef HAVE_SSL
 	if (flags & FLAG_SSL){
+		np_net_ssl_session_cache ((flags & FLAG_TLS_SESSION_CACHE) ? server_address : NULL,
+		                          server_port, (flags & FLAG_TLS_FULL_HANDSHAKE) ? TRUE : FALSE);
 		result = np_net_ssl_init_with_hostname(sd, server_name);
 		if (result == STATE_OK && check_cert == TRUE) {
 			result = np_net_ssl_check_cert(days_till_exp_warn, days_till_exp_crit);
 		}
+		if (result == STATE_OK && check_ocsp == TRUE)
+			result = np_net_ssl_check_ocsp (ocsp_warn_hours, ocsp_crit_hours);
 	}
 	if(result != STATE_OK){
 		if(sd) close(sd);
@@ -257,10 +369,14 @@ main (int argc, char **argv)
 	if (server_send != NULL &&  strlen(server_send) > my_send(server_send, strlen(server_send))) {		/* Something to send? and validate return*/
 		die(STATE_UNKNOWN, "%s - %s", _("No data sent to host"), strerror(errno));
 	}
+	np_timer_phase_begin (NP_PHASE_FIRSTBYTE);
 
 	if (delay > 0) {
 		tv.tv_sec += delay;
 		sleep (delay);
+	} else if (PROTOCOL == IPPROTO_UDP && server_send != NULL && np_net_adaptive) {
+		/* no answer by then is the socket timeout, as it was */
+		np_net_udp_wait (sd, server_send, strlen (server_send), np_net_deadline (0));
 	}
 
 	if(flags & FLAG_VERBOSE) {
@@ -277,23 +393,31 @@ main (int argc, char **argv)
 
 	/* if(len) later on, we know we have a non-NULL response */
 	len = 0;
+	microsec = -1;
 	if (server_expect_count) {
+		np_expect *expect = np_expect_new (server_expect, server_expect_count,
+		                                   match_flags & ~NP_MATCH_VERBOSE);
 
-		/* watch for the expect string */
+		/* watch for the expect string, matching each chunk as it comes in
+		 * and reading no further once the result is known */
 		while ((i = my_recv(buffer, sizeof(buffer))) > 0) {
+			if (len == 0) {
+				np_timer_phase_end (NP_PHASE_FIRSTBYTE);
+				np_timer_phase_begin (NP_PHASE_TRANSFER);
+			}
 			status = realloc(status, len + i + 1);
 			memcpy(&status[len], buffer, i);
 			len += i;
 			status[len] = '\0';
 
-			/* stop reading if user-forced */
-			if (maxbytes && len >= maxbytes)
+			if ((match = np_expect_feed (expect, buffer, i)) != NP_MATCH_RETRY) {
+				/* the response time is that of the answer */
+				microsec = deltime (tv);
 				break;
+			}
 
-			if ((match = np_expect_match(status,
-			    server_expect,
-			    server_expect_count,
-			    match_flags)) != NP_MATCH_RETRY)
+			/* stop reading if user-forced */
+			if (maxbytes && len >= maxbytes)
 				break;
 
 			/* some protocols wait for further input, so make sure we don't wait forever */
@@ -303,9 +427,16 @@ main (int argc, char **argv)
 			if(select(sd + 1, &rfds, NULL, NULL, &timeout) <= 0)
 				break;
 		}
+		np_timer_phase_end (NP_PHASE_TRANSFER);
 		if (match == NP_MATCH_RETRY)
 			match = NP_MATCH_FAILURE;
 
+		if (match_flags & NP_MATCH_VERBOSE)
+			for (i = 0; i < server_expect_count; i++)
+				printf ("%s [%s] %s\n", np_expect_matched (expect, i) ? "found" : "did not find",
+				        server_expect[i], (match_flags & NP_MATCH_EXACT) ? "at the start" : "in the response");
+		np_expect_free (expect);
+
 		/* no data when expected, so return critical */
 		if (len == 0)
 			die (STATE_CRITICAL, _("No data received from host\n"));
@@ -319,6 +450,17 @@ main (int argc, char **argv)
 			status[len] = '\0';
 	}
 
+	/* then the script, over the same connection */
+	if (script_send_count && match != NP_MATCH_FAILURE) {
+		if ((script_times = calloc (script_send_count, sizeof (double))) == NULL)
+			die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+		if ((script_step = run_script (script_times, &script_response)) < script_send_count)
+			match = NP_MATCH_FAILURE;
+		else
+			match = NP_MATCH_SUCCESS;
+		microsec = deltime (tv);
+	}
+
 	if (server_quit != NULL) {
 		my_send(server_quit, strlen(server_quit));
 	}
@@ -327,7 +469,8 @@ main (int argc, char **argv)
 	np_net_ssl_cleanup();
 #endif
 
-	microsec = deltime (tv);
+	if (microsec < 0)
+		microsec = deltime (tv);
 	elapsed_time = (double)microsec / 1.0e6;
 
 	if (flags & FLAG_TIME_CRIT && elapsed_time > critical_time)
@@ -347,7 +490,10 @@ main (int argc, char **argv)
 	 * the response we were looking for. if-else */
 	printf("%s %s - ", SERVICE, state_text(result));
 
-	if(match == NP_MATCH_FAILURE && len && !(flags & FLAG_HIDE_OUTPUT))
+	if (script_step < script_send_count && match == NP_MATCH_FAILURE)
+		printf (_("Unexpected response to step %d [%s]: %s"), script_step + 1, script_expect[script_step],
+		        (script_response && *script_response) ? script_response : _("No data received from host"));
+	else if(match == NP_MATCH_FAILURE && len && !(flags & FLAG_HIDE_OUTPUT))
 		printf("Unexpected response from host/socket: %s", status);
 	else {
 		if(match == NP_MATCH_FAILURE)
@@ -388,12 +534,949 @@ main (int argc, char **argv)
 				TRUE, timeout_interval)
 			);
 
+	if (match != NP_MATCH_FAILURE)
+		for (i = 0; i < script_send_count; i++) {
+			char label[32];
+
+			snprintf (label, sizeof (label), "step%d_time", i + 1);
+			printf (" %s", fperfdata (label, script_times[i], "s", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, timeout_interval));
+		}
+
+#ifdef HAVE_SSL
+	if ((flags & FLAG_SSL) && (flags & FLAG_TLS_SESSION_CACHE))
+		printf (" %s", perfdata ("tls_resumed", np_net_ssl_session_reused (), "",
+		                         FALSE, 0, FALSE, 0, TRUE, 0, TRUE, 1));
+#endif
+
+	if (flags & FLAG_TRACE_TIMING) {
+		np_perfdata pd;
+
+		np_perfdata_init (&pd);
+		np_timer_phase_perfdata (&pd, timeout_interval);
+		printf (" %s", np_perfdata_string (&pd));
+		np_perfdata_free (&pd);
+		np_timer_phase_report (stderr);
+	}
+
 	putchar('\n');
 	return result;
 }
 
 
 
+/*
+ * --script-send/--script-expect: steps run after the -s/-e exchange over
+ * the same connection. Each answer is looked for anywhere in what follows
+ * the answer before it, so the commands can all go out at once with
+ * --script-pipeline. Returns the number of steps answered, each one's time
+ * in times; response has the data of the step that was not.
+ */
+static int
+run_script (double *times, char **response)
+{
+	np_expect *expect;
+	struct timeval start;
+	char *all = NULL, *seg;
+	size_t resp_len = 0, used;
+	int step = 0, n, match;
+
+	gettimeofday (&start, NULL);
+	if (flags & FLAG_SCRIPT_PIPELINE) {
+		for (n = 0; n < script_send_count; n++)
+			xasprintf (&all, "%s%s", all ? all : "", script_send[n]);
+		if ((size_t) my_send (all, strlen (all)) < strlen (all))
+			die (STATE_UNKNOWN, "%s - %s", _("No data sent to host"), strerror (errno));
+		free (all);
+	} else if ((size_t) my_send (script_send[0], strlen (script_send[0])) < strlen (script_send[0]))
+		die (STATE_UNKNOWN, "%s - %s", _("No data sent to host"), strerror (errno));
+
+	*response = NULL;
+	expect = np_expect_new (&script_expect[0], 1, 0);
+	while (step < script_send_count) {
+		/* an answer that stops short of what is expected is taken to be
+		 * complete after READ_TIMEOUT, as for -e */
+		if (resp_len) {
+			fd_set rfds;
+			struct timeval timeout;
+
+			FD_ZERO (&rfds);
+			FD_SET (sd, &rfds);
+			timeout.tv_sec = READ_TIMEOUT;
+			timeout.tv_usec = 0;
+			if (select (sd + 1, &rfds, NULL, NULL, &timeout) <= 0)
+				break;
+		}
+		if ((n = my_recv (buffer, sizeof (buffer))) <= 0)
+			break;
+		for (seg = buffer; ; ) {
+			if ((match = np_expect_feed (expect, seg, n - (seg - buffer))) != NP_MATCH_SUCCESS) {
+				/* kept for the message, should the answer never come */
+				used = n - (seg - buffer);
+				*response = realloc (*response, resp_len + used + 1);
+				memcpy (*response + resp_len, seg, used);
+				resp_len += used;
+				(*response)[resp_len] = '\0';
+				break;
+			}
+			times[step++] = (double) deltime (start) / 1.0e6;
+			seg += np_expect_consumed (expect);
+			np_expect_free (expect);
+			expect = NULL;
+			resp_len = 0;
+			if (*response)
+				**response = '\0';
+			if (step == script_send_count)
+				break;
+
+			expect = np_expect_new (&script_expect[step], 1, 0);
+			if (!(flags & FLAG_SCRIPT_PIPELINE) &&
+			    (size_t) my_send (script_send[step], strlen (script_send[step])) < strlen (script_send[step]))
+				die (STATE_UNKNOWN, "%s - %s", _("No data sent to host"), strerror (errno));
+		}
+	}
+	np_expect_free (expect);
+
+	/* the line ending of the answer before is no part of this one */
+	if (*response) {
+		while (resp_len > 0 && isspace ((unsigned char) (*response)[resp_len - 1]))
+			(*response)[--resp_len] = '\0';
+		for (seg = *response; isspace ((unsigned char) *seg); seg++)
+			;
+		memmove (*response, seg, strlen (seg) + 1);
+	}
+	if (flags & FLAG_VERBOSE)
+		printf ("script: %d of %d steps answered\n", step, script_send_count);
+	return step;
+}
+
+
+
+#ifdef HAVE_POLL
+/*
+ * --hosts/--ports: the same check against every port of every host from
+ * one process, or against each of the --endpoints. Each endpoint is a
+ * non-blocking socket that steps through connect, TLS handshake, -D's
+ * certificate check, send and expect as poll() reports it ready; at most
+ * --concurrency endpoints are in flight at a time. -t bounds each
+ * endpoint, --deadline the whole run.
+ */
+
+enum {
+	TCP_STEP_CONNECT,
+	TCP_STEP_TLS,
+	TCP_STEP_SEND,
+	TCP_STEP_RECV,
+	TCP_STEP_DONE
+};
+
+#ifdef HAVE_SSL
+static SSL_CTX *target_ssl_ctx;
+#endif
+
+struct tcp_target {
+	char *address;
+	int port;
+	char *sni;
+	int fd;
+	int step;
+	short events;       /* what the current step waits for */
+#ifdef HAVE_SSL
+	SSL *ssl;
+#endif
+	struct timeval start;
+	size_t sent;
+	size_t received;
+	np_expect *expect;
+	int state;
+	char *msg;
+	double time;
+	char *cert_msg;     /* -D's verdict, once it has passed */
+	double days;        /* and the days the certificate has left */
+	int days_known;
+	/* UDP: where the datagram goes and the replies come from */
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int tries;
+	struct timeval sent_at;
+	int started;
+};
+
+static void
+tcp_target_done (struct tcp_target *t, int state, const char *msg)
+{
+	if (t->step != TCP_STEP_DONE && t->fd >= 0 && server_quit != NULL && msg == NULL) {
+		/* a polite close, if the socket takes it now */
+#ifdef HAVE_SSL
+		if (t->ssl)
+			SSL_write (t->ssl, server_quit, strlen (server_quit));
+		else
+#endif
+			send (t->fd, server_quit, strlen (server_quit), MSG_DONTWAIT);
+	}
+#ifdef HAVE_SSL
+	if (t->ssl) {
+		SSL_free (t->ssl);
+		t->ssl = NULL;
+	}
+#endif
+	if (t->fd >= 0)
+		close (t->fd);
+	t->fd = -1;
+	np_expect_free (t->expect);
+	t->expect = NULL;
+	t->step = TCP_STEP_DONE;
+	if (msg) {
+		t->state = state;
+		t->msg = strdup (msg);
+	}
+}
+
+/* the response time thresholds, once the endpoint has answered */
+static void
+tcp_target_answered (struct tcp_target *t, int match)
+{
+	t->time = (double) deltime (t->start) / 1.0e6;
+	if (flags & FLAG_TIME_CRIT && t->time > critical_time)
+		t->state = STATE_CRITICAL;
+	else if (flags & FLAG_TIME_WARN && t->time > warning_time)
+		t->state = STATE_WARNING;
+	else
+		t->state = STATE_OK;
+
+	if (match == NP_MATCH_FAILURE) {
+		if (t->state != STATE_CRITICAL)
+			t->state = expect_mismatch_state;
+		tcp_target_done (t, t->state, t->received ? _("Unexpected response from host/socket")
+		                                          : _("No data received from host"));
+		return;
+	}
+	if (t->cert_msg)
+		xasprintf (&t->msg, _("%s %.3f second response time"), t->cert_msg, t->time);
+	else
+		xasprintf (&t->msg, _("%.3f second response time"), t->time);
+	tcp_target_done (t, t->state, NULL);
+}
+
+#ifdef HAVE_SSL
+/* -D, straight after the handshake; an endpoint whose certificate is not
+ * OK is done, as it is without --hosts */
+static void
+tcp_target_cert (struct tcp_target *t)
+{
+	char msg[MAX_INPUT_BUFFER];
+	double days = -1e30;    /* left alone if there is no expiry to read */
+	int state;
+
+	state = np_net_ssl_cert_state (t->ssl, days_till_exp_warn, days_till_exp_crit, msg, sizeof (msg), &days);
+	if (days > -1e30) {
+		t->days = days;
+		t->days_known = TRUE;
+	}
+	if (state != STATE_OK) {
+		t->time = (double) deltime (t->start) / 1.0e6;
+		tcp_target_done (t, state, msg);
+		return;
+	}
+	t->cert_msg = strdup (msg);
+}
+
+/* --ocsp, after -D; the same, its verdict after the certificate's */
+static void
+tcp_target_ocsp (struct tcp_target *t)
+{
+	char msg[MAX_INPUT_BUFFER];
+	int state;
+
+	state = np_net_ssl_ocsp_state (t->ssl, ocsp_warn_hours, ocsp_crit_hours, msg, sizeof (msg), NULL);
+	if (state != STATE_OK) {
+		t->time = (double) deltime (t->start) / 1.0e6;
+		tcp_target_done (t, state, msg);
+		return;
+	}
+	if (t->cert_msg) {
+		xasprintf (&t->cert_msg, "%s %s", t->cert_msg, msg);
+		return;
+	}
+	t->cert_msg = strdup (msg);
+}
+#endif
+
+static void
+tcp_target_connect (struct tcp_target *t)
+{
+	struct addrinfo hints, *res;
+	char port_str[6];
+	int ret;
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = address_family;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf (port_str, sizeof (port_str), "%d", t->port);
+
+	gettimeofday (&t->start, NULL);
+	if ((ret = np_net_getaddrinfo (t->address, port_str, &hints, &res)) != 0) {
+		tcp_target_done (t, STATE_CRITICAL, gai_strerror (ret));
+		return;
+	}
+	t->fd = socket (res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (t->fd < 0 || fcntl (t->fd, F_SETFL, O_NONBLOCK) < 0 ||
+	    (connect (t->fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS)) {
+		tcp_target_done (t, errno == ECONNREFUSED ? econn_refuse_state : STATE_CRITICAL, strerror (errno));
+		return;
+	}
+	if (server_expect_count)
+		t->expect = np_expect_new (server_expect, server_expect_count, match_flags & ~NP_MATCH_VERBOSE);
+	t->step = TCP_STEP_CONNECT;
+	t->events = POLLOUT;
+}
+
+#ifdef HAVE_SSL
+/* what a non-blocking SSL call that did not finish is waiting for;
+ * 0 if it failed */
+static short
+tcp_ssl_wants (SSL *ssl, int ret)
+{
+	switch (SSL_get_error (ssl, ret)) {
+	case SSL_ERROR_WANT_READ:
+		return POLLIN;
+	case SSL_ERROR_WANT_WRITE:
+		return POLLOUT;
+	default:
+		return 0;
+	}
+}
+#endif
+
+/* move an endpoint on as far as it goes without blocking */
+static void
+tcp_target_step (struct tcp_target *t)
+{
+	char buf[MAXBUF];
+	socklen_t len;
+	size_t send_len = server_send ? strlen (server_send) : 0;
+	int err, n, match;
+#ifdef HAVE_SSL
+	int ret;
+#endif
+
+	switch (t->step) {
+	case TCP_STEP_CONNECT:
+		len = sizeof (err);
+		if (getsockopt (t->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+			err = errno;
+		if (err) {
+			tcp_target_done (t, err == ECONNREFUSED ? econn_refuse_state : STATE_CRITICAL, strerror (err));
+			return;
+		}
+#ifdef HAVE_SSL
+		if (flags & FLAG_SSL) {
+			if ((t->ssl = SSL_new (target_ssl_ctx)) == NULL) {
+				tcp_target_done (t, STATE_CRITICAL, _("Cannot initiate SSL handshake"));
+				return;
+			}
+#ifdef SSL_set_tlsext_host_name
+			SSL_set_tlsext_host_name (t->ssl, t->sni ? t->sni : server_name ? server_name : t->address);
+#endif
+			SSL_set_fd (t->ssl, t->fd);
+			np_net_ssl_ocsp_setup (t->ssl);
+			t->step = TCP_STEP_TLS;
+		}
+		else
+#endif
+			t->step = TCP_STEP_SEND;
+		t->events = POLLOUT;
+		/* FALLTHROUGH */
+
+	case TCP_STEP_TLS:
+#ifdef HAVE_SSL
+		if (t->step == TCP_STEP_TLS) {
+			if ((ret = SSL_connect (t->ssl)) != 1) {
+				if ((t->events = tcp_ssl_wants (t->ssl, ret)) == 0)
+					tcp_target_done (t, STATE_CRITICAL, _("Cannot make SSL connection"));
+				return;
+			}
+			t->step = TCP_STEP_SEND;
+			if (check_cert == TRUE) {
+				tcp_target_cert (t);
+				if (t->step == TCP_STEP_DONE)
+					return;
+			}
+			if (check_ocsp == TRUE) {
+				tcp_target_ocsp (t);
+				if (t->step == TCP_STEP_DONE)
+					return;
+			}
+		}
+#endif
+		/* FALLTHROUGH */
+
+	case TCP_STEP_SEND:
+		while (t->sent < send_len) {
+#ifdef HAVE_SSL
+			if (t->ssl) {
+				if ((n = SSL_write (t->ssl, server_send + t->sent, send_len - t->sent)) <= 0) {
+					if ((t->events = tcp_ssl_wants (t->ssl, n)) == 0)
+						tcp_target_done (t, STATE_CRITICAL, _("No data sent to host"));
+					return;
+				}
+			}
+			else
+#endif
+			if ((n = send (t->fd, server_send + t->sent, send_len - t->sent, 0)) < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+					t->events = POLLOUT;
+				else
+					tcp_target_done (t, STATE_CRITICAL, strerror (errno));
+				return;
+			}
+			t->sent += n;
+		}
+		if (server_expect_count == 0) {
+			tcp_target_answered (t, NP_MATCH_SUCCESS);
+			return;
+		}
+		t->step = TCP_STEP_RECV;
+		t->events = POLLIN;
+		/* FALLTHROUGH */
+
+	case TCP_STEP_RECV:
+		for (;;) {
+#ifdef HAVE_SSL
+			if (t->ssl) {
+				if ((n = SSL_read (t->ssl, buf, sizeof (buf))) < 0) {
+					if ((t->events = tcp_ssl_wants (t->ssl, n)) != 0)
+						return;
+					n = 0;  /* a reset ends the response */
+				}
+			}
+			else
+#endif
+			if ((n = read (t->fd, buf, sizeof (buf))) < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+					return;
+				n = 0;
+			}
+			if (n == 0) {
+				tcp_target_answered (t, NP_MATCH_FAILURE);
+				return;
+			}
+			t->received += n;
+			if ((match = np_expect_feed (t->expect, buf, n)) != NP_MATCH_RETRY ||
+			    (maxbytes && t->received >= maxbytes)) {
+				tcp_target_answered (t, match == NP_MATCH_SUCCESS ? match : NP_MATCH_FAILURE);
+				return;
+			}
+		}
+
+	default:
+		return;
+	}
+}
+
+/* the endpoints to check: each --endpoints line, or each port of each
+ * of the --hosts */
+static struct tcp_target *
+tcp_targets_new (int *count)
+{
+	struct tcp_target *targets;
+	int hosts = target_host_count ? target_host_count : 1;
+	int ports = target_port_count ? target_port_count : 1;
+	int k;
+
+	*count = endpoint_count ? endpoint_count : hosts * ports;
+	if ((targets = calloc (*count, sizeof (*targets))) == NULL)
+		die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+
+	/* port by port, so one host's ports are spread over the run */
+	for (k = 0; k < *count; k++) {
+		if (endpoint_count) {
+			targets[k].address = endpoints[k].address;
+			targets[k].port = endpoints[k].port;
+			targets[k].sni = endpoints[k].sni;
+		} else {
+			targets[k].address = target_host_count ? target_hosts[k % hosts] : server_address;
+			targets[k].port = target_port_count ? target_ports[k / hosts] : server_port;
+		}
+		targets[k].fd = -1;
+	}
+	return targets;
+}
+
+/* the first endpoint not started yet that --max-inflight lets start, and
+ * that --max-rate has a token for; -1 if none may start now */
+static int
+tcp_target_next (struct tcp_target *targets, int count, int next, struct tcp_target **active,
+                 nfds_t nactive, np_rate *rate, double now)
+{
+	nfds_t i, inflight;
+
+	for (; next < count; next++) {
+		if (targets[next].started)
+			continue;
+		for (i = inflight = 0; np_net_max_inflight && i < nactive; i++)
+			if (strcmp (active[i]->address, targets[next].address) == 0)
+				inflight++;
+		if (np_net_max_inflight == 0 || inflight < (nfds_t) np_net_max_inflight)
+			break;
+	}
+	if (next == count || !np_rate_take (rate, now))
+		return -1;
+	targets[next].started = TRUE;
+	return next;
+}
+
+/* how long to wait for --max-rate when it holds the next endpoint back,
+ * -1 if it does not */
+static int
+tcp_rate_wait (np_rate *rate, int held, double now)
+{
+	np_rate_held (rate, held, now);
+	if (!held || np_rate_delay (rate, now) == 0)
+		return -1;
+	return (int) (np_rate_delay (rate, now) * 1000) + 1;
+}
+
+/* the summary line, then a line for each endpoint, and the time the
+ * limits held them back; does not return */
+static void
+tcp_targets_report (struct tcp_target *targets, int count, np_rate *rate, struct timeval run_start)
+{
+	np_perfdata perf;
+	char *problems = NULL;
+	char label[MAX_INPUT_BUFFER], warn[16], crit[16];
+	int count_ok = 0, result = STATE_OK;
+	int k;
+
+	np_perfdata_init (&perf);
+	for (k = 0; k < count; k++) {
+		result = max_state_alt (targets[k].state, result);
+		if (targets[k].state == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s port %d%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           targets[k].address, targets[k].port, targets[k].sni ? " name " : "",
+			           targets[k].sni ? targets[k].sni : "", targets[k].msg);
+
+		if (targets[k].days_known) {
+			snprintf (label, sizeof (label), "%s:%d%s%s_days", targets[k].address, targets[k].port,
+			          targets[k].sni ? ":" : "", targets[k].sni ? targets[k].sni : "");
+			/* fewer days than these are the problem */
+			snprintf (warn, sizeof (warn), "%d:", days_till_exp_warn);
+			snprintf (crit, sizeof (crit), "%d:", days_till_exp_crit);
+			np_perfdata_adds (&perf, label, targets[k].days, "", warn, crit, FALSE, 0, FALSE, 0);
+		}
+		if (targets[k].time == 0)
+			continue;
+		snprintf (label, sizeof (label), "%s:%d%s%s_time", targets[k].address, targets[k].port,
+		          targets[k].sni ? ":" : "", targets[k].sni ? targets[k].sni : "");
+		np_perfdata_addf (&perf, label, targets[k].time, "s",
+		                  (flags & FLAG_TIME_WARN) ? TRUE : FALSE, warning_time,
+		                  (flags & FLAG_TIME_CRIT) ? TRUE : FALSE, critical_time,
+		                  TRUE, 0, TRUE, timeout_interval);
+	}
+
+	np_rate_held (rate, FALSE, deltime (run_start) / 1.0e6);
+	if (np_net_max_rate || np_net_max_inflight)
+		np_perfdata_addf (&perf, "throttled", rate->throttled, "s",
+		                  FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+
+	printf ("%s %s: %d of %d endpoints OK%s%s|%s\n", SERVICE, state_text (result), count_ok, count,
+	        problems ? " - " : "", problems ? problems : "", np_perfdata_string (&perf));
+	for (k = 0; k < count; k++)
+		printf ("[%s] %s port %d%s%s: %s\n", state_text (targets[k].state), targets[k].address,
+		        targets[k].port, targets[k].sni ? " name " : "", targets[k].sni ? targets[k].sni : "",
+		        targets[k].msg);
+
+	np_exit (result);
+}
+
+static int
+check_tcp_parallel (void)
+{
+	struct tcp_target *targets, **active;
+	struct pollfd *pfd;
+	struct timeval run_start;
+	np_rate rate;
+	nfds_t nactive = 0, i, j;
+	int next = 0, done = 0, count;
+	int wait, ms, k;
+	double now;
+
+	/* -t bounds each endpoint here, --deadline the whole run */
+	alarm (0);
+	signal (SIGPIPE, SIG_IGN);
+	gettimeofday (&run_start, NULL);
+	np_rate_init (&rate, np_net_max_rate, 1);
+
+	targets = tcp_targets_new (&count);
+	active = calloc (concurrency, sizeof (*active));
+	pfd = calloc (concurrency, sizeof (*pfd));
+	if (!active || !pfd)
+		die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+
+#ifdef HAVE_SSL
+	if ((flags & FLAG_SSL) && np_net_ssl_ctx_new (&target_ssl_ctx, 0, NULL, NULL) != STATE_OK)
+		die (STATE_CRITICAL, NULL);
+#endif
+
+	while (done < count) {
+		if (deadline && deltime (run_start) >= (long) deadline * 1000000L) {
+			/* whatever is left fails now */
+			for (i = 0; i < nactive; i++)
+				tcp_target_done (active[i], STATE_CRITICAL, _("Deadline reached"));
+			for (; next < count; next++)
+				if (!targets[next].started)
+					tcp_target_done (&targets[next], STATE_CRITICAL, _("Not checked before the deadline"));
+			break;
+		}
+
+		/* keep the pipe full, as far as the limits let it */
+		now = deltime (run_start) / 1.0e6;
+		while (nactive < (nfds_t) concurrency
+		       && (k = tcp_target_next (targets, count, next, active, nactive, &rate, now)) >= 0) {
+			tcp_target_connect (&targets[k]);
+			if (targets[k].step == TCP_STEP_DONE)
+				done++;
+			else
+				active[nactive++] = &targets[k];
+			while (next < count && targets[next].started)
+				next++;
+		}
+		wait = tcp_rate_wait (&rate, nactive < (nfds_t) concurrency && next < count, now);
+		if (nactive == 0 && wait < 0)
+			continue;
+
+		for (i = 0; i < nactive; i++) {
+			pfd[i].fd = active[i]->fd;
+			pfd[i].events = active[i]->events;
+			pfd[i].revents = 0;
+			ms = timeout_interval * 1000 - (int) (deltime (active[i]->start) / 1000);
+			if (ms < 0)
+				ms = 0;
+			if (wait < 0 || ms < wait)
+				wait = ms;
+		}
+		if (deadline) {
+			ms = deadline * 1000 - (int) (deltime (run_start) / 1000);
+			if (ms < wait)
+				wait = ms < 0 ? 0 : ms;
+		}
+
+		if (poll (pfd, nactive, wait) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, "%s %s\n", _("poll failed:"), strerror (errno));
+
+		for (i = 0; i < nactive; i++) {
+			if (pfd[i].revents)
+				tcp_target_step (active[i]);
+			else if (deltime (active[i]->start) >= (long) timeout_interval * 1000000L)
+				tcp_target_done (active[i], STATE_CRITICAL, _("Socket timeout"));
+		}
+
+		/* drop the finished ones */
+		for (i = j = 0; i < nactive; i++) {
+			if (active[i]->step == TCP_STEP_DONE)
+				done++;
+			else
+				active[j++] = active[i];
+		}
+		nactive = j;
+	}
+
+#ifdef HAVE_SSL
+	if (target_ssl_ctx) {
+		SSL_CTX_free (target_ssl_ctx);
+		target_ssl_ctx = NULL;
+	}
+#endif
+
+	tcp_targets_report (targets, count, &rate, run_start);
+	return STATE_UNKNOWN;
+}
+
+/*
+ * UDP: every endpoint is sent the -s datagram from one socket per address
+ * family, and the replies of all of them are read from those sockets in
+ * batches, each matched to its endpoint by the address it came from. An
+ * endpoint that has not answered is sent the datagram again --retries
+ * times, spread evenly over -t.
+ */
+
+#define UDP_BATCH 64
+
+static int
+udp_same_address (const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+	if (a->ss_family != b->ss_family)
+		return FALSE;
+	if (a->ss_family == AF_INET)
+		return ((const struct sockaddr_in *) a)->sin_port == ((const struct sockaddr_in *) b)->sin_port &&
+		       ((const struct sockaddr_in *) a)->sin_addr.s_addr == ((const struct sockaddr_in *) b)->sin_addr.s_addr;
+#ifdef USE_IPV6
+	if (a->ss_family == AF_INET6)
+		return ((const struct sockaddr_in6 *) a)->sin6_port == ((const struct sockaddr_in6 *) b)->sin6_port &&
+		       !memcmp (&((const struct sockaddr_in6 *) a)->sin6_addr, &((const struct sockaddr_in6 *) b)->sin6_addr,
+		                sizeof (struct in6_addr));
+#endif
+	return FALSE;
+}
+
+/* the socket for the endpoint's address family, opened on first use */
+static int
+udp_socket (int *socks, int family)
+{
+	int k = family == AF_INET ? 0 : 1;
+
+	if (socks[k] < 0 && (socks[k] = socket (family, SOCK_DGRAM, IPPROTO_UDP)) >= 0 &&
+	    fcntl (socks[k], F_SETFL, O_NONBLOCK) < 0) {
+		close (socks[k]);
+		socks[k] = -1;
+	}
+	return socks[k];
+}
+
+static void
+udp_target_send (struct tcp_target *t, int *socks)
+{
+	int fd = udp_socket (socks, t->addr.ss_family);
+
+	gettimeofday (&t->sent_at, NULL);
+	t->tries++;
+	if (fd < 0 || (sendto (fd, server_send, strlen (server_send), 0, (struct sockaddr *) &t->addr, t->addrlen) < 0 &&
+	               errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+		tcp_target_done (t, STATE_CRITICAL, strerror (errno));
+}
+
+static void
+udp_target_start (struct tcp_target *t, int *socks)
+{
+	struct addrinfo hints, *res;
+	char port_str[6];
+	int ret;
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = address_family;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+	snprintf (port_str, sizeof (port_str), "%d", t->port);
+
+	gettimeofday (&t->start, NULL);
+	if ((ret = np_net_getaddrinfo (t->address, port_str, &hints, &res)) != 0) {
+		tcp_target_done (t, STATE_CRITICAL, gai_strerror (ret));
+		return;
+	}
+	memcpy (&t->addr, res->ai_addr, res->ai_addrlen);
+	t->addrlen = res->ai_addrlen;
+	t->expect = np_expect_new (server_expect, server_expect_count, match_flags & ~NP_MATCH_VERBOSE);
+	t->step = TCP_STEP_RECV;
+	udp_target_send (t, socks);
+}
+
+/* all the datagrams waiting on fd, each given to the endpoint it is from */
+static void
+udp_receive (int fd, struct tcp_target **active, nfds_t nactive)
+{
+	static char bufs[UDP_BATCH][MAXBUF];
+	struct sockaddr_storage from[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	int n, k, match;
+	nfds_t i;
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[UDP_BATCH];
+#endif
+
+	for (;;) {
+#ifdef HAVE_RECVMMSG
+		memset (msgs, 0, sizeof (msgs));
+		for (k = 0; k < UDP_BATCH; k++) {
+			iov[k].iov_base = bufs[k];
+			iov[k].iov_len = MAXBUF;
+			msgs[k].msg_hdr.msg_iov = &iov[k];
+			msgs[k].msg_hdr.msg_iovlen = 1;
+			msgs[k].msg_hdr.msg_name = &from[k];
+			msgs[k].msg_hdr.msg_namelen = sizeof (from[k]);
+		}
+		if ((n = recvmmsg (fd, msgs, UDP_BATCH, MSG_DONTWAIT, NULL)) <= 0)
+			return;
+		for (k = 0; k < n; k++)
+			iov[k].iov_len = msgs[k].msg_len;
+#else
+		socklen_t fromlen = sizeof (from[0]);
+		ssize_t len;
+
+		iov[0].iov_base = bufs[0];
+		if ((len = recvfrom (fd, bufs[0], MAXBUF, MSG_DONTWAIT, (struct sockaddr *) &from[0], &fromlen)) < 0)
+			return;
+		iov[0].iov_len = len;
+		n = 1;
+#endif
+		for (k = 0; k < n; k++) {
+			/* the first endpoint still waiting at that address; replies
+			 * from anywhere else and late ones are dropped */
+			for (i = 0; i < nactive; i++)
+				if (active[i]->step == TCP_STEP_RECV && udp_same_address (&active[i]->addr, &from[k]))
+					break;
+			if (i == nactive)
+				continue;
+			active[i]->received += iov[k].iov_len;
+			match = np_expect_feed (active[i]->expect, iov[k].iov_base, iov[k].iov_len);
+			/* a datagram is the whole answer */
+			tcp_target_answered (active[i], match == NP_MATCH_SUCCESS ? match : NP_MATCH_FAILURE);
+		}
+	}
+}
+
+static int
+check_udp_parallel (void)
+{
+	struct tcp_target *targets, **active;
+	struct pollfd pfd[2];
+	struct timeval run_start;
+	nfds_t nactive = 0, i, j, nfds;
+	long interval = (long) timeout_interval * 1000000L / (udp_retries + 1);
+	int socks[2] = { -1, -1 };
+	int next = 0, done = 0, count;
+	int wait, ms, k;
+	np_rate rate;
+	double now;
+
+	/* -t bounds each endpoint here, --deadline the whole run */
+	alarm (0);
+	gettimeofday (&run_start, NULL);
+	np_rate_init (&rate, np_net_max_rate, 1);
+
+	targets = tcp_targets_new (&count);
+	if ((active = calloc (concurrency, sizeof (*active))) == NULL)
+		die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+
+	while (done < count) {
+		if (deadline && deltime (run_start) >= (long) deadline * 1000000L) {
+			for (i = 0; i < nactive; i++)
+				tcp_target_done (active[i], STATE_CRITICAL, _("Deadline reached"));
+			for (; next < count; next++)
+				if (!targets[next].started)
+					tcp_target_done (&targets[next], STATE_CRITICAL, _("Not checked before the deadline"));
+			break;
+		}
+
+		now = deltime (run_start) / 1.0e6;
+		while (nactive < (nfds_t) concurrency
+		       && (k = tcp_target_next (targets, count, next, active, nactive, &rate, now)) >= 0) {
+			udp_target_start (&targets[k], socks);
+			if (targets[k].step == TCP_STEP_DONE)
+				done++;
+			else
+				active[nactive++] = &targets[k];
+			while (next < count && targets[next].started)
+				next++;
+		}
+		wait = tcp_rate_wait (&rate, nactive < (nfds_t) concurrency && next < count, now);
+		if (nactive == 0 && wait < 0)
+			continue;
+
+		/* until the next retry or timeout, or the next token */
+		for (i = 0; i < nactive; i++) {
+			ms = timeout_interval * 1000 - (int) (deltime (active[i]->start) / 1000);
+			if (active[i]->tries <= udp_retries && (int) ((interval - deltime (active[i]->sent_at)) / 1000) < ms)
+				ms = (int) ((interval - deltime (active[i]->sent_at)) / 1000);
+			if (ms < 0)
+				ms = 0;
+			if (wait < 0 || ms < wait)
+				wait = ms;
+		}
+		if (deadline) {
+			ms = deadline * 1000 - (int) (deltime (run_start) / 1000);
+			if (ms < wait)
+				wait = ms < 0 ? 0 : ms;
+		}
+
+		for (k = 0, nfds = 0; k < 2; k++)
+			if (socks[k] >= 0) {
+				pfd[nfds].fd = socks[k];
+				pfd[nfds].events = POLLIN;
+				pfd[nfds++].revents = 0;
+			}
+		if (poll (pfd, nfds, wait) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, "%s %s\n", _("poll failed:"), strerror (errno));
+		for (i = 0; i < nfds; i++)
+			if (pfd[i].revents)
+				udp_receive (pfd[i].fd, active, nactive);
+
+		for (i = 0; i < nactive; i++) {
+			if (active[i]->step == TCP_STEP_DONE)
+				continue;
+			if (deltime (active[i]->start) >= (long) timeout_interval * 1000000L)
+				tcp_target_done (active[i], STATE_CRITICAL, _("No data received from host"));
+			else if (active[i]->tries <= udp_retries && deltime (active[i]->sent_at) >= interval)
+				udp_target_send (active[i], socks);
+		}
+
+		for (i = j = 0; i < nactive; i++) {
+			if (active[i]->step == TCP_STEP_DONE)
+				done++;
+			else
+				active[j++] = active[i];
+		}
+		nactive = j;
+	}
+
+	for (k = 0; k < 2; k++)
+		if (socks[k] >= 0)
+			close (socks[k]);
+	tcp_targets_report (targets, count, &rate, run_start);
+	return STATE_UNKNOWN;
+}
+#endif /* HAVE_POLL */
+
+
+
+/* --endpoints: one host:port[:name] a line, [address]:port[:name] for an
+ * IPv6 address; - reads them from stdin */
+static void
+add_endpoints (const char *file)
+{
+	FILE *fp;
+	char line[MAX_INPUT_BUFFER], *host, *port, *sni, *p;
+	int lineno = 0;
+
+	if (strcmp (file, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen (file, "r")) == NULL)
+		die (STATE_UNKNOWN, _("Cannot open %s: %s\n"), file, strerror (errno));
+
+	while (fgets (line, sizeof (line), fp) != NULL) {
+		lineno++;
+		line[strcspn (line, "\r\n")] = '\0';
+		for (host = line; isspace ((unsigned char) *host); host++)
+			;
+		if (*host == '\0' || *host == '#')
+			continue;
+		if (*host == '[' && (p = strchr (host, ']')) != NULL) {
+			*p++ = '\0';
+			host++;
+		} else
+			p = host;
+		if ((port = strchr (p, ':')) == NULL)
+			die (STATE_UNKNOWN, _("%s line %d: Port missing\n"), file, lineno);
+		*port++ = '\0';
+		if ((sni = strchr (port, ':')) != NULL)
+			*sni++ = '\0';
+		if (!is_intpos (port) || atoi (port) > 65535)
+			usage2 (_("Port must be a positive integer"), port);
+
+		endpoints = realloc (endpoints, sizeof (*endpoints) * (endpoint_count + 1));
+		if (endpoints == NULL)
+			die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+		endpoints[endpoint_count].address = strdup (host);
+		endpoints[endpoint_count].port = atoi (port);
+		endpoints[endpoint_count].sni = sni && *sni ? strdup (sni) : NULL;
+		endpoint_count++;
+	}
+	if (fp != stdin)
+		fclose (fp);
+}
+
+
+
 /* process command-line arguments */
 static int
 process_arguments (int argc, char **argv)
@@ -402,6 +1485,27 @@ process_arguments (int argc, char **argv)
 	int escape = 0;
 	char *temp;
 
+	enum {
+		TRACE_TIMING_OPTION = CHAR_MAX + 1,
+		TLS_SESSION_CACHE_OPTION,
+		TLS_FULL_HANDSHAKE_OPTION,
+		OCSP_OPTION,
+		OCSP_FETCH_OPTION,
+		HOSTS_OPTION,
+		PORTS_OPTION,
+		CONCURRENCY_OPTION,
+		DEADLINE_OPTION,
+		TCP_FASTOPEN_OPTION,
+		ENDPOINTS_OPTION,
+		RETRIES_OPTION,
+		SCRIPT_SEND_OPTION,
+		SCRIPT_EXPECT_OPTION,
+		SCRIPT_PIPELINE_OPTION,
+		ADAPTIVE_TIMEOUT_OPTION,
+		MAX_RATE_OPTION,
+		MAX_INFLIGHT_OPTION
+	};
+
 	int option = 0;
 	static struct option longopts[] = {
 		{"hostname", required_argument, 0, 'H'},
@@ -429,6 +1533,24 @@ process_arguments (int argc, char **argv)
 		{"help", no_argument, 0, 'h'},
 		{"ssl", no_argument, 0, 'S'},
 		{"certificate", required_argument, 0, 'D'},
+		{"trace-timing", no_argument, 0, TRACE_TIMING_OPTION},
+		{"tls-session-cache", no_argument, 0, TLS_SESSION_CACHE_OPTION},
+		{"tls-full-handshake", no_argument, 0, TLS_FULL_HANDSHAKE_OPTION},
+		{"ocsp", optional_argument, 0, OCSP_OPTION},
+		{"ocsp-fetch", no_argument, 0, OCSP_FETCH_OPTION},
+		{"hosts", required_argument, 0, HOSTS_OPTION},
+		{"ports", required_argument, 0, PORTS_OPTION},
+		{"concurrency", required_argument, 0, CONCURRENCY_OPTION},
+		{"deadline", required_argument, 0, DEADLINE_OPTION},
+		{"tcp-fastopen", no_argument, 0, TCP_FASTOPEN_OPTION},
+		{"adaptive-timeout", no_argument, 0, ADAPTIVE_TIMEOUT_OPTION},
+		{"max-rate", required_argument, 0, MAX_RATE_OPTION},
+		{"max-inflight", required_argument, 0, MAX_INFLIGHT_OPTION},
+		{"endpoints", required_argument, 0, ENDPOINTS_OPTION},
+		{"retries", required_argument, 0, RETRIES_OPTION},
+		{"script-send", required_argument, 0, SCRIPT_SEND_OPTION},
+		{"script-expect", required_argument, 0, SCRIPT_EXPECT_OPTION},
+		{"script-pipeline", no_argument, 0, SCRIPT_PIPELINE_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -464,13 +1586,14 @@ process_arguments (int argc, char **argv)
 			usage5 ();
 		case 'h':                 /* help */
 			print_help ();
-			exit (STATE_OK);
+			np_exit (STATE_OK);
 		case 'V':                 /* version */
 			print_revision (progname, NP_VERSION);
-			exit (STATE_OK);
+			np_exit (STATE_OK);
 		case 'v':                 /* verbose mode */
 			flags |= FLAG_VERBOSE;
 			match_flags |= NP_MATCH_VERBOSE;
+			np_net_verbose = TRUE;
 			break;
 		case '4':
 			address_family = AF_INET;
@@ -607,6 +1730,104 @@ process_arguments (int argc, char **argv)
 		case 'N':                 /* Server Name Indication */
 			server_name = optarg;
 			break;
+		case TRACE_TIMING_OPTION:
+			flags |= FLAG_TRACE_TIMING;
+			break;
+		case TLS_SESSION_CACHE_OPTION:
+			flags |= FLAG_TLS_SESSION_CACHE;
+			break;
+		case TLS_FULL_HANDSHAKE_OPTION:
+			flags |= FLAG_TLS_FULL_HANDSHAKE;
+			break;
+		case OCSP_OPTION: /* the OCSP status of the certificate */
+		case OCSP_FETCH_OPTION:
+#ifdef HAVE_SSL
+			if (c == OCSP_FETCH_OPTION)
+				ocsp_fetch = TRUE;
+			else if (optarg) {
+				if ((temp = strchr (optarg, ',')) != NULL)
+					*temp++ = '\0';
+				if (!is_intnonneg (optarg) || (temp && !is_intnonneg (temp)))
+					usage2 (_("Invalid OCSP next update period"), optarg);
+				ocsp_warn_hours = atoi (optarg);
+				ocsp_crit_hours = temp ? atoi (temp) : 0;
+			}
+			check_ocsp = TRUE;
+			flags |= FLAG_SSL;
+#else
+			die (STATE_UNKNOWN, _("Invalid option - SSL is not available"));
+#endif
+			break;
+		case HOSTS_OPTION: /* comma separated, may be repeated */
+			for (temp = strtok (strdup (optarg), ","); temp != NULL; temp = strtok (NULL, ",")) {
+				target_hosts = realloc (target_hosts, sizeof (char *) * (target_host_count + 1));
+				if (target_hosts == NULL)
+					die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+				target_hosts[target_host_count++] = temp;
+			}
+			break;
+		case PORTS_OPTION: /* comma separated, may be repeated */
+			for (temp = strtok (strdup (optarg), ","); temp != NULL; temp = strtok (NULL, ",")) {
+				if (!is_intpos (temp) || atoi (temp) > 65535)
+					usage2 (_("Port must be a positive integer"), temp);
+				target_ports = realloc (target_ports, sizeof (int) * (target_port_count + 1));
+				if (target_ports == NULL)
+					die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+				target_ports[target_port_count++] = atoi (temp);
+			}
+			break;
+		case CONCURRENCY_OPTION:
+			if (!is_intpos (optarg))
+				usage2 (_("Concurrency must be a positive integer"), optarg);
+			concurrency = atoi (optarg);
+			break;
+		case DEADLINE_OPTION:
+			if (!is_intpos (optarg))
+				usage2 (_("Deadline must be a positive integer"), optarg);
+			deadline = atoi (optarg);
+			break;
+		case TCP_FASTOPEN_OPTION:
+			np_net_fastopen = TRUE;
+			break;
+		case ADAPTIVE_TIMEOUT_OPTION:
+			np_net_adaptive = TRUE;
+			break;
+		case MAX_RATE_OPTION:
+			if (!is_positive (optarg))
+				usage2 (_("Rate must be a positive number"), optarg);
+			np_net_max_rate = strtod (optarg, NULL);
+			break;
+		case MAX_INFLIGHT_OPTION:
+			if (!is_intpos (optarg))
+				usage2 (_("Inflight limit must be a positive integer"), optarg);
+			np_net_max_inflight = atoi (optarg);
+			break;
+		case ENDPOINTS_OPTION:
+			add_endpoints (optarg);
+			break;
+		case RETRIES_OPTION:
+			if (!is_intnonneg (optarg))
+				usage2 (_("Retries must be a non-negative integer"), optarg);
+			udp_retries = atoi (optarg);
+			break;
+		case SCRIPT_SEND_OPTION: /* a line, unless -E came first */
+			script_send = realloc (script_send, sizeof (char *) * (script_send_count + 1));
+			if (script_send == NULL)
+				die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+			if (escape)
+				script_send[script_send_count++] = np_escaped_string (optarg);
+			else
+				xasprintf (&script_send[script_send_count++], "%s\r\n", optarg);
+			break;
+		case SCRIPT_EXPECT_OPTION:
+			script_expect = realloc (script_expect, sizeof (char *) * (script_expect_count + 1));
+			if (script_expect == NULL)
+				die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+			script_expect[script_expect_count++] = escape ? np_escaped_string (optarg) : optarg;
+			break;
+		case SCRIPT_PIPELINE_OPTION:
+			flags |= FLAG_SCRIPT_PIPELINE;
+			break;
 		}
 	}
 
@@ -614,6 +1835,41 @@ process_arguments (int argc, char **argv)
 	if(host_specified == FALSE && c < argc)
 		server_address = strdup (argv[c++]);
 
+	/* it only helps if there is something to send right away */
+	if (server_send == NULL || PROTOCOL != IPPROTO_TCP)
+		np_net_fastopen = FALSE;
+
+	if (script_send_count != script_expect_count)
+		usage4 (_("Each --script-send needs a --script-expect"));
+	if (script_send_count && (PROTOCOL != IPPROTO_TCP || target_host_count || target_port_count || endpoint_count))
+		usage4 (_("A script can only be run over a single TCP connection"));
+
+#ifdef HAVE_SSL
+	np_net_ssl_ocsp (check_ocsp, ocsp_fetch);
+#endif
+	if (endpoint_count && (target_host_count || target_port_count))
+		usage4 (_("--endpoints cannot be used with --hosts or --ports"));
+	if (target_host_count || target_port_count || endpoint_count) {
+#ifndef HAVE_POLL
+		usage4 (_("--hosts and --ports are not supported on this system"));
+#endif
+		if (PROTOCOL == IPPROTO_UDP && (flags & FLAG_SSL))
+			usage4 (_("SSL cannot be used with UDP"));
+		if (delay)
+			usage4 (_("--delay cannot be used with --hosts or --ports"));
+#ifdef HAVE_SSL
+		if (flags & (FLAG_TLS_SESSION_CACHE | FLAG_TLS_FULL_HANDSHAKE))
+			usage4 (_("The TLS session cache cannot be used with --hosts or --ports"));
+#endif
+		if (endpoint_count)
+			return TRUE;
+		if (target_port_count == 0 && server_port <= 0)
+			usage4 (_("You must provide a port"));
+		if (target_host_count == 0 && server_address[0] == '/')
+			usage4 (_("--ports cannot be used with a socket"));
+		return TRUE;
+	}
+
 	if (server_address == NULL)
 		usage4 (_("You must provide a server address"));
 	else if (server_address[0] != '/' && is_host (server_address) == FALSE)
@@ -671,12 +1927,64 @@ print_help (void)
   printf ("    %s\n", _("1st is #days for warning, 2nd is critical (if not specified - 0)."));
   printf (" %s\n", "-S, --ssl");
   printf ("    %s\n", _("Use SSL for the connection."));
+  printf (" %s\n", "--tls-session-cache");
+  printf ("    %s\n", _("Resume TLS sessions from a cache kept in the state directory, and report"));
+  printf ("    %s\n", _("whether the session was resumed as the tls_resumed perfdata."));
+  printf (" %s\n", "--tls-full-handshake");
+  printf ("    %s\n", _("Do not resume a cached session, but cache the new one"));
+  printf (" %s\n", "--ocsp[=WARN_HOURS[,CRIT_HOURS]]");
+  printf ("    %s\n", _("Ask for the OCSP status of the certificate to be stapled to the handshake,"));
+  printf ("    %s\n", _("and check it like -D: CRITICAL if it is revoked, unknown or cannot be"));
+  printf ("    %s\n", _("verified, and WARNING or CRITICAL when its next update is no more than the"));
+  printf ("    %s\n", _("given hours away (default: 24,4). Nothing stapled is a WARNING."));
+  printf (" %s\n", "--ocsp-fetch");
+  printf ("    %s\n", _("With nothing stapled, ask the certificate's OCSP responder instead, keeping"));
+  printf ("    %s\n", _("its answer in the state directory until its next update. Implies --ocsp."));
+#endif
+#ifdef HAVE_POLL
+  printf (" %s\n", "--hosts=ADDRESS[,ADDRESS...]");
+  printf ("    %s\n", _("Check each of these hosts, concurrently (may be repeated)"));
+  printf (" %s\n", "--ports=PORT[,PORT...]");
+  printf ("    %s\n", _("Check each of these ports on each host (may be repeated)"));
+  printf (" %s\n", "--endpoints=FILE");
+  printf ("    %s\n", _("Check each host:port[:name] line of FILE (- for stdin), concurrently; name"));
+  printf ("    %s\n", _("is sent as the SNI. With -D, an endpoint is done once its certificate is"));
+  printf ("    %s\n", _("checked unless -s or -e give it more to do"));
+  printf (" %s\n", "--concurrency=INTEGER");
+  printf ("    %s\n", _("The most endpoints checked at once with --hosts, --ports or --endpoints"));
+  printf ("    %s\n", _("(default: 64)"));
+  printf (UT_MAX_RATE, _("endpoints"));
+  printf (UT_MAX_INFLIGHT, _("endpoints"));
+  printf (" %s\n", "--retries=INTEGER");
+  printf ("    %s\n", _("With UDP, send the datagram again this many times to an endpoint that has"));
+  printf ("    %s\n", _("not answered, spread over -t (default: 0). UDP endpoints are all sent to"));
+  printf ("    %s\n", _("and read from through one socket"));
+  printf (" %s\n", "--deadline=INTEGER");
+  printf ("    %s\n", _("Seconds for all the endpoints together; -t applies to each. Endpoints not"));
+  printf ("    %s\n", _("done by then are CRITICAL (default: no deadline)"));
 #endif
 
+  printf (" %s\n", "--script-send=STRING");
+  printf ("    %s\n", _("A command to send after the -s/-e exchange, followed by CRLF unless -E was"));
+  printf ("    %s\n", _("given first (may be repeated)"));
+  printf (" %s\n", "--script-expect=STRING");
+  printf ("    %s\n", _("What the answer to the matching --script-send must contain; each answer is"));
+  printf ("    %s\n", _("looked for after the one before it (may be repeated)"));
+  printf (" %s\n", "--script-pipeline");
+  printf ("    %s\n", _("Send all the script's commands at once, for protocols that allow it"));
+
 	printf (UT_WARN_CRIT);
 
 	printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
+	printf (UT_TCP_FASTOPEN);
+	printf ("    %s\n", _("(only with -s)"));
+
+	printf (UT_ADAPTIVE_TIMEOUT);
+	printf ("    %s\n", _("(not with --hosts, --ports or --endpoints)"));
+
+	printf (UT_TRACE_TIMING);
+
 	printf (UT_VERBOSE);
 
 	printf (UT_SUPPORT);
@@ -691,5 +1999,11 @@ print_usage (void)
   printf ("[-e <expect string>] [-q <quit string>][-m <maximum bytes>] [-d <delay>]\n");
   printf ("[-t <timeout seconds>] [-r <refuse state>] [-M <mismatch state>] [-v] [-4|-6] [-j]\n");
   printf ("[-D <warn days cert expire>[,<crit days cert expire>]] [-S <use SSL>] [-E]\n");
-  printf ("[-N <server name indication>]\n");
+  printf ("[-N <server name indication>] [--trace-timing]\n");
+  printf ("[--tls-session-cache] [--tls-full-handshake] [--tcp-fastopen] [--adaptive-timeout]\n");
+  printf ("[--ocsp[=<warn hours>[,<crit hours>]]] [--ocsp-fetch]\n");
+  printf ("[--hosts <host>[,<host>...]] [--ports <port>[,<port>...]] [--endpoints <file>]\n");
+  printf ("[--concurrency <n>] [--retries <n>] [--deadline <seconds>]\n");
+  printf ("[--max-rate <rate>] [--max-inflight <n>]\n");
+  printf ("[--script-send <string> --script-expect <string>...] [--script-pipeline]\n");
 }
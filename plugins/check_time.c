@@ -11,6 +11,7 @@
 * 
 * This plugin will check the time difference with the specified host.
 * 
+* With several hosts, they are all asked at once and each gets a line.
 * 
 * This program is free software: you can redistribute it and/or modify
 * it under the terms of the GNU General Public License as published by
@@ -36,6 +37,8 @@ const char *email = "devel@nagios-plugins.org";
 #include "netutils.h"
 #include "utils.h"
 
+#include <fcntl.h>
+
 enum {
 	TIME_PORT = 37
 };
@@ -54,11 +57,15 @@ unsigned long critical_diff = 0;
 int check_critical_diff = FALSE;
 int server_port = TIME_PORT;
 char *server_address = NULL;
+char **server_list = NULL;
+int server_count = 0;
 int use_udp = FALSE;
 
 int process_arguments (int, char **);
 void print_help (void);
 void print_usage (void);
+static int time_fail_state (void);
+static int check_servers (void);
 
 int
 main (int argc, char **argv)
@@ -67,10 +74,6 @@ main (int argc, char **argv)
 	int result = STATE_UNKNOWN;
 	time_t conntime;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
 
@@ -84,6 +87,9 @@ main (int argc, char **argv)
 	alarm (timeout_interval);
 	time (&start_time);
 
+	if (server_count > 1)
+		return check_servers ();
+
 	/* try to connect to the host at the given port number */
 	if (use_udp) {
 		result = my_udp_connect (server_address, server_port, &sd);
@@ -92,12 +98,7 @@ main (int argc, char **argv)
 	}
 
 	if (result != STATE_OK) {
-		if (check_critical_time == TRUE)
-			result = STATE_CRITICAL;
-		else if (check_warning_time == TRUE)
-			result = STATE_WARNING;
-		else
-			result = STATE_UNKNOWN;
+		result = time_fail_state ();
 		die (result,
 		           _("TIME UNKNOWN - could not connect to server %s, port %d\n"),
 		           server_address, server_port);
@@ -105,12 +106,7 @@ main (int argc, char **argv)
 
 	if (use_udp) {
 		if (send (sd, "", 0, 0) < 0) {
-			if (check_critical_time == TRUE)
-				result = STATE_CRITICAL;
-			else if (check_warning_time == TRUE)
-				result = STATE_WARNING;
-			else
-				result = STATE_UNKNOWN;
+			result = time_fail_state ();
 			die (result,
 			  _("TIME UNKNOWN - could not send UDP request to server %s, port %d\n"),
 			  server_address, server_port);
@@ -129,12 +125,7 @@ main (int argc, char **argv)
 
 	/* return a WARNING status if we couldn't read any data */
 	if (result <= 0) {
-		if (check_critical_time == TRUE)
-			result = STATE_CRITICAL;
-		else if (check_warning_time == TRUE)
-			result = STATE_WARNING;
-		else
-			result = STATE_UNKNOWN;
+		result = time_fail_state ();
 		die (result,
 							 _("TIME UNKNOWN - no data received from server %s, port %d\n"),
 							 server_address, server_port);
@@ -181,12 +172,313 @@ main (int argc, char **argv)
 }
 
 
+/* what a server that cannot be asked is, by the connect thresholds */
+static int
+time_fail_state (void)
+{
+	if (check_critical_time == TRUE)
+		return STATE_CRITICAL;
+	else if (check_warning_time == TRUE)
+		return STATE_WARNING;
+	return STATE_UNKNOWN;
+}
+
+
+/*
+ * Several hosts: over UDP every one is asked from one socket per address
+ * family, its answer told apart by its source address and timed by the
+ * kernel as it arrived; over TCP they are all connected to at once. One
+ * poll loop takes the answers as they come.
+ */
+enum {
+	TIME_STEP_CONNECT,
+	TIME_STEP_READ,
+	TIME_STEP_DONE
+};
+
+struct time_server {
+	const char *name;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int fd;			/* its connection, or the socket of its family */
+	int step;
+	unsigned char buf[4];	/* the 32 bit time, network byte order */
+	size_t got;
+	struct timeval sent;
+	struct timeval received;
+	int state;
+	char *msg;
+	double time;		/* seconds from the request to the answer */
+	unsigned long diff;
+	int answered;
+};
+
+static void
+time_server_done (struct time_server *s, int state, const char *msg)
+{
+	if (!use_udp && s->fd >= 0)
+		close (s->fd);
+	s->fd = -1;
+	s->step = TIME_STEP_DONE;
+	if (msg) {
+		s->state = state;
+		s->msg = strdup (msg);
+	}
+}
+
+/* the time is in: held to the thresholds as with one host */
+static void
+time_server_answered (struct time_server *s)
+{
+	uint32_t raw;
+	unsigned long now = (unsigned long) s->received.tv_sec;
+
+	s->answered = TRUE;
+	s->time = (s->received.tv_sec - s->sent.tv_sec) + (s->received.tv_usec - s->sent.tv_usec) / 1.0e6;
+	s->state = STATE_OK;
+	if (check_critical_time == TRUE && s->time > critical_time)
+		s->state = STATE_CRITICAL;
+	else if (check_warning_time == TRUE && s->time > warning_time)
+		s->state = STATE_WARNING;
+	if (s->state != STATE_OK) {
+		xasprintf (&s->msg, _("%.3f second response time"), s->time);
+		time_server_done (s, s->state, NULL);
+		return;
+	}
+
+	memcpy (&raw, s->buf, sizeof (raw));
+	server_time = ntohl (raw) - UNIX_EPOCH;
+	s->diff = server_time > now ? server_time - now : now - server_time;
+	if (check_critical_diff == TRUE && s->diff > critical_diff)
+		s->state = STATE_CRITICAL;
+	else if (check_warning_diff == TRUE && s->diff > warning_diff)
+		s->state = STATE_WARNING;
+	xasprintf (&s->msg, _("%lu second time difference"), s->diff);
+	time_server_done (s, s->state, NULL);
+}
+
+/* a TCP connection on as far as it goes without blocking */
+static void
+time_server_step (struct time_server *s)
+{
+	socklen_t len;
+	ssize_t n;
+	int err;
+
+	switch (s->step) {
+	case TIME_STEP_CONNECT:
+		len = sizeof (err);
+		if (getsockopt (s->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+			err = errno;
+		if (err) {
+			time_server_done (s, time_fail_state (), strerror (err));
+			return;
+		}
+		s->step = TIME_STEP_READ;
+		/* FALLTHROUGH */
+
+	case TIME_STEP_READ:
+		while (s->got < sizeof (s->buf)) {
+			if ((n = read (s->fd, s->buf + s->got, sizeof (s->buf) - s->got)) < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+					return;
+				n = 0;
+			}
+			if (n == 0) {
+				time_server_done (s, time_fail_state (), _("No data received from server"));
+				return;
+			}
+			s->got += n;
+		}
+		gettimeofday (&s->received, NULL);
+		time_server_answered (s);
+		return;
+
+	default:
+		return;
+	}
+}
+
+/* the answer to a UDP request that has arrived on sd, if it is to one */
+static void
+time_udp_read (struct time_server *servers, int count, int sd)
+{
+	struct sockaddr_storage from;
+	socklen_t fromlen;
+	struct timeval when;
+	unsigned char buf[MAX_INPUT_BUFFER];
+	ssize_t got;
+	int i;
+
+	for (;;) {
+		fromlen = sizeof (from);
+		got = np_net_recvfrom_time (sd, buf, sizeof (buf), MSG_DONTWAIT,
+		                            (struct sockaddr *) &from, &fromlen, &when);
+		if (got < 0)
+			return;
+		for (i = 0; i < count; i++)
+			if (servers[i].step == TIME_STEP_READ && servers[i].addrlen == fromlen &&
+			    !memcmp (&servers[i].addr, &from, fromlen))
+				break;
+		if (i == count || got < (ssize_t) sizeof (servers[i].buf))
+			continue;
+		memcpy (servers[i].buf, buf, sizeof (servers[i].buf));
+		servers[i].received = when;
+		time_server_answered (&servers[i]);
+	}
+}
+
+static int
+check_servers (void)
+{
+	struct time_server *servers;
+	struct addrinfo hints, *res;
+	struct pollfd *pfd;
+	struct time_server **active;
+	np_perfdata perf;
+	char port_str[6], label[MAX_INPUT_BUFFER], *problems = NULL;
+	int sd[2] = { -1, -1 };
+	int i, h, n, ret, wait, count_ok = 0, result = STATE_OK;
+	int64_t deadline;
+
+	servers = calloc (server_count, sizeof (*servers));
+	pfd = calloc (server_count + 2, sizeof (*pfd));
+	active = calloc (server_count, sizeof (*active));
+	if (servers == NULL || pfd == NULL || active == NULL)
+		die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = address_family;
+	hints.ai_socktype = use_udp ? SOCK_DGRAM : SOCK_STREAM;
+	snprintf (port_str, sizeof (port_str), "%d", server_port);
+
+	deadline = np_net_deadline (0);
+	for (i = 0; i < server_count; i++) {
+		servers[i].name = server_list[i];
+		servers[i].fd = -1;
+		if ((ret = np_net_getaddrinfo (server_list[i], port_str, &hints, &res)) != 0) {
+			time_server_done (&servers[i], time_fail_state (), gai_strerror (ret));
+			continue;
+		}
+		memcpy (&servers[i].addr, res->ai_addr, res->ai_addrlen);
+		servers[i].addrlen = res->ai_addrlen;
+		h = res->ai_family == AF_INET6;
+
+		if (use_udp) {
+			if (sd[h] == -1) {
+				sd[h] = socket (res->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+				if (sd[h] >= 0)
+					np_net_timestamps (sd[h]);
+			}
+			servers[i].fd = sd[h];
+		}
+		else
+			servers[i].fd = socket (res->ai_family, SOCK_STREAM, IPPROTO_TCP);
+
+		gettimeofday (&servers[i].sent, NULL);
+		if (servers[i].fd < 0) {
+			time_server_done (&servers[i], time_fail_state (), strerror (errno));
+		}
+		else if (use_udp) {
+			/* any datagram asks for the time, an empty one too */
+			if (sendto (servers[i].fd, "", 0, 0, (struct sockaddr *) &servers[i].addr,
+			            servers[i].addrlen) < 0)
+				time_server_done (&servers[i], time_fail_state (), strerror (errno));
+			else
+				servers[i].step = TIME_STEP_READ;
+		}
+		else if (fcntl (servers[i].fd, F_SETFL, O_NONBLOCK) < 0 ||
+		         (connect (servers[i].fd, (struct sockaddr *) &servers[i].addr,
+		                   servers[i].addrlen) < 0 && errno != EINPROGRESS)) {
+			time_server_done (&servers[i], time_fail_state (), strerror (errno));
+		}
+		else
+			servers[i].step = TIME_STEP_CONNECT;
+	}
+
+	for (;;) {
+		n = 0;
+		if (use_udp) {
+			for (i = 0; i < server_count && servers[i].step == TIME_STEP_DONE; i++)
+				;
+			for (h = 0; i < server_count && h < 2; h++) {
+				if (sd[h] < 0)
+					continue;
+				pfd[n].fd = sd[h];
+				pfd[n].events = POLLIN;
+				pfd[n++].revents = 0;
+			}
+		}
+		else {
+			for (i = 0; i < server_count; i++) {
+				if (servers[i].step == TIME_STEP_DONE)
+					continue;
+				pfd[n].fd = servers[i].fd;
+				pfd[n].events = servers[i].step == TIME_STEP_CONNECT ? POLLOUT : POLLIN;
+				pfd[n].revents = 0;
+				active[n++] = &servers[i];
+			}
+		}
+		if (n == 0)
+			break;
+		if ((wait = np_net_time_left (deadline)) == 0) {
+			for (i = 0; i < server_count; i++)
+				if (servers[i].step != TIME_STEP_DONE)
+					time_server_done (&servers[i], time_fail_state (), _("No data received from server"));
+			break;
+		}
+		if (poll (pfd, n, wait) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, "%s %s\n", _("poll failed:"), strerror (errno));
+		for (i = 0; i < n; i++) {
+			if (!pfd[i].revents)
+				continue;
+			if (use_udp)
+				time_udp_read (servers, server_count, pfd[i].fd);
+			else
+				time_server_step (active[i]);
+		}
+	}
+	for (h = 0; h < 2; h++)
+		if (sd[h] >= 0)
+			close (sd[h]);
+	alarm (0);
+
+	np_perfdata_init (&perf);
+	for (i = 0; i < server_count; i++) {
+		result = max_state_alt (result, servers[i].state);
+		if (servers[i].state == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           servers[i].name, servers[i].msg);
+		if (!servers[i].answered)
+			continue;
+		snprintf (label, sizeof (label), "%s_time", servers[i].name);
+		np_perfdata_addf (&perf, label, servers[i].time, "s",
+		                  check_warning_time, warning_time, check_critical_time, critical_time,
+		                  TRUE, 0, FALSE, 0);
+		snprintf (label, sizeof (label), "%s_offset", servers[i].name);
+		np_perfdata_add (&perf, label, (long) servers[i].diff, "s",
+		                 check_warning_diff, (long) warning_diff, check_critical_diff, (long) critical_diff,
+		                 TRUE, 0, FALSE, 0);
+	}
+
+	printf ("TIME %s: %d of %d hosts OK%s%s|%s\n", state_text (result), count_ok, server_count,
+	        problems ? " - " : "", problems ? problems : "", np_perfdata_string (&perf));
+	for (i = 0; i < server_count; i++)
+		printf ("[%s] %s: %s\n", state_text (servers[i].state), servers[i].name, servers[i].msg);
+
+	return result;
+}
+
+
 
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
 {
 	int c;
+	char *p;
 
 	int option = 0;
 	static struct option longopts[] = {
@@ -235,10 +527,17 @@ process_arguments (int argc, char **argv)
 		case 'V':									/* version */
 			print_revision (progname, NP_VERSION);
 			exit (STATE_OK);
-		case 'H':									/* hostname */
-			if (is_host (optarg) == FALSE)
-				usage2 (_("Invalid hostname/address"), optarg);
-			server_address = optarg;
+		case 'H':									/* hostname, may be repeated or a list */
+			for (p = strtok (optarg, ","); p != NULL; p = strtok (NULL, ",")) {
+				if (is_host (p) == FALSE)
+					usage2 (_("Invalid hostname/address"), p);
+				server_list = realloc (server_list, (server_count + 1) * sizeof (char *));
+				if (server_list == NULL)
+					die (STATE_UNKNOWN, "%s\n", _("Memory allocation error"));
+				server_list[server_count++] = p;
+			}
+			if (server_address == NULL && server_count)
+				server_address = server_list[0];
 			break;
 		case 'w':									/* warning-variance */
 			if (is_intnonneg (optarg)) {
@@ -343,6 +642,9 @@ print_help (void)
 	printf (UT_EXTRA_OPTS);
 
 	printf (UT_HOST_PORT, 'p', myport);
+  printf ("   %s\n", _("-H may be repeated or a comma separated list, to ask all the hosts at once"));
+  printf ("   %s\n", _("(over UDP from one socket, with the kernel's time of arrival of each answer)"));
+  printf ("   %s\n", _("and give a line and perfdata for each"));
 
 	printf (" %s\n", "-u, --udp");
   printf ("   %s\n", _("Use UDP to connect, not TCP"));
@@ -366,6 +668,6 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-	printf ("%s -H <host_address> [-p port] [-u] [-w variance] [-c variance]\n",progname);
+	printf ("%s -H <host_address>[,<host_address>...] [-p port] [-u] [-w variance] [-c variance]\n",progname);
   printf (" [-W connect_time] [-C connect_time] [-t timeout]\n");
 }
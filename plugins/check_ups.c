@@ -71,9 +71,31 @@ enum {
 
 enum { NOSUCHVAR = ERROR-1 };
 
+#define UPS_VARS 6
+
+/* the variables a check reads, all of them fetched over one connection */
+static const char *ups_vars[UPS_VARS] = {
+	"ups.status",
+	"input.voltage",
+	"battery.charge",
+	"ups.load",
+	"ups.temperature",
+	"battery.runtime"
+};
+
+/* one -u, or each UPS of the server with --all */
+typedef struct ups_data {
+	char *name;
+	char *values[UPS_VARS];		/* NULL where the UPS does not support it */
+	char *error;			/* why it could not be checked */
+} ups_data;
+
 int server_port = PORT;
 char *server_address;
-char *ups_name = NULL;
+ups_data *upses = NULL;
+int ups_count = 0;
+int all_upses = FALSE;
+ups_data *ups = NULL;			/* the one get_ups_variable() reads */
 double warning_value = 0.0;
 double critical_value = 0.0;
 int check_warn = FALSE;
@@ -93,6 +115,9 @@ int temp_output_c = 0;
 
 int determine_status (void);
 int get_ups_variable (const char *, char *, size_t);
+int fetch_ups_data (void);
+int check_ups (ups_data *, char **, char **);
+void add_ups (const char *);
 
 int process_arguments (int, char **);
 int validate_arguments (void);
@@ -103,20 +128,10 @@ int
 main (int argc, char **argv)
 {
 	int result = STATE_UNKNOWN;
-	char *message;
-	char *data;
-	char *tunits;
-	char temp_buffer[MAX_INPUT_BUFFER];
-	double ups_utility_deviation = 0.0;
-	int res;
-
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
-	ups_status = strdup ("N/A");
-	data = strdup ("");
-	message = strdup ("");
+	int *states;
+	char **messages;
+	char *message, *data, *problems = NULL;
+	int i, count_ok = 0;
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -130,6 +145,93 @@ main (int argc, char **argv)
 	/* set socket timeout */
 	alarm (timeout_interval);
 
+	if (fetch_ups_data () != OK)
+		return STATE_CRITICAL;
+
+	if (ups_count == 1 && !all_upses) {
+		result = check_ups (&upses[0], &message, &data);
+		alarm (0);
+		if (upses[0].error != NULL)
+			printf ("CRITICAL - %s\n", upses[0].error);
+		else
+			printf ("UPS %s - %s|%s\n", state_text(result), message, data);
+		return result;
+	}
+
+	/* several UPSes, each checked as if on its own, with its name on its
+	 * perfdata */
+	states = calloc (ups_count, sizeof (int));
+	messages = calloc (ups_count, sizeof (char *));
+	if (states == NULL || messages == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	data = strdup ("");
+	result = STATE_OK;
+	for (i = 0; i < ups_count; i++) {
+		char *perf;
+
+		states[i] = check_ups (&upses[i], &messages[i], &perf);
+		if (upses[i].error != NULL)
+			messages[i] = upses[i].error;
+		else {
+			/* the perfdata starts with a space without voltage, the
+			 * message ends with one */
+			perf += strspn (perf, " ");
+			if (*perf)
+				xasprintf (&data, "%s%s%s", data, *data ? " " : "", perf);
+			strip (messages[i]);
+		}
+		result = max_state_alt (result, states[i]);
+		if (states[i] == STATE_OK)
+			count_ok++;
+		else
+			xasprintf (&problems, "%s%s%s: %s", problems ? problems : "", problems ? "; " : "",
+			           upses[i].name, messages[i]);
+	}
+	alarm (0);
+
+	printf ("UPS %s: %d of %d %s%s%s|%s\n", state_text (result), count_ok, ups_count,
+	        _("UPSes OK"), problems ? " - " : "", problems ? problems : "", data);
+	for (i = 0; i < ups_count; i++)
+		printf ("[%s] %s: %s\n", state_text (states[i]), upses[i].name, messages[i]);
+	return result;
+}
+
+
+/* the perfdata label, with the name of the UPS when there are several */
+static const char *
+perf_label (const char *label)
+{
+	static char buf[MAX_INPUT_BUFFER];
+
+	if (ups_count == 1 && !all_upses)
+		return label;
+	snprintf (buf, sizeof (buf), "%s@%s", label, ups->name);
+	return buf;
+}
+
+
+/* The state of one UPS from what fetch_ups_data() read, with the
+ * message and perfdata of a check of it alone */
+int
+check_ups (ups_data *u, char **msg, char **perf)
+{
+	int result = STATE_UNKNOWN;
+	char *message;
+	char *data;
+	char *tunits;
+	char temp_buffer[MAX_INPUT_BUFFER];
+	double ups_utility_deviation = 0.0;
+	int res;
+
+	ups = u;
+	status = UPSSTATUS_NONE;
+	supported_options = UPS_NONE;
+	ups_status = strdup ("N/A");
+	data = strdup ("");
+	message = strdup ("");
+	*msg = message;
+	*perf = data;
+
 	/* get the ups status if possible */
 	if (determine_status () != OK)
 		return STATE_CRITICAL;
@@ -215,13 +317,13 @@ main (int argc, char **argv)
 				result = max_state (result, STATE_WARNING);
 			}
 			xasprintf (&data, "%s",
-			          fperfdata ("voltage", ups_utility_voltage, (extended_units ? "V" : ""),
+			          fperfdata (perf_label ("voltage"), ups_utility_voltage, (extended_units ? "V" : ""),
 			                    check_warn, warning_value,
 			                    check_crit, critical_value,
 			                    TRUE, 0, FALSE, 0));
 		} else {
 			xasprintf (&data, "%s",
-			          fperfdata ("voltage", ups_utility_voltage, (extended_units ? "V" : ""),
+			          fperfdata (perf_label ("voltage"), ups_utility_voltage, (extended_units ? "V" : ""),
 			                    FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
 		}
 	}
@@ -244,13 +346,13 @@ main (int argc, char **argv)
 				result = max_state (result, STATE_WARNING);
 			}
 			xasprintf (&data, "%s %s", data,
-			          fperfdata ("battery", ups_battery_percent, "%",
+			          fperfdata (perf_label ("battery"), ups_battery_percent, "%",
 			                    check_warn, warning_value,
 			                    check_crit, critical_value,
 			                    TRUE, 0, TRUE, 100));
 		} else {
 			xasprintf (&data, "%s %s", data,
-			          fperfdata ("battery", ups_battery_percent, "%",
+			          fperfdata (perf_label ("battery"), ups_battery_percent, "%",
 			                    FALSE, 0, FALSE, 0, TRUE, 0, TRUE, 100));
 		}
 	}
@@ -273,13 +375,13 @@ main (int argc, char **argv)
 				result = max_state (result, STATE_WARNING);
 			}
 			xasprintf (&data, "%s %s", data,
-			          fperfdata ("load", ups_load_percent, "%",
+			          fperfdata (perf_label ("load"), ups_load_percent, "%",
 			                    check_warn, warning_value,
 			                    check_crit, critical_value,
 			                    TRUE, 0, TRUE, 100));
 		} else {
 			xasprintf (&data, "%s %s", data,
-			          fperfdata ("load", ups_load_percent, "%",
+			          fperfdata (perf_label ("load"), ups_load_percent, "%",
 			                    FALSE, 0, FALSE, 0, TRUE, 0, TRUE, 100));
 		}
 	}
@@ -310,13 +412,13 @@ main (int argc, char **argv)
 				result = max_state (result, STATE_WARNING);
 			}
 			xasprintf (&data, "%s %s", data,
-			          fperfdata ("temp", ups_temperature, (extended_units ? tunits : ""),
+			          fperfdata (perf_label ("temp"), ups_temperature, (extended_units ? tunits : ""),
 			                    check_warn, warning_value,
 			                    check_crit, critical_value,
 			                    TRUE, 0, FALSE, 0));
 		} else {
 			xasprintf (&data, "%s %s", data,
-			          fperfdata ("temp", ups_temperature, (extended_units ? tunits : ""),
+			          fperfdata (perf_label ("temp"), ups_temperature, (extended_units ? tunits : ""),
 			                    FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
 		}
 	}
@@ -339,13 +441,13 @@ main (int argc, char **argv)
 				result = max_state (result, STATE_WARNING);
 			}
 			xasprintf (&data, "%s %s", data,
-			          fperfdata ("left", ups_battery_left, "",
+			          fperfdata (perf_label ("left"), ups_battery_left, "",
 			                    check_warn, warning_value,
 			                    check_crit, critical_value,
 			                    TRUE, 0, FALSE, 0));
 		} else {
 			xasprintf (&data, "%s %s", data,
-			          fperfdata ("left", ups_battery_left, "",
+			          fperfdata (perf_label ("left"), ups_battery_left, "",
 			                    FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
 		}
 	}
@@ -353,13 +455,11 @@ main (int argc, char **argv)
 	/* if the UPS does not support any options we are looking for, report an error */
 	if (supported_options == UPS_NONE) {
 		result = STATE_CRITICAL;
-		xasprintf (&message, _("UPS does not support any available options\n"));
+		xasprintf (&message, _("UPS does not support any available options"));
 	}
 
-	/* reset timeout */
-	alarm (0);
-
-	printf ("UPS %s - %s|%s\n", state_text(result), message, data);
+	*msg = message;
+	*perf = data;
 	return result;
 }
 
@@ -376,10 +476,8 @@ determine_status (void)
 
 	res=get_ups_variable ("ups.status", recv_buffer, sizeof (recv_buffer));
 	if (res == NOSUCHVAR) return OK;
-	if (res != STATE_OK) {
-		printf ("%s\n", _("Invalid response received from host"));
+	if (res != STATE_OK)
 		return ERROR;
-	}
 
 	supported_options |= UPS_STATUS;
 
@@ -418,65 +516,155 @@ determine_status (void)
 }
 
 
-/* gets a variable value for a specific UPS  */
+/* gets a variable value of the UPS being checked, from what
+ * fetch_ups_data() read */
 int
 get_ups_variable (const char *varname, char *buf, size_t buflen)
 {
-	/*  char command[MAX_INPUT_BUFFER]; */
-	char temp_buffer[MAX_INPUT_BUFFER];
-	char send_buffer[MAX_INPUT_BUFFER];
-	char *ptr;
-	char *logout = "OK Goodbye\n";
-	int logout_len = strlen(logout);
-	int len;
+	int i;
 
 	*buf=0;
 
-	/* create the command string to send to the UPS daemon */
-	/* Add LOGOUT to avoid read failure logs */
-	sprintf (send_buffer, "GET VAR %s %s\nLOGOUT\n", ups_name, varname);
-
-	/* send the command to the daemon and get a response back */
-	if (process_tcp_request
-			(server_address, server_port, send_buffer, temp_buffer,
-			 sizeof (temp_buffer)) != STATE_OK) {
-		printf ("%s\n", _("Invalid response received from host"));
+	if (ups->error != NULL)
 		return ERROR;
-	}
+	for (i = 0; i < UPS_VARS; i++)
+		if (strcmp (ups_vars[i], varname) == 0)
+			break;
+	if (i == UPS_VARS || ups->values[i] == NULL)
+		return NOSUCHVAR;
+	strncpy (buf, ups->values[i], buflen - 1);
+	buf[buflen - 1] = 0;
 
-	ptr = temp_buffer;
-	len = strlen(ptr);
-	if (len > logout_len && strcmp (ptr + len - logout_len, logout) == 0) len -= logout_len;
-	if (len > 0 && ptr[len-1] == '\n') ptr[len-1]=0;
-	if (strcmp (ptr, "ERR UNKNOWN-UPS") == 0) {
-		printf (_("CRITICAL - no such UPS '%s' on that host\n"), ups_name);
-		return ERROR;
-	}
+	return OK;
+}
 
-	if (strcmp (ptr, "ERR VAR-NOT-SUPPORTED") == 0) {
-		/*printf ("Error: Variable '%s' is not supported\n", varname);*/
-		return NOSUCHVAR;
+
+void
+add_ups (const char *name)
+{
+	upses = realloc (upses, (ups_count + 1) * sizeof (ups_data));
+	if (upses == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	memset (&upses[ups_count], 0, sizeof (ups_data));
+	upses[ups_count++].name = strdup (name);
+}
+
+
+/* the reply to GET VAR for variable var of u */
+static void
+parse_reply (ups_data *u, int var, char *reply)
+{
+	char *prefix;
+	size_t len;
+
+	/* the first error is the one that counts: they all are the same when
+	 * the UPS is unknown */
+	if (u->error != NULL)
+		return;
+
+	if (strcmp (reply, "ERR VAR-NOT-SUPPORTED") == 0)
+		return;
+	if (strcmp (reply, "ERR UNKNOWN-UPS") == 0) {
+		xasprintf (&u->error, _("no such UPS '%s' on that host"), u->name);
+		return;
+	}
+	if (strcmp (reply, "ERR DATA-STALE") == 0) {
+		u->error = strdup (_("UPS data is stale"));
+		return;
+	}
+	if (strncmp (reply, "ERR", 3) == 0) {
+		xasprintf (&u->error, _("Unknown error: %s"), reply);
+		return;
 	}
 
-	if (strcmp (ptr, "ERR DATA-STALE") == 0) {
-		printf ("%s\n", _("CRITICAL - UPS data is stale"));
-		return ERROR;
+	/* VAR <ups> <variable> "<value>" */
+	xasprintf (&prefix, "VAR %s %s \"", u->name, ups_vars[var]);
+	len = strlen (reply);
+	if (strncmp (reply, prefix, strlen (prefix)) != 0 || len < strlen (prefix) + 1 ||
+	    reply[len - 1] != '"') {
+		u->error = strdup (_("Error: unable to parse variable"));
+	} else {
+		reply[len - 1] = '\0';
+		u->values[var] = strdup (reply + strlen (prefix));
 	}
+	free (prefix);
+}
+
 
-	if (strncmp (ptr, "ERR", 3) == 0) {
-		printf (_("Unknown error: %s\n"), ptr);
+/* the next line of the reply without its newline, FALSE at its end */
+static int
+read_reply (np_line_reader *reader, char *line, size_t size)
+{
+	int len = np_recvline (reader, line, size);
+
+	if (len <= 0)
+		return FALSE;
+	line[strcspn (line, "\r\n")] = '\0';
+	return TRUE;
+}
+
+
+/* Reads every variable of every UPS over one connection, sending a GET
+ * VAR for each and LOGOUT at once and taking the replies in order, after
+ * LIST UPS for the names with --all. ERROR with the reason printed if the
+ * server could not be asked; the errors of a UPS are kept to report with
+ * it. */
+int
+fetch_ups_data (void)
+{
+	np_line_reader reader;
+	char line[MAX_INPUT_BUFFER];
+	char *request = NULL, *name;
+	int sd, i, j;
+
+	if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
 		return ERROR;
+	np_line_reader_init (&reader, sd, NULL);
+
+	if (all_upses) {
+		/* BEGIN LIST UPS, UPS <name> "<description>" for each, END LIST UPS */
+		if (send (sd, "LIST UPS\n", 9, 0) != 9 || !read_reply (&reader, line, sizeof (line)) ||
+		    strcmp (line, "BEGIN LIST UPS") != 0) {
+			printf ("%s\n", _("Invalid response received from host"));
+			close (sd);
+			return ERROR;
+		}
+		while (read_reply (&reader, line, sizeof (line)) && strncmp (line, "UPS ", 4) == 0) {
+			name = line + 4;
+			name[strcspn (name, " ")] = '\0';
+			add_ups (name);
+		}
+		if (ups_count == 0) {
+			printf ("%s\n", _("CRITICAL - no UPS on that host"));
+			close (sd);
+			return ERROR;
+		}
 	}
 
-	ptr = temp_buffer + strlen (varname) + strlen (ups_name) + 6;
-	len = strlen(ptr);
-	if (len < 2 || ptr[0] != '"' || ptr[len-1] != '"') {
-		printf ("%s\n", _("Error: unable to parse variable"));
+	for (i = 0; i < ups_count; i++)
+		for (j = 0; j < UPS_VARS; j++)
+			xasprintf (&request, "%sGET VAR %s %s\n", request ? request : "", upses[i].name,
+			           ups_vars[j]);
+	/* Add LOGOUT to avoid read failure logs */
+	xasprintf (&request, "%sLOGOUT\n", request);
+	if (send (sd, request, strlen (request), 0) != (ssize_t) strlen (request)) {
+		printf ("%s\n", _("Invalid response received from host"));
+		close (sd);
 		return ERROR;
 	}
-	strncpy (buf, ptr+1, len - 2);
-	buf[len - 2] = 0;
 
+	for (i = 0; i < ups_count; i++)
+		for (j = 0; j < UPS_VARS; j++) {
+			if (!read_reply (&reader, line, sizeof (line))) {
+				printf ("%s\n", _("Invalid response received from host"));
+				close (sd);
+				return ERROR;
+			}
+			parse_reply (&upses[i], j, line);
+		}
+
+	free (request);
+	close (sd);
 	return OK;
 }
 
@@ -495,6 +683,7 @@ process_arguments (int argc, char **argv)
 	static struct option longopts[] = {
 		{"hostname", required_argument, 0, 'H'},
 		{"ups", required_argument, 0, 'u'},
+		{"all", no_argument, 0, 'a'},
 		{"port", required_argument, 0, 'p'},
 		{"critical", required_argument, 0, 'c'},
 		{"warning", required_argument, 0, 'w'},
@@ -504,6 +693,7 @@ process_arguments (int argc, char **argv)
 		{"variable", required_argument, 0, 'v'},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
+		{"tcp-fastopen", no_argument, 0, CHAR_MAX+1},
 		{0, 0, 0, 0}
 	};
 
@@ -520,7 +710,7 @@ process_arguments (int argc, char **argv)
 	}
 
 	while (1) {
-		c = getopt_long (argc, argv, "hVTH:u:p:v:c:w:t:", longopts,
+		c = getopt_long (argc, argv, "hVTaH:u:p:v:c:w:t:", longopts,
 									 &option);
 
 		if (c == -1 || c == EOF)
@@ -541,7 +731,10 @@ process_arguments (int argc, char **argv)
 			temp_output_c = 1;
 			break;
 		case 'u':									/* ups name */
-			ups_name = optarg;
+			add_ups (optarg);
+			break;
+		case 'a':
+			all_upses = TRUE;
 			break;
 		case 'p':									/* port */
 			if (is_intpos (optarg)) {
@@ -595,6 +788,9 @@ process_arguments (int argc, char **argv)
 		case 'h':									/* help */
 			print_help ();
 			exit (STATE_OK);
+		case CHAR_MAX+1:							/* tcp-fastopen */
+			np_net_fastopen = TRUE;
+			break;
 		}
 	}
 
@@ -616,7 +812,11 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments (void)
 {
-	if (! ups_name) {
+	if (all_upses && ups_count > 0) {
+		printf ("%s\n", _("Error : -u and --all exclude each other"));
+		return ERROR;
+	}
+	if (ups_count == 0 && !all_upses) {
 		printf ("%s\n", _("Error : no UPS indicated"));
 		return ERROR;
 	}
@@ -650,7 +850,9 @@ print_help (void)
 	printf (UT_HOST_PORT, 'p', myport);
 
 	printf (" %s\n", "-u, --ups=STRING");
-  printf ("    %s\n", _("Name of UPS"));
+  printf ("    %s\n", _("Name of UPS, may be given more than once"));
+  printf (" %s\n", "-a, --all");
+  printf ("    %s\n", _("Check every UPS the server has"));
   printf (" %s\n", "-T, --temperature");
   printf ("    %s\n", _("Output of temperatures in Celsius"));
   printf (" %s\n", "-e, --extended-units");
@@ -662,6 +864,8 @@ print_help (void)
 
 	printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
+	printf (UT_TCP_FASTOPEN);
+
 /* TODO: -v clashing with -v/-variable. Commenting out help text since verbose
          is unused up to now */
 /*	printf (UT_VERBOSE); */
@@ -679,6 +883,9 @@ print_help (void)
   printf (" %s\n", _("battery load, etc.) as well as warning and critical thresholds for the value"));
   printf (" %s\n", _("of that variable.  If the remote host has multiple UPS that are being monitored"));
   printf (" %s\n", _("you will have to use the --ups option to specify which UPS to check."));
+  printf (" %s\n", _("With several --ups, or --all, each is checked against the thresholds and a"));
+  printf (" %s\n", _("summary is printed with a line for each UPS after it. All variables of all"));
+  printf (" %s\n", _("UPSes are asked for at once, over one connection."));
   printf ("\n");
   printf (" %s\n", _("This plugin requires that the UPSD daemon distributed with Russell Kroll's"));
   printf (" %s\n", _("Network UPS Tools be installed on the remote host. If you do not have the"));
@@ -693,5 +900,6 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-	printf ("%s -H host -u ups [-p port] [-v variable] [-w warn_value] [-c crit_value] [-e] [-to to_sec] [-T]\n", progname);
+	printf ("%s -H host {-u ups [-u ups ...] | -a} [-p port] [-v variable] [-w warn_value] [-c crit_value] [-e] [-to to_sec] [-T]\n", progname);
+	printf ("[--tcp-fastopen]\n");
 }
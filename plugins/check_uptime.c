@@ -28,6 +28,7 @@
 #include "common.h"
 #include "utils.h"
 #include "utils_base.h"
+#include "utils_proc.h"
 #include <time.h>
 
 char *progname = "check_uptime";
@@ -118,6 +119,11 @@ int main (int argc, char **argv) {
 int getuptime () {
 
 	struct timespec t;
+	double uptime;
+
+	/* the time since boot, suspended time included, where there is /proc */
+	if (np_proc_uptime (&uptime))
+		return (int) uptime;
 	clock_gettime(CLOCK_MONOTONIC, &t);
 	if (t.tv_sec > 0) {
 		return t.tv_sec;
@@ -218,7 +218,14 @@ enum {
  *
  */
 #include "gettext.h"
-#define _(String) gettext (String)
+/* the locale is set up by the first message that needs it (utils_base.c) */
+#define _(String) np_gettext (String)
+char *np_gettext (const char *);
+char *np_ngettext (const char *, const char *, unsigned long);
+#if ENABLE_NLS
+# undef ngettext
+# define ngettext(Msgid1, Msgid2, N) np_ngettext (Msgid1, Msgid2, N)
+#endif
 #if ! ENABLE_NLS
 # undef textdomain
 # define textdomain(Domainname) /* empty */
@@ -0,0 +1,598 @@
+/*****************************************************************************
+*
+* Nagios plugins ICMP utilities
+*
+* License: GPL
+* Copyright (c) 2005-2014 Nagios Plugins Development Team
+*
+* Description:
+*
+* This file contains the ICMP echo engine shared by check_ping and
+* check_icmp: the checksum, the meaning of ICMP errors, the sockets, and
+* pinging any number of hosts at once from one process.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "netutils.h"
+#include "icmputils.h"
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+#ifdef HAVE_LINUX_ERRQUEUE_H
+# include <linux/errqueue.h>
+#endif
+
+/* we bundle these in one #ifndef, since they're all from BSD */
+/* Put individual #ifndef's around those that bother you */
+#ifndef ICMP_UNREACH_NET_UNKNOWN
+#define ICMP_UNREACH_NET_UNKNOWN 6
+#define ICMP_UNREACH_HOST_UNKNOWN 7
+#define ICMP_UNREACH_ISOLATED 8
+#define ICMP_UNREACH_NET_PROHIB 9
+#define ICMP_UNREACH_HOST_PROHIB 10
+#define ICMP_UNREACH_TOSNET 11
+#define ICMP_UNREACH_TOSHOST 12
+#endif
+/* tru64 has the ones above, but not these */
+#ifndef ICMP_UNREACH_FILTER_PROHIB
+#define ICMP_UNREACH_FILTER_PROHIB 13
+#define ICMP_UNREACH_HOST_PRECEDENCE 14
+#define ICMP_UNREACH_PRECEDENCE_CUTOFF 15
+#endif
+
+#define ICMP_ECHO_HDR 8		/* type, code, checksum, id, sequence */
+
+unsigned short
+np_icmp_checksum (const void *data, int n)
+{
+	const unsigned short *p = data;
+	long sum = 0;
+
+	while (n > 1) {
+		sum += *p++;
+		n -= sizeof (unsigned short);
+	}
+
+	/* mop up the occasional odd byte */
+	if (n == 1)
+		sum += *(const unsigned char *) p;
+
+	sum = (sum >> 16) + (sum & 0xffff);	/* add hi 16 to low 16 */
+	sum += (sum >> 16);			/* add carry */
+	return (unsigned short) ~sum;		/* ones-complement, trunc to 16 bits */
+}
+
+const char *
+np_icmp_error_text (unsigned char type, unsigned char code)
+{
+	switch (type) {
+	case ICMP_UNREACH:
+		switch (code) {
+		case ICMP_UNREACH_NET:
+			return "Net unreachable";
+		case ICMP_UNREACH_HOST:
+			return "Host unreachable";
+		case ICMP_UNREACH_PROTOCOL:
+			return "Protocol unreachable (firewall?)";
+		case ICMP_UNREACH_PORT:
+			return "Port unreachable (firewall?)";
+		case ICMP_UNREACH_NEEDFRAG:
+			return "Fragmentation needed";
+		case ICMP_UNREACH_SRCFAIL:
+			return "Source route failed";
+		case ICMP_UNREACH_ISOLATED:
+			return "Source host isolated";
+		case ICMP_UNREACH_NET_UNKNOWN:
+			return "Unknown network";
+		case ICMP_UNREACH_HOST_UNKNOWN:
+			return "Unknown host";
+		case ICMP_UNREACH_NET_PROHIB:
+			return "Network denied (firewall?)";
+		case ICMP_UNREACH_HOST_PROHIB:
+			return "Host denied (firewall?)";
+		case ICMP_UNREACH_TOSNET:
+			return "Bad TOS for network (firewall?)";
+		case ICMP_UNREACH_TOSHOST:
+			return "Bad TOS for host (firewall?)";
+		case ICMP_UNREACH_FILTER_PROHIB:
+			return "Prohibited by filter (firewall)";
+		case ICMP_UNREACH_HOST_PRECEDENCE:
+			return "Host precedence violation";
+		case ICMP_UNREACH_PRECEDENCE_CUTOFF:
+			return "Precedence cutoff";
+		default:
+			return "Invalid code";
+		}
+
+	case ICMP_TIMXCEED:
+		/* really 'out of reach', or non-existant host behind a router serving */
+		/* two different subnets */
+		switch (code) {
+		case ICMP_TIMXCEED_INTRANS:
+			return "Time to live exceeded in transit";
+		case ICMP_TIMXCEED_REASS:
+			return "Fragment reassembly time exceeded";
+		default:
+			return "Invalid code";
+		}
+
+	case ICMP_SOURCEQUENCH:
+		return "Transmitting too fast";
+
+	case ICMP_REDIRECT:
+		return "Redirect (change route)";
+
+	case ICMP_PARAMPROB:
+		return "Bad IP header (required option absent)";
+
+	/* the others aren't error messages, so ignore them */
+	default:
+		return "";
+	}
+}
+
+int
+np_icmp_socket (int family, int *raw)
+{
+	int proto = family == AF_INET6 ? IPPROTO_ICMPV6 : IPPROTO_ICMP;
+	int sd;
+
+	*raw = FALSE;
+	if ((sd = socket (family, SOCK_DGRAM, proto)) >= 0)
+		return sd;
+	*raw = TRUE;
+	return socket (family, SOCK_RAW, proto);
+}
+
+int
+np_icmp_resolve (np_icmp_host *host, const char *name, int family)
+{
+	struct addrinfo hints, *res;
+	int result;
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = family;
+	hints.ai_socktype = SOCK_DGRAM;
+#ifdef USE_IPV6
+	if (family == AF_UNSPEC) {
+		hints.ai_family = AF_INET6;
+		if (np_net_getaddrinfo (name, NULL, &hints, &res) != 0)
+			hints.ai_family = AF_INET;
+	}
+#endif
+	if ((result = np_net_getaddrinfo (name, NULL, &hints, &res)) != 0)
+		return result;
+	memset (host, 0, sizeof (*host));
+	host->name = name;
+	memcpy (&host->addr, res->ai_addr, res->ai_addrlen);
+	host->addrlen = res->ai_addrlen;
+	return 0;
+}
+
+#if defined(HAVE_POLL) && defined(HAVE_SYS_POLL_H)
+
+/* One request in flight; its index is its sequence number, so that
+ * replies are matched without a search */
+struct np_icmp_slot {
+	np_icmp_host *host;
+	int64_t sent;		/* nanoseconds, 0 until it is */
+	int answered;
+};
+
+struct np_icmp_engine {
+	int sd[2];		/* IPv4, IPv6 */
+	int raw[2];
+	unsigned short id;	/* raw sockets; the kernel has its own for the others */
+	struct np_icmp_slot *slots;
+	size_t nslots;
+	const np_icmp_options *opts;
+};
+
+static int64_t
+np_icmp_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+np_icmp_same_addr (const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+	if (a->ss_family != b->ss_family)
+		return FALSE;
+	if (a->ss_family == AF_INET6)
+		return !memcmp (&((const struct sockaddr_in6 *) a)->sin6_addr,
+		                &((const struct sockaddr_in6 *) b)->sin6_addr, sizeof (struct in6_addr));
+	return ((const struct sockaddr_in *) a)->sin_addr.s_addr ==
+	       ((const struct sockaddr_in *) b)->sin_addr.s_addr;
+}
+
+/* the class of an ICMP error, NP_ICMP_OK for messages that are none */
+static int
+np_icmp_classify (int v6, unsigned char type, unsigned char code)
+{
+	if (v6) {
+		switch (type) {
+		case ICMP6_DST_UNREACH:
+			switch (code) {
+			case ICMP6_DST_UNREACH_NOROUTE:
+				return NP_ICMP_NET_UNREACH;
+			case ICMP6_DST_UNREACH_ADMIN:
+				return NP_ICMP_FILTERED;
+			case ICMP6_DST_UNREACH_ADDR:
+				return NP_ICMP_HOST_UNREACH;
+			case ICMP6_DST_UNREACH_NOPORT:
+				return NP_ICMP_PORT_UNREACH;
+			default:
+				return NP_ICMP_UNREACH;
+			}
+		case ICMP6_TIME_EXCEEDED:
+			return NP_ICMP_TTL_EXCEEDED;
+		case ICMP6_PARAM_PROB:
+			return NP_ICMP_UNREACH;
+		default:
+			return NP_ICMP_OK;
+		}
+	}
+	switch (type) {
+	case ICMP_UNREACH:
+		switch (code) {
+		case ICMP_UNREACH_NET:
+			return NP_ICMP_NET_UNREACH;
+		case ICMP_UNREACH_HOST:
+			return NP_ICMP_HOST_UNREACH;
+		case ICMP_UNREACH_PROTOCOL:
+			return NP_ICMP_PROTO_UNREACH;
+		case ICMP_UNREACH_PORT:
+			return NP_ICMP_PORT_UNREACH;
+		case ICMP_UNREACH_NET_PROHIB:
+			return NP_ICMP_NET_PROHIB;
+		case ICMP_UNREACH_HOST_PROHIB:
+			return NP_ICMP_HOST_PROHIB;
+		case ICMP_UNREACH_FILTER_PROHIB:
+			return NP_ICMP_FILTERED;
+		default:
+			return NP_ICMP_UNREACH;
+		}
+	case ICMP_TIMXCEED:
+		return NP_ICMP_TTL_EXCEEDED;
+	case ICMP_PARAMPROB:
+		return NP_ICMP_UNREACH;
+	default:
+		return NP_ICMP_OK;
+	}
+}
+
+/* the slot a request we sent is in, from its ICMP header, or NULL */
+static struct np_icmp_slot *
+np_icmp_slot (struct np_icmp_engine *e, int v6, const unsigned char *icmp, size_t len)
+{
+	unsigned int seq;
+
+	if (len < ICMP_ECHO_HDR || icmp[0] != (v6 ? ICMP6_ECHO_REQUEST : ICMP_ECHO))
+		return NULL;
+	if (e->raw[v6] && ((icmp[4] << 8) | icmp[5]) != e->id)
+		return NULL;
+	seq = (icmp[6] << 8) | icmp[7];
+	if (seq >= e->nslots || e->slots[seq].sent == 0)
+		return NULL;
+	return &e->slots[seq];
+}
+
+static void
+np_icmp_error (struct np_icmp_slot *slot, int v6, unsigned char type, unsigned char code)
+{
+	int error = np_icmp_classify (v6, type, code);
+
+	if (error == NP_ICMP_OK || slot == NULL || slot->host->error != NP_ICMP_OK)
+		return;
+	slot->host->error = error;
+	slot->host->error_type = type;
+	slot->host->error_code = code;
+}
+
+static void
+np_icmp_send (struct np_icmp_engine *e, unsigned int seq, unsigned char *packet, size_t len)
+{
+	struct np_icmp_slot *slot = &e->slots[seq];
+	int v6 = slot->host->addr.ss_family == AF_INET6;
+
+	packet[0] = v6 ? ICMP6_ECHO_REQUEST : ICMP_ECHO;
+	packet[1] = 0;
+	packet[2] = packet[3] = 0;
+	packet[4] = e->id >> 8;
+	packet[5] = e->id & 0xff;
+	packet[6] = seq >> 8;
+	packet[7] = seq & 0xff;
+	/* the kernel does it for ICMPv6, and again for datagram sockets */
+	if (!v6) {
+		unsigned short sum = np_icmp_checksum (packet, (int) len);
+		memcpy (&packet[2], &sum, sizeof (sum));
+	}
+
+	slot->sent = np_icmp_now ();
+	slot->host->sent++;
+	if (sendto (e->sd[v6], packet, len, 0, (struct sockaddr *) &slot->host->addr,
+	            slot->host->addrlen) < 0) {
+		if (e->opts->verbose)
+			printf (_("Sending to %s failed: %s\n"), slot->host->name, strerror (errno));
+		/* no route is as good as an ICMP error saying so */
+		if (slot->host->error == NP_ICMP_OK && errno == ENETUNREACH)
+			slot->host->error = NP_ICMP_NET_UNREACH;
+		else if (slot->host->error == NP_ICMP_OK && errno == EHOSTUNREACH)
+			slot->host->error = NP_ICMP_HOST_UNREACH;
+	}
+}
+
+/* a packet read from the socket of family v6 */
+static void
+np_icmp_receive (struct np_icmp_engine *e, int v6, unsigned char *buf, size_t len,
+                 const struct sockaddr_storage *from)
+{
+	struct np_icmp_slot *slot;
+	unsigned char *icmp = buf;
+	size_t hlen;
+	double ms;
+
+	/* raw IPv4 sockets get the IP header too */
+	if (!v6 && e->raw[0]) {
+		if (len < 20 || (hlen = (buf[0] & 0x0f) * 4) + ICMP_ECHO_HDR > len)
+			return;
+		icmp += hlen;
+		len -= hlen;
+	}
+	if (len < ICMP_ECHO_HDR)
+		return;
+
+	if (icmp[0] != (v6 ? ICMP6_ECHO_REPLY : ICMP_ECHOREPLY)) {
+		/* an error about a request of ours has its IP header and the
+		 * start of it, on raw sockets; the others get them queued */
+		if (!e->raw[v6])
+			return;
+		if (v6)
+			hlen = 40;
+		else if (len >= ICMP_ECHO_HDR + 20)
+			hlen = (icmp[ICMP_ECHO_HDR] & 0x0f) * 4;
+		else
+			return;
+		if (len < ICMP_ECHO_HDR + hlen + ICMP_ECHO_HDR)
+			return;
+		np_icmp_error (np_icmp_slot (e, v6, icmp + ICMP_ECHO_HDR + hlen, len - ICMP_ECHO_HDR - hlen),
+		               v6, icmp[0], icmp[1]);
+		return;
+	}
+
+	/* a reply is read as the request it echoes */
+	icmp[0] = v6 ? ICMP6_ECHO_REQUEST : ICMP_ECHO;
+	if ((slot = np_icmp_slot (e, v6, icmp, len)) == NULL || !np_icmp_same_addr (from, &slot->host->addr))
+		return;
+	if (slot->answered) {
+		slot->host->duplicates++;
+		return;
+	}
+	ms = (np_icmp_now () - slot->sent) / 1.0e6;
+	if (ms > e->opts->wait)
+		return;
+	slot->answered = TRUE;
+	slot->host->received++;
+	slot->host->rtt_sum += ms;
+	if (slot->host->received == 1 || ms < slot->host->rtt_min)
+		slot->host->rtt_min = ms;
+	if (ms > slot->host->rtt_max)
+		slot->host->rtt_max = ms;
+	if (e->opts->verbose)
+		printf (_("Reply from %s: icmp_seq=%u time=%.3f ms\n"), slot->host->name,
+		        (unsigned int) (slot - e->slots), ms);
+}
+
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(IP_RECVERR)
+/* the errors the kernel queued for a datagram socket: each has the
+ * request it is about, and the ICMP type and code from the offender */
+static void
+np_icmp_receive_errors (struct np_icmp_engine *e, int v6, unsigned char *buf, size_t size)
+{
+	struct sock_extended_err *ee;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	char control[512];
+	ssize_t len;
+
+	while (1) {
+		memset (&msg, 0, sizeof (msg));
+		iov.iov_base = buf;
+		iov.iov_len = size;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof (control);
+		if ((len = recvmsg (e->sd[v6], &msg, MSG_ERRQUEUE | MSG_DONTWAIT)) < 0)
+			return;
+		for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+			if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+			      (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)))
+				continue;
+			ee = (struct sock_extended_err *) CMSG_DATA (cmsg);
+			if (ee->ee_origin == SO_EE_ORIGIN_ICMP || ee->ee_origin == SO_EE_ORIGIN_ICMP6)
+				np_icmp_error (np_icmp_slot (e, v6, buf, (size_t) len), v6, ee->ee_type, ee->ee_code);
+		}
+	}
+}
+#endif
+
+int
+np_icmp_ping (np_icmp_host *hosts, size_t count, const np_icmp_options *opts)
+{
+	struct np_icmp_engine e;
+	struct sockaddr_storage from;
+	struct pollfd pfd[2];
+	socklen_t fromlen;
+	unsigned char *packet, *buf;
+	size_t i, next = 0, npfd, len, bufsize;
+	int64_t start, now, due;
+	ssize_t n;
+	int v6, timeout, held, on = 1, error = 0, result = NP_ICMP_NO_SOCKET;
+
+	memset (&e, 0, sizeof (e));
+	e.sd[0] = e.sd[1] = -1;
+	e.id = getpid () & 0xffff;
+	e.opts = opts;
+	e.nslots = count * opts->packets;
+	if (e.nslots == 0)
+		return 0;
+	if (e.nslots > 0x10000) {
+		errno = EINVAL;
+		return NP_ICMP_NO_SOCKET;
+	}
+
+	for (i = 0; i < count; i++) {
+		v6 = hosts[i].addr.ss_family == AF_INET6;
+		if (e.sd[v6] >= 0)
+			continue;
+		if ((e.sd[v6] = np_icmp_socket (v6 ? AF_INET6 : AF_INET, &e.raw[v6])) < 0) {
+			error = errno;
+			break;
+		}
+		if (opts->verbose)
+			printf (_("Pinging over %s ICMP%s socket\n"), e.raw[v6] ? _("a raw") : _("a datagram"),
+			        v6 ? "v6" : "");
+		if ((opts->source && opts->source->ss_family == hosts[i].addr.ss_family &&
+		     bind (e.sd[v6], (const struct sockaddr *) opts->source,
+		           opts->source->ss_family == AF_INET6 ? sizeof (struct sockaddr_in6)
+		                                               : sizeof (struct sockaddr_in)) < 0)
+#ifdef SO_BINDTODEVICE
+		    || (opts->interface && setsockopt (e.sd[v6], SOL_SOCKET, SO_BINDTODEVICE, opts->interface,
+		                                       strlen (opts->interface) + 1) < 0)
+#endif
+		   ) {
+			error = errno;
+			result = NP_ICMP_BAD_SOURCE;
+			break;
+		}
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(IP_RECVERR)
+		if (!e.raw[v6])
+			setsockopt (e.sd[v6], v6 ? SOL_IPV6 : SOL_IP, v6 ? IPV6_RECVERR : IP_RECVERR, &on, sizeof (on));
+#endif
+	}
+	len = ICMP_ECHO_HDR + opts->size;
+	bufsize = len + 128;	/* room for IP headers, twice for errors */
+	e.slots = calloc (e.nslots, sizeof (*e.slots));
+	packet = calloc (1, len);
+	buf = malloc (bufsize);
+	if (error == 0 && (e.slots == NULL || packet == NULL || buf == NULL))
+		error = ENOMEM;
+	if (error) {
+		for (v6 = 0; v6 < 2; v6++)
+			if (e.sd[v6] >= 0)
+				close (e.sd[v6]);
+		free (e.slots);
+		free (packet);
+		free (buf);
+		errno = error;
+		return error == ENOMEM ? NP_ICMP_NO_SOCKET : result;
+	}
+
+	/* the packets go to each host in turn, one round each interval */
+	for (i = 0; i < e.nslots; i++)
+		e.slots[i].host = &hosts[i % count];
+	for (i = 0; i < opts->size; i++)
+		packet[ICMP_ECHO_HDR + i] = (unsigned char) i;
+
+	start = np_icmp_now ();
+	while (1) {
+		now = np_icmp_now ();
+		while (next < e.nslots && now >= start + (int64_t) (next / count) * opts->interval * 1000000) {
+			if (opts->rate && !np_rate_take (opts->rate, (now - start) / 1.0e9))
+				break;
+			np_icmp_send (&e, (unsigned int) next, packet, len);
+			next++;
+		}
+		held = next < e.nslots && now >= start + (int64_t) (next / count) * opts->interval * 1000000;
+		if (opts->rate)
+			np_rate_held (opts->rate, held, (now - start) / 1.0e9);
+
+		/* done when all is sent and each request is answered or given up */
+		due = 0;
+		if (held)
+			due = now + (int64_t) (np_rate_delay (opts->rate, (now - start) / 1.0e9) * 1.0e9);
+		else if (next < e.nslots)
+			due = start + (int64_t) (next / count) * opts->interval * 1000000;
+		else {
+			for (i = 0; i < e.nslots; i++)
+				if (!e.slots[i].answered && e.slots[i].sent + (int64_t) opts->wait * 1000000 > due)
+					due = e.slots[i].sent + (int64_t) opts->wait * 1000000;
+			if (due == 0 || due <= now)
+				break;
+		}
+		timeout = due > now ? (int) ((due - now + 999999) / 1000000) : 0;
+
+		npfd = 0;
+		for (v6 = 0; v6 < 2; v6++) {
+			if (e.sd[v6] < 0)
+				continue;
+			pfd[npfd].fd = e.sd[v6];
+			pfd[npfd].events = POLLIN;
+			pfd[npfd++].revents = 0;
+		}
+		if (poll (pfd, npfd, timeout) <= 0)
+			continue;
+
+		for (i = 0; i < npfd; i++) {
+			v6 = pfd[i].fd == e.sd[1];
+			if (pfd[i].revents & POLLERR) {
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(IP_RECVERR)
+				np_icmp_receive_errors (&e, v6, buf, bufsize);
+#endif
+			}
+			if (!(pfd[i].revents & POLLIN))
+				continue;
+			while (1) {
+				fromlen = sizeof (from);
+				n = recvfrom (e.sd[v6], buf, bufsize, MSG_DONTWAIT, (struct sockaddr *) &from, &fromlen);
+				if (n < 0)
+					break;
+				np_icmp_receive (&e, v6, buf, (size_t) n, &from);
+			}
+		}
+	}
+
+	if (opts->rate)
+		np_rate_held (opts->rate, FALSE, (np_icmp_now () - start) / 1.0e9);
+	for (v6 = 0; v6 < 2; v6++)
+		if (e.sd[v6] >= 0)
+			close (e.sd[v6]);
+	free (e.slots);
+	free (packet);
+	free (buf);
+	return 0;
+}
+
+#else
+
+int
+np_icmp_ping (np_icmp_host *hosts, size_t count, const np_icmp_options *opts)
+{
+	errno = ENOSYS;
+	return NP_ICMP_NO_SOCKET;
+}
+
+#endif
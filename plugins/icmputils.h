@@ -0,0 +1,104 @@
+/*****************************************************************************
+*
+* Nagios plugins ICMP utilities include file
+*
+* License: GPL
+* Copyright (c) 2005-2014 Nagios Plugins Development Team
+*
+* Description:
+*
+* This file contains the ICMP echo engine shared by check_ping and
+* check_icmp.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#ifndef NAGIOS_ICMPUTILS_H_INCLUDED_
+#define NAGIOS_ICMPUTILS_H_INCLUDED_
+
+#include "common.h"
+#include "utils_base.h"
+#include <netinet/in.h>
+
+/* RFC 1071 checksum of n bytes */
+unsigned short np_icmp_checksum (const void *, int);
+
+/* what an ICMPv4 error of this type and code means, "" if none */
+const char *np_icmp_error_text (unsigned char type, unsigned char code);
+
+/* An ICMP echo socket of family: an unprivileged datagram socket where
+ * the kernel allows them (net.ipv4.ping_group_range on Linux), else a raw
+ * one, which needs root. *raw tells which. -1 with errno if neither. */
+int np_icmp_socket (int family, int *raw);
+
+/* the ICMP errors a host can answer with, IPv4 or IPv6 alike */
+enum {
+	NP_ICMP_OK = 0,
+	NP_ICMP_UNREACH,		/* of another kind */
+	NP_ICMP_NET_UNREACH,
+	NP_ICMP_HOST_UNREACH,
+	NP_ICMP_PROTO_UNREACH,
+	NP_ICMP_PORT_UNREACH,
+	NP_ICMP_NET_PROHIB,
+	NP_ICMP_HOST_PROHIB,
+	NP_ICMP_FILTERED,
+	NP_ICMP_TTL_EXCEEDED
+};
+
+typedef struct np_icmp_host {
+	const char *name;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	/* the results */
+	unsigned int sent;
+	unsigned int received;
+	unsigned int duplicates;
+	double rtt_min;			/* milliseconds, over the replies */
+	double rtt_max;
+	double rtt_sum;
+	int error;			/* NP_ICMP_* of the first error answered */
+	unsigned char error_type;	/* and its ICMP type and code */
+	unsigned char error_code;
+} np_icmp_host;
+
+typedef struct np_icmp_options {
+	unsigned int packets;		/* echo requests to each host */
+	unsigned int interval;		/* milliseconds between those */
+	unsigned int wait;		/* milliseconds a reply may take */
+	size_t size;			/* bytes of data in each request */
+	const struct sockaddr_storage *source;	/* to send from, or NULL */
+	const char *interface;		/* to send through, or NULL */
+	np_rate *rate;			/* what the requests are spread to, or NULL */
+	int verbose;
+} np_icmp_options;
+
+#define NP_ICMP_DEFAULT_SIZE 56	/* as ping(8) */
+
+/* the address of name in family for host; with AF_UNSPEC, its IPv6
+ * address if it has one, as ping6 used to be chosen over ping. A
+ * getaddrinfo() error code if there is none. */
+int np_icmp_resolve (np_icmp_host *host, const char *name, int family);
+
+/* Echo requests to all the hosts at once, until each is answered or has
+ * waited long enough; their results are in the hosts. Returns 0, or with
+ * errno set NP_ICMP_NO_SOCKET when there is no socket to send them with
+ * and NP_ICMP_BAD_SOURCE when the source or interface cannot be used. */
+#define NP_ICMP_NO_SOCKET -1
+#define NP_ICMP_BAD_SOURCE -2
+int np_icmp_ping (np_icmp_host *hosts, size_t count, const np_icmp_options *opts);
+
+#endif /* NAGIOS_ICMPUTILS_H_INCLUDED_ */
@@ -0,0 +1,377 @@
+/*****************************************************************************
+* 
+* Nagios plugins multi-call binary
+* 
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+* 
+* Description:
+* 
+* This file contains the dispatcher of nagios-plugins, the binary that
+* "make multicall" links from the objects of every plugin
+* 
+* Each plugin's main and print_usage are renamed np_main_<plugin> and
+* np_usage_<plugin>, and its other globals are made local to its object,
+* so all of them fit in one image. The plugin to run is taken from the
+* name the binary is called by (a symlink check_tcp -> nagios-plugins) or
+* from its first argument (nagios-plugins check_tcp -H ...). Symlinks of
+* check_tcp such as check_ftp keep their name, by which check_tcp picks
+* the service.
+* 
+* Wrappers such as negate run the plugins of this binary that they are
+* given within the same process, through cmd_run_inprocess: exit() is
+* wrapped at link time (ld --wrap=exit) to return to the wrapper instead.
+* 
+* Called as nagios-plugins-worker or with --worker, it is a worker of
+* Nagios Core 4 instead (see worker.c).
+* 
+* 
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+* 
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+* 
+* 
+*****************************************************************************/
+
+/* the name utils.c prints; that of the plugin once it is known */
+const char *progname = "nagios-plugins";
+
+#include "common.h"
+#include "utils.h"
+#include "utils_cmd.h"
+#include "resident.h"
+#include "worker.h"
+
+#include <setjmp.h>
+
+/* multicall.h, made by make, lists the plugins with NP_MULTICALL (name),
+ * the other names they answer to with NP_MULTICALL_ALIAS (alias, name)
+ * and those with a resident mode with NP_MULTICALL_RESIDENT (name) */
+#define NP_MULTICALL(name) int np_main_##name (int, char **); void np_usage_##name (void);
+#define NP_MULTICALL_ALIAS(alias, name)
+#define NP_MULTICALL_RESIDENT(name)
+#include "multicall.h"
+#undef NP_MULTICALL
+#undef NP_MULTICALL_ALIAS
+#undef NP_MULTICALL_RESIDENT
+
+static np_applet applets[] = {
+#define NP_MULTICALL(name) { #name, np_main_##name, np_usage_##name, FALSE },
+#define NP_MULTICALL_ALIAS(alias, name)
+#define NP_MULTICALL_RESIDENT(name)
+#include "multicall.h"
+#undef NP_MULTICALL
+#undef NP_MULTICALL_ALIAS
+#undef NP_MULTICALL_RESIDENT
+	{ NULL, NULL, NULL, FALSE }
+};
+
+static const struct {
+	const char *alias;
+	const char *name;
+} aliases[] = {
+#define NP_MULTICALL(name)
+#define NP_MULTICALL_ALIAS(alias, name) { #alias, #name },
+#define NP_MULTICALL_RESIDENT(name)
+#include "multicall.h"
+#undef NP_MULTICALL
+#undef NP_MULTICALL_ALIAS
+#undef NP_MULTICALL_RESIDENT
+	{ NULL, NULL }
+};
+
+static const char *const resident_applets[] = {
+#define NP_MULTICALL(name)
+#define NP_MULTICALL_ALIAS(alias, name)
+#define NP_MULTICALL_RESIDENT(name) #name,
+#include "multicall.h"
+#undef NP_MULTICALL
+#undef NP_MULTICALL_ALIAS
+#undef NP_MULTICALL_RESIDENT
+	NULL
+};
+
+static const np_applet *applet = NULL;
+/* the binary itself, to tell its plugins from others of the same name */
+static char *self = NULL;
+
+/* where exit() returns to while a plugin runs in-process */
+static sigjmp_buf inprocess_return;
+static int inprocess_depth = 0;
+static int inprocess_status;
+
+static const np_applet *find_applet (const char *);
+static int is_self (const char *);
+static void print_applets (void);
+static int run_inprocess (char *const *, output *, output *);
+
+void __real_exit (int) __attribute__ ((noreturn));
+void __wrap_exit (int) __attribute__ ((noreturn));
+
+int
+main (int argc, char **argv)
+{
+	const char *name;
+	int i;
+
+	name = strrchr (argv[0], '/');
+	name = name ? name + 1 : argv[0];
+
+	for (i = 0; resident_applets[i]; i++)
+		applets[np_applet_index (find_applet (resident_applets[i]))].resident = TRUE;
+	if ((self = realpath ("/proc/self/exe", NULL)) == NULL && strchr (argv[0], '/'))
+		self = realpath (argv[0], NULL);
+
+	if (np_worker_requested (name, argc, argv)) {
+		progname = NP_WORKER_NAME;
+		return np_worker_main (argc, argv);
+	}
+
+	if ((applet = find_applet (name)) == NULL) {
+		/* nagios-plugins PLUGIN [ARGS...] */
+		if (argc < 2 || (applet = find_applet (argv[1])) == NULL) {
+			if (argc >= 2 && strcmp (argv[1], "--list") != 0)
+				printf (_("%s: %s is not one of its plugins\n"), progname, argv[1]);
+			print_applets ();
+			return argc >= 2 && strcmp (argv[1], "--list") == 0 ? STATE_OK : STATE_UNKNOWN;
+		}
+		argc--;
+		argv++;
+		name = strrchr (argv[0], '/');
+		name = name ? name + 1 : argv[0];
+	}
+
+	progname = name;
+	if (self)
+		cmd_run_inprocess = run_inprocess;
+	return applet->main (argc, argv);
+}
+
+
+
+void
+__wrap_exit (int status)
+{
+	/* a check the worker runs in-process goes back to it */
+	if (np_resident_active ())
+		np_exit (status);
+	if (inprocess_depth > 0) {
+		inprocess_status = status;
+		siglongjmp (inprocess_return, 1);
+	}
+	__real_exit (status);
+}
+
+
+
+/* Run the plugin argv names, if it is one of this binary's, as its own
+ * process would run: stdout and stderr go to temporary files, read into
+ * out and err once it returns or exits, and its timeout takes over from
+ * the caller's alarm, which is set again afterwards with what was left */
+static int
+run_inprocess (char *const *argv, output *out, output *err)
+{
+	const np_applet *caller = applet, *callee;
+	const char *caller_name = progname, *name;
+	FILE *out_file, *err_file;
+	int saved_out, saved_err, argc, status;
+	char **args;
+	struct sigaction alarm_action;
+	unsigned int alarm_left;
+	time_t start;
+
+	if (inprocess_depth > 0 || (callee = np_applet_find (argv[0])) == NULL)
+		return -1;
+	name = strrchr (argv[0], '/');
+	name = name ? name + 1 : argv[0];
+
+	if ((out_file = tmpfile ()) == NULL)
+		return -1;
+	if ((err_file = tmpfile ()) == NULL) {
+		fclose (out_file);
+		return -1;
+	}
+
+	/* the plugin may change argv, as getopt does */
+	for (argc = 0; argv[argc]; argc++)
+		;
+	args = calloc (argc + 1, sizeof (char *));
+	if (args == NULL)
+		die (STATE_UNKNOWN, _("Could not allocate memory\n"));
+	memcpy (args, argv, argc * sizeof (char *));
+
+	fflush (stdout);
+	fflush (stderr);
+	saved_out = dup (STDOUT_FILENO);
+	saved_err = dup (STDERR_FILENO);
+	dup2 (fileno (out_file), STDOUT_FILENO);
+	dup2 (fileno (err_file), STDERR_FILENO);
+
+	sigaction (SIGALRM, NULL, &alarm_action);
+	alarm_left = alarm (0);
+	start = time (NULL);
+
+	applet = callee;
+	progname = name;
+	/* as glibc and gnulib read it, start the options over */
+	optind = 0;
+
+	inprocess_depth++;
+	if (sigsetjmp (inprocess_return, 1) == 0)
+		status = callee->main (argc, args);
+	else
+		status = inprocess_status;
+	inprocess_depth--;
+
+	alarm (0);
+	sigaction (SIGALRM, &alarm_action, NULL);
+	if (alarm_left) {
+		time_t spent = time (NULL) - start;
+		alarm (spent < (time_t) alarm_left ? alarm_left - spent : 1);
+	}
+
+	applet = caller;
+	progname = caller_name;
+	optind = 0;
+
+	fflush (stdout);
+	fflush (stderr);
+	dup2 (saved_out, STDOUT_FILENO);
+	dup2 (saved_err, STDERR_FILENO);
+	close (saved_out);
+	close (saved_err);
+
+	memset (out, 0, sizeof (output));
+	memset (err, 0, sizeof (output));
+	rewind (out_file);
+	rewind (err_file);
+	cmd_fetch_output (fileno (out_file), out, 0);
+	cmd_fetch_output (fileno (err_file), err, 0);
+	fclose (out_file);
+	fclose (err_file);
+	free (args);
+
+	return status & 0xff;
+}
+
+
+
+const np_applet *
+np_applet_find (const char *path)
+{
+	const np_applet *a;
+	const char *name;
+
+	name = strrchr (path, '/');
+	name = name ? name + 1 : path;
+	if ((a = find_applet (name)) == NULL || !is_self (path))
+		return NULL;
+	return a;
+}
+
+
+
+int
+np_applet_index (const np_applet *a)
+{
+	return (int) (a - applets);
+}
+
+
+
+int
+np_applet_count (void)
+{
+	return (int) (sizeof (applets) / sizeof (applets[0])) - 1;
+}
+
+
+
+const char *
+np_applet_name (int i)
+{
+	int n = np_applet_count ();
+
+	if (i < n)
+		return applets[i].name;
+	return aliases[i - n].alias;
+}
+
+
+
+void
+np_applet_select (const np_applet *a)
+{
+	applet = a;
+}
+
+
+
+/* whether path, through symlinks, is this binary */
+static int
+is_self (const char *path)
+{
+	char *real;
+	int ret;
+
+	if (self == NULL || (real = realpath (path, NULL)) == NULL)
+		return FALSE;
+	ret = strcmp (real, self) == 0;
+	free (real);
+	return ret;
+}
+
+
+
+/* utils.c calls this for the usage of whichever plugin runs */
+void
+print_usage (void)
+{
+	if (applet)
+		applet->usage ();
+	else
+		print_applets ();
+}
+
+
+
+static const np_applet *
+find_applet (const char *name)
+{
+	int i;
+
+	for (i = 0; aliases[i].alias; i++)
+		if (strcmp (aliases[i].alias, name) == 0) {
+			name = aliases[i].name;
+			break;
+		}
+	for (i = 0; applets[i].name; i++)
+		if (strcmp (applets[i].name, name) == 0)
+			return &applets[i];
+	return NULL;
+}
+
+
+
+static void
+print_applets (void)
+{
+	int i;
+
+	printf ("%s\n", _("Usage:"));
+	printf ("%s PLUGIN [ARGS...]\n", progname);
+	printf ("%s\n", _("or through a symlink named as the plugin. The plugins:"));
+	for (i = 0; applets[i].name; i++)
+		printf (" %s\n", applets[i].name);
+	for (i = 0; aliases[i].alias; i++)
+		printf (" %s (%s)\n", aliases[i].alias, aliases[i].name);
+}
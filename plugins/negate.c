@@ -65,14 +65,18 @@ main (int argc, char **argv)
 	output chld_out, chld_err;
 	int i;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	timeout_interval = DEFAULT_TIMEOUT;
 
 	command_line = (char **) process_arguments (argc, argv);
 
+	/* Nothing to remap or substitute: be the plugin rather than wait on it */
+	if (!subst_text && command_line[1] != NULL) {
+		for (i = 0; i < 4 && state[i] == i; i++)
+			;
+		if (i == 4)
+			execv (command_line[0], command_line);
+	}
+
 	/* Set signal handling and alarm */
 	if (signal (SIGALRM, timeout_alarm_handler) == SIG_ERR)
 		die (STATE_UNKNOWN, _("Cannot catch SIGALRM"));
@@ -82,7 +86,8 @@ main (int argc, char **argv)
 	/* catch when the command is quoted */
 	if(command_line[1] == NULL) {
 		result = cmd_run (command_line[0], &chld_out, &chld_err, 0);
-	} else {
+	} else if (cmd_run_inprocess == NULL
+	           || (result = cmd_run_inprocess (command_line, &chld_out, &chld_err)) < 0) {
 		result = cmd_run_array (command_line, &chld_out, &chld_err, 0);
 	}
 	if (chld_err.lines > 0) {
@@ -257,6 +262,10 @@ print_help (void)
 	printf (" %s\n", _("If the wrapped plugin returns OK, the wrapper will return CRITICAL."));
 	printf (" %s\n", _("If the wrapped plugin returns CRITICAL, the wrapper will return OK."));
 	printf (" %s\n", _("Otherwise, the output state of the wrapped plugin is unchanged."));
+	printf (" %s\n", _("If no state is changed and -s is not given, negate runs the plugin in its"));
+	printf (" %s\n", _("place, with its own output, errors and timeout."));
+	printf (" %s\n", _("Built into the multi-call binary, negate runs its plugins within its own"));
+	printf (" %s\n", _("process; the plugin's timeout then stands in for negate's while it runs."));
 	printf ("\n");
 	printf (" %s\n", _("Using timeout-result, it is possible to override the timeout behaviour or a"));
 	printf (" %s\n", _("plugin by setting the negate timeout a bit lower."));
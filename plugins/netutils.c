@@ -29,15 +29,544 @@
 
 #include "common.h"
 #include "netutils.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <sys/stat.h>
+#if defined(HAVE_LINUX_NET_TSTAMP_H) && defined(HAVE_LINUX_ERRQUEUE_H)
+# include <linux/net_tstamp.h>
+# include <linux/errqueue.h>
+/* the SOF_TIMESTAMPING_ flags are an enum; these headers have them all
+ * when they define the origin of the time stamps sent back */
+# if defined(SO_TIMESTAMPING) && defined(SO_EE_ORIGIN_TIMESTAMPING)
+#  define NP_NET_TX_TIMESTAMPS 1
+# endif
+#endif
+
+/* RFC 8305 "Connection Attempt Delay": how long a TCP connect attempt
+ * runs on its own before the next address is tried alongside it */
+#define NP_NET_ATTEMPT_DELAY 250
 
 int econn_refuse_state = STATE_CRITICAL;
 int was_refused = FALSE;
+int np_net_verbose = 0;
+int np_net_connect_timeout = 0;
+int np_net_io_timeout = 0;
+int np_net_fastopen = FALSE;
+int np_net_adaptive = FALSE;
+double np_net_max_rate = 0;
+int np_net_max_inflight = 0;
 #if USE_IPV6
 int address_family = AF_UNSPEC;
 #else
 int address_family = AF_INET;
 #endif
 
+/* The addresses of each name looked up during this run, so that is_host(),
+ * np_net_connect() and the rest ask the resolver once per name (check_http
+ * following a redirect, check_smtp validating then connecting). A lookup
+ * for a port and socket type gets a list built from the cached addresses.
+ *
+ * With NAGIOS_PLUGIN_DNS_CACHE_TTL set to a number of seconds, names are
+ * also kept that long in the state directory for the runs that follow.
+ * Setuid plugins get no such cache, as they get no state. */
+#define NP_RESOLVED_MAGIC "NPDNS\0\0\1"
+#define NP_RESOLVED_MAX 16	/* addresses kept for a name */
+
+struct np_resolved_addr {
+	uint32_t len;
+	struct sockaddr_storage addr;
+};
+
+struct np_resolved_view {
+	char port[6];
+	int socktype;
+	int proto;
+	struct addrinfo *list;	/* one block: the entries, then their addresses */
+	struct np_resolved_view *next;
+};
+
+struct np_resolved {
+	char *host;
+	int family;
+	int count;
+	struct np_resolved_addr addrs[NP_RESOLVED_MAX];
+	struct np_resolved_view *views;
+	struct np_resolved *next;
+};
+static struct np_resolved *resolved = NULL;
+
+/* the on-disk copy of a struct np_resolved */
+struct np_resolved_file {
+	char magic[8];
+	int64_t expires;
+	int32_t family;
+	int32_t count;
+	struct np_resolved_addr addrs[NP_RESOLVED_MAX];
+};
+
+static void
+np_net_resolved_free (void)
+{
+	struct np_resolved *r;
+	struct np_resolved_view *v;
+
+	while ((r = resolved) != NULL) {
+		resolved = r->next;
+		while ((v = r->views) != NULL) {
+			r->views = v->next;
+			free (v->list);
+			free (v);
+		}
+		free (r->host);
+		free (r);
+	}
+}
+
+static int
+np_net_resolved_ttl (void)
+{
+	char *ttl = getenv ("NAGIOS_PLUGIN_DNS_CACHE_TTL");
+
+	if (ttl == NULL || !is_intpos (ttl) || np_suid ())
+		return 0;
+	return atoi (ttl);
+}
+
+/* the state file for a name, NULL when names are not kept or the name is
+ * an address anyway */
+static char *
+np_net_resolved_path (const char *host, int family)
+{
+	struct sha1_ctx ctx;
+	struct in6_addr addr;
+	unsigned char key[20];
+	char *path, keyname[41];
+	int i;
+
+	if (np_net_resolved_ttl () == 0 ||
+	    inet_pton (AF_INET, host, &addr) == 1 || inet_pton (AF_INET6, host, &addr) == 1)
+		return NULL;
+	sha1_init_ctx (&ctx);
+	sha1_process_bytes (host, strlen (host) + 1, &ctx);
+	sha1_process_bytes (&family, sizeof (family), &ctx);
+	sha1_finish_ctx (&ctx, key);
+	for (i = 0; i < 20; i++)
+		sprintf (&keyname[2 * i], "%02x", key[i]);
+
+	if (asprintf (&path, "%s/%lu/dns_cache/%s", _np_state_calculate_location_prefix (),
+	              (unsigned long) geteuid (), keyname) < 0)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	return path;
+}
+
+static int
+np_net_resolved_load (const char *path, struct np_resolved *r)
+{
+	struct np_resolved_file f;
+	struct stat st;
+	int fd, ok;
+
+	if ((fd = open (path, O_RDONLY)) < 0)
+		return FALSE;
+	ok = fstat (fd, &st) == 0 && st.st_size == sizeof (f) && read (fd, &f, sizeof (f)) == sizeof (f) &&
+	     !memcmp (f.magic, NP_RESOLVED_MAGIC, sizeof (f.magic)) && f.family == r->family &&
+	     f.count > 0 && f.count <= NP_RESOLVED_MAX && f.expires > (int64_t) time (NULL);
+	close (fd);
+	if (!ok)
+		return FALSE;
+	r->count = f.count;
+	memcpy (r->addrs, f.addrs, sizeof (r->addrs));
+	return TRUE;
+}
+
+/* replaces the state file at path with data; failing to store what is
+ * only kept to save time is no error */
+static void
+np_net_state_write (char *path, const void *data, size_t len)
+{
+	char *temp_file, *p;
+	int fd;
+
+	/* the state directory may not exist yet */
+	for (p = strchr (path + 1, '/'); p; p = strchr (p + 1, '/')) {
+		*p = '\0';
+		if (access (path, F_OK))
+			mkdir (path, S_IRWXU);
+		*p = '/';
+	}
+
+	if (asprintf (&temp_file, "%s.XXXXXX", path) < 0)
+		return;
+	if ((fd = mkstemp (temp_file)) >= 0) {
+		if (write (fd, data, len) == (ssize_t) len && close (fd) == 0)
+			rename (temp_file, path);
+		else
+			close (fd);
+		unlink (temp_file);
+	}
+	free (temp_file);
+}
+
+/* failing to store a name only costs a lookup next time */
+static void
+np_net_resolved_save (char *path, const struct np_resolved *r)
+{
+	struct np_resolved_file f;
+
+	memset (&f, 0, sizeof (f));
+	memcpy (f.magic, NP_RESOLVED_MAGIC, sizeof (f.magic));
+	f.expires = (int64_t) time (NULL) + np_net_resolved_ttl ();
+	f.family = r->family;
+	f.count = r->count;
+	memcpy (f.addrs, r->addrs, sizeof (f.addrs));
+	np_net_state_write (path, &f, sizeof (f));
+}
+
+/* the addresses of host, from this run's cache, the state directory or
+ * the resolver; a getaddrinfo() error code if there are none */
+static int
+np_net_lookup (const char *host, int family, struct np_resolved **found)
+{
+	struct np_resolved *r;
+	struct addrinfo hints, *res, *ai;
+	char *path;
+	int result;
+
+	for (r = resolved; r; r = r->next) {
+		if (r->family == family && !strcmp (r->host, host)) {
+			*found = r;
+			return 0;
+		}
+	}
+
+	if ((r = calloc (1, sizeof (*r))) == NULL || (r->host = strdup (host)) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	r->family = family;
+
+	path = np_net_resolved_path (host, family);
+	if (path == NULL || !np_net_resolved_load (path, r)) {
+		/* one entry for each address, whatever the socket type */
+		memset (&hints, 0, sizeof (hints));
+		hints.ai_family = family;
+		hints.ai_socktype = SOCK_STREAM;
+		np_timer_phase_begin (NP_PHASE_DNS);
+		result = getaddrinfo (host, NULL, &hints, &res);
+		np_timer_phase_end (NP_PHASE_DNS);
+		if (result != 0) {
+			free (path);
+			free (r->host);
+			free (r);
+			return result;
+		}
+		for (ai = res; ai && r->count < NP_RESOLVED_MAX; ai = ai->ai_next) {
+			if (ai->ai_addrlen > sizeof (r->addrs[0].addr))
+				continue;
+			r->addrs[r->count].len = ai->ai_addrlen;
+			memcpy (&r->addrs[r->count].addr, ai->ai_addr, ai->ai_addrlen);
+			r->count++;
+		}
+		freeaddrinfo (res);
+		if (r->count == 0) {
+			free (path);
+			free (r->host);
+			free (r);
+			return EAI_NONAME;
+		}
+		if (path)
+			np_net_resolved_save (path, r);
+	}
+	free (path);
+
+	r->next = resolved;
+	resolved = r;
+	*found = r;
+	return 0;
+}
+
+/* getaddrinfo() for a host name and numeric port, answered from the cache
+ * if the name was looked up before. The result belongs to the cache and
+ * must not be freed. */
+int
+np_net_getaddrinfo (const char *host, const char *port, const struct addrinfo *hints,
+                    struct addrinfo **res)
+{
+	struct np_resolved *r;
+	struct np_resolved_view *v;
+	struct addrinfo *ai;
+	struct sockaddr_storage *sa;
+	int i, result, socktype = hints->ai_socktype ? hints->ai_socktype : SOCK_STREAM;
+
+	if ((result = np_net_lookup (host, hints->ai_family, &r)) != 0)
+		return result;
+
+	for (v = r->views; v; v = v->next) {
+		if (!strcmp (v->port, port ? port : "") && v->socktype == socktype && v->proto == hints->ai_protocol) {
+			*res = v->list;
+			return 0;
+		}
+	}
+
+	if ((v = malloc (sizeof (*v))) == NULL ||
+	    (v->list = calloc (r->count, sizeof (struct addrinfo) + sizeof (struct sockaddr_storage))) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	snprintf (v->port, sizeof (v->port), "%s", port ? port : "");
+	v->socktype = socktype;
+	v->proto = hints->ai_protocol;
+	sa = (struct sockaddr_storage *) (v->list + r->count);
+	for (i = 0; i < r->count; i++) {
+		ai = &v->list[i];
+		memcpy (&sa[i], &r->addrs[i].addr, r->addrs[i].len);
+		if (sa[i].ss_family == AF_INET)
+			((struct sockaddr_in *) &sa[i])->sin_port = htons (atoi (v->port));
+#ifdef USE_IPV6
+		else if (sa[i].ss_family == AF_INET6)
+			((struct sockaddr_in6 *) &sa[i])->sin6_port = htons (atoi (v->port));
+#endif
+		ai->ai_family = sa[i].ss_family;
+		ai->ai_socktype = socktype;
+		ai->ai_protocol = hints->ai_protocol;
+		ai->ai_addrlen = r->addrs[i].len;
+		ai->ai_addr = (struct sockaddr *) &sa[i];
+		ai->ai_next = i + 1 < r->count ? &v->list[i + 1] : NULL;
+	}
+	v->next = r->views;
+	r->views = v;
+	*res = v->list;
+	return 0;
+}
+
+/* With np_net_adaptive, each target (name or address, port and protocol)
+ * keeps an estimate of its round-trip time in the state directory, from
+ * the TCP handshakes and the UDP exchanges with it. Attempts that take
+ * longer than the estimate allows for are made again - a new connection
+ * attempt alongside a SYN that may be lost, a datagram sent again - with
+ * the wait doubling each time, up to the usual deadline of the operation.
+ * Nothing fails earlier than it would otherwise. */
+#define NP_RTT_MAGIC "NPRTT\0\0\1"
+#define NP_NET_RETRIES 3	/* attempts made again per connection or exchange */
+#define NP_RTT_MAX_AGE 86400	/* seconds an estimate outlasts its last sample */
+
+struct np_rtt_file {
+	char magic[8];
+	int64_t updated;
+	double srtt;
+	double rttvar;
+	uint64_t samples;
+};
+
+static np_rtt np_net_rtt;
+static char *np_net_rtt_file = NULL;
+
+/* loads the estimate for a target, or starts one */
+static void
+np_net_rtt_load (const char *host, int port, int proto)
+{
+	struct np_rtt_file f;
+	struct sha1_ctx ctx;
+	struct stat st;
+	unsigned char key[20];
+	char keyname[41];
+	int fd, i;
+
+	free (np_net_rtt_file);
+	np_net_rtt_file = NULL;
+	memset (&np_net_rtt, 0, sizeof (np_net_rtt));
+	if (!np_net_adaptive || np_suid ())
+		return;
+
+	sha1_init_ctx (&ctx);
+	sha1_process_bytes (host, strlen (host) + 1, &ctx);
+	sha1_process_bytes (&port, sizeof (port), &ctx);
+	sha1_process_bytes (&proto, sizeof (proto), &ctx);
+	sha1_finish_ctx (&ctx, key);
+	for (i = 0; i < 20; i++)
+		sprintf (&keyname[2 * i], "%02x", key[i]);
+	if (asprintf (&np_net_rtt_file, "%s/%lu/rtt/%s", _np_state_calculate_location_prefix (),
+	              (unsigned long) geteuid (), keyname) < 0)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+
+	if ((fd = open (np_net_rtt_file, O_RDONLY)) < 0)
+		return;
+	if (fstat (fd, &st) == 0 && st.st_size == sizeof (f) && read (fd, &f, sizeof (f)) == sizeof (f) &&
+	    !memcmp (f.magic, NP_RTT_MAGIC, sizeof (f.magic)) && f.srtt >= 0 && f.rttvar >= 0 &&
+	    f.updated + NP_RTT_MAX_AGE > (int64_t) time (NULL)) {
+		np_net_rtt.srtt = f.srtt;
+		np_net_rtt.rttvar = f.rttvar;
+		np_net_rtt.samples = f.samples;
+	}
+	close (fd);
+	if (np_net_verbose && np_net_rtt.samples)
+		printf (_("Round-trip time of %s port %d is %.1f ms, give or take %.1f ms\n"),
+		        host, port, np_net_rtt.srtt, np_net_rtt.rttvar);
+}
+
+/* one round trip with the target, in milliseconds */
+static void
+np_net_rtt_save (int64_t ms)
+{
+	struct np_rtt_file f;
+
+	if (np_net_rtt_file == NULL)
+		return;
+	np_rtt_add (&np_net_rtt, (double) ms);
+	memset (&f, 0, sizeof (f));
+	memcpy (f.magic, NP_RTT_MAGIC, sizeof (f.magic));
+	f.updated = (int64_t) time (NULL);
+	f.srtt = np_net_rtt.srtt;
+	f.rttvar = np_net_rtt.rttvar;
+	f.samples = np_net_rtt.samples;
+	np_net_state_write (np_net_rtt_file, &f, sizeof (f));
+}
+
+/* puts the connection options above back to their defaults, for plugins
+ * that run more than one check per process (see resident.h) */
+void
+np_net_reset (void)
+{
+	np_net_resolved_free ();
+	econn_refuse_state = STATE_CRITICAL;
+	was_refused = FALSE;
+	np_net_verbose = 0;
+	np_net_connect_timeout = 0;
+	np_net_io_timeout = 0;
+	np_net_fastopen = FALSE;
+	np_net_adaptive = FALSE;
+	np_net_max_rate = 0;
+	np_net_max_inflight = 0;
+	free (np_net_rtt_file);
+	np_net_rtt_file = NULL;
+	np_timer_phase_reset ();
+#if USE_IPV6
+	address_family = AF_UNSPEC;
+#else
+	address_family = AF_INET;
+#endif
+}
+
+/* milliseconds on a clock that does not jump */
+static int64_t
+np_net_now (void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return (int64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+/* Operations get timeout_ms, or if that is 0 one second less than the
+ * plugin timeout, so that they fail with their own message before the
+ * alarm goes off. */
+int64_t
+np_net_deadline (int timeout_ms)
+{
+	if (timeout_ms <= 0)
+		timeout_ms = timeout_interval > 1 ? (timeout_interval - 1) * 1000 : 1000;
+	return np_net_now () + timeout_ms;
+}
+
+/* milliseconds left until deadline, never negative */
+int
+np_net_time_left (int64_t deadline)
+{
+	int64_t left = deadline - np_net_now ();
+
+	return left < 0 ? 0 : left > INT_MAX ? INT_MAX : (int) left;
+}
+
+/* Wait until sd is ready for events (POLLIN or POLLOUT). Returns 1 when
+ * it is, 0 once the deadline has passed and -1 on errors. */
+int
+np_net_wait (int sd, short events, int64_t deadline)
+{
+	int ret;
+#if defined(HAVE_POLL) && defined(HAVE_SYS_POLL_H)
+	struct pollfd pfd;
+
+	pfd.fd = sd;
+	pfd.events = events;
+	do {
+		ret = poll (&pfd, 1, np_net_time_left (deadline));
+	} while (ret < 0 && errno == EINTR);
+#else
+	struct timeval tv;
+	fd_set fds;
+	int left;
+
+	do {
+		left = np_net_time_left (deadline);
+		tv.tv_sec = left / 1000;
+		tv.tv_usec = (left % 1000) * 1000;
+		FD_ZERO (&fds);
+		FD_SET (sd, &fds);
+		ret = select (sd + 1, (events & POLLIN) ? &fds : NULL,
+		              (events & POLLOUT) ? &fds : NULL, NULL, &tv);
+	} while (ret < 0 && errno == EINTR);
+#endif
+	return ret < 0 ? -1 : ret > 0;
+}
+
+/* send all of buf before the deadline */
+static int
+np_net_send_all (int sd, const char *buf, size_t len, int64_t deadline)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		if (np_net_wait (sd, POLLOUT, deadline) <= 0)
+			return -1;
+		if ((ret = send (sd, buf, len, 0)) < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		len -= (size_t) ret;
+	}
+	return 0;
+}
+
+/* Wait for the answer to the datagram in buf, which was just sent on sd,
+ * until the deadline; as np_net_wait(). With np_net_adaptive and an
+ * estimate for the target, it is sent again each time the answer is late
+ * for that, and the round trip is only counted in if it was not (RFC 6298
+ * after Karn: an answer to a datagram sent twice is to either). */
+int
+np_net_udp_wait (int sd, const char *buf, size_t len, int64_t deadline)
+{
+	int64_t start = np_net_now (), attempt = start;
+	int rto = np_rtt_timeout (&np_net_rtt, np_net_time_left (deadline));
+	int ready, sent = 1;
+
+	while (1) {
+		if (rto > 0 && sent <= NP_NET_RETRIES && attempt + rto < deadline) {
+			ready = np_net_wait (sd, POLLIN, attempt + rto);
+			if (ready == 0) {
+				if (np_net_verbose)
+					printf (_("No answer after %d ms, sending again\n"), rto);
+				attempt = np_net_now ();
+				if (send (sd, buf, len, 0) < 0)
+					return -1;
+				sent++;
+				rto *= 2;
+				continue;
+			}
+		} else
+			ready = np_net_wait (sd, POLLIN, deadline);
+		break;
+	}
+	if (ready > 0 && sent == 1)
+		np_net_rtt_save (np_net_now () - start);
+	return ready;
+}
+
 /* handles socket timeouts */
 void
 socket_timeout_alarm_handler (int sig)
@@ -68,7 +597,7 @@ socket_timeout_alarm_handler (int sig)
 		write(STDOUT_FILENO, msg2, sizeof(msg2) - 1);
 /*		printf (_("%s - Abnormal timeout after %d seconds\n"), state_text(timeout_state), timeout_interval); */
 
-	exit (timeout_state);
+	np_exit (timeout_state);
 }
 
 /* connects to a host on a specified tcp port, sends a string, and gets a
@@ -80,34 +609,25 @@ process_tcp_request2 (const char *server_address, int server_port,
 {
 
 	int result;
-	int send_result;
 	int recv_result;
 	int sd;
-	struct timeval tv;
-	fd_set readfds;
+	int64_t deadline;
 	int recv_length = 0;
 
 	result = np_net_connect (server_address, server_port, &sd, IPPROTO_TCP);
 	if (result != STATE_OK)
 		return STATE_CRITICAL;
 
-	send_result = send (sd, send_buffer, strlen (send_buffer), 0);
-	if (send_result<0 || (size_t)send_result!=strlen(send_buffer)) {
+	/* one deadline for sending and the whole of the answer */
+	deadline = np_net_deadline (np_net_io_timeout);
+	if (np_net_send_all (sd, send_buffer, strlen (send_buffer), deadline) < 0) {
 		printf ("%s\n", _("Send failed"));
 		result = STATE_WARNING;
 	}
 
 	while (1) {
-		/* wait up to the number of seconds for socket timeout
-		   minus one for data from the host */
-		tv.tv_sec = timeout_interval - 1;
-		tv.tv_usec = 0;
-		FD_ZERO (&readfds);
-		FD_SET (sd, &readfds);
-		select (sd + 1, &readfds, NULL, NULL, &tv);
-
 		/* make sure some data has arrived */
-		if (!FD_ISSET (sd, &readfds)) {	/* it hasn't */
+		if (np_net_wait (sd, POLLIN, deadline) <= 0) {	/* it hasn't */
 			if (!recv_length) {
 				strcpy (recv_buffer, "");
 				printf ("%s\n", _("No data was received from host!"));
@@ -142,7 +662,7 @@ process_tcp_request2 (const char *server_address, int server_port,
 				}
 			}
 		}
-		/* end if(!FD_ISSET(sd,&readfds)) */
+		/* end if(np_net_wait()) */
 	}
 	/* end while(1) */
 
@@ -172,6 +692,397 @@ process_request (const char *server_address, int server_port, int proto,
 }
 
 
+void
+np_line_reader_init (np_line_reader *reader, int sd, int (*ssl_read) (void *, int))
+{
+	reader->sd = sd;
+	reader->ssl_read = ssl_read;
+	reader->start = reader->end = 0;
+}
+
+/* more data into the buffer, after what is left of it */
+static int
+np_line_reader_fill (np_line_reader *reader)
+{
+	int n;
+
+	if (reader->start > 0) {
+		memmove (reader->buf, reader->buf + reader->start, reader->end - reader->start);
+		reader->end -= reader->start;
+		reader->start = 0;
+	}
+	if (reader->ssl_read)
+		n = reader->ssl_read (reader->buf + reader->end, sizeof (reader->buf) - reader->end);
+	else
+		n = read (reader->sd, reader->buf + reader->end, sizeof (reader->buf) - reader->end);
+	if (n > 0)
+		reader->end += n;
+	return n;
+}
+
+int
+np_recvline (np_line_reader *reader, char *buf, size_t bufsize)
+{
+	char *nl;
+	size_t len;
+	int n;
+
+	if (bufsize < 2)
+		return -2;
+	for (;;) {
+		len = reader->end - reader->start;
+		if ((nl = memchr (reader->buf + reader->start, '\n', len)) != NULL) {
+			len = nl - (reader->buf + reader->start) + 1;
+			break;
+		}
+		/* no room for more of the line */
+		if (len >= bufsize - 1 || len == sizeof (reader->buf))
+			return -2;
+		if ((n = np_line_reader_fill (reader)) < 0)
+			return n;
+		/* the end of the data ends the last line, newline or not */
+		if (n == 0) {
+			if (len == 0)
+				return 0;
+			break;
+		}
+	}
+	if (len > bufsize - 1)
+		return -2;
+	memcpy (buf, reader->buf + reader->start, len);
+	buf[len] = '\0';
+	reader->start += len;
+	return (int) len;
+}
+
+int
+np_recvlines (np_line_reader *reader, char *buf, size_t bufsize)
+{
+	int result, i;
+
+	for (i = 0; /* forever */; i += result)
+		if (!((result = np_recvline (reader, buf + i, bufsize - i)) > 3 &&
+		    isdigit ((int) buf[i]) &&
+		    isdigit ((int) buf[i + 1]) &&
+		    isdigit ((int) buf[i + 2]) &&
+		    buf[i + 3] == '-'))
+			break;
+
+	return (result <= 0) ? result : result + i;
+}
+
+
+int
+np_net_timestamps (int sd)
+{
+	int stamps = 0, on = 1;
+#ifdef NP_NET_TX_TIMESTAMPS
+	int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+	            SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+#endif
+
+#if defined(SO_TIMESTAMPNS)
+	if (setsockopt (sd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof (on)) == 0)
+		stamps |= NP_NET_RX_STAMPS;
+#elif defined(SO_TIMESTAMP)
+	if (setsockopt (sd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof (on)) == 0)
+		stamps |= NP_NET_RX_STAMPS;
+#endif
+#ifdef NP_NET_TX_TIMESTAMPS
+	if (setsockopt (sd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof (flags)) == 0)
+		stamps |= NP_NET_TX_STAMPS;
+#endif
+	(void) on;
+	return stamps;
+}
+
+ssize_t
+np_net_recvfrom_time (int sd, void *buf, size_t len, int flags, struct sockaddr *from,
+                      socklen_t *fromlen, struct timeval *when)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		char buf[256];
+		struct cmsghdr align;
+	} control;
+	ssize_t got;
+	int stamped = FALSE;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	memset (&msg, 0, sizeof (msg));
+	msg.msg_name = from;
+	msg.msg_namelen = fromlen ? *fromlen : 0;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof (control.buf);
+	if ((got = recvmsg (sd, &msg, flags)) < 0)
+		return got;
+	if (fromlen)
+		*fromlen = msg.msg_namelen;
+	for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+#ifdef SCM_TIMESTAMPNS
+		if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec ts;
+
+			memcpy (&ts, CMSG_DATA (cmsg), sizeof (ts));
+			when->tv_sec = ts.tv_sec;
+			when->tv_usec = ts.tv_nsec / 1000;
+			stamped = TRUE;
+		}
+#endif
+#ifdef SCM_TIMESTAMP
+		if (cmsg->cmsg_type == SCM_TIMESTAMP) {
+			memcpy (when, CMSG_DATA (cmsg), sizeof (*when));
+			stamped = TRUE;
+		}
+#endif
+	}
+	if (!stamped)
+		gettimeofday (when, NULL);
+	return got;
+}
+
+int
+np_net_sent_time (int sd, uint32_t *id, struct timeval *when)
+{
+#ifdef NP_NET_TX_TIMESTAMPS
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union {
+		char buf[512];
+		struct cmsghdr align;
+	} control;
+	struct scm_timestamping stamp;
+	struct sock_extended_err err;
+	int have_stamp, have_id;
+
+	for (;;) {
+		memset (&msg, 0, sizeof (msg));
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof (control.buf);
+		if (recvmsg (sd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			return FALSE;
+		have_stamp = have_id = FALSE;
+		for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+				memcpy (&stamp, CMSG_DATA (cmsg), sizeof (stamp));
+				have_stamp = TRUE;
+			}
+			else if ((cmsg->cmsg_level == SOL_IP || cmsg->cmsg_level == SOL_IPV6) &&
+			         (cmsg->cmsg_type == IP_RECVERR || cmsg->cmsg_type == IPV6_RECVERR)) {
+				memcpy (&err, CMSG_DATA (cmsg), sizeof (err));
+				have_id = err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING;
+			}
+		}
+		/* anything else on the queue is not ours to report */
+		if (have_stamp && have_id) {
+			*id = err.ee_data;
+			when->tv_sec = stamp.ts[0].tv_sec;
+			when->tv_usec = stamp.ts[0].tv_nsec / 1000;
+			return TRUE;
+		}
+	}
+#else
+	(void) sd;
+	(void) id;
+	(void) when;
+	return FALSE;
+#endif
+}
+
+/* With a cookie from an earlier connection, the kernel then sends the
+ * first data with the SYN and connect() returns at once; without one it
+ * asks for a cookie during a normal handshake. Failing to set it is not
+ * an error. */
+static void
+np_net_fastopen_socket (int fd)
+{
+#ifdef TCP_FASTOPEN_CONNECT
+	int on = 1;
+
+	if (np_net_fastopen &&
+	    setsockopt (fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof (on)) < 0 && np_net_verbose)
+		printf (_("TCP Fast Open is not available: %s\n"), strerror (errno));
+#endif
+}
+
+
+#if defined(HAVE_POLL) && defined(HAVE_SYS_POLL_H)
+static const char *
+np_net_address_text (const struct addrinfo *res, char *text, size_t size)
+{
+	if (getnameinfo (res->ai_addr, res->ai_addrlen, text, size, NULL, 0, NI_NUMERICHOST) != 0)
+		snprintf (text, size, "?");
+	return text;
+}
+
+/* Happy Eyeballs (RFC 8305): the addresses are tried in turn, alternating
+ * between address families, but each attempt only gets
+ * NP_NET_ATTEMPT_DELAY ms on its own before the next one starts next to
+ * it. The first connection to be established wins and the others are
+ * dropped, so an unreachable address family costs a quarter of a second
+ * instead of a connect timeout. Returns 0, or -1 with errno set from the
+ * last attempt that failed (ETIMEDOUT if the deadline passed first). */
+static int
+np_net_connect_race (struct addrinfo *list, int *sd, int64_t deadline)
+{
+	struct addrinfo *res, *first, *other, **addr, **pending;
+	struct pollfd *pfd;
+	int64_t *started;
+	char text[NI_MAXHOST];
+	size_t count = 0, attempts, next = 0, npending = 0, i;
+	socklen_t len;
+	int fd, flags, error = ETIMEDOUT, winner = -1, ready, soerror, wait, delay;
+
+	for (res = list; res; res = res->ai_next)
+		count++;
+	/* RFC 8305 lets the attempt delay follow the history of the target;
+	 * past the last address, attempts to the first ones are made again */
+	delay = np_rtt_timeout (&np_net_rtt, np_net_time_left (deadline));
+	attempts = count;
+	if (delay > 0)
+		attempts += NP_NET_RETRIES;
+	else
+		delay = NP_NET_ATTEMPT_DELAY;
+	addr = malloc (count * sizeof (*addr));
+	pending = malloc (attempts * sizeof (*pending));
+	pfd = malloc (attempts * sizeof (*pfd));
+	started = malloc (attempts * sizeof (*started));
+	if (addr == NULL || pending == NULL || pfd == NULL || started == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+
+	/* the resolver's order, but with the families interleaved */
+	for (first = other = list, i = 0; i < count;) {
+		while (first && first->ai_family != list->ai_family)
+			first = first->ai_next;
+		if (first) {
+			addr[i++] = first;
+			first = first->ai_next;
+		}
+		while (other && other->ai_family == list->ai_family)
+			other = other->ai_next;
+		if (other) {
+			addr[i++] = other;
+			other = other->ai_next;
+		}
+	}
+
+	while (winner < 0 && (next < count || npending > 0)) {
+		/* start the next attempt, at once if nothing else is in flight;
+		 * one made again waits twice as long as the one before */
+		if (next < count || (next < attempts && npending > 0)) {
+			res = addr[next % count];
+			if (next++ >= count) {
+				if (np_net_verbose)
+					printf (_("Connecting to %s again after %d ms\n"),
+					        np_net_address_text (res, text, sizeof (text)), delay);
+				delay *= 2;
+			}
+			if ((fd = socket (res->ai_family, res->ai_socktype, res->ai_protocol)) < 0) {
+				error = errno;
+				if (np_net_verbose)
+					printf (_("Socket creation for %s failed: %s\n"),
+					        np_net_address_text (res, text, sizeof (text)), strerror (error));
+				continue;
+			}
+			np_net_fastopen_socket (fd);
+			flags = fcntl (fd, F_GETFL, 0);
+			fcntl (fd, F_SETFL, flags | O_NONBLOCK);
+			started[npending] = np_net_now ();
+			if (connect (fd, res->ai_addr, res->ai_addrlen) == 0) {
+				pfd[npending].fd = fd;
+				pending[npending] = res;
+				winner = npending++;
+				break;
+			}
+			if (errno != EINPROGRESS) {
+				error = errno;
+				if (error == ECONNREFUSED)
+					was_refused = TRUE;
+				if (np_net_verbose)
+					printf (_("Connect to %s failed: %s\n"),
+					        np_net_address_text (res, text, sizeof (text)), strerror (error));
+				close (fd);
+				continue;
+			}
+			pfd[npending].fd = fd;
+			pfd[npending].events = POLLOUT;
+			pending[npending++] = res;
+		}
+
+		if ((wait = np_net_time_left (deadline)) == 0) {
+			error = ETIMEDOUT;
+			break;
+		}
+		if (next < attempts && wait > delay)
+			wait = delay;
+		ready = poll (pfd, npending, wait);
+		if (ready < 0 && errno != EINTR) {
+			error = errno;
+			break;
+		}
+
+		for (i = 0; ready > 0 && i < npending; i++) {
+			if (pfd[i].revents == 0)
+				continue;
+			len = sizeof (soerror);
+			if (getsockopt (pfd[i].fd, SOL_SOCKET, SO_ERROR, &soerror, &len) < 0)
+				soerror = errno;
+			if (soerror == 0) {
+				winner = i;
+				break;
+			}
+			error = soerror;
+			if (error == ECONNREFUSED)
+				was_refused = TRUE;
+			if (np_net_verbose)
+				printf (_("Connect to %s failed: %s\n"),
+				        np_net_address_text (pending[i], text, sizeof (text)), strerror (error));
+			close (pfd[i].fd);
+			pfd[i] = pfd[--npending];
+			started[i] = started[npending];
+			pending[i--] = pending[npending];
+		}
+	}
+
+	for (i = 0; i < npending; i++) {
+		if ((int) i == winner)
+			continue;
+		if (np_net_verbose)
+			printf (_("Attempt to connect to %s abandoned\n"),
+			        np_net_address_text (pending[i], text, sizeof (text)));
+		close (pfd[i].fd);
+	}
+
+	if (winner >= 0) {
+		*sd = pfd[winner].fd;
+		/* callers expect a blocking socket */
+		flags = fcntl (*sd, F_GETFL, 0);
+		fcntl (*sd, F_SETFL, flags & ~O_NONBLOCK);
+		if (np_net_verbose)
+			printf (_("Connected to %s\n"), np_net_address_text (pending[winner], text, sizeof (text)));
+		was_refused = FALSE;
+		np_net_rtt_save (np_net_now () - started[winner]);
+	}
+
+	free (addr);
+	free (pending);
+	free (pfd);
+	free (started);
+	if (winner < 0) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+#endif
+
 /* opens a tcp or udp connection to a remote host or local socket */
 int
 np_net_connect (const char *host_name, int port, int *sd, int proto)
@@ -204,7 +1115,7 @@ np_net_connect (const char *host_name, int port, int *sd, int proto)
 		memcpy (host, host_name, len);
 		host[len] = '\0';
 		snprintf (port_str, sizeof (port_str), "%d", port);
-		result = getaddrinfo (host, port_str, &hints, &orig_res);
+		result = np_net_getaddrinfo (host, port_str, &hints, &orig_res);
 
 		if (result != 0) {
 			if (result == EAI_NONAME)
@@ -215,16 +1126,26 @@ np_net_connect (const char *host_name, int port, int *sd, int proto)
 		}
 
 		res = orig_res;
+		np_net_rtt_load (host, port, proto);
+		np_timer_phase_begin (NP_PHASE_CONNECT);
+#if defined(HAVE_POLL) && defined(HAVE_SYS_POLL_H)
+		if (socktype == SOCK_STREAM) {
+			result = np_net_connect_race (orig_res, sd, np_net_deadline (np_net_connect_timeout));
+			res = NULL;
+		}
+#endif
 		while (res) {
 			/* attempt to create a socket */
 			*sd = socket (res->ai_family, socktype, res->ai_protocol);
 
 			if (*sd < 0) {
 				printf ("%s\n", _("Socket creation failed"));
-				freeaddrinfo (orig_res);
 				return STATE_UNKNOWN;
 			}
 
+			if (socktype == SOCK_STREAM)
+				np_net_fastopen_socket (*sd);
+
 			/* attempt to open a connection */
 			result = connect (*sd, res->ai_addr, res->ai_addrlen);
 
@@ -244,7 +1165,7 @@ np_net_connect (const char *host_name, int port, int *sd, int proto)
 			close (*sd);
 			res = res->ai_next;
 		}
-		freeaddrinfo (orig_res);
+		np_timer_phase_end (NP_PHASE_CONNECT);
 	}
 	/* else the hostname is interpreted as a path to a unix socket */
 	else {
@@ -258,7 +1179,9 @@ np_net_connect (const char *host_name, int port, int *sd, int proto)
 		if(*sd < 0){
 			die(STATE_UNKNOWN, _("Socket creation failed"));
 		}
+		np_timer_phase_begin (NP_PHASE_CONNECT);
 		result = connect(*sd, (struct sockaddr *)&su, sizeof(su));
+		np_timer_phase_end (NP_PHASE_CONNECT);
 		if (result < 0 && errno == ECONNREFUSED)
 			was_refused = TRUE;
 	}
@@ -285,12 +1208,15 @@ np_net_connect (const char *host_name, int port, int *sd, int proto)
 		}
 	}
 	else {
+		/* printf() may change errno */
+		int error = errno;
+
 		if (is_socket)
-			printf("connect to file socket %s: %s\n", host_name, strerror(errno));
+			printf("connect to file socket %s: %s\n", host_name, strerror(error));
 		else
 			printf("connect to address %s and port %d: %s\n",
-			       host_name, port, strerror(errno));
-		return STATE_CRITICAL;
+			       host_name, port, strerror(error));
+		return error == ETIMEDOUT ? timeout_state : STATE_CRITICAL;
 	}
 }
 
@@ -298,27 +1224,17 @@ int
 send_request (int sd, int proto, const char *send_buffer, char *recv_buffer, int recv_size)
 {
 	int result = STATE_OK;
-	int send_result;
 	int recv_result;
-	struct timeval tv;
-	fd_set readfds;
+	int64_t deadline = np_net_deadline (np_net_io_timeout);
 
-	send_result = send (sd, send_buffer, strlen (send_buffer), 0);
-	if (send_result<0 || (size_t)send_result!=strlen(send_buffer)) {
+	if (np_net_send_all (sd, send_buffer, strlen (send_buffer), deadline) < 0) {
 		printf ("%s\n", _("Send failed"));
 		result = STATE_WARNING;
 	}
 
-	/* wait up to the number of seconds for socket timeout minus one
-	   for data from the host */
-	tv.tv_sec = timeout_interval - 1;
-	tv.tv_usec = 0;
-	FD_ZERO (&readfds);
-	FD_SET (sd, &readfds);
-	select (sd + 1, &readfds, NULL, NULL, &tv);
-
 	/* make sure some data has arrived */
-	if (!FD_ISSET (sd, &readfds)) {
+	if ((proto == IPPROTO_UDP ? np_net_udp_wait (sd, send_buffer, strlen (send_buffer), deadline)
+	                          : np_net_wait (sd, POLLIN, deadline)) <= 0) {
 		strcpy (recv_buffer, "");
 		printf ("%s\n", _("No data was received from host!"));
 		result = STATE_WARNING;
@@ -377,20 +1293,9 @@ is_addr (const char *address)
 int
 resolve_host_or_addr (const char *address, int family)
 {
-	struct addrinfo hints;
-	struct addrinfo *res;
-	int retval;
-
-	memset (&hints, 0, sizeof (hints));
-	hints.ai_family = family;
-	retval = getaddrinfo (address, NULL, &hints, &res);
+	struct np_resolved *r;
 
-	if (retval != 0)
-		return FALSE;
-	else {
-		freeaddrinfo (res);
-		return TRUE;
-	}
+	return np_net_lookup (address, family, &r) == 0 ? TRUE : FALSE;
 }
 
 /* Turn a network address into a string */
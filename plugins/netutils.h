@@ -59,6 +59,10 @@ int process_request (const char *address, int port, int proto,
 #define my_tcp_connect(addr, port, s) np_net_connect(addr, port, s, IPPROTO_TCP)
 #define my_udp_connect(addr, port, s) np_net_connect(addr, port, s, IPPROTO_UDP)
 int np_net_connect(const char *address, int port, int *sd, int proto);
+/* getaddrinfo() through the run's name cache (see netutils.c); the
+ * result belongs to the cache and must not be freed */
+int np_net_getaddrinfo (const char *host, const char *port,
+  const struct addrinfo *hints, struct addrinfo **res);
 
 /* send_request and wrapper macros */
 #define send_tcp_request(s, sbuf, rbuf, rsize) \
@@ -67,6 +71,54 @@ int np_net_connect(const char *address, int port, int *sd, int proto);
 	send_request(s, IPPROTO_UDP, sbuf, rbuf, rsize)
 int send_request (int sd, int proto, const char *send_buffer, char *recv_buffer, int recv_size);
 
+/* Time limits in milliseconds for connecting and for each send_request()
+ * or process_tcp_request2() exchange. 0 (the default) means one second
+ * less than the plugin timeout. Each operation waits on the monotonic
+ * clock with poll() until its own deadline; the plugin's alarm stays as
+ * a backstop only. */
+extern int np_net_connect_timeout;
+extern int np_net_io_timeout;
+/* set by plugins that send as soon as they connect, to have TCP
+ * connections use TCP Fast Open where the system has it */
+extern int np_net_fastopen;
+/* set by plugins to keep a round-trip time estimate per target in the
+ * state directory and make attempts that are late for it again, see
+ * netutils.c */
+extern int np_net_adaptive;
+/* --max-rate and --max-inflight of the checks that run many targets at
+ * once: what they start a second, bursts spread out by an np_rate, and
+ * how much of it is in flight to one address; 0 for no limit */
+extern double np_net_max_rate;
+extern int np_net_max_inflight;
+#ifndef POLLIN
+#  define POLLIN 0x001
+#  define POLLOUT 0x004
+#  define POLLERR 0x008
+#endif
+/* returns the deadline for an operation given timeout_ms (0 as above) */
+int64_t np_net_deadline (int timeout_ms);
+int np_net_time_left (int64_t deadline);
+/* 1 once sd is ready for events, 0 after the deadline, -1 on errors */
+int np_net_wait (int sd, short events, int64_t deadline);
+/* the same for the answer to the datagram buf just sent on sd, sending
+ * it again as np_net_adaptive has it */
+int np_net_udp_wait (int sd, const char *buf, size_t len, int64_t deadline);
+
+
+/* Have the kernel stamp the datagrams sd receives with their time of
+ * arrival (SO_TIMESTAMPNS, or SO_TIMESTAMP) and, where it can, those it
+ * sends with the time they left (SO_TIMESTAMPING). Returns which it does. */
+#define NP_NET_RX_STAMPS 0x1
+#define NP_NET_TX_STAMPS 0x2
+int np_net_timestamps (int sd);
+/* recvmsg() as recvfrom(), with when set to the kernel's time of arrival,
+ * or to now if there is none */
+ssize_t np_net_recvfrom_time (int sd, void *buf, size_t len, int flags, struct sockaddr *from,
+  socklen_t *fromlen, struct timeval *when);
+/* The next time a datagram sent on sd left, from its error queue, and the
+ * datagram's number: 0 for the first one sent after np_net_timestamps().
+ * FALSE when there is none (yet). */
+int np_net_sent_time (int sd, uint32_t *id, struct timeval *when);
 
 /* "is_*" wrapper macros and functions */
 int is_host (const char *);
@@ -83,12 +135,36 @@ void host_or_die(const char *str);
 
 extern int econn_refuse_state;
 extern int was_refused;
+/* set by plugins to have np_net_connect() report each connect attempt */
+extern int np_net_verbose;
 extern int address_family;
 extern char address_length(int address_family);
+void np_net_reset (void);
 extern void parse_address_string(int address_family, struct sockaddr_storage *addr, char *address, int size);
 
 RETSIGTYPE socket_timeout_alarm_handler (int) __attribute__((noreturn));
 
+/* Lines of a reply read a block at a time, from a socket or through
+ * ssl_read (np_net_ssl_read, for the connection np_net_ssl_init() made on
+ * it) unless that is NULL. Start it again after STARTTLS, so nothing read
+ * before the handshake is taken for what follows it. */
+typedef struct np_line_reader {
+	int sd;
+	int (*ssl_read) (void *, int);
+	size_t start;
+	size_t end;
+	char buf[MAX_INPUT_BUFFER];
+} np_line_reader;
+
+void np_line_reader_init (np_line_reader *reader, int sd, int (*ssl_read) (void *, int));
+/* one line with its newline into buf, nul-terminated; the last one may
+ * lack it. Returns its length, 0 on EOF, -2 if it does not fit, or <0 as
+ * read() */
+int np_recvline (np_line_reader *reader, char *buf, size_t bufsize);
+/* the lines of a multiline reply as SMTP, FTP and the like send them
+ * ("250-..." up to "250 ..."), as np_recvline() */
+int np_recvlines (np_line_reader *reader, char *buf, size_t bufsize);
+
 /* SSL-Related functionality */
 #ifdef HAVE_SSL
 #  define MP_SSLv2 1
@@ -108,11 +184,64 @@ int np_net_ssl_init(int sd);
 int np_net_ssl_init_with_hostname(int sd, char *host_name);
 int np_net_ssl_init_with_hostname_and_version(int sd, char *host_name, int version);
 int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int version, char *cert, char *privkey);
+/* the building blocks of the above, for plugins that drive many sessions */
+int np_net_ssl_ctx_new(SSL_CTX **ctx, int version, char *cert, char *privkey);
+int np_net_ssl_hostname_ok(SSL *ssl, const char *host_name);
+/* ends the connection; its context is kept for the next one made with
+ * the same version and client certificate */
 void np_net_ssl_cleanup();
+/* frees those contexts and the certificates np_net_ssl_check_cert_real()
+ * has seen, which are otherwise remembered for the life of the process */
+void np_net_ssl_ctx_cache_free(void);
+/* Resume sessions to host:port from an on-disk cache in the state
+ * directory for the handshakes that follow; NULL turns the cache off.
+ * With full_handshake the cached session is not offered, but the new
+ * one is still stored. */
+void np_net_ssl_session_cache(const char *host, int port, int full_handshake);
+/* TRUE if the last handshake resumed a cached session */
+int np_net_ssl_session_reused(void);
+/* With quiet, a failed handshake is not reported on stdout, for plugins
+ * that report many connections in lines of their own */
+void np_net_ssl_quiet(int quiet);
+/* Send len bytes of buf as TLS 1.3 early data (0-RTT) in the next
+ * handshake, if it resumes a cached session whose server allows that
+ * much; the server may replay it, so it has to be an idempotent request.
+ * buf has to last until the handshake. np_net_ssl_early_data_status()
+ * then tells whether the server took it, the caller sending it again as
+ * usual if not. */
+#define NP_SSL_EARLY_DATA_NONE 0     /* not sent */
+#define NP_SSL_EARLY_DATA_REJECTED 1 /* sent but rejected, to send again */
+#define NP_SSL_EARLY_DATA_ACCEPTED 2
+void np_net_ssl_early_data(const void *buf, size_t len);
+int np_net_ssl_early_data_status(void);
+/* Offer the comma separated protocols (e.g. "h2,http/1.1") through ALPN in
+ * the handshakes that follow, NULL for none. ERROR if a name is invalid. */
+int np_net_ssl_alpn(const char *protocols);
+/* the protocol the server selected in the last handshake, or NULL */
+const char *np_net_ssl_alpn_selected(void);
 int np_net_ssl_write(const void *buf, int num);
 int np_net_ssl_read(void *buf, int num);
 int np_net_ssl_check_cert(int days_till_exp_warn, int days_till_exp_crit);
 int np_net_ssl_check_cert_real(SSL *ssl, int days_till_exp_warn, int days_till_exp_crit);
+/* the same check, with the message put in msg instead of printed and the
+ * days left until expiry in days unless it is NULL; days is left alone
+ * when the certificate could not be read */
+/* Ask for the OCSP status of the server's certificate in the handshakes
+ * that follow (the status_request extension), for the server to staple
+ * it. With fetch, a certificate stapled nothing for is looked up with its
+ * own responder instead, the answer kept in the state directory until its
+ * nextUpdate. np_net_ssl_ocsp_setup() asks on an SSL of the caller's. */
+void np_net_ssl_ocsp(int request, int fetch);
+void np_net_ssl_ocsp_setup(SSL *ssl);
+/* The OCSP status of the certificate of the last handshake, its response
+ * verified against the system's CAs: CRITICAL if revoked, unknown, not
+ * to be verified or not current, or if its nextUpdate is no more than
+ * crit_hours away, WARNING within warn_hours or with nothing stapled and
+ * no fetch. The message like np_net_ssl_cert_state()'s, and the hours to
+ * the nextUpdate in *hours if there is one. */
+int np_net_ssl_check_ocsp(int warn_hours, int crit_hours);
+int np_net_ssl_ocsp_state(SSL *ssl, int warn_hours, int crit_hours, char *msg, size_t len, double *hours);
+int np_net_ssl_cert_state(SSL *ssl, int days_till_exp_warn, int days_till_exp_crit, char *msg, size_t len, double *days);
 #endif /* HAVE_SSL */
 
 #endif /* NAGIOS_NETUGILS_H_INCLUDED_ */
@@ -9,9 +9,10 @@
 * 
 * A safe alternative to popen
 * 
-* Provides spopen and spclose
+* Provides spopen, spopenv and spclose
 * 
 * FILE * spopen(const char *);
+* FILE * spopenv(char *const *);
 * int spclose(FILE *);
 * 
 * Code taken with liitle modification from "Advanced Programming for the Unix
@@ -39,6 +40,8 @@
 *****************************************************************************/
 
 #include "common.h"
+#include "utils_base.h"	/* for np_exit() */
+#include "utils_cmd.h"	/* for cmd_spawn() */
 
 /* extern so plugin has pid to kill exec'd process on timeouts */
 extern int timeout_interval;
@@ -47,6 +50,8 @@ extern int *child_stderr_array;
 extern FILE *child_process;
 
 FILE *spopen (const char *);
+FILE *spopenv (char *const *);
+const char *sppath (const char *);
 int spclose (FILE *);
 #ifdef REDHAT_SPOPEN_ERROR
 RETSIGTYPE popen_sigchld_handler (int);
@@ -92,40 +97,31 @@ static int maxfd;								/* from our open_max(), {Prog openmax} */
 static volatile int childtermd = 0;
 #endif
 
+/* the environment of every command */
+static char *const sp_env[] = { "LC_ALL=C", NULL };
+
+/* the paths sppath() found, so PATH is searched once for each name */
+#define SP_PATHS 16
+static struct {
+	char *name;
+	char *path;
+} sp_paths[SP_PATHS];
+
 FILE *
 spopen (const char *cmdstring)
 {
-	char *env[2];
 	char *cmd = NULL;
 	char **argv = NULL;
-	char *str, *tmp;
+	char *str, *tmp, *copy;
 	int argc;
+	FILE *fp;
 
-	int i = 0, pfd[2], pfderr[2];
-	pid_t pid;
-
-#ifdef 	RLIMIT_CORE
-	/* do not leave core files */
-	struct rlimit limit;
-	getrlimit (RLIMIT_CORE, &limit);
-	limit.rlim_cur = 0;
-	setrlimit (RLIMIT_CORE, &limit);
-#endif
-
-	env[0] = strdup("LC_ALL=C");
-	env[1] = '\0';
+	int i = 0;
 
 	/* if no command was passed, return with no error */
 	if (cmdstring == NULL)
 		return (NULL);
 
-	/* make copy of command string so strtok() doesn't silently modify it */
-	/* (the calling program may want to access it later) */
-	cmd = malloc (strlen (cmdstring) + 1);
-	if (cmd == NULL)
-		return NULL;
-	strcpy (cmd, cmdstring);
-
 	/* This is not a shell, so we don't handle "???" */
 	if (strstr (cmdstring, "\""))
 		return NULL;
@@ -134,12 +130,20 @@ spopen (const char *cmdstring)
 	if (strstr (cmdstring, " ' ") || strstr (cmdstring, "'''"))
 		return NULL;
 
+	/* make copy of command string so strtok() doesn't silently modify it */
+	/* (the calling program may want to access it later) */
+	copy = cmd = malloc (strlen (cmdstring) + 1);
+	if (cmd == NULL)
+		return NULL;
+	strcpy (cmd, cmdstring);
+
 	/* there cannot be more args than characters */
 	argc = strlen (cmdstring) + 1;	/* add 1 for NULL termination */
 	argv = malloc (sizeof(char*)*argc);
 
 	if (argv == NULL) {
 		printf ("%s\n", _("Could not malloc argv array in popen()"));
+		free (copy);
 		return NULL;
 	}
 
@@ -150,13 +154,13 @@ spopen (const char *cmdstring)
 
 		if (i >= argc - 2) {
 			printf ("%s\n",_("CRITICAL - You need more args!!!"));
-			return (NULL);
+			break;
 		}
 
 		if (strstr (str, "'") == str) {	/* handle SIMPLE quoted strings */
 			str++;
 			if (!strstr (str, "'"))
-				return NULL;						/* balanced? */
+				break;						/* balanced? */
 			cmd = 1 + strstr (str, "'");
 			str[strcspn (str, "'")] = 0;
 		}
@@ -164,7 +168,7 @@ spopen (const char *cmdstring)
 										/* handle --option='foo bar' strings */
 			tmp = str + strcspn(str, "'") + 1;
 			if (!strstr (tmp, "'"))
-				return NULL;						/* balanced? */
+				break;						/* balanced? */
 			tmp += strcspn(tmp,"'") + 1;
 			*tmp = 0;
 			cmd = tmp + 1;
@@ -186,6 +190,93 @@ spopen (const char *cmdstring)
 	}
 	argv[i] = NULL;
 
+	/* the loop stops early on what it cannot split */
+	fp = cmd ? NULL : spopenv (argv);
+	free (argv);
+	free (copy);
+	return fp;
+}
+
+
+/* The absolute path of the command name, as the PATH of the plugin finds
+ * it, remembered for the next time; name itself if it has a slash. NULL
+ * if it is nowhere. */
+const char *
+sppath (const char *name)
+{
+	const char *dirs, *end;
+	char *path;
+	size_t len;
+	int i;
+
+	if (strchr (name, '/'))
+		return name;
+	for (i = 0; i < SP_PATHS && sp_paths[i].name; i++)
+		if (strcmp (sp_paths[i].name, name) == 0)
+			return sp_paths[i].path;
+
+	if ((dirs = getenv ("PATH")) == NULL)
+		dirs = "/usr/bin:/bin";
+	for (path = NULL; dirs && path == NULL; dirs = *end ? end + 1 : NULL) {
+		end = dirs + strcspn (dirs, ":");
+		len = end - dirs;
+		if ((path = malloc (len + strlen (name) + 3)) == NULL)
+			return NULL;
+		/* an empty entry is the current directory */
+		if (len)
+			sprintf (path, "%.*s/%s", (int) len, dirs, name);
+		else
+			sprintf (path, "./%s", name);
+		if (access (path, X_OK) != 0) {
+			free (path);
+			path = NULL;
+		}
+	}
+
+	if (path && i < SP_PATHS) {
+		sp_paths[i].name = strdup (name);
+		sp_paths[i].path = path;
+	}
+	return path;
+}
+
+
+/* Start argv as it is, with no string to split: argv[0] is the path of
+ * the command, or a name looked up with sppath() */
+FILE *
+spopenv (char *const *argv)
+{
+	char **resolved = NULL;
+	const char *path;
+	int argc, pfd[2], pfderr[2];
+	pid_t pid;
+
+#ifdef 	RLIMIT_CORE
+	/* do not leave core files */
+	struct rlimit limit;
+	getrlimit (RLIMIT_CORE, &limit);
+	limit.rlim_cur = 0;
+	setrlimit (RLIMIT_CORE, &limit);
+#endif
+
+	if (argv == NULL || argv[0] == NULL)
+		return NULL;
+
+	/* only a bare name needs an argv of its own, with the path in it */
+	if (strchr (argv[0], '/') == NULL) {
+		if ((path = sppath (argv[0])) == NULL) {
+			errno = ENOENT;
+			return NULL;
+		}
+		for (argc = 0; argv[argc]; argc++)
+			;
+		if ((resolved = malloc ((argc + 1) * sizeof (char *))) == NULL)
+			return NULL;
+		memcpy (resolved, argv, (argc + 1) * sizeof (char *));
+		resolved[0] = (char *) path;
+		argv = resolved;
+	}
+
 	if (childpid == NULL) {				/* first time through */
 		maxfd = open_max ();				/* allocate zeroed out array for child pids */
 		if ((childpid = calloc ((size_t)maxfd, sizeof (pid_t))) == NULL)
@@ -210,27 +301,10 @@ spopen (const char *cmdstring)
 	}
 #endif
 
-	if ((pid = fork ()) < 0)
+	pid = cmd_spawn (argv, sp_env, pfd, pfderr);
+	free (resolved);
+	if (pid < 0)
 		return (NULL);							/* errno set by fork() */
-	else if (pid == 0) {					/* child */
-		close (pfd[0]);
-		if (pfd[1] != STDOUT_FILENO) {
-			dup2 (pfd[1], STDOUT_FILENO);
-			close (pfd[1]);
-		}
-		close (pfderr[0]);
-		if (pfderr[1] != STDERR_FILENO) {
-			dup2 (pfderr[1], STDERR_FILENO);
-			close (pfderr[1]);
-		}
-		/* close all descriptors in childpid[] */
-		for (i = 0; i < maxfd; i++)
-			if (childpid[i] > 0)
-				close (i);
-
-		execve (argv[0], argv, env);
-		_exit (0);
-	}
 
 	close (pfd[1]);								/* parent */
 	if ((child_process = fdopen (pfd[0], "r")) == NULL)
@@ -310,7 +384,7 @@ popen_timeout_alarm_handler (int signo)
 			/* printf ("%s\n", _("CRITICAL - popen timeout received, but no child process")); */
 			write(STDOUT_FILENO, msg2, sizeof(msg2) - 1);
 		}
-		exit (STATE_CRITICAL);
+		np_exit (STATE_CRITICAL);
 	}
 }
 
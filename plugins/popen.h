@@ -4,6 +4,10 @@
 *****************************************************************************/
 
 FILE *spopen (const char *);
+/* as spopen, for a command already split into its arguments */
+FILE *spopenv (char *const *);
+/* the path of a command name along PATH, looked up once */
+const char *sppath (const char *);
 int spclose (FILE *);
 RETSIGTYPE popen_timeout_alarm_handler (int);
 
@@ -42,6 +42,10 @@ const char *email = "devel@nagios-plugins.org";
 
 #include <ctype.h>
 
+/* The output is held up to this much, so that error output from the
+ * command can still take its place, and streamed past it */
+#define HOLD_SIZE 65536
+
 static const char **process_arguments(int, char **);
 void validate_arguments(char **);
 void print_help(void);
@@ -49,26 +53,40 @@ void print_usage(void);
 int remove_perfdata = 1;
 int remove_long_output = 0;
 
+/* where the filter is in the plugin's output */
+typedef struct filter_state {
+    size_t line;     /* line number */
+    int in_quotes;   /* within quotes on the first line */
+    int in_perfdata; /* past its unquoted | */
+    size_t total;    /* bytes the plugin wrote */
+    char last;       /* the last byte written out */
+    int flushed;     /* whether anything has been written out yet */
+    size_t held;
+    char hold[HOLD_SIZE];
+} filter_state;
+
+static void filter_output(const char *, size_t, void *);
+static void emit(filter_state *, const char *, size_t);
+static void flush_output(filter_state *);
+
 
 int
 main(int argc, char **argv)
 {
     int result = STATE_UNKNOWN;
-    int c = 0;
     int i = 0;
-    int j = 0;
-    char *buf;
-    char *sub;
     char **command_line;
     output chld_out;
     output chld_err;
-
-    setlocale(LC_ALL, "");
-    bindtextdomain(PACKAGE, LOCALEDIR);
-    textdomain(PACKAGE);
+    static filter_state filter;
 
     command_line = (char **) process_arguments(argc, argv);
 
+    /* nothing to remove: be the plugin rather than wait on it */
+    if (!remove_perfdata && !remove_long_output && command_line[1] != NULL) {
+        execv(command_line[0], command_line);
+    }
+
     /* Set signal handling and alarm */
     if (signal(SIGALRM, timeout_alarm_handler) == SIG_ERR) {
         die(STATE_UNKNOWN, _("Cannot catch SIGALRM"));
@@ -77,13 +95,23 @@ main(int argc, char **argv)
     (void) alarm((unsigned) DEFAULT_TIMEOUT);
 
     /* catch when the command is quoted */
-    if (command_line[1] == NULL) {
-        result = cmd_run(command_line[0], &chld_out, &chld_err, 0);
+    if (command_line[1] == NULL && (command_line = cmd_argv(command_line[0])) == NULL) {
+        die(STATE_UNKNOWN, _("No data returned from command\n"));
+    }
+
+    /* the output is filtered as it is read, except from a plugin run
+     * within this process, which comes all at once */
+    if (cmd_run_inprocess
+        && (result = cmd_run_inprocess(command_line, &chld_out, &chld_err)) >= 0) {
+        filter_output(chld_out.buf, chld_out.buflen, &filter);
     } else {
-        result = cmd_run_array(command_line, &chld_out, &chld_err, 0);
+        result = cmd_run_filter(command_line, filter_output, &filter, &chld_err);
     }
 
     if (chld_err.lines > 0) {
+        if (filter.flushed) {
+            flush_output(&filter);
+        }
         printf("%s:\n", _("Error output from command"));
         for (i = 0; i < chld_err.lines; i++) {
             printf("%s\n", chld_err.line[i]);
@@ -92,55 +120,89 @@ main(int argc, char **argv)
     }
 
     /* Return UNKNOWN or worse if no output is returned */
-    if (chld_out.lines == 0) {
+    if (filter.total == 0) {
         die(max_state_alt(result, STATE_UNKNOWN), _("No data returned from command\n"));
     }
 
-    for (i = 0; i < chld_out.lines; i++) {
-
-        /* if we're on the first line, remove the perfdata */
-        if (remove_perfdata && i == 0) {
-
-            int in_quotes = 0;
+    /* and print a newline if the plugin left it out */
+    if (filter.last != '\n') {
+        emit(&filter, "\n", 1);
+    }
+    flush_output(&filter);
 
-            for (j = 0; j < (int) strlen(chld_out.line[i]); j++) {
+    exit(result);
+}
 
-                c = chld_out.line[i][j];
 
-                if (c == '"') {
-                    if (in_quotes) {
-                        in_quotes = 0;
-                    }
-                    else {
-                        in_quotes = 1;
-                    }
-                }
+/* Pass on len bytes of the plugin's output, without the perfdata of the
+ * first line or without the lines after it as asked */
+static void
+filter_output(const char *buf, size_t len, void *data)
+{
+    filter_state *filter = data;
+    const char *end = buf + len, *nl;
+    size_t i;
 
-                /* when we reach an unquoted |, stop printing */
-                if (!in_quotes && c == '|')
-                    break;
+    filter->total += len;
+    while (buf < end) {
 
-                printf("%c", c);
+        /* the long output goes through as it is, or not at all */
+        if (filter->line > 0) {
+            if (!remove_long_output) {
+                emit(filter, buf, (size_t) (end - buf));
             }
+            return;
+        }
 
-            /* and print a newline if we skipped past it */
-            if (c != '\n') {
-                printf("\n");
+        nl = memchr(buf, '\n', (size_t) (end - buf));
+        if (!remove_perfdata) {
+            i = nl ? (size_t) (nl - buf) : (size_t) (end - buf);
+        } else {
+            /* when we reach an unquoted |, stop printing */
+            for (i = 0; !filter->in_perfdata && buf + i < (nl ? nl : end); i++) {
+                if (buf[i] == '"') {
+                    filter->in_quotes = !filter->in_quotes;
+                } else if (!filter->in_quotes && buf[i] == '|') {
+                    filter->in_perfdata = 1;
+                    break;
+                }
             }
         }
+        emit(filter, buf, i);
 
-        /* if we don't want long output, don't print it */
-        else if (remove_long_output && i > 0) {
-            break;
+        if (nl == NULL) {
+            return;
         }
+        emit(filter, "\n", 1);
+        filter->line++;
+        buf = nl + 1;
+    }
+}
 
-        /* for everything else, there's mastercard - or printing the full line to the screen */
-        else {
-            printf("%s\n", chld_out.line[i]);
-        }
+
+static void
+emit(filter_state *filter, const char *buf, size_t len)
+{
+    if (len == 0) {
+        return;
+    }
+    filter->last = buf[len - 1];
+    if (filter->held + len > sizeof(filter->hold)) {
+        flush_output(filter);
+        fwrite(buf, 1, len, stdout);
+        filter->flushed = 1;
+        return;
     }
+    memcpy(filter->hold + filter->held, buf, len);
+    filter->held += len;
+}
 
-    exit(result);
+
+static void
+flush_output(filter_state *filter)
+{
+    fwrite(filter->hold, 1, filter->held, stdout);
+    filter->held = 0;
 }
 
 
@@ -242,6 +304,8 @@ print_help(void)
     printf("%s\n", _("Notes:"));
     printf("    %s\n", _("This plugin is a wrapper to take the output of another plugin and alter it."));
     printf("    %s\n", _("The full path of the plugin must be provided."));
+    printf("    %s\n", _("With -d and without -l, the plugin is run in its place as it is."));
+    printf("    %s\n", _("Built into the multi-call binary, it runs its plugins in its own process."));
     printf("\n");
 
     printf(UT_SUPPORT);
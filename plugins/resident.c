@@ -0,0 +1,494 @@
+/*****************************************************************************
+*
+* Nagios plugins resident (worker) mode
+*
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+*
+* Description:
+*
+* Keeps a plugin in memory and runs checks in-process, so that dynamic
+* linking, locale setup and SSL library initialisation are paid once per
+* worker rather than once per check. die(), the usage*() helpers and the
+* timeout handlers all go through np_exit(), which returns control to the
+* loop below instead of terminating the worker.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "resident.h"
+#include "netutils.h"	/* for UNIX_PATH_MAX and np_net_wait() */
+#include <setjmp.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* descriptors above the ones the worker holds itself are assumed to have
+ * been leaked by a check that died half way; this many get closed */
+#define NP_RESIDENT_FD_SWEEP 256
+
+static char *request_copy = NULL;
+static char **request_argv = NULL;
+
+/* set while the worker runs, for the pool to keep anything */
+static int resident = FALSE;
+
+void (*np_resident_hook) (np_check_fn, np_reset_fn) = NULL;
+
+typedef struct np_pool_entry {
+	char *key;
+	void *conn;
+	const np_pool_ops *ops;
+	int taken;
+	time_t used;
+} np_pool_entry;
+
+static np_pool_entry pool[NP_POOL_SIZE];
+
+static int write_all (int, const char *, size_t);
+static int resident_reply (int, int, const char *, size_t);
+static int resident_run (int, char *, char *, np_check_fn, np_reset_fn, int, int);
+static int resident_serve (int, int, char *, np_check_fn, np_reset_fn, int);
+static void pool_drop (np_pool_entry *);
+static void pool_reap (int);
+static int pool_holds_fd (int);
+
+
+int
+np_resident_requested (int argc, char **argv)
+{
+	size_t len = strlen (NP_RESIDENT_OPTION);
+
+	if (argc != 2 || strncmp (argv[1], NP_RESIDENT_OPTION, len))
+		return FALSE;
+	return (argv[1][len] == '\0' || argv[1][len] == '=');
+}
+
+
+/* Split a request into an argument vector. Returns NULL if quoting is
+ * unbalanced. The vector stays valid until the next call. */
+char **
+np_resident_split (const char *line, char *name, int *argc)
+{
+	char *str, *end;
+	size_t len;
+	int i = 0;
+
+	free (request_copy);
+	free (request_argv);
+	request_copy = strdup (line);
+	len = strlen (line);
+	/* worst case is a one character argument every other byte */
+	request_argv = calloc ((len >> 1) + 3, sizeof (char *));
+	if (request_copy == NULL || request_argv == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+
+	request_argv[i++] = name;
+	str = request_copy;
+	while (*str) {
+		str += strspn (str, " \t\r\n");
+		if (*str == '\0')
+			break;
+
+		if (*str == '\'') {
+			str++;
+			if ((end = strchr (str, '\'')) == NULL)
+				return NULL;
+		}
+		else {
+			end = str + strcspn (str, " \t\r\n");
+		}
+
+		request_argv[i++] = str;
+		if (*end == '\0')
+			break;
+		*end = '\0';
+		str = end + 1;
+	}
+	request_argv[i] = NULL;
+
+	*argc = i;
+	return request_argv;
+}
+
+
+int
+np_resident_main (int argc, char **argv, np_check_fn check, np_reset_fn reset)
+{
+	const char *socket_path;
+	FILE *capture;
+	int result = STATE_OK;
+#ifdef HAVE_SYS_UN_H
+	struct sockaddr_un su;
+	int sd, conn;
+#endif
+
+	if (np_resident_hook) {
+		resident = TRUE;
+		np_resident_hook (check, reset);
+		return STATE_OK;
+	}
+
+	socket_path = strchr (argv[1], '=');
+	if (socket_path)
+		socket_path++;
+
+	/* a client going away must not take the worker with it */
+	signal (SIGPIPE, SIG_IGN);
+	resident = TRUE;
+
+	/* plugin output is collected here and passed on with its length */
+	if ((capture = tmpfile ()) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot create output buffer:"), strerror (errno));
+
+	if (socket_path == NULL || *socket_path == '\0') {
+		/* stdout becomes the capture file while a check runs, so keep
+		 * our own handle on the reply channel */
+		result = resident_serve (STDIN_FILENO, dup (STDOUT_FILENO), argv[0],
+		                         check, reset, fileno (capture));
+		pool_reap (TRUE);
+		fclose (capture);
+		return result;
+	}
+
+#ifdef HAVE_SYS_UN_H
+	if (strlen (socket_path) >= UNIX_PATH_MAX)
+		die (STATE_UNKNOWN, _("Supplied path too long unix domain socket"));
+	memset (&su, 0, sizeof (su));
+	su.sun_family = AF_UNIX;
+	strncpy (su.sun_path, socket_path, UNIX_PATH_MAX);
+
+	if ((sd = socket (PF_UNIX, SOCK_STREAM, 0)) < 0)
+		die (STATE_UNKNOWN, _("Socket creation failed"));
+	unlink (socket_path);
+	if (bind (sd, (struct sockaddr *)&su, sizeof (su)) < 0 || listen (sd, 16) < 0)
+		die (STATE_UNKNOWN, "%s %s: %s\n", _("Cannot listen on"), socket_path, strerror (errno));
+
+	while ((conn = accept (sd, NULL, NULL)) >= 0 || errno == EINTR) {
+		if (conn < 0)
+			continue;
+		resident_serve (conn, conn, argv[0], check, reset, fileno (capture));
+		close (conn);
+	}
+
+	close (sd);
+	unlink (socket_path);
+	pool_reap (TRUE);
+	fclose (capture);
+	return STATE_OK;
+#else
+	die (STATE_UNKNOWN, "%s\n", _("Unix sockets are not supported on this system"));
+#endif
+}
+
+
+/* answer requests read from in_fd until EOF */
+static int
+resident_serve (int in_fd, int out_fd, char *name, np_check_fn check,
+                np_reset_fn reset, int capture_fd)
+{
+	char line[MAX_INPUT_BUFFER];
+	FILE *in;
+	size_t len;
+	int high_fd;
+
+	/* the descriptor is still owned (and closed) by the caller */
+	if ((in = fdopen (dup (in_fd), "r")) == NULL)
+		return STATE_UNKNOWN;
+	high_fd = max (max (fileno (in), out_fd), capture_fd);
+
+	while (fgets (line, sizeof (line), in) != NULL) {
+		len = strlen (line);
+		if (len && line[len - 1] != '\n' && !feof (in)) {
+			/* drop the rest of an overlong line */
+			while (fgets (line, sizeof (line), in) != NULL && !strchr (line, '\n'));
+			if (resident_reply (out_fd, STATE_UNKNOWN, _("Request too long\n"),
+			                    strlen (_("Request too long\n"))) < 0)
+				break;
+			continue;
+		}
+		if (resident_run (out_fd, name, line, check, reset, capture_fd, high_fd) < 0)
+			break;
+	}
+
+	fclose (in);
+	return STATE_OK;
+}
+
+
+/* run one check and send its result; returns -1 if the reply failed.
+ * high_fd is the highest descriptor the worker itself holds. */
+static int
+resident_run (int out_fd, char *name, char *line, np_check_fn check,
+              np_reset_fn reset, int capture_fd, int high_fd)
+{
+	char **argv;
+	char *output;
+	size_t len;
+	int argc, result, ret;
+
+	if ((argv = np_resident_split (line, name, &argc)) == NULL)
+		return resident_reply (out_fd, STATE_UNKNOWN, _("Unbalanced quotes in request\n"),
+		                       strlen (_("Unbalanced quotes in request\n")));
+
+	result = np_resident_check (argc, argv, check, reset, capture_fd, high_fd, &output, &len);
+	ret = resident_reply (out_fd, result, output ? output : "", len);
+	free (output);
+	return ret;
+}
+
+
+int
+np_resident_check (int argc, char **argv, np_check_fn check, np_reset_fn reset,
+                   int capture_fd, int high_fd, char **outputp, size_t *lenp)
+{
+	sigjmp_buf exit_point;
+	volatile int result = STATE_UNKNOWN;
+	char *output;
+	struct stat st;
+	int saved_stdout, first_free, fd;
+
+	*outputp = NULL;
+	*lenp = 0;
+
+	/* library state that plugins change while parsing their options */
+	timeout_state = STATE_CRITICAL;
+	timeout_interval = DEFAULT_SOCKET_TIMEOUT;
+	np_output_format = NP_OUTPUT_TEXT;
+	optind = 0;
+	if (reset)
+		reset ();
+
+	fflush (stdout);
+	if (ftruncate (capture_fd, 0) < 0 || lseek (capture_fd, 0, SEEK_SET) < 0) {
+		*outputp = strdup (_("Cannot reset output buffer\n"));
+		*lenp = *outputp ? strlen (*outputp) : 0;
+		return STATE_UNKNOWN;
+	}
+	saved_stdout = dup (STDOUT_FILENO);
+	dup2 (capture_fd, STDOUT_FILENO);
+
+	/* everything above this was opened by the check itself */
+	first_free = max (high_fd, saved_stdout) + 1;
+
+	if (sigsetjmp (exit_point, 1) == 0) {
+		np_set_resident (&exit_point);
+		result = check (argc, argv);
+	}
+	else {
+		result = np_resident_result ();
+	}
+	np_set_resident (NULL);
+
+	alarm (0);
+	signal (SIGALRM, SIG_DFL);
+	np_cleanup ();
+	pool_reap (FALSE);
+
+	fflush (stdout);
+	dup2 (saved_stdout, STDOUT_FILENO);
+	close (saved_stdout);
+	for (fd = first_free; fd < first_free + NP_RESIDENT_FD_SWEEP; fd++)
+		if (!pool_holds_fd (fd))
+			close (fd);
+
+	if (fstat (capture_fd, &st) < 0)
+		st.st_size = 0;
+	output = malloc ((size_t)st.st_size + 1);
+	if (output == NULL || pread (capture_fd, output, (size_t)st.st_size, 0) != st.st_size)
+		st.st_size = 0;
+
+	if (output)
+		output[st.st_size] = '\0';
+	if (output && np_output_format == NP_OUTPUT_JSON) {
+		const char *plugin = strrchr (argv[0], '/');
+		char *json = np_output_json (plugin ? plugin + 1 : argv[0], result & 0xff, output,
+		                             (size_t)st.st_size);
+		free (output);
+		output = json;
+		st.st_size = (off_t)strlen (json);
+		np_output_format = NP_OUTPUT_TEXT;
+	}
+
+	*outputp = output;
+	*lenp = (size_t)st.st_size;
+	return result;
+}
+
+
+static int
+resident_reply (int fd, int result, const char *output, size_t len)
+{
+	char header[64];
+
+	snprintf (header, sizeof (header), "%d %lu\n", result, (unsigned long)len);
+	if (write_all (fd, header, strlen (header)) < 0 || write_all (fd, output, len) < 0)
+		return -1;
+	return 0;
+}
+
+
+static int
+write_all (int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		if ((ret = write (fd, buf, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		len -= (size_t)ret;
+	}
+	return 0;
+}
+
+
+void *
+np_pool_get (const char *key, const np_pool_ops *ops)
+{
+	np_pool_entry *e;
+	time_t now = time (NULL);
+	int fd;
+
+	for (e = pool; e < pool + NP_POOL_SIZE; e++) {
+		if (e->conn == NULL || e->taken || e->ops != ops || strcmp (e->key, key))
+			continue;
+		fd = ops->fd (e->conn);
+		if ((!ops->keep && (now - e->used > NP_POOL_MAX_IDLE || now < e->used ||
+		                    (fd >= 0 && np_net_wait (fd, POLLIN, 0) != 0))) ||
+		    (ops->alive && !ops->alive (e->conn))) {
+			pool_drop (e);
+			continue;
+		}
+		e->taken = TRUE;
+		return e->conn;
+	}
+	return NULL;
+}
+
+
+void
+np_pool_add (const char *key, void *conn, const np_pool_ops *ops)
+{
+	np_pool_entry *e, *slot = NULL, *oldest = NULL;
+
+	if (!resident || conn == NULL)
+		return;
+
+	/* a free slot, else that of the idle connection used longest ago;
+	 * with neither the connection is just not kept */
+	for (e = pool; e < pool + NP_POOL_SIZE && slot == NULL; e++) {
+		if (e->conn == NULL)
+			slot = e;
+		else if (!e->taken && (oldest == NULL || e->used < oldest->used))
+			oldest = e;
+	}
+	if (slot == NULL) {
+		if (oldest == NULL)
+			return;
+		pool_drop (oldest);
+		slot = oldest;
+	}
+	if ((slot->key = strdup (key)) == NULL)
+		return;
+	slot->conn = conn;
+	slot->ops = ops;
+	slot->taken = TRUE;
+	slot->used = time (NULL);
+}
+
+
+int
+np_pool_release (void *conn)
+{
+	np_pool_entry *e, *found = NULL, *oldest = NULL;
+	int idle = 0;
+
+	for (e = pool; e < pool + NP_POOL_SIZE; e++)
+		if (e->conn == conn && e->taken)
+			found = e;
+	if (found == NULL)
+		return FALSE;
+	found->taken = FALSE;
+	found->used = time (NULL);
+
+	/* no more than NP_POOL_PER_TARGET idle for the target */
+	for (e = pool; e < pool + NP_POOL_SIZE; e++) {
+		if (e->conn == NULL || e->taken || e->ops != found->ops || strcmp (e->key, found->key))
+			continue;
+		idle++;
+		if (e != found && (oldest == NULL || e->used < oldest->used))
+			oldest = e;
+	}
+	if (idle > NP_POOL_PER_TARGET && oldest)
+		pool_drop (oldest);
+	return TRUE;
+}
+
+
+void
+np_pool_close (void *conn, const np_pool_ops *ops)
+{
+	np_pool_entry *e;
+
+	for (e = pool; e < pool + NP_POOL_SIZE; e++)
+		if (e->conn == conn) {
+			pool_drop (e);
+			return;
+		}
+	ops->close (conn);
+}
+
+
+static void
+pool_drop (np_pool_entry *e)
+{
+	e->ops->close (e->conn);
+	free (e->key);
+	memset (e, 0, sizeof (*e));
+}
+
+
+/* after each check: close the connections it did not release and those
+ * idle for too long; all of them when the worker stops */
+static void
+pool_reap (int all)
+{
+	np_pool_entry *e;
+	time_t now = time (NULL);
+
+	for (e = pool; e < pool + NP_POOL_SIZE; e++)
+		if (e->conn && (all || e->taken || (!e->ops->keep && now - e->used > NP_POOL_MAX_IDLE)))
+			pool_drop (e);
+	if (all)
+		resident = FALSE;
+}
+
+
+static int
+pool_holds_fd (int fd)
+{
+	np_pool_entry *e;
+
+	for (e = pool; e < pool + NP_POOL_SIZE; e++)
+		if (e->conn && e->ops->fd (e->conn) == fd)
+			return TRUE;
+	return FALSE;
+}
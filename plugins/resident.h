@@ -0,0 +1,108 @@
+/*****************************************************************************
+*
+* Nagios plugins resident (worker) mode
+*
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#ifndef NAGIOS_RESIDENT_H_INCLUDED
+#define NAGIOS_RESIDENT_H_INCLUDED
+
+#include "common.h"
+#include "utils.h"
+
+/*
+ * A plugin started as "check_foo --resident[=SOCKET]" stays in memory and
+ * runs one check per request, in-process, instead of being fork+exec'd by
+ * the scheduler for every check.
+ *
+ * Requests are single lines holding the plugin arguments (everything after
+ * argv[0]), split like np_runcmd() does: on whitespace, with simple single
+ * quoting. Each reply is a header line "<return code> <length>\n" followed
+ * by exactly <length> bytes of plugin output.
+ *
+ * Without a SOCKET the worker talks over stdin/stdout; otherwise it listens
+ * on the given unix socket and serves connections one after the other.
+ */
+
+/* the per-check entry point: main() without the one-time setup */
+typedef int (*np_check_fn) (int, char **);
+/* puts the plugin's file-scope state back to its defaults */
+typedef void (*np_reset_fn) (void);
+
+#define NP_RESIDENT_OPTION "--resident"
+
+/* returns TRUE if argv asks for resident mode */
+int np_resident_requested (int, char **);
+int np_resident_main (int, char **, np_check_fn, np_reset_fn);
+
+/* One check of argv in-process, as the worker runs it: the plugin's
+ * state reset, its stdout in capture_fd and what it leaves open above
+ * high_fd, the highest descriptor of the caller's, closed afterwards.
+ * The return code; the output, to be freed, in *output and *len. */
+int np_resident_check (int argc, char **argv, np_check_fn, np_reset_fn,
+                       int capture_fd, int high_fd, char **output, size_t *len);
+
+/* Set by a program that runs the checks itself, such as the Nagios
+ * worker of the multi-call binary: np_resident_main() hands it the
+ * plugin's entry points and returns rather than serving requests, and
+ * the pool keeps connections from then on. */
+extern void (*np_resident_hook) (np_check_fn, np_reset_fn);
+
+/* split a request line into a NULL terminated argv, argv[0] = progname */
+char **np_resident_split (const char *, char *, int *);
+
+/*
+ * Connections kept open between the checks of a worker. A database or
+ * directory plugin asks the pool for a connection to its target (the key:
+ * everything that selects and authenticates the connection) before making
+ * one, adds a new one to the pool, and releases it when its check is done.
+ *
+ * A connection idle for more than NP_POOL_MAX_IDLE seconds, with anything
+ * to read on its socket (the server closed it, or said something no one
+ * asked for) or rejected by the plugin's alive() is closed rather than
+ * handed out. So is one still taken when its check ends early, through
+ * die() or the timeout, as no one knows what state it was left in.
+ * Outside resident mode the pool keeps nothing.
+ */
+#define NP_POOL_MAX_IDLE 60
+#define NP_POOL_PER_TARGET 2
+#define NP_POOL_SIZE 16
+
+typedef struct np_pool_ops {
+	int (*fd) (void *);       /* the connection's socket, -1 if unknown */
+	int (*alive) (void *);    /* may be NULL */
+	void (*close) (void *);
+	int keep;                 /* state kept for the life of the worker, such
+	                           * as check_procs' process table: not closed
+	                           * for being idle or having data to read */
+} np_pool_ops;
+
+/* an idle connection for key, now taken by the check, or NULL */
+void *np_pool_get (const char *, const np_pool_ops *);
+/* a new connection for key, taken by the check */
+void np_pool_add (const char *, void *, const np_pool_ops *);
+/* the check is done with the connection; FALSE if the pool did not keep
+ * it and the caller has to close it */
+int np_pool_release (void *);
+/* close a connection, pooled or not */
+void np_pool_close (void *, const np_pool_ops *);
+
+#endif /* NAGIOS_RESIDENT_H_INCLUDED */
@@ -84,11 +84,6 @@ static long maxfd = 0;
 static int np_runcmd_open(const char *, int *, int *)
 	__attribute__((__nonnull__(1, 2, 3)));
 
-static int np_fetch_output(int, output *, int)
-	__attribute__((__nonnull__(2)));
-
-static int np_runcmd_close(int);
-
 /* prototype imported from utils.h */
 extern void die (int, const char *, ...)
 	__attribute__((__noreturn__,__format__(__printf__, 2, 3)));
@@ -122,10 +117,6 @@ np_runcmd_open(const char *cmdstring, int *pfd, int *pfderr)
 	int argc;
 	size_t cmdlen;
 	pid_t pid;
-#ifdef RLIMIT_CORE
-	struct rlimit limit;
-#endif
-
 	int i = 0;
 
 	if(!np_pids) NP_RUNCMD_INIT;
@@ -188,39 +179,10 @@ np_runcmd_open(const char *cmdstring, int *pfd, int *pfderr)
 		argv[i++] = str;
 	}
 
-	if (pipe(pfd) < 0 || pipe(pfderr) < 0 || (pid = fork()) < 0)
+	if (pipe(pfd) < 0 || pipe(pfderr) < 0 ||
+	    (pid = cmd_spawn(argv, env, pfd, pfderr)) < 0)
 		return -1; /* errno set by the failing function */
 
-	/* child runs exceve() and _exit. */
-	if (pid == 0) {
-#ifdef 	RLIMIT_CORE
-		/* the program we execve shouldn't leave core files */
-		getrlimit (RLIMIT_CORE, &limit);
-		limit.rlim_cur = 0;
-		setrlimit (RLIMIT_CORE, &limit);
-#endif
-		close (pfd[0]);
-		if (pfd[1] != STDOUT_FILENO) {
-			dup2 (pfd[1], STDOUT_FILENO);
-			close (pfd[1]);
-		}
-		close (pfderr[0]);
-		if (pfderr[1] != STDERR_FILENO) {
-			dup2 (pfderr[1], STDERR_FILENO);
-			close (pfderr[1]);
-		}
-
-		/* close all descriptors in np_pids[]
-		 * This is executed in a separate address space (pure child),
-		 * so we don't have to worry about async safety */
-		for (i = 0; i < maxfd; i++)
-			if(np_pids[i] > 0)
-				close (i);
-
-		execve (argv[0], argv, env);
-		_exit (STATE_UNKNOWN);
-	}
-
 	/* parent picks up execution here */
 	/* close childs descriptors in our address space */
 	close(pfd[1]);
@@ -233,28 +195,6 @@ np_runcmd_open(const char *cmdstring, int *pfd, int *pfderr)
 }
 
 
-static int
-np_runcmd_close(int fd)
-{
-	int status;
-	pid_t pid;
-
-	/* make sure this fd was opened by popen() */
-	if(fd < 0 || fd > maxfd || !np_pids || (pid = np_pids[fd]) == 0)
-		return -1;
-
-	np_pids[fd] = 0;
-	if (close (fd) == -1) return -1;
-
-	/* EINTR is ok (sort of), everything else is bad */
-	while (waitpid (pid, &status, 0) < 0)
-		if (errno != EINTR) return -1;
-
-	/* return child's termination status */
-	return (WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
-}
-
-
 void
 runcmd_timeout_alarm_handler (int signo)
 {
@@ -287,82 +227,15 @@ runcmd_timeout_alarm_handler (int signo)
 		if(np_pids[i] != 0) kill(np_pids[i], SIGKILL);
 	}
 
-	exit (timeout_state);
-}
-
-static int
-np_fetch_output(int fd, output *op, int flags)
-{
-	size_t len = 0, i = 0, lineno = 0;
-	size_t rsf = 6, ary_size = 0; /* rsf = right shift factor, dec'ed uncond once */
-	char *buf = NULL;
-	int ret;
-	char tmpbuf[4096];
-
-	op->buf = NULL;
-	op->buflen = 0;
-	while((ret = read(fd, tmpbuf, sizeof(tmpbuf))) > 0) {
-		len = (size_t)ret;
-		op->buf = realloc(op->buf, op->buflen + len + 1);
-		memcpy(op->buf + op->buflen, tmpbuf, len);
-		op->buflen += len;
-		i++;
-	}
-
-	if(ret < 0) {
-		printf("read() returned %d: %s\n", ret, strerror(errno));
-		return ret;
-	}
-
-	/* some plugins may want to keep output unbroken, and some commands
-	 * will yield no output, so return here for those */
-	if(flags & RUNCMD_NO_ARRAYS || !op->buf || !op->buflen)
-		return op->buflen;
-
-	/* and some may want both */
-	if(flags & RUNCMD_NO_ASSOC) {
-		buf = malloc(op->buflen);
-		memcpy(buf, op->buf, op->buflen);
-	}
-	else buf = op->buf;
-
-	op->line = NULL;
-	op->lens = NULL;
-	i = 0;
-	while(i < op->buflen) {
-		/* make sure we have enough memory */
-		if(lineno >= ary_size) {
-			/* ary_size must never be zero */
-			do {
-				ary_size = op->buflen >> --rsf;
-			} while(!ary_size);
-
-			op->line = realloc(op->line, ary_size * sizeof(char *));
-			op->lens = realloc(op->lens, ary_size * sizeof(size_t));
-		}
-
-		/* set the pointer to the string */
-		op->line[lineno] = &buf[i];
-
-		/* hop to next newline or end of buffer */
-		while(buf[i] != '\n' && i < op->buflen) i++;
-		buf[i] = '\0';
-
-		/* calculate the string length using pointer difference */
-		op->lens[lineno] = (size_t)&buf[i] - (size_t)op->line[lineno];
-
-		lineno++;
-		i++;
-	}
-
-	return lineno;
+	np_exit (timeout_state);
 }
 
 
 int
 np_runcmd(const char *cmd, output *out, output *err, int flags)
 {
-	int fd, pfd_out[2], pfd_err[2];
+	int fd, pfd_out[2], pfd_err[2], timed_out;
+	cmd_child child;
 
 	/* initialize the structs */
 	if(out) memset(out, 0, sizeof(output));
@@ -371,8 +244,22 @@ np_runcmd(const char *cmd, output *out, output *err, int flags)
 	if((fd = np_runcmd_open(cmd, pfd_out, pfd_err)) == -1)
 		die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), cmd);
 
-	if(out) out->lines = np_fetch_output(pfd_out[0], out, flags);
-	if(err) err->lines = np_fetch_output(pfd_err[0], err, flags);
+	/* both pipes are drained together, so a child filling its stderr
+	 * pipe cannot stall, and the plugin timeout is enforced here too:
+	 * the child is killed at it and reaped there, no signal needed */
+	child.out_fd = pfd_out[0];
+	child.err_fd = pfd_err[0];
+	child.out = out;
+	child.err = err;
+	child.pid = np_pids[fd];
+	child.timeout = 0;
+	timed_out = cmd_fetch_children(&child, 1, flags, timeout_interval) < 0 && errno == ETIMEDOUT;
+	np_pids[fd] = 0;
+	close(pfd_out[0]);
+	close(pfd_err[0]);
+	if(timed_out)
+		die(timeout_state, _("%s - Plugin timed out while executing system call\n"),
+		    state_text(timeout_state));
 
-	return np_runcmd_close(fd);
+	return (WIFEXITED(child.status)) ? WEXITSTATUS(child.status) : -1;
 }
@@ -29,6 +29,15 @@
 #define MAX_CN_LENGTH 256
 #include "common.h"
 #include "netutils.h"
+#include <sys/stat.h>
+#ifdef USE_OPENSSL
+# include <openssl/ocsp.h>
+#endif
+
+/* seconds of clock skew allowed with an OCSP responder */
+#define NP_SSL_OCSP_LEEWAY 300
+/* the largest OCSP response read */
+#define NP_SSL_OCSP_MAX 16384
 
 int check_hostname = 0;
 #ifdef HAVE_SSL
@@ -36,6 +45,56 @@ static SSL_CTX *c=NULL;
 static SSL *s=NULL;
 static int initialized=0;
 
+/* the session cache set up by np_net_ssl_session_cache() */
+static char *session_host=NULL;
+static int session_port=0;
+static int session_full_handshake=FALSE;
+static char *session_file=NULL;
+static int session_reused=FALSE;
+/* what np_net_ssl_early_data() gave for the next handshake */
+static const void *early_data=NULL;
+static size_t early_data_len=0;
+static int early_data_status=NP_SSL_EARLY_DATA_NONE;
+/* set by np_net_ssl_ocsp() */
+static int ocsp_request=FALSE;
+static int ocsp_fetch=FALSE;
+/* set by np_net_ssl_quiet() */
+static int quiet=FALSE;
+#ifdef USE_OPENSSL
+/* the default CAs, which OCSP responses are verified against */
+static X509_STORE *ocsp_store=NULL;
+#endif
+
+/* the protocols offered by np_net_ssl_alpn(), in wire format */
+static unsigned char *alpn=NULL;
+static unsigned int alpn_len=0;
+static char alpn_selected[256];
+
+/* The contexts made so far, one per protocol version and client
+ * certificate, so that every connection after the first to use the same
+ * ones skips loading them again */
+struct np_ssl_ctx {
+	int version;
+	char *cert;
+	char *privkey;
+	SSL_CTX *ctx;
+};
+static struct np_ssl_ctx *contexts=NULL;
+static size_t ncontexts=0;
+
+#ifdef USE_OPENSSL
+/* What np_net_ssl_check_cert_real() read from each certificate it was
+ * shown, by SHA-256 fingerprint, for the many servers sharing one */
+struct np_ssl_cert {
+	unsigned char fingerprint[EVP_MAX_MD_SIZE];
+	unsigned int fingerprint_len;
+	time_t not_after;
+	char cn[MAX_CN_LENGTH];
+};
+static struct np_ssl_cert *certs=NULL;
+static size_t ncerts=0;
+#endif
+
 
 int np_net_ssl_init(int sd) {
 	return np_net_ssl_init_with_hostname(sd, NULL);
@@ -49,7 +108,9 @@ int np_net_ssl_init_with_hostname_and_version(int sd, char *host_name, int versi
 	return np_net_ssl_init_with_hostname_version_and_cert(sd, host_name, version, NULL, NULL);
 }
 
-int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int version, char *cert, char *privkey) {
+/* Create a client context for the given protocol version and optional
+ * client certificate. Returns STATE_OK or prints why it failed. */
+int np_net_ssl_ctx_new(SSL_CTX **ctx, int version, char *cert, char *privkey) {
 	const SSL_METHOD *method = NULL;
 	long options = 0;	/*SSL_OP_ALL | SSL_OP_SINGLE_DH_USE;*/
 
@@ -156,15 +217,15 @@ int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int
 		OpenSSL_add_all_algorithms();
 		initialized = 1;
 	}
-	if ((c = SSL_CTX_new(method)) == NULL) {
+	if ((*ctx = SSL_CTX_new(method)) == NULL) {
 		printf("%s\n", _("CRITICAL - Cannot create SSL context."));
 		return STATE_CRITICAL;
 	}
 	if (cert && privkey) {
-		SSL_CTX_use_certificate_file(c, cert, SSL_FILETYPE_PEM);
-		SSL_CTX_use_PrivateKey_file(c, privkey, SSL_FILETYPE_PEM);
+		SSL_CTX_use_certificate_file(*ctx, cert, SSL_FILETYPE_PEM);
+		SSL_CTX_use_PrivateKey_file(*ctx, privkey, SSL_FILETYPE_PEM);
 #ifdef USE_OPENSSL
-		if (!SSL_CTX_check_private_key(c)) {
+		if (!SSL_CTX_check_private_key(*ctx)) {
 			printf ("%s\n", _("CRITICAL - Private key does not seem to match certificate!\n"));
 			return STATE_CRITICAL;
 		}
@@ -173,36 +234,343 @@ int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int
 #ifdef SSL_OP_NO_TICKET
 	options |= SSL_OP_NO_TICKET;
 #endif
-	SSL_CTX_set_options(c, options);
+	SSL_CTX_set_options(*ctx, options);
 #ifdef SSL_CTX_set_post_handshake_auth
-	SSL_CTX_set_post_handshake_auth(c, 1);
+	SSL_CTX_set_post_handshake_auth(*ctx, 1);
+#endif
+	return STATE_OK;
+}
+
+/* TRUE unless hostname checking is on and the peer certificate does not
+ * match host_name */
+int np_net_ssl_hostname_ok(SSL *ssl, const char *host_name) {
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+	if (check_hostname && host_name && *host_name) {
+		X509 *certificate=SSL_get_peer_certificate(ssl);
+		int rc = X509_check_host(certificate, host_name, 0, 0, NULL);
+		X509_free(certificate);
+		if (rc != 1)
+			return FALSE;
+	}
+#endif
+	return TRUE;
+}
+
+void np_net_ssl_session_cache(const char *host, int port, int full_handshake) {
+	free(session_host);
+	session_host = NULL;
+	if (host != NULL && (session_host = strdup(host)) == NULL)
+		die(STATE_UNKNOWN, "%s %s\n", _("Cannot execute strdup:"), strerror(errno));
+	session_port = port;
+	session_full_handshake = full_handshake;
+}
+
+int np_net_ssl_session_reused(void) {
+	return session_reused;
+}
+
+void np_net_ssl_ocsp(int request, int fetch) {
+	ocsp_request = request;
+	ocsp_fetch = fetch;
+}
+
+void np_net_ssl_ocsp_setup(SSL *ssl) {
+#ifdef USE_OPENSSL
+	if (ocsp_request)
+		SSL_set_tlsext_status_type(ssl, TLSEXT_STATUSTYPE_ocsp);
+#endif
+}
+
+void np_net_ssl_quiet(int q) {
+	quiet = q;
+}
+
+void np_net_ssl_early_data(const void *buf, size_t len) {
+	early_data = buf;
+	early_data_len = len;
+}
+
+int np_net_ssl_early_data_status(void) {
+	return early_data_status;
+}
+
+int np_net_ssl_alpn(const char *protocols) {
+	const char *p;
+	size_t len;
+
+	free(alpn);
+	alpn = NULL;
+	alpn_len = 0;
+	if (protocols == NULL || *protocols == '\0')
+		return OK;
+
+	if ((alpn = malloc(strlen(protocols) + 1)) == NULL)
+		die(STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror(errno));
+	/* each name goes out with a length byte in front instead of a comma */
+	for (p = protocols; *p; p += len + (p[len] == ',')) {
+		len = strcspn(p, ",");
+		if (len == 0 || len > 255)
+			return ERROR;
+		alpn[alpn_len++] = (unsigned char)len;
+		memcpy(alpn + alpn_len, p, len);
+		alpn_len += len;
+	}
+	return OK;
+}
+
+const char *np_net_ssl_alpn_selected(void) {
+	return alpn_selected[0] ? alpn_selected : NULL;
+}
+
+#ifdef USE_OPENSSL
+/* Sessions live one file each under the state directory, named after a
+ * hash of host, port and SNI name since all three select the session the
+ * server will accept. Setuid plugins get no cache, as they get no state. */
+static char *np_net_ssl_session_path(const char *sni) {
+	struct sha1_ctx ctx;
+	unsigned char key[20];
+	char *path, port[16], keyname[41];
+	int i;
+
+	if (np_suid())
+		return NULL;
+	snprintf(port, sizeof(port), "%d", session_port);
+	sha1_init_ctx(&ctx);
+	sha1_process_bytes(session_host, strlen(session_host) + 1, &ctx);
+	sha1_process_bytes(port, strlen(port) + 1, &ctx);
+	if (sni)
+		sha1_process_bytes(sni, strlen(sni), &ctx);
+	sha1_finish_ctx(&ctx, key);
+	for (i = 0; i < 20; i++)
+		sprintf(&keyname[2 * i], "%02x", key[i]);
+
+	if (asprintf(&path, "%s/%lu/tls_sessions/%s", _np_state_calculate_location_prefix(),
+	             (unsigned long)geteuid(), keyname) < 0)
+		die(STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror(errno));
+	return path;
+}
+
+static SSL_SESSION *np_net_ssl_session_load(const char *path) {
+	unsigned char buf[8192];
+	const unsigned char *p = buf;
+	SSL_SESSION *session = NULL;
+	FILE *fp;
+	size_t len;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return NULL;
+	len = fread(buf, 1, sizeof(buf), fp);
+	fclose(fp);
+	if (len > 0 && len < sizeof(buf))
+		session = d2i_SSL_SESSION(NULL, &p, (long)len);
+	if (session == NULL)
+		return NULL;
+
+	if (SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) < (long)time(NULL)
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	    || !SSL_SESSION_is_resumable(session)
+#endif
+	    ) {
+		SSL_SESSION_free(session);
+		unlink(path);
+		return NULL;
+	}
+	return session;
+}
+
+/* called by OpenSSL for every new session or TLSv1.3 ticket; failing to
+ * store one only costs a full handshake next time */
+static int np_net_ssl_session_store(SSL *ssl, SSL_SESSION *session) {
+	unsigned char *der = NULL;
+	char *temp_file, *p;
+	int fd, len;
+
+	if (session_file == NULL || (len = i2d_SSL_SESSION(session, &der)) <= 0)
+		return 0;
+
+	/* the state directory may not exist yet */
+	for (p = strchr(session_file + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (access(session_file, F_OK))
+			mkdir(session_file, S_IRWXU);
+		*p = '/';
+	}
+
+	if (asprintf(&temp_file, "%s.XXXXXX", session_file) < 0) {
+		OPENSSL_free(der);
+		return 0;
+	}
+	/* mkstemp() creates it 0600, it holds the session secret */
+	if ((fd = mkstemp(temp_file)) >= 0) {
+		if (write(fd, der, len) == len && close(fd) == 0)
+			rename(temp_file, session_file);
+		else
+			close(fd);
+		unlink(temp_file);
+	}
+	free(temp_file);
+	OPENSSL_free(der);
+	return 0;
+}
+#endif /* USE_OPENSSL */
+
+static int np_net_ssl_strcmp(const char *a, const char *b) {
+	if (a == NULL || b == NULL)
+		return a != b;
+	return strcmp(a, b);
+}
+
+/* the context for version and the client certificate, made on first use */
+static int np_net_ssl_ctx_get(SSL_CTX **ctx, int version, char *cert, char *privkey) {
+	struct np_ssl_ctx *n;
+	int ret;
+	size_t i;
+
+	for (i = 0; i < ncontexts; i++)
+		if (contexts[i].version == version && !np_net_ssl_strcmp(contexts[i].cert, cert) &&
+		    !np_net_ssl_strcmp(contexts[i].privkey, privkey)) {
+			*ctx = contexts[i].ctx;
+			return STATE_OK;
+		}
+
+	*ctx = NULL;
+	if ((ret = np_net_ssl_ctx_new(ctx, version, cert, privkey)) != STATE_OK) {
+		if (*ctx)
+			SSL_CTX_free(*ctx);
+		*ctx = NULL;
+		return ret;
+	}
+	SSL_CTX_set_mode(*ctx, SSL_MODE_AUTO_RETRY);
+
+	if ((n = realloc(contexts, (ncontexts + 1) * sizeof(*contexts))) == NULL)
+		die(STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror(errno));
+	contexts = n;
+	contexts[ncontexts].version = version;
+	contexts[ncontexts].cert = cert ? strdup(cert) : NULL;
+	contexts[ncontexts].privkey = privkey ? strdup(privkey) : NULL;
+	contexts[ncontexts].ctx = *ctx;
+	ncontexts++;
+	return STATE_OK;
+}
+
+void np_net_ssl_ctx_cache_free(void) {
+	size_t i;
+
+	for (i = 0; i < ncontexts; i++) {
+		SSL_CTX_free(contexts[i].ctx);
+		free(contexts[i].cert);
+		free(contexts[i].privkey);
+	}
+	free(contexts);
+	contexts = NULL;
+	ncontexts = 0;
+	c = NULL;
+#ifdef USE_OPENSSL
+	free(certs);
+	certs = NULL;
+	ncerts = 0;
+	X509_STORE_free(ocsp_store);
+	ocsp_store = NULL;
+#endif
+}
+
+int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int version, char *cert, char *privkey) {
+	int ret;
+	const void *early = early_data;
+	size_t early_len = early_data_len;
+#ifdef USE_OPENSSL
+	SSL_SESSION *session = NULL;
+#endif
+
+	session_reused = FALSE;
+	/* the early data is for this handshake alone */
+	early_data = NULL;
+	early_data_len = 0;
+	early_data_status = NP_SSL_EARLY_DATA_NONE;
+	alpn_selected[0] = '\0';
+	if ((ret = np_net_ssl_ctx_get(&c, version, cert, privkey)) != STATE_OK)
+		return ret;
+#ifdef USE_OPENSSL
+	free(session_file);
+	session_file = NULL;
+	if (session_host && (session_file = np_net_ssl_session_path(host_name)) != NULL) {
+		SSL_CTX_set_session_cache_mode(c, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(c, np_net_ssl_session_store);
+		if (!session_full_handshake)
+			session = np_net_ssl_session_load(session_file);
+	} else {
+		/* the context may have cached sessions for an earlier connection */
+		SSL_CTX_set_session_cache_mode(c, SSL_SESS_CACHE_OFF);
+		SSL_CTX_sess_set_new_cb(c, NULL);
+	}
 #endif
-	SSL_CTX_set_mode(c, SSL_MODE_AUTO_RETRY);
 	if ((s = SSL_new(c)) != NULL) {
 #ifdef SSL_set_tlsext_host_name
 		if (host_name != NULL)
 			SSL_set_tlsext_host_name(s, host_name);
 #endif
 		SSL_set_fd(s, sd);
-		if (SSL_connect(s) == 1) {
+		np_net_ssl_ocsp_setup(s);
 #if OPENSSL_VERSION_NUMBER >= 0x10002000L
-			if (check_hostname && host_name && *host_name) {
-				X509 *certificate=SSL_get_peer_certificate(s);
-				int rc = X509_check_host(certificate, host_name, 0, 0, NULL);
-				if (rc != 1) {
-					printf("%s\n", _("CRITICAL - Hostname mismatch."));
-					return STATE_CRITICAL;
-				}
+		if (alpn)
+			SSL_set_alpn_protos(s, alpn, alpn_len);
+#endif
+		np_timer_phase_begin(NP_PHASE_TLS);
+#ifdef USE_OPENSSL
+		if (session) {
+			SSL_set_session(s, session);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+			/* sent with the ClientHello, so the reply can come a round
+			 * trip sooner; the server may still turn it down */
+			if (early && early_len <= SSL_SESSION_get_max_early_data(session)) {
+				const unsigned char *selected;
+				size_t written = 0, selected_len = 0;
+
+				/* a protocol selected for the session has to be
+				 * offered again, or OpenSSL fails the handshake */
+				SSL_SESSION_get0_alpn_selected(session, &selected, &selected_len);
+				if (alpn == NULL && selected_len == 0
+				    && SSL_write_early_data(s, early, early_len, &written) == 1 && written == early_len)
+					early_data_status = NP_SSL_EARLY_DATA_REJECTED;
+			}
+#endif
+			SSL_SESSION_free(session);
+		}
+#endif
+		ret = SSL_connect(s);
+		np_timer_phase_end(NP_PHASE_TLS);
+		if (ret == 1) {
+#ifdef USE_OPENSSL
+			session_reused = SSL_session_reused(s);
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+			if (early_data_status == NP_SSL_EARLY_DATA_REJECTED
+			    && SSL_get_early_data_status(s) == SSL_EARLY_DATA_ACCEPTED)
+				early_data_status = NP_SSL_EARLY_DATA_ACCEPTED;
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+			if (alpn) {
+				const unsigned char *selected;
+				unsigned int selected_len;
+
+				SSL_get0_alpn_selected(s, &selected, &selected_len);
+				memcpy(alpn_selected, selected, selected_len);
+				alpn_selected[selected_len] = '\0';
 			}
 #endif
+			if (!np_net_ssl_hostname_ok(s, host_name)) {
+				if (!quiet)
+					printf("%s\n", _("CRITICAL - Hostname mismatch."));
+				return STATE_CRITICAL;
+			}
 			return OK;
-		} else {
+		} else if (!quiet) {
 			printf("%s\n", _("CRITICAL - Cannot make SSL connection."));
 #  ifdef USE_OPENSSL /* XXX look into ERR_error_string */
 			ERR_print_errors_fp(stdout);
 #  endif /* USE_OPENSSL */
 		}
-	} else {
+	} else if (!quiet) {
 			printf("%s\n", _("CRITICAL - Cannot initiate SSL handshake."));
 	}
 	return STATE_CRITICAL;
@@ -215,10 +583,7 @@ void np_net_ssl_cleanup() {
 #endif
 		SSL_shutdown(s);
 		SSL_free(s);
-		if (c) {
-			SSL_CTX_free(c);
-			c=NULL;
-		}
+		/* the context stays for the next connection with the same settings */
 		s=NULL;
 	}
 }
@@ -240,43 +605,22 @@ int np_net_ssl_check_cert(int days_till_exp_warn, int days_till_exp_crit){
 #  endif /* USE_OPENSSL */
 }
 
-int np_net_ssl_check_cert_real(SSL *ssl, int days_till_exp_warn, int days_till_exp_crit){
-#  ifdef USE_OPENSSL
-	X509 *certificate=NULL;
+#ifdef USE_OPENSSL
+/* the subject's CN and the end of validity of certificate, into entry;
+ * NULL, or what is wrong with it */
+static const char *np_net_ssl_cert_parse(X509 *certificate, struct np_ssl_cert *entry) {
 	X509_NAME *subj=NULL;
-	char timestamp[50] = "";
-	char cn[MAX_CN_LENGTH]= "";
-	
-	int cnlen =-1;
-	int status=STATE_UNKNOWN;
-
 	ASN1_STRING *tm;
 	int offset;
 	struct tm stamp;
-	float time_left;
-	int days_left;
-	int time_remaining;
-	time_t tm_t;
-
-	// Prefix whatever we're about to print with SSL
-	printf("SSL ");
-
-	certificate=SSL_get_peer_certificate(ssl);
-	if (!certificate) {
-		printf("%s\n",_("CRITICAL - Cannot retrieve server certificate."));
-		return STATE_CRITICAL;
-	}
 
 	/* Extract CN from certificate subject */
 	subj=X509_get_subject_name(certificate);
 
-	if (!subj) {
-		printf("%s\n",_("CRITICAL - Cannot retrieve certificate subject."));
-		return STATE_CRITICAL;
-	}
-	cnlen = X509_NAME_get_text_by_NID(subj, NID_commonName, cn, sizeof(cn)-1);
-	if (cnlen == -1)
-		strncpy(cn, _("Unknown CN\0"), 12);
+	if (!subj)
+		return _("CRITICAL - Cannot retrieve certificate subject.");
+	if (X509_NAME_get_text_by_NID(subj, NID_commonName, entry->cn, sizeof(entry->cn)-1) == -1)
+		strncpy(entry->cn, _("Unknown CN\0"), 12);
 
 	/* Retrieve timestamp of certificate */
 	tm = X509_get_notAfter(certificate);
@@ -284,8 +628,7 @@ int np_net_ssl_check_cert_real(SSL *ssl, int days_till_exp_warn, int days_till_e
 	/* Generate tm structure to process timestamp */
 	if (tm->type == V_ASN1_UTCTIME) {
 		if (tm->length < 10) {
-			printf("%s\n", _("CRITICAL - Wrong time format in certificate."));
-			return STATE_CRITICAL;
+			return _("CRITICAL - Wrong time format in certificate.");
 		} else {
 			stamp.tm_year = (tm->data[0] - '0') * 10 + (tm->data[1] - '0');
 			if (stamp.tm_year < 50)
@@ -294,8 +637,7 @@ int np_net_ssl_check_cert_real(SSL *ssl, int days_till_exp_warn, int days_till_e
 		}
 	} else {
 		if (tm->length < 12) {
-			printf("%s\n", _("CRITICAL - Wrong time format in certificate."));
-			return STATE_CRITICAL;
+			return _("CRITICAL - Wrong time format in certificate.");
 		} else {
 			stamp.tm_year =
 				(tm->data[0] - '0') * 1000 + (tm->data[1] - '0') * 100 +
@@ -316,13 +658,90 @@ int np_net_ssl_check_cert_real(SSL *ssl, int days_till_exp_warn, int days_till_e
 		(tm->data[10 + offset] - '0') * 10 + (tm->data[11 + offset] - '0');
 	stamp.tm_isdst = -1;
 
-	tm_t = timegm(&stamp);
+	entry->not_after = timegm(&stamp);
+	return NULL;
+}
+
+/* the cached entry for certificate, parsing it the first time it is seen;
+ * NULL, or what is wrong with it */
+static const char *np_net_ssl_cert_get(X509 *certificate, struct np_ssl_cert **entry) {
+	struct np_ssl_cert cert, *n;
+	const char *error;
+	size_t i;
+
+	memset(&cert, 0, sizeof(cert));
+	if (X509_digest(certificate, EVP_sha256(), cert.fingerprint, &cert.fingerprint_len)) {
+		for (i = 0; i < ncerts; i++)
+			if (certs[i].fingerprint_len == cert.fingerprint_len &&
+			    !memcmp(certs[i].fingerprint, cert.fingerprint, cert.fingerprint_len)) {
+				*entry = &certs[i];
+				return NULL;
+			}
+	}
+
+	if ((error = np_net_ssl_cert_parse(certificate, &cert)) != NULL)
+		return error;
+	/* one without a fingerprint is checked each time */
+	if (cert.fingerprint_len == 0 || (n = realloc(certs, (ncerts + 1) * sizeof(*certs))) == NULL) {
+		static struct np_ssl_cert uncached;
+
+		uncached = cert;
+		*entry = &uncached;
+		return NULL;
+	}
+	certs = n;
+	certs[ncerts] = cert;
+	*entry = &certs[ncerts++];
+	return NULL;
+}
+#endif /* USE_OPENSSL */
+
+int np_net_ssl_check_cert_real(SSL *ssl, int days_till_exp_warn, int days_till_exp_crit){
+	char msg[MAX_CN_LENGTH + 128];
+	int status;
+
+	status = np_net_ssl_cert_state(ssl, days_till_exp_warn, days_till_exp_crit, msg, sizeof(msg), NULL);
+	// Prefix whatever we're about to print with SSL
+	printf("SSL %s\n", msg);
+	return status;
+}
+
+int np_net_ssl_cert_state(SSL *ssl, int days_till_exp_warn, int days_till_exp_crit, char *msg, size_t len, double *days){
+#  ifdef USE_OPENSSL
+	X509 *certificate=NULL;
+	struct np_ssl_cert *entry;
+	const char *error;
+	char timestamp[50] = "";
+	char *cn;
+	int status=STATE_UNKNOWN;
+
+	float time_left;
+	int days_left;
+	int time_remaining;
+	time_t tm_t;
+
+	certificate=SSL_get_peer_certificate(ssl);
+	if (!certificate) {
+		snprintf(msg, len, "%s", _("CRITICAL - Cannot retrieve server certificate."));
+		return STATE_CRITICAL;
+	}
+	error = np_net_ssl_cert_get(certificate, &entry);
+	X509_free(certificate);
+	if (error) {
+		snprintf(msg, len, "%s", error);
+		return STATE_CRITICAL;
+	}
+	cn = entry->cn;
+	tm_t = entry->not_after;
+
 	time_left = difftime(tm_t, time(NULL));
 	days_left = time_left / 86400;
+	if (days)
+		*days = time_left / 86400;
 	strftime(timestamp, 50, "%F %R %z/%Z", localtime(&tm_t));
 
 	if (days_left > 0 && days_left <= days_till_exp_warn) {
-		printf (_("%s - Certificate '%s' expires in %d day(s) (%s).\n"), (days_left>days_till_exp_crit)?"WARNING":"CRITICAL", cn, days_left, timestamp);
+		snprintf (msg, len, _("%s - Certificate '%s' expires in %d day(s) (%s)."), (days_left>days_till_exp_crit)?"WARNING":"CRITICAL", cn, days_left, timestamp);
 		if (days_left > days_till_exp_crit)
 			status = STATE_WARNING;
 		else
@@ -333,7 +752,7 @@ int np_net_ssl_check_cert_real(SSL *ssl, int days_till_exp_warn, int days_till_e
 		else
 			time_remaining = (int) time_left / 60;
 
-		printf (_("%s - Certificate '%s' expires in %u %s (%s)\n"),
+		snprintf (msg, len, _("%s - Certificate '%s' expires in %u %s (%s)"),
 			(days_left>days_till_exp_crit) ? "WARNING" : "CRITICAL", cn, time_remaining,
 			time_left >= 3600 ? "hours" : "minutes", timestamp);
 
@@ -342,22 +761,333 @@ int np_net_ssl_check_cert_real(SSL *ssl, int days_till_exp_warn, int days_till_e
 		else
 			status = STATE_CRITICAL;
 	} else if (time_left < 0) {
-		printf(_("CRITICAL - Certificate '%s' expired on %s.\n"), cn, timestamp);
+		snprintf(msg, len, _("CRITICAL - Certificate '%s' expired on %s."), cn, timestamp);
 		status=STATE_CRITICAL;
 	} else if (days_left == 0) {
-		printf (_("%s - Certificate '%s' just expired (%s).\n"), (days_left>days_till_exp_crit)?"WARNING":"CRITICAL", cn, timestamp);
+		snprintf (msg, len, _("%s - Certificate '%s' just expired (%s)."), (days_left>days_till_exp_crit)?"WARNING":"CRITICAL", cn, timestamp);
 		if (days_left > days_till_exp_crit)
 			status = STATE_WARNING;
 		else
 			status = STATE_CRITICAL;
 	} else {
-		printf(_("OK - Certificate '%s' will expire in %u days on %s.\n"), cn, days_left, timestamp);
+		snprintf(msg, len, _("OK - Certificate '%s' will expire in %u days on %s."), cn, days_left, timestamp);
+		status = STATE_OK;
+	}
+	return status;
+#  else /* ifndef USE_OPENSSL */
+	snprintf(msg, len, "%s", _("WARNING - Plugin does not support checking certificates."));
+	return STATE_WARNING;
+#  endif /* USE_OPENSSL */
+}
+
+
+#ifdef USE_OPENSSL
+/* The OCSP response of the server's certificate when the handshake had
+ * none stapled: one kept in the state directory while it is current, so
+ * that a responder is asked once per nextUpdate rather than once per
+ * check, or else one asked for by POST to the certificate's responder */
+static char *np_net_ssl_ocsp_path(X509 *certificate) {
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int md_len, i;
+	char *path, keyname[2 * EVP_MAX_MD_SIZE + 1];
+
+	if (np_suid() || !X509_digest(certificate, EVP_sha256(), md, &md_len))
+		return NULL;
+	for (i = 0; i < md_len; i++)
+		sprintf(&keyname[2 * i], "%02x", md[i]);
+	if (asprintf(&path, "%s/%lu/ocsp/%s", _np_state_calculate_location_prefix(),
+	             (unsigned long)geteuid(), keyname) < 0)
+		die(STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror(errno));
+	return path;
+}
+
+/* whether resp has a status for id that is current */
+static int np_net_ssl_ocsp_current(OCSP_RESPONSE *resp, OCSP_CERTID *id) {
+	OCSP_BASICRESP *basic;
+	ASN1_GENERALIZEDTIME *this_update, *next_update;
+	int status, reason, ok = FALSE;
+
+	if (OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL
+	    || (basic = OCSP_response_get1_basic(resp)) == NULL)
+		return FALSE;
+	if (OCSP_resp_find_status(basic, id, &status, &reason, NULL, &this_update, &next_update)
+	    && next_update && OCSP_check_validity(this_update, next_update, NP_SSL_OCSP_LEEWAY, -1))
+		ok = TRUE;
+	OCSP_BASICRESP_free(basic);
+	return ok;
+}
+
+/* the OCSP response to req of the responder at a plain http url, of up
+ * to NP_SSL_OCSP_MAX bytes; NULL if there is none */
+static OCSP_RESPONSE *np_net_ssl_ocsp_post(const char *url, OCSP_REQUEST *req) {
+	struct addrinfo hints, *res, *ai;
+	OCSP_RESPONSE *resp = NULL;
+	unsigned char *der = NULL, *buf;
+	const unsigned char *p;
+	char *host = NULL, *port = NULL, *path = NULL, *header = NULL, *body;
+	size_t len = 0;
+	ssize_t n;
+	int use_ssl, der_len, sd = -1;
+
+	if (!OCSP_parse_url(url, &host, &port, &path, &use_ssl) || use_ssl)
+		goto done;
+	if ((der_len = i2d_OCSP_REQUEST(req, &der)) <= 0)
+		goto done;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = address_family;
+	hints.ai_socktype = SOCK_STREAM;
+	if (np_net_getaddrinfo(host, port, &hints, &res) != 0)
+		goto done;
+	for (ai = res; ai && sd < 0; ai = ai->ai_next) {
+		if ((sd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+			continue;
+		if (connect(sd, ai->ai_addr, ai->ai_addrlen) < 0) {
+			close(sd);
+			sd = -1;
+		}
+	}
+	freeaddrinfo(res);
+	if (sd < 0)
+		goto done;
+
+	if (asprintf(&header, "POST %s HTTP/1.0\r\nHost: %s\r\nContent-Type: application/ocsp-request\r\n"
+	             "Content-Length: %d\r\n\r\n", path, host, der_len) < 0) {
+		header = NULL;
+		goto done;
+	}
+	if (write(sd, header, strlen(header)) != (ssize_t)strlen(header) || write(sd, der, der_len) != der_len)
+		goto done;
+	if ((buf = malloc(NP_SSL_OCSP_MAX + 1)) == NULL)
+		goto done;
+	while (len < NP_SSL_OCSP_MAX && (n = read(sd, buf + len, NP_SSL_OCSP_MAX - len)) > 0)
+		len += (size_t)n;
+	buf[len] = '\0';
+	if (len > 12 && !strncmp((char *)buf, "HTTP/1.", 7) && !strncmp((char *)buf + 9, "200", 3)
+	    && (body = strstr((char *)buf, "\r\n\r\n")) != NULL) {
+		p = (unsigned char *)body + 4;
+		resp = d2i_OCSP_RESPONSE(NULL, &p, (long)(len - (p - buf)));
+	}
+	free(buf);
+
+done:
+	if (sd >= 0)
+		close(sd);
+	free(header);
+	OPENSSL_free(der);
+	OPENSSL_free(host);
+	OPENSSL_free(port);
+	OPENSSL_free(path);
+	return resp;
+}
+
+static OCSP_RESPONSE *np_net_ssl_ocsp_get(X509 *certificate, X509 *issuer, const char **source) {
+	STACK_OF(OPENSSL_STRING) *urls;
+	OCSP_RESPONSE *resp = NULL;
+	OCSP_REQUEST *req;
+	OCSP_CERTID *id;
+	unsigned char buf[NP_SSL_OCSP_MAX], *der = NULL;
+	const unsigned char *p = buf;
+	char *path, *temp_file, *q;
+	FILE *fp;
+	size_t len;
+	int fd, der_len, i;
+
+	if ((id = OCSP_cert_to_id(NULL, certificate, issuer)) == NULL)
+		return NULL;
+	path = np_net_ssl_ocsp_path(certificate);
+	if (path && (fp = fopen(path, "r")) != NULL) {
+		len = fread(buf, 1, sizeof(buf), fp);
+		fclose(fp);
+		if (len > 0 && len < sizeof(buf) && (resp = d2i_OCSP_RESPONSE(NULL, &p, (long)len)) != NULL
+		    && !np_net_ssl_ocsp_current(resp, id)) {
+			OCSP_RESPONSE_free(resp);
+			resp = NULL;
+		}
+		if (resp) {
+			*source = _("cached");
+			OCSP_CERTID_free(id);
+			free(path);
+			return resp;
+		}
+	}
+
+	if ((urls = X509_get1_ocsp(certificate)) != NULL && (req = OCSP_REQUEST_new()) != NULL) {
+		if (OCSP_request_add0_id(req, id)) {
+			id = NULL;
+			for (i = 0; i < sk_OPENSSL_STRING_num(urls) && resp == NULL; i++)
+				resp = np_net_ssl_ocsp_post(sk_OPENSSL_STRING_value(urls, i), req);
+		}
+		OCSP_REQUEST_free(req);
+	}
+	X509_email_free(urls);
+	OCSP_CERTID_free(id);
+	if (resp == NULL) {
+		free(path);
+		return NULL;
+	}
+	*source = _("fetched");
+
+	/* kept only if it is worth keeping; a failed store costs a fetch */
+	if (path && OCSP_response_status(resp) == OCSP_RESPONSE_STATUS_SUCCESSFUL
+	    && (der_len = i2d_OCSP_RESPONSE(resp, &der)) > 0) {
+		for (q = strchr(path + 1, '/'); q; q = strchr(q + 1, '/')) {
+			*q = '\0';
+			if (access(path, F_OK))
+				mkdir(path, S_IRWXU);
+			*q = '/';
+		}
+		if (asprintf(&temp_file, "%s.XXXXXX", path) >= 0) {
+			if ((fd = mkstemp(temp_file)) >= 0) {
+				if (write(fd, der, der_len) == der_len && close(fd) == 0)
+					rename(temp_file, path);
+				else
+					close(fd);
+				unlink(temp_file);
+			}
+			free(temp_file);
+		}
+		OPENSSL_free(der);
+	}
+	free(path);
+	return resp;
+}
+
+/* the certificate of chain that issued certificate, or one from the
+ * trusted store; to be freed */
+static X509 *np_net_ssl_issuer(X509 *certificate, STACK_OF(X509) *chain) {
+	X509_STORE_CTX *store_ctx;
+	X509 *issuer = NULL;
+	int i;
+
+	for (i = 0; chain && i < sk_X509_num(chain); i++)
+		if (X509_check_issued(sk_X509_value(chain, i), certificate) == X509_V_OK) {
+			issuer = sk_X509_value(chain, i);
+			X509_up_ref(issuer);
+			return issuer;
+		}
+	if (ocsp_store && (store_ctx = X509_STORE_CTX_new()) != NULL) {
+		if (X509_STORE_CTX_init(store_ctx, ocsp_store, certificate, chain) == 1
+		    && X509_STORE_CTX_get1_issuer(&issuer, store_ctx, certificate) != 1)
+			issuer = NULL;
+		X509_STORE_CTX_free(store_ctx);
+	}
+	return issuer;
+}
+#endif /* USE_OPENSSL */
+
+int np_net_ssl_check_ocsp(int warn_hours, int crit_hours) {
+	char msg[MAX_CN_LENGTH + 256];
+	int status;
+
+	status = np_net_ssl_ocsp_state(s, warn_hours, crit_hours, msg, sizeof(msg), NULL);
+	printf("SSL %s\n", msg);
+	return status;
+}
+
+int np_net_ssl_ocsp_state(SSL *ssl, int warn_hours, int crit_hours, char *msg, size_t len, double *hours) {
+#  ifdef USE_OPENSSL
+	X509 *certificate, *issuer = NULL;
+	STACK_OF(X509) *chain;
+	OCSP_RESPONSE *resp = NULL;
+	OCSP_BASICRESP *basic = NULL;
+	OCSP_CERTID *id = NULL;
+	ASN1_GENERALIZEDTIME *revoked, *this_update, *next_update;
+	const unsigned char *p;
+	const char *source = _("stapled");
+	char cn[MAX_CN_LENGTH] = "";
+	char when[64];
+	double left = 0;
+	long der_len;
+	int cert_status, reason, days, secs, status = STATE_CRITICAL;
+	struct tm tm;
+
+	if ((certificate = SSL_get_peer_certificate(ssl)) == NULL) {
+		snprintf(msg, len, "%s", _("CRITICAL - Cannot retrieve server certificate."));
+		return STATE_CRITICAL;
+	}
+	if (X509_NAME_get_text_by_NID(X509_get_subject_name(certificate), NID_commonName, cn, sizeof(cn) - 1) == -1)
+		strcpy(cn, _("Unknown CN"));
+	/* the responder's certificate has to lead to a trusted CA, whether or
+	 * not the plugin verifies the server's */
+	if (ocsp_store == NULL && (ocsp_store = X509_STORE_new()) != NULL)
+		X509_STORE_set_default_paths(ocsp_store);
+	chain = SSL_get_peer_cert_chain(ssl);
+	if ((issuer = np_net_ssl_issuer(certificate, chain)) == NULL) {
+		snprintf(msg, len, _("UNKNOWN - Cannot find the issuer of certificate '%s' for OCSP."), cn);
+		status = STATE_UNKNOWN;
+		goto done;
+	}
+
+	if ((der_len = SSL_get_tlsext_status_ocsp_resp(ssl, &p)) > 0 && p)
+		resp = d2i_OCSP_RESPONSE(NULL, &p, der_len);
+	else if (ocsp_fetch)
+		resp = np_net_ssl_ocsp_get(certificate, issuer, &source);
+	if (resp == NULL) {
+		snprintf(msg, len, _("%s - No OCSP response for certificate '%s'%s."),
+		         ocsp_fetch ? "CRITICAL" : "WARNING", cn,
+		         ocsp_fetch ? _(" stapled or from its responder") : _(" stapled"));
+		status = ocsp_fetch ? STATE_CRITICAL : STATE_WARNING;
+		goto done;
+	}
+
+	if (OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+		snprintf(msg, len, _("CRITICAL - OCSP response (%s) for certificate '%s': %s."), source, cn,
+		         OCSP_response_status_str(OCSP_response_status(resp)));
+		goto done;
+	}
+	if ((basic = OCSP_response_get1_basic(resp)) == NULL || OCSP_basic_verify(basic, chain, ocsp_store, 0) <= 0) {
+		snprintf(msg, len, _("CRITICAL - OCSP response (%s) for certificate '%s' cannot be verified."), source, cn);
+		goto done;
+	}
+	if ((id = OCSP_cert_to_id(NULL, certificate, issuer)) == NULL
+	    || !OCSP_resp_find_status(basic, id, &cert_status, &reason, &revoked, &this_update, &next_update)) {
+		snprintf(msg, len, _("CRITICAL - OCSP response (%s) has no status for certificate '%s'."), source, cn);
+		goto done;
+	}
+	if (!OCSP_check_validity(this_update, next_update, NP_SSL_OCSP_LEEWAY, -1)) {
+		snprintf(msg, len, _("CRITICAL - OCSP response (%s) for certificate '%s' is out of date."), source, cn);
+		goto done;
+	}
+
+	if (cert_status == V_OCSP_CERTSTATUS_REVOKED) {
+		when[0] = '\0';
+		if (revoked && ASN1_TIME_to_tm(revoked, &tm))
+			strftime(when, sizeof(when), " on %F %R UTC", &tm);
+		snprintf(msg, len, _("CRITICAL - Certificate '%s' revoked%s (OCSP %s, %s)."), cn, when, source,
+		         OCSP_crl_reason_str(reason));
+		goto done;
+	}
+	if (cert_status != V_OCSP_CERTSTATUS_GOOD) {
+		snprintf(msg, len, _("CRITICAL - Certificate '%s' unknown to its OCSP responder (%s)."), cn, source);
+		goto done;
+	}
+
+	if (next_update == NULL) {
+		snprintf(msg, len, _("OK - OCSP status of certificate '%s' good (%s)."), cn, source);
 		status = STATE_OK;
+		goto done;
 	}
+	if (ASN1_TIME_diff(&days, &secs, NULL, next_update))
+		left = days * 24.0 + secs / 3600.0;
+	if (hours)
+		*hours = left;
+	when[0] = '\0';
+	if (ASN1_TIME_to_tm(next_update, &tm))
+		strftime(when, sizeof(when), "%F %R UTC", &tm);
+	status = left <= crit_hours ? STATE_CRITICAL : left <= warn_hours ? STATE_WARNING : STATE_OK;
+	snprintf(msg, len, _("%s - OCSP status of certificate '%s' good (%s), next update in %.1f hours (%s)."),
+	         status == STATE_CRITICAL ? "CRITICAL" : status == STATE_WARNING ? "WARNING" : "OK",
+	         cn, source, left, when);
+
+done:
+	OCSP_CERTID_free(id);
+	OCSP_BASICRESP_free(basic);
+	OCSP_RESPONSE_free(resp);
+	X509_free(issuer);
 	X509_free(certificate);
 	return status;
 #  else /* ifndef USE_OPENSSL */
-	printf("%s\n", _("WARNING - Plugin does not support checking certificates."));
+	snprintf(msg, len, "%s", _("WARNING - Plugin does not support checking OCSP."));
 	return STATE_WARNING;
 #  endif /* USE_OPENSSL */
 }
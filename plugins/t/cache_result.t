@@ -0,0 +1,83 @@
+#! /usr/bin/perl -w -I ..
+#
+# cache_result checks
+# Need check_dummy to work for testing
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use File::Temp qw(tempdir);
+
+plan tests => 20;
+
+my $res;
+
+my $PWD = $ENV{PWD};
+my $dir = tempdir(CLEANUP => 1);
+$ENV{NAGIOS_PLUGIN_STATE_DIRECTORY} = "$dir/state";
+
+# a plugin that counts its runs, taking a while when asked to
+my $plugin = "$dir/check_count";
+open(my $fh, ">", $plugin) or die "Cannot write $plugin: $!";
+print $fh <<"EOF";
+#!/bin/sh
+n=\$((\$(cat $dir/runs 2>/dev/null || echo 0) + 1))
+echo \$n > $dir/runs
+case "\$1" in slow*) sleep 2;; esac
+echo "CRITICAL: run \$n|runs=\$n"
+echo "\$1"
+exit 2
+EOF
+close($fh);
+chmod 0755, $plugin;
+
+$res = NPTest->testCmd( "./cache_result" );
+is( $res->return_code, 3, "Not enough parameters");
+like( $res->output, "/Could not parse arguments/", "Could not parse arguments");
+
+$res = NPTest->testCmd( "./cache_result -C 30 check_dummy 0" );
+is( $res->return_code, 3, "Require full path" );
+like( $res->output, "/Require path to command/", "Appropriate error message");
+
+$res = NPTest->testCmd( "./cache_result $PWD/check_dummy 1 'not cached'" );
+is( $res->return_code, 1, "Without -C the plugin is run as it is" );
+is( $res->output, "WARNING: not cached", "Output as expected" );
+
+$res = NPTest->testCmd( "./cache_result -C 30 $plugin first" );
+is( $res->return_code, 2, "Exit status of the plugin" );
+is( $res->output, "CRITICAL: run 1|runs=1\nfirst", "and all of its output" );
+
+$res = NPTest->testCmd( "./cache_result -C 30 $plugin first" );
+is( $res->return_code, 2, "Exit status given again" );
+is( $res->output, "CRITICAL: run 1|runs=1\nfirst", "with the output of the first run" );
+
+$res = NPTest->testCmd( "./cache_result --cache-ttl=30 '$plugin first'" );
+is( $res->output, "CRITICAL: run 1|runs=1\nfirst", "A quoted command line is the same command line" );
+
+$res = NPTest->testCmd( "./cache_result -C 30 $plugin second" );
+is( $res->output, "CRITICAL: run 2|runs=2\nsecond", "Other arguments are another result" );
+
+$res = NPTest->testCmd( "./cache_result -C 30 $plugin sec ond" );
+is( $res->output, "CRITICAL: run 3|runs=3\nsec", "and so are the same ones split otherwise" );
+
+$res = NPTest->testCmd( "./cache_result $plugin first" );
+is( $res->output, "CRITICAL: run 4|runs=4\nfirst", "Without -C, nothing is given again" );
+
+sleep 2;
+$res = NPTest->testCmd( "./cache_result -C 1 $plugin first" );
+is( $res->output, "CRITICAL: run 5|runs=5\nfirst", "A result older than -C is run again" );
+
+# identical runs starting together wait for the one that runs the plugin
+my $start = time;
+$res = NPTest->testCmd( "for i in 1 2 3 4; do ./cache_result -C 30 $plugin slow > $dir/out.\$i & done; wait; cat $dir/out.*" );
+my $took = time - $start;
+is( $res->output, join("\n", ("CRITICAL: run 6|runs=6", "slow") x 4), "Runs at the same time share one run" );
+cmp_ok( $took, "<", 4, "and do not take turns" );
+
+$res = NPTest->testCmd( "./cache_result -C 30 -t 1 $plugin slow" );
+is( $res->output, "CRITICAL: run 6|runs=6\nslow", "A stored result is given within any timeout" );
+
+$res = NPTest->testCmd( "./cache_result -C 30 -t 1 $plugin slow2" );
+is( $res->return_code, 2, "Timeout while the plugin runs" );
+like( $res->output, "/timed out/i", "Output as expected" );
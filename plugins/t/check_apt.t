@@ -23,7 +23,7 @@ sub make_result_regexp {
 }
 
 if (-x "./check_apt") {
-	plan tests => 36;
+	plan tests => 41;
 } else {
 	plan skip_all => "No check_apt compiled";
 }
@@ -104,3 +104,19 @@ $result = NPTest->testCmd( sprintf($testfile_command, "", "ubuntu2") );
 is( $result->return_code, 2, "Ubuntu apt output, some critical" );
 like( $result->output, make_result_regexp(25, 14), "Output correct" );
 
+
+# Cached counts, in a state directory of our own
+$ENV{NAGIOS_PLUGIN_STATE_DIRECTORY} = "/tmp/check_apt.$$";
+
+$result = NPTest->testCmd( sprintf($testfile_command, "-v --cache", "debian3") );
+unlike( $result->output, '/Using the result cached/', "First run with --cache runs the simulation" );
+like( $result->output, '/^APT CRITICAL: 19 packages available for upgrade \(4 critical updates\)/m', "Output correct" );
+
+$result = NPTest->testCmd( sprintf($testfile_command, "-v --cache -w 20", "debian3") );
+like( $result->output, '/Using the result cached/', "Second run uses the cached counts" );
+is( $result->return_code, 2, "Cached counts still critical" );
+
+$result = NPTest->testCmd( sprintf($testfile_command, "-v --refresh", "debian3") );
+unlike( $result->output, '/Using the result cached/', "--refresh runs the simulation again" );
+
+system("rm -rf /tmp/check_apt.$$");
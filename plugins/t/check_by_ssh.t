@@ -24,7 +24,7 @@ my $ssh_conf = getTestParameter( "NP_SSH_CONFIGFILE",
 
 plan skip_all => "SSH_HOST and SSH_IDENTITY must be defined" unless ($ssh_service && $ssh_key);
 
-plan tests => 42;
+plan tests => 49;
 
 # Some random check strings/response
 my @response = ('OK: Everything is fine',
@@ -159,3 +159,26 @@ for (0, 1, 2, 3, 4) {
 }
 unlink("/tmp/check_by_ssh.$$") or die("Unable to unlink '/tmp/check_by_ssh.$$': $!");
 
+
+## Shared connections: the first check leaves a master behind, the
+## second one runs over it
+for (my $i=0; $i<2; $i++) {
+	$result = NPTest->testCmd(
+		"./check_by_ssh -i $ssh_key -H $ssh_service --control-persist=10 -C '$check[$i]; exit $i'"
+		);
+	cmp_ok($result->return_code, '==', $i, "Exit with return code $i over a shared connection");
+	is($result->output, $response[$i], "Status text is correct for check $i over a shared connection");
+}
+
+## Several hosts at once
+unlink("/tmp/check_by_ssh.$$");
+$result = NPTest->testCmd(
+	"./check_by_ssh -i $ssh_key -H $ssh_service -n flint -H $ssh_service -n rock -s c0:c1 -C '$check[0];sh -c exit\\ 0' -C '$check[1];sh -c exit\\ 1' -O /tmp/check_by_ssh.$$"
+	);
+cmp_ok($result->return_code, '==', 0, "Exit ok when the results of all hosts were written");
+open(PASV, "/tmp/check_by_ssh.$$") or die("Unable to open '/tmp/check_by_ssh.$$': $!");
+@pasv = <PASV>;
+close(PASV) or die("Unable to close '/tmp/check_by_ssh.$$': $!");
+is(scalar(grep(/;flint;c[01];/, @pasv)), 2, 'Two passive results for the first host');
+is(scalar(grep(/;rock;c[01];/, @pasv)), 2, 'Two passive results for the second host');
+unlink("/tmp/check_by_ssh.$$") or die("Unable to unlink '/tmp/check_by_ssh.$$': $!");
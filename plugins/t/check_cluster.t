@@ -5,7 +5,7 @@
 #
 
 use strict;
-use Test::More tests => 15;
+use Test::More tests => 21;
 use NPTest;
 
 my $result;
@@ -80,3 +80,28 @@ $result = NPTest->testCmd(
 	"./check_cluster -h -w 0 -c 1 -d 0,0,1,1"
 	);
 cmp_ok( $result->return_code, '==', 2, "Exit Critical if non-ok hosts exceed critical warning (no ranges)" );
+
+# States from status.dat, with the groups of objects.cache
+my $input = "t/check_cluster_input";
+
+$result = NPTest->testCmd(
+	"./check_cluster -h -f $input/status.dat"
+	);
+like( $result->output, qr/3 up, 1 down, 1 unreachable/, "All hosts of status.dat counted" );
+
+$result = NPTest->testCmd(
+	"./check_cluster -h -f $input/status.dat -g web -w 0 -c 1"
+	);
+cmp_ok( $result->return_code, '==', 1, "Exit WARNING for one host of the group down" );
+like( $result->output, qr/2 up, 1 down, 0 unreachable/, "Only the hosts of the group counted" );
+
+$result = NPTest->testCmd(
+	"./check_cluster -s -f $input/status.dat -g http -w 0 -c 1"
+	);
+cmp_ok( $result->return_code, '==', 2, "Exit CRITICAL for two services of the group not ok" );
+like( $result->output, qr/1 ok, 1 warning, 0 unknown, 1 critical/, "Only the services of the group counted" );
+
+$result = NPTest->testCmd(
+	"./check_cluster -s -f $input/status.dat -g nosuchgroup"
+	);
+cmp_ok( $result->return_code, '==', 3, "Exit UNKNOWN for a group that is not defined" );
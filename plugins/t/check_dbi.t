@@ -15,7 +15,7 @@ use vars qw($tests);
 
 plan skip_all => "check_dbi not compiled" unless (-x "check_dbi");
 
-$tests = 20;
+$tests = 23;
 plan tests => $tests;
 
 my $missing_driver_output = "failed to open DBI driver 'sqlite3'";
@@ -26,6 +26,7 @@ my $missing_query_output = "/Must specify a query to execute/";
 my $no_rows_output       = "/WARNING - no rows returned/";
 my $not_numeric_output   = "/CRITICAL - result value is not a numeric:/";
 my $query_time_output    = "/OK - connection time: [0-9\.]+s, 'SELECT 1' returned 1.000000 in [0-9\.]+s \|/";
+my $queries_output       = "/^WARNING - connection time: [0-9.]+s, 2 of 3 queries OK - two: 'SELECT 2' returned 2.000000 in [0-9.]+s \\|.*\\n\\[OK\\] one: .*\\n\\[WARNING\\] two: /";
 my $syntax_error_output  = "/CRITICAL - failed to execute query 'GET ALL FROM test': 1: near \"GET\": syntax error/";
 
 my $result;
@@ -96,6 +97,12 @@ SKIP: {
 	cmp_ok($result->return_code, '==', 0, "QUERY_TIME metric okay");
 	like($result->output, $query_time_output, "QUERY_TIME metric output okay");
 
+	$result = NPTest->testCmd("$check_cmd -w 1 -q 'SELECT 1' -n one -q 'SELECT 2' -n two -q 'SELECT a FROM test' -n a -c 5");
+	cmp_ok($result->return_code, '==', 1, "Several queries over one connection");
+	like($result->output, $queries_output, "Several queries output okay");
+	$result = NPTest->testCmd("$check_cmd -q 'SELECT 1' -q 'SELECT 2' -e 1");
+	cmp_ok($result->return_code, '==', 3, "-e takes a single query");
+
 	$result = NPTest->testCmd("./check_dbi -d nodriver -q ''");
 	cmp_ok($result->return_code, '==', 3, "Unknown DBI driver");
 	like($result->output, $bad_driver_output, "Correct error message");
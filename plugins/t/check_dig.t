@@ -13,7 +13,7 @@ BEGIN {
     plan skip_all => "check_dig not compiled" unless (-x "check_dig");
     use NPTest;
     $has_ipv6 = NPTest::has_ipv6();
-    $tests = $has_ipv6 ? 16 : 14;
+    $tests = $has_ipv6 ? 20 : 18;
     plan tests => $tests;
 }
 
@@ -52,7 +52,7 @@ my $res;
 
 SKIP: {
         skip "check_dig.t: not enough parameters given",
-	12 unless ($hostname_valid && $hostname_valid_ip && $hostname_valid_reverse && $hostname_invalid && $dns_server);
+	$tests - 4 unless ($hostname_valid && $hostname_valid_ip && $hostname_valid_reverse && $hostname_invalid && $dns_server);
 
 	$res = NPTest->testCmd("./check_dig -H $dns_server -l $hostname_valid -t 5");
 	cmp_ok( $res->return_code, '==', 0, "Found $hostname_valid");
@@ -96,3 +96,42 @@ SKIP: {
 	    like  ( $res->output, $successOutput, "Output OK for IPv6" );
     }
 }
+
+# queries made without dig, and two servers asked at once, one a serial
+# behind the other
+{
+	use IO::Socket::INET;
+	my $sock1 = IO::Socket::INET->new( Proto => 'udp', LocalAddr => '127.0.0.1', LocalPort => 0 );
+	my $port = $sock1->sockport;
+	my $sock2 = IO::Socket::INET->new( Proto => 'udp', LocalAddr => '127.0.0.2', LocalPort => $port );
+	my @pids;
+	for my $server ([$sock1, 1, 3], [$sock2, 2, 2]) {
+		my ($sock, $serial, $queries) = @$server;
+		my $pid = fork();
+		if ($pid == 0) {
+			my $buf;
+			for (1..$queries) {
+				my $from = $sock->recv($buf, 1024) or last;
+				my $pos = 12;
+				$pos += ord(substr($buf, $pos, 1)) + 1 while ord(substr($buf, $pos, 1));
+				my $type = unpack('n', substr($buf, $pos + 1, 2));
+				my $reply = substr($buf, 0, 2) . pack('nnnnn', 0x8580, 1, 1, 0, 0) . substr($buf, 12, $pos + 5 - 12);
+				if ($type == 6) {
+					$reply .= pack('nnnNn', 0xc00c, 6, 1, 60, 24) . pack('nnNNNNN', 0xc00c, 0xc00c, $serial, 3600, 600, 86400, 60);
+				} else {
+					$reply .= pack('nnnNn', 0xc00c, 1, 1, 60, 4) . pack('C4', 192, 0, 2, 1);
+				}
+				$sock->send($reply, 0, $from);
+			}
+			exit 0;
+		}
+		push @pids, $pid;
+	}
+	$res = NPTest->testCmd("./check_dig -H 127.0.0.1 -p $port -l local.test -t 5");
+	cmp_ok( $res->return_code, '==', 0, "Found local.test on a local server");
+	like  ( $res->output, '/^DNS OK - [\.0-9]+ seconds? response time \(local.test. 60 IN A 192.0.2.1\)\|time=/', "Output OK" );
+	$res = NPTest->testCmd("./check_dig -H 127.0.0.1,127.0.0.2 -p $port -l local.test -a 192.0.2.1 -t 5");
+	cmp_ok( $res->return_code, '==', 1, "A server is a serial behind");
+	like  ( $res->output, '/^DNS WARNING - 1 of 2 servers consistent - 127.0.0.1: serial 1 behind 2 \(serial 2, fastest .*\n\[WARNING\] 127.0.0.1: .*\n\[OK\] 127.0.0.2: local.test. 60 IN A 192.0.2.1 \(serial 2, /', "Output OK" );
+	waitpid($_, 0) for @pids;
+}
@@ -10,7 +10,7 @@ use NPTest;
 
 plan skip_all => "check_dns not compiled" unless (-x "check_dns");
 
-plan tests => 19;
+plan tests => 30;
 
 my $successOutput = '/DNS OK: [\.0-9]+ seconds? response time/';
 
@@ -120,3 +120,53 @@ SKIP: {
 	cmp_ok( $res->return_code, '==', 0, "Found $hostname_valid_aaaa");
 	like  ( $res->output, $successOutput, "TXT Output OK" );
 }
+
+# the queries go to the server itself: one that knows local.test only
+{
+	use IO::Socket::INET;
+	my $sock = IO::Socket::INET->new( Proto => 'udp', LocalAddr => '127.0.0.1', LocalPort => 0 );
+	my $port = $sock->sockport;
+	my $pid = fork();
+	if ($pid == 0) {
+		my $buf;
+		for (1..4) {
+			my $from = $sock->recv($buf, 1024) or last;
+			my ($pos, @labels) = (12);
+			while (my $len = ord(substr($buf, $pos, 1))) {
+				push @labels, substr($buf, $pos + 1, $len);
+				$pos += $len + 1;
+			}
+			my $question = substr($buf, 12, $pos + 5 - 12);
+			my $found = lc(join('.', @labels)) eq 'local.test';
+			my $reply = substr($buf, 0, 2) . pack('nnnnn', $found ? 0x8580 : 0x8583, 1, $found ? 1 : 0, 0, 0) . $question;
+			$reply .= pack('nnnNn', 0xc00c, 1, 1, 60, 4) . pack('C4', 192, 0, 2, 1) if $found;
+			$sock->send($reply, 0, $from);
+		}
+		exit 0;
+	}
+	$res = NPTest->testCmd("./check_dns -H local.test -s 127.0.0.1 -p $port -a 192.0.2.1 -A -t 5");
+	cmp_ok( $res->return_code, '==', 0, "Found local.test on a local server");
+	like  ( $res->output, '/^DNS OK: .* local.test returns 192.0.2.1\|time=/', "Output OK" );
+	$res = NPTest->testCmd("./check_dns -H nosuch.test -s 127.0.0.1 -p $port -t 5");
+	cmp_ok( $res->return_code, '==', 2, "nosuch.test is not found");
+	like  ( $res->output, '/Domain nosuch.test was not found by the server/', "Output OK" );
+	$res = NPTest->testCmd("printf 'local.test A 192.0.2.1\\nnosuch.test\\n' | ./check_dns --records - -s 127.0.0.1 -p $port -t 5");
+	cmp_ok( $res->return_code, '==', 2, "One of the records is not found");
+	like  ( $res->output, '/^DNS CRITICAL: 1 of 2 records OK - nosuch.test A \@127.0.0.1: .*\n\[OK\] local.test A \@127.0.0.1: returns 192.0.2.1 /', "Batch output OK" );
+	waitpid($pid, 0);
+}
+
+# nothing listens over TCP on the port of the UDP server
+SKIP: {
+	skip "No DNS over TLS without SSL", 2 if `./check_dns --help` !~ /--tls/;
+	use IO::Socket::INET;
+	my $sock = IO::Socket::INET->new( Proto => 'udp', LocalAddr => '127.0.0.1', LocalPort => 0 );
+	my $port = $sock->sockport;
+	$res = NPTest->testCmd("./check_dns -H local.test -s 127.0.0.1 -p $port --tls -t 5");
+	cmp_ok( $res->return_code, '==', 2, "DNS over TLS to a closed port");
+	like  ( $res->output, '/Connection to DNS 127.0.0.1 was refused/', "Output OK" );
+}
+
+$res = NPTest->testCmd("./check_dns -H local.test --https=dns-query");
+cmp_ok( $res->return_code, '==', 3, "The DNS over HTTPS path is checked");
+like  ( $res->output, '/must start with a \/|not compiled in/', "Output OK" );
@@ -8,7 +8,7 @@ use strict;
 use Test::More;
 use NPTest;
 
-plan tests => 20;
+plan tests => 28;
 
 my $res;
 
@@ -52,3 +52,19 @@ $res = NPTest->testCmd("./check_dummy 4");
 is( $res->return_code, 3, "Invalid error code" );
 is( $res->output, "UNKNOWN: Status 4 is not a supported error state", "With appropriate error message");
 
+
+$res = NPTest->testCmd("./check_dummy 1 'in json' --output-format=json");
+is( $res->return_code, 1, "Same state as JSON" );
+is( $res->output, '{"plugin":"check_dummy","status":"WARNING","code":1,"message":"WARNING: in json","long_output":"","perfdata":[]}', "Output as a JSON object");
+
+$res = NPTest->testCmd("./check_dummy --output-format=yaml 0");
+is( $res->return_code, 3, "Unknown output format" );
+like( $res->output, '/^Output format must be text or json/', "...is refused");
+
+$res = NPTest->testCmd("./check_dummy 1 profiled --profile");
+is( $res->return_code, 1, "--profile keeps the status" );
+is( $res->output, 'WARNING: profiled', "...and the output" );
+
+$res = NPTest->testCmd("./check_dummy 1 profiled --profile 2>&1");
+like( $res->output, '/^profile check_dummy: wall [\d.]+s user [\d.]+s sys [\d.]+s maxrss \d+kB$/m', "Run profiled on stderr" );
+like( $res->output, '/^profile check_dummy: phase startup 1x wall /m', "...with its phases" );
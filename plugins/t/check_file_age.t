@@ -5,7 +5,7 @@
 #
 
 use strict;
-use Test::More tests => 17;
+use Test::More tests => 23;
 use NPTest;
 
 my $successOutput = '/^FILE_AGE OK: /';
@@ -17,6 +17,7 @@ my $performanceOutput = '/ \| age=[0-9]+s;[0-9]+;[0-9]+ size=[0-9]+B;[0-9]+;[0-9
 my $result;
 my $temp_file = "/tmp/check_file_age.tmp";
 my $temp_link = "/tmp/check_file_age.link.tmp";
+my $temp_dir = "/tmp/check_file_age.dir.tmp";
 
 unlink $temp_file, $temp_link;
 
@@ -89,6 +90,26 @@ $result = NPTest->testCmd("./check_file_age -f $temp_file -c 1");
 cmp_ok( $result->return_code, '==', 0, "Works for directories" );
 rmdir $temp_file;
 
+# several files and patterns in one run
+mkdir $temp_dir or die "Cannot create directory";
+foreach my $name ("a.log", "b.log", "c.dat") {
+	open F, "> $temp_dir/$name" or die "Cannot write to $temp_dir/$name";
+	print F "A" x 10;
+	close F;
+}
+utime time - 100, time - 100, "$temp_dir/b.log";
+$result = NPTest->testCmd("./check_file_age -w 50 -c 200 -f '$temp_dir/*.log' $temp_dir/c.dat");
+cmp_ok( $result->return_code, '==', 1, "Worst state of all files" );
+like  ( $result->output, '/^WARNING: 1 files are WARNING\n/', "Summary counts the warning file" );
+like  ( $result->output, "/\nFILE_AGE WARNING: $temp_dir\/b.log is [0-9]+ seconds old and 10 bytes\n/", "One line for each file" );
+like  ( $result->output, '/ \| a.log_age=[0-9]+s;50;200 a.log_size=10B;0;0;0 b.log_age=.* c.dat_size=10B;0;0;0$/', "Perfdata for each file" );
+
+$result = NPTest->testCmd("./check_file_age -c 200 -f '$temp_dir/*' -f $temp_dir/missing");
+cmp_ok( $result->return_code, '==', 2, "A missing file among several" );
+like  ( $result->output, "/^CRITICAL: 1 files are CRITICAL\n.*File not found - $temp_dir\/missing /s", "Output correct" );
+unlink glob "$temp_dir/*";
+rmdir $temp_dir;
+
 
 sub write_chars {
 	my $size = shift;
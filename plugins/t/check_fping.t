@@ -10,7 +10,7 @@ use NPTest;
 
 use vars qw($tests);
 
-BEGIN {$tests = 4; plan tests => $tests}
+BEGIN {$tests = 6; plan tests => $tests}
 
 my $successOutput = '/^FPING OK - /';
 my $failureOutput = '/^FPING CRITICAL - /';
@@ -32,6 +32,9 @@ if ( -x "./check_fping" )
   $t += checkCmd( "./check_fping $host_responsive",    0,       $successOutput );
   $t += checkCmd( "./check_fping $host_nonresponsive", [ 1, 2 ] );
   $t += checkCmd( "./check_fping $hostname_invalid",   [ 1, 2 ] );
+  # several hosts need an ICMP socket, fping only takes one
+  $t += checkCmd( "./check_fping -H $host_responsive,$host_responsive", [ 0, 3 ],
+                  '/^FPING (OK: 2 of 2 hosts OK|UNKNOWN - No ICMP socket)/' );
 }
 else
 {
@@ -0,0 +1,103 @@
+#! /usr/bin/perl -w -I ..
+#
+# check_hwmon tests, against a hwmon tree of its own
+#
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use File::Temp qw(tempdir);
+use File::Path qw(make_path);
+
+if (! -x "./check_hwmon") {
+	plan skip_all => "check_hwmon is only built on Linux";
+}
+plan tests => 26;
+
+my $dir = tempdir(CLEANUP => 1);
+
+sub chip {
+	my ($dev, %attrs) = @_;
+	make_path("$dir/$dev");
+	while (my ($name, $value) = each %attrs) {
+		open(my $fh, '>', "$dir/$dev/$name") or die "$dir/$dev/$name: $!";
+		print $fh "$value\n";
+		close($fh);
+	}
+}
+
+chip("hwmon0", name => "coretemp",
+	temp1_input => 45000, temp1_label => "Package id 0", temp1_max => 80000, temp1_crit => 100000,
+	temp2_input => 43000, temp2_label => "Core 0", temp2_crit_alarm => 0);
+chip("hwmon1", name => "nct6775",
+	fan1_input => 1200, fan1_alarm => 0, fan2_input => 0, fan2_min => 300,
+	in0_input => 1104, in0_min => 1000, in0_max => 1200, in0_alarm => 0);
+chip("hwmon10", name => "coretemp",
+	temp1_input => 47000, temp1_label => "Package id 1");
+
+my $hwmon = "./check_hwmon --hwmon-dir=$dir";
+my $res;
+
+$res = NPTest->testCmd("$hwmon");
+is( $res->return_code, 0, "All sensors OK" );
+like( $res->output, "/^SENSORS OK: 6 of 6 sensors OK\\|/", "Counts every sensor" );
+like( $res->output, "/'coretemp\\/Package id 0'=45.000000C;80;100;/", "Labels, degrees and the chip's limits in perfdata" );
+like( $res->output, "/'coretemp.1\\/Package id 1'=47.000000C;;;/", "Second chip of a name is .1, in hwmon order" );
+like( $res->output, "/nct6775\\/fan1=1200.000000RPM;;;/", "Fans in RPM" );
+like( $res->output, "/nct6775\\/in0=1.104000V;;;/", "Voltages in volts" );
+
+$res = NPTest->testCmd("$hwmon -v");
+like( $res->output, "/^\\[OK\\] coretemp\\/Core 0: 43.0 C\$/m", "A line for each sensor with -v" );
+
+$res = NPTest->testCmd("$hwmon -w 44 -c 46 -s 'coretemp*/*'");
+is( $res->return_code, 2, "Thresholds given to -s" );
+like( $res->output, "/^SENSORS CRITICAL: 1 of 3 sensors OK - coretemp\\/Package id 0: 45.0 C; coretemp.1\\/Package id 1: 47.0 C\\|/", "Only the sensors of -s, the others named" );
+like( $res->output, "/'coretemp\\/Core 0'=43.000000C;44;46;/", "The thresholds in perfdata" );
+
+$res = NPTest->testCmd("$hwmon -w 44 -s 'coretemp/*' -w 1000: -s '*/fan*' -x '*/fan2'");
+is( $res->return_code, 1, "Thresholds of each -s" );
+like( $res->output, "/^SENSORS WARNING: 2 of 3 sensors OK - coretemp\\/Package id 0: 45.0 C\\|/", "The threshold of each, and -x" );
+
+$res = NPTest->testCmd("$hwmon -s '*/temp2' -l '*/temp2=cpu0'");
+like( $res->output, "/^SENSORS OK: 1 of 1 sensors OK\\|cpu0=43.000000C;;;\$/", "Matched by attribute and renamed with -l" );
+
+$res = NPTest->testCmd("$hwmon -s '*/temp9'");
+is( $res->return_code, 3, "A -s matching nothing" );
+like( $res->output, "/no sensor matches \\*\\/temp9/", "is named" );
+
+$res = NPTest->testCmd("$hwmon -s '*/temp1' -w 10");
+is( $res->return_code, 3, "-w after the last -s" );
+
+chip("hwmon0", temp2_crit_alarm => 1);
+chip("hwmon1", in0_alarm => 1);
+$res = NPTest->testCmd("$hwmon");
+is( $res->return_code, 2, "The chip's alarms" );
+like( $res->output, "/coretemp\\/Core 0: 43.0 C \\(alarm\\); nct6775\\/in0: 1.104 V \\(alarm\\)/", "name the sensors" );
+chip("hwmon0", temp2_crit_alarm => 0);
+chip("hwmon1", in0_alarm => 0);
+
+chip("hwmon10", temp1_input => 85000, temp1_max => 80000);
+$res = NPTest->testCmd("$hwmon");
+is( $res->return_code, 1, "The chip's max without alarm flags" );
+chip("hwmon10", temp1_input => 47000);
+
+chip("hwmon1", fan1_fault => 1);
+$res = NPTest->testCmd("$hwmon");
+is( $res->return_code, 3, "A faulty sensor" );
+like( $res->output, "/nct6775\\/fan1: fault/", "is named" );
+$res = NPTest->testCmd("$hwmon -i");
+is( $res->return_code, 0, "and left out with -i" );
+like( $res->output, "/^SENSORS OK: 5 of 5 sensors OK/", "not counted" );
+unlink("$dir/hwmon1/fan1_fault");
+
+# the attributes in device/ with older kernels
+chip("hwmon2/device", name => "it87", temp3_input => 30000);
+$res = NPTest->testCmd("$hwmon -s 'it87/*'");
+like( $res->output, "/^SENSORS OK: 1 of 1 sensors OK\\|it87\\/temp3=30.000000C;;;\$/", "Attributes of the device directory" );
+
+$res = NPTest->testCmd("./check_hwmon --hwmon-dir=$dir/none");
+is( $res->return_code, 3, "No hwmon directory" );
+
+$res = NPTest->testCmd("./check_hwmon --hwmon-dir=$dir/hwmon2/device");
+like( $res->output, "/No sensors found/", "No sensors" );
@@ -0,0 +1,142 @@
+#! /usr/bin/perl -w -I ..
+#
+# check_lmstat checks, against an lmstat that prints what a license
+# server would say
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use File::Temp qw(tempdir);
+
+if (-x "./check_lmstat") {
+	plan tests => 29;
+} else {
+	plan skip_all => "No check_lmstat compiled";
+}
+
+my $res;
+
+my $dir = tempdir(CLEANUP => 1);
+$ENV{NAGIOS_PLUGIN_STATE_DIRECTORY} = "$dir/state";
+delete $ENV{LM_LICENSE_FILE};
+
+# lmstat -a -c FILE, counting its runs; FILE says how the servers are
+my $lmstat = "$dir/lmstat";
+open(my $fh, ">", $lmstat) or die "Cannot write $lmstat: $!";
+print $fh <<"EOF";
+#!/bin/sh
+n=\$((\$(cat $dir/runs 2>/dev/null || echo 0) + 1))
+echo \$n > $dir/runs
+echo "lmstat - Copyright (c) 1989-2019 Flexera. All Rights Reserved."
+echo "Flexible License Manager status on Thu 8/1/2019 10:15"
+echo
+if [ "\$3" = "dead" ]; then
+	echo "Error getting status: Cannot connect to license server system. (-15,570:115 \\"Operation now in progress\\")"
+	exit 1
+fi
+echo "License server status: 27000\@lic1,27000\@lic2,27000\@lic3"
+echo "    License file(s) on lic1: /opt/flexlm/license.dat:"
+echo
+echo "      lic1: license server UP (MASTER) v11.16.2"
+if [ "\$3" = "down" ]; then
+	echo "      lic2: license server DOWN"
+else
+	echo "      lic2: license server UP v11.16.2"
+fi
+echo "      lic3: license server UP v11.16.2"
+echo
+echo "Vendor daemon status (on lic1):"
+echo
+echo "     MLM: UP v11.16.2"
+echo
+echo "Feature usage info:"
+echo
+echo "Users of MATLAB:  (Total of 10 licenses issued;  Total of 3 licenses in use)"
+echo
+echo "  \\"MATLAB\\" v41, vendor: MLM, expiry: 31-dec-2029"
+echo "  floating license"
+echo
+echo "    alice ws1 /dev/tty (v41) (lic1/27000 101), start Thu 8/1 9:00"
+echo "    bob ws2 /dev/tty (v41) (lic1/27000 102), start Thu 8/1 9:05"
+echo "    carol ws3 /dev/tty (v41) (lic1/27000 103), start Thu 8/1 9:10"
+echo
+echo "Users of Simulink:  (Total of 5 licenses issued;  Total of 5 licenses in use)"
+echo "Users of SOLVER:  (Total of 20 licenses issued;  Total of 6 licenses in use)"
+echo "Users of Viewer:  (Uncounted, node-locked)"
+echo "Users of Legacy:  (Error: 1 licenses, unsupported by licensed server)"
+echo "Users of Single:  (Total of 1 license issued;  Total of 0 licenses in use)"
+EOF
+close($fh);
+chmod 0755, $lmstat;
+
+sub runs {
+	open(my $fh, "<", "$dir/runs") or return 0;
+	my $n = <$fh>;
+	chomp $n;
+	return $n;
+}
+
+my $cmd = "./check_lmstat -L $lmstat -F 27000\@lic1 -C 0";
+
+$res = NPTest->testCmd( "./check_lmstat -L $lmstat" );
+is( $res->return_code, 3, "No license file");
+like( $res->output, "/Missing license.dat file/", "Appropriate error message");
+
+$res = NPTest->testCmd( "./check_lmstat -L $dir/nothere -F 27000\@lic1" );
+is( $res->return_code, 3, "No lmstat");
+
+$res = NPTest->testCmd( "$cmd" );
+is( $res->return_code, 0, "All license servers up");
+is( $res->output, "FLEXLM OK - License servers running: lic1, lic2, lic3|up=3;;;0;3 down=0;;;0;3", "Output as expected" );
+
+$res = NPTest->testCmd( "./check_lmstat -L $lmstat -F down -C 0" );
+is( $res->return_code, 1, "One of three license servers down");
+is( $res->output, "FLEXLM WARNING - License servers running: lic1, lic3; License servers NOT running: lic2|up=2;;;0;3 down=1;;;0;3", "Output as expected" );
+
+$res = NPTest->testCmd( "./check_lmstat -L $lmstat -F dead -C 0 -f MATLAB" );
+is( $res->return_code, 2, "No license server answers");
+like( $res->output, "/^FLEXLM CRITICAL - Error getting status: Cannot connect to license server system/", "with what lmstat said" );
+
+$res = NPTest->testCmd( "$cmd -f MATLAB -w 8 -c 9" );
+is( $res->return_code, 0, "Feature within its thresholds");
+is( $res->output, "FLEXLM OK - MATLAB: 3 of 10 licenses in use|MATLAB=3;8;9;0;10", "Output as expected" );
+
+$res = NPTest->testCmd( "$cmd -f MATLAB -w 20%" );
+is( $res->return_code, 1, "Percent of the licenses issued");
+is( $res->output, "FLEXLM WARNING - MATLAB: 3 of 10 licenses in use|MATLAB=3;2;;0;10", "Output as expected" );
+
+$res = NPTest->testCmd( "$cmd -f Single -c 0" );
+is( $res->return_code, 0, "One license issued");
+is( $res->output, "FLEXLM OK - Single: 0 of 1 licenses in use|Single=0;;0;0;1", "Output as expected" );
+
+$res = NPTest->testCmd( "$cmd -f Viewer -c 1" );
+is( $res->return_code, 0, "Uncounted feature");
+
+$res = NPTest->testCmd( "$cmd -f Legacy" );
+is( $res->return_code, 2, "Feature in error");
+is( $res->output, "FLEXLM CRITICAL - Legacy: Error: 1 licenses, unsupported by licensed server|", "Output as expected" );
+
+$res = NPTest->testCmd( "$cmd -w 90% -c 99% -f MATLAB,Simulink -c 4 -f SOLVER -f NOPE" );
+is( $res->return_code, 2, "Each feature with its own thresholds");
+is( $res->output, "FLEXLM CRITICAL: 1 of 4 features OK - Simulink: 5 of 5 licenses in use; SOLVER: 6 of 20 licenses in use; NOPE: not served|MATLAB=3;9;9;0;10 Simulink=5;4;4;0;5 SOLVER=6;18;4;0;20\n[OK] MATLAB: 3 of 10 licenses in use\n[CRITICAL] Simulink: 5 of 5 licenses in use\n[CRITICAL] SOLVER: 6 of 20 licenses in use\n[CRITICAL] NOPE: not served", "Output as expected" );
+
+$res = NPTest->testCmd( "$cmd -f MATLAB -f SOLVER -w 5" );
+is( $res->return_code, 1, "Thresholds after the last feature are for all of them");
+
+$res = NPTest->testCmd( "./check_lmstat -L $lmstat -F down -C 0 -f MATLAB" );
+is( $res->return_code, 1, "A license server down counts against the features");
+like( $res->output, "/^FLEXLM WARNING: 1 of 1 features OK - License servers NOT running: lic2\\|MATLAB=3;;;0;10/", "Output as expected" );
+
+# the checks of one license file share a run of lmstat
+unlink "$dir/runs";
+$res = NPTest->testCmd( "./check_lmstat -L $lmstat -F 27000\@lic1 -C 30 -f MATLAB" );
+is( $res->return_code, 0, "First check runs lmstat");
+is( runs(), 1, "once" );
+$res = NPTest->testCmd( "./check_lmstat -L $lmstat -F 27000\@lic1 -C 30 -f Simulink -c 4" );
+is( $res->return_code, 2, "Another feature from the cached table");
+is( runs(), 1, "without running lmstat again" );
+$res = NPTest->testCmd( "./check_lmstat -L $lmstat -F 27000\@lic1 -C 0 -f MATLAB" );
+is( runs(), 2, "-C 0 runs it every time" );
+$res = NPTest->testCmd( "./check_lmstat -L $lmstat -F 27000\@lic2 -C 30 -f MATLAB" );
+is( runs(), 3, "Another license file has a table of its own" );
@@ -14,7 +14,7 @@ my $loadValue = "[0-9]+\.?[0-9]+";
 my $successOutput = "/^OK - load average: $loadValue, $loadValue, $loadValue/";
 my $failureOutput = "/^CRITICAL - load average: $loadValue, $loadValue, $loadValue/";
 
-plan tests => 11;
+plan tests => 13;
 
 $res = NPTest->testCmd( "./check_load -w 100,100,100 -c 100,100,100" );
 cmp_ok( $res->return_code, 'eq', 0, "load not over 100");
@@ -34,3 +34,7 @@ like( $res->output, $successOutput, "Output OK");
 like( $res->perf_output, "/load1=$loadValue;100.000;100.000/", "Test handling of non triplet thresholds (load1)");
 like( $res->perf_output, "/load5=$loadValue;100.000;110.000/", "Test handling of non triplet thresholds (load5)");
 like( $res->perf_output, "/load15=$loadValue;100.000;110.000/", "Test handling of non triplet thresholds (load15)");
+
+$res = NPTest->testCmd( "./check_load -w 100 -c 100 -n 3" );
+cmp_ok( $res->return_code, 'eq', 0, "load with the top processes");
+like( $res->output, '/\nSTAT +UID +PID .*%CPU COMMAND\n(\S+ +\d+ +\d+ .*\n?){1,3}$/s', "top processes shown");
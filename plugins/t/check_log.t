@@ -0,0 +1,72 @@
+#! /usr/bin/perl -w -I ..
+#
+# check_log tests
+#
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use File::Temp qw(tempdir);
+
+plan tests => 17;
+
+my $res;
+my $dir = tempdir( CLEANUP => 1 );
+my $log = "$dir/messages";
+my $state = "$dir/messages.offset";
+my $cmd = "./check_log -F $log -O $state -q 'LOGIN FAILURE'";
+
+sub append {
+	open(LOG, ">>", $log) or die "Cannot write $log: $!";
+	print LOG @_;
+	close LOG;
+}
+
+$res = NPTest->testCmd( $cmd );
+is( $res->return_code, 3, "No log file" );
+like( $res->output, "/^Log check error: Log file .* does not exist!/", "Output correct" );
+
+append( "Jan  1 00:00:00 host login: LOGIN FAILURE on tty1\n" );
+$res = NPTest->testCmd( $cmd );
+is( $res->return_code, 0, "First run" );
+is( $res->output, "Log check data initialized...", "Output correct" );
+
+$res = NPTest->testCmd( $cmd );
+is( $res->return_code, 0, "Nothing new" );
+is( $res->output, "Log check ok - 0 pattern matches found|match=0;;;0", "Output correct" );
+
+append( "Jan  1 00:01:00 host sshd: Accepted publickey\n",
+        "Jan  1 00:02:00 host login: LOGIN FAILURE on tty2\n",
+        "Jan  1 00:03:00 host login: LOGIN FAILURE on tty3\n",
+        "Jan  1 00:04:00 host login: LOGIN FAILURE on tty4 and still writ" );
+$res = NPTest->testCmd( $cmd );
+is( $res->return_code, 2, "New matches" );
+is( $res->output, "(2) Jan  1 00:03:00 host login: LOGIN FAILURE on tty3|match=2;;;0", "Only complete lines matched" );
+
+append( "ing\n" );
+$res = NPTest->testCmd( "$cmd -w 1" );
+is( $res->return_code, 1, "Warning up to -w matches" );
+is( $res->output, "(1) Jan  1 00:04:00 host login: LOGIN FAILURE on tty4 and still writing|match=1;;;0", "The line finished since" );
+
+# rotated: a new file under the same name
+rename $log, "$log.1";
+append( "Jan  1 00:05:00 host login: login failure on tty5\n" );
+$res = NPTest->testCmd( $cmd );
+is( $res->return_code, 0, "Rotated log read from its start" );
+is( $res->output, "Log check ok - 0 pattern matches found|match=0;;;0", "Output correct" );
+append( "Jan  1 00:06:00 host login: login failure on tty6\n" );
+$res = NPTest->testCmd( "$cmd -i" );
+is( $res->return_code, 2, "Matched without regard to case" );
+like( $res->output, "/^\\(1\\) .* on tty6\\|/", "Output correct" );
+
+# truncated
+open(LOG, ">", $log) or die "Cannot write $log: $!";
+print LOG "Jan  1 00:07:00 host login: LOGIN FAILURE on tty7\n";
+close LOG;
+$res = NPTest->testCmd( $cmd );
+is( $res->return_code, 2, "Truncated log read from its start" );
+like( $res->output, "/^\\(1\\) .* on tty7\\|/", "Output correct" );
+
+$res = NPTest->testCmd( "./check_log -F $log -O $state -q '('" );
+is( $res->return_code, 3, "Invalid expression" );
@@ -0,0 +1,68 @@
+#! /usr/bin/perl -w -I ..
+#
+# check_mrtg and check_mrtgtraf batches, against logs written here
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use File::Temp qw(tempdir);
+
+plan tests => 12;
+
+my $res;
+
+my $dir = tempdir(CLEANUP => 1);
+
+# the time and counters of the last run, then the sample to check
+sub mrtg_log {
+	my ($name, $in, $out) = @_;
+	my $now = time;
+	open(my $fh, ">", "$dir/$name.log") or die "Cannot write $dir/$name.log: $!";
+	print $fh "$now 123456 654321\n$now $in $out $in $out\n";
+	close($fh);
+}
+
+mrtg_log("ok_1", 10, 20);
+mrtg_log("ok_2", 30, 40);
+mrtg_log("busy", 500, 600);
+
+open(my $fh, ">", "$dir/batch") or die "Cannot write $dir/batch: $!";
+print $fh "$dir/ok_1.log\n$dir/ok_2.log\n$dir/missing.log\n";
+close($fh);
+
+open($fh, ">", "$dir/batch_critical") or die "Cannot write $dir/batch_critical: $!";
+print $fh "$dir/ok_1.log\n$dir/busy.log\n$dir/missing.log\n";
+close($fh);
+
+SKIP: {
+	skip "No check_mrtg compiled", 6 unless -x "./check_mrtg";
+
+	$res = NPTest->testCmd( "./check_mrtg -B $dir/batch -v 1 -w 100 -c 200" );
+	is( $res->return_code, 3, "A missing log is not hidden by the OK ones" );
+	like( $res->output, "/^MRTG UNKNOWN: 3 logs, 0 critical, 0 warning, 1 unknown \\[missing\\]/", "Output as expected" );
+	like( $res->output, "/missing: Unable to open MRTG log file/", "with a line for it" );
+
+	$res = NPTest->testCmd( "./check_mrtg -B $dir/batch_critical -v 1 -w 100 -c 200" );
+	is( $res->return_code, 2, "A critical log is worse than a missing one" );
+	like( $res->output, "/^MRTG CRITICAL: 3 logs, 1 critical, 0 warning, 1 unknown \\[busy, missing\\]/", "Output as expected" );
+
+	$res = NPTest->testCmd( "./check_mrtg -B $dir/nothere -v 1 -w 100 -c 200" );
+	is( $res->return_code, 3, "No batch file" );
+}
+
+SKIP: {
+	skip "No check_mrtgtraf compiled", 6 unless -x "./check_mrtgtraf";
+
+	$res = NPTest->testCmd( "./check_mrtgtraf -B $dir/batch -w 100,100 -c 200,200" );
+	is( $res->return_code, 3, "A missing log is not hidden by the OK ones" );
+	like( $res->output, "/^Traffic UNKNOWN: 3 logs, 0 critical, 0 warning, 1 unknown \\[missing\\]/", "Output as expected" );
+	like( $res->output, "/missing: Unable to open MRTG log file/", "with a line for it" );
+
+	$res = NPTest->testCmd( "./check_mrtgtraf -B $dir/batch_critical -w 100,100 -c 200,200" );
+	is( $res->return_code, 2, "A critical log is worse than a missing one" );
+	like( $res->output, "/^Traffic CRITICAL: 3 logs, 1 critical, 0 warning, 1 unknown \\[busy, missing\\]/", "Output as expected" );
+
+	$res = NPTest->testCmd( "./check_mrtgtraf -B $dir/nothere -w 100,100 -c 200,200" );
+	is( $res->return_code, 3, "No batch file" );
+}
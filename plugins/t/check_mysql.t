@@ -18,7 +18,7 @@ use vars qw($tests);
 
 plan skip_all => "check_mysql not compiled" unless (-x "check_mysql");
 
-plan tests => 15;
+plan tests => 17;
 
 my $bad_login_output = '/Access denied for user /';
 my $mysqlserver = getTestParameter(
@@ -77,7 +77,7 @@ SKIP: {
 }
 
 SKIP: {
-	skip "No mysql server with slaves defined", 5 unless $with_slave;
+	skip "No mysql server with slaves defined", 7 unless $with_slave;
 	$result = NPTest->testCmd("./check_mysql -H $with_slave $with_slave_login");
 	cmp_ok( $result->return_code, '==', 0, "Login okay");
 
@@ -90,4 +90,8 @@ SKIP: {
 	$result = NPTest->testCmd("./check_mysql -S -H $with_slave $with_slave_login -w 60:");
 	cmp_ok( $result->return_code, '==', 1, 'Alert warning if < 60 seconds behind');
 	like( $result->output, "/^SLOW_SLAVE WARNING:/", "Output okay");
+
+	$result = NPTest->testCmd("./check_mysql -m -H $with_slave $with_slave_login -w 60");
+	cmp_ok( $result->return_code, '==', 0, "Every channel okay" );
+	like( $result->output, "/^SLAVE OK: (\\d+) of \\1 channels OK\\|.*\\n\\[OK\\] /", "Output is per channel");
 }
@@ -31,7 +31,7 @@ my $result;
 if (! $mysqlserver) {
 	plan skip_all => "No mysql server defined";
 } else {
-	plan tests => 13;
+	plan tests => 17;
 }
 
 $result = NPTest->testCmd("./check_mysql_query -q 'SELECT 1+1' -H $mysqlserver $mysql_login_details");
@@ -63,3 +63,10 @@ $result = NPTest->testCmd("./check_mysql_query -q 'SHOW VARIABLES' -H $mysqlserv
 cmp_ok( $result->return_code, '==', 2, "Data not numeric");
 like( $result->output, "/Is not a numeric/", "Data not numeric error message");
 
+$result = NPTest->testCmd("./check_mysql_query -w 5 -q 'SELECT 1+1' -n two -q 'SELECT PI()*2' -n tau -c 4 -H $mysqlserver $mysql_login_details");
+cmp_ok( $result->return_code, '==', 2, "Several queries, one critical");
+like( $result->output, "/^QUERY CRITICAL: 1 of 2 queries OK - tau: .*\n\[OK\] two: 'SELECT 1\+1' returned 2.000000 \(/", "Summary and a line for each query");
+
+$result = NPTest->testCmd("./check_mysql_query -M -q 'SELECT 1' -n a -q 'SELECT * FROM adsf' -n b -q 'SELECT 3' -n c -H $mysqlserver $mysql_login_details");
+cmp_ok( $result->return_code, '==', 2, "Multi-statement with a bad query");
+like( $result->output, "/\[CRITICAL\] c: Not run after an earlier error/", "Statements after the bad one not run");
@@ -11,7 +11,7 @@ use NPTest;
 if (`uname -s` eq "SunOS\n") {
         plan skip_all => "Ignoring tests on solaris because of pst3";
 } else {
-        plan tests => 13;
+        plan tests => 21;
 }
 
 my $successOutput = '/^NAGIOS OK: /';
@@ -89,4 +89,45 @@ $result = NPTest->testCmd(
 	);
 cmp_ok( $result->return_code, "==", 2, "Invalid log file" );
 
-
+# -m takes the modification time, whatever the contents say
+system( "cp $nagios1 $nagios1.tmp" ) == 0 or die "Problem with copying $nagios1";
+$result = NPTest->testCmd(
+	"./check_nagios -F $nagios1.tmp -e 1 -C $procname -m"
+	);
+cmp_ok( $result->return_code, "==", 0, "Log up to date by its modification time" );
+$later = time - 121;
+utime $later, $later, "$nagios1.tmp";
+$result = NPTest->testCmd(
+	"./check_nagios -F $nagios1.tmp -e 1 -C $procname -m"
+	);
+cmp_ok( $result->return_code, "==", 1, "Log over 1 minute old by its modification time" );
+
+# -L: the pid of the lock file, the age of the log from stat() alone
+SKIP: {
+	skip "No /proc to read the process of the lock file from", 6 unless -d "/proc/self";
+
+	use File::Temp qw(tempdir);
+	my $dir = tempdir(CLEANUP => 1);
+	local $ENV{NAGIOS_PLUGIN_STATE_DIRECTORY} = "$dir/state";
+	my $pid = open(my $daemon, "-|", "sleep 60") or die "Cannot run sleep: $!";
+	open(my $lock, ">", "$dir/nagios.lock") or die "Cannot write $dir/nagios.lock: $!";
+	print $lock "$pid\n";
+	close $lock;
+	system( "cp $nagios1 $nagios1.tmp" ) == 0 or die "Problem with copying $nagios1";
+
+	$result = NPTest->testCmd( "./check_nagios -F $nagios1.tmp -e 1 -L $dir/nagios.lock -C sleep" );
+	cmp_ok( $result->return_code, "==", 0, "Running by the pid of the lock file" );
+	like( $result->output, "/^NAGIOS OK: pid $pid, status log updated \\d+ seconds? ago, [\\d.]+% CPU\\|age=\\d+s;60;;0 cpu=/", "Output with age and CPU" );
+
+	$result = NPTest->testCmd( "./check_nagios -F $nagios1.tmp -e 1 -L $dir/nagios.lock -C nagios-not-this" );
+	cmp_ok( $result->return_code, "==", 2, "The pid is not of the -C process" );
+
+	$result = NPTest->testCmd( "./check_nagios -F $nagios1 -e 1 -L $dir/nagios.lock" );
+	cmp_ok( $result->return_code, "==", 1, "Log over 1 minute old by its modification time" );
+
+	kill "TERM", $pid;
+	close $daemon;
+	$result = NPTest->testCmd( "./check_nagios -F $nagios1.tmp -e 1 -L $dir/nagios.lock" );
+	cmp_ok( $result->return_code, "==", 2, "Not running once the pid is gone" );
+	like( $result->output, "/^NAGIOS CRITICAL: Nagios is not running, pid $pid/", "Output for that correct" );
+}
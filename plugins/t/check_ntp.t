@@ -11,7 +11,7 @@ use NPTest;
 my @PLUGINS1 = ('check_ntp', 'check_ntp_peer', 'check_ntp_time');
 my @PLUGINS2 = ('check_ntp_peer');
 
-plan tests => (12 * scalar(@PLUGINS1)) + (6 * scalar(@PLUGINS2));
+plan tests => (12 * scalar(@PLUGINS1)) + (6 * scalar(@PLUGINS2)) + 8;
 
 my $res;
 
@@ -108,3 +108,84 @@ foreach my $plugin (@PLUGINS2) {
 		like( $res->output, $ntp_critmatch2, "$plugin: Output match CRITICAL with jitter, stratum, and truechimers" );
 	}
 }
+
+# three local servers asked at once, one of them five seconds off
+{
+	use IO::Socket::INET;
+	use Time::HiRes qw(time);
+	my $sock = IO::Socket::INET->new( Proto => 'udp', LocalAddr => '127.0.0.1', LocalPort => 0 );
+	my $port = $sock->sockport;
+	my @pids;
+	for my $server ([$sock, 0], ['127.0.0.2', 0], ['127.0.0.3', 5]) {
+		my ($s, $off) = @$server;
+		$s = IO::Socket::INET->new( Proto => 'udp', LocalAddr => $s, LocalPort => $port ) unless ref $s;
+		my $pid = fork();
+		if ($pid == 0) {
+			my $buf;
+			for (1..4) {
+				my $from = $s->recv($buf, 1024) or last;
+				my $t = time() + $off + 2208988800;
+				my $ts = pack('NN', int($t), ($t - int($t)) * 4294967296);
+				$s->send(pack('CCCC', 0x24, 1, 4, 0xfa) . pack('NN', 0x100, 0x100) . 'LOCL' .
+				         $ts . substr($buf, 40, 8) . $ts . $ts, 0, $from);
+			}
+			exit 0;
+		}
+		push @pids, $pid;
+	}
+	$res = NPTest->testCmd("./check_ntp_time -H 127.0.0.1,127.0.0.2,127.0.0.3 -p $port -w 10 -c 20 -t 5");
+	cmp_ok( $res->return_code, '==', 1, "check_ntp_time: A falseticker among three servers" );
+	like( $res->output, '/^NTP WARNING: Offset \S+ secs, stratum best:1 worst:1, 2 of 3 servers OK - 127.0.0.3: Offset [45]\.\d+ secs, .*\(falseticker\)\|.*\n\[OK\] 127.0.0.1: /', "check_ntp_time: Output match falseticker" );
+	waitpid($_, 0) for @pids;
+}
+
+# two local servers asked at once, the second of them silent
+{
+	my $sock = IO::Socket::INET->new( Proto => 'udp', LocalAddr => '127.0.0.1', LocalPort => 0 );
+	my $port = $sock->sockport;
+	my $silent = IO::Socket::INET->new( Proto => 'udp', LocalAddr => '127.0.0.2', LocalPort => $port );
+	my $pid = fork();
+	if ($pid == 0) {
+		my $buf;
+		for (1..8) {
+			my $from = $sock->recv($buf, 1024) or last;
+			my $t = time() + 2208988800;
+			my $ts = pack('NN', int($t), ($t - int($t)) * 4294967296);
+			$sock->send(pack('CCCC', 0x24, 2, 4, 0xfa) . pack('NN', 0x100, 0x100) . 'LOCL' .
+			            $ts . substr($buf, 40, 8) . $ts . $ts, 0, $from);
+		}
+		exit 0;
+	}
+	$res = NPTest->testCmd("./check_ntp_time -H 127.0.0.1 -H 127.0.0.2 -p $port -w 10 -c 20 -t 4");
+	cmp_ok( $res->return_code, '==', 2, "check_ntp_time: A silent server is a timeout" );
+	like( $res->output, '/^NTP CRITICAL: Offset \S+ secs, stratum best:2 worst:2, 1 of 2 servers OK - 127.0.0.2: No response from NTP server\|.* stratum_best=2 stratum_worst=2 .*\n\[OK\] 127.0.0.1: .*\n\[CRITICAL\] 127.0.0.2: No response from NTP server$/', "check_ntp_time: Output match silent server" );
+	$res = NPTest->testCmd("./check_ntp_time -H 127.0.0.1 -H 127.0.0.2 -p $port -w 10 -c 20 -t 4:UNKNOWN");
+	cmp_ok( $res->return_code, '==', 3, "check_ntp_time: A silent server takes the timeout state" );
+	like( $res->output, '/^NTP UNKNOWN: .*\n\[OK\] 127.0.0.1: .*\n\[UNKNOWN\] 127.0.0.2: No response from NTP server$/', "check_ntp_time: Output match silent server with -t 4:UNKNOWN" );
+	kill 'TERM', $pid;
+	waitpid($pid, 0);
+}
+
+# a local server with three candidate peers, their variables asked at once
+{
+	my $sock = IO::Socket::INET->new( Proto => 'udp', LocalAddr => '127.0.0.1', LocalPort => 0 );
+	my $port = $sock->sockport;
+	my $pid = fork();
+	if ($pid == 0) {
+		my $buf;
+		for (1..4) {
+			my $from = $sock->recv($buf, 1024) or last;
+			my ($flags, $op, $seq, $status, $assoc) = unpack('CCnnn', $buf);
+			my $data = ($op & 0x1f) == 1 ? pack('n*', map { (100 + $_, 0x9400) } 0..2)
+			         : sprintf('stratum=2, offset=%d.000, jitter=1.500', 10 * ($assoc - 99));
+			my $count = length($data);
+			$data .= "\0" x ((4 - $count % 4) % 4);
+			$sock->send(pack('CCnnnnn', 0x16, 0x80 | ($op & 0x1f), $seq, 0x0618, $assoc, 0, $count) . $data, 0, $from);
+		}
+		exit 0;
+	}
+	$res = NPTest->testCmd("./check_ntp_peer -H 127.0.0.1 -p $port -j 1:10 -t 5");
+	cmp_ok( $res->return_code, '==', 1, "check_ntp_peer: Three candidates and no sync source" );
+	like( $res->output, '/^NTP WARNING: Server not synchronized, Offset 0.01 secs \(WARNING\), jitter=1.500000\|/', "check_ntp_peer: Output match with the best candidate" );
+	waitpid($pid, 0);
+}
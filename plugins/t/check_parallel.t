@@ -0,0 +1,68 @@
+#! /usr/bin/perl -w -I ..
+#
+# check_parallel tests
+# Need check_dummy to work for testing
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use File::Temp qw(tempfile);
+
+plan tests => 21;
+
+my $PWD = $ENV{PWD};
+my $res;
+
+$res = NPTest->testCmd( "./check_parallel" );
+is( $res->return_code, 3, "Not enough parameters" );
+
+$res = NPTest->testCmd( "./check_parallel -x 'command[ ok ] = $PWD/check_dummy 0 fine' -x 'command[ warn ] = $PWD/check_dummy 1 \"so so\"'" );
+is( $res->return_code, 1, "The worst of the states" );
+like( $res->output, "/^PARALLEL WARNING: 1 of 2 checks OK - warn: WARNING: so so\$/m", "the problems named" );
+like( $res->output, "/^\\[OK\\] ok: OK: fine\$/m", "and a line for each" );
+
+my ($fh, $spec) = tempfile(UNLINK => 1);
+print $fh <<"EOF";
+# checks run at once
+command[ one ] = /bin/sh -c "sleep 2; echo 'OK - one|rtt=1.5ms;2;3;0 '\\''a b'\\''=4'"
+command[ two ]   =   /bin/sh -c "sleep 2; echo 'OK - two'; echo 'more text'; echo '|second=2s'"
+
+command[ three ] = /bin/sleep 2
+EOF
+close($fh);
+
+my $start = time;
+$res = NPTest->testCmd( "./check_parallel -f $spec" );
+my $took = time - $start;
+is( $res->return_code, 0, "From a file" );
+cmp_ok( $took, "<", 4, "All at once, not one after another" );
+like( $res->output, "/^PARALLEL OK: 3 of 3 checks OK\\|one::rtt=1.5ms;2;3;0 'one::a b'=4 two::second=2s\$/m", "Perfdata of each, named" );
+like( $res->output, "/^\\[OK\\] two: OK - two\\n    more text\$/m", "with the long output" );
+like( $res->output, "/^\\[OK\\] three: \\(No output on stdout\\)\$/m", "A check with no output" );
+
+$res = NPTest->testCmd( "./check_parallel --concurrency=1 -t 3 -x 'command[ a ] = /bin/sleep 2' -x 'command[ b ] = /bin/sleep 2' -x 'command[ c ] = /bin/sleep 1'" );
+is( $res->return_code, 3, "One at a time, out of time" );
+like( $res->output, "/^\\[UNKNOWN\\] b: Timed out after 1 seconds\$/m", "the time left is what the next gets" );
+like( $res->output, "/^\\[UNKNOWN\\] c: Not run, the 3 seconds are over\$/m", "and the rest are not started" );
+
+$res = NPTest->testCmd( "./check_parallel -T 1 -x 'command[ slow ] = /bin/sleep 5' -x 'command[ quick ] = $PWD/check_dummy 0 quick'" );
+is( $res->return_code, 3, "-T for each" );
+like( $res->output, "/^PARALLEL UNKNOWN: 1 of 2 checks OK - slow: Timed out after 1 seconds/", "Output" );
+
+$res = NPTest->testCmd( "./check_parallel -t 10 -x 'command[ t ] = $PWD/check_dummy 0 \$TIMEOUT\$'" );
+like( $res->output, "/^\\[OK\\] t: OK: 9\$/m", "\$TIMEOUT\$ is the time left, less one" );
+
+$res = NPTest->testCmd( "./check_parallel -x 'command[ code ] = /bin/sh -c \"echo text; exit 7\"'" );
+is( $res->return_code, 3, "An exit code out of bounds" );
+like( $res->output, "/Return code of 7 is out of bounds: text/", "Output" );
+
+$res = NPTest->testCmd( "./check_parallel -x 'command[ x ] = /bin/true' -x 'command[ x ] = /bin/true'" );
+is( $res->return_code, 3, "A name given twice" );
+
+$res = NPTest->testCmd( "./check_parallel -x 'command x = /bin/true'" );
+is( $res->return_code, 3, "Not a command line" );
+
+$res = NPTest->testCmd( "./check_parallel -x 'command[ crit ] = $PWD/check_dummy 2 down' -x 'command[ unknown ] = $PWD/check_dummy 3 what'" );
+is( $res->return_code, 2, "CRITICAL over UNKNOWN" );
+like( $res->output, "/^PARALLEL CRITICAL: 0 of 2 checks OK - crit: CRITICAL: down; unknown: UNKNOWN: what\$/m", "Output" );
@@ -61,7 +61,8 @@ like( $res->output, $failureOutput, "Output OK" );
 # check_ping results will depend on whether the ping command discovered by 
 # ./configure has a timeout option. If it does, then the timeout will
 # be set, so check_ping will always get a response. If it doesn't
-# then check_ping will timeout. We do 2 tests for check_ping's timeout
+# then check_ping will timeout. Pinging with ICMP sockets of its own,
+# check_ping stops waiting in time as well. We do 2 tests for check_ping's timeout
 #  - 1 second
 #  - 15 seconds 
 # The latter should be higher than normal ping timeouts, so should always give a packet loss result
@@ -70,6 +71,8 @@ open(F, "../config.h") or die "Cannot open ../config.h";
 my $has_timeout;
 $has_timeout = 1 if (scalar @_ == 2);	# Need both defined
 close F;
+$res = NPTest->testCmd( "./check_ping -H $host_responsive -w 10,100% -c 10,100% -p 1 -vv" );
+$has_timeout = 1 if ($res->output =~ /^ICMP: /m && $res->output !~ /No ICMP socket/);
 $res = NPTest->testCmd(
 	"./check_ping -H $host_nonresponsive -w 10,100% -c 10,100% -p 1 -t 1"
 	);
@@ -7,13 +7,14 @@
 use strict;
 use Test::More;
 use NPTest;
+use File::Temp qw(tempdir);
 
 my $t;
 
 if (`uname -s` eq "SunOS\n" && ! -x "/usr/local/nagios/libexec/pst3") {
 	plan skip_all => "Ignoring tests on solaris because of pst3";
 } else {
-	plan tests => 14;
+	plan tests => 22;
 }
 
 my $result;
@@ -47,3 +48,25 @@ $result = NPTest->testCmd( "./check_procs -w 0 -c 100000 -p 1" );
 is( $result->return_code, 1, "Checking warning for processes by parentid = 1" );
 like( $result->output, '/^PROCS WARNING: [0-9]+ process(es)? with PPID = 1/', "Output correct" );
 
+SKIP: {
+	skip "CPU samples need /proc", 2 unless `uname -s` eq "Linux\n";
+	$result = NPTest->testCmd( "./check_procs --cpu-sample=200 --metric=CPU -w 100000 -c 200000" );
+	is( $result->return_code, 0, "Checking CPU over a sample of 200ms" );
+	like( $result->output, '/^CPU OK: [0-9]+ process(es)? \| procs=[0-9]+;;;0; .* procpcpu=[0-9.]+;$/', "Output correct" );
+}
+
+$result = NPTest->testCmd( "./check_procs --group-by=cgroup -w 100000 -c 200000" );
+is( $result->return_code, 0, "Checking the processes of each cgroup" );
+like( $result->output, '/^PROCS OK: [0-9]+ cgroups? with [0-9]+ process(es)? \| procs=[0-9]+;;;0; cgroups=[0-9]+;;;0; \'procs:\//', "Output correct" );
+
+SKIP: {
+	skip "The snapshot needs /proc", 4 unless `uname -s` eq "Linux\n";
+	$ENV{NAGIOS_PLUGIN_STATE_DIRECTORY} = tempdir(CLEANUP => 1);
+	$result = NPTest->testCmd( "./check_procs --snapshot=60 -w 100000 -c 100000 -p 1" );
+	is( $result->return_code, 0, "Checking processes from a snapshot taken for it" );
+	like( $result->output, '/^PROCS OK: [0-9]+ process(es)? with PPID = 1/', "Output correct" );
+	$result = NPTest->testCmd( "./check_load --snapshot=60 -w 100000 -c 100000 && ./check_procs --snapshot=60 -vv -w 100000 -c 100000 -s S" );
+	like( $result->output, '/^CMD: .*\/snapshot \([0-9]+ seconds old\)$/m', "Which the next checks share" );
+	like( $result->output, '/^PROCS OK: [0-9]+ process(es)? with STATE = S/m', "Output correct" );
+	delete $ENV{NAGIOS_PLUGIN_STATE_DIRECTORY};
+}
@@ -0,0 +1,61 @@
+#! /usr/bin/perl -w -I ..
+#
+# Real Time Streaming Protocol (RTSP) tests via check_real, against a
+# local server
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use IO::Socket::INET;
+
+plan tests => 9;
+
+my $res;
+
+# answers OPTIONS, and DESCRIBE with an SDP body for /live/* and 404 for
+# anything else, in the order asked; one connection at a time
+my $server = IO::Socket::INET->new( LocalAddr => '127.0.0.1', LocalPort => 0, Listen => 5, ReuseAddr => 1 );
+my $port = $server->sockport;
+my $pid = fork();
+if ($pid == 0) {
+	while (my $c = $server->accept) {
+		my $data = '';
+		while (sysread($c, my $chunk, 4096)) {
+			$data .= $chunk;
+			while ($data =~ s/^(\w+) (\S+) RTSP\/1\.0\r\nCSeq: (\d+)\r\n\r\n//) {
+				my ($method, $url, $cseq) = ($1, $2, $3);
+				if ($method eq 'OPTIONS') {
+					print $c "RTSP/1.0 200 OK\r\nCSeq: $cseq\r\n\r\n";
+				} elsif ($url =~ m{/live/}) {
+					my $sdp = "v=0\r\ns=$url\r\n";
+					print $c "RTSP/1.0 200 OK\r\nCSeq: $cseq\r\nContent-Length: " . length($sdp) . "\r\n\r\n$sdp";
+				} else {
+					print $c "RTSP/1.0 404 Not Found\r\nCSeq: $cseq\r\n\r\n";
+				}
+			}
+		}
+		close $c;
+	}
+	exit 0;
+}
+
+$res = NPTest->testCmd( "./check_real -H 127.0.0.1 -p $port -u /live/one" );
+is( $res->return_code, 0, "One stream" );
+like( $res->output, '/^REAL OK - \d+ second response time/', "as before" );
+
+$res = NPTest->testCmd( "./check_real -H 127.0.0.1 -p $port -u /live/one -u /live/two" );
+is( $res->return_code, 0, "Two streams on one connection" );
+like( $res->output, '/^REAL OK: 3 of 3 streams OK\|127.0.0.1_time=[\d.]+s;;;0\.000000 127.0.0.1\/live\/one_time=[\d.]+s;;;0\.000000 127.0.0.1\/live\/two_time=/', "with response time perfdata for each" );
+like( $res->output, "/^\\[OK\\] rtsp:\\/\\/127.0.0.1:$port\\/live\\/two: [\\d.]+ second response time\$/m", "and a line for each" );
+
+$res = NPTest->testCmd( "./check_real -H 127.0.0.1 -p $port -u /live/one -u /gone" );
+is( $res->return_code, 1, "A stream that is not found is a warning" );
+like( $res->output, "/^REAL WARNING: 2 of 3 streams OK - rtsp:\\/\\/127.0.0.1:$port\\/gone: RTSP\\/1.0 404 Not Found\\|/", "Output as expected" );
+
+$res = NPTest->testCmd( "./check_real -H 127.0.0.1 -p $port --hosts=127.0.0.1 -u /live/one" );
+is( $res->return_code, 0, "Two servers at once" );
+like( $res->output, '/^REAL OK: 4 of 4 streams OK/', "Output as expected" );
+
+kill 'TERM', $pid;
+waitpid($pid, 0);
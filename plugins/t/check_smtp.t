@@ -22,7 +22,7 @@ my $hostname_invalid   = getTestParameter( "NP_HOSTNAME_INVALID",
                                            "An invalid (not known to DNS) hostname", "nosuchhost" );
 my $res;
 
-plan tests => 10;
+plan tests => 12;
 
 SKIP: {
 	skip "No SMTP server defined", 4 unless $host_tcp_smtp;
@@ -64,3 +64,34 @@ is ($res->return_code, 2, "CRITICAL - host non responding" );
 $res = NPTest->testCmd( "./check_smtp $hostname_invalid" );
 is ($res->return_code, 3, "UNKNOWN - hostname invalid" );
 
+
+# a local server that offers PIPELINING and logs what arrives in one read
+{
+	use IO::Socket::INET;
+	my $server = IO::Socket::INET->new( LocalAddr => '127.0.0.1', LocalPort => 0, Listen => 5, ReuseAddr => 1 );
+	my $port = $server->sockport;
+	my $pid = fork();
+	if ($pid == 0) {
+		while (my $c = $server->accept) {
+			print $c "220 test ESMTP\r\n";
+			my ($data, $reads) = ('', 0);
+			while (sysread($c, my $chunk, 4096)) {
+				$data .= $chunk;
+				$reads++;
+				print $c "250-test\r\n250-PIPELINING\r\n250 OK\r\n" if $chunk =~ /^EHLO/;
+				if ($chunk =~ /QUIT/) {
+					my $n = () = $chunk =~ /\n/g;
+					print $c "250 ok\r\n" x ($n - 1), "221 reads=$reads\r\n";
+					last;
+				}
+			}
+			close $c;
+		}
+		exit 0;
+	}
+	$res = NPTest->testCmd( "./check_smtp -H 127.0.0.1 -p $port --pipelining -f a\@b -C 'RCPT TO:<c\@d>' -R '^250' -v" );
+	is ($res->return_code, 0, "OK, pipelined" );
+	like ($res->output, '/221 reads=2/', "MAIL FROM, RCPT TO and QUIT sent together" );
+	kill 'TERM', $pid;
+	waitpid($pid, 0);
+}
@@ -23,7 +23,7 @@ my $hostname_invalid   = getTestParameter("NP_HOSTNAME_INVALID",
 
 
 plan skip_all => "SSH_HOST must be defined" unless $ssh_host;
-plan tests    => 6;
+plan tests    => 8;
 
 
 my $result = NPTest->testCmd(
@@ -47,3 +47,9 @@ $result = NPTest->testCmd(
 cmp_ok($result->return_code, '==', 3, "Exit with return code 0 (OK)");
 like($result->output, '/^check_ssh: Invalid hostname/', "Status text if command returned none (OK)");
 
+
+$result = NPTest->testCmd(
+    "./check_ssh --hosts $ssh_host,$host_nonresponsive -t 2"
+    );
+cmp_ok($result->return_code, '==', 2, "Exit with return code 2 (CRITICAL) when one of the hosts does not answer");
+like($result->output, '/^SSH CRITICAL: 1 of 2 hosts OK - .*\n\[OK\] \S+: .*\n\[CRITICAL\] \S+: /', "One line per host");
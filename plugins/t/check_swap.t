@@ -5,7 +5,7 @@
 #
 
 use strict;
-use Test::More tests => 8;
+use Test::More tests => 12;
 use NPTest;
 
 my $successOutput = '/^SWAP OK - [0-9]+\% free \([0-9]+ MB out of [0-9]+ MB\)/';
@@ -29,3 +29,19 @@ like( $result->output, $failureOutput, "Right output" );
 $result = NPTest->testCmd( "./check_swap -w 100% -c 1%" );			# 100% (always warn)
 cmp_ok( $result->return_code, "==", 1, 'Get warning because not 100% free' );
 like( $result->output, $warnOutput, "Right output" );
+
+SKIP: {
+	skip "memory pressure needs /proc/pressure/memory", 2 unless -r "/proc/pressure/memory";
+	$result = NPTest->testCmd( "./check_swap -w 1% -c 1% -n ok --pressure-critical=\@0:100" );	# always critical
+	cmp_ok( $result->return_code, "==", 2, "Get critical on memory pressure" );
+	like( $result->output, '/\[memory pressure [0-9.]+%\]\|.* pressure_some_avg60=[0-9.]+%;;\@0:100;/', "Right output" );
+}
+
+SKIP: {
+	skip "swap rates need /proc/vmstat", 2 unless -r "/proc/vmstat";
+	NPTest->testCmd( "./check_swap -w 1% -c 1% -n ok --swapin-critical=\@0:" );
+	sleep 1;
+	$result = NPTest->testCmd( "./check_swap -w 1% -c 1% -n ok --swapin-critical=\@0:" );	# always critical
+	cmp_ok( $result->return_code, "==", 2, "Get critical on swap-in rate from the last run" );
+	like( $result->output, '/\[swap-in [0-9.]+\/s, swap-out [0-9.]+\/s\]\|.* swap_in=[0-9.]+;;\@0:;/', "Right output" );
+}
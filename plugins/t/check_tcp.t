@@ -11,7 +11,7 @@ use vars qw($tests $has_ipv6);
 BEGIN {
     use NPTest;
     $has_ipv6 = NPTest::has_ipv6();
-    $tests = $has_ipv6 ? 14 : 11;
+    $tests = $has_ipv6 ? 20 : 17;
 }
 
 
@@ -34,7 +34,7 @@ my $failedExpect = '/^TCP WARNING\s-\sUnexpected response from host/socket on po
 
 my $t;
 
-$tests = $tests - 4 if $internet_access eq "no";
+$tests = $tests - 5 if $internet_access eq "no";
 plan tests => $tests;
 
 $t += checkCmd( "./check_tcp $host_tcp_http      -p 80 -wt 300 -ct 600",       0, $successOutput );
@@ -46,12 +46,56 @@ if($internet_access ne "no") {
     $t += checkCmd( "./check_tcp -S -D 9000,1    -H www.verisign.com -p 443",      1 );
     $t += checkCmd( "./check_tcp -S -D 9000      -H www.verisign.com -p 443",      1 );
     $t += checkCmd( "./check_tcp -S -D 9000,8999 -H www.verisign.com -p 443",      2 );
+    # certificates only, of endpoints listed one a line
+    $t += checkCmd( "printf 'www.verisign.com:443\\nwww.verisign.com:443:verisign.com\\n' | ./check_tcp --endpoints - -D 9000,1", 1,
+                    '/^TCP WARNING: 0 of 2 endpoints OK.*www.verisign.com:443_days=[0-9.]+;9000:;1:; /' );
 }
 
 # Need the \r\n to make it more standards compliant with web servers. Need the various quotes
 # so that perl doesn't interpret the \r\n and is passed onto command line correctly
 $t += checkCmd( "./check_tcp $host_tcp_http      -p 80 -E -s ".'"GET / HTTP/1.1\r\n\r\n"'." -e 'ThisShouldntMatch' -j", 1, $failedExpect );
 
+# every port of every host, concurrently
+$t += checkCmd( "./check_tcp --hosts $host_tcp_http,$hostname_invalid --ports 80,81 -to 1", 2,
+                '/^TCP CRITICAL: 1 of [24] endpoints OK - .*\n\[OK\] \S+ port 80: /' );
+
+# names kept in the state directory for the runs that follow
+{
+    my $statedir = "/tmp/check_tcp.state.$$";
+    local $ENV{NAGIOS_PLUGIN_STATE_DIRECTORY} = $statedir;
+    local $ENV{NAGIOS_PLUGIN_DNS_CACHE_TTL} = 60;
+    `./check_tcp -H localhost -p 81 -to 1`;
+    my @names = glob("$statedir/*/dns_cache/*");
+    ok( scalar @names, 1, "Name cached in the state directory" );
+    $t++ if @names == 1;
+    system( "rm", "-rf", $statedir );
+}
+
+# a send/expect script over one connection, to a server answering like redis
+{
+    use IO::Socket::INET;
+    my $server = IO::Socket::INET->new( LocalAddr => '127.0.0.1', LocalPort => 0, Listen => 5, ReuseAddr => 1 );
+    my $port = $server->sockport;
+    my $pid = fork();
+    if ($pid == 0) {
+        while (my $c = $server->accept) {
+            while (my $line = <$c>) {
+                $line =~ s/\r?\n$//;
+                print $c $line eq "PING" ? "+PONG\r\n" : $line eq "INFO" ? "# Replication\r\nrole:master\r\n" : "-ERR\r\n";
+            }
+            close $c;
+        }
+        exit 0;
+    }
+    my $script = "--script-send PING --script-expect +PONG --script-send INFO --script-expect role:";
+    $t += checkCmd( "./check_tcp -H 127.0.0.1 -p $port $script"."master --script-pipeline", 0,
+                    '/^TCP OK - .*step1_time=\S+ step2_time=/' );
+    $t += checkCmd( "./check_tcp -H 127.0.0.1 -p $port $script"."slave -M crit", 2,
+                    '/^TCP CRITICAL - Unexpected response to step 2 \[role:slave\]: # Replication/' );
+    kill 'TERM', $pid;
+    waitpid($pid, 0);
+}
+
 # IPv6 checks
 if($has_ipv6) {
   $t += checkCmd( "./check_tcp $host_tcp_http      -p 80 -wt 300 -ct 600 -6 ",   0, $successOutput );
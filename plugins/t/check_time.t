@@ -9,7 +9,7 @@ use Test;
 use NPTest;
 
 use vars qw($tests);
-BEGIN {$tests = 8; plan tests => $tests}
+BEGIN {$tests = 12; plan tests => $tests}
 
 my $host_udp_time      = getTestParameter( "host_udp_time",      "NP_HOST_UDP_TIME",      "localhost",
 					   "A host providing the UDP Time Service" );
@@ -37,5 +37,36 @@ $t += checkCmd( "./check_time    $host_udp_time -wt 59 -ct 59 -cd 999999 -wd 999
 $t += checkCmd( "./check_time -H $host_nonresponsive -t 1", 2 );
 $t += checkCmd( "./check_time -H $hostname_invalid   -t 1", 3 );
 
+# several hosts at once, from a local time server on TCP and UDP
+{
+	use IO::Socket::INET;
+	use IO::Select;
+	my $tcp = IO::Socket::INET->new( LocalAddr => '127.0.0.1', LocalPort => 0, Listen => 5, ReuseAddr => 1 );
+	my $port = $tcp->sockport;
+	my $udp = IO::Socket::INET->new( LocalAddr => '127.0.0.1', LocalPort => $port, Proto => 'udp' );
+	my $pid = fork();
+	if ($pid == 0) {
+		my $sel = IO::Select->new($tcp, $udp);
+		while (my @ready = $sel->can_read) {
+			for my $s (@ready) {
+				my $now = pack("N", time + 2208988800);
+				if ($s == $tcp) {
+					my $c = $tcp->accept;
+					print $c $now;
+					close $c;
+				} else {
+					my $from = $udp->recv(my $buf, 512);
+					$udp->send($now, 0, $from);
+				}
+			}
+		}
+		exit 0;
+	}
+	$t += checkCmd( "./check_time -H 127.0.0.1,127.0.0.1 -p $port -w 999999,59 -c 999999,59", 0, '/^TIME OK: 2 of 2 hosts OK\|127.0.0.1_time=/' );
+	$t += checkCmd( "./check_time -H 127.0.0.1 -H 127.0.0.1 -p $port -u -w 999999,59 -c 999999,59", 0, '/\n\[OK\] 127.0.0.1: \d+ second time difference/' );
+	kill 'TERM', $pid;
+	waitpid($pid, 0);
+}
+
 exit(0) if defined($Test::Harness::VERSION);
 exit($tests - $t);
@@ -12,7 +12,7 @@ my $res;
 
 alarm(120); # make sure tests don't hang
 
-plan tests => 14;
+plan tests => 20;
 
 $res = NPTest->testCmd( "./check_udp -H localhost -p 3333" );
 cmp_ok( $res->return_code, '==', 3, "Need send/expect string");
@@ -67,5 +67,51 @@ SKIP: {
 	cmp_ok( $read_nc, 'eq', "foofoo", "Data received correctly" );
 }
 
+# several endpoints from one socket; this listener ignores the first datagram
+{
+	use IO::Socket::INET;
+	my $sock = IO::Socket::INET->new( Proto => 'udp', LocalAddr => '127.0.0.1', LocalPort => 0 );
+	my $port = $sock->sockport;
+	my $pid = fork();
+	if ($pid == 0) {
+		my ($buf, $n) = ('', 0);
+		while (my $from = $sock->recv($buf, 1024)) {
+			$sock->send("barbar", 0, $from) if $n++;
+		}
+		exit 0;
+	}
+	$res = NPTest->testCmd( "./check_udp --hosts 127.0.0.1 --ports $port,1 -s foo -e barbar -t 2 --retries 1" );
+	cmp_ok( $res->return_code, '==', 2, "One of two endpoints answers" );
+	like  ( $res->output, "/^UDP CRITICAL: 1 of 2 endpoints OK.*\\n\\[OK\\] 127.0.0.1 port $port: .*\\n\\[CRITICAL\\] 127.0.0.1 port 1: No data received/s", "Answer after a retry" );
+	kill 'TERM', $pid;
+	waitpid($pid, 0);
+}
+
+# with a round-trip time kept, a datagram late for it is sent again;
+# this listener answers every other one
+{
+	use File::Temp qw(tempdir);
+	local $ENV{NAGIOS_PLUGIN_STATE_DIRECTORY} = tempdir(CLEANUP => 1);
+	my $sock = IO::Socket::INET->new( Proto => 'udp', LocalAddr => '127.0.0.1', LocalPort => 0 );
+	my $port = $sock->sockport;
+	my $pid = fork();
+	if ($pid == 0) {
+		my ($buf, $n) = ('', 0);
+		while (my $from = $sock->recv($buf, 1024)) {
+			$sock->send("barbar", 0, $from) if $n++ % 2;
+		}
+		exit 0;
+	}
+	$res = NPTest->testCmd( "./check_udp -H 127.0.0.1 -p $port -s foo -e barbar -t 3 --adaptive-timeout" );
+	cmp_ok( $res->return_code, '==', 2, "Nothing to go by at first: the datagram is lost" );
+	$res = NPTest->testCmd( "./check_udp -H 127.0.0.1 -p $port -s foo -e barbar -t 3 --adaptive-timeout" );
+	cmp_ok( $res->return_code, '==', 0, "Answered, which gives a round-trip time" );
+	my $start = time;
+	$res = NPTest->testCmd( "./check_udp -H 127.0.0.1 -p $port -s foo -e barbar -t 3 --adaptive-timeout -v" );
+	cmp_ok( $res->return_code, '==', 0, "The lost datagram is sent again" );
+	cmp_ok( time - $start, '<', 2, "long before the timeout" );
+	kill 'TERM', $pid;
+	waitpid($pid, 0);
+}
 
 alarm(0); # disable alarm
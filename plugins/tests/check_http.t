@@ -16,9 +16,13 @@ use strict;
 use Test::More;
 use NPTest;
 use FindBin qw($Bin);
+use IO::Compress::Gzip qw(gzip);
+use File::Temp qw(tempdir);
+use IO::Socket;
+use IO::Select;
 
-my $common_tests = 72;
-my $ssl_only_tests = 8;
+my $common_tests = 94;
+my $ssl_only_tests = 14;
 # Check that all dependent modules are available
 eval {
 	require HTTP::Daemon;
@@ -50,6 +54,7 @@ $HTTP::Daemon::VERSION = "1.00";
 my $port_http = 50000 + int(rand(1000));
 my $port_https = $port_http + 1;
 my $port_https_expired = $port_http + 2;
+my $port_proxy = $port_http + 3;
 
 # This array keeps sockets around for implementing timeouts
 my @persist;
@@ -94,6 +99,14 @@ if ($pid) {
 				run_server( $d );
 				exit;
 			}
+			# Fork a CONNECT proxy in front of the https server
+			$pid = fork();
+			if ($pid) {
+				push @pids, $pid;
+			} else {
+				run_proxy();
+				exit;
+			}
 		} else {
 			my $d = HTTP::Daemon::SSL->new(
 				LocalPort => $port_https,
@@ -139,6 +152,21 @@ sub run_server {
 				$c->send_crlf;
 				sleep 1;
 				$c->send_response("slow");
+			} elsif ($r->method eq "GET" and $r->url->path eq "/gzip") {
+				my $body = "compressed " x 100 . "foobarbaz";
+				my $gzipped;
+				if (($r->header('Accept-Encoding') || "") =~ /gzip/) {
+					gzip \$body => \$gzipped;
+					$c->send_response(HTTP::Response->new(200, 'OK', ['Content-Encoding' => 'gzip'], $gzipped));
+				} else {
+					$c->send_response(HTTP::Response->new(200, 'OK', undef, $body));
+				}
+			} elsif ($r->method eq "GET" and $r->url->path eq "/etag") {
+				if (($r->header('If-None-Match') || "") eq '"v1"') {
+					$c->send_response(HTTP::Response->new(304, 'Not Modified', ['ETag' => '"v1"']));
+				} else {
+					$c->send_response(HTTP::Response->new(200, 'OK', ['ETag' => '"v1"'], "tagged foobarbaz"));
+				}
 			} elsif ($r->method eq "GET" and $r->url->path eq "/chunked") {
 				$c->send_response(HTTP::Response->new(200, 'OK', undef, \&chunked_resp));
 			} elsif ($r->url->path eq "/method") {
@@ -180,6 +208,40 @@ sub run_server {
 	}
 }
 
+# Tunnel every CONNECT with the credentials user:pass to the https server,
+# whatever port it asks for; without them the answer is 407
+sub run_proxy {
+	my $l = IO::Socket::INET->new(
+		LocalPort => $port_proxy,
+		LocalAddr => "127.0.0.1",
+		ReuseAddr => 1,
+		Listen => 5,
+	) || die;
+	while (my $c = $l->accept) {
+		my $req = "";
+		while ($req !~ /\r\n\r\n/) {
+			last unless sysread($c, $req, 4096, length $req);
+		}
+		if ($req !~ /^Proxy-Authorization: Basic dXNlcjpwYXNz\r$/m) {
+			syswrite($c, "HTTP/1.1 407 Proxy Authentication Required\r\nContent-Length: 0\r\n\r\n");
+			close $c;
+			next;
+		}
+		my $s = IO::Socket::INET->new(PeerAddr => "127.0.0.1", PeerPort => $port_https) || die;
+		syswrite($c, "HTTP/1.1 200 Connection established\r\n\r\n");
+		my $sel = IO::Select->new($c, $s);
+		PIPE: while (my @ready = $sel->can_read) {
+			foreach my $from (@ready) {
+				my $buf;
+				last PIPE unless sysread($from, $buf, 16384);
+				syswrite($from == $c ? $s : $c, $buf);
+			}
+		}
+		close $s;
+		close $c;
+	}
+}
+
 END {
 	foreach my $pid (@pids) {
 		if ($pid) { print "Killing $pid\n"; kill "INT", $pid }
@@ -219,6 +281,18 @@ SKIP: {
 		'CRITICAL - Certificate \'Ton Voon\' expired on Thu Mar  5 00:13:16 2009.',
 		"output ok" );
 
+	# the https server closes after every reply, so each URL takes a tunnel
+	my $tunnel = "./check_http -I 127.0.0.1 -p $port_proxy -H 127.0.0.1 -S -j CONNECT";
+	$result = NPTest->testCmd( "$tunnel -u /file/root" );
+	is( $result->return_code, 2, "$tunnel without -b" );
+	like( $result->output, '/^HTTP CRITICAL - Proxy CONNECT to 127\.0\.0\.1:443 failed - HTTP\/1\.1 407 /', "output ok" );
+	$result = NPTest->testCmd( "$tunnel -b user:pass -E -u /file/root -s Root" );
+	is( $result->return_code, 0, "$tunnel -b user:pass" );
+	like( $result->output, '/^HTTP OK: HTTP\/1\.1 200 OK - 274 bytes in .* time_proxy=[\d\.]+s;;;/', "output ok" );
+	$result = NPTest->testCmd( "$tunnel -b user:pass -E --multi-url /file/root --multi-url /statuscode/200" );
+	is( $result->return_code, 0, "$tunnel -b user:pass --multi-url" );
+	like( $result->output, '/^HTTP OK: 2 of 2 URLs OK\|.* time_proxy=[\d\.]+s;;; tunnels=2;;;0$/m', "output ok" );
+
 }
 
 sub run_common_tests {
@@ -351,6 +425,24 @@ sub run_common_tests {
 	is( $result->return_code, 0, $cmd);
 	like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - \d+ bytes in [\d\.]+ second/', "Output correct: ".$result->output );
 
+	# a body larger than any buffer, sent from the file's mapping
+	my $postfile = "/tmp/check_http_post.$$";
+	open(my $fh, '>', $postfile) or die "$postfile: $!";
+	print $fh "start" . ("x" x 1000000) . "finish";
+	close($fh);
+	$cmd = "$command --post-file=$postfile -u /postdata -s POST:startxxx";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 0, $cmd);
+	$cmd = "$command -j PUT --post-file=$postfile -u /postdata -s xxxfinish";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 0, $cmd);
+	like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - 100\d{4} bytes in [\d\.]+ second/', "All of the file sent: ".$result->output );
+	unlink($postfile);
+
+	$cmd = "$command --post-file=/nonexistent/file -u /postdata";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 3, $cmd);
+
 	$cmd = "$command -u /redirect";
 	$result = NPTest->testCmd( $cmd );
 	is( $result->return_code, 0, $cmd);
@@ -386,6 +478,58 @@ sub run_common_tests {
   is( $result->return_code, 0, $cmd);
   like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - \d+ bytes in [\d\.]+ second/', "Output correct: ".$result->output );
 
+  $cmd = "$command -u /chunked -s foobarbaz --stop-on-match";
+  $result = NPTest->testCmd( $cmd );
+  is( $result->return_code, 0, $cmd);
+
+  $cmd = "$command -u /chunked -s foobarbaz --max-body 4";
+  $result = NPTest->testCmd( $cmd );
+  is( $result->return_code, 2, $cmd);
+
+  $cmd = "$command -u /gzip --compressed -s foobarbaz";
+  $result = NPTest->testCmd( $cmd );
+  is( $result->return_code, 0, $cmd);
+  like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - \d+ bytes in [\d\.]+ second .* size_decoded=1\d{3}B;;;0/', "Output correct: ".$result->output );
+
+  $cmd = "$command --multi-url /gzip --url-string foobarbaz -k 'Accept-Encoding: gzip'";
+  $result = NPTest->testCmd( $cmd );
+  is( $result->return_code, 0, $cmd);
+
+  # the second run is answered 304, with the verdict of the first
+  $ENV{NAGIOS_PLUGIN_STATE_DIRECTORY} = tempdir(CLEANUP => 1);
+  $cmd = "$command -u /etag --conditional -s foobarbaz";
+  $result = NPTest->testCmd( $cmd );
+  like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - /', "Output correct: ".$result->output );
+  $result = NPTest->testCmd( $cmd );
+  is( $result->return_code, 0, $cmd);
+  like( $result->output, '/^HTTP OK: HTTP/1.1 304 Not Modified, unchanged - /', "Output correct: ".$result->output );
+  $result = NPTest->testCmd( "$command -u /etag --conditional -s nothere" );
+  is( $result->return_code, 2, "A new command line is a new record");
+
+  # the server closes after every reply, so each URL needs a new connection
+  $cmd = "$command --multi-url /statuscode/200 --multi-url /chunked --url-string foobarbaz";
+  $result = NPTest->testCmd( $cmd );
+  is( $result->return_code, 0, $cmd);
+  like( $result->output, '/^HTTP OK: 2 of 2 URLs OK\|url1_time=[\d\.]+s;;;0\.000000 url1_size=\d+B;;;0 url2_time=/', "Output correct: ".$result->output );
+
+  $cmd = "$command --multi-url /statuscode/200 --multi-url /statuscode/500 --multi-url /chunked --url-string nope";
+  $result = NPTest->testCmd( $cmd );
+  is( $result->return_code, 2, $cmd);
+  like( $result->output, '/^HTTP CRITICAL: 1 of 3 URLs OK - /statuscode/500: HTTP/1.1 500 Internal Server Error - \d+ bytes in [\d\.]+ second response time; /chunked: HTTP/1.1 200 OK, string \'nope\' not found/', "Output correct: ".$result->output );
+
+  $cmd = "$command --hosts 127.0.0.1,127.0.0.1 -u /chunked -s foobarbaz";
+  $result = NPTest->testCmd( $cmd );
+  is( $result->return_code, 0, $cmd);
+  like( $result->output, '/^HTTP OK: 2 of 2 hosts OK\|\'?127\.0\.0\.1_time\'?=[\d\.]+s;;;0\.000000 /', "Output correct: ".$result->output );
+
+  # one backend down of two is within --cluster-critical 1
+  $cmd = "$command --connect-to ::127.0.0.1,127.0.0.1:1 -u /chunked -s foobarbaz --cluster-critical 1";
+  $result = NPTest->testCmd( $cmd );
+  is( $result->return_code, 0, $cmd);
+  like( $result->output, '/^HTTP OK: 1 of 2 hosts OK - 127\.0\.0\.1:1: .* hosts_down=1;;1;0;2/', "Output correct: ".$result->output );
+  $result = NPTest->testCmd( "$command --connect-to ::127.0.0.1,127.0.0.1:1 -u /chunked --cluster-critical 0" );
+  is( $result->return_code, 2, "but not within --cluster-critical 0");
+
   # These tests may block
 	print "ALRM\n";
 
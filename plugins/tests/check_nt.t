@@ -35,17 +35,19 @@ if ($pid) {
 	$server->autoflush(1);
 
 	print "Please contact me at port $port\n";
+	# the connection is kept open for the next request, as check_nt
+	# tries to reuse it
 	while (my $client = $server->accept ) {
 		my $data = "";
-		my $rv = $client->recv($data, POSIX::BUFSIZ, 0);
-
-		my ($password, $command, $arg) = split('&', $data);
-		
-		if ($command eq "4") {
-			if ($arg eq "c") {
-				print $client "930000000&1000000000";
-			} elsif ($arg eq "d") {
-				print $client "UNKNOWN: Drive is not a fixed drive";
+		while (defined $client->recv($data, POSIX::BUFSIZ, 0) && length $data) {
+			my ($password, $command, $arg) = split('&', $data);
+
+			if ($command eq "4") {
+				if ($arg eq "c") {
+					print $client "930000000&1000000000";
+				} elsif ($arg eq "d") {
+					print $client "UNKNOWN: Drive is not a fixed drive";
+				}
 			}
 		}
 	}
@@ -59,7 +61,7 @@ if ($ARGV[0] && $ARGV[0] eq "-d") {
 }
 
 if (-x "./check_nt") {
-	plan tests => 5;
+	plan tests => 7;
 } else {
 	plan skip_all => "No check_nt compiled";
 }
@@ -75,6 +77,12 @@ $result = NPTest->testCmd( "$command -v USEDDISKSPACE -l d" );
 is( $result->return_code, 3, "USEDDISKSPACE d - invalid");
 is( $result->output, "Free disk space : Invalid drive", "Output right" );
 
+$result = NPTest->testCmd( "$command -v USEDDISKSPACE -l c -v USEDDISKSPACE -l d" );
+is( $result->return_code, 3, "USEDDISKSPACE c and d at once");
+is( $result->output, q{NSClient UNKNOWN: 1 of 2 variables OK - USEDDISKSPACE d: Free disk space : Invalid drive|'c:\ Used Space'=0.07Gb;0.00;0.00;0.00;0.93
+[OK] USEDDISKSPACE c: c:\ - total: 0.93 Gb - used: 0.07 Gb (7%) - free 0.87 Gb (93%)
+[UNKNOWN] USEDDISKSPACE d: Free disk space : Invalid drive}, "Output right" );
+
 $result = NPTest->testCmd( "./check_nt -v USEDDISKSPACE -l d" );
 is( $result->return_code, 3, "Fail if -H missing");
 
@@ -8,7 +8,7 @@ use Test::More;
 use NPTest;
 
 if (-x "./check_procs") {
-	plan tests => 50;
+	plan tests => 56;
 } else {
 	plan skip_all => "No check_procs compiled";
 }
@@ -125,3 +125,21 @@ $result = NPTest->testCmd( "$command --ereg-argument-array='(nosuchname|nosuch2n
 is( $result->return_code, 0, "Checking no pipe symbol in output" );
 is( $result->output, "PROCS OK: 0 processes with regex args '(nosuchname,nosuch2name)' | procs=0;;;0;", "Output correct" );
 
+
+$result = NPTest->testCmd( "$command --rule='all:-w 5' --rule='mail:-C Mail -c 1:1' --rule='zombies:-s Z'" );
+is( $result->return_code, 2, "Checking several rules in one scan" );
+is( $result->output, "PROCS CRITICAL: 3 rules, 1 critical, 1 warning [all, mail]
+all: PROCS WARNING: 95 processes
+mail: PROCS CRITICAL: 2 processes with command name 'Mail'
+zombies: PROCS OK: 1 process with STATE = Z
+| all_procs=95;5;;0; mail_procs=2;;1:1;0; zombies_procs=1;;;0;", "Output correct" );
+
+$result = NPTest->testCmd( "$command --rule-output=passive --passive-host=mac --rule='all:-w 5' --rule='mail:-C Mail -c 1:1'" );
+is( $result->return_code, 2, "Checking rules as passive results" );
+like( $result->output, "/^\\[\\d+\\] PROCESS_SERVICE_CHECK_RESULT;mac;all;1;PROCS WARNING: 95 processes\\|procs=95;5;;0;
+\\[\\d+\\] PROCESS_SERVICE_CHECK_RESULT;mac;mail;2;PROCS CRITICAL: 2 processes with command name 'Mail'\\|procs=2;;1:1;0;
+PROCS CRITICAL: 2 rules, 1 critical, 1 warning \\[all, mail\\]\$/", "Output correct" );
+
+$result = NPTest->testCmd( "$command -C Mail --rule='all:-w 5'" );
+is( $result->return_code, 3, "Checking filters outside the rules" );
+like( $result->output, "/Filters, metric and thresholds go in the rules/", "Output correct" );
@@ -0,0 +1,131 @@
+#! /usr/bin/perl -w -I ..
+#
+# Test check_rpc against a stub portmapper and RPC server
+#
+
+use strict;
+use Test::More;
+use NPTest;
+
+use IO::Socket;
+use IO::Select;
+use POSIX;
+
+my $port = 50000 + int(rand(1000));	# the portmapper, and the programs over TCP
+my $uport = $port + 1;			# the programs over UDP
+my $dead = $port + 2;			# nothing there
+
+# program => [ versions ], and what the portmapper has of them
+my %programs = ( 100003 => [3, 4], 100005 => [1, 3], 100021 => [4], 100024 => [1] );
+my @registered = (
+	[100003, 3, 17, $uport], [100003, 4, 17, $uport], [100003, 3, 6, $port], [100003, 4, 6, $port],
+	[100005, 1, 17, $uport], [100005, 3, 17, $uport],
+	[100021, 4, 17, $dead],
+	[100024, 1, 17, $uport], [100024, 1, 6, $port],
+);
+
+# the reply to a call: the result of the NULL procedure, or the list
+sub reply {
+	my ($call) = @_;
+	my ($xid, $type, $rpcvers, $prog, $vers, $proc) = unpack("N6", $call);
+	my $head = pack("N5", $xid, 1, 0, 0, 0);
+	if ($prog == 100000 && $proc == 4) {
+		return $head . pack("N", 0) . join("", map { pack("N5", 1, @$_) } @registered) . pack("N", 0);
+	}
+	return $head . pack("N", 1) unless $programs{$prog};
+	my @v = @{$programs{$prog}};
+	return $head . pack("N3", 2, $v[0], $v[-1]) unless grep { $_ == $vers } @v;
+	return $head . pack("N", 0);
+}
+
+my $pid = fork();
+if ($pid) {
+	sleep(1);
+} else {
+	my $tcp = IO::Socket::INET->new(LocalAddr => "127.0.0.1", LocalPort => $port, Type => SOCK_STREAM,
+		Reuse => 1, Proto => "tcp", Listen => 10) or die "Cannot be a tcp server on port $port: $@";
+	my $udp = IO::Socket::INET->new(LocalAddr => "127.0.0.1", LocalPort => $uport, Proto => "udp")
+		or die "Cannot be a udp server on port $uport: $@";
+	my $select = IO::Select->new($tcp, $udp);
+	my %buf;
+	while (1) {
+		for my $fh ($select->can_read) {
+			my $data;
+			if ($fh == $tcp) {
+				$select->add(scalar $tcp->accept);
+			} elsif ($fh == $udp) {
+				my $from = $udp->recv($data, 1024);
+				$udp->send(reply($data), 0, $from);
+			} elsif (!sysread($fh, $data, 1024)) {
+				$select->remove($fh);
+				close($fh);
+			} else {
+				$buf{$fh} .= $data;
+				while (length($buf{$fh}) >= 4) {
+					my $len = unpack("N", $buf{$fh}) & 0x7fffffff;
+					last if length($buf{$fh}) < 4 + $len;
+					my $r = reply(substr($buf{$fh}, 4, $len));
+					substr($buf{$fh}, 0, 4 + $len) = "";
+					syswrite($fh, pack("N", 0x80000000 | length($r)) . $r);
+				}
+			}
+		}
+	}
+}
+
+END { if ($pid) { kill "INT", $pid } };
+
+if (-x "./check_rpc") {
+	plan tests => 22;
+} else {
+	plan skip_all => "No check_rpc compiled";
+}
+
+my $check = "./check_rpc -H 127.0.0.1 --portmapper=$port --timeout=3";
+my $res;
+
+$res = NPTest->testCmd("$check -C nfs");
+is( $res->return_code, 0, "All registered versions of a program" );
+like( $res->output, "/^OK: RPC program nfs version 3 version 4 udp running\\|nfs_v3_udp=[0-9.]+s;;;0.000000;3.000000 nfs_v4_udp=/", "say what check_rpc.pl said, timed" );
+
+$res = NPTest->testCmd("$check -C 100003 -c 3 -t");
+is( $res->return_code, 0, "By number, a version of -c, over TCP" );
+like( $res->output, "/^OK: RPC program 100003 version 3 tcp running/", "Output" );
+
+$res = NPTest->testCmd("$check -C mountd -c 1,2,3");
+is( $res->return_code, 2, "A version that is not registered" );
+like( $res->output, "/^CRITICAL: RPC program mountd version 2 udp is not running, version 1 version 3 udp is running/", "Output" );
+
+$res = NPTest->testCmd("$check -C mountd -t -v");
+is( $res->return_code, 2, "Not registered for TCP" );
+like( $res->output, "/^CRITICAL: RPC program mountd tcp is not running - program mountd is not registered for tcp|/", "Output" );
+
+$res = NPTest->testCmd("$check -C nfs:3,4 -C mountd -C status");
+is( $res->return_code, 0, "Several programs" );
+like( $res->output, "/^RPC OK: 5 of 5 program versions running\\|/", "counted" );
+like( $res->output, "/^\\[OK\\] mountd version 3 udp: running, [0-9.]+ ms\$/m", "and a line for each" );
+
+my $start = time;
+$res = NPTest->testCmd("$check -C nfs -C mountd -C nlockmgr -C status");
+my $took = time - $start;
+is( $res->return_code, 2, "A program that does not answer" );
+like( $res->output, "/^RPC CRITICAL: 5 of 6 program versions running - nlockmgr version 4 udp: No response\\|/", "is named" );
+cmp_ok( $took, "<=", 3, "Waited for once, not for each" );
+
+$res = NPTest->testCmd("$check -C 200000");
+is( $res->return_code, 2, "A program that is not registered" );
+like( $res->output, "/not running/", "Output" );
+
+$res = NPTest->testCmd("./check_rpc -H 127.0.0.1 -p $uport -C nfs");
+is( $res->return_code, 0, "-p without asking the portmapper" );
+like( $res->output, "/^OK: RPC program nfs version 3 version 4 udp running\\|nfs_udp=/", "any version, and those there are" );
+
+$res = NPTest->testCmd("./check_rpc -H 127.0.0.1 -p $uport -C nfs -c 5 -v");
+is( $res->return_code, 2, "-p with a version the program has not" );
+like( $res->output, "/version not available, only 3 to 4/", "Output" );
+
+$res = NPTest->testCmd("./check_rpc -H 127.0.0.1 --portmapper=$dead -C nfs");
+is( $res->return_code, 2, "No portmapper" );
+
+$res = NPTest->testCmd("./check_rpc -H 127.0.0.1 -C nosuchprogram");
+is( $res->return_code, 3, "A program not known by name" );
@@ -0,0 +1,40 @@
+#! /usr/bin/perl -w -I ..
+#
+# Performance of the plugins against tests/bench_plugins.baseline
+#
+# Only with NPTEST_PERF set, as it takes minutes: tests/bench_plugins runs
+# each plugin NPTEST_PERF_RUNS times (default 500) against its stub server,
+# and a plugin whose p50, CPU time or peak RSS is more than
+# NPTEST_PERF_TOLERANCE percent (default 25) above the baseline fails.
+#
+
+use strict;
+use Test::More;
+use FindBin qw($Bin);
+use File::Temp qw(tempdir);
+
+plan skip_all => "NPTEST_PERF not set" unless $ENV{NPTEST_PERF};
+
+my $runs = $ENV{NPTEST_PERF_RUNS} || 500;
+my $tolerance = defined $ENV{NPTEST_PERF_TOLERANCE} ? $ENV{NPTEST_PERF_TOLERANCE} : 25;
+my $dir = tempdir(CLEANUP => 1);
+
+my @report = `perl $Bin/bench_plugins --plugins=. --runs=$runs --tolerance=$tolerance --output=$dir/bench.out --baseline=$Bin/bench_plugins.baseline`;
+my $status = $? >> 8;
+
+# the rows of the table of changes, each ending in ok or REGRESSED
+my %verdict;
+my $changes = 0;
+for (@report) {
+	$changes = 1 if /^changes from /;
+	next unless $changes && /^(check_\w+)\s.*\s(ok|REGRESSED: .*)$/;
+	$verdict{$1} = $2;
+}
+
+plan tests => scalar(keys %verdict) + 1;
+
+for my $name (sort keys %verdict) {
+	is( $verdict{$name}, "ok", "$name within $tolerance% of the baseline" )
+		or diag( grep { /^\Q$name\E\s/ } @report );
+}
+is( $status, %verdict && grep({ $_ ne "ok" } values %verdict) ? 1 : 0, "Exit status of bench_plugins" );
@@ -36,23 +36,39 @@ const char *email = "devel@nagios-plugins.org";
 
 #include "common.h"
 #include "utils.h"
-#include "popen.h"
+#include "utils_cmd.h"
 
-#define PERF_CHARACTER "|"
+#define PERF_CHARACTER '|'
 #define NEWLINE_CHARACTER '\n'
 
 void print_help (void);
 void print_usage (void);
 
+/* where the filter is in the first line of the plugin's output: its text,
+ * its perfdata or past them */
+enum {
+	IN_TEXT,
+	IN_PERFDATA,
+	PAST_LINE
+};
+
+typedef struct filter_state {
+	int part;
+	size_t total;
+	int perfdata;   /* whether " | " has been printed */
+} filter_state;
+
+static void filter_output (const char *, size_t, void *);
+
 int
 main (int argc, char **argv)
 {
-	int found = 0, result = STATE_UNKNOWN;
+	int result = STATE_UNKNOWN;
 	char *url = NULL;
 	char *cmd;
-	char *buf;
-	char *nstr;
-	char tstr[MAX_INPUT_BUFFER];
+	char **command_line;
+	output chld_err;
+	filter_state filter = { IN_TEXT, 0, FALSE };
 
 	int c;
 	int option = 0;
@@ -63,10 +79,6 @@ main (int argc, char **argv)
 		{0, 0, 0, 0}
 	};
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
 	/* Need at least 2 args */
 	if (argc < 3) {
 		print_help();
@@ -105,55 +117,65 @@ main (int argc, char **argv)
 		xasprintf (&cmd, "%s %s", cmd, argv[c]);
 	}
 
-	child_process = spopen (cmd);
-	if (child_process == NULL) {
+	if ((command_line = cmd_argv (cmd)) == NULL) {
 		printf (_("Could not open pipe: %s\n"), cmd);
 		exit (STATE_UNKNOWN);
 	}
 
-	child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
-	if (child_stderr == NULL) {
-		printf (_("Could not open stderr for %s\n"), cmd);
-	}
-
-	bzero(tstr, sizeof(tstr));
-	buf = malloc(MAX_INPUT_BUFFER);
 	printf ("<A href=\"%s\">", argv[1]);
-	while (fgets (buf, MAX_INPUT_BUFFER - 1, child_process)) {
-		found++;
-		/* Collect the string in temp str so we can tokenize */
-		strcat(tstr, buf);
-	}
+	result = cmd_run_filter (command_line, filter_output, &filter, &chld_err);
 
-	if (!found)
+	if (!filter.total)
 		die (STATE_UNKNOWN,
 		     _("%s UNKNOWN - No data received from host\nCMD: %s</A>\n"),
 		     argv[0], cmd);
 
+	if (filter.part == IN_TEXT)
+		printf ("</A>");
 
-	/* chop the newline character */
-	if ((nstr = strchr(tstr, NEWLINE_CHARACTER)) != NULL)
-		*nstr = '\0';
+	/* WARNING if output found on stderr */
+	if (chld_err.lines > 0)
+		result = max_state (result, STATE_WARNING);
 
-	/* tokenize the string for Perfdata if there is some */
-	nstr = strtok(tstr, PERF_CHARACTER);
-	printf ("%s", nstr);
-	printf ("</A>");
-	nstr = strtok(NULL, PERF_CHARACTER);
-	if (nstr != NULL)
-		printf (" | %s", nstr);
+	return result;
+}
 
-	/* close the pipe */
-	result = spclose (child_process);
 
-	/* WARNING if output found on stderr */
-	if (fgets (buf, MAX_INPUT_BUFFER - 1, child_stderr))
-		result = max_state (result, STATE_WARNING);
 
-	/* close stderr */
-	(void) fclose (child_stderr);
+/* Print the first line of the plugin's output as it comes, its text in
+ * the link and its perfdata after it, up to the next '|' */
+static void
+filter_output (const char *buf, size_t len, void *data)
+{
+	filter_state *filter = data;
+	const char *end = buf + len;
+	size_t span;
+
+	filter->total += len;
+	while (buf < end && filter->part != PAST_LINE) {
+		for (span = 0; buf + span < end; span++)
+			if (buf[span] == PERF_CHARACTER || buf[span] == NEWLINE_CHARACTER)
+				break;
+
+		if (span > 0 && filter->part == IN_PERFDATA && !filter->perfdata) {
+			printf (" | ");
+			filter->perfdata = TRUE;
+		}
+		fwrite (buf, 1, span, stdout);
+		buf += span;
+		if (buf == end)
+			break;
 
-	return result;
+		if (*buf == NEWLINE_CHARACTER || filter->part == IN_PERFDATA) {
+			if (filter->part == IN_TEXT)
+				printf ("</A>");
+			filter->part = PAST_LINE;
+		} else {
+			printf ("</A>");
+			filter->part = IN_PERFDATA;
+		}
+		buf++;
+	}
 }
 
 
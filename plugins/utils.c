@@ -28,6 +28,7 @@
 #include <stdarg.h>
 #include <limits.h>
 #include <ctype.h>
+#include <fcntl.h>
 
 #include <arpa/inet.h>
 
@@ -119,7 +120,7 @@ void usage (const char *msg)
 {
 	printf ("%s\n", msg);
 	print_usage ();
-	exit (STATE_UNKNOWN);
+	np_exit (STATE_UNKNOWN);
 }
 
 void usage_va (const char *fmt, ...)
@@ -130,14 +131,14 @@ void usage_va (const char *fmt, ...)
 	vprintf(fmt, ap);
 	va_end(ap);
 	printf("\n");
-	exit (STATE_UNKNOWN);
+	np_exit (STATE_UNKNOWN);
 }
 
 void usage2(const char *msg, const char *arg)
 {
 	printf ("%s: %s - %s\n", progname, msg, arg?arg:"(null)" );
 	print_usage ();
-	exit (STATE_UNKNOWN);
+	np_exit (STATE_UNKNOWN);
 }
 
 void
@@ -145,7 +146,7 @@ usage3 (const char *msg, int arg)
 {
 	printf ("%s: %s - %c\n", progname, msg, arg);
 	print_usage();
-	exit (STATE_UNKNOWN);
+	np_exit (STATE_UNKNOWN);
 }
 
 void
@@ -153,14 +154,14 @@ usage4 (const char *msg)
 {
 	printf ("%s: %s\n", progname, msg);
 	print_usage();
-	exit (STATE_UNKNOWN);
+	np_exit (STATE_UNKNOWN);
 }
 
 void
 usage5 (void)
 {
 	print_usage();
-	exit (STATE_UNKNOWN);
+	np_exit (STATE_UNKNOWN);
 }
 
 void
@@ -212,7 +213,7 @@ timeout_alarm_handler (int signo)
 				break;
 		}
 		write(STDOUT_FILENO, msg, sizeof(msg) - 1);
-		exit (timeout_state);
+		np_exit (timeout_state);
 	}
 }
 
@@ -635,8 +636,266 @@ xasprintf (char **strp, const char *fmt, ...)
  *
  * Print perfdata in a standard format
  *
+ * An np_perfdata collects any number of metrics in one growing buffer, so
+ * building the perfdata of N items costs O(N) rather than copying the whole
+ * string again for every item. Numbers are formatted without printf; the
+ * result is the same as "%ld", "%d" and "%f" would give.
+ *
  ******************************************************************************/
 
+#define NP_PERFDATA_CHUNK 256
+
+void
+np_perfdata_init (np_perfdata *pd)
+{
+	pd->buf = NULL;
+	pd->len = 0;
+	pd->size = 0;
+}
+
+void
+np_perfdata_free (np_perfdata *pd)
+{
+	free (pd->buf);
+	np_perfdata_init (pd);
+}
+
+/* returns the collected perfdata, valid until the next change to pd */
+const char *
+np_perfdata_string (const np_perfdata *pd)
+{
+	return pd->buf ? pd->buf : "";
+}
+
+/* hands the buffer over to the caller and resets pd */
+char *
+np_perfdata_release (np_perfdata *pd)
+{
+	char *data = pd->buf ? pd->buf : strdup ("");
+
+	if (data == NULL)
+		die (STATE_UNKNOWN, _("failed malloc in xvasprintf\n"));
+	np_perfdata_init (pd);
+	return data;
+}
+
+static void
+np_perfdata_reserve (np_perfdata *pd, size_t len)
+{
+	size_t size = pd->size ? pd->size : NP_PERFDATA_CHUNK;
+
+	if (pd->len + len < pd->size)
+		return;
+	while (size <= pd->len + len)
+		size <<= 1;
+	if ((pd->buf = realloc (pd->buf, size)) == NULL)
+		die (STATE_UNKNOWN, _("failed malloc in xvasprintf\n"));
+	pd->size = size;
+}
+
+void
+np_perfdata_append (np_perfdata *pd, const char *str, size_t len)
+{
+	np_perfdata_reserve (pd, len);
+	memcpy (pd->buf + pd->len, str, len);
+	pd->len += len;
+	pd->buf[pd->len] = '\0';
+}
+
+static void
+np_perfdata_puts (np_perfdata *pd, const char *str)
+{
+	if (str)
+		np_perfdata_append (pd, str, strlen (str));
+}
+
+static void
+np_perfdata_putc (np_perfdata *pd, char c)
+{
+	np_perfdata_append (pd, &c, 1);
+}
+
+/* digits of v, most significant first, into the end of buf; returns start */
+static char *
+np_format_ulong (char *end, unsigned long v)
+{
+	*--end = '\0';
+	do {
+		*--end = '0' + (char) (v % 10);
+		v /= 10;
+	} while (v);
+	return end;
+}
+
+static void
+np_perfdata_put_long (np_perfdata *pd, long v)
+{
+	char buf[32];
+	char *p;
+
+	/* negate in unsigned arithmetic so LONG_MIN comes out right */
+	p = np_format_ulong (buf + sizeof (buf), v < 0 ? 0UL - (unsigned long) v : (unsigned long) v);
+	if (v < 0)
+		*--p = '-';
+	np_perfdata_append (pd, p, buf + sizeof (buf) - 1 - p);
+}
+
+/* "%f": six decimals, rounded */
+static void
+np_perfdata_put_double (np_perfdata *pd, double v)
+{
+	char buf[48];
+	char *p;
+	double ip, frac, scaled, rest;
+	unsigned long whole, decimals;
+	int i;
+
+	/* printf handles what the fast path cannot do exactly: huge values,
+	 * inf/nan, and fractions sitting on a rounding boundary */
+	if (!(fabs (v) < 1e15) || fabs (v) >= (double) (ULONG_MAX >> 1))
+		goto slow;
+	frac = modf (fabs (v), &ip);
+	scaled = frac * 1e6;
+	rest = scaled - floor (scaled);
+	if (fabs (rest - 0.5) < 1e-6)
+		goto slow;
+
+	whole = (unsigned long) ip;
+	decimals = (unsigned long) floor (scaled + 0.5);
+	if (decimals >= 1000000) {
+		decimals -= 1000000;
+		whole++;
+	}
+
+	p = buf + sizeof (buf) - 1;
+	*p = '\0';
+	for (i = 0; i < 6; i++) {
+		*--p = '0' + (char) (decimals % 10);
+		decimals /= 10;
+	}
+	*--p = '.';
+	do {
+		*--p = '0' + (char) (whole % 10);
+		whole /= 10;
+	} while (whole);
+	if (signbit (v))
+		*--p = '-';
+	np_perfdata_append (pd, p, buf + sizeof (buf) - 1 - p);
+	return;
+
+slow:
+	/* "%f" of DBL_MAX is over 300 digits long */
+	np_perfdata_reserve (pd, 512);
+	pd->len += snprintf (pd->buf + pd->len, pd->size - pd->len, "%f", v);
+}
+
+/* label and '=' of a new metric, separated from the previous one */
+static void
+np_perfdata_label (np_perfdata *pd, const char *label)
+{
+	if (pd->len)
+		np_perfdata_putc (pd, ' ');
+	if (strpbrk (label, "'= ")) {
+		np_perfdata_putc (pd, '\'');
+		np_perfdata_puts (pd, label);
+		np_perfdata_append (pd, "'=", 2);
+	}
+	else {
+		np_perfdata_puts (pd, label);
+		np_perfdata_putc (pd, '=');
+	}
+}
+
+void
+np_perfdata_add (np_perfdata *pd, const char *label, long int val, const char *uom,
+                 int warnp, long int warn, int critp, long int crit,
+                 int minp, long int minv, int maxp, long int maxv)
+{
+	np_perfdata_label (pd, label);
+	np_perfdata_put_long (pd, val);
+	np_perfdata_puts (pd, uom);
+	np_perfdata_putc (pd, ';');
+	if (warnp)
+		np_perfdata_put_long (pd, warn);
+	np_perfdata_putc (pd, ';');
+	if (critp)
+		np_perfdata_put_long (pd, crit);
+	np_perfdata_putc (pd, ';');
+	if (minp)
+		np_perfdata_put_long (pd, minv);
+	if (maxp) {
+		np_perfdata_putc (pd, ';');
+		np_perfdata_put_long (pd, maxv);
+	}
+}
+
+void
+np_perfdata_addf (np_perfdata *pd, const char *label, double val, const char *uom,
+                  int warnp, double warn, int critp, double crit,
+                  int minp, double minv, int maxp, double maxv)
+{
+	np_perfdata_label (pd, label);
+	np_perfdata_put_double (pd, val);
+	np_perfdata_puts (pd, uom);
+	np_perfdata_putc (pd, ';');
+	if (warnp)
+		np_perfdata_put_double (pd, warn);
+	np_perfdata_putc (pd, ';');
+	if (critp)
+		np_perfdata_put_double (pd, crit);
+	np_perfdata_putc (pd, ';');
+	if (minp)
+		np_perfdata_put_double (pd, minv);
+	if (maxp) {
+		np_perfdata_putc (pd, ';');
+		np_perfdata_put_double (pd, maxv);
+	}
+}
+
+void
+np_perfdata_adds (np_perfdata *pd, const char *label, double val, const char *uom,
+                  const char *warn, const char *crit,
+                  int minp, double minv, int maxp, double maxv)
+{
+	np_perfdata_label (pd, label);
+	np_perfdata_put_double (pd, val);
+	np_perfdata_puts (pd, uom);
+	np_perfdata_putc (pd, ';');
+	np_perfdata_puts (pd, warn);
+	np_perfdata_putc (pd, ';');
+	np_perfdata_puts (pd, crit);
+	np_perfdata_putc (pd, ';');
+	if (minp)
+		np_perfdata_put_double (pd, minv);
+	if (maxp) {
+		np_perfdata_putc (pd, ';');
+		np_perfdata_put_double (pd, maxv);
+	}
+}
+
+void
+np_perfdata_adds_int (np_perfdata *pd, const char *label, int val, const char *uom,
+                      const char *warn, const char *crit,
+                      int minp, int minv, int maxp, int maxv)
+{
+	np_perfdata_label (pd, label);
+	np_perfdata_put_long (pd, val);
+	np_perfdata_puts (pd, uom);
+	np_perfdata_putc (pd, ';');
+	np_perfdata_puts (pd, warn);
+	np_perfdata_putc (pd, ';');
+	np_perfdata_puts (pd, crit);
+	np_perfdata_putc (pd, ';');
+	if (minp)
+		np_perfdata_put_long (pd, minv);
+	if (maxp) {
+		np_perfdata_putc (pd, ';');
+		np_perfdata_put_long (pd, maxv);
+	}
+}
+
+/* The single metric versions return a new string each */
+
 char *perfdata (const char *label,
  long int val,
  const char *uom,
@@ -649,30 +908,11 @@ char *perfdata (const char *label,
  int maxp,
  long int maxv)
 {
-	char *data = NULL;
-
-	if (strpbrk (label, "'= "))
-		xasprintf (&data, "'%s'=%ld%s;", label, val, uom);
-	else
-		xasprintf (&data, "%s=%ld%s;", label, val, uom);
-
-	if (warnp)
-		xasprintf (&data, "%s%ld;", data, warn);
-	else
-		xasprintf (&data, "%s;", data);
-
-	if (critp)
-		xasprintf (&data, "%s%ld;", data, crit);
-	else
-		xasprintf (&data, "%s;", data);
+	np_perfdata pd;
 
-	if (minp)
-		xasprintf (&data, "%s%ld", data, minv);
-
-	if (maxp)
-		xasprintf (&data, "%s;%ld", data, maxv);
-
-	return data;
+	np_perfdata_init (&pd);
+	np_perfdata_add (&pd, label, val, uom, warnp, warn, critp, crit, minp, minv, maxp, maxv);
+	return np_perfdata_release (&pd);
 }
 
 
@@ -688,35 +928,11 @@ char *fperfdata (const char *label,
  int maxp,
  double maxv)
 {
-	char *data = NULL;
-
-	if (strpbrk (label, "'= "))
-		xasprintf (&data, "'%s'=", label);
-	else
-		xasprintf (&data, "%s=", label);
-
-	xasprintf (&data, "%s%f", data, val);
-	xasprintf (&data, "%s%s;", data, uom);
-
-	if (warnp)
-		xasprintf (&data, "%s%f", data, warn);
-
-	xasprintf (&data, "%s;", data);
-
-	if (critp)
-		xasprintf (&data, "%s%f", data, crit);
-
-	xasprintf (&data, "%s;", data);
-
-	if (minp)
-		xasprintf (&data, "%s%f", data, minv);
+	np_perfdata pd;
 
-	if (maxp) {
-		xasprintf (&data, "%s;", data);
-		xasprintf (&data, "%s%f", data, maxv);
-	}
-
-	return data;
+	np_perfdata_init (&pd);
+	np_perfdata_addf (&pd, label, val, uom, warnp, warn, critp, crit, minp, minv, maxp, maxv);
+	return np_perfdata_release (&pd);
 }
 
 char *sperfdata (const char *label,
@@ -729,34 +945,11 @@ char *sperfdata (const char *label,
  int maxp,
  double maxv)
 {
-	char *data = NULL;
-	if (strpbrk (label, "'= "))
-		xasprintf (&data, "'%s'=", label);
-	else
-		xasprintf (&data, "%s=", label);
-
-	xasprintf (&data, "%s%f", data, val);
-	xasprintf (&data, "%s%s;", data, uom);
-
-	if (warn!=NULL)
-		xasprintf (&data, "%s%s", data, warn);
+	np_perfdata pd;
 
-	xasprintf (&data, "%s;", data);
-
-	if (crit!=NULL)
-		xasprintf (&data, "%s%s", data, crit);
-
-	xasprintf (&data, "%s;", data);
-
-	if (minp)
-		xasprintf (&data, "%s%f", data, minv);
-
-	if (maxp) {
-		xasprintf (&data, "%s;", data);
-		xasprintf (&data, "%s%f", data, maxv);
-	}
-
-	return data;
+	np_perfdata_init (&pd);
+	np_perfdata_adds (&pd, label, val, uom, warn, crit, minp, minv, maxp, maxv);
+	return np_perfdata_release (&pd);
 }
 
 char *sperfdata_int (const char *label,
@@ -769,34 +962,151 @@ char *sperfdata_int (const char *label,
  int maxp,
  int maxv)
 {
-	char *data = NULL;
-	if (strpbrk (label, "'= "))
-		xasprintf (&data, "'%s'=", label);
-	else
-		xasprintf (&data, "%s=", label);
+	np_perfdata pd;
+
+	np_perfdata_init (&pd);
+	np_perfdata_adds_int (&pd, label, val, uom, warn, crit, minp, minv, maxp, maxv);
+	return np_perfdata_release (&pd);
+}
 
-	xasprintf (&data, "%s%d", data, val);
-	xasprintf (&data, "%s%s;", data, uom);
+struct np_phase_timer {
+	struct timeval start;
+	double total;
+	int started;
+	int done;
+};
 
-	if (warn!=NULL)
-		xasprintf (&data, "%s%s", data, warn);
+static struct np_phase_timer phase_timers[NP_PHASE_MAX];
+static const char *phase_names[NP_PHASE_MAX] = {
+	"dns", "connect", "ssl", "firstbyte", "transfer"
+};
 
-	xasprintf (&data, "%s;", data);
+static void
+np_timer_now (struct timeval *now)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	now->tv_sec = ts.tv_sec;
+	now->tv_usec = ts.tv_nsec / 1000;
+#else
+	gettimeofday (now, NULL);
+#endif
+}
 
-	if (crit!=NULL)
-		xasprintf (&data, "%s%s", data, crit);
+void
+np_timer_phase_begin (enum np_timer_phase phase)
+{
+	if (phase >= NP_PHASE_MAX)
+		return;
+	np_timer_now (&phase_timers[phase].start);
+	phase_timers[phase].started = TRUE;
+}
 
-	xasprintf (&data, "%s;", data);
+void
+np_timer_phase_end (enum np_timer_phase phase)
+{
+	struct timeval now;
 
-	if (minp)
-		xasprintf (&data, "%s%d", data, minv);
+	if (phase >= NP_PHASE_MAX || !phase_timers[phase].started)
+		return;
+	np_timer_now (&now);
+	phase_timers[phase].total += (double)(now.tv_sec - phase_timers[phase].start.tv_sec) +
+		(double)(now.tv_usec - phase_timers[phase].start.tv_usec) / 1.0e6;
+	phase_timers[phase].started = FALSE;
+	phase_timers[phase].done = TRUE;
+}
 
-	if (maxp) {
-		xasprintf (&data, "%s;", data);
-		xasprintf (&data, "%s%d", data, maxv);
+double
+np_timer_phase_elapsed (enum np_timer_phase phase)
+{
+	if (phase >= NP_PHASE_MAX || !phase_timers[phase].done)
+		return -1;
+	return phase_timers[phase].total;
+}
+
+void
+np_timer_phase_reset (void)
+{
+	memset (phase_timers, 0, sizeof (phase_timers));
+}
+
+void
+np_timer_phase_perfdata (np_perfdata *pd, double max_time)
+{
+	char label[32];
+	int i;
+
+	for (i = 0; i < NP_PHASE_MAX; i++) {
+		if (!phase_timers[i].done)
+			continue;
+		snprintf (label, sizeof (label), "time_%s", phase_names[i]);
+		np_perfdata_addf (pd, label, phase_timers[i].total, "s",
+		                  FALSE, 0, FALSE, 0, TRUE, 0, max_time > 0, max_time);
 	}
+}
 
-	return data;
+void
+np_timer_phase_report (FILE *fp)
+{
+	int i;
+
+	for (i = 0; i < NP_PHASE_MAX; i++) {
+		if (phase_timers[i].done)
+			fprintf (fp, "%-10s %.6f s\n", phase_names[i], phase_timers[i].total);
+		else
+			fprintf (fp, "%-10s -\n", phase_names[i]);
+	}
+}
+
+int
+np_latency_report (const np_histogram *h, const char *label, double percentile,
+                   const char *warn, const char *crit, thresholds *t,
+                   char **msg, np_perfdata *pd)
+{
+	char name[64];
+	double value = np_histogram_percentile (h, percentile);
+
+	xasprintf (msg, _("%lu samples: min %.6f, median %.6f, %gth percentile %.6f, max %.6f seconds"),
+	           h->count, h->min, np_histogram_percentile (h, 50), percentile, value, h->max);
+	snprintf (name, sizeof (name), "%s_min", label);
+	np_perfdata_addf (pd, name, h->min, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+	snprintf (name, sizeof (name), "%s_median", label);
+	np_perfdata_addf (pd, name, np_histogram_percentile (h, 50), "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+	snprintf (name, sizeof (name), "%s_p%g", label, percentile);
+	np_perfdata_adds (pd, name, value, "s", warn, crit, TRUE, 0, FALSE, 0);
+	snprintf (name, sizeof (name), "%s_max", label);
+	np_perfdata_addf (pd, name, h->max, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+	return get_status (value, t);
+}
+
+int
+mrtg_read_sample (const char *path, mrtg_sample *sample)
+{
+	char buf[MRTG_HEAD_SIZE + 1], *p;
+	ssize_t len;
+	int fd;
+
+	memset (sample, 0, sizeof (*sample));
+	if ((fd = open (path, O_RDONLY)) < 0)
+		return -1;
+	len = pread (fd, buf, MRTG_HEAD_SIZE, 0);
+	close (fd);
+	if (len <= 0)
+		return FALSE;
+	buf[len] = '\0';
+
+	/* the first line has the time and counters of the last MRTG run, the
+	 * second one the sample to check; it has to be all there */
+	if ((p = strchr (buf, '\n')) == NULL || strchr (++p, '\n') == NULL)
+		return FALSE;
+	sample->timestamp = strtoul (p, &p, 10);
+	sample->average[0] = strtoul (p, &p, 10);
+	sample->average[1] = strtoul (p, &p, 10);
+	sample->maximum[0] = strtoul (p, &p, 10);
+	sample->maximum[1] = strtoul (p, &p, 10);
+	return TRUE;
 }
 
 /* set entire string to lower, no need to return as it works on string in place */
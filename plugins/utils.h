@@ -15,13 +15,15 @@ suite of plugins. */
 
 /* now some functions etc are being defined in ../lib/utils_base.c */
 #include "utils_base.h"
+#include "utils_output.h"
+#include "utils_profile.h"
 
 #ifdef NP_EXTRA_OPTS
 /* Include extra-opts functions if compiled in */
 #include "extra_opts.h"
 #else
-/* else, fake np_extra_opts */
-#define np_extra_opts(acptr,av,pr) av
+/* else, fake np_extra_opts, which still takes --output-format */
+#define np_extra_opts(acptr,av,pr) np_output_opts(acptr,av)
 #endif
 
 /* Standardize version information, termination */
@@ -96,6 +98,27 @@ int parse_timeout_string (char *timeout_str);
 #define max(a,b) (((a)>(b))?(a):(b))
 #define min(a,b) (((a)<(b))?(a):(b))
 
+/* perfdata builder: appends metrics to one buffer, space separated */
+typedef struct np_perfdata_struct {
+	char *buf;
+	size_t len;
+	size_t size;
+} np_perfdata;
+
+void np_perfdata_init (np_perfdata *);
+void np_perfdata_free (np_perfdata *);
+const char *np_perfdata_string (const np_perfdata *);
+char *np_perfdata_release (np_perfdata *);
+void np_perfdata_append (np_perfdata *, const char *, size_t);
+void np_perfdata_add (np_perfdata *, const char *, long int, const char *,
+                      int, long int, int, long int, int, long int, int, long int);
+void np_perfdata_addf (np_perfdata *, const char *, double, const char *,
+                       int, double, int, double, int, double, int, double);
+void np_perfdata_adds (np_perfdata *, const char *, double, const char *,
+                       const char *, const char *, int, double, int, double);
+void np_perfdata_adds_int (np_perfdata *, const char *, int, const char *,
+                           const char *, const char *, int, int, int, int);
+
 char *perfdata (const char *, long int, const char *, int, long int,
                 int, long int, int, long int, int, long int);
 
@@ -108,6 +131,51 @@ char *sperfdata (const char *, double, const char *, char *, char *,
 char *sperfdata_int (const char *, int, const char *, char *, char *,
                      int, int, int, int);
 
+/* Phase timing for network checks. np_net_connect() and the SSL setup
+ * mark the DNS, connect and TLS phases themselves; plugins mark first
+ * byte (request sent to first byte of the reply) and transfer (first
+ * byte to the end of the reply). A phase marked more than once adds up.
+ * Measured on CLOCK_MONOTONIC where available. */
+enum np_timer_phase {
+	NP_PHASE_DNS,
+	NP_PHASE_CONNECT,
+	NP_PHASE_TLS,
+	NP_PHASE_FIRSTBYTE,
+	NP_PHASE_TRANSFER,
+	NP_PHASE_MAX
+};
+
+void np_timer_phase_begin (enum np_timer_phase);
+void np_timer_phase_end (enum np_timer_phase);
+/* seconds spent in the phase, or -1 if it was never completed */
+double np_timer_phase_elapsed (enum np_timer_phase);
+void np_timer_phase_reset (void);
+/* time_dns, time_connect, time_ssl, ... for the phases that completed */
+void np_timer_phase_perfdata (np_perfdata *, double);
+/* one line per phase, for --trace-timing */
+void np_timer_phase_report (FILE *);
+
+/* The latencies of a check that repeats its query (--repeat): returns the
+ * state of the percentile against t, with the spread of the samples in
+ * msg and <label>_min, <label>_median, <label>_p<percentile> (with warn
+ * and crit) and <label>_max added to the perfdata */
+int np_latency_report (const np_histogram *, const char *, double, const char *,
+                       const char *, thresholds *, char **, np_perfdata *);
+
+/* The newest sample of an MRTG log, on its second line: the time, then
+ * the average and the maximum of each of the two variables. Only the head
+ * of the file is read, with one pread(). mrtg_read_sample() returns -1 if
+ * the file cannot be opened and FALSE if it has no such line. */
+typedef struct mrtg_sample {
+	time_t timestamp;
+	unsigned long average[2];
+	unsigned long maximum[2];
+} mrtg_sample;
+
+#define MRTG_HEAD_SIZE 512
+
+int mrtg_read_sample (const char *, mrtg_sample *);
+
 /* string case changes */
 void strntoupper (char * test_char, int size);
 void strntolower (char * test_char, int size);
@@ -181,11 +249,48 @@ void strntolower (char * test_char, int size);
  --extra-opts=[section][@file]\n\
     Read options from an ini file. See\n\
     https://www.nagios-plugins.org/doc/extra-opts.html\n\
-    for usage and examples.\n")
+    for usage and examples.\n\
+ --output-format=FORMAT\n\
+    text (the default), or json for the status, message, long output and each\n\
+    perfdata metric as typed fields of one JSON object\n\
+ --profile\n\
+    At exit, print to stderr the wall, CPU and memory use of the run and of\n\
+    each of its phases\n")
 #else
-#define UT_EXTRA_OPTS " \b"
+#define UT_EXTRA_OPTS _("\
+ --output-format=FORMAT\n\
+    text (the default), or json for the status, message, long output and each\n\
+    perfdata metric as typed fields of one JSON object\n\
+ --profile\n\
+    At exit, print to stderr the wall, CPU and memory use of the run and of\n\
+    each of its phases\n")
 #endif
 
+#define UT_TCP_FASTOPEN _("\
+ --tcp-fastopen\n\
+    Send the request with the SYN through TCP Fast Open, where the system and\n\
+    the server support it, saving a round trip on repeated checks\n")
+
+#define UT_ADAPTIVE_TIMEOUT _("\
+ --adaptive-timeout\n\
+    Keep the round-trip time of the target in the state directory and try again\n\
+    as soon as an attempt is late for it, instead of only waiting for the\n\
+    timeout: a new connection beside a lost SYN, a UDP datagram sent again\n")
+
+#define UT_MAX_RATE _("\
+ --max-rate=RATE\n\
+    Start at most RATE %s a second, a burst of them spread out rather\n\
+    than sent at once; the time anything was held back is the throttled perfdata\n")
+
+#define UT_MAX_INFLIGHT _("\
+ --max-inflight=INTEGER\n\
+    Have at most this many %s in flight to any one address at a time\n")
+
+#define UT_TRACE_TIMING _("\
+ --trace-timing\n\
+    Print the time spent resolving, connecting, in the TLS handshake, waiting\n\
+    for the first byte and transferring to stderr, and add it to the perfdata\n")
+
 #define UT_THRESHOLDS_NOTES _("\
  See:\n\
  https://www.nagios-plugins.org/doc/guidelines.html#THRESHOLDFORMAT\n\
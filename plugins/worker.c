@@ -0,0 +1,811 @@
+/*****************************************************************************
+*
+* Nagios plugins worker for Nagios Core 4
+*
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+*
+* Description:
+*
+* This file contains the worker of the multi-call binary, which takes
+* check jobs from Nagios Core 4 over its query handler socket in place of
+* the workers Core starts itself.
+*
+* Those fork and exec every plugin. This one runs the jobs of the plugins
+* with a resident mode in its own process, one after the other, through
+* np_resident_check(), which puts their state back between checks and
+* closes what a check leaves open; their connection pools and tables are
+* kept from one job to the next. The other plugins of the binary are run
+* in a fork of the worker, which has them loaded already, and only
+* scripts, other programs and commands that need a shell are exec'd. All
+* of the forked jobs run at the same time, and are killed with their
+* process group when Core's timeout for them is up.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils.h"
+#include "resident.h"
+#include "worker.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/* multicall.c's, the name of the plugin that runs */
+extern const char *progname;
+
+/* what makes a command one for the shell, as Core's runcmd sees it;
+ * single quotes np_resident_split() takes care of */
+#define WORKER_SHELL_CHARS "\"\\`$|&;<>(){}*?[]~#\n"
+
+/* descriptors a forked job may have been given by the worker */
+#define WORKER_CHILD_FDS 1024
+
+#ifndef ETIME
+# define ETIME ETIMEDOUT
+#endif
+
+typedef struct worker_job {
+	pid_t pid;           /* 0 for a free slot */
+	np_arena arena;
+	char *request;       /* the pairs of the job as Core sent them */
+	size_t request_len;
+	int fd[2];           /* its stdout and stderr, -1 once at the end */
+	np_strbuf out[2];
+	struct timeval start;
+	time_t deadline;
+	int reaped;
+	int status;
+	struct rusage ru;
+	int timed_out;
+} worker_job;
+
+/* the entry points of a resident plugin, taken from it the first time */
+typedef struct worker_entry {
+	int have;
+	int failed;
+	np_check_fn check;
+	np_reset_fn reset;
+} worker_entry;
+
+static char *qh_path = NULL;
+static char *worker_name = "nagios-plugins";
+static int plugins_only = FALSE;
+static int max_jobs = NP_WORKER_MAX_JOBS;
+
+static int sd = -1;
+static int capture_fd = -1;
+static char *inbuf = NULL;
+static size_t inlen = 0, insize = 0;
+static worker_job *jobs = NULL;
+static int njobs = 0;
+static worker_entry *entries = NULL;
+static worker_entry hooked;
+
+static int process_arguments (int, char **);
+static void print_help (void);
+static int worker_connect (const char *);
+static void worker_register (void);
+static int worker_read (void);
+static void worker_job_start (char *, size_t);
+static void worker_inprocess (const np_applet *, int, char **, const char *, size_t);
+static void worker_fork (const np_applet *, int, char **, const char *, int,
+                         const char *, size_t);
+static void worker_child (int, int);
+static void worker_collect (worker_job *, int);
+static void worker_reap (void);
+static void worker_finish (worker_job *);
+static void worker_reply (const char *, size_t, int, const char *, size_t, const char *, size_t,
+                          const struct timeval *, const struct timeval *, int, const struct rusage *);
+static void worker_hook (np_check_fn, np_reset_fn);
+static int worker_high_fd (void);
+static int write_all (int, const char *, size_t);
+
+
+int
+np_worker_requested (const char *name, int argc, char **argv)
+{
+	size_t len = strlen (NP_WORKER_OPTION);
+
+	if (strcmp (name, NP_WORKER_NAME) == 0)
+		return TRUE;
+	return argc >= 2 && !strncmp (argv[1], NP_WORKER_OPTION, len) &&
+	       (argv[1][len] == '\0' || argv[1][len] == '=');
+}
+
+
+int
+np_worker_main (int argc, char **argv)
+{
+	struct pollfd *pfd;
+	worker_job *job;
+	struct timeval now;
+	int i, n, timeout;
+	FILE *capture;
+
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	/* Core going away must not take the worker with it half way */
+	signal (SIGPIPE, SIG_IGN);
+
+	if ((capture = tmpfile ()) == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot create output buffer:"), strerror (errno));
+	capture_fd = fileno (capture);
+	entries = calloc (np_applet_count (), sizeof (*entries));
+	jobs = calloc (max_jobs, sizeof (*jobs));
+	pfd = calloc (2 * max_jobs + 1, sizeof (*pfd));
+	if (entries == NULL || jobs == NULL || pfd == NULL)
+		die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+
+	if ((sd = worker_connect (qh_path)) < 0)
+		die (STATE_UNKNOWN, "%s %s: %s\n", _("Cannot connect to"), qh_path, strerror (errno));
+	worker_register ();
+
+	for (;;) {
+		gettimeofday (&now, NULL);
+		timeout = -1;
+		pfd[0].fd = sd;
+		pfd[0].events = POLLIN;
+		for (i = 0, n = 1; i < njobs; i++) {
+			job = &jobs[i];
+			if (job->pid == 0)
+				continue;
+			if (job->fd[0] >= 0) {
+				pfd[n].fd = job->fd[0];
+				pfd[n++].events = POLLIN;
+			}
+			if (job->fd[1] >= 0) {
+				pfd[n].fd = job->fd[1];
+				pfd[n++].events = POLLIN;
+			}
+			if (job->deadline <= now.tv_sec)
+				timeout = job->timed_out ? 10 : 0;
+			else if (timeout < 0 || (job->deadline - now.tv_sec) * 1000 < timeout)
+				timeout = (int) (job->deadline - now.tv_sec) * 1000;
+			/* one that has closed its output, to wait for */
+			if (!job->reaped && job->fd[0] < 0 && job->fd[1] < 0 && (timeout < 0 || timeout > 100))
+				timeout = 100;
+		}
+
+		if (poll (pfd, n, timeout) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, "poll: %s\n", strerror (errno));
+
+		for (i = 0; i < njobs; i++)
+			if (jobs[i].pid) {
+				worker_collect (&jobs[i], 0);
+				worker_collect (&jobs[i], 1);
+			}
+		worker_reap ();
+
+		gettimeofday (&now, NULL);
+		for (i = 0; i < njobs; i++) {
+			job = &jobs[i];
+			if (job->pid == 0)
+				continue;
+			if (job->deadline <= now.tv_sec && !job->reaped && !job->timed_out) {
+				job->timed_out = TRUE;
+				if (kill (-job->pid, SIGKILL) < 0 && errno == ESRCH)
+					job->reaped = TRUE; /* waited for by someone else */
+			}
+			if (job->deadline <= now.tv_sec && job->reaped) {
+				/* a child of its own may still hold the output */
+				for (n = 0; n < 2; n++)
+					if (job->fd[n] >= 0) {
+						close (job->fd[n]);
+						job->fd[n] = -1;
+					}
+			}
+			if (job->reaped && job->fd[0] < 0 && job->fd[1] < 0)
+				worker_finish (job);
+		}
+
+		if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR) && worker_read () == ERROR)
+			break;
+	}
+
+	/* Core is gone, and with it where the results would go */
+	for (i = 0; i < njobs; i++)
+		if (jobs[i].pid && !jobs[i].reaped)
+			kill (-jobs[i].pid, SIGKILL);
+	return STATE_OK;
+}
+
+
+static int
+process_arguments (int argc, char **argv)
+{
+	int c, option = 0;
+	char *arg;
+	static struct option longopts[] = {
+		{"worker", optional_argument, 0, 'w'},
+		{"name", required_argument, 0, 'n'},
+		{"max-jobs", required_argument, 0, 'j'},
+		{"plugins-only", no_argument, 0, 'p'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while ((c = getopt_long (argc, argv, "n:j:ph", longopts, &option)) != -1) {
+		switch (c) {
+		case 'w':
+			if (optarg && *optarg)
+				qh_path = optarg;
+			break;
+		case 'n':
+			worker_name = optarg;
+			break;
+		case 'j':
+			if (!is_intpos (optarg))
+				usage2 (_("Max jobs must be a positive integer"), optarg);
+			max_jobs = atoi (optarg);
+			break;
+		case 'p':
+			plugins_only = TRUE;
+			break;
+		case 'h':
+			print_help ();
+			exit (STATE_UNKNOWN);
+		default:
+			usage5 ();
+		}
+	}
+
+	if (qh_path == NULL && optind < argc)
+		qh_path = argv[optind++];
+	if (qh_path == NULL)
+		usage4 (_("The query handler socket of Nagios must be given"));
+	/* the pairs of the registration are separated by ';' */
+	for (arg = worker_name; *arg; arg++)
+		if (*arg == ';' || *arg == '=')
+			usage2 (_("Invalid worker name"), worker_name);
+	return OK;
+}
+
+
+static int
+worker_connect (const char *path)
+{
+	struct sockaddr_un su;
+	int fd;
+
+	if (strlen (path) >= sizeof (su.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset (&su, 0, sizeof (su));
+	su.sun_family = AF_UNIX;
+	strcpy (su.sun_path, path);
+	if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (connect (fd, (struct sockaddr *) &su, sizeof (su)) < 0) {
+		close (fd);
+		return -1;
+	}
+	fcntl (fd, F_SETFD, FD_CLOEXEC);
+	return fd;
+}
+
+
+/* "@wproc register name=NAME;pid=PID;max_jobs=N[;plugin=PLUGIN...]",
+ * to which Core answers "OK" */
+static void
+worker_register (void)
+{
+	np_arena arena = { NULL };
+	np_strbuf b;
+	const char *name;
+	char reply[256];
+	size_t len = 0;
+	ssize_t ret;
+	int i;
+
+	np_strbuf_init (&b, &arena);
+	np_strbuf_appendf (&b, "@wproc register name=%s;pid=%ld;max_jobs=%d",
+	                   worker_name, (long) getpid (), max_jobs);
+	/* Core hands the jobs of these to this worker only, the rest to its own */
+	if (plugins_only)
+		for (i = 0; (name = np_applet_name (i)) != NULL; i++)
+			np_strbuf_appendf (&b, ";plugin=%s", name);
+	if (write_all (sd, np_strbuf_string (&b), b.len + 1) < 0)
+		die (STATE_UNKNOWN, "%s %s: %s\n", _("Cannot register with"), qh_path, strerror (errno));
+	np_arena_free (&arena);
+
+	while (len < sizeof (reply) - 1 && (len == 0 || reply[len - 1] != '\0')) {
+		if ((ret = read (sd, reply + len, sizeof (reply) - 1 - len)) < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			die (STATE_UNKNOWN, "%s %s\n", _("No answer to the registration from"), qh_path);
+		len += (size_t) ret;
+	}
+	reply[len] = '\0';
+	if (strncmp (reply, "OK", 2))
+		die (STATE_UNKNOWN, "%s %s: %s\n", _("Registration refused by"), qh_path, reply);
+	/* anything after the answer is the start of the first job */
+	len -= strlen (reply) + 1;
+	if (len > 0) {
+		insize = inlen = len;
+		if ((inbuf = malloc (insize)) == NULL)
+			die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+		memcpy (inbuf, reply + strlen (reply) + 1, len);
+	}
+}
+
+
+/* what Core has sent, and the jobs it completes; ERROR once it is gone */
+static int
+worker_read (void)
+{
+	ssize_t ret;
+	size_t start, i;
+
+	if (insize - inlen < 65536) {
+		insize = insize ? insize * 2 : 65536;
+		if ((inbuf = realloc (inbuf, insize)) == NULL)
+			die (STATE_UNKNOWN, "%s %s\n", _("Cannot allocate memory:"), strerror (errno));
+	}
+	if ((ret = read (sd, inbuf + inlen, insize - inlen)) < 0)
+		return errno == EINTR || errno == EAGAIN ? OK : ERROR;
+	if (ret == 0)
+		return ERROR;
+	inlen += (size_t) ret;
+
+	/* the delimiter that ends a job is one byte longer than what is
+	 * looked for here, its '\0' left before the next job's pairs */
+	start = i = 0;
+	while (i + NP_WORKER_DELIM_LEN - 1 <= inlen) {
+		if (memcmp (inbuf + i, NP_WORKER_DELIM, NP_WORKER_DELIM_LEN - 1)) {
+			i++;
+			continue;
+		}
+		worker_job_start (inbuf + start, i - start);
+		start = i = i + NP_WORKER_DELIM_LEN - 1;
+	}
+	memmove (inbuf, inbuf + start, inlen - start);
+	inlen -= start;
+	return OK;
+}
+
+
+/* the value of key among the len bytes of pairs of a job, or NULL */
+static const char *
+job_value (const char *pairs, size_t len, const char *key)
+{
+	const char *p, *end = pairs + len;
+	size_t klen = strlen (key);
+
+	for (p = pairs; p < end; p += strlen (p) + 1)
+		if (!strncmp (p, key, klen) && p[klen] == '=')
+			return p + klen + 1;
+	return NULL;
+}
+
+
+static void
+worker_job_start (char *pairs, size_t len)
+{
+	const np_applet *applet = NULL;
+	const char *command;
+	char **argv = NULL;
+	struct timeval now;
+	int argc = 0, shell;
+
+	while (len > 0 && *pairs == '\0') {
+		pairs++;
+		len--;
+	}
+	if (len == 0)
+		return;
+	/* the last pair ends in a '\0', for the lookups to stop at */
+	if (pairs[len - 1] != '\0')
+		return;
+	if (job_value (pairs, len, "job_id") == NULL) {
+		fprintf (stderr, "%s: %s\n", progname, _("Job without a job_id skipped"));
+		return;
+	}
+	if ((command = job_value (pairs, len, "command")) == NULL || *command == '\0') {
+		gettimeofday (&now, NULL);
+		worker_reply (pairs, len, 0, NULL, 0, NULL, 0, &now, &now, EINVAL, NULL);
+		return;
+	}
+	shell = strpbrk (command, WORKER_SHELL_CHARS) != NULL;
+	if (!shell) {
+		if ((argv = np_resident_split (command, NULL, &argc)) == NULL || argc < 2)
+			shell = TRUE;
+		else {
+			/* the split puts the name it is given first */
+			argv++;
+			argc--;
+			applet = np_applet_find (argv[0]);
+		}
+	}
+
+	if (applet && applet->resident && !entries[np_applet_index (applet)].failed)
+		worker_inprocess (applet, argc, argv, pairs, len);
+	else
+		worker_fork (applet, argc, argv, command, shell, pairs, len);
+}
+
+
+static void
+worker_hook (np_check_fn check, np_reset_fn reset)
+{
+	hooked.check = check;
+	hooked.reset = reset;
+	hooked.have = TRUE;
+}
+
+
+/* run the check of a resident plugin here and now */
+static void
+worker_inprocess (const np_applet *applet, int argc, char **argv, const char *request, size_t len)
+{
+	worker_entry *e = &entries[np_applet_index (applet)];
+	struct timeval start, stop;
+	struct rusage ru_start, ru_stop, ru;
+	const char *name;
+	char *output;
+	size_t output_len;
+	int result;
+	char *args[3];
+
+	name = strrchr (argv[0], '/');
+	name = name ? name + 1 : argv[0];
+	progname = name;
+	np_applet_select (applet);
+
+	if (!e->have) {
+		/* its main hands its entry points to the hook for --resident */
+		args[0] = argv[0];
+		args[1] = NP_RESIDENT_OPTION;
+		args[2] = NULL;
+		hooked.have = FALSE;
+		np_resident_hook = worker_hook;
+		optind = 0;
+		applet->main (2, args);
+		np_resident_hook = NULL;
+		*e = hooked;
+		if (!e->have) {
+			e->failed = TRUE;
+			progname = NP_WORKER_NAME;
+			worker_fork (applet, argc, argv, NULL, FALSE, request, len);
+			return;
+		}
+	}
+
+	gettimeofday (&start, NULL);
+	getrusage (RUSAGE_SELF, &ru_start);
+	result = np_resident_check (argc, argv, e->check, e->reset, capture_fd, worker_high_fd (),
+	                            &output, &output_len);
+	getrusage (RUSAGE_SELF, &ru_stop);
+	gettimeofday (&stop, NULL);
+	progname = NP_WORKER_NAME;
+	np_applet_select (NULL);
+
+	memset (&ru, 0, sizeof (ru));
+	timersub (&ru_stop.ru_utime, &ru_start.ru_utime, &ru.ru_utime);
+	timersub (&ru_stop.ru_stime, &ru_start.ru_stime, &ru.ru_stime);
+	ru.ru_minflt = ru_stop.ru_minflt - ru_start.ru_minflt;
+	ru.ru_majflt = ru_stop.ru_majflt - ru_start.ru_majflt;
+	ru.ru_inblock = ru_stop.ru_inblock - ru_start.ru_inblock;
+	ru.ru_oublock = ru_stop.ru_oublock - ru_start.ru_oublock;
+
+	/* as the wait status of a process that exited with the result */
+	worker_reply (request, len, (result & 0xff) << 8, output, output_len, NULL, 0,
+	              &start, &stop, 0, &ru);
+	free (output);
+}
+
+
+/* run a job in a process of its own: a plugin of the binary as it is, or
+ * else the program of argv or the shell command */
+static void
+worker_fork (const np_applet *applet, int argc, char **argv, const char *command, int shell,
+             const char *request, size_t len)
+{
+	worker_job *job = NULL;
+	const char *timeout;
+	struct timeval now;
+	char *name;
+	int out[2], err[2], i;
+	pid_t pid;
+
+	gettimeofday (&now, NULL);
+	for (i = 0; i < njobs && jobs[i].pid; i++)
+		;
+	if (i == max_jobs) {
+		worker_reply (request, len, 0, NULL, 0, NULL, 0, &now, &now, EAGAIN, NULL);
+		return;
+	}
+	if (i == njobs)
+		njobs++;
+	job = &jobs[i];
+
+	if (pipe (out) < 0) {
+		worker_reply (request, len, 0, NULL, 0, NULL, 0, &now, &now, errno, NULL);
+		return;
+	}
+	if (pipe (err) < 0) {
+		close (out[0]);
+		close (out[1]);
+		worker_reply (request, len, 0, NULL, 0, NULL, 0, &now, &now, errno, NULL);
+		return;
+	}
+
+	fflush (stdout);
+	fflush (stderr);
+	if ((pid = fork ()) < 0) {
+		i = errno;
+		close (out[0]);
+		close (out[1]);
+		close (err[0]);
+		close (err[1]);
+		worker_reply (request, len, 0, NULL, 0, NULL, 0, &now, &now, i, NULL);
+		return;
+	}
+
+	if (pid == 0) {
+		worker_child (out[1], err[1]);
+		if (applet) {
+			name = strrchr (argv[0], '/');
+			progname = name ? name + 1 : argv[0];
+			np_applet_select (applet);
+			timeout_state = STATE_CRITICAL;
+			timeout_interval = DEFAULT_SOCKET_TIMEOUT;
+			optind = 0;
+			exit (applet->main (argc, argv));
+		}
+		if (shell)
+			execl ("/bin/sh", "sh", "-c", command, (char *) NULL);
+		else
+			execvp (argv[0], argv);
+		fprintf (stderr, "%s: %s\n", shell ? "/bin/sh" : argv[0], strerror (errno));
+		_exit (127);
+	}
+
+	/* the job's process group is its own, to be killed as a whole */
+	setpgid (pid, pid);
+	close (out[1]);
+	close (err[1]);
+	fcntl (out[0], F_SETFD, FD_CLOEXEC);
+	fcntl (err[0], F_SETFD, FD_CLOEXEC);
+	fcntl (out[0], F_SETFL, O_NONBLOCK);
+	fcntl (err[0], F_SETFL, O_NONBLOCK);
+
+	memset (job, 0, sizeof (*job));
+	job->pid = pid;
+	job->fd[0] = out[0];
+	job->fd[1] = err[0];
+	np_strbuf_init (&job->out[0], &job->arena);
+	np_strbuf_init (&job->out[1], &job->arena);
+	job->request = np_arena_alloc (&job->arena, len);
+	memcpy (job->request, request, len);
+	job->request_len = len;
+	job->start = now;
+	timeout = job_value (request, len, "timeout");
+	job->deadline = now.tv_sec + (timeout && atoi (timeout) > 0 ? atoi (timeout) : NP_WORKER_TIMEOUT);
+}
+
+
+/* in a forked job: its output to the pipes, nothing else of the worker's */
+static void
+worker_child (int out, int err)
+{
+	int fd;
+
+	setpgid (0, 0);
+	signal (SIGPIPE, SIG_DFL);
+	if ((fd = open ("/dev/null", O_RDONLY)) >= 0 && fd != STDIN_FILENO) {
+		dup2 (fd, STDIN_FILENO);
+		close (fd);
+	}
+	dup2 (out, STDOUT_FILENO);
+	dup2 (err, STDERR_FILENO);
+	for (fd = STDERR_FILENO + 1; fd < WORKER_CHILD_FDS; fd++)
+		close (fd);
+}
+
+
+/* what there is to read of job's stdout (which 0) or stderr (1) */
+static void
+worker_collect (worker_job *job, int which)
+{
+	char buf[4096];
+	ssize_t ret;
+
+	if (job->fd[which] < 0)
+		return;
+	while ((ret = read (job->fd[which], buf, sizeof (buf))) > 0)
+		np_strbuf_append (&job->out[which], buf, (size_t) ret);
+	if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	close (job->fd[which]);
+	job->fd[which] = -1;
+}
+
+
+static void
+worker_reap (void)
+{
+	struct rusage ru;
+	pid_t pid;
+	int status, i;
+
+	while ((pid = wait4 (-1, &status, WNOHANG, &ru)) > 0)
+		for (i = 0; i < njobs; i++)
+			if (jobs[i].pid == pid && !jobs[i].reaped) {
+				jobs[i].reaped = TRUE;
+				jobs[i].status = status;
+				jobs[i].ru = ru;
+				break;
+			}
+}
+
+
+static void
+worker_finish (worker_job *job)
+{
+	struct timeval stop;
+
+	gettimeofday (&stop, NULL);
+	worker_reply (job->request, job->request_len, job->status,
+	              np_strbuf_string (&job->out[0]), job->out[0].len,
+	              np_strbuf_string (&job->out[1]), job->out[1].len,
+	              &job->start, &stop, job->timed_out ? ETIME : 0, &job->ru);
+	np_arena_free (&job->arena);
+	job->pid = 0;
+}
+
+
+/* the value of a pair as far as its first '\0' would keep it */
+static void
+reply_value (np_strbuf *b, const char *key, const char *value, size_t len)
+{
+	const char *nul;
+
+	np_strbuf_puts (b, key);
+	np_strbuf_append (b, "=", 1);
+	if (value && (nul = memchr (value, '\0', len)) != NULL)
+		len = nul - value;
+	if (value)
+		np_strbuf_append (b, value, len);
+	np_strbuf_append (b, "", 1);
+}
+
+
+static void
+reply_tv (np_strbuf *b, const char *key, const struct timeval *tv)
+{
+	np_strbuf_appendf (b, "%s=%ld.%06ld", key, (long) tv->tv_sec, (long) tv->tv_usec);
+	np_strbuf_append (b, "", 1);
+}
+
+
+/* The result of a job, the pairs of its request followed by those Core's
+ * own workers add; error_code is 0 if it ran to its end, or an errno
+ * value, ETIME for a timeout */
+static void
+worker_reply (const char *request, size_t len, int wait_status, const char *out, size_t out_len,
+              const char *err, size_t err_len, const struct timeval *start,
+              const struct timeval *stop, int error_code, const struct rusage *ru)
+{
+	np_arena arena = { NULL };
+	np_strbuf b;
+	struct timeval runtime;
+
+	np_strbuf_init (&b, &arena);
+	np_strbuf_reserve (&b, len + out_len + err_len + 512);
+	np_strbuf_append (&b, request, len);
+	np_strbuf_appendf (&b, "wait_status=%d", wait_status);
+	np_strbuf_append (&b, "", 1);
+	reply_value (&b, "outstd", out, out_len);
+	reply_value (&b, "outerr", err, err_len);
+	reply_tv (&b, "start", start);
+	reply_tv (&b, "stop", stop);
+	timersub (stop, start, &runtime);
+	np_strbuf_appendf (&b, "runtime=%f", runtime.tv_sec + runtime.tv_usec / 1000000.0);
+	np_strbuf_append (&b, "", 1);
+	if (error_code == 0) {
+		np_strbuf_appendf (&b, "exited_ok=1");
+		np_strbuf_append (&b, "", 1);
+	}
+	else {
+		np_strbuf_appendf (&b, "exited_ok=0");
+		np_strbuf_append (&b, "", 1);
+		np_strbuf_appendf (&b, "error_code=%d", error_code);
+		np_strbuf_append (&b, "", 1);
+	}
+	if (ru) {
+		reply_tv (&b, "ru_utime", &ru->ru_utime);
+		reply_tv (&b, "ru_stime", &ru->ru_stime);
+		np_strbuf_appendf (&b, "ru_minflt=%ld", ru->ru_minflt);
+		np_strbuf_append (&b, "", 1);
+		np_strbuf_appendf (&b, "ru_majflt=%ld", ru->ru_majflt);
+		np_strbuf_append (&b, "", 1);
+		np_strbuf_appendf (&b, "ru_inblock=%ld", ru->ru_inblock);
+		np_strbuf_append (&b, "", 1);
+		np_strbuf_appendf (&b, "ru_oublock=%ld", ru->ru_oublock);
+		np_strbuf_append (&b, "", 1);
+	}
+	np_strbuf_append (&b, NP_WORKER_DELIM, NP_WORKER_DELIM_LEN);
+
+	if (write_all (sd, np_strbuf_string (&b), b.len) < 0)
+		fprintf (stderr, "%s: %s: %s\n", progname, _("Cannot send a result"), strerror (errno));
+	np_arena_free (&arena);
+}
+
+
+/* the highest descriptor the worker holds, above which an in-process
+ * check's leftovers are closed */
+static int
+worker_high_fd (void)
+{
+	int i, high = max (sd, capture_fd);
+
+	for (i = 0; i < njobs; i++)
+		if (jobs[i].pid)
+			high = max (high, max (jobs[i].fd[0], jobs[i].fd[1]));
+	return high;
+}
+
+
+static int
+write_all (int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		if ((ret = write (fd, buf, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		len -= (size_t) ret;
+	}
+	return 0;
+}
+
+
+static void
+print_help (void)
+{
+	printf ("%s\n", _("Nagios Core 4 worker of the multi-call binary of the plugins"));
+	printf ("\n");
+	printf ("%s\n", _("Usage:"));
+	printf (" %s %s[=QH_SOCKET] [-n NAME] [-j MAX_JOBS] [-p] [QH_SOCKET]\n", "nagios-plugins", NP_WORKER_OPTION);
+	printf (" %s [-n NAME] [-j MAX_JOBS] [-p] QH_SOCKET\n", NP_WORKER_NAME);
+	printf ("\n");
+	printf ("%s\n", _("Connects to the query handler socket of Nagios (query_socket in nagios.cfg)"));
+	printf ("%s\n", _("and runs the check jobs Nagios gives it. Its plugins with a resident mode"));
+	printf ("%s\n", _("run in the worker process, its other plugins in a fork of it, and scripts"));
+	printf ("%s\n", _("and other commands are executed as by the workers of Nagios."));
+	printf ("\n");
+	printf (" %s\n", "-n, --name=NAME");
+	printf ("    %s\n", _("Name to register with (default: nagios-plugins)"));
+	printf (" %s\n", "-j, --max-jobs=INTEGER");
+	printf ("    %s\n", _("Jobs to run in forks at the same time at most (default: 256)"));
+	printf (" %s\n", "-p, --plugins-only");
+	printf ("    %s\n", _("Register for the plugins of the binary only, for Nagios to give the other"));
+	printf ("    %s\n", _("commands to its own workers"));
+}
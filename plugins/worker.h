@@ -0,0 +1,71 @@
+/*****************************************************************************
+*
+* Nagios plugins worker for Nagios Core 4
+*
+* License: GPL
+* Copyright (c) 2014 Nagios Plugins Development Team
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#ifndef NAGIOS_WORKER_H_INCLUDED
+#define NAGIOS_WORKER_H_INCLUDED
+
+/*
+ * "nagios-plugins --worker=QH_SOCKET" (or nagios-plugins-worker) connects
+ * to the query handler socket of Nagios Core 4 and registers with its
+ * wproc handler, to be given check jobs as the workers Core starts itself
+ * are. The plugins of the multi-call binary with a resident mode run
+ * in-process, its other plugins in a fork of the worker without an exec,
+ * and everything else is fork+exec'd, through /bin/sh if it needs a shell.
+ *
+ * The jobs come and go as the pairs key=value of libnagios' kvvec, each
+ * ended by a '\0', with NP_WORKER_DELIM after the last one.
+ */
+
+#define NP_WORKER_NAME "nagios-plugins-worker"
+#define NP_WORKER_OPTION "--worker"
+#define NP_WORKER_DELIM "\1\0\0\0"
+#define NP_WORKER_DELIM_LEN 4
+/* for a job Core gives no timeout */
+#define NP_WORKER_TIMEOUT 60
+#define NP_WORKER_MAX_JOBS 256
+
+/* A plugin of the multi-call binary (multicall.c) */
+typedef struct np_applet {
+	const char *name;
+	int (*main) (int, char **);
+	void (*usage) (void);
+	int resident; /* whether it runs checks again in one process */
+} np_applet;
+
+/* the plugin of this binary that the program at path is, by its name and
+ * symlinks, or NULL */
+const np_applet *np_applet_find (const char *path);
+int np_applet_index (const np_applet *);
+int np_applet_count (void);
+/* the names of the plugins, i < np_applet_count(), then the others they
+ * answer to, up to NULL */
+const char *np_applet_name (int i);
+/* the plugin whose usage print_usage() prints */
+void np_applet_select (const np_applet *);
+
+/* TRUE if the binary was called as the worker */
+int np_worker_requested (const char *name, int argc, char **argv);
+int np_worker_main (int argc, char **argv);
+
+#endif /* NAGIOS_WORKER_H_INCLUDED */
@@ -1,23 +1,42 @@
-/* 
+/*
  *
  *  MINI_EPN.C - Mini Embedded Perl Nagios
  *  Contributed by Stanley Hopcroft
  *  Modified by Douglas Warner
  *
- *  This is a sample mini embedded Perl interpreter (hacked out checks.c and 
- *  perlembed) for use in testing Perl plugins. 
+ *  This is a sample mini embedded Perl interpreter (hacked out checks.c and
+ *  perlembed) for use in testing Perl plugins, and a pool of them that
+ *  serves checks over a socket.
  *
- *  It can be compiled with the following command (see 'man perlembed' for 
+ *  It can be compiled with the following command (see 'man perlembed' for
  *  more info):
  *
  *  gcc -omini_epn mini_epn.c `perl -MExtUtils::Embed -e ccopts -e ldopts`
  *
  *  NOTES:  The compiled binary needs to be in the same directory as the p1.pl
- *  file supplied with Nagios (or vice versa)
+ *  file supplied with Nagios (or vice versa), or be given it with -p
  *  When using mini_epn to test perl scripts, you must place positional
  *  arguments immediately after the file/script and before any arguments
  *  processed by Getopt
  *
+ *  Without options it reads "script args..." lines from stdin and prints
+ *  what each run gave, as it always has. With -s SOCKET it keeps -n
+ *  interpreters alive, each in a worker of its own, that take the same
+ *  lines from connections to the Unix socket and answer each as the
+ *  plugins' resident mode does: "<status> <length>\n" and the output.
+ *
+ *  Every interpreter compiles a script once and keeps the compiled sub
+ *  for as long as the file keeps its path and mtime (see p1.pl), so only
+ *  the first run of a script pays for its compilation. Each run then
+ *  happens in a fork of the worker, which gets the compiled sub for
+ *  nothing and takes whatever the script does to its globals, its exit
+ *  or a timeout (-t) away with it. A worker is replaced after -m
+ *  requests, for scripts that leak in the compiling interpreter.
+ *
+ *  mini_epn -s /var/run/nagios/epn.sock -n 4 -t 60 &
+ *  printf '/usr/local/nagios/libexec/check_file_age.pl -f /etc/passwd\n' |
+ *      socat - UNIX-CONNECT:/var/run/nagios/epn.sock
+ *
  */
 
 
@@ -25,6 +44,13 @@
 #include <perl.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
 /* include PERL xs_init code for module and C library support */
 
@@ -49,7 +75,7 @@ extern "C" {
 #    define EXTERN_C extern
 #  endif
 #endif
- 
+
 
 EXTERN_C void xs_init _((void));
 
@@ -65,86 +91,356 @@ EXTERN_C void xs_init(void)
 }
 
 
+#define COMMAND_LINE_SIZE 8192
+#define MAX_WORKERS 256
+#define STATE_UNKNOWN 3
+
 static PerlInterpreter *perl = NULL;
 
+static char *p1_path = "p1.pl";
+static char *socket_path = NULL;
+static int workers = 4;
+static int max_requests = 1000;
+static int timeout = 0;
+static char tmpfname[64];
+
+static pid_t worker_pids[MAX_WORKERS];
+static volatile sig_atomic_t stopping = 0;
+
+static int start_perl (void);
+static void stop_perl (void);
+static int run_script (char *, char *, char **, size_t *);
+static int serve (void);
+static void worker (int);
+static int reply (int, int, const char *, size_t);
+static void on_signal (int);
+static void on_worker_signal (int);
+
 
 int main(int argc, char **argv, char **env)
 {
-	char *embedding[] = { "", "p1.pl" };
-	char plugin_output[1024];
-	char buffer[512];
-	char tmpfname[32];
-	char fname[32];
-	char *args[] = {"","0", "", "", NULL };
-	FILE *fp;
-
-	const int command_line_size = 160;
-	char command_line[command_line_size];
-	char *ap ;
-	int exitstatus;
-	int pclose_result;
+	char command_line[COMMAND_LINE_SIZE];
+	char *output, *args;
+	size_t len;
+	int c, status;
+
+	while ((c = getopt (argc, argv, "s:n:m:t:p:h")) != -1) {
+		switch (c) {
+		case 's': socket_path = optarg; break;
+		case 'n': workers = atoi (optarg); break;
+		case 'm': max_requests = atoi (optarg); break;
+		case 't': timeout = atoi (optarg); break;
+		case 'p': p1_path = optarg; break;
+		default:
+			printf ("Usage: %s [-p p1.pl] [-s SOCKET [-n WORKERS] [-m REQUESTS]] [-t TIMEOUT]\n", argv[0]);
+			exit (c == 'h' ? 0 : 1);
+		}
+	}
+	if (workers < 1 || workers > MAX_WORKERS) {
+		printf ("Error: -n must be 1 to %d\n", MAX_WORKERS);
+		exit (1);
+	}
+
+	if (socket_path)
+		exit (serve ());
+
+	if (start_perl () != 0)
+		exit (1);
+
+	while(printf("Enter file name: ") && fgets(command_line, sizeof(command_line), stdin)) {
+		command_line[strcspn(command_line, "\n")] = '\0';
+		args = command_line + strcspn(command_line, " ");
+		if (*args)
+			*args++ = '\0';
+
+		status = run_script (command_line, args, &output, &len);
+		printf("embedded perl plugin output was %d,%.*s\n", status,
+		       (int) strcspn (output, "\n"), *output ? output : "(No output!)");
+		free (output);
+	}
+
+	stop_perl ();
+	exit(0);
+}
+
+
+/* an interpreter with p1.pl loaded, and the file it sends output to */
+static int
+start_perl (void)
+{
+	char *embedding[] = { "", p1_path };
+	int fd;
 #ifdef THREADEDPERL
 	dTHX;
 #endif
-	dSP; 
 
 	if ((perl=perl_alloc())==NULL) {
-		snprintf(buffer,sizeof(buffer),"Error: Could not allocate memory for embedded Perl interpreter!\n");
-		buffer[sizeof(buffer)-1]='\x0';
-		printf("%s\n", buffer);
-		exit(1);
+		printf("Error: Could not allocate memory for embedded Perl interpreter!\n");
+		return -1;
 	}
 	perl_construct(perl);
-	exitstatus=perl_parse(perl,xs_init,2,embedding,NULL);
-	if (!exitstatus) {
+	if (perl_parse(perl,xs_init,2,embedding,NULL) != 0 || perl_run(perl) != 0) {
+		printf("Error: Could not load %s\n", p1_path);
+		return -1;
+	}
 
-		exitstatus=perl_run(perl);
+	snprintf (tmpfname, sizeof (tmpfname), "/tmp/embeddedXXXXXX");
+	if ((fd = mkstemp (tmpfname)) < 0) {
+		printf("Error: Could not create a file for the output: %s\n", strerror (errno));
+		return -1;
+	}
+	close (fd);
+	return 0;
+}
 
-		while(printf("Enter file name: ") && fgets(command_line, command_line_size, stdin)) {
 
-			/* call the subroutine, passing it the filename as an argument */
+static void
+stop_perl (void)
+{
+	unlink (tmpfname);
+	PL_perl_destruct_level = 0;
+	perl_destruct(perl);
+	perl_free(perl);
+}
 
-			command_line[strlen(command_line) -1] = '\0';
 
-			strncpy(fname,command_line,strcspn(command_line," "));
-			fname[strcspn(command_line," ")] = '\x0';
-			args[0] = fname ;
-			args[3] = command_line + strlen(fname) + 1 ;
+/* Compile the script unless it is cached already, then run it in a fork
+ * of this process with its output into *output. Returns the exit status
+ * of the script, or STATE_UNKNOWN if it could not be run or timed out. */
+static int
+run_script (char *fname, char *script_args, char **output, size_t *output_len)
+{
+	char *args[] = { fname, "0", tmpfname, script_args, NULL };
+	char msg[1024];
+	struct stat st;
+	pid_t pid;
+	int status, fd, ret;
+	size_t len = 0;
+#ifdef THREADEDPERL
+	dTHX;
+#endif
 
-			/* generate a temporary filename to which stdout can be redirected. */
-			sprintf(tmpfname,"/tmp/embedded%d",getpid());
-			args[2] = tmpfname;
+	*output = NULL;
+	*output_len = 0;
 
-			/* call our perl interpreter to compile and optionally cache the command */
-			perl_call_argv("Embed::Persistent::eval_file", G_DISCARD | G_EVAL, args);
+	/* call our perl interpreter to compile and optionally cache the command */
+	perl_call_argv("Embed::Persistent::eval_file", G_DISCARD | G_EVAL, args);
+	if (SvTRUE(ERRSV)) {
+		snprintf (msg, sizeof (msg), "embedded perl could not compile %s: %s\n", fname, SvPV_nolen(ERRSV));
+		*output = strdup (msg);
+		*output_len = strlen (msg);
+		return STATE_UNKNOWN;
+	}
 
-			perl_call_argv("Embed::Persistent::run_package", G_DISCARD | G_EVAL, args);
-			
-			/* check return status  */
-			if(SvTRUE(ERRSV)){
-				pclose_result=-2;
-				printf("embedded perl ran %s with error %s\n",fname,SvPV(ERRSV,PL_na));
-			}
-			
-			/* read back stdout from script */
-			fp=fopen(tmpfname, "r");
-			
-			/* default return string in case nothing was returned */
-			strcpy(plugin_output,"(No output!)");
-			
-			fgets(plugin_output,sizeof(plugin_output)-1,fp);
-			plugin_output[sizeof(plugin_output)-1]='\x0';
-			fclose(fp);
-			unlink(tmpfname);    
-			printf("embedded perl plugin output was %d,%s\n",pclose_result, plugin_output);
+	fflush (stdout);
+	if ((pid = fork ()) < 0) {
+		snprintf (msg, sizeof (msg), "embedded perl could not fork: %s\n", strerror (errno));
+		*output = strdup (msg);
+		*output_len = strlen (msg);
+		return STATE_UNKNOWN;
+	}
+	if (pid == 0) {
+		dSP;
 
+		signal (SIGTERM, SIG_DFL);
+		signal (SIGCHLD, SIG_DFL);
+		if (timeout)
+			alarm (timeout);
+		ENTER;
+		SAVETMPS;
+		ret = perl_call_argv("Embed::Persistent::run_package", G_SCALAR | G_EVAL, args);
+		SPAGAIN;
+		status = ret == 1 ? POPi : STATE_UNKNOWN;
+		if (SvTRUE(ERRSV)) {
+			printf("embedded perl ran %s with error %s\n", fname, SvPV_nolen(ERRSV));
+			status = STATE_UNKNOWN;
+		}
+		PUTBACK;
+		FREETMPS;
+		LEAVE;
+		fflush (stdout);
+		_exit (status & 0xff);
+	}
+
+	while (waitpid (pid, &status, 0) < 0)
+		if (errno != EINTR) {
+			status = 0;
+			break;
 		}
 
+	/* read back stdout from script */
+	if ((fd = open (tmpfname, O_RDONLY)) >= 0 && fstat (fd, &st) == 0
+	    && (*output = malloc ((size_t) st.st_size + 1)) != NULL) {
+		while (len < (size_t) st.st_size && (ret = read (fd, *output + len, (size_t) st.st_size - len)) > 0)
+			len += (size_t) ret;
+		(*output)[len] = '\0';
 	}
+	if (fd >= 0) {
+		close (fd);
+		truncate (tmpfname, 0);
+	}
+	if (*output == NULL)
+		*output = strdup ("");
+	*output_len = len;
 
-	
-	PL_perl_destruct_level = 0;
-	perl_destruct(perl);
-	perl_free(perl);
-	exit(exitstatus);
+	if (WIFSIGNALED (status)) {
+		snprintf (msg, sizeof (msg), WTERMSIG (status) == SIGALRM
+		          ? "embedded perl timed out running %s after %d seconds\n"
+		          : "embedded perl lost %s to a signal %d\n",
+		          fname, WTERMSIG (status) == SIGALRM ? timeout : WTERMSIG (status));
+		free (*output);
+		*output = strdup (msg);
+		*output_len = strlen (msg);
+		return STATE_UNKNOWN;
+	}
+	return WEXITSTATUS (status);
+}
+
+
+/* the pool: workers on one listening socket, replaced as they exit */
+static int
+serve (void)
+{
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	pid_t pid;
+	int sd, i, status;
+
+	if (strlen (socket_path) >= sizeof (addr.sun_path)) {
+		printf ("Error: socket path %s is too long\n", socket_path);
+		return 1;
+	}
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, socket_path);
+	unlink (socket_path);
+	if ((sd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0
+	    || bind (sd, (struct sockaddr *) &addr, sizeof (addr)) < 0
+	    || listen (sd, 128) < 0) {
+		printf ("Error: cannot listen on %s: %s\n", socket_path, strerror (errno));
+		return 1;
+	}
+
+	memset (&sa, 0, sizeof (sa));
+	sa.sa_handler = on_signal;
+	sigaction (SIGTERM, &sa, NULL);
+	sigaction (SIGINT, &sa, NULL);
+	signal (SIGPIPE, SIG_IGN);
+
+	while (!stopping) {
+		for (i = 0; i < workers; i++) {
+			if (worker_pids[i] > 0)
+				continue;
+			if ((pid = fork ()) == 0)
+				worker (sd);
+			worker_pids[i] = pid;
+		}
+		if ((pid = wait (&status)) < 0) {
+			if (errno != EINTR)
+				break;
+			continue;
+		}
+		for (i = 0; i < workers; i++)
+			if (worker_pids[i] == pid)
+				worker_pids[i] = 0;
+	}
+
+	for (i = 0; i < workers; i++)
+		if (worker_pids[i] > 0)
+			kill (worker_pids[i], SIGTERM);
+	while (wait (&status) > 0 || errno == EINTR)
+		;
+	close (sd);
+	unlink (socket_path);
+	return 0;
+}
+
+
+static void
+on_signal (int sig)
+{
+	stopping = 1;
+}
+
+
+/* a worker being stopped takes its output file with it */
+static void
+on_worker_signal (int sig)
+{
+	unlink (tmpfname);
+	_exit (0);
+}
+
+
+/* one interpreter serving connections until max_requests are done */
+static void
+worker (int sd)
+{
+	char line[COMMAND_LINE_SIZE], *output, *args;
+	size_t len, used;
+	ssize_t ret;
+	int conn, served = 0, status;
+	char *nl;
+
+	signal (SIGTERM, SIG_DFL);
+	signal (SIGINT, SIG_DFL);
+	if (start_perl () != 0)
+		_exit (1);
+	signal (SIGTERM, on_worker_signal);
+	signal (SIGINT, on_worker_signal);
+
+	while (max_requests <= 0 || served < max_requests) {
+		if ((conn = accept (sd, NULL, NULL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		/* one request a line, for as long as the client keeps sending */
+		used = 0;
+		while ((ret = read (conn, line + used, sizeof (line) - used - 1)) > 0) {
+			used += (size_t) ret;
+			line[used] = '\0';
+			while ((nl = strchr (line, '\n')) != NULL) {
+				*nl = '\0';
+				args = line + strcspn (line, " ");
+				if (*args)
+					*args++ = '\0';
+				status = run_script (line, args, &output, &len);
+				ret = reply (conn, status, output, len);
+				free (output);
+				served++;
+				used -= (size_t) (nl + 1 - line);
+				memmove (line, nl + 1, used + 1);
+				if (ret < 0)
+					break;
+			}
+			if (used == sizeof (line) - 1) {
+				reply (conn, STATE_UNKNOWN, "Request too long\n", 17);
+				break;
+			}
+		}
+		close (conn);
+	}
+
+	stop_perl ();
+	_exit (0);
+}
+
+
+static int
+reply (int fd, int status, const char *output, size_t len)
+{
+	char header[64];
+	ssize_t ret;
+	size_t done;
+
+	snprintf (header, sizeof (header), "%d %lu\n", status, (unsigned long) len);
+	for (done = 0; done < strlen (header); done += (size_t) ret)
+		if ((ret = write (fd, header + done, strlen (header) - done)) <= 0)
+			return -1;
+	for (done = 0; done < len; done += (size_t) ret)
+		if ((ret = write (fd, output + done, len - done)) <= 0)
+			return -1;
+	return 0;
 }
@@ -13,6 +13,7 @@
  use strict;
  use vars '%Cache';
  use Symbol qw(delete_package);
+ use Text::ParseWords qw(shellwords);
 
 
 package OutputTrap;
@@ -69,18 +70,22 @@ sub CLOSE {
  sub eval_file {
      my $filename = shift;
      my $delete = shift;
-     my $pn = substr($filename, rindex($filename,"/")+1);
-     my $package = valid_package_name($pn);
-     my $mtime = -M $filename;
+     # by the whole path, so that scripts of the same name don't collide
+     my $package = valid_package_name($filename);
+     my $mtime = (stat $filename)[9];
+     die "stat '$filename' $!" unless defined $mtime;
      if(defined $Cache{$package}{mtime}
         &&
-        $Cache{$package}{mtime} <= $mtime)
+        $Cache{$package}{mtime} == $mtime)
      {
         # we have compiled this subroutine already,
         # it has not been updated on disk, nothing left to do
         #print STDERR "already compiled $package->hndlr\n";
      }
      else {
+        # the old version goes before the new one is compiled
+        delete_package($package) if defined $Cache{$package}{mtime};
+        delete $Cache{$package};
         local *FH;
         open FH, $filename or die "open '$filename' $!";
         local($/) = undef;
@@ -121,13 +126,13 @@ sub CLOSE {
      my $delete = shift;
      my $tmpfname = shift;
      my $ar = shift;
-     my $pn = substr($filename, rindex($filename,"/")+1);
-     my $package = valid_package_name($pn);
+     my $package = valid_package_name($filename);
      my $res = 0;
 
      tie (*STDOUT, 'OutputTrap', $tmpfname);
 
-     my @a = split(/ /,$ar);
+     # arguments are split as a shell would, quotes and all
+     my @a = defined $ar ? shellwords($ar) : ();
      
      eval {$res = $package->hndlr(@a);};
 